@@ -37,9 +37,16 @@
 #include <stddef.h>
 #include <stdint.h>
 #include <string.h>
+#include <limits.h>
 
-/*  Internally, zmq_msg_t structure is cast to this structure. */
+/*  zmq_poll with up to this many items doesn't allocate memory. */
+#define NN_ZMQ_POLL_ITEMS 16
+
+/*  Internally, zmq_msg_t structure is cast to this structure. 'msg' is
+    the nanomsg message, 'data' points to its content. The two differ for
+    messages created by zmq_msg_init_data. */
 struct nn_zmqmsg {
+    void *msg;
     void *data;
     size_t size;
 };
@@ -73,6 +80,7 @@ int zmq_msg_init (zmq_msg_t *msg)
     struct nn_zmqmsg *zmqmsg;
 
     zmqmsg = (struct nn_zmqmsg*) msg;
+    zmqmsg->msg = NULL;
     zmqmsg->data = NULL;
     zmqmsg->size = 0;
     return 0;
@@ -84,15 +92,23 @@ int zmq_msg_init_size (zmq_msg_t *msg, size_t size)
 
     zmqmsg = (struct nn_zmqmsg*) msg;
     zmqmsg->size = size;
-    zmqmsg->data = nn_allocmsg (size, 0);
-    return zmqmsg->data ? 0 : -1;
+    zmqmsg->msg = nn_allocmsg (size, 0);
+    zmqmsg->data = zmqmsg->msg;
+    return zmqmsg->msg ? 0 : -1;
 }
 
 int zmq_msg_init_data (zmq_msg_t *msg, void *data,
     size_t size, zmq_free_fn *ffn, void *hint)
 {
-    errno = ENOTSUP;
-    return -1;
+    struct nn_zmqmsg *zmqmsg;
+
+    /*  The buffer is passed down the stack by reference. 'ffn' is invoked
+        once the last copy of the message is closed or sent. */
+    zmqmsg = (struct nn_zmqmsg*) msg;
+    zmqmsg->size = size;
+    zmqmsg->msg = nn_extmsg (data, size, ffn, hint);
+    zmqmsg->data = data;
+    return zmqmsg->msg ? 0 : -1;
 }
 
 int zmq_msg_close (zmq_msg_t *msg)
@@ -100,9 +116,9 @@ int zmq_msg_close (zmq_msg_t *msg)
     struct nn_zmqmsg *zmqmsg;
 
     zmqmsg = (struct nn_zmqmsg*) msg;
-    if (!zmqmsg->data)
+    if (!zmqmsg->msg)
         return 0;
-    return nn_freemsg (zmqmsg->data);
+    return nn_freemsg (zmqmsg->msg);
 }
 
 int zmq_msg_move (zmq_msg_t *dest, zmq_msg_t *src)
@@ -112,10 +128,13 @@ int zmq_msg_move (zmq_msg_t *dest, zmq_msg_t *src)
 
     zmqdest = (struct nn_zmqmsg*) dest;
     zmqsrc = (struct nn_zmqmsg*) src;
+    zmqdest->msg = zmqsrc->msg;
     zmqdest->data = zmqsrc->data;
     zmqdest->size = zmqsrc->size;
+    zmqsrc->msg = NULL;
     zmqsrc->data = NULL;
     zmqsrc->size = 0;
+    return 0;
 }
 
 int zmq_msg_copy (zmq_msg_t *dest, zmq_msg_t *src)
@@ -123,15 +142,15 @@ int zmq_msg_copy (zmq_msg_t *dest, zmq_msg_t *src)
     struct nn_zmqmsg *zmqdest;
     struct nn_zmqmsg *zmqsrc;
 
-    /*  In nanomsg this functionality is not exposed to the user. Let's do
-        an actual copy of the message instead. */
+    /*  Both messages share the same buffer. It's deallocated once both of
+        them are closed or sent. */
     zmqdest = (struct nn_zmqmsg*) dest;
     zmqsrc = (struct nn_zmqmsg*) src;
-    zmqdest->size = zmqsrc->size;
-    zmqdest->data = nn_allocmsg (zmqdest->size, 0);
-    if (!zmqdest->data)
+    if (zmqsrc->msg && nn_addrefmsg (zmqsrc->msg) < 0)
         return -1;
-    memcpy (zmqdest->data, zmqsrc->data, zmqdest->size);
+    zmqdest->msg = zmqsrc->msg;
+    zmqdest->data = zmqsrc->data;
+    zmqdest->size = zmqsrc->size;
     return 0;
 }
 
@@ -376,9 +395,10 @@ int zmq_send (void *s, zmq_msg_t *msg, int flags)
         nnflags |= NN_DONTWAIT;
 
     zmqmsg = (struct nn_zmqmsg*) msg;
-    rc = nn_send (fd, &zmqmsg->data, NN_MSG, nnflags);
+    rc = nn_send (fd, &zmqmsg->msg, NN_MSG, nnflags);
     if (rc < 0)
         return -1;
+    zmqmsg->msg = NULL;
     zmqmsg->data = NULL;
     zmqmsg->size = 0;
     return 0;
@@ -398,17 +418,66 @@ int zmq_recv (void *s, zmq_msg_t *msg, int flags)
         nnflags |= NN_DONTWAIT;
 
     zmqmsg = (struct nn_zmqmsg*) msg;
-    rc = nn_recv (fd, &zmqmsg->data, NN_MSG, nnflags);
+    rc = nn_recv (fd, &zmqmsg->msg, NN_MSG, nnflags);
     if (rc < 0)
         return -1;
+    zmqmsg->data = zmqmsg->msg;
     zmqmsg->size = rc;
     return 0;
 }
 
 int zmq_poll (zmq_pollitem_t *items, int nitems, long timeout)
 {
-    errno = ENOTSUP;
-    return -1;
+    int rc;
+    int i;
+    struct nn_pollfd fdsbuf [NN_ZMQ_POLL_ITEMS];
+    struct nn_pollfd *fds;
+
+    if (nitems <= NN_ZMQ_POLL_ITEMS)
+        fds = fdsbuf;
+    else {
+        fds = nn_alloc (sizeof (struct nn_pollfd) * nitems, "poll items");
+        if (!fds) {
+            errno = ENOMEM;
+            return -1;
+        }
+    }
+
+    /*  SP sockets and OS-level file descriptors are polled in one go. */
+    for (i = 0; i != nitems; ++i) {
+        fds [i].events = 0;
+        if (items [i].events & ZMQ_POLLIN)
+            fds [i].events |= NN_POLLIN;
+        if (items [i].events & ZMQ_POLLOUT)
+            fds [i].events |= NN_POLLOUT;
+        if (items [i].socket)
+            fds [i].fd = (int) (((uint8_t*) items [i].socket) -
+                ((uint8_t*) 0) - 1);
+        else {
+            fds [i].fd = (int) items [i].fd;
+            fds [i].events |= NN_POLLSYSFD;
+        }
+    }
+
+    /*  In ZeroMQ/2 the timeout is specified in microseconds. */
+    rc = nn_poll (fds, nitems, timeout < 0 ? -1 :
+        timeout / 1000 >= INT_MAX ? INT_MAX : (int) ((timeout + 999) / 1000));
+
+    if (rc >= 0) {
+        for (i = 0; i != nitems; ++i) {
+            items [i].revents = 0;
+            if (fds [i].revents & NN_POLLIN)
+                items [i].revents |= ZMQ_POLLIN;
+            if (fds [i].revents & NN_POLLOUT)
+                items [i].revents |= ZMQ_POLLOUT;
+            if (fds [i].revents & NN_POLLERR)
+                items [i].revents |= ZMQ_POLLERR;
+        }
+    }
+
+    if (fds != fdsbuf)
+        nn_free (fds);
+    return rc;
 }
 
 int zmq_device (int device, void *frontend, void *backend)
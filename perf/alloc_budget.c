@@ -0,0 +1,265 @@
+/*
+    Copyright (c) 2012 250bpm s.r.o.
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"),
+    to deal in the Software without restriction, including without limitation
+    the rights to use, copy, modify, merge, publish, distribute, sublicense,
+    and/or sell copies of the Software, and to permit persons to whom
+    the Software is furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included
+    in all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+    THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+    FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+    IN THE SOFTWARE.
+*/
+
+#include "../src/nn.h"
+#include "../src/pair.h"
+#include "../src/fanout.h"
+#include "../src/pubsub.h"
+#include "../src/reqrep.h"
+#include "../src/survey.h"
+#include "../src/bus.h"
+
+#include "../src/utils/err.c"
+#include "../src/utils/sleep.c"
+
+#include <stddef.h>
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*  Checks that passing messages doesn't allocate memory once the buffers
+    are warm. Every pattern is run over every transport: a number of
+    messages is passed to warm the buffers up, then the allocations done
+    by the library (as reported by nn_allocstats) are counted while passing
+    another batch of messages. The message bodies, which are allocated
+    each time a message is copied, are counted separately. If there are more
+    other allocations per message than the budget allows, the names of
+    the allocations are printed and the program fails.
+
+    Both ends of the connection live in the same thread and the messages are
+    passed one at a time, so that the run is deterministic and the I/O
+    threads' allocations are counted as well. The library has to be built
+    with ALLOC_MONITOR, otherwise the program fails straight away. */
+
+/*  Must not be less than the library's limit on allocation names. */
+#define ALLOC_MAX_TAGS 128
+
+/*  Time given to the sockets to connect (ms). */
+#define ALLOC_SETTLE 100
+
+/*  Allocation name of the message bodies. */
+#define ALLOC_BODY "message chunk"
+
+#define ALLOC_PAIR 0
+#define ALLOC_PIPELINE 1
+#define ALLOC_PUBSUB 2
+#define ALLOC_REQREP 3
+#define ALLOC_SURVEY 4
+#define ALLOC_BUS 5
+
+static const char *alloc_patterns [] = {
+    "pair", "pipeline", "pubsub", "reqrep", "survey", "bus", NULL
+};
+
+static const char *alloc_addrs [] = {
+    "inproc://alloc_budget", "ipc://alloc_budget.ipc",
+    "tcp://127.0.0.1:5590", NULL
+};
+
+/*  Sockets sending and receiving the messages. In the two-way patterns
+    the receiving socket replies via the same socket. */
+static void alloc_sockets (int pattern, int *s1, int *s2)
+{
+    int rc;
+    int deadline;
+
+    switch (pattern) {
+    case ALLOC_PAIR:
+        *s1 = nn_socket (AF_SP, NN_PAIR);
+        *s2 = nn_socket (AF_SP, NN_PAIR);
+        break;
+    case ALLOC_PIPELINE:
+        *s1 = nn_socket (AF_SP, NN_PUSH);
+        *s2 = nn_socket (AF_SP, NN_PULL);
+        break;
+    case ALLOC_PUBSUB:
+        *s1 = nn_socket (AF_SP, NN_PUB);
+        *s2 = nn_socket (AF_SP, NN_SUB);
+        errno_assert (*s2 >= 0);
+        rc = nn_setsockopt (*s2, NN_SUB, NN_SUB_SUBSCRIBE, "", 0);
+        errno_assert (rc == 0);
+        break;
+    case ALLOC_REQREP:
+        *s1 = nn_socket (AF_SP, NN_REQ);
+        *s2 = nn_socket (AF_SP, NN_REP);
+        break;
+    case ALLOC_SURVEY:
+        *s1 = nn_socket (AF_SP, NN_SURVEYOR);
+        errno_assert (*s1 >= 0);
+        deadline = 10000;
+        rc = nn_setsockopt (*s1, NN_SURVEYOR, NN_SURVEYOR_DEADLINE,
+            &deadline, sizeof (deadline));
+        errno_assert (rc == 0);
+        *s2 = nn_socket (AF_SP, NN_RESPONDENT);
+        break;
+    case ALLOC_BUS:
+        *s1 = nn_socket (AF_SP, NN_BUS);
+        *s2 = nn_socket (AF_SP, NN_BUS);
+        break;
+    default:
+        assert (0);
+    }
+    errno_assert (*s1 >= 0);
+    errno_assert (*s2 >= 0);
+}
+
+static void alloc_pass (int pattern, int s1, int s2, char *buf, size_t size,
+    int count)
+{
+    int rc;
+    int i;
+
+    for (i = 0; i != count; ++i) {
+        rc = nn_send (s1, buf, size, 0);
+        errno_assert (rc == (int) size);
+        rc = nn_recv (s2, buf, size, 0);
+        errno_assert (rc == (int) size);
+        if (pattern == ALLOC_REQREP || pattern == ALLOC_SURVEY) {
+            rc = nn_send (s2, buf, size, 0);
+            errno_assert (rc == (int) size);
+            rc = nn_recv (s1, buf, size, 0);
+            errno_assert (rc == (int) size);
+        }
+    }
+}
+
+/*  Fills in the number of allocations done so far per name. */
+static int alloc_snapshot (struct nn_alloc_stat *stats)
+{
+    int rc;
+
+    rc = nn_allocstats (stats, ALLOC_MAX_TAGS);
+    errno_assert (rc >= 0);
+    nn_assert (rc <= ALLOC_MAX_TAGS);
+    return rc;
+}
+
+/*  Returns 1 if the run fits into the budget, 0 otherwise. */
+static int alloc_run (int pattern, const char *addr, size_t size, int warmup,
+    int count, double budget)
+{
+    int rc;
+    int s1;
+    int s2;
+    int i;
+    int nbefore;
+    int nafter;
+    char *buf;
+    unsigned long long bodies;
+    unsigned long long allocs;
+    unsigned long long diff;
+    double permsg;
+    struct nn_alloc_stat before [ALLOC_MAX_TAGS];
+    struct nn_alloc_stat after [ALLOC_MAX_TAGS];
+
+    alloc_sockets (pattern, &s1, &s2);
+    rc = nn_bind (s2, addr);
+    errno_assert (rc >= 0);
+    rc = nn_connect (s1, addr);
+    errno_assert (rc >= 0);
+    nn_sleep (ALLOC_SETTLE);
+
+    buf = malloc (size);
+    alloc_assert (buf);
+    memset (buf, 111, size);
+
+    alloc_pass (pattern, s1, s2, buf, size, warmup);
+    nbefore = alloc_snapshot (before);
+    alloc_pass (pattern, s1, s2, buf, size, count);
+    nafter = alloc_snapshot (after);
+
+    /*  The names are listed in the order they were seen first, so the names
+        seen during the measurement are appended at the end. */
+    bodies = 0;
+    allocs = 0;
+    for (i = 0; i != nafter; ++i) {
+        diff = after [i].allocs - (i < nbefore ? before [i].allocs : 0);
+        if (strcmp (after [i].name, ALLOC_BODY) == 0)
+            bodies += diff;
+        else
+            allocs += diff;
+    }
+    permsg = (double) allocs / count;
+
+    printf ("%s %s: %.3f bodies and %.3f other allocations per message\n",
+        alloc_patterns [pattern], addr, (double) bodies / count, permsg);
+    if (permsg > budget) {
+        for (i = 0; i != nafter; ++i) {
+            diff = after [i].allocs - (i < nbefore ? before [i].allocs : 0);
+            if (diff && strcmp (after [i].name, ALLOC_BODY) != 0)
+                printf ("    %s: %llu\n", after [i].name, diff);
+        }
+    }
+
+    free (buf);
+    rc = nn_close (s2);
+    errno_assert (rc == 0);
+    rc = nn_close (s1);
+    errno_assert (rc == 0);
+
+    return permsg <= budget;
+}
+
+int main (int argc, char *argv [])
+{
+    int rc;
+    int p;
+    int a;
+    int ok;
+    double budget;
+    int size;
+    int count;
+
+    budget = argc > 1 ? atof (argv [1]) : 0.0;
+    size = argc > 2 ? atoi (argv [2]) : 64;
+    count = argc > 3 ? atoi (argv [3]) : 10000;
+    if (argc > 4 || budget < 0 || size <= 0 || count <= 0) {
+        printf ("usage: alloc_budget [allocations-per-message] "
+            "[message-size] [message-count]\n");
+        return 1;
+    }
+
+    rc = nn_allocstats (NULL, 0);
+    if (rc < 0) {
+        printf ("allocation monitoring is not available: %s\n",
+            nn_strerror (nn_errno ()));
+        return 1;
+    }
+
+    printf ("message size: %d [B]\n", size);
+    printf ("message count: %d\n", count);
+
+    ok = 1;
+    for (p = 0; alloc_patterns [p]; ++p)
+        for (a = 0; alloc_addrs [a]; ++a)
+            ok &= alloc_run (p, alloc_addrs [a], size, count / 10 + 1, count,
+                budget);
+
+    nn_term ();
+
+    if (!ok) {
+        printf ("allocation budget of %.3f per message exceeded\n", budget);
+        return 1;
+    }
+    return 0;
+}
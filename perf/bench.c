@@ -0,0 +1,772 @@
+/*
+    Copyright (c) 2012 250bpm s.r.o.
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"),
+    to deal in the Software without restriction, including without limitation
+    the rights to use, copy, modify, merge, publish, distribute, sublicense,
+    and/or sell copies of the Software, and to permit persons to whom
+    the Software is furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included
+    in all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+    THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+    FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+    IN THE SOFTWARE.
+*/
+
+#include "../src/nn.h"
+#include "../src/pair.h"
+#include "../src/fanout.h"
+#include "../src/pubsub.h"
+#include "../src/reqrep.h"
+#include "../src/survey.h"
+#include "../src/bus.h"
+
+#include "../src/utils/err.c"
+#include "../src/utils/thread.c"
+#include "../src/utils/mutex.c"
+#include "../src/utils/sleep.c"
+#include "../src/utils/stopwatch.c"
+
+#include <stddef.h>
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*  Benchmark driver. Runs every combination of the patterns, transports,
+    message sizes, thread counts and socket counts given on the command line
+    and prints one line of results per run, either as CSV or as JSON.
+
+    Each thread has its own sockets. Sending threads spread the messages
+    among their sockets in round-robin fashion, receiving threads wait for
+    messages on all of theirs. Except for REQ/REP, the sending sockets bind
+    and each receiving socket connects to one of them, as PULL, SUB and
+    RESPONDENT sockets talk to a single peer. In the BUS pattern the sending
+    sockets form a mesh and the receiving sockets connect to all of them.
+
+    Patterns that may drop messages (PUB/SUB and BUS) are finished once no
+    message arrives for BENCH_IDLE milliseconds; the time of the last message
+    received is used as the end of the run. */
+
+#define BENCH_MAX_THREADS 64
+#define BENCH_MAX_SOCKETS 16
+#define BENCH_MAX_LIST 16
+
+/*  Receivers check whether the run is over at this interval (ms). */
+#define BENCH_TICK 100
+
+/*  Lossy patterns are finished after this long without a message (ms). */
+#define BENCH_IDLE 500
+
+/*  Time given to the sockets to connect before the run starts (ms). */
+#define BENCH_SETTLE 200
+
+#define BENCH_PAIR 0
+#define BENCH_PIPELINE 1
+#define BENCH_PUBSUB 2
+#define BENCH_REQREP 3
+#define BENCH_SURVEY 4
+#define BENCH_BUS 5
+
+static const char *bench_patterns [] = {
+    "pair", "pipeline", "pubsub", "reqrep", "survey", "bus", NULL
+};
+
+#define BENCH_INPROC 0
+#define BENCH_IPC 1
+#define BENCH_TCP 2
+
+static const char *bench_transports [] = {
+    "inproc", "ipc", "tcp", NULL
+};
+
+/*  Roles of the bound sockets. Used to generate distinct addresses. */
+#define BENCH_ROLE_SENDER 0
+#define BENCH_ROLE_RECEIVER 1
+
+struct bench_run {
+    int pattern;
+    int transport;
+    size_t size;
+    int count;
+    int senders;
+    int receivers;
+    int sockets;
+};
+
+struct bench_worker {
+    struct nn_thread thread;
+    struct bench_run *run;
+    int index;
+    int sender;
+    int s [BENCH_MAX_SOCKETS];
+
+    /*  Number of messages sent, received or round trips completed and
+        the time of the last one, in microseconds since the start. */
+    unsigned long messages;
+    uint64_t finish;
+};
+
+/*  Command line settings. */
+static int port = 5600;
+static int json = 0;
+
+/*  State shared by the threads of a run. */
+static struct nn_stopwatch bench_clock;
+static struct nn_mutex bench_sync;
+static int bench_ready;
+static volatile int bench_go;
+static volatile int bench_done;
+static unsigned long bench_received;
+
+static void bench_addr (char *buf, size_t len, struct bench_run *run,
+    int role, int index)
+{
+    switch (run->transport) {
+    case BENCH_INPROC:
+        snprintf (buf, len, "inproc://bench-%d-%d", role, index);
+        break;
+    case BENCH_IPC:
+        snprintf (buf, len, "ipc://bench-%d-%d.ipc", role, index);
+        break;
+    case BENCH_TCP:
+        snprintf (buf, len, "tcp://127.0.0.1:%d",
+            port + role * BENCH_MAX_THREADS * BENCH_MAX_SOCKETS + index);
+        break;
+    default:
+        assert (0);
+    }
+}
+
+static int bench_socket (struct bench_run *run, int sender)
+{
+    switch (run->pattern) {
+    case BENCH_PAIR:
+        return nn_socket (AF_SP, NN_PAIR);
+    case BENCH_PIPELINE:
+        return nn_socket (AF_SP, sender ? NN_PUSH : NN_PULL);
+    case BENCH_PUBSUB:
+        return nn_socket (AF_SP, sender ? NN_PUB : NN_SUB);
+    case BENCH_REQREP:
+        return nn_socket (AF_SP, sender ? NN_REQ : NN_REP);
+    case BENCH_SURVEY:
+        return nn_socket (AF_SP, sender ? NN_SURVEYOR : NN_RESPONDENT);
+    case BENCH_BUS:
+        return nn_socket (AF_SP, NN_BUS);
+    default:
+        assert (0);
+    }
+    return -1;
+}
+
+/*  Returns 1 if the worker binds its sockets, 0 if it only connects. */
+static int bench_binds (struct bench_run *run, int sender)
+{
+    return run->pattern == BENCH_REQREP ? !sender : sender;
+}
+
+/*  Returns 1 if the receivers reply to the messages. */
+static int bench_replies (struct bench_run *run)
+{
+    return run->pattern == BENCH_REQREP || run->pattern == BENCH_SURVEY;
+}
+
+/*  Number of messages sent via the sending socket with the specified global
+    index, i.e. the index of its thread times sockets per thread plus the
+    index of the socket within the thread. */
+static unsigned long bench_share (struct bench_run *run, int index)
+{
+    return run->count / run->sockets +
+        (index % run->sockets < run->count % run->sockets ? 1 : 0);
+}
+
+/*  Number of receiving sockets connected to the sending socket with the
+    specified global index. */
+static int bench_peers (struct bench_run *run, int index)
+{
+    int nsend;
+    int nrecv;
+
+    nsend = run->senders * run->sockets;
+    nrecv = run->receivers * run->sockets;
+    return nrecv / nsend + (index < nrecv % nsend ? 1 : 0);
+}
+
+static void bench_setup (struct bench_worker *self)
+{
+    int rc;
+    int i;
+    int j;
+    int index;
+    int nsend;
+    int timeo;
+    int deadline;
+    char addr [64];
+    struct bench_run *run;
+
+    run = self->run;
+    nsend = run->senders * run->sockets;
+
+    for (i = 0; i != run->sockets; ++i) {
+        index = self->index * run->sockets + i;
+        self->s [i] = bench_socket (run, self->sender);
+        assert (self->s [i] >= 0);
+        timeo = BENCH_TICK;
+        rc = nn_setsockopt (self->s [i], NN_SOL_SOCKET, NN_RCVTIMEO, &timeo,
+            sizeof (timeo));
+        assert (rc == 0);
+        if (run->pattern == BENCH_PUBSUB && !self->sender) {
+            rc = nn_setsockopt (self->s [i], NN_SUB, NN_SUB_SUBSCRIBE, "", 0);
+            assert (rc == 0);
+        }
+        if (run->pattern == BENCH_SURVEY && self->sender) {
+            deadline = 1000;
+            rc = nn_setsockopt (self->s [i], NN_SURVEYOR,
+                NN_SURVEYOR_DEADLINE, &deadline, sizeof (deadline));
+            assert (rc == 0);
+        }
+
+        if (bench_binds (run, self->sender)) {
+            bench_addr (addr, sizeof (addr), run, self->sender ?
+                BENCH_ROLE_SENDER : BENCH_ROLE_RECEIVER, index);
+            rc = nn_bind (self->s [i], addr);
+            assert (rc >= 0);
+
+            /*  BUS senders connect to the senders bound before them. */
+            if (run->pattern == BENCH_BUS) {
+                for (j = 0; j != index; ++j) {
+                    bench_addr (addr, sizeof (addr), run,
+                        BENCH_ROLE_SENDER, j);
+                    rc = nn_connect (self->s [i], addr);
+                    assert (rc >= 0);
+                }
+            }
+            continue;
+        }
+
+        /*  REQ and BUS sockets connect to all the peers... */
+        if (run->pattern == BENCH_REQREP || run->pattern == BENCH_BUS) {
+            for (j = 0; j != (run->pattern == BENCH_REQREP ?
+                  run->receivers * run->sockets : nsend); ++j) {
+                bench_addr (addr, sizeof (addr), run,
+                    self->sender ? BENCH_ROLE_RECEIVER : BENCH_ROLE_SENDER, j);
+                rc = nn_connect (self->s [i], addr);
+                assert (rc >= 0);
+            }
+            continue;
+        }
+
+        /*  ... the others to a single one. */
+        bench_addr (addr, sizeof (addr), run, BENCH_ROLE_SENDER,
+            index % nsend);
+        rc = nn_connect (self->s [i], addr);
+        assert (rc >= 0);
+    }
+}
+
+/*  Receives a message from any of the worker's sockets. Returns the index of
+    the socket or -1 if nothing arrived within BENCH_TICK milliseconds. */
+static int bench_recv (struct bench_worker *self, void *buf, size_t len)
+{
+    int rc;
+    int i;
+    struct nn_pollfd pfd [BENCH_MAX_SOCKETS];
+
+    if (self->run->sockets == 1) {
+        rc = nn_recv (self->s [0], buf, len, 0);
+        if (rc < 0) {
+            errno_assert (nn_errno () == EAGAIN);
+            return -1;
+        }
+        return 0;
+    }
+
+    for (i = 0; i != self->run->sockets; ++i) {
+        pfd [i].fd = self->s [i];
+        pfd [i].events = NN_POLLIN;
+    }
+    rc = nn_poll (pfd, self->run->sockets, BENCH_TICK);
+    errno_assert (rc >= 0);
+    for (i = 0; i != self->run->sockets; ++i) {
+        if (!(pfd [i].revents & NN_POLLIN))
+            continue;
+        rc = nn_recv (self->s [i], buf, len, NN_DONTWAIT);
+        if (rc >= 0)
+            return i;
+        errno_assert (nn_errno () == EAGAIN);
+    }
+    return -1;
+}
+
+static void bench_sender (struct bench_worker *self)
+{
+    int rc;
+    int i;
+    int j;
+    int responses;
+    int expected;
+    char *buf;
+    struct bench_run *run;
+
+    run = self->run;
+    buf = malloc (run->size);
+    assert (buf);
+    memset (buf, 111, run->size);
+
+    for (i = 0; i != run->count; ++i) {
+        j = i % run->sockets;
+        rc = nn_send (self->s [j], buf, run->size, 0);
+        errno_assert (rc >= 0);
+
+        /*  Wait for the reply or collect the responses to the survey. */
+        if (run->pattern == BENCH_REQREP) {
+            while (1) {
+                rc = nn_recv (self->s [j], buf, run->size, 0);
+                if (rc >= 0)
+                    break;
+                errno_assert (nn_errno () == EAGAIN);
+            }
+        }
+        else if (run->pattern == BENCH_SURVEY) {
+            expected = bench_peers (run, self->index * run->sockets + j);
+            responses = 0;
+            while (responses != expected) {
+                rc = nn_recv (self->s [j], buf, run->size, 0);
+                if (rc >= 0) {
+                    ++responses;
+                    continue;
+                }
+
+                /*  The deadline has expired. */
+                if (nn_errno () != EAGAIN)
+                    break;
+            }
+        }
+        ++self->messages;
+    }
+    self->finish = nn_stopwatch_term (&bench_clock);
+
+    free (buf);
+}
+
+static void bench_receiver (struct bench_worker *self)
+{
+    int rc;
+    int i;
+    int lossy;
+    char *buf;
+    uint64_t last;
+    unsigned long expected;
+    struct bench_run *run;
+
+    run = self->run;
+    buf = malloc (run->size);
+    assert (buf);
+
+    /*  Subscribers get all the messages sent via their publishers, BUS
+        receivers get all the messages sent by all the nodes. */
+    lossy = run->pattern == BENCH_PUBSUB || run->pattern == BENCH_BUS;
+    expected = 0;
+    for (i = 0; i != run->sockets; ++i) {
+        if (run->pattern == BENCH_PUBSUB)
+            expected += bench_share (run, (self->index * run->sockets + i) %
+                (run->senders * run->sockets));
+        if (run->pattern == BENCH_BUS)
+            expected += (unsigned long) run->senders * run->count;
+    }
+
+    last = nn_stopwatch_term (&bench_clock);
+    while (!bench_done) {
+        rc = bench_recv (self, buf, run->size);
+        if (rc < 0) {
+
+            /*  Lossy patterns finish when the messages stop coming. */
+            if (lossy && nn_stopwatch_term (&bench_clock) - last >
+                  BENCH_IDLE * 1000)
+                break;
+            continue;
+        }
+        last = nn_stopwatch_term (&bench_clock);
+
+        /*  Reply to requests and surveys. */
+        if (bench_replies (run)) {
+            rc = nn_send (self->s [rc], buf, run->size, 0);
+            errno_assert (rc >= 0);
+        }
+        ++self->messages;
+        self->finish = last;
+
+        if (lossy && self->messages == expected)
+            break;
+
+        /*  The pipelines finish once all the messages were passed. */
+        if (run->pattern == BENCH_PAIR || run->pattern == BENCH_PIPELINE) {
+            nn_mutex_lock (&bench_sync);
+            if (++bench_received ==
+                  (unsigned long) run->senders * run->count)
+                bench_done = 1;
+            nn_mutex_unlock (&bench_sync);
+        }
+    }
+
+    free (buf);
+}
+
+static void bench_routine (void *arg)
+{
+    int rc;
+    int i;
+    struct bench_worker *self;
+
+    self = (struct bench_worker*) arg;
+
+    bench_setup (self);
+
+    nn_mutex_lock (&bench_sync);
+    ++bench_ready;
+    nn_mutex_unlock (&bench_sync);
+    while (!bench_go)
+        nn_sleep (1);
+
+    if (self->sender)
+        bench_sender (self);
+    else
+        bench_receiver (self);
+
+    /*  In the one-way patterns the senders have to keep the sockets open
+        till all the messages are received. */
+    if (self->sender && !bench_replies (self->run))
+        while (!bench_done)
+            nn_sleep (1);
+
+    for (i = 0; i != self->run->sockets; ++i) {
+        rc = nn_close (self->s [i]);
+        errno_assert (rc == 0);
+    }
+}
+
+static int bench_waitready (int count)
+{
+    int ready;
+
+    while (1) {
+        nn_mutex_lock (&bench_sync);
+        ready = bench_ready;
+        nn_mutex_unlock (&bench_sync);
+        if (ready >= count)
+            return ready;
+        nn_sleep (1);
+    }
+}
+
+static void bench (struct bench_run *run, int first)
+{
+    int i;
+    int nworkers;
+    int nbound;
+    unsigned long sent;
+    unsigned long received;
+    uint64_t elapsed;
+    double throughput;
+    double megabytes;
+    double latency;
+    struct bench_worker *workers;
+    struct bench_worker *worker;
+
+    nworkers = run->senders + run->receivers;
+    workers = calloc (nworkers, sizeof (struct bench_worker));
+    assert (workers);
+
+    bench_ready = 0;
+    bench_go = 0;
+    bench_done = 0;
+    bench_received = 0;
+
+    /*  The binding workers go first, one at a time, so that the connecting
+        sockets find the addresses in place. */
+    nbound = bench_binds (run, 1) ? run->senders : run->receivers;
+    for (i = 0; i != nworkers; ++i) {
+        worker = &workers [i];
+        worker->run = run;
+        worker->sender = bench_binds (run, 1) == (i < nbound);
+        worker->index = i < nbound ? i : i - nbound;
+        nn_thread_init (&worker->thread, bench_routine, worker);
+        if (i < nbound)
+            bench_waitready (i + 1);
+    }
+    bench_waitready (nworkers);
+    nn_sleep (BENCH_SETTLE);
+
+    nn_stopwatch_init (&bench_clock);
+    bench_go = 1;
+
+    /*  Request/reply and surveys are over once the senders are done, the
+        other patterns once the receivers are. */
+    for (i = 0; i != nworkers; ++i)
+        if (workers [i].sender == bench_replies (run))
+            nn_thread_term (&workers [i].thread);
+    bench_done = 1;
+    for (i = 0; i != nworkers; ++i)
+        if (workers [i].sender != bench_replies (run))
+            nn_thread_term (&workers [i].thread);
+
+    /*  Compute the results. */
+    sent = 0;
+    received = 0;
+    elapsed = 0;
+    latency = 0;
+    for (i = 0; i != nworkers; ++i) {
+        worker = &workers [i];
+        if (worker->sender) {
+            sent += worker->messages;
+            if (bench_replies (run)) {
+                received += worker->messages;
+                if (worker->messages)
+                    latency += (double) worker->finish / worker->messages;
+                if (worker->finish > elapsed)
+                    elapsed = worker->finish;
+            }
+        }
+        else if (run->pattern != BENCH_REQREP &&
+              run->pattern != BENCH_SURVEY) {
+            received += worker->messages;
+            if (worker->finish > elapsed)
+                elapsed = worker->finish;
+        }
+    }
+    latency /= run->senders;
+    if (elapsed == 0)
+        elapsed = 1;
+    throughput = (double) received / (double) elapsed * 1000000;
+    megabytes = throughput * run->size / 1000000;
+
+    if (json) {
+        printf ("%s{\"pattern\": \"%s\", \"transport\": \"%s\", "
+            "\"size\": %d, \"count\": %d, \"senders\": %d, "
+            "\"receivers\": %d, \"sockets\": %d, \"sent\": %lu, "
+            "\"received\": %lu, \"elapsed_us\": %lu, \"msg_per_s\": %.0f, "
+            "\"mb_per_s\": %.3f, \"latency_us\": ",
+            first ? "[\n  " : ",\n  ", bench_patterns [run->pattern],
+            bench_transports [run->transport], (int) run->size, run->count,
+            run->senders, run->receivers, run->sockets, sent, received,
+            (unsigned long) elapsed, throughput, megabytes);
+        if (bench_replies (run))
+            printf ("%.3f}", latency);
+        else
+            printf ("null}");
+    }
+    else {
+        if (first)
+            printf ("pattern,transport,size,count,senders,receivers,sockets,"
+                "sent,received,elapsed_us,msg_per_s,mb_per_s,latency_us\n");
+        printf ("%s,%s,%d,%d,%d,%d,%d,%lu,%lu,%lu,%.0f,%.3f,",
+            bench_patterns [run->pattern], bench_transports [run->transport],
+            (int) run->size, run->count, run->senders, run->receivers,
+            run->sockets, sent, received, (unsigned long) elapsed, throughput,
+            megabytes);
+        if (bench_replies (run))
+            printf ("%.3f", latency);
+        printf ("\n");
+    }
+    fflush (stdout);
+
+    free (workers);
+}
+
+/*  Parses a comma-separated list of names. Returns number of items or -1. */
+static int bench_parse_names (char *arg, const char **names, int *list)
+{
+    int n;
+    int i;
+    char *tok;
+
+    n = 0;
+    for (tok = strtok (arg, ","); tok; tok = strtok (NULL, ",")) {
+        for (i = 0; names [i]; ++i)
+            if (strcmp (tok, names [i]) == 0)
+                break;
+        if (!names [i] || n == BENCH_MAX_LIST)
+            return -1;
+        list [n++] = i;
+    }
+    return n;
+}
+
+/*  Parses a comma-separated list of numbers in range [min, max]. Returns
+    number of items or -1. */
+static int bench_parse_ints (char *arg, int min, int max, int *list)
+{
+    int n;
+    char *tok;
+
+    n = 0;
+    for (tok = strtok (arg, ","); tok; tok = strtok (NULL, ",")) {
+        if (n == BENCH_MAX_LIST)
+            return -1;
+        list [n] = atoi (tok);
+        if (list [n] < min || list [n] > max)
+            return -1;
+        ++n;
+    }
+    return n;
+}
+
+static void bench_usage (void)
+{
+    printf ("usage: bench [-p patterns] [-t transports] [-s sizes] "
+        "[-n count]\n"
+        "             [-S senders] [-R receivers] [-c sockets] [-P port] "
+        "[-f csv|json]\n\n"
+        "  -p  pair,pipeline,pubsub,reqrep,survey,bus (default: all)\n"
+        "  -t  inproc,ipc,tcp (default: inproc)\n"
+        "  -s  message sizes in bytes (default: 64)\n"
+        "  -n  messages, requests or surveys per sending thread "
+        "(default: 100000)\n"
+        "  -S  sending threads (default: 1)\n"
+        "  -R  receiving threads (default: 1)\n"
+        "  -c  sockets per thread (default: 1)\n"
+        "  -P  first TCP port to use (default: 5600)\n"
+        "  -f  output format (default: csv)\n\n"
+        "All the lists are comma-separated. Every combination is run, except\n"
+        "that pair runs with a single socket on each side only and pipeline\n"
+        "with at least as many receivers as senders only.\n");
+}
+
+int main (int argc, char *argv [])
+{
+    int i;
+    int p;
+    int t;
+    int s;
+    int ns;
+    int nr;
+    int c;
+    int first;
+    int patterns [BENCH_MAX_LIST];
+    int npatterns;
+    int transports [BENCH_MAX_LIST];
+    int ntransports;
+    int sizes [BENCH_MAX_LIST];
+    int nsizes;
+    int senders [BENCH_MAX_LIST];
+    int nsenders;
+    int receivers [BENCH_MAX_LIST];
+    int nreceivers;
+    int sockets [BENCH_MAX_LIST];
+    int nsockets;
+    int count;
+    struct bench_run run;
+
+    npatterns = 0;
+    while (bench_patterns [npatterns]) {
+        patterns [npatterns] = npatterns;
+        ++npatterns;
+    }
+    transports [0] = BENCH_INPROC;
+    ntransports = 1;
+    sizes [0] = 64;
+    nsizes = 1;
+    senders [0] = 1;
+    nsenders = 1;
+    receivers [0] = 1;
+    nreceivers = 1;
+    sockets [0] = 1;
+    nsockets = 1;
+    count = 100000;
+
+    for (i = 1; i != argc; i += 2) {
+        if (argv [i][0] != '-' || strlen (argv [i]) != 2 || i + 1 == argc) {
+            bench_usage ();
+            return 1;
+        }
+        switch (argv [i][1]) {
+        case 'p':
+            npatterns = bench_parse_names (argv [i + 1], bench_patterns,
+                patterns);
+            break;
+        case 't':
+            ntransports = bench_parse_names (argv [i + 1], bench_transports,
+                transports);
+            break;
+        case 's':
+            nsizes = bench_parse_ints (argv [i + 1], 1, 0x7fffffff, sizes);
+            break;
+        case 'n':
+            count = atoi (argv [i + 1]);
+            break;
+        case 'S':
+            nsenders = bench_parse_ints (argv [i + 1], 1, BENCH_MAX_THREADS,
+                senders);
+            break;
+        case 'R':
+            nreceivers = bench_parse_ints (argv [i + 1], 1,
+                BENCH_MAX_THREADS, receivers);
+            break;
+        case 'c':
+            nsockets = bench_parse_ints (argv [i + 1], 1, BENCH_MAX_SOCKETS,
+                sockets);
+            break;
+        case 'P':
+            port = atoi (argv [i + 1]);
+            break;
+        case 'f':
+            if (strcmp (argv [i + 1], "csv") == 0)
+                json = 0;
+            else if (strcmp (argv [i + 1], "json") == 0)
+                json = 1;
+            else
+                npatterns = -1;
+            break;
+        default:
+            npatterns = -1;
+        }
+        if (npatterns <= 0 || ntransports <= 0 || nsizes <= 0 ||
+              nsenders <= 0 || nreceivers <= 0 || nsockets <= 0 ||
+              count <= 0 || port <= 0) {
+            bench_usage ();
+            return 1;
+        }
+    }
+
+    nn_mutex_init (&bench_sync);
+
+    first = 1;
+    for (p = 0; p != npatterns; ++p)
+    for (t = 0; t != ntransports; ++t)
+    for (s = 0; s != nsizes; ++s)
+    for (ns = 0; ns != nsenders; ++ns)
+    for (nr = 0; nr != nreceivers; ++nr)
+    for (c = 0; c != nsockets; ++c) {
+        run.pattern = patterns [p];
+        run.transport = transports [t];
+        run.size = sizes [s];
+        run.count = count;
+        run.senders = senders [ns];
+        run.receivers = receivers [nr];
+        run.sockets = sockets [c];
+
+        /*  PAIR connects exactly two sockets. PUSH sockets block without
+            a peer, so each of them needs at least one PULL socket. */
+        if (run.pattern == BENCH_PAIR && (run.senders != 1 ||
+              run.receivers != 1 || run.sockets != 1))
+            continue;
+        if (run.pattern == BENCH_PIPELINE && run.receivers < run.senders)
+            continue;
+
+        bench (&run, first);
+        first = 0;
+    }
+    if (json && !first)
+        printf ("\n]\n");
+
+    nn_mutex_term (&bench_sync);
+
+    return 0;
+}
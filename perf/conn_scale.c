@@ -0,0 +1,352 @@
+/*
+    Copyright (c) 2012 250bpm s.r.o.
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"),
+    to deal in the Software without restriction, including without limitation
+    the rights to use, copy, modify, merge, publish, distribute, sublicense,
+    and/or sell copies of the Software, and to permit persons to whom
+    the Software is furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included
+    in all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+    THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+    FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+    IN THE SOFTWARE.
+*/
+
+#include "../src/nn.h"
+#include "../src/pubsub.h"
+#include "../src/reqrep.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+
+#include "../src/utils/err.c"
+#include "../src/utils/thread.c"
+#include "../src/utils/sleep.c"
+#include "../src/utils/stopwatch.c"
+
+/*  Connection-scale benchmark. Opens many connections to a single bound
+    socket within one process and measures the connect rate, the memory used
+    per connection, the throughput once all of them are established and the
+    CPU used while they are idle.
+
+    With "pubsub" the bound socket is PUB and each connection comes from
+    a separate SUB socket, with "reqrep" the bound socket is REP and the
+    connections come from REQ sockets. The connecting sockets share the
+    completion ports (see NN_CP_THREADS) rather than having a thread each.
+
+    The number of TCP connections to a single address is limited by the
+    range of ephemeral ports. If the socket is bound to all the interfaces
+    (an asterisk in place of the interface), the connections are spread
+    among 127.0.0.1-254 to get around that. */
+
+#define CONN_PUBSUB 1
+#define CONN_REQREP 2
+
+/*  Number of times per second the connect phase checks for completion. */
+#define CONN_CHECK 100
+
+/*  Request resend interval while connecting and once connected (ms). */
+#define CONN_RESEND_IVL 100
+#define CONN_RESEND_IVL_STEADY 60000
+
+static int conn_pattern;
+static int conn_bound;
+static volatile int conn_stop;
+
+/*  Returns memory used by the process in kB. The peak is used as that's what
+    getrusage reports portably; it only grows while the connections are being
+    established anyway. */
+static long conn_memory (void)
+{
+    int rc;
+    struct rusage usage;
+
+    rc = getrusage (RUSAGE_SELF, &usage);
+    errno_assert (rc == 0);
+#if defined __APPLE__
+    return usage.ru_maxrss / 1024;
+#else
+    return usage.ru_maxrss;
+#endif
+}
+
+/*  Returns CPU time (user and system) used by the process in microseconds. */
+static uint64_t conn_cpu (void)
+{
+    int rc;
+    struct rusage usage;
+
+    rc = getrusage (RUSAGE_SELF, &usage);
+    errno_assert (rc == 0);
+    return (uint64_t) (usage.ru_utime.tv_sec + usage.ru_stime.tv_sec) *
+        1000000 + usage.ru_utime.tv_usec + usage.ru_stime.tv_usec;
+}
+
+/*  Returns number of subscribers attached to the PUB socket. */
+static int conn_subscribers (void)
+{
+    int rc;
+    size_t sz;
+    struct nn_pub_pipe_stats stats;
+
+    /*  The size needed for all the entries is reported back. */
+    sz = sizeof (stats);
+    rc = nn_getsockopt (conn_bound, NN_PUB, NN_PUB_PIPE_STATS, &stats, &sz);
+    errno_assert (rc == 0);
+    return (int) (sz / sizeof (struct nn_pub_pipe_stats));
+}
+
+/*  Echoes the requests till asked to stop. */
+static void conn_server (void *arg)
+{
+    int nbytes;
+    void *buf;
+
+    while (!conn_stop) {
+        nbytes = nn_recv (conn_bound, &buf, NN_MSG, 0);
+        if (nbytes < 0) {
+            errno_assert (nn_errno () == EAGAIN || nn_errno () == ETERM);
+            continue;
+        }
+        nbytes = nn_send (conn_bound, &buf, NN_MSG, 0);
+        errno_assert (nbytes >= 0);
+    }
+}
+
+/*  Receives whatever is waiting on the connecting sockets. Returns number
+    of messages received. Each socket that got a reply to its request sends
+    another one if 'again' is set. */
+static int conn_drain (int *socks, int n, char *buf, size_t sz, int again)
+{
+    int rc;
+    int i;
+    int received;
+
+    received = 0;
+    for (i = 0; i != n; ++i) {
+        while (1) {
+            rc = nn_recv (socks [i], buf, sz, NN_DONTWAIT);
+
+            /*  EFSM means the REQ socket has no request outstanding. */
+            if (rc < 0) {
+                errno_assert (nn_errno () == EAGAIN ||
+                    nn_errno () == EFSM);
+                break;
+            }
+            ++received;
+            if (conn_pattern == CONN_REQREP) {
+                if (again) {
+                    rc = nn_send (socks [i], buf, sz, 0);
+                    errno_assert (rc >= 0);
+                }
+                break;
+            }
+        }
+    }
+    return received;
+}
+
+int main (int argc, char *argv [])
+{
+    const char *bind_to;
+    char connect_to [128];
+    const char *port;
+    int n;
+    size_t sz;
+    int seconds;
+    int *socks;
+    char *buf;
+    int rc;
+    int i;
+    int timeo;
+    int ivl;
+    int connected;
+    long mem;
+    uint64_t elapsed;
+    uint64_t cpu;
+    unsigned long long total;
+    struct rlimit rl;
+    struct nn_thread server;
+    struct nn_stopwatch sw;
+
+    if (argc < 3 || argc > 6) {
+        printf ("usage: conn_scale <bind-to> <connections> [pubsub|reqrep] "
+            "[<msg-size>] [<seconds>]\n");
+        return 1;
+    }
+    bind_to = argv [1];
+    n = atoi (argv [2]);
+    conn_pattern = CONN_PUBSUB;
+    if (argc > 3 && strcmp (argv [3], "reqrep") == 0)
+        conn_pattern = CONN_REQREP;
+    else if (argc > 3 && strcmp (argv [3], "pubsub") != 0) {
+        printf ("unknown pattern: %s\n", argv [3]);
+        return 1;
+    }
+    sz = argc > 4 ? atoi (argv [4]) : 64;
+    seconds = argc > 5 ? atoi (argv [5]) : 5;
+    assert (n > 0 && sz > 0 && seconds > 0);
+
+    /*  Each connection needs a few file descriptors on both ends. */
+    rc = getrlimit (RLIMIT_NOFILE, &rl);
+    errno_assert (rc == 0);
+    rl.rlim_cur = rl.rlim_max;
+    rc = setrlimit (RLIMIT_NOFILE, &rl);
+    errno_assert (rc == 0);
+
+    /*  Don't start a thread per socket. */
+    setenv ("NN_CP_THREADS", "0", 0);
+
+    socks = malloc (n * sizeof (int));
+    assert (socks);
+    buf = malloc (sz);
+    assert (buf);
+    memset (buf, 111, sz);
+
+    conn_bound = nn_socket (AF_SP, conn_pattern == CONN_PUBSUB ?
+        NN_PUB : NN_REP);
+    assert (conn_bound >= 0);
+    rc = nn_bind (conn_bound, bind_to);
+    assert (rc >= 0);
+    if (conn_pattern == CONN_REQREP) {
+        timeo = 100;
+        rc = nn_setsockopt (conn_bound, NN_SOL_SOCKET, NN_RCVTIMEO, &timeo,
+            sizeof (timeo));
+        assert (rc == 0);
+        nn_thread_init (&server, conn_server, NULL);
+    }
+
+    /*  Connect phase. It's over once the PUB socket has all the subscribers
+        attached or once each REQ socket got a reply to its first request. */
+    mem = conn_memory ();
+    nn_stopwatch_init (&sw);
+    port = strncmp (bind_to, "tcp://*:", 8) == 0 ? bind_to + 8 : NULL;
+    for (i = 0; i != n; ++i) {
+        socks [i] = nn_socket (AF_SP, conn_pattern == CONN_PUBSUB ?
+            NN_SUB : NN_REQ);
+        if (socks [i] < 0) {
+            printf ("failed to open socket #%d: %s\n", i,
+                nn_strerror (nn_errno ()));
+            return 1;
+        }
+        if (conn_pattern == CONN_PUBSUB) {
+            rc = nn_setsockopt (socks [i], NN_SUB, NN_SUB_SUBSCRIBE, "", 0);
+            assert (rc == 0);
+        }
+
+        /*  A request is lost if the connection it was sent to fails during
+            the handshake, which does happen with many connections being
+            established at once. Resend it soon so that the connect time is
+            not dominated by the resend interval. */
+        if (conn_pattern == CONN_REQREP) {
+            ivl = CONN_RESEND_IVL;
+            rc = nn_setsockopt (socks [i], NN_REQ, NN_REQ_RESEND_IVL, &ivl,
+                sizeof (ivl));
+            assert (rc == 0);
+        }
+        if (port)
+            sprintf (connect_to, "tcp://127.0.0.%d:%s", 1 + i % 254, port);
+        else
+            sprintf (connect_to, "%s", bind_to);
+        rc = nn_connect (socks [i], connect_to);
+        assert (rc >= 0);
+        if (conn_pattern == CONN_REQREP) {
+            rc = nn_send (socks [i], buf, sz, 0);
+            errno_assert (rc >= 0);
+        }
+    }
+    connected = 0;
+    while (connected != n) {
+        nn_sleep (1000 / CONN_CHECK);
+        if (conn_pattern == CONN_PUBSUB)
+            connected = conn_subscribers ();
+        else
+            connected += conn_drain (socks, n, buf, sz, 0);
+    }
+    elapsed = nn_stopwatch_term (&sw);
+    mem = conn_memory () - mem;
+    if (conn_pattern == CONN_REQREP) {
+        for (i = 0; i != n; ++i) {
+            ivl = CONN_RESEND_IVL_STEADY;
+            rc = nn_setsockopt (socks [i], NN_REQ, NN_REQ_RESEND_IVL, &ivl,
+                sizeof (ivl));
+            assert (rc == 0);
+        }
+    }
+
+    printf ("connections: %d\n", n);
+    printf ("connect time: %.3f [s]\n", (double) elapsed / 1000000);
+    printf ("connect rate: %.0f [conn/s]\n",
+        (double) n * 1000000 / elapsed);
+    printf ("memory per connection: %.1f [kB] (both ends)\n",
+        (double) mem / n);
+
+    /*  Steady state. PUB sends the messages in bursts small enough not to
+        overflow the subscribers' buffers, REQ sockets keep a request each in
+        flight. */
+    total = 0;
+    nn_stopwatch_init (&sw);
+    if (conn_pattern == CONN_REQREP) {
+        for (i = 0; i != n; ++i) {
+            rc = nn_send (socks [i], buf, sz, 0);
+            errno_assert (rc >= 0);
+        }
+    }
+    while (nn_stopwatch_term (&sw) < (uint64_t) seconds * 1000000) {
+        if (conn_pattern == CONN_PUBSUB) {
+            for (i = 0; i != 10; ++i) {
+                rc = nn_send (conn_bound, buf, sz, 0);
+                errno_assert (rc >= 0);
+            }
+        }
+        total += conn_drain (socks, n, buf, sz, 1);
+    }
+    elapsed = nn_stopwatch_term (&sw);
+
+    /*  Collect the messages still on the way so that the sockets are idle
+        in the next phase. */
+    for (i = 0; i != 10; ++i) {
+        nn_sleep (10);
+        total += conn_drain (socks, n, buf, sz, 0);
+    }
+    printf ("message size: %d [B]\n", (int) sz);
+    printf ("%s: %.0f [msg/s]\n", conn_pattern == CONN_PUBSUB ?
+        "messages delivered" : "roundtrips", (double) total * 1000000 /
+        elapsed);
+
+    /*  Idle phase. Nothing is being sent, any CPU used is the overhead of
+        keeping the connections open. */
+    cpu = conn_cpu ();
+    nn_stopwatch_init (&sw);
+    nn_sleep (seconds * 1000);
+    elapsed = nn_stopwatch_term (&sw);
+    cpu = conn_cpu () - cpu;
+    printf ("idle CPU: %.2f [%%]\n", (double) cpu * 100 / elapsed);
+
+    conn_stop = 1;
+    for (i = 0; i != n; ++i) {
+        rc = nn_close (socks [i]);
+        assert (rc == 0);
+    }
+    if (conn_pattern == CONN_REQREP)
+        nn_thread_term (&server);
+    rc = nn_close (conn_bound);
+    assert (rc == 0);
+
+    free (buf);
+    free (socks);
+
+    return 0;
+}
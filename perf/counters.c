@@ -0,0 +1,172 @@
+/*
+    Copyright (c) 2012 250bpm s.r.o.
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"),
+    to deal in the Software without restriction, including without limitation
+    the rights to use, copy, modify, merge, publish, distribute, sublicense,
+    and/or sell copies of the Software, and to permit persons to whom
+    the Software is furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included
+    in all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+    THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+    FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+    IN THE SOFTWARE.
+*/
+
+/*  Hardware performance counters for the perf tools. The counters are read
+    around the measured loop only and are reported per message, so that the
+    effect of layout changes in the library's data structures can be seen
+    directly. They are off by default; set NN_PERF_COUNTERS in the
+    environment to turn them on. Only the calling thread is counted.
+    On systems other than Linux, or when perf_event_open() is not permitted
+    (see /proc/sys/kernel/perf_event_paranoid), nothing is reported. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#define COUNTERS_MAX 4
+
+struct counters {
+    int fds [COUNTERS_MAX];
+    uint64_t values [COUNTERS_MAX];
+};
+
+static const char *counters_names [COUNTERS_MAX] = {
+    "cycles", "instructions", "cache misses", "branch misses"
+};
+
+#if defined NN_HAVE_LINUX
+
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+
+static const uint64_t counters_configs [COUNTERS_MAX] = {
+    PERF_COUNT_HW_CPU_CYCLES,
+    PERF_COUNT_HW_INSTRUCTIONS,
+    PERF_COUNT_HW_CACHE_MISSES,
+    PERF_COUNT_HW_BRANCH_MISSES
+};
+
+static void counters_init (struct counters *self)
+{
+    int i;
+    struct perf_event_attr attr;
+
+    for (i = 0; i != COUNTERS_MAX; ++i) {
+        self->fds [i] = -1;
+        self->values [i] = 0;
+    }
+    if (!getenv ("NN_PERF_COUNTERS"))
+        return;
+
+    for (i = 0; i != COUNTERS_MAX; ++i) {
+        memset (&attr, 0, sizeof (attr));
+        attr.type = PERF_TYPE_HARDWARE;
+        attr.size = sizeof (attr);
+        attr.config = counters_configs [i];
+        attr.disabled = 1;
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        self->fds [i] = (int) syscall (__NR_perf_event_open, &attr, 0, -1,
+            -1, 0);
+        if (self->fds [i] < 0)
+            fprintf (stderr, "perf counters: %s not available\n",
+                counters_names [i]);
+    }
+}
+
+static void counters_start (struct counters *self)
+{
+    int i;
+
+    for (i = 0; i != COUNTERS_MAX; ++i) {
+        if (self->fds [i] < 0)
+            continue;
+        ioctl (self->fds [i], PERF_EVENT_IOC_RESET, 0);
+        ioctl (self->fds [i], PERF_EVENT_IOC_ENABLE, 0);
+    }
+}
+
+static void counters_stop (struct counters *self)
+{
+    int i;
+    uint64_t value;
+
+    for (i = 0; i != COUNTERS_MAX; ++i) {
+        if (self->fds [i] < 0)
+            continue;
+        ioctl (self->fds [i], PERF_EVENT_IOC_DISABLE, 0);
+        if (read (self->fds [i], &value, sizeof (value)) == sizeof (value))
+            self->values [i] = value;
+    }
+}
+
+static void counters_term (struct counters *self)
+{
+    int i;
+
+    for (i = 0; i != COUNTERS_MAX; ++i) {
+        if (self->fds [i] >= 0)
+            close (self->fds [i]);
+        self->fds [i] = -1;
+    }
+}
+
+#else
+
+static void counters_init (struct counters *self)
+{
+    int i;
+
+    for (i = 0; i != COUNTERS_MAX; ++i) {
+        self->fds [i] = -1;
+        self->values [i] = 0;
+    }
+    if (getenv ("NN_PERF_COUNTERS"))
+        fprintf (stderr, "perf counters: not supported on this platform\n");
+}
+
+static void counters_start (struct counters *self)
+{
+}
+
+static void counters_stop (struct counters *self)
+{
+}
+
+static void counters_term (struct counters *self)
+{
+}
+
+#endif
+
+/*  Prints the counters divided by the number of messages (or whatever unit
+    is specified), plus the instructions per cycle if both are available. */
+static void counters_report (struct counters *self, uint64_t count,
+    const char *unit)
+{
+    int i;
+
+    if (count == 0)
+        count = 1;
+    for (i = 0; i != COUNTERS_MAX; ++i) {
+        if (self->fds [i] < 0)
+            continue;
+        printf ("%s: %.2f [per %s]\n", counters_names [i],
+            (double) self->values [i] / count, unit);
+    }
+    if (self->fds [0] >= 0 && self->fds [1] >= 0 && self->values [0] != 0)
+        printf ("instructions per cycle: %.2f\n",
+            (double) self->values [1] / self->values [0]);
+}
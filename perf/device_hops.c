@@ -0,0 +1,365 @@
+/*
+    Copyright (c) 2012 250bpm s.r.o.
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"),
+    to deal in the Software without restriction, including without limitation
+    the rights to use, copy, modify, merge, publish, distribute, sublicense,
+    and/or sell copies of the Software, and to permit persons to whom
+    the Software is furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included
+    in all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+    THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+    FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+    IN THE SOFTWARE.
+*/
+
+#include "../src/nn.h"
+#include "../src/pair.h"
+#include "../src/fanout.h"
+#include "../src/reqrep.h"
+
+#include "../src/utils/err.c"
+#include "../src/utils/thread.c"
+#include "../src/utils/sleep.c"
+#include "../src/utils/stopwatch.c"
+
+#include <stddef.h>
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*  Measures the cost of forwarding messages through devices. The messages
+    travel from the client socket through a chain of devices to the server
+    socket:
+
+        client -> device 1 -> ... -> device N -> server
+
+    Each device runs nn_device() in a thread of its own, its front socket
+    being bound and its back socket connected to the next device's front
+    socket or to the server socket.
+
+    The same measurement is done first with the client connected directly to
+    the server and then through the chain, so that the latency added by each
+    hop can be computed. Latency is measured as the mean roundtrip of
+    a message: a reply for REQ/REP, the message sent back via the same chain
+    for PAIR and an acknowledgement sent via a direct connection for
+    PUSH/PULL, which has no way back. Throughput is measured by streaming
+    the messages in one direction for PAIR and PUSH/PULL; for REQ/REP it is
+    the number of roundtrips per second.
+
+    PUB/SUB has no raw sockets and thus can't be forwarded by nn_device();
+    PUSH/PULL stands in for the one-way patterns. */
+
+#define DEVICE_MAX_HOPS 64
+
+/*  Time given to the sockets to connect (ms). */
+#define DEVICE_SETTLE 200
+
+/*  First TCP port to use. */
+#define DEVICE_PORT 5700
+
+#define DEVICE_PAIR 0
+#define DEVICE_REQREP 1
+#define DEVICE_PIPELINE 2
+
+static const char *device_patterns [] = {
+    "pair", "reqrep", "pipeline", NULL
+};
+
+#define DEVICE_INPROC 0
+#define DEVICE_IPC 1
+#define DEVICE_TCP 2
+
+static const char *device_transports [] = {
+    "inproc", "ipc", "tcp", NULL
+};
+
+struct device_run {
+    int hops;
+
+    /*  Index of the first address used by the run. */
+    int base;
+
+    /*  Server socket and, for PUSH/PULL, the server's end of the direct
+        connection used to acknowledge the messages. */
+    int server;
+    int ack;
+
+    /*  Streaming results as seen by the server thread. */
+    unsigned long received;
+    uint64_t finish;
+};
+
+/*  Command line settings. */
+static int pattern;
+static int transport;
+static size_t size;
+static int count;
+
+static struct nn_stopwatch device_clock;
+
+/*  The devices run till the end of the program. */
+static int device_sockets [DEVICE_MAX_HOPS][2];
+static struct nn_thread device_threads [DEVICE_MAX_HOPS];
+
+static void device_addr (char *buf, size_t len, int index)
+{
+    switch (transport) {
+    case DEVICE_INPROC:
+        snprintf (buf, len, "inproc://device-%d", index);
+        break;
+    case DEVICE_IPC:
+        snprintf (buf, len, "ipc://device-%d.ipc", index);
+        break;
+    case DEVICE_TCP:
+        snprintf (buf, len, "tcp://127.0.0.1:%d", DEVICE_PORT + index);
+        break;
+    default:
+        assert (0);
+    }
+}
+
+static void device_routine (void *arg)
+{
+    int rc;
+    int *s;
+
+    s = (int*) arg;
+
+    rc = nn_device (s [0], s [1]);
+    nn_assert (rc < 0 && nn_errno () == ETERM);
+
+    rc = nn_close (s [1]);
+    errno_assert (rc == 0);
+    rc = nn_close (s [0]);
+    errno_assert (rc == 0);
+}
+
+static void server_routine (void *arg)
+{
+    int rc;
+    int i;
+    char *buf;
+    struct device_run *run;
+
+    run = (struct device_run*) arg;
+    buf = malloc (size);
+    assert (buf);
+
+    /*  Answer the roundtrips. */
+    for (i = 0; i != count; ++i) {
+        rc = nn_recv (run->server, buf, size, 0);
+        errno_assert (rc >= 0);
+        rc = nn_send (pattern == DEVICE_PIPELINE ? run->ack : run->server,
+            buf, pattern == DEVICE_PIPELINE ? 1 : size, 0);
+        errno_assert (rc >= 0);
+    }
+
+    /*  Receive the stream. */
+    if (pattern != DEVICE_REQREP) {
+        while (run->received != (unsigned long) count) {
+            rc = nn_recv (run->server, buf, size, 0);
+            errno_assert (rc >= 0);
+            run->finish = nn_stopwatch_term (&device_clock);
+            ++run->received;
+        }
+    }
+
+    free (buf);
+}
+
+/*  Runs the measurement. Returns mean roundtrip in microseconds and fills
+    in the throughput in messages per second. */
+static double device_measure (struct device_run *run, double *throughput)
+{
+    int rc;
+    int i;
+    int client;
+    int ack;
+    int (*s) [2];
+    char addr [64];
+    char *buf;
+    uint64_t elapsed;
+    double roundtrip;
+    struct nn_thread server;
+
+    /*  The server socket is bound at the end of the chain. */
+    run->server = nn_socket (AF_SP, pattern == DEVICE_PAIR ? NN_PAIR :
+        pattern == DEVICE_REQREP ? NN_REP : NN_PULL);
+    errno_assert (run->server >= 0);
+    device_addr (addr, sizeof (addr), run->base + run->hops);
+    rc = nn_bind (run->server, addr);
+    errno_assert (rc >= 0);
+
+    /*  Build the chain of devices from its end. */
+    s = device_sockets;
+    for (i = run->hops - 1; i >= 0; --i) {
+        s [i][0] = nn_socket (AF_SP_RAW, pattern == DEVICE_PAIR ? NN_PAIR :
+            pattern == DEVICE_REQREP ? NN_REP : NN_PULL);
+        errno_assert (s [i][0] >= 0);
+        device_addr (addr, sizeof (addr), run->base + i);
+        rc = nn_bind (s [i][0], addr);
+        errno_assert (rc >= 0);
+        s [i][1] = nn_socket (AF_SP_RAW, pattern == DEVICE_PAIR ? NN_PAIR :
+            pattern == DEVICE_REQREP ? NN_REQ : NN_PUSH);
+        errno_assert (s [i][1] >= 0);
+        device_addr (addr, sizeof (addr), run->base + i + 1);
+        rc = nn_connect (s [i][1], addr);
+        errno_assert (rc >= 0);
+        nn_thread_init (&device_threads [i], device_routine, s [i]);
+    }
+
+    client = nn_socket (AF_SP, pattern == DEVICE_PAIR ? NN_PAIR :
+        pattern == DEVICE_REQREP ? NN_REQ : NN_PUSH);
+    errno_assert (client >= 0);
+    device_addr (addr, sizeof (addr), run->base);
+    rc = nn_connect (client, addr);
+    errno_assert (rc >= 0);
+
+    /*  PULL sockets have no way back, so the server acknowledges
+        the messages via a direct connection. */
+    ack = -1;
+    run->ack = -1;
+    if (pattern == DEVICE_PIPELINE) {
+        ack = nn_socket (AF_SP, NN_PAIR);
+        errno_assert (ack >= 0);
+        device_addr (addr, sizeof (addr), run->base + run->hops + 1);
+        rc = nn_bind (ack, addr);
+        errno_assert (rc >= 0);
+        run->ack = nn_socket (AF_SP, NN_PAIR);
+        errno_assert (run->ack >= 0);
+        rc = nn_connect (run->ack, addr);
+        errno_assert (rc >= 0);
+    }
+
+    nn_sleep (DEVICE_SETTLE);
+
+    run->received = 0;
+    run->finish = 0;
+    nn_thread_init (&server, server_routine, run);
+
+    buf = malloc (size);
+    assert (buf);
+    memset (buf, 111, size);
+
+    /*  Measure the roundtrips. */
+    nn_stopwatch_init (&device_clock);
+    for (i = 0; i != count; ++i) {
+        rc = nn_send (client, buf, size, 0);
+        errno_assert (rc >= 0);
+        rc = nn_recv (pattern == DEVICE_PIPELINE ? ack : client, buf, size, 0);
+        errno_assert (rc >= 0);
+    }
+    elapsed = nn_stopwatch_term (&device_clock);
+    if (elapsed == 0)
+        elapsed = 1;
+    roundtrip = (double) elapsed / count;
+
+    /*  Measure the stream. */
+    if (pattern == DEVICE_REQREP)
+        *throughput = (double) count / elapsed * 1000000;
+    else {
+        nn_stopwatch_init (&device_clock);
+        for (i = 0; i != count; ++i) {
+            rc = nn_send (client, buf, size, 0);
+            errno_assert (rc >= 0);
+        }
+    }
+    nn_thread_term (&server);
+    if (pattern != DEVICE_REQREP)
+        *throughput = run->finish ?
+            (double) run->received / run->finish * 1000000 : 0;
+
+    free (buf);
+
+    if (ack >= 0) {
+        rc = nn_close (run->ack);
+        errno_assert (rc == 0);
+        rc = nn_close (ack);
+        errno_assert (rc == 0);
+    }
+    rc = nn_close (client);
+    errno_assert (rc == 0);
+    rc = nn_close (run->server);
+    errno_assert (rc == 0);
+
+    return roundtrip;
+}
+
+static int device_parse_name (const char *arg, const char **names)
+{
+    int i;
+
+    for (i = 0; names [i]; ++i)
+        if (strcmp (arg, names [i]) == 0)
+            return i;
+    return -1;
+}
+
+int main (int argc, char *argv [])
+{
+    int hops;
+    int i;
+    struct device_run direct;
+    struct device_run chain;
+    double direct_thr;
+    double chain_thr;
+    double direct_rtt;
+    double chain_rtt;
+    double added;
+
+    if (argc == 6) {
+        pattern = device_parse_name (argv [1], device_patterns);
+        transport = device_parse_name (argv [2], device_transports);
+        hops = atoi (argv [3]);
+        size = atoi (argv [4]);
+        count = atoi (argv [5]);
+    }
+    if (argc != 6 || pattern < 0 || transport < 0 || hops < 1 ||
+          hops > DEVICE_MAX_HOPS || (int) size < 1 || count < 1) {
+        printf ("usage: device_hops pair|reqrep|pipeline inproc|ipc|tcp "
+            "<hops> <message-size> <message-count>\n");
+        return 1;
+    }
+
+    printf ("pattern: %s\n", device_patterns [pattern]);
+    printf ("transport: %s\n", device_transports [transport]);
+    printf ("message size: %d [B]\n", (int) size);
+    printf ("message count: %d\n", count);
+
+    /*  The direct run and the chain use distinct addresses. */
+    memset (&direct, 0, sizeof (direct));
+    direct.hops = 0;
+    direct.base = 0;
+    direct_rtt = device_measure (&direct, &direct_thr);
+    printf ("direct: mean roundtrip: %.3f [us], mean throughput: %.0f "
+        "[msg/s]\n", direct_rtt, direct_thr);
+
+    memset (&chain, 0, sizeof (chain));
+    chain.hops = hops;
+    chain.base = 2;
+    chain_rtt = device_measure (&chain, &chain_thr);
+    printf ("%d hops: mean roundtrip: %.3f [us], mean throughput: %.0f "
+        "[msg/s]\n", hops, chain_rtt, chain_thr);
+
+    /*  PAIR and REQ/REP messages pass each device twice per roundtrip. */
+    added = (chain_rtt - direct_rtt) / hops;
+    if (pattern != DEVICE_PIPELINE)
+        added /= 2;
+    printf ("added latency: %.3f [us] per hop\n", added);
+
+    /*  Stop the devices. */
+    nn_term ();
+    for (i = 0; i != hops; ++i)
+        nn_thread_term (&device_threads [i]);
+
+    return 0;
+}
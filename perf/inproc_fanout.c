@@ -0,0 +1,129 @@
+/*
+    Copyright (c) 2012 250bpm s.r.o.
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"),
+    to deal in the Software without restriction, including without limitation
+    the rights to use, copy, modify, merge, publish, distribute, sublicense,
+    and/or sell copies of the Software, and to permit persons to whom
+    the Software is furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included
+    in all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+    THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+    FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+    IN THE SOFTWARE.
+*/
+
+#include "../src/nn.h"
+#include "../src/pubsub.h"
+
+#include "../src/utils/err.c"
+#include "../src/utils/stopwatch.c"
+
+#include <stddef.h>
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*  Measures the cost of distributing messages from a single publisher to
+    many subscribers. Subscribers' buffers are large enough to hold all
+    the messages, so that none of them is dropped and the time measured is
+    spent purely on the publisher side, copying the messages to the pipes. */
+
+int main (int argc, char *argv [])
+{
+    int rc;
+    int pub;
+    int *subs;
+    int subscriber_count;
+    size_t message_size;
+    int message_count;
+    int rcvbuf;
+    int i;
+    char *buf;
+    struct nn_stopwatch stopwatch;
+    uint64_t elapsed;
+    unsigned long throughput;
+    unsigned long copies;
+
+    if (argc != 4) {
+        printf ("usage: inproc_fanout <subscriber-count> <message-size> "
+            "<message-count>\n");
+        return 1;
+    }
+
+    subscriber_count = atoi (argv [1]);
+    message_size = atoi (argv [2]);
+    message_count = atoi (argv [3]);
+
+    pub = nn_socket (AF_SP, NN_PUB);
+    assert (pub != -1);
+    rc = nn_bind (pub, "inproc://inproc_fanout");
+    assert (rc >= 0);
+
+    subs = malloc (sizeof (int) * subscriber_count);
+    assert (subs);
+    rcvbuf = (int) ((message_size + 64) * message_count);
+    for (i = 0; i != subscriber_count; ++i) {
+        subs [i] = nn_socket (AF_SP, NN_SUB);
+        assert (subs [i] != -1);
+        rc = nn_setsockopt (subs [i], NN_SOL_SOCKET, NN_RCVBUF, &rcvbuf,
+            sizeof (rcvbuf));
+        assert (rc == 0);
+        rc = nn_setsockopt (subs [i], NN_SUB, NN_SUB_SUBSCRIBE, "", 0);
+        assert (rc == 0);
+        rc = nn_connect (subs [i], "inproc://inproc_fanout");
+        assert (rc >= 0);
+    }
+
+    buf = malloc (message_size);
+    assert (buf);
+    memset (buf, 111, message_size);
+
+    nn_stopwatch_init (&stopwatch);
+
+    for (i = 0; i != message_count; i++) {
+        rc = nn_send (pub, buf, message_size, 0);
+        assert (rc == (int) message_size);
+    }
+
+    elapsed = nn_stopwatch_term (&stopwatch);
+
+    /*  Check that the last subscriber got all the messages. */
+    for (i = 0; i != message_count; i++) {
+        rc = nn_recv (subs [subscriber_count - 1], buf, message_size,
+            NN_DONTWAIT);
+        assert (rc == (int) message_size);
+    }
+
+    free (buf);
+    for (i = 0; i != subscriber_count; ++i) {
+        rc = nn_close (subs [i]);
+        assert (rc == 0);
+    }
+    free (subs);
+    rc = nn_close (pub);
+    assert (rc == 0);
+
+    if (elapsed == 0)
+        elapsed = 1;
+    throughput = (unsigned long)
+        ((double) message_count / (double) elapsed * 1000000);
+    copies = (unsigned long) ((double) message_count * subscriber_count /
+        (double) elapsed * 1000000);
+
+    printf ("subscriber count: %d\n", subscriber_count);
+    printf ("message size: %d [B]\n", (int) message_size);
+    printf ("message count: %d\n", (int) message_count);
+    printf ("mean throughput: %d [msg/s]\n", (int) throughput);
+    printf ("mean delivery rate: %lu [copies/s]\n", copies);
+
+    return 0;
+}
+
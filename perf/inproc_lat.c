@@ -27,6 +27,7 @@
 #include "../src/utils/thread.c"
 #include "../src/utils/sleep.c"
 #include "../src/utils/stopwatch.c"
+#include "counters.c"
 
 #include <stddef.h>
 #include <assert.h>
@@ -71,6 +72,7 @@ int main (int argc, char *argv [])
     char *buf;
     struct nn_thread thread;
     struct nn_stopwatch stopwatch;
+    struct counters counters;
     uint64_t elapsed;
     double latency;
 
@@ -95,7 +97,9 @@ int main (int argc, char *argv [])
     nn_thread_init (&thread, worker, NULL);
     nn_sleep (100);
 
+    counters_init (&counters);
     nn_stopwatch_init (&stopwatch);
+    counters_start (&counters);
 
     for (i = 0; i != roundtrip_count; i++) {
         rc = nn_send (s, buf, message_size, 0);
@@ -104,12 +108,15 @@ int main (int argc, char *argv [])
         assert (rc == message_size);
     }
 
+    counters_stop (&counters);
     elapsed = nn_stopwatch_term (&stopwatch);
 
     latency = (double) elapsed / (roundtrip_count * 2);
     printf ("message size: %d [B]\n", (int) message_size);
     printf ("roundtrip count: %d\n", (int) roundtrip_count);
     printf ("average latency: %.3f [us]\n", (double) latency);
+    counters_report (&counters, (uint64_t) roundtrip_count * 2, "msg");
+    counters_term (&counters);
 
     nn_thread_term (&thread);
     free (buf);
@@ -0,0 +1,139 @@
+/*
+    Copyright (c) 2013 250bpm s.r.o.
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"),
+    to deal in the Software without restriction, including without limitation
+    the rights to use, copy, modify, merge, publish, distribute, sublicense,
+    and/or sell copies of the Software, and to permit persons to whom
+    the Software is furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included
+    in all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+    THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+    FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+    IN THE SOFTWARE.
+*/
+
+/*  Measures the throughput of a single socket shared by several sending
+    threads. All the threads contend for the lock of the socket. */
+
+#include "../src/nn.h"
+#include "../src/fanout.h"
+
+#include "../src/utils/err.c"
+#include "../src/utils/thread.c"
+#include "../src/utils/stopwatch.c"
+
+#include <stddef.h>
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define MAX_THREADS 64
+
+static int push;
+static size_t message_size;
+static int message_count;
+
+void worker (void *arg)
+{
+    int rc;
+    int i;
+    char *buf;
+
+    buf = malloc (message_size);
+    assert (buf);
+    memset (buf, 111, message_size);
+
+    for (i = 0; i != message_count; i++) {
+        rc = nn_send (push, buf, message_size, 0);
+        assert (rc == message_size);
+    }
+
+    free (buf);
+}
+
+int main (int argc, char *argv [])
+{
+    int rc;
+    int s;
+    int i;
+    int thread_count;
+    int total;
+    char *buf;
+    struct nn_thread threads [MAX_THREADS];
+    struct nn_stopwatch stopwatch;
+    uint64_t elapsed;
+    unsigned long throughput;
+
+    if (argc != 4) {
+        printf ("usage: inproc_mt_thr <message-size> <message-count> "
+            "<thread-count>\n");
+        return 1;
+    }
+
+    message_size = atoi (argv [1]);
+    message_count = atoi (argv [2]);
+    thread_count = atoi (argv [3]);
+    if (thread_count < 1 || thread_count > MAX_THREADS) {
+        printf ("thread count must be between 1 and %d\n", MAX_THREADS);
+        return 1;
+    }
+    total = message_count * thread_count;
+
+    s = nn_socket (AF_SP, NN_PULL);
+    assert (s != -1);
+    rc = nn_bind (s, "inproc://inproc_mt_thr");
+    assert (rc >= 0);
+    push = nn_socket (AF_SP, NN_PUSH);
+    assert (push != -1);
+    rc = nn_connect (push, "inproc://inproc_mt_thr");
+    assert (rc >= 0);
+
+    buf = malloc (message_size);
+    assert (buf);
+
+    /*  First message is used to start the stopwatch. */
+    rc = nn_send (push, NULL, 0, 0);
+    assert (rc == 0);
+    rc = nn_recv (s, buf, message_size, 0);
+    assert (rc == 0);
+
+    nn_stopwatch_init (&stopwatch);
+
+    for (i = 0; i != thread_count; i++)
+        nn_thread_init (&threads [i], worker, NULL);
+    for (i = 0; i != total; i++) {
+        rc = nn_recv (s, buf, message_size, 0);
+        assert (rc == message_size);
+    }
+
+    elapsed = nn_stopwatch_term (&stopwatch);
+
+    for (i = 0; i != thread_count; i++)
+        nn_thread_term (&threads [i]);
+    free (buf);
+    rc = nn_close (push);
+    assert (rc == 0);
+    rc = nn_close (s);
+    assert (rc == 0);
+
+    if (elapsed == 0)
+        elapsed = 1;
+    throughput = (unsigned long)
+        ((double) total / (double) elapsed * 1000000);
+
+    printf ("message size: %d [B]\n", (int) message_size);
+    printf ("message count: %d\n", total);
+    printf ("sending threads: %d\n", thread_count);
+    printf ("mean throughput: %d [msg/s]\n", (int) throughput);
+
+    return 0;
+}
+
@@ -26,6 +26,7 @@
 #include "../src/utils/err.c"
 #include "../src/utils/thread.c"
 #include "../src/utils/stopwatch.c"
+#include "counters.c"
 
 #include <stddef.h>
 #include <assert.h>
@@ -72,6 +73,7 @@ int main (int argc, char *argv [])
     char *buf;
     struct nn_thread thread;
     struct nn_stopwatch stopwatch;
+    struct counters counters;
     uint64_t elapsed;
     unsigned long throughput;
     double megabits;
@@ -98,13 +100,16 @@ int main (int argc, char *argv [])
     rc = nn_recv (s, buf, message_size, 0);
     assert (rc == 0);
 
+    counters_init (&counters);
     nn_stopwatch_init (&stopwatch);
+    counters_start (&counters);
 
     for (i = 0; i != message_count; i++) {
         rc = nn_recv (s, buf, message_size, 0);
         assert (rc == message_size);
     }
 
+    counters_stop (&counters);
     elapsed = nn_stopwatch_term (&stopwatch);
 
     nn_thread_term (&thread);
@@ -122,6 +127,8 @@ int main (int argc, char *argv [])
     printf ("message count: %d\n", (int) message_count);
     printf ("mean throughput: %d [msg/s]\n", (int) throughput);
     printf ("mean throughput: %.3f [Mb/s]\n", (double) megabits);
+    counters_report (&counters, message_count, "msg");
+    counters_term (&counters);
 
     return 0;
 }
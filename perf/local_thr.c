@@ -28,6 +28,7 @@
 #include <assert.h>
 
 #include "../src/utils/stopwatch.c"
+#include "counters.c"
 
 int main (int argc, char *argv [])
 {
@@ -40,6 +41,7 @@ int main (int argc, char *argv [])
     int rc;
     int i;
     struct nn_stopwatch sw;
+    struct counters counters;
     uint64_t total;
     uint64_t thr;
     double mbs;
@@ -63,11 +65,14 @@ int main (int argc, char *argv [])
     nbytes = nn_recv (s, buf, sz, 0);
     assert (nbytes == 0);
 
+    counters_init (&counters);
     nn_stopwatch_init (&sw);
+    counters_start (&counters);
     for (i = 0; i != count; i++) {
         nbytes = nn_recv (s, buf, sz, 0);
         assert (nbytes == sz);
     }
+    counters_stop (&counters);
     total = nn_stopwatch_term (&sw);
     if (total == 0)
         total = 1;
@@ -79,6 +84,8 @@ int main (int argc, char *argv [])
     printf ("message count: %d\n", (int) count);
     printf ("throughput: %d [msg/s]\n", (int) thr);
     printf ("throughput: %.3f [Mb/s]\n", (double) mbs);
+    counters_report (&counters, count, "msg");
+    counters_term (&counters);
 
     free (buf);
 
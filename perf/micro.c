@@ -0,0 +1,493 @@
+/*
+    Copyright (c) 2012 250bpm s.r.o.
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"),
+    to deal in the Software without restriction, including without limitation
+    the rights to use, copy, modify, merge, publish, distribute, sublicense,
+    and/or sell copies of the Software, and to permit persons to whom
+    the Software is furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included
+    in all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+    THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+    FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+    IN THE SOFTWARE.
+*/
+
+/*  Micro-benchmarks of the library's internal data structures. The sources
+    are compiled in directly, the same way the unit tests do it, as the
+    structures are not exported from the library. chunk.c goes first as it
+    asks for GNU extensions of the system headers. */
+
+#include "../src/utils/chunk.c"
+#include "../src/protocols/pubsub/trie.c"
+#include "../src/utils/hash.c"
+#include "../src/transports/inproc/msgqueue.c"
+#include "../src/utils/codel.c"
+#include "../src/utils/dist.c"
+#include "../src/aio/timerset.c"
+#include "../src/utils/msg.c"
+#include "../src/utils/chunkref.c"
+#include "../src/utils/chunkpool.c"
+#include "../src/utils/atomic.c"
+#include "../src/utils/list.c"
+#include "../src/utils/clock.c"
+#include "../src/utils/alloc.c"
+#include "../src/utils/mutex.c"
+#include "../src/utils/thread.c"
+#include "../src/utils/sleep.c"
+#include "../src/utils/err.c"
+#include "../src/utils/stopwatch.c"
+#include "counters.c"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*  The hardware counters only see the calling thread, so they are started
+    by micro_start for the single-threaded benchmarks only. */
+static struct counters micro_counters;
+static int micro_counting;
+
+static void micro_start (struct nn_stopwatch *sw)
+{
+    micro_counting = 1;
+    nn_stopwatch_init (sw);
+    counters_start (&micro_counters);
+}
+
+static void micro_report (const char *name, uint64_t ops, uint64_t elapsed)
+{
+    if (micro_counting)
+        counters_stop (&micro_counters);
+    if (elapsed == 0)
+        elapsed = 1;
+    printf ("%-24s %10llu ops %10.1f [ns/op] %12.0f [ops/s]\n", name,
+        (unsigned long long) ops, (double) elapsed * 1000 / ops,
+        (double) ops * 1000000 / elapsed);
+    if (micro_counting)
+        counters_report (&micro_counters, ops, "op");
+    micro_counting = 0;
+}
+
+/*  Simple xorshift generator so that the runs are repeatable. */
+static uint32_t micro_seed = 2463534242u;
+
+static uint32_t micro_random (void)
+{
+    micro_seed ^= micro_seed << 13;
+    micro_seed ^= micro_seed >> 17;
+    micro_seed ^= micro_seed << 5;
+    return micro_seed;
+}
+
+/*  nn_trie_match against a large set of subscriptions. The topics share
+    long prefixes, the way hierarchical topic names do. */
+#define MICRO_TOPIC 64
+
+static void micro_trie (int n)
+{
+    int rc;
+    int i;
+    int hits;
+    char *topics;
+    size_t *lens;
+    struct nn_trie trie;
+    struct nn_stopwatch sw;
+
+    /*  The first half of the topics is subscribed to. The messages match
+        a subscription if they are from the first half, not otherwise. */
+    topics = malloc ((size_t) 2 * n * MICRO_TOPIC);
+    nn_assert (topics);
+    lens = malloc ((size_t) 2 * n * sizeof (size_t));
+    nn_assert (lens);
+    for (i = 0; i != 2 * n; ++i)
+        lens [i] = sprintf (topics + (size_t) i * MICRO_TOPIC,
+            "market.%u.instrument.%u.payload", (unsigned) i % 64,
+            (unsigned) i);
+
+    nn_trie_init (&trie);
+
+    micro_start (&sw);
+    for (i = 0; i != n; ++i) {
+        rc = nn_trie_subscribe (&trie,
+            (uint8_t*) topics + (size_t) i * MICRO_TOPIC, lens [i] - 8);
+        nn_assert (rc == 1);
+    }
+    micro_report ("trie subscribe", n, nn_stopwatch_term (&sw));
+
+    micro_seed = 2463534242u;
+    hits = 0;
+    micro_start (&sw);
+    for (i = 0; i != 10 * n; ++i) {
+        rc = micro_random () % (2 * n);
+        hits += nn_trie_match (&trie,
+            (uint8_t*) topics + (size_t) rc * MICRO_TOPIC, lens [rc]);
+    }
+    micro_report ("trie match", 10 * n, nn_stopwatch_term (&sw));
+    nn_assert (hits > 0 && hits < 10 * n);
+
+    nn_trie_term (&trie);
+    free (lens);
+    free (topics);
+}
+
+/*  nn_hash_insert, nn_hash_get and nn_hash_erase. */
+static void micro_hash (int n)
+{
+    int i;
+    struct nn_hash hash;
+    struct nn_hash_item *items;
+    struct nn_hash_item *item;
+    uint32_t *keys;
+    struct nn_stopwatch sw;
+
+    items = malloc (n * sizeof (struct nn_hash_item));
+    nn_assert (items);
+    keys = malloc (n * sizeof (uint32_t));
+    nn_assert (keys);
+    /*  Distinct keys spread over the whole range. Odd keys are never
+        inserted and are used to look for missing items. */
+    for (i = 0; i != n; ++i) {
+        nn_hash_item_init (&items [i]);
+        keys [i] = (uint32_t) i * 2654435761u;
+    }
+    nn_hash_init (&hash);
+
+    micro_start (&sw);
+    for (i = 0; i != n; ++i)
+        nn_hash_insert (&hash, keys [i] << 1, &items [i]);
+    micro_report ("hash insert", n, nn_stopwatch_term (&sw));
+
+    micro_start (&sw);
+    for (i = 0; i != n; ++i) {
+        item = nn_hash_get (&hash, keys [i] << 1);
+        nn_assert (item);
+    }
+    micro_report ("hash get (hit)", n, nn_stopwatch_term (&sw));
+
+    micro_start (&sw);
+    for (i = 0; i != n; ++i)
+        nn_hash_get (&hash, (keys [i] << 1) | 1);
+    micro_report ("hash get (miss)", n, nn_stopwatch_term (&sw));
+
+    micro_start (&sw);
+    for (i = 0; i != n; ++i)
+        nn_hash_erase (&hash, &items [i]);
+    micro_report ("hash erase", n, nn_stopwatch_term (&sw));
+
+    nn_hash_term (&hash);
+    for (i = 0; i != n; ++i)
+        nn_hash_item_term (&items [i]);
+    free (keys);
+    free (items);
+}
+
+/*  nn_msgqueue_send and nn_msgqueue_recv from a single thread, in batches
+    so that the queue's chunks are being recycled. */
+#define MICRO_BATCH 1000
+
+static void micro_msgqueue (int n)
+{
+    int rc;
+    int i;
+    int j;
+    struct nn_msgqueue queue;
+    struct nn_msg msg;
+    struct nn_stopwatch sw;
+
+    nn_msgqueue_init (&queue, (size_t) -1, (size_t) -1, 0, 0, 1);
+
+    micro_start (&sw);
+    for (i = 0; i < n; i += MICRO_BATCH) {
+        for (j = 0; j != MICRO_BATCH; ++j) {
+            nn_msg_init (&msg, 64);
+            rc = nn_msgqueue_send (&queue, &msg);
+            errnum_assert (rc >= 0, -rc);
+        }
+        for (j = 0; j != MICRO_BATCH; ++j) {
+            rc = nn_msgqueue_recv (&queue, &msg);
+            errnum_assert (rc >= 0, -rc);
+            nn_msg_term (&msg);
+        }
+    }
+    micro_report ("msgqueue send+recv", i, nn_stopwatch_term (&sw));
+
+    nn_msgqueue_term (&queue);
+}
+
+/*  nn_chunk_alloc and nn_chunk_free, both within a thread and with chunks
+    allocated in one thread and freed in another. In the latter case the
+    chunks are passed between the threads in batches and only the time
+    spent allocating and freeing them is measured. */
+#define MICRO_CHUNKS 64
+
+struct micro_handoff {
+    struct nn_mutex sync;
+    struct nn_chunk *chunks [MICRO_CHUNKS];
+    int full;
+    int count;
+    uint64_t elapsed;
+};
+
+static void micro_local_routine (void *arg)
+{
+    int rc;
+    int i;
+    int j;
+    struct nn_chunk *chunks [MICRO_CHUNKS];
+
+    for (i = 0; i < *(int*) arg; i += MICRO_CHUNKS) {
+        for (j = 0; j != MICRO_CHUNKS; ++j) {
+            rc = nn_chunk_alloc (64 + j * 16, 0, &chunks [j]);
+            errnum_assert (rc == 0, -rc);
+        }
+        for (j = 0; j != MICRO_CHUNKS; ++j)
+            nn_chunk_free (chunks [j]);
+    }
+}
+
+/*  Waits till the batch is in the state specified. */
+static void micro_handoff_wait (struct micro_handoff *self, int full)
+{
+    int current;
+
+    while (1) {
+        nn_mutex_lock (&self->sync);
+        current = self->full;
+        nn_mutex_unlock (&self->sync);
+        if (current == full)
+            return;
+        nn_sleep (0);
+    }
+}
+
+static void micro_handoff_set (struct micro_handoff *self, int full)
+{
+    nn_mutex_lock (&self->sync);
+    self->full = full;
+    nn_mutex_unlock (&self->sync);
+}
+
+static void micro_remote_routine (void *arg)
+{
+    int i;
+    int j;
+    struct micro_handoff *handoff;
+    struct nn_stopwatch sw;
+
+    handoff = (struct micro_handoff*) arg;
+    for (i = 0; i < handoff->count; i += MICRO_CHUNKS) {
+        micro_handoff_wait (handoff, 1);
+        nn_stopwatch_init (&sw);
+        for (j = 0; j != MICRO_CHUNKS; ++j)
+            nn_chunk_free (handoff->chunks [j]);
+        handoff->elapsed += nn_stopwatch_term (&sw);
+        micro_handoff_set (handoff, 0);
+    }
+}
+
+static void micro_chunk (int n, int nthreads)
+{
+    int i;
+    struct nn_thread threads [16];
+    struct nn_stopwatch sw;
+    char name [32];
+
+    nn_stopwatch_init (&sw);
+    for (i = 0; i != nthreads; ++i)
+        nn_thread_init (&threads [i], micro_local_routine, &n);
+    for (i = 0; i != nthreads; ++i)
+        nn_thread_term (&threads [i]);
+    sprintf (name, "chunk alloc+free (%dx)", nthreads);
+    micro_report (name, (uint64_t) n * nthreads, nn_stopwatch_term (&sw));
+}
+
+static void micro_chunk_remote (int n)
+{
+    int rc;
+    int i;
+    int j;
+    uint64_t elapsed;
+    struct nn_thread thread;
+    struct micro_handoff handoff;
+    struct nn_chunk *chunks [MICRO_CHUNKS];
+    struct nn_stopwatch sw;
+
+    nn_mutex_init (&handoff.sync);
+    handoff.full = 0;
+    handoff.count = n;
+    handoff.elapsed = 0;
+    elapsed = 0;
+    nn_thread_init (&thread, micro_remote_routine, &handoff);
+    for (i = 0; i < n; i += MICRO_CHUNKS) {
+        nn_stopwatch_init (&sw);
+        for (j = 0; j != MICRO_CHUNKS; ++j) {
+            rc = nn_chunk_alloc (64 + j * 16, 0, &chunks [j]);
+            errnum_assert (rc == 0, -rc);
+        }
+        elapsed += nn_stopwatch_term (&sw);
+        micro_handoff_wait (&handoff, 0);
+        memcpy (handoff.chunks, chunks, sizeof (chunks));
+        micro_handoff_set (&handoff, 1);
+    }
+    nn_thread_term (&thread);
+    micro_report ("chunk alloc+remote free", i, elapsed + handoff.elapsed);
+    nn_mutex_term (&handoff.sync);
+}
+
+/*  nn_timerset_add and nn_timerset_rm with many timers active. */
+static void micro_timerset (int n)
+{
+    int i;
+    struct nn_timerset timerset;
+    struct nn_timerset_hndl *hndls;
+    struct nn_stopwatch sw;
+
+    hndls = malloc (n * sizeof (struct nn_timerset_hndl));
+    nn_assert (hndls);
+    for (i = 0; i != n; ++i)
+        nn_timerset_hndl_init (&hndls [i]);
+    nn_timerset_init (&timerset);
+
+    micro_seed = 2463534242u;
+    micro_start (&sw);
+    for (i = 0; i != n; ++i)
+        nn_timerset_add (&timerset, 1000 + micro_random () % 100000,
+            &hndls [i]);
+    micro_report ("timerset add", n, nn_stopwatch_term (&sw));
+
+    /*  Re-arming the timers is the common case, e.g. for heartbeats. */
+    micro_start (&sw);
+    for (i = 0; i != n; ++i) {
+        nn_timerset_rm (&timerset, &hndls [i]);
+        nn_timerset_add (&timerset, 1000 + micro_random () % 100000,
+            &hndls [i]);
+    }
+    micro_report ("timerset rm+add", n, nn_stopwatch_term (&sw));
+
+    micro_start (&sw);
+    for (i = 0; i != n; ++i)
+        nn_timerset_rm (&timerset, &hndls [i]);
+    micro_report ("timerset rm", n, nn_stopwatch_term (&sw));
+
+    nn_timerset_term (&timerset);
+    for (i = 0; i != n; ++i)
+        nn_timerset_hndl_term (&hndls [i]);
+    free (hndls);
+}
+
+/*  nn_dist_send with many pipes. The pipes are fake; sending to them just
+    drops the message, so that only the cost of the distribution itself is
+    measured. */
+static uint64_t micro_pipe_sends;
+
+int nn_pipe_send (struct nn_pipe *self, struct nn_msg *msg)
+{
+    ++micro_pipe_sends;
+    nn_msg_term (msg);
+    return 0;
+}
+
+static void micro_dist (int n, int npipes)
+{
+    int i;
+    struct nn_dist dist;
+    struct nn_dist_data *data;
+    struct nn_msg msg;
+    struct nn_stopwatch sw;
+    char name [32];
+
+    data = malloc (npipes * sizeof (struct nn_dist_data));
+    nn_assert (data);
+    nn_dist_init (&dist);
+    for (i = 0; i != npipes; ++i) {
+        nn_dist_add (&dist, (struct nn_pipe*) &data [i], &data [i]);
+        nn_dist_out (&dist, (struct nn_pipe*) &data [i], &data [i]);
+    }
+
+    micro_pipe_sends = 0;
+    micro_start (&sw);
+    for (i = 0; i != n; ++i) {
+        nn_msg_init (&msg, 64);
+        nn_dist_send (&dist, &msg, NULL);
+    }
+    sprintf (name, "dist send (%d pipes)", npipes);
+    micro_report (name, n, nn_stopwatch_term (&sw));
+    nn_assert (micro_pipe_sends == (uint64_t) n * npipes);
+
+    for (i = 0; i != npipes; ++i)
+        nn_dist_rm (&dist, (struct nn_pipe*) &data [i], &data [i]);
+    nn_dist_term (&dist);
+    free (data);
+}
+
+/*  Returns 1 if the benchmark was asked for on the command line or if no
+    benchmarks were specified at all. */
+static int micro_selected (int argc, char *argv [], const char *name)
+{
+    int i;
+    int any;
+
+    any = 0;
+    for (i = 1; i != argc; ++i) {
+        if (argv [i][0] >= '0' && argv [i][0] <= '9')
+            continue;
+        if (strcmp (argv [i], name) == 0)
+            return 1;
+        any = 1;
+    }
+    return !any;
+}
+
+int main (int argc, char *argv [])
+{
+    int i;
+    int n;
+
+    n = 100000;
+    for (i = 1; i != argc; ++i) {
+        if (argv [i][0] >= '0' && argv [i][0] <= '9')
+            n = atoi (argv [i]);
+        else if (strcmp (argv [i], "trie") && strcmp (argv [i], "hash") &&
+              strcmp (argv [i], "msgqueue") && strcmp (argv [i], "chunk") &&
+              strcmp (argv [i], "timerset") && strcmp (argv [i], "dist"))
+            n = 0;
+    }
+    if (n <= 0) {
+        printf ("usage: micro [trie|hash|msgqueue|chunk|timerset|dist]... "
+            "[<count>]\n");
+        return 1;
+    }
+
+    counters_init (&micro_counters);
+
+    if (micro_selected (argc, argv, "trie"))
+        micro_trie (n);
+    if (micro_selected (argc, argv, "hash"))
+        micro_hash (n);
+    if (micro_selected (argc, argv, "msgqueue"))
+        micro_msgqueue (10 * n);
+    if (micro_selected (argc, argv, "chunk")) {
+        micro_chunk (10 * n, 1);
+        micro_chunk (10 * n, 4);
+        micro_chunk_remote (10 * n);
+    }
+    if (micro_selected (argc, argv, "timerset"))
+        micro_timerset (n);
+    if (micro_selected (argc, argv, "dist")) {
+        micro_dist (n, 10);
+        micro_dist (n / 10 ? n / 10 : 1, 100);
+        micro_dist (n / 100 ? n / 100 : 1, 1000);
+    }
+
+    counters_term (&micro_counters);
+
+    return 0;
+}
@@ -28,32 +28,231 @@
 #include <stdlib.h>
 #include <string.h>
 #include <assert.h>
+#include <math.h>
 
+#include "../src/utils/err.c"
+#include "../src/utils/thread.c"
+#include "../src/utils/sleep.c"
 #include "../src/utils/stopwatch.c"
 
+/*  Latencies are collected in a log-linear histogram, the same way HDR
+    histograms do. Values below LAT_SUB microseconds are recorded exactly.
+    Above that, each power of two is split into LAT_SUB / 2 buckets, which
+    keeps the error of any recorded value below 1/64 (1.6%). */
+#define LAT_SUB 128
+#define LAT_HALF (LAT_SUB / 2)
+#define LAT_RANGES 40
+#define LAT_BUCKETS (LAT_SUB + LAT_RANGES * LAT_HALF)
+
+struct lat_histogram {
+    uint64_t counts [LAT_BUCKETS];
+    uint64_t total;
+    uint64_t min;
+    uint64_t max;
+    double sum;
+    double sumsq;
+};
+
+static int lat_index (uint64_t value)
+{
+    int range;
+
+    if (value < LAT_SUB)
+        return (int) value;
+    range = 0;
+    while ((value >> range) >= LAT_SUB)
+        ++range;
+    if (range > LAT_RANGES)
+        return LAT_BUCKETS - 1;
+    return LAT_SUB + (range - 1) * LAT_HALF +
+        (int) ((value >> range) - LAT_HALF);
+}
+
+/*  Returns the highest value that falls into the bucket. */
+static uint64_t lat_value (int index)
+{
+    int range;
+
+    if (index < LAT_SUB)
+        return index;
+    range = (index - LAT_SUB) / LAT_HALF + 1;
+    return (((uint64_t) ((index - LAT_SUB) % LAT_HALF + LAT_HALF + 1))
+        << range) - 1;
+}
+
+static void lat_record (struct lat_histogram *self, uint64_t value)
+{
+    ++self->counts [lat_index (value)];
+    if (!self->total || value < self->min)
+        self->min = value;
+    if (value > self->max)
+        self->max = value;
+    ++self->total;
+    self->sum += value;
+    self->sumsq += (double) value * value;
+}
+
+static double lat_mean (struct lat_histogram *self)
+{
+    return self->total ? self->sum / self->total : 0;
+}
+
+static double lat_stddev (struct lat_histogram *self)
+{
+    double mean;
+    double variance;
+
+    if (!self->total)
+        return 0;
+    mean = lat_mean (self);
+    variance = self->sumsq / self->total - mean * mean;
+    return variance > 0 ? sqrt (variance) : 0;
+}
+
+/*  Returns the value below or at which the specified percentage of the
+    recorded values lies. */
+static uint64_t lat_percentile (struct lat_histogram *self, double percentile)
+{
+    int i;
+    uint64_t count;
+    uint64_t target;
+
+    target = (uint64_t) (percentile / 100 * self->total + 0.5);
+    if (target == 0)
+        target = 1;
+    count = 0;
+    for (i = 0; i != LAT_BUCKETS; ++i) {
+        count += self->counts [i];
+        if (count >= target)
+            return lat_value (i) < self->max ? lat_value (i) : self->max;
+    }
+    return self->max;
+}
+
+/*  Prints the summary followed by the percentile distribution in the format
+    of HdrHistogram's .hgrm files, so that it can be plotted by the usual
+    tools. The percentiles get five ticks per each halving of the distance
+    to 100%. */
+static void lat_print (struct lat_histogram *self)
+{
+    int half;
+    int tick;
+    double percentile;
+    double distance;
+
+    printf ("p50 latency: %llu [us]\n",
+        (unsigned long long) lat_percentile (self, 50));
+    printf ("p99 latency: %llu [us]\n",
+        (unsigned long long) lat_percentile (self, 99));
+    printf ("p99.9 latency: %llu [us]\n",
+        (unsigned long long) lat_percentile (self, 99.9));
+    printf ("max latency: %llu [us]\n\n", (unsigned long long) self->max);
+
+    printf ("%12s %14s %10s %14s\n\n", "Value", "Percentile", "TotalCount",
+        "1/(1-Percentile)");
+    for (half = 0; ; ++half) {
+        distance = 100.0 / (1 << half);
+        for (tick = 0; tick != 5; ++tick) {
+            percentile = 100.0 - distance + distance / 2 * tick / 5;
+            if (percentile / 100 * self->total >= self->total - 1 ||
+                  half == 30)
+                goto done;
+            printf ("%12.3f %14.12f %10llu %14.2f\n",
+                (double) lat_percentile (self, percentile), percentile / 100,
+                (unsigned long long) (percentile / 100 * self->total + 0.5),
+                100 / (100 - percentile));
+        }
+    }
+done:
+    printf ("%12.3f %14.12f %10llu\n", (double) self->max, 1.0,
+        (unsigned long long) self->total);
+    printf ("#[Mean    = %12.3f, StdDeviation   = %12.3f]\n",
+        lat_mean (self), lat_stddev (self));
+    printf ("#[Max     = %12.3f, Total count    = %12llu]\n",
+        (double) self->max, (unsigned long long) self->total);
+}
+
+/*  State of the open-loop run. */
+struct lat_sender {
+    int s;
+    char *buf;
+    size_t sz;
+    int rts;
+    int rate;
+    struct nn_stopwatch *sw;
+};
+
+/*  Returns the time, relative to the start of the run, the message with
+    the specified sequence number is meant to be sent at. */
+static uint64_t lat_schedule (struct lat_sender *self, int seq)
+{
+    return (uint64_t) seq * 1000000 / self->rate;
+}
+
+/*  Sends the messages at the specified rate irrespective of how fast the
+    replies come back. If it falls behind, the messages are sent back-to-back
+    till it catches up, so that the time spent waiting counts towards the
+    latency of the messages delayed, instead of being omitted. */
+static void lat_routine (void *arg)
+{
+    int i;
+    int nbytes;
+    uint64_t now;
+    uint64_t next;
+    struct lat_sender *self;
+
+    self = (struct lat_sender*) arg;
+    for (i = 0; i != self->rts; i++) {
+        next = lat_schedule (self, i);
+        while (1) {
+            now = nn_stopwatch_term (self->sw);
+            if (now >= next)
+                break;
+            if (next - now > 2000)
+                nn_sleep ((int) ((next - now) / 1000) - 1);
+        }
+        memcpy (self->buf, &i, sizeof (i));
+        nbytes = nn_send (self->s, self->buf, self->sz, 0);
+        assert (nbytes == self->sz);
+    }
+}
+
 int main (int argc, char *argv [])
 {
     const char *connect_to;
     size_t sz;
     int rts;
+    int rate;
     char *buf;
     int nbytes;
     int s;
     int rc;
     int i;
+    int seq;
     int opt;
     struct nn_stopwatch sw;
+    uint64_t start;
+    uint64_t now;
     uint64_t total;
     double lat;
-    
+    struct lat_histogram *hist;
+    struct lat_sender sender;
+    struct nn_thread thread;
 
-    if (argc != 4) {
-        printf ("usage: remote_lat <connect-to> <msg-size> <roundtrips>\n");
+    if (argc != 4 && argc != 5) {
+        printf ("usage: remote_lat <connect-to> <msg-size> <roundtrips> "
+            "[<rate>]\n");
         return 1;
     }
     connect_to = argv [1];
     sz = atoi (argv [2]);
     rts = atoi (argv [3]);
+    rate = argc == 5 ? atoi (argv [4]) : 0;
+    if (rate < 0 || (rate > 0 && sz < sizeof (int))) {
+        printf ("rate has to be positive and message size at least %d [B]\n",
+            (int) sizeof (int));
+        return 1;
+    }
 
     s = nn_socket (AF_SP, NN_PAIR);
     assert (s != -1);
@@ -67,20 +266,61 @@ int main (int argc, char *argv [])
     assert (buf);
     memset (buf, 111, sz);
 
+    hist = calloc (1, sizeof (struct lat_histogram));
+    assert (hist);
+
     nn_stopwatch_init (&sw);
-    for (i = 0; i != rts; i++) {
-        nbytes = nn_send (s, buf, sz, 0);
-        assert (nbytes == sz);
-        nbytes = nn_recv (s, buf, sz, 0);
-        assert (nbytes == sz);
+
+    /*  Closed loop. Each message is sent once the previous one returns. */
+    if (!rate) {
+        for (i = 0; i != rts; i++) {
+            start = nn_stopwatch_term (&sw);
+            nbytes = nn_send (s, buf, sz, 0);
+            assert (nbytes == sz);
+            nbytes = nn_recv (s, buf, sz, 0);
+            assert (nbytes == sz);
+            lat_record (hist, nn_stopwatch_term (&sw) - start);
+        }
+    }
+
+    /*  Open loop. The messages are sent by a separate thread at a fixed rate
+        and the latency is measured from the time each of them was meant to
+        be sent at. */
+    else {
+        sender.s = s;
+        sender.buf = malloc (sz);
+        assert (sender.buf);
+        memset (sender.buf, 111, sz);
+        sender.sz = sz;
+        sender.rts = rts;
+        sender.rate = rate;
+        sender.sw = &sw;
+        nn_thread_init (&thread, lat_routine, &sender);
+        for (i = 0; i != rts; i++) {
+            nbytes = nn_recv (s, buf, sz, 0);
+            assert (nbytes == sz);
+            now = nn_stopwatch_term (&sw);
+            memcpy (&seq, buf, sizeof (seq));
+            assert (seq >= 0 && seq < rts);
+            start = lat_schedule (&sender, seq);
+            lat_record (hist, now > start ? now - start : 0);
+        }
+        nn_thread_term (&thread);
+        free (sender.buf);
     }
     total = nn_stopwatch_term (&sw);
 
     lat = (double) total / (rts * 2);
     printf ("message size: %d [B]\n", (int) sz);
     printf ("roundtrip count: %d\n", (int) rts);
-    printf ("average latency: %.3f [us]\n", (double) lat);
+    if (rate)
+        printf ("rate: %d [msg/s]\n", rate);
+    else
+        printf ("average latency: %.3f [us]\n", (double) lat);
+    printf ("\nroundtrip latency distribution:\n");
+    lat_print (hist);
 
+    free (hist);
     free (buf);
 
     rc = nn_close (s);
@@ -0,0 +1,480 @@
+/*
+    Copyright (c) 2012 250bpm s.r.o.
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"),
+    to deal in the Software without restriction, including without limitation
+    the rights to use, copy, modify, merge, publish, distribute, sublicense,
+    and/or sell copies of the Software, and to permit persons to whom
+    the Software is furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included
+    in all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+    THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+    FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+    IN THE SOFTWARE.
+*/
+
+#include "../src/nn.h"
+#include "../src/pair.h"
+#include "../src/fanout.h"
+#include "../src/pubsub.h"
+#include "../src/reqrep.h"
+#include "../src/survey.h"
+#include "../src/bus.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#include "../src/utils/err.c"
+#include "../src/utils/atomic.c"
+#include "../src/utils/mutex.c"
+#include "../src/utils/thread.c"
+#include "../src/utils/sleep.c"
+#include "../src/utils/stopwatch.c"
+#include "../src/utils/wire.c"
+#include "../src/utils/capture.h"
+
+/*  Replays the traffic recorded by NN_CAPTURE socket option. The messages
+    the captured socket sent and received are passed between a pair of
+    sockets of the same pattern, with the recorded sizes, at the recorded
+    times relative to the start of the capture. The messages of a one-way
+    flow carry the time they were meant to be sent at, so the receiver
+    measures the latency from that time; if the sender falls behind,
+    the time spent waiting counts towards the latency. Messages shorter than
+    8 bytes are padded to fit the time. Requests are sent by the requester
+    at the recorded times, one at a time, and answered straight away with
+    the recorded reply size; the latency is that of the roundtrip. All the
+    connections of the captured socket are replayed over a single one. */
+
+/*  Time given to the sockets to connect (ms). */
+#define REPLAY_SETTLE 100
+
+/*  Time after which a receiver gives up waiting for more messages once
+    the sender is done (ms). */
+#define REPLAY_TIMEOUT 1000
+
+struct replay_msg {
+
+    /*  Time since the start of the capture (us). */
+    uint64_t time;
+
+    uint32_t size;
+
+    /*  Size of the reply in two-way patterns. */
+    uint32_t reply;
+};
+
+struct replay_flow {
+    const char *name;
+    int twoway;
+    int out;
+    int in;
+    struct replay_msg *msgs;
+    int count;
+    int nreplies;
+
+    /*  Latencies of the messages received (us). */
+    uint64_t *lats;
+    int nlats;
+
+    /*  The longest time the sender was behind the schedule (us). */
+    uint64_t lag;
+
+    /*  Set once the sender has sent all the messages. */
+    struct nn_atomic done;
+
+    struct nn_stopwatch *sw;
+    struct nn_thread sender;
+    struct nn_thread receiver;
+};
+
+static void replay_add (struct replay_flow *self, uint64_t time,
+    uint32_t size)
+{
+    if (!(self->count & (self->count - 1))) {
+        self->msgs = realloc (self->msgs, (self->count ? self->count * 2 : 1) *
+            sizeof (struct replay_msg));
+        alloc_assert (self->msgs);
+    }
+    self->msgs [self->count].time = time;
+    self->msgs [self->count].size = size;
+    self->msgs [self->count].reply = 0;
+    ++self->count;
+}
+
+/*  Assigns the sizes of the replies to the requests, in order. */
+static void replay_reply (struct replay_flow *self, uint32_t size)
+{
+    if (self->nreplies < self->count)
+        self->msgs [self->nreplies++].reply = size;
+}
+
+static size_t replay_maxsize (struct replay_flow *self)
+{
+    int i;
+    size_t sz;
+
+    sz = 8;
+    for (i = 0; i != self->count; ++i) {
+        if (self->msgs [i].size > sz)
+            sz = self->msgs [i].size;
+        if (self->msgs [i].reply > sz)
+            sz = self->msgs [i].reply;
+    }
+    return sz;
+}
+
+/*  Waits till the time the message is meant to be sent at. Returns how
+    far behind the schedule the sender is. */
+static uint64_t replay_wait (struct replay_flow *self, uint64_t next)
+{
+    uint64_t now;
+
+    while (1) {
+        now = nn_stopwatch_term (self->sw);
+        if (now >= next)
+            return now - next;
+        if (next - now > 3000)
+            nn_sleep ((int) ((next - now) / 1000) - 2);
+    }
+}
+
+static void replay_send (void *arg)
+{
+    int i;
+    int rc;
+    size_t sz;
+    char *buf;
+    uint64_t lag;
+    struct replay_flow *self;
+
+    self = (struct replay_flow*) arg;
+    buf = malloc (replay_maxsize (self));
+    alloc_assert (buf);
+    memset (buf, 111, replay_maxsize (self));
+
+    for (i = 0; i != self->count; ++i) {
+        lag = replay_wait (self, self->msgs [i].time);
+        if (lag > self->lag)
+            self->lag = lag;
+        sz = self->msgs [i].size;
+        if (!self->twoway) {
+            if (sz < 8)
+                sz = 8;
+            nn_putll ((uint8_t*) buf, self->msgs [i].time);
+        }
+        rc = nn_send (self->out, buf, sz, 0);
+        errno_assert (rc == (int) sz);
+
+        /*  The requester waits for the reply before sending the next
+            request. */
+        if (self->twoway) {
+            rc = nn_recv (self->out, buf, replay_maxsize (self), 0);
+            if (rc < 0) {
+                errno_assert (nn_errno () == EAGAIN ||
+                    nn_errno () == ETIMEDOUT);
+                continue;
+            }
+            self->lats [self->nlats++] = nn_stopwatch_term (self->sw) -
+                self->msgs [i].time;
+        }
+    }
+    nn_atomic_store (&self->done, 1);
+    free (buf);
+}
+
+static void replay_recv (void *arg)
+{
+    int i;
+    int rc;
+    uint64_t now;
+    uint64_t time;
+    char *buf;
+    struct replay_flow *self;
+
+    self = (struct replay_flow*) arg;
+    buf = malloc (replay_maxsize (self));
+    alloc_assert (buf);
+    memset (buf, 111, replay_maxsize (self));
+
+    i = 0;
+    while (i != self->count) {
+        rc = nn_recv (self->in, buf, replay_maxsize (self), 0);
+        if (rc < 0) {
+
+            /*  The capture may have long pauses in it. Give up only once
+                the sender is done, the rest of the messages were lost. */
+            errno_assert (nn_errno () == EAGAIN ||
+                nn_errno () == ETIMEDOUT);
+            if (nn_atomic_load (&self->done))
+                break;
+            continue;
+        }
+        ++i;
+        if (self->twoway) {
+            rc = nn_send (self->in, buf, self->msgs [i - 1].reply, 0);
+            errno_assert (rc == (int) self->msgs [i - 1].reply);
+            continue;
+        }
+        now = nn_stopwatch_term (self->sw);
+        time = nn_getll ((uint8_t*) buf);
+        self->lats [self->nlats++] = now > time ? now - time : 0;
+    }
+    free (buf);
+}
+
+static int replay_cmp (const void *a, const void *b)
+{
+    uint64_t x;
+    uint64_t y;
+
+    x = *(const uint64_t*) a;
+    y = *(const uint64_t*) b;
+    return x < y ? -1 : x > y ? 1 : 0;
+}
+
+static uint64_t replay_percentile (struct replay_flow *self, double percentile)
+{
+    int i;
+
+    i = (int) (percentile / 100 * self->nlats + 0.5);
+    if (i > 0)
+        --i;
+    return self->lats [i];
+}
+
+static void replay_print (struct replay_flow *self, uint64_t duration)
+{
+    int i;
+    uint64_t bytes;
+
+    bytes = 0;
+    for (i = 0; i != self->count; ++i)
+        bytes += self->msgs [i].size;
+
+    printf ("\n%s:\n", self->name);
+    printf ("message count: %d\n", self->count);
+    printf ("message bytes: %llu\n", (unsigned long long) bytes);
+    if (!self->count)
+        return;
+    printf ("scheduled duration: %llu [us]\n",
+        (unsigned long long) self->msgs [self->count - 1].time);
+    printf ("replay duration: %llu [us]\n", (unsigned long long) duration);
+    printf ("max lag behind schedule: %llu [us]\n",
+        (unsigned long long) self->lag);
+    printf ("lost: %d\n", self->count - self->nlats);
+    if (!self->nlats)
+        return;
+    qsort (self->lats, self->nlats, sizeof (uint64_t), replay_cmp);
+    printf ("p50 %s: %llu [us]\n", self->twoway ? "roundtrip" : "latency",
+        (unsigned long long) replay_percentile (self, 50));
+    printf ("p99 %s: %llu [us]\n", self->twoway ? "roundtrip" : "latency",
+        (unsigned long long) replay_percentile (self, 99));
+    printf ("p99.9 %s: %llu [us]\n", self->twoway ? "roundtrip" : "latency",
+        (unsigned long long) replay_percentile (self, 99.9));
+    printf ("max %s: %llu [us]\n", self->twoway ? "roundtrip" : "latency",
+        (unsigned long long) self->lats [self->nlats - 1]);
+}
+
+static int replay_socket (int protocol)
+{
+    int rc;
+    int s;
+    int opt;
+
+    s = nn_socket (AF_SP, protocol);
+    errno_assert (s >= 0);
+    opt = REPLAY_TIMEOUT;
+    rc = nn_setsockopt (s, NN_SOL_SOCKET, NN_RCVTIMEO, &opt, sizeof (opt));
+    errno_assert (rc == 0);
+    if (protocol == NN_SUB) {
+        rc = nn_setsockopt (s, NN_SUB, NN_SUB_SUBSCRIBE, "", 0);
+        errno_assert (rc == 0);
+    }
+    return s;
+}
+
+int main (int argc, char *argv [])
+{
+    int rc;
+    int i;
+    int nflows;
+    int protocol;
+    int captured;
+    int peer;
+    int s1;
+    int s2;
+    double speed;
+    FILE *file;
+    uint8_t hdr [NN_CAPTURE_HDRSIZE];
+    uint8_t rec [NN_CAPTURE_RECSIZE];
+    uint64_t time;
+    uint32_t size;
+    uint32_t pipe;
+    uint32_t maxpipe;
+    uint64_t duration;
+    struct nn_stopwatch sw;
+    struct replay_flow flows [2];
+    struct replay_flow *sent;
+    struct replay_flow *received;
+
+    if (argc != 3 && argc != 4) {
+        printf ("usage: replay <capture-file> <bind-to> [<speed>]\n");
+        return 1;
+    }
+    speed = argc == 4 ? atof (argv [3]) : 1.0;
+    if (speed <= 0) {
+        printf ("speed has to be positive\n");
+        return 1;
+    }
+
+    file = fopen (argv [1], "rb");
+    if (!file) {
+        printf ("can't open %s\n", argv [1]);
+        return 1;
+    }
+    if (fread (hdr, 1, sizeof (hdr), file) != sizeof (hdr) ||
+          memcmp (hdr, NN_CAPTURE_MAGIC, 4) != 0 ||
+          nn_gets (hdr + 4) != NN_CAPTURE_VERSION) {
+        printf ("%s is not a capture file\n", argv [1]);
+        return 1;
+    }
+    protocol = nn_gets (hdr + 6);
+
+    /*  The sockets the traffic is replayed between. 'captured' stands for
+        the captured socket, 'peer' for the other end. */
+    captured = protocol;
+    switch (protocol) {
+    case NN_PAIR:
+    case NN_BUS:
+        peer = protocol;
+        break;
+    case NN_PUSH:
+        peer = NN_PULL;
+        break;
+    case NN_PULL:
+        peer = NN_PUSH;
+        break;
+    case NN_PUB:
+        peer = NN_SUB;
+        break;
+    case NN_SUB:
+        peer = NN_PUB;
+        break;
+    case NN_REQ:
+        peer = NN_REP;
+        break;
+    case NN_REP:
+        peer = NN_REQ;
+        break;
+    case NN_SURVEYOR:
+        peer = NN_RESPONDENT;
+        break;
+    case NN_RESPONDENT:
+        peer = NN_SURVEYOR;
+        break;
+    default:
+        printf ("socket type %d can't be replayed\n", protocol);
+        return 1;
+    }
+    s1 = replay_socket (captured);
+    s2 = replay_socket (peer);
+
+    /*  Messages sent by the captured socket flow from s1 to s2, those it
+        received from s2 to s1. In two-way patterns the requests go one way
+        and the replies are matched to them in order. */
+    memset (flows, 0, sizeof (flows));
+    nn_atomic_init (&flows [0].done, 0);
+    nn_atomic_init (&flows [1].done, 0);
+    flows [0].name = "sent by the captured socket";
+    flows [0].out = s1;
+    flows [0].in = s2;
+    flows [1].name = "received by the captured socket";
+    flows [1].out = s2;
+    flows [1].in = s1;
+    sent = &flows [0];
+    received = &flows [1];
+    if (protocol == NN_REQ || protocol == NN_SURVEYOR)
+        sent->twoway = 1;
+    if (protocol == NN_REP || protocol == NN_RESPONDENT)
+        received->twoway = 1;
+
+    maxpipe = 0;
+    while (fread (rec, 1, sizeof (rec), file) == sizeof (rec)) {
+        time = (uint64_t) (nn_getll (rec) / 1000 / speed);
+        size = nn_getl (rec + 8);
+        pipe = nn_getl (rec + 12);
+        if ((pipe & ~NN_CAPTURE_RECV) > maxpipe)
+            maxpipe = pipe & ~NN_CAPTURE_RECV;
+        if (pipe & NN_CAPTURE_RECV) {
+            if (sent->twoway)
+                replay_reply (sent, size);
+            else
+                replay_add (received, time, size);
+        }
+        else {
+            if (received->twoway)
+                replay_reply (received, size);
+            else
+                replay_add (sent, time, size);
+        }
+    }
+    fclose (file);
+
+    printf ("socket type: %d\n", protocol);
+    printf ("connections: %u\n", (unsigned) maxpipe);
+    printf ("address: %s\n", argv [2]);
+    printf ("speed: %.2f\n", speed);
+
+    rc = nn_bind (s2, argv [2]);
+    errno_assert (rc >= 0);
+    rc = nn_connect (s1, argv [2]);
+    errno_assert (rc >= 0);
+    nn_sleep (REPLAY_SETTLE);
+
+    /*  Start all the flows at once, on a common clock. */
+    nflows = 0;
+    nn_stopwatch_init (&sw);
+    for (i = 0; i != 2; ++i) {
+        if (!flows [i].count)
+            continue;
+        flows [i].lats = malloc (flows [i].count * sizeof (uint64_t));
+        alloc_assert (flows [i].lats);
+        flows [i].sw = &sw;
+        nn_thread_init (&flows [i].sender, replay_send, &flows [i]);
+        nn_thread_init (&flows [i].receiver, replay_recv, &flows [i]);
+        ++nflows;
+    }
+    for (i = 0; i != 2; ++i) {
+        if (!flows [i].count)
+            continue;
+        nn_thread_term (&flows [i].sender);
+        nn_thread_term (&flows [i].receiver);
+    }
+    duration = nn_stopwatch_term (&sw);
+
+    for (i = 0; i != 2; ++i) {
+        if (flows [i].count)
+            replay_print (&flows [i], duration);
+        free (flows [i].msgs);
+        free (flows [i].lats);
+        nn_atomic_term (&flows [i].done);
+    }
+    if (!nflows)
+        printf ("\nno messages captured\n");
+
+    rc = nn_close (s1);
+    errno_assert (rc == 0);
+    rc = nn_close (s2);
+    errno_assert (rc == 0);
+
+    return 0;
+}
@@ -0,0 +1,82 @@
+/*
+    Copyright (c) 2013 250bpm s.r.o.
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"),
+    to deal in the Software without restriction, including without limitation
+    the rights to use, copy, modify, merge, publish, distribute, sublicense,
+    and/or sell copies of the Software, and to permit persons to whom
+    the Software is furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included
+    in all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+    THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+    FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+    IN THE SOFTWARE.
+*/
+
+
+/*  Measures the rate at which sockets can be created and closed. Optionally,
+    each socket is bound to an inproc address before it's closed. */
+
+#include "../src/nn.h"
+#include "../src/pair.h"
+
+#include "../src/utils/err.c"
+#include "../src/utils/stopwatch.c"
+
+#include <stdio.h>
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+
+int main (int argc, char *argv [])
+{
+    int rc;
+    int s;
+    int i;
+    int count;
+    int bind;
+    struct nn_stopwatch stopwatch;
+    uint64_t elapsed;
+    unsigned long rate;
+
+    if (argc != 2 && !(argc == 3 && strcmp (argv [2], "bind") == 0)) {
+        printf ("usage: socket_rate <socket-count> [bind]\n");
+        return 1;
+    }
+
+    count = atoi (argv [1]);
+    bind = argc == 3;
+
+    nn_stopwatch_init (&stopwatch);
+
+    for (i = 0; i != count; i++) {
+        s = nn_socket (AF_SP, NN_PAIR);
+        assert (s != -1);
+        if (bind) {
+            rc = nn_bind (s, "inproc://socket_rate");
+            assert (rc >= 0);
+        }
+        rc = nn_close (s);
+        assert (rc == 0);
+    }
+
+    elapsed = nn_stopwatch_term (&stopwatch);
+
+    if (elapsed == 0)
+        elapsed = 1;
+    rate = (unsigned long) ((double) count / (double) elapsed * 1000000);
+
+    printf ("socket count: %d\n", count);
+    printf ("bound: %s\n", bind ? "yes" : "no");
+    printf ("mean rate: %d [sockets/s]\n", (int) rate);
+
+    return 0;
+}
+
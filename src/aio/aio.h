@@ -26,6 +26,7 @@
 #include "../utils/addr.h"
 
 #include <stddef.h>
+#include <stdint.h>
 
 /*  These objects are not thread-safe. To make it work correctly, all the calls
     should by synchronised via nn_cp_lock(). All the callbacks are already
@@ -35,8 +36,12 @@ struct nn_cp;
 struct nn_timer;
 struct nn_usock;
 struct nn_event;
+struct nn_ticker;
+struct nn_flusher;
 
-#define NN_AIO_MAX_IOVCNT 3
+/*  Enough for a batch of several messages, each consisting of a stream
+    header, SP header, body and possibly several body fragments. */
+#define NN_AIO_MAX_IOVCNT 64
 
 struct nn_iobuf {
     void *iov_base;
@@ -73,6 +78,21 @@ void nn_event_init (struct nn_event *self, const struct nn_cp_sink **sink,
 void nn_event_term (struct nn_event *self);
 void nn_event_signal (struct nn_event *self);
 
+/*  Signals the event without involving the worker thread. If the completion
+    port is locked at the moment, the event is processed by the thread that
+    holds the lock, as it unlocks it. Otherwise the completion port is locked
+    and the function returns 1. The caller then has to unlock it using
+    nn_cp_unlock or nn_cp_flush, which process the event. Returns 0
+    otherwise. */
+int nn_event_post (struct nn_event *self);
+
+/*  Same as nn_event_post except that it doesn't try to lock the completion
+    port. The event is processed by whoever unlocks the completion port next.
+    Unless someone is sure to do that, the caller has to check for the events
+    using nn_cp_pending later on, which allows several events to be processed
+    at once. */
+void nn_event_push (struct nn_event *self);
+
 int nn_usock_init (struct nn_usock *self, const struct nn_cp_sink **sink,
     int domain, int type, int protocol, int sndbuf, int rcvbuf,
     struct nn_cp *cp);
@@ -92,14 +112,256 @@ void nn_usock_accept (struct nn_usock *self);
 
 void nn_usock_send (struct nn_usock *self,
     const struct nn_iobuf *iov, int iovcnt);
+
+/*  Maximum number of file descriptors passed by a single nn_usock_sendfds
+    call. */
+#ifndef NN_USOCK_MAX_FDS
+#define NN_USOCK_MAX_FDS 8
+#endif
+
+/*  Same as nn_usock_send, except that the file descriptors in 'fds' are
+    passed to the peer along with the data. Available for UNIX domain sockets
+    only. The descriptors must be kept open till the send is done. */
+void nn_usock_sendfds (struct nn_usock *self,
+    const struct nn_iobuf *iov, int iovcnt, const int *fds, int nfds);
+
+/*  Same as nn_usock_send, except that 'len' bytes of file 'fd' starting at
+    'offset' are sent after the data in 'iov', by the kernel, without being
+    copied through user space. The descriptor must be kept open till the send
+    is done. If the file turns out to be shorter, the connection fails.
+    Available only if NN_USE_SENDFILE is defined. */
+void nn_usock_sendfile (struct nn_usock *self, const struct nn_iobuf *iov,
+    int iovcnt, int fd, uint64_t offset, size_t len);
 void nn_usock_recv (struct nn_usock *self, void *buf, size_t len);
 
+/*  Receives a single datagram. Datagrams longer than 'len' bytes are
+    truncated. Once the 'received' callback is invoked, nn_usock_dgramlen
+    returns the size of the datagram received. When sending via a datagram
+    socket, datagrams that can't be sent because of an error are dropped
+    rather than reported. Available for datagram sockets only. */
+void nn_usock_recvdgram (struct nn_usock *self, void *buf, size_t len);
+size_t nn_usock_dgramlen (struct nn_usock *self);
+
+/*  Maximum number of datagrams received or sent by a single system call. */
+#ifndef NN_USOCK_MAX_DGRAMS
+#define NN_USOCK_MAX_DGRAMS 32
+#endif
+
+/*  Datagram received by nn_usock_recvdgrams. 'buf' and 'size' describe
+    the buffer to receive the datagram into. Once received, 'len' is the size
+    of the datagram, bigger than 'size' if the datagram was truncated, and
+    'addr' and 'addrlen' are the address of the sender. */
+struct nn_usock_dgram {
+    void *buf;
+    size_t size;
+    size_t len;
+    struct sockaddr_storage addr;
+    nn_socklen addrlen;
+};
+
+/*  Receives at least one and at most 'count' datagrams, using a single
+    system call where possible. Once the 'received' callback is invoked,
+    nn_usock_dgramcount returns the number of datagrams received. Also
+    available for SOCK_SEQPACKET sockets, in which case the records are
+    read from the connection without an address, and an error or an empty
+    record, meaning that the peer closed the connection, is reported by
+    the 'err' callback. */
+void nn_usock_recvdgrams (struct nn_usock *self,
+    struct nn_usock_dgram *dgrams, int count);
+int nn_usock_dgramcount (struct nn_usock *self);
+
+/*  Sends 'nrecs' records via a SOCK_SEQPACKET socket, using as few system
+    calls as possible. Record i is made of the next 'reciovs [i]' buffers of
+    'iov'; it must not be empty. Once all the records are sent, the 'sent'
+    callback is invoked. nn_usock_isseqpacket returns 1 for SOCK_SEQPACKET
+    sockets, 0 otherwise. */
+void nn_usock_sendrecs (struct nn_usock *self, const struct nn_iobuf *iov,
+    int iovcnt, const int *reciovs, int nrecs);
+int nn_usock_isseqpacket (struct nn_usock *self);
+
+/*  Sends the datagram composed of 'iov' to each of the 'count' addresses,
+    using as few system calls as possible. If 'addrs' is NULL, the datagram
+    is sent once, to the address the socket is connected to. The datagrams
+    are sent synchronously and no callback is invoked; those that can't be
+    sent immediately are dropped. */
+void nn_usock_sendto (struct nn_usock *self, const struct nn_iobuf *iov,
+    int iovcnt, const struct sockaddr_storage *addrs,
+    const nn_socklen *addrlens, int count);
+
+/*  Sets an option on the underlying OS-level socket. Returns 0 in case of
+    success, negative error code otherwise. */
+int nn_usock_setsockopt (struct nn_usock *self, int level, int optname,
+    const void *optval, size_t optvallen);
+
+/*  Moves the worker thread of the completion port to the CPU the kernel
+    processes the incoming packets of the connection on (SO_INCOMING_CPU),
+    so that the packets and the data they carry are handled by the same
+    cache. Has no effect unless called from the worker thread itself.
+    Linux only. */
+void nn_usock_follow (struct nn_usock *self);
+
+/*  If set to 1, outgoing data are corked while nn_usock_send is in progress
+    and flushed to the network once it is done. The setting is inherited by
+    the sockets accepted from this socket. */
+void nn_usock_setcork (struct nn_usock *self, int cork);
+
+/*  If set to 1, file descriptors passed by the peer are accepted and can be
+    retrieved, in the order they were sent, using nn_usock_recvfd. Otherwise
+    they are discarded. The setting is inherited by the sockets accepted
+    from this socket. nn_usock_recvfd returns -1 if there's no descriptor
+    available, otherwise the caller becomes the owner of the descriptor. */
+void nn_usock_setfdpassing (struct nn_usock *self, int enable);
+int nn_usock_getfdpassing (struct nn_usock *self);
+int nn_usock_recvfd (struct nn_usock *self);
+
+/*  Attaches TLS configuration to the socket. The connection is going to be
+    secured by the object using the socket, acting as a server if 'server'
+    is 1. The sockets accepted from this socket inherit the configuration and
+    act as servers. The socket holds a reference to 'tls'. nn_usock_gettls
+    returns NULL if no configuration is attached. */
+struct nn_tls;
+void nn_usock_settls (struct nn_usock *self, struct nn_tls *tls, int server);
+struct nn_tls *nn_usock_gettls (struct nn_usock *self, int *server);
+
+/*  Messages with body at least 'threshold' bytes long are to be compressed
+    by the object using the socket, if the peer supports it. Zero means no
+    compression. The sockets accepted from this socket inherit the setting. */
+void nn_usock_setcompress (struct nn_usock *self, size_t threshold);
+size_t nn_usock_getcompress (struct nn_usock *self);
+
+/*  Messages are to be sent along with their checksums by the object using
+    the socket, if the peer supports it. The sockets accepted from this
+    socket inherit the setting. */
+void nn_usock_setcrc (struct nn_usock *self, int crc);
+int nn_usock_getcrc (struct nn_usock *self);
+
+/*  Sends of at least 'threshold' bytes are done without copying the data
+    into the kernel. Such a send is reported as complete only once the
+    kernel is done with the data, which may be when the peer acknowledges
+    them, so the buffers must stay intact until then. If the kernel falls
+    back to copying the data, the following sends are done in the standard
+    way. The sockets accepted from this socket inherit the setting. Returns
+    -ENOTSUP if the platform can't do that. */
+int nn_usock_setzerocopy (struct nn_usock *self, size_t threshold);
+
+/*  Marks the socket as carrying a WebSocket connection. The object using
+    the socket does the opening handshake, acting as a server if 'server' is
+    1. The sockets accepted from this socket inherit the setting and act as
+    servers. nn_usock_getws returns 0 if the socket is not a WebSocket one,
+    1 otherwise. */
+void nn_usock_setws (struct nn_usock *self, int server);
+int nn_usock_getws (struct nn_usock *self, int *server);
+
+/*  If set to 0, no data beyond those requested by nn_usock_recv are read
+    from the socket. This is needed when the processing of the data stream
+    is going to be passed to the kernel at some point. Default is 1. */
+void nn_usock_setreadahead (struct nn_usock *self, int enable);
+
+/*  If set to 1, the kernel is asked to timestamp the incoming data.
+    nn_usock_gettstamp then returns the time the data obtained by the most
+    recent read from the socket were received, in nanoseconds since the
+    epoch, or 0 if not known. nn_usock_settstamp returns -ENOTSUP if the
+    platform can't timestamp the data. */
+int nn_usock_settstamp (struct nn_usock *self, int enable);
+uint64_t nn_usock_gettstamp (struct nn_usock *self);
+
+/*  Gives direct access to the data that were already read from the socket
+    but not yet requested by nn_usock_recv(). Returns the number of bytes
+    available; '*buf' is set to point to them. nn_usock_consume() discards
+    the specified number of bytes from the beginning of the data. */
+size_t nn_usock_peek (struct nn_usock *self, const void **buf);
+void nn_usock_consume (struct nn_usock *self, size_t len);
+
+/*  Hot restart support (see nn_handoff). nn_usock_init_fd initialises
+    the object using socket 's' passed over from another process, which is
+    bound and possibly listening already. nn_usock_getfd returns
+    the underlying socket. nn_usock_isidle returns 1 if nothing is being
+    sent and no data were read from the socket beyond those already passed
+    to the user of the object, except for a receive into 'buf' that got no
+    data yet, i.e. if the socket can be passed over to another process
+    without losing any data; 0 otherwise. Not available on Windows. */
+int nn_usock_init_fd (struct nn_usock *self, const struct nn_cp_sink **sink,
+    int s, struct nn_cp *cp);
+int nn_usock_getfd (struct nn_usock *self);
+int nn_usock_isidle (struct nn_usock *self, const void *buf);
+
+/*  Reads NN_CP_SPIN environment variable, the time in microseconds the worker
+    threads of the completion ports keep polling for events without blocking
+    after the last event. On Windows, reads NN_CP_WORKERS environment variable
+    instead, the number of worker threads per completion port. Must not be
+    called while any completion ports exist. */
+void nn_cp_setup (void);
+
 int nn_cp_init (struct nn_cp *self);
 void nn_cp_term (struct nn_cp *self);
 
+/*  The worker thread of a completion port, along with the file descriptors
+    it polls, is created only once the completion port is first needed.
+    nn_cp_start creates it straight away so that failures to do so can be
+    reported to the user. Once started, it does nothing. */
+int nn_cp_start (struct nn_cp *self);
+
+/*  Makes the worker thread of the completion port run on the CPUs of NUMA
+    node 'node', -1 meaning any node. Has no effect once the worker thread
+    is started. */
+void nn_cp_setnode (struct nn_cp *self, int node);
+
 void nn_cp_lock (struct nn_cp *self);
 void nn_cp_unlock (struct nn_cp *self);
 
+/*  Locks the completion port if it's not locked at the moment. Returns 1 if
+    it was locked, 0 otherwise. */
+int nn_cp_trylock (struct nn_cp *self);
+
+/*  Same as nn_cp_unlock except that it doesn't check for the events posted
+    while the completion port was being unlocked. It's meant for the threads
+    that don't own the completion port, which may cease to exist once it's
+    unlocked. Once such thread makes sure that the completion port still
+    exists, it has to check for the events using nn_cp_pending and, if there
+    are any, process them in the same way as nn_event_post tells. */
+void nn_cp_flush (struct nn_cp *self);
+int nn_cp_pending (struct nn_cp *self);
+
+/*  Initialises a completion port with no worker thread. The events are
+    processed by the user calling nn_cp_process, which must not be done
+    while the completion port is locked. nn_cp_process waits for at most
+    'timeout' milliseconds, processes all the events available and returns
+    the number of milliseconds till the next timer expiration, -1 if there
+    are no timers. nn_cp_getfd returns a file descriptor that becomes
+    readable when there is some processing to do, -1 if the platform doesn't
+    provide one. nn_cp_wakeup interrupts a nn_cp_process call that is
+    waiting for events. */
+int nn_cp_init_external (struct nn_cp *self);
+int nn_cp_isexternal (struct nn_cp *self);
+int nn_cp_process (struct nn_cp *self, int timeout);
+int nn_cp_getfd (struct nn_cp *self);
+void nn_cp_wakeup (struct nn_cp *self);
+
+/*  Time, in nanoseconds, the thread processing the events of the completion
+    port spent waiting for the events, waiting for the completion port lock,
+    running the timers, doing I/O on the sockets, including the callbacks
+    the data are passed to, processing the events signalled by other threads
+    and updating the pollset. Must be called with the completion port
+    locked. Not available on Windows, where all the values are zero. */
+struct nn_cp_stats {
+    uint64_t wait;
+    uint64_t lock;
+    uint64_t timers;
+    uint64_t io;
+    uint64_t events;
+    uint64_t ops;
+};
+
+void nn_cp_getstats (struct nn_cp *self, struct nn_cp_stats *stats);
+
+/*  Arms the high-resolution alarm of the completion port to go off once
+    nn_clock_monotonic reaches 'deadline', replacing the previous setting.
+    Zero disarms the alarm. When the alarm goes off, the thread processing
+    the events invokes nn_flusher_alarm (see flusher.h) with the completion
+    port locked. Returns -ENOTSUP if the platform has no timer finer than
+    nn_timer. Must be called with the completion port locked. */
+int nn_cp_setalarm (struct nn_cp *self, uint64_t deadline);
+
 #if defined NN_HAVE_WINDOWS
 
 #include "../utils/win.h"
@@ -108,6 +370,13 @@ void nn_cp_unlock (struct nn_cp *self);
 
 #include "timerset.h"
 
+/*  Registered I/O is compiled in only if asked for by RIO build option and
+    the SDK is recent enough (Windows 8 and newer). Whether it's used at run
+    time is decided by NN_CP_RIO. */
+#if defined NN_USE_RIO && defined SIO_GET_MULTIPLE_EXTENSION_FUNCTION_POINTER
+#define NN_HAVE_RIO
+#endif
+
 struct nn_timer {
     const struct nn_cp_sink **sink;
     struct nn_cp *cp;
@@ -142,8 +411,44 @@ struct nn_usock {
     int domain;
     int type;
     int protocol;
+    size_t compress;
+    int crc;
+
+    /*  0 if not a WebSocket, 1 for the client side, 2 for the server side. */
+    int ws;
+
+#if defined NN_HAVE_RIO
+    /*  1 if the socket was opened for registered I/O. The request queue and
+        the registered buffer are created on the first send or receive. */
+    int rio;
+    RIO_RQ riorq;
+    RIO_BUFFERID riobuf;
+
+    /*  Registered memory. The first half is used for sending, the second
+        one for receiving. */
+    char *rioarea;
+
+    /*  The data being sent. 'riosndpos' is the index of the first buffer not
+        yet sent, 'riosndoff' is the number of bytes of it that were. */
+    struct nn_iobuf riosnd [NN_AIO_MAX_IOVCNT];
+    int riosndcnt;
+    int riosndpos;
+    size_t riosndoff;
+
+    /*  The part of the user's buffer yet to be received into. */
+    char *riorcv;
+    size_t riorcvlen;
+
+    /*  Data received but not yet requested by the user. They are stored in
+        the receive half of the registered memory, starting at 'rioaheadpos'. */
+    size_t rioaheadpos;
+    size_t rioaheadlen;
+#endif
 };
 
+/*  Maximum number of worker threads per completion port. */
+#define NN_CP_MAX_WORKERS 16
+
 struct nn_cp {
     struct nn_mutex sync;
     struct nn_timerset timeout;
@@ -154,15 +459,42 @@ struct nn_cp {
     char stop_event;
     char timer_event;
 
-    struct nn_thread worker;
+    /*  The worker threads. All of them wait on the completion port, the
+        completions are processed with 'sync' locked. */
+    struct nn_thread workers [NN_CP_MAX_WORKERS];
+    int nworkers;
+    int stop;
+
+    /*  Ticks shared by the users of the completion port, see ticker.h. */
+    struct nn_ticker *ticker;
+
+    /*  Flushes shared by the users of the completion port, see flusher.h. */
+    struct nn_flusher *flusher;
+
+#if defined NN_HAVE_RIO
+    /*  Registered I/O. All the sockets of the completion port share a single
+        RIO completion queue. The completion port is notified about new
+        entries in the queue via 'rioolpd' with 'rio_event' as a key. */
+    int rio;
+    RIO_EXTENSION_FUNCTION_TABLE riofns;
+    RIO_CQ riocq;
+    DWORD riocqsize;
+    DWORD rioqueues;
+    OVERLAPPED rioolpd;
+    char rio_event;
+#endif
 };
 
 #else
 
 #include "../utils/efd.h"
 #include "../utils/queue.h"
+#include "../utils/mpscq.h"
+#include "../utils/cacheline.h"
+#include "../utils/cacheline.h"
 #include "../utils/thread.h"
 #include "../utils/mutex.h"
+#include "../utils/atomic.h"
 
 #include "poller.h"
 #include "timerset.h"
@@ -195,14 +527,61 @@ struct nn_cp_op_hndl {
 #define NN_USOCK_INOP_NONE 0
 #define NN_USOCK_INOP_RECV 1
 #define NN_USOCK_INOP_ACCEPT 2
+#define NN_USOCK_INOP_RECVDGRAM 3
+#define NN_USOCK_INOP_RECVDGRAMS 4
 
 #define NN_USOCK_OUTOP_NONE 0
 #define NN_USOCK_OUTOP_SEND 1
 #define NN_USOCK_OUTOP_CONNECT 2
+#define NN_USOCK_OUTOP_ZEROCOPY 3
 
 #define NN_USOCK_FLAG_REGISTERED 1
-
+#define NN_USOCK_FLAG_CORK 2
+#define NN_USOCK_FLAG_FDPASSING 4
+#define NN_USOCK_FLAG_NOREADAHEAD 8
+#define NN_USOCK_FLAG_TLSSERVER 16
+#define NN_USOCK_FLAG_DGRAM 32
+#define NN_USOCK_FLAG_WS 64
+#define NN_USOCK_FLAG_WSSERVER 128
+#define NN_USOCK_FLAG_TSTAMP 256
+
+/*  Maximum number of received file descriptors waiting to be retrieved. */
+#define NN_USOCK_FDQUEUE (NN_USOCK_MAX_FDS * 4)
+
+/*  Bounds of the per-connection receive batch buffer. The buffer starts at
+    the minimum size and adapts to the amount of data that each read
+    actually yields. */
+#ifndef NN_USOCK_BATCH_SIZE
 #define NN_USOCK_BATCH_SIZE 2048
+#endif
+#ifndef NN_USOCK_BATCH_MAX
+#define NN_USOCK_BATCH_MAX 65536
+#endif
+
+/*  A connection gives its batch buffer up whenever it has to wait for
+    the data to arrive, so the buffers are held by the connections that are
+    receiving at the moment rather than by all of them. The completion port
+    keeps up to this many buffers of the minimum size for re-use. */
+#ifndef NN_CP_MAX_BATCHES
+#define NN_CP_MAX_BATCHES 64
+#endif
+
+/*  Maximum number of connections accepted in one go when the listening
+    socket becomes readable. */
+#ifndef NN_USOCK_ACCEPT_BATCH
+#define NN_USOCK_ACCEPT_BATCH 32
+#endif
+
+/*  While waiting for at least NN_USOCK_RCVLOWAT_MIN bytes of a TCP stream,
+    the socket is reported readable only once that much data, up to
+    NN_USOCK_RCVLOWAT_MAX, has arrived. The kernel caps the value to half
+    of the receive buffer. */
+#ifndef NN_USOCK_RCVLOWAT_MIN
+#define NN_USOCK_RCVLOWAT_MIN 65536
+#endif
+#ifndef NN_USOCK_RCVLOWAT_MAX
+#define NN_USOCK_RCVLOWAT_MAX 262144
+#endif
 
 struct nn_usock {
     const struct nn_cp_sink **sink;
@@ -215,34 +594,118 @@ struct nn_usock {
         int op;
         uint8_t *buf;
         size_t len;
+        struct nn_usock_dgram *dgrams;
         struct nn_cp_op_hndl hndl;
         uint8_t *batch;
+        size_t batch_size;
         size_t batch_len;
         size_t batch_pos;
+        int fds [NN_USOCK_FDQUEUE];
+        int fdpos;
+        int fdcount;
+        uint64_t tstamp;
+
+        /*  Current SO_RCVLOWAT of the socket. */
+        size_t lowat;
     } in;
     struct {
         int op;
         struct msghdr hdr;
         struct iovec iov [NN_AIO_MAX_IOVCNT];
+        union {
+            struct cmsghdr align;
+            uint8_t buf [CMSG_SPACE (sizeof (int) * NN_USOCK_MAX_FDS)];
+        } ctl;
+        int file;
+        uint64_t fileoff;
+        size_t filelen;
         struct nn_cp_op_hndl hndl;
+
+        /*  If 'nrecs' is not zero, the iovecs are sent as that many records,
+            'recs' being the number of iovecs in each of them and 'rec'
+            the first one not sent yet, starting at 'msg_iov' of 'hdr'. */
+        int recs [NN_AIO_MAX_IOVCNT];
+        int nrecs;
+        int rec;
+
+        /*  Set if the data being sent are not to be copied. The kernel
+            numbers the sends done without copying; 'zcnext' is the number
+            of the next one, 'zcdone' the number of the first one the kernel
+            isn't done with yet. */
+        int zerocopy;
+        uint32_t zcnext;
+        uint32_t zcdone;
     } out;
     int domain;
     int type;
     int protocol;
     int flags;
+    struct nn_tls *tls;
+    size_t compress;
+    int crc;
+    size_t zerocopy;
 };
 
 struct nn_cp {
+
+    /*  The lock is contended by the user threads and the worker thread. It's
+        kept apart from the queue of incoming events, which is written to
+        without locking, and from the rest of the completion port. */
     struct nn_mutex sync;
+    NN_CACHELINE_PAD (pad1);
+
+    /*  Events signalled from any thread are pushed into 'incoming' without
+        locking. They are moved to 'events' by whoever holds the completion
+        port lock. */
+    struct nn_mpscq incoming;
+    NN_CACHELINE_PAD (pad2);
+    struct nn_queue events;
+
+    /*  Events posted by nn_event_post. They are moved to 'posted' and
+        processed by whoever unlocks the completion port. */
+    struct nn_mpscq direct;
+    struct nn_queue posted;
+
     struct nn_timerset timeout;
     struct nn_efd efd;
     struct nn_poller_hndl efd_hndl;
+#if defined NN_USE_TIMERFD
+    int tfd;
+    struct nn_poller_hndl tfd_hndl;
+#endif
     struct nn_poller poller;
     struct nn_queue opqueue;
-    struct nn_mutex events_sync;
-    struct nn_queue events;
     int stop;
     struct nn_thread worker;
+
+    /*  NUMA node the worker thread is to run on, -1 if any. */
+    int node;
+
+    /*  Ticks shared by the users of the completion port, see ticker.h. */
+    struct nn_ticker *ticker;
+
+    /*  Flushes shared by the users of the completion port, see flusher.h. */
+    struct nn_flusher *flusher;
+
+    /*  Unused batch buffers of the minimum size, linked through their first
+        bytes. Accessed with the completion port locked. */
+    void *batches;
+    int nbatches;
+
+    /*  Set once the efd, the poller and the worker thread were created.
+        'startsync' serialises the threads trying to create them. */
+    struct nn_atomic started;
+    struct nn_mutex startsync;
+
+    /*  If set, there's no worker thread. The events are processed by
+        nn_cp_process, one thread at a time, as guarded by 'procsync'.
+        'processing' is set while the events are being dispatched. */
+    int external;
+    int processing;
+    struct nn_mutex procsync;
+
+    /*  Accessed with the completion port locked. */
+    struct nn_cp_stats stats;
 };
 
 #endif
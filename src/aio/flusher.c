@@ -0,0 +1,204 @@
+/*
+    Copyright (c) 2012-2013 250bpm s.r.o.
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"),
+    to deal in the Software without restriction, including without limitation
+    the rights to use, copy, modify, merge, publish, distribute, sublicense,
+    and/or sell copies of the Software, and to permit persons to whom
+    the Software is furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included
+    in all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+    THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+    FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+    IN THE SOFTWARE.
+*/
+
+
+#include "flusher.h"
+
+#include "../utils/err.h"
+#include "../utils/cont.h"
+#include "../utils/alloc.h"
+#include "../utils/clock.h"
+
+/*  The flushes of a completion port. It's created along with the first
+    flush started and lives as long as the completion port, so that
+    starting and stopping the flushes at high rate allocates nothing. */
+struct nn_flusher {
+    const struct nn_cp_sink *sink;
+    struct nn_cp *cp;
+
+    /*  The flushes started, ordered by their deadlines. */
+    struct nn_list flushes;
+
+    /*  1 if the flushes are driven by the alarm of the completion port,
+        0 if by 'timer'. */
+    int hires;
+    struct nn_timer timer;
+
+    /*  The deadline the alarm or the timer is set to, zero if neither is.
+        Neither is reset when the flushes are stopped; going off with no
+        flush due does no harm. */
+    uint64_t armed;
+};
+
+/*  Private functions. */
+static void nn_flusher_timeout (const struct nn_cp_sink **self,
+    struct nn_timer *timer);
+static void nn_flusher_arm (struct nn_flusher *self);
+static void nn_flusher_fire (struct nn_flusher *self);
+
+static const struct nn_cp_sink nn_flusher_sink = {
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    nn_flusher_timeout,
+    NULL
+};
+
+void nn_flush_init (struct nn_flush *self, nn_flush_fn *fn, struct nn_cp *cp)
+{
+    self->fn = fn;
+    self->cp = cp;
+    self->deadline = 0;
+    nn_list_item_init (&self->item);
+}
+
+void nn_flush_term (struct nn_flush *self)
+{
+    nn_flush_stop (self);
+    nn_list_item_term (&self->item);
+}
+
+void nn_flush_start (struct nn_flush *self, int delay)
+{
+    struct nn_flusher *flusher;
+    struct nn_list_item *it;
+    struct nn_list_item *prev;
+
+    if (nn_list_item_isinlist (&self->item))
+        return;
+
+    flusher = self->cp->flusher;
+    if (!flusher) {
+        flusher = nn_alloc (sizeof (struct nn_flusher), "flusher");
+        alloc_assert (flusher);
+        flusher->sink = &nn_flusher_sink;
+        flusher->cp = self->cp;
+        nn_list_init (&flusher->flushes);
+        flusher->hires = nn_cp_setalarm (self->cp, 0) == 0;
+        nn_timer_init (&flusher->timer, &flusher->sink, self->cp);
+        flusher->armed = 0;
+        self->cp->flusher = flusher;
+    }
+
+    /*  Keep the flushes ordered by their deadlines. The objects mostly use
+        the same delay, so the flush usually goes to the end straight away. */
+    self->deadline = nn_clock_monotonic () + (uint64_t) delay * 1000;
+    it = nn_list_end (&flusher->flushes);
+    while (it != nn_list_begin (&flusher->flushes)) {
+        prev = nn_list_prev (&flusher->flushes, it);
+        if (nn_cont (prev, struct nn_flush, item)->deadline <=
+              self->deadline)
+            break;
+        it = prev;
+    }
+    nn_list_insert (&flusher->flushes, &self->item, it);
+    nn_flusher_arm (flusher);
+}
+
+void nn_flush_stop (struct nn_flush *self)
+{
+    struct nn_flusher *flusher;
+
+    if (!nn_list_item_isinlist (&self->item))
+        return;
+
+    flusher = self->cp->flusher;
+    nn_assert (flusher);
+    nn_list_erase (&flusher->flushes, &self->item);
+}
+
+void nn_flusher_alarm (struct nn_cp *cp)
+{
+    if (cp->flusher && cp->flusher->hires)
+        nn_flusher_fire (cp->flusher);
+}
+
+void nn_flusher_term (struct nn_cp *cp)
+{
+    struct nn_flusher *flusher;
+
+    flusher = cp->flusher;
+    if (!flusher)
+        return;
+    cp->flusher = NULL;
+    nn_assert (nn_list_empty (&flusher->flushes));
+    nn_timer_term (&flusher->timer);
+    nn_list_term (&flusher->flushes);
+    nn_free (flusher);
+}
+
+static void nn_flusher_timeout (const struct nn_cp_sink **self,
+    struct nn_timer *timer)
+{
+    nn_flusher_fire (nn_cont (self, struct nn_flusher, sink));
+}
+
+/*  Makes sure the alarm or the timer goes off no later than the deadline of
+    the first flush. */
+static void nn_flusher_arm (struct nn_flusher *self)
+{
+    int rc;
+    uint64_t deadline;
+    uint64_t now;
+
+    if (nn_list_empty (&self->flushes))
+        return;
+    deadline = nn_cont (nn_list_begin (&self->flushes), struct nn_flush,
+        item)->deadline;
+    if (self->armed && self->armed <= deadline)
+        return;
+
+    if (self->hires) {
+        rc = nn_cp_setalarm (self->cp, deadline);
+        errnum_assert (rc == 0, -rc);
+    }
+    else {
+        now = nn_clock_monotonic ();
+        nn_timer_start (&self->timer, deadline > now ?
+            (int) ((deadline - now + 999999) / 1000000) : 0);
+    }
+    self->armed = deadline;
+}
+
+static void nn_flusher_fire (struct nn_flusher *self)
+{
+    uint64_t now;
+    struct nn_flush *flush;
+
+    /*  Invoke the callbacks of the flushes that are due. A flush is removed
+        from the list before its callback is invoked, so that the callback
+        can start it again or stop any other flush. */
+    self->armed = 0;
+    now = nn_clock_monotonic ();
+    while (!nn_list_empty (&self->flushes)) {
+        flush = nn_cont (nn_list_begin (&self->flushes), struct nn_flush,
+            item);
+        if (flush->deadline > now)
+            break;
+        nn_list_erase (&self->flushes, &flush->item);
+        flush->fn (flush);
+    }
+    nn_flusher_arm (self);
+}
@@ -0,0 +1,67 @@
+/*
+    Copyright (c) 2012-2013 250bpm s.r.o.
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"),
+    to deal in the Software without restriction, including without limitation
+    the rights to use, copy, modify, merge, publish, distribute, sublicense,
+    and/or sell copies of the Software, and to permit persons to whom
+    the Software is furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included
+    in all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+    THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+    FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+    IN THE SOFTWARE.
+*/
+
+
+#ifndef NN_FLUSHER_INCLUDED
+#define NN_FLUSHER_INCLUDED
+
+#include "aio.h"
+
+#include "../utils/list.h"
+
+#include <stdint.h>
+
+/*  One-shot flushes shared by all the objects using a completion port, such
+    as the stream sessions holding small messages back to send them in
+    a single batch (NN_SNDBATCH). Once started, the callback of the flush is
+    invoked after the specified number of microseconds with the completion
+    port locked. All the flushes of the completion port are driven by
+    a single timer: the high-resolution alarm of the completion port where
+    available, otherwise a nn_timer, which rounds the delays up to its own
+    granularity. */
+
+struct nn_flush;
+
+typedef void (nn_flush_fn) (struct nn_flush *self);
+
+struct nn_flush {
+    nn_flush_fn *fn;
+    struct nn_cp *cp;
+    uint64_t deadline;
+    struct nn_list_item item;
+};
+
+void nn_flush_init (struct nn_flush *self, nn_flush_fn *fn, struct nn_cp *cp);
+void nn_flush_term (struct nn_flush *self);
+
+/*  If the flush is started already, it keeps its original deadline. */
+void nn_flush_start (struct nn_flush *self, int delay);
+void nn_flush_stop (struct nn_flush *self);
+
+/*  Invoked by the completion port when its alarm goes off. */
+void nn_flusher_alarm (struct nn_cp *cp);
+
+/*  Deallocates the flusher of the completion port being terminated. There
+    must be no flushes started at that point. */
+void nn_flusher_term (struct nn_cp *cp);
+
+#endif
@@ -26,7 +26,11 @@
 #include "poller_poll.inc"
 #elif defined NN_USE_EPOLL
 #include "poller_epoll.inc"
+#elif defined NN_USE_URING
+#include "poller_uring.inc"
 #elif defined NN_USE_KQUEUE
 #include "poller_kqueue.inc"
+#elif defined NN_USE_PORT
+#include "poller_port.inc"
 #endif
 
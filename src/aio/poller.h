@@ -45,6 +45,13 @@ int nn_poller_wait (struct nn_poller *self, int timeout);
 int nn_poller_event (struct nn_poller *self, int *event,
     struct nn_poller_hndl **hndl);
 
+/*  Returns a file descriptor that becomes readable when there are events
+    to be retrieved by nn_poller_wait, or -1 if the pollset itself cannot be
+    polled on. Even then, nn_poller_pending may report events that were
+    already retrieved from the OS and won't make the descriptor readable. */
+int nn_poller_getfd (struct nn_poller *self);
+int nn_poller_pending (struct nn_poller *self);
+
 #if defined NN_USE_POLL
 
 #include <poll.h>
@@ -63,6 +70,9 @@ struct nn_poller {
     /*  Index of the event being processed at the moment. */
     int index;
 
+    /*  Number of elements of the pollset with events not yet processed. */
+    int nevents;
+
     /*  Number of allocated elements in the pollset. */
     int capacity;
 
@@ -90,11 +100,38 @@ struct nn_poller {
 
 #define NN_POLLER_HAVE_ASYNC_ADD 1
 
-#define NN_POLLER_MAX_EVENTS 32
+/*  Initial size of the event array. The array grows whenever a single call
+    to epoll_wait fills it in completely, up to NN_POLLER_MAX_EVENTS. Both
+    values can be overriden at compile time. */
+#ifndef NN_POLLER_MIN_EVENTS
+#define NN_POLLER_MIN_EVENTS 32
+#endif
+#ifndef NN_POLLER_MAX_EVENTS
+#define NN_POLLER_MAX_EVENTS 1024
+#endif
+
+/*  If NN_USE_EPOLLET is defined, file descriptors are registered with epoll
+    in edge-triggered mode once and for all. Changing the interest set is then
+    just a matter of modifying the handle and doesn't require a syscall. The
+    user of the poller must keep reading/writing the fd till EAGAIN while
+    it's interested in the given event. */
+#if defined NN_USE_EPOLLET
+#define NN_POLLER_EDGE_TRIGGERED 1
+#endif
 
 struct nn_poller_hndl {
     int fd;
     uint32_t events;
+#if defined NN_POLLER_EDGE_TRIGGERED
+
+    /*  Events that may have happened while the user was not interested
+        in them. They'll be reported once the user asks for them. */
+    uint32_t ready;
+
+    /*  Set if the handle is in the list of handles with pending events. */
+    int pending;
+    struct nn_poller_hndl *next;
+#endif
 };
 
 struct nn_poller {
@@ -102,14 +139,142 @@ struct nn_poller {
     /*  Current pollset. */
     int ep;
 
+#if defined NN_POLLER_EDGE_TRIGGERED
+    /*  Handles with events to report that were not returned by epoll. */
+    struct nn_poller_hndl *pending;
+#endif
+
     /*  Number of events being processed at the moment. */
     int nevents;
 
     /*  Index of the event being processed at the moment. */
     int index;
 
+    /*  Number of allocated elements in the event array. */
+    int capacity;
+
     /*  Events being processed at the moment. */
-    struct epoll_event events [NN_POLLER_MAX_EVENTS];
+    struct epoll_event *events;
+};
+
+#endif
+
+#if defined NN_USE_URING
+
+#include <stddef.h>
+#include <stdint.h>
+#include <linux/io_uring.h>
+
+#define NN_POLLER_HAVE_ASYNC_ADD 1
+
+/*  Size of the submission queue. Completion queue is several times larger
+    as there's one outstanding poll request per file descriptor. */
+#define NN_POLLER_URING_SQ_ENTRIES 256
+#define NN_POLLER_URING_CQ_ENTRIES 4096
+
+struct nn_poller_hndl {
+
+    /*  Index of the slot in the poller associated with this handle. */
+    int index;
+
+    /*  Events the user is interested in (POLLIN, POLLOUT). */
+    uint32_t events;
+};
+
+struct nn_poller {
+
+    /*  The io_uring instance. */
+    int fd;
+
+    /*  Submission queue ring. */
+    void *sq_ring;
+    size_t sq_ring_sz;
+    uint32_t *sq_head;
+    uint32_t *sq_tail;
+    uint32_t *sq_mask;
+    uint32_t *sq_array;
+    struct io_uring_sqe *sqes;
+    size_t sqes_sz;
+
+    /*  Number of submission queue entries filled in but not yet submitted. */
+    uint32_t nsubmit;
+
+    /*  Completion queue ring. If the kernel supports single mmap, it shares
+        the mapping with the submission queue ring. */
+    void *cq_ring;
+    size_t cq_ring_sz;
+    uint32_t *cq_head;
+    uint32_t *cq_tail;
+    uint32_t *cq_mask;
+    struct io_uring_cqe *cqes;
+
+    /*  Kernel may still hold a reference to a file descriptor after it was
+        removed from the poller. Thus, the state associated with individual
+        fds lives here rather than in the user-supplied handle. */
+    struct nn_poller_slot {
+        struct nn_poller_hndl *hndl;
+        int fd;
+        int flags;
+        uint32_t armed;
+        uint32_t revents;
+        int next;
+    } *slots;
+    int capacity;
+
+    /*  List of unused slots, linked by indices. -1 means empty list. */
+    int free;
+
+    /*  Slots that may need a poll request to be (re-)submitted. */
+    int *dirty;
+    int ndirty;
+
+    /*  Slots with events ready to be processed. */
+    int *ready;
+    int nready;
+    int index;
+};
+
+#endif
+
+#if defined NN_USE_PORT
+
+#include <port.h>
+#include <poll.h>
+
+#define NN_POLLER_HAVE_ASYNC_ADD 1
+
+#define NN_POLLER_MAX_EVENTS 32
+
+struct nn_poller_hndl {
+    int fd;
+
+    /*  Events the user is interested in. */
+    int events;
+
+    /*  Event ports report each event only once, the file descriptor has to
+        be associated with the port anew afterwards. Handles that have to be
+        associated or dissociated before the next wait are kept in a list. */
+    int dirty;
+    struct nn_poller_hndl *prev;
+    struct nn_poller_hndl *next;
+};
+
+struct nn_poller {
+
+    /*  The event port. */
+    int port;
+
+    /*  Handles to associate with the port before the next wait. */
+    struct nn_poller_hndl *dirty;
+
+    /*  Number of events being processed at the moment. */
+    int nevents;
+
+    /*  Index of the event being processed at the moment. */
+    int index;
+
+    /*  Events being processed at the moment. */
+    port_event_t events [NN_POLLER_MAX_EVENTS];
 };
 
 #endif
@@ -122,6 +287,10 @@ struct nn_poller {
 
 #define NN_POLLER_MAX_EVENTS 32
 
+/*  Maximum number of pollset changes accumulated before they are passed
+    to the kernel. */
+#define NN_POLLER_MAX_CHANGES 64
+
 #define NN_POLLER_EVENT_IN 1
 #define NN_POLLER_EVENT_OUT 2
 
@@ -135,6 +304,11 @@ struct nn_poller {
     /*  Current pollset. */
     int kq;
 
+    /*  Changes to the pollset not yet passed to the kernel. They are
+        submitted along with the next wait. */
+    int nchanges;
+    struct kevent changes [NN_POLLER_MAX_CHANGES];
+
     /*  Number of events being processed at the moment. */
     int nevents;
 
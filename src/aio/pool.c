@@ -24,23 +24,152 @@
 
 #include "pool.h"
 
-/*  TODO: The dummy implementation of a thread pool. As for now there's only
-    one worker thread created. */
+#include "../utils/err.h"
+#include "../utils/fast.h"
+#include "../utils/alloc.h"
+#include "../utils/thread.h"
+#include "../utils/clock.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+/*  Private functions. */
+static int nn_pool_nworkers (void);
+static void nn_pool_sample (struct nn_pool *self);
 
 int nn_pool_init (struct nn_pool *self)
 {
-    return nn_worker_init (&self->worker);
+    int rc;
+    int i;
+
+    self->nworkers = nn_pool_nworkers ();
+    self->nnodes = nn_thread_nodes ();
+    if (self->nworkers < self->nnodes)
+        self->nnodes = 1;
+    self->workers = nn_alloc (sizeof (struct nn_worker) * self->nworkers,
+        "worker threads");
+    alloc_assert (self->workers);
+    for (i = 0; i != self->nworkers; ++i) {
+        rc = nn_worker_init (&self->workers [i],
+            self->nnodes > 1 ? i % self->nnodes : -1);
+        if (nn_slow (rc < 0)) {
+            while (i > 0)
+                nn_worker_term (&self->workers [--i]);
+            nn_free (self->workers);
+            self->workers = NULL;
+            self->nworkers = 0;
+            return rc;
+        }
+    }
+    nn_atomic_init (&self->next, 0);
+    nn_mutex_init (&self->sync);
+    memset (self->load, 0, sizeof (self->load));
+    memset (self->busy, 0, sizeof (self->busy));
+    self->sampled = nn_clock_monotonic ();
+
+    return 0;
 }
 
 void nn_pool_term (struct nn_pool *self)
 {
-    nn_worker_term (&self->worker);
+    int i;
+
+    if (nn_slow (!self->workers))
+        return;
+
+    nn_mutex_term (&self->sync);
+    nn_atomic_term (&self->next);
+    for (i = 0; i != self->nworkers; ++i)
+        nn_worker_term (&self->workers [i]);
+    nn_free (self->workers);
+    self->workers = NULL;
+    self->nworkers = 0;
 }
 
-struct nn_worker *nn_pool_choose_worker (struct nn_pool *self)
+struct nn_worker *nn_pool_choose_worker (struct nn_pool *self, int node)
 {
-    return &self->worker;
+    uint32_t n;
+    int count;
+    int a;
+    int b;
+
+    nn_assert (self->workers);
+
+    /*  Fast path. No need for atomic operation if there's only one worker. */
+    if (self->nworkers == 1)
+        return &self->workers [0];
+
+    /*  Workers of the node are those at indices node, node + nnodes etc. */
+    n = nn_atomic_inc (&self->next, 1);
+    if (node < 0 || node >= self->nnodes) {
+        count = self->nworkers;
+        a = (int) (n % count);
+        b = (int) ((n + count / 2) % count);
+    }
+    else {
+        count = (self->nworkers - node + self->nnodes - 1) / self->nnodes;
+        if (count == 1)
+            return &self->workers [node];
+        a = node + (int) (n % count) * self->nnodes;
+        b = node + (int) ((n + count / 2) % count) * self->nnodes;
+    }
+
+    /*  Of the two candidates, the one less busy recently is chosen. Comparing
+        just two of them, rather than looking for the least busy worker,
+        keeps all the choices made before the next sample from piling up on
+        the same worker. */
+    nn_mutex_lock (&self->sync);
+    nn_pool_sample (self);
+    if (self->load [b] < self->load [a])
+        a = b;
+    nn_mutex_unlock (&self->sync);
+    return &self->workers [a];
 }
 
-#endif
+int nn_pool_stats (struct nn_pool *self, struct nn_worker_stats *stats,
+    int count)
+{
+    int i;
 
+    for (i = 0; i != self->nworkers && i != count; ++i)
+        nn_worker_getstats (&self->workers [i], &stats [i]);
+    return self->nworkers;
+}
+
+static void nn_pool_sample (struct nn_pool *self)
+{
+    int i;
+    uint64_t now;
+    uint64_t busy;
+    struct nn_worker_stats stats;
+
+    now = nn_clock_monotonic ();
+    if (now - self->sampled < (uint64_t) NN_POOL_SAMPLE_IVL * 1000000)
+        return;
+    for (i = 0; i != self->nworkers; ++i) {
+        nn_worker_getstats (&self->workers [i], &stats);
+        busy = stats.timers + stats.fds + stats.tasks;
+        self->load [i] = busy - self->busy [i];
+        self->busy [i] = busy;
+    }
+    self->sampled = now;
+}
+
+static int nn_pool_nworkers (void)
+{
+    const char *env;
+    int nworkers;
+
+    env = getenv ("NN_WORKERS");
+    if (!env)
+        return nn_thread_nodes () < NN_POOL_MAX_WORKERS ?
+            nn_thread_nodes () : NN_POOL_MAX_WORKERS;
+    nworkers = atoi (env);
+    if (nworkers < 1)
+        return 1;
+    if (nworkers > NN_POOL_MAX_WORKERS)
+        return NN_POOL_MAX_WORKERS;
+    return nworkers;
+}
+
+#endif
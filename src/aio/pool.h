@@ -27,17 +27,60 @@
 
 #include "worker.h"
 
-/*  Worker thread pool. */
+#include "../utils/atomic.h"
+#include "../utils/mutex.h"
+
+/*  Worker thread pool. The number of worker threads can be set using
+    NN_WORKERS environment variable. If it is not set, single worker thread
+    is started, or one per node on NUMA machines. If there are at least as
+    many workers as NUMA nodes, worker i is bound to node i modulo the number
+    of nodes. */
+
+/*  Upper limit on number of worker threads in the pool. */
+#define NN_POOL_MAX_WORKERS 64
+
+/*  How often, in milliseconds, the load of the workers is sampled. */
+#define NN_POOL_SAMPLE_IVL 100
 
 struct nn_pool {
-    struct nn_worker worker;
+
+    /*  Array of worker threads. */
+    struct nn_worker *workers;
+    int nworkers;
+
+    /*  Number of NUMA nodes the workers are spread over, 1 if they are not
+        bound to nodes. */
+    int nnodes;
+
+    /*  Used to distribute the load among workers in round-robin fashion. */
+    struct nn_atomic next;
+
+    /*  Time, in nanoseconds, each worker was busy during the last sampling
+        period, its total busy time at the end of the period and the time
+        the period ended at. Refreshed by whoever chooses a worker once
+        the next period is over. Guarded by 'sync'. */
+    struct nn_mutex sync;
+    uint64_t load [NN_POOL_MAX_WORKERS];
+    uint64_t busy [NN_POOL_MAX_WORKERS];
+    uint64_t sampled;
 };
 
 int nn_pool_init (struct nn_pool *self);
 void nn_pool_term (struct nn_pool *self);
-struct nn_worker *nn_pool_choose_worker (struct nn_pool *self);
 
-#endif
+/*  Returns one of the workers in the pool. Two workers are picked in
+    round-robin fashion and the one that was less busy recently is returned,
+    so that the load is spread evenly among the threads even if some of
+    the work they were given turned out to be more expensive than the rest.
+    If 'node' is not negative, the worker is chosen from those bound to that
+    NUMA node, if there are any. */
+struct nn_worker *nn_pool_choose_worker (struct nn_pool *self, int node);
+
+/*  Retrieves the statistics of up to 'count' workers. Returns the number of
+    workers in the pool. */
+int nn_pool_stats (struct nn_pool *self, struct nn_worker_stats *stats,
+    int count);
 
 #endif
 
+#endif
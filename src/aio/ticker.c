@@ -0,0 +1,145 @@
+/*
+    Copyright (c) 2012-2013 250bpm s.r.o.
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"),
+    to deal in the Software without restriction, including without limitation
+    the rights to use, copy, modify, merge, publish, distribute, sublicense,
+    and/or sell copies of the Software, and to permit persons to whom
+    the Software is furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included
+    in all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+    THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+    FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+    IN THE SOFTWARE.
+*/
+
+#include "ticker.h"
+
+#include "../utils/err.h"
+#include "../utils/cont.h"
+#include "../utils/alloc.h"
+
+/*  The ticks of a completion port. It's created along with the first tick
+    started and destroyed once the last one is stopped. */
+struct nn_ticker {
+    const struct nn_cp_sink *sink;
+    struct nn_cp *cp;
+    struct nn_timer timer;
+    struct nn_list ticks;
+
+    /*  Set while the callbacks are being invoked. 'next' is the tick to be
+        processed next, so that the ticks can be stopped by the callbacks. */
+    int running;
+    struct nn_list_item *next;
+};
+
+/*  Private functions. */
+static void nn_ticker_timeout (const struct nn_cp_sink **self,
+    struct nn_timer *timer);
+static void nn_ticker_free (struct nn_ticker *self);
+
+static const struct nn_cp_sink nn_ticker_sink = {
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    nn_ticker_timeout,
+    NULL
+};
+
+void nn_tick_init (struct nn_tick *self, nn_tick_fn *fn, struct nn_cp *cp)
+{
+    self->fn = fn;
+    self->cp = cp;
+    nn_list_item_init (&self->item);
+}
+
+void nn_tick_term (struct nn_tick *self)
+{
+    nn_tick_stop (self);
+    nn_list_item_term (&self->item);
+}
+
+void nn_tick_start (struct nn_tick *self)
+{
+    struct nn_ticker *ticker;
+
+    if (nn_list_item_isinlist (&self->item))
+        return;
+
+    ticker = self->cp->ticker;
+    if (!ticker) {
+        ticker = nn_alloc (sizeof (struct nn_ticker), "ticker");
+        alloc_assert (ticker);
+        ticker->sink = &nn_ticker_sink;
+        ticker->cp = self->cp;
+        nn_timer_init (&ticker->timer, &ticker->sink, self->cp);
+        nn_list_init (&ticker->ticks);
+        ticker->running = 0;
+        ticker->next = NULL;
+        self->cp->ticker = ticker;
+        nn_timer_start (&ticker->timer, NN_TICKER_IVL);
+    }
+    nn_list_insert (&ticker->ticks, &self->item,
+        nn_list_end (&ticker->ticks));
+}
+
+void nn_tick_stop (struct nn_tick *self)
+{
+    struct nn_ticker *ticker;
+
+    if (!nn_list_item_isinlist (&self->item))
+        return;
+
+    ticker = self->cp->ticker;
+    nn_assert (ticker);
+    if (ticker->next == &self->item)
+        ticker->next = nn_list_next (&ticker->ticks, &self->item);
+    nn_list_erase (&ticker->ticks, &self->item);
+    if (!ticker->running && nn_list_empty (&ticker->ticks))
+        nn_ticker_free (ticker);
+}
+
+static void nn_ticker_timeout (const struct nn_cp_sink **self,
+    struct nn_timer *timer)
+{
+    struct nn_ticker *ticker;
+    struct nn_list_item *it;
+    struct nn_tick *tick;
+
+    ticker = nn_cont (self, struct nn_ticker, sink);
+
+    ticker->running = 1;
+    it = nn_list_begin (&ticker->ticks);
+    while (it != nn_list_end (&ticker->ticks)) {
+        ticker->next = nn_list_next (&ticker->ticks, it);
+        tick = nn_cont (it, struct nn_tick, item);
+        tick->fn (tick);
+        it = ticker->next;
+    }
+    ticker->running = 0;
+    ticker->next = NULL;
+
+    if (nn_list_empty (&ticker->ticks)) {
+        nn_ticker_free (ticker);
+        return;
+    }
+    nn_timer_start (&ticker->timer, NN_TICKER_IVL);
+}
+
+static void nn_ticker_free (struct nn_ticker *self)
+{
+    self->cp->ticker = NULL;
+    nn_timer_term (&self->timer);
+    nn_list_term (&self->ticks);
+    nn_free (self);
+}
@@ -0,0 +1,53 @@
+/*
+    Copyright (c) 2012-2013 250bpm s.r.o.
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"),
+    to deal in the Software without restriction, including without limitation
+    the rights to use, copy, modify, merge, publish, distribute, sublicense,
+    and/or sell copies of the Software, and to permit persons to whom
+    the Software is furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included
+    in all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+    THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+    FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+    IN THE SOFTWARE.
+*/
+
+#ifndef NN_TICKER_INCLUDED
+#define NN_TICKER_INCLUDED
+
+#include "aio.h"
+
+#include "../utils/list.h"
+
+/*  Periodic tick shared by all the objects using a completion port, such as
+    the stream sessions sending heartbeats. A single timer drives the ticks
+    of the completion port, so that the objects don't need a timer each.
+    Once started, the callback of the tick is invoked every NN_TICKER_IVL
+    milliseconds with the completion port locked. */
+
+#define NN_TICKER_IVL 100
+
+struct nn_tick;
+
+typedef void (nn_tick_fn) (struct nn_tick *self);
+
+struct nn_tick {
+    nn_tick_fn *fn;
+    struct nn_cp *cp;
+    struct nn_list_item item;
+};
+
+void nn_tick_init (struct nn_tick *self, nn_tick_fn *fn, struct nn_cp *cp);
+void nn_tick_term (struct nn_tick *self);
+void nn_tick_start (struct nn_tick *self);
+void nn_tick_stop (struct nn_tick *self);
+
+#endif
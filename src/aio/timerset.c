@@ -26,90 +26,175 @@
 #include "../utils/cont.h"
 #include "../utils/err.h"
 
+CT_ASSERT (NN_TIMERSET_SLOTS % 64 == 0);
+CT_ASSERT ((NN_TIMERSET_SLOTS & (NN_TIMERSET_SLOTS - 1)) == 0);
+
+/*  Private functions. */
+static uint64_t nn_timerset_tick (uint64_t instant);
+static int nn_timerset_next_slot (struct nn_timerset *self, int slot);
+
 void nn_timerset_init (struct nn_timerset *self)
 {
+    int i;
+
     nn_clock_init (&self->clock);
-    nn_list_init (&self->timeouts);
+    for (i = 0; i != NN_TIMERSET_SLOTS; ++i)
+        nn_list_init (&self->slots [i]);
+    for (i = 0; i != NN_TIMERSET_SLOTS / 64; ++i)
+        self->used [i] = 0;
+    self->count = 0;
+    self->now = nn_clock_now (&self->clock);
+    self->current = self->now / NN_TIMERSET_TICK;
+    self->next = UINT64_MAX;
 }
 
 void nn_timerset_term (struct nn_timerset *self)
 {
-    nn_list_term (&self->timeouts);
+    int i;
+
+    for (i = 0; i != NN_TIMERSET_SLOTS; ++i)
+        nn_list_term (&self->slots [i]);
     nn_clock_term (&self->clock);
 }
 
 int nn_timerset_add (struct nn_timerset *self, int timeout,
     struct nn_timerset_hndl *hndl)
 {
-    struct nn_list_item *it;
-    struct nn_timerset_hndl *ith;
-    int first;
+    uint64_t tick;
+    int slot;
 
     /*  Compute the instant when the timeout will be due. */
     hndl->timeout = nn_clock_now (&self->clock) + timeout;
 
-    /*  Insert it into the ordered list of timeouts. */
-    for (it = nn_list_begin (&self->timeouts);
-          it != nn_list_end (&self->timeouts);
-          it = nn_list_next (&self->timeouts, it)) {
-        ith = nn_cont (it, struct nn_timerset_hndl, list);
-        if (hndl->timeout < ith->timeout)
-            break;
+    /*  Put it into the appropriate slot of the wheel. */
+    tick = nn_timerset_tick (hndl->timeout);
+    nn_assert (tick >= self->current);
+    slot = (int) (tick % NN_TIMERSET_SLOTS);
+    nn_list_insert (&self->slots [slot], &hndl->list,
+        nn_list_end (&self->slots [slot]));
+    self->used [slot / 64] |= ((uint64_t) 1) << (slot % 64);
+    ++self->count;
+
+    /*  If the new timeout expires before the instant the user is going to
+        wake up at, let the user know that the current waiting interval has
+        to be changed. */
+    if (tick * NN_TIMERSET_TICK < self->next) {
+        self->next = tick * NN_TIMERSET_TICK;
+        return 1;
     }
-
-    /*  If the new timeout happens to be the first one to expire, let the user
-        know that the current waiting interval has to be changed. */
-    first = nn_list_begin (&self->timeouts) == it ? 1 : 0;
-    nn_list_insert (&self->timeouts, &hndl->list, it);
-    return first;
+    return 0;
 }
 
 int nn_timerset_rm (struct nn_timerset *self, struct nn_timerset_hndl *hndl)
 {
-    int first;
+    int slot;
 
     /*  Ignore if handle is not in the timeouts list. */
     if (!nn_list_item_isinlist (&hndl->list))
         return 0;
 
-    /*  If it was the first timeout that was removed, the actual waiting time
-        may have changed. We'll thus return 1 to let the user know. */
-    first = nn_list_begin (&self->timeouts) == &hndl->list ? 1 : 0;
-    nn_list_erase (&self->timeouts, &hndl->list);
-    return first;
+    slot = (int) (nn_timerset_tick (hndl->timeout) % NN_TIMERSET_SLOTS);
+    nn_list_erase (&self->slots [slot], &hndl->list);
+    if (nn_list_empty (&self->slots [slot]))
+        self->used [slot / 64] &= ~(((uint64_t) 1) << (slot % 64));
+    --self->count;
+
+    /*  Removing a timeout never requires the user to wake up earlier. If the
+        user wakes up needlessly, it'll find no event and simply compute
+        the new timeout. */
+    return 0;
 }
 
 int nn_timerset_timeout (struct nn_timerset *self)
 {
-    int timeout;
+    uint64_t tick;
+    uint64_t now;
+    int slot;
+    struct nn_list_item *it;
+    struct nn_timerset_hndl *ith;
 
-    if (nn_fast (nn_list_empty (&self->timeouts)))
+    if (nn_fast (!self->count)) {
+        self->next = UINT64_MAX;
         return -1;
+    }
+
+    /*  Find the nearest non-empty slot that contains a timeout belonging
+        to the current rotation of the wheel. If there's no such slot, wake
+        up after the full rotation to check again. */
+    self->next = (self->current + NN_TIMERSET_SLOTS) * NN_TIMERSET_TICK;
+    tick = self->current;
+    while (1) {
+        slot = nn_timerset_next_slot (self, (int) (tick % NN_TIMERSET_SLOTS));
+        tick += (slot - tick) % NN_TIMERSET_SLOTS;
+        if (tick >= self->current + NN_TIMERSET_SLOTS)
+            break;
+        for (it = nn_list_begin (&self->slots [slot]);
+              it != nn_list_end (&self->slots [slot]);
+              it = nn_list_next (&self->slots [slot], it)) {
+            ith = nn_cont (it, struct nn_timerset_hndl, list);
+            if (nn_timerset_tick (ith->timeout) <= tick)
+                break;
+        }
+        if (it != nn_list_end (&self->slots [slot])) {
+            self->next = tick * NN_TIMERSET_TICK;
+            break;
+        }
+        ++tick;
+    }
 
-    timeout = (int) (nn_cont (nn_list_begin (&self->timeouts),
-        struct nn_timerset_hndl, list)->timeout - nn_clock_now (&self->clock));
-    return timeout < 0 ? 0 : timeout;
+    now = nn_clock_now (&self->clock);
+    return self->next <= now ? 0 : (int) (self->next - now);
+}
+
+void nn_timerset_refresh (struct nn_timerset *self)
+{
+    self->now = nn_clock_now (&self->clock);
 }
 
 int nn_timerset_event (struct nn_timerset *self, struct nn_timerset_hndl **hndl)
 {
-    struct nn_timerset_hndl *first;
+    uint64_t last;
+    int slot;
+    int visited;
+    struct nn_list_item *it;
+    struct nn_timerset_hndl *ith;
 
     /*  If there's no timeout, there's no event to report. */
-    if (nn_fast (nn_list_empty (&self->timeouts)))
+    if (nn_fast (!self->count))
         return -EAGAIN;
 
-    /*  If no timeout have expired yet, there's no event to return. */
-    first = nn_cont (nn_list_begin (&self->timeouts),
-        struct nn_timerset_hndl, list);
-    if (first->timeout > nn_clock_now (&self->clock))
-        return -EAGAIN;
+    /*  Walk through the ticks that have already elapsed. If the time jumped
+        by more that a full rotation of the wheel, visiting each slot once
+        is sufficient. */
+    last = self->now / NN_TIMERSET_TICK;
+    for (visited = 0; self->current <= last && visited != NN_TIMERSET_SLOTS;
+          ++visited) {
+        slot = (int) (self->current % NN_TIMERSET_SLOTS);
+        if (self->used [slot / 64] & (((uint64_t) 1) << (slot % 64))) {
+            for (it = nn_list_begin (&self->slots [slot]);
+                  it != nn_list_end (&self->slots [slot]);
+                  it = nn_list_next (&self->slots [slot], it)) {
+                ith = nn_cont (it, struct nn_timerset_hndl, list);
+                if (nn_timerset_tick (ith->timeout) > last)
+                    continue;
+
+                /*  Return the timeout and remove it from the set. */
+                nn_list_erase (&self->slots [slot], &ith->list);
+                if (nn_list_empty (&self->slots [slot]))
+                    self->used [slot / 64] &= ~(((uint64_t) 1) << (slot % 64));
+                --self->count;
+                *hndl = ith;
+                return 0;
+            }
+        }
+        if (self->current == last)
+            break;
+        ++self->current;
+    }
+    if (self->current < last)
+        self->current = last;
 
-    /*  Return the first timeout and remove it from the list of active
-        timeouts. */
-    nn_list_erase (&self->timeouts, &first->list);
-    *hndl = first;
-    return 0;
+    return -EAGAIN;
 }
 
 void nn_timerset_hndl_init (struct nn_timerset_hndl *self)
@@ -127,3 +212,35 @@ int nn_timerset_hndl_isactive (struct nn_timerset_hndl *self)
     return nn_list_item_isinlist (&self->list);
 }
 
+static uint64_t nn_timerset_tick (uint64_t instant)
+{
+    /*  Round up so that the timeout never fires prematurely. */
+    return (instant + NN_TIMERSET_TICK - 1) / NN_TIMERSET_TICK;
+}
+
+static int nn_timerset_next_slot (struct nn_timerset *self, int slot)
+{
+    int word;
+    int i;
+    uint64_t bits;
+
+    /*  Check the remaining bits in the current word. */
+    word = slot / 64;
+    bits = self->used [word] & (~((uint64_t) 0) << (slot % 64));
+
+    /*  Walk through the remaining words, wrapping around to the beginning
+        of the bitmap, including the lower bits of the initial word. */
+    for (i = 0; !bits; ++i) {
+        nn_assert (i <= NN_TIMERSET_SLOTS / 64);
+        word = (word + 1) % (NN_TIMERSET_SLOTS / 64);
+        bits = self->used [word];
+    }
+
+    /*  Find the lowest set bit. */
+    slot = 0;
+    while (!(bits & 1)) {
+        bits >>= 1;
+        ++slot;
+    }
+    return word * 64 + slot;
+}
@@ -26,8 +26,26 @@
 #include "../utils/clock.h"
 #include "../utils/list.h"
 
-/*  This class stores a list of timeouts and reports the next one to expire
-    along with the time till it happens. */
+#include <stddef.h>
+#include <stdint.h>
+
+/*  This class stores a set of timeouts and reports the next one to expire
+    along with the time till it happens. The timeouts are stored in a hashed
+    timing wheel, so that adding and removing a timeout is O(1). The price
+    to pay is that the timeouts are rounded up to NN_TIMERSET_TICK
+    milliseconds. */
+
+/*  Granularity of the timeouts, in milliseconds. */
+#ifndef NN_TIMERSET_TICK
+#define NN_TIMERSET_TICK 4
+#endif
+
+/*  Number of slots in the wheel. Must be a power of 2 and a multiple of 64.
+    Timeouts longer than NN_TIMERSET_SLOTS * NN_TIMERSET_TICK milliseconds
+    share the slots with the shorter ones and are skipped over until due. */
+#ifndef NN_TIMERSET_SLOTS
+#define NN_TIMERSET_SLOTS 512
+#endif
 
 struct nn_timerset_hndl {
     struct nn_list_item list;
@@ -36,7 +54,27 @@ struct nn_timerset_hndl {
 
 struct nn_timerset {
     struct nn_clock clock;
-    struct nn_list timeouts;
+
+    /*  The wheel itself. Slot N contains timeouts that expire at ticks that
+        are equal to N modulo NN_TIMERSET_SLOTS. */
+    struct nn_list slots [NN_TIMERSET_SLOTS];
+
+    /*  Bitmap of non-empty slots. */
+    uint64_t used [NN_TIMERSET_SLOTS / 64];
+
+    /*  Number of timeouts in the set. */
+    size_t count;
+
+    /*  The tick that is being processed at the moment. Timeouts for all
+        previous ticks have already expired. */
+    uint64_t current;
+
+    /*  The time as sampled by the last nn_timerset_refresh call. */
+    uint64_t now;
+
+    /*  The earliest instant the user is told to wake up at, or UINT64_MAX
+        if there's no such instant. */
+    uint64_t next;
 };
 
 void nn_timerset_init (struct nn_timerset *self);
@@ -45,6 +83,13 @@ int nn_timerset_add (struct nn_timerset *self, int timeout,
     struct nn_timerset_hndl *hndl);
 int nn_timerset_rm (struct nn_timerset *self, struct nn_timerset_hndl *hndl);
 int nn_timerset_timeout (struct nn_timerset *self);
+
+/*  Samples the current time. It should be called once per each poller
+    iteration, after the waiting is done. nn_timerset_event then reports
+    the timeouts that have expired at the sampled instant, without having
+    to check the time for each of them. */
+void nn_timerset_refresh (struct nn_timerset *self);
+
 int nn_timerset_event (struct nn_timerset *self, struct nn_timerset_hndl **hndl);
 
 void nn_timerset_hndl_init (struct nn_timerset_hndl *self);
@@ -52,4 +97,3 @@ void nn_timerset_hndl_term (struct nn_timerset_hndl *self);
 int nn_timerset_hndl_isactive (struct nn_timerset_hndl *self);
 
 #endif
-
@@ -27,6 +27,9 @@
 #include "../utils/err.h"
 #include "../utils/fast.h"
 #include "../utils/cont.h"
+#include "../utils/clock.h"
+
+#include <string.h>
 
 /*  Private functions. */
 static void nn_worker_routine (void *arg);
@@ -124,7 +127,7 @@ void nn_worker_task_term (struct nn_worker_task *self)
     nn_queue_item_term (&self->item);
 }
 
-int nn_worker_init (struct nn_worker *self)
+int nn_worker_init (struct nn_worker *self, int node)
 {
     int rc;
 
@@ -132,14 +135,17 @@ int nn_worker_init (struct nn_worker *self)
     if (rc < 0)
         return rc;
 
-    nn_mutex_init (&self->sync);
-    nn_queue_init (&self->tasks);
+    nn_mpscq_init (&self->tasks);
     nn_queue_item_init (&self->stop);
     nn_poller_init (&self->poller);
     nn_poller_add (&self->poller, nn_efd_getfd (&self->efd), &self->efd_hndl);
     nn_poller_set_in (&self->poller, &self->efd_hndl);
     nn_timerset_init (&self->timerset);
-    nn_thread_init (&self->thread, nn_worker_routine, self);
+    self->node = node;
+    nn_mutex_init (&self->statsync);
+    memset (&self->stats, 0, sizeof (self->stats));
+    nn_thread_init_node (&self->thread, "nn_worker", node, nn_worker_routine,
+        self);
 
     return 0;
 }
@@ -147,29 +153,35 @@ int nn_worker_init (struct nn_worker *self)
 void nn_worker_term (struct nn_worker *self)
 {
     /*  Ask worker thread to terminate. */
-    nn_mutex_lock (&self->sync);
-    nn_queue_push (&self->tasks, &self->stop);
-    nn_efd_signal (&self->efd);
-    nn_mutex_unlock (&self->sync);
+    if (nn_mpscq_push (&self->tasks, &self->stop))
+        nn_efd_signal (&self->efd);
 
     /*  Wait till worker thread terminates. */
     nn_thread_term (&self->thread);
 
     /*  Clean up. */
+    nn_mutex_term (&self->statsync);
     nn_timerset_term (&self->timerset);
     nn_poller_term (&self->poller);
     nn_efd_term (&self->efd);
     nn_queue_item_term (&self->stop);
-    nn_queue_term (&self->tasks);
-    nn_mutex_term (&self->sync);
+    nn_mpscq_term (&self->tasks);
 }
 
 void nn_worker_execute (struct nn_worker *self, struct nn_worker_task *task)
 {
-    nn_mutex_lock (&self->sync);
-    nn_queue_push (&self->tasks, &task->item);
-    nn_efd_signal (&self->efd);
-    nn_mutex_unlock (&self->sync);
+    /*  The worker thread takes all the pending tasks at once, so it has to be
+        woken up only if there were none. */
+    if (nn_mpscq_push (&self->tasks, &task->item))
+        nn_efd_signal (&self->efd);
+}
+
+void nn_worker_getstats (struct nn_worker *self,
+    struct nn_worker_stats *stats)
+{
+    nn_mutex_lock (&self->statsync);
+    *stats = self->stats;
+    nn_mutex_unlock (&self->statsync);
 }
 
 static void nn_worker_routine (void *arg)
@@ -184,6 +196,9 @@ static void nn_worker_routine (void *arg)
     struct nn_worker_task *task;
     struct nn_worker_fd *fd;
     struct nn_worker_timer *timer;
+    struct nn_worker_stats stats;
+    uint64_t start;
+    uint64_t now;
 
     self = (struct nn_worker*) arg;
 
@@ -192,10 +207,15 @@ static void nn_worker_routine (void *arg)
     while (1) {
 
         /*  Wait for any activity. */
-        
+        memset (&stats, 0, sizeof (stats));
+        start = nn_clock_monotonic ();
         rc = nn_poller_wait (&self->poller,
             nn_timerset_timeout (&self->timerset));
         errnum_assert (rc == 0, -rc);
+        now = nn_clock_monotonic ();
+        stats.wait = now - start;
+        start = now;
+        nn_timerset_refresh (&self->timerset);
 
         /*  Process all expired timers. */
         while (1) {
@@ -207,6 +227,9 @@ static void nn_worker_routine (void *arg)
             timer->callback->vfptr->callback (timer->callback, timer,
                 NN_WORKER_TIMER_TIMEOUT, (struct nn_worker_poller*) self);
         }
+        now = nn_clock_monotonic ();
+        stats.timers = now - start;
+        start = now;
 
         /*  Process all events from the poller. */
         while (1) {
@@ -220,14 +243,12 @@ static void nn_worker_routine (void *arg)
             if (phndl == &self->efd_hndl) {
                 nn_assert (pevent == NN_POLLER_IN);
 
-                /*  Make a local copy of the task queue. This way
-                    the application threads are not blocked and can post new
-                    tasks while the existing tasks are being processed. */
-                nn_mutex_lock (&self->sync);
+                /*  Take all the pending tasks. The efd is unsignalled first
+                    so that tasks posted after the queue was emptied wake the
+                    thread up anew. */
                 nn_efd_unsignal (&self->efd);
-                memcpy (&tasks, &self->tasks, sizeof (tasks));
-                nn_queue_init (&self->tasks);
-                nn_mutex_unlock (&self->sync);
+                nn_queue_init (&tasks);
+                nn_mpscq_drain (&self->tasks, &tasks);
 
                 while (1) {
 
@@ -250,6 +271,9 @@ static void nn_worker_routine (void *arg)
                         (struct nn_worker_poller*) self);
                 }
                 nn_queue_term (&tasks);
+                now = nn_clock_monotonic ();
+                stats.tasks += now - start;
+                start = now;
                 continue;
             }
 
@@ -257,7 +281,17 @@ static void nn_worker_routine (void *arg)
             fd = nn_cont (phndl, struct nn_worker_fd, hndl);
             fd->callback->vfptr->callback (fd->callback, fd, pevent,
                 (struct nn_worker_poller*) self);
+            now = nn_clock_monotonic ();
+            stats.fds += now - start;
+            start = now;
         }
+
+        nn_mutex_lock (&self->statsync);
+        self->stats.wait += stats.wait;
+        self->stats.timers += stats.timers;
+        self->stats.fds += stats.fds;
+        self->stats.tasks += stats.tasks;
+        nn_mutex_unlock (&self->statsync);
     }
 }
 
@@ -26,9 +26,10 @@
 #if !defined NN_HAVE_WINDOWS
 
 #include "../utils/queue.h"
-#include "../utils/mutex.h"
+#include "../utils/mpscq.h"
 #include "../utils/thread.h"
 #include "../utils/efd.h"
+#include "../utils/mutex.h"
 
 #include "poller.h"
 #include "timerset.h"
@@ -110,20 +111,39 @@ void nn_worker_task_init (struct nn_worker_task *self,
     struct nn_worker_callback *callback);
 void nn_worker_task_term (struct nn_worker_task *self);
 
+/*  Time, in nanoseconds, the worker thread spent waiting for activity,
+    running the timers, handling the events on the file descriptors and
+    executing the tasks. */
+struct nn_worker_stats {
+    uint64_t wait;
+    uint64_t timers;
+    uint64_t fds;
+    uint64_t tasks;
+};
+
 struct nn_worker {
-    struct nn_mutex sync;
-    struct nn_queue tasks;
+    struct nn_mpscq tasks;
     struct nn_queue_item stop;
     struct nn_efd efd;
     struct nn_poller poller;
     struct nn_poller_hndl efd_hndl;
     struct nn_timerset timerset;
     struct nn_thread thread;
+
+    /*  NUMA node the worker thread runs on, -1 if any. */
+    int node;
+
+    /*  The worker thread adds to the statistics once per loop iteration.
+        'statsync' allows them to be read from other threads. */
+    struct nn_mutex statsync;
+    struct nn_worker_stats stats;
 };
 
-int nn_worker_init (struct nn_worker *self);
+int nn_worker_init (struct nn_worker *self, int node);
 void nn_worker_term (struct nn_worker *self);
 void nn_worker_execute (struct nn_worker *self, struct nn_worker_task *task);
+void nn_worker_getstats (struct nn_worker *self,
+    struct nn_worker_stats *stats);
 
 #endif
 
@@ -21,57 +21,215 @@
 */
 
 #include "../nn.h"
+#include "../fanout.h"
+
+#include "global.h"
 
 #include "../utils/err.h"
 #include "../utils/fast.h"
+#include "../utils/msg.h"
+#include "../utils/alloc.h"
+#include "../utils/sem.h"
+#include "../utils/thread.h"
 
 #include <string.h>
 
-#if defined NN_HAVE_WINDOWS
-#include "../utils/win.h"
-#elif defined NN_HAVE_POLL
-#include <poll.h>
-#else
-#error
-#endif
+/*  Maximum number of messages moved from one socket to the other in one go.
+    Messages are passed as they are, without converting them to nn_msghdr
+    and back. */
+#define NN_DEVICE_BATCH 64
+
+/*  Messages received from one socket and not yet sent to the other one. */
+struct nn_device_batch {
+    struct nn_msg msgs [NN_DEVICE_BATCH];
+    int pos;
+    int count;
+};
+
+/*  Once a device is split between several threads, each direction is either
+    handled by a single thread or by a pair of threads, one receiving the
+    messages and the other one sending them. The pair hands the batches over
+    in order using a single slot. */
+struct nn_device_pipeline {
+    struct nn_device_batch batches [3];
+    struct nn_device_batch *slot;
+    struct nn_sem empty;
+    struct nn_sem full;
+};
+
+#define NN_DEVICE_STAGE_ONEWAY 1
+#define NN_DEVICE_STAGE_RECV 2
+#define NN_DEVICE_STAGE_SEND 3
+
+/*  Maximum number of threads a device can use: a receiving and a sending
+    thread for each of the two directions. */
+#define NN_DEVICE_MAX_THREADS 4
+
+struct nn_device_stage {
+    struct nn_thread thread;
+    int type;
+    int from;
+    int to;
+    struct nn_device_pipeline *pipeline;
+
+    /*  The error the stage has failed with. */
+    int err;
+};
+
+struct nn_device_mt {
+    struct nn_device_stage stages [NN_DEVICE_MAX_THREADS];
+    struct nn_device_pipeline pipelines [2];
+};
 
 /*  Private functions. */
+static int nn_device_check (int *s1, int *s2);
 static int nn_device_loopback (int s);
-static int nn_device_twoway (int s1, int s1rcv, int s1snd,
-    int s2, int s2rcv, int s2snd);
-static int nn_device_oneway (int s1, int s1rcv, int s2, int s2snd);
-static int nn_device_mvmsg (int from, int to, int flags);
+static void nn_device_credit (int s1, int s2);
+static int nn_device_twoway (int s1, int s2);
+static int nn_device_oneway (int s1, int s2);
+static void nn_device_batch_init (struct nn_device_batch *self);
+static void nn_device_batch_term (struct nn_device_batch *self);
+static int nn_device_pass (struct nn_device_batch *batch, int from, int to,
+    int *fromevents, int *toevents);
+static void nn_device_pipeline_init (struct nn_device_pipeline *self);
+static void nn_device_pipeline_term (struct nn_device_pipeline *self);
+static void nn_device_pipeline_swap (struct nn_device_pipeline *self,
+    struct nn_device_batch **batch, struct nn_sem *wait, struct nn_sem *post);
+static void nn_device_stage_routine (void *arg);
+static int nn_device_recv_stage (int from,
+    struct nn_device_pipeline *pipeline);
+static int nn_device_send_stage (int to, struct nn_device_pipeline *pipeline);
 
 int nn_device (int s1, int s2)
+{
+    int rc;
+
+    rc = nn_device_check (&s1, &s2);
+    if (nn_slow (rc < 0))
+        return -1;
+    if (rc == 2)
+        return nn_device_twoway (s1, s2);
+    nn_device_credit (s1, s2);
+    return nn_device_oneway (s1, s2);
+}
+
+int nn_device_threads (int s1, int s2, int nthreads)
+{
+    int i;
+    int ndirs;
+    int nstages;
+    int split [2];
+    int err;
+    struct nn_device_mt *mt;
+    struct nn_device_stage *stage;
+
+    if (nn_slow (nthreads < 1)) {
+        errno = EINVAL;
+        return -1;
+    }
+    ndirs = nn_device_check (&s1, &s2);
+    if (nn_slow (ndirs < 0))
+        return -1;
+    if (ndirs == 1)
+        nn_device_credit (s1, s2);
+    if (nthreads == 1) {
+        if (ndirs == 2)
+            return nn_device_twoway (s1, s2);
+        return nn_device_oneway (s1, s2);
+    }
+
+    /*  Each direction gets a thread of its own. The remaining threads are
+        used to split the directions into the receiving and the sending part.
+        Messages passed in any direction are still handled by a single
+        receiving thread, so their ordering is preserved. */
+    if (nthreads > ndirs * 2)
+        nthreads = ndirs * 2;
+    for (i = 0; i != ndirs; ++i)
+        split [i] = nthreads - ndirs > i;
+
+    mt = nn_alloc (sizeof (struct nn_device_mt), "device");
+    if (nn_slow (!mt)) {
+        errno = ENOMEM;
+        return -1;
+    }
+
+    nstages = 0;
+    for (i = 0; i != ndirs; ++i) {
+        if (split [i]) {
+            nn_device_pipeline_init (&mt->pipelines [i]);
+            stage = &mt->stages [nstages++];
+            stage->type = NN_DEVICE_STAGE_RECV;
+            stage->from = i ? s2 : s1;
+            stage->pipeline = &mt->pipelines [i];
+            stage = &mt->stages [nstages++];
+            stage->type = NN_DEVICE_STAGE_SEND;
+            stage->to = i ? s1 : s2;
+            stage->pipeline = &mt->pipelines [i];
+        }
+        else {
+            stage = &mt->stages [nstages++];
+            stage->type = NN_DEVICE_STAGE_ONEWAY;
+            stage->from = i ? s2 : s1;
+            stage->to = i ? s1 : s2;
+        }
+    }
+    nn_assert (nstages == nthreads);
+
+    /*  Run the stages till they all fail. */
+    for (i = 0; i != nstages; ++i)
+        nn_thread_init_named (&mt->stages [i].thread, "nn_device",
+            nn_device_stage_routine, &mt->stages [i]);
+    err = 0;
+    for (i = 0; i != nstages; ++i) {
+        nn_thread_term (&mt->stages [i].thread);
+        if (!err)
+            err = mt->stages [i].err;
+    }
+
+    for (i = 0; i != ndirs; ++i)
+        if (split [i])
+            nn_device_pipeline_term (&mt->pipelines [i]);
+    nn_free (mt);
+
+    errno = err;
+    return -1;
+}
+
+/*  Checks whether the two sockets can form a device. Returns the number of
+    directions the messages flow in or -1 with errno set. Sockets are
+    reordered so that a single-directional device passes messages from 's1'
+    to 's2'. */
+static int nn_device_check (int *s1, int *s2)
 {
     int rc;
     int op1;
     int op2;
-    int s1rcv;
-    int s1snd;
-    int s2rcv;
-    int s2snd;
+    int dirs1;
+    int dirs2;
+    int tmp;
     size_t opsz;
 
     /*  At least one socket must be specified. */
-    if (s1 < 0 && s2 < 0) {
+    if (*s1 < 0 && *s2 < 0) {
         errno = EBADF;
         return -1;
     }
 
     /*  Handle the case when there's only one socket in the device. */
-    if (s2 < 0)
-        return nn_device_loopback (s1);
-    if (s1 < 0)
-        return nn_device_loopback (s2);
+    if (*s2 < 0)
+        *s2 = *s1;
+    if (*s1 < 0)
+        *s1 = *s2;
+    if (*s1 == *s2)
+        return nn_device_loopback (*s1);
 
     /*  Check whether both sockets are "raw" sockets. */
     opsz = sizeof (op1);
-    rc = nn_getsockopt (s1, NN_SOL_SOCKET, NN_DOMAIN, &op1, &opsz);
+    rc = nn_getsockopt (*s1, NN_SOL_SOCKET, NN_DOMAIN, &op1, &opsz);
     errno_assert (rc == 0);
     nn_assert (opsz == sizeof (op1));
     opsz = sizeof (op2);
-    rc = nn_getsockopt (s2, NN_SOL_SOCKET, NN_DOMAIN, &op2, &opsz);
+    rc = nn_getsockopt (*s2, NN_SOL_SOCKET, NN_DOMAIN, &op2, &opsz);
     errno_assert (rc == 0);
     nn_assert (opsz == sizeof (op2));
     if (op1 != AF_SP_RAW || op2 != AF_SP_RAW) {
@@ -81,11 +239,11 @@ int nn_device (int s1, int s2)
 
     /*  Check whether both sockets are from the same protocol. */
     opsz = sizeof (op1);
-    rc = nn_getsockopt (s1, NN_SOL_SOCKET, NN_PROTOCOL, &op1, &opsz);
+    rc = nn_getsockopt (*s1, NN_SOL_SOCKET, NN_PROTOCOL, &op1, &opsz);
     errno_assert (rc == 0);
     nn_assert (opsz == sizeof (op1));
     opsz = sizeof (op2);
-    rc = nn_getsockopt (s2, NN_SOL_SOCKET, NN_PROTOCOL, &op2, &opsz);
+    rc = nn_getsockopt (*s2, NN_SOL_SOCKET, NN_PROTOCOL, &op2, &opsz);
     errno_assert (rc == 0);
     nn_assert (opsz == sizeof (op2));
     if (op1 / 16 != op2 / 16) {
@@ -93,79 +251,53 @@ int nn_device (int s1, int s2)
         return -1;
     }
 
-    /*  Get the file descriptors for polling. */
-    opsz = sizeof (s1rcv);
-    rc = nn_getsockopt (s1, NN_SOL_SOCKET, NN_RCVFD, &s1rcv, &opsz);
-    if (rc < 0 && nn_errno () == ENOPROTOOPT)
-        s1rcv = -1;
-    else {
-        nn_assert (rc == 0);
-        nn_assert (opsz == sizeof (s1rcv));
-        nn_assert (s1rcv >= 0);
-    }
-    opsz = sizeof (s1snd);
-    rc = nn_getsockopt (s1, NN_SOL_SOCKET, NN_SNDFD, &s1snd, &opsz);
-    if (rc < 0 && nn_errno () == ENOPROTOOPT)
-        s1snd = -1;
-    else {
-        nn_assert (rc == 0);
-        nn_assert (opsz == sizeof (s1snd));
-        nn_assert (s1snd >= 0);
-    }
-    opsz = sizeof (s2rcv);
-    rc = nn_getsockopt (s2, NN_SOL_SOCKET, NN_RCVFD, &s2rcv, &opsz);
-    if (rc < 0 && nn_errno () == ENOPROTOOPT)
-        s2rcv = -1;
-    else {
-        nn_assert (rc == 0);
-        nn_assert (opsz == sizeof (s2rcv));
-        nn_assert (s2rcv >= 0);
-    }
-    opsz = sizeof (s2snd);
-    rc = nn_getsockopt (s2, NN_SOL_SOCKET, NN_SNDFD, &s2snd, &opsz);
-    if (rc < 0 && nn_errno () == ENOPROTOOPT)
-        s2snd = -1;
-    else {
-        nn_assert (rc == 0);
-        nn_assert (opsz == sizeof (s2snd));
-        nn_assert (s2snd >= 0);
-    }
+    /*  Find out which directions the sockets support. */
+    dirs1 = nn_global_sockdirs (*s1);
+    errno_assert (dirs1 >= 0);
+    dirs2 = nn_global_sockdirs (*s2);
+    errno_assert (dirs2 >= 0);
 
     /*  Check the directionality of the sockets. */
-    if (s1rcv != -1 && s2snd == -1) {
+    if ((dirs1 & NN_POLLIN) && !(dirs2 & NN_POLLOUT)) {
         errno = EINVAL;
         return -1;
     }
-    if (s1snd != -1 && s2rcv == -1) {
+    if ((dirs1 & NN_POLLOUT) && !(dirs2 & NN_POLLIN)) {
         errno = EINVAL;
         return -1;
     }
-    if (s2rcv != -1 && s1snd == -1) {
+    if ((dirs2 & NN_POLLIN) && !(dirs1 & NN_POLLOUT)) {
         errno = EINVAL;
         return -1;
     }
-    if (s2snd != -1 && s1rcv == -1) {
+    if ((dirs2 & NN_POLLOUT) && !(dirs1 & NN_POLLIN)) {
         errno = EINVAL;
         return -1;
     }
 
     /*  Two-directional device. */
-    if (s1rcv != -1 && s1snd != -1 && s2rcv != -1 && s2snd != -1)
-        return nn_device_twoway (s1, s1rcv, s1snd, s2, s2rcv, s2snd);
+    if (dirs1 == (NN_POLLIN | NN_POLLOUT) && dirs2 == (NN_POLLIN | NN_POLLOUT))
+        return 2;
 
     /*  Single-directional device passing messages from s1 to s2. */
-    if (s1rcv != -1 && s1snd == -1 && s2rcv == -1 && s2snd != -1)
-        return nn_device_oneway (s1, s1rcv, s2, s2snd);
+    if (dirs1 == NN_POLLIN && dirs2 == NN_POLLOUT)
+        return 1;
 
     /*  Single-directional device passing messages from s2 to s1. */
-    if (s1rcv == -1 && s1snd != -1 && s2rcv != -1 && s2snd == -1)
-        return nn_device_oneway (s2, s2rcv, s1, s1snd);
+    if (dirs1 == NN_POLLOUT && dirs2 == NN_POLLIN) {
+        tmp = *s1;
+        *s1 = *s2;
+        *s2 = tmp;
+        return 1;
+    }
 
     /*  This should never happen. */
     nn_assert (0);
 }
 
-int nn_device_loopback (int s)
+/*  Checks whether the socket can be used as a loopback device. Returns
+    the number of directions the messages flow in or -1 with errno set. */
+static int nn_device_loopback (int s)
 {
     int rc;
     int op;
@@ -181,168 +313,304 @@ int nn_device_loopback (int s)
         return -1;
     }
 
-    while (1) {
-        rc = nn_device_mvmsg (s, s, 0);
-        if (nn_slow (rc < 0))
-            return -1;
-    }
+    return 1;
 }
 
-#if defined NN_HAVE_WINDOWS
+/*  When messages are passed from a PULL socket to a PUSH socket and the user
+    hasn't set up the credit of the former, it's set to a single batch. Once
+    the pullers downstream stop granting credit to the device, it stops
+    receiving messages and thus stops granting credit to the pushers
+    upstream, so that the backpressure travels up the chain of devices
+    without filling the buffers on the way. */
+static void nn_device_credit (int s1, int s2)
+{
+    int rc;
+    int op;
+    size_t opsz;
 
-static int nn_device_twoway (int s1, int s1rcv, int s1snd,
-    int s2, int s2rcv, int s2snd)
+    opsz = sizeof (op);
+    rc = nn_getsockopt (s1, NN_SOL_SOCKET, NN_PROTOCOL, &op, &opsz);
+    errno_assert (rc == 0);
+    if (op != NN_PULL || s1 == s2)
+        return;
+    opsz = sizeof (op);
+    rc = nn_getsockopt (s1, NN_PULL, NN_PULL_CREDIT, &op, &opsz);
+    errno_assert (rc == 0);
+    if (op)
+        return;
+    op = NN_DEVICE_BATCH;
+    rc = nn_setsockopt (s1, NN_PULL, NN_PULL_CREDIT, &op, sizeof (op));
+    errno_assert (rc == 0);
+}
+
+static int nn_device_twoway (int s1, int s2)
 {
     int rc;
-    fd_set fds;
+    int events1;
+    int events2;
+    int progress;
+    struct nn_pollfd pfd [2];
+    struct nn_device_batch batch12;
+    struct nn_device_batch batch21;
 
-    /*  Initialise the pollset. */
-    FD_ZERO (&fds);
-    FD_SET (s1rcv, &fds);
-    FD_SET (s1snd, &fds);
-    FD_SET (s2rcv, &fds);
-    FD_SET (s2snd, &fds);
+    /*  The events that were already received. We cease polling for them
+        until they are found not to hold any more. */
+    events1 = 0;
+    events2 = 0;
+
+    pfd [0].fd = s1;
+    pfd [1].fd = s2;
+
+    nn_device_batch_init (&batch12);
+    nn_device_batch_init (&batch21);
 
     while (1) {
 
-        /*  Wait for network events. */
-        rc = select (0, &fds, NULL, NULL, NULL);
-        wsa_assert (rc != SOCKET_ERROR);
-
-        /*  Process the events. When the event is received, we cease polling
-            for it. */
-        if (FD_ISSET (s1rcv, &fds))
-            FD_CLR (s1rcv, &fds);
-        else
-            FD_SET (s1snd, &fds);
-        if (FD_ISSET (s1snd, &fds))
-            FD_CLR (s1snd, &fds);
-        else
-            FD_SET (s1snd, &fds);
-        if (FD_ISSET (s2rcv, &fds))
-            FD_CLR (s2rcv, &fds);
-        else
-            FD_SET (s2snd, &fds);
-        if (FD_ISSET (s2snd, &fds))
-            FD_CLR (s2snd, &fds);
-        else
-            FD_SET (s2snd, &fds);
-
-        /*  If possible, pass the message from s1 to s2. */
-        if (!FD_ISSET (s1rcv, &fds) && !FD_ISSET (s2snd, &fds)) {
-            rc = nn_device_mvmsg (s1, s2, NN_DONTWAIT);
-            if (nn_slow (rc < 0))
-                return -1;
-            FD_SET (s1rcv, &fds);
-            FD_SET (s2snd, &fds);
-        }
+        /*  Move a batch of messages in each direction. Poll only when
+            neither direction can make progress. */
+        progress = nn_device_pass (&batch12, s1, s2, &events1, &events2);
+        if (nn_slow (progress < 0))
+            break;
+        rc = nn_device_pass (&batch21, s2, s1, &events2, &events1);
+        if (nn_slow (rc < 0))
+            break;
+        if (progress || rc)
+            continue;
 
-        /*  If possible, pass the message from s2 to s1. */
-        if (!FD_ISSET (s2rcv, &fds) && !FD_ISSET (s1snd, &fds)) {
-            rc = nn_device_mvmsg (s2, s1, NN_DONTWAIT);
-            if (nn_slow (rc < 0))
-                return -1;
-            FD_SET (s2rcv, &fds);
-            FD_SET (s1snd, &fds);
-        }
+        /*  Wait for network events. */
+        pfd [0].events = (short) ((NN_POLLIN | NN_POLLOUT) & ~events1);
+        pfd [1].events = (short) ((NN_POLLIN | NN_POLLOUT) & ~events2);
+        rc = nn_poll (pfd, 2, -1);
+        if (nn_slow (rc < 0 && nn_errno () == EINTR))
+            break;
+        errno_assert (rc >= 0);
+        nn_assert (rc != 0);
+        events1 |= pfd [0].revents;
+        events2 |= pfd [1].revents;
     }
-}
 
-#elif defined NN_HAVE_POLL
+    nn_device_batch_term (&batch21);
+    nn_device_batch_term (&batch12);
+    return -1;
+}
 
-static int nn_device_twoway (int s1, int s1rcv, int s1snd,
-    int s2, int s2rcv, int s2snd)
+static int nn_device_oneway (int s1, int s2)
 {
     int rc;
-    struct pollfd pfd [4];
-
-    /*  Initialise the pollset. */
-    pfd [0].fd = s1rcv;
-    pfd [0].events = POLLIN;
-    pfd [1].fd = s1snd;
-    pfd [1].events = POLLIN;
-    pfd [2].fd = s2rcv;
-    pfd [2].events = POLLIN;
-    pfd [3].fd = s2snd;
-    pfd [3].events = POLLIN;
+    struct nn_device_batch batch;
 
-    while (1) {
+    nn_device_batch_init (&batch);
 
-        /*  Wait for network events. */
-        rc = poll (pfd, 4, -1);
-        errno_assert (rc >= 0);
-        if (nn_slow (rc < 0 && errno == EINTR))
-            return -1;
-        nn_assert (rc != 0);
+    while (1) {
 
-        /*  Process the events. When the event is received, we cease polling
-            for it. */
-        if (pfd [0].revents & POLLIN)
-            pfd [0].events = 0;
-        if (pfd [1].revents & POLLIN)
-            pfd [1].events = 0;
-        if (pfd [2].revents & POLLIN)
-            pfd [2].events = 0;
-        if (pfd [3].revents & POLLIN)
-            pfd [3].events = 0;
-
-        /*  If possible, pass the message from s1 to s2. */
-        if (pfd [0].events == 0 && pfd [3].events == 0) {
-            rc = nn_device_mvmsg (s1, s2, NN_DONTWAIT);
-            if (nn_slow (rc < 0))
-                return -1;
-            pfd [0].events = POLLIN;
-            pfd [3].events = POLLIN;
+        /*  Wait for the first message and grab whatever else is available
+            at the moment. */
+        rc = nn_global_recvv (s1, batch.msgs, NN_DEVICE_BATCH, 0);
+        if (nn_slow (rc < 0 && nn_errno () == ETERM))
+            break;
+        errno_assert (rc > 0);
+        batch.pos = 0;
+        batch.count = rc;
+
+        /*  Push the whole batch to the other socket. */
+        while (batch.pos != batch.count) {
+            rc = nn_global_sendv (s2, batch.msgs + batch.pos,
+                batch.count - batch.pos, 0);
+            if (nn_slow (rc < 0 && nn_errno () == ETERM))
+                goto term;
+            errno_assert (rc > 0);
+            batch.pos += rc;
         }
+    }
+
+term:
+    nn_device_batch_term (&batch);
+    return -1;
+}
+
+static void nn_device_batch_init (struct nn_device_batch *self)
+{
+    self->pos = 0;
+    self->count = 0;
+}
 
-        /*  If possible, pass the message from s2 to s1. */
-        if (pfd [2].events == 0 && pfd [1].events == 0) {
-            rc = nn_device_mvmsg (s2, s1, NN_DONTWAIT);
-            if (nn_slow (rc < 0))
-                return -1;
-            pfd [2].events = POLLIN;
-            pfd [1].events = POLLIN;
+static void nn_device_batch_term (struct nn_device_batch *self)
+{
+    while (self->pos != self->count) {
+        nn_msg_term (&self->msgs [self->pos]);
+        ++self->pos;
+    }
+}
+
+/*  Moves at most one batch of messages from 'from' to 'to' without blocking.
+    Events that turn out not to hold any more are removed from 'fromevents'
+    and 'toevents'. Returns 1 if any progress was made, 0 if it was not and
+    -1 with errno set to ETERM when the library is being terminated. */
+static int nn_device_pass (struct nn_device_batch *batch, int from, int to,
+    int *fromevents, int *toevents)
+{
+    int rc;
+    int progress;
+
+    progress = 0;
+
+    /*  If there are no messages pending, get a new batch, but only if
+        the other socket is ready to take some of them. The messages left
+        in the device would not be pushed back to the sender otherwise. */
+    if (batch->pos == batch->count) {
+        if (!(*fromevents & NN_POLLIN) || !(*toevents & NN_POLLOUT))
+            return 0;
+        rc = nn_global_recvv (from, batch->msgs, NN_DEVICE_BATCH,
+            NN_DONTWAIT);
+        if (nn_slow (rc < 0 && nn_errno () == EAGAIN)) {
+            *fromevents &= ~NN_POLLIN;
+            return 0;
         }
+        if (nn_slow (rc < 0 && nn_errno () == ETERM))
+            return -1;
+        errno_assert (rc > 0);
+        batch->pos = 0;
+        batch->count = rc;
+        progress = 1;
     }
+
+    /*  Pass as many pending messages as the other socket will take. */
+    if (!(*toevents & NN_POLLOUT))
+        return progress;
+    rc = nn_global_sendv (to, batch->msgs + batch->pos,
+        batch->count - batch->pos, NN_DONTWAIT);
+    if (nn_slow (rc < 0 && nn_errno () == EAGAIN)) {
+        *toevents &= ~NN_POLLOUT;
+        return progress;
+    }
+    if (nn_slow (rc < 0 && nn_errno () == ETERM))
+        return -1;
+    errno_assert (rc > 0);
+    batch->pos += rc;
+    return 1;
+}
+
+static void nn_device_pipeline_init (struct nn_device_pipeline *self)
+{
+    int i;
+
+    for (i = 0; i != 3; ++i)
+        nn_device_batch_init (&self->batches [i]);
+    self->slot = &self->batches [0];
+    nn_sem_init (&self->empty);
+    nn_sem_init (&self->full);
+    nn_sem_post (&self->empty);
+}
+
+static void nn_device_pipeline_term (struct nn_device_pipeline *self)
+{
+    int i;
+
+    nn_sem_term (&self->full);
+    nn_sem_term (&self->empty);
+    for (i = 0; i != 3; ++i)
+        nn_device_batch_term (&self->batches [i]);
+}
+
+/*  Exchanges the batch owned by the caller with the one in the slot. */
+static void nn_device_pipeline_swap (struct nn_device_pipeline *self,
+    struct nn_device_batch **batch, struct nn_sem *wait, struct nn_sem *post)
+{
+    int rc;
+    struct nn_device_batch *tmp;
+
+    do {
+        rc = nn_sem_wait (wait);
+    } while (rc == -EINTR);
+    errnum_assert (rc == 0, -rc);
+    tmp = self->slot;
+    self->slot = *batch;
+    *batch = tmp;
+    nn_sem_post (post);
 }
 
-#else
-#error
-#endif
+static void nn_device_stage_routine (void *arg)
+{
+    int rc;
+    struct nn_device_stage *self;
+
+    self = (struct nn_device_stage*) arg;
+
+    switch (self->type) {
+    case NN_DEVICE_STAGE_ONEWAY:
+        rc = nn_device_oneway (self->from, self->to);
+        break;
+    case NN_DEVICE_STAGE_RECV:
+        rc = nn_device_recv_stage (self->from, self->pipeline);
+        break;
+    case NN_DEVICE_STAGE_SEND:
+        rc = nn_device_send_stage (self->to, self->pipeline);
+        break;
+    default:
+        nn_assert (0);
+    }
+    nn_assert (rc < 0);
+    self->err = nn_errno ();
+}
 
-static int nn_device_oneway (int s1, int s1rcv, int s2, int s2snd)
+static int nn_device_recv_stage (int from,
+    struct nn_device_pipeline *pipeline)
 {
     int rc;
+    struct nn_device_batch *batch;
+
+    batch = &pipeline->batches [1];
 
     while (1) {
-        rc = nn_device_mvmsg (s1, s2, 0);
-        if (nn_slow (rc < 0))
-            return -1;
+        rc = nn_global_recvv (from, batch->msgs, NN_DEVICE_BATCH, 0);
+        if (nn_slow (rc < 0 && nn_errno () == ETERM))
+            break;
+        errno_assert (rc > 0);
+        batch->pos = 0;
+        batch->count = rc;
+        nn_device_pipeline_swap (pipeline, &batch, &pipeline->empty,
+            &pipeline->full);
     }
+
+    /*  An empty batch tells the sending thread to exit. */
+    batch->pos = 0;
+    batch->count = 0;
+    nn_device_pipeline_swap (pipeline, &batch, &pipeline->empty,
+        &pipeline->full);
+    errno = ETERM;
+    return -1;
 }
 
-static int nn_device_mvmsg (int from, int to, int flags)
+static int nn_device_send_stage (int to, struct nn_device_pipeline *pipeline)
 {
     int rc;
-    void *body;
-    void *control;
-    struct nn_iovec iov;
-    struct nn_msghdr hdr;
-
-    iov.iov_base = &body;
-    iov.iov_len = NN_MSG;
-    memset (&hdr, 0, sizeof (hdr));
-    hdr.msg_iov = &iov;
-    hdr.msg_iovlen = 1;
-    hdr.msg_control = &control;
-    hdr.msg_controllen = NN_MSG;
-    rc = nn_recvmsg (from, &hdr, flags);
-    if (nn_slow (rc < 0 && nn_errno () == ETERM))
-        return -1;
-    errno_assert (rc >= 0);
-    rc = nn_sendmsg (to, &hdr, flags);
-    if (nn_slow (rc < 0 && nn_errno () == ETERM))
-        return -1;
-    errno_assert (rc >= 0);
-    return 0;
+    int term;
+    struct nn_device_batch *batch;
+
+    batch = &pipeline->batches [2];
+    term = 0;
+
+    while (1) {
+        nn_device_pipeline_swap (pipeline, &batch, &pipeline->full,
+            &pipeline->empty);
+        if (batch->count == 0)
+            break;
+
+        /*  Once the library is terminating, the batches are dropped till
+            the receiving thread exits. */
+        while (!term && batch->pos != batch->count) {
+            rc = nn_global_sendv (to, batch->msgs + batch->pos,
+                batch->count - batch->pos, 0);
+            if (nn_slow (rc < 0 && nn_errno () == ETERM)) {
+                term = 1;
+                break;
+            }
+            errno_assert (rc > 0);
+            batch->pos += rc;
+        }
+        nn_device_batch_term (batch);
+    }
+
+    errno = ETERM;
+    return -1;
 }
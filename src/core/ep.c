@@ -21,11 +21,14 @@
 */
 
 #include "../transport.h"
+#include "../protocol.h"
 
 #include "ep.h"
 #include "sock.h"
 
 #include "../utils/err.h"
+#include "../utils/handoff.h"
+#include "../utils/wire.h"
 
 #include <string.h>
 
@@ -39,6 +42,19 @@ void nn_epbase_init (struct nn_epbase *self,
     /*  Remember which socket the endpoint belongs to. */
     self->sock = (struct nn_sock*) hint;
 
+    /*  The endpoint will get the next endpoint ID of the socket once it's
+        created. The ID is needed earlier though, as some transports create
+        pipes straight away. */
+    self->eid = ((struct nn_sockbase*) self->sock)->eid;
+
+    /*  The socket fills in the transport ID once the endpoint is created. */
+    self->transport = 0;
+
+    /*  Priorities of the pipes are those in effect when the endpoint is
+        created, irrespective of when the pipes are created. */
+    self->sndprio = ((struct nn_sockbase*) self->sock)->sndprio;
+    self->rcvprio = ((struct nn_sockbase*) self->sock)->rcvprio;
+
     /*  This enpoint does not belong to any socket yet. */
     nn_list_item_init (&self->item);
 
@@ -75,6 +91,16 @@ struct nn_worker *nn_epbase_choose_worker (struct nn_epbase *self)
     return nn_sock_choose_worker (self->sock);
 }
 
+int nn_epbase_ownscp (struct nn_epbase *self)
+{
+    return nn_sock_ownscp (self->sock);
+}
+
+struct nn_budget *nn_epbase_getbudget (struct nn_epbase *self)
+{
+    return nn_sock_getbudget (self->sock);
+}
+
 const char *nn_epbase_getaddr (struct nn_epbase *self)
 {
     return self->addr;
@@ -94,6 +120,25 @@ int nn_epbase_ispeer (struct nn_epbase *self, int socktype)
     return nn_sock_ispeer (self->sock, socktype);
 }
 
+int nn_epbase_handoff (struct nn_epbase *self, int fd, const int *fds,
+    int nfds)
+{
+    size_t len;
+    uint8_t buf [4 + NN_SOCKADDR_MAX];
+
+    /*  The transport ID followed by the address. */
+    len = strlen (self->addr);
+    nn_putl (buf, (uint32_t) self->transport);
+    memcpy (buf + 4, self->addr, len);
+    return nn_handoff_send (fd, NN_HANDOFF_EP, buf, 4 + len, fds, nfds);
+}
+
+int nn_epbase_handoffpipe (struct nn_epbase *self, int fd, int s,
+    const void *state, size_t len)
+{
+    return nn_handoff_send (fd, NN_HANDOFF_PIPE, state, len, &s, 1);
+}
+
 int nn_ep_close (struct nn_ep *self)
 {
     struct nn_epbase *epbase;
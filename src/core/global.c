@@ -33,16 +33,27 @@
 #include "../utils/err.h"
 #include "../utils/alloc.h"
 #include "../utils/mutex.h"
-#include "../utils/list.h"
+#include "../utils/atomic.h"
+#include "../utils/sleep.h"
+#include "../utils/efd.h"
+#include "../utils/clock.h"
 #include "../utils/cont.h"
 #include "../utils/random.h"
+#include "../utils/resolver.h"
+#include "../utils/cstream.h"
 #include "../utils/glock.h"
 #include "../utils/chunk.h"
 #include "../utils/msg.h"
+#include "../utils/thread.h"
 
 #include "../transports/inproc/inproc.h"
 #include "../transports/ipc/ipc.h"
+#include "../transports/shm/shm.h"
 #include "../transports/tcp/tcp.h"
+#include "../transports/udpm/udpm.h"
+#include "../transports/udp/udp.h"
+#include "../transports/ws/ws.h"
+#include "../transports/tcpmux/tcpmux.h"
 
 #include "../protocols/pair/pair.h"
 #include "../protocols/pair/xpair.h"
@@ -68,55 +79,162 @@
 #include "../protocols/bus/xbus.h"
 
 #include <stddef.h>
+#include <stdlib.h>
 #include <string.h>
+#include <limits.h>
 
 #if defined NN_HAVE_WINDOWS
 #include "../utils/win.h"
+#else
+#include <unistd.h>
+#include <poll.h>
 #endif
 
-/*  Max number of concurrent SP sockets. */
-#define NN_MAX_SOCKETS 512
+/*  Default max number of concurrent SP sockets. It can be overriden by
+    NN_MAX_SOCKETS environment variable. */
+#ifndef NN_MAX_SOCKETS
+#define NN_MAX_SOCKETS 0x10000
+#endif
 
-/*  To save some space, list of unused socket slots uses uint16_t integers to
-    refer to individual sockets. If there's a need to more that 0x10000 sockets,
-    the type should be changed to uint32_t or int. */
-CT_ASSERT (NN_MAX_SOCKETS <= 0x10000);
+/*  The socket table is allocated in pages of this many sockets as more
+    sockets are opened. The pages are never moved or deallocated while
+    the library is initialised, so socket lookup needs no locking. */
+#define NN_SOCKS_PAGE_BITS 8
+#define NN_SOCKS_PAGE_SIZE (1 << NN_SOCKS_PAGE_BITS)
+
+/*  The top of the stack of unused descriptors is stored in the lower 32 bits
+    of a 64-bit atomic. The upper 32 bits are a tag that changes with each
+    push and pop to prevent the ABA problem. NN_UNUSED_NIL marks the empty
+    stack and caps the number of descriptors. */
+#define NN_UNUSED_NIL ((1u << 20) - 1)
+#define NN_UNUSED_TAG ((uint64_t) 1 << 32)
+#define NN_UNUSED_TOP(u) ((uint32_t) ((u) & 0xffffffffu))
+#define NN_UNUSED_NEXT(u, top) \
+    ((((u) & ~(uint64_t) 0xffffffffu) + NN_UNUSED_TAG) | (uint32_t) (top))
+
+/*  Size of the tables the transports are looked up in. Transport IDs are
+    negative numbers above minus this, and the hash table by name is kept
+    at most half full. Must be a power of two. */
+#define NN_GLOBAL_TRANSPORTS 16
+
+/*  Socket types are looked up by the domain and the protocol ID. Protocol IDs
+    are below this number. */
+#define NN_GLOBAL_PROTOCOLS 128
+
+/*  The value of NN_MAX_SOCKETS environment variable is capped at this. */
+#define NN_MAX_SOCKETS_LIMIT (NN_UNUSED_NIL + 1 - NN_SOCKS_PAGE_SIZE)
+
+/*  Returns the slot for socket 's' in the socket table. */
+#define NN_SOCK(s) \
+    (self.socks [(s) >> NN_SOCKS_PAGE_BITS] [(s) & (NN_SOCKS_PAGE_SIZE - 1)])
+
+/*  Returns the link to the next descriptor in the stack of unused ones. */
+#define NN_SOCK_NEXT(s) \
+    (((uint32_t*) (self.socks [(s) >> NN_SOCKS_PAGE_BITS] + \
+    NN_SOCKS_PAGE_SIZE)) [(s) & (NN_SOCKS_PAGE_SIZE - 1)])
 
 /*  This check is performed at the beginning of each socket operation to make
     sure that the library was initialised and the socket actually exists. */
 #define NN_BASIC_CHECKS \
-    if (nn_slow (!self.socks || !self.socks [s])) {\
+    if (nn_slow (!self.socks || s < 0 || s >= self.npages * \
+          NN_SOCKS_PAGE_SIZE || !NN_SOCK (s))) {\
         errno = EBADF;\
         return -1;\
     }
 
 #define NN_CTX_FLAG_ZOMBIE 1
 
-struct nn_global {
+/*  Max number of messages transferred by a single nn_sendmmsg or nn_recvmmsg
+    call. Longer vectors are processed only partially. */
+#define NN_MAX_MMSG 64
 
-    /*  The global table of existing sockets. The descriptor representing
-        the socket is the index to this table. This pointer is also used to
-        find out whether context is initialised. If it is NULL, context is
-        uninitialised. */
-    struct nn_sock **socks;
+/*  nn_poll with up to this many sockets doesn't allocate memory. */
+#define NN_POLL_ITEMS 16
+
+/*  Max number of completion ports shared among the sockets. */
+#define NN_MAX_CPS 64
 
-    /*  Stack of unused file descriptors. */
-    uint16_t *unused;
+/*  How often, in milliseconds, the load of the shared completion ports is
+    sampled. */
+#define NN_CP_SAMPLE_IVL 100
 
-    /*  Number of actual open sockets in the socket table. */
-    size_t nsocks;
+struct nn_global {
+
+    /*  The global table of existing sockets. The descriptor representing
+        the socket is the index to this table. The table is split into pages
+        of NN_SOCKS_PAGE_SIZE sockets, 'npages' of which are allocated so far.
+        'maxsocks' is the max number of sockets and determines the number of
+        page pointers. This pointer is also used to find out whether context
+        is initialised. If it is NULL, context is uninitialised. */
+    struct nn_sock ***socks;
+    int npages;
+    int maxsocks;
+
+    /*  Lock-free stack of unused file descriptors, linked through the pages
+        of the socket table. See NN_UNUSED_TAG for the format. */
+    struct nn_atomic64 unused;
+
+    /*  Number of open sockets, including those being created at the moment.
+        The library is initialised while it is non-zero. */
+    struct nn_atomic nsocks;
+
+    /*  Number of nn_socket and nn_close calls modifying the socket table
+        without the global lock. nn_term waits for them before walking
+        the table. */
+    struct nn_atomic busy;
+
+    /*  Number of sockets in the socket table. nn_term stops walking the table
+        once it has seen them all. */
+    struct nn_atomic nopen;
+
+    /*  Serialises growing of the socket table. */
+    struct nn_mutex growsync;
+
+    /*  The synchronisation objects above are initialised the first time
+        the library is initialised and are never deallocated so that they
+        can be used without holding the global lock. */
+    int syncinit;
 
     /*  Combination of the flags listed above. */
     int flags;
 
-    /*  List of all available transports. */
-    struct nn_list transports;
+    /*  Available transports, hashed by the name with linear probing and
+        indexed by the negated ID. The tables are filled in when the library
+        is initialised and don't change while there are open sockets, so they
+        are accessed without locking. */
+    struct nn_transport *transports [NN_GLOBAL_TRANSPORTS];
+    struct nn_transport *transportids [NN_GLOBAL_TRANSPORTS];
 
-    /*  List of all available socket types. */
-    struct nn_list socktypes;
+    /*  Available socket types, indexed by the domain and the protocol ID. */
+    struct nn_socktype *socktypes [2][NN_GLOBAL_PROTOCOLS];
 
     /*  Pool of worker threads. */
     struct nn_pool pool;
+
+    /*  Completion ports shared among the sockets. If 'ncps' is zero, each
+        socket creates its own completion port instead. 'nextcp' counts
+        the sockets created, it determines the completion port to be assigned
+        to the next socket. If 'cpnodes' is greater than 1, completion port i
+        is bound to NUMA node i modulo 'cpnodes' and the sockets get one of
+        those on the node they are created on. */
+    struct nn_cp *cps;
+    int ncps;
+    int cpnodes;
+    struct nn_atomic nextcp;
+
+    /*  Time, in nanoseconds, the thread of each shared completion port was
+        busy during the last sampling period, its total busy time at the end
+        of the period and the time the period ended at. Guarded by
+        'cpsync'. */
+    struct nn_mutex cpsync;
+    uint64_t cpload [NN_MAX_CPS];
+    uint64_t cpbusy [NN_MAX_CPS];
+    uint64_t cpsampled;
+
+    /*  If set, there's a single completion port shared among all the sockets
+        and it has no worker thread. It's driven by the user via nn_process
+        instead. */
+    int external;
 };
 
 /*  Singleton object containing the global state of the library. */
@@ -126,14 +244,130 @@ static struct nn_global self = {0};
 static void nn_global_init (void);
 static void nn_global_term (void);
 
+/*  Shared completion port-related private functions. */
+static void nn_global_init_cps (void);
+static void nn_global_term_cps (void);
+static int nn_global_ncpus (void);
+static void nn_global_sample_cps (void);
+
 /*  Transport-related private functions. */
 static void nn_global_add_transport (struct nn_transport *transport);
 static void nn_global_add_socktype (struct nn_socktype *socktype);
+static uint32_t nn_global_hash (const char *name, size_t namelen);
 
 /*  Private function that unifies nn_bind and nn_connect functionality.
     It returns the ID of the newly created endpoint. */
 static int nn_global_create_ep (int fd, const char *addr, int bind);
 
+/*  Reference counting of the global state. nn_global_hold returns 0 if
+    the library isn't initialised, in which case it has to be initialised
+    under the global lock. */
+static int nn_global_hold (void);
+static void nn_global_release (void);
+
+/*  Same as nn_global_release, except that the library is never terminated.
+    If the last reference is dropped, the library is left initialised and
+    it's terminated by the next nn_global_init. */
+#if !defined NN_HAVE_WINDOWS
+static void nn_global_release_bg (void);
+#endif
+
+/*  Socket table-related private functions. */
+static int nn_global_pop (void);
+static void nn_global_pushlist (int first, int last);
+static void nn_global_push (int s);
+static void nn_global_add_page (void);
+
+/*  Functions converting between nn_msghdr structures and messages. */
+static int nn_global_hdrtomsg (const struct nn_msghdr *msghdr,
+    struct nn_msg *msg, size_t *sz, int cmsgs);
+static void nn_global_freeiov (const struct nn_msghdr *msghdr);
+static int nn_global_checkhdr (const struct nn_msghdr *msghdr);
+static size_t nn_global_msgtohdr (struct nn_msg *msg,
+    struct nn_msghdr *msghdr, int cmsgs);
+
+/*  Looks up the control information entry of the given level and type in
+    the control buffer. If there's no such entry, 'data' is set to NULL.
+    Returns -EINVAL if the buffer is not a valid sequence of entries. */
+static int nn_global_getcmsg (const struct nn_msghdr *msghdr,
+    int level, int type, const void **data, size_t *len);
+
+/*  Stores a control information entry at offset 'pos' of the control buffer,
+    as much of it as fits. Returns the offset of the next entry. */
+static size_t nn_global_putcmsg (struct nn_msghdr *msghdr, size_t pos,
+    int level, int type, const void *data, size_t len);
+
+/*  Returns 1 if the control information of the messages received from
+    the socket consists of nn_cmsghdr entries, 0 if it's the bare protocol
+    header. */
+static int nn_global_cmsgs (int s);
+
+/*  Polls OS-level file descriptors passed to nn_poll. */
+static int nn_global_pollsys (struct nn_pollfd *fds, int nfds, int nsys,
+    struct nn_efd *efd, int timeout);
+
+/*  Implementation of nn_send and nn_recv. If 'ctx' is not negative, the
+    context with the specified ID is used. */
+static int nn_global_send (struct nn_sock *sock, int ctx, const void *buf,
+    size_t len, int flags);
+static int nn_global_recv (struct nn_sock *sock, int ctx, void *buf,
+    size_t len, int flags);
+
+/*  Create a message from the user's buffer the way nn_send does and store
+    the received message in the user's buffer the way nn_recv does. */
+static int nn_global_buftomsg (const void *buf, size_t *len,
+    struct nn_msg *msg);
+static size_t nn_global_msgtobuf (struct nn_msg *msg, void *buf, size_t len);
+
+#if !defined NN_HAVE_WINDOWS
+
+/*  State of a single nn_send_async or nn_recv_async call. Once the socket
+    completes the operation, the rest of the work, including invocation of
+    the user's callback, is done in a worker thread. */
+struct nn_global_async {
+    struct nn_sockop op;
+    struct nn_worker *worker;
+    struct nn_worker_callback callback;
+    struct nn_worker_task task;
+    int s;
+    int recv;
+    void *buf;
+    size_t len;
+    void (*fn) (int s, int rc, void *arg);
+    void *arg;
+};
+
+/*  State of a socket closed by nn_close with NN_BGCLOSE set. Once all its
+    endpoints terminate, the socket is deallocated by a worker thread. */
+struct nn_global_bgclose {
+    struct nn_sock *sock;
+    struct nn_worker *worker;
+    struct nn_worker_callback callback;
+    struct nn_worker_task task;
+};
+
+/*  Closes the socket in the background if NN_BGCLOSE is set. Returns 1 if
+    the socket was handed to a worker thread, 0 if it has to be closed
+    synchronously. */
+static int nn_global_bgclose (int s, struct nn_sock *sock);
+static void nn_global_bgclose_done (void *arg);
+static void nn_global_bgclose_callback (struct nn_worker_callback *self,
+    void *source, int type, struct nn_worker_poller *poller);
+static const struct nn_worker_callback_vfptr nn_global_bgclose_vfptr = {
+    nn_global_bgclose_callback
+};
+
+static int nn_global_async (int s, int recv, void *buf, size_t len,
+    void (*fn) (int s, int rc, void *arg), void *arg);
+static void nn_global_async_done (struct nn_sockop *op);
+static void nn_global_async_callback (struct nn_worker_callback *self,
+    void *source, int type, struct nn_worker_poller *poller);
+static const struct nn_worker_callback_vfptr nn_global_async_vfptr = {
+    nn_global_async_callback
+};
+
+#endif
+
 int nn_errno (void)
 {
     return nn_err_errno ();
@@ -147,26 +381,31 @@ const char *nn_strerror (int errnum)
 struct nn_cmsghdr *nn_cmsg_nexthdr (const struct nn_msghdr *mhdr,
     const struct nn_cmsghdr *cmsg)
 {
-    size_t sz;
+    size_t pos;
 
-    sz = sizeof (struct nn_cmsghdr) + cmsg->cmsg_len;
-    if (((uint8_t*) cmsg) - ((uint8_t*) mhdr->msg_control) + sz >=
-           mhdr->msg_controllen)
+    pos = ((uint8_t*) cmsg) - ((uint8_t*) mhdr->msg_control) +
+        NN_CMSG_ALIGN (cmsg->cmsg_len);
+    if (pos + sizeof (struct nn_cmsghdr) > mhdr->msg_controllen)
         return NULL;
-    return (struct nn_cmsghdr*) (((uint8_t*) cmsg) + sz);
+    return (struct nn_cmsghdr*) (((uint8_t*) mhdr->msg_control) + pos);
 }
 
 static void nn_global_init (void)
 {
-    int i;
+    const char *env;
 #if defined NN_HAVE_WINDOWS
     WSADATA data;
     int rc;
 #endif
 
-    /*  Check whether the library was already initialised. If so, do nothing. */
-    if (self.socks)
-        return;
+    /*  Check whether the library was already initialised. If so, do nothing.
+        If it was left initialised with no sockets, as it happens when the last
+        socket is closed in the background, terminate it and start anew. */
+    if (self.socks) {
+        if (nn_atomic_get (&self.nsocks) > 0)
+            return;
+        nn_global_term ();
+    }
 
     /*  On Windows, initialise the socket library. */
 #if defined NN_HAVE_WINDOWS
@@ -179,61 +418,125 @@ static void nn_global_init (void)
     /*  Initialise the memory allocation subsystem. */
     nn_alloc_init ();
 
+    /*  Find out how the library's own threads should be set up. */
+    nn_thread_setup ();
+
     /*  Seed the pseudo-random number generator. */
     nn_random_seed ();
 
-    /*  Allocate the global table of SP sockets. */
-    self.socks = nn_alloc ((sizeof (struct nn_sock*) * NN_MAX_SOCKETS) +
-        (sizeof (uint16_t) * NN_MAX_SOCKETS), "socket table");
-    alloc_assert (self.socks);
-    for (i = 0; i != NN_MAX_SOCKETS; ++i)
-        self.socks [i] = NULL;
-    self.nsocks = 0;
-    self.flags = 0;
+    /*  Prepare for resolving hostnames. */
+    nn_resolver_init ();
+
+    /*  Find out whether connection attempts should be rate-limited. */
+    nn_cstream_setup ();
 
-    /*  Allocate the stack of unused file descriptors. */
-    self.unused = (uint16_t*) (self.socks + NN_MAX_SOCKETS);
-    alloc_assert (self.unused);
-    for (i = 0; i != NN_MAX_SOCKETS; ++i)
-        self.unused [i] = NN_MAX_SOCKETS - i - 1;
+    /*  Find out whether the I/O threads should spin when idle. */
+    nn_cp_setup ();
+
+    /*  Find out the max number of SP sockets. */
+    self.maxsocks = NN_MAX_SOCKETS;
+    env = getenv ("NN_MAX_SOCKETS");
+    if (env && atoi (env) > 0)
+        self.maxsocks = atoi (env);
+    if (self.maxsocks > NN_MAX_SOCKETS_LIMIT)
+        self.maxsocks = NN_MAX_SOCKETS_LIMIT;
+
+    /*  Allocate the global table of SP sockets. Only the page pointers and
+        the first page are allocated now, the rest is done on demand. */
+    self.socks = nn_alloc (sizeof (struct nn_sock**) *
+        ((self.maxsocks + NN_SOCKS_PAGE_SIZE - 1) / NN_SOCKS_PAGE_SIZE),
+        "socket table");
+    alloc_assert (self.socks);
+    if (!self.syncinit) {
+        nn_atomic64_init (&self.unused, 0);
+        nn_atomic_init (&self.nsocks, 0);
+        nn_atomic_init (&self.busy, 0);
+        nn_atomic_init (&self.nopen, 0);
+        nn_atomic_init (&self.nextcp, 0);
+        nn_mutex_init (&self.cpsync);
+        nn_mutex_init (&self.growsync);
+        self.syncinit = 1;
+    }
+    self.npages = 0;
 
-    /*  Initialise other parts of the global state. */
-    nn_list_init (&self.transports);
-    nn_list_init (&self.socktypes);
+    /*  Nobody else can access the stack of unused descriptors now. */
+    nn_atomic64_store (&self.unused, NN_UNUSED_NIL);
+    self.flags = 0;
+    nn_global_add_page ();
 
-    /*  Plug in individual transports. */
+    /*  Plug in individual transports. Those left out of the build are
+        not available. */
+    memset (self.transports, 0, sizeof (self.transports));
+    memset (self.transportids, 0, sizeof (self.transportids));
+#if defined NN_USE_INPROC
     nn_global_add_transport (nn_inproc);
-#if !defined NN_HAVE_WINDOWS
+#endif
+#if defined NN_USE_IPC && !defined NN_HAVE_WINDOWS
     nn_global_add_transport (nn_ipc);
 #endif
+#if defined NN_USE_SHM
+    nn_global_add_transport (nn_shm);
+#endif
+#if defined NN_USE_TCP
     nn_global_add_transport (nn_tcp);
+#endif
+#if defined NN_USE_WS
+    nn_global_add_transport (nn_ws);
+#endif
+#if defined NN_USE_UDPM && !defined NN_HAVE_WINDOWS
+    nn_global_add_transport (nn_udpm);
+#endif
+#if defined NN_USE_UDP && !defined NN_HAVE_WINDOWS
+    nn_global_add_transport (nn_udp);
+#endif
+#if defined NN_USE_TCPMUX
+    nn_global_add_transport (nn_tcpmux);
+#endif
 
     /*  Plug in individual socktypes. */
+    memset (self.socktypes, 0, sizeof (self.socktypes));
+#if defined NN_USE_PAIR
     nn_global_add_socktype (nn_pair_socktype);
     nn_global_add_socktype (nn_xpair_socktype);
+#endif
+#if defined NN_USE_PUBSUB
     nn_global_add_socktype (nn_pub_socktype);
     nn_global_add_socktype (nn_sub_socktype);
+#endif
+#if defined NN_USE_REQREP
     nn_global_add_socktype (nn_rep_socktype);
     nn_global_add_socktype (nn_req_socktype);
     nn_global_add_socktype (nn_xrep_socktype);
     nn_global_add_socktype (nn_xreq_socktype);
+#endif
+#if defined NN_USE_FANIN
     nn_global_add_socktype (nn_sink_socktype);
     nn_global_add_socktype (nn_source_socktype);
     nn_global_add_socktype (nn_xsink_socktype);
     nn_global_add_socktype (nn_xsource_socktype);
+#endif
+#if defined NN_USE_FANOUT
     nn_global_add_socktype (nn_push_socktype);
     nn_global_add_socktype (nn_xpush_socktype);
     nn_global_add_socktype (nn_pull_socktype);
     nn_global_add_socktype (nn_xpull_socktype);
+#endif
+#if defined NN_USE_SURVEY
     nn_global_add_socktype (nn_respondent_socktype);
     nn_global_add_socktype (nn_surveyor_socktype);
     nn_global_add_socktype (nn_xrespondent_socktype);
     nn_global_add_socktype (nn_xsurveyor_socktype);
+#endif
+#if defined NN_USE_BUS
     nn_global_add_socktype (nn_bus_socktype);
     nn_global_add_socktype (nn_xbus_socktype);
+#endif
 
     /*  Start the worker threads. */
     nn_pool_init (&self.pool);
+
+    /*  Start the completion ports shared among the sockets, if any. */
+    nn_global_init_cps ();
 }
 
 static void nn_global_term (void)
@@ -241,36 +544,34 @@ static void nn_global_term (void)
 #if defined NN_HAVE_WINDOWS
     int rc;
 #endif
-    struct nn_list_item *it;
+    int i;
 
-    /*  If there are no sockets remaining, uninitialise the global context. */
+    /*  This is called when the last socket is closed. */
     nn_assert (self.socks);
-    if (self.nsocks > 0)
-        return;
+    nn_assert (nn_atomic_get (&self.nsocks) == 0);
+
+    /*  Shut down the shared completion ports. */
+    nn_global_term_cps ();
 
     /*  Shut down the worker threads. */
     nn_pool_term (&self.pool);
 
     /*  Ask all the transport to deallocate their global resources. */
-    while (!nn_list_empty (&self.transports)) {
-        it = nn_list_begin (&self.transports);
-        nn_cont (it, struct nn_transport, item)->term ();
-        nn_list_erase (&self.transports, it);
-    }
-
-    /*  For now there's nothing to deallocate about socket types, however,
-        let's remove them from the list anyway. */
-    while (!nn_list_empty (&self.socktypes))
-        nn_list_erase (&self.socktypes, nn_list_begin (&self.socktypes));
+    for (i = 0; i != NN_GLOBAL_TRANSPORTS; ++i)
+        if (self.transportids [i])
+            self.transportids [i]->term ();
 
     /*  Final deallocation of the nn_global object itself. */
-    nn_list_term (&self.socktypes);
-    nn_list_term (&self.transports);
+    while (self.npages)
+        nn_free (self.socks [--self.npages]);
     nn_free (self.socks);
 
     /*  This marks the global state as uninitialised. */
     self.socks = NULL;
 
+    /*  Stop the resolver threads, if they were started. */
+    nn_resolver_term ();
+
     /*  Shut down the memory allocation subsystem. */
     nn_alloc_term ();
 
@@ -284,29 +585,50 @@ static void nn_global_term (void)
 void nn_term (void)
 {
     int i;
+    uint32_t n;
 
     nn_glock_lock ();
 
     /*  Switch the global state into the zombie state. */
     self.flags |= NN_CTX_FLAG_ZOMBIE;
 
-    /*  Mark all open sockets as terminating. */
-    if (self.socks && self.nsocks) {
-        for (i = 0; i != NN_MAX_SOCKETS; ++i)
-            if (self.socks [i])
-                nn_sock_zombify (self.socks [i]);
+    /*  Wait for nn_socket and nn_close calls that started modifying
+        the socket table before they've seen the flag. */
+    if (self.syncinit)
+        while (nn_atomic_get (&self.busy))
+            nn_sleep (0);
+
+    /*  Mark all open sockets as terminating. The free slots are reused
+        before any others, so the open sockets tend to be at the beginning
+        of the table. */
+    if (self.socks) {
+        n = nn_atomic_get (&self.nopen);
+        for (i = 0; n && i != self.npages * NN_SOCKS_PAGE_SIZE; ++i)
+            if (NN_SOCK (i)) {
+                nn_sock_zombify (NN_SOCK (i));
+                --n;
+            }
     }
 
     nn_glock_unlock ();
 }
 
+/*  Public allocation constants must match the internal ones. */
+CT_ASSERT (NN_ALLOC_POOL == NN_CHUNK_POOL);
+CT_ASSERT (NN_ALLOC_SHARED == NN_CHUNK_SHARED);
+CT_ASSERT (NN_ALLOC_USER == NN_CHUNK_USER);
+CT_ASSERT (NN_ALLOC_MAX == NN_CHUNK_MAX);
+
 void *nn_allocmsg (size_t size, int type)
 {
+    int rc;
     struct nn_chunk *ch;
 
-    ch = nn_chunk_alloc (size, type);
-    if (nn_slow (!ch))
+    rc = nn_chunk_alloc (size, type, &ch);
+    if (nn_slow (rc < 0)) {
+        errno = -rc;
         return NULL;
+    }
     return (void*) (ch + 1);
 }
 
@@ -316,95 +638,285 @@ int nn_freemsg (void *msg)
     return 0;
 }
 
+int nn_setallocator (int type, const struct nn_allocator *allocator)
+{
+    int rc;
+
+    rc = nn_chunk_setallocator (type, allocator ? allocator->alloc : NULL,
+        allocator ? allocator->free : NULL);
+    if (nn_slow (rc < 0)) {
+        errno = -rc;
+        return -1;
+    }
+    return 0;
+}
+
+int nn_setmemfns (const struct nn_memfns *fns)
+{
+    int rc;
+
+    if (nn_slow (!fns)) {
+        errno = EINVAL;
+        return -1;
+    }
+    rc = nn_alloc_setfns (fns->alloc, fns->realloc, fns->free);
+    if (nn_slow (rc < 0)) {
+        errno = -rc;
+        return -1;
+    }
+    return 0;
+}
+
+int nn_allocstats (struct nn_alloc_stat *stats, int count)
+{
+    int rc;
+
+    if (nn_slow (count < 0 || (count && !stats))) {
+        errno = EINVAL;
+        return -1;
+    }
+    rc = nn_alloc_stats (stats, count);
+    if (nn_slow (rc < 0)) {
+        errno = -rc;
+        return -1;
+    }
+    return rc;
+}
+
+int nn_lockstats (struct nn_lock_stat *stats, int count)
+{
+    int rc;
+
+    if (nn_slow (count < 0 || (count && !stats))) {
+        errno = EINVAL;
+        return -1;
+    }
+    rc = nn_mutex_stats (stats, count);
+    if (nn_slow (rc < 0)) {
+        errno = -rc;
+        return -1;
+    }
+    return rc;
+}
+
+int nn_workerstats (struct nn_worker_stat *stats, int count)
+{
+#if defined NN_HAVE_WINDOWS
+    errno = ENOTSUP;
+    return -1;
+#else
+    int rc;
+    int i;
+    struct nn_worker_stats wstats [NN_POOL_MAX_WORKERS];
+
+    if (nn_slow (count < 0 || (count && !stats))) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    /*  The worker threads exist only while there are open sockets. */
+    if (nn_slow (!nn_global_hold ()))
+        return 0;
+    rc = nn_pool_stats (&self.pool, wstats,
+        count < NN_POOL_MAX_WORKERS ? count : NN_POOL_MAX_WORKERS);
+    nn_global_release ();
+
+    for (i = 0; i != rc && i != count; ++i) {
+        stats [i].wait = wstats [i].wait / 1000;
+        stats [i].timers = wstats [i].timers / 1000;
+        stats [i].fds = wstats [i].fds / 1000;
+        stats [i].tasks = wstats [i].tasks / 1000;
+    }
+    return rc;
+#endif
+}
+
+void *nn_extmsg (void *buf, size_t size, nn_freefn *ffn, void *arg)
+{
+    struct nn_chunk *ch;
+
+    if (nn_slow (!buf && size)) {
+        errno = EFAULT;
+        return NULL;
+    }
+    ch = nn_chunk_ext (buf, size, ffn, arg);
+    if (nn_slow (!ch)) {
+        errno = ENOMEM;
+        return NULL;
+    }
+    return (void*) (ch + 1);
+}
+
+void *nn_filemsg (int fd, unsigned long long offset, size_t size)
+{
+    int rc;
+    struct nn_chunk *ch;
+
+    rc = nn_chunk_file (fd, (uint64_t) offset, size, &ch);
+    if (nn_slow (rc < 0)) {
+        errno = -rc;
+        return NULL;
+    }
+    return (void*) (ch + 1);
+}
+
+int nn_addrefmsg (void *msg)
+{
+    struct nn_chunk *ch;
+
+    ch = nn_chunk_from_data (msg);
+    if (nn_slow (!ch)) {
+        errno = EFAULT;
+        return -1;
+    }
+    nn_chunk_addref (ch, 1);
+    return 0;
+}
+
 int nn_socket (int domain, int protocol)
 {
     int rc;
     int s;
-    struct nn_list_item *it;
     struct nn_socktype *socktype;
-
-    nn_glock_lock ();
-
-    /*  Make sure that global state is initialised. */
-    nn_global_init ();
+    struct nn_sock *sock;
+
+    /*  Make sure that global state is initialised. If there are other sockets
+        open, it is, and the socket count can be simply incremented. */
+    if (nn_slow (!nn_global_hold ())) {
+        nn_glock_lock ();
+        nn_global_init ();
+        nn_atomic_inc (&self.nsocks, 1);
+        nn_glock_unlock ();
+    }
 
     /*  If nn_term() was already called, return ETERM. */
     if (nn_slow (self.flags & NN_CTX_FLAG_ZOMBIE)) {
-        nn_global_term ();
-        nn_glock_unlock ();
+        nn_global_release ();
         errno = ETERM;
         return -1;
     }
 
     /*  Only AF_SP and AF_SP_RAW domains are supported. */
     if (nn_slow (domain != AF_SP && domain != AF_SP_RAW)) {
-        nn_global_term ();
-        nn_glock_unlock ();
+        nn_global_release ();
         errno = EAFNOSUPPORT;
         return -1;
     }
 
     /*  If socket limit was reached, report error. */
-    if (nn_slow (self.nsocks >= NN_MAX_SOCKETS)) {
-        nn_global_term ();
-        nn_glock_unlock ();
+    if (nn_slow (nn_atomic_get (&self.nsocks) > (uint32_t) self.maxsocks)) {
+        nn_global_release ();
         errno = EMFILE;
         return -1;
     }
 
-    /*  Find an empty socket slot. */
-    s = self.unused [NN_MAX_SOCKETS - self.nsocks - 1];
-
-    /*  Find the appropriate socket type and instantiate it. */
-    for (it = nn_list_begin (&self.socktypes);
-          it != nn_list_end (&self.socktypes);
-          it = nn_list_next (&self.socktypes, it)) {
-        socktype = nn_cont (it, struct nn_socktype, item);
-        if (socktype->domain == domain && socktype->protocol == protocol) {
-            rc = socktype->create ((struct nn_sockbase**) &self.socks [s]);
-            if (rc < 0)
-                goto error;
-            nn_sock_postinit (self.socks [s], domain, protocol);
-            ++self.nsocks;
-            nn_glock_unlock ();
-            return s;
+    /*  Find the appropriate socket type and instantiate it. The table of
+        socket types doesn't change while the library is initialised, so it
+        can be accessed without locking. */
+    socktype = protocol >= 0 && protocol < NN_GLOBAL_PROTOCOLS ?
+        self.socktypes [domain - AF_SP][protocol] : NULL;
+    if (nn_slow (!socktype)) {
+        nn_global_release ();
+        errno = EINVAL;
+        return -1;
+    }
+    rc = socktype->create ((struct nn_sockbase**) &sock);
+    if (nn_slow (rc < 0)) {
+        nn_global_release ();
+        errno = -rc;
+        return -1;
+    }
+    nn_sock_postinit (sock, domain, protocol);
+
+    /*  Find an empty socket slot. If all the allocated slots are used, grow
+        the socket table. */
+    s = nn_global_pop ();
+    if (nn_slow (s < 0)) {
+        nn_mutex_lock (&self.growsync);
+        while ((s = nn_global_pop ()) < 0) {
+            if (self.npages * NN_SOCKS_PAGE_SIZE < self.maxsocks)
+                nn_global_add_page ();
         }
+        nn_mutex_unlock (&self.growsync);
     }
-    rc = -EINVAL;
 
-    /*  Specified socket type wasn't found. */
-error:
-    nn_global_term ();
-    nn_glock_unlock ();
-    errno = -rc;
-    return -1;
+    /*  Publish the socket. If nn_term() runs in parallel, either it sees
+        the socket or we see the zombie flag. */
+    nn_atomic_inc (&self.busy, 1);
+    if (nn_slow (self.flags & NN_CTX_FLAG_ZOMBIE)) {
+        nn_atomic_dec (&self.busy, 1);
+        nn_global_push (s);
+        rc = nn_sock_destroy (sock);
+        errnum_assert (rc == 0, -rc);
+        nn_global_release ();
+        errno = ETERM;
+        return -1;
+    }
+    NN_SOCK (s) = sock;
+    nn_atomic_inc (&self.nopen, 1);
+    nn_atomic_dec (&self.busy, 1);
+
+    return s;
 }
 
 int nn_close (int s)
 {
     int rc;
+    struct nn_sock *sock;
 
     NN_BASIC_CHECKS;
 
+    /*  Remove the socket from the socket table first so that nn_term()
+        running in parallel won't touch it while it's being deallocated.
+        Once nn_term() was called it may be walking the table, so wait
+        for it to finish. */
+    nn_atomic_inc (&self.busy, 1);
+    if (nn_fast (!(self.flags & NN_CTX_FLAG_ZOMBIE))) {
+        sock = NN_SOCK (s);
+        NN_SOCK (s) = NULL;
+        if (nn_fast (sock != NULL))
+            nn_atomic_dec (&self.nopen, 1);
+        nn_atomic_dec (&self.busy, 1);
+    }
+    else {
+        nn_atomic_dec (&self.busy, 1);
+        nn_glock_lock ();
+        sock = NN_SOCK (s);
+        NN_SOCK (s) = NULL;
+        if (sock)
+            nn_atomic_dec (&self.nopen, 1);
+        nn_glock_unlock ();
+    }
+    if (nn_slow (!sock)) {
+        errno = EBADF;
+        return -1;
+    }
+
+#if !defined NN_HAVE_WINDOWS
+    /*  If asked to, leave the termination of the endpoints to the library
+        and return straight away. */
+    if (nn_global_bgclose (s, sock))
+        return 0;
+#endif
+
     /*  Deallocate the socket object. */
-    rc = nn_sock_destroy (self.socks [s]);
+    rc = nn_sock_destroy (sock);
     if (nn_slow (rc == -EINTR)) {
+        nn_glock_lock ();
+        NN_SOCK (s) = sock;
+        nn_atomic_inc (&self.nopen, 1);
+        if (self.flags & NN_CTX_FLAG_ZOMBIE)
+            nn_sock_zombify (sock);
+        nn_glock_unlock ();
         errno = EINTR;
         return -1;
     }
 
-    nn_glock_lock ();
-
-    /*  Remove the socket from the socket table, add it to unused socket
-        table. */
-    self.socks [s] = NULL;
-    self.unused [NN_MAX_SOCKETS - self.nsocks] = s;
-    --self.nsocks;
+    /*  Add the socket to unused socket table. */
+    nn_global_push (s);
 
     /*  Destroy the global context if there's no socket remaining. */
-    nn_global_term ();
-
-    nn_glock_unlock ();
+    nn_global_release ();
 
     return 0;
 }
@@ -421,7 +933,7 @@ int nn_setsockopt (int s, int level, int option, const void *optval,
         return -1;
     }
 
-    rc = nn_sock_setopt (self.socks [s], level, option, optval, optvallen);
+    rc = nn_sock_setopt (NN_SOCK (s), level, option, optval, optvallen);
     if (nn_slow (rc < 0)) {
         errno = -rc;
         return -1;
@@ -443,7 +955,7 @@ int nn_getsockopt (int s, int level, int option, void *optval,
         return -1;
     }
 
-    rc = nn_sock_getopt (self.socks [s], level, option, optval, optvallen, 0);
+    rc = nn_sock_getopt (NN_SOCK (s), level, option, optval, optvallen, 0);
     if (nn_slow (rc < 0)) {
         errno = -rc;
         return -1;
@@ -489,7 +1001,7 @@ int nn_shutdown (int s, int how)
 
     NN_BASIC_CHECKS;
 
-    rc = nn_sock_rm_ep (self.socks [s], how);
+    rc = nn_sock_rm_ep (NN_SOCK (s), how);
     if (nn_slow (rc < 0)) {
         errno = -rc;
         return -1;
@@ -499,212 +1011,1120 @@ int nn_shutdown (int s, int how)
     return 0;
 }
 
-int nn_send (int s, const void *buf, size_t len, int flags)
+int nn_handoff (int s, int fd)
 {
     int rc;
-    struct nn_msg msg;
-    struct nn_chunk *ch;
 
     NN_BASIC_CHECKS;
 
-    if (nn_slow (!buf && len)) {
-        errno = EFAULT;
-        return -1;
-    }
-
-    /*  Create a message object. */
-    if (len == NN_MSG) {
-        ch = nn_chunk_from_data (*(void**) buf);
-        if (nn_slow (ch == NULL)) {
-            errno = EFAULT;
-            return -1;
-        }
-        len = nn_chunk_size (ch);
-        nn_msg_init_chunk (&msg, ch);
-    }
-    else {
-        nn_msg_init (&msg, len);
-        memcpy (nn_chunkref_data (&msg.body), buf, len);
-    }
-
-    /*  Send it further down the stack. */
-    rc = nn_sock_send (self.socks [s], &msg, flags);
+    rc = nn_sock_handoff (NN_SOCK (s), fd);
     if (nn_slow (rc < 0)) {
-        nn_msg_term (&msg);
         errno = -rc;
         return -1;
     }
 
-    return (int) len;
+    return rc;
 }
 
-int nn_recv (int s, void *buf, size_t len, int flags)
+int nn_adopt (int s, int fd)
 {
     int rc;
-    struct nn_msg msg;
-    size_t sz;
-    struct nn_chunk *ch;
 
     NN_BASIC_CHECKS;
 
-    if (nn_slow (!buf && len)) {
-        errno = EFAULT;
-        return -1;
-    }
-
-    rc = nn_sock_recv (self.socks [s], &msg, flags);
+    rc = nn_sock_adopt (NN_SOCK (s), fd);
     if (nn_slow (rc < 0)) {
         errno = -rc;
         return -1;
     }
 
-    if (len == NN_MSG) {
-        ch = nn_chunkref_getchunk (&msg.body);
-        *(void**) buf = nn_chunk_data (ch);
-        sz = nn_chunk_size (ch);
-    }
-    else {
-        sz = nn_chunkref_size (&msg.body);
-        memcpy (buf, nn_chunkref_data (&msg.body), len < sz ? len : sz);
-    }
-    nn_msg_term (&msg);
-
-    return (int) sz;
+    return rc;
 }
 
-int nn_sendmsg (int s, const struct nn_msghdr *msghdr, int flags)
+int nn_send (int s, const void *buf, size_t len, int flags)
 {
-    int rc;
-    size_t sz;
-    int i;
-    struct nn_iovec *iov;
-    struct nn_msg msg;
-    struct nn_chunk *ch;
-
     NN_BASIC_CHECKS;
 
-    if (nn_slow (!msghdr)) {
-        errno = EINVAL;
+    return nn_global_send (NN_SOCK (s), -1, buf, len, flags);
+}
+
+int nn_recv (int s, void *buf, size_t len, int flags)
+{
+    NN_BASIC_CHECKS;
+
+    return nn_global_recv (NN_SOCK (s), -1, buf, len, flags);
+}
+
+int nn_send_async (int s, const void *buf, size_t len, int flags,
+    void (*fn) (int s, int rc, void *arg), void *arg)
+{
+    NN_BASIC_CHECKS;
+
+    if (nn_slow (flags || !fn)) {
+        errno = EINVAL;
+        return -1;
+    }
+
+#if defined NN_HAVE_WINDOWS
+    errno = ENOTSUP;
+    return -1;
+#else
+    return nn_global_async (s, 0, (void*) buf, len, fn, arg);
+#endif
+}
+
+int nn_recv_async (int s, void *buf, size_t len, int flags,
+    void (*fn) (int s, int rc, void *arg), void *arg)
+{
+    NN_BASIC_CHECKS;
+
+    if (nn_slow (flags || !fn)) {
+        errno = EINVAL;
+        return -1;
+    }
+
+#if defined NN_HAVE_WINDOWS
+    errno = ENOTSUP;
+    return -1;
+#else
+    return nn_global_async (s, 1, buf, len, fn, arg);
+#endif
+}
+
+int nn_ctx_open (int s)
+{
+    int rc;
+
+    NN_BASIC_CHECKS;
+
+    rc = nn_sock_ctx_open (NN_SOCK (s));
+    if (nn_slow (rc < 0)) {
+        errno = -rc;
+        return -1;
+    }
+
+    return rc;
+}
+
+int nn_ctx_close (int s, int ctx)
+{
+    int rc;
+
+    NN_BASIC_CHECKS;
+
+    rc = nn_sock_ctx_close (NN_SOCK (s), ctx);
+    if (nn_slow (rc < 0)) {
+        errno = -rc;
+        return -1;
+    }
+
+    return 0;
+}
+
+int nn_ctx_send (int s, int ctx, const void *buf, size_t len, int flags)
+{
+    NN_BASIC_CHECKS;
+
+    if (nn_slow (ctx < 0)) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    return nn_global_send (NN_SOCK (s), ctx, buf, len, flags);
+}
+
+int nn_ctx_recv (int s, int ctx, void *buf, size_t len, int flags)
+{
+    NN_BASIC_CHECKS;
+
+    if (nn_slow (ctx < 0)) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    return nn_global_recv (NN_SOCK (s), ctx, buf, len, flags);
+}
+
+static int nn_global_send (struct nn_sock *sock, int ctx, const void *buf,
+    size_t len, int flags)
+{
+    int rc;
+    struct nn_msg msg;
+
+    /*  Create a message object. */
+    rc = nn_global_buftomsg (buf, &len, &msg);
+    if (nn_slow (rc < 0)) {
+        errno = -rc;
+        return -1;
+    }
+
+    /*  Send it further down the stack. */
+    rc = ctx < 0 ? nn_sock_send (sock, &msg, flags) :
+        nn_sock_ctx_send (sock, ctx, &msg, flags);
+    if (nn_slow (rc < 0)) {
+        nn_msg_term (&msg);
+        errno = -rc;
+        return -1;
+    }
+
+    return (int) len;
+}
+
+static int nn_global_recv (struct nn_sock *sock, int ctx, void *buf,
+    size_t len, int flags)
+{
+    int rc;
+    struct nn_msg msg;
+
+    if (nn_slow (!buf && len)) {
+        errno = EFAULT;
+        return -1;
+    }
+
+    rc = ctx < 0 ? nn_sock_recv (sock, &msg, flags) :
+        nn_sock_ctx_recv (sock, ctx, &msg, flags);
+    if (nn_slow (rc < 0)) {
+        errno = -rc;
+        return -1;
+    }
+
+    return (int) nn_global_msgtobuf (&msg, buf, len);
+}
+
+static int nn_global_buftomsg (const void *buf, size_t *len,
+    struct nn_msg *msg)
+{
+    struct nn_chunk *ch;
+
+    if (nn_slow (!buf && *len))
+        return -EFAULT;
+
+    if (*len == NN_MSG) {
+        ch = nn_chunk_from_data (*(void**) buf);
+        if (nn_slow (ch == NULL))
+            return -EFAULT;
+        *len = nn_chunk_size (ch);
+        nn_msg_init_chunk (msg, ch);
+    }
+    else {
+        nn_msg_init (msg, *len);
+        memcpy (nn_chunkref_data (&msg->body), buf, *len);
+    }
+
+    return 0;
+}
+
+static size_t nn_global_msgtobuf (struct nn_msg *msg, void *buf, size_t len)
+{
+    size_t sz;
+    struct nn_chunk *ch;
+
+    /*  The message is deallocated, unless its chunk is handed to the user. */
+    nn_msg_flatten (msg);
+    if (len == NN_MSG) {
+        ch = nn_chunkref_getchunk (&msg->body);
+        *(void**) buf = nn_chunk_data (ch);
+        sz = nn_chunk_size (ch);
+    }
+    else {
+        sz = nn_chunkref_size (&msg->body);
+        memcpy (buf, nn_chunkref_data (&msg->body), len < sz ? len : sz);
+    }
+    nn_msg_term (msg);
+
+    return sz;
+}
+
+#if !defined NN_HAVE_WINDOWS
+
+static int nn_global_async (int s, int recv, void *buf, size_t len,
+    void (*fn) (int s, int rc, void *arg), void *arg)
+{
+    int rc;
+    struct nn_global_async *async;
+
+    if (nn_slow (!buf && len)) {
+        errno = EFAULT;
+        return -1;
+    }
+
+    async = nn_alloc (sizeof (struct nn_global_async), "async operation");
+    alloc_assert (async);
+    if (!recv) {
+        rc = nn_global_buftomsg (buf, &len, &async->op.msg);
+        if (nn_slow (rc < 0)) {
+            nn_free (async);
+            errno = -rc;
+            return -1;
+        }
+    }
+    async->op.done = nn_global_async_done;
+    async->worker = nn_global_choose_worker (nn_thread_node ());
+    nn_worker_callback_init (&async->callback, &nn_global_async_vfptr);
+    nn_worker_task_init (&async->task, &async->callback);
+    async->s = s;
+    async->recv = recv;
+    async->buf = buf;
+    async->len = len;
+    async->fn = fn;
+    async->arg = arg;
+
+    /*  From now on, the callback is guaranteed to be invoked. */
+    rc = recv ? nn_sock_recv_async (NN_SOCK (s), &async->op) :
+        nn_sock_send_async (NN_SOCK (s), &async->op);
+    if (nn_slow (rc < 0)) {
+        if (!recv)
+            nn_msg_term (&async->op.msg);
+        nn_worker_task_term (&async->task);
+        nn_worker_callback_term (&async->callback);
+        nn_free (async);
+        errno = -rc;
+        return -1;
+    }
+
+    return 0;
+}
+
+static int nn_global_bgclose (int s, struct nn_sock *sock)
+{
+    int rc;
+    int val;
+    size_t sz;
+    struct nn_global_bgclose *bg;
+
+    val = 0;
+    sz = sizeof (val);
+    nn_sock_getopt (sock, NN_SOL_SOCKET, NN_BGCLOSE, &val, &sz, 1);
+    if (!val)
+        return 0;
+
+    bg = nn_alloc (sizeof (struct nn_global_bgclose), "background close");
+    alloc_assert (bg);
+    bg->sock = sock;
+    bg->worker = nn_global_choose_worker (-1);
+    nn_worker_callback_init (&bg->callback, &nn_global_bgclose_vfptr);
+    nn_worker_task_init (&bg->task, &bg->callback);
+    rc = nn_sock_close_async (sock, nn_global_bgclose_done, bg);
+    if (rc == 0) {
+        nn_worker_task_term (&bg->task);
+        nn_worker_callback_term (&bg->callback);
+        nn_free (bg);
+        return 0;
+    }
+    errnum_assert (rc == -EINPROGRESS, -rc);
+
+    /*  The socket keeps the library initialised till it's deallocated, but
+        its descriptor can be reused straight away. */
+    nn_global_push (s);
+    return 1;
+}
+
+static void nn_global_bgclose_done (void *arg)
+{
+    struct nn_global_bgclose *self;
+
+    /*  The socket is locked at this point. Leave the rest to the worker. */
+    self = (struct nn_global_bgclose*) arg;
+    nn_worker_execute (self->worker, &self->task);
+}
+
+static void nn_global_bgclose_callback (struct nn_worker_callback *self,
+    void *source, int type, struct nn_worker_poller *poller)
+{
+    int rc;
+    struct nn_global_bgclose *bg;
+
+    bg = nn_cont (self, struct nn_global_bgclose, callback);
+    nn_assert (type == NN_WORKER_TASK_EXECUTE);
+
+    /*  All the endpoints are terminated, so this doesn't block. */
+    rc = nn_sock_destroy (bg->sock);
+    errnum_assert (rc == 0, -rc);
+    nn_worker_task_term (&bg->task);
+    nn_worker_callback_term (&bg->callback);
+    nn_free (bg);
+
+    /*  The worker thread can't terminate the pool it belongs to. */
+    nn_global_release_bg ();
+}
+
+static void nn_global_async_done (struct nn_sockop *op)
+{
+    struct nn_global_async *self;
+
+    /*  The socket is locked at this point. Leave the rest to the worker. */
+    self = nn_cont (op, struct nn_global_async, op);
+    nn_worker_execute (self->worker, &self->task);
+}
+
+static void nn_global_async_callback (struct nn_worker_callback *self,
+    void *source, int type, struct nn_worker_poller *poller)
+{
+    int rc;
+    int s;
+    void (*fn) (int s, int rc, void *arg);
+    void *arg;
+    struct nn_global_async *async;
+
+    async = nn_cont (self, struct nn_global_async, callback);
+    nn_assert (type == NN_WORKER_TASK_EXECUTE);
+
+    rc = async->op.rc;
+    if (async->recv) {
+        if (nn_fast (rc == 0))
+            rc = (int) nn_global_msgtobuf (&async->op.msg, async->buf,
+                async->len);
+    }
+    else {
+        if (nn_fast (rc == 0))
+            rc = (int) async->len;
+        else
+            nn_msg_term (&async->op.msg);
+    }
+
+    /*  Deallocate the operation before invoking the callback so that
+        the user can submit a new operation from within the callback. */
+    s = async->s;
+    fn = async->fn;
+    arg = async->arg;
+    nn_worker_task_term (&async->task);
+    nn_worker_callback_term (&async->callback);
+    nn_free (async);
+
+    fn (s, rc, arg);
+}
+
+#endif
+
+int nn_sendmsg (int s, const struct nn_msghdr *msghdr, int flags)
+{
+    int rc;
+    size_t sz;
+    struct nn_msg msg;
+
+    NN_BASIC_CHECKS;
+
+    if (nn_slow (!msghdr)) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    /*  Create a message object. */
+    rc = nn_global_hdrtomsg (msghdr, &msg, &sz, nn_global_cmsgs (s));
+    if (nn_slow (rc < 0)) {
+        errno = -rc;
+        return -1;
+    }
+    if (nn_slow (rc == 1))
+        nn_global_freeiov (msghdr);
+
+    /*  Send it further down the stack. */
+    rc = nn_sock_send (NN_SOCK (s), &msg, flags);
+    if (nn_slow (rc < 0)) {
+        nn_msg_term (&msg);
+        errno = -rc;
+        return -1;
+    }
+
+    return (int) sz;
+}
+
+int nn_recvmsg (int s, struct nn_msghdr *msghdr, int flags)
+{
+    int rc;
+    struct nn_msg msg;
+    size_t sz;
+
+    NN_BASIC_CHECKS;
+
+    if (nn_slow (!msghdr)) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    rc = nn_global_checkhdr (msghdr);
+    if (nn_slow (rc < 0)) {
+        errno = -rc;
+        return -1;
+    }
+
+    /*  Get a message. */
+    rc = nn_sock_recv (NN_SOCK (s), &msg, flags);
+    if (nn_slow (rc < 0)) {
+        errno = -rc;
+        return -1;
+    }
+
+    sz = nn_global_msgtohdr (&msg, msghdr, nn_global_cmsgs (s));
+    nn_msg_term (&msg);
+
+    return (int) sz;
+}
+
+int nn_sendmmsg (int s, struct nn_mmsghdr *msgvec, unsigned int vlen,
+    int flags)
+{
+    int rc;
+    int i;
+    int count;
+    int cmsgs;
+    struct nn_msg msgs [NN_MAX_MMSG];
+    char copied [NN_MAX_MMSG];
+
+    NN_BASIC_CHECKS;
+
+    if (nn_slow (!msgvec && vlen)) {
+        errno = EFAULT;
+        return -1;
+    }
+    if (nn_slow (vlen == 0))
+        return 0;
+    count = vlen > NN_MAX_MMSG ? NN_MAX_MMSG : (int) vlen;
+    cmsgs = nn_global_cmsgs (s);
+
+    /*  Create the message objects. If one of the headers is malformed, send
+        the messages preceding it and leave the error to the next call. */
+    for (i = 0; i != count; ++i) {
+        rc = nn_global_hdrtomsg (&msgvec [i].msg_hdr, &msgs [i],
+            &msgvec [i].msg_len, cmsgs);
+        if (nn_slow (rc < 0)) {
+            if (i == 0) {
+                errno = -rc;
+                return -1;
+            }
+            count = i;
+            break;
+        }
+        copied [i] = (char) rc;
+    }
+
+    /*  Send the whole batch down the stack at once. */
+    rc = nn_sock_sendv (NN_SOCK (s), msgs, count, flags);
+
+    /*  Buffers allocated by nn_allocmsg that were copied into the messages
+        are freed only if the message was actually sent. Messages that were
+        not sent leave such buffers to the caller. */
+    for (i = 0; i != count; ++i) {
+        if (i < rc) {
+            if (nn_slow (copied [i]))
+                nn_global_freeiov (&msgvec [i].msg_hdr);
+        }
+        else
+            nn_msg_release (&msgs [i]);
+    }
+
+    if (nn_slow (rc < 0)) {
+        errno = -rc;
+        return -1;
+    }
+    return rc;
+}
+
+int nn_recvmmsg (int s, struct nn_mmsghdr *msgvec, unsigned int vlen,
+    int flags)
+{
+    int rc;
+    int i;
+    int count;
+    int cmsgs;
+    struct nn_msg msgs [NN_MAX_MMSG];
+
+    NN_BASIC_CHECKS;
+
+    if (nn_slow (!msgvec && vlen)) {
+        errno = EFAULT;
+        return -1;
+    }
+    if (nn_slow (vlen == 0))
+        return 0;
+    count = vlen > NN_MAX_MMSG ? NN_MAX_MMSG : (int) vlen;
+
+    /*  Check the headers before any message is taken from the socket so that
+        the messages are not lost when a header turns out to be malformed. */
+    for (i = 0; i != count; ++i) {
+        rc = nn_global_checkhdr (&msgvec [i].msg_hdr);
+        if (nn_slow (rc < 0)) {
+            if (i == 0) {
+                errno = -rc;
+                return -1;
+            }
+            count = i;
+            break;
+        }
+    }
+
+    /*  Get the whole batch of messages at once. */
+    rc = nn_sock_recvv (NN_SOCK (s), msgs, count, flags);
+    if (nn_slow (rc < 0)) {
+        errno = -rc;
+        return -1;
+    }
+    cmsgs = nn_global_cmsgs (s);
+
+    for (i = 0; i != rc; ++i) {
+        msgvec [i].msg_len = nn_global_msgtohdr (&msgs [i],
+            &msgvec [i].msg_hdr, cmsgs);
+        nn_msg_term (&msgs [i]);
+    }
+
+    return rc;
+}
+
+int nn_poll (struct nn_pollfd *fds, int nfds, int timeout)
+{
+    int rc;
+    int i;
+    int s;
+    int res;
+    int ready;
+    int nsys;
+    uint64_t deadline;
+    uint64_t now;
+    struct nn_clock clock;
+    struct nn_pollwaiter waiter;
+    struct nn_pollitem itemsbuf [NN_POLL_ITEMS];
+    struct nn_pollitem *items;
+
+    if (nn_slow (nfds < 0)) {
+        errno = EINVAL;
+        return -1;
+    }
+    if (nn_slow (!fds && nfds)) {
+        errno = EFAULT;
+        return -1;
+    }
+
+    /*  Check the sockets first. If any of them is ready there's no need to
+        wait and no syscall is done at all. OS-level file descriptors are
+        checked in a single non-blocking syscall. */
+    res = 0;
+    nsys = 0;
+    for (i = 0; i != nfds; ++i) {
+        if (fds [i].events & NN_POLLSYSFD) {
+            ++nsys;
+            continue;
+        }
+        s = fds [i].fd;
+        NN_BASIC_CHECKS;
+        fds [i].revents = (short) nn_sock_poll (NN_SOCK (s), fds [i].events,
+            NULL, NULL);
+        if (fds [i].revents)
+            ++res;
+    }
+    if (nsys) {
+        rc = nn_global_pollsys (fds, nfds, nsys, NULL, 0);
+        if (nn_slow (rc < 0)) {
+            errno = -rc;
+            return -1;
+        }
+        res += rc;
+    }
+    if (res || timeout == 0)
+        return res;
+
+    /*  Nothing is ready. Register with all the sockets and wait for any of
+        them to signal the waiter. */
+    rc = nn_efd_init (&waiter.efd);
+    if (nn_slow (rc < 0)) {
+        errno = -rc;
+        return -1;
+    }
+    if (nfds <= NN_POLL_ITEMS)
+        items = itemsbuf;
+    else {
+        items = nn_alloc (sizeof (struct nn_pollitem) * nfds, "poll items");
+        alloc_assert (items);
+    }
+    nn_clock_init (&clock);
+    if (timeout > 0)
+        deadline = nn_clock_now (&clock) + timeout;
+
+    while (1) {
+
+        /*  If any event arrives while registering, don't wait at all. */
+        waiter.signalled = 0;
+        ready = 0;
+        for (i = 0; i != nfds; ++i)
+            if (!(fds [i].events & NN_POLLSYSFD) &&
+                  nn_sock_poll (NN_SOCK (fds [i].fd), fds [i].events,
+                  &waiter, &items [i]))
+                ready = 1;
+
+        /*  OS-level file descriptors are waited for along with the waiter
+            in a single syscall. */
+        res = 0;
+        if (ready)
+            rc = 0;
+        else if (nsys) {
+            rc = nn_global_pollsys (fds, nfds, nsys, &waiter.efd, timeout);
+            if (rc > 0) {
+                res = rc;
+                rc = 0;
+            }
+        }
+        else if (nfds)
+            rc = nn_sock_wait (NN_SOCK (fds [0].fd), &waiter.efd, timeout);
+        else
+            rc = nn_efd_wait (&waiter.efd, timeout);
+
+        for (i = 0; i != nfds; ++i) {
+            if (fds [i].events & NN_POLLSYSFD)
+                continue;
+            fds [i].revents = (short) nn_sock_unpoll (NN_SOCK (fds [i].fd),
+                &items [i]);
+            if (fds [i].revents)
+                ++res;
+        }
+        if (res || rc == -ETIMEDOUT || rc == -EINTR)
+            break;
+        errnum_assert (rc == 0, -rc);
+
+        /*  The event went away before we've got to it. Wait anew. With
+            a completion port driven by the user, the wait may have ended
+            without the waiter being signalled. */
+        if (waiter.signalled)
+            nn_efd_unsignal (&waiter.efd);
+        if (timeout > 0) {
+            now = nn_clock_now (&clock);
+            timeout = (int) (now > deadline ? 0 : deadline - now);
+        }
+    }
+
+    nn_clock_term (&clock);
+    if (items != itemsbuf)
+        nn_free (items);
+    nn_efd_term (&waiter.efd);
+
+    if (nn_slow (!res && rc == -EINTR)) {
+        errno = EINTR;
+        return -1;
+    }
+    return res;
+}
+
+/*  Polls the OS-level file descriptors among 'fds', 'nsys' in number, and
+    fills in their 'revents'. If 'efd' is not NULL, waits for it to be
+    signalled as well and, with a completion port driven by the user, does
+    the pending I/O processing. Returns the number of file descriptors with
+    events to report, -ETIMEDOUT if the timeout expired while waiting for
+    'efd' or -EINTR. */
+static int nn_global_pollsys (struct nn_pollfd *fds, int nfds, int nsys,
+    struct nn_efd *efd, int timeout)
+{
+#if defined NN_HAVE_WINDOWS
+    return -ENOTSUP;
+#else
+    int rc;
+    int i;
+    int j;
+    int first;
+    int n;
+    int res;
+    struct pollfd pfdsbuf [NN_POLL_ITEMS + 2];
+    struct pollfd *pfds;
+
+    if (nsys <= NN_POLL_ITEMS)
+        pfds = pfdsbuf;
+    else {
+        pfds = nn_alloc (sizeof (struct pollfd) * (nsys + 2), "poll fds");
+        alloc_assert (pfds);
+    }
+
+    /*  The waiter's efd and the completion port go first. */
+    first = 0;
+    if (efd) {
+        pfds [first].fd = nn_efd_getfd (efd);
+        pfds [first].events = POLLIN;
+        ++first;
+        if (self.external) {
+            pfds [first].fd = nn_cp_getfd (&self.cps [0]);
+            pfds [first].events = POLLIN;
+            ++first;
+        }
+    }
+    j = first;
+    for (i = 0; i != nfds; ++i) {
+        if (!(fds [i].events & NN_POLLSYSFD))
+            continue;
+        pfds [j].fd = fds [i].fd;
+        pfds [j].events = 0;
+        if (fds [i].events & NN_POLLIN)
+            pfds [j].events |= POLLIN;
+        if (fds [i].events & NN_POLLOUT)
+            pfds [j].events |= POLLOUT;
+        ++j;
+    }
+
+    n = poll (pfds, j, timeout);
+    if (nn_slow (n < 0 && errno == EINTR)) {
+        res = -EINTR;
+        goto done;
+    }
+    errno_assert (n >= 0);
+
+    res = 0;
+    j = first;
+    for (i = 0; i != nfds; ++i) {
+        if (!(fds [i].events & NN_POLLSYSFD))
+            continue;
+        fds [i].revents = 0;
+        if (pfds [j].revents & POLLIN)
+            fds [i].revents |= NN_POLLIN;
+        if (pfds [j].revents & POLLOUT)
+            fds [i].revents |= NN_POLLOUT;
+        if (pfds [j].revents & ~(POLLIN | POLLOUT))
+            fds [i].revents |= NN_POLLERR;
+        if (fds [i].revents)
+            ++res;
+        ++j;
+    }
+
+    /*  Nobody else processes the I/O events with a completion port driven
+        by the user. */
+    if (efd && self.external && (pfds [1].revents & POLLIN)) {
+        rc = nn_cp_process (&self.cps [0], 0);
+        if (nn_slow (rc == -EINTR)) {
+            res = -EINTR;
+            goto done;
+        }
+    }
+
+    if (efd && n == 0)
+        res = -ETIMEDOUT;
+
+done:
+    if (pfds != pfdsbuf)
+        nn_free (pfds);
+    return res;
+#endif
+}
+
+int nn_processfd (void)
+{
+    int fd;
+
+    if (nn_slow (!nn_global_hold ())) {
+        errno = ENOTSUP;
+        return -1;
+    }
+    if (nn_slow (!self.external)) {
+        nn_global_release ();
+        errno = ENOTSUP;
+        return -1;
+    }
+    fd = nn_cp_getfd (&self.cps [0]);
+    nn_global_release ();
+    if (nn_slow (fd < 0)) {
+        errno = ENOTSUP;
+        return -1;
+    }
+    return fd;
+}
+
+int nn_process (int timeout)
+{
+    int rc;
+
+    if (nn_slow (!nn_global_hold ())) {
+        errno = ENOTSUP;
+        return -1;
+    }
+    if (nn_slow (!self.external)) {
+        nn_global_release ();
+        errno = ENOTSUP;
+        return -1;
+    }
+    rc = nn_cp_process (&self.cps [0], timeout);
+    nn_global_release ();
+    if (nn_slow (rc == -EINTR)) {
+        errno = EINTR;
+        return -1;
+    }
+
+    /*  -1 is reserved for errors. No pending timers are reported as
+        the longest timeout possible. */
+    return rc < 0 ? INT_MAX : rc;
+}
+
+int nn_global_sockdirs (int s)
+{
+    NN_BASIC_CHECKS;
+
+    return nn_sock_dirs (NN_SOCK (s));
+}
+
+struct nn_sock *nn_global_serve (int s, int handlers)
+{
+    int rc;
+
+    if (nn_slow (!self.socks || s < 0 || s >= self.npages *
+          NN_SOCKS_PAGE_SIZE || !NN_SOCK (s))) {
+        errno = EBADF;
+        return NULL;
+    }
+
+    rc = nn_sock_serving (NN_SOCK (s), handlers, 0);
+    if (nn_slow (rc < 0)) {
+        errno = -rc;
+        return NULL;
+    }
+    return NN_SOCK (s);
+}
+
+int nn_global_ctxsend (struct nn_sock *sock, int ctx, const void *buf,
+    size_t len, int flags)
+{
+    return nn_global_send (sock, ctx, buf, len, flags);
+}
+
+int nn_global_ctxrecv (struct nn_sock *sock, int ctx, void *buf, size_t len,
+    int flags)
+{
+    return nn_global_recv (sock, ctx, buf, len, flags);
+}
+
+int nn_global_sendv (int s, struct nn_msg *msgs, int count, int flags)
+{
+    int rc;
+
+    NN_BASIC_CHECKS;
+
+    rc = nn_sock_sendv (NN_SOCK (s), msgs, count, flags);
+    if (nn_slow (rc < 0)) {
+        errno = -rc;
         return -1;
     }
+    return rc;
+}
+
+int nn_global_recvv (int s, struct nn_msg *msgs, int count, int flags)
+{
+    int rc;
+
+    NN_BASIC_CHECKS;
 
-    if (nn_slow (msghdr->msg_iovlen < 0)) {
-        errno = EMSGSIZE;
+    rc = nn_sock_recvv (NN_SOCK (s), msgs, count, flags);
+    if (nn_slow (rc < 0)) {
+        errno = -rc;
         return -1;
     }
+    return rc;
+}
+
+/*  Creates a message from the scatter array. Returns 1 if the buffers passed
+    as NN_MSG were copied into the message rather than referenced and thus
+    have to be freed by the caller, 0 otherwise. If 'cmsgs' is set, the control
+    buffer consists of nn_cmsghdr entries rather than the bare header. */
+static int nn_global_hdrtomsg (const struct nn_msghdr *msghdr,
+    struct nn_msg *msg, size_t *sz, int cmsgs)
+{
+    int rc;
+    const void *hdr;
+    size_t hdrlen;
+    const void *trace;
+    size_t tracelen;
+    size_t len;
+    size_t pos;
+    int i;
+    int j;
+    int nparts;
+    int copy;
+    struct nn_iovec *iov;
+    struct nn_chunk *ch;
+    struct nn_chunkref part;
+
+    if (nn_slow (msghdr->msg_iovlen < 0))
+        return -EMSGSIZE;
+
+    /*  Locate the protocol header and the trace context in the control
+        buffer. */
+    hdr = msghdr->msg_control;
+    hdrlen = msghdr->msg_controllen;
+    trace = NULL;
+    if (hdr && cmsgs && hdrlen != NN_MSG) {
+        rc = nn_global_getcmsg (msghdr, PROTO_SP, SP_HDR, &hdr, &hdrlen);
+        if (nn_slow (rc < 0))
+            return rc;
+        rc = nn_global_getcmsg (msghdr, PROTO_SP, SP_TRACE, &trace,
+            &tracelen);
+        errnum_assert (rc == 0, -rc);
+        if (nn_slow (trace && tracelen != NN_TRACE_SIZE))
+            return -EINVAL;
+    }
 
     if (msghdr->msg_iovlen == 1 && msghdr->msg_iov [0].iov_len == NN_MSG) {
         ch = nn_chunk_from_data (*(void**) msghdr->msg_iov [0].iov_base);
-        if (nn_slow (ch == NULL)) {
-            errno = EFAULT;
-            return -1;
-        }
-        sz = nn_chunk_size (ch);
-        nn_msg_init_chunk (&msg, ch);
+        if (nn_slow (ch == NULL))
+            return -EFAULT;
+        *sz = nn_chunk_size (ch);
+        nn_msg_init_chunk (msg, ch);
     }
     else {
 
-        /*  Compute the total size of the message. */
-        sz = 0;
+        /*  Compute the total size of the message and the number of parts it
+            consists of. A part is either a sequence of ordinary buffers, which
+            are copied into a single chunk, or a chunk passed as NN_MSG. */
+        *sz = 0;
+        nparts = 0;
+        copy = 0;
         for (i = 0; i != msghdr->msg_iovlen; ++i) {
             iov = &msghdr->msg_iov [i];
-            if (nn_slow (iov->iov_len == NN_MSG)) {
-               errno = EINVAL;
-               return -1;
-            }
-            if (nn_slow (!iov->iov_base && iov->iov_len)) {
-                errno = EFAULT;
-                return -1;
+            if (iov->iov_len == NN_MSG) {
+                ch = nn_chunk_from_data (*(void**) iov->iov_base);
+                if (nn_slow (ch == NULL))
+                    return -EFAULT;
+                len = nn_chunk_size (ch);
+                ++nparts;
+                copy = 0;
             }
-            if (nn_slow (sz + iov->iov_len < sz)) {
-                errno = EINVAL;
-                return -1;
+            else {
+                if (nn_slow (!iov->iov_base && iov->iov_len))
+                    return -EFAULT;
+                len = iov->iov_len;
+                if (!copy)
+                    ++nparts;
+                copy = 1;
             }
-            sz += iov->iov_len;
+            if (nn_slow (*sz + len < *sz))
+                return -EINVAL;
+            *sz += len;
         }
 
-        /*  Create a message object from the supplied scatter array. */
-        nn_msg_init (&msg, sz);
-        sz = 0;
-        for (i = 0; i != msghdr->msg_iovlen; ++i) {
+        /*  Create a message object from the supplied scatter array. If there
+            are too many parts, copy everything into a single chunk. */
+        nn_msg_init (msg, nparts > NN_MSG_MAXFRAGS + 1 ? *sz : 0);
+        nparts = nparts > NN_MSG_MAXFRAGS + 1 ? -1 : 0;
+        pos = 0;
+        for (i = 0; i != msghdr->msg_iovlen; ) {
             iov = &msghdr->msg_iov [i];
-            memcpy (((uint8_t*) nn_chunkref_data (&msg.body)) + sz,
-                iov->iov_base, iov->iov_len);
-            sz += iov->iov_len;
+
+            /*  Everything is being copied into the body. */
+            if (nparts < 0) {
+                if (iov->iov_len == NN_MSG) {
+                    ch = nn_chunk_from_data (*(void**) iov->iov_base);
+                    memcpy (((uint8_t*) nn_chunkref_data (&msg->body)) + pos,
+                        nn_chunk_data (ch), nn_chunk_size (ch));
+                    pos += nn_chunk_size (ch);
+                }
+                else {
+                    memcpy (((uint8_t*) nn_chunkref_data (&msg->body)) + pos,
+                        iov->iov_base, iov->iov_len);
+                    pos += iov->iov_len;
+                }
+                ++i;
+                continue;
+            }
+
+            /*  Chunks are passed by reference. */
+            if (iov->iov_len == NN_MSG) {
+                ch = nn_chunk_from_data (*(void**) iov->iov_base);
+                nn_chunkref_init_chunk (&part, ch);
+                ++i;
+            }
+
+            /*  Sequence of ordinary buffers is copied into a new chunk. */
+            else {
+                len = 0;
+                for (j = i; j != msghdr->msg_iovlen &&
+                      msghdr->msg_iov [j].iov_len != NN_MSG; ++j)
+                    len += msghdr->msg_iov [j].iov_len;
+                nn_chunkref_init (&part, len);
+                pos = 0;
+                for (; i != j; ++i) {
+                    iov = &msghdr->msg_iov [i];
+                    memcpy (((uint8_t*) nn_chunkref_data (&part)) + pos,
+                        iov->iov_base, iov->iov_len);
+                    pos += iov->iov_len;
+                }
+            }
+
+            /*  First part becomes the body, subsequent ones are fragments. */
+            if (!nparts) {
+                nn_chunkref_term (&msg->body);
+                nn_chunkref_mv (&msg->body, &part);
+            }
+            else
+                nn_msg_addfrag (msg, &part);
+            ++nparts;
         }
     }
 
-    /*  Add ancillary data to the message. */
-    if (msghdr->msg_control) {
-        if (msghdr->msg_controllen == NN_MSG) {
-            ch = nn_chunk_from_data (*((void**) msghdr->msg_control));
-            nn_chunkref_term (&msg.hdr);
-            nn_chunkref_init_chunk (&msg.hdr, ch);
+    /*  Add ancillary data to the message. Small headers are stored inline
+        in the chunkref, so copying them doesn't allocate. */
+    if (hdr) {
+        if (hdrlen == NN_MSG) {
+            ch = nn_chunk_from_data (*((void**) hdr));
+            nn_chunkref_term (&msg->hdr);
+            nn_chunkref_init_chunk (&msg->hdr, ch);
         }
         else {
-
-            /*  TODO: Copy the control data to the message. */
-            nn_assert (0);
+            nn_chunkref_term (&msg->hdr);
+            nn_chunkref_init (&msg->hdr, hdrlen);
+            memcpy (nn_chunkref_data (&msg->hdr), hdr, hdrlen);
         }
     }
-
-    /*  Send it further down the stack. */
-    rc = nn_sock_send (self.socks [s], &msg, flags);
-    if (nn_slow (rc < 0)) {
-        nn_msg_term (&msg);
-        errno = -rc;
-        return -1;
+    if (trace) {
+        nn_chunkref_term (&msg->trace);
+        nn_chunkref_init (&msg->trace, NN_TRACE_SIZE);
+        memcpy (nn_chunkref_data (&msg->trace), trace, NN_TRACE_SIZE);
     }
 
-    return (int) sz;
+    return nparts < 0 ? 1 : 0;
 }
 
-int nn_recvmsg (int s, struct nn_msghdr *msghdr, int flags)
+/*  Frees all the buffers passed as NN_MSG in the scatter array. */
+static void nn_global_freeiov (const struct nn_msghdr *msghdr)
+{
+    int i;
+
+    for (i = 0; i != msghdr->msg_iovlen; ++i)
+        if (msghdr->msg_iov [i].iov_len == NN_MSG)
+            nn_chunk_free (nn_chunk_from_data (
+                *(void**) msghdr->msg_iov [i].iov_base));
+}
+
+/*  Checks whether a message can be stored in the gather array. */
+static int nn_global_checkhdr (const struct nn_msghdr *msghdr)
+{
+    int i;
+
+    if (nn_slow (msghdr->msg_iovlen < 0))
+        return -EMSGSIZE;
+    if (msghdr->msg_iovlen == 1 && msghdr->msg_iov [0].iov_len == NN_MSG)
+        return 0;
+    for (i = 0; i != msghdr->msg_iovlen; ++i)
+        if (nn_slow (msghdr->msg_iov [i].iov_len == NN_MSG))
+            return -EINVAL;
+    return 0;
+}
+
+/*  Stores the message into the gather array. The header must have been
+    checked by nn_global_checkhdr beforehand. Returns size of the message. */
+static size_t nn_global_msgtohdr (struct nn_msg *msg,
+    struct nn_msghdr *msghdr, int cmsgs)
 {
-    int rc;
-    struct nn_msg msg;
     uint8_t *data;
     size_t sz;
+    size_t pos;
     int i;
     struct nn_iovec *iov;
     struct nn_chunk *ch;
+    uint64_t chunk [2];
 
-    NN_BASIC_CHECKS;
-
-    if (nn_slow (!msghdr)) {
-        errno = EINVAL;
-        return -1;
-    }
-
-    if (nn_slow (msghdr->msg_iovlen < 0)) {
-        errno = EMSGSIZE;
-        return -1;
-    }
-
-    /*  Get a message. */
-    rc = nn_sock_recv (self.socks [s], &msg, flags);
-    if (nn_slow (rc < 0)) {
-        errno = -rc;
-        return -1;
-    }
+    nn_msg_flatten (msg);
 
     if (msghdr->msg_iovlen == 1 && msghdr->msg_iov [0].iov_len == NN_MSG) {
-        ch = nn_chunkref_getchunk (&msg.body);
+        ch = nn_chunkref_getchunk (&msg->body);
         *(void**) (msghdr->msg_iov [0].iov_base) = nn_chunk_data (ch);
         sz = nn_chunk_size (ch);
     }
     else {
 
         /*  Copy the message content into the supplied gather array. */
-        data = nn_chunkref_data (&msg.body);
-        sz = nn_chunkref_size (&msg.body);
+        data = nn_chunkref_data (&msg->body);
+        sz = nn_chunkref_size (&msg->body);
         for (i = 0; i != msghdr->msg_iovlen; ++i) {
             iov = &msghdr->msg_iov [i];
-            if (nn_slow (iov->iov_len == NN_MSG)) {
-                nn_msg_term (&msg);
-                errno = EINVAL;
-                return -1;
-            }
             if (iov->iov_len > sz) {
                 memcpy (iov->iov_base, data, sz);
                 break;
@@ -713,40 +2133,271 @@ int nn_recvmsg (int s, struct nn_msghdr *msghdr, int flags)
             data += iov->iov_len;
             sz -= iov->iov_len;
         }
-        sz = nn_chunkref_size (&msg.body);
+        sz = nn_chunkref_size (&msg->body);
     }
 
-    /*  Retrieve the ancillary data from the message. */
+    /*  Retrieve the ancillary data from the message. If the socket provides
+        more than the protocol header, the buffer is filled in with
+        nn_cmsghdr entries, the header being the first of them. */
     if (msghdr->msg_control) {
-        if (msghdr->msg_controllen == NN_MSG) {
-            ch = nn_chunkref_getchunk (&msg.hdr);
+        if (cmsgs && msghdr->msg_controllen != NN_MSG) {
+            pos = nn_global_putcmsg (msghdr, 0, PROTO_SP, SP_HDR,
+                nn_chunkref_data (&msg->hdr), nn_chunkref_size (&msg->hdr));
+            if (nn_chunkref_size (&msg->trace))
+                pos = nn_global_putcmsg (msghdr, pos, PROTO_SP, SP_TRACE,
+                    nn_chunkref_data (&msg->trace),
+                    nn_chunkref_size (&msg->trace));
+            if (msg->tstamp)
+                pos = nn_global_putcmsg (msghdr, pos, NN_SOL_SOCKET,
+                    NN_RCVTIMESTAMP, &msg->tstamp, sizeof (msg->tstamp));
+            if (msg->chunktotal) {
+                chunk [0] = msg->chunkoff;
+                chunk [1] = msg->chunktotal;
+                pos = nn_global_putcmsg (msghdr, pos, NN_SOL_SOCKET,
+                    NN_RCVCHUNKS, chunk, sizeof (chunk));
+            }
+            msghdr->msg_controllen = pos;
+        }
+        else if (msghdr->msg_controllen == NN_MSG) {
+            ch = nn_chunkref_getchunk (&msg->hdr);
             *((void**) msghdr->msg_control) = nn_chunk_data (ch);
         }
         else {
 
-            /*  TODO: Copy the data to the supplied buffer, prefix them
-                with size. */
-            nn_assert (0);
-        }   
+            /*  Copy as much of the data as fits into the supplied buffer.
+                The size of the data is returned as the new buffer size. */
+            memcpy (msghdr->msg_control, nn_chunkref_data (&msg->hdr),
+                nn_chunkref_size (&msg->hdr) < msghdr->msg_controllen ?
+                nn_chunkref_size (&msg->hdr) : msghdr->msg_controllen);
+            msghdr->msg_controllen = nn_chunkref_size (&msg->hdr);
+        }
     }
 
-    nn_msg_term (&msg);
+    return sz;
+}
 
-    return (int) sz;
+static int nn_global_getcmsg (const struct nn_msghdr *msghdr,
+    int level, int type, const void **data, size_t *len)
+{
+    struct nn_cmsghdr cmsg;
+    const uint8_t *buf;
+    size_t hdrlen;
+    size_t pos;
+
+    *data = NULL;
+    *len = 0;
+    buf = (const uint8_t*) msghdr->msg_control;
+    hdrlen = NN_CMSG_ALIGN (sizeof (struct nn_cmsghdr));
+    pos = 0;
+    while (pos < msghdr->msg_controllen) {
+
+        /*  The buffer may not be aligned, so copy the entry header out. */
+        if (nn_slow (msghdr->msg_controllen - pos < sizeof (cmsg)))
+            return -EINVAL;
+        memcpy (&cmsg, buf + pos, sizeof (cmsg));
+        if (nn_slow (cmsg.cmsg_len < NN_CMSG_LEN (0) ||
+              cmsg.cmsg_len > msghdr->msg_controllen - pos))
+            return -EINVAL;
+        if (cmsg.cmsg_level == level && cmsg.cmsg_type == type &&
+              !*data) {
+            *data = buf + pos + hdrlen;
+            *len = cmsg.cmsg_len - hdrlen;
+        }
+        if (NN_CMSG_ALIGN (cmsg.cmsg_len) >= msghdr->msg_controllen - pos)
+            break;
+        pos += NN_CMSG_ALIGN (cmsg.cmsg_len);
+    }
+
+    return 0;
+}
+
+static size_t nn_global_putcmsg (struct nn_msghdr *msghdr, size_t pos,
+    int level, int type, const void *data, size_t len)
+{
+    struct nn_cmsghdr cmsg;
+    uint8_t *buf;
+    size_t hdrlen;
+
+    buf = (uint8_t*) msghdr->msg_control;
+    hdrlen = NN_CMSG_ALIGN (sizeof (struct nn_cmsghdr));
+    if (pos + hdrlen <= msghdr->msg_controllen) {
+        cmsg.cmsg_len = NN_CMSG_LEN (len);
+        cmsg.cmsg_level = level;
+        cmsg.cmsg_type = type;
+        memcpy (buf + pos, &cmsg, sizeof (cmsg));
+        if (pos + hdrlen + len <= msghdr->msg_controllen)
+            memcpy (buf + pos + hdrlen, data, len);
+        else
+            memcpy (buf + pos + hdrlen, data,
+                msghdr->msg_controllen - pos - hdrlen);
+    }
+
+    return pos + NN_CMSG_SPACE (len);
+}
+
+static int nn_global_cmsgs (int s)
+{
+    int val;
+    size_t sz;
+
+    /*  At the moment, only the timestamps, the positions of the chunks and
+        the trace contexts are provided on top of the protocol header. */
+    sz = sizeof (val);
+    nn_sock_getopt (NN_SOCK (s), NN_SOL_SOCKET, NN_TRACECTX, &val, &sz, 1);
+    if (val)
+        return 1;
+    sz = sizeof (val);
+    nn_sock_getopt (NN_SOCK (s), NN_SOL_SOCKET, NN_RCVTIMESTAMP, &val, &sz, 1);
+    if (val)
+        return 1;
+    sz = sizeof (val);
+    nn_sock_getopt (NN_SOCK (s), NN_SOL_SOCKET, NN_RCVCHUNKS, &val, &sz, 1);
+    return val;
+}
+
+static int nn_global_hold (void)
+{
+    uint32_t n;
+
+    if (nn_slow (!self.syncinit))
+        return 0;
+    while (1) {
+        n = nn_atomic_get (&self.nsocks);
+        if (nn_slow (n == 0))
+            return 0;
+        if (nn_fast (nn_atomic_cas (&self.nsocks, n, n + 1)))
+            return 1;
+    }
+}
+
+static void nn_global_release (void)
+{
+    uint32_t n;
+
+    while (1) {
+        n = nn_atomic_get (&self.nsocks);
+        nn_assert (n > 0);
+        if (nn_slow (n == 1))
+            break;
+        if (nn_fast (nn_atomic_cas (&self.nsocks, n, n - 1)))
+            return;
+    }
+
+    /*  The last socket may be going away. Terminating the library has to be
+        done under the global lock. Someone may have re-acquired the library
+        in the meantime though. */
+    nn_glock_lock ();
+    if (nn_atomic_dec (&self.nsocks, 1) == 1)
+        nn_global_term ();
+    nn_glock_unlock ();
+}
+
+#if !defined NN_HAVE_WINDOWS
+
+static void nn_global_release_bg (void)
+{
+    nn_atomic_dec (&self.nsocks, 1);
+}
+
+#endif
+
+static int nn_global_pop (void)
+{
+    uint64_t old;
+    uint32_t s;
+
+    while (1) {
+        old = nn_atomic64_load (&self.unused);
+        s = NN_UNUSED_TOP (old);
+        if (nn_slow (s == NN_UNUSED_NIL))
+            return -1;
+        if (nn_fast (nn_atomic64_cas (&self.unused, old,
+              NN_UNUSED_NEXT (old, NN_SOCK_NEXT (s)))))
+            return (int) s;
+    }
+}
+
+static void nn_global_pushlist (int first, int last)
+{
+    uint64_t old;
+
+    while (1) {
+        old = nn_atomic64_load (&self.unused);
+        NN_SOCK_NEXT (last) = NN_UNUSED_TOP (old);
+        if (nn_fast (nn_atomic64_cas (&self.unused, old,
+              NN_UNUSED_NEXT (old, first))))
+            return;
+    }
+}
+
+static void nn_global_push (int s)
+{
+    nn_global_pushlist (s, s);
+}
+
+static void nn_global_add_page (void)
+{
+    int i;
+    int base;
+    struct nn_sock **page;
+
+    base = self.npages * NN_SOCKS_PAGE_SIZE;
+    nn_assert (base < self.maxsocks);
+
+    /*  The page holds socket pointers followed by the links of the stack of
+        unused descriptors. */
+    page = nn_alloc ((sizeof (struct nn_sock*) + sizeof (uint32_t)) *
+        NN_SOCKS_PAGE_SIZE, "socket table page");
+    alloc_assert (page);
+    for (i = 0; i != NN_SOCKS_PAGE_SIZE; ++i)
+        page [i] = NULL;
+
+    /*  Publish the page before its descriptors can be handed out. */
+    self.socks [self.npages] = page;
+    ++self.npages;
+
+    /*  Push the descriptors from the new page to the stack of unused ones,
+        lowest on top. */
+    for (i = 0; i != NN_SOCKS_PAGE_SIZE - 1; ++i)
+        NN_SOCK_NEXT (base + i) = base + i + 1;
+    nn_global_pushlist (base, base + NN_SOCKS_PAGE_SIZE - 1);
 }
 
 static void nn_global_add_transport (struct nn_transport *transport)
 {
+    uint32_t i;
+
+    nn_assert (transport->id < 0 && transport->id > -NN_GLOBAL_TRANSPORTS);
+    nn_assert (!self.transportids [-transport->id]);
+
     transport->init ();
-    nn_list_insert (&self.transports, &transport->item,
-        nn_list_end (&self.transports));
-    
+    self.transportids [-transport->id] = transport;
+    i = nn_global_hash (transport->name, strlen (transport->name));
+    while (self.transports [i])
+        i = (i + 1) & (NN_GLOBAL_TRANSPORTS - 1);
+    self.transports [i] = transport;
 }
 
 static void nn_global_add_socktype (struct nn_socktype *socktype)
 {
-    nn_list_insert (&self.socktypes, &socktype->item,
-        nn_list_end (&self.socktypes));
+    nn_assert (socktype->domain == AF_SP || socktype->domain == AF_SP_RAW);
+    nn_assert (socktype->protocol >= 0 &&
+        socktype->protocol < NN_GLOBAL_PROTOCOLS);
+    nn_assert (!self.socktypes [socktype->domain - AF_SP][socktype->protocol]);
+
+    self.socktypes [socktype->domain - AF_SP][socktype->protocol] = socktype;
+}
+
+/*  Returns the slot of the transport hash table to start looking for
+    the transport name at. */
+static uint32_t nn_global_hash (const char *name, size_t namelen)
+{
+    uint32_t hash;
+
+    hash = 5381;
+    while (namelen--)
+        hash = hash * 33 + (uint8_t) *name++;
+    return hash & (NN_GLOBAL_TRANSPORTS - 1);
 }
 
 static int nn_global_create_ep (int fd, const char *addr, int bind)
@@ -755,14 +2406,13 @@ static int nn_global_create_ep (int fd, const char *addr, int bind)
     const char *proto;
     const char *delim;
     size_t protosz;
+    int addrlist;
     struct nn_transport *tp;
-    struct nn_list_item *it;
+    uint32_t i;
 
     /*  Check whether address is valid. */
     if (!addr)
         return -EINVAL;
-    if (strlen (addr) >= NN_SOCKADDR_MAX)
-        return -ENAMETOOLONG;
 
     /*  Separate the protocol and the actual address. */
     proto = addr;
@@ -774,56 +2424,203 @@ static int nn_global_create_ep (int fd, const char *addr, int bind)
     protosz = delim - addr;
     addr += protosz + 3;
 
-    /*  Find the specified protocol. */
-    tp = NULL;
-    nn_glock_lock ();
-    for (it = nn_list_begin (&self.transports);
-          it != nn_list_end (&self.transports);
-          it = nn_list_next (&self.transports, it)) {
-        tp = nn_cont (it, struct nn_transport, item);
-        if (strlen (tp->name) == protosz &&
-              memcmp (tp->name, proto, protosz) == 0)
+    /*  Find the specified protocol. The table doesn't change while there are
+        open sockets. It's never full, so the search ends at an empty slot
+        if the protocol is unknown. */
+    i = nn_global_hash (proto, protosz);
+    while (1) {
+        tp = self.transports [i];
+        if (!tp || (strlen (tp->name) == protosz &&
+              memcmp (tp->name, proto, protosz) == 0))
             break;
-        tp = NULL;
+        i = (i + 1) & (NN_GLOBAL_TRANSPORTS - 1);
     }
 
     /*  The protocol specified doesn't match any known protocol. */
-    if (!tp) {
-        nn_glock_unlock ();
+    if (!tp)
         return -EPROTONOSUPPORT;
-    }
+
+    /*  The transport may accept a list of addresses to connect to. Then,
+        only the length of the individual addresses is limited. */
+    addrlist = !bind && (tp->flags & NN_TRANSPORT_ADDRLIST);
+    if (!addrlist && strlen (proto) >= NN_SOCKADDR_MAX)
+        return -ENAMETOOLONG;
 
     /*  Ask socket to create the endpoint. Pass it the class factory
         function. */
-    rc = nn_sock_add_ep (self.socks [fd], addr,
+    rc = nn_sock_add_ep (NN_SOCK (fd), addr, addrlist, tp->id,
         bind ? tp->bind : tp->connect);
-    nn_glock_unlock ();
     return rc;
 }
 
 struct nn_transport *nn_global_transport (int id)
 {
-    struct nn_transport *tp;
-    struct nn_list_item *it;
+    /*  The table of transports is filled in when the library is initialised
+        and doesn't change while there are open sockets, so it can be accessed
+        without the global lock. */
+    if (id >= 0 || id <= -NN_GLOBAL_TRANSPORTS)
+        return NULL;
+    return self.transportids [-id];
+}
 
-    /*  Find the specified protocol. */
-    tp = NULL;
-    nn_glock_lock ();
-    for (it = nn_list_begin (&self.transports);
-          it != nn_list_end (&self.transports);
-          it = nn_list_next (&self.transports, it)) {
-        tp = nn_cont (it, struct nn_transport, item);
-        if (tp->id == id)
-            break;
-        tp = NULL;
+struct nn_worker *nn_global_choose_worker (int node)
+{
+    return nn_pool_choose_worker (&self.pool, node);
+}
+
+struct nn_cp *nn_global_choose_cp (void)
+{
+    uint32_t n;
+    int node;
+    int count;
+    int a;
+    int b;
+
+    if (!self.ncps)
+        return NULL;
+    if (self.ncps == 1)
+        return &self.cps [0];
+
+    /*  Completion ports of the node are those at indices node,
+        node + cpnodes etc. */
+    n = nn_atomic_inc (&self.nextcp, 1);
+    node = 0;
+    if (self.cpnodes > 1) {
+        node = nn_thread_node ();
+        if (node >= self.cpnodes)
+            node = 0;
     }
-    nn_glock_unlock ();
+    count = (self.ncps - node + self.cpnodes - 1) / self.cpnodes;
+    if (count == 1)
+        return &self.cps [node];
+
+    /*  A socket stays with its completion port for its whole life, so
+        of the two ports picked in round-robin fashion, the one whose thread
+        was less busy recently gets the new socket. That way the sockets
+        created later steer clear of the threads already loaded by a few
+        busy connections. See nn_pool_choose_worker for why only two ports
+        are compared. */
+    a = node + (int) (n % count) * self.cpnodes;
+    b = node + (int) ((n + count / 2) % count) * self.cpnodes;
+    nn_mutex_lock (&self.cpsync);
+    nn_global_sample_cps ();
+    if (self.cpload [b] < self.cpload [a])
+        a = b;
+    nn_mutex_unlock (&self.cpsync);
+    return &self.cps [a];
+}
+
+static void nn_global_sample_cps (void)
+{
+    int i;
+    uint64_t now;
+    uint64_t busy;
+    struct nn_cp_stats stats;
+
+    now = nn_clock_monotonic ();
+    if (now - self.cpsampled < (uint64_t) NN_CP_SAMPLE_IVL * 1000000)
+        return;
+    for (i = 0; i != self.ncps; ++i) {
+        nn_cp_getstats (&self.cps [i], &stats);
+        busy = stats.timers + stats.io + stats.events + stats.ops;
+        self.cpload [i] = busy - self.cpbusy [i];
+        self.cpbusy [i] = busy;
+    }
+    self.cpsampled = now;
+}
+
+static void nn_global_init_cps (void)
+{
+    int rc;
+    int i;
+    const char *env;
+    int ncps;
+
+    self.cps = NULL;
+    self.ncps = 0;
+    self.cpnodes = 1;
+    self.external = 0;
+
+    /*  If NN_CP_EXTERNAL environment variable is set, all the sockets share
+        one completion port and the I/O processing is done by the user's
+        thread. If the platform doesn't support that, fall back to
+        the default. */
+    env = getenv ("NN_CP_EXTERNAL");
+    if (env && atoi (env) > 0) {
+        self.cps = nn_alloc (sizeof (struct nn_cp), "external completion port");
+        alloc_assert (self.cps);
+        rc = nn_cp_init_external (&self.cps [0]);
+        if (rc == 0) {
+            self.ncps = 1;
+            self.external = 1;
+            return;
+        }
+        errnum_assert (rc == -ENOTSUP, -rc);
+        nn_free (self.cps);
+        self.cps = NULL;
+    }
+
+    /*  By default, each socket has its own completion port. If NN_CP_THREADS
+        environment variable is set, the sockets share the specified number of
+        completion ports instead. Zero means one completion port per CPU
+        core. */
+    env = getenv ("NN_CP_THREADS");
+    if (!env)
+        return;
+    ncps = atoi (env);
+    if (ncps <= 0)
+        ncps = nn_global_ncpus ();
+    if (ncps > NN_MAX_CPS)
+        ncps = NN_MAX_CPS;
+
+    /*  If there are enough of them, the completion ports are spread over
+        the NUMA nodes. */
+    if (ncps >= nn_thread_nodes ())
+        self.cpnodes = nn_thread_nodes ();
+
+    self.cps = nn_alloc (sizeof (struct nn_cp) * ncps,
+        "shared completion ports");
+    alloc_assert (self.cps);
+    for (i = 0; i != ncps; ++i) {
+        rc = nn_cp_init (&self.cps [i]);
+        errnum_assert (rc == 0, -rc);
+        if (self.cpnodes > 1)
+            nn_cp_setnode (&self.cps [i], i % self.cpnodes);
+        self.cpload [i] = 0;
+        self.cpbusy [i] = 0;
+    }
+    self.ncps = ncps;
+    self.cpsampled = nn_clock_monotonic ();
+}
+
+static void nn_global_term_cps (void)
+{
+    int i;
 
-    return tp;
+    for (i = 0; i != self.ncps; ++i)
+        nn_cp_term (&self.cps [i]);
+    if (self.cps)
+        nn_free (self.cps);
+    self.cps = NULL;
+    self.ncps = 0;
+    self.cpnodes = 1;
+    self.external = 0;
 }
 
-struct nn_worker *nn_global_choose_worker ()
+static int nn_global_ncpus (void)
 {
-    return nn_pool_choose_worker (&self.pool);
+#if defined NN_HAVE_WINDOWS
+    SYSTEM_INFO info;
+
+    GetSystemInfo (&info);
+    return (int) info.dwNumberOfProcessors;
+#elif defined _SC_NPROCESSORS_ONLN
+    long n;
+
+    n = sysconf (_SC_NPROCESSORS_ONLN);
+    return n > 0 ? (int) n : 1;
+#else
+    return 1;
+#endif
 }
 
@@ -23,10 +23,43 @@
 #ifndef NN_GLOBAL_INCLUDED
 #define NN_GLOBAL_INCLUDED
 
+struct nn_msg;
+struct nn_sock;
+
 /*  Provides access to the list of available transports. */
 struct nn_transport *nn_global_transport (int id);
 
-/*  Returns a worker. Each call to this function may return different worker. */
-struct nn_worker *nn_global_choose_worker ();
+/*  Returns combination of NN_POLLIN and NN_POLLOUT, specifying whether
+    the socket can be used to receive and/or send messages, or -1 with errno
+    set in case of error. */
+int nn_global_sockdirs (int s);
+
+/*  Send or receive up to 'count' messages in the internal format, bypassing
+    the conversion to and from nn_msghdr. Blocks only until the first message
+    is through. Returns number of messages processed or -1 with errno set. */
+int nn_global_sendv (int s, struct nn_msg *msgs, int count, int flags);
+int nn_global_recvv (int s, struct nn_msg *msgs, int count, int flags);
+
+/*  Registers 'handlers' handler threads of nn_serve with socket 's' and
+    returns the socket object, or NULL with errno set. The socket object
+    stays valid till the handlers leave via nn_sock_serving, even if the
+    socket is closed in the meantime, so the handlers use it instead of
+    the descriptor, which may be reused. */
+struct nn_sock *nn_global_serve (int s, int handlers);
+
+/*  nn_ctx_send and nn_ctx_recv for the handlers of nn_serve. */
+int nn_global_ctxsend (struct nn_sock *sock, int ctx, const void *buf,
+    size_t len, int flags);
+int nn_global_ctxrecv (struct nn_sock *sock, int ctx, void *buf, size_t len,
+    int flags);
+
+/*  Returns a worker. Each call to this function may return different worker.
+    If 'node' is not negative, a worker bound to that NUMA node is preferred. */
+struct nn_worker *nn_global_choose_worker (int node);
+
+/*  Returns one of the completion ports shared among the sockets, or NULL if
+    each socket is supposed to create its own completion port. Can be called
+    from several threads in parallel. */
+struct nn_cp *nn_global_choose_cp (void);
 
 #endif
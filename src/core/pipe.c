@@ -27,6 +27,8 @@
 
 #include "../utils/err.h"
 #include "../utils/fast.h"
+#include "../utils/trace.h"
+#include "../utils/capture.h"
 
 /*  Internal pipe states. */
 #define NN_PIPEBASE_INSTATE_DEACTIVATED 0
@@ -48,6 +50,10 @@ int nn_pipebase_init (struct nn_pipebase *self,
     self->instate = NN_PIPEBASE_INSTATE_DEACTIVATED;
     self->outstate = NN_PIPEBASE_OUTSTATE_DEACTIVATED;
     self->sock = epbase->sock;
+    self->eid = epbase->eid;
+    self->id = ++((struct nn_sockbase*) self->sock)->pipeids;
+    self->sndprio = epbase->sndprio;
+    self->rcvprio = epbase->rcvprio;
     return nn_sock_add (self->sock, (struct nn_pipe*) self);
 }
 
@@ -69,6 +75,7 @@ void nn_pipebase_activate (struct nn_pipebase *self)
 
 void nn_pipebase_received (struct nn_pipebase *self)
 {
+    nn_trace1 (pipe_received, self);
     if (nn_fast (self->instate == NN_PIPEBASE_INSTATE_RECEIVING)) {
         self->instate = NN_PIPEBASE_INSTATE_RECEIVED;
         return;
@@ -91,6 +98,11 @@ void nn_pipebase_sent (struct nn_pipebase *self)
         nn_sock_out (self->sock, (struct nn_pipe*) self);
 }
 
+int nn_pipebase_isreceiving (struct nn_pipebase *self)
+{
+    return self->instate == NN_PIPEBASE_INSTATE_ASYNC ? 1 : 0;
+}
+
 struct nn_cp *nn_pipebase_getcp (struct nn_pipebase *self)
 {
     return nn_sock_getcp (self->sock);
@@ -101,6 +113,50 @@ int nn_pipebase_ispeer (struct nn_pipebase *self, int socktype)
     return nn_sock_ispeer (self->sock, socktype);
 }
 
+uint64_t nn_pipebase_now (struct nn_pipebase *self)
+{
+    return nn_sock_now (self->sock);
+}
+
+int nn_pipebase_expired (struct nn_pipebase *self, struct nn_msg *msg)
+{
+    return nn_sock_expired (self->sock, msg);
+}
+
+void nn_pipebase_shed (struct nn_pipebase *self, struct nn_msg *msg)
+{
+    nn_sockbase_shed ((struct nn_sockbase*) self->sock,
+        nn_msg_bodysize (msg));
+}
+
+void nn_pipebase_lost (struct nn_pipebase *self, uint64_t msgs,
+    uint64_t bytes)
+{
+    struct nn_sockbase *sockbase;
+
+    sockbase = (struct nn_sockbase*) self->sock;
+    sockbase->stats.shed += msgs;
+    sockbase->stats.shedbytes += bytes;
+}
+
+void nn_pipebase_deferred_init (struct nn_pipebase_deferred *self,
+    void (*fn) (struct nn_pipebase_deferred *self))
+{
+    nn_list_item_init (&self->item);
+    self->fn = fn;
+}
+
+void nn_pipebase_deferred_term (struct nn_pipebase_deferred *self)
+{
+    nn_list_item_term (&self->item);
+}
+
+int nn_pipebase_defer (struct nn_pipebase *self,
+    struct nn_pipebase_deferred *deferred)
+{
+    return nn_sock_defer (self->sock, deferred);
+}
+
 void nn_pipe_setdata (struct nn_pipe *self, void *data)
 {
     ((struct nn_pipebase*) self)->data = data;
@@ -111,6 +167,21 @@ void *nn_pipe_getdata (struct nn_pipe *self)
     return ((struct nn_pipebase*) self)->data;
 }
 
+int nn_pipe_geteid (struct nn_pipe *self)
+{
+    return ((struct nn_pipebase*) self)->eid;
+}
+
+int nn_pipe_getsndprio (struct nn_pipe *self)
+{
+    return ((struct nn_pipebase*) self)->sndprio;
+}
+
+int nn_pipe_getrcvprio (struct nn_pipe *self)
+{
+    return ((struct nn_pipebase*) self)->rcvprio;
+}
+
 int nn_pipe_send (struct nn_pipe *self, struct nn_msg *msg)
 {
     int rc;
@@ -119,8 +190,14 @@ int nn_pipe_send (struct nn_pipe *self, struct nn_msg *msg)
     pipebase = (struct nn_pipebase*) self;
     nn_assert (pipebase->outstate == NN_PIPEBASE_OUTSTATE_IDLE);
     pipebase->outstate = NN_PIPEBASE_OUTSTATE_SENDING;
+    nn_trace2 (pipe_send, self, nn_msg_bodysize (msg));
+    if (nn_slow (pipebase->sock &&
+          ((struct nn_sockbase*) pipebase->sock)->capture))
+        nn_capture_record (((struct nn_sockbase*) pipebase->sock)->capture,
+            0, pipebase->id, nn_msg_bodysize (msg));
     rc = pipebase->vfptr->send (pipebase, msg);
     errnum_assert (rc >= 0, -rc);
+    nn_trace2 (pipe_sent, self, rc);
     if (nn_fast (pipebase->outstate == NN_PIPEBASE_OUTSTATE_SENT)) {
         pipebase->outstate = NN_PIPEBASE_OUTSTATE_IDLE;
         return rc;
@@ -140,6 +217,11 @@ int nn_pipe_recv (struct nn_pipe *self, struct nn_msg *msg)
     pipebase->instate = NN_PIPEBASE_INSTATE_RECEIVING;
     rc = pipebase->vfptr->recv (pipebase, msg);
     errnum_assert (rc >= 0, -rc);
+    nn_trace2 (pipe_recv, self, nn_msg_bodysize (msg));
+    if (nn_slow (pipebase->sock &&
+          ((struct nn_sockbase*) pipebase->sock)->capture))
+        nn_capture_record (((struct nn_sockbase*) pipebase->sock)->capture,
+            1, pipebase->id, nn_msg_bodysize (msg));
 
     if (nn_fast (pipebase->instate == NN_PIPEBASE_INSTATE_RECEIVED)) {
         pipebase->instate = NN_PIPEBASE_INSTATE_IDLE;
@@ -150,3 +232,18 @@ int nn_pipe_recv (struct nn_pipe *self, struct nn_msg *msg)
     return rc | NN_PIPEBASE_RELEASE;
 }
 
+int nn_pipe_expired (struct nn_pipe *self, struct nn_msg *msg)
+{
+    return nn_sock_expired (((struct nn_pipebase*) self)->sock, msg);
+}
+
+int nn_pipe_close (struct nn_pipe *self)
+{
+    struct nn_pipebase *pipebase;
+
+    pipebase = (struct nn_pipebase*) self;
+    if (!pipebase->vfptr->close)
+        return -ENOTSUP;
+    pipebase->vfptr->close (pipebase);
+    return 0;
+}
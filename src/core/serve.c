@@ -0,0 +1,174 @@
+/*
+    Copyright (c) 2013 250bpm s.r.o.
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"),
+    to deal in the Software without restriction, including without limitation
+    the rights to use, copy, modify, merge, publish, distribute, sublicense,
+    and/or sell copies of the Software, and to permit persons to whom
+    the Software is furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included
+    in all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+    THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+    FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+    IN THE SOFTWARE.
+*/
+
+#include "../nn.h"
+
+#include "global.h"
+#include "sock.h"
+
+#include "../utils/err.h"
+#include "../utils/fast.h"
+#include "../utils/alloc.h"
+#include "../utils/thread.h"
+
+/*  Each handler thread has a context of its own, so the requests are
+    received and the replies sent by the handler threads themselves, each
+    request's backtrace being kept in the context of the thread handling it.
+    The messages are passed to and from the handler as they are (NN_MSG).
+    The handler threads use the socket object rather than the descriptor:
+    nn_close wakes them up and doesn't deallocate the socket till they've
+    all left it. */
+
+struct nn_serve;
+
+struct nn_serve_handler {
+    struct nn_thread thread;
+    struct nn_serve *serve;
+    int ctx;
+
+    /*  The error the handler has failed with. */
+    int err;
+};
+
+struct nn_serve {
+    struct nn_sock *sock;
+    void *(*fn) (void *req, size_t len, void *arg);
+    void *arg;
+    struct nn_serve_handler handlers [1];
+};
+
+/*  Private functions. */
+static void nn_serve_routine (void *arg);
+
+int nn_serve (int s, int nthreads,
+    void *(*fn) (void *req, size_t len, void *arg), void *arg)
+{
+    int i;
+    int rc;
+    int err;
+    struct nn_serve *self;
+
+    if (nn_slow (nthreads < 1 || !fn)) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    self = nn_alloc (sizeof (struct nn_serve) +
+        sizeof (struct nn_serve_handler) * (nthreads - 1), "serve");
+    if (nn_slow (!self)) {
+        errno = ENOMEM;
+        return -1;
+    }
+    self->fn = fn;
+    self->arg = arg;
+
+    /*  Register all the handlers up front, so that the socket is kept alive
+        for the threads from the start. */
+    self->sock = nn_global_serve (s, nthreads);
+    if (nn_slow (!self->sock)) {
+        err = errno;
+        nn_free (self);
+        errno = err;
+        return -1;
+    }
+
+    /*  Open the contexts before launching any threads, so that a socket
+        that can't be served fails straight away. */
+    for (i = 0; i != nthreads; ++i) {
+        self->handlers [i].serve = self;
+        self->handlers [i].err = 0;
+        rc = nn_sock_ctx_open (self->sock);
+        if (nn_slow (rc < 0)) {
+            while (i--)
+                nn_sock_ctx_close (self->sock, self->handlers [i].ctx);
+            nn_sock_serving (self->sock, -nthreads, 0);
+            nn_free (self);
+            errno = -rc;
+            return -1;
+        }
+        self->handlers [i].ctx = rc;
+    }
+
+    /*  Run the handlers till they all fail. */
+    for (i = 0; i != nthreads; ++i)
+        nn_thread_init_named (&self->handlers [i].thread, "nn_serve",
+            nn_serve_routine, &self->handlers [i]);
+    err = 0;
+    for (i = 0; i != nthreads; ++i) {
+        nn_thread_term (&self->handlers [i].thread);
+        if (!err)
+            err = self->handlers [i].err;
+    }
+
+    nn_free (self);
+
+    errno = err;
+    return -1;
+}
+
+static void nn_serve_routine (void *arg)
+{
+    int rc;
+    int nbytes;
+    void *req;
+    void *rep;
+    struct nn_serve_handler *self;
+    struct nn_serve *serve;
+
+    self = (struct nn_serve_handler*) arg;
+    serve = self->serve;
+
+    while (1) {
+
+        /*  Wait for a request. Closing the socket or terminating the library
+            wakes the thread up with ETERM. */
+        nbytes = nn_global_ctxrecv (serve->sock, self->ctx, &req, NN_MSG, 0);
+        if (nn_slow (nbytes < 0)) {
+            if (errno == EINTR || errno == ETIMEDOUT)
+                continue;
+            self->err = errno;
+            break;
+        }
+
+        /*  The handler owns the request. The message it returns is sent as
+            the reply straight from this thread. If it returns NULL, no reply
+            is sent and the requester eventually resends the request. */
+        nn_sock_serving (serve->sock, 0, 1);
+        rep = serve->fn (req, (size_t) nbytes, serve->arg);
+        if (rep) {
+            rc = nn_global_ctxsend (serve->sock, self->ctx, &rep, NN_MSG, 0);
+            if (nn_slow (rc < 0)) {
+                nn_freemsg (rep);
+                if (errno == ETERM) {
+                    self->err = errno;
+                    nn_sock_serving (serve->sock, 0, -1);
+                    break;
+                }
+            }
+        }
+        nn_sock_serving (serve->sock, 0, -1);
+    }
+
+    /*  Once the handler has left, the socket may be deallocated. */
+    nn_sock_ctx_close (serve->sock, self->ctx);
+    nn_sock_serving (serve->sock, -1, 0);
+}
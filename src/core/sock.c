@@ -30,24 +30,82 @@
 #include "../utils/err.h"
 #include "../utils/cont.h"
 #include "../utils/fast.h"
+#include "../utils/alloc.h"
 #include "../utils/msg.h"
+#include "../utils/stopwatch.h"
+#include "../utils/trace.h"
+#include "../utils/thread.h"
+#include "../utils/handoff.h"
+#include "../utils/wire.h"
+#include "../utils/capture.h"
+
+#include <string.h>
 
 /*  This flag is set, if nn_term() function was already called. All the socket
     function, except for nn_close() should return ETERM error in such case. */
 #define NN_SOCK_FLAG_ZOMBIE 1
 
-/*  These bits specify whether individual efds are signalled or not at
-    the moment. Storing this information allows us to avoid redundant signalling
-    and unsignalling of the efd objects. */
+/*  These bits specify whether the socket is readable and writeable at
+    the moment, i.e. whether the efds should be signalled. */
 #define NN_SOCK_FLAG_IN 2
 #define NN_SOCK_FLAG_OUT 4
 
 /*  Set if nn_close() is already in progress. */
 #define NN_SOCK_FLAG_CLOSING 8
 
+/*  Set if the socket has its private completion port, as opposed to using
+    one of the completion ports shared among all the sockets. */
+#define NN_SOCK_FLAG_OWNCP 16
+
+/*  These bits specify whether individual efds are actually signalled or not at
+    the moment. The efds are kept in sync with IN and OUT bits only while
+    someone can observe them, i.e. while a thread is blocked on them or once
+    the user have retrieved them via NN_SNDFD/NN_RCVFD options (the RCVFD and
+    SNDFD bits). Otherwise signalling and unsignalling, which are syscalls, are
+    skipped altogether. */
+#define NN_SOCK_FLAG_INFD 32
+#define NN_SOCK_FLAG_OUTFD 64
+#define NN_SOCK_FLAG_RCVFD 128
+#define NN_SOCK_FLAG_SNDFD 256
+
+/*  Set while the queued asynchronous operations are being performed. */
+#define NN_SOCK_FLAG_OPS 512
+
+/*  Set in the number of the nn_serve handler threads once nn_sock_destroy
+    is about to wait for them. */
+#define NN_SOCK_HANDLERS_WAITED 0x80000000u
+
+/*  Set while nn_send() is passing the messages to the pipes. The pipes
+    defer waking their peers up till it's done, see nn_pipebase_defer. */
+#define NN_SOCK_FLAG_DEFER 1024
+
 /*  Private functions. */
 void nn_sockbase_adjust_events (struct nn_sockbase *self);
 struct nn_optset *nn_sockbase_optset (struct nn_sockbase *self, int id);
+static int nn_sock_spin (struct nn_sockbase *self, int flag, int spin);
+static int nn_sock_sendctx (struct nn_sock *self, int ctx,
+    struct nn_msg *msgs, int count, int flags);
+static int nn_sock_recvctx (struct nn_sock *self, int ctx,
+    struct nn_msg *msgs, int count, int flags);
+static int nn_sockbase_send (struct nn_sockbase *self, int ctx,
+    struct nn_msg *msg);
+static int nn_sockbase_recv (struct nn_sockbase *self, int ctx,
+    struct nn_msg *msg);
+static void nn_sockbase_update_events (struct nn_sockbase *self);
+static void nn_sockbase_publish_ready (struct nn_sockbase *self);
+static void nn_sockbase_sync_efds (struct nn_sockbase *self);
+static void nn_sockbase_run_ops (struct nn_sockbase *self);
+static void nn_sockbase_complete_op (struct nn_list *ops,
+    struct nn_sockop *op, int rc);
+static void nn_sockbase_cancel_ops (struct nn_sockbase *self, int rc);
+static int nn_sockbase_wait (struct nn_sockbase *self, struct nn_efd *efd,
+    int timeout);
+static int nn_sockbase_poll_events (struct nn_sockbase *self, int events);
+static int nn_sockbase_rcvwait (struct nn_sockbase *self, int ctx,
+    int timeout);
+static void nn_sockbase_wake_rcvwaiters (struct nn_sockbase *self, int all);
+static void nn_sockbase_run_deferred (struct nn_sockbase *self);
+static int nn_sock_close_eps (struct nn_sock *self, int eid);
 
 int nn_sockbase_init (struct nn_sockbase *self,
     const struct nn_sockbase_vfptr *vfptr)
@@ -64,14 +122,14 @@ int nn_sockbase_init (struct nn_sockbase *self,
     if (vfptr->flags & NN_SOCKBASE_FLAG_NOSEND)
         memset (&self->sndfd, 0xcd, sizeof (self->sndfd));
     else {
-        rc = nn_efd_init (&self->sndfd);
+        rc = nn_efd_init_lazy (&self->sndfd);
         if (nn_slow (rc < 0))
             return rc;
     }
     if (vfptr->flags & NN_SOCKBASE_FLAG_NORECV)
         memset (&self->rcvfd, 0xcd, sizeof (self->rcvfd));
     else {
-        rc = nn_efd_init (&self->rcvfd);
+        rc = nn_efd_init_lazy (&self->rcvfd);
         if (nn_slow (rc < 0)) {
             if (!(vfptr->flags & NN_SOCKBASE_FLAG_NOSEND))
                 nn_efd_term (&self->sndfd);
@@ -79,39 +137,99 @@ int nn_sockbase_init (struct nn_sockbase *self,
         }
     }
     memset (&self->termsem, 0xcd, sizeof (self->termsem));
-    rc = nn_cp_init (&self->cp);
-    if (nn_slow (rc < 0)) {
-        if (!(vfptr->flags & NN_SOCKBASE_FLAG_NORECV))
-            nn_efd_term (&self->rcvfd);
-        if (!(vfptr->flags & NN_SOCKBASE_FLAG_NOSEND))
-            nn_efd_term (&self->sndfd);
-        return rc;
+    memset (&self->servesem, 0xcd, sizeof (self->servesem));
+
+    /*  If there are completion ports shared among sockets, use one of them.
+        Otherwise create a completion port (and a thread) dedicated to this
+        socket. */
+    self->flags = 0;
+    self->cp = nn_global_choose_cp ();
+    if (!self->cp) {
+        self->cp = nn_alloc (sizeof (struct nn_cp), "completion port");
+        alloc_assert (self->cp);
+        rc = nn_cp_init (self->cp);
+        if (nn_slow (rc < 0)) {
+            nn_free (self->cp);
+            if (!(vfptr->flags & NN_SOCKBASE_FLAG_NORECV))
+                nn_efd_term (&self->rcvfd);
+            if (!(vfptr->flags & NN_SOCKBASE_FLAG_NOSEND))
+                nn_efd_term (&self->sndfd);
+            return rc;
+        }
+        self->flags |= NN_SOCK_FLAG_OWNCP;
     }
 
     self->vfptr = vfptr;
-    self->flags = 0;
     nn_clock_init (&self->clock);
     nn_list_init (&self->eps);
+    nn_list_init (&self->pollers);
+    nn_list_init (&self->rcvwaitq);
+    nn_list_init (&self->rcvidle);
+    nn_list_init (&self->sndops);
+    nn_list_init (&self->rcvops);
+    nn_list_init (&self->deferred);
     self->eid = 1;
 
     /*  Default values for NN_SOL_SOCKET options. */
     self->domain = -1;
     self->protocol = -1;
     self->linger = 1000;
+    self->bgclose = 0;
+    self->numa = 0;
+    self->node = nn_thread_node ();
+    self->heartbeat_ivl = 0;
+    self->heartbeat_misses = 3;
+    self->membudget = 0;
+    self->sndttl = -1;
+    self->tracectx = 0;
+    self->singlethreaded = 0;
+    self->codeltarget = -1;
+    self->codelinterval = 100;
+    nn_budget_init (&self->budget, 0);
     self->sndbuf = 128 * 1024;
     self->rcvbuf = 128 * 1024;
     self->sndtimeo = -1;
     self->rcvtimeo = -1;
     self->reconnect_ivl = 100;
     self->reconnect_ivl_max = 0;
+    self->reconnect_jitter = NN_JITTER_PARTIAL;
     self->sndprio = 8;
     self->rcvprio = 8;
+    self->handshake_timeout = 1000;
+    self->sndspin = 0;
+    self->rcvspin = 0;
+    self->sndweight = 1;
+    self->rcvquantum = 1;
+    self->sndlowat = -1;
+    self->sndbufmsgs = 0;
+    self->rcvbufmsgs = 0;
+    self->sndlowatmsgs = -1;
+    self->rcvtimestamp = 0;
+    self->rcvchunks = 0;
+    self->rcvalloc = NN_ALLOC_DEFAULT;
+    self->sndbatch = 0;
+    self->sndbatchbytes = 0;
+    self->capture = NULL;
+    self->pipeids = 0;
+    self->sndwaiters = 0;
+    self->rcvwaiters = 0;
+    self->rcvwoken = 0;
+    memset (&self->stats, 0, sizeof (self->stats));
+    nn_atomic_init (&self->ready, 0);
+    nn_atomic_init (&self->handlers, 0);
+    nn_atomic_init (&self->handling, 0);
+    nn_atomic64_init (&self->handled, 0);
 
     /*  The transport-specific options are not initialised immediately,
         rather, they are allocated later on when needed. */
     for (i = 0; i != NN_MAX_TRANSPORT; ++i)
         self->optsets [i] = NULL;
 
+    /*  No contexts are open at the beginning. */
+    self->ctxs = NULL;
+    self->nctxs = 0;
+    self->closed = NULL;
+
     return 0;
 }
 
@@ -120,86 +238,163 @@ void nn_sock_zombify (struct nn_sock *self)
     struct nn_sockbase *sockbase;
 
     sockbase = (struct nn_sockbase*) self;
-    nn_cp_lock (&sockbase->cp);
+    nn_cp_lock (sockbase->cp);
     sockbase->flags |= NN_SOCK_FLAG_ZOMBIE;
+    nn_sockbase_cancel_ops (sockbase, -ETERM);
 
     /*  Reset IN and OUT events to unblock any polling function. */
     if (!(sockbase->flags & NN_SOCK_FLAG_CLOSING)) {
-        if (!(sockbase->flags & NN_SOCK_FLAG_IN)) {
-            sockbase->flags |= NN_SOCK_FLAG_IN;
-            if (!(sockbase->vfptr->flags & NN_SOCKBASE_FLAG_NORECV))
-                nn_efd_signal (&sockbase->rcvfd);
-        }
-        if (!(sockbase->flags & NN_SOCK_FLAG_OUT)) {
-            sockbase->flags |= NN_SOCK_FLAG_OUT;
-            if (!(sockbase->vfptr->flags & NN_SOCKBASE_FLAG_NOSEND))
-                nn_efd_signal (&sockbase->sndfd);
-        }
+        sockbase->flags |= NN_SOCK_FLAG_IN | NN_SOCK_FLAG_OUT;
+        nn_sockbase_sync_efds (sockbase);
+        nn_sockbase_wake_rcvwaiters (sockbase, 1);
     }
+    nn_sockbase_publish_ready (sockbase);
 
-    nn_cp_unlock (&sockbase->cp);
+    nn_cp_unlock (sockbase->cp);
 }
 
-int nn_sock_destroy (struct nn_sock *self)
+/*  Starts shutting the socket down, unless it was already done. Called with
+    the completion port locked. */
+static void nn_sock_start_closing (struct nn_sockbase *self)
 {
     int rc;
-    struct nn_sockbase *sockbase;
     struct nn_list_item *it;
     struct nn_epbase *ep;
 
-    sockbase = (struct nn_sockbase*) self;
+    if (self->flags & NN_SOCK_FLAG_CLOSING)
+        return;
 
-    nn_cp_lock (&sockbase->cp);
+    /*  Mark the socket as being in process of shutting down. */
+    self->flags |= NN_SOCK_FLAG_CLOSING;
+    nn_sockbase_publish_ready (self);
+    nn_sockbase_cancel_ops (self, -ETERM);
+    nn_sockbase_wake_rcvwaiters (self, 1);
 
-    /*  The call may have been interrupted by a singal and restarted afterwards.
-        In such case don't do the following stuff again. */
-    if (!(sockbase->flags & NN_SOCK_FLAG_CLOSING)) {
+    /*  Close sndfd and rcvfd. This should make any current select/poll
+        using SNDFD and/or RCVFD exit. */
+    if (!(self->vfptr->flags & NN_SOCKBASE_FLAG_NORECV)) {
+        nn_efd_term (&self->rcvfd);
+        memset (&self->rcvfd, 0xcd, sizeof (self->rcvfd));
+    }
+    if (!(self->vfptr->flags & NN_SOCKBASE_FLAG_NOSEND)) {
+        nn_efd_term (&self->sndfd);
+        memset (&self->sndfd, 0xcd, sizeof (self->sndfd));
+    }
 
-        /*  Mark the socket as being in process of shutting down. */
-        sockbase->flags |= NN_SOCK_FLAG_CLOSING;
+    /*  Create a semaphore to wait on for all endpoint to terminate. */
+    nn_sem_init (&self->termsem);
+    nn_sem_init (&self->servesem);
 
-        /*  Close sndfd and rcvfd. This should make any current select/poll
-            using SNDFD and/or RCVFD exit. */
-        if (!(sockbase->vfptr->flags & NN_SOCKBASE_FLAG_NORECV)) {
-            nn_efd_term (&sockbase->rcvfd);
-            memset (&sockbase->rcvfd, 0xcd, sizeof (sockbase->rcvfd));
-        }
-        if (!(sockbase->vfptr->flags & NN_SOCKBASE_FLAG_NOSEND)) {
-            nn_efd_term (&sockbase->sndfd);
-            memset (&sockbase->sndfd, 0xcd, sizeof (sockbase->sndfd));
-        }
+    /*  Ask all the associated endpoints to terminate. Call to nn_ep_close
+        can actually deallocate the endpoint, so take care to get pointer
+        to the next endpoint before the call. */
+    it = nn_list_begin (&self->eps);
+    while (it != nn_list_end (&self->eps)) {
+        ep = nn_cont (it, struct nn_epbase, item);
+        it = nn_list_next (&self->eps, it);
+        rc = nn_ep_close ((void*) ep);
+        errnum_assert (rc == 0 || rc == -EINPROGRESS, -rc);
+    }
+}
 
-        /*  Create a semaphore to wait on for all endpoint to terminate. */
-        nn_sem_init (&sockbase->termsem);
+int nn_sock_close_async (struct nn_sock *self, void (*fn) (void *arg),
+    void *arg)
+{
+    struct nn_sockbase *sockbase;
 
-        /*  Ask all the associated endpoints to terminate. Call to nn_ep_close
-            can actually deallocate the endpoint, so take care to get pointer
-            to the next endpoint before the call. */
-        it = nn_list_begin (&sockbase->eps);
-        while (it != nn_list_end (&sockbase->eps)) {
-            ep = nn_cont (it, struct nn_epbase, item);
-            it = nn_list_next (&sockbase->eps, it);
-            rc = nn_ep_close ((void*) ep);
-            errnum_assert (rc == 0 || rc == -EINPROGRESS, -rc);      
-        }
+    sockbase = (struct nn_sockbase*) self;
+
+    nn_cp_lock (sockbase->cp);
+    nn_sock_start_closing (sockbase);
+
+    /*  With an external completion port, the endpoints can only terminate
+        while nn_sock_destroy processes the I/O events. The handler threads
+        of nn_serve can only be waited for by nn_sock_destroy as well. */
+    if (nn_list_empty (&sockbase->eps) || nn_cp_isexternal (sockbase->cp) ||
+          nn_atomic_load (&sockbase->handlers) > 0) {
+        nn_cp_unlock (sockbase->cp);
+        return 0;
     }
+    sockbase->closed = fn;
+    sockbase->closedarg = arg;
+    nn_cp_unlock (sockbase->cp);
+    return -EINPROGRESS;
+}
+
+int nn_sock_destroy (struct nn_sock *self)
+{
+    int rc;
+    int i;
+    uint32_t handlers;
+    struct nn_sockbase *sockbase;
+
+    sockbase = (struct nn_sockbase*) self;
+
+    nn_cp_lock (sockbase->cp);
+
+    /*  The call may have been interrupted by a singal and restarted afterwards.
+        In such case the shutdown was already started. */
+    nn_sock_start_closing (sockbase);
 
     /*  Shutdown process was already started but some endpoints are still
         alive. Here we are going to wait till they are all closed. */
     if (!nn_list_empty (&sockbase->eps)) {
-        nn_cp_unlock (&sockbase->cp);
-        rc = nn_sem_wait (&sockbase->termsem);
+        nn_cp_unlock (sockbase->cp);
+        if (nn_cp_isexternal (sockbase->cp)) {
+
+            /*  Nobody else may be processing the I/O events. The endpoints
+                can be terminated only if it's done here. */
+            while (1) {
+                rc = nn_cp_process (sockbase->cp, -1);
+                if (nn_slow (rc == -EINTR))
+                    return -EINTR;
+                nn_cp_lock (sockbase->cp);
+                if (nn_list_empty (&sockbase->eps))
+                    break;
+                nn_cp_unlock (sockbase->cp);
+            }
+            rc = nn_sem_wait (&sockbase->termsem);
+            errnum_assert (rc == 0, -rc);
+        }
+        else {
+            rc = nn_sem_wait (&sockbase->termsem);
+            if (nn_slow (rc == -EINTR))
+                return -EINTR;
+            errnum_assert (rc == 0, -rc);
+            nn_cp_lock (sockbase->cp);
+        }
+        nn_assert (nn_list_empty (&sockbase->eps));
+    }
+
+    /*  The handler threads of nn_serve were woken up with ETERM, wait till
+        they leave the socket. The last one to leave posts servesem, which
+        is the last time it touches the socket. */
+    handlers = nn_atomic_load (&sockbase->handlers);
+    if (!(handlers & NN_SOCK_HANDLERS_WAITED))
+        handlers = nn_atomic_inc (&sockbase->handlers,
+            NN_SOCK_HANDLERS_WAITED);
+    if (handlers & ~NN_SOCK_HANDLERS_WAITED) {
+        nn_cp_unlock (sockbase->cp);
+        rc = nn_sem_wait (&sockbase->servesem);
         if (nn_slow (rc == -EINTR))
             return -EINTR;
         errnum_assert (rc == 0, -rc);
-        nn_cp_lock (&sockbase->cp);
-        nn_assert (nn_list_empty (&sockbase->eps));
+        nn_cp_lock (sockbase->cp);
     }
 
     /*  Deallocation of the socket is done by asking the derived class
         to deallocate. Derived class, in turn will terminate the sockbase
         class. */
     nn_sem_term (&sockbase->termsem);
+    nn_sem_term (&sockbase->servesem);
+
+    /*  Close the contexts the user haven't closed. */
+    for (i = 0; i != sockbase->nctxs; ++i)
+        if (sockbase->ctxs [i])
+            sockbase->vfptr->ctxclose (sockbase, sockbase->ctxs [i]);
+    if (sockbase->ctxs)
+        nn_free (sockbase->ctxs);
+
     sockbase->vfptr->destroy (sockbase);
     /*  At this point the socket is already deallocated, make sure
         that it is not used here any more. */
@@ -210,20 +405,45 @@ int nn_sock_destroy (struct nn_sock *self)
 void nn_sockbase_term (struct nn_sockbase *self)
 {
     int i;
+    struct nn_rcvwaiter *waiter;
 
     nn_assert (self->flags & NN_SOCK_FLAG_CLOSING);
 
     /*  The lock was done in nn_sock_destroy function. */
-    nn_cp_unlock (&self->cp);
+    nn_cp_unlock (self->cp);
 
     /*  Destroy any optsets associated with the socket. */
     for (i = 0; i != NN_MAX_TRANSPORT; ++i)
         if (self->optsets [i])
             self->optsets [i]->vfptr->destroy (self->optsets [i]);
 
+    if (self->capture)
+        nn_capture_close (self->capture);
+    nn_budget_term (&self->budget);
+    nn_atomic_term (&self->ready);
+    nn_atomic_term (&self->handlers);
+    nn_atomic_term (&self->handling);
+    nn_atomic64_term (&self->handled);
+    while (!nn_list_empty (&self->rcvidle)) {
+        waiter = nn_cont (nn_list_begin (&self->rcvidle),
+            struct nn_rcvwaiter, item);
+        nn_list_erase (&self->rcvidle, &waiter->item);
+        nn_list_item_term (&waiter->item);
+        nn_efd_term (&waiter->efd);
+        nn_free (waiter);
+    }
+    nn_list_term (&self->rcvidle);
+    nn_list_term (&self->rcvwaitq);
+    nn_list_term (&self->deferred);
+    nn_list_term (&self->rcvops);
+    nn_list_term (&self->sndops);
+    nn_list_term (&self->pollers);
     nn_list_term (&self->eps);
     nn_clock_term (&self->clock);
-    nn_cp_term (&self->cp);
+    if (self->flags & NN_SOCK_FLAG_OWNCP) {
+        nn_cp_term (self->cp);
+        nn_free (self->cp);
+    }
 }
 
 void nn_sock_postinit (struct nn_sock *self, int domain, int protocol)
@@ -245,17 +465,83 @@ void nn_sockbase_changed (struct nn_sockbase *self)
 
 struct nn_cp *nn_sockbase_getcp (struct nn_sockbase *self)
 {
-    return &self->cp;
+    return self->cp;
+}
+
+void nn_sockbase_dropped (struct nn_sockbase *self, size_t size)
+{
+    ++self->stats.dropped;
+    self->stats.droppedbytes += size;
+}
+
+void nn_sockbase_shed (struct nn_sockbase *self, size_t size)
+{
+    ++self->stats.shed;
+    self->stats.shedbytes += size;
+}
+
+void nn_sockbase_evicted (struct nn_sockbase *self)
+{
+    ++self->stats.evicted;
+}
+
+uint64_t nn_sock_now (struct nn_sock *self)
+{
+    return nn_clock_now (&((struct nn_sockbase*) self)->clock);
+}
+
+int nn_sock_expired (struct nn_sock *self, struct nn_msg *msg)
+{
+    struct nn_sockbase *sockbase;
+
+    if (nn_fast (!msg->deadline))
+        return 0;
+    sockbase = (struct nn_sockbase*) self;
+    if (nn_clock_now (&sockbase->clock) <= msg->deadline)
+        return 0;
+    ++sockbase->stats.expired;
+    sockbase->stats.expiredbytes += nn_msg_bodysize (msg);
+    return 1;
+}
+
+int nn_sock_defer (struct nn_sock *self,
+    struct nn_pipebase_deferred *deferred)
+{
+    struct nn_sockbase *sockbase;
+
+    sockbase = (struct nn_sockbase*) self;
+    if (!(sockbase->flags & NN_SOCK_FLAG_DEFER))
+        return 0;
+    if (!nn_list_item_isinlist (&deferred->item))
+        nn_list_insert (&sockbase->deferred, &deferred->item,
+            nn_list_end (&sockbase->deferred));
+    return 1;
 }
 
 struct nn_cp *nn_sock_getcp (struct nn_sock *self)
 {
-    return &((struct nn_sockbase*) self)->cp;
+    return ((struct nn_sockbase*) self)->cp;
+}
+
+int nn_sock_ownscp (struct nn_sock *self)
+{
+    return ((struct nn_sockbase*) self)->flags & NN_SOCK_FLAG_OWNCP ? 1 : 0;
 }
 
 struct nn_worker *nn_sock_choose_worker (struct nn_sock *self)
 {
-    return nn_global_choose_worker ();
+    struct nn_sockbase *sockbase;
+
+    sockbase = (struct nn_sockbase*) self;
+    return nn_global_choose_worker (sockbase->numa ? sockbase->node : -1);
+}
+
+struct nn_budget *nn_sock_getbudget (struct nn_sock *self)
+{
+    struct nn_sockbase *sockbase;
+
+    sockbase = (struct nn_sockbase*) self;
+    return sockbase->membudget ? &sockbase->budget : NULL;
 }
 
 int nn_sock_ispeer (struct nn_sock *self, int socktype)
@@ -285,21 +571,31 @@ int nn_sock_setopt (struct nn_sock *self, int level, int option,
 
     sockbase = (struct nn_sockbase*) self;
 
-    nn_cp_lock (&sockbase->cp);
+    nn_cp_lock (sockbase->cp);
 
     /*  If nn_term() was already called, return ETERM. */
     if (nn_slow (sockbase->flags &
           (NN_SOCK_FLAG_ZOMBIE | NN_SOCK_FLAG_CLOSING))) {
-        nn_cp_unlock (&sockbase->cp);
+        nn_cp_unlock (sockbase->cp);
         return -ETERM;
     }
 
+    /*  Protocol-specific socket options the socket handles unlocked. */
+    if (level > NN_SOL_SOCKET && sockbase->vfptr->setoptunlocked) {
+        nn_cp_unlock (sockbase->cp);
+        rc = sockbase->vfptr->setoptunlocked (sockbase, level, option,
+            optval, optvallen);
+        if (rc != -ENOPROTOOPT)
+            return rc;
+        nn_cp_lock (sockbase->cp);
+    }
+
     /*  Protocol-specific socket options. */
     if (level > NN_SOL_SOCKET) {
         rc = sockbase->vfptr->setopt (sockbase, level, option,
             optval, optvallen);
         nn_sockbase_adjust_events (sockbase);
-        nn_cp_unlock (&sockbase->cp);
+        nn_cp_unlock (sockbase->cp);
         return rc;
     }
 
@@ -307,17 +603,32 @@ int nn_sock_setopt (struct nn_sock *self, int level, int option,
     if (level < NN_SOL_SOCKET) {
         optset = nn_sockbase_optset (sockbase, level);
         if (!optset) {
-            nn_cp_unlock (&sockbase->cp);
+            nn_cp_unlock (sockbase->cp);
             return -ENOPROTOOPT;
         }
         rc = optset->vfptr->setopt (optset, option, optval, optvallen);
-        nn_cp_unlock (&sockbase->cp);
+        nn_cp_unlock (sockbase->cp);
+        return rc;
+    }
+
+    /*  The capture file is specified by its path. The previous capture,
+        if any, is finished first. Empty path just finishes it. */
+    if (level == NN_SOL_SOCKET && option == NN_CAPTURE) {
+        if (sockbase->capture) {
+            nn_capture_close (sockbase->capture);
+            sockbase->capture = NULL;
+        }
+        rc = 0;
+        if (optvallen)
+            rc = nn_capture_open (&sockbase->capture, (const char*) optval,
+                optvallen, sockbase->protocol);
+        nn_cp_unlock (sockbase->cp);
         return rc;
     }
 
     /*  At this point we assume that all options are of type int. */
     if (optvallen != sizeof (int)) {
-        nn_cp_unlock (&sockbase->cp);
+        nn_cp_unlock (sockbase->cp);
         return -EINVAL;
     }
     val = *(int*) optval;
@@ -330,14 +641,14 @@ int nn_sock_setopt (struct nn_sock *self, int level, int option,
             break;
         case NN_SNDBUF:
             if (nn_slow (val <= 0)) {
-                nn_cp_unlock (&sockbase->cp);
+                nn_cp_unlock (sockbase->cp);
                 return -EINVAL;
             }
             dst = &sockbase->sndbuf;
             break;
         case NN_RCVBUF:
             if (nn_slow (val <= 0)) {
-                nn_cp_unlock (&sockbase->cp);
+                nn_cp_unlock (sockbase->cp);
                 return -EINVAL;
             }
             dst = &sockbase->rcvbuf;
@@ -345,36 +656,216 @@ int nn_sock_setopt (struct nn_sock *self, int level, int option,
         case NN_SNDTIMEO:
             dst = &sockbase->sndtimeo;
             break;
+        case NN_SNDTTL:
+            dst = &sockbase->sndttl;
+            break;
         case NN_RCVTIMEO:
             dst = &sockbase->rcvtimeo;
             break;
         case NN_RECONNECT_IVL:
             if (nn_slow (val < 0)) {
-                nn_cp_unlock (&sockbase->cp);
+                nn_cp_unlock (sockbase->cp);
                 return -EINVAL;
             }
             dst = &sockbase->reconnect_ivl;
             break;
         case NN_RECONNECT_IVL_MAX:
             if (nn_slow (val < 0)) {
-                nn_cp_unlock (&sockbase->cp);
+                nn_cp_unlock (sockbase->cp);
                 return -EINVAL;
             }
             dst = &sockbase->reconnect_ivl_max;
             break;
+        case NN_RECONNECT_JITTER:
+            if (nn_slow (val < NN_JITTER_NONE ||
+                  val > NN_JITTER_DECORRELATED)) {
+                nn_cp_unlock (sockbase->cp);
+                return -EINVAL;
+            }
+            dst = &sockbase->reconnect_jitter;
+            break;
         case NN_SNDPRIO:
             if (nn_slow (val < 1 || val > 16)) {
-                nn_cp_unlock (&sockbase->cp);
+                nn_cp_unlock (sockbase->cp);
                 return -EINVAL;
             }
             dst = &sockbase->sndprio;
             break;
+        case NN_RCVPRIO:
+            if (nn_slow (val < 1 || val > 16)) {
+                nn_cp_unlock (sockbase->cp);
+                return -EINVAL;
+            }
+            dst = &sockbase->rcvprio;
+            break;
+        case NN_HANDSHAKE_TIMEOUT:
+            if (nn_slow (val <= 0 && val != -1)) {
+                nn_cp_unlock (sockbase->cp);
+                return -EINVAL;
+            }
+            dst = &sockbase->handshake_timeout;
+            break;
+        case NN_SNDSPIN:
+            if (nn_slow (val < 0)) {
+                nn_cp_unlock (sockbase->cp);
+                return -EINVAL;
+            }
+            dst = &sockbase->sndspin;
+            break;
+        case NN_RCVSPIN:
+            if (nn_slow (val < 0)) {
+                nn_cp_unlock (sockbase->cp);
+                return -EINVAL;
+            }
+            dst = &sockbase->rcvspin;
+            break;
+        case NN_SNDWEIGHT:
+            if (nn_slow (val < 1 || val > 1000)) {
+                nn_cp_unlock (sockbase->cp);
+                return -EINVAL;
+            }
+            dst = &sockbase->sndweight;
+            break;
+        case NN_RCVQUANTUM:
+            if (nn_slow (val < 1 || val > 1000)) {
+                nn_cp_unlock (sockbase->cp);
+                return -EINVAL;
+            }
+            dst = &sockbase->rcvquantum;
+            break;
+        case NN_SNDLOWAT:
+            if (nn_slow (val < -1)) {
+                nn_cp_unlock (sockbase->cp);
+                return -EINVAL;
+            }
+            dst = &sockbase->sndlowat;
+            break;
+        case NN_SNDBUFMSGS:
+            if (nn_slow (val < 0)) {
+                nn_cp_unlock (sockbase->cp);
+                return -EINVAL;
+            }
+            dst = &sockbase->sndbufmsgs;
+            break;
+        case NN_RCVBUFMSGS:
+            if (nn_slow (val < 0)) {
+                nn_cp_unlock (sockbase->cp);
+                return -EINVAL;
+            }
+            dst = &sockbase->rcvbufmsgs;
+            break;
+        case NN_SNDLOWATMSGS:
+            if (nn_slow (val < -1)) {
+                nn_cp_unlock (sockbase->cp);
+                return -EINVAL;
+            }
+            dst = &sockbase->sndlowatmsgs;
+            break;
+        case NN_RCVTIMESTAMP:
+            dst = &sockbase->rcvtimestamp;
+            val = val ? 1 : 0;
+            break;
+        case NN_RCVCHUNKS:
+            if (nn_slow (val && !(sockbase->vfptr->flags &
+                  NN_SOCKBASE_FLAG_PASSTHROUGH))) {
+                nn_cp_unlock (sockbase->cp);
+                return -ENOTSUP;
+            }
+            dst = &sockbase->rcvchunks;
+            val = val ? 1 : 0;
+            break;
+        case NN_RCVALLOC:
+            if (nn_slow (val != NN_ALLOC_DEFAULT && val != NN_ALLOC_POOL &&
+                  (val < NN_ALLOC_USER || val >= NN_ALLOC_MAX))) {
+                nn_cp_unlock (sockbase->cp);
+                return -EINVAL;
+            }
+            dst = &sockbase->rcvalloc;
+            break;
+        case NN_SNDBATCH:
+            if (nn_slow (val < 0)) {
+                nn_cp_unlock (sockbase->cp);
+                return -EINVAL;
+            }
+            dst = &sockbase->sndbatch;
+            break;
+        case NN_SNDBATCHBYTES:
+            if (nn_slow (val < 0)) {
+                nn_cp_unlock (sockbase->cp);
+                return -EINVAL;
+            }
+            dst = &sockbase->sndbatchbytes;
+            break;
+        case NN_BGCLOSE:
+            dst = &sockbase->bgclose;
+            val = val ? 1 : 0;
+            break;
+        case NN_TRACECTX:
+            dst = &sockbase->tracectx;
+            val = val ? 1 : 0;
+            break;
+        case NN_SINGLE_THREADED:
+
+            /*  The IN and OUT bits are relied upon without the socket locked
+                from now on. Make sure they are up to date even if nothing
+                has happened on the socket so far. */
+            nn_sockbase_update_events (sockbase);
+            dst = &sockbase->singlethreaded;
+            val = val ? 1 : 0;
+            break;
+        case NN_CODEL_TARGET:
+            if (nn_slow (val < -1)) {
+                nn_cp_unlock (sockbase->cp);
+                return -EINVAL;
+            }
+            if (nn_slow (val >= 0 && !(sockbase->vfptr->flags &
+                  NN_SOCKBASE_FLAG_LOSSY))) {
+                nn_cp_unlock (sockbase->cp);
+                return -ENOTSUP;
+            }
+            dst = &sockbase->codeltarget;
+            break;
+        case NN_CODEL_INTERVAL:
+            if (nn_slow (val <= 0)) {
+                nn_cp_unlock (sockbase->cp);
+                return -EINVAL;
+            }
+            dst = &sockbase->codelinterval;
+            break;
+        case NN_HEARTBEAT_IVL:
+            if (nn_slow (val < 0)) {
+                nn_cp_unlock (sockbase->cp);
+                return -EINVAL;
+            }
+            dst = &sockbase->heartbeat_ivl;
+            break;
+        case NN_HEARTBEAT_MISSES:
+            if (nn_slow (val < 1)) {
+                nn_cp_unlock (sockbase->cp);
+                return -EINVAL;
+            }
+            dst = &sockbase->heartbeat_misses;
+            break;
+        case NN_MEMBUDGET:
+            if (nn_slow (val < 0)) {
+                nn_cp_unlock (sockbase->cp);
+                return -EINVAL;
+            }
+            dst = &sockbase->membudget;
+            nn_budget_setmax (&sockbase->budget, val);
+            break;
+        case NN_NUMA:
+            dst = &sockbase->numa;
+            val = val ? 1 : 0;
+            if (sockbase->flags & NN_SOCK_FLAG_OWNCP)
+                nn_cp_setnode (sockbase->cp, val ? sockbase->node : -1);
+            break;
         default:
-            nn_cp_unlock (&sockbase->cp);
+            nn_cp_unlock (sockbase->cp);
             return -ENOPROTOOPT;
         }
         *dst = val;
-        nn_cp_unlock (&sockbase->cp);
+        nn_cp_unlock (sockbase->cp);
         return 0;
     }
 
@@ -388,17 +879,19 @@ int nn_sock_getopt (struct nn_sock *self, int level, int option,
     struct nn_sockbase *sockbase;
     struct nn_optset *optset;
     int intval;
+    size_t sz;
     nn_fd fd;
+    struct nn_cp_stats cpstats;
 
     sockbase = (struct nn_sockbase*) self;
 
     if (!internal)
-        nn_cp_lock (&sockbase->cp);
+        nn_cp_lock (sockbase->cp);
 
     /*  If nn_term() was already called, return ETERM. */
     if (!internal && nn_slow (sockbase->flags &
           (NN_SOCK_FLAG_ZOMBIE | NN_SOCK_FLAG_CLOSING))) {
-        nn_cp_unlock (&sockbase->cp);
+        nn_cp_unlock (sockbase->cp);
         return -ETERM;
     }
 
@@ -423,6 +916,9 @@ int nn_sock_getopt (struct nn_sock *self, int level, int option,
         case NN_SNDTIMEO:
             intval = sockbase->sndtimeo;
             break;
+        case NN_SNDTTL:
+            intval = sockbase->sndttl;
+            break;
         case NN_RCVTIMEO:
             intval = sockbase->rcvtimeo;
             break;
@@ -432,45 +928,165 @@ int nn_sock_getopt (struct nn_sock *self, int level, int option,
         case NN_RECONNECT_IVL_MAX:
             intval = sockbase->reconnect_ivl_max;
             break;
+        case NN_RECONNECT_JITTER:
+            intval = sockbase->reconnect_jitter;
+            break;
         case NN_SNDPRIO:
             intval = sockbase->sndprio;
             break;
+        case NN_RCVPRIO:
+            intval = sockbase->rcvprio;
+            break;
+        case NN_HANDSHAKE_TIMEOUT:
+            intval = sockbase->handshake_timeout;
+            break;
+        case NN_SNDSPIN:
+            intval = sockbase->sndspin;
+            break;
+        case NN_RCVSPIN:
+            intval = sockbase->rcvspin;
+            break;
+        case NN_SNDWEIGHT:
+            intval = sockbase->sndweight;
+            break;
+        case NN_RCVQUANTUM:
+            intval = sockbase->rcvquantum;
+            break;
+        case NN_SNDLOWAT:
+            intval = sockbase->sndlowat;
+            break;
+        case NN_SNDBUFMSGS:
+            intval = sockbase->sndbufmsgs;
+            break;
+        case NN_RCVBUFMSGS:
+            intval = sockbase->rcvbufmsgs;
+            break;
+        case NN_SNDLOWATMSGS:
+            intval = sockbase->sndlowatmsgs;
+            break;
+        case NN_RCVTIMESTAMP:
+            intval = sockbase->rcvtimestamp;
+            break;
+        case NN_RCVCHUNKS:
+            intval = sockbase->rcvchunks;
+            break;
+        case NN_RCVALLOC:
+            intval = sockbase->rcvalloc;
+            break;
+        case NN_SNDBATCH:
+            intval = sockbase->sndbatch;
+            break;
+        case NN_SNDBATCHBYTES:
+            intval = sockbase->sndbatchbytes;
+            break;
+        case NN_BGCLOSE:
+            intval = sockbase->bgclose;
+            break;
+        case NN_TRACECTX:
+            intval = sockbase->tracectx;
+            break;
+        case NN_SINGLE_THREADED:
+            intval = sockbase->singlethreaded;
+            break;
+        case NN_CODEL_TARGET:
+            intval = sockbase->codeltarget;
+            break;
+        case NN_CODEL_INTERVAL:
+            intval = sockbase->codelinterval;
+            break;
+        case NN_NUMA:
+            intval = sockbase->numa;
+            break;
+        case NN_HEARTBEAT_IVL:
+            intval = sockbase->heartbeat_ivl;
+            break;
+        case NN_HEARTBEAT_MISSES:
+            intval = sockbase->heartbeat_misses;
+            break;
+        case NN_MEMBUDGET:
+            intval = sockbase->membudget;
+            break;
+        case NN_CAPTURE:
+            sz = sockbase->capture ?
+                strlen (nn_capture_path (sockbase->capture)) : 0;
+            if (sz)
+                memcpy (optval, nn_capture_path (sockbase->capture),
+                    *optvallen < sz ? *optvallen : sz);
+            *optvallen = sz;
+            if (!internal)
+                nn_cp_unlock (sockbase->cp);
+            return 0;
+        case NN_STATS:
+            sockbase->stats.memused = nn_budget_used (&sockbase->budget);
+            sockbase->stats.memwaits = nn_budget_waits (&sockbase->budget);
+            nn_cp_getstats (sockbase->cp, &cpstats);
+            sockbase->stats.iowait = cpstats.wait / 1000;
+            sockbase->stats.iolock = cpstats.lock / 1000;
+            sockbase->stats.iotimers = cpstats.timers / 1000;
+            sockbase->stats.io = cpstats.io / 1000;
+            sockbase->stats.ioevents = cpstats.events / 1000;
+            sockbase->stats.ioops = cpstats.ops / 1000;
+            sockbase->stats.handlers = nn_atomic_load (&sockbase->handlers) &
+                ~NN_SOCK_HANDLERS_WAITED;
+            sockbase->stats.handling = nn_atomic_load (&sockbase->handling);
+            sockbase->stats.handled = nn_atomic64_load (&sockbase->handled);
+            memcpy (optval, &sockbase->stats,
+                *optvallen < sizeof (sockbase->stats) ?
+                *optvallen : sizeof (sockbase->stats));
+            *optvallen = sizeof (sockbase->stats);
+            if (!internal)
+                nn_cp_unlock (sockbase->cp);
+            return 0;
         case NN_SNDFD:
             if (sockbase->vfptr->flags & NN_SOCKBASE_FLAG_NOSEND) {
                 if (!internal)
-                    nn_cp_unlock (&sockbase->cp);
+                    nn_cp_unlock (sockbase->cp);
                 return -ENOPROTOOPT;
             }
+            sockbase->flags |= NN_SOCK_FLAG_SNDFD;
+            nn_sockbase_sync_efds (sockbase);
             fd = nn_efd_getfd (&sockbase->sndfd);
+            if (nn_slow (fd == (nn_fd) -1)) {
+                if (!internal)
+                    nn_cp_unlock (sockbase->cp);
+                return -EMFILE;
+            }
             memcpy (optval, &fd,
                 *optvallen < sizeof (nn_fd) ? *optvallen : sizeof (nn_fd));
             *optvallen = sizeof (nn_fd);
             if (!internal)
-                nn_cp_unlock (&sockbase->cp);
+                nn_cp_unlock (sockbase->cp);
             return 0;
         case NN_RCVFD:
             if (sockbase->vfptr->flags & NN_SOCKBASE_FLAG_NORECV) {
                 if (!internal)
-                    nn_cp_unlock (&sockbase->cp);
+                    nn_cp_unlock (sockbase->cp);
                 return -ENOPROTOOPT;
             }
+            sockbase->flags |= NN_SOCK_FLAG_RCVFD;
+            nn_sockbase_sync_efds (sockbase);
             fd = nn_efd_getfd (&sockbase->rcvfd);
+            if (nn_slow (fd == (nn_fd) -1)) {
+                if (!internal)
+                    nn_cp_unlock (sockbase->cp);
+                return -EMFILE;
+            }
             memcpy (optval, &fd,
                 *optvallen < sizeof (nn_fd) ? *optvallen : sizeof (nn_fd));
             *optvallen = sizeof (nn_fd);
             if (!internal)
-                nn_cp_unlock (&sockbase->cp);
+                nn_cp_unlock (sockbase->cp);
             return 0;
         default:
             if (!internal)
-                nn_cp_unlock (&sockbase->cp);
+                nn_cp_unlock (sockbase->cp);
             return -ENOPROTOOPT;
         }
         memcpy (optval, &intval,
             *optvallen < sizeof (int) ? *optvallen : sizeof (int));
         *optvallen = sizeof (int);
         if (!internal)
-            nn_cp_unlock (&sockbase->cp);
+            nn_cp_unlock (sockbase->cp);
         return 0;
     }
 
@@ -480,7 +1096,7 @@ int nn_sock_getopt (struct nn_sock *self, int level, int option,
             optval, optvallen);
         nn_sockbase_adjust_events (sockbase);
         if (!internal)
-            nn_cp_unlock (&sockbase->cp);
+            nn_cp_unlock (sockbase->cp);
         return rc;
     }
 
@@ -489,118 +1105,401 @@ int nn_sock_getopt (struct nn_sock *self, int level, int option,
         optset = nn_sockbase_optset (sockbase, level);
         if (!optset) {
             if (!internal)
-                nn_cp_unlock (&sockbase->cp);
+                nn_cp_unlock (sockbase->cp);
             return -ENOPROTOOPT;
         }
         rc = optset->vfptr->getopt (optset, option, optval, optvallen);
         if (!internal)
-            nn_cp_unlock (&sockbase->cp);
+            nn_cp_unlock (sockbase->cp);
         return rc;
     }
 
     nn_assert (0);
 }
 
-int nn_sock_add_ep (struct nn_sock *self, const char *addr,
+int nn_sock_add_ep (struct nn_sock *self, const char *addr, int addrlist,
+    int transport,
     int (*factory) (const char *addr, void *hint, struct nn_epbase **ep))
 {
     int rc;
     struct nn_sockbase *sockbase;
     struct nn_epbase *ep;
     int eid;
+    const char *end;
+    size_t len;
+    char buf [NN_SOCKADDR_MAX];
     
     sockbase = (struct nn_sockbase*) self;
 
-    nn_cp_lock (&sockbase->cp);
+    /*  Check the syntax of the address list before creating any endpoints. */
+    if (addrlist) {
+        for (end = addr; ; ++end) {
+            len = strcspn (end, ",");
+            if (nn_slow (len == 0))
+                return -EINVAL;
+            if (nn_slow (len >= NN_SOCKADDR_MAX))
+                return -ENAMETOOLONG;
+            end += len;
+            if (!*end)
+                break;
+        }
+    }
 
-    /*  Create the transport-specific endpoint. */
-    rc = factory (addr, (void*) self, &ep);
-    if (nn_slow (rc < 0)) {
-        nn_cp_unlock (&sockbase->cp);
+    /*  The endpoints are going to need the worker thread of the completion
+        port. If it can't be created, say so here rather than failing later
+        on. */
+    rc = nn_cp_start (sockbase->cp);
+    if (nn_slow (rc < 0))
         return rc;
+
+    nn_cp_lock (sockbase->cp);
+
+    /*  Create the transport-specific endpoints. They get the next endpoint
+        ID. It was already filled in by nn_epbase_init. */
+    eid = sockbase->eid;
+    rc = 0;
+    while (1) {
+        len = addrlist ? strcspn (addr, ",") : strlen (addr);
+        nn_assert (len < NN_SOCKADDR_MAX);
+        memcpy (buf, addr, len);
+        buf [len] = 0;
+        rc = factory (buf, (void*) self, &ep);
+        if (nn_slow (rc < 0))
+            break;
+        nn_assert (ep->eid == eid);
+        ep->transport = transport;
+
+        /*  Add it to the list of active endpoints. */
+        nn_list_insert (&sockbase->eps, &ep->item,
+            nn_list_end (&sockbase->eps));
+
+        addr += len;
+        if (!*addr)
+            break;
+        ++addr;
     }
 
-    /*  Provide it with an unique endpoint ID. */
-    eid = ep->eid = sockbase->eid;
+    /*  The endpoint ID is used up even if some of the endpoints could not be
+        created. Those that were created are closed in such case. */
     ++sockbase->eid;
+    if (nn_slow (rc < 0)) {
+        nn_sock_close_eps (self, eid);
+        nn_cp_unlock (sockbase->cp);
+        return rc;
+    }
 
-    /*  Add it to the list of active endpoints. */
-    nn_list_insert (&sockbase->eps, &ep->item, nn_list_end (&sockbase->eps));
-
-    nn_cp_unlock (&sockbase->cp);
+    nn_cp_unlock (sockbase->cp);
 
     return eid;
 }
 
 int nn_sock_rm_ep (struct nn_sock *self, int eid)
 {
-    int rc;
+    int found;
     struct nn_sockbase *sockbase;
-    struct nn_list_item *it;
-    struct nn_epbase *ep;
     
     sockbase = (struct nn_sockbase*) self;
 
-    nn_cp_lock (&sockbase->cp);
-
-    /*  Find the specified enpoint. */
-    ep = NULL;
-    for (it = nn_list_begin (&sockbase->eps);
-          it != nn_list_end (&sockbase->eps);
-          it = nn_list_next (&sockbase->eps, it)) {
-        ep = nn_cont (it, struct nn_epbase, item);
-        if (ep->eid == eid)
-            break;
-        ep = NULL;
-    }
+    nn_cp_lock (sockbase->cp);
+    found = nn_sock_close_eps (self, eid);
+    nn_cp_unlock (sockbase->cp);
 
     /*  The endpoint doesn't exist. */
-    if (!ep) {
-        nn_cp_unlock (&sockbase->cp);
+    if (!found)
         return -EINVAL;
-    }
-    
-    /*  Ask the endpoint to shutdown. Actual terminatation may be delayed
-        by the transport. */
-    rc = nn_ep_close ((void*) ep);
-    errnum_assert (rc == 0 || rc == -EINPROGRESS, -rc);
-
-    nn_cp_unlock (&sockbase->cp);
 
     return 0;
 }
 
-void nn_sock_ep_closed (struct nn_sock *self, struct nn_epbase *ep)
+int nn_sock_serving (struct nn_sock *self, int handlers, int handling)
 {
     struct nn_sockbase *sockbase;
 
     sockbase = (struct nn_sockbase*) self;
 
-    /*  Remove the endpoint from the list of active endpoints. */
-    nn_list_erase (&sockbase->eps, &ep->item);
+    if (handling > 0)
+        nn_atomic_inc (&sockbase->handling, 1);
+    else if (handling < 0) {
+        nn_atomic_dec (&sockbase->handling, 1);
+        nn_atomic64_inc (&sockbase->handled, 1);
+    }
+
+    /*  The handler threads join with the socket locked, so that they can't
+        join once nn_sock_destroy has started waiting for them. */
+    if (handlers > 0) {
+        nn_cp_lock (sockbase->cp);
+        if (nn_slow (sockbase->flags &
+              (NN_SOCK_FLAG_ZOMBIE | NN_SOCK_FLAG_CLOSING))) {
+            nn_cp_unlock (sockbase->cp);
+            return -ETERM;
+        }
+        nn_atomic_inc (&sockbase->handlers, handlers);
+        nn_cp_unlock (sockbase->cp);
+    }
+
+    /*  Leaving doesn't lock the socket. Once a handler has left, the socket
+        may be deallocated, so it must not be touched any more. */
+    else if (handlers < 0 && nn_atomic_dec (&sockbase->handlers,
+          (uint32_t) -handlers) == (NN_SOCK_HANDLERS_WAITED | (uint32_t) -handlers))
+        nn_sem_post (&sockbase->servesem);
+
+    return 0;
+}
+
+int nn_sock_handoff (struct nn_sock *self, int fd)
+{
+    int rc;
+    int count;
+    struct nn_sockbase *sockbase;
+    struct nn_list_item *it;
+    struct nn_epbase *ep;
+
+    sockbase = (struct nn_sockbase*) self;
+
+    /*  The endpoints are passed over and closed without releasing the lock
+        in between, so that the worker thread reads no more data from
+        the connections that were passed over. Call to nn_ep_close can
+        deallocate the endpoint, so take care to get pointer to the next
+        endpoint before the call. */
+    nn_cp_lock (sockbase->cp);
+    count = 0;
+    it = nn_list_begin (&sockbase->eps);
+    while (it != nn_list_end (&sockbase->eps)) {
+        ep = nn_cont (it, struct nn_epbase, item);
+        it = nn_list_next (&sockbase->eps, it);
+        if (!ep->vfptr->handoff)
+            continue;
+        rc = ep->vfptr->handoff (ep, fd);
+        if (nn_slow (rc < 0)) {
+            nn_cp_unlock (sockbase->cp);
+            return rc;
+        }
+        if (rc == 0)
+            continue;
+        rc = nn_ep_close ((void*) ep);
+        errnum_assert (rc == 0 || rc == -EINPROGRESS, -rc);
+        ++count;
+    }
+    nn_cp_unlock (sockbase->cp);
+
+    rc = nn_handoff_send (fd, NN_HANDOFF_END, NULL, 0, NULL, 0);
+    if (nn_slow (rc < 0))
+        return rc;
+
+    return count;
+}
+
+int nn_sock_adopt (struct nn_sock *self, int fd)
+{
+    int rc;
+    int err;
+    int type;
+    int count;
+    int nfds;
+    size_t len;
+    int fds [NN_HANDOFF_MAXFDS];
+    uint8_t buf [NN_HANDOFF_MAXDATA + 1];
+    struct nn_sockbase *sockbase;
+    struct nn_transport *tp;
+    struct nn_epbase *ep;
+
+    sockbase = (struct nn_sockbase*) self;
+
+    rc = nn_cp_start (sockbase->cp);
+    if (nn_slow (rc < 0))
+        return rc;
+
+    /*  The records are read without holding the lock, as the predecessor
+        may take a while to send them. */
+    err = 0;
+    count = 0;
+    ep = NULL;
+    while (1) {
+        type = nn_handoff_recv (fd, buf, &len, fds, &nfds);
+        if (nn_slow (type < 0))
+            return type;
+        if (type == NN_HANDOFF_END) {
+            nn_handoff_closefds (fds, nfds);
+            break;
+        }
+
+        nn_cp_lock (sockbase->cp);
+
+        /*  Create the endpoint. It gets the next endpoint ID, same as if
+            it was created by nn_bind. If that fails, the connections
+            passed along with it are closed and the remaining endpoints are
+            still taken over. */
+        if (type == NN_HANDOFF_EP) {
+            ep = NULL;
+            tp = len > 4 && len - 4 <= NN_SOCKADDR_MAX ?
+                nn_global_transport ((int) nn_getl (buf)) : NULL;
+            if (nn_slow (!tp || !tp->adopt)) {
+                nn_handoff_closefds (fds, nfds);
+                rc = tp ? -EPROTONOSUPPORT : -EPROTO;
+            }
+            else {
+                buf [len] = 0;
+                rc = tp->adopt ((const char*) buf + 4, (void*) self,
+                    fds, nfds, &ep);
+            }
+            if (nn_slow (rc < 0)) {
+                ep = NULL;
+                err = err ? err : rc;
+            }
+            else {
+                nn_assert (ep->eid == sockbase->eid);
+                ep->transport = tp->id;
+                nn_list_insert (&sockbase->eps, &ep->item,
+                    nn_list_end (&sockbase->eps));
+                ++sockbase->eid;
+                ++count;
+            }
+        }
+
+        /*  Take over the connection. If it can't be done, the connection is
+            closed and the peer reconnects. */
+        else if (type == NN_HANDOFF_PIPE && nfds == 1) {
+            rc = ep && ep->vfptr->adoptpipe ?
+                ep->vfptr->adoptpipe (ep, fds [0], buf, len) : -EPROTO;
+            if (nn_slow (rc < 0))
+                nn_handoff_closefds (fds, nfds);
+        }
+
+        else {
+            nn_handoff_closefds (fds, nfds);
+            err = err ? err : -EPROTO;
+        }
+
+        nn_cp_unlock (sockbase->cp);
+    }
+
+    return err ? err : count;
+}
+
+static int nn_sock_close_eps (struct nn_sock *self, int eid)
+{
+    int rc;
+    int found;
+    struct nn_sockbase *sockbase;
+    struct nn_list_item *it;
+    struct nn_epbase *ep;
+
+    sockbase = (struct nn_sockbase*) self;
+
+    /*  Ask the endpoints to shutdown. Actual terminatation may be delayed
+        by the transport. Call to nn_ep_close can deallocate the endpoint,
+        so take care to get pointer to the next endpoint before the call. */
+    found = 0;
+    it = nn_list_begin (&sockbase->eps);
+    while (it != nn_list_end (&sockbase->eps)) {
+        ep = nn_cont (it, struct nn_epbase, item);
+        it = nn_list_next (&sockbase->eps, it);
+        if (ep->eid != eid)
+            continue;
+        rc = nn_ep_close ((void*) ep);
+        errnum_assert (rc == 0 || rc == -EINPROGRESS, -rc);
+        ++found;
+    }
+
+    return found;
+}
+
+void nn_sock_ep_closed (struct nn_sock *self, struct nn_epbase *ep)
+{
+    struct nn_sockbase *sockbase;
+
+    sockbase = (struct nn_sockbase*) self;
+
+    /*  Remove the endpoint from the list of active endpoints. */
+    nn_list_erase (&sockbase->eps, &ep->item);
 
     /*  nn_close() may be waiting for termination of this endpoint.
         Send it a signal. */
     if (sockbase->flags & NN_SOCK_FLAG_CLOSING &&
-          nn_list_empty (&sockbase->eps))
+          nn_list_empty (&sockbase->eps)) {
+        if (sockbase->closed) {
+            sockbase->closed (sockbase->closedarg);
+            return;
+        }
         nn_sem_post (&sockbase->termsem);
+        if (nn_cp_isexternal (sockbase->cp))
+            nn_cp_wakeup (sockbase->cp);
+    }
 }
 
 int nn_sock_send (struct nn_sock *self, struct nn_msg *msg, int flags)
+{
+    int rc;
+
+    rc = nn_sock_sendctx (self, -1, msg, 1, flags);
+    return rc < 0 ? rc : 0;
+}
+
+int nn_sock_sendv (struct nn_sock *self, struct nn_msg *msgs, int count,
+    int flags)
+{
+    return nn_sock_sendctx (self, -1, msgs, count, flags);
+}
+
+int nn_sock_ctx_send (struct nn_sock *self, int ctx, struct nn_msg *msg,
+    int flags)
+{
+    int rc;
+
+    rc = nn_sock_sendctx (self, ctx, msg, 1, flags);
+    return rc < 0 ? rc : 0;
+}
+
+static int nn_sock_sendctx (struct nn_sock *self, int ctx,
+    struct nn_msg *msgs, int count, int flags)
 {
     int rc;
     struct nn_sockbase *sockbase;
     uint64_t deadline;
     uint64_t now;
     int timeout;
+    int spin;
+    int spun;
+    size_t size;
+    size_t bytes;
+    struct nn_stopwatch stopwatch;
 
     sockbase = (struct nn_sockbase*) self;
 
     /*  Some sockets types cannot be used for sending messages. */
     if (nn_slow (sockbase->vfptr->flags & NN_SOCKBASE_FLAG_NOSEND))
         return -ENOTSUP;
+    if (nn_slow (ctx >= 0 && !sockbase->vfptr->ctxsend))
+        return -ENOTSUP;
 
-    nn_cp_lock (&sockbase->cp);
+    /*  Urgent messages are passed to the transports ahead of the other
+        messages queued for the same peer. */
+    if (nn_slow (flags & NN_URGENT))
+        for (rc = 0; rc != count; ++rc)
+            msgs [rc].urgent = 1;
+
+    /*  If the socket is used by a single thread, the OUT bit can change
+        only by the completion port making the socket writeable. Thus,
+        a non-blocking send to a socket that isn't writeable can fail without
+        contending for the lock with the worker thread. */
+    if (sockbase->singlethreaded && ctx < 0 && flags & NN_DONTWAIT &&
+          !(nn_atomic_load (&sockbase->ready) & (NN_SOCK_FLAG_OUT |
+          NN_SOCK_FLAG_ZOMBIE | NN_SOCK_FLAG_CLOSING)))
+        return -EAGAIN;
+
+    nn_trace2 (sock_send_start, self, count);
+    spun = 0;
+    nn_cp_lock (sockbase->cp);
+    nn_trace1 (sock_send_locked, self);
+
+    /*  The time-to-live of the messages runs from now on, including the time
+        spent blocked here. */
+    if (nn_slow (sockbase->sndttl >= 0)) {
+        now = nn_clock_now (&sockbase->clock);
+        for (rc = 0; rc != count; ++rc)
+            if (!msgs [rc].deadline)
+                msgs [rc].deadline = now + sockbase->sndttl;
+    }
 
     /*  Compute the deadline for SNDTIMEO timer. */
     if (sockbase->sndtimeo < 0)
@@ -615,42 +1514,82 @@ int nn_sock_send (struct nn_sock *self, struct nn_msg *msg, int flags)
         /*  If nn_term() was already called, return ETERM. */
         if (nn_slow (sockbase->flags &
               (NN_SOCK_FLAG_ZOMBIE | NN_SOCK_FLAG_CLOSING))) {
-            nn_cp_unlock (&sockbase->cp);
+            nn_cp_unlock (sockbase->cp);
             return -ETERM;
         }
 
-        /*  Try to send the message in a non-blocking way. */
-        rc = sockbase->vfptr->send (sockbase, msg);
-        nn_sockbase_adjust_events (sockbase);
+        /*  Try to send the message in a non-blocking way. Once the first
+            message is through, send as many of the remaining ones as are
+            possible without blocking. Any error is left to the next call. */
+        size = nn_msg_bodysize (msgs);
+        sockbase->flags |= NN_SOCK_FLAG_DEFER;
+        rc = nn_sockbase_send (sockbase, ctx, msgs);
         if (nn_fast (rc == 0)) {
-            nn_cp_unlock (&sockbase->cp);
-            return 0;
+            bytes = size;
+            for (rc = 1; rc != count; ++rc) {
+                size = nn_msg_bodysize (&msgs [rc]);
+                if (nn_sockbase_send (sockbase, ctx, &msgs [rc]) != 0)
+                    break;
+                bytes += size;
+            }
+            sockbase->stats.sent += rc;
+            sockbase->stats.sentbytes += bytes;
+        }
+        nn_sockbase_run_deferred (sockbase);
+        nn_sockbase_adjust_events (sockbase);
+        if (nn_fast (rc > 0)) {
+            nn_cp_unlock (sockbase->cp);
+            nn_trace2 (sock_send_done, self, rc);
+            return rc;
         }
         nn_assert (rc < 0);
 
         /*  Any unexpected error is forwarded to the caller. */
         if (nn_slow (rc != -EAGAIN)) {
-            nn_cp_unlock (&sockbase->cp);
+            nn_cp_unlock (sockbase->cp);
             return rc;
         }
 
         /*  If the message cannot be sent at the moment and the send call
             is non-blocking, return immediately. */
         if (nn_fast (flags & NN_DONTWAIT)) {
-            nn_cp_unlock (&sockbase->cp);
+            nn_cp_unlock (sockbase->cp);
             return -EAGAIN;
         }
 
         /*  With blocking send, wait while there are new pipes available
-            for sending. */
-        nn_cp_unlock (&sockbase->cp);
-        rc = nn_efd_wait (&sockbase->sndfd, timeout);
-        if (nn_slow (rc == -ETIMEDOUT))
-            return -EAGAIN;
-        if (nn_slow (rc == -EINTR))
-            return -EINTR;
-        errnum_assert (rc == 0, rc);
-        nn_cp_lock (&sockbase->cp);
+            for sending. If requested, busy-poll for a while first. Spinning
+            is done only once per call so that a spurious wake-up doesn't
+            result in burning the CPU for the rest of the call. While waiting
+            on the efd, the thread is registered as a waiter so that the efd
+            gets actually signalled. */
+        spin = spun ? 0 : sockbase->sndspin;
+        spun = 1;
+        nn_stopwatch_init (&stopwatch);
+        if (spin) {
+            nn_cp_unlock (sockbase->cp);
+            nn_sock_spin (sockbase, NN_SOCK_FLAG_OUT, spin);
+            nn_cp_lock (sockbase->cp);
+            sockbase->stats.sndblocked += nn_stopwatch_term (&stopwatch);
+        }
+        else {
+            ++sockbase->sndwaiters;
+            nn_sockbase_sync_efds (sockbase);
+            nn_cp_unlock (sockbase->cp);
+            rc = nn_sockbase_wait (sockbase, &sockbase->sndfd, timeout);
+            nn_cp_lock (sockbase->cp);
+            --sockbase->sndwaiters;
+            sockbase->stats.sndblocked += nn_stopwatch_term (&stopwatch);
+            if (nn_slow (rc == -ETIMEDOUT)) {
+                nn_cp_unlock (sockbase->cp);
+                return -EAGAIN;
+            }
+            if (nn_slow (rc == -EINTR)) {
+                nn_cp_unlock (sockbase->cp);
+                return -EINTR;
+            }
+            errnum_assert (rc == 0, rc);
+        }
 
         /*  If needed, re-compute the timeout to reflect the time that have
             already elapsed. */
@@ -662,20 +1601,61 @@ int nn_sock_send (struct nn_sock *self, struct nn_msg *msg, int flags)
 }
 
 int nn_sock_recv (struct nn_sock *self, struct nn_msg *msg, int flags)
+{
+    int rc;
+
+    rc = nn_sock_recvctx (self, -1, msg, 1, flags);
+    return rc < 0 ? rc : 0;
+}
+
+int nn_sock_recvv (struct nn_sock *self, struct nn_msg *msgs, int count,
+    int flags)
+{
+    return nn_sock_recvctx (self, -1, msgs, count, flags);
+}
+
+int nn_sock_ctx_recv (struct nn_sock *self, int ctx, struct nn_msg *msg,
+    int flags)
+{
+    int rc;
+
+    rc = nn_sock_recvctx (self, ctx, msg, 1, flags);
+    return rc < 0 ? rc : 0;
+}
+
+static int nn_sock_recvctx (struct nn_sock *self, int ctx,
+    struct nn_msg *msgs, int count, int flags)
 {
     int rc;
     struct nn_sockbase *sockbase;
     uint64_t deadline;
     uint64_t now;
     int timeout;
+    int spin;
+    int spun;
+    int i;
+    struct nn_stopwatch stopwatch;
 
     sockbase = (struct nn_sockbase*) self;
 
     /*  Some sockets types cannot be used for receiving messages. */
     if (nn_slow (sockbase->vfptr->flags & NN_SOCKBASE_FLAG_NORECV))
         return -ENOTSUP;
+    if (nn_slow (ctx >= 0 && !sockbase->vfptr->ctxrecv))
+        return -ENOTSUP;
 
-    nn_cp_lock (&sockbase->cp);
+    /*  Same as with sending, a non-blocking receive from a socket that isn't
+        readable fails straight away if the socket is used by a single
+        thread. */
+    if (sockbase->singlethreaded && ctx < 0 && flags & NN_DONTWAIT &&
+          !(nn_atomic_load (&sockbase->ready) & (NN_SOCK_FLAG_IN |
+          NN_SOCK_FLAG_ZOMBIE | NN_SOCK_FLAG_CLOSING)))
+        return -EAGAIN;
+
+    nn_trace2 (sock_recv_start, self, count);
+    spun = 0;
+    nn_cp_lock (sockbase->cp);
+    nn_trace1 (sock_recv_locked, self);
 
     /*  Compute the deadline for RCVTIMEO timer. */
     if (sockbase->rcvtimeo < 0)
@@ -690,42 +1670,71 @@ int nn_sock_recv (struct nn_sock *self, struct nn_msg *msg, int flags)
         /*  If nn_term() was already called, return ETERM. */
         if (nn_slow (sockbase->flags &
               (NN_SOCK_FLAG_ZOMBIE | NN_SOCK_FLAG_CLOSING))) {
-            nn_cp_unlock (&sockbase->cp);
+            nn_cp_unlock (sockbase->cp);
             return -ETERM;
         }
 
-        /*  Try to receive the message in a non-blocking way. */
-        rc = sockbase->vfptr->recv (sockbase, msg);
-        nn_sockbase_adjust_events (sockbase);
+        /*  Try to receive the message in a non-blocking way. Once the first
+            message is through, receive as many of the remaining ones as are
+            possible without blocking. Any error is left to the next call. */
+        rc = nn_sockbase_recv (sockbase, ctx, msgs);
         if (nn_fast (rc == 0)) {
-            nn_cp_unlock (&sockbase->cp);
-            return 0;
+            for (rc = 1; rc != count; ++rc)
+                if (nn_sockbase_recv (sockbase, ctx, &msgs [rc]) != 0)
+                    break;
+            sockbase->stats.received += rc;
+            for (i = 0; i != rc; ++i)
+                sockbase->stats.receivedbytes += nn_msg_bodysize (&msgs [i]);
+        }
+        nn_sockbase_adjust_events (sockbase);
+        if (nn_fast (rc > 0)) {
+            nn_cp_unlock (sockbase->cp);
+            nn_trace2 (sock_recv_done, self, rc);
+            return rc;
         }
         nn_assert (rc < 0);
 
         /*  Any unexpected error is forwarded to the caller. */
         if (nn_slow (rc != -EAGAIN)) {
-            nn_cp_unlock (&sockbase->cp);
+            nn_cp_unlock (sockbase->cp);
             return rc;
         }
 
         /*  If the message cannot be received at the moment and the recv call
             is non-blocking, return immediately. */
         if (nn_fast (flags & NN_DONTWAIT)) {
-            nn_cp_unlock (&sockbase->cp);
+            nn_cp_unlock (sockbase->cp);
             return -EAGAIN;
         }
 
         /*  With blocking recv, wait while there are new pipes available
-            for receiving. */
-        nn_cp_unlock (&sockbase->cp);
-        rc = nn_efd_wait (&sockbase->rcvfd, timeout);
-        if (nn_slow (rc == -ETIMEDOUT))
-            return -EAGAIN;
-        if (nn_slow (rc == -EINTR))
-            return -EINTR;
-        errnum_assert (rc == 0, rc);
-        nn_cp_lock (&sockbase->cp);
+            for receiving. If requested, busy-poll for a while first. Spinning
+            is done only once per call so that a spurious wake-up doesn't
+            result in burning the CPU for the rest of the call. While waiting
+            on the efd, the thread is registered as a waiter so that the efd
+            gets actually signalled. */
+        spin = spun ? 0 : sockbase->rcvspin;
+        spun = 1;
+        nn_stopwatch_init (&stopwatch);
+        if (spin) {
+            nn_cp_unlock (sockbase->cp);
+            nn_sock_spin (sockbase, NN_SOCK_FLAG_IN, spin);
+            nn_cp_lock (sockbase->cp);
+            sockbase->stats.rcvblocked += nn_stopwatch_term (&stopwatch);
+        }
+        else {
+            rc = nn_sockbase_rcvwait (sockbase, ctx, timeout);
+            sockbase->stats.rcvblocked += nn_stopwatch_term (&stopwatch);
+            if (nn_slow (rc == -ETIMEDOUT)) {
+                nn_cp_unlock (sockbase->cp);
+                return -EAGAIN;
+            }
+            if (nn_slow (rc == -EINTR)) {
+                nn_cp_unlock (sockbase->cp);
+                return -EINTR;
+            }
+            errnum_assert (rc == 0, rc);
+        }
 
         /*  If needed, re-compute the timeout to reflect the time that have
             already elapsed. */
@@ -736,6 +1745,168 @@ int nn_sock_recv (struct nn_sock *self, struct nn_msg *msg, int flags)
     }  
 }
 
+int nn_sock_send_async (struct nn_sock *self, struct nn_sockop *op)
+{
+    struct nn_sockbase *sockbase;
+
+    sockbase = (struct nn_sockbase*) self;
+
+    if (nn_slow (sockbase->vfptr->flags & NN_SOCKBASE_FLAG_NOSEND))
+        return -ENOTSUP;
+
+    nn_cp_lock (sockbase->cp);
+    if (nn_slow (sockbase->flags &
+          (NN_SOCK_FLAG_ZOMBIE | NN_SOCK_FLAG_CLOSING))) {
+        nn_cp_unlock (sockbase->cp);
+        return -ETERM;
+    }
+    if (nn_slow (sockbase->sndttl >= 0 && !op->msg.deadline))
+        op->msg.deadline = nn_clock_now (&sockbase->clock) + sockbase->sndttl;
+    nn_list_item_init (&op->item);
+    nn_list_insert (&sockbase->sndops, &op->item,
+        nn_list_end (&sockbase->sndops));
+    nn_sockbase_adjust_events (sockbase);
+    nn_cp_unlock (sockbase->cp);
+
+    return 0;
+}
+
+int nn_sock_recv_async (struct nn_sock *self, struct nn_sockop *op)
+{
+    struct nn_sockbase *sockbase;
+
+    sockbase = (struct nn_sockbase*) self;
+
+    if (nn_slow (sockbase->vfptr->flags & NN_SOCKBASE_FLAG_NORECV))
+        return -ENOTSUP;
+
+    nn_cp_lock (sockbase->cp);
+    if (nn_slow (sockbase->flags &
+          (NN_SOCK_FLAG_ZOMBIE | NN_SOCK_FLAG_CLOSING))) {
+        nn_cp_unlock (sockbase->cp);
+        return -ETERM;
+    }
+    nn_list_item_init (&op->item);
+    nn_list_insert (&sockbase->rcvops, &op->item,
+        nn_list_end (&sockbase->rcvops));
+    nn_sockbase_adjust_events (sockbase);
+    nn_cp_unlock (sockbase->cp);
+
+    return 0;
+}
+
+int nn_sock_ctx_open (struct nn_sock *self)
+{
+    int rc;
+    int i;
+    struct nn_sockbase *sockbase;
+    void *ctx;
+    void **ctxs;
+
+    sockbase = (struct nn_sockbase*) self;
+
+    if (nn_slow (!sockbase->vfptr->ctxopen))
+        return -ENOTSUP;
+
+    nn_cp_lock (sockbase->cp);
+
+    /*  If nn_term() was already called, return ETERM. */
+    if (nn_slow (sockbase->flags &
+          (NN_SOCK_FLAG_ZOMBIE | NN_SOCK_FLAG_CLOSING))) {
+        nn_cp_unlock (sockbase->cp);
+        return -ETERM;
+    }
+
+    /*  Find an unused context ID. If there's none, grow the table. */
+    for (i = 0; i != sockbase->nctxs; ++i)
+        if (!sockbase->ctxs [i])
+            break;
+    if (i == sockbase->nctxs) {
+        ctxs = nn_realloc (sockbase->ctxs, (sockbase->nctxs ?
+            sockbase->nctxs * 2 : 16) * sizeof (void*));
+        if (nn_slow (!ctxs)) {
+            nn_cp_unlock (sockbase->cp);
+            return -ENOMEM;
+        }
+        sockbase->ctxs = ctxs;
+        sockbase->nctxs = sockbase->nctxs ? sockbase->nctxs * 2 : 16;
+        memset (&sockbase->ctxs [i], 0,
+            (sockbase->nctxs - i) * sizeof (void*));
+    }
+
+    rc = sockbase->vfptr->ctxopen (sockbase, &ctx);
+    if (nn_slow (rc < 0)) {
+        nn_cp_unlock (sockbase->cp);
+        return rc;
+    }
+    sockbase->ctxs [i] = ctx;
+
+    nn_cp_unlock (sockbase->cp);
+
+    return i;
+}
+
+int nn_sock_ctx_close (struct nn_sock *self, int ctx)
+{
+    struct nn_sockbase *sockbase;
+    struct nn_list_item *it;
+    struct nn_rcvwaiter *waiter;
+
+    sockbase = (struct nn_sockbase*) self;
+
+    nn_cp_lock (sockbase->cp);
+
+    if (nn_slow (ctx < 0 || ctx >= sockbase->nctxs ||
+          !sockbase->ctxs [ctx])) {
+        nn_cp_unlock (sockbase->cp);
+        return -EINVAL;
+    }
+    /*  Threads blocked on the context are woken up, they'll find out that
+        the context no longer exists. */
+    for (it = nn_list_begin (&sockbase->rcvwaitq);
+          it != nn_list_end (&sockbase->rcvwaitq); ) {
+        waiter = nn_cont (it, struct nn_rcvwaiter, item);
+        it = nn_list_next (&sockbase->rcvwaitq, it);
+        if (waiter->ctx != sockbase->ctxs [ctx])
+            continue;
+        nn_list_erase (&sockbase->rcvwaitq, &waiter->item);
+        waiter->ctx = NULL;
+        waiter->signalled = 1;
+        ++sockbase->rcvwoken;
+        nn_efd_signal (&waiter->efd);
+    }
+
+    sockbase->vfptr->ctxclose (sockbase, sockbase->ctxs [ctx]);
+    sockbase->ctxs [ctx] = NULL;
+    nn_sockbase_adjust_events (sockbase);
+
+    nn_cp_unlock (sockbase->cp);
+
+    return 0;
+}
+
+static int nn_sockbase_send (struct nn_sockbase *self, int ctx,
+    struct nn_msg *msg)
+{
+    if (nn_fast (ctx < 0))
+        return self->vfptr->send (self, msg);
+
+    /*  The context may have been closed by another thread in the meantime. */
+    if (nn_slow (ctx >= self->nctxs || !self->ctxs [ctx]))
+        return -EINVAL;
+    return self->vfptr->ctxsend (self, self->ctxs [ctx], msg);
+}
+
+static int nn_sockbase_recv (struct nn_sockbase *self, int ctx,
+    struct nn_msg *msg)
+{
+    if (nn_fast (ctx < 0))
+        return self->vfptr->recv (self, msg);
+    if (nn_slow (ctx >= self->nctxs || !self->ctxs [ctx]))
+        return -EINVAL;
+    return self->vfptr->ctxrecv (self, self->ctxs [ctx], msg);
+}
+
 int nn_sock_add (struct nn_sock *self, struct nn_pipe *pipe)
 {
     int rc;
@@ -744,6 +1915,7 @@ int nn_sock_add (struct nn_sock *self, struct nn_pipe *pipe)
     sockbase = (struct nn_sockbase*) self;
 
     rc = sockbase->vfptr->add (sockbase, pipe);
+    ++sockbase->stats.connects;
     nn_sockbase_adjust_events (sockbase);
     return rc;
 }
@@ -755,6 +1927,7 @@ void nn_sock_rm (struct nn_sock *self, struct nn_pipe *pipe)
     sockbase = (struct nn_sockbase*) self;
 
     sockbase->vfptr->rm (sockbase, pipe);
+    ++sockbase->stats.disconnects;
     nn_sockbase_adjust_events (sockbase);
 }
 
@@ -778,52 +1951,411 @@ void nn_sock_out (struct nn_sock *self, struct nn_pipe *pipe)
     nn_sockbase_adjust_events (sockbase);
 }
 
-void nn_sockbase_adjust_events (struct nn_sockbase *self)
+int nn_sock_wait (struct nn_sock *self, struct nn_efd *efd, int timeout)
 {
-    int events;
+    return nn_sockbase_wait ((struct nn_sockbase*) self, efd, timeout);
+}
+
+static int nn_sockbase_wait (struct nn_sockbase *self, struct nn_efd *efd,
+    int timeout)
+{
+    int rc;
+
+    if (nn_fast (!nn_cp_isexternal (self->cp)))
+        return nn_efd_wait (efd, timeout);
+
+    /*  The I/O events may not be processed by anyone else, so instead of
+        waiting on the efd, do the processing here. The caller re-checks
+        the state of the socket afterwards. */
+    rc = nn_cp_process (self->cp, timeout);
+    if (nn_slow (rc == -EINTR))
+        return -EINTR;
+    return timeout == 0 ? -ETIMEDOUT : 0;
+}
+
+static int nn_sockbase_rcvwait (struct nn_sockbase *self, int ctx,
+    int timeout)
+{
+    int rc;
+    struct nn_rcvwaiter *waiter;
+
+    /*  Called with the socket locked, returns with the socket locked. */
+
+    /*  Waiters are kept for re-use so that the efds are not created and
+        destroyed each time a thread blocks. If no efd can be created, wait
+        along with everybody else on the rcvfd. */
+    waiter = NULL;
+    if (nn_fast (!nn_cp_isexternal (self->cp))) {
+        if (!nn_list_empty (&self->rcvidle)) {
+            waiter = nn_cont (nn_list_begin (&self->rcvidle),
+                struct nn_rcvwaiter, item);
+            nn_list_erase (&self->rcvidle, &waiter->item);
+        }
+        else {
+            waiter = nn_alloc (sizeof (struct nn_rcvwaiter), "rcvwaiter");
+            if (waiter && nn_efd_init (&waiter->efd) < 0) {
+                nn_free (waiter);
+                waiter = NULL;
+            }
+            if (waiter)
+                nn_list_item_init (&waiter->item);
+        }
+    }
+    if (nn_slow (!waiter)) {
+        ++self->rcvwaiters;
+        nn_sockbase_sync_efds (self);
+        nn_cp_unlock (self->cp);
+        rc = nn_sockbase_wait (self, &self->rcvfd, timeout);
+        nn_cp_lock (self->cp);
+        --self->rcvwaiters;
+        return rc;
+    }
+
+    waiter->signalled = 0;
+    waiter->ctx = ctx >= 0 ? self->ctxs [ctx] : NULL;
+    nn_list_insert (&self->rcvwaitq, &waiter->item,
+        nn_list_end (&self->rcvwaitq));
+    nn_sockbase_wake_rcvwaiters (self, 0);
+    nn_cp_unlock (self->cp);
+    rc = nn_efd_wait (&waiter->efd, timeout);
+    nn_cp_lock (self->cp);
+
+    /*  If woken up, try to receive even if the wait timed out or was
+        interrupted in the meantime. Otherwise the wake-up would be lost. */
+    if (waiter->signalled) {
+        nn_efd_unsignal (&waiter->efd);
+        --self->rcvwoken;
+        rc = 0;
+    }
+    else
+        nn_list_erase (&self->rcvwaitq, &waiter->item);
+    nn_list_insert (&self->rcvidle, &waiter->item,
+        nn_list_end (&self->rcvidle));
+    return rc;
+}
+
+static void nn_sockbase_wake_rcvwaiters (struct nn_sockbase *self, int all)
+{
+    struct nn_list_item *it;
+    struct nn_rcvwaiter *waiter;
+
+    /*  Wake up the first of the threads blocked in nn_recv unless some
+        thread was already woken up and haven't had a chance to receive yet.
+        If the socket tracks the readiness of the contexts, each thread
+        blocked in nn_ctx_recv is woken up as soon as its context is readable
+        instead. When the socket is being shut down, wake them all up. */
+    it = nn_list_begin (&self->rcvwaitq);
+    while (it != nn_list_end (&self->rcvwaitq)) {
+        waiter = nn_cont (it, struct nn_rcvwaiter, item);
+        it = nn_list_next (&self->rcvwaitq, it);
+        if (!all && waiter->ctx && self->vfptr->ctxevents) {
+            if (!(self->vfptr->ctxevents (self, waiter->ctx) &
+                  NN_SOCKBASE_EVENT_IN))
+                continue;
+        }
+        else if (!all &&
+              (self->rcvwoken || !(self->flags & NN_SOCK_FLAG_IN))) {
+            if (self->vfptr->ctxevents)
+                continue;
+            return;
+        }
+        nn_list_erase (&self->rcvwaitq, &waiter->item);
+        waiter->signalled = 1;
+        ++self->rcvwoken;
+        nn_efd_signal (&waiter->efd);
+    }
+}
+
+static void nn_sockbase_run_deferred (struct nn_sockbase *self)
+{
+    struct nn_pipebase_deferred *deferred;
+
+    /*  The pipes that got the messages wake their peers up now, all at once,
+        so that the peers sharing a thread are woken up only once. */
+    self->flags &= ~NN_SOCK_FLAG_DEFER;
+    while (nn_slow (!nn_list_empty (&self->deferred))) {
+        deferred = nn_cont (nn_list_begin (&self->deferred),
+            struct nn_pipebase_deferred, item);
+        nn_list_erase (&self->deferred, &deferred->item);
+        deferred->fn (deferred);
+    }
+}
+
+static int nn_sock_spin (struct nn_sockbase *self, int flag, int spin)
+{
+    struct nn_stopwatch stopwatch;
 
+    /*  Busy-poll the socket state for 'spin' microseconds. The state is read
+        without locking the socket. That's OK as it's only a hint and the
+        caller re-checks once the socket is locked. Returns 1 if the socket
+        became ready (or is being closed) and 0 in case of timeout. */
+    nn_stopwatch_init (&stopwatch);
+    while (1) {
+        if (nn_atomic_load (&self->ready) & (flag | NN_SOCK_FLAG_ZOMBIE | NN_SOCK_FLAG_CLOSING))
+            return 1;
+        if (nn_stopwatch_term (&stopwatch) >= (uint64_t) spin)
+            return 0;
+    }
+}
+
+void nn_sockbase_adjust_events (struct nn_sockbase *self)
+{
     /*  If nn_close() was already called there's no point in adjusting the
         snd/rcv file descriptors. */
     if (self->flags & NN_SOCK_FLAG_CLOSING)
         return;
 
+    nn_sockbase_update_events (self);
+
+    /*  If the socket became readable or writeable, perform the queued
+        asynchronous operations first so that the efds reflect what's left
+        afterwards. */
+    if (nn_slow (!nn_list_empty (&self->sndops) ||
+          !nn_list_empty (&self->rcvops)))
+        nn_sockbase_run_ops (self);
+
+    nn_sockbase_sync_efds (self);
+}
+
+static void nn_sockbase_update_events (struct nn_sockbase *self)
+{
+    int events;
+
     /*  Check whether socket is readable and/or writeable at the moment. */
     events = self->vfptr->events (self);
     errnum_assert (events >= 0, -events);
 
-    /*  Signal/unsignal IN as needed. */
-    if (!(self->vfptr->flags & NN_SOCKBASE_FLAG_NORECV)) {
-        if (events & NN_SOCKBASE_EVENT_IN) {
-            nn_assert (!(self->vfptr->flags & NN_SOCKBASE_FLAG_NORECV));
-            if (!(self->flags & NN_SOCK_FLAG_IN)) {
-                self->flags |= NN_SOCK_FLAG_IN;
+    /*  Update IN and OUT flags as needed. */
+    if (events & NN_SOCKBASE_EVENT_IN)
+        self->flags |= NN_SOCK_FLAG_IN;
+    else
+        self->flags &= ~NN_SOCK_FLAG_IN;
+    if (events & NN_SOCKBASE_EVENT_OUT)
+        self->flags |= NN_SOCK_FLAG_OUT;
+    else
+        self->flags &= ~NN_SOCK_FLAG_OUT;
+    nn_sockbase_publish_ready (self);
+}
+
+static void nn_sockbase_publish_ready (struct nn_sockbase *self)
+{
+    /*  Expose the readiness of the socket to the paths that check it without
+        locking the socket. Called with the completion port locked. */
+    nn_atomic_store (&self->ready, self->flags & (NN_SOCK_FLAG_IN |
+        NN_SOCK_FLAG_OUT | NN_SOCK_FLAG_ZOMBIE | NN_SOCK_FLAG_CLOSING));
+}
+
+static void nn_sockbase_run_ops (struct nn_sockbase *self)
+{
+    int rc;
+    int progress;
+    size_t size;
+    struct nn_sockop *op;
+
+    /*  Sending or receiving a message may make a pipe notify the socket
+        synchronously, which would get us here again. The loop below picks
+        the new state up anyway, so don't recurse. */
+    if (self->flags & NN_SOCK_FLAG_OPS)
+        return;
+    self->flags |= NN_SOCK_FLAG_OPS;
+
+    /*  Alternate between sends and receives till neither can progress. */
+    do {
+        progress = 0;
+        if (self->flags & NN_SOCK_FLAG_OUT && !nn_list_empty (&self->sndops)) {
+            op = nn_cont (nn_list_begin (&self->sndops), struct nn_sockop,
+                item);
+            size = nn_msg_bodysize (&op->msg);
+            rc = self->vfptr->send (self, &op->msg);
+            if (rc != -EAGAIN) {
+                if (nn_fast (rc == 0)) {
+                    ++self->stats.sent;
+                    self->stats.sentbytes += size;
+                }
+                nn_sockbase_complete_op (&self->sndops, op, rc);
+                progress = 1;
+            }
+        }
+        if (self->flags & NN_SOCK_FLAG_IN && !nn_list_empty (&self->rcvops)) {
+            op = nn_cont (nn_list_begin (&self->rcvops), struct nn_sockop,
+                item);
+            rc = self->vfptr->recv (self, &op->msg);
+            if (rc != -EAGAIN) {
+                if (nn_fast (rc == 0)) {
+                    ++self->stats.received;
+                    self->stats.receivedbytes += nn_msg_bodysize (&op->msg);
+                }
+                nn_sockbase_complete_op (&self->rcvops, op, rc);
+                progress = 1;
+            }
+        }
+        if (progress)
+            nn_sockbase_update_events (self);
+    } while (progress);
+
+    self->flags &= ~NN_SOCK_FLAG_OPS;
+}
+
+static void nn_sockbase_complete_op (struct nn_list *ops,
+    struct nn_sockop *op, int rc)
+{
+    nn_list_erase (ops, &op->item);
+    nn_list_item_term (&op->item);
+    op->rc = rc;
+    op->done (op);
+}
+
+static void nn_sockbase_cancel_ops (struct nn_sockbase *self, int rc)
+{
+    while (!nn_list_empty (&self->sndops))
+        nn_sockbase_complete_op (&self->sndops, nn_cont (
+            nn_list_begin (&self->sndops), struct nn_sockop, item), rc);
+    while (!nn_list_empty (&self->rcvops))
+        nn_sockbase_complete_op (&self->rcvops, nn_cont (
+            nn_list_begin (&self->rcvops), struct nn_sockop, item), rc);
+}
+
+static void nn_sockbase_sync_efds (struct nn_sockbase *self)
+{
+    int wake;
+    struct nn_list_item *it;
+    struct nn_pollitem *item;
+
+    wake = 0;
+
+    /*  Signal/unsignal rcvfd as needed, if anyone can observe it. */
+    if (!(self->vfptr->flags & NN_SOCKBASE_FLAG_NORECV) &&
+          (self->rcvwaiters || self->flags & NN_SOCK_FLAG_RCVFD)) {
+        if (self->flags & NN_SOCK_FLAG_IN) {
+            if (!(self->flags & NN_SOCK_FLAG_INFD)) {
+                self->flags |= NN_SOCK_FLAG_INFD;
                 nn_efd_signal (&self->rcvfd);
+                wake |= self->rcvwaiters;
             }
         }
         else {
-            if (self->flags & NN_SOCK_FLAG_IN) {
-                self->flags &= ~NN_SOCK_FLAG_IN;
+            if (self->flags & NN_SOCK_FLAG_INFD) {
+                self->flags &= ~NN_SOCK_FLAG_INFD;
                 nn_efd_unsignal (&self->rcvfd);
             }
         }
     }
 
-    /*  Signal/unsignal OUT as needed. */
-    if (!(self->vfptr->flags & NN_SOCKBASE_FLAG_NOSEND)) {
-        if (events & NN_SOCKBASE_EVENT_OUT) {
-            nn_assert (!(self->vfptr->flags & NN_SOCKBASE_FLAG_NOSEND));
-            if (!(self->flags & NN_SOCK_FLAG_OUT)) {
-                self->flags |= NN_SOCK_FLAG_OUT;
+    /*  Signal/unsignal sndfd as needed, if anyone can observe it. */
+    if (!(self->vfptr->flags & NN_SOCKBASE_FLAG_NOSEND) &&
+          (self->sndwaiters || self->flags & NN_SOCK_FLAG_SNDFD)) {
+        if (self->flags & NN_SOCK_FLAG_OUT) {
+            if (!(self->flags & NN_SOCK_FLAG_OUTFD)) {
+                self->flags |= NN_SOCK_FLAG_OUTFD;
                 nn_efd_signal (&self->sndfd);
+                wake |= self->sndwaiters;
             }
         }
         else {
-            if (self->flags & NN_SOCK_FLAG_OUT) {
-                self->flags &= ~NN_SOCK_FLAG_OUT;
+            if (self->flags & NN_SOCK_FLAG_OUTFD) {
+                self->flags &= ~NN_SOCK_FLAG_OUTFD;
                 nn_efd_unsignal (&self->sndfd);
             }
         }
     }
+
+    /*  Wake up one of the threads blocked in nn_recv. */
+    if (nn_slow (!nn_list_empty (&self->rcvwaitq)))
+        nn_sockbase_wake_rcvwaiters (self, 0);
+
+    /*  Wake up nn_poll callers waiting for the events that are signalled. */
+    if (nn_slow (!nn_list_empty (&self->pollers))) {
+        for (it = nn_list_begin (&self->pollers);
+              it != nn_list_end (&self->pollers);
+              it = nn_list_next (&self->pollers, it)) {
+            item = nn_cont (it, struct nn_pollitem, item);
+            if (!item->waiter->signalled &&
+                  nn_sockbase_poll_events (self, item->events)) {
+                item->waiter->signalled = 1;
+                nn_efd_signal (&item->waiter->efd);
+                wake = 1;
+            }
+        }
+    }
+
+    /*  With an external completion port, the waiters may be processing
+        the I/O events instead of waiting on the efds. Interrupt them. */
+    if (nn_slow (wake && nn_cp_isexternal (self->cp)))
+        nn_cp_wakeup (self->cp);
+}
+
+static int nn_sockbase_poll_events (struct nn_sockbase *self, int events)
+{
+    int revents;
+
+    /*  Once the socket is terminating, report all the events so that
+        the caller finds out about it from the subsequent operation. */
+    if (nn_slow (self->flags & (NN_SOCK_FLAG_ZOMBIE | NN_SOCK_FLAG_CLOSING)))
+        return events;
+
+    revents = 0;
+    if (events & NN_POLLIN && self->flags & NN_SOCK_FLAG_IN &&
+          !(self->vfptr->flags & NN_SOCKBASE_FLAG_NORECV))
+        revents |= NN_POLLIN;
+    if (events & NN_POLLOUT && self->flags & NN_SOCK_FLAG_OUT &&
+          !(self->vfptr->flags & NN_SOCKBASE_FLAG_NOSEND))
+        revents |= NN_POLLOUT;
+    return revents;
+}
+
+int nn_sock_poll (struct nn_sock *self, int events,
+    struct nn_pollwaiter *waiter, struct nn_pollitem *item)
+{
+    int revents;
+    struct nn_sockbase *sockbase;
+
+    sockbase = (struct nn_sockbase*) self;
+
+    nn_cp_lock (sockbase->cp);
+    revents = nn_sockbase_poll_events (sockbase, events);
+    if (item) {
+        item->waiter = waiter;
+        item->events = events;
+        nn_list_item_init (&item->item);
+    }
+    if (!revents && item)
+        nn_list_insert (&sockbase->pollers, &item->item,
+            nn_list_end (&sockbase->pollers));
+    nn_cp_unlock (sockbase->cp);
+
+    return revents;
+}
+
+int nn_sock_dirs (struct nn_sock *self)
+{
+    int dirs;
+    struct nn_sockbase *sockbase;
+
+    sockbase = (struct nn_sockbase*) self;
+
+    dirs = 0;
+    if (!(sockbase->vfptr->flags & NN_SOCKBASE_FLAG_NORECV))
+        dirs |= NN_POLLIN;
+    if (!(sockbase->vfptr->flags & NN_SOCKBASE_FLAG_NOSEND))
+        dirs |= NN_POLLOUT;
+    return dirs;
+}
+
+int nn_sock_unpoll (struct nn_sock *self, struct nn_pollitem *item)
+{
+    int revents;
+    struct nn_sockbase *sockbase;
+
+    sockbase = (struct nn_sockbase*) self;
+
+    nn_cp_lock (sockbase->cp);
+    if (nn_list_item_isinlist (&item->item))
+        nn_list_erase (&sockbase->pollers, &item->item);
+    revents = nn_sockbase_poll_events (sockbase, item->events);
+    nn_list_item_term (&item->item);
+    nn_cp_unlock (sockbase->cp);
+
+    return revents;
 }
 
 struct nn_optset *nn_sockbase_optset (struct nn_sockbase *self, int id)
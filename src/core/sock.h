@@ -23,10 +23,56 @@
 #ifndef NN_SOCK_INCLUDED
 #define NN_SOCK_INCLUDED
 
+#include "../utils/efd.h"
+#include "../utils/list.h"
+#include "../utils/msg.h"
+
 struct nn_sock;
 struct nn_pipe;
 struct nn_msg;
 struct nn_cp;
+struct nn_pipebase_deferred;
+struct nn_budget;
+struct nn_epbase;
+
+/*  nn_poll waits on a single efd of the waiter for events on all the sockets.
+    The sockets signal it once any of the events in the registered items
+    occurs. 'signalled' is used to avoid signalling the efd repeatedly. */
+struct nn_pollwaiter {
+    struct nn_efd efd;
+    int signalled;
+};
+
+/*  Thread blocked in nn_recv. When the socket becomes readable, only the
+    first thread in the queue is woken up. Once it has received, it passes
+    the wake-up on if there's still something left to receive. If the thread
+    is blocked in nn_ctx_recv, 'ctx' is the context, otherwise it's NULL.
+    If the socket tracks the readiness of each context (see 'ctxevents' in
+    nn_sockbase_vfptr), such a thread is woken up whenever its context is
+    readable. */
+struct nn_rcvwaiter {
+    struct nn_list_item item;
+    struct nn_efd efd;
+    int signalled;
+    void *ctx;
+};
+
+struct nn_pollitem {
+    struct nn_list_item item;
+    struct nn_pollwaiter *waiter;
+    int events;
+};
+
+/*  Send or receive operation queued on the socket by nn_sock_send_async or
+    nn_sock_recv_async. Once the operation is done, 'rc' is set to zero or
+    to a negative error and 'done' is invoked. It's invoked with the socket
+    locked and thus it must not call back into the socket. */
+struct nn_sockop {
+    struct nn_list_item item;
+    struct nn_msg msg;
+    int rc;
+    void (*done) (struct nn_sockop *self);
+};
 
 /*  Called after the whole socket (including the derived class) is
     intialised. */
@@ -36,26 +82,58 @@ void nn_sock_postinit (struct nn_sock *self, int domain, int protocol);
     and can return -EINTR. */
 int nn_sock_destroy (struct nn_sock *self);
 
+/*  Starts closing the socket without waiting for its endpoints to terminate.
+    Returns 0 if there's nothing to wait for, in which case nn_sock_destroy
+    won't block. Otherwise, returns -EINPROGRESS and 'fn' is invoked, with
+    the completion port locked, once the last endpoint terminates. Until
+    then, nn_sock_destroy must not be called. */
+int nn_sock_close_async (struct nn_sock *self, void (*fn) (void *arg),
+    void *arg);
+
 /*  Called by nn_term() to let the socket know about the process shutdown. */
 void nn_sock_zombify (struct nn_sock *self);
 
 /*  Returns default completion port associated with the socket. */
 struct nn_cp *nn_sock_getcp (struct nn_sock *self);
 
+/*  Returns 1 if the completion port is not shared with other sockets. */
+int nn_sock_ownscp (struct nn_sock *self);
+
 /*  Returns a worker. Each call to this function may return different worker. */
 struct nn_worker *nn_sock_choose_worker (struct nn_sock *self);
 
+/*  Returns the memory budget of the socket, NULL if NN_MEMBUDGET is not set. */
+struct nn_budget *nn_sock_getbudget (struct nn_sock *self);
+
 /*  Returns 1 if the specified socket type is a valid peer for this socket,
     0 otherwise. */
 int nn_sock_ispeer (struct nn_sock *self, int socktype);
 
-/*  Add new endpoint to the socket. */
-int nn_sock_add_ep (struct nn_sock *self, const char *addr,
+/*  Add new endpoint to the socket. If 'addrlist' is set, 'addr' is
+    a comma-separated list of addresses and an endpoint is created for each
+    of them. All of them get the same endpoint ID. 'transport' is the ID of
+    the transport 'factory' belongs to. */
+int nn_sock_add_ep (struct nn_sock *self, const char *addr, int addrlist,
+    int transport,
     int (*factory) (const char *addr, void *hint, struct nn_epbase **ep));
 
-/*  Remove the endpoint with the specified ID from the socket. */
+/*  Remove the endpoint(s) with the specified ID from the socket. */
 int nn_sock_rm_ep (struct nn_sock *self, int eid);
 
+/*  Hot restart. nn_sock_handoff passes the endpoints of the socket over to
+    another process via UNIX domain socket 'fd' and closes them, returning
+    the number of the endpoints passed. nn_sock_adopt creates the endpoints
+    passed that way, returning their number. */
+int nn_sock_handoff (struct nn_sock *self, int fd);
+int nn_sock_adopt (struct nn_sock *self, int fd);
+
+/*  Updates the statistics of nn_serve. 'handlers' is added to the number of
+    the handler threads. 'handling' is 1 when a handler starts handling
+    a request and -1 once it's done with it. The socket isn't deallocated
+    while there are any handler threads, so they can use the socket object
+    directly. Joining a socket that is being closed fails with -ETERM. */
+int nn_sock_serving (struct nn_sock *self, int handlers, int handling);
+
 /*  used by endpoint to notify the socket that it has terminated. */
 void nn_sock_ep_closed (struct nn_sock *self, struct nn_epbase *ep);
 
@@ -65,6 +143,59 @@ int nn_sock_send (struct nn_sock *self, struct nn_msg *msg, int flags);
 /*  Receive a message from the socket. */
 int nn_sock_recv (struct nn_sock *self, struct nn_msg *msg, int flags);
 
+/*  Send up to 'count' messages to the socket. Blocks only until the first
+    message is sent. Returns number of messages sent or a negative error. */
+int nn_sock_sendv (struct nn_sock *self, struct nn_msg *msgs, int count,
+    int flags);
+
+/*  Receive up to 'count' messages from the socket. Blocks only until the first
+    message arrives. Returns number of messages received or a negative error. */
+int nn_sock_recvv (struct nn_sock *self, struct nn_msg *msgs, int count,
+    int flags);
+
+/*  Queue an operation to send 'op->msg' or to receive a message into it.
+    The operations are performed in order, as soon as the socket becomes
+    writeable or readable. If the socket is closed or the library terminates
+    beforehand, they are completed with -ETERM. Returns zero or a negative
+    error if the operation can't be queued. */
+int nn_sock_send_async (struct nn_sock *self, struct nn_sockop *op);
+int nn_sock_recv_async (struct nn_sock *self, struct nn_sockop *op);
+
+/*  Open a new context on the socket. Returns ID of the context or
+    a negative error. */
+int nn_sock_ctx_open (struct nn_sock *self);
+
+/*  Close the context with the specified ID. */
+int nn_sock_ctx_close (struct nn_sock *self, int ctx);
+
+/*  Same as nn_sock_send and nn_sock_recv except that the state of the context
+    is used instead of the state of the socket. */
+int nn_sock_ctx_send (struct nn_sock *self, int ctx, struct nn_msg *msg,
+    int flags);
+int nn_sock_ctx_recv (struct nn_sock *self, int ctx, struct nn_msg *msg,
+    int flags);
+
+/*  Returns those of NN_POLLIN and NN_POLLOUT in 'events' that are signalled
+    on the socket at the moment. If there are none and 'item' is not NULL,
+    the item is registered with the socket to signal the waiter when any of
+    the events occurs. */
+int nn_sock_poll (struct nn_sock *self, int events,
+    struct nn_pollwaiter *waiter, struct nn_pollitem *item);
+
+/*  Returns NN_POLLIN if the socket can be used to receive messages and
+    NN_POLLOUT if it can be used to send them. */
+int nn_sock_dirs (struct nn_sock *self);
+
+/*  Unregisters the item, if registered. Returns the events signalled at
+    the moment. */
+int nn_sock_unpoll (struct nn_sock *self, struct nn_pollitem *item);
+
+/*  Waits for the efd to be signalled the same way nn_efd_wait does. If the
+    socket's completion port is driven by the user, the I/O events are
+    processed in the meantime and the function may return before the efd
+    is signalled. Must be called with the socket unlocked. */
+int nn_sock_wait (struct nn_sock *self, struct nn_efd *efd, int timeout);
+
 /*  Set a socket option. */
 int nn_sock_setopt (struct nn_sock *self, int level, int option,
     const void *optval, size_t optvallen); 
@@ -79,5 +210,9 @@ int nn_sock_add (struct nn_sock *self, struct nn_pipe *pipe);
 void nn_sock_rm (struct nn_sock *self, struct nn_pipe *pipe);
 void nn_sock_in (struct nn_sock *self, struct nn_pipe *pipe);
 void nn_sock_out (struct nn_sock *self, struct nn_pipe *pipe);
+uint64_t nn_sock_now (struct nn_sock *self);
+int nn_sock_expired (struct nn_sock *self, struct nn_msg *msg);
+int nn_sock_defer (struct nn_sock *self,
+    struct nn_pipebase_deferred *deferred);
 
 #endif
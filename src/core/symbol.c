@@ -24,7 +24,12 @@
 
 #include "../inproc.h"
 #include "../ipc.h"
+#include "../shm.h"
 #include "../tcp.h"
+#include "../udpm.h"
+#include "../udp.h"
+#include "../ws.h"
+#include "../tcpmux.h"
 
 #include "../pair.h"
 #include "../pubsub.h"
@@ -51,7 +56,12 @@ static const struct sym_value_name sym_value_names[] = {
 
     {NN_INPROC, "NN_INPROC"},
     {NN_IPC, "NN_IPC"},
+    {NN_SHM, "NN_SHM"},
     {NN_TCP, "NN_TCP"},
+    {NN_UDPM, "NN_UDPM"},
+    {NN_UDP, "NN_UDP"},
+    {NN_WS, "NN_WS"},
+    {NN_TCPMUX, "NN_TCPMUX"},
 
     {NN_PAIR, "NN_PAIR"},
     {NN_PUB, "NN_PUB"},
@@ -78,10 +88,32 @@ static const struct sym_value_name sym_value_names[] = {
     {NN_RECONNECT_IVL, "NN_RECONNECT_IVL"},
     {NN_RECONNECT_IVL_MAX, "NN_RECONNECT_IVL_MAX"},
     {NN_SNDPRIO, "NN_SNDPRIO"},
+    {NN_RCVPRIO, "NN_RCVPRIO"},
     {NN_SNDFD, "NN_SNDFD"},
     {NN_RCVFD, "NN_RCVFD"},
     {NN_DOMAIN, "NN_DOMAIN"},
     {NN_PROTOCOL, "NN_PROTOCOL"},
+    {NN_HANDSHAKE_TIMEOUT, "NN_HANDSHAKE_TIMEOUT"},
+    {NN_SNDSPIN, "NN_SNDSPIN"},
+    {NN_RCVSPIN, "NN_RCVSPIN"},
+    {NN_SNDWEIGHT, "NN_SNDWEIGHT"},
+    {NN_RCVQUANTUM, "NN_RCVQUANTUM"},
+    {NN_SNDLOWAT, "NN_SNDLOWAT"},
+    {NN_SNDBUFMSGS, "NN_SNDBUFMSGS"},
+    {NN_RCVBUFMSGS, "NN_RCVBUFMSGS"},
+    {NN_SNDLOWATMSGS, "NN_SNDLOWATMSGS"},
+    {NN_STATS, "NN_STATS"},
+    {NN_RECONNECT_JITTER, "NN_RECONNECT_JITTER"},
+    {NN_BGCLOSE, "NN_BGCLOSE"},
+    {NN_NUMA, "NN_NUMA"},
+    {NN_HEARTBEAT_IVL, "NN_HEARTBEAT_IVL"},
+    {NN_HEARTBEAT_MISSES, "NN_HEARTBEAT_MISSES"},
+    {NN_MEMBUDGET, "NN_MEMBUDGET"},
+
+    {NN_JITTER_NONE, "NN_JITTER_NONE"},
+    {NN_JITTER_PARTIAL, "NN_JITTER_PARTIAL"},
+    {NN_JITTER_FULL, "NN_JITTER_FULL"},
+    {NN_JITTER_DECORRELATED, "NN_JITTER_DECORRELATED"},
 
     {NN_SUB_SUBSCRIBE, "NN_SUB_SUBSCRIBE"},
     {NN_SUB_UNSUBSCRIBE, "NN_SUB_UNSUBSCRIBE"},
@@ -32,6 +32,10 @@ extern "C" {
 #define NN_SOURCE (NN_PROTO_FANIN * 16 + 0)
 #define NN_SINK (NN_PROTO_FANIN * 16 + 1)
 
+#define NN_SOURCE_STREAM 1
+
+#define NN_SINK_REORDER 1
+
 #ifdef __cplusplus
 }
 #endif
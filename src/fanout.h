@@ -32,6 +32,11 @@ extern "C" {
 #define NN_PUSH (NN_PROTO_FANOUT * 16 + 0)
 #define NN_PULL (NN_PROTO_FANOUT * 16 + 1)
 
+#define NN_PUSH_AFFINITY 1
+#define NN_PUSH_SPOOL 2
+
+#define NN_PULL_CREDIT 1
+
 #ifdef __cplusplus
 }
 #endif
@@ -29,6 +29,10 @@ extern "C" {
 
 #define NN_INPROC -1
 
+#define NN_INPROC_CHUNKS 1
+#define NN_INPROC_PREFAULT 2
+#define NN_INPROC_ALLOCTYPE 3
+
 #ifdef __cplusplus
 }
 #endif
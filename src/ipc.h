@@ -29,6 +29,8 @@ extern "C" {
 
 #define NN_IPC -2
 
+#define NN_IPC_SEQPACKET 1
+
 #ifdef __cplusplus
 }
 #endif
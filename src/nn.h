@@ -151,8 +151,67 @@ NN_EXPORT void nn_term (void);
 
 #define NN_MSG ((size_t) -1)
 
+/*  Allocation mechanisms that can be passed to nn_allocmsg. Types from
+    NN_ALLOC_USER up to NN_ALLOC_MAX - 1 can be defined by the user
+    using nn_setallocator. */
+#define NN_ALLOC_DEFAULT 0
+#define NN_ALLOC_POOL 1
+#define NN_ALLOC_SHARED 2
+#define NN_ALLOC_USER 16
+#define NN_ALLOC_MAX 32
+
+struct nn_allocator {
+    void *(*alloc) (size_t size);
+    void (*free) (void *ptr);
+};
+
+typedef void (nn_freefn) (void *buf, void *arg);
+
 NN_EXPORT void *nn_allocmsg (size_t size, int type);
 NN_EXPORT int nn_freemsg (void *msg);
+NN_EXPORT int nn_setallocator (int type, const struct nn_allocator *allocator);
+NN_EXPORT void *nn_extmsg (void *buf, size_t size, nn_freefn *ffn, void *arg);
+NN_EXPORT void *nn_filemsg (int fd, unsigned long long offset, size_t size);
+NN_EXPORT int nn_addrefmsg (void *msg);
+
+/*  Memory held by the library, per subsystem, as returned by nn_allocstats.
+    'bytes' and 'blocks' describe the memory allocated at the moment,
+    'allocs' is the number of allocations done so far. */
+struct nn_alloc_stat {
+    const char *name;
+    long long bytes;
+    long long blocks;
+    unsigned long long allocs;
+};
+
+NN_EXPORT int nn_allocstats (struct nn_alloc_stat *stats, int count);
+
+/*  Contention on the locks of the library, per place the lock is initialised
+    at, as returned by nn_lockstats. The times are in nanoseconds. waits[i]
+    is the number of contended acquisitions that waited for 2^i to
+    2^(i+1)-1 nanoseconds, the last one counts the longer waits as well. */
+#define NN_LOCK_BUCKETS 32
+
+struct nn_lock_stat {
+    const char *name;
+    unsigned long long locks;
+    unsigned long long contended;
+    unsigned long long waitns;
+    unsigned long long maxwaitns;
+    unsigned long long waits [NN_LOCK_BUCKETS];
+};
+
+NN_EXPORT int nn_lockstats (struct nn_lock_stat *stats, int count);
+
+/*  Memory management functions used for all the memory the library
+    allocates internally, as passed to nn_setmemfns. */
+struct nn_memfns {
+    void *(*alloc) (size_t size);
+    void *(*realloc) (void *ptr, size_t size);
+    void (*free) (void *ptr);
+};
+
+NN_EXPORT int nn_setmemfns (const struct nn_memfns *fns);
 
 /******************************************************************************/
 /*  Socket definition.                                                        */
@@ -170,6 +229,11 @@ struct nn_msghdr {
     size_t msg_controllen;
 };
 
+struct nn_mmsghdr {
+    struct nn_msghdr msg_hdr;
+    size_t msg_len;
+};
+
 struct nn_cmsghdr {
     size_t cmsg_len;
     int cmsg_level;
@@ -183,7 +247,7 @@ NN_EXPORT struct nn_cmsghdr *nn_cmsg_nexthdr (const struct nn_msghdr *mhdr,
 
 #define NN_CMSG_FIRSTHDR(mhdr) \
     ((mhdr)->msg_controllen >= sizeof (struct nn_cmsghdr) \
-    ? (struct nn_cmsghdr*) (mhdr)->msg_control : (struct cmsghdr*) NULL)
+    ? (struct nn_cmsghdr*) (mhdr)->msg_control : (struct nn_cmsghdr*) NULL)
 
 #define NN_CMSG_NXTHDR(mhdr,cmsg) \
     nn_cmsg_nexthdr ((struct nn_msghdr*) (mhdr), (struct nn_cmsghdr*) (cmsg))
@@ -198,10 +262,19 @@ NN_EXPORT struct nn_cmsghdr *nn_cmsg_nexthdr (const struct nn_msghdr *mhdr,
 /* Extensions to POSIX defined by RFC3542.                                    */
 
 #define NN_CMSG_SPACE(len) \
-    (CMSG_ALIGN (len) + CMSG_ALIGN (sizeof (struct nn_cmsghdr)))
+    (NN_CMSG_ALIGN (len) + NN_CMSG_ALIGN (sizeof (struct nn_cmsghdr)))
 
 #define NN_CMSG_LEN(len) \
-    (CMSG_ALIGN (sizeof (struct nn_cmsghdr)) + (len))
+    (NN_CMSG_ALIGN (sizeof (struct nn_cmsghdr)) + (len))
+
+/*  Levels and types of the control information.                              */
+#define PROTO_SP 1
+#define SP_HDR 1
+#define SP_TRACE 2
+
+/*  Size of the trace context carried by SP_TRACE entries, e.g. a 16-byte
+    trace ID followed by an 8-byte span ID.                                   */
+#define NN_TRACE_SIZE 24
 
 /*  SP address families.                                                      */
 #define AF_SP 1
@@ -223,13 +296,142 @@ NN_EXPORT struct nn_cmsghdr *nn_cmsg_nexthdr (const struct nn_msghdr *mhdr,
 #define NN_RECONNECT_IVL 6
 #define NN_RECONNECT_IVL_MAX 7
 #define NN_SNDPRIO 8
+#define NN_RCVPRIO 9
 #define NN_SNDFD 10
 #define NN_RCVFD 11
 #define NN_DOMAIN 12
 #define NN_PROTOCOL 13
+#define NN_HANDSHAKE_TIMEOUT 14
+#define NN_SNDSPIN 15
+#define NN_RCVSPIN 16
+#define NN_SNDWEIGHT 17
+#define NN_RCVQUANTUM 18
+#define NN_SNDLOWAT 19
+#define NN_SNDBUFMSGS 20
+#define NN_RCVBUFMSGS 21
+#define NN_SNDLOWATMSGS 22
+#define NN_STATS 23
+#define NN_RECONNECT_JITTER 24
+#define NN_RCVTIMESTAMP 25
+#define NN_RCVCHUNKS 26
+#define NN_BGCLOSE 27
+#define NN_NUMA 28
+#define NN_HEARTBEAT_IVL 29
+#define NN_HEARTBEAT_MISSES 30
+#define NN_MEMBUDGET 31
+#define NN_SNDTTL 32
+#define NN_TRACECTX 33
+#define NN_SINGLE_THREADED 34
+#define NN_CODEL_TARGET 35
+#define NN_CODEL_INTERVAL 36
+#define NN_RCVALLOC 37
+#define NN_SNDBATCH 38
+#define NN_SNDBATCHBYTES 39
+#define NN_CAPTURE 40
+
+/*  Values of NN_RECONNECT_JITTER socket option.                              */
+#define NN_JITTER_NONE 0
+#define NN_JITTER_PARTIAL 1
+#define NN_JITTER_FULL 2
+#define NN_JITTER_DECORRELATED 3
 
 /*  Send/recv options.                                                        */
 #define NN_DONTWAIT 1
+#define NN_URGENT 2
+
+/*  Latency statistics, in microseconds, as returned by NN_REQ_LATENCY and
+    NN_SURVEYOR_LATENCY socket options.                                       */
+struct nn_latency_stats {
+    unsigned long long count;
+    unsigned long long min;
+    unsigned long long mean;
+    unsigned long long max;
+    unsigned long long p50;
+    unsigned long long p90;
+    unsigned long long p99;
+    unsigned long long p999;
+};
+
+/*  Statistics of a socket as returned by NN_STATS socket option. The sizes
+    are the sizes of message bodies, the times are in microseconds. The
+    counters only ever grow while the socket is open.                         */
+struct nn_sock_stats {
+
+    /*  Messages sent and received by the user. */
+    unsigned long long sent;
+    unsigned long long sentbytes;
+    unsigned long long received;
+    unsigned long long receivedbytes;
+
+    /*  Messages the socket accepted but dropped before passing them to
+        a peer, e.g. because the peer was not keeping up. */
+    unsigned long long dropped;
+    unsigned long long droppedbytes;
+
+    /*  Connections to peers established and broken so far. Every reconnect
+        counts as a new connection, so the difference between the two is
+        the number of connections open at the moment. */
+    unsigned long long connects;
+    unsigned long long disconnects;
+
+    /*  Time spent blocked in send and recv calls. */
+    unsigned long long sndblocked;
+    unsigned long long rcvblocked;
+
+    /*  Memory held by the pipes of the socket if NN_MEMBUDGET is set, and
+        the number of times the pipes had to wait for it to drop below
+        the budget. */
+    unsigned long long memused;
+    unsigned long long memwaits;
+
+    /*  Messages dropped because their NN_SNDTTL ran out before they were
+        sent to the peer or received by the user. */
+    unsigned long long expired;
+    unsigned long long expiredbytes;
+
+    /*  Messages dropped because they had been queued for too long, i.e.
+        requests queued for longer than NN_REP_MAXWAIT allows, messages
+        dropped by the queue management policy (NN_CODEL_TARGET) and
+        messages overwritten in the shared ring of a shm publisher before
+        the subscriber read them. */
+    unsigned long long shed;
+    unsigned long long shedbytes;
+
+    /*  Time the I/O thread serving the socket spent waiting for events,
+        waiting for the socket to be unlocked by the user, running timers,
+        doing I/O on the connections, including parsing the data and passing
+        the messages to the socket, handling events signalled by other
+        threads and updating the set of polled connections. If the thread is
+        shared with other sockets, the times are those of the whole thread. */
+    unsigned long long iowait;
+    unsigned long long iolock;
+    unsigned long long iotimers;
+    unsigned long long io;
+    unsigned long long ioevents;
+    unsigned long long ioops;
+
+    /*  Handler threads serving the socket via nn_serve, requests being
+        handled by them at the moment and requests handled so far. Once all
+        the handlers are busy, incoming requests queue up in the socket. */
+    unsigned long long handlers;
+    unsigned long long handling;
+    unsigned long long handled;
+
+    /*  Peers disconnected because they were not keeping up, see
+        NN_PUB_EVICT_TIMEOUT and NN_PUB_EVICT_DROPS. */
+    unsigned long long evicted;
+};
+
+/*  Time, in microseconds, a thread of the library's worker pool spent waiting
+    for activity, running timers, handling events on file descriptors and
+    executing tasks such as asynchronous operations, as returned by
+    nn_workerstats.                                                           */
+struct nn_worker_stat {
+    unsigned long long wait;
+    unsigned long long timers;
+    unsigned long long fds;
+    unsigned long long tasks;
+};
 
 NN_EXPORT int nn_socket (int domain, int protocol);
 NN_EXPORT int nn_close (int s);
@@ -244,12 +446,80 @@ NN_EXPORT int nn_send (int s, const void *buf, size_t len, int flags);
 NN_EXPORT int nn_recv (int s, void *buf, size_t len, int flags);
 NN_EXPORT int nn_sendmsg (int s, const struct nn_msghdr *msghdr, int flags);
 NN_EXPORT int nn_recvmsg (int s, struct nn_msghdr *msghdr, int flags);
+NN_EXPORT int nn_sendmmsg (int s, struct nn_mmsghdr *msgvec, unsigned int vlen,
+    int flags);
+NN_EXPORT int nn_recvmmsg (int s, struct nn_mmsghdr *msgvec, unsigned int vlen,
+    int flags);
+NN_EXPORT int nn_workerstats (struct nn_worker_stat *stats, int count);
+
+/******************************************************************************/
+/*  Asynchronous sending and receiving.                                       */
+/******************************************************************************/
+
+NN_EXPORT int nn_send_async (int s, const void *buf, size_t len, int flags,
+    void (*fn) (int s, int rc, void *arg), void *arg);
+NN_EXPORT int nn_recv_async (int s, void *buf, size_t len, int flags,
+    void (*fn) (int s, int rc, void *arg), void *arg);
+
+/******************************************************************************/
+/*  Contexts.                                                                 */
+/******************************************************************************/
+
+NN_EXPORT int nn_ctx_open (int s);
+NN_EXPORT int nn_ctx_close (int s, int ctx);
+NN_EXPORT int nn_ctx_send (int s, int ctx, const void *buf, size_t len,
+    int flags);
+NN_EXPORT int nn_ctx_recv (int s, int ctx, void *buf, size_t len, int flags);
+
+/******************************************************************************/
+/*  Socket multiplexing support.                                              */
+/******************************************************************************/
+
+#define NN_POLLIN 1
+#define NN_POLLOUT 2
+
+/*  Reported for OS-level file descriptors in an error or hang-up state. */
+#define NN_POLLERR 4
+
+/*  Set in 'events' if 'fd' is an OS-level file descriptor rather than
+    an SP socket. */
+#define NN_POLLSYSFD 8
+
+struct nn_pollfd {
+    int fd;
+    short events;
+    short revents;
+};
+
+NN_EXPORT int nn_poll (struct nn_pollfd *fds, int nfds, int timeout);
+
+/******************************************************************************/
+/*  Integration with external event loops.                                    */
+/******************************************************************************/
+
+NN_EXPORT int nn_processfd (void);
+NN_EXPORT int nn_process (int timeout);
+
+/******************************************************************************/
+/*  Built-in request serving.                                                 */
+/******************************************************************************/
+
+NN_EXPORT int nn_serve (int s, int nthreads,
+    void *(*fn) (void *req, size_t len, void *arg), void *arg);
+
+/******************************************************************************/
+/*  Hot restart.                                                              */
+/******************************************************************************/
+
+NN_EXPORT int nn_handoff (int s, int fd);
+NN_EXPORT int nn_adopt (int s, int fd);
 
 /******************************************************************************/
 /*  Built-in support for devices.                                             */
 /******************************************************************************/
 
 NN_EXPORT int nn_device (int s1, int s2);
+NN_EXPORT int nn_device_threads (int s1, int s2, int nthreads);
 
 #undef NN_EXPORT
 
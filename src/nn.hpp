@@ -0,0 +1,168 @@
+/*
+    Copyright (c) 2013 250bpm s.r.o.
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"),
+    to deal in the Software without restriction, including without limitation
+    the rights to use, copy, modify, merge, publish, distribute, sublicense,
+    and/or sell copies of the Software, and to permit persons to whom
+    the Software is furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included
+    in all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+    THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+    FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+    IN THE SOFTWARE.
+*/
+
+#ifndef NN_HPP_INCLUDED
+#define NN_HPP_INCLUDED
+
+/*  C++20 coroutine layer on top of nn_send_async and nn_recv_async.
+
+        int nbytes = co_await nn::async_recv (s, buf, sizeof (buf));
+
+    By default the coroutine is resumed in the nanomsg worker thread that
+    completed the operation. To resume it elsewhere, pass an executor, i.e.
+    any callable accepting std::coroutine_handle<>, that schedules the handle
+    to be resumed in the desired context. Errors are reported by throwing
+    std::system_error in nn::category (). */
+
+#include "nn.h"
+
+#include <coroutine>
+#include <cstddef>
+#include <string>
+#include <system_error>
+#include <utility>
+
+namespace nn
+{
+
+    class error_category : public std::error_category
+    {
+    public:
+
+        const char *name () const noexcept
+        {
+            return "nanomsg";
+        }
+
+        std::string message (int errnum) const
+        {
+            return nn_strerror (errnum);
+        }
+    };
+
+    inline const std::error_category &category ()
+    {
+        static const error_category instance;
+        return instance;
+    }
+
+    /*  Resumes the coroutine directly in the worker thread. */
+    struct inline_executor
+    {
+        void operator () (std::coroutine_handle <> handle) const
+        {
+            handle.resume ();
+        }
+    };
+
+    namespace detail
+    {
+
+        template <typename Executor> class operation
+        {
+        public:
+
+            operation (int s, void *buf, size_t len, bool recv,
+                  Executor executor) :
+                s (s), buf (buf), len (len), recv (recv), result (0),
+                executor (std::move (executor))
+            {
+            }
+
+            operation (const operation&) = delete;
+            operation &operator = (const operation&) = delete;
+
+            bool await_ready () const noexcept
+            {
+                return false;
+            }
+
+            bool await_suspend (std::coroutine_handle <> h)
+            {
+                handle = h;
+                int rc = recv ? nn_recv_async (s, buf, len, 0, done, this) :
+                    nn_send_async (s, buf, len, 0, done, this);
+
+                /*  Once the operation is queued, the coroutine may be resumed
+                    and this object destroyed at any time. Don't touch it. */
+                if (rc == 0)
+                    return true;
+                result = -nn_errno ();
+                return false;
+            }
+
+            int await_resume () const
+            {
+                if (result < 0)
+                    throw std::system_error (-result, category ());
+                return result;
+            }
+
+        private:
+
+            static void done (int, int rc, void *arg)
+            {
+                operation *self = static_cast <operation*> (arg);
+
+                /*  The executor may resume the coroutine before it returns,
+                    so take everything needed out of the object first. */
+                self->result = rc;
+                std::coroutine_handle <> h = self->handle;
+                Executor executor (std::move (self->executor));
+                executor (h);
+            }
+
+            int s;
+            void *buf;
+            size_t len;
+            bool recv;
+            int result;
+            Executor executor;
+            std::coroutine_handle <> handle;
+        };
+
+    }
+
+    /*  Sends the message. The buffer is copied (or, with NN_MSG, taken
+        over) before the coroutine is suspended. Evaluates to the number of
+        bytes sent. */
+    template <typename Executor = inline_executor>
+    detail::operation <Executor> async_send (int s, const void *buf,
+        size_t len, Executor executor = Executor ())
+    {
+        return detail::operation <Executor> (s, const_cast <void*> (buf),
+            len, false, std::move (executor));
+    }
+
+    /*  Receives a message into the buffer, which has to stay valid till the
+        coroutine is resumed. Evaluates to the size of the message. */
+    template <typename Executor = inline_executor>
+    detail::operation <Executor> async_recv (int s, void *buf, size_t len,
+        Executor executor = Executor ())
+    {
+        return detail::operation <Executor> (s, buf, len, true,
+            std::move (executor));
+    }
+
+}
+
+#endif
@@ -23,6 +23,8 @@
 #ifndef NN_PROTOCOL_INCLUDED
 #define NN_PROTOCOL_INCLUDED
 
+#include "nn.h"
+
 #include "aio/aio.h"
 
 #include "utils/list.h"
@@ -30,6 +32,9 @@
 #include "utils/msg.h"
 #include "utils/efd.h"
 #include "utils/sem.h"
+#include "utils/cacheline.h"
+#include "utils/budget.h"
+#include "utils/atomic.h"
 
 #include <stddef.h>
 #include <stdint.h>
@@ -60,6 +65,15 @@ void nn_pipe_setdata (struct nn_pipe *self, void *data);
 /*  Retrieves the opaque pointer associated with the pipe. */
 void *nn_pipe_getdata (struct nn_pipe *self);
 
+/*  Returns the ID of the endpoint the pipe belongs to, i.e. the value
+    returned from the nn_bind or nn_connect call that created it. */
+int nn_pipe_geteid (struct nn_pipe *self);
+
+/*  Returns the send and receive priorities of the pipe, i.e. the values of
+    NN_SNDPRIO and NN_RCVPRIO at the time its endpoint was created. */
+int nn_pipe_getsndprio (struct nn_pipe *self);
+int nn_pipe_getrcvprio (struct nn_pipe *self);
+
 /*  Send the message to the pipe. If successful, pipe takes ownership of the
     messages. */
 int nn_pipe_send (struct nn_pipe *self, struct nn_msg *msg);
@@ -68,6 +82,17 @@ int nn_pipe_send (struct nn_pipe *self, struct nn_msg *msg);
     the call. It will be initialised when the call succeeds. */
 int nn_pipe_recv (struct nn_pipe *self, struct nn_msg *msg);
 
+/*  Returns 1 if the message has outlived its NN_SNDTTL, in which case it's
+    to be dropped by the caller, 0 otherwise. The drop is reported in NN_STATS
+    socket option of the socket the pipe belongs to. */
+int nn_pipe_expired (struct nn_pipe *self, struct nn_msg *msg);
+
+/*  Breaks the connection as if it failed, e.g. because the peer is not
+    keeping up. The pipe is removed from the socket before the function
+    returns, the connecting side reconnects as usual. Returns -ENOTSUP if
+    the transport is not able to break the connection. */
+int nn_pipe_close (struct nn_pipe *self);
+
 /******************************************************************************/
 /*  Base class for all socket types.                                          */
 /******************************************************************************/
@@ -75,7 +100,7 @@ int nn_pipe_recv (struct nn_pipe *self, struct nn_msg *msg);
 struct nn_sockbase;
 
 /*  The maximum implemented transport ID. */
-#define NN_MAX_TRANSPORT 3
+#define NN_MAX_TRANSPORT 6
 
 #define NN_SOCKBASE_EVENT_IN 1
 #define NN_SOCKBASE_EVENT_OUT 2
@@ -86,6 +111,15 @@ struct nn_sockbase;
 /*  Specifies that the socket type can be never used to send messages. */
 #define NN_SOCKBASE_FLAG_NOSEND 2
 
+/*  Specifies that the socket type passes the received messages to the user
+    as they are, so that they can be received in chunks (see NN_RCVCHUNKS). */
+#define NN_SOCKBASE_FLAG_PASSTHROUGH 4
+
+/*  Specifies that the socket type tolerates the messages it sends being
+    dropped on the way, so that the transports may drop those that have been
+    queued for too long (see NN_CODEL_TARGET). */
+#define NN_SOCKBASE_FLAG_LOSSY 8
+
 /*  To be implemented by individual socket types. */
 struct nn_sockbase_vfptr {
 
@@ -130,18 +164,47 @@ struct nn_sockbase_vfptr {
     /*  Retrieve a protocol specific option. */
     int (*getopt) (struct nn_sockbase *self, int level, int option,
         void *optval, size_t *optvallen);
+
+    /*  Contexts, see nn_ctx_open. Each context is a separate instance of
+        the protocol state sharing the pipes of the socket. 'ctxopen' creates
+        the state, 'ctxclose' deallocates it. 'ctxsend' and 'ctxrecv' behave
+        the same as 'send' and 'recv', except that they use the state of the
+        context rather than the state of the socket. Socket types that don't
+        support contexts leave these NULL. */
+    int (*ctxopen) (struct nn_sockbase *self, void **ctx);
+    void (*ctxclose) (struct nn_sockbase *self, void *ctx);
+    int (*ctxsend) (struct nn_sockbase *self, void *ctx, struct nn_msg *msg);
+    int (*ctxrecv) (struct nn_sockbase *self, void *ctx, struct nn_msg *msg);
+
+    /*  Optional. Set a protocol specific option without the socket being
+        locked, so that an expensive change doesn't stall the threads sending
+        and receiving. The socket has to lock the completion port itself
+        (see nn_sockbase_getcp) to touch any state shared with them and call
+        nn_sockbase_changed if the events may have changed. Returning
+        -ENOPROTOOPT passes the option on to 'setopt'. */
+    int (*setoptunlocked) (struct nn_sockbase *self, int level, int option,
+        const void *optval, size_t optvallen);
+
+    /*  Optional. Returns NN_SOCKBASE_EVENT_IN if a message can be received
+        from the context. Sockets whose contexts don't simply share the state
+        of the socket implement this, so that a thread blocked in
+        nn_ctx_recv is woken up when its own context becomes readable rather
+        than when the socket does. */
+    int (*ctxevents) (struct nn_sockbase *self, void *ctx);
 };
 
 /*  The members of this structure are used exclusively by the core. Never use
-    or modify them directly from the protocol implementation. */
+    or modify them directly from the protocol implementation. The options and
+    other rarely modified members come first. The socket state, written by
+    both the user threads and the worker thread, and the efds, which threads
+    blocked in send and recv access without locking the socket, are kept on
+    separate cache lines. */
 struct nn_sockbase
 {
     const struct nn_sockbase_vfptr *vfptr;
-    int flags;
-    struct nn_cp cp;
-    struct nn_efd sndfd;
-    struct nn_efd rcvfd;
+    struct nn_cp *cp;
     struct nn_sem termsem;
+    struct nn_sem servesem;
     struct nn_clock clock;
     struct nn_list eps;
     int eid;
@@ -154,9 +217,71 @@ struct nn_sockbase
     int rcvtimeo;
     int reconnect_ivl;
     int reconnect_ivl_max;
+    int reconnect_jitter;
     int sndprio;
     int rcvprio;
+    int handshake_timeout;
+    int sndspin;
+    int rcvspin;
+    int sndweight;
+    int rcvquantum;
+    int sndlowat;
+    int sndbufmsgs;
+    int rcvbufmsgs;
+    int sndlowatmsgs;
+    int rcvtimestamp;
+    int rcvchunks;
+    int rcvalloc;
+    int sndbatch;
+    int sndbatchbytes;
+    int bgclose;
+    int numa;
+    int node;
+    int heartbeat_ivl;
+    int heartbeat_misses;
+    int membudget;
+    int sndttl;
+    int tracectx;
+    int singlethreaded;
+    int codeltarget;
+    int codelinterval;
+    struct nn_capture *capture;
+    uint32_t pipeids;
+    struct nn_budget budget;
     struct nn_optset *optsets [NN_MAX_TRANSPORT];
+    void **ctxs;
+    int nctxs;
+    void (*closed) (void *arg);
+    void *closedarg;
+    NN_CACHELINE_PAD (pad1);
+    int flags;
+    /*  Copy of the IN, OUT, ZOMBIE and CLOSING bits of 'flags', published
+        whenever they change so that it can be read without locking the
+        socket. */
+    struct nn_atomic ready;
+    int sndwaiters;
+    int rcvwaiters;
+    int rcvwoken;
+    struct nn_sock_stats stats;
+    struct nn_list pollers;
+    struct nn_list rcvwaitq;
+    struct nn_list rcvidle;
+    struct nn_list sndops;
+    struct nn_list rcvops;
+    struct nn_list deferred;
+    NN_CACHELINE_PAD (pad2);
+    struct nn_efd sndfd;
+    NN_CACHELINE_PAD (pad3);
+    struct nn_efd rcvfd;
+    NN_CACHELINE_PAD (pad4);
+
+    /*  Statistics of nn_serve, updated by the handler threads without
+        locking the socket, except for the handler threads leaving, which
+        nn_close waits for. */
+    struct nn_atomic handlers;
+    struct nn_atomic handling;
+    struct nn_atomic64 handled;
+    NN_CACHELINE_PAD (pad5);
 };
 
 /*  Initialise the socket. */
@@ -177,6 +302,20 @@ void nn_sockbase_changed (struct nn_sockbase *self);
 /*  Returns the completion port associated with the socket. */
 struct nn_cp *nn_sockbase_getcp (struct nn_sockbase *self);
 
+/*  Call this function when the socket drops a message it has accepted from
+    the user instead of passing it to a peer. 'size' is the size of
+    the message body. The drop is reported in NN_STATS socket option. */
+void nn_sockbase_dropped (struct nn_sockbase *self, size_t size);
+
+/*  Call this function when the socket drops a message received from a peer
+    because it's overloaded. 'size' is the size of the message body. The drop
+    is reported in NN_STATS socket option. */
+void nn_sockbase_shed (struct nn_sockbase *self, size_t size);
+
+/*  Call this function when the socket evicts a peer that is not keeping up.
+    The eviction is reported in NN_STATS socket option. */
+void nn_sockbase_evicted (struct nn_sockbase *self);
+
 /******************************************************************************/
 /*  The socktype class.                                                       */
 /******************************************************************************/
@@ -191,13 +330,8 @@ struct nn_socktype {
 
     /*  Function to create the socket type. 'sockbase' is the output parameter
         to return reference to newly created socket. This function is called
-        under global lock, so it is not possible that two sockets are being
-        created in parallel. */
+        without global lock, so several sockets may be created in parallel. */
     int (*create) (struct nn_sockbase **sockbase);
-
-    /*  This member is owned by the core. Never touch it directly from inside
-        the protocol implementation. */
-    struct nn_list_item item;
 };
 
 #endif
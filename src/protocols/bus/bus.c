@@ -139,8 +139,7 @@ static int nn_bus_create (struct nn_sockbase **sockbase)
 static struct nn_socktype nn_bus_socktype_struct = {
     AF_SP,
     NN_BUS,
-    nn_bus_create,
-    NN_LIST_ITEM_INITIALIZER
+    nn_bus_create
 };
 
 struct nn_socktype *nn_bus_socktype = &nn_bus_socktype_struct;
@@ -0,0 +1,153 @@
+/*
+    Copyright (c) 2012-2013 250bpm s.r.o.
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"),
+    to deal in the Software without restriction, including without limitation
+    the rights to use, copy, modify, merge, publish, distribute, sublicense,
+    and/or sell copies of the Software, and to permit persons to whom
+    the Software is furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included
+    in all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+    THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+    FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+    IN THE SOFTWARE.
+*/
+
+
+#include "dedup.h"
+
+#include "../../utils/alloc.h"
+#include "../../utils/fast.h"
+#include "../../utils/err.h"
+
+#include <string.h>
+
+/*  Private functions. */
+static uint64_t nn_dedup_hash (const void *data, size_t size);
+static size_t nn_dedup_find (struct nn_dedup *self, uint64_t hash);
+static void nn_dedup_erase (struct nn_dedup *self, size_t slot);
+
+void nn_dedup_init (struct nn_dedup *self)
+{
+    self->capacity = 0;
+    self->ring = NULL;
+    self->pos = 0;
+    self->count = 0;
+    self->table = NULL;
+    self->mask = 0;
+}
+
+void nn_dedup_term (struct nn_dedup *self)
+{
+    nn_dedup_resize (self, 0);
+}
+
+void nn_dedup_resize (struct nn_dedup *self, size_t capacity)
+{
+    size_t size;
+
+    if (self->ring) {
+        nn_free (self->ring);
+        nn_free (self->table);
+    }
+    nn_dedup_init (self);
+    if (!capacity)
+        return;
+
+    size = 2;
+    while (size < 2 * capacity)
+        size *= 2;
+    self->capacity = capacity;
+    self->ring = nn_alloc (capacity * sizeof (uint64_t), "dedup ring");
+    alloc_assert (self->ring);
+    self->table = nn_alloc (size * sizeof (uint64_t), "dedup table");
+    alloc_assert (self->table);
+    memset (self->table, 0, size * sizeof (uint64_t));
+    self->mask = size - 1;
+}
+
+int nn_dedup_check (struct nn_dedup *self, const void *data, size_t size)
+{
+    uint64_t hash;
+    size_t slot;
+
+    if (!self->capacity)
+        return 0;
+
+    hash = nn_dedup_hash (data, size);
+    slot = nn_dedup_find (self, hash);
+    if (self->table [slot] == hash)
+        return 1;
+
+    /*  Make room for the new hash by forgetting the oldest one. This may move
+        the hashes around in the table, so the slot has to be found anew. */
+    if (self->count == self->capacity) {
+        nn_dedup_erase (self, nn_dedup_find (self, self->ring [self->pos]));
+        slot = nn_dedup_find (self, hash);
+    }
+    else
+        ++self->count;
+    self->table [slot] = hash;
+    self->ring [self->pos] = hash;
+    self->pos = (self->pos + 1) % self->capacity;
+
+    return 0;
+}
+
+static uint64_t nn_dedup_hash (const void *data, size_t size)
+{
+    const uint8_t *p;
+    uint64_t hash;
+    size_t i;
+
+    /*  FNV-1a. Zero is reserved for empty slots. */
+    p = (const uint8_t*) data;
+    hash = 14695981039346656037ULL;
+    for (i = 0; i != size; ++i)
+        hash = (hash ^ p [i]) * 1099511628211ULL;
+    return hash ? hash : 1;
+}
+
+static size_t nn_dedup_find (struct nn_dedup *self, uint64_t hash)
+{
+    size_t slot;
+
+    /*  Returns the slot holding the hash or the empty slot where it would
+        be stored. */
+    slot = (size_t) (hash ^ (hash >> 32)) & self->mask;
+    while (self->table [slot] && self->table [slot] != hash)
+        slot = (slot + 1) & self->mask;
+    return slot;
+}
+
+static void nn_dedup_erase (struct nn_dedup *self, size_t slot)
+{
+    size_t next;
+    size_t home;
+
+    nn_assert (self->table [slot]);
+
+    /*  Backward-shift deletion. The hashes following the erased one are moved
+        back unless they are already at their home slots or beyond, so that
+        no hash is separated from its home slot by an empty slot. */
+    next = slot;
+    while (1) {
+        next = (next + 1) & self->mask;
+        if (!self->table [next])
+            break;
+        home = (size_t) (self->table [next] ^ (self->table [next] >> 32)) &
+            self->mask;
+        if (((next - home) & self->mask) < ((next - slot) & self->mask))
+            continue;
+        self->table [slot] = self->table [next];
+        slot = next;
+    }
+    self->table [slot] = 0;
+}
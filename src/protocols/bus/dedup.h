@@ -0,0 +1,67 @@
+/*
+    Copyright (c) 2012-2013 250bpm s.r.o.
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"),
+    to deal in the Software without restriction, including without limitation
+    the rights to use, copy, modify, merge, publish, distribute, sublicense,
+    and/or sell copies of the Software, and to permit persons to whom
+    the Software is furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included
+    in all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+    THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+    FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+    IN THE SOFTWARE.
+*/
+
+
+#ifndef NN_DEDUP_INCLUDED
+#define NN_DEDUP_INCLUDED
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*  Remembers the hashes of the last messages seen so that the duplicates
+    can be recognised. When the cache is full, the oldest hash is forgotten.
+    The hashes are kept both in the order of arrival, to know which one is
+    the oldest, and in an open-addressing hash table with linear probing,
+    so that both the lookup and the eviction take constant time. */
+
+struct nn_dedup {
+
+    /*  Maximum number of hashes remembered, zero if the cache is off. */
+    size_t capacity;
+
+    /*  The hashes in the order of arrival. The oldest one is at 'pos' once
+        the ring is full. */
+    uint64_t *ring;
+    size_t pos;
+    size_t count;
+
+    /*  The hash table. Its size is a power of two at least twice the capacity.
+        Zero marks an empty slot. */
+    uint64_t *table;
+    size_t mask;
+};
+
+/*  Initialise an empty cache that remembers no hashes. */
+void nn_dedup_init (struct nn_dedup *self);
+
+/*  Terminate the cache. */
+void nn_dedup_term (struct nn_dedup *self);
+
+/*  Forgets all the hashes and sets the number of hashes to remember. */
+void nn_dedup_resize (struct nn_dedup *self, size_t capacity);
+
+/*  Returns 1 if the data were already seen recently, 0 otherwise. In the
+    latter case, the data are remembered. If the cache is off, always
+    returns 0. */
+int nn_dedup_check (struct nn_dedup *self, const void *data, size_t size);
+
+#endif
@@ -40,6 +40,9 @@
     neccessary for the pointer to fit in 64-bit ID. */
 CT_ASSERT (sizeof (uint64_t) >= sizeof (struct nn_pipe*));
 
+/*  Maximum number of messages remembered in the NN_BUS_DEDUP mode. */
+#define NN_XBUS_MAX_DEDUP 1048576
+
 /*  Implementation of nn_sockbase's virtual functions. */
 static void nn_xbus_destroy (struct nn_sockbase *self);
 static const struct nn_sockbase_vfptr nn_xbus_sockbase_vfptr = {
@@ -73,12 +76,14 @@ int nn_xbus_init (struct nn_xbus *self,
 
     nn_dist_init (&self->outpipes);
     nn_fq_init (&self->inpipes);
+    nn_dedup_init (&self->dedup);
 
     return 0;
 }
 
 void nn_xbus_term (struct nn_xbus *self)
 {
+    nn_dedup_term (&self->dedup);
     nn_fq_term (&self->inpipes);
     nn_dist_term (&self->outpipes);
     nn_sockbase_term (&self->sockbase);
@@ -104,7 +109,8 @@ int nn_xbus_add (struct nn_sockbase *self, struct nn_pipe *pipe)
     data = nn_alloc (sizeof (struct nn_xbus_data),
         "pipe data (xbus)");
     alloc_assert (data);
-    nn_fq_add (&xbus->inpipes, pipe, &data->initem, 8);
+    nn_fq_add (&xbus->inpipes, pipe, &data->initem, nn_pipe_getrcvprio (pipe),
+        self->rcvquantum);
     nn_dist_add (&xbus->outpipes, pipe, &data->outitem);
     nn_pipe_setdata (pipe, data);
 
@@ -157,6 +163,9 @@ int nn_xbus_send (struct nn_sockbase *self, struct nn_msg *msg)
 {
     size_t hdrsz;
     struct nn_pipe *exclude;
+    struct nn_xbus *xbus;
+
+    xbus = nn_cont (self, struct nn_xbus, sockbase);
 
     hdrsz = nn_chunkref_size (&msg->hdr);
     if (hdrsz == 0)
@@ -169,8 +178,15 @@ int nn_xbus_send (struct nn_sockbase *self, struct nn_msg *msg)
     else
         return -EINVAL;
 
-    return nn_dist_send (&nn_cont (self, struct nn_xbus, sockbase)->outpipes,
-        msg, exclude);
+    /*  Remember the message so that it's dropped if it comes back via
+        a cycle in the topology. */
+    if (xbus->dedup.capacity) {
+        nn_msg_flatten (msg);
+        nn_dedup_check (&xbus->dedup, nn_chunkref_data (&msg->body),
+            nn_chunkref_size (&msg->body));
+    }
+
+    return nn_dist_send (&xbus->outpipes, msg, exclude);
 }
 
 int nn_xbus_recv (struct nn_sockbase *self, struct nn_msg *msg)
@@ -189,8 +205,16 @@ int nn_xbus_recv (struct nn_sockbase *self, struct nn_msg *msg)
             return rc;
 
         /*  The message should have no header. Drop malformed messages. */
-        if (nn_chunkref_size (&msg->hdr) == 0)
-            break;
+        if (nn_chunkref_size (&msg->hdr) == 0) {
+            if (!xbus->dedup.capacity)
+                break;
+
+            /*  Drop the messages seen recently. */
+            nn_msg_flatten (msg);
+            if (!nn_dedup_check (&xbus->dedup, nn_chunkref_data (&msg->body),
+                  nn_chunkref_size (&msg->body)))
+                break;
+        }
         nn_msg_term (msg);
     }
 
@@ -206,12 +230,38 @@ int nn_xbus_recv (struct nn_sockbase *self, struct nn_msg *msg)
 int nn_xbus_setopt (struct nn_sockbase *self, int level, int option,
         const void *optval, size_t optvallen)
 {
+    struct nn_xbus *xbus;
+
+    xbus = nn_cont (self, struct nn_xbus, sockbase);
+
+    if (level == NN_BUS && option == NN_BUS_DEDUP) {
+        if (nn_slow (optvallen != sizeof (int)))
+            return -EINVAL;
+        if (nn_slow (*(int*) optval < 0 ||
+              *(int*) optval > NN_XBUS_MAX_DEDUP))
+            return -EINVAL;
+        nn_dedup_resize (&xbus->dedup, *(int*) optval);
+        return 0;
+    }
+
     return -ENOPROTOOPT;
 }
 
 int nn_xbus_getopt (struct nn_sockbase *self, int level, int option,
         void *optval, size_t *optvallen)
 {
+    struct nn_xbus *xbus;
+
+    xbus = nn_cont (self, struct nn_xbus, sockbase);
+
+    if (level == NN_BUS && option == NN_BUS_DEDUP) {
+        if (nn_slow (*optvallen < sizeof (int)))
+            return -EINVAL;
+        *(int*) optval = (int) xbus->dedup.capacity;
+        *optvallen = sizeof (int);
+        return 0;
+    }
+
     return -ENOPROTOOPT;
 }
 
@@ -235,8 +285,7 @@ static int nn_xbus_create (struct nn_sockbase **sockbase)
 static struct nn_socktype nn_xbus_socktype_struct = {
     AF_SP_RAW,
     NN_BUS,
-    nn_xbus_create,
-    NN_LIST_ITEM_INITIALIZER
+    nn_xbus_create
 };
 
 struct nn_socktype *nn_xbus_socktype = &nn_xbus_socktype_struct;
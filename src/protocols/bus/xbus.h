@@ -28,6 +28,8 @@
 #include "../../utils/dist.h"
 #include "../../utils/fq.h"
 
+#include "dedup.h"
+
 extern struct nn_socktype *nn_xbus_socktype;
 
 struct nn_xbus_data {
@@ -39,6 +41,10 @@ struct nn_xbus {
     struct nn_sockbase sockbase;
     struct nn_dist outpipes;
     struct nn_fq inpipes;
+
+    /*  Messages recently sent or received. Received messages that are
+        among them are dropped. See NN_BUS_DEDUP. */
+    struct nn_dedup dedup;
 };
 
 int nn_xbus_init (struct nn_xbus *self,
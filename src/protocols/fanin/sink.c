@@ -30,8 +30,7 @@
 static struct nn_socktype nn_sink_socktype_struct = {
     AF_SP,
     NN_SINK,
-    nn_xsink_create,
-    NN_LIST_ITEM_INITIALIZER
+    nn_xsink_create
 };
 
 struct nn_socktype *nn_sink_socktype = &nn_sink_socktype_struct;
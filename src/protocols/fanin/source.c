@@ -30,8 +30,7 @@
 static struct nn_socktype nn_source_socktype_struct = {
     AF_SP,
     NN_SOURCE,
-    nn_xsource_create,
-    NN_LIST_ITEM_INITIALIZER
+    nn_xsource_create
 };
 
 struct nn_socktype *nn_source_socktype = &nn_source_socktype_struct;
@@ -31,20 +31,71 @@
 #include "../../utils/alloc.h"
 #include "../../utils/fq.h"
 #include "../../utils/list.h"
+#include "../../utils/hash.h"
+#include "../../utils/queue.h"
+#include "../../utils/wire.h"
+
+#include <string.h>
+
+/*  Maximum size of the reorder window. */
+#define NN_XSINK_MAX_WINDOW 1024
 
 struct nn_xsink_data {
     struct nn_fq_data fq;
 };
 
+/*  Message received ahead of its turn. */
+struct nn_xsink_slot {
+    int present;
+    struct nn_msg msg;
+};
+
+/*  State of a stream of messages, i.e. of a producer or of a set of
+    replicated producers, identified by the stream ID in the message
+    header. */
+struct nn_xsink_stream {
+    struct nn_hash_item hash;
+    struct nn_list_item item;
+
+    /*  Sequence number of the next message to deliver. */
+    uint32_t next;
+
+    /*  Messages received ahead of 'next', indexed by their sequence numbers
+        modulo 'size', which is a power of two not less than the window. */
+    uint32_t size;
+    struct nn_xsink_slot *slots;
+};
+
+/*  Message ready to be received by the user. */
+struct nn_xsink_ready {
+    struct nn_queue_item item;
+    struct nn_msg msg;
+};
+
 struct nn_xsink {
     struct nn_sockbase sockbase;
     struct nn_fq fq;
+
+    /*  Size of the reorder window. Zero if the messages are not reordered. */
+    int window;
+
+    /*  Streams the messages were received from, both in a hash table keyed
+        by the stream ID and in a list. */
+    struct nn_hash streams;
+    struct nn_list streamlist;
+
+    /*  Messages already put in order, waiting to be received. */
+    struct nn_queue ready;
+    int nready;
 };
 
 /*  Private functions. */
 static int nn_xsink_init (struct nn_xsink *self,
     const struct nn_sockbase_vfptr *vfptr);
 static void nn_xsink_term (struct nn_xsink *self);
+static void nn_xsink_reorder (struct nn_xsink *self, struct nn_msg *msg);
+static void nn_xsink_deliver (struct nn_xsink *self, struct nn_msg *msg);
+static void nn_xsink_flush (struct nn_xsink *self);
 
 /*  Implementation of nn_sockbase's virtual functions. */
 static int nn_xsink_ispeer (int socktype);
@@ -89,12 +140,30 @@ static int nn_xsink_init (struct nn_xsink *self,
         return rc;
 
     nn_fq_init (&self->fq);
+    self->window = 0;
+    nn_hash_init (&self->streams);
+    nn_list_init (&self->streamlist);
+    nn_queue_init (&self->ready);
+    self->nready = 0;
 
     return 0;
 }
 
 static void nn_xsink_term (struct nn_xsink *self)
 {
+    struct nn_queue_item *it;
+    struct nn_xsink_ready *ready;
+
+    nn_xsink_flush (self);
+    while ((it = nn_queue_pop (&self->ready)) != NULL) {
+        ready = nn_cont (it, struct nn_xsink_ready, item);
+        nn_msg_term (&ready->msg);
+        nn_queue_item_term (&ready->item);
+        nn_free (ready);
+    }
+    nn_queue_term (&self->ready);
+    nn_list_term (&self->streamlist);
+    nn_hash_term (&self->streams);
     nn_fq_term (&self->fq);
     nn_sockbase_term (&self->sockbase);
 }
@@ -118,7 +187,8 @@ static int nn_xsink_add (struct nn_sockbase *self, struct nn_pipe *pipe)
     data = nn_alloc (sizeof (struct nn_xsink_data), "pipe data (sink)");
     alloc_assert (data);
     nn_pipe_setdata (pipe, data);
-    nn_fq_add (&xsink->fq, pipe, &data->fq, self->rcvprio);
+    nn_fq_add (&xsink->fq, pipe, &data->fq, nn_pipe_getrcvprio (pipe),
+        self->rcvquantum);
 
     return 0;
 }
@@ -152,30 +222,230 @@ static void nn_xsink_out (struct nn_sockbase *self, struct nn_pipe *pipe)
 
 static int nn_xsink_events (struct nn_sockbase *self)
 {
-    return nn_fq_can_recv (&nn_cont (self, struct nn_xsink, sockbase)->fq) ?
+    struct nn_xsink *xsink;
+
+    xsink = nn_cont (self, struct nn_xsink, sockbase);
+
+    return xsink->nready || nn_fq_can_recv (&xsink->fq) ?
         NN_SOCKBASE_EVENT_IN : 0;
 }
 
 static int nn_xsink_recv (struct nn_sockbase *self, struct nn_msg *msg)
 {
     int rc;
+    struct nn_xsink *xsink;
+    struct nn_queue_item *it;
+    struct nn_xsink_ready *ready;
 
-    rc = nn_fq_recv (&nn_cont (self, struct nn_xsink, sockbase)->fq,
-        msg, NULL);
+    xsink = nn_cont (self, struct nn_xsink, sockbase);
 
-    /*  Discard NN_PIPEBASE_PARSED flag. */
-    return rc < 0 ? rc : 0;
+    while (1) {
+
+        /*  Messages already put in order go first. */
+        it = nn_queue_pop (&xsink->ready);
+        if (it) {
+            ready = nn_cont (it, struct nn_xsink_ready, item);
+            nn_msg_mv (msg, &ready->msg);
+            nn_queue_item_term (&ready->item);
+            nn_free (ready);
+            --xsink->nready;
+            return 0;
+        }
+
+        rc = nn_fq_recv (&xsink->fq, msg, NULL);
+        if (nn_slow (rc < 0))
+            return rc;
+
+        /*  Unless reordering, pass the message to the user straight away.
+            Discard NN_PIPEBASE_PARSED flag. */
+        if (!xsink->window)
+            return 0;
+
+        /*  Split the stream ID and the sequence number from the body. Drop
+            malformed messages. */
+        if (!(rc & NN_PIPE_PARSED)) {
+            if (msg->frags)
+                nn_msg_flatten (msg);
+            if (nn_slow (nn_chunkref_size (&msg->body) < 8)) {
+                nn_msg_term (msg);
+                continue;
+            }
+            nn_assert (nn_chunkref_size (&msg->hdr) == 0);
+            nn_chunkref_term (&msg->hdr);
+            nn_chunkref_init (&msg->hdr, 8);
+            memcpy (nn_chunkref_data (&msg->hdr),
+                nn_chunkref_data (&msg->body), 8);
+            nn_chunkref_trim (&msg->body, 8);
+        }
+
+        nn_xsink_reorder (xsink, msg);
+    }
+}
+
+static void nn_xsink_reorder (struct nn_xsink *self, struct nn_msg *msg)
+{
+    uint8_t *hdr;
+    uint32_t id;
+    uint32_t seq;
+    int32_t ahead;
+    struct nn_hash_item *it;
+    struct nn_xsink_stream *stream;
+    struct nn_xsink_slot *slot;
+
+    if (nn_slow (nn_chunkref_size (&msg->hdr) != 8)) {
+        nn_msg_term (msg);
+        return;
+    }
+    hdr = nn_chunkref_data (&msg->hdr);
+    id = nn_getl (hdr);
+    seq = nn_getl (hdr + 4);
+
+    /*  The first message of a stream determines where it starts. */
+    it = nn_hash_get (&self->streams, id);
+    if (it)
+        stream = nn_cont (it, struct nn_xsink_stream, hash);
+    else {
+        stream = nn_alloc (sizeof (struct nn_xsink_stream), "sink stream");
+        alloc_assert (stream);
+        nn_hash_item_init (&stream->hash);
+        nn_list_item_init (&stream->item);
+        stream->next = seq;
+        stream->size = 1;
+        while (stream->size < (uint32_t) self->window)
+            stream->size *= 2;
+        stream->slots = nn_alloc (stream->size *
+            sizeof (struct nn_xsink_slot), "sink window");
+        alloc_assert (stream->slots);
+        memset (stream->slots, 0, stream->size *
+            sizeof (struct nn_xsink_slot));
+        nn_hash_insert (&self->streams, id, &stream->hash);
+        nn_list_insert (&self->streamlist, &stream->item,
+            nn_list_end (&self->streamlist));
+    }
+
+    /*  Messages that were already delivered are duplicates. */
+    ahead = (int32_t) (seq - stream->next);
+    if (ahead < 0) {
+        nn_msg_term (msg);
+        return;
+    }
+
+    /*  If the message doesn't fit into the window, the missing messages
+        at the beginning of the window are considered lost. Those that are
+        present are delivered. */
+    while (ahead >= self->window) {
+        slot = &stream->slots [stream->next & (stream->size - 1)];
+        if (slot->present) {
+            nn_xsink_deliver (self, &slot->msg);
+            slot->present = 0;
+        }
+        ++stream->next;
+        --ahead;
+    }
+
+    /*  Store the message that arrived ahead of its turn, unless it's
+        a duplicate. */
+    if (ahead > 0) {
+        slot = &stream->slots [seq & (stream->size - 1)];
+        if (slot->present) {
+            nn_msg_term (msg);
+            return;
+        }
+        nn_msg_mv (&slot->msg, msg);
+        slot->present = 1;
+        return;
+    }
+
+    /*  The message is the next one in order. Deliver it along with the
+        messages that were waiting for it. */
+    nn_xsink_deliver (self, msg);
+    ++stream->next;
+    while (1) {
+        slot = &stream->slots [stream->next & (stream->size - 1)];
+        if (!slot->present)
+            break;
+        nn_xsink_deliver (self, &slot->msg);
+        slot->present = 0;
+        ++stream->next;
+    }
+}
+
+static void nn_xsink_deliver (struct nn_xsink *self, struct nn_msg *msg)
+{
+    struct nn_xsink_ready *ready;
+
+    ready = nn_alloc (sizeof (struct nn_xsink_ready), "sink ready message");
+    alloc_assert (ready);
+    nn_queue_item_init (&ready->item);
+    nn_msg_mv (&ready->msg, msg);
+    nn_queue_push (&self->ready, &ready->item);
+    ++self->nready;
+}
+
+static void nn_xsink_flush (struct nn_xsink *self)
+{
+    struct nn_xsink_stream *stream;
+    struct nn_xsink_slot *slot;
+    uint32_t i;
+
+    /*  Deliver all the messages waiting for their turn, in order, and
+        forget about the streams. */
+    while (!nn_list_empty (&self->streamlist)) {
+        stream = nn_cont (nn_list_begin (&self->streamlist),
+            struct nn_xsink_stream, item);
+        for (i = 0; i != stream->size; ++i) {
+            slot = &stream->slots [(stream->next + i) & (stream->size - 1)];
+            if (slot->present)
+                nn_xsink_deliver (self, &slot->msg);
+        }
+        nn_free (stream->slots);
+        nn_hash_erase (&self->streams, &stream->hash);
+        nn_hash_item_term (&stream->hash);
+        nn_list_erase (&self->streamlist, &stream->item);
+        nn_list_item_term (&stream->item);
+        nn_free (stream);
+    }
 }
 
 static int nn_xsink_setopt (struct nn_sockbase *self, int level, int option,
         const void *optval, size_t optvallen)
 {
+    struct nn_xsink *xsink;
+
+    xsink = nn_cont (self, struct nn_xsink, sockbase);
+
+    if (level == NN_SINK && option == NN_SINK_REORDER) {
+        if (nn_slow (optvallen != sizeof (int)))
+            return -EINVAL;
+        if (nn_slow (*(int*) optval < 0 ||
+              *(int*) optval > NN_XSINK_MAX_WINDOW))
+            return -EINVAL;
+
+        /*  The messages waiting for their turn are delivered straight away
+            and the streams start anew with the new window. */
+        nn_xsink_flush (xsink);
+        xsink->window = *(int*) optval;
+        return 0;
+    }
+
     return -ENOPROTOOPT;
 }
 
 static int nn_xsink_getopt (struct nn_sockbase *self, int level, int option,
         void *optval, size_t *optvallen)
 {
+    struct nn_xsink *xsink;
+
+    xsink = nn_cont (self, struct nn_xsink, sockbase);
+
+    if (level == NN_SINK && option == NN_SINK_REORDER) {
+        if (nn_slow (*optvallen < sizeof (int)))
+            return -EINVAL;
+        *(int*) optval = xsink->window;
+        *optvallen = sizeof (int);
+        return 0;
+    }
+
     return -ENOPROTOOPT;
 }
 
@@ -199,8 +469,7 @@ int nn_xsink_create (struct nn_sockbase **sockbase)
 static struct nn_socktype nn_xsink_socktype_struct = {
     AF_SP_RAW,
     NN_SINK,
-    nn_xsink_create,
-    NN_LIST_ITEM_INITIALIZER
+    nn_xsink_create
 };
 
 struct nn_socktype *nn_xsink_socktype = &nn_xsink_socktype_struct;
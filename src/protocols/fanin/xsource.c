@@ -31,10 +31,16 @@
 #include "../../utils/alloc.h"
 #include "../../utils/excl.h"
 #include "../../utils/list.h"
+#include "../../utils/wire.h"
 
 struct nn_xsource {
     struct nn_sockbase sockbase;
     struct nn_excl excl;
+
+    /*  If non-zero, each message is stamped with this stream ID and with
+        the sequence number of the message. See NN_SOURCE_STREAM. */
+    int stream;
+    uint32_t seq;
 };
 
 /*  Private functions. */
@@ -85,6 +91,8 @@ static int nn_xsource_init (struct nn_xsource *self,
         return rc;
 
     nn_excl_init (&self->excl);
+    self->stream = 0;
+    self->seq = 0;
 
     return 0;
 }
@@ -134,19 +142,59 @@ static int nn_xsource_events (struct nn_sockbase *self)
 
 static int nn_xsource_send (struct nn_sockbase *self, struct nn_msg *msg)
 {
-    return nn_excl_send (&nn_cont (self, struct nn_xsource, sockbase)->excl,
-        msg);
+    int rc;
+    struct nn_xsource *xsource;
+
+    xsource = nn_cont (self, struct nn_xsource, sockbase);
+
+    /*  Stamp the message with the stream ID and the sequence number. If the
+        message can't be sent now, it will get the same number next time. */
+    if (xsource->stream) {
+        nn_chunkref_term (&msg->hdr);
+        nn_chunkref_init (&msg->hdr, 8);
+        nn_putl (nn_chunkref_data (&msg->hdr), (uint32_t) xsource->stream);
+        nn_putl (((uint8_t*) nn_chunkref_data (&msg->hdr)) + 4,
+            xsource->seq);
+    }
+
+    rc = nn_excl_send (&xsource->excl, msg);
+    if (rc >= 0)
+        ++xsource->seq;
+    return rc;
 }
 
 static int nn_xsource_setopt (struct nn_sockbase *self, int level, int option,
         const void *optval, size_t optvallen)
 {
+    struct nn_xsource *xsource;
+
+    xsource = nn_cont (self, struct nn_xsource, sockbase);
+
+    if (level == NN_SOURCE && option == NN_SOURCE_STREAM) {
+        if (nn_slow (optvallen != sizeof (int)))
+            return -EINVAL;
+        xsource->stream = *(int*) optval;
+        return 0;
+    }
+
     return -ENOPROTOOPT;
 }
 
 static int nn_xsource_getopt (struct nn_sockbase *self, int level, int option,
         void *optval, size_t *optvallen)
 {
+    struct nn_xsource *xsource;
+
+    xsource = nn_cont (self, struct nn_xsource, sockbase);
+
+    if (level == NN_SOURCE && option == NN_SOURCE_STREAM) {
+        if (nn_slow (*optvallen < sizeof (int)))
+            return -EINVAL;
+        *(int*) optval = xsource->stream;
+        *optvallen = sizeof (int);
+        return 0;
+    }
+
     return -ENOPROTOOPT;
 }
 
@@ -170,8 +218,7 @@ int nn_xsource_create (struct nn_sockbase **sockbase)
 static struct nn_socktype nn_xsource_socktype_struct = {
     AF_SP_RAW,
     NN_SOURCE,
-    nn_xsource_create,
-    NN_LIST_ITEM_INITIALIZER
+    nn_xsource_create
 };
 
 struct nn_socktype *nn_xsource_socktype = &nn_xsource_socktype_struct;
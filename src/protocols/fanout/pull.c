@@ -30,8 +30,7 @@
 static struct nn_socktype nn_pull_socktype_struct = {
     AF_SP,
     NN_PULL,
-    nn_xpull_create,
-    NN_LIST_ITEM_INITIALIZER
+    nn_xpull_create
 };
 
 struct nn_socktype *nn_pull_socktype = &nn_pull_socktype_struct;
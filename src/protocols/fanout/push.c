@@ -30,8 +30,7 @@
 static struct nn_socktype nn_push_socktype_struct = {
     AF_SP,
     NN_PUSH,
-    nn_xpush_create,
-    NN_LIST_ITEM_INITIALIZER
+    nn_xpush_create
 };
 
 struct nn_socktype *nn_push_socktype = &nn_push_socktype_struct;
@@ -31,16 +31,30 @@
 #include "../../utils/alloc.h"
 #include "../../utils/excl.h"
 #include "../../utils/list.h"
+#include "../../utils/wire.h"
 
 struct nn_xpull {
     struct nn_sockbase sockbase;
     struct nn_excl excl;
+
+    /*  Number of messages the pusher is allowed to have in flight towards
+        this socket, or zero if the socket is not in the credit mode.
+        See NN_PULL_CREDIT. */
+    int credit;
+
+    /*  Credit granted to the pusher not yet used up by messages received
+        by the user. */
+    int granted;
+
+    /*  Set if the pusher was told to respect the credit. */
+    int limited;
 };
 
 /*  Private functions. */
 static int nn_xpull_init (struct nn_xpull *self,
     const struct nn_sockbase_vfptr *vfptr);
 static void nn_xpull_term (struct nn_xpull *self);
+static void nn_xpull_grant (struct nn_xpull *self);
 
 /*  Implementation of nn_sockbase's virtual functions. */
 static int nn_xpull_ispeer (int socktype);
@@ -56,7 +70,7 @@ static int nn_xpull_setopt (struct nn_sockbase *self, int level, int option,
 static int nn_xpull_getopt (struct nn_sockbase *self, int level, int option,
     void *optval, size_t *optvallen);
 static const struct nn_sockbase_vfptr nn_xpull_sockbase_vfptr = {
-    NN_SOCKBASE_FLAG_NOSEND,
+    NN_SOCKBASE_FLAG_NOSEND | NN_SOCKBASE_FLAG_PASSTHROUGH,
     nn_xpull_ispeer,
     nn_xpull_destroy,
     nn_xpull_add,
@@ -85,6 +99,9 @@ static int nn_xpull_init (struct nn_xpull *self,
         return rc;
 
     nn_excl_init (&self->excl);
+    self->credit = 0;
+    self->granted = 0;
+    self->limited = 0;
 
     return 0;
 }
@@ -107,8 +124,20 @@ void nn_xpull_destroy (struct nn_sockbase *self)
 
 static int nn_xpull_add (struct nn_sockbase *self, struct nn_pipe *pipe)
 {
-    return nn_excl_add (&nn_cont (self, struct nn_xpull, sockbase)->excl,
-        pipe);
+    int rc;
+    struct nn_xpull *xpull;
+
+    xpull = nn_cont (self, struct nn_xpull, sockbase);
+
+    rc = nn_excl_add (&xpull->excl, pipe);
+    if (rc < 0)
+        return rc;
+
+    /*  The new pusher knows nothing about the credit yet. */
+    xpull->granted = 0;
+    xpull->limited = 0;
+
+    return 0;
 }
 
 static void nn_xpull_rm (struct nn_sockbase *self, struct nn_pipe *pipe)
@@ -123,7 +152,12 @@ static void nn_xpull_in (struct nn_sockbase *self, struct nn_pipe *pipe)
 
 static void nn_xpull_out (struct nn_sockbase *self, struct nn_pipe *pipe)
 {
-    nn_excl_out (&nn_cont (self, struct nn_xpull, sockbase)->excl, pipe);
+    struct nn_xpull *xpull;
+
+    xpull = nn_cont (self, struct nn_xpull, sockbase);
+
+    nn_excl_out (&xpull->excl, pipe);
+    nn_xpull_grant (xpull);
 }
 
 static int nn_xpull_events (struct nn_sockbase *self)
@@ -135,25 +169,105 @@ static int nn_xpull_events (struct nn_sockbase *self)
 static int nn_xpull_recv (struct nn_sockbase *self, struct nn_msg *msg)
 {
     int rc;
+    struct nn_xpull *xpull;
+
+    xpull = nn_cont (self, struct nn_xpull, sockbase);
+
+    rc = nn_excl_recv (&xpull->excl, msg);
+    if (nn_slow (rc < 0))
+        return rc;
 
-    rc = nn_excl_recv (&nn_cont (self, struct nn_xpull, sockbase)->excl, msg);
+    /*  The message used up a unit of credit. Replenish it. */
+    if (xpull->limited) {
+        if (xpull->granted)
+            --xpull->granted;
+        nn_xpull_grant (xpull);
+    }
 
     /*  Discard NN_PIPEBASE_PARSED flag. */
-    return rc < 0 ? rc : 0;
+    return 0;
 }
 
 static int nn_xpull_setopt (struct nn_sockbase *self, int level, int option,
         const void *optval, size_t optvallen)
 {
+    struct nn_xpull *xpull;
+
+    xpull = nn_cont (self, struct nn_xpull, sockbase);
+
+    if (level != NN_PULL)
+        return -ENOPROTOOPT;
+
+    if (option == NN_PULL_CREDIT) {
+        if (nn_slow (optvallen != sizeof (int)))
+            return -EINVAL;
+        if (nn_slow (*(int*) optval < 0))
+            return -EINVAL;
+        xpull->credit = *(int*) optval;
+        nn_xpull_grant (xpull);
+        return 0;
+    }
+
     return -ENOPROTOOPT;
 }
 
 static int nn_xpull_getopt (struct nn_sockbase *self, int level, int option,
         void *optval, size_t *optvallen)
 {
+    struct nn_xpull *xpull;
+
+    xpull = nn_cont (self, struct nn_xpull, sockbase);
+
+    if (level != NN_PULL)
+        return -ENOPROTOOPT;
+
+    if (option == NN_PULL_CREDIT) {
+        if (nn_slow (*optvallen < sizeof (int)))
+            return -EINVAL;
+        *(int*) optval = xpull->credit;
+        *optvallen = sizeof (int);
+        return 0;
+    }
+
     return -ENOPROTOOPT;
 }
 
+static void nn_xpull_grant (struct nn_xpull *self)
+{
+    uint32_t credit;
+    struct nn_msg msg;
+
+    if (!nn_excl_can_send (&self->excl))
+        return;
+
+    /*  Switching the credit mode off lets the pusher send at will. */
+    if (!self->credit) {
+        if (!self->limited)
+            return;
+        credit = NN_PULL_UNLIMITED;
+        self->limited = 0;
+        self->granted = 0;
+    }
+
+    /*  Credit is granted in batches of at least half the window so that
+        there's not a credit message for each message received. If the window
+        was shrunk, no credit is granted until the messages in flight drop
+        below the new window. */
+    else {
+        if (self->granted >= self->credit ||
+              (self->limited &&
+              self->credit - self->granted < (self->credit + 1) / 2))
+            return;
+        credit = self->credit - self->granted;
+        self->granted = self->credit;
+        self->limited = 1;
+    }
+
+    nn_msg_init (&msg, sizeof (uint32_t));
+    nn_putl (nn_chunkref_data (&msg.body), credit);
+    nn_excl_send (&self->excl, &msg);
+}
+
 int nn_xpull_create (struct nn_sockbase **sockbase)
 {
     int rc;
@@ -174,8 +288,7 @@ int nn_xpull_create (struct nn_sockbase **sockbase)
 static struct nn_socktype nn_xpull_socktype_struct = {
     AF_SP_RAW,
     NN_PULL,
-    nn_xpull_create,
-    NN_LIST_ITEM_INITIALIZER
+    nn_xpull_create
 };
 
 struct nn_socktype *nn_xpull_socktype = &nn_xpull_socktype_struct;
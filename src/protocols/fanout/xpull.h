@@ -27,6 +27,12 @@
 
 extern struct nn_socktype *nn_xpull_socktype;
 
+/*  In the credit mode, PULL socket tells the pusher how many more messages
+    it's ready to accept. Each message sent from PULL to PUSH is a 32-bit
+    credit in network byte order. NN_PULL_UNLIMITED switches the credit mode
+    off again. */
+#define NN_PULL_UNLIMITED 0xffffffff
+
 int nn_xpull_create (struct nn_sockbase **sockbase);
 
 #endif
@@ -21,6 +21,7 @@
 */
 
 #include "xpush.h"
+#include "xpull.h"
 
 #include "../../nn.h"
 #include "../../fanout.h"
@@ -31,6 +32,11 @@
 #include "../../utils/alloc.h"
 #include "../../utils/lb.h"
 #include "../../utils/list.h"
+#include "../../utils/wire.h"
+#include "../../utils/spool.h"
+
+#include <limits.h>
+#include <string.h>
 
 struct nn_xpush_data {
     struct nn_lb_data lb;
@@ -39,12 +45,21 @@ struct nn_xpush_data {
 struct nn_xpush {
     struct nn_sockbase sockbase;
     struct nn_lb lb;
+
+    /*  The pipe nn_xpush_in is currently receiving from. It's reset to NULL
+        if the pipe gets removed while being received from. */
+    struct nn_pipe *inpipe;
+
+    /*  Messages that couldn't be sent because all the pipes were full.
+        NULL if NN_PUSH_SPOOL is not set. */
+    struct nn_spool *spool;
 };
 
 /*  Private functions. */
 static int nn_xpush_init (struct nn_xpush *self,
     const struct nn_sockbase_vfptr *vfptr);
 static void nn_xpush_term (struct nn_xpush *self);
+static void nn_xpush_drain (struct nn_xpush *self);
 
 /*  Implementation of nn_sockbase's virtual functions. */
 static int nn_xpush_ispeer (int socktype);
@@ -60,7 +75,7 @@ static int nn_xpush_setopt (struct nn_sockbase *self, int level, int option,
 static int nn_xpush_getopt (struct nn_sockbase *self, int level, int option,
     void *optval, size_t *optvallen);
 static const struct nn_sockbase_vfptr nn_xpush_sockbase_vfptr = {
-    NN_SOCKBASE_FLAG_NORECV,
+    NN_SOCKBASE_FLAG_NORECV | NN_SOCKBASE_FLAG_LOSSY,
     nn_xpush_ispeer,
     nn_xpush_destroy,
     nn_xpush_add,
@@ -89,12 +104,20 @@ static int nn_xpush_init (struct nn_xpush *self,
         return -rc;
 
     nn_lb_init (&self->lb);
+    self->inpipe = NULL;
+    self->spool = NULL;
 
     return 0;
 }
 
 static void nn_xpush_term (struct nn_xpush *self)
 {
+#if !defined NN_HAVE_WINDOWS
+    if (self->spool) {
+        nn_spool_term (self->spool);
+        nn_free (self->spool);
+    }
+#endif
     nn_lb_term (&self->lb);
     nn_sockbase_term (&self->sockbase);
 }
@@ -118,7 +141,8 @@ static int nn_xpush_add (struct nn_sockbase *self, struct nn_pipe *pipe)
     data = nn_alloc (sizeof (struct nn_xpush_data), "pipe data (push)");
     alloc_assert (data);
     nn_pipe_setdata (pipe, data);
-    nn_lb_add (&xpush->lb, pipe, &data->lb, self->sndprio);
+    nn_lb_add (&xpush->lb, pipe, &data->lb, nn_pipe_getsndprio (pipe),
+        self->sndweight);
 
     return 0;
 }
@@ -132,12 +156,47 @@ static void nn_xpush_rm (struct nn_sockbase *self, struct nn_pipe *pipe)
     data = nn_pipe_getdata (pipe);
     nn_lb_rm (&xpush->lb, pipe, &data->lb);
     nn_free (data);
+    if (xpush->inpipe == pipe)
+        xpush->inpipe = NULL;
 }
 
 static void nn_xpush_in (struct nn_sockbase *self, struct nn_pipe *pipe)
 {
-    /*  We are not going to receive any messages, so there's no need to store
-        the list of inbound pipes. */
+    int rc;
+    uint32_t credit;
+    struct nn_xpush *xpush;
+    struct nn_xpush_data *data;
+    struct nn_msg msg;
+
+    xpush = nn_cont (self, struct nn_xpush, sockbase);
+    data = nn_pipe_getdata (pipe);
+
+    /*  The only messages we get from pullers are credits. Anything else
+        is ignored. */
+    while (1) {
+        xpush->inpipe = pipe;
+        rc = nn_pipe_recv (pipe, &msg);
+        errnum_assert (rc >= 0, -rc);
+        if (nn_slow (!xpush->inpipe)) {
+            nn_msg_term (&msg);
+            return;
+        }
+        xpush->inpipe = NULL;
+        if (nn_fast (nn_chunkref_size (&msg.body) == sizeof (uint32_t) &&
+              nn_chunkref_size (&msg.hdr) == 0)) {
+            credit = nn_getl (nn_chunkref_data (&msg.body));
+            if (credit == NN_PULL_UNLIMITED)
+                nn_lb_credit (&xpush->lb, &data->lb, -1);
+            else if (credit)
+                nn_lb_credit (&xpush->lb, &data->lb,
+                    credit > INT_MAX ? INT_MAX : (int) credit);
+        }
+        nn_msg_term (&msg);
+        if (rc & NN_PIPE_RELEASE)
+            break;
+    }
+
+    nn_xpush_drain (xpush);
 }
 
 static void nn_xpush_out (struct nn_sockbase *self, struct nn_pipe *pipe)
@@ -148,28 +207,139 @@ static void nn_xpush_out (struct nn_sockbase *self, struct nn_pipe *pipe)
     xpush = nn_cont (self, struct nn_xpush, sockbase);
     data = nn_pipe_getdata (pipe);
     nn_lb_out (&xpush->lb, pipe, &data->lb);
+    nn_xpush_drain (xpush);
+}
+
+static void nn_xpush_drain (struct nn_xpush *self)
+{
+#if !defined NN_HAVE_WINDOWS
+    int rc;
+    struct nn_msg msg;
+
+    /*  Replay the spooled messages, oldest first, while there is a pipe to
+        send them to. */
+    if (nn_fast (!self->spool))
+        return;
+    while (!nn_spool_empty (self->spool) && nn_lb_can_send (&self->lb)) {
+        rc = nn_spool_get (self->spool, &msg);
+        errnum_assert (rc == 0, -rc);
+        rc = nn_lb_send (&self->lb, &msg);
+        errnum_assert (rc >= 0, -rc);
+    }
+#endif
 }
 
 static int nn_xpush_events (struct nn_sockbase *self)
 {
-    return nn_lb_can_send (&nn_cont (self, struct nn_xpush, sockbase)->lb) ?
+    struct nn_xpush *xpush;
+
+    /*  With the spool on, the messages can always be sent. */
+    xpush = nn_cont (self, struct nn_xpush, sockbase);
+    return xpush->spool || nn_lb_can_send (&xpush->lb) ?
         NN_SOCKBASE_EVENT_OUT : 0;
 }
 
 static int nn_xpush_send (struct nn_sockbase *self, struct nn_msg *msg)
 {
-    return nn_lb_send (&nn_cont (self, struct nn_xpush, sockbase)->lb, msg);
+    int rc;
+    struct nn_xpush *xpush;
+
+    xpush = nn_cont (self, struct nn_xpush, sockbase);
+    if (nn_fast (!xpush->spool))
+        return nn_lb_send (&xpush->lb, msg);
+
+#if !defined NN_HAVE_WINDOWS
+    /*  Once there are messages in the spool, the new ones have to queue up
+        behind them to keep the order. */
+    if (nn_spool_empty (xpush->spool)) {
+        rc = nn_lb_send (&xpush->lb, msg);
+        if (rc != -EAGAIN)
+            return rc;
+    }
+    return nn_spool_put (xpush->spool, msg);
+#else
+    nn_assert (0);
+#endif
 }
 
 static int nn_xpush_setopt (struct nn_sockbase *self, int level, int option,
         const void *optval, size_t optvallen)
 {
+    int rc;
+    struct nn_xpush *xpush;
+    struct nn_spool *spool;
+
+    xpush = nn_cont (self, struct nn_xpush, sockbase);
+
+    if (level == NN_PUSH && option == NN_PUSH_SPOOL) {
+#if defined NN_HAVE_WINDOWS
+        return -ENOTSUP;
+#else
+        /*  The spool can't be switched while there are messages in it. An
+            empty string switches it off. */
+        if (nn_slow (xpush->spool && !nn_spool_empty (xpush->spool)))
+            return -EBUSY;
+        spool = NULL;
+        if (optvallen) {
+            spool = nn_alloc (sizeof (struct nn_spool), "spool");
+            alloc_assert (spool);
+            rc = nn_spool_init (spool, optval, optvallen);
+            if (nn_slow (rc < 0)) {
+                nn_free (spool);
+                return rc;
+            }
+        }
+        if (xpush->spool) {
+            nn_spool_term (xpush->spool);
+            nn_free (xpush->spool);
+        }
+        xpush->spool = spool;
+        nn_xpush_drain (xpush);
+        return 0;
+#endif
+    }
+
+    if (level == NN_PUSH && option == NN_PUSH_AFFINITY) {
+        if (nn_slow (optvallen != sizeof (int)))
+            return -EINVAL;
+        if (nn_slow (*(int*) optval < 0))
+            return -EINVAL;
+        nn_lb_setaffinity (&xpush->lb, *(int*) optval);
+        return 0;
+    }
+
     return -ENOPROTOOPT;
 }
 
 static int nn_xpush_getopt (struct nn_sockbase *self, int level, int option,
         void *optval, size_t *optvallen)
 {
+    struct nn_xpush *xpush;
+    size_t sz;
+
+    xpush = nn_cont (self, struct nn_xpush, sockbase);
+
+    if (level == NN_PUSH && option == NN_PUSH_SPOOL) {
+#if defined NN_HAVE_WINDOWS
+        sz = 0;
+#else
+        sz = xpush->spool ? strlen (xpush->spool->dir) : 0;
+        if (sz)
+            memcpy (optval, xpush->spool->dir, *optvallen < sz ?
+                *optvallen : sz);
+#endif
+        *optvallen = sz;
+        return 0;
+    }
+
+    if (level == NN_PUSH && option == NN_PUSH_AFFINITY) {
+        if (nn_slow (*optvallen < sizeof (int)))
+            return -EINVAL;
+        *(int*) optval = xpush->lb.affinity;
+        *optvallen = sizeof (int);
+        return 0;
+    }
+
     return -ENOPROTOOPT;
 }
 
@@ -193,8 +363,7 @@ int nn_xpush_create (struct nn_sockbase **sockbase)
 static struct nn_socktype nn_xpush_socktype_struct = {
     AF_SP_RAW,
     NN_PUSH,
-    nn_xpush_create,
-    NN_LIST_ITEM_INITIALIZER
+    nn_xpush_create
 };
 
 struct nn_socktype *nn_xpush_socktype = &nn_xpush_socktype_struct;
@@ -30,8 +30,7 @@
 static struct nn_socktype nn_pair_socktype_struct = {
     AF_SP,
     NN_PAIR,
-    nn_xpair_create,
-    NN_LIST_ITEM_INITIALIZER
+    nn_xpair_create
 };
 
 struct nn_socktype *nn_pair_socktype = &nn_pair_socktype_struct;
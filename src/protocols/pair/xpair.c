@@ -57,7 +57,7 @@ static int nn_xpair_setopt (struct nn_sockbase *self, int level, int option,
 static int nn_xpair_getopt (struct nn_sockbase *self, int level, int option,
         void *optval, size_t *optvallen);
 static const struct nn_sockbase_vfptr nn_xpair_sockbase_vfptr = {
-    0,
+    NN_SOCKBASE_FLAG_PASSTHROUGH,
     nn_xpair_ispeer,
     nn_xpair_destroy,
     nn_xpair_add,
@@ -189,8 +189,7 @@ int nn_xpair_create (struct nn_sockbase **sockbase)
 static struct nn_socktype nn_xpair_socktype_struct = {
     AF_SP_RAW,
     NN_PAIR,
-    nn_xpair_create,
-    NN_LIST_ITEM_INITIALIZER
+    nn_xpair_create
 };
 
 struct nn_socktype *nn_xpair_socktype = &nn_xpair_socktype_struct;
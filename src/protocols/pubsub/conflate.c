@@ -0,0 +1,133 @@
+/*
+    Copyright (c) 2012-2013 250bpm s.r.o.
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"),
+    to deal in the Software without restriction, including without limitation
+    the rights to use, copy, modify, merge, publish, distribute, sublicense,
+    and/or sell copies of the Software, and to permit persons to whom
+    the Software is furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included
+    in all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+    THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+    FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+    IN THE SOFTWARE.
+*/
+
+#include "conflate.h"
+
+#include "../../utils/alloc.h"
+#include "../../utils/cont.h"
+#include "../../utils/fast.h"
+#include "../../utils/err.h"
+
+void nn_conflate_init (struct nn_conflate *self)
+{
+    nn_topics_init (&self->topics);
+    nn_list_init (&self->entries);
+    self->count = 0;
+    self->bytes = 0;
+}
+
+void nn_conflate_term (struct nn_conflate *self)
+{
+    int rc;
+    struct nn_msg msg;
+
+    while (1) {
+        rc = nn_conflate_get (self, &msg);
+        if (rc == -EAGAIN)
+            break;
+        errnum_assert (rc == 0, -rc);
+        nn_msg_term (&msg);
+    }
+    nn_list_term (&self->entries);
+    nn_topics_term (&self->topics);
+}
+
+int nn_conflate_empty (struct nn_conflate *self)
+{
+    return nn_list_empty (&self->entries);
+}
+
+void nn_conflate_put (struct nn_conflate *self, struct nn_msg *msg,
+    size_t topic)
+{
+    int rc;
+    uint8_t *data;
+    void **slot;
+    struct nn_conflate_entry *entry;
+
+    nn_assert (nn_chunkref_size (&msg->body) >= topic);
+    data = nn_chunkref_data (&msg->body);
+
+    /*  There's already a message with this topic. Replace it. */
+    slot = nn_topics_data (&self->topics, data, topic);
+    if (slot) {
+        entry = (struct nn_conflate_entry*) *slot;
+        self->bytes -= nn_chunkref_size (&entry->msg.body);
+        self->bytes += nn_chunkref_size (&msg->body);
+        nn_msg_term (&entry->msg);
+        nn_msg_mv (&entry->msg, msg);
+        return;
+    }
+
+    entry = nn_alloc (sizeof (struct nn_conflate_entry), "conflated message");
+    alloc_assert (entry);
+    entry->topic = topic;
+    nn_msg_mv (&entry->msg, msg);
+    nn_list_item_init (&entry->item);
+    nn_list_insert (&self->entries, &entry->item,
+        nn_list_end (&self->entries));
+    rc = nn_topics_subscribe (&self->topics, data, topic);
+    errnum_assert (rc == 1, -rc);
+    *nn_topics_data (&self->topics, data, topic) = entry;
+    ++self->count;
+    self->bytes += nn_chunkref_size (&entry->msg.body);
+}
+
+int nn_conflate_get (struct nn_conflate *self, struct nn_msg *msg)
+{
+    int rc;
+    struct nn_list_item *it;
+    struct nn_conflate_entry *entry;
+
+    it = nn_list_begin (&self->entries);
+    if (it == nn_list_end (&self->entries))
+        return -EAGAIN;
+    entry = nn_cont (it, struct nn_conflate_entry, item);
+    nn_list_erase (&self->entries, it);
+    nn_list_item_term (&entry->item);
+
+    rc = nn_topics_unsubscribe (&self->topics,
+        nn_chunkref_data (&entry->msg.body), entry->topic);
+    errnum_assert (rc == 1, -rc);
+
+    --self->count;
+    self->bytes -= nn_chunkref_size (&entry->msg.body);
+    nn_msg_mv (msg, &entry->msg);
+    nn_free (entry);
+
+    return 0;
+}
+
+
+void nn_conflate_walk (struct nn_conflate *self, nn_conflate_walk_fn *fn,
+    void *arg)
+{
+    struct nn_list_item *it;
+    struct nn_conflate_entry *entry;
+
+    for (it = nn_list_begin (&self->entries);
+          it != nn_list_end (&self->entries);
+          it = nn_list_next (&self->entries, it)) {
+        entry = nn_cont (it, struct nn_conflate_entry, item);
+        fn (&entry->msg, entry->topic, arg);
+    }
+}
@@ -0,0 +1,90 @@
+/*
+    Copyright (c) 2012-2013 250bpm s.r.o.
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"),
+    to deal in the Software without restriction, including without limitation
+    the rights to use, copy, modify, merge, publish, distribute, sublicense,
+    and/or sell copies of the Software, and to permit persons to whom
+    the Software is furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included
+    in all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+    THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+    FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+    IN THE SOFTWARE.
+*/
+
+#ifndef NN_CONFLATE_INCLUDED
+#define NN_CONFLATE_INCLUDED
+
+#include "topics.h"
+
+#include "../../utils/msg.h"
+#include "../../utils/list.h"
+
+#include <stddef.h>
+
+/*  Queue of messages that holds only the latest message for each topic.
+    When a message is added and there's already a message with the same topic
+    in the queue, the old message is replaced by the new one and keeps its
+    position in the queue. Thus, the size of the queue is bounded by
+    the number of distinct topics and no message is older than the latest
+    update of its topic. */
+
+struct nn_conflate_entry {
+    struct nn_list_item item;
+
+    /*  Length of the topic. The topic is the beginning of the message body. */
+    size_t topic;
+
+    struct nn_msg msg;
+};
+
+struct nn_conflate {
+
+    /*  Maps topics to the entries. */
+    struct nn_topics topics;
+
+    /*  The entries in the order the topics were added to the queue. */
+    struct nn_list entries;
+
+    /*  Number of messages in the queue and the total size of their bodies. */
+    size_t count;
+    size_t bytes;
+};
+
+/*  Initialise an empty queue. */
+void nn_conflate_init (struct nn_conflate *self);
+
+/*  Deallocate the queue along with the messages stored in it. */
+void nn_conflate_term (struct nn_conflate *self);
+
+/*  Returns 1 if there are no messages in the queue. */
+int nn_conflate_empty (struct nn_conflate *self);
+
+/*  Adds the message to the queue, replacing the message with the same topic,
+    if any. The message body must be flattened and the topic is its first
+    'topic' bytes. The queue takes ownership of the message. */
+void nn_conflate_put (struct nn_conflate *self, struct nn_msg *msg,
+    size_t topic);
+
+/*  Retrieves the oldest message from the queue. Returns -EAGAIN if the queue
+    is empty. */
+int nn_conflate_get (struct nn_conflate *self, struct nn_msg *msg);
+
+/*  Invokes the function for each message in the queue, from the oldest one
+    to the newest one. The queue must not be modified while it's being
+    walked. */
+typedef void (nn_conflate_walk_fn) (struct nn_msg *msg, size_t topic,
+    void *arg);
+void nn_conflate_walk (struct nn_conflate *self, nn_conflate_walk_fn *fn,
+    void *arg);
+
+#endif
+
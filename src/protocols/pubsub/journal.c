@@ -0,0 +1,399 @@
+/*
+    Copyright (c) 2012-2013 250bpm s.r.o.
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"),
+    to deal in the Software without restriction, including without limitation
+    the rights to use, copy, modify, merge, publish, distribute, sublicense,
+    and/or sell copies of the Software, and to permit persons to whom
+    the Software is furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included
+    in all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+    THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+    FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+    IN THE SOFTWARE.
+*/
+
+#include "journal.h"
+
+#include "../../utils/err.h"
+
+#if !defined NN_HAVE_WINDOWS
+
+#include "../../utils/fast.h"
+#include "../../utils/alloc.h"
+#include "../../utils/wire.h"
+
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+/*  Layout of the header page: magic number, size of the ring, tail, head,
+    first and last, all of them 64-bit. */
+#define NN_JOURNAL_MAGIC 0x6e6e6a726e6c0001ULL
+#define NN_JOURNAL_HDRSIZE 4096
+
+/*  Size of the two words preceding the body of a record. */
+#define NN_JOURNAL_RECHDR 16
+
+#define NN_JOURNAL_GRANULE (64 * 1024)
+
+/*  Private functions. */
+static void nn_journal_sync (struct nn_journal *self);
+static void nn_journal_rebuild (struct nn_journal *self);
+static size_t nn_journal_next (struct nn_journal *self, size_t pos);
+static void nn_journal_evict (struct nn_journal *self, size_t from,
+    size_t to);
+static void nn_journal_index (struct nn_journal *self, uint64_t seq,
+    size_t pos);
+static size_t nn_journal_find (struct nn_journal *self, uint64_t seq);
+
+int nn_journal_init (struct nn_journal *self, const char *path,
+    size_t pathlen, size_t size)
+{
+    int rc;
+    struct stat st;
+    size_t fsize;
+    int created;
+
+    self->path = nn_alloc (pathlen + 1, "journal path");
+    alloc_assert (self->path);
+    memcpy (self->path, path, pathlen);
+    self->path [pathlen] = 0;
+
+    self->fd = open (self->path, O_RDWR | O_CREAT, 0600);
+    if (self->fd < 0) {
+        rc = -errno;
+        goto err_path;
+    }
+    rc = fstat (self->fd, &st);
+    errno_assert (rc == 0);
+
+    /*  The space for a new file is allocated upfront, so that running out
+        of disk space is reported here rather than by SIGBUS later on. */
+    created = st.st_size == 0;
+    if (created) {
+        fsize = NN_JOURNAL_HDRSIZE + (size & ~((size_t) 7));
+        rc = posix_fallocate (self->fd, 0, fsize);
+        if (nn_slow (rc != 0)) {
+            rc = -rc;
+            unlink (self->path);
+            goto err_fd;
+        }
+    }
+    else {
+        fsize = (size_t) st.st_size;
+        if (nn_slow (fsize < NN_JOURNAL_HDRSIZE + NN_JOURNAL_MINSIZE)) {
+            rc = -EINVAL;
+            goto err_fd;
+        }
+    }
+
+    self->map = mmap (NULL, fsize, PROT_READ | PROT_WRITE, MAP_SHARED,
+        self->fd, 0);
+    if (self->map == MAP_FAILED) {
+        rc = -errno;
+        goto err_fd;
+    }
+    self->ring = self->map + NN_JOURNAL_HDRSIZE;
+    self->size = fsize - NN_JOURNAL_HDRSIZE;
+
+    if (created) {
+        nn_putll (self->map, NN_JOURNAL_MAGIC);
+        nn_putll (self->map + 8, self->size);
+        self->tail = 0;
+        self->head = 0;
+        self->first = 0;
+        self->last = 0;
+        nn_journal_sync (self);
+    }
+    else {
+        if (nn_slow (nn_getll (self->map) != NN_JOURNAL_MAGIC ||
+              nn_getll (self->map + 8) != self->size)) {
+            rc = -EINVAL;
+            goto err_map;
+        }
+        self->tail = (size_t) nn_getll (self->map + 16);
+        self->head = (size_t) nn_getll (self->map + 24);
+        self->first = nn_getll (self->map + 32);
+        self->last = nn_getll (self->map + 40);
+    }
+
+    self->ngranules = (self->size + NN_JOURNAL_GRANULE - 1) /
+        NN_JOURNAL_GRANULE;
+    self->granules = nn_alloc (self->ngranules *
+        sizeof (struct nn_journal_granule), "journal index");
+    alloc_assert (self->granules);
+    memset (self->granules, 0,
+        self->ngranules * sizeof (struct nn_journal_granule));
+    self->current = 0;
+    nn_journal_rebuild (self);
+
+    return 0;
+
+err_map:
+    munmap (self->map, fsize);
+err_fd:
+    close (self->fd);
+err_path:
+    nn_free (self->path);
+    return rc;
+}
+
+void nn_journal_term (struct nn_journal *self)
+{
+    int rc;
+
+    nn_free (self->granules);
+    rc = munmap (self->map, NN_JOURNAL_HDRSIZE + self->size);
+    errno_assert (rc == 0);
+    rc = close (self->fd);
+    errno_assert (rc == 0);
+    nn_free (self->path);
+}
+
+uint64_t nn_journal_last (struct nn_journal *self)
+{
+    return self->last;
+}
+
+void nn_journal_put (struct nn_journal *self, uint64_t seq,
+    const void *body, size_t size)
+{
+    size_t reclen;
+    size_t pos;
+    uint8_t *rec;
+
+    reclen = NN_JOURNAL_RECHDR + ((size + 7) & ~((size_t) 7));
+    if (nn_slow (reclen > self->size / 4))
+        return;
+
+    /*  If the record doesn't fit at the end of the ring, mark the place and
+        start from the beginning. The records in the way are dropped. */
+    pos = self->head;
+    if (pos + reclen > self->size) {
+        nn_journal_evict (self, pos, self->size);
+        if (pos + NN_JOURNAL_RECHDR <= self->size)
+            nn_putll (self->ring + pos, 0);
+        pos = 0;
+    }
+    nn_journal_evict (self, pos, pos + reclen);
+
+    rec = self->ring + pos;
+    nn_putll (rec, seq);
+    nn_putll (rec + 8, size);
+    memcpy (rec + NN_JOURNAL_RECHDR, body, size);
+    nn_journal_index (self, seq, pos);
+
+    /*  The header is updated only after the record is complete. */
+    if (!self->first) {
+        self->first = seq;
+        self->tail = pos;
+    }
+    self->last = seq;
+    self->head = pos + reclen;
+    nn_journal_sync (self);
+}
+
+void nn_journal_seek (struct nn_journal *self,
+    struct nn_journal_cursor *cursor, uint64_t seq)
+{
+    cursor->seq = seq;
+    cursor->pos = self->size;
+}
+
+int nn_journal_get (struct nn_journal *self, struct nn_journal_cursor *cursor,
+    uint64_t *seq, const uint8_t **body, size_t *size)
+{
+    size_t pos;
+    uint8_t *rec;
+
+    if (!self->first || cursor->seq > self->last)
+        return -EAGAIN;
+
+    /*  The hint is used if there's the right record at the position. It
+        typically is, unless the cursor has reached the newest record and
+        the next one went to the beginning of the ring. */
+    if (cursor->seq < self->first)
+        pos = self->tail;
+    else if (nn_fast (cursor->pos <= self->size - NN_JOURNAL_RECHDR &&
+          nn_getll (self->ring + cursor->pos) == cursor->seq))
+        pos = cursor->pos;
+    else
+        pos = nn_journal_find (self, cursor->seq);
+
+    rec = self->ring + pos;
+    *seq = nn_getll (rec);
+    *size = (size_t) nn_getll (rec + 8);
+    *body = rec + NN_JOURNAL_RECHDR;
+
+    if (*seq == self->last) {
+        cursor->seq = self->last + 1;
+        cursor->pos = self->head;
+    }
+    else {
+        cursor->pos = nn_journal_next (self, pos);
+        cursor->seq = nn_getll (self->ring + cursor->pos);
+    }
+
+    return 0;
+}
+
+static void nn_journal_sync (struct nn_journal *self)
+{
+    nn_putll (self->map + 16, self->tail);
+    nn_putll (self->map + 24, self->head);
+    nn_putll (self->map + 32, self->first);
+    nn_putll (self->map + 40, self->last);
+}
+
+static void nn_journal_rebuild (struct nn_journal *self)
+{
+    size_t pos;
+    uint64_t seq;
+    uint64_t prev;
+
+    /*  Walk the records from the oldest to the newest. If they don't add up,
+        the file is damaged and the records are dropped. */
+    if (!self->first)
+        return;
+    if (nn_slow (self->tail > self->size - NN_JOURNAL_RECHDR ||
+          self->head > self->size || self->first > self->last))
+        goto damaged;
+    pos = self->tail;
+    prev = 0;
+    while (1) {
+        seq = nn_getll (self->ring + pos);
+        if (nn_slow (seq <= prev || seq < self->first || seq > self->last ||
+              nn_getll (self->ring + pos + 8) >
+              self->size - pos - NN_JOURNAL_RECHDR))
+            goto damaged;
+        nn_journal_index (self, seq, pos);
+        if (seq == self->last)
+            return;
+        prev = seq;
+        pos = nn_journal_next (self, pos);
+    }
+
+damaged:
+    self->tail = 0;
+    self->head = 0;
+    self->first = 0;
+    self->last = 0;
+    memset (self->granules, 0,
+        self->ngranules * sizeof (struct nn_journal_granule));
+    nn_journal_sync (self);
+}
+
+static size_t nn_journal_next (struct nn_journal *self, size_t pos)
+{
+    pos += NN_JOURNAL_RECHDR +
+        ((nn_getll (self->ring + pos + 8) + 7) & ~((uint64_t) 7));
+    if (pos + NN_JOURNAL_RECHDR > self->size ||
+          nn_getll (self->ring + pos) == 0)
+        return 0;
+    return pos;
+}
+
+static void nn_journal_evict (struct nn_journal *self, size_t from,
+    size_t to)
+{
+    /*  Drop the oldest records while they start in the specified range. */
+    while (self->first && self->tail >= from && self->tail < to) {
+        if (self->first == self->last) {
+            self->first = 0;
+            break;
+        }
+        self->tail = nn_journal_next (self, self->tail);
+        self->first = nn_getll (self->ring + self->tail);
+    }
+}
+
+static void nn_journal_index (struct nn_journal *self, uint64_t seq,
+    size_t pos)
+{
+    size_t g;
+
+    /*  Only the first record in the granule is remembered, unless the one
+        remembered was dropped in the meantime. */
+    g = pos / NN_JOURNAL_GRANULE;
+    if (g != self->current || self->granules [g].seq < self->first) {
+        self->granules [g].seq = seq;
+        self->granules [g].pos = pos;
+    }
+    self->current = g;
+}
+
+static size_t nn_journal_find (struct nn_journal *self, uint64_t seq)
+{
+    size_t i;
+    size_t pos;
+    uint64_t best;
+    struct nn_journal_granule *granule;
+
+    /*  Find the closest record preceding the one we are looking for. Entries
+        referring to the records that were already dropped are ignored. */
+    pos = self->tail;
+    best = self->first;
+    for (i = 0; i != self->ngranules; ++i) {
+        granule = &self->granules [i];
+        if (granule->seq > best && granule->seq <= seq &&
+              granule->seq <= self->last) {
+            best = granule->seq;
+            pos = granule->pos;
+        }
+    }
+
+    /*  Walk the rest of the way. */
+    while (nn_getll (self->ring + pos) < seq)
+        pos = nn_journal_next (self, pos);
+    return pos;
+}
+
+#else
+
+int nn_journal_init (struct nn_journal *self, const char *path,
+    size_t pathlen, size_t size)
+{
+    return -ENOTSUP;
+}
+
+void nn_journal_term (struct nn_journal *self)
+{
+    nn_assert (0);
+}
+
+uint64_t nn_journal_last (struct nn_journal *self)
+{
+    nn_assert (0);
+    return 0;
+}
+
+void nn_journal_put (struct nn_journal *self, uint64_t seq,
+    const void *body, size_t size)
+{
+    nn_assert (0);
+}
+
+void nn_journal_seek (struct nn_journal *self,
+    struct nn_journal_cursor *cursor, uint64_t seq)
+{
+    nn_assert (0);
+}
+
+int nn_journal_get (struct nn_journal *self, struct nn_journal_cursor *cursor,
+    uint64_t *seq, const uint8_t **body, size_t *size)
+{
+    nn_assert (0);
+    return -ENOTSUP;
+}
+
+#endif
@@ -0,0 +1,114 @@
+/*
+    Copyright (c) 2012-2013 250bpm s.r.o.
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"),
+    to deal in the Software without restriction, including without limitation
+    the rights to use, copy, modify, merge, publish, distribute, sublicense,
+    and/or sell copies of the Software, and to permit persons to whom
+    the Software is furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included
+    in all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+    THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+    FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+    IN THE SOFTWARE.
+*/
+
+#ifndef NN_JOURNAL_INCLUDED
+#define NN_JOURNAL_INCLUDED
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*  Ring of published messages stored in a memory-mapped file, so that
+    the subscribers can catch up on what they have missed. The file starts
+    with a header page holding the state of the ring, followed by the ring
+    itself. Each record consists of the sequence number of the message and
+    the size of the body, both 64-bit, followed by the body, padded to
+    a multiple of 8 bytes. A record that doesn't fit at the end of the ring
+    goes to the beginning, the oldest records being overwritten. Sequence
+    number zero marks the place where that happened. The ring is divided into
+    granules; for each granule, the first record written into it is
+    remembered, so that a record can be found by its sequence number without
+    scanning the whole ring. The object is not thread-safe. */
+
+/*  Default size of the ring. */
+#define NN_JOURNAL_SIZE (64 * 1024 * 1024)
+
+/*  Minimal size of the ring. */
+#define NN_JOURNAL_MINSIZE (64 * 1024)
+
+struct nn_journal_granule {
+    uint64_t seq;
+    size_t pos;
+};
+
+struct nn_journal {
+
+    /*  Path to the file. */
+    char *path;
+
+    /*  The mapping of the file, the header and the ring. */
+    int fd;
+    uint8_t *map;
+    uint8_t *ring;
+    size_t size;
+
+    /*  Offset of the oldest record and of the end of the newest one, and
+        their sequence numbers. 'first' is zero if the ring is empty. */
+    size_t tail;
+    size_t head;
+    uint64_t first;
+    uint64_t last;
+
+    /*  First record in each granule and the granule written to last. */
+    struct nn_journal_granule *granules;
+    size_t ngranules;
+    size_t current;
+};
+
+/*  Position of a reader in the journal. 'seq' is the sequence number of
+    the next message to read, 'pos' is a hint where it may be found. */
+struct nn_journal_cursor {
+    uint64_t seq;
+    size_t pos;
+};
+
+/*  Opens the journal file, creating it with a ring of the specified size if
+    it doesn't exist. If it does, its content is preserved and the size of
+    the existing ring is used. Returns -ENOTSUP on Windows. */
+int nn_journal_init (struct nn_journal *self, const char *path,
+    size_t pathlen, size_t size);
+
+/*  Closes the journal. The file is left behind. */
+void nn_journal_term (struct nn_journal *self);
+
+/*  Sequence number of the newest message in the journal, zero if there's
+    none. */
+uint64_t nn_journal_last (struct nn_journal *self);
+
+/*  Appends a message to the journal. The sequence numbers must grow.
+    Messages larger than quarter of the ring are not stored. */
+void nn_journal_put (struct nn_journal *self, uint64_t seq,
+    const void *body, size_t size);
+
+/*  Initialises the cursor to read messages starting with the specified
+    sequence number. */
+void nn_journal_seek (struct nn_journal *self,
+    struct nn_journal_cursor *cursor, uint64_t seq);
+
+/*  Returns the first message at or after the cursor and moves the cursor
+    past it. If the messages the cursor points to were already overwritten,
+    the oldest message in the journal is returned. The body points into
+    the journal and is valid only till the next nn_journal_put. Returns
+    -EAGAIN if there's no such message. */
+int nn_journal_get (struct nn_journal *self, struct nn_journal_cursor *cursor,
+    uint64_t *seq, const uint8_t **body, size_t *size);
+
+#endif
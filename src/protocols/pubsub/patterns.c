@@ -0,0 +1,430 @@
+/*
+    Copyright (c) 2012-2013 250bpm s.r.o.
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"),
+    to deal in the Software without restriction, including without limitation
+    the rights to use, copy, modify, merge, publish, distribute, sublicense,
+    and/or sell copies of the Software, and to permit persons to whom
+    the Software is furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included
+    in all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+    THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+    FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+    IN THE SOFTWARE.
+*/
+
+
+#include "patterns.h"
+
+#include "../../utils/alloc.h"
+#include "../../utils/fast.h"
+#include "../../utils/err.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+/*  The automaton is built by the subset construction from a nondeterministic
+    one. Each position within each pattern is a state of the latter and its
+    symbol is the byte expected at that position, a wildcard or the end of
+    the pattern. The states of a pattern are numbered consecutively, so that
+    'state + 1' is the next position. */
+#define NN_PATTERNS_STAR 256
+#define NN_PATTERNS_END 257
+
+struct nn_patterns_build {
+
+    /*  The patterns being compiled. */
+    struct nn_patterns *self;
+
+    /*  Symbol of each state of the nondeterministic automaton. */
+    uint16_t *syms;
+    uint32_t nsyms;
+
+    /*  Representative byte of each byte class. */
+    uint8_t reps [256];
+
+    /*  The automaton being built. Each of its states is a sorted set of
+        the nondeterministic states, stored as 'setlen' entries of 'pool'
+        at 'setpos'. The capacity of all these arrays is 'capacity'
+        states. */
+    struct nn_patterns_dfa *dfa;
+    uint32_t capacity;
+    size_t *setpos;
+    uint32_t *setlen;
+    uint32_t *pool;
+    size_t poolsize;
+    size_t poolcapacity;
+
+    /*  Open-addressing hash table mapping the sets to the states. */
+    uint32_t *slots;
+    uint32_t nslots;
+
+    /*  The set being computed. 'marks' tells which states are already
+        in it. */
+    uint32_t *set;
+    uint32_t setsize;
+    uint8_t *marks;
+};
+
+/*  Private functions. */
+static void nn_patterns_count (const uint8_t *data, size_t size, void *arg);
+static void nn_patterns_fill (const uint8_t *data, size_t size, void *arg);
+static void nn_patterns_add (struct nn_patterns_build *build, uint32_t sym);
+static int nn_patterns_state (struct nn_patterns_build *build);
+static uint32_t nn_patterns_hash (const uint32_t *set, uint32_t size);
+static void nn_patterns_rehash (struct nn_patterns_build *build);
+static int nn_patterns_cmp (const void *a, const void *b);
+
+void nn_patterns_init (struct nn_patterns *self, uint8_t separator)
+{
+    nn_topics_init (&self->source);
+    self->separator = separator;
+}
+
+void nn_patterns_term (struct nn_patterns *self)
+{
+    nn_topics_term (&self->source);
+}
+
+int nn_patterns_subscribe (struct nn_patterns *self, const uint8_t *data,
+    size_t size)
+{
+    return nn_topics_subscribe (&self->source, data, size);
+}
+
+int nn_patterns_unsubscribe (struct nn_patterns *self, const uint8_t *data,
+    size_t size)
+{
+    return nn_topics_unsubscribe (&self->source, data, size);
+}
+
+int nn_patterns_compile (struct nn_patterns *self,
+    struct nn_patterns_dfa **dfa)
+{
+    int rc;
+    struct nn_patterns_build build;
+    uint8_t used [256];
+    uint32_t classes;
+    uint32_t s;
+    uint32_t c;
+    uint32_t i;
+    uint32_t sym;
+    uint8_t rep;
+    int b;
+
+    *dfa = NULL;
+    if (!self->source.items)
+        return 0;
+
+    /*  Lay out the states of the nondeterministic automaton. */
+    memset (&build, 0, sizeof (build));
+    build.self = self;
+    nn_topics_walk (&self->source, nn_patterns_count, &build);
+    build.syms = nn_alloc (build.nsyms * sizeof (uint16_t), "patterns");
+    alloc_assert (build.syms);
+    build.nsyms = 0;
+    nn_topics_walk (&self->source, nn_patterns_fill, &build);
+
+    /*  All the bytes that don't occur in any pattern behave the same way,
+        they are put into class 0. Each of the other bytes gets a class of
+        its own. If all the byte values are used, there's no class 0. */
+    memset (used, 0, sizeof (used));
+    used [self->separator] = 1;
+    for (i = 0; i != build.nsyms; ++i)
+        if (build.syms [i] < 256)
+            used [build.syms [i]] = 1;
+    build.dfa = nn_alloc (sizeof (struct nn_patterns_dfa), "patterns");
+    alloc_assert (build.dfa);
+    classes = 0;
+    for (b = 0; b != 256; ++b) {
+        if (!used [b]) {
+            build.reps [0] = (uint8_t) b;
+            classes = 1;
+            break;
+        }
+    }
+    for (b = 0; b != 256; ++b) {
+        if (used [b]) {
+            build.dfa->map [b] = (uint8_t) classes;
+            build.reps [classes] = (uint8_t) b;
+            ++classes;
+        }
+        else
+            build.dfa->map [b] = 0;
+    }
+    build.dfa->classes = classes;
+    build.dfa->states = 0;
+    build.dfa->table = NULL;
+    build.dfa->accept = NULL;
+
+    build.set = nn_alloc (build.nsyms * sizeof (uint32_t), "patterns");
+    alloc_assert (build.set);
+    build.marks = nn_alloc (build.nsyms, "patterns");
+    alloc_assert (build.marks);
+    memset (build.marks, 0, build.nsyms);
+
+    /*  The dead state is the empty set. The initial state is the beginning
+        of every pattern. */
+    build.setsize = 0;
+    rc = nn_patterns_state (&build);
+    nn_assert (rc == 0);
+    for (i = 0; i != build.nsyms; ++i)
+        if (i == 0 || build.syms [i - 1] == NN_PATTERNS_END)
+            nn_patterns_add (&build, i);
+    rc = nn_patterns_state (&build);
+    nn_assert (rc == 1);
+
+    /*  The states are numbered in the order they are discovered, so walking
+        the numbers processes each of them exactly once. */
+    for (s = 1; s != build.dfa->states; ++s) {
+        for (c = 0; c != classes; ++c) {
+
+            /*  Once a pattern has matched the result is known. */
+            if (build.dfa->accept [s]) {
+                build.dfa->table [s * classes + c] = s;
+                continue;
+            }
+
+            rep = build.reps [c];
+            build.setsize = 0;
+            for (i = 0; i != build.setlen [s]; ++i) {
+                sym = build.pool [build.setpos [s] + i];
+                if (build.syms [sym] == NN_PATTERNS_STAR) {
+                    if (rep != self->separator)
+                        nn_patterns_add (&build, sym);
+                }
+                else if (build.syms [sym] == rep)
+                    nn_patterns_add (&build, sym + 1);
+            }
+            rc = nn_patterns_state (&build);
+            if (nn_slow (rc < 0))
+                goto fail;
+            build.dfa->table [s * classes + c] = (uint32_t) rc;
+        }
+    }
+
+    *dfa = build.dfa;
+    build.dfa = NULL;
+    rc = 0;
+
+fail:
+    nn_patterns_free (build.dfa);
+    nn_free (build.marks);
+    nn_free (build.set);
+    if (build.slots)
+        nn_free (build.slots);
+    if (build.pool)
+        nn_free (build.pool);
+    if (build.setlen)
+        nn_free (build.setlen);
+    if (build.setpos)
+        nn_free (build.setpos);
+    nn_free (build.syms);
+    return rc;
+}
+
+void nn_patterns_free (struct nn_patterns_dfa *dfa)
+{
+    if (!dfa)
+        return;
+    if (dfa->accept)
+        nn_free (dfa->accept);
+    if (dfa->table)
+        nn_free (dfa->table);
+    nn_free (dfa);
+}
+
+int nn_patterns_match (struct nn_patterns_dfa *dfa, const uint8_t *data,
+    size_t size, size_t *len)
+{
+    uint32_t state;
+    uint32_t classes;
+    const uint32_t *table;
+    const uint8_t *accept;
+    size_t i;
+
+    classes = dfa->classes;
+    table = dfa->table;
+    accept = dfa->accept;
+    state = 1;
+    for (i = 0; !accept [state]; ++i) {
+        if (i == size || !state)
+            return 0;
+        state = table [state * classes + dfa->map [data [i]]];
+    }
+    *len = i;
+    return 1;
+}
+
+size_t nn_patterns_prefix (const uint8_t *data, size_t size)
+{
+    const uint8_t *pos;
+
+    pos = memchr (data, '*', size);
+    return pos ? (size_t) (pos - data) : size;
+}
+
+static void nn_patterns_count (const uint8_t *data, size_t size, void *arg)
+{
+    ((struct nn_patterns_build*) arg)->nsyms += (uint32_t) size + 1;
+}
+
+static void nn_patterns_fill (const uint8_t *data, size_t size, void *arg)
+{
+    struct nn_patterns_build *build;
+    size_t i;
+
+    build = (struct nn_patterns_build*) arg;
+    for (i = 0; i != size; ++i)
+        build->syms [build->nsyms++] =
+            data [i] == '*' ? NN_PATTERNS_STAR : data [i];
+    build->syms [build->nsyms++] = NN_PATTERNS_END;
+}
+
+static void nn_patterns_add (struct nn_patterns_build *build, uint32_t sym)
+{
+    /*  A wildcard can match an empty segment, so the position following
+        it is reached at the same time. */
+    while (1) {
+        if (build->marks [sym])
+            return;
+        build->marks [sym] = 1;
+        build->set [build->setsize++] = sym;
+        if (build->syms [sym] != NN_PATTERNS_STAR)
+            return;
+        ++sym;
+    }
+}
+
+static int nn_patterns_state (struct nn_patterns_build *build)
+{
+    /*  Returns the state of the automaton for the set just computed, adding
+        it if it doesn't exist yet. Returns -ENOMEM if there are too many
+        states. */
+
+    struct nn_patterns_dfa *dfa;
+    uint32_t hash;
+    uint32_t i;
+    uint32_t s;
+    uint32_t j;
+
+    dfa = build->dfa;
+    for (i = 0; i != build->setsize; ++i)
+        build->marks [build->set [i]] = 0;
+    qsort (build->set, build->setsize, sizeof (uint32_t), nn_patterns_cmp);
+
+    /*  Look the set up. */
+    hash = nn_patterns_hash (build->set, build->setsize);
+    if (build->nslots) {
+        i = hash & (build->nslots - 1);
+        while (build->slots [i]) {
+            s = build->slots [i] - 1;
+            if (build->setlen [s] == build->setsize &&
+                  memcmp (build->pool + build->setpos [s], build->set,
+                  build->setsize * sizeof (uint32_t)) == 0)
+                return (int) s;
+            i = (i + 1) & (build->nslots - 1);
+        }
+    }
+
+    /*  It's a new state. */
+    if (nn_slow (dfa->states == NN_PATTERNS_MAX_STATES))
+        return -ENOMEM;
+    if (dfa->states == build->capacity) {
+        build->capacity = build->capacity ? build->capacity * 2 : 64;
+        build->setpos = nn_realloc (build->setpos,
+            build->capacity * sizeof (size_t));
+        alloc_assert (build->setpos);
+        build->setlen = nn_realloc (build->setlen,
+            build->capacity * sizeof (uint32_t));
+        alloc_assert (build->setlen);
+        dfa->table = nn_realloc (dfa->table,
+            build->capacity * dfa->classes * sizeof (uint32_t));
+        alloc_assert (dfa->table);
+        dfa->accept = nn_realloc (dfa->accept, build->capacity);
+        alloc_assert (dfa->accept);
+    }
+    if (build->poolsize + build->setsize > build->poolcapacity) {
+        while (build->poolsize + build->setsize > build->poolcapacity)
+            build->poolcapacity = build->poolcapacity ?
+                build->poolcapacity * 2 : 256;
+        build->pool = nn_realloc (build->pool,
+            build->poolcapacity * sizeof (uint32_t));
+        alloc_assert (build->pool);
+    }
+    s = dfa->states++;
+    build->setpos [s] = build->poolsize;
+    build->setlen [s] = build->setsize;
+    if (build->setsize)
+        memcpy (build->pool + build->poolsize, build->set,
+            build->setsize * sizeof (uint32_t));
+    build->poolsize += build->setsize;
+    dfa->accept [s] = 0;
+    for (j = 0; j != build->setsize; ++j)
+        if (build->syms [build->set [j]] == NN_PATTERNS_END)
+            dfa->accept [s] = 1;
+    memset (dfa->table + s * dfa->classes, 0,
+        dfa->classes * sizeof (uint32_t));
+
+    /*  Keep the table at most half full. */
+    if (dfa->states * 2 > build->nslots)
+        nn_patterns_rehash (build);
+    else {
+        i = hash & (build->nslots - 1);
+        while (build->slots [i])
+            i = (i + 1) & (build->nslots - 1);
+        build->slots [i] = s + 1;
+    }
+
+    return (int) s;
+}
+
+static uint32_t nn_patterns_hash (const uint32_t *set, uint32_t size)
+{
+    uint32_t hash;
+
+    /*  FNV-1a, applied to whole states rather than bytes. */
+    hash = 2166136261u;
+    while (size--) {
+        hash ^= *set++;
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+static void nn_patterns_rehash (struct nn_patterns_build *build)
+{
+    uint32_t s;
+    uint32_t i;
+
+    if (build->slots)
+        nn_free (build->slots);
+    build->nslots = build->nslots ? build->nslots * 2 : 128;
+    build->slots = nn_alloc (build->nslots * sizeof (uint32_t), "patterns");
+    alloc_assert (build->slots);
+    memset (build->slots, 0, build->nslots * sizeof (uint32_t));
+    for (s = 0; s != build->dfa->states; ++s) {
+        i = nn_patterns_hash (build->pool + build->setpos [s],
+            build->setlen [s]) & (build->nslots - 1);
+        while (build->slots [i])
+            i = (i + 1) & (build->nslots - 1);
+        build->slots [i] = s + 1;
+    }
+}
+
+static int nn_patterns_cmp (const void *a, const void *b)
+{
+    uint32_t x;
+    uint32_t y;
+
+    x = *(const uint32_t*) a;
+    y = *(const uint32_t*) b;
+    return x < y ? -1 : (x > y ? 1 : 0);
+}
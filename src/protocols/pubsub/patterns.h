@@ -0,0 +1,113 @@
+/*
+    Copyright (c) 2012-2013 250bpm s.r.o.
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"),
+    to deal in the Software without restriction, including without limitation
+    the rights to use, copy, modify, merge, publish, distribute, sublicense,
+    and/or sell copies of the Software, and to permit persons to whom
+    the Software is furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included
+    in all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+    THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+    FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+    IN THE SOFTWARE.
+*/
+
+
+#ifndef NN_PATTERNS_INCLUDED
+#define NN_PATTERNS_INCLUDED
+
+#include "topics.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*  Set of wildcard patterns. A pattern matches the beginning of a message,
+    same as a prefix subscription, except that each '*' in the pattern
+    matches any run of bytes not containing the separator, i.e. a single
+    segment of a hierarchical topic. With '.' as the separator, "md.*.nq."
+    matches "md.eq.nq.AAPL" but neither "md.eq.ny.IBM" nor "md.eq.x.nq.".
+
+    The patterns are not matched one by one. The whole set is compiled into
+    a deterministic automaton that decides whether a message matches any of
+    the patterns in a single pass over its bytes, irrespective of the number
+    of patterns. The bytes are mapped to classes first, so that the bytes not
+    occurring in any pattern share a single column of the transition table. */
+
+/*  Upper limit on the number of states of the automaton. */
+#define NN_PATTERNS_MAX_STATES 65536
+
+struct nn_patterns_dfa {
+
+    /*  Number of states and of byte classes. State 0 is the dead state,
+        i.e. no pattern can match any more. State 1 is the initial state. */
+    uint32_t states;
+    uint32_t classes;
+
+    /*  Byte class of each byte value. */
+    uint8_t map [256];
+
+    /*  Next state for each state and byte class, 'classes' entries per
+        state. */
+    uint32_t *table;
+
+    /*  1 for the states where some pattern has already matched. */
+    uint8_t *accept;
+};
+
+struct nn_patterns {
+
+    /*  The patterns with their reference counts. */
+    struct nn_topics source;
+
+    /*  The byte delimiting the segments of a topic. */
+    uint8_t separator;
+};
+
+/*  Initialise an empty set. */
+void nn_patterns_init (struct nn_patterns *self, uint8_t separator);
+
+/*  Release all the resources associated with the set. */
+void nn_patterns_term (struct nn_patterns *self);
+
+/*  Add the pattern to the set. If the pattern is not yet there, 1 is returned
+    and the automaton has to be compiled anew. If it already exists in
+    the set, its reference count is incremented and 0 is returned. */
+int nn_patterns_subscribe (struct nn_patterns *self, const uint8_t *data,
+    size_t size);
+
+/*  Remove the pattern from the set. If the pattern was actually removed,
+    1 is returned. If reference count was decremented without falling to
+    zero, 0 is returned. If the pattern is not in the set, -EINVAL is
+    returned. */
+int nn_patterns_unsubscribe (struct nn_patterns *self, const uint8_t *data,
+    size_t size);
+
+/*  Compile the automaton for the current set of patterns. If the set is
+    empty, 'dfa' is set to NULL. Returns -ENOMEM if the automaton would have
+    more than NN_PATTERNS_MAX_STATES states. Removing patterns never makes
+    the automaton grow, so it fails only after adding one. */
+int nn_patterns_compile (struct nn_patterns *self,
+    struct nn_patterns_dfa **dfa);
+
+/*  Deallocate the automaton. NULL is allowed. */
+void nn_patterns_free (struct nn_patterns_dfa *dfa);
+
+/*  Returns 1 if the message matches any of the patterns the automaton was
+    compiled from, 0 otherwise. In case of a match, the length of the part
+    of the message matched by the pattern is stored in 'len'. */
+int nn_patterns_match (struct nn_patterns_dfa *dfa, const uint8_t *data,
+    size_t size, size_t *len);
+
+/*  Returns the length of the literal part of the pattern, i.e. the part
+    preceding the first wildcard. */
+size_t nn_patterns_prefix (const uint8_t *data, size_t size);
+
+#endif
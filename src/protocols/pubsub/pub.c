@@ -21,6 +21,11 @@
 */
 
 #include "pub.h"
+#include "sub.h"
+#include "trie.h"
+#include "topics.h"
+#include "conflate.h"
+#include "journal.h"
 
 #include "../../nn.h"
 #include "../../pubsub.h"
@@ -31,11 +36,84 @@
 #include "../../utils/dist.h"
 #include "../../utils/alloc.h"
 #include "../../utils/list.h"
+#include "../../utils/wire.h"
 
 #include <stddef.h>
+#include <string.h>
+
+/*  NN_PUB_EVICT_DROPS applies to each this many consecutive messages
+    for the subscriber. */
+#define NN_PUB_EVICT_WINDOW 100
 
 struct nn_pub_data {
     struct nn_dist_data item;
+
+    /*  Subscriptions forwarded by the subscriber. Until the subscriber
+        sends any, 'filtering' is not set, the pipe is in the list of
+        unfiltered pipes and all the messages are sent to it. The subscriber
+        does its own filtering anyway. */
+    struct nn_list subs;
+    int filtering;
+    struct nn_list_item unfiltered;
+
+    /*  Messages waiting to be sent to the pipe, the latest one for each topic.
+        These are the cached messages replayed to the subscriber and, in
+        conflating mode, the messages that couldn't be sent because the pipe
+        wasn't ready. They are sent as soon as the pipe is writable. */
+    struct nn_conflate pending;
+
+    /*  Item in the list of all the pipes. */
+    struct nn_list_item pipesitem;
+
+    /*  Endpoint the pipe belongs to and the statistics of the pipe. */
+    int eid;
+    uint64_t sent;
+    uint64_t sentbytes;
+    uint64_t dropped;
+    uint64_t droppedbytes;
+
+    /*  Sequence number of the last message delivered to the pipe. A pipe
+        matching several subscriptions is selected several times for the same
+        message, this makes sure it's counted only once. */
+    uint64_t seq;
+
+    /*  If set, the subscriber has asked for the sequence numbers of the
+        messages. Such a pipe is fed from the journal rather than by the
+        distributor; the cursor points to the next message to send to it. */
+    int sequenced;
+    struct nn_journal_cursor cursor;
+    struct nn_list_item seqitem;
+
+    /*  Eviction of a subscriber that's not keeping up. 'stalled' is set
+        while the pipe is not accepting messages, since the time 'since'.
+        'window' counts the messages for the pipe and 'windowdrops' those of
+        them dropped, since the drop rate was checked last. A pipe to evict
+        is put into the list of such pipes until the message is sent to
+        the others. 'evicted' is set if the transport wasn't able to break
+        the connection, in which case the pipe stays but gets nothing. */
+    int stalled;
+    uint64_t since;
+    int window;
+    int windowdrops;
+    struct nn_list_item evictitem;
+    int evicted;
+};
+
+/*  A topic at least one subscriber is subscribed to. It's stored as the user
+    data of the corresponding subscription in the shared trie. The topic
+    itself follows the structure. */
+struct nn_pub_topic {
+    struct nn_list subs;
+    size_t size;
+};
+
+/*  Subscription of a single pipe to a single topic. It's both in the list
+    of the topic's subscribers and in the list of the pipe's subscriptions. */
+struct nn_pub_sub {
+    struct nn_list_item topicitem;
+    struct nn_list_item pipeitem;
+    struct nn_pub_data *data;
+    struct nn_pub_topic *topic;
 };
 
 struct nn_pub {
@@ -45,12 +123,118 @@ struct nn_pub {
 
     /*  Distributor. */
     struct nn_dist outpipes;
+
+    /*  All the pipes, in the order they were added. */
+    struct nn_list pipes;
+
+    /*  Sequence number of the message being sent. */
+    uint64_t seq;
+
+    /*  Subscriptions of all the pipes. A single traversal of the trie yields
+        all the pipes a message should be sent to, so the cost of matching
+        doesn't grow with the number of subscribers. The reference count of
+        each subscription is the number of pipes subscribed to it. */
+    struct nn_trie trie;
+
+    /*  Pipes whose subscribers haven't sent any subscriptions yet. */
+    struct nn_list unfiltered;
+
+    /*  The pipe nn_pub_in is currently receiving from. Receiving from a pipe
+        may fail synchronously and remove the pipe from the socket. In such
+        case this is reset to NULL so that nn_pub_in knows it mustn't touch
+        the pipe's data any more. */
+    struct nn_pub_data *indata;
+
+    /*  Same as above, for sending the pending messages in nn_pub_out. */
+    struct nn_pub_data *outdata;
+
+    /*  If set, messages for pipes that are not ready for sending are kept,
+        one per topic, instead of being dropped. See NN_PUB_CONFLATE. */
+    int conflate;
+
+    /*  Character that terminates the topic of the message, or -1 if
+        the whole message is the topic. */
+    int delimiter;
+
+    /*  If set, the latest message for each topic is kept in 'cache' and
+        replayed to the subscribers as they subscribe to it. See
+        NN_PUB_LAST_VALUE_CACHE. */
+    int lvc;
+    struct nn_conflate cache;
+
+    /*  Journal of the published messages, NULL if NN_PUB_JOURNAL is not
+        set, the size of the ring to create and the pipes fed from it. See
+        NN_PUB_JOURNAL. */
+    struct nn_journal *journal;
+    int journalsize;
+    struct nn_list sequenced;
+
+    /*  Pipes to evict once the message being sent is sent. See
+        NN_PUB_EVICT_TIMEOUT and NN_PUB_EVICT_DROPS, zero means the check
+        is off. */
+    struct nn_list evicting;
+    int evicttimeout;
+    int evictdrops;
+};
+
+/*  The message being sent, passed to nn_pub_select. The topic is computed
+    only if some pipe needs it, 'hastopic' is set once it is. */
+struct nn_pub_sending {
+    struct nn_pub *pub;
+    struct nn_msg *msg;
+    uint64_t seq;
+    int hastopic;
+    size_t topic;
+    int hasnow;
+    uint64_t now;
+};
+
+/*  The pipe the cached messages are being replayed to, passed to
+    nn_pub_replay_msg. If 'sub' is NULL, the messages matching any of
+    the pipe's subscriptions are replayed. Otherwise, only those matching
+    'sub' and none of the pipe's older subscriptions are. */
+struct nn_pub_replaying {
+    struct nn_pub *pub;
+    struct nn_pub_data *data;
+    struct nn_pub_sub *sub;
 };
 
 /*  Private functions. */
 static int nn_pub_init (struct nn_pub *self,
     const struct nn_sockbase_vfptr *vfptr);
 static void nn_pub_term (struct nn_pub *self);
+static void nn_pub_subscriptions (struct nn_pub *self,
+    struct nn_pub_data *data, struct nn_msg *msg);
+static struct nn_pub_sub *nn_pub_subscribe (struct nn_pub *self,
+    struct nn_pub_data *data, const uint8_t *topic, size_t size);
+static void nn_pub_unsubscribe (struct nn_pub *self, struct nn_pub_data *data,
+    const uint8_t *topic, size_t size);
+static void nn_pub_unsubscribe_all (struct nn_pub *self,
+    struct nn_pub_data *data);
+static void nn_pub_rmsub (struct nn_pub *self, struct nn_pub_sub *sub);
+static void nn_pub_select (void *topic, void *arg);
+static void nn_pub_deliver (struct nn_pub_sending *sending,
+    struct nn_pub_data *data);
+static size_t nn_pub_topic (struct nn_pub_sending *sending);
+static int nn_pub_enqueue (struct nn_pub *self, struct nn_pub_data *data,
+    struct nn_msg *msg, size_t topic);
+static void nn_pub_check (struct nn_pub_sending *sending,
+    struct nn_pub_data *data, int ready, int dropped);
+static void nn_pub_evict (struct nn_pub *self, struct nn_pub_data *data);
+static void nn_pub_replay (struct nn_pub *self, struct nn_pub_data *data,
+    struct nn_pub_sub *sub);
+static void nn_pub_replay_msg (struct nn_msg *msg, size_t topic, void *arg);
+static int nn_pub_sub_matches (struct nn_pub_sub *sub, struct nn_msg *msg);
+static void nn_pub_flush (struct nn_pub *self, struct nn_pub_data *data);
+static void nn_pub_sequence (struct nn_pub *self, struct nn_pub_data *data,
+    uint64_t seq);
+static void nn_pub_pump (struct nn_pub *self, struct nn_pub_data *data);
+static int nn_pub_wants (struct nn_pub_data *data, const uint8_t *body,
+    size_t size);
+static int nn_pub_setjournal (struct nn_pub *self, const void *path,
+    size_t pathlen);
+static int nn_pub_stats (struct nn_pub *self, void *optval,
+    size_t *optvallen);
 
 /*  Implementation of nn_sockbase's virtual functions. */
 static int nn_pub_ispeer (int socktype);
@@ -66,7 +250,7 @@ static int nn_pub_setopt (struct nn_sockbase *self, int level, int option,
 static int nn_pub_getopt (struct nn_sockbase *self, int level, int option,
     void *optval, size_t *optvallen);
 static const struct nn_sockbase_vfptr nn_pub_sockbase_vfptr = {
-    NN_SOCKBASE_FLAG_NORECV,
+    NN_SOCKBASE_FLAG_NORECV | NN_SOCKBASE_FLAG_LOSSY,
     nn_pub_ispeer,
     nn_pub_destroy,
     nn_pub_add,
@@ -95,12 +279,38 @@ static int nn_pub_init (struct nn_pub *self,
         return rc;
 
     nn_dist_init (&self->outpipes);
+    nn_list_init (&self->pipes);
+    self->seq = 0;
+    nn_trie_init (&self->trie);
+    nn_list_init (&self->unfiltered);
+    self->indata = NULL;
+    self->outdata = NULL;
+    self->conflate = 0;
+    self->delimiter = -1;
+    self->lvc = 0;
+    nn_conflate_init (&self->cache);
+    self->journal = NULL;
+    self->journalsize = NN_JOURNAL_SIZE;
+    nn_list_init (&self->sequenced);
+    nn_list_init (&self->evicting);
+    self->evicttimeout = 0;
+    self->evictdrops = 0;
 
     return 0;
 }
 
 static void nn_pub_term (struct nn_pub *self)
 {
+    if (self->journal) {
+        nn_journal_term (self->journal);
+        nn_free (self->journal);
+    }
+    nn_list_term (&self->evicting);
+    nn_list_term (&self->sequenced);
+    nn_conflate_term (&self->cache);
+    nn_list_term (&self->unfiltered);
+    nn_trie_term (&self->trie);
+    nn_list_term (&self->pipes);
     nn_dist_term (&self->outpipes);
     nn_sockbase_term (&self->sockbase);
 }
@@ -125,6 +335,28 @@ static int nn_pub_add (struct nn_sockbase *self, struct nn_pipe *pipe)
     data = nn_alloc (sizeof (struct nn_pub_data), "pipe data (pub)");
     alloc_assert (data);
     nn_dist_add (&pub->outpipes, pipe, &data->item);
+    nn_list_init (&data->subs);
+    data->filtering = 0;
+    nn_list_item_init (&data->unfiltered);
+    nn_list_insert (&pub->unfiltered, &data->unfiltered,
+        nn_list_end (&pub->unfiltered));
+    nn_conflate_init (&data->pending);
+    nn_list_item_init (&data->pipesitem);
+    nn_list_insert (&pub->pipes, &data->pipesitem, nn_list_end (&pub->pipes));
+    data->eid = nn_pipe_geteid (pipe);
+    data->sent = 0;
+    data->sentbytes = 0;
+    data->dropped = 0;
+    data->droppedbytes = 0;
+    data->seq = 0;
+    data->sequenced = 0;
+    nn_list_item_init (&data->seqitem);
+    data->stalled = 0;
+    data->since = 0;
+    data->window = 0;
+    data->windowdrops = 0;
+    nn_list_item_init (&data->evictitem);
+    data->evicted = 0;
     nn_pipe_setdata (pipe, data);
 
     return 0;
@@ -139,23 +371,95 @@ static void nn_pub_rm (struct nn_sockbase *self, struct nn_pipe *pipe)
     data = nn_pipe_getdata (pipe);
 
     nn_dist_rm (&pub->outpipes, pipe, &data->item);
+    nn_pub_unsubscribe_all (pub, data);
+    nn_list_term (&data->subs);
+    if (nn_list_item_isinlist (&data->unfiltered))
+        nn_list_erase (&pub->unfiltered, &data->unfiltered);
+    nn_list_item_term (&data->unfiltered);
+    nn_conflate_term (&data->pending);
+    nn_list_erase (&pub->pipes, &data->pipesitem);
+    nn_list_item_term (&data->pipesitem);
+    if (data->sequenced)
+        nn_list_erase (&pub->sequenced, &data->seqitem);
+    nn_list_item_term (&data->seqitem);
+    if (nn_list_item_isinlist (&data->evictitem))
+        nn_list_erase (&pub->evicting, &data->evictitem);
+    nn_list_item_term (&data->evictitem);
+    if (pub->indata == data)
+        pub->indata = NULL;
+    if (pub->outdata == data)
+        pub->outdata = NULL;
 
     nn_free (data);
 }
 
 static void nn_pub_in (struct nn_sockbase *self, struct nn_pipe *pipe)
 {
-    /*  We shouldn't get any messages from subscribers. */
-    nn_assert (0);
+    int rc;
+    struct nn_pub *pub;
+    struct nn_pub_data *data;
+    struct nn_msg msg;
+
+    pub = nn_cont (self, struct nn_pub, sockbase);
+    data = nn_pipe_getdata (pipe);
+
+    /*  The only messages we get from subscribers are their subscriptions. */
+    while (1) {
+        pub->indata = data;
+        rc = nn_pipe_recv (pipe, &msg);
+        errnum_assert (rc >= 0, -rc);
+        if (nn_slow (!pub->indata)) {
+            nn_msg_term (&msg);
+            return;
+        }
+        nn_pub_subscriptions (pub, data, &msg);
+        nn_msg_term (&msg);
+
+        /*  Replaying the cached messages may have removed the pipe, too. */
+        if (nn_slow (!pub->indata))
+            return;
+        pub->indata = NULL;
+        if (rc & NN_PIPE_RELEASE)
+            break;
+    }
 }
 
 static void nn_pub_out (struct nn_sockbase *self, struct nn_pipe *pipe)
 {
+    int rc;
     struct nn_pub *pub;
     struct nn_pub_data *data;
+    struct nn_msg msg;
 
     pub = nn_cont (self, struct nn_pub, sockbase);
     data = nn_pipe_getdata (pipe);
+    data->stalled = 0;
+
+    if (data->sequenced) {
+        nn_dist_out (&pub->outpipes, pipe, &data->item);
+        nn_pub_pump (pub, data);
+        return;
+    }
+
+    /*  Send the messages conflated while the pipe was not writable first.
+        If the pipe gets full again, the rest of them wait for the next
+        time. */
+    while (1) {
+        rc = nn_conflate_get (&data->pending, &msg);
+        if (rc == -EAGAIN)
+            break;
+        errnum_assert (rc == 0, -rc);
+        ++data->sent;
+        data->sentbytes += nn_chunkref_size (&msg.body);
+        pub->outdata = data;
+        rc = nn_pipe_send (pipe, &msg);
+        errnum_assert (rc >= 0, -rc);
+        if (nn_slow (!pub->outdata))
+            return;
+        pub->outdata = NULL;
+        if (rc & NN_PIPE_RELEASE)
+            return;
+    }
 
     nn_dist_out (&pub->outpipes, pipe, &data->item);
 }
@@ -167,20 +471,711 @@ static int nn_pub_events (struct nn_sockbase *self)
 
 static int nn_pub_send (struct nn_sockbase *self, struct nn_msg *msg)
 {
-    return nn_dist_send (&nn_cont (self, struct nn_pub, sockbase)->outpipes,
-        msg, NULL);
+    int rc;
+    struct nn_pub *pub;
+    struct nn_list_item *it;
+    struct nn_list_item *next;
+    struct nn_pub_sending sending;
+    struct nn_msg copy;
+
+    pub = nn_cont (self, struct nn_pub, sockbase);
+
+    nn_msg_flatten (msg);
+    sending.pub = pub;
+    sending.msg = msg;
+    sending.seq = ++pub->seq;
+    sending.hastopic = 0;
+    sending.hasnow = 0;
+
+    /*  The pipes that don't filter get everything. */
+    for (it = nn_list_begin (&pub->unfiltered);
+          it != nn_list_end (&pub->unfiltered);
+          it = nn_list_next (&pub->unfiltered, it))
+        nn_pub_deliver (&sending, nn_cont (it, struct nn_pub_data, unfiltered));
+
+    /*  Select the pipes subscribed to any prefix of the message. */
+    nn_trie_match_all (&pub->trie, nn_chunkref_data (&msg->body),
+        nn_chunkref_size (&msg->body), nn_pub_select, &sending);
+
+    /*  Keep a copy of the message for the future subscribers. */
+    if (pub->lvc) {
+        nn_msg_cp (&copy, msg);
+        nn_conflate_put (&pub->cache, &copy, nn_pub_topic (&sending));
+    }
+
+    rc = nn_dist_send_selected (&pub->outpipes, msg);
+    errnum_assert (rc == 0, -rc);
+
+    /*  Evicting a pipe may remove it. */
+    while (!nn_list_empty (&pub->evicting)) {
+        it = nn_list_begin (&pub->evicting);
+        nn_list_erase (&pub->evicting, it);
+        nn_pub_evict (pub, nn_cont (it, struct nn_pub_data, evictitem));
+    }
+
+    if (!pub->journal)
+        return 0;
+
+    /*  The subscribers that want the sequence numbers get the message from
+        the journal. Pumping a pipe may remove it. */
+    nn_journal_put (pub->journal, sending.seq, nn_chunkref_data (&msg->body),
+        nn_chunkref_size (&msg->body));
+    for (it = nn_list_begin (&pub->sequenced);
+          it != nn_list_end (&pub->sequenced); it = next) {
+        next = nn_list_next (&pub->sequenced, it);
+        nn_pub_pump (pub, nn_cont (it, struct nn_pub_data, seqitem));
+    }
+    return 0;
+}
+
+static void nn_pub_select (void *topic, void *arg)
+{
+    struct nn_list_item *it;
+
+    for (it = nn_list_begin (&((struct nn_pub_topic*) topic)->subs);
+          it != nn_list_end (&((struct nn_pub_topic*) topic)->subs);
+          it = nn_list_next (&((struct nn_pub_topic*) topic)->subs, it))
+        nn_pub_deliver ((struct nn_pub_sending*) arg,
+            nn_cont (it, struct nn_pub_sub, topicitem)->data);
+}
+
+static void nn_pub_deliver (struct nn_pub_sending *sending,
+    struct nn_pub_data *data)
+{
+    size_t size;
+    struct nn_msg copy;
+
+    if (data->seq == sending->seq || data->sequenced)
+        return;
+    data->seq = sending->seq;
+
+    /*  If the pipe is ready, it will get the message. Otherwise, in the
+        conflating mode, the message replaces any older message with the same
+        topic waiting for the pipe. The same is done while there are replayed
+        messages waiting, lest they overtake the newer ones. */
+    size = nn_chunkref_size (&sending->msg->body);
+    if (nn_dist_select (&sending->pub->outpipes, &data->item)) {
+        ++data->sent;
+        data->sentbytes += size;
+        nn_pub_check (sending, data, 1, 0);
+        return;
+    }
+    if (!sending->pub->conflate && nn_conflate_empty (&data->pending)) {
+        ++data->dropped;
+        data->droppedbytes += size;
+        nn_sockbase_dropped (&sending->pub->sockbase, size);
+        nn_pub_check (sending, data, 0, 1);
+        return;
+    }
+    nn_msg_cp (&copy, sending->msg);
+    nn_pub_check (sending, data, 0,
+        nn_pub_enqueue (sending->pub, data, &copy, nn_pub_topic (sending)));
+}
+
+static int nn_pub_enqueue (struct nn_pub *self, struct nn_pub_data *data,
+    struct nn_msg *msg, size_t topic)
+{
+    size_t count;
+    size_t bytes;
+
+    /*  If the message replaced an older one, the older one is dropped. */
+    count = data->pending.count;
+    bytes = data->pending.bytes + nn_chunkref_size (&msg->body);
+    nn_conflate_put (&data->pending, msg, topic);
+    if (data->pending.count == count) {
+        ++data->dropped;
+        data->droppedbytes += bytes - data->pending.bytes;
+        nn_sockbase_dropped (&self->sockbase, bytes - data->pending.bytes);
+        return 1;
+    }
+    return 0;
+}
+
+static void nn_pub_check (struct nn_pub_sending *sending,
+    struct nn_pub_data *data, int ready, int dropped)
+{
+    struct nn_pub *pub;
+    int evict;
+
+    pub = sending->pub;
+    evict = 0;
+
+    /*  Evict the pipe if it hasn't been accepting messages for too long. */
+    if (ready)
+        data->stalled = 0;
+    else if (pub->evicttimeout) {
+        if (!sending->hasnow) {
+            sending->now = nn_clock_now (&pub->sockbase.clock);
+            sending->hasnow = 1;
+        }
+        if (!data->stalled) {
+            data->stalled = 1;
+            data->since = sending->now;
+        }
+        else if (sending->now - data->since >= (uint64_t) pub->evicttimeout)
+            evict = 1;
+    }
+
+    /*  Evict the pipe if too many of the recent messages were dropped. */
+    if (pub->evictdrops) {
+        ++data->window;
+        data->windowdrops += dropped;
+        if (data->window == NN_PUB_EVICT_WINDOW) {
+            if (data->windowdrops * 100 >=
+                  pub->evictdrops * NN_PUB_EVICT_WINDOW)
+                evict = 1;
+            data->window = 0;
+            data->windowdrops = 0;
+        }
+    }
+
+    if (evict && !nn_list_item_isinlist (&data->evictitem))
+        nn_list_insert (&pub->evicting, &data->evictitem,
+            nn_list_end (&pub->evicting));
+}
+
+static void nn_pub_evict (struct nn_pub *self, struct nn_pub_data *data)
+{
+    int rc;
+
+    nn_sockbase_evicted (&self->sockbase);
+    rc = nn_pipe_close (data->item.pipe);
+    if (rc == 0)
+        return;
+    errnum_assert (rc == -ENOTSUP, -rc);
+
+    /*  The transport can't break the connection. Detach the pipe from all
+        the topics instead, so that it costs nothing from now on. Its
+        subscriptions are ignored. */
+    data->evicted = 1;
+    nn_pub_unsubscribe_all (self, data);
+    if (!data->filtering) {
+        data->filtering = 1;
+        nn_list_erase (&self->unfiltered, &data->unfiltered);
+    }
+    nn_conflate_term (&data->pending);
+    nn_conflate_init (&data->pending);
+}
+
+static size_t nn_pub_topic (struct nn_pub_sending *sending)
+{
+    if (!sending->hastopic) {
+        sending->topic = nn_topics_topic (
+            nn_chunkref_data (&sending->msg->body),
+            nn_chunkref_size (&sending->msg->body), sending->pub->delimiter);
+        sending->hastopic = 1;
+    }
+    return sending->topic;
+}
+
+static void nn_pub_replay (struct nn_pub *self, struct nn_pub_data *data,
+    struct nn_pub_sub *sub)
+{
+    struct nn_pub_replaying replaying;
+
+    /*  The cached messages have no sequence numbers. */
+    if (!self->lvc || data->sequenced)
+        return;
+
+    replaying.pub = self;
+    replaying.data = data;
+    replaying.sub = sub;
+    nn_conflate_walk (&self->cache, nn_pub_replay_msg, &replaying);
+    nn_pub_flush (self, data);
+}
+
+static void nn_pub_replay_msg (struct nn_msg *msg, size_t topic, void *arg)
+{
+    struct nn_pub_replaying *replaying;
+    struct nn_list_item *it;
+    struct nn_pub_sub *sub;
+    struct nn_msg copy;
+
+    replaying = (struct nn_pub_replaying*) arg;
+
+    if (replaying->sub && !nn_pub_sub_matches (replaying->sub, msg))
+        return;
+    for (it = nn_list_begin (&replaying->data->subs);
+          it != nn_list_end (&replaying->data->subs);
+          it = nn_list_next (&replaying->data->subs, it)) {
+        sub = nn_cont (it, struct nn_pub_sub, pipeitem);
+        if (replaying->sub) {
+
+            /*  The subscriber has already got the message because of
+                a subscription it had before. */
+            if (sub != replaying->sub && nn_pub_sub_matches (sub, msg))
+                return;
+        }
+        else if (nn_pub_sub_matches (sub, msg))
+            break;
+    }
+    if (!replaying->sub && it == nn_list_end (&replaying->data->subs))
+        return;
+
+    nn_msg_cp (&copy, msg);
+    nn_pub_enqueue (replaying->pub, replaying->data, &copy, topic);
+}
+
+static int nn_pub_sub_matches (struct nn_pub_sub *sub, struct nn_msg *msg)
+{
+    return nn_chunkref_size (&msg->body) >= sub->topic->size &&
+        memcmp (nn_chunkref_data (&msg->body), sub->topic + 1,
+        sub->topic->size) == 0;
+}
+
+static void nn_pub_flush (struct nn_pub *self, struct nn_pub_data *data)
+{
+    int rc;
+    struct nn_msg msg;
+
+    /*  Send the pending messages for as long as the pipe is writable.
+        The rest of them are sent by nn_pub_out. */
+    while (!nn_conflate_empty (&data->pending) &&
+          nn_dist_select (&self->outpipes, &data->item)) {
+        rc = nn_conflate_get (&data->pending, &msg);
+        errnum_assert (rc == 0, -rc);
+        ++data->sent;
+        data->sentbytes += nn_chunkref_size (&msg.body);
+        self->outdata = data;
+        rc = nn_dist_send_selected (&self->outpipes, &msg);
+        errnum_assert (rc == 0, -rc);
+        if (nn_slow (!self->outdata))
+            return;
+        self->outdata = NULL;
+    }
+}
+
+static void nn_pub_sequence (struct nn_pub *self, struct nn_pub_data *data,
+    uint64_t seq)
+{
+    /*  From now on, the pipe is fed from the journal. The messages that
+        were queued for it the usual way have no sequence numbers. */
+    if (!data->sequenced) {
+        data->sequenced = 1;
+        nn_list_insert (&self->sequenced, &data->seqitem,
+            nn_list_end (&self->sequenced));
+        nn_conflate_term (&data->pending);
+        nn_conflate_init (&data->pending);
+    }
+    nn_journal_seek (self->journal, &data->cursor,
+        seq ? seq : nn_journal_last (self->journal) + 1);
+    nn_pub_pump (self, data);
+}
+
+static void nn_pub_pump (struct nn_pub *self, struct nn_pub_data *data)
+{
+    int rc;
+    struct nn_journal_cursor cursor;
+    uint64_t seq;
+    const uint8_t *body;
+    size_t size;
+    struct nn_msg msg;
+
+    /*  Send the messages from the journal for as long as the pipe is
+        writable. The cursor is advanced only once the message is sent, so
+        that the rest of them are sent by nn_pub_out. */
+    while (1) {
+        cursor = data->cursor;
+        rc = nn_journal_get (self->journal, &cursor, &seq, &body, &size);
+        if (rc == -EAGAIN)
+            return;
+        errnum_assert (rc == 0, -rc);
+        if (!nn_pub_wants (data, body, size)) {
+            data->cursor = cursor;
+            continue;
+        }
+        if (!nn_dist_select (&self->outpipes, &data->item))
+            return;
+        data->cursor = cursor;
+
+        /*  The body is copied straight from the mapping of the journal. */
+        nn_msg_init (&msg, 8 + size);
+        nn_putll (nn_chunkref_data (&msg.body), seq);
+        memcpy (((uint8_t*) nn_chunkref_data (&msg.body)) + 8, body, size);
+        ++data->sent;
+        data->sentbytes += size;
+        self->outdata = data;
+        rc = nn_dist_send_selected (&self->outpipes, &msg);
+        errnum_assert (rc == 0, -rc);
+        if (nn_slow (!self->outdata))
+            return;
+        self->outdata = NULL;
+    }
+}
+
+static int nn_pub_wants (struct nn_pub_data *data, const uint8_t *body,
+    size_t size)
+{
+    struct nn_list_item *it;
+    struct nn_pub_sub *sub;
+
+    if (!data->filtering)
+        return 1;
+    for (it = nn_list_begin (&data->subs); it != nn_list_end (&data->subs);
+          it = nn_list_next (&data->subs, it)) {
+        sub = nn_cont (it, struct nn_pub_sub, pipeitem);
+        if (size >= sub->topic->size &&
+              memcmp (body, sub->topic + 1, sub->topic->size) == 0)
+            return 1;
+    }
+    return 0;
+}
+
+static void nn_pub_subscriptions (struct nn_pub *self,
+    struct nn_pub_data *data, struct nn_msg *msg)
+{
+    uint8_t *pos;
+    size_t size;
+    size_t sz;
+    int replay;
+    struct nn_pub_sub *sub;
+
+    /*  Malformed commands and the commands we don't understand are ignored.
+        The subscriber filters the messages itself, so the worst that can
+        happen is that some unneeded messages are sent to it. */
+    nn_msg_flatten (msg);
+    pos = nn_chunkref_data (&msg->body);
+    size = nn_chunkref_size (&msg->body);
+    if (nn_slow (!size || data->evicted))
+        return;
+
+    /*  A subscriber that sends its subscriptions for the first time gets
+        all the cached messages it is subscribed to. Later on, it gets those
+        matching the subscriptions it adds. */
+    replay = !data->filtering;
+    sub = NULL;
+
+    switch (*pos) {
+    case NN_SUB_CMD_RESET:
+        nn_pub_unsubscribe_all (self, data);
+        ++pos;
+        --size;
+        while (size >= 4) {
+            sz = nn_getl (pos);
+            if (nn_slow (sz > size - 4))
+                break;
+            nn_pub_subscribe (self, data, pos + 4, sz);
+            pos += 4 + sz;
+            size -= 4 + sz;
+        }
+
+        /*  If the command was truncated, we don't know the full set of
+            subscriptions. Send everything to be on the safe side. */
+        if (nn_slow (size)) {
+            if (data->filtering) {
+                data->filtering = 0;
+                nn_list_insert (&self->unfiltered, &data->unfiltered,
+                    nn_list_end (&self->unfiltered));
+            }
+            return;
+        }
+        break;
+    case NN_SUB_CMD_SUBSCRIBE:
+        sub = nn_pub_subscribe (self, data, pos + 1, size - 1);
+        break;
+    case NN_SUB_CMD_UNSUBSCRIBE:
+        nn_pub_unsubscribe (self, data, pos + 1, size - 1);
+        break;
+    case NN_SUB_CMD_REPLAY:
+
+        /*  Without the journal, the subscriber gets the messages the usual
+            way. It doesn't change the subscriptions. */
+        if (self->journal && size == 9)
+            nn_pub_sequence (self, data, nn_getll (pos + 1));
+        return;
+    default:
+        return;
+    }
+
+    /*  From now on, the pipe gets only the messages it's subscribed to. */
+    if (!data->filtering) {
+        data->filtering = 1;
+        nn_list_erase (&self->unfiltered, &data->unfiltered);
+    }
+
+    if (replay)
+        nn_pub_replay (self, data, NULL);
+    else if (sub)
+        nn_pub_replay (self, data, sub);
+}
+
+static struct nn_pub_sub *nn_pub_subscribe (struct nn_pub *self,
+    struct nn_pub_data *data, const uint8_t *topic, size_t size)
+{
+    int rc;
+    void **slot;
+    struct nn_pub_topic *t;
+    struct nn_list_item *it;
+    struct nn_pub_sub *sub;
+
+    rc = nn_trie_subscribe (&self->trie, topic, size);
+    errnum_assert (rc >= 0, -rc);
+    slot = nn_trie_data (&self->trie, topic, size);
+    nn_assert (slot);
+
+    /*  First subscriber to the topic. */
+    if (rc == 1) {
+        t = nn_alloc (sizeof (struct nn_pub_topic) + size, "topic (pub)");
+        alloc_assert (t);
+        nn_list_init (&t->subs);
+        t->size = size;
+        memcpy (t + 1, topic, size);
+        *slot = t;
+    }
+    else {
+        t = (struct nn_pub_topic*) *slot;
+
+        /*  The pipe is already subscribed to the topic. */
+        for (it = nn_list_begin (&t->subs); it != nn_list_end (&t->subs);
+              it = nn_list_next (&t->subs, it)) {
+            if (nn_cont (it, struct nn_pub_sub, topicitem)->data == data) {
+                rc = nn_trie_unsubscribe (&self->trie, topic, size);
+                errnum_assert (rc == 0, -rc);
+                return NULL;
+            }
+        }
+    }
+
+    sub = nn_alloc (sizeof (struct nn_pub_sub), "subscription (pub)");
+    alloc_assert (sub);
+    sub->data = data;
+    sub->topic = t;
+    nn_list_item_init (&sub->topicitem);
+    nn_list_insert (&t->subs, &sub->topicitem, nn_list_end (&t->subs));
+    nn_list_item_init (&sub->pipeitem);
+    nn_list_insert (&data->subs, &sub->pipeitem, nn_list_end (&data->subs));
+
+    return sub;
+}
+
+static void nn_pub_unsubscribe (struct nn_pub *self, struct nn_pub_data *data,
+    const uint8_t *topic, size_t size)
+{
+    void **slot;
+    struct nn_pub_topic *t;
+    struct nn_list_item *it;
+    struct nn_pub_sub *sub;
+
+    slot = nn_trie_data (&self->trie, topic, size);
+    if (!slot)
+        return;
+    t = (struct nn_pub_topic*) *slot;
+    for (it = nn_list_begin (&t->subs); it != nn_list_end (&t->subs);
+          it = nn_list_next (&t->subs, it)) {
+        sub = nn_cont (it, struct nn_pub_sub, topicitem);
+        if (sub->data == data) {
+            nn_pub_rmsub (self, sub);
+            return;
+        }
+    }
+}
+
+static void nn_pub_unsubscribe_all (struct nn_pub *self,
+    struct nn_pub_data *data)
+{
+    struct nn_list_item *it;
+
+    while (1) {
+        it = nn_list_begin (&data->subs);
+        if (it == nn_list_end (&data->subs))
+            break;
+        nn_pub_rmsub (self, nn_cont (it, struct nn_pub_sub, pipeitem));
+    }
+}
+
+static void nn_pub_rmsub (struct nn_pub *self, struct nn_pub_sub *sub)
+{
+    int rc;
+    struct nn_pub_topic *t;
+
+    t = sub->topic;
+    nn_list_erase (&t->subs, &sub->topicitem);
+    nn_list_item_term (&sub->topicitem);
+    nn_list_erase (&sub->data->subs, &sub->pipeitem);
+    nn_list_item_term (&sub->pipeitem);
+    nn_free (sub);
+
+    /*  If this was the last subscriber to the topic, the topic has to be
+        detached from the trie before the subscription is removed. */
+    if (nn_list_empty (&t->subs)) {
+        *nn_trie_data (&self->trie, (uint8_t*) (t + 1), t->size) = NULL;
+        rc = nn_trie_unsubscribe (&self->trie, (uint8_t*) (t + 1), t->size);
+        errnum_assert (rc == 1, -rc);
+        nn_list_term (&t->subs);
+        nn_free (t);
+        return;
+    }
+
+    rc = nn_trie_unsubscribe (&self->trie, (uint8_t*) (t + 1), t->size);
+    errnum_assert (rc == 0, -rc);
 }
 
 static int nn_pub_setopt (struct nn_sockbase *self, int level, int option,
         const void *optval, size_t optvallen)
 {
-    return -ENOPROTOOPT;
+    struct nn_pub *pub;
+    int val;
+
+    pub = nn_cont (self, struct nn_pub, sockbase);
+
+    if (level != NN_PUB)
+        return -ENOPROTOOPT;
+    if (option == NN_PUB_JOURNAL)
+        return nn_pub_setjournal (pub, optval, optvallen);
+    if (optvallen != sizeof (int))
+        return -EINVAL;
+    val = *(int*) optval;
+
+    switch (option) {
+    case NN_PUB_CONFLATE:
+        pub->conflate = val ? 1 : 0;
+        return 0;
+    case NN_PUB_TOPIC_DELIMITER:
+        if (val < -1 || val > 255)
+            return -EINVAL;
+        pub->delimiter = val;
+        return 0;
+    case NN_PUB_LAST_VALUE_CACHE:
+
+        /*  Switching the cache off drops the cached messages. */
+        if (!val) {
+            nn_conflate_term (&pub->cache);
+            nn_conflate_init (&pub->cache);
+        }
+        pub->lvc = val ? 1 : 0;
+        return 0;
+    case NN_PUB_JOURNAL_SIZE:
+        if (val < NN_JOURNAL_MINSIZE)
+            return -EINVAL;
+        pub->journalsize = val;
+        return 0;
+    case NN_PUB_EVICT_TIMEOUT:
+        if (val < 0)
+            return -EINVAL;
+        pub->evicttimeout = val;
+        return 0;
+    case NN_PUB_EVICT_DROPS:
+        if (val < 0 || val > 100)
+            return -EINVAL;
+        pub->evictdrops = val;
+        return 0;
+    default:
+        return -ENOPROTOOPT;
+    }
 }
 
 static int nn_pub_getopt (struct nn_sockbase *self, int level, int option,
         void *optval, size_t *optvallen)
 {
-    return -ENOPROTOOPT;
+    struct nn_pub *pub;
+    size_t sz;
+
+    pub = nn_cont (self, struct nn_pub, sockbase);
+
+    if (level != NN_PUB)
+        return -ENOPROTOOPT;
+    if (option == NN_PUB_PIPE_STATS)
+        return nn_pub_stats (pub, optval, optvallen);
+    if (option == NN_PUB_JOURNAL) {
+        sz = pub->journal ? strlen (pub->journal->path) : 0;
+        if (sz)
+            memcpy (optval, pub->journal->path, *optvallen < sz ?
+                *optvallen : sz);
+        *optvallen = sz;
+        return 0;
+    }
+    if (*optvallen < sizeof (int))
+        return -EINVAL;
+
+    switch (option) {
+    case NN_PUB_CONFLATE:
+        *(int*) optval = pub->conflate;
+        break;
+    case NN_PUB_TOPIC_DELIMITER:
+        *(int*) optval = pub->delimiter;
+        break;
+    case NN_PUB_LAST_VALUE_CACHE:
+        *(int*) optval = pub->lvc;
+        break;
+    case NN_PUB_JOURNAL_SIZE:
+        *(int*) optval = pub->journalsize;
+        break;
+    case NN_PUB_EVICT_TIMEOUT:
+        *(int*) optval = pub->evicttimeout;
+        break;
+    case NN_PUB_EVICT_DROPS:
+        *(int*) optval = pub->evictdrops;
+        break;
+    default:
+        return -ENOPROTOOPT;
+    }
+    *optvallen = sizeof (int);
+    return 0;
+}
+
+static int nn_pub_setjournal (struct nn_pub *self, const void *path,
+    size_t pathlen)
+{
+    int rc;
+    struct nn_journal *journal;
+
+    /*  The journal can't be switched while there are subscribers fed from
+        it. An empty string switches it off. */
+    if (nn_slow (!nn_list_empty (&self->sequenced)))
+        return -EBUSY;
+    journal = NULL;
+    if (pathlen) {
+        journal = nn_alloc (sizeof (struct nn_journal), "journal");
+        alloc_assert (journal);
+        rc = nn_journal_init (journal, path, pathlen, self->journalsize);
+        if (nn_slow (rc < 0)) {
+            nn_free (journal);
+            return rc;
+        }
+
+        /*  The numbering continues where the previous publisher using
+            the journal left off, so that its subscribers can catch up. */
+        if (nn_journal_last (journal) > self->seq)
+            self->seq = nn_journal_last (journal);
+    }
+    if (self->journal) {
+        nn_journal_term (self->journal);
+        nn_free (self->journal);
+    }
+    self->journal = journal;
+    return 0;
+}
+
+static int nn_pub_stats (struct nn_pub *self, void *optval,
+    size_t *optvallen)
+{
+    size_t count;
+    size_t max;
+    struct nn_list_item *it;
+    struct nn_pub_data *data;
+    struct nn_pub_pipe_stats *stats;
+
+    /*  Fill in as many entries as fit into the buffer. The size needed for
+        all of them is returned. */
+    count = 0;
+    max = *optvallen / sizeof (struct nn_pub_pipe_stats);
+    stats = (struct nn_pub_pipe_stats*) optval;
+    for (it = nn_list_begin (&self->pipes); it != nn_list_end (&self->pipes);
+          it = nn_list_next (&self->pipes, it)) {
+        if (count < max) {
+            data = nn_cont (it, struct nn_pub_data, pipesitem);
+            stats [count].eid = data->eid;
+            stats [count].sent = data->sent;
+            stats [count].sentbytes = data->sentbytes;
+            stats [count].dropped = data->dropped;
+            stats [count].droppedbytes = data->droppedbytes;
+            stats [count].queued = data->pending.count;
+            stats [count].queuedbytes = data->pending.bytes;
+        }
+        ++count;
+    }
+    *optvallen = count * sizeof (struct nn_pub_pipe_stats);
+    return 0;
 }
 
 static int nn_pub_create (struct nn_sockbase **sockbase)
@@ -203,8 +1198,7 @@ static int nn_pub_create (struct nn_sockbase **sockbase)
 static struct nn_socktype nn_pub_socktype_struct = {
     AF_SP,
     NN_PUB,
-    nn_pub_create,
-    NN_LIST_ITEM_INITIALIZER
+    nn_pub_create
 };
 
 struct nn_socktype *nn_pub_socktype = &nn_pub_socktype_struct;
@@ -22,27 +22,147 @@
 
 #include "sub.h"
 #include "trie.h"
+#include "topics.h"
+#include "patterns.h"
+#include "conflate.h"
 
 #include "../../nn.h"
 #include "../../pubsub.h"
 
+#include "../../aio/aio.h"
+
 #include "../../utils/err.h"
 #include "../../utils/cont.h"
 #include "../../utils/fast.h"
 #include "../../utils/alloc.h"
 #include "../../utils/excl.h"
 #include "../../utils/list.h"
+#include "../../utils/wire.h"
+#include "../../utils/mutex.h"
+#include "../../utils/queue.h"
+
+#include <string.h>
+
+/*  Maximum number of messages queued in the shards, see below. */
+#define NN_SUB_SHARD_QUEUE 1024
+
+struct nn_sub_queued {
+    struct nn_queue_item item;
+    struct nn_msg msg;
+};
+
+/*  Messages waiting to be received via the socket or a context. */
+struct nn_sub_shard {
+    struct nn_queue msgs;
+};
 
 struct nn_sub {
     struct nn_sockbase sockbase;
     struct nn_excl excl;
-    struct nn_trie trie;
+
+    /*  Prefix subscriptions. There are two identical copies of the trie.
+        Messages are matched against 'trie' with the socket locked, while
+        a change is applied to 'standby' with the socket unlocked. Then
+        the two are swapped and the change is applied to the other copy as
+        well. That way the receiving thread never waits for the trie to be
+        modified, only for the swap. 'wlock' serialises the changes. */
+    struct nn_trie *trie;
+    struct nn_trie *standby;
+    struct nn_trie tries [2];
+    struct nn_mutex wlock;
+
+    /*  Wildcard subscriptions, see NN_SUB_PATTERN_SUBSCRIBE. The patterns
+        are compiled into 'dfa' with the socket unlocked, the same way as
+        the trie is modified, and the data path matches against 'dfa'
+        only. 'patterns' is accessed with 'wlock' held. The publisher is
+        sent the literal prefixes of the patterns, kept in 'prefixes'.
+        'separator' is the separator as seen by NN_SUB_PATTERN_SEPARATOR. */
+    struct nn_patterns patterns;
+    struct nn_patterns_dfa *dfa;
+    struct nn_topics prefixes;
+    int separator;
+
+    /*  Sharding, see nn_ctx_open. The socket itself is shard 0 and each
+        context open on the socket is a shard of its own. Once there's more
+        than one shard, the messages are read from the pipe as soon as they
+        arrive and, if they match, put into the queue of the shard selected
+        by the hash of their topic. If no topic delimiter is set, the part of
+        the message matched by the subscription is hashed instead. At most
+        NN_SUB_SHARD_QUEUE messages are queued in all the shards together,
+        the rest are left in the pipe. */
+    struct nn_sub_shard shard;
+    struct nn_sub_shard **shards;
+    int nshards;
+    size_t queued;
+
+    /*  Subscriptions that match the topic of the message exactly. The topic
+        is the part of the message preceding the first occurrence of
+        'delimiter', or the whole message if there's no delimiter (-1) or
+        it doesn't occur in the message. */
+    struct nn_topics topics;
+    int delimiter;
+
+    /*  In conflating mode all the messages available are read from the pipe
+        on each receive and only the latest message for each topic is kept
+        here. See NN_SUB_CONFLATE. */
+    int conflate;
+    struct nn_conflate pending;
+
+    /*  If set, the full set of subscriptions has to be sent to the publisher
+        as soon as the pipe becomes writable. This happens when the pipe is
+        new or when some change couldn't be forwarded straight away. */
+    int resync;
+
+    /*  If set, the publisher is asked to prefix the messages by their
+        sequence numbers and to replay those following 'seq', the sequence
+        number of the last message received. See NN_SUB_REPLAY. The request
+        is sent once per pipe, 'rewind' is set until it is. */
+    int replay;
+    uint64_t seq;
+    int rewind;
+};
+
+/*  Used to build the RESET command by walking the trie. */
+struct nn_sub_reset {
+    struct nn_sub *sub;
+    size_t size;
+    uint8_t *pos;
 };
 
 /*  Private functions. */
 static int nn_sub_init (struct nn_sub *self,
     const struct nn_sockbase_vfptr *vfptr);
 static void nn_sub_term (struct nn_sub *self);
+static int nn_sub_subscribed (struct nn_sub *self, const void *data,
+    size_t size);
+static int nn_sub_change (struct nn_trie *trie, int option,
+    const void *optval, size_t optvallen);
+static int nn_sub_bulk (struct nn_trie *trie, const uint8_t *data,
+    size_t size);
+static int nn_sub_pattern (struct nn_sub *self, int option,
+    const void *optval, size_t optvallen);
+static int nn_sub_forwarded (struct nn_sub *self, const void *data,
+    size_t size);
+static int nn_sub_match (struct nn_sub *self, struct nn_msg *msg,
+    size_t *key);
+static void nn_sub_distribute (struct nn_sub *self);
+static int nn_sub_pop (struct nn_sub *self, struct nn_sub_shard *shard,
+    struct nn_msg *msg);
+static void nn_sub_drain (struct nn_sub *self, struct nn_sub_shard *shard);
+static int nn_sub_unseq (struct nn_sub *self, struct nn_msg *msg);
+static void nn_sub_forward (struct nn_sub *self, int cmd,
+    const void *data, size_t size);
+static void nn_sub_flush (struct nn_sub *self);
+static void nn_sub_reset_size (const uint8_t *data, size_t size, void *arg);
+static void nn_sub_reset_fill (const uint8_t *data, size_t size, void *arg);
+static void nn_sub_reset_size_exact (const uint8_t *data, size_t size,
+    void *arg);
+static void nn_sub_reset_fill_exact (const uint8_t *data, size_t size,
+    void *arg);
+static void nn_sub_reset_size_prefix (const uint8_t *data, size_t size,
+    void *arg);
+static void nn_sub_reset_fill_prefix (const uint8_t *data, size_t size,
+    void *arg);
 
 /*  Implementation of nn_sockbase's virtual functions. */
 static int nn_sub_ispeer (int socktype);
@@ -53,10 +173,30 @@ static void nn_sub_in (struct nn_sockbase *self, struct nn_pipe *pipe);
 static void nn_sub_out (struct nn_sockbase *self, struct nn_pipe *pipe);
 static int nn_sub_events (struct nn_sockbase *self);
 static int nn_sub_recv (struct nn_sockbase *self, struct nn_msg *msg);
+static int nn_sub_unseq (struct nn_sub *self, struct nn_msg *msg)
+{
+    /*  Strips the sequence number off the message. Messages too short to
+        have one are dropped. */
+    if (!self->replay)
+        return 1;
+    if (nn_slow (nn_chunkref_size (&msg->body) < 8))
+        return 0;
+    self->seq = nn_getll (nn_chunkref_data (&msg->body));
+    nn_chunkref_trim (&msg->body, 8);
+    return 1;
+}
+
 static int nn_sub_setopt (struct nn_sockbase *self, int level, int option,
     const void *optval, size_t optvallen);
 static int nn_sub_getopt (struct nn_sockbase *self, int level, int option,
     void *optval, size_t *optvallen);
+static int nn_sub_setoptunlocked (struct nn_sockbase *self, int level,
+    int option, const void *optval, size_t optvallen);
+static int nn_sub_ctxopen (struct nn_sockbase *self, void **ctx);
+static void nn_sub_ctxclose (struct nn_sockbase *self, void *ctx);
+static int nn_sub_ctxrecv (struct nn_sockbase *self, void *ctx,
+    struct nn_msg *msg);
+static int nn_sub_ctxevents (struct nn_sockbase *self, void *ctx);
 static const struct nn_sockbase_vfptr nn_sub_sockbase_vfptr = {
     NN_SOCKBASE_FLAG_NOSEND,
     nn_sub_ispeer,
@@ -69,7 +209,13 @@ static const struct nn_sockbase_vfptr nn_sub_sockbase_vfptr = {
     NULL,
     nn_sub_recv,
     nn_sub_setopt,
-    nn_sub_getopt
+    nn_sub_getopt,
+    nn_sub_ctxopen,
+    nn_sub_ctxclose,
+    NULL,
+    nn_sub_ctxrecv,
+    nn_sub_setoptunlocked,
+    nn_sub_ctxevents
 };
 
 static int nn_sub_ispeer (int socktype)
@@ -87,14 +233,45 @@ static int nn_sub_init (struct nn_sub *self,
         return rc;
 
     nn_excl_init (&self->excl);
-    nn_trie_init (&self->trie);
+    nn_trie_init (&self->tries [0]);
+    nn_trie_init (&self->tries [1]);
+    self->trie = &self->tries [0];
+    self->standby = &self->tries [1];
+    nn_mutex_init (&self->wlock);
+    nn_patterns_init (&self->patterns, '.');
+    self->dfa = NULL;
+    nn_topics_init (&self->prefixes);
+    self->separator = '.';
+    nn_queue_init (&self->shard.msgs);
+    self->shards = NULL;
+    self->nshards = 1;
+    self->queued = 0;
+    nn_topics_init (&self->topics);
+    self->delimiter = -1;
+    self->conflate = 0;
+    nn_conflate_init (&self->pending);
+    self->resync = 0;
+    self->replay = 0;
+    self->seq = 0;
+    self->rewind = 0;
 
     return 0;
 }
 
 static void nn_sub_term (struct nn_sub *self)
 {
-    nn_trie_term (&self->trie);
+    nn_conflate_term (&self->pending);
+    nn_topics_term (&self->topics);
+    nn_sub_drain (self, &self->shard);
+    nn_queue_term (&self->shard.msgs);
+    if (self->shards)
+        nn_free (self->shards);
+    nn_topics_term (&self->prefixes);
+    nn_patterns_free (self->dfa);
+    nn_patterns_term (&self->patterns);
+    nn_mutex_term (&self->wlock);
+    nn_trie_term (&self->tries [1]);
+    nn_trie_term (&self->tries [0]);
     nn_excl_term (&self->excl);
     nn_sockbase_term (&self->sockbase);
 }
@@ -111,7 +288,20 @@ void nn_sub_destroy (struct nn_sockbase *self)
 
 static int nn_sub_add (struct nn_sockbase *self, struct nn_pipe *pipe)
 {
-    return nn_excl_add (&nn_cont (self, struct nn_sub, sockbase)->excl, pipe);
+    int rc;
+    struct nn_sub *sub;
+
+    sub = nn_cont (self, struct nn_sub, sockbase);
+
+    rc = nn_excl_add (&sub->excl, pipe);
+    if (rc < 0)
+        return rc;
+
+    /*  The new publisher has to learn about all our subscriptions. */
+    sub->resync = 1;
+    sub->rewind = 1;
+
+    return 0;
 }
 
 static void nn_sub_rm (struct nn_sockbase *self, struct nn_pipe *pipe)
@@ -121,27 +311,76 @@ static void nn_sub_rm (struct nn_sockbase *self, struct nn_pipe *pipe)
 
 static void nn_sub_in (struct nn_sockbase *self, struct nn_pipe *pipe)
 {
-    nn_excl_in (&nn_cont (self, struct nn_sub, sockbase)->excl, pipe);
+    struct nn_sub *sub;
+
+    sub = nn_cont (self, struct nn_sub, sockbase);
+
+    nn_excl_in (&sub->excl, pipe);
+    nn_sub_distribute (sub);
 }
 
 static void nn_sub_out (struct nn_sockbase *self, struct nn_pipe *pipe)
 {
-    nn_excl_out (&nn_cont (self, struct nn_sub, sockbase)->excl, pipe);
+    struct nn_sub *sub;
+
+    sub = nn_cont (self, struct nn_sub, sockbase);
+
+    nn_excl_out (&sub->excl, pipe);
+    nn_sub_flush (sub);
 }
 
 static int nn_sub_events (struct nn_sockbase *self)
 {
-    return nn_excl_can_recv (&nn_cont (self, struct nn_sub, sockbase)->excl) ?
-        NN_SOCKBASE_EVENT_IN : 0;
+    struct nn_sub *sub;
+
+    sub = nn_cont (self, struct nn_sub, sockbase);
+
+    if (sub->nshards > 1)
+        return nn_sub_ctxevents (self, &sub->shard);
+    return nn_excl_can_recv (&sub->excl) ||
+        !nn_conflate_empty (&sub->pending) ||
+        !nn_queue_empty (&sub->shard.msgs) ? NN_SOCKBASE_EVENT_IN : 0;
 }
 
 static int nn_sub_recv (struct nn_sockbase *self, struct nn_msg *msg)
 {
     int rc;
     struct nn_sub *sub;
+    size_t key;
 
     sub = nn_cont (self, struct nn_sub, sockbase);
 
+    /*  When sharded, the socket gets only the messages of shard 0. Once it's
+        not, the messages left in shard 0 go first. */
+    rc = nn_sub_pop (sub, &sub->shard, msg);
+    if (rc == 0 || sub->nshards > 1)
+        return rc;
+
+    /*  In conflating mode, read everything there is and keep only the latest
+        message for each topic. */
+    if (sub->conflate) {
+        while (1) {
+            rc = nn_excl_recv (&sub->excl, msg);
+            if (rc == -EAGAIN)
+                break;
+            errnum_assert (rc >= 0, -rc);
+            nn_msg_flatten (msg);
+            if (!nn_sub_unseq (sub, msg) || !nn_sub_match (sub, msg, &key)) {
+                nn_msg_term (msg);
+                continue;
+            }
+            nn_conflate_put (&sub->pending, msg, nn_topics_topic (
+                nn_chunkref_data (&msg->body), nn_chunkref_size (&msg->body),
+                sub->delimiter));
+        }
+    }
+
+    /*  Messages conflated so far go first. There may be some left even if
+        the conflating mode was switched off in the meantime. */
+    rc = nn_conflate_get (&sub->pending, msg);
+    if (rc == 0)
+        return 0;
+
     /*  Loop while a matching message is found or when there are no more
         messages to receive. */
     while (1) {
@@ -149,14 +388,173 @@ static int nn_sub_recv (struct nn_sockbase *self, struct nn_msg *msg)
         if (nn_slow (rc == -EAGAIN))
             return -EAGAIN;
         errnum_assert (rc >= 0, -rc);
-        rc = nn_trie_match (&sub->trie, nn_chunkref_data (&msg->body),
-            nn_chunkref_size (&msg->body));
-        if (rc == 0)
-            continue;
-        if (rc == 1)
+        nn_msg_flatten (msg);
+        if (nn_sub_unseq (sub, msg) && nn_sub_match (sub, msg, &key))
             return 0;
-        errnum_assert (0, -rc);
+        nn_msg_term (msg);
+    }
+}
+
+static int nn_sub_match (struct nn_sub *self, struct nn_msg *msg,
+    size_t *key)
+{
+    int rc;
+    uint8_t *data;
+    size_t size;
+    size_t topic;
+
+    /*  Returns 1 if the message matches some subscription. The length of
+        the key the message is sharded by is stored in 'key'. */
+
+    data = nn_chunkref_data (&msg->body);
+    size = nn_chunkref_size (&msg->body);
+    topic = nn_topics_topic (data, size, self->delimiter);
+
+    /*  Exact subscriptions are checked first. It's a single hash lookup
+        irrespective of the number of subscriptions. */
+    if (self->topics.items && nn_topics_match (&self->topics, data, topic)) {
+        *key = topic;
+        return 1;
     }
+
+    rc = nn_trie_match_len (self->trie, data, size, key);
+    errnum_assert (rc >= 0, -rc);
+    if (!rc && self->dfa)
+        rc = nn_patterns_match (self->dfa, data, size, key);
+    if (rc && self->delimiter >= 0)
+        *key = topic;
+    return rc;
+}
+
+static void nn_sub_distribute (struct nn_sub *self)
+{
+    int rc;
+    struct nn_msg msg;
+    size_t key;
+    struct nn_sub_shard *shard;
+    struct nn_sub_queued *queued;
+
+    if (self->nshards < 2)
+        return;
+
+    while (self->queued < NN_SUB_SHARD_QUEUE) {
+        rc = nn_excl_recv (&self->excl, &msg);
+        if (rc == -EAGAIN)
+            return;
+        errnum_assert (rc >= 0, -rc);
+        nn_msg_flatten (&msg);
+        if (!nn_sub_unseq (self, &msg) || !nn_sub_match (self, &msg, &key)) {
+            nn_msg_term (&msg);
+            continue;
+        }
+        shard = self->shards [nn_topics_hash (nn_chunkref_data (&msg.body),
+            key) % (uint32_t) self->nshards];
+        queued = nn_alloc (sizeof (struct nn_sub_queued), "queued message");
+        alloc_assert (queued);
+        nn_queue_item_init (&queued->item);
+        nn_msg_mv (&queued->msg, &msg);
+        nn_queue_push (&shard->msgs, &queued->item);
+        ++self->queued;
+    }
+}
+
+static int nn_sub_pop (struct nn_sub *self, struct nn_sub_shard *shard,
+    struct nn_msg *msg)
+{
+    struct nn_queue_item *item;
+    struct nn_sub_queued *queued;
+
+    item = nn_queue_pop (&shard->msgs);
+    if (!item)
+        return -EAGAIN;
+    queued = nn_cont (item, struct nn_sub_queued, item);
+    nn_msg_mv (msg, &queued->msg);
+    nn_queue_item_term (&queued->item);
+    nn_free (queued);
+    --self->queued;
+
+    /*  Make room for the messages waiting in the pipe. */
+    nn_sub_distribute (self);
+
+    return 0;
+}
+
+static void nn_sub_drain (struct nn_sub *self, struct nn_sub_shard *shard)
+{
+    struct nn_queue_item *item;
+    struct nn_sub_queued *queued;
+
+    while ((item = nn_queue_pop (&shard->msgs)) != NULL) {
+        queued = nn_cont (item, struct nn_sub_queued, item);
+        nn_msg_term (&queued->msg);
+        nn_queue_item_term (&queued->item);
+        nn_free (queued);
+        --self->queued;
+    }
+}
+
+static int nn_sub_ctxopen (struct nn_sockbase *self, void **ctx)
+{
+    struct nn_sub *sub;
+    struct nn_sub_shard *shard;
+    struct nn_sub_shard **shards;
+
+    sub = nn_cont (self, struct nn_sub, sockbase);
+
+    /*  Conflation keeps the latest message of each topic for the socket,
+        there's nothing to spread among the shards. */
+    if (nn_slow (sub->conflate))
+        return -ENOTSUP;
+
+    shards = nn_realloc (sub->shards,
+        (sub->nshards + 1) * sizeof (struct nn_sub_shard*));
+    if (nn_slow (!shards))
+        return -ENOMEM;
+    sub->shards = shards;
+    sub->shards [0] = &sub->shard;
+    shard = nn_alloc (sizeof (struct nn_sub_shard), "context (sub)");
+    alloc_assert (shard);
+    nn_queue_init (&shard->msgs);
+    sub->shards [sub->nshards++] = shard;
+    nn_sub_distribute (sub);
+    *ctx = shard;
+
+    return 0;
+}
+
+static void nn_sub_ctxclose (struct nn_sockbase *self, void *ctx)
+{
+    struct nn_sub *sub;
+    struct nn_sub_shard *shard;
+    int i;
+
+    sub = nn_cont (self, struct nn_sub, sockbase);
+    shard = (struct nn_sub_shard*) ctx;
+
+    /*  The messages queued in the shard are dropped. Topics of the following
+        shards get remapped. */
+    for (i = 1; sub->shards [i] != shard; ++i)
+        nn_assert (i + 1 < sub->nshards);
+    memmove (&sub->shards [i], &sub->shards [i + 1],
+        (sub->nshards - i - 1) * sizeof (struct nn_sub_shard*));
+    --sub->nshards;
+    nn_sub_drain (sub, shard);
+    nn_queue_term (&shard->msgs);
+    nn_free (shard);
+    nn_sub_distribute (sub);
+}
+
+static int nn_sub_ctxrecv (struct nn_sockbase *self, void *ctx,
+    struct nn_msg *msg)
+{
+    return nn_sub_pop (nn_cont (self, struct nn_sub, sockbase),
+        (struct nn_sub_shard*) ctx, msg);
+}
+
+static int nn_sub_ctxevents (struct nn_sockbase *self, void *ctx)
+{
+    return nn_queue_empty (&((struct nn_sub_shard*) ctx)->msgs) ?
+        0 : NN_SOCKBASE_EVENT_IN;
 }
 
 static int nn_sub_setopt (struct nn_sockbase *self, int level, int option,
@@ -164,24 +562,67 @@ static int nn_sub_setopt (struct nn_sockbase *self, int level, int option,
 {
     int rc;
     struct nn_sub *sub;
+    int val;
 
     sub = nn_cont (self, struct nn_sub, sockbase);
 
     if (level != NN_SUB)
         return -ENOPROTOOPT;
 
-    if (option == NN_SUB_SUBSCRIBE) {
-        rc = nn_trie_subscribe (&sub->trie, optval, optvallen);
-        if (rc >= 0)
-            return 0;
-        return rc;
+    /*  Prefix subscriptions are handled by nn_sub_setoptunlocked. */
+    if (option == NN_SUB_EXACT_SUBSCRIBE) {
+        rc = nn_topics_subscribe (&sub->topics, optval, optvallen);
+        if (rc == 1 && !nn_sub_subscribed (sub, optval, optvallen) &&
+              !nn_topics_match (&sub->prefixes, optval, optvallen))
+            nn_sub_forward (sub, NN_SUB_CMD_SUBSCRIBE, optval, optvallen);
+        return 0;
     }
 
-    if (option == NN_SUB_UNSUBSCRIBE) {
-        rc = nn_trie_unsubscribe (&sub->trie, optval, optvallen);
-        if (rc >= 0)
-            return 0;
-        return rc;
+    if (option == NN_SUB_EXACT_UNSUBSCRIBE) {
+        rc = nn_topics_unsubscribe (&sub->topics, optval, optvallen);
+        if (rc < 0)
+            return rc;
+        if (rc == 1 && !nn_sub_subscribed (sub, optval, optvallen) &&
+              !nn_topics_match (&sub->prefixes, optval, optvallen))
+            nn_sub_forward (sub, NN_SUB_CMD_UNSUBSCRIBE, optval, optvallen);
+        return 0;
+    }
+
+    if (option == NN_SUB_TOPIC_DELIMITER) {
+        if (optvallen != sizeof (int))
+            return -EINVAL;
+        val = *(int*) optval;
+        if (val < -1 || val > 255)
+            return -EINVAL;
+        sub->delimiter = val;
+        return 0;
+    }
+
+    if (option == NN_SUB_CONFLATE) {
+        if (optvallen != sizeof (int))
+            return -EINVAL;
+        if (nn_slow (*(int*) optval && sub->nshards > 1))
+            return -EINVAL;
+        sub->conflate = *(int*) optval ? 1 : 0;
+        return 0;
+    }
+
+    /*  The publisher starts prefixing the messages only when it gets
+        the REPLAY command, so the mode can't be changed while connected. */
+    if (option == NN_SUB_REPLAY) {
+        if (optvallen != sizeof (int))
+            return -EINVAL;
+        if (nn_slow (sub->excl.pipe != NULL))
+            return -EISCONN;
+        sub->replay = *(int*) optval ? 1 : 0;
+        return 0;
+    }
+
+    if (option == NN_SUB_SEQ) {
+        if (optvallen != sizeof (uint64_t))
+            return -EINVAL;
+        sub->seq = *(uint64_t*) optval;
+        return 0;
     }
 
     return -ENOPROTOOPT;
@@ -190,9 +631,386 @@ static int nn_sub_setopt (struct nn_sockbase *self, int level, int option,
 static int nn_sub_getopt (struct nn_sockbase *self, int level, int option,
         void *optval, size_t *optvallen)
 {
+    struct nn_sub *sub;
+    size_t nodes;
+    size_t bytes;
+
+    sub = nn_cont (self, struct nn_sub, sockbase);
+
+    if (level != NN_SUB)
+        return -ENOPROTOOPT;
+
+    if (option == NN_SUB_TOPIC_DELIMITER || option == NN_SUB_CONFLATE) {
+        if (*optvallen < sizeof (int))
+            return -EINVAL;
+        *(int*) optval = option == NN_SUB_TOPIC_DELIMITER ?
+            sub->delimiter : sub->conflate;
+        *optvallen = sizeof (int);
+        return 0;
+    }
+
+    if (option == NN_SUB_REPLAY) {
+        if (*optvallen < sizeof (int))
+            return -EINVAL;
+        *(int*) optval = sub->replay;
+        *optvallen = sizeof (int);
+        return 0;
+    }
+
+    if (option == NN_SUB_SEQ) {
+        if (*optvallen < sizeof (uint64_t))
+            return -EINVAL;
+        *(uint64_t*) optval = sub->seq;
+        *optvallen = sizeof (uint64_t);
+        return 0;
+    }
+
+    if (option == NN_SUB_PATTERN_SEPARATOR) {
+        if (*optvallen < sizeof (int))
+            return -EINVAL;
+        *(int*) optval = sub->separator;
+        *optvallen = sizeof (int);
+        return 0;
+    }
+
+    if (option == NN_SUB_TRIE_STATS) {
+        if (*optvallen < sizeof (struct nn_sub_trie_stats))
+            return -EINVAL;
+        nn_trie_stats (sub->trie, &nodes, &bytes);
+        ((struct nn_sub_trie_stats*) optval)->nodes = nodes;
+        ((struct nn_sub_trie_stats*) optval)->bytes = bytes;
+        *optvallen = sizeof (struct nn_sub_trie_stats);
+        return 0;
+    }
+
     return -ENOPROTOOPT;
 }
 
+static int nn_sub_setoptunlocked (struct nn_sockbase *self, int level,
+    int option, const void *optval, size_t optvallen)
+{
+    int rc;
+    struct nn_sub *sub;
+    struct nn_cp *cp;
+    struct nn_trie *trie;
+
+    sub = nn_cont (self, struct nn_sub, sockbase);
+
+    if (level != NN_SUB)
+        return -ENOPROTOOPT;
+    if (option == NN_SUB_PATTERN_SUBSCRIBE ||
+          option == NN_SUB_PATTERN_UNSUBSCRIBE ||
+          option == NN_SUB_PATTERN_SEPARATOR)
+        return nn_sub_pattern (sub, option, optval, optvallen);
+    if (option != NN_SUB_SUBSCRIBE && option != NN_SUB_UNSUBSCRIBE &&
+          option != NN_SUB_SUBSCRIBE_BULK)
+        return -ENOPROTOOPT;
+
+    /*  Nobody but us touches the standby trie, so it can be modified without
+        locking the socket. If the change fails, neither copy is modified. */
+    nn_mutex_lock (&sub->wlock);
+    rc = nn_sub_change (sub->standby, option, optval, optvallen);
+    if (rc < 0) {
+        nn_mutex_unlock (&sub->wlock);
+        return rc;
+    }
+
+    cp = nn_sockbase_getcp (&sub->sockbase);
+    nn_cp_lock (cp);
+    trie = sub->trie;
+    sub->trie = sub->standby;
+    sub->standby = trie;
+
+    /*  Only the changes to the set of distinct subscriptions are forwarded
+        to the publisher. The publisher filters by prefix, so an exact
+        subscription is forwarded as a prefix one and the messages that
+        don't match it exactly are dropped here. Thus, a string is forwarded
+        only if it's not already subscribed to in the other way. After
+        a bulk change the publisher gets the whole new set at once. */
+    if (option == NN_SUB_SUBSCRIBE_BULK) {
+        sub->resync = 1;
+        nn_sub_flush (sub);
+    }
+    else if (rc == 1 && !nn_topics_match (&sub->topics, optval, optvallen) &&
+          !nn_topics_match (&sub->prefixes, optval, optvallen))
+        nn_sub_forward (sub, option == NN_SUB_SUBSCRIBE ?
+            NN_SUB_CMD_SUBSCRIBE : NN_SUB_CMD_UNSUBSCRIBE, optval, optvallen);
+    nn_sockbase_changed (&sub->sockbase);
+    nn_cp_unlock (cp);
+
+    /*  Once the socket is unlocked no one is matching against the former
+        trie any more. Bring it up to date. */
+    rc = nn_sub_change (sub->standby, option, optval, optvallen);
+    errnum_assert (rc >= 0, -rc);
+    nn_mutex_unlock (&sub->wlock);
+
+    return 0;
+}
+
+static int nn_sub_pattern (struct nn_sub *self, int option,
+    const void *optval, size_t optvallen)
+{
+    int rc;
+    int val;
+    size_t prefix;
+    struct nn_cp *cp;
+    struct nn_patterns_dfa *dfa;
+
+    nn_mutex_lock (&self->wlock);
+
+    if (option == NN_SUB_PATTERN_SEPARATOR) {
+        if (optvallen != sizeof (int)) {
+            nn_mutex_unlock (&self->wlock);
+            return -EINVAL;
+        }
+        val = *(int*) optval;
+        if (val < 0 || val > 255) {
+            nn_mutex_unlock (&self->wlock);
+            return -EINVAL;
+        }
+        self->patterns.separator = (uint8_t) val;
+        rc = 1;
+    }
+    else if (option == NN_SUB_PATTERN_SUBSCRIBE)
+        rc = nn_patterns_subscribe (&self->patterns, optval, optvallen);
+    else
+        rc = nn_patterns_unsubscribe (&self->patterns, optval, optvallen);
+    if (rc < 0) {
+        nn_mutex_unlock (&self->wlock);
+        return rc;
+    }
+
+    /*  Compile the new automaton while the messages are still being matched
+        against the old one. A pattern that would make it too large is
+        rejected. */
+    dfa = NULL;
+    if (rc == 1) {
+        rc = nn_patterns_compile (&self->patterns, &dfa);
+        if (nn_slow (rc < 0)) {
+            nn_assert (option == NN_SUB_PATTERN_SUBSCRIBE);
+            nn_patterns_unsubscribe (&self->patterns, optval, optvallen);
+            nn_mutex_unlock (&self->wlock);
+            return rc;
+        }
+        rc = 1;
+    }
+
+    cp = nn_sockbase_getcp (&self->sockbase);
+    nn_cp_lock (cp);
+    if (rc == 1) {
+        nn_patterns_free (self->dfa);
+        self->dfa = dfa;
+    }
+    if (option == NN_SUB_PATTERN_SEPARATOR)
+        self->separator = self->patterns.separator;
+
+    /*  The publisher filters by prefix, so it's sent the part of the pattern
+        preceding the first wildcard, unless it's already subscribed to it
+        in some other way. */
+    else {
+        prefix = nn_patterns_prefix (optval, optvallen);
+        if (option == NN_SUB_PATTERN_SUBSCRIBE) {
+            rc = nn_topics_subscribe (&self->prefixes, optval, prefix);
+            if (rc == 1 && !nn_sub_forwarded (self, optval, prefix))
+                nn_sub_forward (self, NN_SUB_CMD_SUBSCRIBE, optval, prefix);
+        }
+        else {
+            rc = nn_topics_unsubscribe (&self->prefixes, optval, prefix);
+            errnum_assert (rc >= 0, -rc);
+            if (rc == 1 && !nn_sub_forwarded (self, optval, prefix))
+                nn_sub_forward (self, NN_SUB_CMD_UNSUBSCRIBE, optval, prefix);
+        }
+    }
+    nn_sockbase_changed (&self->sockbase);
+    nn_cp_unlock (cp);
+
+    nn_mutex_unlock (&self->wlock);
+    return 0;
+}
+
+static int nn_sub_forwarded (struct nn_sub *self, const void *data,
+    size_t size)
+{
+    /*  Returns 1 if the publisher was sent the string because of a prefix
+        or an exact subscription. */
+    return nn_sub_subscribed (self, data, size) ||
+        nn_topics_match (&self->topics, data, size) ? 1 : 0;
+}
+
+static int nn_sub_change (struct nn_trie *trie, int option,
+    const void *optval, size_t optvallen)
+{
+    if (option == NN_SUB_SUBSCRIBE)
+        return nn_trie_subscribe (trie, optval, optvallen);
+    if (option == NN_SUB_UNSUBSCRIBE)
+        return nn_trie_unsubscribe (trie, optval, optvallen);
+    return nn_sub_bulk (trie, optval, optvallen);
+}
+
+static int nn_sub_subscribed (struct nn_sub *self, const void *data,
+    size_t size)
+{
+    /*  Returns 1 if there's a prefix subscription to exactly this string. */
+    return nn_trie_data (self->trie, data, size) ? 1 : 0;
+}
+
+static int nn_sub_bulk (struct nn_trie *trie, const uint8_t *data,
+    size_t size)
+{
+    size_t count;
+    size_t pos;
+    size_t len;
+    size_t i;
+    const uint8_t **strs;
+    size_t *sizes;
+    int rc;
+
+    /*  The subscriptions are laid out the same way as in the RESET command,
+        each one preceded by its 4-byte length. Check the layout first so
+        that either all of them or none are subscribed to. */
+    count = 0;
+    for (pos = 0; pos != size; pos += 4 + len) {
+        if (nn_slow (size - pos < 4))
+            return -EINVAL;
+        len = nn_getl (data + pos);
+        if (nn_slow (len > size - pos - 4))
+            return -EINVAL;
+        ++count;
+    }
+    if (!count)
+        return 0;
+
+    strs = nn_alloc (count * sizeof (uint8_t*), "bulk subscriptions");
+    alloc_assert (strs);
+    sizes = nn_alloc (count * sizeof (size_t), "bulk subscriptions");
+    alloc_assert (sizes);
+    pos = 0;
+    for (i = 0; i != count; ++i) {
+        sizes [i] = nn_getl (data + pos);
+        strs [i] = data + pos + 4;
+        pos += 4 + sizes [i];
+    }
+
+    /*  A sorted list fills in an empty trie in a single pass. Otherwise,
+        the strings are subscribed to one by one. */
+    rc = nn_trie_build (trie, strs, sizes, count);
+    if (rc < 0)
+        for (i = 0; i != count; ++i)
+            nn_trie_subscribe (trie, strs [i], sizes [i]);
+    nn_free (sizes);
+    nn_free (strs);
+
+    return 0;
+}
+
+static void nn_sub_forward (struct nn_sub *self, int cmd,
+    const void *data, size_t size)
+{
+    struct nn_msg msg;
+
+    /*  If the change can't be sent straight away, the publisher will get
+        the full set of subscriptions later on. That way we never have to
+        store more than the subscriptions themselves. */
+    if (self->resync || !nn_excl_can_send (&self->excl)) {
+        self->resync = 1;
+        nn_sub_flush (self);
+        return;
+    }
+
+    nn_msg_init (&msg, 1 + size);
+    *((uint8_t*) nn_chunkref_data (&msg.body)) = (uint8_t) cmd;
+    memcpy (((uint8_t*) nn_chunkref_data (&msg.body)) + 1, data, size);
+    nn_excl_send (&self->excl, &msg);
+}
+
+static void nn_sub_flush (struct nn_sub *self)
+{
+    struct nn_sub_reset reset;
+    struct nn_msg msg;
+
+    if (!self->resync || !nn_excl_can_send (&self->excl))
+        return;
+
+    /*  Send all the subscriptions in a single RESET command. */
+    reset.sub = self;
+    reset.size = 1;
+    nn_trie_walk (self->trie, nn_sub_reset_size, &reset);
+    nn_topics_walk (&self->topics, nn_sub_reset_size_exact, &reset);
+    nn_topics_walk (&self->prefixes, nn_sub_reset_size_prefix, &reset);
+    nn_msg_init (&msg, reset.size);
+    reset.pos = nn_chunkref_data (&msg.body);
+    *reset.pos = NN_SUB_CMD_RESET;
+    ++reset.pos;
+    nn_trie_walk (self->trie, nn_sub_reset_fill, &reset);
+    nn_topics_walk (&self->topics, nn_sub_reset_fill_exact, &reset);
+    nn_topics_walk (&self->prefixes, nn_sub_reset_fill_prefix, &reset);
+    nn_excl_send (&self->excl, &msg);
+
+    /*  Ask for the messages following the last one received. If the command
+        can't be sent now, both are sent again later on. */
+    if (self->replay && self->rewind) {
+        if (!nn_excl_can_send (&self->excl))
+            return;
+        nn_msg_init (&msg, 9);
+        reset.pos = nn_chunkref_data (&msg.body);
+        *reset.pos = NN_SUB_CMD_REPLAY;
+        nn_putll (reset.pos + 1, self->seq ? self->seq + 1 : 0);
+        nn_excl_send (&self->excl, &msg);
+        self->rewind = 0;
+    }
+
+    self->resync = 0;
+}
+
+static void nn_sub_reset_size (const uint8_t *data, size_t size, void *arg)
+{
+    ((struct nn_sub_reset*) arg)->size += 4 + size;
+}
+
+static void nn_sub_reset_fill (const uint8_t *data, size_t size, void *arg)
+{
+    struct nn_sub_reset *reset;
+
+    reset = (struct nn_sub_reset*) arg;
+    nn_putl (reset->pos, (uint32_t) size);
+    memcpy (reset->pos + 4, data, size);
+    reset->pos += 4 + size;
+}
+
+/*  Exact subscriptions that are also prefix subscriptions were already
+    included in the RESET command while walking the trie. */
+
+static void nn_sub_reset_size_exact (const uint8_t *data, size_t size,
+    void *arg)
+{
+    if (!nn_sub_subscribed (((struct nn_sub_reset*) arg)->sub, data, size))
+        nn_sub_reset_size (data, size, arg);
+}
+
+static void nn_sub_reset_fill_exact (const uint8_t *data, size_t size,
+    void *arg)
+{
+    if (!nn_sub_subscribed (((struct nn_sub_reset*) arg)->sub, data, size))
+        nn_sub_reset_fill (data, size, arg);
+}
+
+/*  Likewise, the prefixes of the patterns are included only if they are not
+    subscribed to in some other way. */
+
+static void nn_sub_reset_size_prefix (const uint8_t *data, size_t size,
+    void *arg)
+{
+    if (!nn_sub_forwarded (((struct nn_sub_reset*) arg)->sub, data, size))
+        nn_sub_reset_size (data, size, arg);
+}
+
+static void nn_sub_reset_fill_prefix (const uint8_t *data, size_t size,
+    void *arg)
+{
+    if (!nn_sub_forwarded (((struct nn_sub_reset*) arg)->sub, data, size))
+        nn_sub_reset_fill (data, size, arg);
+}
+
 static int nn_sub_create (struct nn_sockbase **sockbase)
 {
     int rc;
@@ -213,8 +1031,7 @@ static int nn_sub_create (struct nn_sockbase **sockbase)
 static struct nn_socktype nn_sub_socktype_struct = {
     AF_SP,
     NN_SUB,
-    nn_sub_create,
-    NN_LIST_ITEM_INITIALIZER
+    nn_sub_create
 };
 
 struct nn_socktype *nn_sub_socktype = &nn_sub_socktype_struct;
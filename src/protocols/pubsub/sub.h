@@ -27,4 +27,20 @@
 
 extern struct nn_socktype *nn_sub_socktype;
 
+/*  SUB socket forwards its subscriptions to the publisher so that it doesn't
+    send the messages nobody is interested in. Each message sent from SUB to
+    PUB starts with one of the following commands. SUBSCRIBE and UNSUBSCRIBE
+    are followed by a single subscription. RESET replaces all the previous
+    subscriptions by the ones that follow it, each of them encoded as 32-bit
+    length in network byte order followed by the subscription itself.
+    REPLAY asks the publisher to prefix each message by its 64-bit sequence
+    number in network byte order and to start with the message whose
+    sequence number follows it, in the same format, replaying the older
+    messages from its journal. Zero means to start with the next message
+    published. */
+#define NN_SUB_CMD_RESET 0
+#define NN_SUB_CMD_SUBSCRIBE 1
+#define NN_SUB_CMD_UNSUBSCRIBE 2
+#define NN_SUB_CMD_REPLAY 3
+
 #endif
@@ -0,0 +1,241 @@
+/*
+    Copyright (c) 2012-2013 250bpm s.r.o.
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"),
+    to deal in the Software without restriction, including without limitation
+    the rights to use, copy, modify, merge, publish, distribute, sublicense,
+    and/or sell copies of the Software, and to permit persons to whom
+    the Software is furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included
+    in all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+    THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+    FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+    IN THE SOFTWARE.
+*/
+
+#include "topics.h"
+
+#include "../../utils/alloc.h"
+#include "../../utils/fast.h"
+#include "../../utils/err.h"
+
+#include <string.h>
+
+#define NN_TOPICS_INITIAL_SLOTS 32
+
+/*  Private functions. */
+static uint32_t nn_topics_find (struct nn_topics *self, uint32_t hash,
+    const uint8_t *data, size_t size);
+static void nn_topics_resize (struct nn_topics *self, uint32_t slots);
+
+void nn_topics_init (struct nn_topics *self)
+{
+    self->slots = 0;
+    self->items = 0;
+    self->array = NULL;
+}
+
+void nn_topics_term (struct nn_topics *self)
+{
+    uint32_t i;
+
+    for (i = 0; i != self->slots; ++i)
+        if (self->array [i])
+            nn_free (self->array [i]);
+    if (self->array)
+        nn_free (self->array);
+}
+
+int nn_topics_subscribe (struct nn_topics *self, const uint8_t *data,
+    size_t size)
+{
+    uint32_t hash;
+    uint32_t i;
+    struct nn_topics_entry *entry;
+
+    /*  If the string is already in the set, just increment its reference
+        count. */
+    hash = nn_topics_hash (data, size);
+    i = nn_topics_find (self, hash, data, size);
+    if (i != self->slots && self->array [i]) {
+        ++self->array [i]->refcount;
+        return 0;
+    }
+
+    /*  Keep the table at most half full so that the probe sequences
+        stay short. */
+    if (nn_slow ((self->items + 1) * 2 > self->slots)) {
+        nn_topics_resize (self,
+            self->slots ? self->slots * 2 : NN_TOPICS_INITIAL_SLOTS);
+        i = nn_topics_find (self, hash, data, size);
+    }
+
+    entry = nn_alloc (sizeof (struct nn_topics_entry) + size, "topic");
+    alloc_assert (entry);
+    entry->hash = hash;
+    entry->refcount = 1;
+    entry->data = NULL;
+    entry->size = size;
+    memcpy (entry + 1, data, size);
+    self->array [i] = entry;
+    ++self->items;
+
+    return 1;
+}
+
+int nn_topics_unsubscribe (struct nn_topics *self, const uint8_t *data,
+    size_t size)
+{
+    uint32_t mask;
+    uint32_t i;
+    uint32_t j;
+    uint32_t k;
+
+    i = nn_topics_find (self, nn_topics_hash (data, size), data, size);
+    if (nn_slow (i == self->slots || !self->array [i]))
+        return -EINVAL;
+
+    if (--self->array [i]->refcount)
+        return 0;
+
+    nn_free (self->array [i]);
+    self->array [i] = NULL;
+    --self->items;
+
+    /*  Move the following entries of the probe sequence back to fill
+        the gap. An entry can be moved to the gap only if its home slot is
+        not cyclically between the gap and the entry itself. */
+    mask = self->slots - 1;
+    j = i;
+    while (1) {
+        j = (j + 1) & mask;
+        if (!self->array [j])
+            break;
+        k = self->array [j]->hash & mask;
+        if (i <= j ? (i < k && k <= j) : (i < k || k <= j))
+            continue;
+        self->array [i] = self->array [j];
+        self->array [j] = NULL;
+        i = j;
+    }
+
+    return 1;
+}
+
+int nn_topics_match (struct nn_topics *self, const uint8_t *data,
+    size_t size)
+{
+    uint32_t i;
+
+    if (!self->items)
+        return 0;
+    i = nn_topics_find (self, nn_topics_hash (data, size), data, size);
+    return self->array [i] ? 1 : 0;
+}
+
+void **nn_topics_data (struct nn_topics *self, const uint8_t *data,
+    size_t size)
+{
+    uint32_t i;
+
+    if (!self->items)
+        return NULL;
+    i = nn_topics_find (self, nn_topics_hash (data, size), data, size);
+    return self->array [i] ? &self->array [i]->data : NULL;
+}
+
+size_t nn_topics_topic (const uint8_t *data, size_t size, int delimiter)
+{
+    const uint8_t *pos;
+
+    if (delimiter < 0)
+        return size;
+    pos = memchr (data, delimiter, size);
+    return pos ? (size_t) (pos - data) : size;
+}
+
+void nn_topics_walk (struct nn_topics *self, nn_topics_walk_fn *fn,
+    void *arg)
+{
+    uint32_t i;
+
+    for (i = 0; i != self->slots; ++i)
+        if (self->array [i])
+            fn ((const uint8_t*) (self->array [i] + 1),
+                self->array [i]->size, arg);
+}
+
+uint32_t nn_topics_hash (const uint8_t *data, size_t size)
+{
+    uint32_t hash;
+
+    /*  FNV-1a. */
+    hash = 2166136261u;
+    while (size--) {
+        hash ^= *data++;
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+static uint32_t nn_topics_find (struct nn_topics *self, uint32_t hash,
+    const uint8_t *data, size_t size)
+{
+    /*  Returns the slot holding the string or, if the string is not in
+        the set, the empty slot where it should be inserted. If there are no
+        slots at all, 'slots' is returned. */
+
+    uint32_t mask;
+    uint32_t i;
+    struct nn_topics_entry *entry;
+
+    if (nn_slow (!self->slots))
+        return self->slots;
+
+    mask = self->slots - 1;
+    i = hash & mask;
+    while (1) {
+        entry = self->array [i];
+        if (!entry || (entry->hash == hash && entry->size == size &&
+              memcmp (entry + 1, data, size) == 0))
+            return i;
+        i = (i + 1) & mask;
+    }
+}
+
+static void nn_topics_resize (struct nn_topics *self, uint32_t slots)
+{
+    uint32_t oldslots;
+    struct nn_topics_entry **oldarray;
+    uint32_t i;
+    uint32_t j;
+
+    oldslots = self->slots;
+    oldarray = self->array;
+    self->slots = slots;
+    self->array = nn_alloc (sizeof (struct nn_topics_entry*) * slots,
+        "topics");
+    alloc_assert (self->array);
+    memset (self->array, 0, sizeof (struct nn_topics_entry*) * slots);
+
+    /*  Re-insert all the entries into the new array. */
+    for (i = 0; i != oldslots; ++i) {
+        if (!oldarray [i])
+            continue;
+        j = oldarray [i]->hash & (slots - 1);
+        while (self->array [j])
+            j = (j + 1) & (slots - 1);
+        self->array [j] = oldarray [i];
+    }
+
+    if (oldarray)
+        nn_free (oldarray);
+}
+
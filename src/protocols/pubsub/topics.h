@@ -0,0 +1,107 @@
+/*
+    Copyright (c) 2012-2013 250bpm s.r.o.
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"),
+    to deal in the Software without restriction, including without limitation
+    the rights to use, copy, modify, merge, publish, distribute, sublicense,
+    and/or sell copies of the Software, and to permit persons to whom
+    the Software is furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included
+    in all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+    THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+    FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+    IN THE SOFTWARE.
+*/
+
+#ifndef NN_TOPICS_INCLUDED
+#define NN_TOPICS_INCLUDED
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*  Set of strings that are matched exactly rather than as prefixes. Unlike
+    with nn_trie, the cost of the lookup doesn't depend on the number of
+    strings in the set and there's no character-by-character traversal.
+    It's an open-addressing hash table with linear probing. */
+
+struct nn_topics_entry {
+
+    /*  Hash of the string. */
+    uint32_t hash;
+
+    /*  Number of subscriptions to the string. */
+    uint32_t refcount;
+
+    /*  User data associated with the string, see nn_topics_data. */
+    void *data;
+
+    /*  Length of the string. The string itself follows the structure. */
+    size_t size;
+};
+
+struct nn_topics {
+
+    /*  Number of slots in the table. It's either zero or a power of two. */
+    uint32_t slots;
+
+    /*  Number of strings in the table. */
+    uint32_t items;
+
+    /*  Array of slots. Unused slots are NULL. */
+    struct nn_topics_entry **array;
+};
+
+/*  Initialise an empty set. No memory is allocated until the first string
+    is added. */
+void nn_topics_init (struct nn_topics *self);
+
+/*  Release all the resources associated with the set. */
+void nn_topics_term (struct nn_topics *self);
+
+/*  Add the string to the set. If the string is not yet there, 1 is returned.
+    If it already exists in the set, its reference count is incremented and
+    0 is returned. */
+int nn_topics_subscribe (struct nn_topics *self, const uint8_t *data,
+    size_t size);
+
+/*  Remove the string from the set. If the string was actually removed,
+    1 is returned. If reference count was decremented without falling to zero,
+    0 is returned. If the string is not in the set, -EINVAL is returned. */
+int nn_topics_unsubscribe (struct nn_topics *self, const uint8_t *data,
+    size_t size);
+
+/*  Returns 1 if the string is in the set, 0 otherwise. */
+int nn_topics_match (struct nn_topics *self, const uint8_t *data,
+    size_t size);
+
+/*  Returns pointer to the user data associated with the string, or NULL if
+    the string is not in the set. The user data are NULL when the string is
+    added to the set. */
+void **nn_topics_data (struct nn_topics *self, const uint8_t *data,
+    size_t size);
+
+/*  Hash of the string, as used by the set. */
+uint32_t nn_topics_hash (const uint8_t *data, size_t size);
+
+/*  Returns the length of the topic of the message, i.e. the part of
+    the message preceding the first occurrence of 'delimiter'. If the
+    delimiter is -1 or it doesn't occur in the message, the topic is
+    the whole message. */
+size_t nn_topics_topic (const uint8_t *data, size_t size, int delimiter);
+
+/*  Invokes 'fn' for each string in the set. The set must not be modified
+    while it's being walked. */
+typedef void (nn_topics_walk_fn) (const uint8_t *data, size_t size,
+    void *arg);
+void nn_topics_walk (struct nn_topics *self, nn_topics_walk_fn *fn,
+    void *arg);
+
+#endif
+
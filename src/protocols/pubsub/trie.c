@@ -29,34 +29,243 @@
 #include "../../utils/fast.h"
 #include "../../utils/err.h"
 
+#if defined __SSE2__ || defined _M_X64 || \
+    (defined _M_IX86_FP && _M_IX86_FP >= 2)
+#define NN_TRIE_SSE2
+#include <emmintrin.h>
+#if defined _MSC_VER
+#include <intrin.h>
+#endif
+#elif defined __ARM_NEON && !defined __ARM_BIG_ENDIAN && defined __GNUC__
+#define NN_TRIE_NEON
+#include <arm_neon.h>
+#endif
+
 /*  Double check that the size of node structure is as small as
     we believe it to be. */
-CT_ASSERT (sizeof (struct nn_trie_node) == 24);
+CT_ASSERT (sizeof (struct nn_trie_node) == 24 + sizeof (void*));
+
+/*  Pointer to an out-of-line prefix must fit into the inline prefix array. */
+CT_ASSERT (NN_TRIE_PREFIX_INLINE >= sizeof (uint8_t*));
+
+/*  Length of the prefix must fit into 'prefix_len'. */
+CT_ASSERT (NN_TRIE_PREFIX_MAX <= 255);
+
+/*  State of the trie traversal. 'buf' holds the string corresponding to
+    the node being visited. */
+struct nn_trie_walk {
+    nn_trie_walk_fn *fn;
+    void *arg;
+    uint8_t *buf;
+    size_t len;
+    size_t capacity;
+};
 
 /*  Forward declarations. */
-static struct nn_trie_node *nn_node_compact (struct nn_trie_node *self);
+static int nn_trie_class (int children);
+static struct nn_trie_node *nn_trie_alloc (struct nn_trie *self,
+    int children);
+static void nn_trie_free (struct nn_trie *self, struct nn_trie_node *node,
+    int children);
+static struct nn_trie_node *nn_trie_realloc (struct nn_trie *self,
+    struct nn_trie_node *node, int old_children, int new_children);
+static uint8_t *nn_trie_alloc_prefix (struct nn_trie *self, size_t size);
+static void nn_trie_free_prefix (struct nn_trie *self, uint8_t *prefix,
+    size_t size);
+static uint8_t *nn_node_prefix (struct nn_trie_node *self);
+static void nn_node_set_prefix (struct nn_trie *trie,
+    struct nn_trie_node *self, const uint8_t *data, size_t size);
+static void nn_node_free (struct nn_trie *trie, struct nn_trie_node *self,
+    int children);
+static struct nn_trie_node *nn_node_compact (struct nn_trie *trie,
+    struct nn_trie_node *self);
 static int nn_node_check_prefix (struct nn_trie_node *self,
     const uint8_t *data, size_t size);
 static struct nn_trie_node **nn_node_child (struct nn_trie_node *self,
     int index);
 static struct nn_trie_node **nn_node_next (struct nn_trie_node *self,
     uint8_t c);
-static int nn_node_unsubscribe (struct nn_trie_node **self,
-    const uint8_t *data, size_t size);
-static void nn_node_term (struct nn_trie_node *self);
+static int nn_node_unsubscribe (struct nn_trie *trie,
+    struct nn_trie_node **self, const uint8_t *data, size_t size);
 static int nn_node_has_subscribers (struct nn_trie_node *self);
+static struct nn_trie_node *nn_node_build (struct nn_trie *trie,
+    const uint8_t **data, const size_t *sizes, size_t count, size_t depth);
+static size_t nn_node_count (struct nn_trie_node *self);
+static void nn_node_walk (struct nn_trie_node *self,
+    struct nn_trie_walk *walk);
 static void nn_node_dump (struct nn_trie_node *self, int indent);
 static void nn_node_indent (int indent);
 static void nn_node_putchar (uint8_t c);
 
 void nn_trie_init (struct nn_trie *self)
 {
+    int i;
+
     self->root = NULL;
+    self->blocks = NULL;
+    self->pos = NULL;
+    self->end = NULL;
+    for (i = 0; i != NN_TRIE_CLASSES; ++i)
+        self->free [i] = NULL;
 }
 
 void nn_trie_term (struct nn_trie *self)
 {
-    nn_node_term (self->root);
+    void *block;
+
+    /*  All the nodes live in the blocks, so there's no need to traverse
+        the trie to deallocate them. */
+    while (self->blocks) {
+        block = self->blocks;
+        self->blocks = *(void**) block;
+        nn_free (block);
+    }
+}
+
+static int nn_trie_class (int children)
+{
+    int cls;
+
+    cls = 0;
+    while (children > (cls ? 1 << (cls - 1) : 0))
+        ++cls;
+    return cls;
+}
+
+static struct nn_trie_node *nn_trie_alloc (struct nn_trie *self,
+    int children)
+{
+    int cls;
+    size_t size;
+    void *block;
+    struct nn_trie_node *node;
+
+    /*  Reuse a deallocated node of the same size class, if possible. */
+    cls = nn_trie_class (children);
+    node = self->free [cls];
+    if (node) {
+        self->free [cls] = (struct nn_trie_node*) node->data;
+        return node;
+    }
+
+    /*  If there's not enough space left in the current block, allocate
+        a new one. The rest of the old block is left unused. */
+    size = sizeof (struct nn_trie_node) +
+        (cls ? 1 << (cls - 1) : 0) * sizeof (struct nn_trie_node*);
+    if (nn_slow ((size_t) (self->end - self->pos) < size)) {
+        block = nn_alloc (NN_TRIE_ARENA_SIZE, "trie arena");
+        alloc_assert (block);
+        *(void**) block = self->blocks;
+        self->blocks = block;
+        self->pos = ((uint8_t*) block) + sizeof (void*);
+        self->end = ((uint8_t*) block) + NN_TRIE_ARENA_SIZE;
+    }
+
+    node = (struct nn_trie_node*) self->pos;
+    self->pos += size;
+    return node;
+}
+
+static void nn_trie_free (struct nn_trie *self, struct nn_trie_node *node,
+    int children)
+{
+    int cls;
+
+    cls = nn_trie_class (children);
+    node->data = self->free [cls];
+    self->free [cls] = node;
+}
+
+static uint8_t *nn_trie_alloc_prefix (struct nn_trie *self, size_t size)
+{
+    /*  Out-of-line prefixes share the size classes with the nodes. Prefix
+        occupies the space of a node with as many children as needed for
+        the prefix to fit in. */
+    return (uint8_t*) nn_trie_alloc (self, size <= sizeof (struct nn_trie_node) ?
+        0 : (int) ((size - sizeof (struct nn_trie_node) +
+        sizeof (struct nn_trie_node*) - 1) / sizeof (struct nn_trie_node*)));
+}
+
+static void nn_trie_free_prefix (struct nn_trie *self, uint8_t *prefix,
+    size_t size)
+{
+    nn_trie_free (self, (struct nn_trie_node*) prefix,
+        size <= sizeof (struct nn_trie_node) ? 0 :
+        (int) ((size - sizeof (struct nn_trie_node) +
+        sizeof (struct nn_trie_node*) - 1) / sizeof (struct nn_trie_node*)));
+}
+
+static struct nn_trie_node *nn_trie_realloc (struct nn_trie *self,
+    struct nn_trie_node *node, int old_children, int new_children)
+{
+    struct nn_trie_node *new_node;
+
+    /*  If the node still fits into its size class, there's nothing to do. */
+    if (nn_trie_class (old_children) == nn_trie_class (new_children))
+        return node;
+
+    new_node = nn_trie_alloc (self, new_children);
+    memcpy (new_node, node, sizeof (struct nn_trie_node) +
+        (old_children < new_children ? old_children : new_children) *
+        sizeof (struct nn_trie_node*));
+    nn_trie_free (self, node, old_children);
+    return new_node;
+}
+
+void nn_trie_walk (struct nn_trie *self, nn_trie_walk_fn *fn, void *arg)
+{
+    struct nn_trie_walk walk;
+
+    walk.fn = fn;
+    walk.arg = arg;
+    walk.len = 0;
+    walk.capacity = 64;
+    walk.buf = nn_alloc (walk.capacity, "trie walk");
+    alloc_assert (walk.buf);
+    nn_node_walk (self->root, &walk);
+    nn_free (walk.buf);
+}
+
+static void nn_node_walk (struct nn_trie_node *self,
+    struct nn_trie_walk *walk)
+{
+    int i;
+    int children;
+    struct nn_trie_node *child;
+
+    if (!self)
+        return;
+
+    /*  Make sure there's space for the prefix and one more character. */
+    while (walk->len + self->prefix_len + 1 > walk->capacity) {
+        walk->capacity *= 2;
+        walk->buf = nn_realloc (walk->buf, walk->capacity);
+        alloc_assert (walk->buf);
+    }
+
+    /*  The string represented by the node is the parent string followed
+        by the prefix. */
+    memcpy (walk->buf + walk->len, nn_node_prefix (self), self->prefix_len);
+    walk->len += self->prefix_len;
+    if (nn_node_has_subscribers (self))
+        walk->fn (walk->buf, walk->len, walk->arg);
+
+    /*  Each child adds one more character, either stored in the sparse
+        array or implied by its position in the dense array. */
+    children = self->type <= NN_TRIE_SPARSE_MAX ?
+        self->type : (self->u.dense.max - self->u.dense.min + 1);
+    for (i = 0; i != children; ++i) {
+        child = *nn_node_child (self, i);
+        if (!child)
+            continue;
+        walk->buf [walk->len] = self->type <= NN_TRIE_SPARSE_MAX ?
+            self->u.sparse.children [i] : (uint8_t) (self->u.dense.min + i);
+        ++walk->len;
+        nn_node_walk (child, walk);
+        --walk->len;
+    }
+
+    walk->len -= self->prefix_len;
 }
 
 void nn_trie_dump (struct nn_trie *self)
@@ -89,7 +298,7 @@ void nn_node_dump (struct nn_trie_node *self, int indent)
     nn_node_indent (indent);
     printf ("prefix=\"");
     for (i = 0; i != self->prefix_len; ++i)
-        nn_node_putchar (self->prefix [i]);
+        nn_node_putchar (nn_node_prefix (self) [i]);
     printf ("\"\n");
     if (self->type <= 8) {
         nn_node_indent (indent);
@@ -134,34 +343,17 @@ void nn_node_putchar (uint8_t c)
         putchar (c);
 }
 
-void nn_node_term (struct nn_trie_node *self)
-{
-    int children;
-    int i;
-
-    /*  Trivial case of the recursive algorithm. */
-    if (!self)
-        return;
-
-    /*  Recursively destroy the child nodes. */
-    children = self->type <= NN_TRIE_SPARSE_MAX ?
-        self->type : (self->u.dense.max - self->u.dense.min + 1);
-    for (i = 0; i != children; ++i)
-        nn_node_term (*nn_node_child (self, i));
-
-    /*  Deallocate this node. */
-    nn_free (self);
-}
-
 int nn_node_check_prefix (struct nn_trie_node *self,
     const uint8_t *data, size_t size)
 {
     /*  Check how many characters from the data match the prefix. */
 
     int i;
+    const uint8_t *prefix;
 
+    prefix = nn_node_prefix (self);
     for (i = 0; i != self->prefix_len; ++i) {
-        if (!size || self->prefix [i] != *data)
+        if (!size || prefix [i] != *data)
             return i;
         ++data;
         --size;
@@ -169,6 +361,56 @@ int nn_node_check_prefix (struct nn_trie_node *self,
     return self->prefix_len;
 }
 
+uint8_t *nn_node_prefix (struct nn_trie_node *self)
+{
+    /*  Returns pointer to the prefix, wherever it is stored. */
+
+    uint8_t *prefix;
+
+    if (nn_fast (self->prefix_len <= NN_TRIE_PREFIX_INLINE))
+        return self->prefix;
+    memcpy (&prefix, self->prefix, sizeof (prefix));
+    return prefix;
+}
+
+void nn_node_set_prefix (struct nn_trie *trie, struct nn_trie_node *self,
+    const uint8_t *data, size_t size)
+{
+    /*  Replaces the prefix of the node. 'data' may point into the current
+        prefix. 'prefix_len' must be valid (zero for fresh nodes) as
+        the current out-of-line prefix, if any, is deallocated. */
+
+    uint8_t *old;
+    uint8_t *prefix;
+
+    old = self->prefix_len > NN_TRIE_PREFIX_INLINE ?
+        nn_node_prefix (self) : NULL;
+
+    if (size <= NN_TRIE_PREFIX_INLINE)
+        memmove (self->prefix, data, size);
+    else {
+        prefix = nn_trie_alloc_prefix (trie, size);
+        memcpy (prefix, data, size);
+        memcpy (self->prefix, &prefix, sizeof (prefix));
+    }
+
+    if (old)
+        nn_trie_free_prefix (trie, old, self->prefix_len);
+    self->prefix_len = (uint8_t) size;
+}
+
+void nn_node_free (struct nn_trie *trie, struct nn_trie_node *self,
+    int children)
+{
+    /*  Deallocates the node including its out-of-line prefix. Nodes that
+        are merely moved to a different place in memory are deallocated
+        using nn_trie_free as the prefix is inherited by the new node. */
+
+    if (self->prefix_len > NN_TRIE_PREFIX_INLINE)
+        nn_trie_free_prefix (trie, nn_node_prefix (self), self->prefix_len);
+    nn_trie_free (trie, self, children);
+}
+
 struct nn_trie_node **nn_node_child (struct nn_trie_node *self, int index)
 {
     /*  Finds pointer to the n-th child of the node. */
@@ -181,17 +423,50 @@ struct nn_trie_node **nn_node_next (struct nn_trie_node *self, uint8_t c)
     /*  Finds the pointer to the next node based on the supplied character.
         If there is no such pointer, it returns NULL. */
 
+#if defined NN_TRIE_SSE2
+    unsigned int mask;
+#if defined _MSC_VER
+    unsigned long index;
+#endif
+#elif defined NN_TRIE_NEON
+    uint64_t mask;
+#else
     int i;
+#endif
 
     if (self->type == 0)
         return NULL;
 
-    /*  Sparse mode. */
+    /*  Sparse mode. All the children are compared with the character at
+        once. The bytes of the array past the 'type' children are ignored. */
     if (self->type <= 8) {
+#if defined NN_TRIE_SSE2
+        mask = (unsigned int) _mm_movemask_epi8 (_mm_cmpeq_epi8 (
+            _mm_loadl_epi64 ((const __m128i*) self->u.sparse.children),
+            _mm_set1_epi8 ((char) c)));
+        mask &= (1u << self->type) - 1;
+        if (!mask)
+            return NULL;
+#if defined _MSC_VER
+        _BitScanForward (&index, mask);
+        return nn_node_child (self, (int) index);
+#else
+        return nn_node_child (self, __builtin_ctz (mask));
+#endif
+#elif defined NN_TRIE_NEON
+        mask = vget_lane_u64 (vreinterpret_u64_u8 (vceq_u8 (
+            vld1_u8 (self->u.sparse.children), vdup_n_u8 (c))), 0);
+        if (self->type < 8)
+            mask &= (((uint64_t) 1) << (self->type * 8)) - 1;
+        if (!mask)
+            return NULL;
+        return nn_node_child (self, __builtin_ctzll (mask) / 8);
+#else
         for (i = 0; i != self->type; ++i)
             if (self->u.sparse.children [i] == c)
                 return nn_node_child (self, i);
         return NULL;
+#endif
     }
 
     /*  Dense mode. */
@@ -200,12 +475,14 @@ struct nn_trie_node **nn_node_next (struct nn_trie_node *self, uint8_t c)
     return nn_node_child (self, c - self->u.dense.min);
 }
 
-struct nn_trie_node *nn_node_compact (struct nn_trie_node *self)
+struct nn_trie_node *nn_node_compact (struct nn_trie *trie,
+    struct nn_trie_node *self)
 {
     /*  Tries to merge the node with the child node. Returns pointer to
         the compacted node. */
 
     struct nn_trie_node *ch;
+    uint8_t prefix [NN_TRIE_PREFIX_MAX];
 
     /*  Node that is a subscription cannot be compacted. */
     if (nn_node_has_subscribers (self))
@@ -221,13 +498,15 @@ struct nn_trie_node *nn_node_compact (struct nn_trie_node *self)
         return self;
 
     /*  Concatenate the prefixes. */
-    memmove (ch->prefix + self->prefix_len + 1, ch->prefix, ch->prefix_len);
-    memcpy (ch->prefix, self->prefix, self->prefix_len);
-    ch->prefix [self->prefix_len] = self->u.sparse.children [0];
-    ch->prefix_len += self->prefix_len + 1;
+    memcpy (prefix, nn_node_prefix (self), self->prefix_len);
+    prefix [self->prefix_len] = self->u.sparse.children [0];
+    memcpy (prefix + self->prefix_len + 1, nn_node_prefix (ch),
+        ch->prefix_len);
+    nn_node_set_prefix (trie, ch, prefix,
+        self->prefix_len + 1 + ch->prefix_len);
 
     /*  Get rid of the obsolete parent node. */
-    nn_free (self);
+    nn_node_free (trie, self, 1);
 
     /*  Return the new compacted node. */
     return ch;
@@ -274,9 +553,11 @@ int nn_trie_subscribe (struct nn_trie *self, const uint8_t *data, size_t size)
         if (!size)
             goto step5;
 
-        /*  Move to the next node. If it is not present, go to step 3. */
+        /*  Move to the next node. If it is not present, go to step 3. Note
+            that in a dense array there may be an empty slot for the
+            character. */
         n = nn_node_next (*node, *data);
-        if (!n)
+        if (!n || !*n)
             goto step3;
         node = n;
         ++data;
@@ -287,17 +568,16 @@ int nn_trie_subscribe (struct nn_trie *self, const uint8_t *data, size_t size)
 step2:
 
     ch = *node;
-    *node = nn_alloc (sizeof (struct nn_trie_node) +
-        sizeof (struct nn_trie_node*), "trie node");
-    assert (*node);
+    *node = nn_trie_alloc (self, 1);
     (*node)->refcount = 0;
-    (*node)->prefix_len = pos;
+    (*node)->data = NULL;
+    (*node)->prefix_len = 0;
     (*node)->type = 1;
-    memcpy ((*node)->prefix, ch->prefix, pos);
-    (*node)->u.sparse.children [0] = ch->prefix [pos];
-    ch->prefix_len -= (pos + 1);
-    memmove (ch->prefix, ch->prefix + pos + 1, ch->prefix_len);
-    ch = nn_node_compact (ch);
+    nn_node_set_prefix (self, *node, nn_node_prefix (ch), pos);
+    (*node)->u.sparse.children [0] = nn_node_prefix (ch) [pos];
+    nn_node_set_prefix (self, ch, nn_node_prefix (ch) + pos + 1,
+        ch->prefix_len - pos - 1);
+    ch = nn_node_compact (self, ch);
     *nn_node_child (*node, 0) = ch;
     pos = (*node)->prefix_len;
 
@@ -311,9 +591,8 @@ step3:
 
     /*  If the new branch fits into sparse array... */
     if ((*node)->type < NN_TRIE_SPARSE_MAX) {
-        *node = nn_realloc (*node, sizeof (struct nn_trie_node) +
-            ((*node)->type + 1) * sizeof (struct nn_trie_node*));
-        assert (*node);
+        *node = nn_trie_realloc (self, *node, (*node)->type,
+            (*node)->type + 1);
         (*node)->u.sparse.children [(*node)->type] = *data;
         ++(*node)->type;
         node = nn_node_child (*node, (*node)->type - 1);
@@ -330,11 +609,9 @@ step3:
         if (c < (*node)->u.dense.min || c > (*node)->u.dense.max) {
             new_min = (*node)->u.dense.min < c ? (*node)->u.dense.min : c;
             new_max = (*node)->u.dense.max > c ? (*node)->u.dense.max : c;
-            *node = nn_realloc (*node, sizeof (struct nn_trie_node) +
-                (new_max - new_min + 1) * sizeof (struct nn_trie_node*));
-            assert (*node);
             old_children = (*node)->u.dense.max - (*node)->u.dense.min + 1;
             new_children = new_max - new_min + 1;
+            *node = nn_trie_realloc (self, *node, old_children, new_children);
             if ((*node)->u.dense.min != new_min) {
                 inserted = (*node)->u.dense.min - new_min;
                 memmove (nn_node_child (*node, inserted),
@@ -350,8 +627,8 @@ step3:
             }
             (*node)->u.dense.min = new_min;
             (*node)->u.dense.max = new_max;
-            ++(*node)->u.dense.nbr;
         }
+        ++(*node)->u.dense.nbr;
         node = nn_node_child (*node, c - (*node)->u.dense.min);
         ++data;
         --size;
@@ -374,16 +651,14 @@ step3:
 
         /*  Create a new mode, while keeping the old one for a while. */
         old_node = *node;
-        *node = (struct nn_trie_node*) nn_alloc (sizeof (struct nn_trie_node) +
-            (new_max - new_min + 1) * sizeof (struct nn_trie_node*),
-            "trie node");
-        assert (*node);
+        *node = nn_trie_alloc (self, new_max - new_min + 1);
 
         /*  Fill in the new node. */
-        (*node)->refcount = 0;
+        (*node)->refcount = old_node->refcount;
+        (*node)->data = old_node->data;
         (*node)->prefix_len = old_node->prefix_len;
         (*node)->type = NN_TRIE_DENSE_TYPE;
-        memcpy ((*node)->prefix, old_node->prefix, old_node->prefix_len);
+        memcpy ((*node)->prefix, old_node->prefix, NN_TRIE_PREFIX_INLINE);
         (*node)->u.dense.min = new_min;
         (*node)->u.dense.max = new_max;
         (*node)->u.dense.nbr = old_node->type + 1;
@@ -397,7 +672,7 @@ step3:
         --size;
 
         /*  Get rid of the obsolete old node. */
-        nn_free (old_node);
+        nn_trie_free (self, old_node, old_node->type);
     }
 
     /*  Step 4 -- Create new nodes for remaining part of the subscription. */
@@ -408,16 +683,16 @@ step4:
 
         /*  Create a new node to hold the next part of the subscription. */
         more_nodes = size > NN_TRIE_PREFIX_MAX;
-        *node = nn_alloc (sizeof (struct nn_trie_node) +
-            (more_nodes ? sizeof (struct nn_trie_node*) : 0), "trie node");
-        assert (*node);
+        *node = nn_trie_alloc (self, more_nodes ? 1 : 0);
 
         /*  Fill in the new node. */
         (*node)->refcount = 0;
+        (*node)->data = NULL;
         (*node)->type = more_nodes ? 1 : 0;
-        (*node)->prefix_len = size < (size_t) NN_TRIE_PREFIX_MAX ?
-            size : (size_t) NN_TRIE_PREFIX_MAX;
-        memcpy ((*node)->prefix, data, (*node)->prefix_len);
+        (*node)->prefix_len = 0;
+        nn_node_set_prefix (self, *node, data,
+            size < (size_t) NN_TRIE_PREFIX_MAX ?
+            size : (size_t) NN_TRIE_PREFIX_MAX);
         data += (*node)->prefix_len;
         size -= (*node)->prefix_len;
         if (!more_nodes)
@@ -437,11 +712,144 @@ step5:
     return (*node)->refcount == 1 ? 1 : 0;
 }
 
+int nn_trie_build (struct nn_trie *self, const uint8_t **data,
+    const size_t *sizes, size_t count)
+{
+    size_t i;
+    int rc;
+
+    if (nn_slow (self->root != NULL))
+        return -EINVAL;
+
+    /*  Each string must not precede the previous one. A string that is
+        a prefix of another one precedes it. */
+    for (i = 1; i < count; ++i) {
+        rc = memcmp (data [i - 1], data [i],
+            sizes [i - 1] < sizes [i] ? sizes [i - 1] : sizes [i]);
+        if (nn_slow (rc > 0 || (rc == 0 && sizes [i - 1] > sizes [i])))
+            return -EINVAL;
+    }
+
+    if (count)
+        self->root = nn_node_build (self, data, sizes, count, 0);
+    return 0;
+}
+
+static struct nn_trie_node *nn_node_build (struct nn_trie *trie,
+    const uint8_t **data, const size_t *sizes, size_t count, size_t depth)
+{
+    /*  Creates the node for the sorted strings that share the first 'depth'
+        characters, along with the whole subtree below it. */
+
+    struct nn_trie_node *self;
+    size_t len;
+    size_t refs;
+    size_t i;
+    size_t j;
+    int groups;
+    int children;
+    uint8_t c;
+
+    /*  The strings are sorted, so the prefix common to all of them is
+        the one shared by the first and the last one. If it's too long,
+        the rest is left to the only child. */
+    len = 0;
+    while (len < NN_TRIE_PREFIX_MAX && depth + len < sizes [0] &&
+          depth + len < sizes [count - 1] &&
+          data [0] [depth + len] == data [count - 1] [depth + len])
+        ++len;
+    depth += len;
+
+    /*  Strings that end here go first. They are the subscriptions to this
+        very node. */
+    refs = 0;
+    while (refs != count && sizes [refs] == depth)
+        ++refs;
+
+    /*  The remaining strings are grouped by their next character. */
+    groups = 0;
+    for (i = refs; i != count; ++i)
+        if (i == refs || data [i] [depth] != data [i - 1] [depth])
+            ++groups;
+    children = groups <= NN_TRIE_SPARSE_MAX ? groups :
+        data [count - 1] [depth] - data [refs] [depth] + 1;
+
+    self = nn_trie_alloc (trie, children);
+    self->data = NULL;
+    self->refcount = (uint32_t) refs;
+    self->prefix_len = 0;
+    nn_node_set_prefix (trie, self, data [0] + depth - len, len);
+    if (groups <= NN_TRIE_SPARSE_MAX)
+        self->type = (uint8_t) groups;
+    else {
+        self->type = NN_TRIE_DENSE_TYPE;
+        self->u.dense.min = data [refs] [depth];
+        self->u.dense.max = data [count - 1] [depth];
+        self->u.dense.nbr = (uint16_t) groups;
+        memset (self + 1, 0, children * sizeof (struct nn_trie_node*));
+    }
+
+    /*  Build the subtrees of the children. */
+    groups = 0;
+    for (i = refs; i != count; i = j) {
+        c = data [i] [depth];
+        for (j = i + 1; j != count && data [j] [depth] == c; ++j)
+            ;
+        if (self->type <= NN_TRIE_SPARSE_MAX) {
+            self->u.sparse.children [groups] = c;
+            *nn_node_child (self, groups) = nn_node_build (trie, data + i,
+                sizes + i, j - i, depth + 1);
+        }
+        else
+            *nn_node_child (self, c - self->u.dense.min) = nn_node_build (
+                trie, data + i, sizes + i, j - i, depth + 1);
+        ++groups;
+    }
+
+    return self;
+}
+
+void nn_trie_stats (struct nn_trie *self, size_t *nodes, size_t *bytes)
+{
+    void *block;
+
+    *nodes = nn_node_count (self->root);
+    *bytes = 0;
+    for (block = self->blocks; block; block = *(void**) block)
+        *bytes += NN_TRIE_ARENA_SIZE;
+}
+
+static size_t nn_node_count (struct nn_trie_node *self)
+{
+    size_t count;
+    int children;
+    int i;
+
+    if (!self)
+        return 0;
+    count = 1;
+    children = self->type <= NN_TRIE_SPARSE_MAX ?
+        self->type : (self->u.dense.max - self->u.dense.min + 1);
+    for (i = 0; i != children; ++i)
+        count += nn_node_count (*nn_node_child (self, i));
+    return count;
+}
+
 int nn_trie_match (struct nn_trie *self, const uint8_t *data, size_t size)
+{
+    size_t len;
+
+    return nn_trie_match_len (self, data, size, &len);
+}
+
+int nn_trie_match_len (struct nn_trie *self, const uint8_t *data,
+    size_t size, size_t *len)
 {
     struct nn_trie_node *node;
     struct nn_trie_node **tmp;
+    const uint8_t *begin;
 
+    begin = data;
     node = self->root;
     while (1) {
 
@@ -459,8 +867,14 @@ int nn_trie_match (struct nn_trie *self, const uint8_t *data, size_t size)
         size -= node->prefix_len;
 
         /*  If all the data are matched, return. */
-        if (nn_node_has_subscribers (node))
+        if (nn_node_has_subscribers (node)) {
+            *len = (size_t) (data - begin);
             return 1;
+        }
+
+        /*  If there are no more data, there's no next node to move to. */
+        if (!size)
+            return 0;
 
         /*  Move to the next node. */
         tmp = nn_node_next (node, *data);
@@ -470,15 +884,78 @@ int nn_trie_match (struct nn_trie *self, const uint8_t *data, size_t size)
     }
 }
 
+void **nn_trie_data (struct nn_trie *self, const uint8_t *data, size_t size)
+{
+    struct nn_trie_node *node;
+    struct nn_trie_node **tmp;
+
+    node = self->root;
+    while (1) {
+
+        if (!node)
+            return NULL;
+
+        /*  Check whether whole prefix matches the data. */
+        if (nn_node_check_prefix (node, data, size) != node->prefix_len)
+            return NULL;
+        data += node->prefix_len;
+        size -= node->prefix_len;
+
+        /*  The whole string was matched. Check whether it's a subscription
+            rather than just a prefix of some other subscription. */
+        if (!size)
+            return nn_node_has_subscribers (node) ? &node->data : NULL;
+
+        /*  Move to the next node. */
+        tmp = nn_node_next (node, *data);
+        node = tmp ? *tmp : NULL;
+        ++data;
+        --size;
+    }
+}
+
+void nn_trie_match_all (struct nn_trie *self, const uint8_t *data,
+    size_t size, nn_trie_match_fn *fn, void *arg)
+{
+    struct nn_trie_node *node;
+    struct nn_trie_node **tmp;
+
+    node = self->root;
+    while (1) {
+
+        if (!node)
+            return;
+
+        if (nn_node_check_prefix (node, data, size) != node->prefix_len)
+            return;
+        data += node->prefix_len;
+        size -= node->prefix_len;
+
+        /*  Unlike nn_trie_match, continue the traversal when a matching
+            subscription is found. Longer subscriptions may match as well. */
+        if (nn_node_has_subscribers (node))
+            fn (node->data, arg);
+
+        if (!size)
+            return;
+        tmp = nn_node_next (node, *data);
+        node = tmp ? *tmp : NULL;
+        ++data;
+        --size;
+    }
+}
+
 int nn_trie_unsubscribe (struct nn_trie *self, const uint8_t *data, size_t size)
 {
-    return nn_node_unsubscribe (&self->root, data, size);
+    return nn_node_unsubscribe (self, &self->root, data, size);
 }
 
-static int nn_node_unsubscribe (struct nn_trie_node **self,
-    const uint8_t *data, size_t size)
+static int nn_node_unsubscribe (struct nn_trie *trie,
+    struct nn_trie_node **self, const uint8_t *data, size_t size)
 {
+    int rc;
     int i;
+    int children;
     int j;
     int index;
     int new_min;
@@ -486,6 +963,10 @@ static int nn_node_unsubscribe (struct nn_trie_node **self,
     struct nn_trie_node *new_node;
     struct nn_trie_node *ch2;
 
+    /*  Empty trie. The subscription doesn't exist. */
+    if (nn_slow (!*self))
+        return -EINVAL;
+
     if (!size)
         goto found;
 
@@ -502,14 +983,15 @@ static int nn_node_unsubscribe (struct nn_trie_node **self,
 
     /*  Move to the next node. */
     ch = nn_node_next (*self, *data);
-    if (!ch)
+    if (!ch || !*ch)
         return 0; /*  TODO: This should be an error. */
 
     /*  Recursive traversal of the trie happens here. If the subscription
         wasn't really removed, nothing have changed in the trie and
         no additional pruning is needed. */
-    if (nn_node_unsubscribe (ch, data + 1, size - 1) == 0)
-        return 0;
+    rc = nn_node_unsubscribe (trie, ch, data + 1, size - 1);
+    if (rc != 1)
+        return rc;
 
     /*  Subscription removal is already done. Now we are going to compact
         the trie. However, if the following node remains in place, there's
@@ -536,25 +1018,25 @@ static int nn_node_unsubscribe (struct nn_trie_node **self,
             nn_node_child (*self, index + 1),
             ((*self)->type - index - 1) * sizeof (struct nn_trie_node*));
         --(*self)->type;
-        *self = nn_realloc (*self, sizeof (struct nn_trie_node) +
-            ((*self)->type * sizeof (struct nn_trie_node*)));
-        assert (*self);
-        
+        *self = nn_trie_realloc (trie, *self, (*self)->type + 1,
+            (*self)->type);
+
         /*  If there are no more children and no refcount, we can delete
             the node altogether. */
         if (!(*self)->type && !nn_node_has_subscribers (*self)) {
-            nn_free (*self);
+            nn_node_free (trie, *self, 0);
             *self = NULL;
             return 1;
         }
 
         /*  Try to merge the node with the following node. */
-        *self = nn_node_compact (*self);
+        *self = nn_node_compact (trie, *self);
 
         return 1;
     }
 
     /*  Dense array. */
+    children = (*self)->u.dense.max - (*self)->u.dense.min + 1;
 
     /*  In this case the array stays dense. We have to adjust the limits of
         the array, if appropriate. */
@@ -573,10 +1055,8 @@ static int nn_node_unsubscribe (struct nn_trie_node **self,
                  sizeof (struct nn_trie_node*));
              (*self)->u.dense.min = new_min;
              --(*self)->u.dense.nbr;
-             *self = nn_realloc (*self, sizeof (struct nn_trie_node) +
-                 ((*self)->u.dense.max - new_min + 1) *
-                 sizeof (struct nn_trie_node*));
-             assert (*self);
+             *self = nn_trie_realloc (trie, *self, children,
+                 (*self)->u.dense.max - new_min + 1);
              return 1;
         }
 
@@ -588,10 +1068,8 @@ static int nn_node_unsubscribe (struct nn_trie_node **self,
                      break;
              (*self)->u.dense.max = i + (*self)->u.dense.min;
              --(*self)->u.dense.nbr;
-             *self = nn_realloc (*self, sizeof (struct nn_trie_node) +
-                 ((*self)->u.dense.max - (*self)->u.dense.min + 1) *
-                 sizeof (struct nn_trie_node*));
-             assert (*self);
+             *self = nn_trie_realloc (trie, *self, children,
+                 (*self)->u.dense.max - (*self)->u.dense.min + 1);
              return 1;
         }
 
@@ -602,12 +1080,11 @@ static int nn_node_unsubscribe (struct nn_trie_node **self,
 
     /*  Convert dense array into sparse array. */
     {
-        new_node = nn_alloc (sizeof (struct nn_trie_node) +
-            NN_TRIE_SPARSE_MAX * sizeof (struct nn_trie_node*), "trie node");
-        assert (new_node);
-        new_node->refcount = 0;
+        new_node = nn_trie_alloc (trie, NN_TRIE_SPARSE_MAX);
+        new_node->refcount = (*self)->refcount;
+        new_node->data = (*self)->data;
         new_node->prefix_len = (*self)->prefix_len;
-        memcpy (new_node->prefix, (*self)->prefix, new_node->prefix_len);
+        memcpy (new_node->prefix, (*self)->prefix, NN_TRIE_PREFIX_INLINE);
         new_node->type = NN_TRIE_SPARSE_MAX;
         j = 0;
         for (i = 0; i != (*self)->u.dense.max - (*self)->u.dense.min + 1;
@@ -620,7 +1097,7 @@ static int nn_node_unsubscribe (struct nn_trie_node **self,
             }
         }
         assert (j == NN_TRIE_SPARSE_MAX);
-        nn_free (*self);
+        nn_trie_free (trie, *self, children);
         *self = new_node;
         return 1;
     }
@@ -642,13 +1119,13 @@ found:
 
         /*  If there are no children, we can delete the node altogether. */
         if (!(*self)->type) {
-            nn_free (*self);
+            nn_node_free (trie, *self, 0);
             *self = NULL;
             return 1;
         }
 
         /*  Try to merge the node with the following node. */
-        *self = nn_node_compact (*self);
+        *self = nn_node_compact (trie, *self);
         return 1;
     }
 
@@ -29,7 +29,11 @@
 /*  This class implements highly memory-efficient patricia trie. */
 
 /* Maximum length of the prefix. */
-#define NN_TRIE_PREFIX_MAX 10
+#define NN_TRIE_PREFIX_MAX 255
+
+/* Prefixes up to this length are stored directly in the node. Longer ones are
+   stored out of line and the node holds a pointer to them instead. */
+#define NN_TRIE_PREFIX_INLINE 10
 
 /* Maximum number of children in the sparse mode. */
 #define NN_TRIE_SPARSE_MAX 8
@@ -43,6 +47,9 @@
     including the prefix in that node. */
 struct nn_trie_node
 {
+    /*  User data associated with the subscription, see nn_trie_data. */
+    void *data;
+
     /*  Number of subscriptions to the given string. */
     uint32_t refcount;
 
@@ -53,9 +60,13 @@ struct nn_trie_node
     /*  The node adds more characters to the string, compared to the parent
         node. If there is only a single character added, it's represented
         directly in the child array. If there's more than one character added,
-        all but the last one are stored as a 'prefix'. */
+        all but the last one are stored as a 'prefix'. If the prefix is longer
+        than NN_TRIE_PREFIX_INLINE, the 'prefix' array holds pointer to
+        the actual prefix allocated from the trie's arena. That way long
+        common prefixes of the subscriptions don't have to be split into
+        chains of nodes. */
     uint8_t prefix_len;
-    uint8_t prefix [NN_TRIE_PREFIX_MAX];
+    uint8_t prefix [NN_TRIE_PREFIX_INLINE];
 
     /*  The array of characters pointing to individual children of the node.
         Actual pointers to child nodes are stored in the memory following
@@ -84,11 +95,31 @@ struct nn_trie_node
 };
 /*  The structure is followed by the array of pointers to children. */
 
+/*  Number of node size classes. Nodes of class 0 have no children, nodes of
+    class N have space for 2^(N-1) children. */
+#define NN_TRIE_CLASSES 10
+
+/*  Size of the blocks of memory the nodes are carved from. */
+#define NN_TRIE_ARENA_SIZE 65536
+
 struct nn_trie {
 
     /*  The root node of the trie (representing the empty subscription). */
     struct nn_trie_node *root;
 
+    /*  The nodes are not allocated one by one. Instead, they are carved from
+        large blocks of memory, so that the nodes visited during a traversal
+        are likely to share cache lines and pages. The blocks are linked
+        through their first pointer and are returned to the system only when
+        the trie is terminated. 'pos' and 'end' delimit the unused part of
+        the most recent block. */
+    void *blocks;
+    uint8_t *pos;
+    uint8_t *end;
+
+    /*  Nodes that were deallocated, one list per size class. The lists are
+        linked through the 'data' field of the nodes. */
+    struct nn_trie_node *free [NN_TRIE_CLASSES];
 };
 
 /*  Initialise an empty trie. */
@@ -102,6 +133,15 @@ void nn_trie_term (struct nn_trie *self);
     0 is returned. */
 int nn_trie_subscribe (struct nn_trie *self, const uint8_t *data, size_t size);
 
+/*  Add 'count' strings, sorted in ascending order of their bytes, to an empty
+    trie. The trie is the same as if the strings were subscribed to one by
+    one, but it's built in a single pass, each node being allocated once
+    at its final size and the nodes being laid out in the order of
+    the traversal. Returns -EINVAL if the strings are not sorted or
+    the trie is not empty, in which case the trie is left untouched. */
+int nn_trie_build (struct nn_trie *self, const uint8_t **data,
+    const size_t *sizes, size_t count);
+
 /*  Remove the string from the trie. If the string was actually removed,
     1 is returned. If reference count was decremented without falling to zero,
     0 is returned. */
@@ -112,6 +152,33 @@ int nn_trie_unsubscribe (struct nn_trie *self, const uint8_t *data,
     it returns 0. */
 int nn_trie_match (struct nn_trie *self, const uint8_t *data, size_t size);
 
+/*  Same as nn_trie_match, except that in case of a match the length of
+    the shortest subscription matching the string is stored in 'len'. */
+int nn_trie_match_len (struct nn_trie *self, const uint8_t *data,
+    size_t size, size_t *len);
+
+/*  Returns pointer to the user data associated with the string, or NULL if
+    there's no subscription to the string. The user data are NULL when
+    the subscription is created and they must be set back to NULL before
+    the last reference to the subscription is removed. */
+void **nn_trie_data (struct nn_trie *self, const uint8_t *data, size_t size);
+
+/*  Invokes 'fn' with the user data of each subscription matching the supplied
+    string, i.e. each subscription that is a prefix of the string. The string
+    is traversed only once, irrespective of the number of subscriptions. */
+typedef void (nn_trie_match_fn) (void *data, void *arg);
+void nn_trie_match_all (struct nn_trie *self, const uint8_t *data,
+    size_t size, nn_trie_match_fn *fn, void *arg);
+
+/*  Invokes 'fn' for each string in the trie, irrespective of its reference
+    count. The trie must not be modified while it's being walked. */
+typedef void (nn_trie_walk_fn) (const uint8_t *data, size_t size, void *arg);
+void nn_trie_walk (struct nn_trie *self, nn_trie_walk_fn *fn, void *arg);
+
+/*  Retrieves the number of nodes in the trie and the amount of memory,
+    in bytes, allocated to hold them. */
+void nn_trie_stats (struct nn_trie *self, size_t *nodes, size_t *bytes);
+
 /*  Debugging interface. */
 void nn_trie_dump (struct nn_trie *self);
 
@@ -32,6 +32,7 @@
 #include "../../utils/chunkref.h"
 #include "../../utils/wire.h"
 #include "../../utils/list.h"
+#include "../../utils/replycache.h"
 
 #include <stddef.h>
 #include <stdint.h>
@@ -39,22 +40,48 @@
 
 #define NN_REP_INPROGRESS 1
 
-struct nn_rep {
-    struct nn_xrep xrep;
+/*  State of processing of a single request. The socket has one, each context
+    open on the socket has its own. While a request is being processed, its
+    backtrace and trace context are kept to be attached to the reply. */
+struct nn_rep_ctx {
     uint32_t flags;
     struct nn_chunkref backtrace;
+    struct nn_chunkref trace;
+};
+
+struct nn_rep {
+    struct nn_xrep xrep;
+    struct nn_rep_ctx ctx;
+
+    /*  Requests received lately, see NN_REP_DEDUP. */
+    struct nn_replycache cache;
 };
 
 /*  Private functions. */
 static int nn_rep_init (struct nn_rep *self,
     const struct nn_sockbase_vfptr *vfptr);
 static void nn_rep_term (struct nn_rep *self);
+static int nn_rep_dosend (struct nn_rep *self, struct nn_rep_ctx *ctx,
+    struct nn_msg *msg);
+static int nn_rep_dorecv (struct nn_rep *self, struct nn_rep_ctx *ctx,
+    struct nn_msg *msg);
+static void nn_rep_cancel (struct nn_rep *self, struct nn_rep_ctx *ctx);
 
 /*  Implementation of nn_sockbase's virtual functions. */
 static void nn_rep_destroy (struct nn_sockbase *self);
 static int nn_rep_events (struct nn_sockbase *self);
 static int nn_rep_send (struct nn_sockbase *self, struct nn_msg *msg);
 static int nn_rep_recv (struct nn_sockbase *self, struct nn_msg *msg);
+static int nn_rep_setopt (struct nn_sockbase *self, int level, int option,
+    const void *optval, size_t optvallen);
+static int nn_rep_getopt (struct nn_sockbase *self, int level, int option,
+    void *optval, size_t *optvallen);
+static int nn_rep_ctxopen (struct nn_sockbase *self, void **ctx);
+static void nn_rep_ctxclose (struct nn_sockbase *self, void *ctx);
+static int nn_rep_ctxsend (struct nn_sockbase *self, void *ctx,
+    struct nn_msg *msg);
+static int nn_rep_ctxrecv (struct nn_sockbase *self, void *ctx,
+    struct nn_msg *msg);
 
 static const struct nn_sockbase_vfptr nn_rep_sockbase_vfptr = {
     0,
@@ -67,8 +94,12 @@ static const struct nn_sockbase_vfptr nn_rep_sockbase_vfptr = {
     nn_rep_events,
     nn_rep_send,
     nn_rep_recv,
-    nn_xrep_setopt,
-    nn_xrep_getopt
+    nn_rep_setopt,
+    nn_rep_getopt,
+    nn_rep_ctxopen,
+    nn_rep_ctxclose,
+    nn_rep_ctxsend,
+    nn_rep_ctxrecv
 };
 
 static int nn_rep_init (struct nn_rep *self,
@@ -79,15 +110,16 @@ static int nn_rep_init (struct nn_rep *self,
     rc = nn_xrep_init (&self->xrep, vfptr);
     if (rc < 0)
         return rc;
-    self->flags = 0;
+    self->ctx.flags = 0;
+    nn_replycache_init (&self->cache);
 
     return 0;
 }
 
 static void nn_rep_term (struct nn_rep *self)
 {
-    if (self->flags & NN_REP_INPROGRESS)
-        nn_chunkref_term (&self->backtrace);
+    nn_rep_cancel (self, &self->ctx);
+    nn_replycache_term (&self->cache);
     nn_xrep_term (&self->xrep);
 }
 
@@ -108,63 +140,193 @@ static int nn_rep_events (struct nn_sockbase *self)
 
     rep = nn_cont (self, struct nn_rep, xrep.sockbase);
     events = nn_xrep_events (&rep->xrep.sockbase);
-    if (!(rep->flags & NN_REP_INPROGRESS))
+    if (!(rep->ctx.flags & NN_REP_INPROGRESS))
         events &= ~NN_SOCKBASE_EVENT_OUT;
     return events;
 }
 
 static int nn_rep_send (struct nn_sockbase *self, struct nn_msg *msg)
 {
-    int rc;
     struct nn_rep *rep;
 
     rep = nn_cont (self, struct nn_rep, xrep.sockbase);
+    return nn_rep_dosend (rep, &rep->ctx, msg);
+}
+
+static int nn_rep_recv (struct nn_sockbase *self, struct nn_msg *msg)
+{
+    struct nn_rep *rep;
+
+    rep = nn_cont (self, struct nn_rep, xrep.sockbase);
+    return nn_rep_dorecv (rep, &rep->ctx, msg);
+}
+
+static int nn_rep_setopt (struct nn_sockbase *self, int level, int option,
+    const void *optval, size_t optvallen)
+{
+    struct nn_rep *rep;
+
+    rep = nn_cont (self, struct nn_rep, xrep.sockbase);
+
+    if (level == NN_REP && option == NN_REP_DEDUP) {
+        if (nn_slow (optvallen != sizeof (int) || *(int*) optval < 0))
+            return -EINVAL;
+        nn_replycache_resize (&rep->cache, *(int*) optval);
+        return 0;
+    }
+
+    return nn_xrep_setopt (self, level, option, optval, optvallen);
+}
+
+static int nn_rep_getopt (struct nn_sockbase *self, int level, int option,
+    void *optval, size_t *optvallen)
+{
+    struct nn_rep *rep;
+
+    rep = nn_cont (self, struct nn_rep, xrep.sockbase);
+
+    if (level == NN_REP && option == NN_REP_DEDUP) {
+        if (nn_slow (*optvallen < sizeof (int)))
+            return -EINVAL;
+        *(int*) optval = rep->cache.capacity;
+        *optvallen = sizeof (int);
+        return 0;
+    }
+
+    return nn_xrep_getopt (self, level, option, optval, optvallen);
+}
+
+static int nn_rep_ctxopen (struct nn_sockbase *self, void **ctx)
+{
+    struct nn_rep_ctx *repctx;
+
+    repctx = nn_alloc (sizeof (struct nn_rep_ctx), "context (rep)");
+    alloc_assert (repctx);
+    repctx->flags = 0;
+    *ctx = repctx;
+
+    return 0;
+}
+
+static void nn_rep_ctxclose (struct nn_sockbase *self, void *ctx)
+{
+    struct nn_rep_ctx *repctx;
+
+    repctx = (struct nn_rep_ctx*) ctx;
+    nn_rep_cancel (nn_cont (self, struct nn_rep, xrep.sockbase), repctx);
+    nn_free (repctx);
+}
+
+static int nn_rep_ctxsend (struct nn_sockbase *self, void *ctx,
+    struct nn_msg *msg)
+{
+    return nn_rep_dosend (nn_cont (self, struct nn_rep, xrep.sockbase),
+        (struct nn_rep_ctx*) ctx, msg);
+}
+
+static int nn_rep_ctxrecv (struct nn_sockbase *self, void *ctx,
+    struct nn_msg *msg)
+{
+    return nn_rep_dorecv (nn_cont (self, struct nn_rep, xrep.sockbase),
+        (struct nn_rep_ctx*) ctx, msg);
+}
+
+static int nn_rep_dosend (struct nn_rep *self, struct nn_rep_ctx *ctx,
+    struct nn_msg *msg)
+{
+    int rc;
 
     /*  If no request was received, there's nowhere to send the reply to. */
-    if (nn_slow (!(rep->flags & NN_REP_INPROGRESS)))
+    if (nn_slow (!(ctx->flags & NN_REP_INPROGRESS)))
         return -EFSM;
 
     /*  Move the stored backtrace into the message header. */
     nn_assert (nn_chunkref_size (&msg->hdr) == 0);
     nn_chunkref_term (&msg->hdr);
-    nn_chunkref_mv (&msg->hdr, &rep->backtrace);
-    rep->flags &= ~NN_REP_INPROGRESS;
+    nn_chunkref_mv (&msg->hdr, &ctx->backtrace);
+    ctx->flags &= ~NN_REP_INPROGRESS;
+
+    /*  Unless the user has set a trace context of their own, the reply
+        carries the one of the request. */
+    if (!nn_chunkref_size (&msg->trace)) {
+        nn_chunkref_term (&msg->trace);
+        nn_chunkref_mv (&msg->trace, &ctx->trace);
+    }
+    else
+        nn_chunkref_term (&ctx->trace);
+
+    /*  Keep a copy of the reply in case the request is resent. */
+    if (nn_replycache_active (&self->cache))
+        nn_replycache_done (&self->cache, &msg->hdr, msg);
 
     /*  Send the reply. If it cannot be sent because of pushback,
         drop it silently. */
-    rc = nn_xrep_send (&rep->xrep.sockbase, msg);
+    rc = nn_xrep_send (&self->xrep.sockbase, msg);
     errnum_assert (rc == 0 || rc == -EAGAIN, -rc);
 
     return 0;
 }
 
-static int nn_rep_recv (struct nn_sockbase *self, struct nn_msg *msg)
+static int nn_rep_dorecv (struct nn_rep *self, struct nn_rep_ctx *ctx,
+    struct nn_msg *msg)
 {
     int rc;
-    struct nn_rep *rep;
 
-    rep = nn_cont (self, struct nn_rep, xrep.sockbase);
+    struct nn_msg reply;
 
     /*  If a request is already being processed, cancel it. */
-    if (nn_slow (rep->flags & NN_REP_INPROGRESS)) {
-        nn_chunkref_term (&rep->backtrace);
-        rep->flags &= ~NN_REP_INPROGRESS;
+    nn_rep_cancel (self, ctx);
+
+    while (1) {
+
+        /*  Receive the request. */
+        rc = nn_xrep_recv (&self->xrep.sockbase, msg);
+        if (nn_slow (rc == -EAGAIN))
+            return -EAGAIN;
+        errnum_assert (rc == 0, -rc);
+
+        if (nn_fast (!nn_replycache_active (&self->cache)))
+            break;
+
+        /*  A resent request is not passed to the user. If it was answered
+            already, the reply is sent again. If it's still being processed,
+            the reply is yet to come. */
+        switch (nn_replycache_check (&self->cache, &msg->hdr, &reply)) {
+        case NN_REPLYCACHE_NEW:
+            break;
+        case NN_REPLYCACHE_DONE:
+            rc = nn_xrep_send (&self->xrep.sockbase, &reply);
+            errnum_assert (rc == 0 || rc == -EAGAIN, -rc);
+            nn_msg_term (msg);
+            continue;
+        default:
+            nn_msg_term (msg);
+            continue;
+        }
+        break;
     }
 
-    /*  Receive the request. */
-    rc = nn_xrep_recv (&rep->xrep.sockbase, msg);
-    if (nn_slow (rc == -EAGAIN))
-        return -EAGAIN;
-    errnum_assert (rc == 0, -rc);
-
     /*  Store the backtrace. */
-    nn_chunkref_mv (&rep->backtrace, &msg->hdr);
+    nn_chunkref_mv (&ctx->backtrace, &msg->hdr);
     nn_chunkref_init (&msg->hdr, 0);
-    rep->flags |= NN_REP_INPROGRESS;
+    nn_chunkref_cp (&ctx->trace, &msg->trace);
+    ctx->flags |= NN_REP_INPROGRESS;
 
     return 0;
 }
 
+/*  Drops the request being processed, if any. */
+static void nn_rep_cancel (struct nn_rep *self, struct nn_rep_ctx *ctx)
+{
+    if (!(ctx->flags & NN_REP_INPROGRESS))
+        return;
+    if (nn_replycache_active (&self->cache))
+        nn_replycache_cancel (&self->cache, &ctx->backtrace);
+    nn_chunkref_term (&ctx->backtrace);
+    nn_chunkref_term (&ctx->trace);
+    ctx->flags &= ~NN_REP_INPROGRESS;
+}
+
 static int nn_rep_create (struct nn_sockbase **sockbase)
 {
     int rc;
@@ -185,8 +347,7 @@ static int nn_rep_create (struct nn_sockbase **sockbase)
 static struct nn_socktype nn_rep_socktype_struct = {
     AF_SP,
     NN_REP,
-    nn_rep_create,
-    NN_LIST_ITEM_INITIALIZER
+    nn_rep_create
 };
 
 struct nn_socktype *nn_rep_socktype = &nn_rep_socktype_struct;
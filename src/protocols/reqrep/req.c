@@ -32,6 +32,9 @@
 #include "../../utils/random.h"
 #include "../../utils/wire.h"
 #include "../../utils/list.h"
+#include "../../utils/clock.h"
+#include "../../utils/stopwatch.h"
+#include "../../utils/hist.h"
 
 #include <stdint.h>
 #include <stddef.h>
@@ -52,6 +55,45 @@
 /*  Reply was already received, but not yet retrieved by the user. */
 #define NN_REQ_STATE_RECEIVED 3
 
+/*  Maximum number of requests in flight in the pipelined mode. */
+#define NN_REQ_MAX_PIPELINE 65536
+
+/*  Lower bound of the adaptive re-send interval, so that a peer that usually
+    replies within a millisecond isn't flooded with duplicates whenever it
+    takes a bit longer. */
+#define NN_REQ_MIN_ADAPTIVE_IVL 10
+
+/*  Reply latencies are capped at this many milliseconds before being used
+    to compute the adaptive re-send interval to prevent overflows. */
+#define NN_REQ_MAX_LATENCY 0x1000000
+
+/*  A request in the pipelined mode. When it's not in IDLE state, it's in one of
+    the lists of the socket, depending on its state. */
+struct nn_req_entry {
+
+    /*  One of the states defined above. */
+    int state;
+
+    /*  ID of the request. */
+    uint32_t reqid;
+
+    /*  Header supplied by the user along with the request. It's returned
+        as the header of the reply, so that the user can match the replies
+        with the requests. */
+    struct nn_chunkref tag;
+
+    /*  The request while in UNSENT and SENT states, the reply while in RECEIVED
+        state. */
+    struct nn_msg msg;
+
+    /*  Time when the request was sent for the first time and time when it
+        should be re-sent. Valid in SENT state. */
+    struct nn_stopwatch firstsent;
+    uint64_t deadline;
+
+    struct nn_list_item item;
+};
+
 struct nn_req {
 
     /*  The base class. Raw REQ socket. */
@@ -78,14 +120,72 @@ struct nn_req {
     /*  Re-send interval, in milliseconds. */
     int resend_ivl;
 
+    /*  If non-zero, the first re-send happens after this many milliseconds
+        rather than after the re-send interval. See NN_REQ_HEDGE_IVL. */
+    int hedge_ivl;
+
+    /*  If set, the re-send interval adapts to the observed reply latency,
+        with 'resend_ivl' being its upper bound. See NN_REQ_ADAPTIVE_RESEND. */
+    int adaptive;
+
+    /*  Smoothed reply latency scaled by 8 and its mean deviation scaled
+        by 4, both in milliseconds, computed the same way as the round-trip
+        time estimates of TCP's retransmission timer (RFC 6298). The adaptive
+        re-send interval is the latency plus four times the deviation.
+        'srtt' is -1 until the first reply arrives. */
+    int srtt;
+    int rttvar;
+
+    /*  Time when the current request was sent for the first time. Valid in
+        SENT state. */
+    struct nn_stopwatch firstsent;
+
+    /*  Reply latencies, in microseconds. See NN_REQ_LATENCY. */
+    struct nn_hist latency;
+
     /*  Timer used to wait till request resending should be done. */
     struct nn_timer resend_timer;
+
+    /*  Maximum number of requests in flight, or zero if the socket is not
+        pipelined. See NN_REQ_PIPELINE. In the pipelined mode, the fields
+        above, except for the request ID and the re-send interval, are not
+        used. */
+    int pipeline;
+
+    /*  Requests in flight, indexed by the low bits of the request ID.
+        The size of the table is a power of two not smaller than 'pipeline'.
+        Request IDs that would map to occupied entries are skipped. */
+    struct nn_req_entry *entries;
+    uint32_t mask;
+    int count;
+
+    /*  Requests waiting for a pipe to be sent to, requests waiting for
+        the reply ordered by their re-send deadlines and requests with
+        replies not yet retrieved by the user, in the order of arrival.
+        The re-send interval is mostly the same for all the requests, so
+        keeping the 'sent' list ordered rarely requires more than appending
+        the requests at its end. */
+    struct nn_list unsent;
+    struct nn_list sent;
+    struct nn_list received;
 };
 
 /*  Private functions. */
 static int nn_req_init (struct nn_req *self,
     const struct nn_sockbase_vfptr *vfptr);
 static void nn_req_term (struct nn_req *self);
+static void nn_req_cancel (struct nn_req *self);
+static void nn_req_setpipeline (struct nn_req *self, int pipeline);
+static int nn_req_send_pipelined (struct nn_req *self, struct nn_msg *msg);
+static int nn_req_recv_pipelined (struct nn_req *self, struct nn_msg *msg);
+static void nn_req_reply_pipelined (struct nn_req *self, struct nn_msg *msg);
+static void nn_req_sendentry (struct nn_req *self, struct nn_req_entry *entry);
+static void nn_req_settimer (struct nn_req *self);
+static void nn_req_timeout_pipelined (struct nn_req *self);
+static void nn_req_schedule (struct nn_req *self, struct nn_req_entry *entry);
+static int nn_req_ivl (struct nn_req *self);
+static int nn_req_firstivl (struct nn_req *self);
+static void nn_req_latency (struct nn_req *self, struct nn_stopwatch *sent);
 
 /*  Implementation of nn_sockbase's virtual functions. */
 static void nn_req_destroy (struct nn_sockbase *self);
@@ -143,22 +243,99 @@ static int nn_req_init (struct nn_req *self,
 
     self->state = NN_REQ_STATE_IDLE;
     self->resend_ivl = NN_REQ_DEFAULT_RESEND_IVL;
+    self->hedge_ivl = 0;
+    self->adaptive = 0;
+    self->srtt = -1;
+    self->rttvar = 0;
+    nn_hist_init (&self->latency);
     nn_timer_init (&self->resend_timer, &self->sink,
         nn_sockbase_getcp (&self->xreq.sockbase));
+    self->pipeline = 0;
+    self->entries = NULL;
+    self->mask = 0;
+    self->count = 0;
+    nn_list_init (&self->unsent);
+    nn_list_init (&self->sent);
+    nn_list_init (&self->received);
 
     return 0;
 }
 
 static void nn_req_term (struct nn_req *self)
 {
-    if (self->state == NN_REQ_STATE_UNSENT || self->state == NN_REQ_STATE_SENT)
-        nn_msg_term (&self->request);
-    if (self->state == NN_REQ_STATE_RECEIVED)
-        nn_msg_term (&self->reply);
+    nn_req_setpipeline (self, 0);
+    nn_list_term (&self->received);
+    nn_list_term (&self->sent);
+    nn_list_term (&self->unsent);
     nn_timer_term (&self->resend_timer);
+    nn_hist_term (&self->latency);
     nn_xreq_term (&self->xreq);
 }
 
+static void nn_req_cancel (struct nn_req *self)
+{
+    uint32_t i;
+    struct nn_req_entry *entry;
+
+    nn_timer_stop (&self->resend_timer);
+
+    if (!self->pipeline) {
+        if (self->state == NN_REQ_STATE_UNSENT ||
+              self->state == NN_REQ_STATE_SENT)
+            nn_msg_term (&self->request);
+        if (self->state == NN_REQ_STATE_RECEIVED)
+            nn_msg_term (&self->reply);
+        self->state = NN_REQ_STATE_IDLE;
+        return;
+    }
+
+    for (i = 0; i <= self->mask; ++i) {
+        entry = &self->entries [i];
+        if (entry->state == NN_REQ_STATE_IDLE)
+            continue;
+        if (entry->state == NN_REQ_STATE_UNSENT)
+            nn_list_erase (&self->unsent, &entry->item);
+        else if (entry->state == NN_REQ_STATE_SENT)
+            nn_list_erase (&self->sent, &entry->item);
+        else
+            nn_list_erase (&self->received, &entry->item);
+        nn_list_item_term (&entry->item);
+        nn_chunkref_term (&entry->tag);
+        nn_msg_term (&entry->msg);
+        entry->state = NN_REQ_STATE_IDLE;
+    }
+    self->count = 0;
+}
+
+static void nn_req_setpipeline (struct nn_req *self, int pipeline)
+{
+    uint32_t size;
+    uint32_t i;
+
+    /*  Requests in progress are cancelled, same as when a new request is sent
+        in the non-pipelined mode. */
+    nn_req_cancel (self);
+    if (self->entries) {
+        nn_free (self->entries);
+        self->entries = NULL;
+        self->mask = 0;
+    }
+
+    self->pipeline = pipeline;
+    if (!pipeline)
+        return;
+
+    size = 1;
+    while (size < (uint32_t) pipeline)
+        size <<= 1;
+    self->entries = nn_alloc (size * sizeof (struct nn_req_entry),
+        "request table");
+    alloc_assert (self->entries);
+    for (i = 0; i != size; ++i)
+        self->entries [i].state = NN_REQ_STATE_IDLE;
+    self->mask = size - 1;
+}
+
 static void nn_req_destroy (struct nn_sockbase *self)
 {
     struct nn_req *req;
@@ -188,6 +365,11 @@ static void nn_req_in (struct nn_sockbase *self, struct nn_pipe *pipe)
             return;
         errnum_assert (rc == 0, -rc);
 
+        if (req->pipeline) {
+            nn_req_reply_pipelined (req, &req->reply);
+            continue;
+        }
+
         /*  No request was sent. Getting a reply doesn't make sense. */
         if (nn_slow (req->state != NN_REQ_STATE_SENT)) {
             nn_msg_term (&req->reply);
@@ -216,6 +398,7 @@ static void nn_req_in (struct nn_sockbase *self, struct nn_pipe *pipe)
         nn_chunkref_init (&req->reply.hdr, 0);
 
         /*  Swtich to RECEIVED state. */
+        nn_req_latency (req, &req->firstsent);
         nn_timer_stop (&req->resend_timer);
         nn_msg_term (&req->request);
         req->state = NN_REQ_STATE_RECEIVED;
@@ -229,17 +412,38 @@ static void nn_req_out (struct nn_sockbase *self, struct nn_pipe *pipe)
     int rc;
     struct nn_req *req;
     struct nn_msg msg;
+    struct nn_req_entry *entry;
 
     req = nn_cont (self, struct nn_req, xreq.sockbase);
 
     /*  Add the pipe to the underlying raw socket. */
     nn_xreq_out (&req->xreq.sockbase, pipe);
 
+    /*  Send the requests that were not sent yet, while it's possible. */
+    if (req->pipeline) {
+        while (!nn_list_empty (&req->unsent)) {
+            entry = nn_cont (nn_list_begin (&req->unsent),
+                struct nn_req_entry, item);
+            nn_msg_cp (&msg, &entry->msg);
+            rc = nn_xreq_send (&req->xreq.sockbase, &msg);
+            errnum_assert (rc == 0 || rc == -EAGAIN, -rc);
+            if (rc == -EAGAIN) {
+                nn_msg_term (&msg);
+                break;
+            }
+            nn_list_erase (&req->unsent, &entry->item);
+            nn_req_sendentry (req, entry);
+        }
+        return;
+    }
+
     /*  If the current request was not sent yet, send it now. */
     if (req->state == NN_REQ_STATE_UNSENT) {
         nn_msg_cp (&msg, &req->request);
         rc = nn_xreq_send (&req->xreq.sockbase, &msg);
         errnum_assert (rc == 0, -rc);
+        nn_stopwatch_init (&req->firstsent);
+        nn_timer_start (&req->resend_timer, nn_req_firstivl (req));
         req->state = NN_REQ_STATE_SENT;
     }
 }
@@ -250,6 +454,12 @@ static int nn_req_events (struct nn_sockbase *self)
 
     req = nn_cont (self, struct nn_req, xreq.sockbase);
 
+    /*  In the pipelined mode, new request can be sent unless the maximum
+        number of requests is already in flight. */
+    if (req->pipeline)
+        return (nn_list_empty (&req->received) ? 0 : NN_SOCKBASE_EVENT_IN) |
+            (req->count < req->pipeline ? NN_SOCKBASE_EVENT_OUT : 0);
+
     /*  OUT is signalled all the time because sending a request while
         another one is being processed cancels the old one. */
     if (req->state == NN_REQ_STATE_RECEIVED)
@@ -264,16 +474,12 @@ static int nn_req_send (struct nn_sockbase *self, struct nn_msg *msg)
 
     req = nn_cont (self, struct nn_req, xreq.sockbase);
 
+    if (req->pipeline)
+        return nn_req_send_pipelined (req, msg);
+
     /*  If there's a request in progress, cancel it. */
-    if (nn_slow (req->state != NN_REQ_STATE_IDLE)) {
-        if (req->state == NN_REQ_STATE_UNSENT ||
-              req->state == NN_REQ_STATE_SENT)
-            nn_msg_term (&req->request);
-        if (req->state == NN_REQ_STATE_RECEIVED)
-            nn_msg_term (&req->reply);
-        nn_timer_term (&req->resend_timer);
-        req->state = NN_REQ_STATE_IDLE;
-    }
+    if (nn_slow (req->state != NN_REQ_STATE_IDLE))
+        nn_req_cancel (req);
 
     /*  Generate new request ID for the new request and put it into message
         header. The most important bit is set to 1 to indicate that this is
@@ -300,7 +506,8 @@ static int nn_req_send (struct nn_sockbase *self, struct nn_msg *msg)
 
     /*  If the request was successgfully sent set up the re-send timer in case
         it get lost somewhere further out in the topology. */
-    nn_timer_start (&req->resend_timer, req->resend_ivl);
+    nn_stopwatch_init (&req->firstsent);
+    nn_timer_start (&req->resend_timer, nn_req_firstivl (req));
     req->state = NN_REQ_STATE_SENT;
 
     return 0;
@@ -312,6 +519,9 @@ static int nn_req_recv (struct nn_sockbase *self, struct nn_msg *msg)
 
     req = nn_cont (self, struct nn_req, xreq.sockbase);
 
+    if (req->pipeline)
+        return nn_req_recv_pipelined (req, msg);
+
     /*  No request was sent. Waiting for a reply doesn't make sense. */
     if (nn_slow (req->state == NN_REQ_STATE_IDLE))
         return -EFSM;
@@ -344,7 +554,41 @@ static int nn_req_setopt (struct nn_sockbase *self, int level, int option,
         return 0;
     }
 
-    return -ENOPROTOOPT;
+    if (option == NN_REQ_PIPELINE) {
+        if (nn_slow (optvallen != sizeof (int)))
+            return -EINVAL;
+        if (nn_slow (*(int*) optval < 0 ||
+              *(int*) optval > NN_REQ_MAX_PIPELINE))
+            return -EINVAL;
+        nn_req_setpipeline (req, *(int*) optval);
+        return 0;
+    }
+
+    if (option == NN_REQ_ADAPTIVE_RESEND) {
+        if (nn_slow (optvallen != sizeof (int)))
+            return -EINVAL;
+        if (nn_slow (*(int*) optval != 0 && *(int*) optval != 1))
+            return -EINVAL;
+        req->adaptive = *(int*) optval;
+        return 0;
+    }
+
+    if (option == NN_REQ_HEDGE_IVL) {
+        if (nn_slow (optvallen != sizeof (int)))
+            return -EINVAL;
+        if (nn_slow (*(int*) optval < 0))
+            return -EINVAL;
+        req->hedge_ivl = *(int*) optval;
+        return 0;
+    }
+
+    /*  Setting the option, whatever the value, drops the statistics. */
+    if (option == NN_REQ_LATENCY) {
+        nn_hist_reset (&req->latency);
+        return 0;
+    }
+
+    return nn_xreq_setopt (self, level, option, optval, optvallen);
 }
 
 static int nn_req_getopt (struct nn_sockbase *self, int level, int option,
@@ -365,7 +609,39 @@ static int nn_req_getopt (struct nn_sockbase *self, int level, int option,
         return 0;
     }
 
-    return -ENOPROTOOPT;
+    if (option == NN_REQ_PIPELINE) {
+        if (nn_slow (*optvallen < sizeof (int)))
+            return -EINVAL;
+        *(int*) optval = req->pipeline;
+        *optvallen = sizeof (int);
+        return 0;
+    }
+
+    if (option == NN_REQ_ADAPTIVE_RESEND) {
+        if (nn_slow (*optvallen < sizeof (int)))
+            return -EINVAL;
+        *(int*) optval = req->adaptive;
+        *optvallen = sizeof (int);
+        return 0;
+    }
+
+    if (option == NN_REQ_HEDGE_IVL) {
+        if (nn_slow (*optvallen < sizeof (int)))
+            return -EINVAL;
+        *(int*) optval = req->hedge_ivl;
+        *optvallen = sizeof (int);
+        return 0;
+    }
+
+    if (option == NN_REQ_LATENCY) {
+        if (nn_slow (*optvallen < sizeof (struct nn_latency_stats)))
+            return -EINVAL;
+        nn_hist_stats (&req->latency, (struct nn_latency_stats*) optval);
+        *optvallen = sizeof (struct nn_latency_stats);
+        return 0;
+    }
+
+    return nn_xreq_getopt (self, level, option, optval, optvallen);
 }
 
 static void nn_req_timeout (const struct nn_cp_sink **self,
@@ -376,6 +652,12 @@ static void nn_req_timeout (const struct nn_cp_sink **self,
     struct nn_msg msg;
 
     req = nn_cont (self, struct nn_req, sink);
+
+    if (req->pipeline) {
+        nn_req_timeout_pipelined (req);
+        return;
+    }
+
     nn_assert (req->state == NN_REQ_STATE_SENT);
 
     /*  Re-send the request. If it cannot be sent, just drop it. */
@@ -386,7 +668,237 @@ static void nn_req_timeout (const struct nn_cp_sink **self,
         nn_msg_term (&msg);
 
     /*  Set up the next re-send timer. */
-    nn_timer_start (&req->resend_timer, req->resend_ivl);
+    nn_timer_start (&req->resend_timer, nn_req_ivl (req));
+}
+
+static int nn_req_send_pipelined (struct nn_req *self, struct nn_msg *msg)
+{
+    int rc;
+    struct nn_req_entry *entry;
+    struct nn_msg copy;
+
+    if (nn_slow (self->count >= self->pipeline))
+        return -EAGAIN;
+
+    /*  Find an unused request ID. As there are fewer requests in flight than
+        there are entries in the table, there's always one. */
+    do {
+        ++self->reqid;
+        entry = &self->entries [self->reqid & self->mask];
+    } while (entry->state != NN_REQ_STATE_IDLE);
+
+    /*  The header supplied by the user is kept aside and replaced by
+        the request ID. */
+    entry->reqid = self->reqid;
+    nn_chunkref_mv (&entry->tag, &msg->hdr);
+    nn_chunkref_init (&msg->hdr, 4);
+    nn_putl (nn_chunkref_data (&msg->hdr), self->reqid | 0x80000000);
+    nn_msg_mv (&entry->msg, msg);
+    nn_list_item_init (&entry->item);
+    ++self->count;
+
+    /*  If the request can't be sent straight away, it will be sent as soon as
+        an outbound pipe becomes available. */
+    nn_msg_cp (&copy, &entry->msg);
+    rc = nn_xreq_send (&self->xreq.sockbase, &copy);
+    errnum_assert (rc == 0 || rc == -EAGAIN, -rc);
+    if (nn_slow (rc == -EAGAIN)) {
+        nn_msg_term (&copy);
+        entry->state = NN_REQ_STATE_UNSENT;
+        nn_list_insert (&self->unsent, &entry->item,
+            nn_list_end (&self->unsent));
+        return 0;
+    }
+    nn_req_sendentry (self, entry);
+
+    return 0;
+}
+
+static int nn_req_recv_pipelined (struct nn_req *self, struct nn_msg *msg)
+{
+    struct nn_list_item *it;
+    struct nn_req_entry *entry;
+
+    if (nn_list_empty (&self->received))
+        return self->count ? -EAGAIN : -EFSM;
+
+    /*  Replies are passed to the user in the order of arrival, each with
+        the header the user supplied along with the request. */
+    it = nn_list_begin (&self->received);
+    entry = nn_cont (it, struct nn_req_entry, item);
+    nn_list_erase (&self->received, it);
+    nn_list_item_term (&entry->item);
+    nn_msg_mv (msg, &entry->msg);
+    nn_chunkref_term (&msg->hdr);
+    nn_chunkref_mv (&msg->hdr, &entry->tag);
+    entry->state = NN_REQ_STATE_IDLE;
+    --self->count;
+
+    return 0;
+}
+
+static void nn_req_reply_pipelined (struct nn_req *self, struct nn_msg *msg)
+{
+    uint32_t reqid;
+    struct nn_req_entry *entry;
+
+    /*  Ignore malformed replies and replies to requests that are not
+        in flight. */
+    if (nn_slow (nn_chunkref_size (&msg->hdr) != sizeof (uint32_t))) {
+        nn_msg_term (msg);
+        return;
+    }
+    reqid = nn_getl (nn_chunkref_data (&msg->hdr));
+    if (nn_slow (!(reqid & 0x80000000))) {
+        nn_msg_term (msg);
+        return;
+    }
+    reqid &= 0x7fffffff;
+    entry = &self->entries [reqid & self->mask];
+    if (nn_slow (entry->state != NN_REQ_STATE_SENT ||
+          (entry->reqid & 0x7fffffff) != reqid)) {
+        nn_msg_term (msg);
+        return;
+    }
+
+    /*  Replace the request by the reply. */
+    nn_req_latency (self, &entry->firstsent);
+    nn_list_erase (&self->sent, &entry->item);
+    nn_msg_term (&entry->msg);
+    nn_msg_mv (&entry->msg, msg);
+    entry->state = NN_REQ_STATE_RECEIVED;
+    nn_list_insert (&self->received, &entry->item,
+        nn_list_end (&self->received));
+    nn_req_settimer (self);
+}
+
+static void nn_req_sendentry (struct nn_req *self, struct nn_req_entry *entry)
+{
+    /*  The request was sent. Schedule its re-sending in case it gets lost
+        somewhere further out in the topology. */
+    entry->state = NN_REQ_STATE_SENT;
+    nn_stopwatch_init (&entry->firstsent);
+    entry->deadline = nn_clock_now (&self->xreq.sockbase.clock) +
+        nn_req_firstivl (self);
+    nn_req_schedule (self, entry);
+    if (nn_list_begin (&self->sent) == &entry->item)
+        nn_req_settimer (self);
+}
+
+static void nn_req_settimer (struct nn_req *self)
+{
+    uint64_t now;
+    struct nn_req_entry *entry;
+
+    /*  The timer is set to the earliest deadline. */
+    if (nn_list_empty (&self->sent)) {
+        nn_timer_stop (&self->resend_timer);
+        return;
+    }
+    entry = nn_cont (nn_list_begin (&self->sent), struct nn_req_entry, item);
+    now = nn_clock_now (&self->xreq.sockbase.clock);
+    nn_timer_start (&self->resend_timer,
+        entry->deadline > now ? (int) (entry->deadline - now) : 0);
+}
+
+static void nn_req_timeout_pipelined (struct nn_req *self)
+{
+    int rc;
+    uint64_t now;
+    struct nn_req_entry *entry;
+    struct nn_req_entry *first;
+    struct nn_msg msg;
+
+    /*  Re-send all the requests whose deadlines have expired. Same as in
+        the non-pipelined mode, if a request can't be re-sent, it's dropped
+        and another attempt is made after the next re-send interval.
+        The re-sent requests are moved behind the expired ones, so stop when
+        the first of them is encountered again. */
+    now = nn_clock_now (&self->xreq.sockbase.clock);
+    first = NULL;
+    while (!nn_list_empty (&self->sent)) {
+        entry = nn_cont (nn_list_begin (&self->sent), struct nn_req_entry,
+            item);
+        if (entry->deadline > now || entry == first)
+            break;
+        if (!first)
+            first = entry;
+        nn_msg_cp (&msg, &entry->msg);
+        rc = nn_xreq_send (&self->xreq.sockbase, &msg);
+        errnum_assert (rc == 0 || rc == -EAGAIN, -rc);
+        if (nn_slow (rc == -EAGAIN))
+            nn_msg_term (&msg);
+        nn_list_erase (&self->sent, &entry->item);
+        entry->deadline = now + nn_req_ivl (self);
+        nn_req_schedule (self, entry);
+    }
+    nn_req_settimer (self);
+}
+
+static void nn_req_schedule (struct nn_req *self, struct nn_req_entry *entry)
+{
+    struct nn_list_item *it;
+    struct nn_list_item *prev;
+
+    /*  Insert the request into the 'sent' list behind all the requests with
+        the same or earlier deadline. Search from the end as that's where
+        the request almost always belongs. */
+    it = nn_list_end (&self->sent);
+    while (1) {
+        prev = nn_list_prev (&self->sent, it);
+        if (!prev || nn_cont (prev, struct nn_req_entry, item)->deadline <=
+              entry->deadline)
+            break;
+        it = prev;
+    }
+    nn_list_insert (&self->sent, &entry->item, it);
+}
+
+static int nn_req_ivl (struct nn_req *self)
+{
+    int ivl;
+
+    if (!self->adaptive || self->srtt < 0)
+        return self->resend_ivl;
+
+    ivl = (self->srtt >> 3) + self->rttvar;
+    if (ivl < NN_REQ_MIN_ADAPTIVE_IVL)
+        ivl = NN_REQ_MIN_ADAPTIVE_IVL;
+    return ivl < self->resend_ivl ? ivl : self->resend_ivl;
+}
+
+static int nn_req_firstivl (struct nn_req *self)
+{
+    int ivl;
+
+    /*  A hedged request is sent again, most likely to a different peer,
+        earlier than it would be re-sent otherwise. */
+    ivl = nn_req_ivl (self);
+    return self->hedge_ivl && self->hedge_ivl < ivl ? self->hedge_ivl : ivl;
+}
+
+static void nn_req_latency (struct nn_req *self, struct nn_stopwatch *sent)
+{
+    uint64_t elapsed;
+    int rtt;
+    int delta;
+
+    elapsed = nn_stopwatch_term (sent);
+    nn_hist_record (&self->latency, elapsed);
+    rtt = elapsed / 1000 > NN_REQ_MAX_LATENCY ? NN_REQ_MAX_LATENCY :
+        (int) (elapsed / 1000);
+
+    if (self->srtt < 0) {
+        self->srtt = rtt << 3;
+        self->rttvar = rtt << 1;
+        return;
+    }
+
+    delta = rtt - (self->srtt >> 3);
+    self->srtt += delta;
+    if (delta < 0)
+        delta = -delta;
+    self->rttvar += delta - (self->rttvar >> 2);
 }
 
 static int nn_req_create (struct nn_sockbase **sockbase)
@@ -409,8 +921,7 @@ static int nn_req_create (struct nn_sockbase **sockbase)
 static struct nn_socktype nn_req_socktype_struct = {
     AF_SP,
     NN_REQ,
-    nn_req_create,
-    NN_LIST_ITEM_INITIALIZER
+    nn_req_create
 };
 
 struct nn_socktype *nn_req_socktype = &nn_req_socktype_struct;
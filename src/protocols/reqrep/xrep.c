@@ -32,11 +32,14 @@
 #include "../../utils/random.h"
 #include "../../utils/wire.h"
 #include "../../utils/list.h"
+#include "../../utils/clock.h"
 
 #include <string.h>
 
 /*  Private functions. */
 static void nn_xrep_destroy (struct nn_sockbase *self);
+static uint64_t nn_xrep_waited (struct nn_xrep *self,
+    struct nn_xrep_data *data, struct nn_msg *msg);
 
 static const struct nn_sockbase_vfptr nn_xrep_sockbase_vfptr = {
     0,
@@ -72,6 +75,7 @@ int nn_xrep_init (struct nn_xrep *self, const struct nn_sockbase_vfptr *vfptr)
 
     nn_hash_init (&self->outpipes);
     nn_fq_init (&self->inpipes);
+    self->maxwait = -1;
 
     return 0;
 }
@@ -108,7 +112,8 @@ int nn_xrep_add (struct nn_sockbase *self, struct nn_pipe *pipe)
     nn_hash_insert (&xrep->outpipes, xrep->next_key & 0x7fffffff,
         &data->outitem);
     ++xrep->next_key;
-    nn_fq_add (&xrep->inpipes, pipe, &data->initem, 8);
+    nn_fq_add (&xrep->inpipes, pipe, &data->initem, nn_pipe_getrcvprio (pipe),
+        self->rcvquantum);
 
     nn_pipe_setdata (pipe, data);
 
@@ -198,14 +203,25 @@ int nn_xrep_recv (struct nn_sockbase *self, struct nn_msg *msg)
     int i;
     void *data;
     size_t sz;
-    struct nn_chunkref ref;
+    uint8_t key [sizeof (uint32_t)];
     struct nn_xrep_data *pipedata;
 
     xrep = nn_cont (self, struct nn_xrep, sockbase);
 
-    rc = nn_fq_recv (&xrep->inpipes, msg, &pipe);
-    if (nn_slow (rc < 0))
-        return rc;
+    /*  Shed the requests that have been waiting for too long. The peers are
+        likely to have given up on them, or will try elsewhere, and serving
+        them would only delay the requests queued behind them. */
+    while (1) {
+        rc = nn_fq_recv (&xrep->inpipes, msg, &pipe);
+        if (nn_slow (rc < 0))
+            return rc;
+        pipedata = nn_pipe_getdata (pipe);
+        if (nn_fast (xrep->maxwait < 0) ||
+              nn_xrep_waited (xrep, pipedata, msg) <= (uint64_t) xrep->maxwait)
+            break;
+        nn_sockbase_shed (&xrep->sockbase, nn_msg_bodysize (msg));
+        nn_msg_term (msg);
+    }
 
     if (!(rc & NN_PIPE_PARSED)) {
 
@@ -229,35 +245,86 @@ int nn_xrep_recv (struct nn_sockbase *self, struct nn_msg *msg)
         }
         ++i;
 
-        /*  Split the header and the body. */
+        /*  Split the header and the body. The header is allocated with
+            space for the pipe key so that the backtrace is copied once. */
         nn_assert (nn_chunkref_size (&msg->hdr) == 0);
         nn_chunkref_term (&msg->hdr);
-        nn_chunkref_init (&msg->hdr, i * sizeof (uint32_t));
-        memcpy (nn_chunkref_data (&msg->hdr), data, i * sizeof (uint32_t));
+        nn_chunkref_init (&msg->hdr, (i + 1) * sizeof (uint32_t));
+        nn_putl (nn_chunkref_data (&msg->hdr), pipedata->outitem.key);
+        memcpy (((uint8_t*) nn_chunkref_data (&msg->hdr)) + sizeof (uint32_t),
+            data, i * sizeof (uint32_t));
         nn_chunkref_trim (&msg->body, i * sizeof (uint32_t));
+        return 0;
     }
 
     /*  Prepend the header by the pipe key. */
-    pipedata = nn_pipe_getdata (pipe);
-    nn_chunkref_init (&ref, nn_chunkref_size (&msg->hdr) + sizeof (uint32_t));
-    nn_putl (nn_chunkref_data (&ref), pipedata->outitem.key);
-    memcpy (((uint8_t*) nn_chunkref_data (&ref)) + sizeof (uint32_t),
-        nn_chunkref_data (&msg->hdr), nn_chunkref_size (&msg->hdr));
-    nn_chunkref_term (&msg->hdr);
-    nn_chunkref_mv (&msg->hdr, &ref);
+    nn_putl (key, pipedata->outitem.key);
+    nn_chunkref_push (&msg->hdr, key, sizeof (key));
 
     return 0;
 }
 
+/*  Returns the time, in milliseconds, the message has been waiting for.
+    The time the pipe became readable is an upper bound for messages queued
+    by the transport. If the kernel has timestamped the message, the time it
+    spent in the kernel buffers is accounted for as well. */
+static uint64_t nn_xrep_waited (struct nn_xrep *self,
+    struct nn_xrep_data *data, struct nn_msg *msg)
+{
+    uint64_t waited;
+    uint64_t now;
+
+    waited = 0;
+    if (data->initem.since)
+        waited = nn_clock_now (&self->sockbase.clock) - data->initem.since;
+    if (msg->tstamp) {
+        now = nn_clock_realtime ();
+        if (now > msg->tstamp && (now - msg->tstamp) / 1000000 > waited)
+            waited = (now - msg->tstamp) / 1000000;
+    }
+    return waited;
+}
+
 int nn_xrep_setopt (struct nn_sockbase *self, int level, int option,
     const void *optval, size_t optvallen)
 {
+    struct nn_xrep *xrep;
+
+    xrep = nn_cont (self, struct nn_xrep, sockbase);
+
+    if (level != NN_REP)
+        return -ENOPROTOOPT;
+
+    if (option == NN_REP_MAXWAIT) {
+        if (nn_slow (optvallen != sizeof (int)))
+            return -EINVAL;
+        xrep->maxwait = *(int*) optval;
+        nn_fq_setclock (&xrep->inpipes,
+            xrep->maxwait >= 0 ? &xrep->sockbase.clock : NULL);
+        return 0;
+    }
+
     return -ENOPROTOOPT;
 }
 
 int nn_xrep_getopt (struct nn_sockbase *self, int level, int option,
     void *optval, size_t *optvallen)
 {
+    struct nn_xrep *xrep;
+
+    xrep = nn_cont (self, struct nn_xrep, sockbase);
+
+    if (level != NN_REP)
+        return -ENOPROTOOPT;
+
+    if (option == NN_REP_MAXWAIT) {
+        if (nn_slow (*optvallen < sizeof (int)))
+            return -EINVAL;
+        *(int*) optval = xrep->maxwait;
+        *optvallen = sizeof (int);
+        return 0;
+    }
+
     return -ENOPROTOOPT;
 }
 
@@ -281,8 +348,7 @@ static int nn_xrep_create (struct nn_sockbase **sockbase)
 static struct nn_socktype nn_xrep_socktype_struct = {
     AF_SP_RAW,
     NN_REP,
-    nn_xrep_create,
-    NN_LIST_ITEM_INITIALIZER
+    nn_xrep_create
 };
 
 struct nn_socktype *nn_xrep_socktype = &nn_xrep_socktype_struct;
@@ -52,6 +52,10 @@ struct nn_xrep {
 
     /*  Fair-queuer to get messages from. */
     struct nn_fq inpipes;
+
+    /*  Requests that have been queued for longer than this, in milliseconds,
+        are dropped. Negative if they are never dropped. */
+    int maxwait;
 };
 
 int nn_xrep_init (struct nn_xrep *self, const struct nn_sockbase_vfptr *vfptr);
@@ -98,8 +98,10 @@ int nn_xreq_add (struct nn_sockbase *self, struct nn_pipe *pipe)
     data = nn_alloc (sizeof (struct nn_xreq_data), "pipe data (req)");
     alloc_assert (data);
     nn_pipe_setdata (pipe, data);
-    nn_lb_add (&xreq->lb, pipe, &data->lb, self->sndprio);
-    nn_fq_add (&xreq->fq, pipe, &data->fq, self->rcvprio);
+    nn_lb_add (&xreq->lb, pipe, &data->lb, nn_pipe_getsndprio (pipe),
+        self->sndweight);
+    nn_fq_add (&xreq->fq, pipe, &data->fq, nn_pipe_getrcvprio (pipe),
+        self->rcvquantum);
     return 0;
 }
 
@@ -161,12 +163,21 @@ int nn_xreq_send (struct nn_sockbase *self, struct nn_msg *msg)
 int nn_xreq_recv (struct nn_sockbase *self, struct nn_msg *msg)
 {
     int rc;
+    struct nn_xreq *xreq;
+    struct nn_pipe *pipe;
+    struct nn_xreq_data *data;
+
+    xreq = nn_cont (self, struct nn_xreq, sockbase);
 
-    rc = nn_fq_recv (&nn_cont (self, struct nn_xreq, sockbase)->fq, msg, NULL);
+    rc = nn_fq_recv (&xreq->fq, msg, &pipe);
     if (rc == -EAGAIN)
         return -EAGAIN;
     errnum_assert (rc >= 0, -rc);
 
+    /*  The peer is done with one of the requests. */
+    data = nn_pipe_getdata (pipe);
+    nn_lb_done (&xreq->lb, &data->lb);
+
     if (!(rc & NN_PIPE_PARSED)) {
 
         /*  Ignore malformed replies. */
@@ -190,12 +201,54 @@ int nn_xreq_recv (struct nn_sockbase *self, struct nn_msg *msg)
 int nn_xreq_setopt (struct nn_sockbase *self, int level, int option,
     const void *optval, size_t optvallen)
 {
+    struct nn_xreq *xreq;
+
+    xreq = nn_cont (self, struct nn_xreq, sockbase);
+
+    if (level == NN_REQ && option == NN_REQ_LEAST_BUSY) {
+        if (nn_slow (optvallen != sizeof (int)))
+            return -EINVAL;
+        if (nn_slow (*(int*) optval != 0 && *(int*) optval != 1))
+            return -EINVAL;
+        nn_lb_setleastbusy (&xreq->lb, *(int*) optval);
+        return 0;
+    }
+
+    if (level == NN_REQ && option == NN_REQ_AFFINITY) {
+        if (nn_slow (optvallen != sizeof (int)))
+            return -EINVAL;
+        if (nn_slow (*(int*) optval < 0))
+            return -EINVAL;
+        nn_lb_setaffinity (&xreq->lb, *(int*) optval);
+        return 0;
+    }
+
     return -ENOPROTOOPT;
 }
 
 int nn_xreq_getopt (struct nn_sockbase *self, int level, int option,
     void *optval, size_t *optvallen)
 {
+    struct nn_xreq *xreq;
+
+    xreq = nn_cont (self, struct nn_xreq, sockbase);
+
+    if (level == NN_REQ && option == NN_REQ_LEAST_BUSY) {
+        if (nn_slow (*optvallen < sizeof (int)))
+            return -EINVAL;
+        *(int*) optval = xreq->lb.leastbusy;
+        *optvallen = sizeof (int);
+        return 0;
+    }
+
+    if (level == NN_REQ && option == NN_REQ_AFFINITY) {
+        if (nn_slow (*optvallen < sizeof (int)))
+            return -EINVAL;
+        *(int*) optval = xreq->lb.affinity;
+        *optvallen = sizeof (int);
+        return 0;
+    }
+
     return -ENOPROTOOPT;
 }
 
@@ -219,8 +272,7 @@ static int nn_xreq_create (struct nn_sockbase **sockbase)
 static struct nn_socktype nn_xreq_socktype_struct = {
     AF_SP_RAW,
     NN_REQ,
-    nn_xreq_create,
-    NN_LIST_ITEM_INITIALIZER
+    nn_xreq_create
 };
 
 struct nn_socktype *nn_xreq_socktype = &nn_xreq_socktype_struct;
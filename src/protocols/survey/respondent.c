@@ -32,6 +32,7 @@
 #include "../../utils/alloc.h"
 #include "../../utils/wire.h"
 #include "../../utils/list.h"
+#include "../../utils/replycache.h"
 
 #include <stdint.h>
 #include <string.h>
@@ -42,18 +43,26 @@ struct nn_respondent {
     struct nn_xrespondent xrespondent;
     uint32_t surveyid;
     uint32_t flags;
+
+    /*  Surveys received lately, see NN_RESPONDENT_DEDUP. */
+    struct nn_replycache cache;
 };
 
 /*  Private functions. */
 static int nn_respondent_init (struct nn_respondent *self,
     const struct nn_sockbase_vfptr *vfptr);
 static void nn_respondent_term (struct nn_respondent *self);
+static void nn_respondent_cancel (struct nn_respondent *self);
 
 /*  Implementation of nn_sockbase's virtual functions. */
 static void nn_respondent_destroy (struct nn_sockbase *self);
 static int nn_respondent_events (struct nn_sockbase *self);
 static int nn_respondent_send (struct nn_sockbase *self, struct nn_msg *msg);
 static int nn_respondent_recv (struct nn_sockbase *self, struct nn_msg *msg);
+static int nn_respondent_setopt (struct nn_sockbase *self, int level,
+    int option, const void *optval, size_t optvallen);
+static int nn_respondent_getopt (struct nn_sockbase *self, int level,
+    int option, void *optval, size_t *optvallen);
 static const struct nn_sockbase_vfptr nn_respondent_sockbase_vfptr = {
     0,
     nn_xrespondent_ispeer,
@@ -65,8 +74,8 @@ static const struct nn_sockbase_vfptr nn_respondent_sockbase_vfptr = {
     nn_respondent_events,
     nn_respondent_send,
     nn_respondent_recv,
-    nn_xrespondent_setopt,
-    nn_xrespondent_getopt
+    nn_respondent_setopt,
+    nn_respondent_getopt
 };
 
 static int nn_respondent_init (struct nn_respondent *self,
@@ -78,12 +87,14 @@ static int nn_respondent_init (struct nn_respondent *self,
     if (rc < 0)
         return rc;
     self->flags = 0;
+    nn_replycache_init (&self->cache);
 
     return 0;
 }
 
 static void nn_respondent_term (struct nn_respondent *self)
 {
+    nn_replycache_term (&self->cache);
     nn_xrespondent_term (&self->xrespondent);
 }
 
@@ -127,6 +138,10 @@ static int nn_respondent_send (struct nn_sockbase *self, struct nn_msg *msg)
     nn_chunkref_init (&msg->hdr, 4);
     nn_putl (nn_chunkref_data (&msg->hdr), respondent->surveyid);
 
+    /*  Keep a copy of the response in case the survey is resent. */
+    if (nn_replycache_active (&respondent->cache))
+        nn_replycache_done (&respondent->cache, &msg->hdr, msg);
+
     /*  Try to send the message. If it cannot be sent due to pushback, drop it
         silently. */
     rc = nn_xrespondent_send (&respondent->xrespondent.sockbase, msg);
@@ -146,17 +161,45 @@ static int nn_respondent_recv (struct nn_sockbase *self, struct nn_msg *msg)
 {
     int rc;
     struct nn_respondent *respondent;
+    struct nn_msg reply;
 
     respondent = nn_cont (self, struct nn_respondent, xrespondent.sockbase);
 
     /*  Cancel current survey, if it exists. */
-    respondent->flags &= ~NN_RESPONDENT_INPROGRESS;
-
-    /*  Get next survey. */
-    rc = nn_xrespondent_recv (&respondent->xrespondent.sockbase, msg);
-    if (nn_slow (rc == -EAGAIN))
-        return -EAGAIN;
-    errnum_assert (rc == 0, -rc);
+    nn_respondent_cancel (respondent);
+
+    while (1) {
+
+        /*  Get next survey. */
+        rc = nn_xrespondent_recv (&respondent->xrespondent.sockbase, msg);
+        if (nn_slow (rc == -EAGAIN))
+            return -EAGAIN;
+        errnum_assert (rc == 0, -rc);
+
+        if (nn_fast (!nn_replycache_active (&respondent->cache)))
+            break;
+
+        /*  A resent survey is not passed to the user. If it was responded
+            to already, the response is sent again. */
+        switch (nn_replycache_check (&respondent->cache, &msg->hdr,
+              &reply)) {
+        case NN_REPLYCACHE_NEW:
+            break;
+        case NN_REPLYCACHE_DONE:
+            rc = nn_xrespondent_send (&respondent->xrespondent.sockbase,
+                &reply);
+            if (nn_slow (rc == -EAGAIN))
+                nn_msg_term (&reply);
+            else
+                errnum_assert (rc == 0, -rc);
+            nn_msg_term (msg);
+            continue;
+        default:
+            nn_msg_term (msg);
+            continue;
+        }
+        break;
+    }
 
     /*  Remember the survey ID. */
     nn_assert (nn_chunkref_size (&msg->hdr) == sizeof (uint32_t));
@@ -170,6 +213,57 @@ static int nn_respondent_recv (struct nn_sockbase *self, struct nn_msg *msg)
     return 0;
 }
 
+static int nn_respondent_setopt (struct nn_sockbase *self, int level,
+    int option, const void *optval, size_t optvallen)
+{
+    struct nn_respondent *respondent;
+
+    respondent = nn_cont (self, struct nn_respondent, xrespondent.sockbase);
+
+    if (level == NN_RESPONDENT && option == NN_RESPONDENT_DEDUP) {
+        if (nn_slow (optvallen != sizeof (int) || *(int*) optval < 0))
+            return -EINVAL;
+        nn_replycache_resize (&respondent->cache, *(int*) optval);
+        return 0;
+    }
+
+    return nn_xrespondent_setopt (self, level, option, optval, optvallen);
+}
+
+static int nn_respondent_getopt (struct nn_sockbase *self, int level,
+    int option, void *optval, size_t *optvallen)
+{
+    struct nn_respondent *respondent;
+
+    respondent = nn_cont (self, struct nn_respondent, xrespondent.sockbase);
+
+    if (level == NN_RESPONDENT && option == NN_RESPONDENT_DEDUP) {
+        if (nn_slow (*optvallen < sizeof (int)))
+            return -EINVAL;
+        *(int*) optval = respondent->cache.capacity;
+        *optvallen = sizeof (int);
+        return 0;
+    }
+
+    return nn_xrespondent_getopt (self, level, option, optval, optvallen);
+}
+
+/*  Drops the survey being processed, if any. */
+static void nn_respondent_cancel (struct nn_respondent *self)
+{
+    struct nn_chunkref key;
+
+    if (!(self->flags & NN_RESPONDENT_INPROGRESS))
+        return;
+    if (nn_replycache_active (&self->cache)) {
+        nn_chunkref_init (&key, sizeof (uint32_t));
+        nn_putl (nn_chunkref_data (&key), self->surveyid);
+        nn_replycache_cancel (&self->cache, &key);
+        nn_chunkref_term (&key);
+    }
+    self->flags &= ~NN_RESPONDENT_INPROGRESS;
+}
+
 static int nn_respondent_create (struct nn_sockbase **sockbase)
 {
     int rc;
@@ -190,8 +284,7 @@ static int nn_respondent_create (struct nn_sockbase **sockbase)
 static struct nn_socktype nn_respondent_socktype_struct = {
     AF_SP,
     NN_RESPONDENT,
-    nn_respondent_create,
-    NN_LIST_ITEM_INITIALIZER
+    nn_respondent_create
 };
 
 struct nn_socktype *nn_respondent_socktype = &nn_respondent_socktype_struct;
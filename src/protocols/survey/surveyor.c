@@ -33,6 +33,9 @@
 #include "../../utils/alloc.h"
 #include "../../utils/random.h"
 #include "../../utils/list.h"
+#include "../../utils/clock.h"
+#include "../../utils/stopwatch.h"
+#include "../../utils/hist.h"
 
 #include <stdint.h>
 #include <string.h>
@@ -41,6 +44,36 @@
 
 #define NN_SURVEYOR_INPROGRESS 1
 
+/*  In the batch mode, the collected responses can be received. */
+#define NN_SURVEYOR_RELEASED 2
+
+/*  Maximum number of surveys in progress in the concurrent mode. */
+#define NN_SURVEYOR_MAX_CONCURRENT 65536
+
+/*  A survey in the concurrent mode. */
+struct nn_surveyor_entry {
+
+    /*  Set if the survey is in progress. The survey is in the list of
+        the surveys in progress then. */
+    int inprogress;
+
+    uint32_t surveyid;
+
+    /*  Header supplied by the user along with the survey. It's returned
+        as the header of each response, so that the user can tell which
+        survey the response belongs to. */
+    struct nn_chunkref tag;
+
+    /*  Time when the survey was sent and time when it is over. */
+    struct nn_stopwatch sent;
+    uint64_t deadline;
+
+    /*  Number of responses received so far. */
+    int received;
+
+    struct nn_list_item item;
+};
+
 struct nn_surveyor {
     struct nn_xsurveyor xsurveyor;
     const struct nn_cp_sink *sink;
@@ -48,15 +81,69 @@ struct nn_surveyor {
     uint32_t surveyid;
     int deadline;
     struct nn_timer deadline_timer;
+
+    /*  Number of responses after which the survey is over, or zero if
+        the survey lasts till the deadline. See NN_SURVEYOR_QUORUM. */
+    int quorum;
+
+    /*  Number of responses to the current survey received so far. */
+    int received;
+
+    /*  Time when the current survey was sent. */
+    struct nn_stopwatch sent;
+
+    /*  Response latencies, in microseconds. See NN_SURVEYOR_LATENCY. */
+    struct nn_hist latency;
+
+    /*  Number of responses to collect before they can be received, or zero
+        if the socket is not in the batch mode. See NN_SURVEYOR_BATCH. */
+    int batch;
+
+    /*  Responses collected in the batch mode. Those between 'head' and
+        'tail' are not received by the user yet. */
+    struct nn_msg *responses;
+    int head;
+    int tail;
+    int capacity;
+
+    /*  Maximum number of surveys in progress, or zero if the socket is not in
+        the concurrent mode. See NN_SURVEYOR_CONCURRENT. In the concurrent mode,
+        'flags' and 'received' are not used. */
+    int concurrent;
+
+    /*  Surveys in progress, indexed by the low bits of the survey ID. The size
+        of the table is a power of two not smaller than 'concurrent'. Survey IDs
+        that would map to occupied entries are skipped. */
+    struct nn_surveyor_entry *entries;
+    uint32_t mask;
+    int count;
+
+    /*  Surveys in progress ordered by their deadlines. The deadline timer is
+        set to the deadline of the first one. */
+    struct nn_list surveys;
 };
 
 /*  Private functions. */
 static int nn_surveyor_init (struct nn_surveyor *self,
     const struct nn_sockbase_vfptr *vfptr);
 static void nn_surveyor_term (struct nn_surveyor *self);
+static int nn_surveyor_recvresp (struct nn_surveyor *self, struct nn_msg *msg);
+static void nn_surveyor_collect (struct nn_surveyor *self);
+static void nn_surveyor_drop (struct nn_surveyor *self);
+static void nn_surveyor_finish (struct nn_surveyor *self);
+static void nn_surveyor_setconcurrent (struct nn_surveyor *self,
+    int concurrent);
+static int nn_surveyor_send_concurrent (struct nn_surveyor *self,
+    struct nn_msg *msg);
+static int nn_surveyor_recv_concurrent (struct nn_surveyor *self,
+    struct nn_msg *msg);
+static void nn_surveyor_finish_concurrent (struct nn_surveyor *self,
+    struct nn_surveyor_entry *entry);
+static void nn_surveyor_settimer (struct nn_surveyor *self);
 
 /*  Implementation of nn_sockbase's virtual functions. */
 static void nn_surveyor_destroy (struct nn_sockbase *self);
+static void nn_surveyor_in (struct nn_sockbase *self, struct nn_pipe *pipe);
 static int nn_surveyor_events (struct nn_sockbase *self);
 static int nn_surveyor_send (struct nn_sockbase *self, struct nn_msg *msg);
 static int nn_surveyor_recv (struct nn_sockbase *self, struct nn_msg *msg);
@@ -65,12 +152,12 @@ static int nn_surveyor_setopt (struct nn_sockbase *self, int level, int option,
 static int nn_surveyor_getopt (struct nn_sockbase *self, int level, int option,
     void *optval, size_t *optvallen);
 static const struct nn_sockbase_vfptr nn_surveyor_sockbase_vfptr = {
-    0,
+    NN_SOCKBASE_FLAG_LOSSY,
     nn_xsurveyor_ispeer,
     nn_surveyor_destroy,
     nn_xsurveyor_add,
     nn_xsurveyor_rm,
-    nn_xsurveyor_in,
+    nn_surveyor_in,
     nn_xsurveyor_out,
     nn_surveyor_events,
     nn_surveyor_send,
@@ -112,12 +199,32 @@ static int nn_surveyor_init (struct nn_surveyor *self,
     nn_timer_init (&self->deadline_timer, &self->sink,
         nn_sockbase_getcp (&self->xsurveyor.sockbase));
 
+    self->quorum = 0;
+    self->received = 0;
+    nn_hist_init (&self->latency);
+    self->batch = 0;
+    self->responses = NULL;
+    self->head = 0;
+    self->tail = 0;
+    self->capacity = 0;
+    self->concurrent = 0;
+    self->entries = NULL;
+    self->mask = 0;
+    self->count = 0;
+    nn_list_init (&self->surveys);
+
     return 0;
 }
 
 static void nn_surveyor_term (struct nn_surveyor *self)
 {
+    nn_surveyor_setconcurrent (self, 0);
+    nn_list_term (&self->surveys);
+    nn_surveyor_drop (self);
+    if (self->responses)
+        nn_free (self->responses);
     nn_timer_term (&self->deadline_timer);
+    nn_hist_term (&self->latency);
     nn_xsurveyor_term (&self->xsurveyor);
 }
 
@@ -137,11 +244,42 @@ static int nn_surveyor_events (struct nn_sockbase *self)
 
     surveyor = nn_cont (self, struct nn_surveyor, xsurveyor.sockbase);
 
+    /*  In the concurrent mode, new survey can be sent unless the maximum
+        number of surveys is already in progress. */
+    if (surveyor->concurrent)
+        return (!surveyor->count ? NN_SOCKBASE_EVENT_IN :
+            nn_xsurveyor_events (&surveyor->xsurveyor.sockbase) &
+            NN_SOCKBASE_EVENT_IN) |
+            (surveyor->count < surveyor->concurrent ?
+            NN_SOCKBASE_EVENT_OUT : 0);
+
+    /*  In the batch mode, the collected responses are held back until they
+        are released. When the survey is over and all of them were received,
+        recv fails straight away. */
+    if (surveyor->batch) {
+        if (surveyor->head != surveyor->tail ?
+              (surveyor->flags & NN_SURVEYOR_RELEASED) :
+              !(surveyor->flags & NN_SURVEYOR_INPROGRESS))
+            return NN_SOCKBASE_EVENT_IN | NN_SOCKBASE_EVENT_OUT;
+        return NN_SOCKBASE_EVENT_OUT;
+    }
+
     if (!(surveyor->flags & NN_SURVEYOR_INPROGRESS))
         return NN_SOCKBASE_EVENT_IN | NN_SOCKBASE_EVENT_OUT;
     return nn_xsurveyor_events (&surveyor->xsurveyor.sockbase);
 }
 
+static void nn_surveyor_in (struct nn_sockbase *self, struct nn_pipe *pipe)
+{
+    struct nn_surveyor *surveyor;
+
+    surveyor = nn_cont (self, struct nn_surveyor, xsurveyor.sockbase);
+
+    nn_xsurveyor_in (&surveyor->xsurveyor.sockbase, pipe);
+    if (surveyor->batch)
+        nn_surveyor_collect (surveyor);
+}
+
 static int nn_surveyor_send (struct nn_sockbase *self, struct nn_msg *msg)
 {
     int rc;
@@ -149,12 +287,23 @@ static int nn_surveyor_send (struct nn_sockbase *self, struct nn_msg *msg)
 
     surveyor = nn_cont (self, struct nn_surveyor, xsurveyor.sockbase);
 
+    if (surveyor->concurrent)
+        return nn_surveyor_send_concurrent (surveyor, msg);
+
     /*  Cancel any ongoing survey. */
     if (nn_slow (surveyor->flags & NN_SURVEYOR_INPROGRESS)) {
         surveyor->flags &= ~NN_SURVEYOR_INPROGRESS;
         nn_timer_stop (&surveyor->deadline_timer);
     }
 
+    /*  In the batch mode, get rid of the responses to the previous survey,
+        both collected and still waiting in the pipes. */
+    if (surveyor->batch) {
+        surveyor->flags &= ~NN_SURVEYOR_RELEASED;
+        nn_surveyor_drop (surveyor);
+        nn_surveyor_collect (surveyor);
+    }
+
     /*  Generate new survey ID. */
     ++surveyor->surveyid;
 
@@ -169,6 +318,8 @@ static int nn_surveyor_send (struct nn_sockbase *self, struct nn_msg *msg)
     errnum_assert (rc == 0, -rc);
 
     surveyor->flags |= NN_SURVEYOR_INPROGRESS;
+    surveyor->received = 0;
+    nn_stopwatch_init (&surveyor->sent);
 
     /*  Set up the re-send timer. */
     nn_timer_start (&surveyor->deadline_timer, surveyor->deadline);
@@ -178,20 +329,46 @@ static int nn_surveyor_send (struct nn_sockbase *self, struct nn_msg *msg)
 
 static int nn_surveyor_recv (struct nn_sockbase *self, struct nn_msg *msg)
 {
-    int rc;
     struct nn_surveyor *surveyor;
-    uint32_t surveyid;
 
     surveyor = nn_cont (self, struct nn_surveyor, xsurveyor.sockbase);
 
+    if (surveyor->concurrent)
+        return nn_surveyor_recv_concurrent (surveyor, msg);
+
+    /*  In the batch mode, pass the collected responses to the user once
+        they are released. */
+    if (surveyor->batch) {
+        if (surveyor->head != surveyor->tail) {
+            if (!(surveyor->flags & NN_SURVEYOR_RELEASED))
+                return -EAGAIN;
+            nn_msg_mv (msg, &surveyor->responses [surveyor->head]);
+            ++surveyor->head;
+            if (surveyor->head == surveyor->tail) {
+                surveyor->head = 0;
+                surveyor->tail = 0;
+            }
+            return 0;
+        }
+        return surveyor->flags & NN_SURVEYOR_INPROGRESS ? -EAGAIN : -EFSM;
+    }
+
     /*  If no survey is going on return EFSM error. */
     if (nn_slow (!(surveyor->flags & NN_SURVEYOR_INPROGRESS)))
        return -EFSM;
 
+    return nn_surveyor_recvresp (surveyor, msg);
+}
+
+static int nn_surveyor_recvresp (struct nn_surveyor *self, struct nn_msg *msg)
+{
+    int rc;
+    uint32_t surveyid;
+
     while (1) {
 
         /*  Get next response. */
-        rc = nn_xsurveyor_recv (&surveyor->xsurveyor.sockbase, msg);
+        rc = nn_xsurveyor_recv (&self->xsurveyor.sockbase, msg);
         if (nn_slow (rc == -EAGAIN))
             return -EAGAIN;
         errnum_assert (rc == 0, -rc);
@@ -202,7 +379,7 @@ static int nn_surveyor_recv (struct nn_sockbase *self, struct nn_msg *msg)
             continue;
         }
         surveyid = nn_getl (nn_chunkref_data (&msg->hdr));
-        if (nn_slow (surveyid != surveyor->surveyid)) {
+        if (nn_slow (surveyid != self->surveyid)) {
             nn_msg_term (msg);
             continue;
         }
@@ -213,18 +390,101 @@ static int nn_surveyor_recv (struct nn_sockbase *self, struct nn_msg *msg)
         break;
     }
 
+    nn_hist_record (&self->latency, nn_stopwatch_term (&self->sent));
+
+    /*  Once the quorum is reached, there's no point in waiting further. */
+    ++self->received;
+    if (self->quorum && self->received >= self->quorum)
+        nn_surveyor_finish (self);
+
     return 0;
 }
 
+static void nn_surveyor_collect (struct nn_surveyor *self)
+{
+    int rc;
+    struct nn_msg msg;
+
+    while (1) {
+
+        /*  Once the survey is over, the late responses are dropped. */
+        if (!(self->flags & NN_SURVEYOR_INPROGRESS)) {
+            rc = nn_xsurveyor_recv (&self->xsurveyor.sockbase, &msg);
+            if (rc == -EAGAIN)
+                return;
+            errnum_assert (rc == 0, -rc);
+            nn_msg_term (&msg);
+            continue;
+        }
+
+        rc = nn_surveyor_recvresp (self, &msg);
+        if (rc == -EAGAIN)
+            return;
+        errnum_assert (rc == 0, -rc);
+
+        if (nn_slow (self->tail == self->capacity)) {
+            self->capacity = self->capacity ? self->capacity * 2 : 16;
+            self->responses = nn_realloc (self->responses,
+                self->capacity * sizeof (struct nn_msg));
+            alloc_assert (self->responses);
+        }
+        nn_msg_mv (&self->responses [self->tail], &msg);
+        ++self->tail;
+
+        /*  Release the batch when enough responses are collected. */
+        if (self->tail - self->head >= self->batch)
+            self->flags |= NN_SURVEYOR_RELEASED;
+    }
+}
+
+static void nn_surveyor_drop (struct nn_surveyor *self)
+{
+    while (self->head != self->tail) {
+        nn_msg_term (&self->responses [self->head]);
+        ++self->head;
+    }
+    self->head = 0;
+    self->tail = 0;
+}
+
+static void nn_surveyor_finish (struct nn_surveyor *self)
+{
+    nn_timer_stop (&self->deadline_timer);
+    self->flags &= ~NN_SURVEYOR_INPROGRESS;
+    if (self->batch)
+        self->flags |= NN_SURVEYOR_RELEASED;
+}
+
 static void nn_surveyor_timeout (const struct nn_cp_sink **self,
     struct nn_timer *timer)
 {
     struct nn_surveyor *surveyor;
+    uint64_t now;
+    struct nn_surveyor_entry *entry;
 
     surveyor = nn_cont (self, struct nn_surveyor, sink);
 
-    /*  Cancel the survey. */
+    /*  In the concurrent mode, all the surveys whose deadlines have expired
+        are over. */
+    if (surveyor->concurrent) {
+        now = nn_clock_now (&surveyor->xsurveyor.sockbase.clock);
+        while (!nn_list_empty (&surveyor->surveys)) {
+            entry = nn_cont (nn_list_begin (&surveyor->surveys),
+                struct nn_surveyor_entry, item);
+            if (entry->deadline > now)
+                break;
+            nn_surveyor_finish_concurrent (surveyor, entry);
+        }
+        nn_surveyor_settimer (surveyor);
+        nn_sockbase_changed (&surveyor->xsurveyor.sockbase);
+        return;
+    }
+
+    /*  Cancel the survey. In the batch mode, the responses collected so far
+        become available. */
     surveyor->flags &= ~NN_SURVEYOR_INPROGRESS;
+    if (surveyor->batch)
+        surveyor->flags |= NN_SURVEYOR_RELEASED;
 
     /*  If there's a blocked recv/poll operation, unblock it. */
     nn_sockbase_changed (&surveyor->xsurveyor.sockbase);
@@ -247,6 +507,55 @@ static int nn_surveyor_setopt (struct nn_sockbase *self, int level, int option,
         return 0;
     }
 
+    if (option == NN_SURVEYOR_QUORUM) {
+        if (nn_slow (optvallen != sizeof (int)))
+            return -EINVAL;
+        if (nn_slow (*(int*) optval < 0))
+            return -EINVAL;
+        surveyor->quorum = *(int*) optval;
+        return 0;
+    }
+
+    if (option == NN_SURVEYOR_BATCH) {
+        if (nn_slow (optvallen != sizeof (int)))
+            return -EINVAL;
+        if (nn_slow (*(int*) optval < 0))
+            return -EINVAL;
+        if (nn_slow (*(int*) optval && surveyor->concurrent))
+            return -EINVAL;
+
+        /*  Switching the mode cancels the ongoing survey. */
+        if (surveyor->flags & NN_SURVEYOR_INPROGRESS)
+            nn_timer_stop (&surveyor->deadline_timer);
+        surveyor->flags = 0;
+        nn_surveyor_drop (surveyor);
+        surveyor->batch = *(int*) optval;
+        return 0;
+    }
+
+    if (option == NN_SURVEYOR_CONCURRENT) {
+        if (nn_slow (optvallen != sizeof (int)))
+            return -EINVAL;
+        if (nn_slow (*(int*) optval < 0 ||
+              *(int*) optval > NN_SURVEYOR_MAX_CONCURRENT))
+            return -EINVAL;
+        if (nn_slow (*(int*) optval && surveyor->batch))
+            return -EINVAL;
+
+        /*  Switching the mode cancels the ongoing surveys. */
+        if (surveyor->flags & NN_SURVEYOR_INPROGRESS)
+            nn_timer_stop (&surveyor->deadline_timer);
+        surveyor->flags = 0;
+        nn_surveyor_setconcurrent (surveyor, *(int*) optval);
+        return 0;
+    }
+
+    /*  Setting the option, whatever the value, drops the statistics. */
+    if (option == NN_SURVEYOR_LATENCY) {
+        nn_hist_reset (&surveyor->latency);
+        return 0;
+    }
+
     return -ENOPROTOOPT;
 }
 
@@ -268,9 +577,200 @@ static int nn_surveyor_getopt (struct nn_sockbase *self, int level, int option,
         return 0;
     }
 
+    if (option == NN_SURVEYOR_QUORUM) {
+        if (nn_slow (*optvallen < sizeof (int)))
+            return -EINVAL;
+        *(int*) optval = surveyor->quorum;
+        *optvallen = sizeof (int);
+        return 0;
+    }
+
+    if (option == NN_SURVEYOR_BATCH) {
+        if (nn_slow (*optvallen < sizeof (int)))
+            return -EINVAL;
+        *(int*) optval = surveyor->batch;
+        *optvallen = sizeof (int);
+        return 0;
+    }
+
+    if (option == NN_SURVEYOR_CONCURRENT) {
+        if (nn_slow (*optvallen < sizeof (int)))
+            return -EINVAL;
+        *(int*) optval = surveyor->concurrent;
+        *optvallen = sizeof (int);
+        return 0;
+    }
+
+    if (option == NN_SURVEYOR_LATENCY) {
+        if (nn_slow (*optvallen < sizeof (struct nn_latency_stats)))
+            return -EINVAL;
+        nn_hist_stats (&surveyor->latency, (struct nn_latency_stats*) optval);
+        *optvallen = sizeof (struct nn_latency_stats);
+        return 0;
+    }
+
     return -ENOPROTOOPT;
 }
 
+static void nn_surveyor_setconcurrent (struct nn_surveyor *self,
+    int concurrent)
+{
+    uint32_t size;
+    uint32_t i;
+
+    /*  Surveys in progress are cancelled. */
+    while (!nn_list_empty (&self->surveys))
+        nn_surveyor_finish_concurrent (self, nn_cont (
+            nn_list_begin (&self->surveys), struct nn_surveyor_entry, item));
+    nn_timer_stop (&self->deadline_timer);
+    if (self->entries) {
+        nn_free (self->entries);
+        self->entries = NULL;
+        self->mask = 0;
+    }
+
+    self->concurrent = concurrent;
+    if (!concurrent)
+        return;
+
+    size = 1;
+    while (size < (uint32_t) concurrent)
+        size <<= 1;
+    self->entries = nn_alloc (size * sizeof (struct nn_surveyor_entry),
+        "survey table");
+    alloc_assert (self->entries);
+    for (i = 0; i != size; ++i)
+        self->entries [i].inprogress = 0;
+    self->mask = size - 1;
+}
+
+static int nn_surveyor_send_concurrent (struct nn_surveyor *self,
+    struct nn_msg *msg)
+{
+    int rc;
+    struct nn_surveyor_entry *entry;
+    struct nn_list_item *it;
+    struct nn_list_item *prev;
+
+    if (nn_slow (self->count >= self->concurrent))
+        return -EAGAIN;
+
+    /*  Find an unused survey ID. As there are fewer surveys in progress than
+        there are entries in the table, there's always one. */
+    do {
+        ++self->surveyid;
+        entry = &self->entries [self->surveyid & self->mask];
+    } while (entry->inprogress);
+
+    /*  The header supplied by the user is kept aside and replaced by
+        the survey ID. */
+    entry->inprogress = 1;
+    entry->surveyid = self->surveyid;
+    entry->received = 0;
+    nn_stopwatch_init (&entry->sent);
+    nn_chunkref_mv (&entry->tag, &msg->hdr);
+    nn_chunkref_init (&msg->hdr, 4);
+    nn_putl (nn_chunkref_data (&msg->hdr), self->surveyid);
+    ++self->count;
+
+    rc = nn_xsurveyor_send (&self->xsurveyor.sockbase, msg);
+    errnum_assert (rc == 0, -rc);
+
+    /*  Keep the list of surveys ordered by the deadlines. The deadline
+        interval rarely changes, so search from the end. */
+    entry->deadline = nn_clock_now (&self->xsurveyor.sockbase.clock) +
+        self->deadline;
+    nn_list_item_init (&entry->item);
+    it = nn_list_end (&self->surveys);
+    while (1) {
+        prev = nn_list_prev (&self->surveys, it);
+        if (!prev || nn_cont (prev, struct nn_surveyor_entry,
+              item)->deadline <= entry->deadline)
+            break;
+        it = prev;
+    }
+    nn_list_insert (&self->surveys, &entry->item, it);
+    if (nn_list_begin (&self->surveys) == &entry->item)
+        nn_surveyor_settimer (self);
+
+    return 0;
+}
+
+static int nn_surveyor_recv_concurrent (struct nn_surveyor *self,
+    struct nn_msg *msg)
+{
+    int rc;
+    uint32_t surveyid;
+    struct nn_surveyor_entry *entry;
+
+    /*  If no survey is going on return EFSM error. */
+    if (nn_slow (!self->count))
+        return -EFSM;
+
+    while (1) {
+
+        rc = nn_xsurveyor_recv (&self->xsurveyor.sockbase, msg);
+        if (nn_slow (rc == -EAGAIN))
+            return -EAGAIN;
+        errnum_assert (rc == 0, -rc);
+
+        /*  Ignore malformed responses and responses to surveys that are not
+            in progress. */
+        if (nn_slow (nn_chunkref_size (&msg->hdr) != sizeof (uint32_t))) {
+            nn_msg_term (msg);
+            continue;
+        }
+        surveyid = nn_getl (nn_chunkref_data (&msg->hdr));
+        entry = &self->entries [surveyid & self->mask];
+        if (nn_slow (!entry->inprogress || entry->surveyid != surveyid)) {
+            nn_msg_term (msg);
+            continue;
+        }
+        break;
+    }
+
+    /*  Replace the survey ID by the header of the survey. */
+    nn_chunkref_term (&msg->hdr);
+    nn_chunkref_cp (&msg->hdr, &entry->tag);
+
+    nn_hist_record (&self->latency, nn_stopwatch_term (&entry->sent));
+
+    /*  Once the quorum is reached, there's no point in waiting further. */
+    ++entry->received;
+    if (self->quorum && entry->received >= self->quorum) {
+        nn_surveyor_finish_concurrent (self, entry);
+        nn_surveyor_settimer (self);
+    }
+
+    return 0;
+}
+
+static void nn_surveyor_finish_concurrent (struct nn_surveyor *self,
+    struct nn_surveyor_entry *entry)
+{
+    nn_list_erase (&self->surveys, &entry->item);
+    nn_list_item_term (&entry->item);
+    nn_chunkref_term (&entry->tag);
+    entry->inprogress = 0;
+    --self->count;
+}
+
+static void nn_surveyor_settimer (struct nn_surveyor *self)
+{
+    uint64_t now;
+    struct nn_surveyor_entry *entry;
+
+    /*  The timer is set to the earliest deadline. */
+    nn_timer_stop (&self->deadline_timer);
+    if (nn_list_empty (&self->surveys))
+        return;
+    entry = nn_cont (nn_list_begin (&self->surveys), struct nn_surveyor_entry,
+        item);
+    now = nn_clock_now (&self->xsurveyor.sockbase.clock);
+    nn_timer_start (&self->deadline_timer,
+        entry->deadline > now ? (int) (entry->deadline - now) : 0);
+}
+
 static int nn_surveyor_create (struct nn_sockbase **sockbase)
 {
     int rc;
@@ -291,8 +791,7 @@ static int nn_surveyor_create (struct nn_sockbase **sockbase)
 static struct nn_socktype nn_surveyor_socktype_struct = {
     AF_SP,
     NN_SURVEYOR,
-    nn_surveyor_create,
-    NN_LIST_ITEM_INITIALIZER
+    nn_surveyor_create
 };
 
 struct nn_socktype *nn_surveyor_socktype = &nn_surveyor_socktype_struct;
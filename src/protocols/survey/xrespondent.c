@@ -191,8 +191,7 @@ static int nn_xrespondent_create (struct nn_sockbase **sockbase)
 static struct nn_socktype nn_xrespondent_socktype_struct = {
     AF_SP_RAW,
     NN_RESPONDENT,
-    nn_xrespondent_create,
-    NN_LIST_ITEM_INITIALIZER
+    nn_xrespondent_create
 };
 
 struct nn_socktype *nn_xrespondent_socktype = &nn_xrespondent_socktype_struct;
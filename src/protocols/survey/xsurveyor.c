@@ -28,18 +28,32 @@
 #include "../../utils/err.h"
 #include "../../utils/cont.h"
 #include "../../utils/fast.h"
-#include "../../utils/list.h"
+#include "../../utils/wire.h"
 #include "../../utils/alloc.h"
 #include "../../utils/list.h"
+#include "../../utils/clock.h"
 
 #include <stddef.h>
+#include <string.h>
+
+#define NN_XSURVEYOR_DEFAULT_DEADLINE 1000
 
 /*  Private functions. */
 static void nn_xsurveyor_destroy (struct nn_sockbase *self);
+static int nn_xsurveyor_recv_raw (struct nn_xsurveyor *self,
+    struct nn_msg *msg);
+static struct nn_xsurveyor_reduction *nn_xsurveyor_find (
+    struct nn_xsurveyor *self, uint32_t surveyid);
+static void nn_xsurveyor_combine (struct nn_xsurveyor *self,
+    struct nn_xsurveyor_reduction *reduction, struct nn_msg *msg);
+static void nn_xsurveyor_finish (struct nn_xsurveyor *self,
+    struct nn_xsurveyor_reduction *reduction);
+static void nn_xsurveyor_drop (struct nn_xsurveyor *self);
+static void nn_xsurveyor_settimer (struct nn_xsurveyor *self);
 
 /*  Implementation of nn_sockbase's virtual functions. */
 static const struct nn_sockbase_vfptr nn_xsurveyor_sockbase_vfptr = {
-    0,
+    NN_SOCKBASE_FLAG_LOSSY,
     nn_xsurveyor_ispeer,
     nn_xsurveyor_destroy,
     nn_xsurveyor_add,
@@ -53,6 +67,19 @@ static const struct nn_sockbase_vfptr nn_xsurveyor_sockbase_vfptr = {
     nn_xsurveyor_getopt
 };
 
+/*  Event sink. */
+static void nn_xsurveyor_timeout (const struct nn_cp_sink **self,
+    struct nn_timer *timer);
+static const struct nn_cp_sink nn_xsurveyor_sink = {
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    nn_xsurveyor_timeout
+};
+
 int nn_xsurveyor_ispeer (int socktype)
 {
     return socktype == NN_RESPONDENT ? 1 : 0;
@@ -70,11 +97,23 @@ int nn_xsurveyor_init (struct nn_xsurveyor *self,
     nn_dist_init (&self->outpipes);
     nn_fq_init (&self->inpipes);
 
+    self->reduce = NN_SURVEYOR_REDUCE_NONE;
+    self->deadline = NN_XSURVEYOR_DEFAULT_DEADLINE;
+    self->sink = &nn_xsurveyor_sink;
+    nn_timer_init (&self->timer, &self->sink,
+        nn_sockbase_getcp (&self->sockbase));
+    nn_list_init (&self->reductions);
+    nn_list_init (&self->ready);
+
     return 0;
 }
 
 void nn_xsurveyor_term (struct nn_xsurveyor *self)
 {
+    nn_xsurveyor_drop (self);
+    nn_list_term (&self->ready);
+    nn_list_term (&self->reductions);
+    nn_timer_term (&self->timer);
     nn_fq_term (&self->inpipes);
     nn_dist_term (&self->outpipes);
     nn_sockbase_term (&self->sockbase);
@@ -101,7 +140,8 @@ int nn_xsurveyor_add (struct nn_sockbase *self, struct nn_pipe *pipe)
         "pipe data (xsurveyor)");
     alloc_assert (data);
     data->pipe = pipe;
-    nn_fq_add (&xsurveyor->inpipes, pipe, &data->initem, 8);
+    nn_fq_add (&xsurveyor->inpipes, pipe, &data->initem,
+        nn_pipe_getrcvprio (pipe), self->rcvquantum);
     nn_dist_add (&xsurveyor->outpipes, pipe, &data->outitem);
     nn_pipe_setdata (pipe, data);
 
@@ -152,25 +192,117 @@ int nn_xsurveyor_events (struct nn_sockbase *self)
     xsurveyor = nn_cont (self, struct nn_xsurveyor, sockbase);
 
     events = NN_SOCKBASE_EVENT_OUT;
-    if (nn_fq_can_recv (&xsurveyor->inpipes))
+    if (nn_fq_can_recv (&xsurveyor->inpipes) ||
+          !nn_list_empty (&xsurveyor->ready))
         events |= NN_SOCKBASE_EVENT_IN;
     return events;
 }
 
 int nn_xsurveyor_send (struct nn_sockbase *self, struct nn_msg *msg)
 {
-    return nn_dist_send (
-        &nn_cont (self, struct nn_xsurveyor, sockbase)->outpipes, msg, NULL);
+    struct nn_xsurveyor *xsurveyor;
+    struct nn_xsurveyor_reduction *reduction;
+
+    xsurveyor = nn_cont (self, struct nn_xsurveyor, sockbase);
+
+    /*  If the responses are to be combined, start collecting them. The survey
+        ID is at the beginning of the header. Surveys without it are passed
+        through and their responses are dropped. */
+    if (xsurveyor->reduce != NN_SURVEYOR_REDUCE_NONE &&
+          xsurveyor->outpipes.count > 0 &&
+          nn_chunkref_size (&msg->hdr) >= sizeof (uint32_t)) {
+        reduction = nn_alloc (sizeof (struct nn_xsurveyor_reduction),
+            "reduction (xsurveyor)");
+        alloc_assert (reduction);
+        nn_list_item_init (&reduction->item);
+        reduction->surveyid = nn_getl (nn_chunkref_data (&msg->hdr));
+        reduction->deadline = nn_clock_now (&self->clock) +
+            xsurveyor->deadline;
+        reduction->expected = xsurveyor->outpipes.count;
+        reduction->received = 0;
+        reduction->valid = 0;
+        reduction->value = 0;
+        reduction->data = NULL;
+        reduction->size = 0;
+        nn_list_insert (&xsurveyor->reductions, &reduction->item,
+            nn_list_end (&xsurveyor->reductions));
+        if (nn_list_begin (&xsurveyor->reductions) == &reduction->item)
+            nn_xsurveyor_settimer (xsurveyor);
+    }
+
+    return nn_dist_send (&xsurveyor->outpipes, msg, NULL);
 }
 
 int nn_xsurveyor_recv (struct nn_sockbase *self, struct nn_msg *msg)
 {
     int rc;
     struct nn_xsurveyor *xsurveyor;
+    struct nn_xsurveyor_reduction *reduction;
+    int first;
 
     xsurveyor = nn_cont (self, struct nn_xsurveyor, sockbase);
 
-    rc = nn_fq_recv (&xsurveyor->inpipes, msg, NULL);
+    if (xsurveyor->reduce == NN_SURVEYOR_REDUCE_NONE)
+        return nn_xsurveyor_recv_raw (xsurveyor, msg);
+
+    while (1) {
+
+        /*  Hand out the combined response that's ready, if any. */
+        if (!nn_list_empty (&xsurveyor->ready)) {
+            reduction = nn_cont (nn_list_begin (&xsurveyor->ready),
+                struct nn_xsurveyor_reduction, item);
+            nn_list_erase (&xsurveyor->ready, &reduction->item);
+            if (xsurveyor->reduce == NN_SURVEYOR_REDUCE_CONCAT) {
+                nn_msg_init (msg, reduction->size);
+                if (reduction->size)
+                    memcpy (nn_chunkref_data (&msg->body), reduction->data,
+                        reduction->size);
+            }
+            else {
+                nn_msg_init (msg, sizeof (uint64_t));
+                nn_putll (nn_chunkref_data (&msg->body),
+                    (uint64_t) reduction->value);
+            }
+            nn_chunkref_term (&msg->hdr);
+            nn_chunkref_init (&msg->hdr, sizeof (uint32_t));
+            nn_putl (nn_chunkref_data (&msg->hdr), reduction->surveyid);
+            if (reduction->data)
+                nn_free (reduction->data);
+            nn_list_item_term (&reduction->item);
+            nn_free (reduction);
+            return 0;
+        }
+
+        /*  Combine the responses as they arrive. Responses to the surveys
+            that are already over are dropped. */
+        rc = nn_xsurveyor_recv_raw (xsurveyor, msg);
+        if (nn_slow (rc < 0))
+            return rc;
+        reduction = nn_xsurveyor_find (xsurveyor,
+            nn_getl (nn_chunkref_data (&msg->hdr)));
+        if (nn_slow (!reduction)) {
+            nn_msg_term (msg);
+            continue;
+        }
+        nn_xsurveyor_combine (xsurveyor, reduction, msg);
+        nn_msg_term (msg);
+        if (++reduction->received < reduction->expected)
+            continue;
+
+        /*  All the responses have arrived. */
+        first = nn_list_begin (&xsurveyor->reductions) == &reduction->item;
+        nn_xsurveyor_finish (xsurveyor, reduction);
+        if (first)
+            nn_xsurveyor_settimer (xsurveyor);
+    }
+}
+
+static int nn_xsurveyor_recv_raw (struct nn_xsurveyor *self,
+    struct nn_msg *msg)
+{
+    int rc;
+
+    rc = nn_fq_recv (&self->inpipes, msg, NULL);
     if (nn_slow (rc < 0))
         return rc;
 
@@ -194,13 +326,194 @@ int nn_xsurveyor_recv (struct nn_sockbase *self, struct nn_msg *msg)
 int nn_xsurveyor_setopt (struct nn_sockbase *self, int level, int option,
         const void *optval, size_t optvallen)
 {
-    return -ENOPROTOOPT;
+    struct nn_xsurveyor *xsurveyor;
+    int val;
+
+    xsurveyor = nn_cont (self, struct nn_xsurveyor, sockbase);
+
+    if (level != NN_SURVEYOR)
+        return -ENOPROTOOPT;
+    if (option != NN_SURVEYOR_REDUCE && option != NN_SURVEYOR_DEADLINE)
+        return -ENOPROTOOPT;
+    if (nn_slow (optvallen != sizeof (int)))
+        return -EINVAL;
+    val = *(int*) optval;
+
+    if (option == NN_SURVEYOR_DEADLINE) {
+        if (nn_slow (val < 0))
+            return -EINVAL;
+        xsurveyor->deadline = val;
+        return 0;
+    }
+
+    /*  Switching the reducer drops the responses combined so far. */
+    if (nn_slow (val < NN_SURVEYOR_REDUCE_NONE ||
+          val > NN_SURVEYOR_REDUCE_CONCAT))
+        return -EINVAL;
+    nn_xsurveyor_drop (xsurveyor);
+    xsurveyor->reduce = val;
+    return 0;
 }
 
 int nn_xsurveyor_getopt (struct nn_sockbase *self, int level, int option,
         void *optval, size_t *optvallen)
 {
-    return -ENOPROTOOPT;
+    struct nn_xsurveyor *xsurveyor;
+    int val;
+
+    xsurveyor = nn_cont (self, struct nn_xsurveyor, sockbase);
+
+    if (level != NN_SURVEYOR)
+        return -ENOPROTOOPT;
+    if (option == NN_SURVEYOR_REDUCE)
+        val = xsurveyor->reduce;
+    else if (option == NN_SURVEYOR_DEADLINE)
+        val = xsurveyor->deadline;
+    else
+        return -ENOPROTOOPT;
+    if (nn_slow (*optvallen < sizeof (int)))
+        return -EINVAL;
+    *(int*) optval = val;
+    *optvallen = sizeof (int);
+    return 0;
+}
+
+static struct nn_xsurveyor_reduction *nn_xsurveyor_find (
+    struct nn_xsurveyor *self, uint32_t surveyid)
+{
+    struct nn_list_item *it;
+    struct nn_xsurveyor_reduction *reduction;
+
+    for (it = nn_list_begin (&self->reductions);
+          it != nn_list_end (&self->reductions);
+          it = nn_list_next (&self->reductions, it)) {
+        reduction = nn_cont (it, struct nn_xsurveyor_reduction, item);
+        if (reduction->surveyid == surveyid)
+            return reduction;
+    }
+    return NULL;
+}
+
+static void nn_xsurveyor_combine (struct nn_xsurveyor *self,
+    struct nn_xsurveyor_reduction *reduction, struct nn_msg *msg)
+{
+    size_t size;
+    int64_t val;
+
+    nn_msg_flatten (msg);
+    size = nn_chunkref_size (&msg->body);
+
+    if (self->reduce == NN_SURVEYOR_REDUCE_COUNT) {
+        ++reduction->value;
+        reduction->valid = 1;
+        return;
+    }
+
+    if (self->reduce == NN_SURVEYOR_REDUCE_CONCAT) {
+        if (size) {
+            reduction->data = nn_realloc (reduction->data,
+                reduction->size + size);
+            alloc_assert (reduction->data);
+            memcpy (reduction->data + reduction->size,
+                nn_chunkref_data (&msg->body), size);
+            reduction->size += size;
+        }
+        reduction->valid = 1;
+        return;
+    }
+
+    /*  The remaining reducers work on 64-bit signed integers in network
+        byte order. Responses of any other size are ignored. */
+    if (nn_slow (size != sizeof (uint64_t)))
+        return;
+    val = (int64_t) nn_getll (nn_chunkref_data (&msg->body));
+    if (!reduction->valid)
+        reduction->value = val;
+    else if (self->reduce == NN_SURVEYOR_REDUCE_SUM)
+        reduction->value += val;
+    else if (self->reduce == NN_SURVEYOR_REDUCE_MIN)
+        reduction->value = val < reduction->value ? val : reduction->value;
+    else
+        reduction->value = val > reduction->value ? val : reduction->value;
+    reduction->valid = 1;
+}
+
+static void nn_xsurveyor_finish (struct nn_xsurveyor *self,
+    struct nn_xsurveyor_reduction *reduction)
+{
+    nn_list_erase (&self->reductions, &reduction->item);
+
+    /*  If none of the responses contributed, there's nothing to send. */
+    if (!reduction->valid) {
+        if (reduction->data)
+            nn_free (reduction->data);
+        nn_list_item_term (&reduction->item);
+        nn_free (reduction);
+        return;
+    }
+
+    nn_list_insert (&self->ready, &reduction->item, nn_list_end (&self->ready));
+}
+
+static void nn_xsurveyor_drop (struct nn_xsurveyor *self)
+{
+    struct nn_list *lists [2];
+    struct nn_xsurveyor_reduction *reduction;
+    int i;
+
+    nn_timer_stop (&self->timer);
+    lists [0] = &self->reductions;
+    lists [1] = &self->ready;
+    for (i = 0; i != 2; ++i) {
+        while (!nn_list_empty (lists [i])) {
+            reduction = nn_cont (nn_list_begin (lists [i]),
+                struct nn_xsurveyor_reduction, item);
+            nn_list_erase (lists [i], &reduction->item);
+            if (reduction->data)
+                nn_free (reduction->data);
+            nn_list_item_term (&reduction->item);
+            nn_free (reduction);
+        }
+    }
+}
+
+static void nn_xsurveyor_settimer (struct nn_xsurveyor *self)
+{
+    uint64_t now;
+    struct nn_xsurveyor_reduction *reduction;
+
+    /*  The timer is set to the earliest deadline. */
+    nn_timer_stop (&self->timer);
+    if (nn_list_empty (&self->reductions))
+        return;
+    reduction = nn_cont (nn_list_begin (&self->reductions),
+        struct nn_xsurveyor_reduction, item);
+    now = nn_clock_now (&self->sockbase.clock);
+    nn_timer_start (&self->timer,
+        reduction->deadline > now ? (int) (reduction->deadline - now) : 0);
+}
+
+static void nn_xsurveyor_timeout (const struct nn_cp_sink **self,
+    struct nn_timer *timer)
+{
+    struct nn_xsurveyor *xsurveyor;
+    uint64_t now;
+    struct nn_xsurveyor_reduction *reduction;
+
+    xsurveyor = nn_cont (self, struct nn_xsurveyor, sink);
+
+    /*  Send the responses combined so far upwards, without waiting for
+        the missing ones. */
+    now = nn_clock_now (&xsurveyor->sockbase.clock);
+    while (!nn_list_empty (&xsurveyor->reductions)) {
+        reduction = nn_cont (nn_list_begin (&xsurveyor->reductions),
+            struct nn_xsurveyor_reduction, item);
+        if (reduction->deadline > now)
+            break;
+        nn_xsurveyor_finish (xsurveyor, reduction);
+    }
+    nn_xsurveyor_settimer (xsurveyor);
+    nn_sockbase_changed (&xsurveyor->sockbase);
 }
 
 static int nn_xsurveyor_create (struct nn_sockbase **sockbase)
@@ -223,8 +536,7 @@ static int nn_xsurveyor_create (struct nn_sockbase **sockbase)
 static struct nn_socktype nn_xsurveyor_socktype_struct = {
     AF_SP_RAW,
     NN_SURVEYOR,
-    nn_xsurveyor_create,
-    NN_LIST_ITEM_INITIALIZER
+    nn_xsurveyor_create
 };
 
 struct nn_socktype *nn_xsurveyor_socktype = &nn_xsurveyor_socktype_struct;
@@ -27,6 +27,9 @@
 
 #include "../../utils/dist.h"
 #include "../../utils/fq.h"
+#include "../../utils/list.h"
+
+#include <stdint.h>
 
 extern struct nn_socktype *nn_xsurveyor_socktype;
 
@@ -36,6 +39,29 @@ struct nn_xsurveyor_data {
     struct nn_fq_data initem;
 };
 
+/*  Survey whose responses are being combined into a single one. */
+struct nn_xsurveyor_reduction {
+    struct nn_list_item item;
+    uint32_t surveyid;
+
+    /*  Time when the combined response is sent upwards, even if some of
+        the responses are still missing. */
+    uint64_t deadline;
+
+    /*  Number of pipes the survey was sent to and number of responses
+        received so far. */
+    int expected;
+    int received;
+
+    /*  Combined value of the responses. For NN_SURVEYOR_REDUCE_CONCAT it's
+        the concatenation of their bodies. 'valid' is set once there's
+        anything to send upwards. */
+    int valid;
+    int64_t value;
+    uint8_t *data;
+    size_t size;
+};
+
 struct nn_xsurveyor {
 
     /*  The generic socket base class. */
@@ -46,6 +72,19 @@ struct nn_xsurveyor {
 
     /*  Fair-queuer to receive messages. */
     struct nn_fq inpipes;
+
+    /*  In-network aggregation. If 'reduce' is not NN_SURVEYOR_REDUCE_NONE,
+        the responses to each survey are combined and received as a single
+        message once all of them arrive or the deadline expires. */
+    int reduce;
+    int deadline;
+    const struct nn_cp_sink *sink;
+    struct nn_timer timer;
+
+    /*  Surveys being reduced, ordered by their deadlines, and surveys whose
+        combined responses are ready to be received. */
+    struct nn_list reductions;
+    struct nn_list ready;
 };
 
 int nn_xsurveyor_init (struct nn_xsurveyor *self,
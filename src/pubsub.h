@@ -34,6 +34,58 @@ extern "C" {
 
 #define NN_SUB_SUBSCRIBE 1
 #define NN_SUB_UNSUBSCRIBE 2
+#define NN_SUB_EXACT_SUBSCRIBE 3
+#define NN_SUB_EXACT_UNSUBSCRIBE 4
+#define NN_SUB_TOPIC_DELIMITER 5
+#define NN_SUB_CONFLATE 6
+#define NN_SUB_REPLAY 7
+#define NN_SUB_SEQ 8
+#define NN_SUB_SUBSCRIBE_BULK 9
+#define NN_SUB_TRIE_STATS 10
+#define NN_SUB_PATTERN_SUBSCRIBE 11
+#define NN_SUB_PATTERN_UNSUBSCRIBE 12
+#define NN_SUB_PATTERN_SEPARATOR 13
+
+#define NN_PUB_CONFLATE 1
+#define NN_PUB_TOPIC_DELIMITER 2
+#define NN_PUB_LAST_VALUE_CACHE 3
+#define NN_PUB_PIPE_STATS 4
+#define NN_PUB_JOURNAL 5
+#define NN_PUB_JOURNAL_SIZE 6
+#define NN_PUB_EVICT_TIMEOUT 7
+#define NN_PUB_EVICT_DROPS 8
+
+/*  Statistics of a single subscriber, as returned by NN_PUB_PIPE_STATS.
+    The sizes are the sizes of message bodies. */
+struct nn_pub_pipe_stats {
+
+    /*  ID of the endpoint the subscriber is connected via. */
+    int eid;
+
+    /*  Messages passed to the subscriber. */
+    unsigned long long sent;
+    unsigned long long sentbytes;
+
+    /*  Messages dropped because the subscriber was not keeping up. */
+    unsigned long long dropped;
+    unsigned long long droppedbytes;
+
+    /*  Messages kept by the socket until the subscriber is ready
+        to receive them. */
+    unsigned long long queued;
+    unsigned long long queuedbytes;
+};
+
+/*  Size of the prefix subscriptions of a SUB socket, as returned by
+    NN_SUB_TRIE_STATS. */
+struct nn_sub_trie_stats {
+
+    /*  Number of nodes in the trie. */
+    unsigned long long nodes;
+
+    /*  Memory allocated for the nodes, in bytes. */
+    unsigned long long bytes;
+};
 
 #ifdef __cplusplus
 }
@@ -33,6 +33,15 @@ extern "C" {
 #define NN_REP (NN_PROTO_REQREP * 16 + 1)
 
 #define NN_REQ_RESEND_IVL 1
+#define NN_REQ_PIPELINE 2
+#define NN_REQ_LEAST_BUSY 3
+#define NN_REQ_ADAPTIVE_RESEND 4
+#define NN_REQ_HEDGE_IVL 5
+#define NN_REQ_LATENCY 6
+#define NN_REQ_AFFINITY 7
+
+#define NN_REP_MAXWAIT 1
+#define NN_REP_DEDUP 2
 
 #ifdef __cplusplus
 }
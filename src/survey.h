@@ -33,6 +33,21 @@ extern "C" {
 #define NN_RESPONDENT (NN_PROTO_SURVEY * 16 + 1)
 
 #define NN_SURVEYOR_DEADLINE 1
+#define NN_SURVEYOR_BATCH 2
+#define NN_SURVEYOR_QUORUM 3
+#define NN_SURVEYOR_CONCURRENT 4
+#define NN_SURVEYOR_LATENCY 5
+#define NN_SURVEYOR_REDUCE 6
+
+#define NN_RESPONDENT_DEDUP 1
+
+/*  Reducers combining the responses on raw surveyor sockets. */
+#define NN_SURVEYOR_REDUCE_NONE 0
+#define NN_SURVEYOR_REDUCE_COUNT 1
+#define NN_SURVEYOR_REDUCE_SUM 2
+#define NN_SURVEYOR_REDUCE_MIN 3
+#define NN_SURVEYOR_REDUCE_MAX 4
+#define NN_SURVEYOR_REDUCE_CONCAT 5
 
 #ifdef __cplusplus
 }
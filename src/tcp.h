@@ -30,6 +30,19 @@ extern "C" {
 #define NN_TCP -3
 
 #define NN_TCP_NODELAY 1
+#define NN_TCP_CORK 2
+#define NN_TCP_BUSY_POLL 3
+#define NN_TCP_LISTENERS 4
+#define NN_TCP_TLS 5
+#define NN_TCP_TLS_CERT 6
+#define NN_TCP_TLS_KEY 7
+#define NN_TCP_TLS_CA 8
+#define NN_TCP_COMPRESS 9
+#define NN_TCP_ZEROCOPY 10
+#define NN_TCP_RSS 11
+#define NN_TCP_CRC 12
+#define NN_TCP_NOTSENT_LOWAT 13
+#define NN_TCP_FASTOPEN 14
 
 #ifdef __cplusplus
 }
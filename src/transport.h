@@ -37,6 +37,7 @@
 
 struct nn_sock;
 struct nn_cp;
+struct nn_budget;
 
 /******************************************************************************/
 /*  Container for transport-specific socket options.                          */
@@ -72,6 +73,20 @@ struct nn_epbase_vfptr {
         to send the pending outbound data. In such case the function returns
         -EINPROGRESS error. */
     int (*close) (struct nn_epbase *self);
+
+    /*  Hot restart (see nn_handoff). Passes the endpoint and those of its
+        connections that can be passed without losing data over to another
+        process via UNIX domain socket 'fd', using nn_epbase_handoff and
+        nn_epbase_handoffpipe. The core closes the endpoint afterwards.
+        Returns 0 or a negative error code. NULL if the endpoint can't be
+        handed off. */
+    int (*handoff) (struct nn_epbase *self, int fd);
+
+    /*  Takes over connection 's' handed off by the endpoint this endpoint
+        was adopted from. 'state' is the state of the connection as passed
+        to nn_epbase_handoffpipe. In case of failure the core closes 's'. */
+    int (*adoptpipe) (struct nn_epbase *self, int s, const void *state,
+        size_t len);
 };
 
 /*  The members of this structure are used exclusively by the core. Never use
@@ -80,6 +95,9 @@ struct nn_epbase {
     const struct nn_epbase_vfptr *vfptr;
     struct nn_sock *sock;
     int eid;
+    int transport;
+    int sndprio;
+    int rcvprio;
     struct nn_list_item item;
     char addr [NN_SOCKADDR_MAX + 1];
 };
@@ -97,9 +115,19 @@ void nn_epbase_term (struct nn_epbase *self);
 /*  Returns the default completion port associated with the current socket. */
 struct nn_cp *nn_epbase_getcp (struct nn_epbase *self);
 
-/*  Returns a worker. Each call to this function may return different worker. */
+/*  Returns a worker. Each call to this function may return different worker.
+    The transport is expected to call this function once per pipe and use the
+    returned worker for the whole lifetime of the pipe. */
 struct nn_worker *nn_epbase_choose_worker (struct nn_epbase *self);
 
+/*  Returns 1 if the completion port of the socket is not shared with other
+    sockets (see NN_CP_THREADS), 0 otherwise. */
+int nn_epbase_ownscp (struct nn_epbase *self);
+
+/*  Returns the memory budget the pipes of the socket draw from, or NULL if
+    the socket has none (see NN_MEMBUDGET). */
+struct nn_budget *nn_epbase_getbudget (struct nn_epbase *self);
+
 /*  Returns the address string associated with this endpoint. */
 const char *nn_epbase_getaddr (struct nn_epbase *self);
 
@@ -111,6 +139,16 @@ void nn_epbase_getopt (struct nn_epbase *self, int level, int option,
     or 0 otherwise. */
 int nn_epbase_ispeer (struct nn_epbase *self, int socktype);
 
+/*  Hot restart (see nn_handoff). nn_epbase_handoff sends the endpoint's
+    address along with its listening sockets 'fds' via UNIX domain socket
+    'fd'. nn_epbase_handoffpipe then sends each connection 's', along with
+    its state, to be passed to the successor's adoptpipe function. Both
+    return 0 or a negative error code. */
+int nn_epbase_handoff (struct nn_epbase *self, int fd, const int *fds,
+    int nfds);
+int nn_epbase_handoffpipe (struct nn_epbase *self, int fd, int s,
+    const void *state, size_t len);
+
 /******************************************************************************/
 /*  The base class for pipes.                                                 */
 /******************************************************************************/
@@ -143,6 +181,11 @@ struct nn_pipebase_vfptr {
     /*  Receive a message from the network. The function can return either error
         (negative number) or any combination of the flags defined above. */
     int (*recv) (struct nn_pipebase *self, struct nn_msg *msg);
+
+    /*  Break the connection as if it failed. The pipe has to be removed from
+        the socket before the function returns. NULL if the transport is not
+        able to do that. */
+    void (*close) (struct nn_pipebase *self);
 };
 
 /*  The member of this structure are used internally by the core. Never use
@@ -152,6 +195,10 @@ struct nn_pipebase {
     uint8_t instate;
     uint8_t outstate;
     struct nn_sock *sock;
+    int eid;
+    uint32_t id;
+    int sndprio;
+    int rcvprio;
     void *data;
 };
 
@@ -172,6 +219,10 @@ void nn_pipebase_received (struct nn_pipebase *self);
 /*  Call this function when current outgoing message was fully sent. */
 void nn_pipebase_sent (struct nn_pipebase *self);
 
+/*  Returns 1 if the pipe is receiving the next message, 0 if the message
+    received last is still waiting for the user. */
+int nn_pipebase_isreceiving (struct nn_pipebase *self);
+
 /*  Returns the default completion port associated with the pipe. */
 struct nn_cp *nn_pipebase_getcp (struct nn_pipebase *self);
 
@@ -179,10 +230,55 @@ struct nn_cp *nn_pipebase_getcp (struct nn_pipebase *self);
     or 0 otherwise. */
 int nn_pipebase_ispeer (struct nn_pipebase *self, int socktype);
 
+/*  Returns the current time of the socket's clock, in milliseconds, as used
+    for the deadlines of the messages. */
+uint64_t nn_pipebase_now (struct nn_pipebase *self);
+
+/*  Returns 1 if the message has outlived its NN_SNDTTL and accounts for it
+    in the socket statistics. The caller is supposed to drop the message. */
+int nn_pipebase_expired (struct nn_pipebase *self, struct nn_msg *msg);
+
+/*  Accounts for a message dropped by the transport because it had been
+    queued for too long (see NN_CODEL_TARGET) in the socket statistics. */
+void nn_pipebase_shed (struct nn_pipebase *self, struct nn_msg *msg);
+
+/*  Accounts for messages the peer sent but the transport lost on the way,
+    e.g. because the reader didn't keep up with a lossy shared ring, in
+    the same statistics. */
+void nn_pipebase_lost (struct nn_pipebase *self, uint64_t msgs,
+    uint64_t bytes);
+
+/*  Work the transport wants to be done once the socket is done passing
+    the messages to the pipes, typically waking the peer up. While a message
+    is being sent to many pipes, doing it for all of them at once, e.g. one
+    wake-up per thread rather than one per pipe, is cheaper. */
+struct nn_pipebase_deferred {
+    struct nn_list_item item;
+    void (*fn) (struct nn_pipebase_deferred *self);
+};
+
+void nn_pipebase_deferred_init (struct nn_pipebase_deferred *self,
+    void (*fn) (struct nn_pipebase_deferred *self));
+void nn_pipebase_deferred_term (struct nn_pipebase_deferred *self);
+
+/*  If the pipe is sending as part of nn_send(), queues 'deferred' to be run
+    once the socket is done sending and returns 1. If it's already queued,
+    it's run only once. Returns 0 otherwise, in which case the transport has
+    to do the work straight away. The socket doesn't remove a pipe while
+    sending, so the work is run before the pipe can be terminated. */
+int nn_pipebase_defer (struct nn_pipebase *self,
+    struct nn_pipebase_deferred *deferred);
+
 /******************************************************************************/
 /*  The transport class.                                                      */
 /******************************************************************************/
 
+/*  The address passed to nn_connect may be a comma-separated list of
+    addresses. An endpoint is created for each of them. The endpoints share
+    a single endpoint ID. Don't set the flag if commas can appear in
+    the addresses of the transport. */
+#define NN_TRANSPORT_ADDRLIST 1
+
 struct nn_transport {
 
     /*  Name of the transport as it appears in the connection strings ("tcp",
@@ -192,6 +288,9 @@ struct nn_transport {
     /*  ID of the transport. */
     int id;
 
+    /*  Combination of NN_TRANSPORT_* flags. */
+    int flags;
+
     /*  Following methods are guarded by a global critical section. Two of these
         function will never be invoked in parallel. The first is called when
         the library is initialised, the second one when it is terminated, i.e.
@@ -212,9 +311,13 @@ struct nn_transport {
         socket options available. */
     struct nn_optset *(*optset) ();
 
-    /*  This member is used exclusively by the core. Never touch it directly
-        from the transport. */
-    struct nn_list_item item;
+    /*  Creates an endpoint the same way as 'bind' does, except that it takes
+        over the listening sockets 'fds' of an endpoint handed off by another
+        process (see nn_handoff). The sockets are closed in case of failure.
+        Set this member to NULL if the transport doesn't support hot
+        restart. */
+    int (*adopt) (const char *addr, void *hint, const int *fds, int nfds,
+        struct nn_epbase **epbase);
 };
 
 #endif
@@ -0,0 +1,435 @@
+/*
+    Copyright (c) 2012-2013 250bpm s.r.o.
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"),
+    to deal in the Software without restriction, including without limitation
+    the rights to use, copy, modify, merge, publish, distribute, sublicense,
+    and/or sell copies of the Software, and to permit persons to whom
+    the Software is furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included
+    in all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+    THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+    FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+    IN THE SOFTWARE.
+*/
+
+#include "bcast.h"
+
+#include "../../utils/err.h"
+#include "../../utils/fast.h"
+#include "../../utils/alloc.h"
+#include "../../utils/chunkref.h"
+
+#include <string.h>
+
+/*  Private functions. */
+static size_t nn_bcast_msgsz (struct nn_bcast_reader *reader,
+    struct nn_msg *msg);
+static int nn_bcast_same (struct nn_msg *a, struct nn_msg *b);
+static int nn_bcast_isfull (struct nn_bcast_reader *reader, uint32_t count,
+    uint32_t mem);
+static int nn_bcast_isdrained (struct nn_bcast_reader *reader,
+    uint32_t count, uint32_t mem);
+static void nn_bcast_reclaim (struct nn_bcast *self);
+static uint64_t nn_bcast_need (struct nn_bcast *self,
+    struct nn_bcast_reader *reader, uint64_t head);
+static void nn_bcast_overrun (struct nn_bcast *self, int reader);
+
+struct nn_bcast *nn_bcast_create (void)
+{
+    int i;
+    struct nn_bcast *self;
+    struct nn_bcast_reader *r;
+
+    self = nn_alloc (sizeof (struct nn_bcast), "bcast");
+    alloc_assert (self);
+    nn_mutex_init (&self->sync);
+    nn_atomic_init (&self->refcount, 1);
+    self->tail = 0;
+    nn_atomic64_init (&self->head, 0);
+    self->stamped = 0;
+    nn_clock_init (&self->clock);
+    for (i = 0; i != NN_BCAST_MAXREADERS; ++i) {
+        r = &self->readers [i];
+        nn_mutex_init (&r->sync);
+        nn_atomic64_init (&r->avail, 0);
+        nn_atomic_init (&r->written, 0);
+        nn_atomic_init (&r->read, 0);
+        nn_atomic_init (&r->count, 0);
+        nn_atomic_init (&r->blocked, 0);
+        nn_codel_init (&r->codel, -1, 0);
+        nn_clock_init (&r->clock);
+        r->attached = 0;
+    }
+    return self;
+}
+
+void nn_bcast_addref (struct nn_bcast *self)
+{
+    nn_atomic_addref (&self->refcount, 1);
+}
+
+void nn_bcast_release (struct nn_bcast *self)
+{
+    int i;
+    uint64_t seq;
+    uint64_t head;
+    struct nn_bcast_reader *r;
+
+    if (nn_atomic_decref (&self->refcount, 1) != 1)
+        return;
+
+    /*  All the readers are detached by now. */
+    head = nn_atomic64_load (&self->head);
+    for (seq = self->tail; seq != head; ++seq)
+        nn_msg_term (&self->slots [seq % NN_BCAST_SIZE].msg);
+    for (i = 0; i != NN_BCAST_MAXREADERS; ++i) {
+        r = &self->readers [i];
+        nn_assert (!r->attached);
+        nn_clock_term (&r->clock);
+        nn_atomic_term (&r->blocked);
+        nn_atomic_term (&r->count);
+        nn_atomic_term (&r->read);
+        nn_atomic_term (&r->written);
+        nn_atomic64_term (&r->avail);
+        nn_mutex_term (&r->sync);
+    }
+    nn_clock_term (&self->clock);
+    nn_atomic64_term (&self->head);
+    nn_atomic_term (&self->refcount);
+    nn_mutex_term (&self->sync);
+    nn_free (self);
+}
+
+int nn_bcast_attach (struct nn_bcast *self, size_t maxmem, size_t lowmem,
+    uint32_t maxmsgs, uint32_t lowmsgs, int target, int interval)
+{
+    int i;
+    uint64_t head;
+    struct nn_bcast_reader *r;
+
+    nn_mutex_lock (&self->sync);
+    for (i = 0; i != NN_BCAST_MAXREADERS; ++i)
+        if (!self->readers [i].attached)
+            break;
+    if (nn_slow (i == NN_BCAST_MAXREADERS)) {
+        nn_mutex_unlock (&self->sync);
+        return -EMFILE;
+    }
+
+    r = &self->readers [i];
+    head = nn_atomic64_load (&self->head);
+    r->cursor = head;
+    r->last = head;
+    nn_atomic64_store (&r->avail, head);
+    r->maxmem = maxmem;
+    r->lowmem = lowmem;
+    r->maxmsgs = maxmsgs;
+    r->lowmsgs = lowmsgs;
+    nn_atomic_store (&r->written, 0);
+    nn_atomic_store (&r->read, 0);
+    nn_atomic_store (&r->count, 0);
+    nn_atomic_store (&r->blocked, 0);
+    r->stashed = 0;
+    nn_codel_init (&r->codel, target, interval);
+    if (nn_codel_active (&r->codel))
+        self->stamped = 1;
+    r->attached = 1;
+    r->dead = 0;
+    nn_mutex_unlock (&self->sync);
+    return i;
+}
+
+void nn_bcast_stop (struct nn_bcast *self, int reader)
+{
+    nn_mutex_lock (&self->readers [reader].sync);
+    self->readers [reader].dead = 1;
+    nn_mutex_unlock (&self->readers [reader].sync);
+}
+
+void nn_bcast_detach (struct nn_bcast *self, int reader)
+{
+    struct nn_bcast_reader *r;
+
+    /*  The bit of the reader may still be set in some of the slots. That's
+        harmless as the next reader with the same index starts past them. */
+    r = &self->readers [reader];
+    nn_mutex_lock (&self->sync);
+    nn_mutex_lock (&r->sync);
+    if (r->stashed) {
+        nn_msg_term (&r->stash);
+        r->stashed = 0;
+    }
+    r->attached = 0;
+    nn_mutex_unlock (&r->sync);
+    nn_mutex_unlock (&self->sync);
+}
+
+int nn_bcast_send (struct nn_bcast *self, int reader, struct nn_msg *msg)
+{
+    int rc;
+    int result;
+    uint64_t bit;
+    uint64_t head;
+    uint32_t written;
+    uint32_t count;
+    struct nn_bcast_slot *slot;
+    struct nn_bcast_reader *r;
+
+    bit = ((uint64_t) 1) << reader;
+    r = &self->readers [reader];
+    written = nn_atomic_load (&r->written) + (uint32_t) nn_bcast_msgsz (r, msg);
+    head = nn_atomic64_load (&self->head);
+
+    /*  The same message was just written for other readers. */
+    slot = &self->slots [(head - 1) % NN_BCAST_SIZE];
+    if (head != self->tail && !(slot->readers & bit) &&
+          nn_bcast_same (&slot->msg, msg)) {
+        slot->readers |= bit;
+        nn_msg_term (msg);
+    }
+    else {
+        if (nn_slow (head - self->tail == NN_BCAST_SIZE))
+            nn_bcast_reclaim (self);
+        slot = &self->slots [head % NN_BCAST_SIZE];
+        nn_msg_mv (&slot->msg, msg);
+        slot->readers = bit;
+        slot->stamp = nn_slow (self->stamped) ?
+            nn_clock_now (&self->clock) : 0;
+        ++head;
+        nn_atomic64_store (&self->head, head);
+    }
+
+    /*  Publish the message to the reader. From here on it's the same as with
+        nn_msgqueue_send. */
+    r->last = head;
+    nn_atomic64_store (&r->avail, head);
+    nn_atomic_store (&r->written, written);
+    count = nn_atomic_inc (&r->count, 1) + 1;
+    result = count == 1 ? NN_MSGQUEUE_SIGNAL : 0;
+    if (nn_slow (nn_bcast_isfull (r, count,
+          written - nn_atomic_load (&r->read)))) {
+        rc = nn_atomic_cas (&r->blocked, 0, 1);
+        nn_assert (rc);
+        if (!nn_bcast_isdrained (r, nn_atomic_get (&r->count),
+              written - nn_atomic_get (&r->read)) ||
+              !nn_atomic_cas (&r->blocked, 1, 0))
+            result |= NN_MSGQUEUE_RELEASE;
+    }
+
+    return result;
+}
+
+int nn_bcast_recv (struct nn_bcast *self, int reader, struct nn_msg *msg)
+{
+    int result;
+    uint64_t bit;
+    uint64_t cursor;
+    uint64_t avail;
+    uint64_t stamp;
+    uint32_t read;
+    struct nn_bcast_slot *slot;
+    struct nn_bcast_reader *r;
+
+    bit = ((uint64_t) 1) << reader;
+    r = &self->readers [reader];
+    nn_mutex_lock (&r->sync);
+    if (nn_slow (!nn_atomic_load (&r->count))) {
+        nn_mutex_unlock (&r->sync);
+        return -EAGAIN;
+    }
+
+    /*  Messages kept aside when the reader was overrun go first. Otherwise,
+        find the next slot meant for the reader. It's there, as the count is
+        incremented only after the slot is published. */
+    if (nn_slow (r->stashed)) {
+        nn_msg_mv (msg, &r->stash);
+        stamp = r->stashstamp;
+        r->stashed = 0;
+    }
+    else {
+        avail = nn_atomic64_load (&r->avail);
+        for (cursor = r->cursor; cursor != avail; ++cursor) {
+            slot = &self->slots [cursor % NN_BCAST_SIZE];
+            if (slot->readers & bit)
+                break;
+        }
+        nn_assert (cursor != avail);
+        nn_msg_cp (msg, &slot->msg);
+        stamp = slot->stamp;
+        r->cursor = cursor + 1;
+    }
+
+    /*  The rest is the same as with nn_msgqueue_recv. */
+    read = nn_atomic_load (&r->read) + (uint32_t) nn_bcast_msgsz (r, msg);
+    nn_atomic_store (&r->read, read);
+    result = nn_atomic_dec (&r->count, 1) == 1 ? NN_MSGQUEUE_RELEASE : 0;
+    if (nn_slow (nn_atomic_load (&r->blocked)) &&
+          nn_bcast_isdrained (r, nn_atomic_get (&r->count),
+          nn_atomic_get (&r->written) - read) &&
+          nn_atomic_cas (&r->blocked, 1, 0))
+        result |= NN_MSGQUEUE_SIGNAL;
+    if (nn_slow (nn_codel_active (&r->codel)) && nn_codel_drop (&r->codel,
+          nn_clock_now (&r->clock), stamp, result & NN_MSGQUEUE_RELEASE))
+        result |= NN_MSGQUEUE_DROP;
+    nn_mutex_unlock (&r->sync);
+
+    return result;
+}
+
+static size_t nn_bcast_msgsz (struct nn_bcast_reader *reader,
+    struct nn_msg *msg)
+{
+    size_t msgsz;
+
+    msgsz = nn_chunkref_size (&msg->hdr) + nn_msg_bodysize (msg);
+    return msgsz > reader->maxmem ? reader->maxmem : msgsz;
+}
+
+static int nn_bcast_same (struct nn_msg *a, struct nn_msg *b)
+{
+    size_t sz;
+
+    /*  Copies of a published message share the body chunk. Bodies stored in
+        the chunkref itself are compared byte by byte. */
+    if (a->frags || b->frags || a->urgent != b->urgent ||
+          a->deadline != b->deadline ||
+          a->chunkoff != b->chunkoff || a->chunktotal != b->chunktotal)
+        return 0;
+    sz = nn_chunkref_size (&a->hdr);
+    if (sz != nn_chunkref_size (&b->hdr) || memcmp (nn_chunkref_data (&a->hdr),
+          nn_chunkref_data (&b->hdr), sz) != 0)
+        return 0;
+    sz = nn_chunkref_size (&a->trace);
+    if (sz != nn_chunkref_size (&b->trace) || memcmp (
+          nn_chunkref_data (&a->trace), nn_chunkref_data (&b->trace), sz) != 0)
+        return 0;
+    sz = nn_chunkref_size (&a->body);
+    if (sz != nn_chunkref_size (&b->body))
+        return 0;
+    if (nn_chunkref_data (&a->body) == nn_chunkref_data (&b->body))
+        return 1;
+    return sz < NN_CHUNKREF_MAX && memcmp (nn_chunkref_data (&a->body),
+        nn_chunkref_data (&b->body), sz) == 0;
+}
+
+static int nn_bcast_isfull (struct nn_bcast_reader *reader, uint32_t count,
+    uint32_t mem)
+{
+    return count >= 2 && (mem >= reader->maxmem || count >= reader->maxmsgs);
+}
+
+static int nn_bcast_isdrained (struct nn_bcast_reader *reader,
+    uint32_t count, uint32_t mem)
+{
+    return count < 2 || (mem <= reader->lowmem && count <= reader->lowmsgs);
+}
+
+static void nn_bcast_reclaim (struct nn_bcast *self)
+{
+    int i;
+    int overrun;
+    uint64_t head;
+    uint64_t need;
+    uint64_t min;
+    uint64_t seq;
+
+    /*  Free the slots all the readers are past. If that doesn't free at least
+        half of the ring, overrun the readers that lag behind more than that,
+        so that the ring doesn't fill up again straight away. */
+    head = nn_atomic64_load (&self->head);
+    nn_mutex_lock (&self->sync);
+    for (overrun = 0; overrun != 2; ++overrun) {
+        min = head;
+        for (i = 0; i != NN_BCAST_MAXREADERS; ++i) {
+            if (!self->readers [i].attached)
+                continue;
+            need = nn_bcast_need (self, &self->readers [i], head);
+            if (overrun && head - need > NN_BCAST_SIZE / 2) {
+                nn_bcast_overrun (self, i);
+                need = head;
+            }
+            if (need < min)
+                min = need;
+        }
+        if (head - min <= NN_BCAST_SIZE / 2)
+            break;
+    }
+    for (seq = self->tail; seq != min; ++seq)
+        nn_msg_term (&self->slots [seq % NN_BCAST_SIZE].msg);
+    self->tail = min;
+    nn_mutex_unlock (&self->sync);
+}
+
+static uint64_t nn_bcast_need (struct nn_bcast *self,
+    struct nn_bcast_reader *reader, uint64_t head)
+{
+    uint64_t need;
+
+    /*  The oldest slot the reader may still read. If all its messages in
+        the ring were read, it doesn't need any. Its cursor is moved up to
+        the newest slot then, as it may lag behind the slots about to be
+        reclaimed. The newest slot itself may still be shared with the reader
+        by the next send, unless it's the one the reader has just read. */
+    nn_mutex_lock (&reader->sync);
+    if (!reader->dead && nn_atomic_get (&reader->count) >
+          (uint32_t) reader->stashed)
+        need = reader->cursor;
+    else {
+        reader->cursor = reader->last == head ? head : head - 1;
+        need = head;
+    }
+    nn_mutex_unlock (&reader->sync);
+    return need;
+}
+
+static void nn_bcast_overrun (struct nn_bcast *self, int reader)
+{
+    uint64_t bit;
+    uint64_t seq;
+    uint32_t count;
+    uint32_t dropped;
+    size_t droppedsz;
+    struct nn_bcast_slot *slot;
+    struct nn_bcast_reader *r;
+
+    /*  Keep the newest message of the reader aside and drop the rest. The
+        reader can't be reading at the moment, so its side of the accounting
+        can be adjusted here. */
+    bit = ((uint64_t) 1) << reader;
+    r = &self->readers [reader];
+    nn_mutex_lock (&r->sync);
+    count = nn_atomic_get (&r->count);
+    if (!r->dead && count > (uint32_t) r->stashed) {
+        dropped = 0;
+        droppedsz = 0;
+        if (r->stashed) {
+            ++dropped;
+            droppedsz += nn_bcast_msgsz (r, &r->stash);
+            nn_msg_term (&r->stash);
+        }
+        for (seq = r->cursor; seq != r->last - 1; ++seq) {
+            slot = &self->slots [seq % NN_BCAST_SIZE];
+            if (slot->readers & bit) {
+                ++dropped;
+                droppedsz += nn_bcast_msgsz (r, &slot->msg);
+            }
+        }
+        slot = &self->slots [(r->last - 1) % NN_BCAST_SIZE];
+        nn_msg_cp (&r->stash, &slot->msg);
+        r->stashstamp = slot->stamp;
+        r->stashed = 1;
+        r->cursor = r->last;
+        nn_atomic_store (&r->read,
+            nn_atomic_load (&r->read) + (uint32_t) droppedsz);
+        nn_atomic_dec (&r->count, dropped);
+    }
+    nn_mutex_unlock (&r->sync);
+}
@@ -0,0 +1,169 @@
+/*
+    Copyright (c) 2012-2013 250bpm s.r.o.
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"),
+    to deal in the Software without restriction, including without limitation
+    the rights to use, copy, modify, merge, publish, distribute, sublicense,
+    and/or sell copies of the Software, and to permit persons to whom
+    the Software is furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included
+    in all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+    THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+    FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+    IN THE SOFTWARE.
+*/
+
+#ifndef NN_BCAST_INCLUDED
+#define NN_BCAST_INCLUDED
+
+#include "msgqueue.h"
+
+#include "../../utils/msg.h"
+#include "../../utils/mutex.h"
+#include "../../utils/atomic.h"
+#include "../../utils/cacheline.h"
+#include "../../utils/clock.h"
+#include "../../utils/codel.h"
+
+#include <stdint.h>
+
+/*  Ring shared by the inproc pipes from a bound PUB socket to its SUB peers.
+    A message published to several subscribers is written into the ring once,
+    marked with the set of subscribers it is meant for. Each subscriber reads
+    the ring from its own cursor, skipping the messages that are not for it.
+    There's one writer, the publisher's socket, and up to NN_BCAST_MAXREADERS
+    readers, each in the thread of its own socket. The messages pending for
+    each reader are limited the same way as with nn_msgqueue.
+
+    The slots are reclaimed by the writer once all the readers are past them.
+    If the ring is full because of a reader that lags far behind, the reader
+    is overrun: the messages it hasn't read are dropped except for the newest
+    one. */
+
+/*  Number of slots in the ring. Must be a power of two. */
+#define NN_BCAST_SIZE 1024
+
+/*  Maximum number of readers of a ring. */
+#define NN_BCAST_MAXREADERS 64
+
+struct nn_bcast_slot {
+    struct nn_msg msg;
+
+    /*  Readers the message is meant for, one bit per reader. Bits are added
+        by the writer while the slot is the newest one. */
+    volatile uint64_t readers;
+
+    /*  Time the message was written, if any reader has nn_codel enabled,
+        zero otherwise. */
+    uint64_t stamp;
+};
+
+struct nn_bcast_reader {
+
+    /*  Guards the cursor and the stashed message. Taken by the reader while
+        reading and by the writer while reclaiming the slots. */
+    struct nn_mutex sync;
+
+    /*  Sequence number of the slot to look for the next message at. */
+    uint64_t cursor;
+
+    /*  Sequence number past the newest slot meant for the reader. Published
+        before the message is accounted for in 'count'. */
+    struct nn_atomic64 avail;
+
+    /*  Writer's copy of 'avail'. */
+    uint64_t last;
+
+    /*  Limits and accounting of the messages pending for the reader. These
+        have the same meaning as in nn_msgqueue. */
+    size_t maxmem;
+    size_t lowmem;
+    uint32_t maxmsgs;
+    uint32_t lowmsgs;
+    struct nn_atomic written;
+    struct nn_atomic read;
+    struct nn_atomic count;
+    struct nn_atomic blocked;
+
+    /*  Newest message of the reader that was overrun, if 'stashed' is set,
+        and the time it was written. */
+    int stashed;
+    struct nn_msg stash;
+    uint64_t stashstamp;
+
+    /*  Queue management policy of the reader and the clock to measure
+        the time the messages have spent in the ring with. */
+    struct nn_codel codel;
+    struct nn_clock clock;
+
+    /*  Set while the reader is attached to the ring. 'dead' is set once it
+        won't read any more. */
+    int attached;
+    int dead;
+
+    NN_CACHELINE_PAD (pad);
+};
+
+struct nn_bcast {
+
+    /*  Guards the set of readers and the slot reclamation. */
+    struct nn_mutex sync;
+
+    /*  The ring is deallocated when the last reference is dropped. */
+    struct nn_atomic refcount;
+
+    /*  Sequence numbers of the oldest slot in use and of the next slot to be
+        written. 'head' is read by other threads only when attaching a new
+        reader. */
+    uint64_t tail;
+    struct nn_atomic64 head;
+
+    /*  Set once a reader with nn_codel enabled attaches. From then on
+        the writer stamps the messages using its clock. */
+    volatile int stamped;
+    struct nn_clock clock;
+
+    struct nn_bcast_slot slots [NN_BCAST_SIZE];
+    NN_CACHELINE_PAD (pad);
+    struct nn_bcast_reader readers [NN_BCAST_MAXREADERS];
+};
+
+/*  Allocates a ring. The caller holds the only reference. */
+struct nn_bcast *nn_bcast_create (void);
+
+/*  Adds a reference to the ring. */
+void nn_bcast_addref (struct nn_bcast *self);
+
+/*  Drops a reference. The last one deallocates the ring. */
+void nn_bcast_release (struct nn_bcast *self);
+
+/*  Attaches a new reader. It gets only the messages written from now on.
+    The limits are those of an nn_msgqueue, as adjusted by nn_msgqueue_init,
+    and so are the target and interval of nn_codel (see nn_msgqueue_codel).
+    Returns the index of the reader or -EMFILE if there are too many. */
+int nn_bcast_attach (struct nn_bcast *self, size_t maxmem, size_t lowmem,
+    uint32_t maxmsgs, uint32_t lowmsgs, int target, int interval);
+
+/*  The reader won't read any more. It no longer holds the slots back. */
+void nn_bcast_stop (struct nn_bcast *self, int reader);
+
+/*  Detaches the reader. The writer must not send to it any more. */
+void nn_bcast_detach (struct nn_bcast *self, int reader);
+
+/*  Writes the message for the reader. If the newest slot holds the same
+    message, the reader is just added to it. The message is taken over by
+    the ring. Returns the same flags as nn_msgqueue_send. */
+int nn_bcast_send (struct nn_bcast *self, int reader, struct nn_msg *msg);
+
+/*  Reads the next message for the reader. Returns -EAGAIN if there's none,
+    otherwise the same flags as nn_msgqueue_recv. */
+int nn_bcast_recv (struct nn_bcast *self, int reader, struct nn_msg *msg);
+
+#endif
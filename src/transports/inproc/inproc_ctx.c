@@ -25,6 +25,7 @@
 #include "msgpipe.h"
 
 #include "../../inproc.h"
+#include "../../nn.h"
 
 #include "../../utils/mutex.h"
 #include "../../utils/alloc.h"
@@ -42,16 +43,39 @@ static int nn_inproc_ctx_bind (const char *addr, void *hint,
     struct nn_epbase **epbase);
 static int nn_inproc_ctx_connect (const char *addr, void *hint,
     struct nn_epbase **epbase);
+static struct nn_optset *nn_inproc_ctx_optset ();
+
+/*  Maximal number of chunks that can be prefaulted for a single queue. */
+#define NN_INPROC_MAX_PREFAULT 4096
+
+/*  Inproc-specific socket options. */
+struct nn_inproc_optset {
+    struct nn_optset base;
+    int chunks;
+    int prefault;
+    int alloctype;
+};
+
+static void nn_inproc_optset_destroy (struct nn_optset *self);
+static int nn_inproc_optset_setopt (struct nn_optset *self, int option,
+    const void *optval, size_t optvallen);
+static int nn_inproc_optset_getopt (struct nn_optset *self, int option,
+    void *optval, size_t *optvallen);
+static const struct nn_optset_vfptr nn_inproc_optset_vfptr = {
+    nn_inproc_optset_destroy,
+    nn_inproc_optset_setopt,
+    nn_inproc_optset_getopt
+};
 
 static struct nn_transport nn_inproc_vfptr = {
     "inproc",
     NN_INPROC,
+    0,
     nn_inproc_ctx_init,
     nn_inproc_ctx_term,
     nn_inproc_ctx_bind,
     nn_inproc_ctx_connect,
-    NULL,
-    NN_LIST_ITEM_INITIALIZER
+    nn_inproc_ctx_optset
 };
 
 struct nn_transport *nn_inproc = &nn_inproc_vfptr;
@@ -199,3 +223,89 @@ void nn_inproc_ctx_disconnect (struct nn_inprocc *inprocc)
     nn_mutex_unlock (&self.sync);
 }
 
+
+static struct nn_optset *nn_inproc_ctx_optset ()
+{
+    struct nn_inproc_optset *optset;
+
+    optset = nn_alloc (sizeof (struct nn_inproc_optset), "optset (inproc)");
+    alloc_assert (optset);
+    optset->base.vfptr = &nn_inproc_optset_vfptr;
+
+    /*  Default values for inproc socket options. A single spare chunk is
+        kept and nothing is prefaulted. */
+    optset->chunks = 1;
+    optset->prefault = 0;
+    optset->alloctype = NN_ALLOC_DEFAULT;
+
+    return &optset->base;
+}
+
+static void nn_inproc_optset_destroy (struct nn_optset *self)
+{
+    struct nn_inproc_optset *optset;
+
+    optset = nn_cont (self, struct nn_inproc_optset, base);
+    nn_free (optset);
+}
+
+static int nn_inproc_optset_setopt (struct nn_optset *self, int option,
+    const void *optval, size_t optvallen)
+{
+    struct nn_inproc_optset *optset;
+    int val;
+
+    optset = nn_cont (self, struct nn_inproc_optset, base);
+
+    /*  All the options are of type int. */
+    if (optvallen != sizeof (int))
+        return -EINVAL;
+    val = *(int*) optval;
+
+    switch (option) {
+    case NN_INPROC_CHUNKS:
+        if (nn_slow (val < 0))
+            return -EINVAL;
+        optset->chunks = val;
+        return 0;
+    case NN_INPROC_PREFAULT:
+        if (nn_slow (val < 0 || val > NN_INPROC_MAX_PREFAULT))
+            return -EINVAL;
+        optset->prefault = val;
+        return 0;
+    case NN_INPROC_ALLOCTYPE:
+        if (nn_slow (val < 0 || val >= NN_ALLOC_MAX))
+            return -EINVAL;
+        optset->alloctype = val;
+        return 0;
+    default:
+        return -ENOPROTOOPT;
+    }
+}
+
+static int nn_inproc_optset_getopt (struct nn_optset *self, int option,
+    void *optval, size_t *optvallen)
+{
+    struct nn_inproc_optset *optset;
+    int intval;
+
+    optset = nn_cont (self, struct nn_inproc_optset, base);
+
+    switch (option) {
+    case NN_INPROC_CHUNKS:
+        intval = optset->chunks;
+        break;
+    case NN_INPROC_PREFAULT:
+        intval = optset->prefault;
+        break;
+    case NN_INPROC_ALLOCTYPE:
+        intval = optset->alloctype;
+        break;
+    default:
+        return -ENOPROTOOPT;
+    }
+    memcpy (optval, &intval,
+        *optvallen < sizeof (int) ? *optvallen : sizeof (int));
+    *optvallen = sizeof (int);
+    return 0;
+}
@@ -42,6 +42,7 @@ int nn_inprocb_init (struct nn_inprocb *self, const char *addr, void *hint)
     nn_list_item_init (&self->list);
     nn_list_init (&self->pipes);
     self->flags = 0;
+    self->bcast = NULL;
 
     return 0;
 }
@@ -80,6 +81,8 @@ void nn_inprocb_rm_pipe (struct nn_inprocb *self, struct nn_msgpipe *pipe)
 
     if (self->flags & NN_INPROCB_FLAG_TERMINATING &&
           nn_list_empty (&self->pipes)) {
+        if (self->bcast)
+            nn_bcast_release (self->bcast);
         nn_list_term (&self->pipes);
         nn_epbase_term (&self->epbase);
         nn_free (self);
@@ -87,6 +90,14 @@ void nn_inprocb_rm_pipe (struct nn_inprocb *self, struct nn_msgpipe *pipe)
     }
 }
 
+struct nn_bcast *nn_inprocb_getbcast (struct nn_inprocb *self)
+{
+    if (!self->bcast)
+        self->bcast = nn_bcast_create ();
+    nn_bcast_addref (self->bcast);
+    return self->bcast;
+}
+
 static int nn_inprocb_close (struct nn_epbase *self)
 {
     struct nn_inprocb *inprocb;
@@ -115,6 +126,8 @@ static int nn_inprocb_close (struct nn_epbase *self)
 
     /*  If there's no pipe attached, deallocate the object straight away. */
     if (nn_list_empty (&inprocb->pipes)) {
+        if (inprocb->bcast)
+            nn_bcast_release (inprocb->bcast);
         nn_list_term (&inprocb->pipes);
         nn_list_item_term (&inprocb->list);
         nn_epbase_term (&inprocb->epbase);
@@ -28,6 +28,7 @@
 #include "../../utils/list.h"
 
 #include "msgpipe.h"
+#include "bcast.h"
 
 #define NN_INPROCB_FLAG_TERMINATING 1
 
@@ -45,6 +46,10 @@ struct nn_inprocb {
 
     /*  Any combination of the flags defined above. */
     int flags;
+
+    /*  Ring shared by the pipes to the subscribers if this is a publisher.
+        Created when the first subscriber connects. */
+    struct nn_bcast *bcast;
 };
 
 int nn_inprocb_init (struct nn_inprocb *self, const char *addr, void *hint);
@@ -54,4 +59,8 @@ int nn_inprocb_ispeer (struct nn_inprocb *self, int socktype);
 void nn_inprocb_add_pipe (struct nn_inprocb *self, struct nn_msgpipe *pipe);
 void nn_inprocb_rm_pipe (struct nn_inprocb *self, struct nn_msgpipe *pipe);
 
+/*  Returns the ring shared by the pipes to the subscribers. The caller gets
+    a reference of its own. */
+struct nn_bcast *nn_inprocb_getbcast (struct nn_inprocb *self);
+
 #endif
@@ -23,6 +23,8 @@
 #include "inprocb.h"
 #include "inprocc.h"
 
+#include "../../inproc.h"
+#include "../../pubsub.h"
 #include "../../protocol.h"
 
 #include "../../utils/err.h"
@@ -39,10 +41,12 @@ static void nn_msgpipehalf_init (struct nn_msgpipehalf *self,
     void (*rmpipefn) (struct nn_msgpipehalf *self));
 static void nn_msgpipehalf_term (struct nn_msgpipehalf *self);
 static void nn_msgpipehalf_detach (struct nn_msgpipehalf *self);
-static void nn_msgpipehalf_send (struct nn_msgpipehalf *self,
+static int nn_msgpipehalf_send (struct nn_msgpipehalf *self,
     struct nn_msgpipehalf *peer, struct nn_msg *msg);
-static void nn_msgpipehalf_recv (struct nn_msgpipehalf *self,
+static int nn_msgpipehalf_recv (struct nn_msgpipehalf *self,
     struct nn_msgpipehalf *peer, struct nn_msg *msg);
+static void nn_msgpipehalf_event (const struct nn_cp_sink **self,
+    struct nn_event *event);
 
 /******************************************************************************/
 /*  Implementation of nn_msgpipe.                                             */
@@ -52,6 +56,13 @@ static void nn_msgpipehalf_recv (struct nn_msgpipehalf *self,
 static void nn_msgpipe_destroy (struct nn_msgpipe *self);
 static void nn_msgpipe_rmpipeb (struct nn_msgpipehalf *self);
 static void nn_msgpipe_rmpipec (struct nn_msgpipehalf *self);
+static void nn_msgpipe_signal (struct nn_msgpipe *self, int deadflag,
+    struct nn_msgpipehalf *peer, struct nn_event *event);
+static void nn_msgpipe_flush (struct nn_msgpipe *self, int deadflag,
+    struct nn_cp *cp);
+static void nn_msgpipe_sent (struct nn_msgpipe *self,
+    struct nn_msgpipehalf *half, int deadflag, struct nn_msgpipehalf *peer);
+static void nn_msgpipe_wake (struct nn_pipebase_deferred *deferred);
 
 /*  Implementation of nn_pipe interface for the bound half. */
 static int nn_msgpipe_sendb (struct nn_pipebase *self, struct nn_msg *msg);
@@ -84,19 +95,48 @@ void nn_msgpipe_init (struct nn_msgpipe *self,
     self->inprocb = inprocb;
     self->inprocc = inprocc;
 
+    /*  Messages from a publisher to its subscribers go through a shared ring
+        as long as there's room for another reader in it. */
+    self->bcast = NULL;
+    self->reader = -1;
+    if (nn_inprocb_socktype (inprocb) == NN_PUB &&
+          nn_inprocc_socktype (inprocc) == NN_SUB) {
+        self->bcast = nn_inprocb_getbcast (inprocb);
+        self->reader = nn_bcast_attach (self->bcast, self->chalf.queue.maxmem,
+            self->chalf.queue.lowmem, self->chalf.queue.maxmsgs,
+            self->chalf.queue.lowmsgs, self->chalf.queue.codel.target,
+            self->chalf.queue.codel.interval);
+        if (nn_slow (self->reader < 0)) {
+            nn_bcast_release (self->bcast);
+            self->bcast = NULL;
+        }
+    }
+
     /*  Attach the pipe to both endpoints. */
     nn_inprocb_add_pipe (inprocb, self);
     nn_inprocc_add_pipe (inprocc, self);
+
+    /*  Mark the halfs as writeable. This is done only once both of them are
+        initialised, as the sockets may start sending straight away. */
+    nn_pipebase_activate (&self->bhalf.pipebase);
+    nn_pipebase_activate (&self->chalf.pipebase);
 }
 
 static void nn_msgpipe_destroy (struct nn_msgpipe *self)
 {
     /*  The precondition is that both halfs are already terminated at
         this point. We don't need to terminate them here. */
-    nn_assert (self->flags & NN_MSGPIPE_FLAG_BHALF_DEAD &&
-        self->flags & NN_MSGPIPE_FLAG_CHALF_DEAD);
-
-    /*  Deallocate the resources. */
+    nn_assert (self->flags & NN_MSGPIPE_FLAG_BHALF_DONE &&
+        self->flags & NN_MSGPIPE_FLAG_CHALF_DONE);
+
+    /*  Deallocate the resources. The message queues are deallocated only now
+        as the peer may write to them till the very end. */
+    nn_msgqueue_term (&self->bhalf.queue);
+    nn_msgqueue_term (&self->chalf.queue);
+    if (self->bcast) {
+        nn_bcast_detach (self->bcast, self->reader);
+        nn_bcast_release (self->bcast);
+    }
     nn_mutex_term (&self->sync);
     nn_list_item_term (&self->item);
     nn_free (self);
@@ -121,53 +161,177 @@ void nn_msgpipe_detachc (struct nn_msgpipe *self)
 static void nn_msgpipe_rmpipeb (struct nn_msgpipehalf *self)
 {
     struct nn_msgpipe *msgpipe;
+    int destroy;
 
     msgpipe = nn_cont (self, struct nn_msgpipe, bhalf);
 
+    /*  Make sure that the peer won't signal the events any more. */
+    nn_mutex_lock (&msgpipe->sync);
+    msgpipe->flags |= NN_MSGPIPE_FLAG_BHALF_DEAD;
+    nn_mutex_unlock (&msgpipe->sync);
+
     /*  Terminate the bound half of the pipe. */
     nn_msgpipehalf_term (&msgpipe->bhalf);
-    msgpipe->flags |= NN_MSGPIPE_FLAG_BHALF_DEAD;
 
     /*  Remove the pipe from the endpoint. */
     nn_inprocb_rm_pipe (msgpipe->inprocb, msgpipe);
 
     /*  If both ends of the pipe are detached, deallocate it. */
-    if (msgpipe->flags & NN_MSGPIPE_FLAG_CHALF_DEAD)
+    nn_mutex_lock (&msgpipe->sync);
+    msgpipe->flags |= NN_MSGPIPE_FLAG_BHALF_DONE;
+    destroy = msgpipe->flags & NN_MSGPIPE_FLAG_CHALF_DONE;
+    nn_mutex_unlock (&msgpipe->sync);
+    if (destroy)
         nn_msgpipe_destroy (msgpipe);
 }
 
 static void nn_msgpipe_rmpipec (struct nn_msgpipehalf *self)
 {
     struct nn_msgpipe *msgpipe;
+    int destroy;
 
     msgpipe = nn_cont (self, struct nn_msgpipe, chalf);
 
-    /*  Terminate the bound half of the pipe. */
-    nn_msgpipehalf_term (&msgpipe->chalf);
+    /*  Make sure that the peer won't signal the events any more. */
+    nn_mutex_lock (&msgpipe->sync);
     msgpipe->flags |= NN_MSGPIPE_FLAG_CHALF_DEAD;
+    nn_mutex_unlock (&msgpipe->sync);
+
+    /*  Don't hold the slots of the shared ring back any more. */
+    if (msgpipe->bcast)
+        nn_bcast_stop (msgpipe->bcast, msgpipe->reader);
+
+    /*  Terminate the connected half of the pipe. */
+    nn_msgpipehalf_term (&msgpipe->chalf);
 
     /*  Remove the pipe from the endpoint. */
     nn_inprocc_rm_pipe (msgpipe->inprocc, msgpipe);
 
     /*  If both ends of the pipe are detached, deallocate it. */
-    if (msgpipe->flags & NN_MSGPIPE_FLAG_BHALF_DEAD)
+    nn_mutex_lock (&msgpipe->sync);
+    msgpipe->flags |= NN_MSGPIPE_FLAG_CHALF_DONE;
+    destroy = msgpipe->flags & NN_MSGPIPE_FLAG_BHALF_DONE;
+    nn_mutex_unlock (&msgpipe->sync);
+    if (destroy)
         nn_msgpipe_destroy (msgpipe);
 }
 
+static void nn_msgpipe_signal (struct nn_msgpipe *self, int deadflag,
+    struct nn_msgpipehalf *peer, struct nn_event *event)
+{
+    struct nn_cp *cp;
+
+    /*  Messages are passed through the queues without locking. The lock is
+        needed only when waking up the peer, which happens only when its
+        queue becomes non-empty or non-full, to make sure that the peer is
+        not being terminated at the same time. */
+    nn_mutex_lock (&self->sync);
+    if (!(self->flags & deadflag)) {
+
+        /*  The worker thread of the peer's socket is not involved. If the
+            socket is not in use at the moment, typically because its user
+            is blocked in nn_recv(), the event is processed in place and the
+            user is woken up directly. Otherwise it's processed by the thread
+            that uses the socket, once it's done with it. The peer's socket
+            can't be locked while 'sync' is held, as both lock orders are
+            possible, hence no waiting for the lock here. */
+        cp = nn_pipebase_getcp (&peer->pipebase);
+        if (nn_event_post (event))
+            nn_msgpipe_flush (self, deadflag, cp);
+    }
+    nn_mutex_unlock (&self->sync);
+}
+
+static void nn_msgpipe_flush (struct nn_msgpipe *self, int deadflag,
+    struct nn_cp *cp)
+{
+    /*  Called with both 'sync' and the peer's socket locked. Once the peer's
+        socket is locked, the peer can't be terminated and 'sync' can be
+        released. The peer may well send a message back while handling
+        the events, which would signal this pipe again. Once the socket is
+        unlocked, it's safe to check for the events posted in the meantime
+        only as long as the peer is alive. */
+    do {
+        nn_mutex_unlock (&self->sync);
+        nn_cp_flush (cp);
+        nn_mutex_lock (&self->sync);
+    } while (!(self->flags & deadflag) && nn_cp_pending (cp) &&
+        nn_cp_trylock (cp));
+}
+
+static void nn_msgpipe_sent (struct nn_msgpipe *self,
+    struct nn_msgpipehalf *half, int deadflag, struct nn_msgpipehalf *peer)
+{
+    /*  If the socket is sending the message to other pipes as well, only
+        queue the event now and process it once the socket is done. By then
+        the events for all the peers that share a completion port are queued
+        and are processed at once, by the first of the pipes to get there. */
+    if (!nn_pipebase_defer (&half->pipebase, &half->wake)) {
+        nn_msgpipe_signal (self, deadflag, peer, &peer->inevent);
+        return;
+    }
+    nn_mutex_lock (&self->sync);
+    if (!(self->flags & deadflag))
+        nn_event_push (&peer->inevent);
+    nn_mutex_unlock (&self->sync);
+}
+
+static void nn_msgpipe_wake (struct nn_pipebase_deferred *deferred)
+{
+    struct nn_msgpipehalf *half;
+    struct nn_msgpipehalf *peer;
+    struct nn_msgpipe *msgpipe;
+    int deadflag;
+    struct nn_cp *cp;
+
+    half = nn_cont (deferred, struct nn_msgpipehalf, wake);
+    if (half->pipebase.vfptr == &nn_msgpipe_vfptrb) {
+        msgpipe = nn_cont (half, struct nn_msgpipe, bhalf);
+        deadflag = NN_MSGPIPE_FLAG_CHALF_DEAD;
+        peer = &msgpipe->chalf;
+    }
+    else {
+        msgpipe = nn_cont (half, struct nn_msgpipe, chalf);
+        deadflag = NN_MSGPIPE_FLAG_BHALF_DEAD;
+        peer = &msgpipe->bhalf;
+    }
+
+    /*  Nothing pending means that the events were already processed, either
+        by the peer's socket or by another pipe flushing the same completion
+        port. If the completion port is locked, the holder processes them. */
+    nn_mutex_lock (&msgpipe->sync);
+    if (!(msgpipe->flags & deadflag)) {
+        cp = nn_pipebase_getcp (&peer->pipebase);
+        if (nn_cp_pending (cp) && nn_cp_trylock (cp))
+            nn_msgpipe_flush (msgpipe, deadflag, cp);
+    }
+    nn_mutex_unlock (&msgpipe->sync);
+}
+
 static int nn_msgpipe_sendb (struct nn_pipebase *self, struct nn_msg *msg)
 {
+    int rc;
     struct nn_msgpipe *msgpipe;
 
     msgpipe = nn_cont (self, struct nn_msgpipe, bhalf.pipebase);
 
-    nn_mutex_lock (&msgpipe->sync);
     nn_assert (!(msgpipe->flags & NN_MSGPIPE_FLAG_BHALF_DEAD));
-    if (nn_slow (msgpipe->flags & NN_MSGPIPE_FLAG_CHALF_DEAD)) {
-        nn_mutex_unlock (&msgpipe->sync);
+    if (nn_slow (msgpipe->flags & NN_MSGPIPE_FLAG_CHALF_DEAD))
         return -EAGAIN;
+
+    if (msgpipe->bcast) {
+        rc = nn_bcast_send (msgpipe->bcast, msgpipe->reader, msg);
+        if (!(rc & NN_MSGQUEUE_RELEASE))
+            nn_pipebase_sent (&msgpipe->bhalf.pipebase);
+        if (rc & NN_MSGQUEUE_SIGNAL)
+            nn_msgpipe_sent (msgpipe, &msgpipe->bhalf,
+                NN_MSGPIPE_FLAG_CHALF_DEAD, &msgpipe->chalf);
+        return 0;
     }
-    nn_msgpipehalf_send (&msgpipe->bhalf, &msgpipe->chalf, msg);
-    nn_mutex_unlock (&msgpipe->sync);
+
+    if (nn_msgpipehalf_send (&msgpipe->bhalf, &msgpipe->chalf, msg))
+        nn_msgpipe_sent (msgpipe, &msgpipe->bhalf,
+            NN_MSGPIPE_FLAG_CHALF_DEAD, &msgpipe->chalf);
 
     return 0;
 }
@@ -178,11 +342,10 @@ static int nn_msgpipe_recvb (struct nn_pipebase *self, struct nn_msg *msg)
 
     msgpipe = nn_cont (self, struct nn_msgpipe, bhalf.pipebase);
 
-    nn_mutex_lock (&msgpipe->sync);
     nn_assert (!(msgpipe->flags & NN_MSGPIPE_FLAG_BHALF_DEAD));
-    nn_msgpipehalf_recv (&msgpipe->bhalf, msgpipe->flags &
-        NN_MSGPIPE_FLAG_CHALF_DEAD ? NULL : &msgpipe->chalf, msg);
-    nn_mutex_unlock (&msgpipe->sync);
+    if (nn_msgpipehalf_recv (&msgpipe->bhalf, &msgpipe->chalf, msg))
+        nn_msgpipe_signal (msgpipe, NN_MSGPIPE_FLAG_CHALF_DEAD,
+            &msgpipe->chalf, &msgpipe->chalf.outevent);
 
     return NN_PIPEBASE_PARSED;
 }
@@ -193,29 +356,48 @@ static int nn_msgpipe_sendc (struct nn_pipebase *self, struct nn_msg *msg)
 
     msgpipe = nn_cont (self, struct nn_msgpipe, chalf.pipebase);
 
-    nn_mutex_lock (&msgpipe->sync);
     nn_assert (!(msgpipe->flags & NN_MSGPIPE_FLAG_CHALF_DEAD));
-    if (nn_slow (msgpipe->flags & NN_MSGPIPE_FLAG_BHALF_DEAD)) {
-        nn_mutex_unlock (&msgpipe->sync);
+    if (nn_slow (msgpipe->flags & NN_MSGPIPE_FLAG_BHALF_DEAD))
         return -EAGAIN;
-    }
-    nn_msgpipehalf_send (&msgpipe->chalf, &msgpipe->bhalf, msg);
-    nn_mutex_unlock (&msgpipe->sync);
+    if (nn_msgpipehalf_send (&msgpipe->chalf, &msgpipe->bhalf, msg))
+        nn_msgpipe_sent (msgpipe, &msgpipe->chalf,
+            NN_MSGPIPE_FLAG_BHALF_DEAD, &msgpipe->bhalf);
 
     return 0;
 }
 
 static int nn_msgpipe_recvc (struct nn_pipebase *self, struct nn_msg *msg)
 {
+    int rc;
+    int signal;
     struct nn_msgpipe *msgpipe;
 
     msgpipe = nn_cont (self, struct nn_msgpipe, chalf.pipebase);
 
-    nn_mutex_lock (&msgpipe->sync);
     nn_assert (!(msgpipe->flags & NN_MSGPIPE_FLAG_CHALF_DEAD));
-    nn_msgpipehalf_recv (&msgpipe->chalf, msgpipe->flags &
-        NN_MSGPIPE_FLAG_BHALF_DEAD ? NULL : &msgpipe->bhalf, msg);
-    nn_mutex_unlock (&msgpipe->sync);
+    if (msgpipe->bcast) {
+        signal = 0;
+        while (1) {
+            rc = nn_bcast_recv (msgpipe->bcast, msgpipe->reader, msg);
+            errnum_assert (rc >= 0, -rc);
+            signal |= rc & NN_MSGQUEUE_SIGNAL;
+            if (nn_slow (rc & NN_MSGQUEUE_DROP))
+                nn_pipebase_shed (self, msg);
+            else if ((rc & NN_MSGQUEUE_RELEASE) || !msg->deadline ||
+                  !nn_pipebase_expired (self, msg))
+                break;
+            nn_msg_term (msg);
+        }
+        if (!(rc & NN_MSGQUEUE_RELEASE))
+            nn_pipebase_received (&msgpipe->chalf.pipebase);
+        if (signal)
+            nn_msgpipe_signal (msgpipe, NN_MSGPIPE_FLAG_BHALF_DEAD,
+                &msgpipe->bhalf, &msgpipe->bhalf.outevent);
+        return NN_PIPEBASE_PARSED;
+    }
+    if (nn_msgpipehalf_recv (&msgpipe->chalf, &msgpipe->bhalf, msg))
+        nn_msgpipe_signal (msgpipe, NN_MSGPIPE_FLAG_BHALF_DEAD,
+            &msgpipe->bhalf, &msgpipe->bhalf.outevent);
 
     return NN_PIPEBASE_PARSED;
 }
@@ -225,8 +407,6 @@ static int nn_msgpipe_recvc (struct nn_pipebase *self, struct nn_msg *msg)
 /******************************************************************************/
 
 /*  Implementation of event sink. */
-static void nn_msgpipehalf_event (const struct nn_cp_sink **self,
-    struct nn_event *event);
 static const struct nn_cp_sink nn_msgpipehalf_sink =
     {NULL, NULL, NULL, NULL, NULL, NULL, NULL, nn_msgpipehalf_event};
 
@@ -237,6 +417,15 @@ static void nn_msgpipehalf_init (struct nn_msgpipehalf *self,
 {
     int rcvbuf;
     int sndbuf;
+    int sndlowat;
+    int rcvbufmsgs;
+    int sndbufmsgs;
+    int sndlowatmsgs;
+    int chunks;
+    int prefault;
+    int alloctype;
+    int codeltarget;
+    int codelinterval;
     size_t sz;
     struct nn_cp *cp;
 
@@ -252,9 +441,58 @@ static void nn_msgpipehalf_init (struct nn_msgpipehalf *self,
     sz = sizeof (sndbuf);
     nn_epbase_getopt (peer_epbase, NN_SOL_SOCKET, NN_SNDBUF, &sndbuf, &sz);
     nn_assert (sz == sizeof (sndbuf));
-
-    /*  Initialise inbound message queue. */
-    nn_msgqueue_init (&(self->queue), sndbuf + rcvbuf);
+    sz = sizeof (sndlowat);
+    nn_epbase_getopt (peer_epbase, NN_SOL_SOCKET, NN_SNDLOWAT, &sndlowat, &sz);
+    nn_assert (sz == sizeof (sndlowat));
+    sz = sizeof (rcvbufmsgs);
+    nn_epbase_getopt (epbase, NN_SOL_SOCKET, NN_RCVBUFMSGS, &rcvbufmsgs, &sz);
+    nn_assert (sz == sizeof (rcvbufmsgs));
+    sz = sizeof (sndbufmsgs);
+    nn_epbase_getopt (peer_epbase, NN_SOL_SOCKET, NN_SNDBUFMSGS,
+        &sndbufmsgs, &sz);
+    nn_assert (sz == sizeof (sndbufmsgs));
+    sz = sizeof (sndlowatmsgs);
+    nn_epbase_getopt (peer_epbase, NN_SOL_SOCKET, NN_SNDLOWATMSGS,
+        &sndlowatmsgs, &sz);
+    nn_assert (sz == sizeof (sndlowatmsgs));
+
+    /*  The chunks of the queue are allocated by the writer, so it's
+        the sending side that decides how they are cached. */
+    sz = sizeof (chunks);
+    nn_epbase_getopt (peer_epbase, NN_INPROC, NN_INPROC_CHUNKS, &chunks, &sz);
+    nn_assert (sz == sizeof (chunks));
+    sz = sizeof (prefault);
+    nn_epbase_getopt (peer_epbase, NN_INPROC, NN_INPROC_PREFAULT,
+        &prefault, &sz);
+    nn_assert (sz == sizeof (prefault));
+    sz = sizeof (alloctype);
+    nn_epbase_getopt (peer_epbase, NN_INPROC, NN_INPROC_ALLOCTYPE,
+        &alloctype, &sz);
+    nn_assert (sz == sizeof (alloctype));
+
+    /*  Initialise inbound message queue. Message count is limited if either
+        side asks for it. */
+    nn_msgqueue_init (&(self->queue), sndbuf + rcvbuf,
+        sndlowat < 0 ? (size_t) -1 : (size_t) sndlowat,
+        sndbufmsgs + rcvbufmsgs,
+        sndlowatmsgs < 0 ? (size_t) -1 : (size_t) sndlowatmsgs, chunks);
+
+    /*  If the memory can't be prefaulted, e.g. because a user-defined
+        allocator has run out of it, the chunks are allocated on demand
+        as usual. */
+    nn_msgqueue_prefault (&(self->queue), prefault, alloctype);
+
+    /*  Whether the messages can be dropped when they have been queued for
+        too long depends on the sending side. */
+    sz = sizeof (codeltarget);
+    nn_epbase_getopt (peer_epbase, NN_SOL_SOCKET, NN_CODEL_TARGET,
+        &codeltarget, &sz);
+    nn_assert (sz == sizeof (codeltarget));
+    sz = sizeof (codelinterval);
+    nn_epbase_getopt (peer_epbase, NN_SOL_SOCKET, NN_CODEL_INTERVAL,
+        &codelinterval, &sz);
+    nn_assert (sz == sizeof (codelinterval));
+    nn_msgqueue_codel (&(self->queue), codeltarget, codelinterval);
 
     /*  Set the sink for all async events. */
     self->sink = &nn_msgpipehalf_sink;
@@ -264,11 +502,9 @@ static void nn_msgpipehalf_init (struct nn_msgpipehalf *self,
     nn_event_init (&self->inevent, &self->sink, cp);
     nn_event_init (&self->outevent, &self->sink, cp);
     nn_event_init (&self->detachevent, &self->sink, cp);
+    nn_pipebase_deferred_init (&self->wake, nn_msgpipe_wake);
 
     self->rmpipefn = rmpipefn;
-
-    /*  Mark the pipe as writeable. */
-    nn_pipebase_activate (&self->pipebase);
 }
 
 static void nn_msgpipehalf_term (struct nn_msgpipehalf *self)
@@ -277,9 +513,7 @@ static void nn_msgpipehalf_term (struct nn_msgpipehalf *self)
     nn_event_term (&self->inevent);
     nn_event_term (&self->outevent);
     nn_event_term (&self->detachevent);
- 
-    /*  Deallocate the message queue along with the messages stored in it. */
-    nn_msgqueue_term (&self->queue);
+    nn_pipebase_deferred_term (&self->wake);
 
     /*  Terminate the base class. */
     nn_pipebase_term (&self->pipebase);
@@ -296,7 +530,7 @@ static void nn_msgpipehalf_detach (struct nn_msgpipehalf *self)
     nn_event_signal (&self->detachevent);
 }
 
-static void nn_msgpipehalf_send (struct nn_msgpipehalf *self,
+static int nn_msgpipehalf_send (struct nn_msgpipehalf *self,
     struct nn_msgpipehalf *peer, struct nn_msg *msg)
 {
     int rc;
@@ -305,33 +539,46 @@ static void nn_msgpipehalf_send (struct nn_msgpipehalf *self,
     rc = nn_msgqueue_send (&peer->queue, msg);
     errnum_assert (rc >= 0, -rc);
 
-    /*  If the peer is sleeping, wake it up. */
-    if (rc & NN_MSGQUEUE_SIGNAL)
-        nn_event_signal (&peer->inevent);
-
     /*  If the pipe is still writeable, make sure that it's not removed
         from the list of eligible outbound pipes. */
     if (!(rc & NN_MSGQUEUE_RELEASE))
         nn_pipebase_sent (&self->pipebase);
+
+    /*  Let the caller know whether the peer is sleeping and should be woken
+        up, i.e. whether its inevent should be signaled. */
+    return rc & NN_MSGQUEUE_SIGNAL ? 1 : 0;
 }
 
-static void nn_msgpipehalf_recv (struct nn_msgpipehalf *self,
+static int nn_msgpipehalf_recv (struct nn_msgpipehalf *self,
     struct nn_msgpipehalf *peer, struct nn_msg *msg)
 {
     int rc;
-
-    /*  Get a message from the inbound queue. */
-    rc = nn_msgqueue_recv (&self->queue, msg);
-    errnum_assert (rc >= 0, -rc);
-
-    /*  If it makes the other end writeable, notify the peer. */
-    if (rc & NN_MSGQUEUE_SIGNAL && peer)
-        nn_event_signal (&peer->outevent);
+    int signal;
+
+    /*  Get a message from the inbound queue. Expired messages, as well as
+        those that have been queued for too long, are dropped as long as
+        there's another one to return instead. */
+    signal = 0;
+    while (1) {
+        rc = nn_msgqueue_recv (&self->queue, msg);
+        errnum_assert (rc >= 0, -rc);
+        signal |= rc & NN_MSGQUEUE_SIGNAL;
+        if (nn_slow (rc & NN_MSGQUEUE_DROP))
+            nn_pipebase_shed (&self->pipebase, msg);
+        else if ((rc & NN_MSGQUEUE_RELEASE) || !msg->deadline ||
+              !nn_pipebase_expired (&self->pipebase, msg))
+            break;
+        nn_msg_term (msg);
+    }
 
     /*  If the pipe is still readable, make sure that it's not removed
         from the list of eligible inbound pipes. */
     if (!(rc & NN_MSGQUEUE_RELEASE))
         nn_pipebase_received (&self->pipebase);
+
+    /*  Let the caller know whether this makes the other end writeable, i.e.
+        whether peer's outevent should be signaled. */
+    return signal ? 1 : 0;
 }
 
 static void nn_msgpipehalf_event (const struct nn_cp_sink **self,
@@ -26,10 +26,12 @@
 #include "../../transport.h"
 
 #include "msgqueue.h"
+#include "bcast.h"
 
 #include "../../aio/aio.h"
 
 #include "../../utils/mutex.h"
+#include "../../utils/cacheline.h"
 
 struct nn_inprocb;
 struct nn_inprocc;
@@ -56,23 +58,34 @@ struct nn_msgpipehalf {
     struct nn_event outevent;
     struct nn_event detachevent;
 
+    /*  Wake-up of the peer after sending a message to it, deferred while
+        the socket is sending to other pipes as well. */
+    struct nn_pipebase_deferred wake;
+
     /*  Function from removing the pipe from the endpoint. */
     void (*rmpipefn) (struct nn_msgpipehalf *self);
 };
 
 #define NN_MSGPIPE_FLAG_BHALF_DEAD 1
 #define NN_MSGPIPE_FLAG_CHALF_DEAD 2
+#define NN_MSGPIPE_FLAG_BHALF_DONE 4
+#define NN_MSGPIPE_FLAG_CHALF_DONE 8
 
 struct nn_msgpipe {
 
-    /*  Critical section to guard the whole msgpipe object. */
+    /*  Critical section to guard the lifetime of the msgpipe object. The
+        messages themselves are passed without locking. */
     struct nn_mutex sync;
 
-    /*  Any combination of the flags defined above. */
-    int flags;
+    /*  Any combination of the flags defined above. Modified only while
+        'sync' is locked. */
+    volatile int flags;
 
-    /*  Two halfs of the pipe (bind side and connect side). */
+    /*  Two halfs of the pipe (bind side and connect side). Each of them is
+        used by the threads of its own socket, so they don't share a cache
+        line. */
     struct nn_msgpipehalf bhalf;
+    NN_CACHELINE_PAD (pad);
     struct nn_msgpipehalf chalf;
 
     /*  The pipe is owned by exactly one bound endpoint. */
@@ -81,6 +94,13 @@ struct nn_msgpipe {
     /*  Bound-side and connected-side endpoint. */
     struct nn_inprocb *inprocb;
     struct nn_inprocc *inprocc;
+
+    /*  If the bound side is a publisher and the connected one a subscriber,
+        the messages to the subscriber are passed through the ring shared by
+        all the subscribers of the endpoint, rather than through the queue of
+        the connected half. NULL otherwise. */
+    struct nn_bcast *bcast;
+    int reader;
 };
 
 /*  Initialise the message pipe. */
@@ -28,13 +28,43 @@
 
 #include <string.h>
 
-void nn_msgqueue_init (struct nn_msgqueue *self, size_t maxmem)
+/*  Private functions. */
+static int nn_msgqueue_isfull (struct nn_msgqueue *self, uint32_t count,
+    uint32_t mem);
+static int nn_msgqueue_isdrained (struct nn_msgqueue *self, uint32_t count,
+    uint32_t mem);
+static struct nn_msgqueue_chunk *nn_msgqueue_newchunk (
+    struct nn_msgqueue *self);
+static int nn_msgqueue_inslab (struct nn_msgqueue *self,
+    struct nn_msgqueue_chunk *chunk);
+static void nn_msgqueue_freechunks (struct nn_msgqueue *self,
+    struct nn_msgqueue_chunk *chunk);
+
+void nn_msgqueue_init (struct nn_msgqueue *self, size_t maxmem,
+    size_t lowmem, size_t maxmsgs, size_t lowmsgs, int maxspare)
 {
     struct nn_msgqueue_chunk *chunk;
 
-    self->count = 0;
-    self->mem = 0;
+    /*  Memory usage is tracked in 32 bits. To prevent overflow, the limit
+        has to fit into 31 bits. */
+    if (maxmem > 0x7fffffff)
+        maxmem = 0x7fffffff;
+    if (maxmsgs == 0 || maxmsgs > 0x7fffffff)
+        maxmsgs = 0x7fffffff;
+
+    nn_atomic_init (&self->done, 0);
+    nn_atomic_init (&self->count, 0);
+    nn_atomic_init (&self->written, 0);
+    nn_atomic_init (&self->read, 0);
+    nn_atomic_init (&self->blocked, 0);
     self->maxmem = maxmem;
+    self->lowmem = lowmem < maxmem ? lowmem : maxmem - 1;
+    self->maxmsgs = (uint32_t) maxmsgs;
+    self->lowmsgs = (uint32_t) (lowmsgs < maxmsgs ? lowmsgs : maxmsgs - 1);
+    self->stamped = 0;
+    nn_clock_init (&self->outclock);
+    nn_codel_init (&self->codel, -1, 0);
+    nn_clock_init (&self->inclock);
 
     chunk = nn_alloc (sizeof (struct nn_msgqueue_chunk), "msgqueue chunk");
     alloc_assert (chunk);
@@ -42,10 +72,16 @@ void nn_msgqueue_init (struct nn_msgqueue *self, size_t maxmem)
 
     self->out.chunk = chunk;
     self->out.pos = 0;
+    self->head = chunk;
+    self->reused = 0;
+    self->spare = NULL;
+    self->nspare = 0;
+    self->maxspare = maxspare;
+    self->slab = NULL;
+    self->nslab = 0;
+    self->slabchunk = NULL;
     self->in.chunk = chunk;
     self->in.pos = 0;
-
-    self->cache = NULL;
 }
 
 void nn_msgqueue_term (struct nn_msgqueue *self)
@@ -62,92 +98,240 @@ void nn_msgqueue_term (struct nn_msgqueue *self)
         nn_msg_term (&msg);
     }
 
-    /*  There are no more messages in the pipe so there's at most one chunk
-        in the queue. Deallocate it. */
+    /*  There are no more messages in the pipe. Deallocate the chunks that
+        were not re-used yet along with the current one and the spare ones. */
     nn_assert (self->in.chunk == self->out.chunk);
-    nn_free (self->in.chunk);
+    nn_msgqueue_freechunks (self, self->head);
+    nn_msgqueue_freechunks (self, self->spare);
+    if (self->slabchunk)
+        nn_chunk_free (self->slabchunk);
 
-    /*  Deallocate the cached chunk, if any. */
-    if (self->cache)
-        nn_free (self->cache);
+    nn_clock_term (&self->inclock);
+    nn_clock_term (&self->outclock);
+    nn_atomic_term (&self->blocked);
+    nn_atomic_term (&self->read);
+    nn_atomic_term (&self->written);
+    nn_atomic_term (&self->count);
+    nn_atomic_term (&self->done);
 }
 
 int nn_msgqueue_send (struct nn_msgqueue *self, struct nn_msg *msg)
 {
+    int rc;
     size_t msgsz;
+    uint32_t written;
+    uint32_t count;
     int result;
 
-    msgsz = nn_chunkref_size (&msg->hdr) + nn_chunkref_size (&msg->body);
-
-    /*  Adjust the statistics. */
-    result = self->count ? 0 : NN_MSGQUEUE_SIGNAL;
-    ++self->count;
-    self->mem += msgsz;
-
-    /*  To mimic other transports, it should be always possible to store two
-        messages in the queue. Beyond that we'll apply the queue limit specified
-        by the user (SNDBUF on the sender side + RCVBUF on the receiver side. */
-    if (self->count >= 2 && self->mem >= self->maxmem)
-        result |= NN_MSGQUEUE_RELEASE;
+    msgsz = nn_chunkref_size (&msg->hdr) + nn_msg_bodysize (msg);
+    if (msgsz > self->maxmem)
+        msgsz = self->maxmem;
 
     /*  Move the content of the message to the pipe. */
     nn_msg_mv (&self->out.chunk->msgs [self->out.pos], msg);
+    if (nn_slow (self->stamped))
+        self->out.chunk->stamps [self->out.pos] =
+            nn_clock_now (&self->outclock);
     ++self->out.pos;
 
-    /*  If there's no space for a new message in the pipe, either re-use
-        the cache chunk or allocate a new chunk if it does not exist. */
+    /*  If there's no space for a new message in the pipe, link a new chunk
+        to the queue. This has to be done before the message is published
+        as the reader moves to the next chunk straight away. */
     if (nn_slow (self->out.pos == NN_MSGQUEUE_GRANULARITY)) {
-        if (nn_slow (!self->cache)) {
-            self->cache = nn_alloc (sizeof (struct nn_msgqueue_chunk),
-                "msgqueue chunk");
-            alloc_assert (self->cache);
-            self->cache->next = NULL;
-        }
-        self->out.chunk->next = self->cache;
-        self->out.chunk = self->cache;
-        self->cache = NULL;
+        self->out.chunk->next = nn_msgqueue_newchunk (self);
+        self->out.chunk = self->out.chunk->next;
         self->out.pos = 0;
     }
 
+    /*  Publish the message and adjust the statistics. If the queue was empty,
+        the reader has to be woken up. Incrementing the count is the only
+        atomic read-modify-write operation needed in the common case. */
+    written = nn_atomic_load (&self->written) + (uint32_t) msgsz;
+    nn_atomic_store (&self->written, written);
+    count = nn_atomic_inc (&self->count, 1) + 1;
+    result = count == 1 ? NN_MSGQUEUE_SIGNAL : 0;
+
+    /*  To mimic other transports, it should be always possible to store two
+        messages in the queue. Beyond that we'll apply the queue limit specified
+        by the user (SNDBUF on the sender side + RCVBUF on the receiver side,
+        and the same for the number of messages).
+        If the queue is full, announce that the writer is going to stop and
+        check again to make sure the reader haven't drained the queue in the
+        meantime. If it did, whoever resets the flag first wins. The first
+        check may see a stale state of the reader, which errs on the side
+        of the queue being full. The second one comes after a full memory
+        barrier and sees the current state. */
+    if (nn_slow (nn_msgqueue_isfull (self, count,
+          written - nn_atomic_load (&self->read)))) {
+        rc = nn_atomic_cas (&self->blocked, 0, 1);
+        nn_assert (rc);
+        if (!nn_msgqueue_isdrained (self, nn_atomic_get (&self->count),
+              written - nn_atomic_get (&self->read)) ||
+              !nn_atomic_cas (&self->blocked, 1, 0))
+            result |= NN_MSGQUEUE_RELEASE;
+    }
+
     return result;
 }
 
 int nn_msgqueue_recv (struct nn_msgqueue *self, struct nn_msg *msg)
 {
     int result;
+    size_t msgsz;
+    uint32_t read;
+    uint64_t stamp;
     struct nn_msgqueue_chunk *o;
 
     /*  If there is no message in the queue. */
-    if (nn_slow (!self->count))
+    if (nn_slow (!nn_atomic_load (&self->count)))
         return -EAGAIN;
 
     /*  Move the message from the pipe to the user. */
     nn_msg_mv (msg, &self->in.chunk->msgs [self->in.pos]);
+    stamp = self->stamped ? self->in.chunk->stamps [self->in.pos] : 0;
 
-    /*  Move to the next position. */
+    /*  Move to the next position. Once the chunk is left, the writer is
+        free to re-use it. */
     ++self->in.pos;
     if (nn_slow (self->in.pos == NN_MSGQUEUE_GRANULARITY)) {
         o = self->in.chunk;
-        self->in.chunk = self->in.chunk->next;
+        self->in.chunk = o->next;
         self->in.pos = 0;
-        if (nn_fast (!self->cache))
-            self->cache = o;
-        else
-            nn_free (o);
+        nn_atomic_inc (&self->done, 1);
     }
 
-    /*  Adjust the statistics. */
-    result = 0;
-    if (self->count >= 2 && self->mem >= self->maxmem)
+    /*  Adjust the statistics. The memory has to be accounted for before
+        the count is decremented so that the writer, having seen the new
+        count, sees the freed memory as well. */
+    msgsz = nn_chunkref_size (&msg->hdr) + nn_msg_bodysize (msg);
+    if (msgsz > self->maxmem)
+        msgsz = self->maxmem;
+    read = nn_atomic_load (&self->read) + (uint32_t) msgsz;
+    nn_atomic_store (&self->read, read);
+    result = nn_atomic_dec (&self->count, 1) == 1 ? NN_MSGQUEUE_RELEASE : 0;
+
+    /*  If the writer is blocked and the queue have drained to the low-water
+        mark now, let it continue. The decrement above is a full memory
+        barrier, so either the blocked flag is seen here or the writer sees
+        the freed space when it checks again after setting the flag. */
+    if (nn_slow (nn_atomic_load (&self->blocked)) &&
+          nn_msgqueue_isdrained (self, nn_atomic_get (&self->count),
+          nn_atomic_get (&self->written) - read) &&
+          nn_atomic_cas (&self->blocked, 1, 0))
         result |= NN_MSGQUEUE_SIGNAL;
-    --self->count;
-    self->mem -= (nn_chunkref_size (&msg->hdr) + nn_chunkref_size (&msg->body));
-    if (self->count >= 2 && self->mem >= self->maxmem)
-        result &= ~NN_MSGQUEUE_SIGNAL;
 
-    if (!self->count)
-        result |= NN_MSGQUEUE_RELEASE;
+    /*  Ask the queue management policy whether the message has been queued
+        for too long. */
+    if (nn_slow (self->stamped) && nn_codel_drop (&self->codel,
+          nn_clock_now (&self->inclock), stamp,
+          result & NN_MSGQUEUE_RELEASE))
+        result |= NN_MSGQUEUE_DROP;
 
     return result;
 }
 
+void nn_msgqueue_codel (struct nn_msgqueue *self, int target, int interval)
+{
+    nn_codel_init (&self->codel, target, interval);
+    self->stamped = nn_codel_active (&self->codel);
+}
+
+static int nn_msgqueue_isfull (struct nn_msgqueue *self, uint32_t count,
+    uint32_t mem)
+{
+    return count >= 2 && (mem >= self->maxmem || count >= self->maxmsgs);
+}
+
+static int nn_msgqueue_isdrained (struct nn_msgqueue *self, uint32_t count,
+    uint32_t mem)
+{
+    return count < 2 || (mem <= self->lowmem && count <= self->lowmsgs);
+}
+
+static struct nn_msgqueue_chunk *nn_msgqueue_newchunk (
+    struct nn_msgqueue *self)
+{
+    uint32_t done;
+    struct nn_msgqueue_chunk *chunk;
+    struct nn_msgqueue_chunk *o;
+
+    /*  Move the chunks that were already read to the spare ones. Those that
+        don't fit there are deallocated. The most recently used chunk ends up
+        on the top so that it's re-used while still in the cache. */
+    done = nn_atomic_get (&self->done);
+    while (self->reused != done) {
+        o = self->head;
+        self->head = o->next;
+        ++self->reused;
+        if (nn_msgqueue_inslab (self, o))
+            ;
+        else if (self->nspare < self->maxspare)
+            ++self->nspare;
+        else {
+            nn_free (o);
+            continue;
+        }
+        o->next = self->spare;
+        self->spare = o;
+    }
+
+    /*  Re-use a spare chunk. If there's none, allocate a new one. */
+    chunk = self->spare;
+    if (nn_fast (chunk != NULL)) {
+        self->spare = chunk->next;
+        if (!nn_msgqueue_inslab (self, chunk))
+            --self->nspare;
+    }
+    else {
+        chunk = nn_alloc (sizeof (struct nn_msgqueue_chunk), "msgqueue chunk");
+        alloc_assert (chunk);
+    }
+    chunk->next = NULL;
+    return chunk;
+}
+
+int nn_msgqueue_prefault (struct nn_msgqueue *self, int count, int type)
+{
+    int rc;
+    int i;
+
+    nn_assert (!self->slabchunk);
+    if (count <= 0)
+        return 0;
+
+    rc = nn_chunk_alloc (count * sizeof (struct nn_msgqueue_chunk), type,
+        &self->slabchunk);
+    if (nn_slow (rc < 0))
+        return rc;
+    self->slab = (struct nn_msgqueue_chunk*) nn_chunk_data (self->slabchunk);
+    self->nslab = count;
+
+    /*  Writing to the memory makes the system back it with physical pages
+        straight away rather than on the first use. */
+    memset (self->slab, 0, count * sizeof (struct nn_msgqueue_chunk));
+
+    for (i = count - 1; i >= 0; --i) {
+        self->slab [i].next = self->spare;
+        self->spare = &self->slab [i];
+    }
+    return 0;
+}
+
+static int nn_msgqueue_inslab (struct nn_msgqueue *self,
+    struct nn_msgqueue_chunk *chunk)
+{
+    return chunk >= self->slab && chunk < self->slab + self->nslab;
+}
+
+static void nn_msgqueue_freechunks (struct nn_msgqueue *self,
+    struct nn_msgqueue_chunk *chunk)
+{
+    struct nn_msgqueue_chunk *o;
+
+    while (chunk) {
+        o = chunk;
+        chunk = chunk->next;
+        if (!nn_msgqueue_inslab (self, o))
+            nn_free (o);
+    }
+}
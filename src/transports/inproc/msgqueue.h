@@ -24,10 +24,17 @@
 #define NN_MSGQUEUE_INCLUDED
 
 #include "../../utils/msg.h"
+#include "../../utils/chunk.h"
+#include "../../utils/atomic.h"
+#include "../../utils/cacheline.h"
+#include "../../utils/clock.h"
+#include "../../utils/codel.h"
 
 #include <stddef.h>
 
-/*  This class is a simple uni-directional message queue. */
+/*  This class is a simple uni-directional message queue. It is lock-free
+    as long as there's at most one thread writing into it and at most one
+    thread reading from it at any given time. */
 
 /*  This flag is returned from send/recv functions to let the user know that
     more sends/recvs are not possible. */
@@ -37,46 +44,145 @@
     other side of the pipe should be re-activated. */
 #define NN_MSGQUEUE_SIGNAL 2
 
+/*  This flag is returned from recv function if the message has been queued
+    for too long (see nn_msgqueue_codel) and should be dropped. It's never
+    returned along with NN_MSGQUEUE_RELEASE. */
+#define NN_MSGQUEUE_DROP 4
+
 /*  It's not 128 so that chunk including its footer fits into a memory page. */
 #define NN_MSGQUEUE_GRANULARITY 127
 
 struct nn_msgqueue_chunk {
     struct nn_msg msgs [NN_MSGQUEUE_GRANULARITY];
+
+    /*  Time each message was written, if the queue has nn_codel enabled. */
+    uint64_t stamps [NN_MSGQUEUE_GRANULARITY];
     struct nn_msgqueue_chunk *next;
 };
 
+/*  The writer and the reader typically run in different threads. The fields
+    written by either of them, as well as those written by both, are kept on
+    separate cache lines. */
 struct nn_msgqueue {
 
+    /*   Maximal queue size (in bytes). */
+    size_t maxmem;
+
+    /*  Once the queue gets full, the writer is re-activated only after
+        the memory used drops to this many bytes. */
+    size_t lowmem;
+
+    /*  Maximal number of messages in the queue and the number of messages
+        the queue has to drop to before the writer is re-activated. */
+    uint32_t maxmsgs;
+    uint32_t lowmsgs;
+
+    /*  1 if the messages are stamped with the time they were written. */
+    int stamped;
+
+    NN_CACHELINE_PAD (pad1);
+
     /*  Pointer to the position where next message should be written into
-        the message queue. */
+        the message queue. Accessed by the writer only. */
     struct {
         struct nn_msgqueue_chunk *chunk;
         int pos;
     } out;
 
-    /*  Pointer to the first unread message in the message queue. */
+    /*  The oldest chunk that was not yet re-used by the writer and the
+        number of chunks re-used so far. Chunks that were fully read are
+        re-used (or deallocated) by the writer so that in case of steady
+        stream of messages through the pipe there are no memory allocations.
+        Accessed by the writer only. */
+    struct nn_msgqueue_chunk *head;
+    uint32_t reused;
+
+    /*  Chunks that were re-used but are not needed yet. Up to 'maxspare'
+        allocated chunks are kept here so that a burst of messages doesn't
+        hit the allocator. Prefaulted chunks don't count towards the limit
+        and are never deallocated before the queue is. Accessed by the writer
+        only. */
+    struct nn_msgqueue_chunk *spare;
+    int nspare;
+    int maxspare;
+
+    /*  Block of prefaulted chunks, if any, and the message chunk it was
+        allocated as. */
+    struct nn_msgqueue_chunk *slab;
+    int nslab;
+    struct nn_chunk *slabchunk;
+
+    /*  Total amount of memory of the messages written to the queue and read
+        from it, modulo 2^32. Each of them is set by one side only, so that
+        no atomic read-modify-write operation is needed to account for
+        a message. The difference is the amount of memory used by messages
+        in the queue. Each message is accounted for with at most 'maxmem'
+        bytes, which is enough to tell whether the queue is full and keeps
+        the difference within 32 bits. */
+    struct nn_atomic written;
+
+    /*  Clock to stamp the messages with. Accessed by the writer only. */
+    struct nn_clock outclock;
+
+    NN_CACHELINE_PAD (pad2);
+
+    /*  Pointer to the first unread message in the message queue. Accessed
+        by the reader only. */
     struct {
         struct nn_msgqueue_chunk *chunk;
         int pos;
     } in;
 
-    /*  Number of messages in the queue. */
-    size_t count;
+    /*  See 'written' above. */
+    struct nn_atomic read;
 
-    /*  Amount of memory used by messages in the queue. */
-    size_t mem;
+    /*  Number of chunks fully read by the reader. */
+    struct nn_atomic done;
 
-    /*   Maximal queue size (in bytes). */
-    size_t maxmem;
+    /*  Policy deciding which messages are dropped at dequeue because of
+        the time they have spent in the queue, and the clock to measure it
+        with. Accessed by the reader only. */
+    struct nn_codel codel;
+    struct nn_clock inclock;
+
+    NN_CACHELINE_PAD (pad3);
+
+    /*  Number of messages in the queue. The reader can access the messages
+        only after they are accounted for here. */
+    struct nn_atomic count;
 
-    /*  One empty chunk is always cached so that in case of steady stream
-        of messages through the pipe there are no memory allocations. */
-    struct nn_msgqueue_chunk *cache;
+    /*  Set to 1 by the writer once the queue becomes full. The side that
+        manages to reset it back to 0 once the queue is not full any more
+        takes care of re-activating the writer. */
+    struct nn_atomic blocked;
 
+    NN_CACHELINE_PAD (pad4);
 };
 
-/*  Initialise the message pipe. maxmem is the maximal queue size in bytes. */
-void nn_msgqueue_init (struct nn_msgqueue *self, size_t maxmem);
+/*  Initialise the message pipe. maxmem is the maximal queue size in bytes,
+    maxmsgs is the maximal number of messages in the queue, 0 meaning no
+    limit. Once the queue is full, the writer is not re-activated until
+    the memory used drops to lowmem bytes and the number of messages to
+    lowmsgs. Any low-water mark that is not below the respective limit means
+    that the writer is re-activated as soon as the queue is not full. Up to
+    maxspare chunks that were already read are kept for re-use. */
+void nn_msgqueue_init (struct nn_msgqueue *self, size_t maxmem,
+    size_t lowmem, size_t maxmsgs, size_t lowmsgs, int maxspare);
+
+/*  Allocates 'count' chunks in a single block using the allocation mechanism
+    'type' (see nn_chunk_alloc) and touches all of the memory, so that neither
+    the allocator nor the page fault handler is invoked while the queue holds
+    fewer messages than the chunks can store. Can be called only once, before
+    any message is written to the queue. Returns -EINVAL if the type is
+    invalid, -ENOMEM if the allocator has run out of memory. */
+int nn_msgqueue_prefault (struct nn_msgqueue *self, int count, int type);
+
+/*  Makes the reader drop the messages that have been queued for too long,
+    as described in nn_codel, using the target and interval specified in
+    milliseconds. Negative target means that no messages are dropped, which
+    is the default. Can be called only before any message is written to
+    the queue. */
+void nn_msgqueue_codel (struct nn_msgqueue *self, int target, int interval);
 
 /*  Terminate the message pipe. */
 void nn_msgqueue_term (struct nn_msgqueue *self);
@@ -87,8 +193,8 @@ void nn_msgqueue_term (struct nn_msgqueue *self);
 int nn_msgqueue_send (struct nn_msgqueue *self, struct nn_msg *msg);
 
 /*  Reads a message from the pipe. -EAGAIN is returned if there's no message
-    to receive. Any combination of NN_MSGQUEUE_RELEASE and NN_MSGQUEUE_SIGNAL
-    flags is return in case of success. */
+    to receive. Any combination of NN_MSGQUEUE_RELEASE, NN_MSGQUEUE_SIGNAL
+    and NN_MSGQUEUE_DROP flags is return in case of success. */
 int nn_msgqueue_recv (struct nn_msgqueue *self, struct nn_msg *msg);
 
 #endif
@@ -29,6 +29,7 @@
 #include "../../utils/err.h"
 #include "../../utils/alloc.h"
 #include "../../utils/fast.h"
+#include "../../utils/cont.h"
 #include "../../utils/bstream.h"
 #include "../../utils/cstream.h"
 #include "../../utils/list.h"
@@ -39,13 +40,32 @@
 
 #define NN_IPC_BACKLOG 10
 
+/*  IPC-specific socket options. */
+struct nn_ipc_optset {
+    struct nn_optset base;
+    int seqpacket;
+};
+
+static void nn_ipc_optset_destroy (struct nn_optset *self);
+static int nn_ipc_optset_setopt (struct nn_optset *self, int option,
+    const void *optval, size_t optvallen);
+static int nn_ipc_optset_getopt (struct nn_optset *self, int option,
+    void *optval, size_t *optvallen);
+static const struct nn_optset_vfptr nn_ipc_optset_vfptr = {
+    nn_ipc_optset_destroy,
+    nn_ipc_optset_setopt,
+    nn_ipc_optset_getopt
+};
+
 /*  Private functions. */
+static int nn_ipc_socktype (struct nn_epbase *epbase);
 static int nn_ipc_binit (const char *addr, struct nn_usock *usock,
-    struct nn_cp *cp, int backlog);
+    struct nn_epbase *epbase, int backlog, int s);
 static int nn_ipc_csockinit (struct nn_usock *usock, int sndbuf, int rcvbuf,
-    struct nn_cp *cp);
-static int nn_ipc_cresolve (const char *addr, struct sockaddr_storage *local,
-    socklen_t *locallen, struct sockaddr_storage *remote, socklen_t *remotelen);
+    struct nn_epbase *epbase);
+static int nn_ipc_cresolve (const char *addr, struct nn_resolve *resolve,
+    struct sockaddr_storage *local, socklen_t *locallen,
+    struct sockaddr_storage *remote, socklen_t *remotelen, int *nremote);
 
 /*  nn_transport interface. */
 static void nn_ipc_init (void);
@@ -54,16 +74,20 @@ static int nn_ipc_bind (const char *addr, void *hint,
     struct nn_epbase **epbase);
 static int nn_ipc_connect (const char *addr, void *hint,
     struct nn_epbase **epbase);
+static struct nn_optset *nn_ipc_optset ();
+static int nn_ipc_adopt (const char *addr, void *hint, const int *fds,
+    int nfds, struct nn_epbase **epbase);
 
 static struct nn_transport nn_ipc_vfptr = {
     "ipc",
     NN_IPC,
+    0,
     nn_ipc_init,
     nn_ipc_term,
     nn_ipc_bind,
     nn_ipc_connect,
-    NULL,
-    NN_LIST_ITEM_INITIALIZER
+    nn_ipc_optset,
+    nn_ipc_adopt
 };
 
 struct nn_transport *nn_ipc = &nn_ipc_vfptr;
@@ -84,7 +108,27 @@ static int nn_ipc_bind (const char *addr, void *hint,
 
     bstream = nn_alloc (sizeof (struct nn_bstream), "bstream (ipc)");
     alloc_assert (bstream);
-    rc = nn_bstream_init (bstream, addr, hint, nn_ipc_binit, NN_IPC_BACKLOG);
+    rc = nn_bstream_init (bstream, addr, hint, nn_ipc_binit, NULL, NULL,
+        NN_IPC_BACKLOG);
+    if (nn_slow (rc != 0)) {
+        nn_free (bstream);
+        return rc;
+    }
+    *epbase = &bstream->epbase;
+
+    return 0;
+}
+
+static int nn_ipc_adopt (const char *addr, void *hint, const int *fds,
+    int nfds, struct nn_epbase **epbase)
+{
+    int rc;
+    struct nn_bstream *bstream;
+
+    bstream = nn_alloc (sizeof (struct nn_bstream), "bstream (ipc)");
+    alloc_assert (bstream);
+    rc = nn_bstream_adopt (bstream, addr, hint, nn_ipc_binit, NULL,
+        NN_IPC_BACKLOG, fds, nfds);
     if (nn_slow (rc != 0)) {
         nn_free (bstream);
         return rc;
@@ -115,14 +159,42 @@ static int nn_ipc_connect (const char *addr, void *hint,
     return 0;
 }
 
+/*  Returns the type of the sockets to use, SOCK_SEQPACKET if NN_IPC_SEQPACKET
+    option is set. */
+static int nn_ipc_socktype (struct nn_epbase *epbase)
+{
+    int val;
+    size_t sz;
+
+    sz = sizeof (val);
+    nn_epbase_getopt (epbase, NN_IPC, NN_IPC_SEQPACKET, &val, &sz);
+    nn_assert (sz == sizeof (val));
+    return val ? SOCK_SEQPACKET : SOCK_STREAM;
+}
+
 static int nn_ipc_binit (const char *addr, struct nn_usock *usock,
-    struct nn_cp *cp, int backlog)
+    struct nn_epbase *epbase, int backlog, int s)
 {
     int rc;
+    int type;
     struct sockaddr_storage ss;
     socklen_t sslen;
     struct sockaddr_un *un;
 
+    /*  The socket handed off by another process is bound to the address
+        already. The file must not be deleted. */
+    if (s >= 0) {
+        rc = nn_usock_init_fd (usock, NULL, s, nn_epbase_getcp (epbase));
+        if (nn_slow (rc < 0))
+            return rc;
+        rc = nn_usock_listen (usock, backlog);
+        if (nn_slow (rc < 0))
+            return rc;
+        if (!nn_usock_isseqpacket (usock))
+            nn_usock_setfdpassing (usock, 1);
+        return 0;
+    }
+
     /*  Create the AF_UNIX address. */
     memset (&ss, 0, sizeof (ss));
     un = (struct sockaddr_un*) &ss;
@@ -138,25 +210,43 @@ static int nn_ipc_binit (const char *addr, struct nn_usock *usock,
     errno_assert (rc == 0 || errno == ENOENT);
 
     /*  Open the listening socket. */
-    rc = nn_usock_init (usock, NULL, AF_UNIX, SOCK_STREAM, 0, -1, -1, cp);
+    type = nn_ipc_socktype (epbase);
+    rc = nn_usock_init (usock, NULL, AF_UNIX, type, 0, -1, -1,
+        nn_epbase_getcp (epbase));
     errnum_assert (rc == 0, -rc);
     rc = nn_usock_bind (usock, (struct sockaddr*) &ss, sslen);
     errnum_assert (rc == 0, -rc);
     rc = nn_usock_listen (usock, backlog);
     errnum_assert (rc == 0, -rc);
 
+    /*  Large messages can be passed to local peers by file descriptor.
+        Accepted sockets inherit the setting. With SOCK_SEQPACKET, they are
+        sent as a sequence of records instead. */
+    if (type == SOCK_STREAM)
+        nn_usock_setfdpassing (usock, 1);
+
     return 0;
 }
 
 static int nn_ipc_csockinit (struct nn_usock *usock, int sndbuf, int rcvbuf,
-    struct nn_cp *cp)
+    struct nn_epbase *epbase)
 {
-    return nn_usock_init (usock, NULL, AF_UNIX, SOCK_STREAM, 0,
-        sndbuf, rcvbuf, cp);
+    int rc;
+    int type;
+
+    type = nn_ipc_socktype (epbase);
+    rc = nn_usock_init (usock, NULL, AF_UNIX, type, 0,
+        sndbuf, rcvbuf, nn_epbase_getcp (epbase));
+    if (nn_slow (rc < 0))
+        return rc;
+    if (type == SOCK_STREAM)
+        nn_usock_setfdpassing (usock, 1);
+    return 0;
 }
 
-static int nn_ipc_cresolve (const char *addr, struct sockaddr_storage *local,
-    socklen_t *locallen, struct sockaddr_storage *remote, socklen_t *remotelen)
+static int nn_ipc_cresolve (const char *addr, struct nn_resolve *resolve,
+    struct sockaddr_storage *local, socklen_t *locallen,
+    struct sockaddr_storage *remote, socklen_t *remotelen, int *nremote)
 {
     struct sockaddr_un *un;
 
@@ -170,9 +260,80 @@ static int nn_ipc_cresolve (const char *addr, struct sockaddr_storage *local,
     remote->ss_family = AF_UNIX;
     strncpy (un->sun_path, addr, sizeof (un->sun_path));
     *remotelen = sizeof (struct sockaddr_un);
+    *nremote = 1;
 
     return 0;
 }
 
+static struct nn_optset *nn_ipc_optset ()
+{
+    struct nn_ipc_optset *optset;
+
+    optset = nn_alloc (sizeof (struct nn_ipc_optset), "optset (ipc)");
+    alloc_assert (optset);
+    optset->base.vfptr = &nn_ipc_optset_vfptr;
+
+    /*  Default values for IPC socket options. */
+    optset->seqpacket = 0;
+
+    return &optset->base;
+}
+
+static void nn_ipc_optset_destroy (struct nn_optset *self)
+{
+    struct nn_ipc_optset *optset;
+
+    optset = nn_cont (self, struct nn_ipc_optset, base);
+    nn_free (optset);
+}
+
+static int nn_ipc_optset_setopt (struct nn_optset *self, int option,
+    const void *optval, size_t optvallen)
+{
+    struct nn_ipc_optset *optset;
+    int val;
+
+    optset = nn_cont (self, struct nn_ipc_optset, base);
+
+    /*  At this point, all the options are of type int. */
+    if (optvallen != sizeof (int))
+        return -EINVAL;
+    val = *(int*) optval;
+
+    switch (option) {
+    case NN_IPC_SEQPACKET:
+#if defined SOCK_SEQPACKET
+        if (nn_slow (val != 0 && val != 1))
+            return -EINVAL;
+        optset->seqpacket = val;
+        return 0;
+#else
+        return -ENOPROTOOPT;
 #endif
+    default:
+        return -ENOPROTOOPT;
+    }
+}
+
+static int nn_ipc_optset_getopt (struct nn_optset *self, int option,
+    void *optval, size_t *optvallen)
+{
+    struct nn_ipc_optset *optset;
+    int intval;
 
+    optset = nn_cont (self, struct nn_ipc_optset, base);
+
+    switch (option) {
+    case NN_IPC_SEQPACKET:
+        intval = optset->seqpacket;
+        break;
+    default:
+        return -ENOPROTOOPT;
+    }
+    memcpy (optval, &intval,
+        *optvallen < sizeof (int) ? *optvallen : sizeof (int));
+    *optvallen = sizeof (int);
+    return 0;
+}
+
+#endif
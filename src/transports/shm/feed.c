@@ -0,0 +1,539 @@
+/*
+    Copyright (c) 2013 250bpm s.r.o.
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"),
+    to deal in the Software without restriction, including without limitation
+    the rights to use, copy, modify, merge, publish, distribute, sublicense,
+    and/or sell copies of the Software, and to permit persons to whom
+    the Software is furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included
+    in all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+    THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+    FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+    IN THE SOFTWARE.
+*/
+
+#if defined NN_USE_SHM
+
+#include "feed.h"
+#include "shms.h"
+
+#include "../../utils/err.h"
+#include "../../utils/cont.h"
+#include "../../utils/fast.h"
+#include "../../utils/random.h"
+
+#include <string.h>
+#include <stdio.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+/*  Number of attempts to find an unused name for the memory segment. */
+#define NN_SHM_FEED_CREATE_ATTEMPTS 16
+
+#define NN_SHM_FEED_MASK (NN_SHM_FEED_SIZE - 1)
+
+/*  Space taken by a record followed by 'size' bytes of data. */
+#define NN_SHM_FEED_RECLEN(size) (sizeof (struct nn_shm_feed_rec) + \
+    (((size) + NN_SHM_FEED_ALIGN - 1) & ~((size_t) NN_SHM_FEED_ALIGN - 1)))
+
+/*  Private functions. */
+static struct nn_shm_feed_rec *nn_shm_feed_rec (struct nn_shm_feed_seg *seg,
+    uint64_t pos);
+static int nn_shm_feed_same (struct nn_msg *a, struct nn_msg *b);
+static struct nn_shm_feed_rec *nn_shm_feed_append (struct nn_shm_feed *self,
+    size_t size);
+static void nn_shm_feed_reclaim (struct nn_shm_feed *self, uint64_t end);
+static void nn_shm_feed_overrun (struct nn_shm_feed *self,
+    struct nn_shm_feed_rec *rec, uint64_t next);
+static void nn_shm_feed_written (struct nn_shm_feed *self,
+    struct nn_pipebase *pipebase, uint64_t bit);
+static void nn_shm_feed_publish (struct nn_pipebase_deferred *deferred);
+
+int nn_shm_feed_init (struct nn_shm_feed *self)
+{
+    int rc;
+    int fd;
+    int i;
+    uint32_t rnd;
+
+    /*  Create a new memory segment with a unique name. */
+    for (i = 0; i != NN_SHM_FEED_CREATE_ATTEMPTS; ++i) {
+        nn_random_generate (&rnd, sizeof (rnd));
+        rc = snprintf (self->name, sizeof (self->name), "/nn-feed-%lu-%08x",
+            (unsigned long) getpid (), (unsigned int) rnd);
+        nn_assert (rc > 0 && rc < (int) sizeof (self->name));
+        fd = shm_open (self->name, O_RDWR | O_CREAT | O_EXCL, 0600);
+        if (nn_fast (fd >= 0))
+            break;
+        if (nn_slow (errno != EEXIST))
+            return -errno;
+    }
+    if (nn_slow (i == NN_SHM_FEED_CREATE_ATTEMPTS))
+        return -EEXIST;
+
+    /*  Size and map the segment. The memory is zero-filled, i.e. the ring is
+        empty and the slots are unused. */
+    rc = ftruncate (fd, sizeof (struct nn_shm_feed_seg));
+    if (nn_slow (rc != 0)) {
+        rc = -errno;
+        close (fd);
+        shm_unlink (self->name);
+        return rc;
+    }
+    self->seg = mmap (NULL, sizeof (struct nn_shm_feed_seg),
+        PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (nn_slow (self->seg == MAP_FAILED)) {
+        rc = -errno;
+        close (fd);
+        shm_unlink (self->name);
+        return rc;
+    }
+    rc = close (fd);
+    errno_assert (rc == 0);
+
+    self->head = 0;
+    self->pos = 0;
+    self->mincursor = 0;
+    self->last = 0;
+    self->haslast = 0;
+    self->pending = 0;
+    self->attached = 0;
+    memset (self->readers, 0, sizeof (self->readers));
+    self->next = 0;
+    nn_pipebase_deferred_init (&self->publish, nn_shm_feed_publish);
+
+    return 0;
+}
+
+void nn_shm_feed_term (struct nn_shm_feed *self)
+{
+    int rc;
+
+    nn_assert (!self->attached);
+
+    if (self->haslast)
+        nn_msg_term (&self->lastmsg);
+    nn_pipebase_deferred_term (&self->publish);
+
+    /*  The readers that are still mapping the segment keep it alive. */
+    rc = munmap (self->seg, sizeof (struct nn_shm_feed_seg));
+    errno_assert (rc == 0);
+    rc = shm_unlink (self->name);
+    errno_assert (rc == 0 || errno == ENOENT);
+}
+
+int nn_shm_feed_attach (struct nn_shm_feed *self, struct nn_shms *shms)
+{
+    int i;
+    int slot;
+    struct nn_shm_feed_slot *s;
+
+    for (i = 0; i != NN_SHM_FEED_MAXREADERS; ++i) {
+        slot = (self->next + i) % NN_SHM_FEED_MAXREADERS;
+        if (!(self->attached & (((uint64_t) 1) << slot)))
+            break;
+    }
+    if (nn_slow (i == NN_SHM_FEED_MAXREADERS))
+        return -EMFILE;
+
+    /*  The newest record is behind the reader's cursor, so the same message
+        can't be passed to it by adding it to the record. */
+    if (self->haslast) {
+        nn_msg_term (&self->lastmsg);
+        self->haslast = 0;
+    }
+
+    /*  The slot is announced to the reader via the connection, which orders
+        the writes to the segment before it. The previous reader using
+        the slot may have left it asleep. */
+    s = &self->seg->slots [slot];
+    s->cursor = self->pos;
+    s->lost = 0;
+    s->lostbytes = 0;
+    __sync_fetch_and_and (&self->seg->sleepers, ~(((uint64_t) 1) << slot));
+    if (self->pos < self->mincursor)
+        self->mincursor = self->pos;
+    self->attached |= ((uint64_t) 1) << slot;
+    self->readers [slot] = shms;
+    self->next = slot + 1;
+
+    return slot;
+}
+
+void nn_shm_feed_detach (struct nn_shm_feed *self, int slot)
+{
+    self->attached &= ~(((uint64_t) 1) << slot);
+    self->readers [slot] = NULL;
+}
+
+void nn_shm_feed_send (struct nn_shm_feed *self, struct nn_pipebase *pipebase,
+    int slot, struct nn_msg *msg)
+{
+    int i;
+    uint64_t bit;
+    uint8_t *pos;
+    struct nn_shm_feed_rec *rec;
+
+    bit = ((uint64_t) 1) << slot;
+
+    /*  The same message was just written for other readers. */
+    if (self->haslast) {
+        rec = nn_shm_feed_rec (self->seg, self->last);
+        if (!(rec->readers & bit) && nn_shm_feed_same (&self->lastmsg, msg)) {
+            rec->readers |= bit;
+            nn_msg_term (msg);
+            nn_shm_feed_written (self, pipebase, bit);
+            return;
+        }
+    }
+
+    /*  Copy the message into a new record. Fragments are copied straight
+        from the user's chunks. */
+    rec = nn_shm_feed_append (self, nn_chunkref_size (&msg->hdr) +
+        nn_msg_bodysize (msg));
+    rec->readers = bit;
+    rec->seq = 0;
+    pos = (uint8_t*) (rec + 1);
+    memcpy (pos, nn_chunkref_data (&msg->hdr), nn_chunkref_size (&msg->hdr));
+    pos += nn_chunkref_size (&msg->hdr);
+    memcpy (pos, nn_chunkref_data (&msg->body), nn_chunkref_size (&msg->body));
+    pos += nn_chunkref_size (&msg->body);
+    if (msg->frags) {
+        for (i = 0; i != msg->frags->count; ++i) {
+            memcpy (pos, nn_chunkref_data (&msg->frags->frag [i]),
+                nn_chunkref_size (&msg->frags->frag [i]));
+            pos += nn_chunkref_size (&msg->frags->frag [i]);
+        }
+    }
+
+    /*  Keep the message to recognise it when it's sent to the next reader.
+        Its chunks can't be reused while it's kept. */
+    nn_msg_mv (&self->lastmsg, msg);
+    self->haslast = 1;
+
+    nn_shm_feed_written (self, pipebase, bit);
+}
+
+void nn_shm_feed_mark (struct nn_shm_feed *self, struct nn_pipebase *pipebase,
+    int slot, uint32_t seq)
+{
+    uint64_t bit;
+    struct nn_shm_feed_rec *rec;
+
+    bit = ((uint64_t) 1) << slot;
+    rec = nn_shm_feed_append (self, 0);
+    rec->readers = bit;
+    rec->size |= NN_SHM_FEED_MARKER;
+    rec->seq = seq;
+    nn_shm_feed_written (self, pipebase, bit);
+}
+
+static struct nn_shm_feed_rec *nn_shm_feed_rec (struct nn_shm_feed_seg *seg,
+    uint64_t pos)
+{
+    return (struct nn_shm_feed_rec*) (seg->data + (pos & NN_SHM_FEED_MASK));
+}
+
+static int nn_shm_feed_same (struct nn_msg *a, struct nn_msg *b)
+{
+    size_t sz;
+
+    /*  Copies of a published message share the body chunk. Bodies stored in
+        the chunkref itself are compared byte by byte. Only the header and
+        the body are passed through the feed. */
+    if (a->frags || b->frags)
+        return 0;
+    sz = nn_chunkref_size (&a->hdr);
+    if (sz != nn_chunkref_size (&b->hdr) || memcmp (nn_chunkref_data (&a->hdr),
+          nn_chunkref_data (&b->hdr), sz) != 0)
+        return 0;
+    sz = nn_chunkref_size (&a->body);
+    if (sz != nn_chunkref_size (&b->body))
+        return 0;
+    if (nn_chunkref_data (&a->body) == nn_chunkref_data (&b->body))
+        return 1;
+    return sz < NN_CHUNKREF_MAX && memcmp (nn_chunkref_data (&a->body),
+        nn_chunkref_data (&b->body), sz) == 0;
+}
+
+static struct nn_shm_feed_rec *nn_shm_feed_append (struct nn_shm_feed *self,
+    size_t size)
+{
+    size_t len;
+    size_t left;
+    struct nn_shm_feed_rec *rec;
+
+    nn_assert (size <= NN_SHM_FEED_MAXMSG);
+
+    /*  The newest record is going to be a different one. */
+    if (self->haslast) {
+        nn_msg_term (&self->lastmsg);
+        self->haslast = 0;
+    }
+
+    /*  Records don't wrap around the end of the ring. If the record doesn't
+        fit before the end, the rest of the ring is filled with padding. */
+    len = NN_SHM_FEED_RECLEN (size);
+    left = NN_SHM_FEED_SIZE - (self->pos & NN_SHM_FEED_MASK);
+    if (len > left) {
+        nn_shm_feed_reclaim (self, self->pos + left + len);
+        rec = nn_shm_feed_rec (self->seg, self->pos);
+        rec->readers = 0;
+        rec->size = NN_SHM_FEED_PAD |
+            (uint32_t) (left - sizeof (struct nn_shm_feed_rec));
+        rec->seq = 0;
+        self->pos += left;
+    }
+    else
+        nn_shm_feed_reclaim (self, self->pos + len);
+
+    rec = nn_shm_feed_rec (self->seg, self->pos);
+    rec->size = (uint32_t) size;
+    self->last = self->pos;
+    self->pos += len;
+
+    return rec;
+}
+
+static void nn_shm_feed_reclaim (struct nn_shm_feed *self, uint64_t end)
+{
+    uint64_t next;
+    struct nn_shm_feed_rec *rec;
+
+    /*  Drop the oldest records till there's room for the data up to 'end'.
+        The readers still pointing to them are moved past them. */
+    while (self->head + NN_SHM_FEED_SIZE < end) {
+        rec = nn_shm_feed_rec (self->seg, self->head);
+        next = self->head + NN_SHM_FEED_RECLEN (rec->size &
+            NN_SHM_FEED_SIZEMASK);
+        if (nn_slow (self->head >= self->mincursor))
+            nn_shm_feed_overrun (self, rec, next);
+        self->head = next;
+    }
+}
+
+static void nn_shm_feed_overrun (struct nn_shm_feed *self,
+    struct nn_shm_feed_rec *rec, uint64_t next)
+{
+    int i;
+    uint64_t bit;
+    uint64_t cursor;
+    uint64_t min;
+    struct nn_shm_feed_slot *s;
+
+    /*  Some readers may lag by the whole ring. Those which haven't read
+        the record yet lose it. The cursors of the others are collected
+        to skip the check till the oldest of them is reached. */
+    min = (uint64_t) -1;
+    for (i = 0; i != NN_SHM_FEED_MAXREADERS; ++i) {
+        bit = ((uint64_t) 1) << i;
+        if (!(self->attached & bit))
+            continue;
+        s = &self->seg->slots [i];
+        cursor = s->cursor;
+        if (cursor == self->head) {
+            if (__sync_bool_compare_and_swap (&s->cursor, cursor, next)) {
+                if (rec->readers & bit && !(rec->size &
+                      (NN_SHM_FEED_PAD | NN_SHM_FEED_MARKER))) {
+                    s->lost = s->lost + 1;
+                    s->lostbytes = s->lostbytes + rec->size;
+                }
+            }
+            cursor = s->cursor;
+        }
+        if (cursor < min)
+            min = cursor;
+    }
+    self->mincursor = min;
+}
+
+static void nn_shm_feed_written (struct nn_shm_feed *self,
+    struct nn_pipebase *pipebase, uint64_t bit)
+{
+    /*  While the socket sends the message to several subscribers, publish
+        the records once it's done, so that each of the sleeping readers is
+        woken up once. */
+    self->pending |= bit;
+    if (!nn_pipebase_defer (pipebase, &self->publish))
+        nn_shm_feed_publish (&self->publish);
+}
+
+static void nn_shm_feed_publish (struct nn_pipebase_deferred *deferred)
+{
+    int i;
+    uint64_t woken;
+    struct nn_shm_feed *self;
+
+    self = nn_cont (deferred, struct nn_shm_feed, publish);
+
+    /*  Make the records visible to the readers. From now on they may be
+        read, so they can't be modified any more. */
+    __sync_synchronize ();
+    self->seg->tail = self->pos;
+    __sync_synchronize ();
+    if (self->haslast) {
+        nn_msg_term (&self->lastmsg);
+        self->haslast = 0;
+    }
+
+    /*  Wake up the readers that went to sleep and are meant to get some of
+        the records. Paired with the barrier in nn_shm_feedr_recv this
+        ensures that the wake-up can't be lost. */
+    woken = 0;
+    if (self->seg->sleepers & self->pending)
+        woken = __sync_fetch_and_and (&self->seg->sleepers, ~self->pending) &
+            self->pending;
+    self->pending = 0;
+    for (i = 0; woken; ++i) {
+        if (!(woken & (((uint64_t) 1) << i)))
+            continue;
+        woken &= ~(((uint64_t) 1) << i);
+        if (self->readers [i])
+            nn_shms_feedwake (self->readers [i]);
+    }
+}
+
+int nn_shm_feedr_init (struct nn_shm_feedr *self, const char *name, int slot)
+{
+    int rc;
+    int fd;
+    struct stat st;
+
+    if (nn_slow (slot < 0 || slot >= NN_SHM_FEED_MAXREADERS))
+        return -EPROTO;
+
+    /*  Open the segment and make sure it's of the expected size. */
+    fd = shm_open (name, O_RDWR, 0);
+    if (nn_slow (fd < 0))
+        return -errno;
+    rc = fstat (fd, &st);
+    errno_assert (rc == 0);
+    if (nn_slow (st.st_size != sizeof (struct nn_shm_feed_seg))) {
+        close (fd);
+        return -EPROTO;
+    }
+
+    /*  Map it into the memory. */
+    self->seg = mmap (NULL, sizeof (struct nn_shm_feed_seg),
+        PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (nn_slow (self->seg == MAP_FAILED)) {
+        self->seg = NULL;
+        rc = -errno;
+        close (fd);
+        return rc;
+    }
+    rc = close (fd);
+    errno_assert (rc == 0);
+    self->slot = slot;
+    self->lost = 0;
+    self->lostbytes = 0;
+
+    return 0;
+}
+
+void nn_shm_feedr_term (struct nn_shm_feedr *self)
+{
+    int rc;
+
+    rc = munmap (self->seg, sizeof (struct nn_shm_feed_seg));
+    errno_assert (rc == 0);
+}
+
+int nn_shm_feedr_recv (struct nn_shm_feedr *self, struct nn_msg *msg,
+    uint32_t *seq)
+{
+    uint64_t bit;
+    uint64_t cursor;
+    uint64_t tail;
+    uint64_t readers;
+    uint32_t size;
+    size_t len;
+    size_t off;
+    struct nn_shm_feed_slot *s;
+    struct nn_shm_feed_rec *rec;
+
+    bit = ((uint64_t) 1) << self->slot;
+    s = &self->seg->slots [self->slot];
+    while (1) {
+        cursor = s->cursor;
+        tail = self->seg->tail;
+        __sync_synchronize ();
+
+        /*  Nothing to read. The writer may have moved the cursor past
+            the records that are not published yet. Announce the intent to
+            sleep first, then check whether anything was published in
+            the meantime. */
+        if ((int64_t) (tail - cursor) <= 0) {
+            __sync_fetch_and_or (&self->seg->sleepers, bit);
+            if ((int64_t) (self->seg->tail - cursor) <= 0)
+                return 0;
+            __sync_fetch_and_and (&self->seg->sleepers, ~bit);
+            continue;
+        }
+
+        /*  The writer may be overwriting the record at the moment, so
+            the values read may be garbage. If so, it will have moved
+            the cursor. */
+        off = cursor & NN_SHM_FEED_MASK;
+        rec = (struct nn_shm_feed_rec*) (self->seg->data + off);
+        readers = rec->readers;
+        size = rec->size;
+        *seq = rec->seq;
+        len = NN_SHM_FEED_RECLEN (size & NN_SHM_FEED_SIZEMASK);
+        if (nn_slow (tail - cursor > NN_SHM_FEED_SIZE ||
+              cursor % NN_SHM_FEED_ALIGN || off + len > NN_SHM_FEED_SIZE ||
+              (!(size & NN_SHM_FEED_PAD) &&
+              (size & NN_SHM_FEED_SIZEMASK) > NN_SHM_FEED_MAXMSG))) {
+            if (s->cursor != cursor)
+                continue;
+            return -EPROTO;
+        }
+
+        /*  Skip the records that are not meant for the reader. */
+        if (size & NN_SHM_FEED_PAD || !(readers & bit)) {
+            __sync_bool_compare_and_swap (&s->cursor, cursor, cursor + len);
+            continue;
+        }
+        if (size & NN_SHM_FEED_MARKER) {
+            if (!__sync_bool_compare_and_swap (&s->cursor, cursor,
+                  cursor + len))
+                continue;
+            return NN_SHM_FEED_MARKER;
+        }
+
+        /*  Copy the message out. If the writer have moved the cursor in
+            the meantime, the data may have been overwritten. */
+        nn_msg_term (msg);
+        nn_msg_init (msg, size);
+        memcpy (nn_chunkref_data (&msg->body), rec + 1, size);
+        __sync_synchronize ();
+        if (__sync_bool_compare_and_swap (&s->cursor, cursor, cursor + len))
+            return 1;
+    }
+}
+
+void nn_shm_feedr_lost (struct nn_shm_feedr *self, uint64_t *msgs,
+    uint64_t *bytes)
+{
+    uint64_t lost;
+    uint64_t lostbytes;
+
+    lost = self->seg->slots [self->slot].lost;
+    lostbytes = self->seg->slots [self->slot].lostbytes;
+    *msgs = lost - self->lost;
+    *bytes = lostbytes - self->lostbytes;
+    self->lost = lost;
+    self->lostbytes = lostbytes;
+}
+
+#endif
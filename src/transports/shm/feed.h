@@ -0,0 +1,206 @@
+/*
+    Copyright (c) 2013 250bpm s.r.o.
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"),
+    to deal in the Software without restriction, including without limitation
+    the rights to use, copy, modify, merge, publish, distribute, sublicense,
+    and/or sell copies of the Software, and to permit persons to whom
+    the Software is furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included
+    in all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+    THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+    FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+    IN THE SOFTWARE.
+*/
+
+#ifndef NN_SHM_FEED_INCLUDED
+#define NN_SHM_FEED_INCLUDED
+
+#include "../../transport.h"
+
+#include "../../utils/msg.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+struct nn_shms;
+
+/*  Memory segment shared by a bound PUB endpoint and all its shm subscribers,
+    in whichever process they are. A message published to several subscribers
+    is written into the ring once, marked with the set of subscribers it is
+    meant for. Each subscriber reads the ring in place from its own cursor,
+    skipping the messages that are not for it.
+
+    The writer never waits for the readers. Once the ring is full, the oldest
+    record is overwritten. If a reader's cursor still points to it, i.e. the
+    reader lags by the whole ring, the writer moves the cursor past it and
+    accounts for the message as lost. Both the reader and the writer move
+    the cursor using compare-and-swap, so a reader learns that the message it
+    has just copied was overwritten in the meantime by failing to move its
+    cursor past it.
+
+    The records are NN_SHM_FEED_ALIGN-aligned and never wrap around the end
+    of the ring. Messages larger than NN_SHM_FEED_MAXMSG are passed through
+    the ring of the connection instead. A marker record, carrying the number
+    of such messages sent to the reader so far, is written into the feed in
+    their place, so that the reader knows when to read them. If a marker is
+    lost, the reader finds out from the next one and drops the message. */
+
+/*  Size of the ring. Must be a power of two. */
+#ifndef NN_SHM_FEED_SIZE
+#define NN_SHM_FEED_SIZE 1048576
+#endif
+
+#define NN_SHM_FEED_MAXMSG (NN_SHM_FEED_SIZE / 16)
+#define NN_SHM_FEED_MAXREADERS 64
+#define NN_SHM_FEED_ALIGN 16
+#define NN_SHM_FEED_CACHELINE 64
+
+/*  Maximum length of the name of the memory segment, including
+    the terminating zero. */
+#define NN_SHM_FEED_NAMELEN 48
+
+/*  Flags in the size field of a record. */
+#define NN_SHM_FEED_PAD 0x80000000
+#define NN_SHM_FEED_MARKER 0x40000000
+#define NN_SHM_FEED_SIZEMASK 0x3fffffff
+
+struct nn_shm_feed_rec {
+
+    /*  Readers the record is meant for, one bit per reader. */
+    uint64_t readers;
+
+    /*  Size of the message following the record, possibly combined with
+        the flags above. */
+    uint32_t size;
+
+    /*  Sequence number of the message if the record is a marker. */
+    uint32_t seq;
+};
+
+struct nn_shm_feed_slot {
+
+    /*  Position of the next record to be read by the reader. */
+    volatile uint64_t cursor;
+
+    /*  Messages of the reader and their bytes lost so far because the writer
+        overwrote them, not counting the markers. Modified by the writer
+        only. */
+    volatile uint64_t lost;
+    volatile uint64_t lostbytes;
+
+    uint8_t pad [NN_SHM_FEED_CACHELINE - 3 * sizeof (uint64_t)];
+};
+
+struct nn_shm_feed_seg {
+
+    /*  Position past the newest record published to the readers. */
+    volatile uint64_t tail;
+    uint8_t pad1 [NN_SHM_FEED_CACHELINE - sizeof (uint64_t)];
+
+    /*  Readers that went to sleep waiting for new records. The writer resets
+        the bits and wakes the readers up. */
+    volatile uint64_t sleepers;
+    uint8_t pad2 [NN_SHM_FEED_CACHELINE - sizeof (uint64_t)];
+
+    struct nn_shm_feed_slot slots [NN_SHM_FEED_MAXREADERS];
+
+    uint8_t data [NN_SHM_FEED_SIZE];
+};
+
+/*  The writer's side of the feed. Used by the bound endpoint's sessions,
+    all of them in the thread of the socket. */
+struct nn_shm_feed {
+
+    /*  Name of the memory segment and the segment itself. */
+    char name [NN_SHM_FEED_NAMELEN];
+    struct nn_shm_feed_seg *seg;
+
+    /*  Position of the oldest record in the ring and the position past
+        the newest one. Records past seg->tail are not published yet. */
+    uint64_t head;
+    uint64_t pos;
+
+    /*  No reader's cursor is less than this. */
+    uint64_t mincursor;
+
+    /*  Newest record, as long as it's not published, and the message
+        written into it, so that the same message sent to another reader
+        only adds the reader to the record. */
+    uint64_t last;
+    int haslast;
+    struct nn_msg lastmsg;
+
+    /*  Readers of the records not published yet. */
+    uint64_t pending;
+
+    /*  Sessions of the attached readers and the slot to try first when
+        attaching the next one, so that the slots are reused as late as
+        possible. */
+    uint64_t attached;
+    struct nn_shms *readers [NN_SHM_FEED_MAXREADERS];
+    int next;
+
+    /*  The records written while the socket sends a message to several
+        subscribers are published at once. */
+    struct nn_pipebase_deferred publish;
+};
+
+/*  Creates the memory segment. Returns 0 or a negative error code. */
+int nn_shm_feed_init (struct nn_shm_feed *self);
+void nn_shm_feed_term (struct nn_shm_feed *self);
+
+/*  Attaches the session as a new reader. Its cursor is set past the records
+    written so far. Returns the reader's slot or -EMFILE if there are too
+    many readers. */
+int nn_shm_feed_attach (struct nn_shm_feed *self, struct nn_shms *shms);
+void nn_shm_feed_detach (struct nn_shm_feed *self, int slot);
+
+/*  Writes the message, at most NN_SHM_FEED_MAXMSG bytes long, for the reader
+    and takes it over. The records are published once 'pipebase' is done
+    sending (see nn_pipebase_defer). The readers sleeping at that point are
+    woken up using nn_shms_feedwake. */
+void nn_shm_feed_send (struct nn_shm_feed *self, struct nn_pipebase *pipebase,
+    int slot, struct nn_msg *msg);
+
+/*  Same as above, except that a marker with sequence number 'seq' is written
+    for the reader. */
+void nn_shm_feed_mark (struct nn_shm_feed *self, struct nn_pipebase *pipebase,
+    int slot, uint32_t seq);
+
+/*  The reader's side of the feed. */
+struct nn_shm_feedr {
+    struct nn_shm_feed_seg *seg;
+    int slot;
+
+    /*  Losses accounted for so far. */
+    uint64_t lost;
+    uint64_t lostbytes;
+};
+
+/*  Maps the segment announced by the writer. Returns 0 or a negative error
+    code. */
+int nn_shm_feedr_init (struct nn_shm_feedr *self, const char *name, int slot);
+void nn_shm_feedr_term (struct nn_shm_feedr *self);
+
+/*  Reads the next message meant for the reader into 'msg'. Returns 1 if
+    there was one. Returns NN_SHM_FEED_MARKER if the next message is to be
+    read from the connection instead, along with the marker's sequence number
+    in 'seq'. Returns 0 if there's nothing to read, in which case the reader
+    is asleep till the writer wakes it up, or -EPROTO if the segment is
+    corrupted. Unless 1 is returned, the content of 'msg' is undefined. */
+int nn_shm_feedr_recv (struct nn_shm_feedr *self, struct nn_msg *msg,
+    uint32_t *seq);
+
+/*  Retrieves the number of messages and bytes lost since the last call. */
+void nn_shm_feedr_lost (struct nn_shm_feedr *self, uint64_t *msgs,
+    uint64_t *bytes);
+
+#endif
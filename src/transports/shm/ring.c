@@ -0,0 +1,151 @@
+/*
+    Copyright (c) 2013 250bpm s.r.o.
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"),
+    to deal in the Software without restriction, including without limitation
+    the rights to use, copy, modify, merge, publish, distribute, sublicense,
+    and/or sell copies of the Software, and to permit persons to whom
+    the Software is furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included
+    in all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+    THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+    FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+    IN THE SOFTWARE.
+*/
+
+#if defined NN_USE_SHM
+
+#include "ring.h"
+
+#include <string.h>
+
+#define NN_SHM_RING_MASK (NN_SHM_RING_SIZE - 1)
+
+/*  Returns number of bytes stored in the ring. The peer may have corrupted
+    the positions so make sure the result is sane. */
+static size_t nn_shm_ring_used (uint32_t head, uint32_t tail)
+{
+    uint32_t used;
+
+    used = tail - head;
+    return used > NN_SHM_RING_SIZE ? NN_SHM_RING_SIZE : used;
+}
+
+void nn_shm_ring_init (struct nn_shm_ring *self)
+{
+    self->head = 0;
+    self->tail = 0;
+    self->rwaiting = 0;
+    self->wwaiting = 0;
+}
+
+size_t nn_shm_ring_write (struct nn_shm_ring *self, const void *data,
+    size_t len)
+{
+    uint32_t tail;
+    size_t avail;
+    size_t pos;
+    size_t chunk;
+
+    /*  Make sure that consumer is done with the space before overwriting it. */
+    tail = self->tail;
+    avail = NN_SHM_RING_SIZE - nn_shm_ring_used (self->head, tail);
+    __sync_synchronize ();
+    if (len > avail)
+        len = avail;
+    if (!len)
+        return 0;
+
+    /*  Copy the data, wrapping around the end of the buffer if needed. */
+    pos = tail & NN_SHM_RING_MASK;
+    chunk = NN_SHM_RING_SIZE - pos;
+    if (chunk > len)
+        chunk = len;
+    memcpy (self->data + pos, data, chunk);
+    memcpy (self->data, ((const uint8_t*) data) + chunk, len - chunk);
+
+    /*  Publish the data to the consumer. */
+    __sync_synchronize ();
+    self->tail = tail + (uint32_t) len;
+
+    return len;
+}
+
+size_t nn_shm_ring_read (struct nn_shm_ring *self, void *data, size_t len)
+{
+    uint32_t head;
+    size_t avail;
+    size_t pos;
+    size_t chunk;
+
+    /*  Make sure the data are visible before reading them. */
+    head = self->head;
+    avail = nn_shm_ring_used (head, self->tail);
+    __sync_synchronize ();
+    if (len > avail)
+        len = avail;
+    if (!len)
+        return 0;
+
+    /*  Copy the data, wrapping around the end of the buffer if needed. */
+    pos = head & NN_SHM_RING_MASK;
+    chunk = NN_SHM_RING_SIZE - pos;
+    if (chunk > len)
+        chunk = len;
+    memcpy (data, self->data + pos, chunk);
+    memcpy (((uint8_t*) data) + chunk, self->data, len - chunk);
+
+    /*  Return the space to the producer. */
+    __sync_synchronize ();
+    self->head = head + (uint32_t) len;
+
+    return len;
+}
+
+int nn_shm_ring_rsleep (struct nn_shm_ring *self)
+{
+    /*  Announce the intent to sleep first, then check whether any data have
+        arrived in the meantime. Paired with the barrier in
+        nn_shm_ring_rwake() this ensures that the wake-up can't be lost. */
+    self->rwaiting = 1;
+    __sync_synchronize ();
+    if (self->head == self->tail)
+        return 0;
+    self->rwaiting = 0;
+    return 1;
+}
+
+int nn_shm_ring_wsleep (struct nn_shm_ring *self)
+{
+    self->wwaiting = 1;
+    __sync_synchronize ();
+    if (nn_shm_ring_used (self->head, self->tail) == NN_SHM_RING_SIZE)
+        return 0;
+    self->wwaiting = 0;
+    return 1;
+}
+
+int nn_shm_ring_rwake (struct nn_shm_ring *self)
+{
+    __sync_synchronize ();
+    if (!self->rwaiting)
+        return 0;
+    return __sync_bool_compare_and_swap (&self->rwaiting, 1, 0);
+}
+
+int nn_shm_ring_wwake (struct nn_shm_ring *self)
+{
+    __sync_synchronize ();
+    if (!self->wwaiting)
+        return 0;
+    return __sync_bool_compare_and_swap (&self->wwaiting, 1, 0);
+}
+
+#endif
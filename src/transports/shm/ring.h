@@ -0,0 +1,80 @@
+/*
+    Copyright (c) 2013 250bpm s.r.o.
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"),
+    to deal in the Software without restriction, including without limitation
+    the rights to use, copy, modify, merge, publish, distribute, sublicense,
+    and/or sell copies of the Software, and to permit persons to whom
+    the Software is furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included
+    in all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+    THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+    FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+    IN THE SOFTWARE.
+*/
+
+#ifndef NN_SHM_RING_INCLUDED
+#define NN_SHM_RING_INCLUDED
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*  Single-producer single-consumer ring buffer placed in a memory segment
+    shared by two processes. 'head' and 'tail' are free-running byte counters
+    so that the ring is empty when they are equal and full when they are
+    NN_SHM_RING_SIZE bytes apart. The size must be a power of two. */
+#ifndef NN_SHM_RING_SIZE
+#define NN_SHM_RING_SIZE 262144
+#endif
+
+#define NN_SHM_RING_CACHELINE 64
+
+struct nn_shm_ring {
+
+    /*  Position of the consumer. Modified by the consumer only. */
+    volatile uint32_t head;
+    uint8_t pad1 [NN_SHM_RING_CACHELINE - sizeof (uint32_t)];
+
+    /*  Position of the producer. Modified by the producer only. */
+    volatile uint32_t tail;
+    uint8_t pad2 [NN_SHM_RING_CACHELINE - sizeof (uint32_t)];
+
+    /*  Set to 1 when the consumer waits for data or when the producer waits
+        for free space, respectively. The peer resets the flag and wakes
+        the sleeper up. */
+    volatile uint32_t rwaiting;
+    volatile uint32_t wwaiting;
+    uint8_t pad3 [NN_SHM_RING_CACHELINE - 2 * sizeof (uint32_t)];
+
+    /*  The data. */
+    uint8_t data [NN_SHM_RING_SIZE];
+};
+
+void nn_shm_ring_init (struct nn_shm_ring *self);
+
+/*  Copy as much of the data as possible to/from the ring. Return the number
+    of bytes actually transferred which may be less than 'len'. */
+size_t nn_shm_ring_write (struct nn_shm_ring *self, const void *data,
+    size_t len);
+size_t nn_shm_ring_read (struct nn_shm_ring *self, void *data, size_t len);
+
+/*  Called by the consumer/producer when it can't make any progress. Returns 0
+    if it should wait till it's woken up by the peer, 1 if the peer have made
+    progress in the meantime and the operation can be retried straight away. */
+int nn_shm_ring_rsleep (struct nn_shm_ring *self);
+int nn_shm_ring_wsleep (struct nn_shm_ring *self);
+
+/*  Called by the producer/consumer after it have made progress. Returns 1 if
+    the peer is asleep and has to be woken up. */
+int nn_shm_ring_rwake (struct nn_shm_ring *self);
+int nn_shm_ring_wwake (struct nn_shm_ring *self);
+
+#endif
+
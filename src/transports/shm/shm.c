@@ -0,0 +1,102 @@
+/*
+    Copyright (c) 2013 250bpm s.r.o.
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"),
+    to deal in the Software without restriction, including without limitation
+    the rights to use, copy, modify, merge, publish, distribute, sublicense,
+    and/or sell copies of the Software, and to permit persons to whom
+    the Software is furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included
+    in all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+    THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+    FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+    IN THE SOFTWARE.
+*/
+
+#if defined NN_USE_SHM
+
+#include "shm.h"
+#include "shmb.h"
+#include "shmc.h"
+
+#include "../../shm.h"
+
+#include "../../utils/err.h"
+#include "../../utils/alloc.h"
+#include "../../utils/fast.h"
+#include "../../utils/list.h"
+
+/*  nn_transport interface. */
+static void nn_shm_init (void);
+static void nn_shm_term (void);
+static int nn_shm_bind (const char *addr, void *hint,
+    struct nn_epbase **epbase);
+static int nn_shm_connect (const char *addr, void *hint,
+    struct nn_epbase **epbase);
+
+static struct nn_transport nn_shm_vfptr = {
+    "shm",
+    NN_SHM,
+    0,
+    nn_shm_init,
+    nn_shm_term,
+    nn_shm_bind,
+    nn_shm_connect,
+    NULL
+};
+
+struct nn_transport *nn_shm = &nn_shm_vfptr;
+
+static void nn_shm_init (void)
+{
+}
+
+static void nn_shm_term (void)
+{
+}
+
+static int nn_shm_bind (const char *addr, void *hint,
+    struct nn_epbase **epbase)
+{
+    int rc;
+    struct nn_shmb *shmb;
+
+    shmb = nn_alloc (sizeof (struct nn_shmb), "shmb");
+    alloc_assert (shmb);
+    rc = nn_shmb_init (shmb, addr, hint);
+    if (nn_slow (rc != 0)) {
+        nn_free (shmb);
+        return rc;
+    }
+    *epbase = &shmb->epbase;
+
+    return 0;
+}
+
+static int nn_shm_connect (const char *addr, void *hint,
+    struct nn_epbase **epbase)
+{
+    int rc;
+    struct nn_shmc *shmc;
+
+    shmc = nn_alloc (sizeof (struct nn_shmc), "shmc");
+    alloc_assert (shmc);
+    rc = nn_shmc_init (shmc, addr, hint);
+    if (nn_slow (rc != 0)) {
+        nn_free (shmc);
+        return rc;
+    }
+    *epbase = &shmc->epbase;
+
+    return 0;
+}
+
+#endif
+
@@ -0,0 +1,134 @@
+/*
+    Copyright (c) 2013 250bpm s.r.o.
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"),
+    to deal in the Software without restriction, including without limitation
+    the rights to use, copy, modify, merge, publish, distribute, sublicense,
+    and/or sell copies of the Software, and to permit persons to whom
+    the Software is furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included
+    in all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+    THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+    FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+    IN THE SOFTWARE.
+*/
+
+#if defined NN_USE_SHM
+
+#include "shma.h"
+#include "shmb.h"
+
+#include "../../utils/err.h"
+#include "../../utils/cont.h"
+#include "../../utils/alloc.h"
+
+static const struct nn_cp_sink nn_shma_state_connected;
+static const struct nn_cp_sink nn_shma_state_terminating;
+
+/******************************************************************************/
+/*  State: CONNECTED                                                          */
+/******************************************************************************/
+
+/*  In this state control is yielded to the 'shms' state machine. */
+
+static void nn_shma_connected_err (const struct nn_cp_sink **self,
+    struct nn_usock *usock, int errnum);
+static const struct nn_cp_sink nn_shma_state_connected = {
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    nn_shma_connected_err,
+    NULL,
+    NULL,
+    NULL
+};
+
+void nn_shma_init (struct nn_shma *self, struct nn_epbase *epbase,
+    int s, struct nn_usock *usock, struct nn_shmb *shmb)
+{
+    /*  Switch the state. */
+    self->sink = &nn_shma_state_connected;
+    self->shmb = shmb;
+    nn_list_item_init (&self->item);
+
+    /*  The socket is used only for the handshake and for the wake-ups so
+        the default buffer sizes are good enough. */
+    nn_usock_init_child (&self->usock, usock, s, &self->sink, -1, -1,
+        usock->cp);
+
+    /*  Note: must add myself to the list *before* initializing the session,
+        which may fail and terminate me. */
+    nn_list_insert (&shmb->shmas, &self->item, nn_list_end (&shmb->shmas));
+
+    /*  Note: may fail and terminate me - do not reference self after
+        this point! */
+    nn_shms_init (&self->shms, epbase, &self->usock, 0, shmb->feed);
+}
+
+static void nn_shma_connected_err (const struct nn_cp_sink **self,
+    struct nn_usock *usock, int errnum)
+{
+    struct nn_shma *shma;
+
+    shma = nn_cont (self, struct nn_shma, sink);
+
+    /*  Ask the underlying socket to terminate. */
+    shma->sink = &nn_shma_state_terminating;
+    nn_usock_close (&shma->usock);
+}
+
+/******************************************************************************/
+/*  State: TERMINATING                                                        */
+/******************************************************************************/
+
+static void nn_shma_terminating_closed (const struct nn_cp_sink **self,
+    struct nn_usock *usock);
+static const struct nn_cp_sink nn_shma_state_terminating = {
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    nn_shma_terminating_closed,
+    NULL,
+    NULL
+};
+
+void nn_shma_close (struct nn_shma *self)
+{
+    /*  If termination is already underway, do nothing and let it continue. */
+    if (self->sink == &nn_shma_state_terminating)
+        return;
+
+    /*  Terminate the associated session. */
+    nn_shms_term (&self->shms);
+
+    /*  Ask the underlying socket to terminate. */
+    self->sink = &nn_shma_state_terminating;
+    nn_usock_close (&self->usock);
+}
+
+static void nn_shma_terminating_closed (const struct nn_cp_sink **self,
+    struct nn_usock *usock)
+{
+    struct nn_shma *shma;
+
+    shma = nn_cont (self, struct nn_shma, sink);
+
+    /*  Ignore if I don't belong to the bound endpoint. */
+    if (nn_list_item_isinlist (&shma->item))
+        nn_shmb_shma_closed (shma->shmb, shma);
+
+    nn_list_item_term (&shma->item);
+    nn_free (shma);
+}
+
+#endif
@@ -0,0 +1,247 @@
+/*
+    Copyright (c) 2013 250bpm s.r.o.
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"),
+    to deal in the Software without restriction, including without limitation
+    the rights to use, copy, modify, merge, publish, distribute, sublicense,
+    and/or sell copies of the Software, and to permit persons to whom
+    the Software is furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included
+    in all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+    THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+    FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+    IN THE SOFTWARE.
+*/
+
+#if defined NN_USE_SHM
+
+#include "shmb.h"
+#include "shma.h"
+
+#include "../../pubsub.h"
+
+#include "../../utils/err.h"
+#include "../../utils/cont.h"
+#include "../../utils/alloc.h"
+#include "../../utils/fast.h"
+
+#include <string.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#define NN_SHMB_BACKLOG 10
+
+/*  States. */
+static const struct nn_cp_sink nn_shmb_state_listening;
+static const struct nn_cp_sink nn_shmb_state_terminating1;
+static const struct nn_cp_sink nn_shmb_state_terminating2;
+
+/*  Implementation of nn_epbase interface. */
+static int nn_shmb_close (struct nn_epbase *self);
+static const struct nn_epbase_vfptr nn_shmb_epbase_vfptr =
+    {nn_shmb_close};
+
+/*  Private functions. */
+static void nn_shmb_term (struct nn_shmb *self);
+
+/******************************************************************************/
+/*  State: LISTENING                                                          */
+/******************************************************************************/
+
+static void nn_shmb_listening_accepted (const struct nn_cp_sink **self,
+    struct nn_usock *usock, int s);
+static const struct nn_cp_sink nn_shmb_state_listening = {
+    NULL,
+    NULL,
+    NULL,
+    nn_shmb_listening_accepted,
+    NULL,
+    NULL,
+    NULL,
+    NULL
+};
+
+int nn_shmb_init (struct nn_shmb *self, const char *addr, void *hint)
+{
+    int rc;
+    int protocol;
+    size_t sz;
+    struct sockaddr_storage ss;
+    struct sockaddr_un *un;
+
+    /*  Create the AF_UNIX address. */
+    memset (&ss, 0, sizeof (ss));
+    un = (struct sockaddr_un*) &ss;
+    if (strlen (addr) >= sizeof (un->sun_path))
+        return -ENAMETOOLONG;
+    ss.ss_family = AF_UNIX;
+    strncpy (un->sun_path, addr, sizeof (un->sun_path));
+
+    /*  Start in LISTENING state. */
+    self->sink = &nn_shmb_state_listening;
+    nn_list_init (&self->shmas);
+    nn_epbase_init (&self->epbase, &nn_shmb_epbase_vfptr, addr, hint);
+
+    /*  PUB socket passes the messages to the subscribers via a feed. If it
+        can't be created, the connections fall back to their own rings. */
+    self->feed = NULL;
+    sz = sizeof (protocol);
+    nn_epbase_getopt (&self->epbase, NN_SOL_SOCKET, NN_PROTOCOL,
+        &protocol, &sz);
+    nn_assert (sz == sizeof (protocol));
+    if (protocol == NN_PUB) {
+        self->feed = nn_alloc (sizeof (struct nn_shm_feed), "shm feed");
+        alloc_assert (self->feed);
+        rc = nn_shm_feed_init (self->feed);
+        if (nn_slow (rc < 0)) {
+            nn_free (self->feed);
+            self->feed = NULL;
+        }
+    }
+
+    /*  Delete the file left over by eventual previous runs of
+        the application. */
+    rc = unlink (addr);
+    errno_assert (rc == 0 || errno == ENOENT);
+
+    /*  Open the listening socket. */
+    rc = nn_usock_init (&self->usock, &self->sink, AF_UNIX, SOCK_STREAM, 0,
+        -1, -1, nn_epbase_getcp (&self->epbase));
+    errnum_assert (rc == 0, -rc);
+    rc = nn_usock_bind (&self->usock, (struct sockaddr*) &ss,
+        sizeof (struct sockaddr_un));
+    errnum_assert (rc == 0, -rc);
+    rc = nn_usock_listen (&self->usock, NN_SHMB_BACKLOG);
+    errnum_assert (rc == 0, -rc);
+
+    /*  Start waiting for incoming connections. */
+    nn_usock_accept (&self->usock);
+
+    return 0;
+}
+
+static void nn_shmb_listening_accepted (const struct nn_cp_sink **self,
+    struct nn_usock *usock, int s)
+{
+    struct nn_shmb *shmb;
+    struct nn_shma *shma;
+
+    shmb = nn_cont (self, struct nn_shmb, sink);
+
+    shma = nn_alloc (sizeof (struct nn_shma), "shma");
+    alloc_assert (shma);
+
+    /*  Note: shma may be terminated after this call -
+        do not reference it. */
+    nn_shma_init (shma, &shmb->epbase, s, usock, shmb);
+
+    /*  Start waiting for the next incoming connection. */
+    nn_usock_accept (usock);
+}
+
+/******************************************************************************/
+/*  State: TERMINATING1                                                       */
+/******************************************************************************/
+
+static void nn_shmb_terminating1_closed (const struct nn_cp_sink **self,
+    struct nn_usock *usock);
+static const struct nn_cp_sink nn_shmb_state_terminating1 = {
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    nn_shmb_terminating1_closed,
+    NULL,
+    NULL
+};
+
+static int nn_shmb_close (struct nn_epbase *self)
+{
+    struct nn_shmb *shmb;
+
+    shmb = nn_cont (self, struct nn_shmb, epbase);
+
+    /*  Close the listening socket itself. */
+    shmb->sink = &nn_shmb_state_terminating1;
+    nn_usock_close (&shmb->usock);
+
+    return -EINPROGRESS;
+}
+
+static void nn_shmb_terminating1_closed (const struct nn_cp_sink **self,
+    struct nn_usock *usock)
+{
+    struct nn_shmb *shmb;
+    struct nn_list_item *it;
+    struct nn_shma *shma;
+
+    shmb = nn_cont (self, struct nn_shmb, sink);
+
+    /*  Listening socket is closed. Switch from TERMINATING1 to TERMINATING2
+        state and start closing individual sessions. */
+    shmb->sink = &nn_shmb_state_terminating2;
+
+    /*  If there are no sessions left, we can terminate straight away. */
+    if (nn_list_empty (&shmb->shmas)) {
+        nn_shmb_term (shmb);
+        return;
+    }
+
+    /*  Ask all the associated sessions to close. Once the last of them is
+        closed, which may happen synchronously, the endpoint is deallocated,
+        so it can't be referenced afterwards. */
+    it = nn_list_begin (&shmb->shmas);
+    while (it != nn_list_end (&shmb->shmas)) {
+        shma = nn_cont (it, struct nn_shma, item);
+        it = nn_list_next (&shmb->shmas, it);
+        nn_shma_close (shma);
+    }
+}
+
+/******************************************************************************/
+/*  State: TERMINATING2                                                       */
+/******************************************************************************/
+
+static const struct nn_cp_sink nn_shmb_state_terminating2 = {
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    NULL
+};
+
+void nn_shmb_shma_closed (struct nn_shmb *self, struct nn_shma *shma)
+{
+    /*  One of the associated connections was closed. */
+    nn_list_erase (&self->shmas, &shma->item);
+
+    /*  In TERMINATING state this may be the last connection left.
+        If so, we can move on with the deallocation. */
+    if (self->sink == &nn_shmb_state_terminating2 &&
+          nn_list_empty (&self->shmas))
+        nn_shmb_term (self);
+}
+
+static void nn_shmb_term (struct nn_shmb *self)
+{
+    if (self->feed) {
+        nn_shm_feed_term (self->feed);
+        nn_free (self->feed);
+    }
+    nn_list_term (&self->shmas);
+    nn_epbase_term (&self->epbase);
+    nn_free (self);
+}
+
+#endif
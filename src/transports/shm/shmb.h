@@ -0,0 +1,61 @@
+/*
+    Copyright (c) 2013 250bpm s.r.o.
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"),
+    to deal in the Software without restriction, including without limitation
+    the rights to use, copy, modify, merge, publish, distribute, sublicense,
+    and/or sell copies of the Software, and to permit persons to whom
+    the Software is furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included
+    in all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+    THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+    FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+    IN THE SOFTWARE.
+*/
+
+#ifndef NN_SHMB_INCLUDED
+#define NN_SHMB_INCLUDED
+
+#include "../../transport.h"
+#include "../../utils/list.h"
+
+#include "feed.h"
+
+struct nn_shma;
+
+/*  Bound shm endpoint. The rendezvous is done via a UNIX domain socket bound
+    to the address of the endpoint. */
+
+struct nn_shmb {
+
+    /*  Event sink. */
+    const struct nn_cp_sink *sink;
+
+    /*  This object is an endpoint. */
+    struct nn_epbase epbase;
+
+    /*  The listening socket. */
+    struct nn_usock usock;
+
+    /*  List of all connections accepted via this endpoint. */
+    struct nn_list shmas;
+
+    /*  Feed shared by the subscribers if the socket is a PUB socket. NULL
+        if there's none, in which case each connection uses its own
+        rings. */
+    struct nn_shm_feed *feed;
+};
+
+int nn_shmb_init (struct nn_shmb *self, const char *addr, void *hint);
+
+void nn_shmb_shma_closed (struct nn_shmb *self, struct nn_shma *shma);
+
+#endif
+
@@ -0,0 +1,330 @@
+/*
+    Copyright (c) 2013 250bpm s.r.o.
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"),
+    to deal in the Software without restriction, including without limitation
+    the rights to use, copy, modify, merge, publish, distribute, sublicense,
+    and/or sell copies of the Software, and to permit persons to whom
+    the Software is furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included
+    in all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+    THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+    FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+    IN THE SOFTWARE.
+*/
+
+#if defined NN_USE_SHM
+
+#include "shmc.h"
+
+#include "../../utils/err.h"
+#include "../../utils/cont.h"
+#include "../../utils/alloc.h"
+#include "../../utils/fast.h"
+#include "../../utils/random.h"
+
+#include <string.h>
+#include <sys/un.h>
+
+/*  States. */
+static const struct nn_cp_sink nn_shmc_state_waiting;
+static const struct nn_cp_sink nn_shmc_state_connecting;
+static const struct nn_cp_sink nn_shmc_state_connected;
+static const struct nn_cp_sink nn_shmc_state_closing;
+
+/*  Private functions. */
+static int nn_shmc_compute_retry_ivl (struct nn_shmc *self)
+{
+    int reconnect_ivl;
+    int reconnect_ivl_max;
+    size_t sz;
+    int result;
+    unsigned int random;
+
+    /*  Get relevant options' values. */
+    sz = sizeof (reconnect_ivl);
+    nn_epbase_getopt (&self->epbase, NN_SOL_SOCKET, NN_RECONNECT_IVL,
+        &reconnect_ivl, &sz);
+    nn_assert (sz == sizeof (reconnect_ivl));
+    sz = sizeof (reconnect_ivl_max);
+    nn_epbase_getopt (&self->epbase, NN_SOL_SOCKET, NN_RECONNECT_IVL_MAX,
+        &reconnect_ivl_max, &sz);
+    nn_assert (sz == sizeof (reconnect_ivl_max));
+
+    /*  Negative number means that reconnect sequence is starting.
+        The reconnect interval in this case is NN_RECONNECT_IVL. */
+    if (self->retry_ivl < 0)
+        self->retry_ivl = reconnect_ivl;
+
+    /*  Current retry_ivl will be returned to the caller. */
+    result = self->retry_ivl;
+
+    /*  Re-compute new retry interval. */
+    if (reconnect_ivl_max > 0 && reconnect_ivl_max > reconnect_ivl) {
+        self->retry_ivl *= 2;
+        if (self->retry_ivl > reconnect_ivl_max)
+            self->retry_ivl = reconnect_ivl_max;
+    }
+
+    /*  Randomise the result to prevent re-connection storms when network
+        and/or server goes down and then up again. This may rise
+        the reconnection interval at most twice and at most by one second. */
+    nn_random_generate (&random, sizeof (random));
+    result += (random % result % 1000);
+    return result;
+}
+
+/*  Implementation of nn_epbase interface. */
+static int nn_shmc_close (struct nn_epbase *self);
+static const struct nn_epbase_vfptr nn_shmc_epbase_vfptr =
+    {nn_shmc_close};
+
+/******************************************************************************/
+/*  State: WAITING                                                            */
+/******************************************************************************/
+
+static void nn_shmc_waiting_timeout (const struct nn_cp_sink **self,
+    struct nn_timer *timer);
+static const struct nn_cp_sink nn_shmc_state_waiting = {
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    nn_shmc_waiting_timeout,
+    NULL
+};
+
+int nn_shmc_init (struct nn_shmc *self, const char *addr, void *hint)
+{
+    int rc;
+    struct sockaddr_un *un;
+
+    /*  Check the address. */
+    if (strlen (addr) >= sizeof (un->sun_path))
+        return -ENAMETOOLONG;
+
+    /*  Initialise the base class. */
+    nn_epbase_init (&self->epbase, &nn_shmc_epbase_vfptr, addr, hint);
+
+    /*  Open a socket. It's used only for the handshake and for the wake-ups
+        so the default buffer sizes are good enough. */
+    rc = nn_usock_init (&self->usock, &self->sink, AF_UNIX, SOCK_STREAM, 0,
+        -1, -1, nn_epbase_getcp (&self->epbase));
+    errnum_assert (rc == 0, -rc);
+
+    /*  Initialise the retry timer. */
+    self->retry_ivl = -1;
+    nn_timer_init (&self->retry_timer, &self->sink,
+        nn_epbase_getcp (&self->epbase));
+
+    /*  Pretend we were waiting for the re-connect timer and that the timer
+        have expired. */
+    self->sink = &nn_shmc_state_waiting;
+    nn_shmc_waiting_timeout (&self->sink, &self->retry_timer);
+
+    return 0;
+}
+
+static void nn_shmc_waiting_timeout (const struct nn_cp_sink **self,
+    struct nn_timer *timer)
+{
+    struct nn_shmc *shmc;
+    struct sockaddr_storage ss;
+    struct sockaddr_un *un;
+
+    shmc = nn_cont (self, struct nn_shmc, sink);
+
+    /*  Retry timer expired. Create the AF_UNIX address. */
+    memset (&ss, 0, sizeof (ss));
+    un = (struct sockaddr_un*) &ss;
+    ss.ss_family = AF_UNIX;
+    strncpy (un->sun_path, nn_epbase_getaddr (&shmc->epbase),
+        sizeof (un->sun_path));
+
+    /*  Start connecting. */
+    shmc->sink = &nn_shmc_state_connecting;
+    nn_usock_connect (&shmc->usock, (struct sockaddr*) &ss,
+        sizeof (struct sockaddr_un));
+}
+
+/******************************************************************************/
+/*  State: CONNECTING                                                         */
+/******************************************************************************/
+
+static void nn_shmc_connecting_connected (const struct nn_cp_sink **self,
+    struct nn_usock *usock);
+static void nn_shmc_connecting_err (const struct nn_cp_sink **self,
+    struct nn_usock *usock, int errnum);
+static const struct nn_cp_sink nn_shmc_state_connecting = {
+    NULL,
+    NULL,
+    nn_shmc_connecting_connected,
+    NULL,
+    nn_shmc_connecting_err,
+    NULL,
+    NULL,
+    NULL
+};
+
+static void nn_shmc_connecting_connected (const struct nn_cp_sink **self,
+    struct nn_usock *usock)
+{
+    struct nn_shmc *shmc;
+
+    shmc = nn_cont (self, struct nn_shmc, sink);
+
+    /*  TODO: Set current reconnect interval to the value of
+        NN_RECONNECT_IVL. */
+
+    /*  Connect succeeded. Switch to the session state machine. */
+    shmc->sink = &nn_shmc_state_connected;
+    nn_shms_init (&shmc->shms, &shmc->epbase, &shmc->usock, 1, NULL);
+}
+
+static void nn_shmc_connecting_err (const struct nn_cp_sink **self,
+    struct nn_usock *usock, int errnum)
+{
+    struct nn_shmc *shmc;
+
+    shmc = nn_cont (self, struct nn_shmc, sink);
+
+    /*  Connect failed. Close the underlying socket. */
+    shmc->sink = &nn_shmc_state_closing;
+    nn_usock_close (&shmc->usock);
+}
+
+/******************************************************************************/
+/*  State: CONNECTED                                                          */
+/******************************************************************************/
+
+/*  In this state control is yielded to the 'shms' state machine. */
+
+static void nn_shmc_connected_err (const struct nn_cp_sink **self,
+    struct nn_usock *usock, int errnum);
+static const struct nn_cp_sink nn_shmc_state_connected = {
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    nn_shmc_connected_err,
+    NULL,
+    NULL,
+    NULL
+};
+
+static void nn_shmc_connected_err (const struct nn_cp_sink **self,
+    struct nn_usock *usock, int errnum)
+{
+    struct nn_shmc *shmc;
+
+    shmc = nn_cont (self, struct nn_shmc, sink);
+
+    /*  The connection is broken. Close the underlying socket and reconnect
+        once it is closed. */
+    shmc->sink = &nn_shmc_state_closing;
+    nn_usock_close (&shmc->usock);
+}
+
+/******************************************************************************/
+/*  State: CLOSING                                                            */
+/******************************************************************************/
+
+static void nn_shmc_closing_closed (const struct nn_cp_sink **self,
+    struct nn_usock *usock);
+static const struct nn_cp_sink nn_shmc_state_closing = {
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    nn_shmc_closing_closed,
+    NULL,
+    NULL
+};
+
+static void nn_shmc_closing_closed (const struct nn_cp_sink **self,
+    struct nn_usock *usock)
+{
+    int rc;
+    struct nn_shmc *shmc;
+
+    shmc = nn_cont (self, struct nn_shmc, sink);
+
+    /*  Create new socket. */
+    rc = nn_usock_init (&shmc->usock, &shmc->sink, AF_UNIX, SOCK_STREAM, 0,
+        -1, -1, nn_epbase_getcp (&shmc->epbase));
+    errnum_assert (rc == 0, -rc);
+
+    /*  Wait for the specified period. */
+    shmc->sink = &nn_shmc_state_waiting;
+    nn_timer_start (&shmc->retry_timer,
+        nn_shmc_compute_retry_ivl (shmc));
+}
+
+/******************************************************************************/
+/*  State: TERMINATING                                                        */
+/******************************************************************************/
+
+static void nn_shmc_terminating_closed (const struct nn_cp_sink **self,
+    struct nn_usock *usock);
+static const struct nn_cp_sink nn_shmc_state_terminating = {
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    nn_shmc_terminating_closed,
+    NULL,
+    NULL
+};
+
+static int nn_shmc_close (struct nn_epbase *self)
+{
+    struct nn_shmc *shmc;
+
+    shmc = nn_cont (self, struct nn_shmc, epbase);
+
+    /*  If termination is already underway, do nothing and let it continue. */
+    if (shmc->sink == &nn_shmc_state_terminating)
+        return -EINPROGRESS;
+
+    /*  If the connection exists, stop the session state machine. */
+    if (shmc->sink == &nn_shmc_state_connected)
+        nn_shms_term (&shmc->shms);
+
+    /*  Deallocate resources. */
+    nn_timer_term (&shmc->retry_timer);
+
+    /*  Close the socket, if needed. If it is being closed already, just wait
+        for the closing to finish. */
+    if (shmc->sink == &nn_shmc_state_closing) {
+        shmc->sink = &nn_shmc_state_terminating;
+        return -EINPROGRESS;
+    }
+    shmc->sink = &nn_shmc_state_terminating;
+    nn_usock_close (&shmc->usock);
+
+    return -EINPROGRESS;
+}
+
+static void nn_shmc_terminating_closed (const struct nn_cp_sink **self,
+    struct nn_usock *usock)
+{
+    struct nn_shmc *shmc;
+
+    shmc = nn_cont (self, struct nn_shmc, sink);
+
+    nn_epbase_term (&shmc->epbase);
+    nn_free (shmc);
+}
+
+#endif
@@ -0,0 +1,58 @@
+/*
+    Copyright (c) 2013 250bpm s.r.o.
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"),
+    to deal in the Software without restriction, including without limitation
+    the rights to use, copy, modify, merge, publish, distribute, sublicense,
+    and/or sell copies of the Software, and to permit persons to whom
+    the Software is furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included
+    in all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+    THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+    FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+    IN THE SOFTWARE.
+*/
+
+#ifndef NN_SHMC_INCLUDED
+#define NN_SHMC_INCLUDED
+
+#include "../../transport.h"
+
+#include "shms.h"
+
+/*  Connecting shm endpoint. */
+
+struct nn_shmc {
+
+    /*  Event sink. */
+    const struct nn_cp_sink *sink;
+
+    /*  This object is an endpoint. */
+    struct nn_epbase epbase;
+
+    /*  The underlying UNIX domain socket. */
+    struct nn_usock usock;
+
+    /*  There's at most one session per connecting endpoint, thus we can
+        embed the session object directly into the connecter class. */
+    struct nn_shms shms;
+
+    /*  Current value of rety interval, in milliseconds. -1 means that
+        value of NN_RECONNECT_IVL option should be used. */
+    int retry_ivl;
+
+    /*  Timer to wait before retrying to connect. */
+    struct nn_timer retry_timer;
+};
+
+int nn_shmc_init (struct nn_shmc *self, const char *addr, void *hint);
+
+#endif
+
@@ -0,0 +1,896 @@
+/*
+    Copyright (c) 2013 250bpm s.r.o.
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"),
+    to deal in the Software without restriction, including without limitation
+    the rights to use, copy, modify, merge, publish, distribute, sublicense,
+    and/or sell copies of the Software, and to permit persons to whom
+    the Software is furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included
+    in all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+    THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+    FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+    IN THE SOFTWARE.
+*/
+
+#if defined NN_USE_SHM
+
+#include "shms.h"
+
+#include "../../pubsub.h"
+
+#include "../../utils/err.h"
+#include "../../utils/cont.h"
+#include "../../utils/wire.h"
+#include "../../utils/fast.h"
+#include "../../utils/random.h"
+
+#include <string.h>
+#include <stdio.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+/*  Number of attempts to find an unused name for the memory segment. */
+#define NN_SHMS_CREATE_ATTEMPTS 16
+
+/*  Private functions. */
+static void nn_shms_chello_sent (const struct nn_cp_sink **self,
+    struct nn_usock *usock);
+static void nn_shms_creply_received (const struct nn_cp_sink **self,
+    struct nn_usock *usock);
+static void nn_shms_cfeed_received (const struct nn_cp_sink **self,
+    struct nn_usock *usock);
+static void nn_shms_ahello_received (const struct nn_cp_sink **self,
+    struct nn_usock *usock);
+static void nn_shms_areply_sent (const struct nn_cp_sink **self,
+    struct nn_usock *usock);
+static void nn_shms_hdr_timeout (const struct nn_cp_sink **self,
+    struct nn_timer *timer);
+static void nn_shms_received (const struct nn_cp_sink **self,
+    struct nn_usock *usock);
+static void nn_shms_sent (const struct nn_cp_sink **self,
+    struct nn_usock *usock);
+static void nn_shms_err (const struct nn_cp_sink **self,
+    struct nn_usock *usock, int errnum);
+static void nn_shms_fail (struct nn_shms *self, int errnum);
+static void nn_shms_leave (struct nn_shms *self);
+static int nn_shms_create (struct nn_shms *self);
+static int nn_shms_open (struct nn_shms *self);
+static void nn_shms_connected (struct nn_shms *self);
+static void nn_shms_activate (struct nn_shms *self);
+static int nn_shms_read (struct nn_shms *self, void *buf, size_t len);
+static int nn_shms_parse (struct nn_shms *self);
+static int nn_shms_parsering (struct nn_shms *self);
+static int nn_shms_flush (struct nn_shms *self);
+static void nn_shms_wake (struct nn_shms *self);
+
+/*  CHELLO state. Connecting side is sending the hello message. */
+static const struct nn_cp_sink nn_shms_state_chello = {
+    NULL,
+    nn_shms_chello_sent,
+    NULL,
+    NULL,
+    nn_shms_err,
+    NULL,
+    nn_shms_hdr_timeout,
+    NULL
+};
+
+/*  CREPLY state. Connecting side is waiting for the reply. */
+static const struct nn_cp_sink nn_shms_state_creply = {
+    nn_shms_creply_received,
+    NULL,
+    NULL,
+    NULL,
+    nn_shms_err,
+    NULL,
+    nn_shms_hdr_timeout,
+    NULL
+};
+
+/*  CFEED state. Connecting side is receiving the description of the feed. */
+static const struct nn_cp_sink nn_shms_state_cfeed = {
+    nn_shms_cfeed_received,
+    NULL,
+    NULL,
+    NULL,
+    nn_shms_err,
+    NULL,
+    nn_shms_hdr_timeout,
+    NULL
+};
+
+/*  AHELLO state. Accepting side is waiting for the hello message. */
+static const struct nn_cp_sink nn_shms_state_ahello = {
+    nn_shms_ahello_received,
+    NULL,
+    NULL,
+    NULL,
+    nn_shms_err,
+    NULL,
+    nn_shms_hdr_timeout,
+    NULL
+};
+
+/*  AREPLY state. Accepting side is sending the reply. */
+static const struct nn_cp_sink nn_shms_state_areply = {
+    NULL,
+    nn_shms_areply_sent,
+    NULL,
+    NULL,
+    nn_shms_err,
+    NULL,
+    nn_shms_hdr_timeout,
+    NULL
+};
+
+/*  ACTIVE state. */
+static const struct nn_cp_sink nn_shms_state_active = {
+    nn_shms_received,
+    nn_shms_sent,
+    NULL,
+    NULL,
+    nn_shms_err,
+    NULL,
+    NULL,
+    NULL
+};
+
+/*  Pipe interface. */
+static int nn_shms_send (struct nn_pipebase *self, struct nn_msg *msg);
+static int nn_shms_recv (struct nn_pipebase *self, struct nn_msg *msg);
+const struct nn_pipebase_vfptr nn_shms_pipebase_vfptr = {
+    nn_shms_send,
+    nn_shms_recv
+};
+
+void nn_shms_init (struct nn_shms *self, struct nn_epbase *epbase,
+    struct nn_usock *usock, int creator, struct nn_shm_feed *feed)
+{
+    int rc;
+    int protocol;
+    int timeout;
+    size_t sz;
+    struct nn_iobuf iobuf;
+
+    /*  Redirect the underlying socket's events to this state machine. */
+    self->usock = usock;
+    self->sink = creator ? &nn_shms_state_chello : &nn_shms_state_ahello;
+    self->original_sink = nn_usock_setsink (usock, &self->sink);
+
+    /*  Initialise the pipe to communicate with the user. */
+    rc = nn_pipebase_init (&self->pipebase, &nn_shms_pipebase_vfptr, epbase);
+    nn_assert (rc == 0);
+
+    self->creator = creator;
+    self->name [0] = 0;
+    self->seg = NULL;
+    self->in = NULL;
+    self->out = NULL;
+    self->instate = NN_SHMS_INSTATE_HDR;
+    self->inoff = 0;
+    nn_msg_init (&self->inmsg, 0);
+    self->outstate = NN_SHMS_OUTSTATE_IDLE;
+    self->feed = feed;
+    self->slot = -1;
+    self->markers = 0;
+    self->reading = 0;
+    self->fromring = 0;
+    self->ringseq = 0;
+    self->ringwant = 0;
+    self->wakein = 0;
+    self->wakeout = 0;
+    self->wakeup = 0;
+    self->wakeinflight = 0;
+    self->busy = 0;
+    self->errnum = 0;
+
+    /*  Start the header timeout timer. */
+    sz = sizeof (timeout);
+    nn_epbase_getopt (epbase, NN_SOL_SOCKET, NN_HANDSHAKE_TIMEOUT,
+        &timeout, &sz);
+    nn_assert (sz == sizeof (timeout));
+    nn_timer_init (&self->hdr_timeout, &self->sink, usock->cp);
+    if (timeout >= 0)
+        nn_timer_start (&self->hdr_timeout, timeout);
+
+    /*  Prepare the protocol header. */
+    sz = sizeof (protocol);
+    nn_epbase_getopt (epbase, NN_SOL_SOCKET, NN_PROTOCOL, &protocol, &sz);
+    nn_assert (sz == sizeof (protocol));
+    memcpy (self->protohdr, "\0\0SP\0\0\0\0", 8);
+    nn_puts (self->protohdr + 4, (uint16_t) protocol);
+
+    /*  Accepting side waits for the peer to announce the memory segment. */
+    if (!creator) {
+        nn_usock_recv (usock, self->hello, NN_SHMS_HELLO_SIZE);
+        return;
+    }
+
+    /*  Connecting side creates the memory segment and sends its name to
+        the peer along with the protocol header. Subscribers offer to read
+        the peer's feed. */
+    rc = nn_shms_create (self);
+    if (nn_slow (rc < 0)) {
+        nn_shms_fail (self, -rc);
+        return;
+    }
+    memset (self->hello, 0, NN_SHMS_HELLO_SIZE);
+    memcpy (self->hello, self->protohdr, 8);
+    if (protocol == NN_SUB)
+        self->hello [7] |= NN_SHMS_FEED;
+    memcpy (self->hello + 8, self->name, strlen (self->name));
+    iobuf.iov_base = self->hello;
+    iobuf.iov_len = NN_SHMS_HELLO_SIZE;
+    nn_usock_send (usock, &iobuf, 1);
+}
+
+void nn_shms_term (struct nn_shms *self)
+{
+    int rc;
+
+    /*  Close the messages in progress. */
+    nn_msg_term (&self->inmsg);
+    if (self->outstate == NN_SHMS_OUTSTATE_SENDING)
+        nn_msg_term (&self->outmsg);
+
+    nn_timer_term (&self->hdr_timeout);
+    nn_pipebase_term (&self->pipebase);
+
+    /*  Stop using the feed. */
+    if (self->slot >= 0)
+        nn_shm_feed_detach (self->feed, self->slot);
+    if (self->reading)
+        nn_shm_feedr_term (&self->feedr);
+
+    /*  Unmap the memory segment. If the peer haven't opened it yet, make sure
+        that it doesn't outlive the session. */
+    if (self->seg) {
+        rc = munmap (self->seg, sizeof (struct nn_shm_seg));
+        errno_assert (rc == 0);
+    }
+    if (self->name [0]) {
+        rc = shm_unlink (self->name);
+        errno_assert (rc == 0 || errno == ENOENT);
+    }
+
+    /*  Return control to the parent state machine. */
+    nn_usock_setsink (self->usock, self->original_sink);
+}
+
+static void nn_shms_chello_sent (const struct nn_cp_sink **self,
+    struct nn_usock *usock)
+{
+    struct nn_shms *shms;
+
+    shms = nn_cont (self, struct nn_shms, sink);
+
+    /*  Receive the protocol header from the peer. */
+    shms->sink = &nn_shms_state_creply;
+    nn_usock_recv (usock, shms->hello, 8);
+}
+
+static void nn_shms_creply_received (const struct nn_cp_sink **self,
+    struct nn_usock *usock)
+{
+    struct nn_shms *shms;
+
+    shms = nn_cont (self, struct nn_shms, sink);
+
+    /*  Check whether the peer speaks the right protocol. */
+    if (nn_slow (memcmp (shms->hello, "\0\0SP", 4) != 0 ||
+          !nn_pipebase_ispeer (&shms->pipebase, nn_gets (shms->hello + 4)))) {
+        nn_shms_fail (shms, EPROTO);
+        return;
+    }
+
+    /*  If the peer is going to use the feed, the rest of the reply
+        describes it. */
+    if (shms->hello [7] & NN_SHMS_FEED) {
+        if (nn_slow (nn_gets (shms->protohdr + 4) != NN_SUB)) {
+            nn_shms_fail (shms, EPROTO);
+            return;
+        }
+        shms->sink = &nn_shms_state_cfeed;
+        nn_usock_recv (usock, shms->hello + 8, NN_SHMS_HELLO_SIZE - 8);
+        return;
+    }
+
+    nn_shms_connected (shms);
+}
+
+static void nn_shms_cfeed_received (const struct nn_cp_sink **self,
+    struct nn_usock *usock)
+{
+    int rc;
+    const char *name;
+    struct nn_shms *shms;
+
+    shms = nn_cont (self, struct nn_shms, sink);
+
+    /*  Check whether the name of the feed is well-formed and map it. */
+    name = (const char*) shms->hello + 8;
+    if (nn_slow (name [0] != '/' ||
+          !memchr (name, 0, NN_SHM_FEED_NAMELEN))) {
+        nn_shms_fail (shms, EPROTO);
+        return;
+    }
+    rc = nn_shm_feedr_init (&shms->feedr, name,
+        (int) nn_getl (shms->hello + 56));
+    if (nn_slow (rc < 0)) {
+        nn_shms_fail (shms, -rc);
+        return;
+    }
+    shms->reading = 1;
+
+    nn_shms_connected (shms);
+}
+
+static void nn_shms_ahello_received (const struct nn_cp_sink **self,
+    struct nn_usock *usock)
+{
+    int rc;
+    struct nn_shms *shms;
+    struct nn_iobuf iobuf;
+
+    shms = nn_cont (self, struct nn_shms, sink);
+
+    /*  Check whether the peer speaks the right protocol. */
+    if (nn_slow (memcmp (shms->hello, "\0\0SP", 4) != 0 ||
+          !nn_pipebase_ispeer (&shms->pipebase, nn_gets (shms->hello + 4)))) {
+        nn_shms_fail (shms, EPROTO);
+        return;
+    }
+
+    /*  Map the memory segment announced by the peer. */
+    rc = nn_shms_open (shms);
+    if (nn_slow (rc < 0)) {
+        nn_shms_fail (shms, -rc);
+        return;
+    }
+
+    /*  If the peer is able to read the feed, attach it. If there are too
+        many readers already, the peer uses the ring only. */
+    if (shms->feed && shms->hello [7] & NN_SHMS_FEED)
+        shms->slot = nn_shm_feed_attach (shms->feed, shms);
+
+    /*  Confirm the connection by sending our own protocol header, followed
+        by the description of the feed, if it is used. */
+    shms->sink = &nn_shms_state_areply;
+    if (shms->slot >= 0) {
+        memset (shms->hello, 0, NN_SHMS_HELLO_SIZE);
+        memcpy (shms->hello, shms->protohdr, 8);
+        shms->hello [7] |= NN_SHMS_FEED;
+        memcpy (shms->hello + 8, shms->feed->name, strlen (shms->feed->name));
+        nn_putl (shms->hello + 56, (uint32_t) shms->slot);
+        iobuf.iov_base = shms->hello;
+        iobuf.iov_len = NN_SHMS_HELLO_SIZE;
+    }
+    else {
+        iobuf.iov_base = shms->protohdr;
+        iobuf.iov_len = 8;
+    }
+    nn_usock_send (usock, &iobuf, 1);
+}
+
+static void nn_shms_areply_sent (const struct nn_cp_sink **self,
+    struct nn_usock *usock)
+{
+    struct nn_shms *shms;
+
+    shms = nn_cont (self, struct nn_shms, sink);
+    nn_shms_activate (shms);
+}
+
+static void nn_shms_hdr_timeout (const struct nn_cp_sink **self,
+    struct nn_timer *timer)
+{
+    struct nn_shms *shms;
+
+    /*  The initial handshake have timed out. */
+    shms = nn_cont (self, struct nn_shms, sink);
+    nn_shms_fail (shms, ETIMEDOUT);
+}
+
+static void nn_shms_connected (struct nn_shms *self)
+{
+    int rc;
+
+    /*  The peer have mapped the segment so its name is not needed any more. */
+    rc = shm_unlink (self->name);
+    errno_assert (rc == 0 || errno == ENOENT);
+    self->name [0] = 0;
+
+    nn_shms_activate (self);
+}
+
+static void nn_shms_activate (struct nn_shms *self)
+{
+    self->sink = &nn_shms_state_active;
+    nn_timer_stop (&self->hdr_timeout);
+
+    /*  Connection is ready for sending. Make outpipe available
+        to the SP socket. */
+    nn_pipebase_activate (&self->pipebase);
+
+    /*  The peer may have already written some messages in the ring. Then
+        start waiting for wake-ups. */
+    ++self->busy;
+    if (nn_shms_parse (self))
+        nn_pipebase_received (&self->pipebase);
+    nn_shms_wake (self);
+    if (!self->errnum)
+        nn_usock_recv (self->usock, &self->wakein, 1);
+    nn_shms_leave (self);
+}
+
+static void nn_shms_received (const struct nn_cp_sink **self,
+    struct nn_usock *usock)
+{
+    struct nn_shms *shms;
+    const void *data;
+
+    shms = nn_cont (self, struct nn_shms, sink);
+    ++shms->busy;
+
+    /*  Multiple wake-ups may have been sent by the peer in the meantime.
+        One is enough, so drop all the others. */
+    nn_usock_consume (usock, nn_usock_peek (usock, &data));
+
+    /*  The peer have either written some data or made some space available.
+        Check both rings. */
+    if (shms->instate != NN_SHMS_INSTATE_READY && nn_shms_parse (shms))
+        nn_pipebase_received (&shms->pipebase);
+    if (shms->outstate == NN_SHMS_OUTSTATE_SENDING && nn_shms_flush (shms)) {
+        nn_msg_term (&shms->outmsg);
+        shms->outstate = NN_SHMS_OUTSTATE_IDLE;
+        nn_pipebase_sent (&shms->pipebase);
+    }
+
+    /*  Wait for the next wake-up. */
+    nn_shms_wake (shms);
+    if (!shms->errnum)
+        nn_usock_recv (usock, &shms->wakein, 1);
+    nn_shms_leave (shms);
+}
+
+static void nn_shms_sent (const struct nn_cp_sink **self,
+    struct nn_usock *usock)
+{
+    struct nn_shms *shms;
+
+    shms = nn_cont (self, struct nn_shms, sink);
+
+    /*  If another wake-up was requested meanwhile, send it now. */
+    ++shms->busy;
+    shms->wakeinflight = 0;
+    nn_shms_wake (shms);
+    nn_shms_leave (shms);
+}
+
+static void nn_shms_err (const struct nn_cp_sink **self,
+    struct nn_usock *usock, int errnum)
+{
+    struct nn_shms *shms;
+
+    shms = nn_cont (self, struct nn_shms, sink);
+
+    /*  During the handshake, simply terminate the session. */
+    if (shms->sink != &nn_shms_state_active) {
+        nn_shms_fail (shms, errnum);
+        return;
+    }
+
+    /*  If an event is being processed, postpone the termination till
+        the processing is done. */
+    if (!shms->errnum)
+        shms->errnum = errnum;
+    if (shms->busy)
+        return;
+    ++shms->busy;
+    nn_shms_leave (shms);
+}
+
+static void nn_shms_fail (struct nn_shms *self, int errnum)
+{
+    const struct nn_cp_sink **original_sink;
+
+    original_sink = self->original_sink;
+
+    /*  Terminate the session object. */
+    nn_shms_term (self);
+
+    /*  Notify the parent state machine about the failure. */
+    nn_assert ((*original_sink)->err);
+    (*original_sink)->err (original_sink, self->usock, errnum);
+}
+
+static void nn_shms_leave (struct nn_shms *self)
+{
+    --self->busy;
+    if (nn_fast (self->busy || !self->errnum))
+        return;
+
+    /*  The underlying socket have failed, presumably because the peer have
+        closed the connection. Unlike the data in flight in a socket buffer,
+        the messages in the ring would be lost if the session was terminated
+        straight away. Thus, pass them to the user first and terminate the
+        session once there's no complete message left. */
+    if (self->instate != NN_SHMS_INSTATE_READY && nn_shms_parse (self))
+        nn_pipebase_received (&self->pipebase);
+    if (self->instate == NN_SHMS_INSTATE_READY)
+        return;
+    nn_shms_fail (self, self->errnum);
+}
+
+static int nn_shms_send (struct nn_pipebase *self, struct nn_msg *msg)
+{
+    struct nn_shms *shms;
+    struct nn_iobuf *iov;
+    int i;
+
+    shms = nn_cont (self, struct nn_shms, pipebase);
+    nn_assert (shms->outstate == NN_SHMS_OUTSTATE_IDLE);
+
+    /*  If the peer reads the feed, write the message there. The feed never
+        waits for the reader, so the pipe remains available for sending.
+        Large messages go through the ring, announced by a marker. */
+    if (shms->slot >= 0) {
+        if (nn_fast (nn_chunkref_size (&msg->hdr) + nn_msg_bodysize (msg) <=
+              NN_SHM_FEED_MAXMSG)) {
+            nn_shm_feed_send (shms->feed, &shms->pipebase, shms->slot, msg);
+            nn_pipebase_sent (&shms->pipebase);
+            return 0;
+        }
+        nn_shm_feed_mark (shms->feed, &shms->pipebase, shms->slot,
+            ++shms->markers);
+    }
+
+    /*  Describe the data to write to the ring. Fragments of the message are
+        copied into the ring directly from the user's chunks. */
+    nn_msg_mv (&shms->outmsg, msg);
+    nn_putll (shms->outhdr, nn_chunkref_size (&shms->outmsg.hdr) +
+        nn_msg_bodysize (&shms->outmsg));
+    iov = shms->outiov;
+    iov [0].iov_base = shms->outhdr;
+    iov [0].iov_len = sizeof (shms->outhdr);
+    iov [1].iov_base = nn_chunkref_data (&shms->outmsg.hdr);
+    iov [1].iov_len = nn_chunkref_size (&shms->outmsg.hdr);
+    iov [2].iov_base = nn_chunkref_data (&shms->outmsg.body);
+    iov [2].iov_len = nn_chunkref_size (&shms->outmsg.body);
+    shms->outiovcnt = 3;
+    if (shms->outmsg.frags) {
+        for (i = 0; i != shms->outmsg.frags->count; ++i) {
+            iov [shms->outiovcnt].iov_base =
+                nn_chunkref_data (&shms->outmsg.frags->frag [i]);
+            iov [shms->outiovcnt].iov_len =
+                nn_chunkref_size (&shms->outmsg.frags->frag [i]);
+            ++shms->outiovcnt;
+        }
+    }
+    shms->outpos = 0;
+    shms->outoff = 0;
+
+    /*  If the whole message fits into the ring, the pipe remains available
+        for sending. Otherwise, the rest of the message will be written once
+        the peer makes some space in the ring. */
+    ++shms->busy;
+    if (nn_shms_flush (shms)) {
+        nn_msg_term (&shms->outmsg);
+        nn_pipebase_sent (&shms->pipebase);
+    }
+    else
+        shms->outstate = NN_SHMS_OUTSTATE_SENDING;
+    nn_shms_wake (shms);
+    nn_shms_leave (shms);
+
+    return 0;
+}
+
+static int nn_shms_recv (struct nn_pipebase *self, struct nn_msg *msg)
+{
+    struct nn_shms *shms;
+
+    shms = nn_cont (self, struct nn_shms, pipebase);
+    nn_assert (shms->instate == NN_SHMS_INSTATE_READY);
+
+    /*  Move message content to the user-supplied structure. */
+    nn_msg_mv (msg, &shms->inmsg);
+    nn_msg_init (&shms->inmsg, 0);
+
+    /*  Start receiving new message. If it is already in the ring, the pipe
+        remains available for receiving. */
+    ++shms->busy;
+    shms->instate = NN_SHMS_INSTATE_HDR;
+    if (nn_shms_parse (shms))
+        nn_pipebase_received (&shms->pipebase);
+    nn_shms_wake (shms);
+    nn_shms_leave (shms);
+
+    return 0;
+}
+
+static int nn_shms_create (struct nn_shms *self)
+{
+    int rc;
+    int fd;
+    int i;
+    uint32_t rnd;
+
+    /*  Create a new memory segment with a unique name. */
+    for (i = 0; i != NN_SHMS_CREATE_ATTEMPTS; ++i) {
+        nn_random_generate (&rnd, sizeof (rnd));
+        rc = snprintf (self->name, sizeof (self->name), "/nn-%lu-%08x",
+            (unsigned long) getpid (), (unsigned int) rnd);
+        nn_assert (rc > 0 && rc < (int) sizeof (self->name));
+        fd = shm_open (self->name, O_RDWR | O_CREAT | O_EXCL, 0600);
+        if (nn_fast (fd >= 0))
+            break;
+        if (nn_slow (errno != EEXIST)) {
+            self->name [0] = 0;
+            return -errno;
+        }
+    }
+    if (nn_slow (i == NN_SHMS_CREATE_ATTEMPTS)) {
+        self->name [0] = 0;
+        return -EEXIST;
+    }
+
+    /*  Size and map the segment. The memory is zero-filled so the rings are
+        initialised to empty state already, still, be explicit about it. */
+    rc = ftruncate (fd, sizeof (struct nn_shm_seg));
+    if (nn_slow (rc != 0)) {
+        rc = -errno;
+        close (fd);
+        return rc;
+    }
+    self->seg = mmap (NULL, sizeof (struct nn_shm_seg),
+        PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (nn_slow (self->seg == MAP_FAILED)) {
+        self->seg = NULL;
+        rc = -errno;
+        close (fd);
+        return rc;
+    }
+    rc = close (fd);
+    errno_assert (rc == 0);
+    nn_shm_ring_init (&self->seg->rings [0]);
+    nn_shm_ring_init (&self->seg->rings [1]);
+    self->out = &self->seg->rings [0];
+    self->in = &self->seg->rings [1];
+
+    return 0;
+}
+
+static int nn_shms_open (struct nn_shms *self)
+{
+    int rc;
+    int fd;
+    const char *name;
+    struct stat st;
+
+    /*  Check whether the name of the segment is well-formed. */
+    name = (const char*) self->hello + 8;
+    if (nn_slow (name [0] != '/' ||
+          !memchr (name, 0, NN_SHMS_HELLO_SIZE - 8)))
+        return -EPROTO;
+
+    /*  Open the segment and make sure it's of the expected size. */
+    fd = shm_open (name, O_RDWR, 0);
+    if (nn_slow (fd < 0))
+        return -errno;
+    rc = fstat (fd, &st);
+    errno_assert (rc == 0);
+    if (nn_slow (st.st_size != sizeof (struct nn_shm_seg))) {
+        close (fd);
+        return -EPROTO;
+    }
+
+    /*  Map it into the memory. */
+    self->seg = mmap (NULL, sizeof (struct nn_shm_seg),
+        PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (nn_slow (self->seg == MAP_FAILED)) {
+        self->seg = NULL;
+        rc = -errno;
+        close (fd);
+        return rc;
+    }
+    rc = close (fd);
+    errno_assert (rc == 0);
+    self->in = &self->seg->rings [0];
+    self->out = &self->seg->rings [1];
+
+    return 0;
+}
+
+static int nn_shms_read (struct nn_shms *self, void *buf, size_t len)
+{
+    size_t nbytes;
+    int progress;
+
+    /*  Read the data from the ring until 'len' bytes are available in the
+        buffer. Returns 1 if it is so, 0 if the consumer went to sleep. */
+    progress = 0;
+    while (self->inoff != len) {
+        nbytes = nn_shm_ring_read (self->in, ((uint8_t*) buf) + self->inoff,
+            len - self->inoff);
+        if (nbytes) {
+            self->inoff += nbytes;
+            progress = 1;
+            continue;
+        }
+
+        /*  Before going to sleep wake up the producer if it is waiting for
+            the space freed so far. */
+        if (progress && nn_shm_ring_wwake (self->in))
+            self->wakeup = 1;
+        progress = 0;
+        if (!nn_shm_ring_rsleep (self->in))
+            return 0;
+    }
+    if (progress && nn_shm_ring_wwake (self->in))
+        self->wakeup = 1;
+    self->inoff = 0;
+    return 1;
+}
+
+static int nn_shms_parse (struct nn_shms *self)
+{
+    int rc;
+    uint32_t seq;
+    uint64_t msgs;
+    uint64_t bytes;
+
+    /*  Returns 1 if there's a complete message in 'inmsg', 0 if it have
+        to wait for more data from the peer. */
+    if (!self->reading)
+        return nn_shms_parsering (self);
+
+    while (1) {
+
+        /*  Read the message announced by the marker from the ring. Those
+            announced by the markers the writer have overwritten are
+            dropped. */
+        if (self->fromring) {
+            if (!nn_shms_parsering (self))
+                return 0;
+            ++self->ringseq;
+            if (nn_fast (self->ringseq == self->ringwant)) {
+                self->fromring = 0;
+                return 1;
+            }
+            nn_pipebase_lost (&self->pipebase, 1,
+                nn_chunkref_size (&self->inmsg.body));
+            self->instate = NN_SHMS_INSTATE_HDR;
+            continue;
+        }
+
+        /*  Account for the messages the writer have overwritten before they
+            were read. */
+        nn_shm_feedr_lost (&self->feedr, &msgs, &bytes);
+        if (nn_slow (msgs))
+            nn_pipebase_lost (&self->pipebase, msgs, bytes);
+
+        rc = nn_shm_feedr_recv (&self->feedr, &self->inmsg, &seq);
+        if (nn_fast (rc == 1)) {
+            self->instate = NN_SHMS_INSTATE_READY;
+            return 1;
+        }
+        if (rc == 0)
+            return 0;
+        if (nn_fast (rc == NN_SHM_FEED_MARKER &&
+              (int32_t) (seq - self->ringseq) > 0)) {
+            self->ringwant = seq;
+            self->fromring = 1;
+            continue;
+        }
+
+        /*  The peer have corrupted the feed. */
+        if (!self->errnum)
+            self->errnum = EPROTO;
+        return 0;
+    }
+}
+
+static int nn_shms_parsering (struct nn_shms *self)
+{
+    uint64_t size;
+
+    while (1) {
+        switch (self->instate) {
+        case NN_SHMS_INSTATE_HDR:
+            if (!nn_shms_read (self, self->inhdr, sizeof (self->inhdr)))
+                return 0;
+            size = nn_getll (self->inhdr);
+            nn_msg_term (&self->inmsg);
+            nn_msg_init (&self->inmsg, (size_t) size);
+            self->instate = NN_SHMS_INSTATE_BODY;
+            break;
+        case NN_SHMS_INSTATE_BODY:
+            if (!nn_shms_read (self, nn_chunkref_data (&self->inmsg.body),
+                  nn_chunkref_size (&self->inmsg.body)))
+                return 0;
+            self->instate = NN_SHMS_INSTATE_READY;
+            return 1;
+        default:
+            nn_assert (0);
+        }
+    }
+}
+
+static int nn_shms_flush (struct nn_shms *self)
+{
+    struct nn_iobuf *iov;
+    size_t nbytes;
+    int progress;
+
+    /*  Write the rest of the outgoing message to the ring. Returns 1 if
+        the whole message was written, 0 if the producer went to sleep. */
+    progress = 0;
+    while (self->outpos != self->outiovcnt) {
+        iov = &self->outiov [self->outpos];
+        if (self->outoff == iov->iov_len) {
+            ++self->outpos;
+            self->outoff = 0;
+            continue;
+        }
+        nbytes = nn_shm_ring_write (self->out,
+            ((uint8_t*) iov->iov_base) + self->outoff,
+            iov->iov_len - self->outoff);
+        if (nbytes) {
+            self->outoff += nbytes;
+            progress = 1;
+            continue;
+        }
+
+        /*  Before going to sleep wake up the consumer if it is waiting for
+            the data written so far. */
+        if (progress && nn_shm_ring_rwake (self->out))
+            self->wakeup = 1;
+        progress = 0;
+        if (!nn_shm_ring_wsleep (self->out))
+            return 0;
+    }
+    if (progress && nn_shm_ring_rwake (self->out))
+        self->wakeup = 1;
+    return 1;
+}
+
+void nn_shms_feedwake (struct nn_shms *self)
+{
+    /*  Till the handshake is done, the wake-up is only noted. Once active,
+        the session sends it along with its own ones. */
+    self->wakeup = 1;
+    if (self->sink != &nn_shms_state_active)
+        return;
+    ++self->busy;
+    nn_shms_wake (self);
+    --self->busy;
+}
+
+static void nn_shms_wake (struct nn_shms *self)
+{
+    struct nn_iobuf iobuf;
+
+    /*  Only a single wake-up can be in flight at any given time. If another
+        one is requested meanwhile, it is sent once the previous one is
+        done. */
+    if (!self->wakeup || self->wakeinflight || self->errnum)
+        return;
+    self->wakeup = 0;
+    self->wakeinflight = 1;
+    iobuf.iov_base = &self->wakeout;
+    iobuf.iov_len = 1;
+    nn_usock_send (self->usock, &iobuf, 1);
+}
+
+#endif
@@ -0,0 +1,181 @@
+/*
+    Copyright (c) 2013 250bpm s.r.o.
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"),
+    to deal in the Software without restriction, including without limitation
+    the rights to use, copy, modify, merge, publish, distribute, sublicense,
+    and/or sell copies of the Software, and to permit persons to whom
+    the Software is furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included
+    in all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+    THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+    FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+    IN THE SOFTWARE.
+*/
+
+#ifndef NN_SHMS_INCLUDED
+#define NN_SHMS_INCLUDED
+
+#include "../../transport.h"
+
+#include "../../utils/msg.h"
+
+#include "ring.h"
+#include "feed.h"
+
+#include <stdint.h>
+
+/*  Session object for the shared memory transport. The messages are passed
+    through a pair of rings in a memory segment shared between the peers.
+    The UNIX domain socket the session was established over is used to
+    exchange the protocol headers and, later on, to wake up the peer when it
+    is waiting for data or for free space in the ring.
+
+    Connections accepted by a bound PUB endpoint from SUB sockets pass
+    the messages through the endpoint's feed (see feed.h) instead, so that
+    a message published to many subscribers is copied into the shared memory
+    once. The connection's own ring is still used for the messages too large
+    for the feed. */
+
+#define NN_SHMS_INSTATE_HDR 1
+#define NN_SHMS_INSTATE_BODY 2
+#define NN_SHMS_INSTATE_READY 3
+
+#define NN_SHMS_OUTSTATE_IDLE 1
+#define NN_SHMS_OUTSTATE_SENDING 2
+
+/*  Size of the initial message sent by the connecting side. It consists of
+    the standard 8-byte protocol header followed by the name of the shared
+    memory segment. */
+#define NN_SHMS_HELLO_SIZE 64
+
+/*  Flag in the last byte of the protocol header. In the hello message it
+    means that the connecting side is able to read a feed. In the reply it
+    means that the peer will use the feed, in which case the reply is
+    NN_SHMS_HELLO_SIZE bytes long: the protocol header, the name of the
+    feed's memory segment and the reader's slot in the feed. */
+#define NN_SHMS_FEED 1
+
+/*  The shared memory segment. First ring is used to pass messages from
+    the connecting side to the accepting side, the second one to pass
+    messages in the opposite direction. */
+struct nn_shm_seg {
+    struct nn_shm_ring rings [2];
+};
+
+struct nn_shms {
+
+    /*  Event sink. */
+    const struct nn_cp_sink *sink;
+
+    /*  Pipe to exchange messages with the user of the library. */
+    struct nn_pipebase pipebase;
+
+    /*  The underlying socket. */
+    struct nn_usock *usock;
+
+    /*  1 if this side of the connection creates the memory segment. */
+    int creator;
+
+    /*  Name of the memory segment. Empty string if the segment was already
+        unlinked or if it was never created. */
+    char name [NN_SHMS_HELLO_SIZE - 8];
+
+    /*  The mapped memory segment and the rings to read from and write to. */
+    struct nn_shm_seg *seg;
+    struct nn_shm_ring *in;
+    struct nn_shm_ring *out;
+
+    /*  Local protocol header and the buffer to send and receive the initial
+        handshake in. */
+    uint8_t protohdr [8];
+    uint8_t hello [NN_SHMS_HELLO_SIZE];
+
+    /*  If the handshake is not done in certain amount of time, connection
+        is closed. */
+    struct nn_timer hdr_timeout;
+
+    /*  State of the inbound state machine. */
+    int instate;
+
+    /*  Buffer used to store the header of incoming message. */
+    uint8_t inhdr [8];
+
+    /*  Number of bytes of the current header or body read so far. */
+    size_t inoff;
+
+    /*  Message being received at the moment. */
+    struct nn_msg inmsg;
+
+    /*  State of the outbound state machine. */
+    int outstate;
+
+    /*  Message being sent at the moment and the description of the data
+        that has yet to be copied to the ring. */
+    uint8_t outhdr [8];
+    struct nn_msg outmsg;
+    struct nn_iobuf outiov [3 + NN_MSG_MAXFRAGS];
+    int outiovcnt;
+    int outpos;
+    size_t outoff;
+
+    /*  The feed to write the messages to, NULL if the endpoint has none, and
+        the peer's slot in it, -1 if the peer doesn't read the feed. Each
+        message too large for the feed is announced by a marker carrying
+        the number of such messages sent so far. */
+    struct nn_shm_feed *feed;
+    int slot;
+    uint32_t markers;
+
+    /*  1 if the messages are read from the peer's feed. If so, 'fromring'
+        is 1 while the message announced by the latest marker is being read
+        from the ring. 'ringseq' is the number of messages read from
+        the ring so far and 'ringwant' the marker's sequence number. */
+    int reading;
+    struct nn_shm_feedr feedr;
+    int fromring;
+    uint32_t ringseq;
+    uint32_t ringwant;
+
+    /*  Single-byte buffers for the wake-ups being received and sent. */
+    uint8_t wakein;
+    uint8_t wakeout;
+
+    /*  1 if the peer has to be woken up. */
+    int wakeup;
+
+    /*  1 if a wake-up is being sent at the moment. */
+    int wakeinflight;
+
+    /*  Error reported by the underlying socket. The socket may report it from
+        within nn_usock_send() or nn_usock_recv() so it is acted upon only
+        once the processing of the current event is done. 'busy' is
+        the nesting level of the event handlers. */
+    int busy;
+    int errnum;
+
+    /*  Stores the sink of the parent state machine while this state machine
+        does its job. */
+    const struct nn_cp_sink **original_sink;
+};
+
+/*  If 'creator' is 1 the memory segment is created by this side of
+    the connection, otherwise it is opened when the peer announces it.
+    'feed' is the feed of the accepting side's endpoint, if any. */
+void nn_shms_init (struct nn_shms *self, struct nn_epbase *epbase,
+    struct nn_usock *usock, int creator, struct nn_shm_feed *feed);
+void nn_shms_term (struct nn_shms *self);
+
+/*  Wakes up the peer reading the feed. Failures are acted upon once
+    the pending wait for the peer's wake-ups fails as well. */
+void nn_shms_feedwake (struct nn_shms *self);
+
+#endif
+
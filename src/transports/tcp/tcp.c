@@ -32,14 +32,39 @@
 #include "../../utils/bstream.h"
 #include "../../utils/cstream.h"
 #include "../../utils/list.h"
+#include "../../utils/tls.h"
 
 #include <string.h>
 
+#if !defined NN_HAVE_WINDOWS
+#include <netinet/tcp.h>
+#endif
+#if defined NN_HAVE_LINUX
+#include <linux/filter.h>
+#endif
+
 #define NN_TCP_BACKLOG 100
 
+/*  Maximum number of listening sockets per bound endpoint. */
+#define NN_TCP_MAX_LISTENERS 64
+
 struct nn_tcp_optset {
     struct nn_optset base;
     int nodelay;
+    int cork;
+    int busy_poll;
+    int listeners;
+    int tls;
+    char *tls_cert;
+    char *tls_key;
+    char *tls_ca;
+    struct nn_tls *tls_ctx;
+    int compress;
+    int zerocopy;
+    int rss;
+    int crc;
+    int notsent_lowat;
+    int fastopen;
 };
 
 static void nn_tcp_optset_destroy (struct nn_optset *self);
@@ -47,6 +72,9 @@ static int nn_tcp_optset_setopt (struct nn_optset *self, int option,
     const void *optval, size_t optvallen);
 static int nn_tcp_optset_getopt (struct nn_optset *self, int option,
     void *optval, size_t *optvallen);
+static int nn_tcp_optset_setstr (char **dst, const void *optval,
+    size_t optvallen);
+static int nn_tcp_optset_settls (struct nn_tcp_optset *self);
 static const struct nn_optset_vfptr nn_tcp_optset_vfptr = {
     nn_tcp_optset_destroy,
     nn_tcp_optset_setopt,
@@ -54,12 +82,10 @@ static const struct nn_optset_vfptr nn_tcp_optset_vfptr = {
 };
 
 /*  Private functions. */
-static int nn_tcp_binit (const char *addr, struct nn_usock *usock,
-    struct nn_cp *cp, int backlog);
-static int nn_tcp_csockinit (struct nn_usock *usock, int sndbuf, int rcvbuf,
-    struct nn_cp *cp);
-static int nn_tcp_cresolve (const char *addr, struct sockaddr_storage *local,
-    socklen_t *locallen, struct sockaddr_storage *remote, socklen_t *remotelen);
+static void nn_tcp_tune (struct nn_usock *usock, struct nn_epbase *epbase,
+    int server);
+static int nn_tcp_getint (struct nn_epbase *epbase, int option);
+static void nn_tcp_steer (struct nn_usock *usock);
 
 /*  nn_transport interface. */
 static void nn_tcp_init (void);
@@ -69,16 +95,19 @@ static int nn_tcp_bind (const char *addr, void *hint,
 static int nn_tcp_connect (const char *addr, void *hint,
     struct nn_epbase **epbase);
 static struct nn_optset *nn_tcp_optset ();
+static int nn_tcp_adopt (const char *addr, void *hint, const int *fds,
+    int nfds, struct nn_epbase **epbase);
 
 static struct nn_transport nn_tcp_vfptr = {
     "tcp",
     NN_TCP,
+    NN_TRANSPORT_ADDRLIST,
     nn_tcp_init,
     nn_tcp_term,
     nn_tcp_bind,
     nn_tcp_connect,
     nn_tcp_optset,
-    NN_LIST_ITEM_INITIALIZER
+    nn_tcp_adopt
 };
 
 struct nn_transport *nn_tcp = &nn_tcp_vfptr;
@@ -99,7 +128,27 @@ static int nn_tcp_bind (const char *addr, void *hint,
 
     bstream = nn_alloc (sizeof (struct nn_bstream), "bstream (tcp)");
     alloc_assert (bstream);
-    rc = nn_bstream_init (bstream, addr, hint, nn_tcp_binit, NN_TCP_BACKLOG);
+    rc = nn_bstream_init (bstream, addr, hint, nn_tcp_binit, nn_tcp_bcount,
+        nn_tcp_baccept, NN_TCP_BACKLOG);
+    if (nn_slow (rc != 0)) {
+        nn_free (bstream);
+        return rc;
+    }
+    *epbase = &bstream->epbase;
+
+    return 0;
+}
+
+static int nn_tcp_adopt (const char *addr, void *hint, const int *fds,
+    int nfds, struct nn_epbase **epbase)
+{
+    int rc;
+    struct nn_bstream *bstream;
+
+    bstream = nn_alloc (sizeof (struct nn_bstream), "bstream (tcp)");
+    alloc_assert (bstream);
+    rc = nn_bstream_adopt (bstream, addr, hint, nn_tcp_binit, nn_tcp_baccept,
+        NN_TCP_BACKLOG, fds, nfds);
     if (nn_slow (rc != 0)) {
         nn_free (bstream);
         return rc;
@@ -151,8 +200,8 @@ static int nn_tcp_connect (const char *addr, void *hint,
     return 0;
 }
 
-static int nn_tcp_binit (const char *addr, struct nn_usock *usock,
-    struct nn_cp *cp, int backlog)
+int nn_tcp_binit (const char *addr, struct nn_usock *usock,
+    struct nn_epbase *epbase, int backlog, int s)
 {
     int rc;
     int port;
@@ -160,6 +209,23 @@ static int nn_tcp_binit (const char *addr, struct nn_usock *usock,
     const char *pos;
     struct sockaddr_storage ss;
     socklen_t sslen;
+#if defined SO_REUSEPORT
+    int val;
+#endif
+    int rss;
+
+    /*  The socket handed off by another process is bound already and
+        the options it was listening with apply anew. */
+    if (s >= 0) {
+        rc = nn_usock_init_fd (usock, NULL, s, nn_epbase_getcp (epbase));
+        if (nn_slow (rc < 0))
+            return rc;
+        rc = nn_usock_listen (usock, backlog);
+        if (nn_slow (rc < 0))
+            return rc;
+        nn_tcp_tune (usock, epbase, 1);
+        return 0;
+    }
 
     /*  Make sure we're working from a clean slate. Required on Mac OS X. */
     memset (&ss, 0, sizeof (ss));
@@ -192,27 +258,217 @@ static int nn_tcp_binit (const char *addr, struct nn_usock *usock,
 
     /*  Open the listening socket. */
     rc = nn_usock_init (usock, NULL, AF_INET, SOCK_STREAM, IPPROTO_TCP,
-        -1, -1, cp);
+        -1, -1, nn_epbase_getcp (epbase));
     errnum_assert (rc == 0, -rc);
+
+    /*  Accepted sockets inherit the TCP options from the listening socket. */
+    nn_tcp_tune (usock, epbase, 1);
+
+    /*  If there are multiple listening sockets, allow them to share the
+        address. The kernel will distribute the connections among them.
+        With NN_TCP_RSS, the sockets of other SP sockets may share it
+        as well. */
+    rss = nn_tcp_getint (epbase, NN_TCP_RSS);
+#if defined SO_REUSEPORT
+    if (nn_tcp_bcount (epbase) > 1 || rss) {
+        val = 1;
+        rc = nn_usock_setsockopt (usock, SOL_SOCKET, SO_REUSEPORT,
+            &val, sizeof (val));
+        errnum_assert (rc == 0, -rc);
+    }
+#endif
+
     rc = nn_usock_bind (usock, (struct sockaddr*) &ss, sslen);
     errnum_assert (rc == 0, -rc);
     rc = nn_usock_listen (usock, NN_TCP_BACKLOG);
     errnum_assert (rc == 0, -rc);
+    if (rss)
+        nn_tcp_steer (usock);
+
+    return 0;
+}
+
+int nn_tcp_bcount (struct nn_epbase *epbase)
+{
+    return nn_tcp_getint (epbase, NN_TCP_LISTENERS);
+}
+
+void nn_tcp_baccept (struct nn_usock *usock, struct nn_epbase *epbase)
+{
+    /*  Move the I/O thread of the socket to the CPU the packets of
+        the connection arrive on. A thread shared with other sockets is
+        left alone. */
+    if (nn_tcp_getint (epbase, NN_TCP_RSS) && nn_epbase_ownscp (epbase))
+        nn_usock_follow (usock);
+}
+
+static int nn_tcp_getint (struct nn_epbase *epbase, int option)
+{
+    int val;
+    size_t sz;
+
+    sz = sizeof (val);
+    nn_epbase_getopt (epbase, NN_TCP, option, &val, &sz);
+    nn_assert (sz == sizeof (val));
+    return val;
+}
+
+/*  Makes the kernel pick the listening socket from the SO_REUSEPORT group
+    by the CPU the connection arrives on: the n-th socket bound to
+    the address gets the connections whose packets are processed by CPU n.
+    The connections arriving on CPUs with no matching socket are spread by
+    the kernel as usual. The program is shared by the whole group, so it's
+    fine to attach it to each socket anew. It has to be attached once
+    the socket is listening; before that, the kernel would put the socket
+    into a group of its own. Best effort; older kernels just keep spreading
+    the connections by hash. */
+static void nn_tcp_steer (struct nn_usock *usock)
+{
+#if defined NN_HAVE_LINUX && defined SO_ATTACH_REUSEPORT_CBPF
+    struct sock_filter code [] = {
+        BPF_STMT (BPF_LD | BPF_W | BPF_ABS, SKF_AD_OFF + SKF_AD_CPU),
+        BPF_STMT (BPF_RET | BPF_A, 0)
+    };
+    struct sock_fprog prog;
+
+    prog.len = sizeof (code) / sizeof (code [0]);
+    prog.filter = code;
+    nn_usock_setsockopt (usock, SOL_SOCKET, SO_ATTACH_REUSEPORT_CBPF,
+        &prog, sizeof (prog));
+#endif
+}
+
+int nn_tcp_csockinit (struct nn_usock *usock, int sndbuf, int rcvbuf,
+    struct nn_epbase *epbase)
+{
+    int rc;
+
+    rc = nn_usock_init (usock, NULL, AF_INET, SOCK_STREAM, IPPROTO_TCP,
+        sndbuf, rcvbuf, nn_epbase_getcp (epbase));
+    if (nn_slow (rc < 0))
+        return rc;
+    nn_tcp_tune (usock, epbase, 0);
 
     return 0;
 }
 
-static int nn_tcp_csockinit (struct nn_usock *usock, int sndbuf, int rcvbuf,
-    struct nn_cp *cp)
+static void nn_tcp_tune (struct nn_usock *usock, struct nn_epbase *epbase,
+    int server)
 {
-    return nn_usock_init (usock, NULL, AF_INET, SOCK_STREAM, IPPROTO_TCP,
-        sndbuf, rcvbuf, cp);
+    int rc;
+    int val;
+    size_t sz;
+    struct nn_tls *tls;
+
+    /*  Apply the TCP-specific socket options to the underlying socket. */
+    sz = sizeof (val);
+    nn_epbase_getopt (epbase, NN_TCP, NN_TCP_NODELAY, &val, &sz);
+    nn_assert (sz == sizeof (val));
+    if (val) {
+        rc = nn_usock_setsockopt (usock, IPPROTO_TCP, TCP_NODELAY,
+            &val, sizeof (val));
+        errnum_assert (rc == 0, -rc);
+    }
+
+    sz = sizeof (val);
+    nn_epbase_getopt (epbase, NN_TCP, NN_TCP_CORK, &val, &sz);
+    nn_assert (sz == sizeof (val));
+    nn_usock_setcork (usock, val);
+
+    sz = sizeof (val);
+    nn_epbase_getopt (epbase, NN_TCP, NN_TCP_COMPRESS, &val, &sz);
+    nn_assert (sz == sizeof (val));
+    nn_usock_setcompress (usock, (size_t) val);
+
+    sz = sizeof (val);
+    nn_epbase_getopt (epbase, NN_TCP, NN_TCP_CRC, &val, &sz);
+    nn_assert (sz == sizeof (val));
+    nn_usock_setcrc (usock, val);
+
+#if defined TCP_NOTSENT_LOWAT
+    /*  The kernel accepts no more data once this much is waiting to be sent,
+        so the backlog stays in the pipes, where the protocols can reorder,
+        expire or conflate it. */
+    sz = sizeof (val);
+    nn_epbase_getopt (epbase, NN_TCP, NN_TCP_NOTSENT_LOWAT, &val, &sz);
+    nn_assert (sz == sizeof (val));
+    if (val) {
+        rc = nn_usock_setsockopt (usock, IPPROTO_TCP, TCP_NOTSENT_LOWAT,
+            &val, sizeof (val));
+        errnum_assert (rc == 0, -rc);
+    }
+#endif
+
+#if defined TCP_FASTOPEN && defined TCP_FASTOPEN_CONNECT
+    /*  The listening socket accepts data in the SYN from the peers that
+        have a cookie. The connecting socket defers the connect till the
+        first send, so the protocol header goes in the SYN, saving a round
+        trip on each (re)connect. Either way, the kernel falls back to
+        the ordinary handshake if the peer doesn't support Fast Open. */
+    sz = sizeof (val);
+    nn_epbase_getopt (epbase, NN_TCP, NN_TCP_FASTOPEN, &val, &sz);
+    nn_assert (sz == sizeof (val));
+    if (val) {
+        if (server) {
+            val = NN_TCP_BACKLOG;
+            rc = nn_usock_setsockopt (usock, IPPROTO_TCP, TCP_FASTOPEN,
+                &val, sizeof (val));
+        }
+        else
+            rc = nn_usock_setsockopt (usock, IPPROTO_TCP,
+                TCP_FASTOPEN_CONNECT, &val, sizeof (val));
+        errnum_assert (rc == 0 || rc == -ENOPROTOOPT || rc == -EOPNOTSUPP,
+            -rc);
+    }
+#endif
+
+#if defined SO_BUSY_POLL
+    sz = sizeof (val);
+    nn_epbase_getopt (epbase, NN_TCP, NN_TCP_BUSY_POLL, &val, &sz);
+    nn_assert (sz == sizeof (val));
+    if (val) {
+
+        /*  Raising the value above the system-wide limit requires special
+            privileges. In such case we simply fall back to the default. */
+        rc = nn_usock_setsockopt (usock, SOL_SOCKET, SO_BUSY_POLL,
+            &val, sizeof (val));
+        errnum_assert (rc == 0 || rc == -EPERM, -rc);
+
+#if defined SO_PREFER_BUSY_POLL
+        /*  Ask the kernel to leave the device queue to the busy polling
+            instead of the interrupts. Older kernels don't know the option. */
+        val = 1;
+        rc = nn_usock_setsockopt (usock, SOL_SOCKET, SO_PREFER_BUSY_POLL,
+            &val, sizeof (val));
+        errnum_assert (rc == 0 || rc == -EPERM || rc == -ENOPROTOOPT, -rc);
+#endif
+    }
+#endif
+
+    /*  The TLS configuration is shared with the socket option set. The
+        socket holds its own reference so the configuration can be changed
+        without affecting the existing connections. */
+    sz = sizeof (tls);
+    nn_epbase_getopt (epbase, NN_TCP, NN_TCP_TLS_CTX, &tls, &sz);
+    nn_assert (sz == sizeof (tls));
+    if (tls)
+        nn_usock_settls (usock, tls, server);
+
+    /*  Kernel TLS doesn't support sending without copying. If the kernel
+        doesn't support it at all, the data are simply copied. */
+    sz = sizeof (val);
+    nn_epbase_getopt (epbase, NN_TCP, NN_TCP_ZEROCOPY, &val, &sz);
+    nn_assert (sz == sizeof (val));
+    if (val && !tls)
+        nn_usock_setzerocopy (usock, (size_t) val);
 }
 
-static int nn_tcp_cresolve (const char *addr, struct sockaddr_storage *local,
-    socklen_t *locallen, struct sockaddr_storage *remote, socklen_t *remotelen)
+int nn_tcp_cresolve (const char *addr, struct nn_resolve *resolve,
+    struct sockaddr_storage *local, socklen_t *locallen,
+    struct sockaddr_storage *remote, socklen_t *remotelen, int *nremote)
 {
     int rc;
+    int i;
     int port;
     const char *end;
     const char *colon;
@@ -222,7 +478,7 @@ static int nn_tcp_cresolve (const char *addr, struct sockaddr_storage *local,
     res = 0;
 
     /*  Make sure we're working from a clean slate. Required on Mac OS X. */
-    memset (remote, 0, sizeof (struct sockaddr_storage));
+    memset (remote, 0, *nremote * sizeof (struct sockaddr_storage));
 
     /*  Parse the port. */
     end = addr + strlen (addr);
@@ -243,20 +499,25 @@ static int nn_tcp_cresolve (const char *addr, struct sockaddr_storage *local,
         res |= NN_CSTREAM_DOBIND;
     }
 
-    /*  Parse the remote address. */
+    /*  Parse the remote address. If it's a hostname that wasn't looked up
+        recently, the lookup is done asynchronously. The hostname may resolve
+        to several addresses, all of which are tried. */
     /*  TODO:  Get the actual value of the IPV4ONLY socket option. */
-    rc = nn_addr_parse_remote (addr, colon - addr, NN_ADDR_IPV4ONLY,
-        remote, remotelen);
+    rc = nn_resolve_start (resolve, addr, colon - addr, NN_ADDR_IPV4ONLY,
+        remote, remotelen, *nremote);
     if (nn_slow (rc < 0))
         return rc;
-
-    /*  Combine the port and the address. */
-    if (remote->ss_family == AF_INET)
-        ((struct sockaddr_in*) remote)->sin_port = htons (port);
-    else if (remote->ss_family == AF_INET6)
-        ((struct sockaddr_in6*) remote)->sin6_port = htons (port);
-    else
-        nn_assert (0);
+    *nremote = rc;
+
+    /*  Combine the port and the addresses. */
+    for (i = 0; i != *nremote; ++i) {
+        if (remote [i].ss_family == AF_INET)
+            ((struct sockaddr_in*) &remote [i])->sin_port = htons (port);
+        else if (remote [i].ss_family == AF_INET6)
+            ((struct sockaddr_in6*) &remote [i])->sin6_port = htons (port);
+        else
+            nn_assert (0);
+    }
 
     return res;
 }
@@ -271,6 +532,20 @@ static struct nn_optset *nn_tcp_optset ()
 
     /*  Default values for TCP socket options. */
     optset->nodelay = 0;
+    optset->cork = 0;
+    optset->busy_poll = 0;
+    optset->listeners = 1;
+    optset->tls = 0;
+    optset->tls_cert = NULL;
+    optset->tls_key = NULL;
+    optset->tls_ca = NULL;
+    optset->tls_ctx = NULL;
+    optset->compress = 0;
+    optset->zerocopy = 0;
+    optset->rss = 0;
+    optset->crc = 0;
+    optset->notsent_lowat = 0;
+    optset->fastopen = 0;
 
     return &optset->base;   
 }
@@ -280,18 +555,95 @@ static void nn_tcp_optset_destroy (struct nn_optset *self)
     struct nn_tcp_optset *optset;
 
     optset = nn_cont (self, struct nn_tcp_optset, base);
+    if (optset->tls_ctx)
+        nn_tls_release (optset->tls_ctx);
+    if (optset->tls_cert)
+        nn_free (optset->tls_cert);
+    if (optset->tls_key)
+        nn_free (optset->tls_key);
+    if (optset->tls_ca)
+        nn_free (optset->tls_ca);
     nn_free (optset);
 }
 
+static int nn_tcp_optset_setstr (char **dst, const void *optval,
+    size_t optvallen)
+{
+    /*  Empty string resets the option. */
+    if (*dst) {
+        nn_free (*dst);
+        *dst = NULL;
+    }
+    if (!optvallen)
+        return 0;
+    *dst = nn_alloc (optvallen + 1, "tcp option");
+    alloc_assert (*dst);
+    memcpy (*dst, optval, optvallen);
+    (*dst) [optvallen] = 0;
+    return 0;
+}
+
+static int nn_tcp_optset_settls (struct nn_tcp_optset *self)
+{
+    int rc;
+    struct nn_tls *tls;
+
+    /*  (Re)create the TLS configuration from the current settings. */
+    tls = NULL;
+    if (self->tls) {
+        rc = nn_tls_create (self->tls_cert, self->tls_key, self->tls_ca, &tls);
+        if (nn_slow (rc < 0))
+            return rc;
+    }
+    if (self->tls_ctx)
+        nn_tls_release (self->tls_ctx);
+    self->tls_ctx = tls;
+    return 0;
+}
+
 static int nn_tcp_optset_setopt (struct nn_optset *self, int option,
     const void *optval, size_t optvallen)
 {
+    int rc;
     struct nn_tcp_optset *optset;
     int val;
+    char **str;
+    char *old;
 
     optset = nn_cont (self, struct nn_tcp_optset, base);
 
-    /*  At this point we assume that all options are of type int. */
+    /*  Paths to the TLS files are strings. If TLS is already switched on,
+        the new file is loaded straight away. */
+    switch (option) {
+    case NN_TCP_TLS_CERT:
+        str = &optset->tls_cert;
+        break;
+    case NN_TCP_TLS_KEY:
+        str = &optset->tls_key;
+        break;
+    case NN_TCP_TLS_CA:
+        str = &optset->tls_ca;
+        break;
+    default:
+        str = NULL;
+    }
+    if (str) {
+        old = *str;
+        *str = NULL;
+        nn_tcp_optset_setstr (str, optval, optvallen);
+        rc = nn_tcp_optset_settls (optset);
+        if (nn_slow (rc < 0)) {
+            if (*str)
+                nn_free (*str);
+            *str = old;
+            return rc;
+        }
+        if (old)
+            nn_free (old);
+        return 0;
+    }
+
+    /*  The rest of the options are of type int. */
     if (optvallen != sizeof (int))
         return -EINVAL;
     val = *(int*) optval;
@@ -302,6 +654,85 @@ static int nn_tcp_optset_setopt (struct nn_optset *self, int option,
             return -EINVAL;
         optset->nodelay = val;
         return 0;
+    case NN_TCP_CORK:
+        if (nn_slow (val != 0 && val != 1))
+            return -EINVAL;
+        optset->cork = val;
+        return 0;
+    case NN_TCP_BUSY_POLL:
+#if defined SO_BUSY_POLL
+        if (nn_slow (val < 0))
+            return -EINVAL;
+        optset->busy_poll = val;
+        return 0;
+#else
+        return -ENOPROTOOPT;
+#endif
+    case NN_TCP_LISTENERS:
+        if (nn_slow (val < 1 || val > NN_TCP_MAX_LISTENERS))
+            return -EINVAL;
+#if !defined SO_REUSEPORT
+        if (nn_slow (val > 1))
+            return -ENOPROTOOPT;
+#endif
+        optset->listeners = val;
+        return 0;
+    case NN_TCP_TLS:
+        if (nn_slow (val != 0 && val != 1))
+            return -EINVAL;
+        optset->tls = val;
+        rc = nn_tcp_optset_settls (optset);
+        if (nn_slow (rc < 0)) {
+            optset->tls = 0;
+            return rc;
+        }
+        return 0;
+    case NN_TCP_COMPRESS:
+        if (nn_slow (val < 0))
+            return -EINVAL;
+        optset->compress = val;
+        return 0;
+    case NN_TCP_ZEROCOPY:
+#if defined NN_USE_ZEROCOPY
+        if (nn_slow (val < 0))
+            return -EINVAL;
+        optset->zerocopy = val;
+        return 0;
+#else
+        return -ENOPROTOOPT;
+#endif
+    case NN_TCP_RSS:
+#if defined SO_INCOMING_CPU && defined SO_ATTACH_REUSEPORT_CBPF
+        if (nn_slow (val != 0 && val != 1))
+            return -EINVAL;
+        optset->rss = val;
+        return 0;
+#else
+        return -ENOPROTOOPT;
+#endif
+    case NN_TCP_CRC:
+        if (nn_slow (val != 0 && val != 1))
+            return -EINVAL;
+        optset->crc = val;
+        return 0;
+    case NN_TCP_NOTSENT_LOWAT:
+#if defined TCP_NOTSENT_LOWAT
+        if (nn_slow (val < 0))
+            return -EINVAL;
+        optset->notsent_lowat = val;
+        return 0;
+#else
+        return -ENOPROTOOPT;
+#endif
+    case NN_TCP_FASTOPEN:
+#if defined TCP_FASTOPEN && defined TCP_FASTOPEN_CONNECT
+        if (nn_slow (val != 0 && val != 1))
+            return -EINVAL;
+        optset->fastopen = val;
+        return 0;
+#else
+        return -ENOPROTOOPT;
+#endif
     default:
         return -ENOPROTOOPT;
     }
@@ -312,13 +743,72 @@ static int nn_tcp_optset_getopt (struct nn_optset *self, int option,
 {
     struct nn_tcp_optset *optset;
     int intval;
+    const char *str;
+    size_t sz;
 
     optset = nn_cont (self, struct nn_tcp_optset, base);
 
+    switch (option) {
+    case NN_TCP_TLS_CTX:
+        memcpy (optval, &optset->tls_ctx, *optvallen < sizeof (void*) ?
+            *optvallen : sizeof (void*));
+        *optvallen = sizeof (void*);
+        return 0;
+    case NN_TCP_TLS_CERT:
+        str = optset->tls_cert;
+        break;
+    case NN_TCP_TLS_KEY:
+        str = optset->tls_key;
+        break;
+    case NN_TCP_TLS_CA:
+        str = optset->tls_ca;
+        break;
+    default:
+        str = NULL;
+    }
+    if (option == NN_TCP_TLS_CERT || option == NN_TCP_TLS_KEY ||
+          option == NN_TCP_TLS_CA) {
+        sz = str ? strlen (str) : 0;
+        if (sz)
+            memcpy (optval, str, *optvallen < sz ? *optvallen : sz);
+        *optvallen = sz;
+        return 0;
+    }
+
     switch (option) {
     case NN_TCP_NODELAY:
         intval = optset->nodelay;
         break;
+    case NN_TCP_CORK:
+        intval = optset->cork;
+        break;
+    case NN_TCP_BUSY_POLL:
+        intval = optset->busy_poll;
+        break;
+    case NN_TCP_LISTENERS:
+        intval = optset->listeners;
+        break;
+    case NN_TCP_TLS:
+        intval = optset->tls;
+        break;
+    case NN_TCP_COMPRESS:
+        intval = optset->compress;
+        break;
+    case NN_TCP_ZEROCOPY:
+        intval = optset->zerocopy;
+        break;
+    case NN_TCP_RSS:
+        intval = optset->rss;
+        break;
+    case NN_TCP_CRC:
+        intval = optset->crc;
+        break;
+    case NN_TCP_NOTSENT_LOWAT:
+        intval = optset->notsent_lowat;
+        break;
+    case NN_TCP_FASTOPEN:
+        intval = optset->fastopen;
+        break;
     default:
         return -ENOPROTOOPT;
     }
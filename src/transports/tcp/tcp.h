@@ -25,6 +25,26 @@
 
 #include "../../transport.h"
 
+#include "../../utils/resolver.h"
+
 extern struct nn_transport *nn_tcp;
 
+/*  Functions used by the transports layered on top of TCP. nn_tcp_binit,
+    nn_tcp_bcount and nn_tcp_baccept are the bstream callbacks, nn_tcp_csockinit and
+    nn_tcp_cresolve are the cstream callbacks of the TCP transport. */
+int nn_tcp_binit (const char *addr, struct nn_usock *usock,
+    struct nn_epbase *epbase, int backlog, int s);
+int nn_tcp_bcount (struct nn_epbase *epbase);
+void nn_tcp_baccept (struct nn_usock *usock, struct nn_epbase *epbase);
+int nn_tcp_csockinit (struct nn_usock *usock, int sndbuf, int rcvbuf,
+    struct nn_epbase *epbase);
+int nn_tcp_cresolve (const char *addr, struct nn_resolve *resolve,
+    struct sockaddr_storage *local, socklen_t *locallen,
+    struct sockaddr_storage *remote, socklen_t *remotelen, int *nremote);
+
+/*  Private option used by the transport to retrieve the TLS configuration
+    (struct nn_tls*) from the socket. NULL if TLS is not used. No reference
+    is added; the pointer is valid while the socket is locked. */
+#define NN_TCP_TLS_CTX 1000
+
 #endif
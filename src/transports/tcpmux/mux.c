@@ -0,0 +1,832 @@
+/*
+    Copyright (c) 2013 250bpm s.r.o.
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"),
+    to deal in the Software without restriction, including without limitation
+    the rights to use, copy, modify, merge, publish, distribute, sublicense,
+    and/or sell copies of the Software, and to permit persons to whom
+    the Software is furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included
+    in all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+    THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+    FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+    IN THE SOFTWARE.
+*/
+
+#include "mux.h"
+#include "muxb.h"
+#include "muxchan.h"
+#include "tcpmux.h"
+
+#include "../../utils/err.h"
+#include "../../utils/fast.h"
+#include "../../utils/cont.h"
+#include "../../utils/alloc.h"
+#include "../../utils/wire.h"
+#include "../../utils/addr.h"
+
+#include <string.h>
+
+#if !defined NN_HAVE_WINDOWS
+#include <netinet/tcp.h>
+#endif
+
+/*  States of the connection. Once it fails, or once the connecting side has
+    no channels left, it's closed from within 'done' event. */
+#define NN_MUX_STATE_RESOLVING 1
+#define NN_MUX_STATE_CONNECTING 2
+#define NN_MUX_STATE_ACTIVE 3
+#define NN_MUX_STATE_DONE 4
+#define NN_MUX_STATE_CLOSING 5
+
+/*  States of the inbound state machine. */
+#define NN_MUX_INSTATE_MAGIC 1
+#define NN_MUX_INSTATE_HDR 2
+#define NN_MUX_INSTATE_CTL 3
+#define NN_MUX_INSTATE_DATA 4
+#define NN_MUX_INSTATE_SKIP 5
+
+static const uint8_t nn_mux_magic [NN_MUX_MAGICLEN] =
+    {0, 'S', 'P', 'M', 'U', 'X', 0, 1};
+
+/*  Private functions. */
+static struct nn_mux *nn_mux_alloc (int server, const char *addr,
+    size_t addrlen);
+static void nn_mux_destroy (struct nn_mux *self);
+static void nn_mux_resolve (struct nn_mux *self);
+static void nn_mux_tune (struct nn_mux *self);
+static void nn_mux_start (struct nn_mux *self);
+static void nn_mux_finish (struct nn_mux *self);
+static void nn_mux_addchan (struct nn_mux *self, struct nn_muxchan *chan);
+static void nn_mux_rmchan (struct nn_mux *self, struct nn_muxchan *chan);
+static struct nn_muxchan *nn_mux_getchan (struct nn_mux *self, uint32_t id);
+static void nn_mux_ctl (struct nn_mux *self, uint32_t id, int type,
+    const void *payload, size_t len);
+static void nn_mux_recv (struct nn_mux *self);
+static void nn_mux_input (struct nn_mux *self);
+static void nn_mux_onopen (struct nn_mux *self);
+static void nn_mux_onready (struct nn_mux *self);
+static void nn_mux_ondata (struct nn_mux *self);
+static void nn_mux_send (struct nn_mux *self);
+static int nn_mux_batch (struct nn_mux *self);
+static void nn_mux_release (struct nn_mux *self);
+
+/*  Event sink. */
+static void nn_mux_received (const struct nn_cp_sink **self,
+    struct nn_usock *usock);
+static void nn_mux_sent (const struct nn_cp_sink **self,
+    struct nn_usock *usock);
+static void nn_mux_connected (const struct nn_cp_sink **self,
+    struct nn_usock *usock);
+static void nn_mux_err (const struct nn_cp_sink **self,
+    struct nn_usock *usock, int errnum);
+static void nn_mux_closed (const struct nn_cp_sink **self,
+    struct nn_usock *usock);
+static void nn_mux_event (const struct nn_cp_sink **self,
+    struct nn_event *event);
+static const struct nn_cp_sink nn_mux_sink = {
+    nn_mux_received,
+    nn_mux_sent,
+    nn_mux_connected,
+    NULL,
+    nn_mux_err,
+    nn_mux_closed,
+    NULL,
+    nn_mux_event
+};
+
+struct nn_mux *nn_mux_create (const char *addr, size_t addrlen)
+{
+    struct nn_mux *self;
+
+    self = nn_mux_alloc (0, addr, addrlen);
+    nn_resolve_init (&self->resolve, &self->sink, nn_tcpmux_getcp ());
+
+    /*  The frames of the channels opened before the connection is
+        established are sent right after the header. */
+    nn_mux_ctl (self, 0, 0, NULL, 0);
+    nn_mux_resolve (self);
+
+    return self;
+}
+
+struct nn_mux *nn_mux_create_accepted (struct nn_usock *listener, int s,
+    const char *addr)
+{
+    int rc;
+    struct nn_mux *self;
+
+    self = nn_mux_alloc (1, addr, strlen (addr));
+    rc = nn_usock_init_child (&self->usock, listener, s, &self->sink, -1, -1,
+        nn_tcpmux_getcp ());
+    errnum_assert (rc == 0, -rc);
+    nn_mux_tune (self);
+    nn_mux_ctl (self, 0, 0, NULL, 0);
+    self->state = NN_MUX_STATE_ACTIVE;
+    nn_mux_start (self);
+
+    return self;
+}
+
+static struct nn_mux *nn_mux_alloc (int server, const char *addr,
+    size_t addrlen)
+{
+    struct nn_mux *self;
+
+    nn_assert (addrlen <= NN_SOCKADDR_MAX);
+    self = nn_alloc (sizeof (struct nn_mux), "connection (tcpmux)");
+    alloc_assert (self);
+    self->sink = &nn_mux_sink;
+    self->state = NN_MUX_STATE_RESOLVING;
+    self->server = server;
+    nn_event_init (&self->done, &self->sink, nn_tcpmux_getcp ());
+    nn_list_item_init (&self->item);
+    memcpy (self->addr, addr, addrlen);
+    self->addr [addrlen] = 0;
+    nn_hash_init (&self->chans);
+    nn_list_init (&self->chanlist);
+    self->nchans = 0;
+    self->nextid = 1;
+    nn_list_init (&self->sendable);
+    self->instate = NN_MUX_INSTATE_MAGIC;
+    self->skipbuf = NULL;
+    self->blocked = NULL;
+    self->inloop = 0;
+    self->inready = 0;
+    self->sending = 0;
+    self->insend = 0;
+    self->ctl = NULL;
+    self->ctllen = 0;
+    self->ctlcap = 0;
+    self->ctlout = NULL;
+    self->ctloutcap = 0;
+    self->nmsgs = 0;
+
+    return self;
+}
+
+static void nn_mux_destroy (struct nn_mux *self)
+{
+    nn_assert (self->nchans == 0);
+    nn_mux_release (self);
+    if (self->instate == NN_MUX_INSTATE_DATA)
+        nn_msg_term (&self->inmsg);
+    if (!self->server)
+        nn_resolve_term (&self->resolve);
+    nn_event_term (&self->done);
+    nn_free (self->skipbuf);
+    nn_free (self->ctl);
+    nn_free (self->ctlout);
+    nn_list_term (&self->sendable);
+    nn_list_term (&self->chanlist);
+    nn_hash_term (&self->chans);
+    nn_tcpmux_rmmux (self);
+    nn_list_item_term (&self->item);
+    nn_free (self);
+}
+
+int nn_mux_isusable (struct nn_mux *self)
+{
+    return !self->server && self->state <= NN_MUX_STATE_ACTIVE;
+}
+
+void nn_mux_close (struct nn_mux *self)
+{
+    struct nn_list_item *it;
+    struct nn_muxchan *chan;
+    int hasusock;
+
+    if (self->state == NN_MUX_STATE_CLOSING)
+        return;
+    hasusock = self->state != NN_MUX_STATE_RESOLVING;
+    self->state = NN_MUX_STATE_CLOSING;
+
+    /*  Close all the channels. Their sockets are notified. */
+    while (!nn_list_empty (&self->chanlist)) {
+        it = nn_list_begin (&self->chanlist);
+        chan = nn_cont (it, struct nn_muxchan, muxitem);
+        nn_hash_erase (&self->chans, &chan->hashitem);
+        nn_list_erase (&self->chanlist, &chan->muxitem);
+        if (nn_list_item_isinlist (&chan->senditem))
+            nn_list_erase (&self->sendable, &chan->senditem);
+        nn_muxchan_muxclose (chan);
+    }
+    self->nchans = 0;
+    self->blocked = NULL;
+
+    /*  The connection is deallocated once the socket is closed, which may
+        happen straight away. */
+    if (hasusock) {
+        nn_usock_close (&self->usock);
+        return;
+    }
+    nn_mux_destroy (self);
+}
+
+static void nn_mux_resolve (struct nn_mux *self)
+{
+    int rc;
+    int port;
+    const char *colon;
+    struct sockaddr_storage ss;
+    nn_socklen sslen;
+
+    /*  Only the first address the name resolves to is tried. */
+    colon = strrchr (self->addr, ':');
+    nn_assert (colon);
+    port = nn_addr_parse_port (colon + 1, strlen (colon + 1));
+    errnum_assert (port > 0, -port);
+    memset (&ss, 0, sizeof (ss));
+    rc = nn_resolve_start (&self->resolve, self->addr, colon - self->addr,
+        NN_ADDR_IPV4ONLY, &ss, &sslen, 1);
+    if (rc == -EINPROGRESS)
+        return;
+    if (nn_slow (rc <= 0)) {
+        nn_mux_finish (self);
+        return;
+    }
+    if (ss.ss_family == AF_INET)
+        ((struct sockaddr_in*) &ss)->sin_port = htons (port);
+    else if (ss.ss_family == AF_INET6)
+        ((struct sockaddr_in6*) &ss)->sin6_port = htons (port);
+    else
+        nn_assert (0);
+
+    rc = nn_usock_init (&self->usock, &self->sink, ss.ss_family,
+        SOCK_STREAM, IPPROTO_TCP, -1, -1, nn_tcpmux_getcp ());
+    if (nn_slow (rc < 0)) {
+        nn_mux_finish (self);
+        return;
+    }
+    nn_mux_tune (self);
+
+    /*  Note that the result may be reported to the sink before the function
+        returns. */
+    self->state = NN_MUX_STATE_CONNECTING;
+    nn_usock_connect (&self->usock, (struct sockaddr*) &ss, sslen);
+}
+
+static void nn_mux_tune (struct nn_mux *self)
+{
+    int rc;
+    int val;
+
+    /*  Messages of many sockets are batched by the connection itself, thus
+        there's no point in delaying the small segments. */
+    val = 1;
+    rc = nn_usock_setsockopt (&self->usock, IPPROTO_TCP, TCP_NODELAY,
+        &val, sizeof (val));
+    errnum_assert (rc == 0, -rc);
+}
+
+static void nn_mux_start (struct nn_mux *self)
+{
+    self->instate = NN_MUX_INSTATE_MAGIC;
+    nn_mux_recv (self);
+    nn_mux_send (self);
+}
+
+static void nn_mux_finish (struct nn_mux *self)
+{
+    if (self->state >= NN_MUX_STATE_DONE)
+        return;
+    self->state = NN_MUX_STATE_DONE;
+    nn_event_signal (&self->done);
+}
+
+void nn_mux_open (struct nn_mux *self, struct nn_muxchan *chan,
+    const char *name, size_t namelen)
+{
+    uint8_t payload [2 + NN_SOCKADDR_MAX];
+
+    nn_assert (namelen <= NN_SOCKADDR_MAX);
+    chan->mux = self;
+    chan->id = self->nextid++;
+    nn_mux_addchan (self, chan);
+    nn_puts (payload, (uint16_t) chan->protocol);
+    memcpy (payload + 2, name, namelen);
+    nn_mux_ctl (self, chan->id, NN_MUX_OPEN, payload, 2 + namelen);
+    nn_mux_send (self);
+}
+
+static void nn_mux_addchan (struct nn_mux *self, struct nn_muxchan *chan)
+{
+    nn_hash_insert (&self->chans, chan->id, &chan->hashitem);
+    nn_list_insert (&self->chanlist, &chan->muxitem,
+        nn_list_end (&self->chanlist));
+    ++self->nchans;
+}
+
+static void nn_mux_rmchan (struct nn_mux *self, struct nn_muxchan *chan)
+{
+    int resume;
+
+    nn_hash_erase (&self->chans, &chan->hashitem);
+    nn_list_erase (&self->chanlist, &chan->muxitem);
+    if (nn_list_item_isinlist (&chan->senditem))
+        nn_list_erase (&self->sendable, &chan->senditem);
+    resume = self->blocked == chan;
+    if (resume)
+        self->blocked = NULL;
+    --self->nchans;
+    nn_muxchan_muxclose (chan);
+
+    /*  If the connection was waiting for the channel to drain, it doesn't
+        have to any more. */
+    if (resume && self->state == NN_MUX_STATE_ACTIVE)
+        nn_mux_recv (self);
+
+    /*  The connecting side closes the connection once it's not needed. */
+    if (!self->server && !self->nchans)
+        nn_mux_finish (self);
+}
+
+static struct nn_muxchan *nn_mux_getchan (struct nn_mux *self, uint32_t id)
+{
+    struct nn_hash_item *item;
+
+    item = nn_hash_get (&self->chans, id);
+    return item ? nn_cont (item, struct nn_muxchan, hashitem) : NULL;
+}
+
+static void nn_mux_ctl (struct nn_mux *self, uint32_t id, int type,
+    const void *payload, size_t len)
+{
+    size_t sz;
+
+    /*  Type 0 stands for the connection header. */
+    sz = type ? NN_MUX_HDRLEN + len : NN_MUX_MAGICLEN;
+    if (self->ctllen + sz > self->ctlcap) {
+        self->ctlcap = self->ctlcap ? self->ctlcap * 2 : 256;
+        if (self->ctlcap < self->ctllen + sz)
+            self->ctlcap = self->ctllen + sz;
+        self->ctl = nn_realloc (self->ctl, self->ctlcap);
+        alloc_assert (self->ctl);
+    }
+    if (!type) {
+        memcpy (self->ctl + self->ctllen, nn_mux_magic, NN_MUX_MAGICLEN);
+        self->ctllen += NN_MUX_MAGICLEN;
+        return;
+    }
+    nn_putl (self->ctl + self->ctllen, id);
+    self->ctl [self->ctllen + 4] = (uint8_t) type;
+    nn_putll (self->ctl + self->ctllen + 5, len);
+    if (len)
+        memcpy (self->ctl + self->ctllen + NN_MUX_HDRLEN, payload, len);
+    self->ctllen += sz;
+}
+
+void nn_mux_chanin (struct nn_mux *self, struct nn_muxchan *chan)
+{
+    /*  The socket can send messages only once the channel is open, but
+        the accepting side may get the event before it replies. */
+    if (nn_slow (chan->state != NN_MUXCHAN_STATE_OPEN)) {
+        chan->outready = 1;
+        return;
+    }
+    if (!nn_list_item_isinlist (&chan->senditem))
+        nn_list_insert (&self->sendable, &chan->senditem,
+            nn_list_end (&self->sendable));
+    nn_mux_send (self);
+}
+
+void nn_mux_chanout (struct nn_mux *self, struct nn_muxchan *chan)
+{
+    if (self->blocked != chan)
+        return;
+    self->blocked = NULL;
+    if (self->state == NN_MUX_STATE_ACTIVE)
+        nn_mux_recv (self);
+}
+
+void nn_mux_chanready (struct nn_mux *self, struct nn_muxchan *chan)
+{
+    uint8_t payload [2];
+
+    /*  The bound socket has accepted the channel. Let the peer know. */
+    nn_assert (chan->state == NN_MUXCHAN_STATE_ACCEPTING);
+    chan->state = NN_MUXCHAN_STATE_OPEN;
+    nn_puts (payload, (uint16_t) chan->protocol);
+    nn_mux_ctl (self, chan->id, NN_MUX_READY, payload, 2);
+    if (chan->outready)
+        nn_mux_chanin (self, chan);
+    else
+        nn_mux_send (self);
+}
+
+void nn_mux_chandetach (struct nn_mux *self, struct nn_muxchan *chan)
+{
+    /*  The socket has closed the channel. Let the peer know. */
+    nn_mux_ctl (self, chan->id, NN_MUX_CLOSE, NULL, 0);
+    nn_mux_rmchan (self, chan);
+    nn_mux_send (self);
+}
+
+/******************************************************************************/
+/*  Inbound state machine.                                                    */
+/******************************************************************************/
+
+/*  Starts reading whatever the current state of the inbound state machine
+    asks for. */
+static void nn_mux_recv (struct nn_mux *self)
+{
+    size_t len;
+
+    switch (self->instate) {
+    case NN_MUX_INSTATE_MAGIC:
+        nn_usock_recv (&self->usock, self->inhdr, NN_MUX_MAGICLEN);
+        return;
+    case NN_MUX_INSTATE_HDR:
+        nn_usock_recv (&self->usock, self->inhdr, NN_MUX_HDRLEN);
+        return;
+    case NN_MUX_INSTATE_CTL:
+        nn_usock_recv (&self->usock, self->inbuf, (size_t) self->insize);
+        return;
+    case NN_MUX_INSTATE_DATA:
+        nn_usock_recv (&self->usock, nn_chunkref_data (&self->inmsg.body),
+            (size_t) self->insize);
+        return;
+    case NN_MUX_INSTATE_SKIP:
+        len = self->insize < NN_MUX_SKIPBUF ?
+            (size_t) self->insize : NN_MUX_SKIPBUF;
+        nn_usock_recv (&self->usock, self->skipbuf, len);
+        return;
+    default:
+        nn_assert (0);
+    }
+}
+
+static void nn_mux_received (const struct nn_cp_sink **self,
+    struct nn_usock *usock)
+{
+    struct nn_mux *mux;
+
+    mux = nn_cont (self, struct nn_mux, sink);
+
+    /*  The data may be reported before nn_usock_recv returns. Rather than
+        recursing, the data are processed by the outermost invocation. */
+    mux->inready = 1;
+    if (mux->inloop)
+        return;
+    mux->inloop = 1;
+    while (mux->inready) {
+        mux->inready = 0;
+        nn_mux_input (mux);
+    }
+    mux->inloop = 0;
+}
+
+static void nn_mux_input (struct nn_mux *self)
+{
+    struct nn_muxchan *chan;
+
+    switch (self->instate) {
+
+    case NN_MUX_INSTATE_MAGIC:
+        if (nn_slow (memcmp (self->inhdr, nn_mux_magic,
+              NN_MUX_MAGICLEN) != 0)) {
+            nn_mux_finish (self);
+            return;
+        }
+        self->instate = NN_MUX_INSTATE_HDR;
+        break;
+
+    case NN_MUX_INSTATE_HDR:
+        self->inid = nn_getl (self->inhdr);
+        self->intype = self->inhdr [4];
+        self->insize = nn_getll (self->inhdr + 5);
+        switch (self->intype) {
+        case NN_MUX_OPEN:
+            if (nn_slow (!self->server || self->insize < 2 ||
+                  self->insize > sizeof (self->inbuf))) {
+                nn_mux_finish (self);
+                return;
+            }
+            self->instate = NN_MUX_INSTATE_CTL;
+            break;
+        case NN_MUX_READY:
+            if (nn_slow (self->server || self->insize != 2)) {
+                nn_mux_finish (self);
+                return;
+            }
+            self->instate = NN_MUX_INSTATE_CTL;
+            break;
+        case NN_MUX_CLOSE:
+            if (nn_slow (self->insize != 0)) {
+                nn_mux_finish (self);
+                return;
+            }
+
+            /*  The channel may have been closed by this side already. */
+            chan = nn_mux_getchan (self, self->inid);
+            if (chan)
+                nn_mux_rmchan (self, chan);
+            break;
+        case NN_MUX_DATA:
+
+            /*  The messages to the channels that were closed by this side
+                in the meantime, as well as to those that are not open yet,
+                are dropped. */
+            chan = nn_mux_getchan (self, self->inid);
+            if (nn_slow (!chan || chan->state != NN_MUXCHAN_STATE_OPEN ||
+                  chan->flags & NN_MUXCHAN_FLAG_SOCK_DEAD)) {
+                if (!self->insize)
+                    break;
+                if (!self->skipbuf) {
+                    self->skipbuf = nn_alloc (NN_MUX_SKIPBUF,
+                        "skip buffer (tcpmux)");
+                    alloc_assert (self->skipbuf);
+                }
+                self->instate = NN_MUX_INSTATE_SKIP;
+                break;
+            }
+            nn_msg_init (&self->inmsg, (size_t) self->insize);
+            self->instate = NN_MUX_INSTATE_DATA;
+            if (!self->insize)
+                nn_mux_ondata (self);
+            break;
+        default:
+            nn_mux_finish (self);
+            return;
+        }
+        break;
+
+    case NN_MUX_INSTATE_CTL:
+        if (self->intype == NN_MUX_OPEN)
+            nn_mux_onopen (self);
+        else
+            nn_mux_onready (self);
+        break;
+
+    case NN_MUX_INSTATE_DATA:
+        nn_mux_ondata (self);
+        break;
+
+    case NN_MUX_INSTATE_SKIP:
+        self->insize -= self->insize < NN_MUX_SKIPBUF ?
+            self->insize : NN_MUX_SKIPBUF;
+        if (!self->insize)
+            self->instate = NN_MUX_INSTATE_HDR;
+        break;
+
+    default:
+        nn_assert (0);
+    }
+
+    /*  Go on reading unless the connection has failed or the channel
+        the message was delivered to is full. */
+    if (self->state == NN_MUX_STATE_ACTIVE && !self->blocked)
+        nn_mux_recv (self);
+}
+
+static void nn_mux_onopen (struct nn_mux *self)
+{
+    int peer;
+    struct nn_muxb *muxb;
+    struct nn_muxchan *chan;
+
+    self->instate = NN_MUX_INSTATE_HDR;
+    if (nn_slow (nn_mux_getchan (self, self->inid) != NULL)) {
+        nn_mux_finish (self);
+        return;
+    }
+
+    /*  If there's no socket bound to the name, refuse the channel. */
+    peer = nn_gets (self->inbuf);
+    muxb = nn_tcpmux_findb (self->addr, (const char*) self->inbuf + 2,
+        (size_t) self->insize - 2);
+    if (!muxb) {
+        nn_mux_ctl (self, self->inid, NN_MUX_CLOSE, NULL, 0);
+        nn_mux_send (self);
+        return;
+    }
+
+    /*  The channel is handed over to the bound endpoint, which replies
+        once it has attached it to the socket. */
+    chan = nn_muxchan_create_accepted (self, self->inid, peer,
+        nn_muxb_getcp (muxb));
+    nn_mux_addchan (self, chan);
+    nn_muxb_accept (muxb, chan);
+}
+
+static void nn_mux_onready (struct nn_mux *self)
+{
+    struct nn_muxchan *chan;
+
+    self->instate = NN_MUX_INSTATE_HDR;
+
+    /*  The channel may have been closed by this side already. */
+    chan = nn_mux_getchan (self, self->inid);
+    if (!chan)
+        return;
+    if (nn_slow (chan->state != NN_MUXCHAN_STATE_OPENING)) {
+        nn_mux_finish (self);
+        return;
+    }
+    chan->state = NN_MUXCHAN_STATE_OPEN;
+    chan->peer = nn_gets (self->inbuf);
+    nn_muxchan_ready (chan);
+}
+
+static void nn_mux_ondata (struct nn_mux *self)
+{
+    struct nn_muxchan *chan;
+
+    self->instate = NN_MUX_INSTATE_HDR;
+
+    /*  The channel may have been closed while the message was being
+        read. */
+    chan = nn_mux_getchan (self, self->inid);
+    if (nn_slow (!chan)) {
+        nn_msg_term (&self->inmsg);
+        return;
+    }
+    if (nn_muxchan_deliver (chan, &self->inmsg))
+        self->blocked = chan;
+}
+
+/******************************************************************************/
+/*  Outbound state machine.                                                   */
+/******************************************************************************/
+
+static void nn_mux_send (struct nn_mux *self)
+{
+    /*  The batch may be reported as sent before nn_usock_send returns.
+        Rather than recursing, the next batch is sent by the outermost
+        invocation. */
+    if (self->insend)
+        return;
+    self->insend = 1;
+    while (self->state == NN_MUX_STATE_ACTIVE && !self->sending &&
+          nn_mux_batch (self)) {
+        self->sending = 1;
+        nn_usock_send (&self->usock, self->iov, self->iovcnt);
+    }
+    self->insend = 0;
+}
+
+/*  Fills in the iovecs with the pending control frames followed by as many
+    messages as fit. Returns 0 if there's nothing to send. */
+static int nn_mux_batch (struct nn_mux *self)
+{
+    int rc;
+    int i;
+    uint8_t *buf;
+    size_t cap;
+    size_t size;
+    struct nn_msg *msg;
+    struct nn_muxchan *chan;
+
+    self->iovcnt = 0;
+    if (self->ctllen) {
+        buf = self->ctlout;
+        cap = self->ctloutcap;
+        self->ctlout = self->ctl;
+        self->ctloutcap = self->ctlcap;
+        self->iov [0].iov_base = self->ctlout;
+        self->iov [0].iov_len = self->ctllen;
+        self->iovcnt = 1;
+        self->ctl = buf;
+        self->ctlcap = cap;
+        self->ctllen = 0;
+    }
+
+    /*  Take one message from each channel in turn, so that a busy channel
+        doesn't hold the others back. */
+    while (self->nmsgs < NN_MUX_BATCH && !nn_list_empty (&self->sendable) &&
+          self->iovcnt + 3 + NN_MSG_MAXFRAGS <= NN_AIO_MAX_IOVCNT) {
+        chan = nn_cont (nn_list_begin (&self->sendable), struct nn_muxchan,
+            senditem);
+        nn_list_erase (&self->sendable, &chan->senditem);
+        msg = &self->msgs [self->nmsgs];
+        rc = nn_muxchan_recv (chan, msg);
+        if (!(rc & NN_MSGQUEUE_RELEASE))
+            nn_list_insert (&self->sendable, &chan->senditem,
+                nn_list_end (&self->sendable));
+        if (nn_slow (rc & NN_MSGQUEUE_DROP)) {
+            nn_msg_term (msg);
+            continue;
+        }
+
+        size = nn_chunkref_size (&msg->hdr) + nn_msg_bodysize (msg);
+        nn_putl (self->hdrs [self->nmsgs], chan->id);
+        self->hdrs [self->nmsgs][4] = NN_MUX_DATA;
+        nn_putll (self->hdrs [self->nmsgs] + 5, size);
+        self->iov [self->iovcnt].iov_base = self->hdrs [self->nmsgs];
+        self->iov [self->iovcnt].iov_len = NN_MUX_HDRLEN;
+        ++self->iovcnt;
+        if (nn_chunkref_size (&msg->hdr)) {
+            self->iov [self->iovcnt].iov_base = nn_chunkref_data (&msg->hdr);
+            self->iov [self->iovcnt].iov_len = nn_chunkref_size (&msg->hdr);
+            ++self->iovcnt;
+        }
+        if (nn_chunkref_size (&msg->body)) {
+            self->iov [self->iovcnt].iov_base = nn_chunkref_data (&msg->body);
+            self->iov [self->iovcnt].iov_len = nn_chunkref_size (&msg->body);
+            ++self->iovcnt;
+        }
+        if (msg->frags) {
+            for (i = 0; i != msg->frags->count; ++i) {
+                self->iov [self->iovcnt].iov_base =
+                    nn_chunkref_data (&msg->frags->frag [i]);
+                self->iov [self->iovcnt].iov_len =
+                    nn_chunkref_size (&msg->frags->frag [i]);
+                ++self->iovcnt;
+            }
+        }
+        ++self->nmsgs;
+    }
+
+    return self->iovcnt;
+}
+
+/*  Deallocates the messages of the batch that was sent. */
+static void nn_mux_release (struct nn_mux *self)
+{
+    int i;
+
+    for (i = 0; i != self->nmsgs; ++i)
+        nn_msg_term (&self->msgs [i]);
+    self->nmsgs = 0;
+}
+
+/******************************************************************************/
+/*  Event handlers.                                                           */
+/******************************************************************************/
+
+static void nn_mux_sent (const struct nn_cp_sink **self,
+    struct nn_usock *usock)
+{
+    struct nn_mux *mux;
+
+    mux = nn_cont (self, struct nn_mux, sink);
+
+    nn_mux_release (mux);
+    mux->sending = 0;
+    nn_mux_send (mux);
+}
+
+static void nn_mux_connected (const struct nn_cp_sink **self,
+    struct nn_usock *usock)
+{
+    struct nn_mux *mux;
+
+    mux = nn_cont (self, struct nn_mux, sink);
+
+    nn_assert (mux->state == NN_MUX_STATE_CONNECTING);
+    mux->state = NN_MUX_STATE_ACTIVE;
+    nn_mux_start (mux);
+}
+
+static void nn_mux_err (const struct nn_cp_sink **self,
+    struct nn_usock *usock, int errnum)
+{
+    struct nn_mux *mux;
+
+    mux = nn_cont (self, struct nn_mux, sink);
+
+    /*  The error may be reported from deep within the call stack. Close
+        the connection later on. */
+    nn_mux_finish (mux);
+}
+
+static void nn_mux_closed (const struct nn_cp_sink **self,
+    struct nn_usock *usock)
+{
+    struct nn_mux *mux;
+
+    mux = nn_cont (self, struct nn_mux, sink);
+
+    nn_assert (mux->state == NN_MUX_STATE_CLOSING);
+    nn_mux_destroy (mux);
+}
+
+static void nn_mux_event (const struct nn_cp_sink **self,
+    struct nn_event *event)
+{
+    struct nn_mux *mux;
+
+    mux = nn_cont (self, struct nn_mux, sink);
+
+    if (event == &mux->done) {
+        nn_mux_close (mux);
+        return;
+    }
+
+    /*  The name lookup is done. Pick up the result. */
+    if (!mux->server && event == &mux->resolve.done &&
+          mux->state == NN_MUX_STATE_RESOLVING) {
+        nn_mux_resolve (mux);
+        return;
+    }
+
+    nn_assert (0);
+}
+
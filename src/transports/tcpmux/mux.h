@@ -0,0 +1,163 @@
+/*
+    Copyright (c) 2013 250bpm s.r.o.
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"),
+    to deal in the Software without restriction, including without limitation
+    the rights to use, copy, modify, merge, publish, distribute, sublicense,
+    and/or sell copies of the Software, and to permit persons to whom
+    the Software is furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included
+    in all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+    THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+    FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+    IN THE SOFTWARE.
+*/
+
+#ifndef NN_MUX_INCLUDED
+#define NN_MUX_INCLUDED
+
+#include "../../transport.h"
+
+#include "../../aio/aio.h"
+
+#include "../../utils/hash.h"
+#include "../../utils/list.h"
+#include "../../utils/msg.h"
+#include "../../utils/resolver.h"
+
+#include <stdint.h>
+
+struct nn_muxchan;
+
+/*  A TCP connection carrying the channels of any number of SP sockets.
+
+    Both peers start by sending NN_MUX_MAGICLEN bytes long header. Then the
+    connection carries frames, each consisting of a 4-byte channel ID,
+    a 1-byte frame type and an 8-byte payload size, followed by the payload.
+    All the numbers are in network byte order. Channels are opened by the
+    connecting side only, so the IDs are chosen by it. IDs are never reused
+    within a connection.
+
+    OPEN frame opens a channel. It carries the 2-byte SP protocol of
+    the socket followed by the name the peer's socket is bound to. The peer
+    replies with READY frame carrying the protocol of its socket, or with
+    CLOSE frame if there's no socket bound to the name. CLOSE frame can be
+    sent by either side at any time, the channel is closed once it's sent.
+    DATA frame carries a message, SP header followed by the body. */
+
+#define NN_MUX_MAGICLEN 8
+#define NN_MUX_HDRLEN 13
+
+#define NN_MUX_OPEN 1
+#define NN_MUX_READY 2
+#define NN_MUX_CLOSE 3
+#define NN_MUX_DATA 4
+
+/*  Maximum number of messages sent in a single batch. */
+#define NN_MUX_BATCH 16
+
+/*  Size of the buffer the data of the frames to skip are read into. */
+#define NN_MUX_SKIPBUF 4096
+
+struct nn_mux {
+
+    /*  Event sink. */
+    const struct nn_cp_sink *sink;
+
+    /*  Current state of the connection. */
+    int state;
+
+    /*  1 if the connection was accepted from a listening socket. */
+    int server;
+
+    /*  The underlying TCP socket. */
+    struct nn_usock usock;
+
+    /*  The connection is closed from within this event so that the objects
+        using it in the current call stack are not deallocated under their
+        feet. */
+    struct nn_event done;
+
+    /*  Lookup of the peer's address, for the connecting side. */
+    struct nn_resolve resolve;
+
+    /*  The connection is an element of the list of all the connections. */
+    struct nn_list_item item;
+
+    /*  "host:port" address the connection was opened to, or the address of
+        the listening socket it was accepted from. */
+    char addr [NN_SOCKADDR_MAX + 1];
+
+    /*  Open channels, looked up by their IDs. */
+    struct nn_hash chans;
+    struct nn_list chanlist;
+    int nchans;
+    uint32_t nextid;
+
+    /*  Channels that have messages to send, served in round-robin fashion. */
+    struct nn_list sendable;
+
+    /*  Inbound state machine. If the socket side of the channel the last
+        message was delivered to is full, no more data are read from
+        the connection till it drains. */
+    int instate;
+    uint8_t inhdr [NN_MUX_HDRLEN];
+    uint8_t inbuf [2 + NN_SOCKADDR_MAX];
+    uint32_t inid;
+    int intype;
+    uint64_t insize;
+    struct nn_msg inmsg;
+    uint8_t *skipbuf;
+    struct nn_muxchan *blocked;
+    int inloop;
+    int inready;
+
+    /*  Outbound state machine. Control frames are accumulated in 'ctl' and
+        sent ahead of the messages of the next batch. */
+    int sending;
+    int insend;
+    uint8_t *ctl;
+    size_t ctllen;
+    size_t ctlcap;
+    uint8_t *ctlout;
+    size_t ctloutcap;
+    uint8_t hdrs [NN_MUX_BATCH][NN_MUX_HDRLEN];
+    struct nn_msg msgs [NN_MUX_BATCH];
+    int nmsgs;
+    struct nn_iobuf iov [NN_AIO_MAX_IOVCNT];
+    int iovcnt;
+};
+
+/*  Creates a connection to the "host:port" address. */
+struct nn_mux *nn_mux_create (const char *addr, size_t addrlen);
+
+/*  Creates a connection accepted from the listening socket. */
+struct nn_mux *nn_mux_create_accepted (struct nn_usock *listener, int s,
+    const char *addr);
+
+/*  Returns 1 if new channels can be opened on the connection. */
+int nn_mux_isusable (struct nn_mux *self);
+
+/*  Closes all the channels and the connection itself. */
+void nn_mux_close (struct nn_mux *self);
+
+/*  Opens the channel to the socket bound to the name on the peer's side. */
+void nn_mux_open (struct nn_mux *self, struct nn_muxchan *chan,
+    const char *name, size_t namelen);
+
+/*  Handlers of the events the socket side of a channel posts to the mux
+    side. */
+void nn_mux_chanin (struct nn_mux *self, struct nn_muxchan *chan);
+void nn_mux_chanout (struct nn_mux *self, struct nn_muxchan *chan);
+void nn_mux_chanready (struct nn_mux *self, struct nn_muxchan *chan);
+void nn_mux_chandetach (struct nn_mux *self, struct nn_muxchan *chan);
+
+#endif
+
@@ -0,0 +1,204 @@
+/*
+    Copyright (c) 2013 250bpm s.r.o.
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"),
+    to deal in the Software without restriction, including without limitation
+    the rights to use, copy, modify, merge, publish, distribute, sublicense,
+    and/or sell copies of the Software, and to permit persons to whom
+    the Software is furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included
+    in all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+    THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+    FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+    IN THE SOFTWARE.
+*/
+
+#include "muxb.h"
+#include "muxchan.h"
+#include "tcpmux.h"
+
+#include "../../utils/err.h"
+#include "../../utils/fast.h"
+#include "../../utils/cont.h"
+#include "../../utils/alloc.h"
+#include "../../utils/addr.h"
+
+#include <string.h>
+
+/*  Private functions. */
+static void nn_muxb_rm (struct nn_muxchan *chan);
+
+/*  Implementation of nn_epbase interface. */
+static int nn_muxb_close (struct nn_epbase *self);
+static const struct nn_epbase_vfptr nn_muxb_epbase_vfptr =
+    {nn_muxb_close};
+
+/*  Event sink. */
+static void nn_muxb_event (const struct nn_cp_sink **self,
+    struct nn_event *event);
+static const struct nn_cp_sink nn_muxb_sink =
+    {NULL, NULL, NULL, NULL, NULL, NULL, NULL, nn_muxb_event};
+
+int nn_muxb_create (const char *addr, void *hint, struct nn_epbase **epbase)
+{
+    int rc;
+    const char *slash;
+    const char *colon;
+    struct nn_muxb *self;
+
+    /*  The address is "interface:port/name". The name may be empty. */
+    slash = strchr (addr, '/');
+    if (!slash)
+        slash = addr + strlen (addr);
+    colon = strrchr (addr, ':');
+    if (!colon || colon > slash)
+        return -EINVAL;
+    rc = nn_addr_parse_port (colon + 1, slash - colon - 1);
+    if (rc < 0)
+        return rc;
+    rc = nn_addr_parse_local (addr, colon - addr, NN_ADDR_IPV4ONLY,
+        NULL, NULL);
+    if (rc < 0)
+        return rc;
+
+    self = nn_alloc (sizeof (struct nn_muxb), "bound endpoint (tcpmux)");
+    alloc_assert (self);
+    nn_epbase_init (&self->epbase, &nn_muxb_epbase_vfptr, addr, hint);
+    self->sink = &nn_muxb_sink;
+    self->namelen = *slash ? strlen (slash + 1) : 0;
+    memcpy (self->name, slash + (*slash ? 1 : 0), self->namelen);
+    self->name [self->namelen] = 0;
+    nn_list_item_init (&self->item);
+    self->listener = NULL;
+    nn_mutex_init (&self->sync);
+    nn_list_init (&self->incoming);
+    nn_event_init (&self->accept, &self->sink,
+        nn_epbase_getcp (&self->epbase));
+    nn_list_init (&self->chans);
+
+    /*  Register the name with the listening socket. */
+    nn_cp_lock (nn_tcpmux_getcp ());
+    rc = nn_tcpmux_addb (self, addr, slash - addr);
+    nn_cp_unlock (nn_tcpmux_getcp ());
+    if (nn_slow (rc < 0)) {
+        nn_list_term (&self->chans);
+        nn_event_term (&self->accept);
+        nn_list_term (&self->incoming);
+        nn_mutex_term (&self->sync);
+        nn_list_item_term (&self->item);
+        nn_epbase_term (&self->epbase);
+        nn_free (self);
+        return rc;
+    }
+
+    *epbase = &self->epbase;
+    return 0;
+}
+
+struct nn_cp *nn_muxb_getcp (struct nn_muxb *self)
+{
+    return nn_epbase_getcp (&self->epbase);
+}
+
+void nn_muxb_accept (struct nn_muxb *self, struct nn_muxchan *chan)
+{
+    int empty;
+
+    nn_mutex_lock (&self->sync);
+    empty = nn_list_empty (&self->incoming);
+    nn_list_insert (&self->incoming, &chan->item,
+        nn_list_end (&self->incoming));
+    nn_mutex_unlock (&self->sync);
+
+    /*  The endpoint can't be closed while the completion port of
+        the connections is locked, thus its completion port is safe to
+        unlock. */
+    if (empty && nn_event_post (&self->accept))
+        nn_cp_unlock (nn_muxb_getcp (self));
+}
+
+static void nn_muxb_rm (struct nn_muxchan *chan)
+{
+    struct nn_muxb *muxb;
+
+    muxb = (struct nn_muxb*) chan->owner;
+    nn_list_erase (&muxb->chans, &chan->item);
+}
+
+static int nn_muxb_close (struct nn_epbase *self)
+{
+    struct nn_muxb *muxb;
+    struct nn_muxchan *chan;
+
+    muxb = nn_cont (self, struct nn_muxb, epbase);
+
+    /*  Unregister the name. No channels are handed over from now on. */
+    nn_cp_lock (nn_tcpmux_getcp ());
+    nn_tcpmux_rmb (muxb);
+    nn_cp_unlock (nn_tcpmux_getcp ());
+
+    /*  Refuse the channels that were not picked up yet and close those that
+        were. */
+    nn_event_term (&muxb->accept);
+    while (!nn_list_empty (&muxb->incoming)) {
+        chan = nn_cont (nn_list_begin (&muxb->incoming), struct nn_muxchan,
+            item);
+        nn_list_erase (&muxb->incoming, &chan->item);
+        nn_muxchan_close (chan);
+    }
+    while (!nn_list_empty (&muxb->chans)) {
+        chan = nn_cont (nn_list_begin (&muxb->chans), struct nn_muxchan,
+            item);
+        nn_list_erase (&muxb->chans, &chan->item);
+        nn_muxchan_close (chan);
+    }
+
+    nn_list_term (&muxb->chans);
+    nn_list_term (&muxb->incoming);
+    nn_mutex_term (&muxb->sync);
+    nn_list_item_term (&muxb->item);
+    nn_epbase_term (&muxb->epbase);
+    nn_free (muxb);
+
+    return 0;
+}
+
+static void nn_muxb_event (const struct nn_cp_sink **self,
+    struct nn_event *event)
+{
+    struct nn_muxb *muxb;
+    struct nn_list incoming;
+    struct nn_muxchan *chan;
+
+    muxb = nn_cont (self, struct nn_muxb, sink);
+
+    /*  Take all the channels handed over so far. */
+    nn_list_init (&incoming);
+    nn_mutex_lock (&muxb->sync);
+    while (!nn_list_empty (&muxb->incoming)) {
+        chan = nn_cont (nn_list_begin (&muxb->incoming), struct nn_muxchan,
+            item);
+        nn_list_erase (&muxb->incoming, &chan->item);
+        nn_list_insert (&incoming, &chan->item, nn_list_end (&incoming));
+    }
+    nn_mutex_unlock (&muxb->sync);
+
+    /*  Attach them to the socket. Those that can't be attached are closed
+        by nn_muxchan_attach. */
+    while (!nn_list_empty (&incoming)) {
+        chan = nn_cont (nn_list_begin (&incoming), struct nn_muxchan, item);
+        nn_list_erase (&incoming, &chan->item);
+        if (nn_muxchan_attach (chan, &muxb->epbase, nn_muxb_rm, muxb) == 0)
+            nn_list_insert (&muxb->chans, &chan->item,
+                nn_list_end (&muxb->chans));
+    }
+    nn_list_term (&incoming);
+}
+
@@ -0,0 +1,77 @@
+/*
+    Copyright (c) 2013 250bpm s.r.o.
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"),
+    to deal in the Software without restriction, including without limitation
+    the rights to use, copy, modify, merge, publish, distribute, sublicense,
+    and/or sell copies of the Software, and to permit persons to whom
+    the Software is furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included
+    in all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+    THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+    FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+    IN THE SOFTWARE.
+*/
+
+#ifndef NN_MUXB_INCLUDED
+#define NN_MUXB_INCLUDED
+
+#include "../../transport.h"
+
+#include "../../aio/aio.h"
+
+#include "../../utils/list.h"
+#include "../../utils/mutex.h"
+
+struct nn_muxchan;
+
+/*  Endpoint created by nn_bind. It registers its name with the listening
+    socket shared by all the endpoints bound to the same "interface:port"
+    address and picks up the channels the peers open to the name. */
+
+struct nn_muxb {
+
+    /*  This object is an endpoint. */
+    struct nn_epbase epbase;
+
+    /*  Event sink. */
+    const struct nn_cp_sink *sink;
+
+    /*  The name the endpoint is bound to. */
+    char name [NN_SOCKADDR_MAX + 1];
+    size_t namelen;
+
+    /*  The endpoint is an element of the list of endpoints bound to
+        the listening socket. The listening socket itself is opaque. */
+    struct nn_list_item item;
+    void *listener;
+
+    /*  Channels opened by the peers, waiting for the socket to pick them
+        up. The list is filled in by the completion port of the connections,
+        hence the critical section. 'accept' event is signalled once it
+        becomes non-empty. */
+    struct nn_mutex sync;
+    struct nn_list incoming;
+    struct nn_event accept;
+
+    /*  Channels attached to the socket. */
+    struct nn_list chans;
+};
+
+int nn_muxb_create (const char *addr, void *hint, struct nn_epbase **epbase);
+
+/*  Returns the completion port of the socket the endpoint belongs to. */
+struct nn_cp *nn_muxb_getcp (struct nn_muxb *self);
+
+/*  Hands the channel opened by the peer over to the endpoint. Called with
+    the completion port of the connections locked. */
+void nn_muxb_accept (struct nn_muxb *self, struct nn_muxchan *chan);
+
+#endif
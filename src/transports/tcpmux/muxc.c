@@ -0,0 +1,146 @@
+/*
+    Copyright (c) 2013 250bpm s.r.o.
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"),
+    to deal in the Software without restriction, including without limitation
+    the rights to use, copy, modify, merge, publish, distribute, sublicense,
+    and/or sell copies of the Software, and to permit persons to whom
+    the Software is furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included
+    in all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+    THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+    FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+    IN THE SOFTWARE.
+*/
+
+#include "muxc.h"
+#include "mux.h"
+#include "muxchan.h"
+#include "tcpmux.h"
+
+#include "../../utils/err.h"
+#include "../../utils/fast.h"
+#include "../../utils/cont.h"
+#include "../../utils/alloc.h"
+#include "../../utils/addr.h"
+
+#include <string.h>
+
+/*  Private functions. */
+static void nn_muxc_open (struct nn_muxc *self);
+static void nn_muxc_rm (struct nn_muxchan *chan);
+
+/*  Implementation of nn_epbase interface. */
+static int nn_muxc_close (struct nn_epbase *self);
+static const struct nn_epbase_vfptr nn_muxc_epbase_vfptr =
+    {nn_muxc_close};
+
+/*  Event sink. */
+static void nn_muxc_timeout (const struct nn_cp_sink **self,
+    struct nn_timer *timer);
+static const struct nn_cp_sink nn_muxc_sink =
+    {NULL, NULL, NULL, NULL, NULL, NULL, nn_muxc_timeout, NULL};
+
+int nn_muxc_create (const char *addr, void *hint, struct nn_epbase **epbase)
+{
+    int rc;
+    const char *slash;
+    const char *colon;
+    struct nn_muxc *self;
+
+    /*  The address is "host:port/name". The name may be empty. Local
+        address can't be specified as the connection is shared. */
+    if (strchr (addr, ';'))
+        return -EINVAL;
+    slash = strchr (addr, '/');
+    if (!slash)
+        slash = addr + strlen (addr);
+    colon = strrchr (addr, ':');
+    if (!colon || colon > slash || colon == addr)
+        return -EINVAL;
+    rc = nn_addr_parse_port (colon + 1, slash - colon - 1);
+    if (rc < 0)
+        return rc;
+
+    self = nn_alloc (sizeof (struct nn_muxc), "connecting endpoint (tcpmux)");
+    alloc_assert (self);
+    nn_epbase_init (&self->epbase, &nn_muxc_epbase_vfptr, addr, hint);
+    self->sink = &nn_muxc_sink;
+    self->addrlen = slash - addr;
+    memcpy (self->addr, addr, self->addrlen);
+    self->addr [self->addrlen] = 0;
+    self->namelen = *slash ? strlen (slash + 1) : 0;
+    memcpy (self->name, slash + (*slash ? 1 : 0), self->namelen);
+    self->name [self->namelen] = 0;
+    self->chan = NULL;
+    nn_timer_init (&self->retry_timer, &self->sink,
+        nn_epbase_getcp (&self->epbase));
+
+    nn_muxc_open (self);
+
+    *epbase = &self->epbase;
+    return 0;
+}
+
+static void nn_muxc_open (struct nn_muxc *self)
+{
+    struct nn_mux *mux;
+
+    nn_assert (!self->chan);
+    nn_cp_lock (nn_tcpmux_getcp ());
+    self->chan = nn_muxchan_create (&self->epbase, nn_muxc_rm, self);
+    mux = nn_tcpmux_getmux (self->addr, self->addrlen);
+    nn_mux_open (mux, self->chan, self->name, self->namelen);
+    nn_cp_unlock (nn_tcpmux_getcp ());
+}
+
+static void nn_muxc_rm (struct nn_muxchan *chan)
+{
+    struct nn_muxc *muxc;
+    int ivl;
+    size_t sz;
+
+    muxc = (struct nn_muxc*) chan->owner;
+
+    /*  The channel was closed or refused. Try again later on. */
+    nn_assert (muxc->chan == chan);
+    muxc->chan = NULL;
+    sz = sizeof (ivl);
+    nn_epbase_getopt (&muxc->epbase, NN_SOL_SOCKET, NN_RECONNECT_IVL,
+        &ivl, &sz);
+    nn_assert (sz == sizeof (ivl));
+    nn_timer_start (&muxc->retry_timer, ivl);
+}
+
+static int nn_muxc_close (struct nn_epbase *self)
+{
+    struct nn_muxc *muxc;
+
+    muxc = nn_cont (self, struct nn_muxc, epbase);
+
+    nn_timer_term (&muxc->retry_timer);
+    if (muxc->chan)
+        nn_muxchan_close (muxc->chan);
+    nn_epbase_term (&muxc->epbase);
+    nn_free (muxc);
+
+    return 0;
+}
+
+static void nn_muxc_timeout (const struct nn_cp_sink **self,
+    struct nn_timer *timer)
+{
+    struct nn_muxc *muxc;
+
+    muxc = nn_cont (self, struct nn_muxc, sink);
+
+    nn_muxc_open (muxc);
+}
+
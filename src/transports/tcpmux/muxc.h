@@ -0,0 +1,61 @@
+/*
+    Copyright (c) 2013 250bpm s.r.o.
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"),
+    to deal in the Software without restriction, including without limitation
+    the rights to use, copy, modify, merge, publish, distribute, sublicense,
+    and/or sell copies of the Software, and to permit persons to whom
+    the Software is furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included
+    in all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+    THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+    FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+    IN THE SOFTWARE.
+*/
+
+#ifndef NN_MUXC_INCLUDED
+#define NN_MUXC_INCLUDED
+
+#include "../../transport.h"
+
+#include "../../aio/aio.h"
+
+struct nn_muxchan;
+
+/*  Endpoint created by nn_connect. It opens a channel to the name over
+    the connection to the "host:port" address shared with all the other
+    endpoints connected to the same address. Once the channel is closed,
+    it's re-opened after NN_RECONNECT_IVL milliseconds. */
+
+struct nn_muxc {
+
+    /*  This object is an endpoint. */
+    struct nn_epbase epbase;
+
+    /*  Event sink. */
+    const struct nn_cp_sink *sink;
+
+    /*  "host:port" address of the peer and the name the channel is opened
+        to. */
+    char addr [NN_SOCKADDR_MAX + 1];
+    size_t addrlen;
+    char name [NN_SOCKADDR_MAX + 1];
+    size_t namelen;
+
+    /*  The current channel, NULL while waiting to re-open it. */
+    struct nn_muxchan *chan;
+
+    /*  Timer to wait before re-opening the channel. */
+    struct nn_timer retry_timer;
+};
+
+int nn_muxc_create (const char *addr, void *hint, struct nn_epbase **epbase);
+
+#endif
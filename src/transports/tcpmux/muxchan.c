@@ -0,0 +1,445 @@
+/*
+    Copyright (c) 2013 250bpm s.r.o.
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"),
+    to deal in the Software without restriction, including without limitation
+    the rights to use, copy, modify, merge, publish, distribute, sublicense,
+    and/or sell copies of the Software, and to permit persons to whom
+    the Software is furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included
+    in all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+    THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+    FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+    IN THE SOFTWARE.
+*/
+
+#include "muxchan.h"
+#include "mux.h"
+#include "tcpmux.h"
+
+#include "../../nn.h"
+
+#include "../../utils/err.h"
+#include "../../utils/fast.h"
+#include "../../utils/cont.h"
+#include "../../utils/alloc.h"
+
+/*  Private functions. */
+static void nn_muxchan_init (struct nn_muxchan *self, struct nn_cp *sockcp);
+static void nn_muxchan_initqueues (struct nn_muxchan *self,
+    struct nn_epbase *epbase);
+static void nn_muxchan_destroy (struct nn_muxchan *self);
+static void nn_muxchan_signal (struct nn_muxchan *self, int deadflag,
+    struct nn_cp *cp, struct nn_event *event);
+static int nn_muxchan_getopt (struct nn_epbase *epbase, int option);
+
+/*  Implementation of nn_pipebase interface. */
+static int nn_muxchan_send (struct nn_pipebase *self, struct nn_msg *msg);
+static int nn_muxchan_precv (struct nn_pipebase *self, struct nn_msg *msg);
+static const struct nn_pipebase_vfptr nn_muxchan_pipebase_vfptr =
+    {nn_muxchan_send, nn_muxchan_precv};
+
+/*  Event sinks of the socket side and the mux side. */
+static void nn_muxchan_sockevent (const struct nn_cp_sink **self,
+    struct nn_event *event);
+static const struct nn_cp_sink nn_muxchan_socksink =
+    {NULL, NULL, NULL, NULL, NULL, NULL, NULL, nn_muxchan_sockevent};
+static void nn_muxchan_muxevent (const struct nn_cp_sink **self,
+    struct nn_event *event);
+static const struct nn_cp_sink nn_muxchan_muxsink =
+    {NULL, NULL, NULL, NULL, NULL, NULL, NULL, nn_muxchan_muxevent};
+
+struct nn_muxchan *nn_muxchan_create (struct nn_epbase *epbase,
+    void (*rmfn) (struct nn_muxchan *self), void *owner)
+{
+    int rc;
+    size_t sz;
+    struct nn_muxchan *self;
+
+    self = nn_alloc (sizeof (struct nn_muxchan), "channel (tcpmux)");
+    alloc_assert (self);
+    nn_muxchan_init (self, nn_epbase_getcp (epbase));
+    nn_muxchan_initqueues (self, epbase);
+    self->rmfn = rmfn;
+    self->owner = owner;
+    sz = sizeof (self->protocol);
+    nn_epbase_getopt (epbase, NN_SOL_SOCKET, NN_PROTOCOL,
+        &self->protocol, &sz);
+    nn_assert (sz == sizeof (self->protocol));
+
+    /*  The pipe is activated once the peer accepts the channel. */
+    rc = nn_pipebase_init (&self->pipebase, &nn_muxchan_pipebase_vfptr,
+        epbase);
+    nn_assert (rc == 0);
+    self->attached = 1;
+    self->state = NN_MUXCHAN_STATE_OPENING;
+
+    return self;
+}
+
+struct nn_muxchan *nn_muxchan_create_accepted (struct nn_mux *mux,
+    uint32_t id, int peer, struct nn_cp *sockcp)
+{
+    struct nn_muxchan *self;
+
+    self = nn_alloc (sizeof (struct nn_muxchan), "channel (tcpmux)");
+    alloc_assert (self);
+    nn_muxchan_init (self, sockcp);
+    self->flags = NN_MUXCHAN_FLAG_SOCK_DEAD;
+    self->peer = peer;
+    self->mux = mux;
+    self->id = id;
+    self->state = NN_MUXCHAN_STATE_ACCEPTING;
+
+    return self;
+}
+
+static void nn_muxchan_init (struct nn_muxchan *self, struct nn_cp *sockcp)
+{
+    nn_mutex_init (&self->sync);
+    self->flags = 0;
+    self->peer = -1;
+    self->attached = 0;
+    self->sockcp = sockcp;
+    self->socksink = &nn_muxchan_socksink;
+    nn_event_init (&self->sockin, &self->socksink, sockcp);
+    nn_event_init (&self->sockout, &self->socksink, sockcp);
+    nn_event_init (&self->sockready, &self->socksink, sockcp);
+    nn_event_init (&self->sockdetach, &self->socksink, sockcp);
+    self->rmfn = NULL;
+    self->owner = NULL;
+    nn_list_item_init (&self->item);
+    self->protocol = -1;
+    self->mux = NULL;
+    self->id = 0;
+    self->state = 0;
+    self->outready = 0;
+    self->muxsink = &nn_muxchan_muxsink;
+    nn_event_init (&self->muxin, &self->muxsink, nn_tcpmux_getcp ());
+    nn_event_init (&self->muxout, &self->muxsink, nn_tcpmux_getcp ());
+    nn_event_init (&self->muxready, &self->muxsink, nn_tcpmux_getcp ());
+    nn_event_init (&self->muxdetach, &self->muxsink, nn_tcpmux_getcp ());
+    nn_hash_item_init (&self->hashitem);
+    nn_list_item_init (&self->muxitem);
+    nn_list_item_init (&self->senditem);
+}
+
+static void nn_muxchan_initqueues (struct nn_muxchan *self,
+    struct nn_epbase *epbase)
+{
+    int sndlowat;
+    int sndlowatmsgs;
+
+    /*  The socket's send buffer limits the messages waiting to be sent to
+        the connection, its receive buffer those waiting for the socket.
+        Once the latter is full, the connection stops reading. */
+    sndlowat = nn_muxchan_getopt (epbase, NN_SNDLOWAT);
+    sndlowatmsgs = nn_muxchan_getopt (epbase, NN_SNDLOWATMSGS);
+    nn_msgqueue_init (&self->outq, nn_muxchan_getopt (epbase, NN_SNDBUF),
+        sndlowat < 0 ? (size_t) -1 : (size_t) sndlowat,
+        nn_muxchan_getopt (epbase, NN_SNDBUFMSGS),
+        sndlowatmsgs < 0 ? (size_t) -1 : (size_t) sndlowatmsgs, 1);
+    nn_msgqueue_init (&self->inq, nn_muxchan_getopt (epbase, NN_RCVBUF),
+        (size_t) -1, nn_muxchan_getopt (epbase, NN_RCVBUFMSGS),
+        (size_t) -1, 1);
+}
+
+static int nn_muxchan_getopt (struct nn_epbase *epbase, int option)
+{
+    int val;
+    size_t sz;
+
+    sz = sizeof (val);
+    nn_epbase_getopt (epbase, NN_SOL_SOCKET, option, &val, &sz);
+    nn_assert (sz == sizeof (val));
+    return val;
+}
+
+int nn_muxchan_attach (struct nn_muxchan *self, struct nn_epbase *epbase,
+    void (*rmfn) (struct nn_muxchan *self), void *owner)
+{
+    int rc;
+    size_t sz;
+
+    self->rmfn = rmfn;
+    self->owner = owner;
+
+    /*  Refuse the peers that can't talk to this socket. */
+    if (!nn_epbase_ispeer (epbase, self->peer)) {
+        nn_muxchan_close (self);
+        return -1;
+    }
+
+    nn_muxchan_initqueues (self, epbase);
+    sz = sizeof (self->protocol);
+    nn_epbase_getopt (epbase, NN_SOL_SOCKET, NN_PROTOCOL,
+        &self->protocol, &sz);
+    nn_assert (sz == sizeof (self->protocol));
+    rc = nn_pipebase_init (&self->pipebase, &nn_muxchan_pipebase_vfptr,
+        epbase);
+    nn_assert (rc == 0);
+    self->attached = 1;
+
+    /*  From now on, the mux side can wake the socket side up, unless it's
+        been closed in the meantime. */
+    nn_mutex_lock (&self->sync);
+    if (nn_slow (self->flags & NN_MUXCHAN_FLAG_MUX_DEAD)) {
+        nn_mutex_unlock (&self->sync);
+        nn_muxchan_close (self);
+        return -1;
+    }
+    self->flags &= ~NN_MUXCHAN_FLAG_SOCK_DEAD;
+    nn_mutex_unlock (&self->sync);
+
+    /*  Let the mux side reply to the peer before the socket can send any
+        messages, so that the reply precedes them on the wire. */
+    nn_muxchan_signal (self, NN_MUXCHAN_FLAG_MUX_DEAD, nn_tcpmux_getcp (),
+        &self->muxready);
+    nn_pipebase_activate (&self->pipebase);
+
+    return 0;
+}
+
+void nn_muxchan_close (struct nn_muxchan *self)
+{
+    int destroy;
+
+    /*  Make sure that the mux side won't signal the events any more. */
+    nn_mutex_lock (&self->sync);
+    self->flags |= NN_MUXCHAN_FLAG_SOCK_DEAD;
+    nn_mutex_unlock (&self->sync);
+
+    if (self->attached)
+        nn_pipebase_term (&self->pipebase);
+    nn_event_term (&self->sockin);
+    nn_event_term (&self->sockout);
+    nn_event_term (&self->sockready);
+    nn_event_term (&self->sockdetach);
+
+    /*  Ask the mux side to close the channel, unless it's closed already. */
+    nn_muxchan_signal (self, NN_MUXCHAN_FLAG_MUX_DEAD, nn_tcpmux_getcp (),
+        &self->muxdetach);
+
+    /*  If both sides are closed, deallocate the channel. */
+    nn_mutex_lock (&self->sync);
+    self->flags |= NN_MUXCHAN_FLAG_SOCK_DONE;
+    destroy = self->flags & NN_MUXCHAN_FLAG_MUX_DONE;
+    nn_mutex_unlock (&self->sync);
+    if (destroy)
+        nn_muxchan_destroy (self);
+}
+
+void nn_muxchan_muxclose (struct nn_muxchan *self)
+{
+    int destroy;
+
+    /*  Make sure that the socket side won't signal the events any more. */
+    nn_mutex_lock (&self->sync);
+    self->flags |= NN_MUXCHAN_FLAG_MUX_DEAD;
+    nn_mutex_unlock (&self->sync);
+
+    nn_event_term (&self->muxin);
+    nn_event_term (&self->muxout);
+    nn_event_term (&self->muxready);
+    nn_event_term (&self->muxdetach);
+
+    /*  Ask the socket side to close the channel, unless it's closed or not
+        attached yet. */
+    nn_muxchan_signal (self, NN_MUXCHAN_FLAG_SOCK_DEAD, self->sockcp,
+        &self->sockdetach);
+
+    /*  If both sides are closed, deallocate the channel. */
+    nn_mutex_lock (&self->sync);
+    self->flags |= NN_MUXCHAN_FLAG_MUX_DONE;
+    destroy = self->flags & NN_MUXCHAN_FLAG_SOCK_DONE;
+    nn_mutex_unlock (&self->sync);
+    if (destroy)
+        nn_muxchan_destroy (self);
+}
+
+static void nn_muxchan_destroy (struct nn_muxchan *self)
+{
+    /*  The queues are deallocated only now as either side may write to them
+        till the very end. The channels refused by the bound endpoint never
+        had any. */
+    if (self->attached) {
+        nn_msgqueue_term (&self->inq);
+        nn_msgqueue_term (&self->outq);
+    }
+    nn_hash_item_term (&self->hashitem);
+    nn_list_item_term (&self->muxitem);
+    nn_list_item_term (&self->senditem);
+    nn_list_item_term (&self->item);
+    nn_mutex_term (&self->sync);
+    nn_free (self);
+}
+
+static void nn_muxchan_signal (struct nn_muxchan *self, int deadflag,
+    struct nn_cp *cp, struct nn_event *event)
+{
+    /*  Same as nn_msgpipe_signal. The lock is needed only to make sure
+        the other side is not being closed while it's woken up. If its
+        completion port happens to be free, the event is processed in place
+        rather than by the worker thread. */
+    nn_mutex_lock (&self->sync);
+    if (!(self->flags & deadflag) && nn_event_post (event)) {
+        do {
+            nn_mutex_unlock (&self->sync);
+            nn_cp_flush (cp);
+            nn_mutex_lock (&self->sync);
+        } while (!(self->flags & deadflag) && nn_cp_pending (cp) &&
+            nn_cp_trylock (cp));
+    }
+    nn_mutex_unlock (&self->sync);
+}
+
+static int nn_muxchan_send (struct nn_pipebase *self, struct nn_msg *msg)
+{
+    int rc;
+    struct nn_muxchan *chan;
+
+    chan = nn_cont (self, struct nn_muxchan, pipebase);
+
+    /*  If the mux side is gone, the message is dropped. The pipe is not
+        writeable any more; it's going to be removed shortly. */
+    if (nn_slow (chan->flags & NN_MUXCHAN_FLAG_MUX_DEAD)) {
+        nn_msg_term (msg);
+        return 0;
+    }
+
+    rc = nn_msgqueue_send (&chan->outq, msg);
+    errnum_assert (rc >= 0, -rc);
+    if (!(rc & NN_MSGQUEUE_RELEASE))
+        nn_pipebase_sent (&chan->pipebase);
+    if (rc & NN_MSGQUEUE_SIGNAL)
+        nn_muxchan_signal (chan, NN_MUXCHAN_FLAG_MUX_DEAD,
+            nn_tcpmux_getcp (), &chan->muxin);
+
+    return 0;
+}
+
+static int nn_muxchan_precv (struct nn_pipebase *self, struct nn_msg *msg)
+{
+    int rc;
+    struct nn_muxchan *chan;
+
+    chan = nn_cont (self, struct nn_muxchan, pipebase);
+
+    rc = nn_msgqueue_recv (&chan->inq, msg);
+    errnum_assert (rc >= 0, -rc);
+    if (!(rc & NN_MSGQUEUE_RELEASE))
+        nn_pipebase_received (&chan->pipebase);
+    if (rc & NN_MSGQUEUE_SIGNAL)
+        nn_muxchan_signal (chan, NN_MUXCHAN_FLAG_MUX_DEAD,
+            nn_tcpmux_getcp (), &chan->muxout);
+
+    return 0;
+}
+
+int nn_muxchan_recv (struct nn_muxchan *self, struct nn_msg *msg)
+{
+    int rc;
+
+    rc = nn_msgqueue_recv (&self->outq, msg);
+    errnum_assert (rc >= 0, -rc);
+    if (rc & NN_MSGQUEUE_SIGNAL)
+        nn_muxchan_signal (self, NN_MUXCHAN_FLAG_SOCK_DEAD, self->sockcp,
+            &self->sockout);
+    return rc;
+}
+
+int nn_muxchan_deliver (struct nn_muxchan *self, struct nn_msg *msg)
+{
+    int rc;
+
+    rc = nn_msgqueue_send (&self->inq, msg);
+    errnum_assert (rc >= 0, -rc);
+    if (rc & NN_MSGQUEUE_SIGNAL)
+        nn_muxchan_signal (self, NN_MUXCHAN_FLAG_SOCK_DEAD, self->sockcp,
+            &self->sockin);
+    return rc & NN_MSGQUEUE_RELEASE ? 1 : 0;
+}
+
+void nn_muxchan_ready (struct nn_muxchan *self)
+{
+    nn_muxchan_signal (self, NN_MUXCHAN_FLAG_SOCK_DEAD, self->sockcp,
+        &self->sockready);
+}
+
+static void nn_muxchan_sockevent (const struct nn_cp_sink **self,
+    struct nn_event *event)
+{
+    struct nn_muxchan *chan;
+
+    chan = nn_cont (self, struct nn_muxchan, socksink);
+
+    if (event == &chan->sockin) {
+        nn_pipebase_received (&chan->pipebase);
+        return;
+    }
+
+    if (event == &chan->sockout) {
+        nn_pipebase_sent (&chan->pipebase);
+        return;
+    }
+
+    /*  The peer has accepted the channel. If its socket can't talk to this
+        one, the channel is closed the same way as if the peer closed it. */
+    if (event == &chan->sockready) {
+        if (nn_fast (nn_pipebase_ispeer (&chan->pipebase, chan->peer))) {
+            nn_pipebase_activate (&chan->pipebase);
+            return;
+        }
+        chan->rmfn (chan);
+        nn_muxchan_close (chan);
+        return;
+    }
+
+    /*  The mux side has closed the channel. Be aware that the channel may
+        be deallocated here. */
+    if (event == &chan->sockdetach) {
+        chan->rmfn (chan);
+        nn_muxchan_close (chan);
+        return;
+    }
+
+    nn_assert (0);
+}
+
+static void nn_muxchan_muxevent (const struct nn_cp_sink **self,
+    struct nn_event *event)
+{
+    struct nn_muxchan *chan;
+
+    chan = nn_cont (self, struct nn_muxchan, muxsink);
+
+    if (event == &chan->muxin) {
+        nn_mux_chanin (chan->mux, chan);
+        return;
+    }
+
+    if (event == &chan->muxout) {
+        nn_mux_chanout (chan->mux, chan);
+        return;
+    }
+
+    if (event == &chan->muxready) {
+        nn_mux_chanready (chan->mux, chan);
+        return;
+    }
+
+    if (event == &chan->muxdetach) {
+        nn_mux_chandetach (chan->mux, chan);
+        return;
+    }
+
+    nn_assert (0);
+}
+
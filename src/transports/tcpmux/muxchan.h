@@ -0,0 +1,151 @@
+/*
+    Copyright (c) 2013 250bpm s.r.o.
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"),
+    to deal in the Software without restriction, including without limitation
+    the rights to use, copy, modify, merge, publish, distribute, sublicense,
+    and/or sell copies of the Software, and to permit persons to whom
+    the Software is furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included
+    in all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+    THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+    FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+    IN THE SOFTWARE.
+*/
+
+#ifndef NN_MUXCHAN_INCLUDED
+#define NN_MUXCHAN_INCLUDED
+
+#include "../../transport.h"
+
+#include "../inproc/msgqueue.h"
+
+#include "../../aio/aio.h"
+
+#include "../../utils/mutex.h"
+#include "../../utils/hash.h"
+#include "../../utils/list.h"
+#include "../../utils/cacheline.h"
+
+#include <stdint.h>
+
+struct nn_mux;
+
+/*  Channel is a pipe of an SP socket carried by a multiplexed connection.
+    It has two sides. The socket side is used by the threads of the socket,
+    the mux side by the completion port of the connection (see
+    nn_tcpmux_getcp). Messages are passed between them through a pair of
+    lock-free queues, the same way the inproc transport passes them, and
+    the sides wake each other up by posting events. */
+
+#define NN_MUXCHAN_FLAG_SOCK_DEAD 1
+#define NN_MUXCHAN_FLAG_MUX_DEAD 2
+#define NN_MUXCHAN_FLAG_SOCK_DONE 4
+#define NN_MUXCHAN_FLAG_MUX_DONE 8
+
+/*  States of the mux side. */
+#define NN_MUXCHAN_STATE_OPENING 1
+#define NN_MUXCHAN_STATE_ACCEPTING 2
+#define NN_MUXCHAN_STATE_OPEN 3
+
+struct nn_muxchan {
+
+    /*  Critical section to guard the lifetime of the channel. The messages
+        themselves are passed without locking. */
+    struct nn_mutex sync;
+
+    /*  Any combination of the flags defined above. Modified only while
+        'sync' is locked. The channels accepted by a bound endpoint start
+        with the socket side dead, as there's no socket side to wake up
+        until the endpoint picks the channel up. */
+    volatile int flags;
+
+    /*  Protocol of the peer socket. Set by the mux side before the socket
+        side is told that the channel is open. */
+    int peer;
+
+    /*  Socket side. The pipe is initialised once the socket side is
+        attached to an endpoint. 'inq' holds the messages received from
+        the connection. */
+    struct nn_pipebase pipebase;
+    int attached;
+    struct nn_msgqueue inq;
+    struct nn_cp *sockcp;
+    const struct nn_cp_sink *socksink;
+    struct nn_event sockin;
+    struct nn_event sockout;
+    struct nn_event sockready;
+    struct nn_event sockdetach;
+
+    /*  Function the socket side calls to remove the channel from its
+        endpoint once the channel is closed by the mux side. The endpoint
+        is not supposed to close the channel itself. */
+    void (*rmfn) (struct nn_muxchan *self);
+    void *owner;
+    struct nn_list_item item;
+
+    /*  Protocol of the socket, for the mux side to announce to the peer. */
+    int protocol;
+
+    NN_CACHELINE_PAD (pad);
+
+    /*  Mux side. 'outq' holds the messages to send to the connection. */
+    struct nn_mux *mux;
+    uint32_t id;
+    int state;
+    int outready;
+    struct nn_msgqueue outq;
+    const struct nn_cp_sink *muxsink;
+    struct nn_event muxin;
+    struct nn_event muxout;
+    struct nn_event muxready;
+    struct nn_event muxdetach;
+    struct nn_hash_item hashitem;
+    struct nn_list_item muxitem;
+    struct nn_list_item senditem;
+};
+
+/*  Creates a channel with the socket side attached to a connecting endpoint.
+    Must be called by the socket. The connection is assigned separately using
+    nn_mux_open. */
+struct nn_muxchan *nn_muxchan_create (struct nn_epbase *epbase,
+    void (*rmfn) (struct nn_muxchan *self), void *owner);
+
+/*  Creates a channel opened by the peer of the connection, with the socket
+    side not attached yet. Called by the connection. */
+struct nn_muxchan *nn_muxchan_create_accepted (struct nn_mux *mux,
+    uint32_t id, int peer, struct nn_cp *sockcp);
+
+/*  Attaches the socket side of a channel created by nn_muxchan_create_accepted
+    to the bound endpoint. If the peer's protocol doesn't match or if the
+    connection is closed in the meantime, the channel is closed and -1 is
+    returned. Must be called by the socket. */
+int nn_muxchan_attach (struct nn_muxchan *self, struct nn_epbase *epbase,
+    void (*rmfn) (struct nn_muxchan *self), void *owner);
+
+/*  Closes the socket side of the channel. The channel may be deallocated
+    by this call. Must be called by the socket. */
+void nn_muxchan_close (struct nn_muxchan *self);
+
+/*  Closes the mux side of the channel, once the connection has removed it
+    from its tables. The channel may be deallocated by this call. */
+void nn_muxchan_muxclose (struct nn_muxchan *self);
+
+/*  Functions used by the mux side to pass messages. nn_muxchan_recv returns
+    a combination of NN_MSGQUEUE_* flags, nn_muxchan_deliver returns 1 if
+    the queue of the socket side is full. */
+int nn_muxchan_recv (struct nn_muxchan *self, struct nn_msg *msg);
+int nn_muxchan_deliver (struct nn_muxchan *self, struct nn_msg *msg);
+
+/*  Tells the socket side that the peer has accepted the channel. */
+void nn_muxchan_ready (struct nn_muxchan *self);
+
+#endif
+
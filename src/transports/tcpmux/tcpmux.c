@@ -0,0 +1,369 @@
+/*
+    Copyright (c) 2013 250bpm s.r.o.
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"),
+    to deal in the Software without restriction, including without limitation
+    the rights to use, copy, modify, merge, publish, distribute, sublicense,
+    and/or sell copies of the Software, and to permit persons to whom
+    the Software is furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included
+    in all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+    THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+    FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+    IN THE SOFTWARE.
+*/
+
+#include "tcpmux.h"
+#include "mux.h"
+#include "muxb.h"
+#include "muxc.h"
+
+#include "../../tcpmux.h"
+
+#include "../../aio/aio.h"
+
+#include "../../utils/err.h"
+#include "../../utils/fast.h"
+#include "../../utils/cont.h"
+#include "../../utils/alloc.h"
+#include "../../utils/addr.h"
+#include "../../utils/list.h"
+#include "../../utils/sleep.h"
+
+#include <string.h>
+
+#define NN_TCPMUX_BACKLOG 100
+
+/*  Listening socket shared by all the endpoints bound to the same
+    "interface:port" address. */
+struct nn_tcpmux_listener {
+    const struct nn_cp_sink *sink;
+    struct nn_usock usock;
+    char addr [NN_SOCKADDR_MAX + 1];
+    struct nn_list muxbs;
+    struct nn_list_item item;
+};
+
+/*  Global state of the transport. Guarded by the lock of the completion
+    port. */
+struct nn_tcpmux_ctx {
+    struct nn_cp cp;
+    struct nn_list muxes;
+    struct nn_list listeners;
+
+    /*  Number of connections and listening sockets not deallocated yet. */
+    int count;
+};
+
+static struct nn_tcpmux_ctx self;
+
+/*  Private functions. */
+static struct nn_tcpmux_listener *nn_tcpmux_getlistener (const char *addr);
+static int nn_tcpmux_listen (struct nn_tcpmux_listener *listener);
+
+/*  Event sink of the listening sockets. */
+static void nn_tcpmux_accepted (const struct nn_cp_sink **sink,
+    struct nn_usock *usock, int s);
+static void nn_tcpmux_closed (const struct nn_cp_sink **sink,
+    struct nn_usock *usock);
+static const struct nn_cp_sink nn_tcpmux_sink = {
+    NULL,
+    NULL,
+    NULL,
+    nn_tcpmux_accepted,
+    NULL,
+    nn_tcpmux_closed,
+    NULL,
+    NULL
+};
+
+/*  nn_transport interface. */
+static void nn_tcpmux_init (void);
+static void nn_tcpmux_term (void);
+static int nn_tcpmux_bind (const char *addr, void *hint,
+    struct nn_epbase **epbase);
+static int nn_tcpmux_connect (const char *addr, void *hint,
+    struct nn_epbase **epbase);
+
+static struct nn_transport nn_tcpmux_vfptr = {
+    "tcpmux",
+    NN_TCPMUX,
+    0,
+    nn_tcpmux_init,
+    nn_tcpmux_term,
+    nn_tcpmux_bind,
+    nn_tcpmux_connect,
+    NULL
+};
+
+struct nn_transport *nn_tcpmux = &nn_tcpmux_vfptr;
+
+static void nn_tcpmux_init (void)
+{
+    int rc;
+
+    rc = nn_cp_init (&self.cp);
+    errnum_assert (rc == 0, -rc);
+    nn_list_init (&self.muxes);
+    nn_list_init (&self.listeners);
+    self.count = 0;
+}
+
+static void nn_tcpmux_term (void)
+{
+    struct nn_list_item *it;
+    struct nn_mux *mux;
+    int count;
+
+    /*  All the sockets are closed by now, so all the listening sockets are
+        being closed as well. Close the connections accepted from the peers
+        and wait till everything is deallocated. */
+    nn_cp_lock (&self.cp);
+    it = nn_list_begin (&self.muxes);
+    while (it != nn_list_end (&self.muxes)) {
+        mux = nn_cont (it, struct nn_mux, item);
+        it = nn_list_next (&self.muxes, it);
+        nn_mux_close (mux);
+    }
+    nn_cp_unlock (&self.cp);
+    while (1) {
+        nn_cp_lock (&self.cp);
+        count = self.count;
+        nn_cp_unlock (&self.cp);
+        if (!count)
+            break;
+        nn_sleep (1);
+    }
+
+    nn_assert (nn_list_empty (&self.listeners));
+    nn_list_term (&self.listeners);
+    nn_list_term (&self.muxes);
+    nn_cp_term (&self.cp);
+}
+
+static int nn_tcpmux_bind (const char *addr, void *hint,
+    struct nn_epbase **epbase)
+{
+    int rc;
+
+    rc = nn_cp_start (&self.cp);
+    if (nn_slow (rc < 0))
+        return rc;
+    return nn_muxb_create (addr, hint, epbase);
+}
+
+static int nn_tcpmux_connect (const char *addr, void *hint,
+    struct nn_epbase **epbase)
+{
+    int rc;
+
+    rc = nn_cp_start (&self.cp);
+    if (nn_slow (rc < 0))
+        return rc;
+    return nn_muxc_create (addr, hint, epbase);
+}
+
+struct nn_cp *nn_tcpmux_getcp (void)
+{
+    return &self.cp;
+}
+
+struct nn_mux *nn_tcpmux_getmux (const char *addr, size_t addrlen)
+{
+    struct nn_list_item *it;
+    struct nn_mux *mux;
+
+    for (it = nn_list_begin (&self.muxes); it != nn_list_end (&self.muxes);
+          it = nn_list_next (&self.muxes, it)) {
+        mux = nn_cont (it, struct nn_mux, item);
+        if (nn_mux_isusable (mux) && strlen (mux->addr) == addrlen &&
+              memcmp (mux->addr, addr, addrlen) == 0)
+            return mux;
+    }
+
+    mux = nn_mux_create (addr, addrlen);
+    nn_list_insert (&self.muxes, &mux->item, nn_list_end (&self.muxes));
+    ++self.count;
+    return mux;
+}
+
+void nn_tcpmux_rmmux (struct nn_mux *mux)
+{
+    nn_list_erase (&self.muxes, &mux->item);
+    --self.count;
+}
+
+int nn_tcpmux_addb (struct nn_muxb *muxb, const char *addr, size_t addrlen)
+{
+    int rc;
+    struct nn_list_item *it;
+    struct nn_tcpmux_listener *listener;
+    char buf [NN_SOCKADDR_MAX + 1];
+
+    memcpy (buf, addr, addrlen);
+    buf [addrlen] = 0;
+    listener = nn_tcpmux_getlistener (buf);
+
+    if (listener) {
+        for (it = nn_list_begin (&listener->muxbs);
+              it != nn_list_end (&listener->muxbs);
+              it = nn_list_next (&listener->muxbs, it))
+            if (strcmp (nn_cont (it, struct nn_muxb, item)->name,
+                  muxb->name) == 0)
+                return -EADDRINUSE;
+    }
+    else {
+        listener = nn_alloc (sizeof (struct nn_tcpmux_listener),
+            "listener (tcpmux)");
+        alloc_assert (listener);
+        listener->sink = &nn_tcpmux_sink;
+        memcpy (listener->addr, buf, addrlen + 1);
+        nn_list_init (&listener->muxbs);
+        nn_list_item_init (&listener->item);
+        nn_list_insert (&self.listeners, &listener->item,
+            nn_list_end (&self.listeners));
+        rc = nn_tcpmux_listen (listener);
+        if (nn_slow (rc < 0))
+            return rc;
+    }
+
+    nn_list_insert (&listener->muxbs, &muxb->item,
+        nn_list_end (&listener->muxbs));
+    muxb->listener = listener;
+    return 0;
+}
+
+void nn_tcpmux_rmb (struct nn_muxb *muxb)
+{
+    struct nn_tcpmux_listener *listener;
+
+    listener = (struct nn_tcpmux_listener*) muxb->listener;
+    nn_list_erase (&listener->muxbs, &muxb->item);
+
+    /*  Once there's no endpoint bound to it, close the listening socket.
+        The connections accepted from it stay open. */
+    if (nn_list_empty (&listener->muxbs)) {
+        nn_list_erase (&self.listeners, &listener->item);
+        nn_usock_close (&listener->usock);
+    }
+}
+
+struct nn_muxb *nn_tcpmux_findb (const char *addr, const char *name,
+    size_t namelen)
+{
+    struct nn_list_item *it;
+    struct nn_tcpmux_listener *listener;
+    struct nn_muxb *muxb;
+
+    listener = nn_tcpmux_getlistener (addr);
+    if (!listener)
+        return NULL;
+    for (it = nn_list_begin (&listener->muxbs);
+          it != nn_list_end (&listener->muxbs);
+          it = nn_list_next (&listener->muxbs, it)) {
+        muxb = nn_cont (it, struct nn_muxb, item);
+        if (muxb->namelen == namelen &&
+              memcmp (muxb->name, name, namelen) == 0)
+            return muxb;
+    }
+    return NULL;
+}
+
+static struct nn_tcpmux_listener *nn_tcpmux_getlistener (const char *addr)
+{
+    struct nn_list_item *it;
+    struct nn_tcpmux_listener *listener;
+
+    for (it = nn_list_begin (&self.listeners);
+          it != nn_list_end (&self.listeners);
+          it = nn_list_next (&self.listeners, it)) {
+        listener = nn_cont (it, struct nn_tcpmux_listener, item);
+        if (strcmp (listener->addr, addr) == 0)
+            return listener;
+    }
+    return NULL;
+}
+
+/*  Opens the listening socket. If that fails, the listener is closed. */
+static int nn_tcpmux_listen (struct nn_tcpmux_listener *listener)
+{
+    int rc;
+    int port;
+    const char *colon;
+    struct sockaddr_storage ss;
+    nn_socklen sslen;
+
+    /*  The address was validated by the endpoint already. */
+    memset (&ss, 0, sizeof (ss));
+    colon = strrchr (listener->addr, ':');
+    port = nn_addr_parse_port (colon + 1, strlen (colon + 1));
+    errnum_assert (port > 0, -port);
+    rc = nn_addr_parse_local (listener->addr, colon - listener->addr,
+        NN_ADDR_IPV4ONLY, &ss, &sslen);
+    errnum_assert (rc == 0, -rc);
+    if (ss.ss_family == AF_INET)
+        ((struct sockaddr_in*) &ss)->sin_port = htons (port);
+    else if (ss.ss_family == AF_INET6)
+        ((struct sockaddr_in6*) &ss)->sin6_port = htons (port);
+    else
+        nn_assert (0);
+
+    rc = nn_usock_init (&listener->usock, &listener->sink, ss.ss_family,
+        SOCK_STREAM, IPPROTO_TCP, -1, -1, &self.cp);
+    if (nn_slow (rc < 0)) {
+        nn_list_erase (&self.listeners, &listener->item);
+        nn_list_term (&listener->muxbs);
+        nn_list_item_term (&listener->item);
+        nn_free (listener);
+        return rc;
+    }
+    ++self.count;
+    rc = nn_usock_bind (&listener->usock, (struct sockaddr*) &ss, sslen);
+    if (nn_slow (rc < 0))
+        goto fail;
+    rc = nn_usock_listen (&listener->usock, NN_TCPMUX_BACKLOG);
+    if (nn_slow (rc < 0))
+        goto fail;
+    nn_usock_accept (&listener->usock);
+    return 0;
+
+fail:
+    nn_list_erase (&self.listeners, &listener->item);
+    nn_usock_close (&listener->usock);
+    return rc;
+}
+
+static void nn_tcpmux_accepted (const struct nn_cp_sink **sink,
+    struct nn_usock *usock, int s)
+{
+    struct nn_tcpmux_listener *listener;
+    struct nn_mux *mux;
+
+    listener = nn_cont (sink, struct nn_tcpmux_listener, sink);
+
+    mux = nn_mux_create_accepted (usock, s, listener->addr);
+    nn_list_insert (&self.muxes, &mux->item, nn_list_end (&self.muxes));
+    ++self.count;
+    nn_usock_accept (usock);
+}
+
+static void nn_tcpmux_closed (const struct nn_cp_sink **sink,
+    struct nn_usock *usock)
+{
+    struct nn_tcpmux_listener *listener;
+
+    listener = nn_cont (sink, struct nn_tcpmux_listener, sink);
+
+    nn_list_term (&listener->muxbs);
+    nn_list_item_term (&listener->item);
+    nn_free (listener);
+    --self.count;
+}
+
@@ -0,0 +1,59 @@
+/*
+    Copyright (c) 2013 250bpm s.r.o.
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"),
+    to deal in the Software without restriction, including without limitation
+    the rights to use, copy, modify, merge, publish, distribute, sublicense,
+    and/or sell copies of the Software, and to permit persons to whom
+    the Software is furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included
+    in all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+    THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+    FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+    IN THE SOFTWARE.
+*/
+
+#ifndef NN_TCPMUX_TRANSPORT_INCLUDED
+#define NN_TCPMUX_TRANSPORT_INCLUDED
+
+#include "../../transport.h"
+
+#include <stddef.h>
+
+struct nn_mux;
+struct nn_muxb;
+
+extern struct nn_transport *nn_tcpmux;
+
+/*  All the multiplexed connections, as well as the listening sockets, are
+    handled by a single completion port shared by the whole process. Unless
+    stated otherwise, the functions below have to be called with it locked. */
+struct nn_cp *nn_tcpmux_getcp (void);
+
+/*  Returns the connection to the specified "host:port" address, opening
+    a new one if there's none that can take new channels. */
+struct nn_mux *nn_tcpmux_getmux (const char *addr, size_t addrlen);
+
+/*  Called by the connection once it's closed and about to be deallocated. */
+void nn_tcpmux_rmmux (struct nn_mux *mux);
+
+/*  Registers the bound endpoint under its name with the listening socket for
+    the "interface:port" address, opening the socket if needed. Returns
+    -EADDRINUSE if the name is already taken. */
+int nn_tcpmux_addb (struct nn_muxb *muxb, const char *addr, size_t addrlen);
+void nn_tcpmux_rmb (struct nn_muxb *muxb);
+
+/*  Returns the bound endpoint that registered the name with the listening
+    socket for the address, NULL if there's none. */
+struct nn_muxb *nn_tcpmux_findb (const char *addr, const char *name,
+    size_t namelen);
+
+#endif
+
@@ -0,0 +1,805 @@
+/*
+    Copyright (c) 2013 250bpm s.r.o.
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"),
+    to deal in the Software without restriction, including without limitation
+    the rights to use, copy, modify, merge, publish, distribute, sublicense,
+    and/or sell copies of the Software, and to permit persons to whom
+    the Software is furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included
+    in all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+    THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+    FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+    IN THE SOFTWARE.
+*/
+
+#if !defined NN_HAVE_WINDOWS
+
+#include "udp.h"
+
+#include "../../udp.h"
+#include "../../pubsub.h"
+#include "../../survey.h"
+#include "../../bus.h"
+
+#include "../../utils/err.h"
+#include "../../utils/cont.h"
+#include "../../utils/alloc.h"
+#include "../../utils/fast.h"
+#include "../../utils/wire.h"
+#include "../../utils/addr.h"
+
+#include <string.h>
+#include <netinet/in.h>
+
+/*  Maximum size of a UDP datagram over IPv4. Each message is sent as a single
+    datagram, prefixed by the protocol header. Messages that don't fit into
+    a datagram are dropped. */
+#define NN_UDP_MAX_DGRAM 65507
+
+/*  Number of datagrams received by a single system call. Each one of them
+    has a buffer of its own, big enough for the largest datagram. */
+#ifndef NN_UDP_RECV_BATCH
+#define NN_UDP_RECV_BATCH 8
+#endif
+
+/*  Maximum number of peers a bound endpoint sends the messages to. */
+#ifndef NN_UDP_MAX_PEERS
+#define NN_UDP_MAX_PEERS 64
+#endif
+
+/*  Peer of a bound endpoint is forgotten if nothing was received from it
+    for this many keep-alive intervals. */
+#define NN_UDP_PEER_IVLS 3
+
+/*  Flag in the protocol header marking a keep-alive datagram. Keep-alives
+    carry no message. */
+#define NN_UDP_HDR_KEEPALIVE 1
+
+/*  States of the inbound state machine. While in RECEIVING state, the
+    endpoint is waiting for nn_usock_recvdgrams to complete synchronously.
+    If it does, the state changes to RECEIVED. IDLE means that the datagrams
+    are going to be received asynchronously. In READY state there's a message
+    waiting to be received by the user. */
+#define NN_UDP_INSTATE_IDLE 1
+#define NN_UDP_INSTATE_RECEIVING 2
+#define NN_UDP_INSTATE_RECEIVED 3
+#define NN_UDP_INSTATE_READY 4
+
+/*  UDP endpoint. As there are no connections, each endpoint has exactly one
+    pipe. The connected endpoint exchanges messages with the single peer it
+    is connected to and keeps sending keep-alives to it. The bound endpoint
+    receives messages from anyone and sends each message to all the peers
+    it has heard from recently, using as few system calls as possible. */
+struct nn_udp {
+
+    /*  Event sink. */
+    const struct nn_cp_sink *sink;
+
+    /*  This object is an endpoint. */
+    struct nn_epbase epbase;
+
+    /*  Pipe to exchange messages with the user of the library. */
+    struct nn_pipebase pipebase;
+
+    /*  The underlying UDP socket. */
+    struct nn_usock usock;
+
+    /*  1 if the endpoint was created by nn_connect, 0 if by nn_bind. */
+    int connected;
+
+    /*  Subscribers don't send messages and publishers don't receive them.
+        The subscriptions are not forwarded, the subscriber filters the
+        messages itself. */
+    int nosend;
+    int norecv;
+
+    /*  Protocol header prefixed to each datagram and the keep-alive. */
+    uint8_t protohdr [8];
+    uint8_t keepalive [8];
+
+    /*  The connected endpoint sends a keep-alive each time the timer
+        expires, the bound endpoint checks which peers are still alive. */
+    struct nn_timer timer;
+    int ivl;
+
+    /*  Peers of the bound endpoint and the number of keep-alive intervals
+        since anything was received from each one of them. */
+    struct sockaddr_storage peers [NN_UDP_MAX_PEERS];
+    nn_socklen peerlens [NN_UDP_MAX_PEERS];
+    int idle [NN_UDP_MAX_PEERS];
+    int npeers;
+
+    /*  State of the inbound state machine, the batch of datagrams received,
+        the position of the next one to process and the message received. */
+    int instate;
+    uint8_t *inbuf;
+    struct nn_usock_dgram dgrams [NN_UDP_RECV_BATCH];
+    int dgramcount;
+    int dgrampos;
+    struct nn_msg inmsg;
+
+    /*  Error encountered while connecting the socket during the
+        initialisation. */
+    int errnum;
+};
+
+struct nn_udp_optset {
+    struct nn_optset base;
+    int keepalive;
+};
+
+static void nn_udp_optset_destroy (struct nn_optset *self);
+static int nn_udp_optset_setopt (struct nn_optset *self, int option,
+    const void *optval, size_t optvallen);
+static int nn_udp_optset_getopt (struct nn_optset *self, int option,
+    void *optval, size_t *optvallen);
+static const struct nn_optset_vfptr nn_udp_optset_vfptr = {
+    nn_udp_optset_destroy,
+    nn_udp_optset_setopt,
+    nn_udp_optset_getopt
+};
+
+/*  nn_transport interface. */
+static void nn_udp_init (void);
+static void nn_udp_term (void);
+static int nn_udp_bind (const char *addr, void *hint,
+    struct nn_epbase **epbase);
+static int nn_udp_connect (const char *addr, void *hint,
+    struct nn_epbase **epbase);
+static struct nn_optset *nn_udp_optset ();
+
+static struct nn_transport nn_udp_vfptr = {
+    "udp",
+    NN_UDP,
+    0,
+    nn_udp_init,
+    nn_udp_term,
+    nn_udp_bind,
+    nn_udp_connect,
+    nn_udp_optset
+};
+
+struct nn_transport *nn_udp = &nn_udp_vfptr;
+
+/*  Private functions. */
+static int nn_udp_create (const char *addr, void *hint,
+    struct nn_epbase **epbase, int connected);
+static int nn_udp_ep_init (struct nn_udp *self, const char *addr,
+    void *hint, int connected);
+static int nn_udp_resolve (const char *addr, int connected,
+    struct sockaddr_storage *local, nn_socklen *locallen,
+    struct sockaddr_storage *remote, nn_socklen *remotelen);
+static int nn_udp_setup (struct nn_udp *self,
+    struct sockaddr_storage *local, nn_socklen locallen,
+    struct sockaddr_storage *remote, nn_socklen remotelen);
+static void nn_udp_next (struct nn_udp *self);
+static int nn_udp_parse (struct nn_udp *self, struct nn_usock_dgram *dgram);
+static void nn_udp_addpeer (struct nn_udp *self,
+    struct sockaddr_storage *addr, nn_socklen addrlen);
+static void nn_udp_sendkeepalive (struct nn_udp *self);
+
+/*  Implementation of nn_epbase interface. */
+static int nn_udp_close (struct nn_epbase *self);
+static const struct nn_epbase_vfptr nn_udp_epbase_vfptr =
+    {nn_udp_close};
+
+/*  Implementation of nn_pipebase interface. */
+static int nn_udp_send (struct nn_pipebase *self, struct nn_msg *msg);
+static int nn_udp_recv (struct nn_pipebase *self, struct nn_msg *msg);
+static const struct nn_pipebase_vfptr nn_udp_pipebase_vfptr = {
+    nn_udp_send,
+    nn_udp_recv
+};
+
+/*  CONNECTING state. The socket is being connected to the peer. For UDP,
+    this is done synchronously. */
+static void nn_udp_connecting_connected (const struct nn_cp_sink **self,
+    struct nn_usock *usock);
+static void nn_udp_connecting_err (const struct nn_cp_sink **self,
+    struct nn_usock *usock, int errnum);
+static const struct nn_cp_sink nn_udp_state_connecting = {
+    NULL,
+    NULL,
+    nn_udp_connecting_connected,
+    NULL,
+    nn_udp_connecting_err,
+    NULL,
+    NULL,
+    NULL
+};
+
+/*  ACTIVE state. */
+static void nn_udp_active_received (const struct nn_cp_sink **self,
+    struct nn_usock *usock);
+static void nn_udp_active_err (const struct nn_cp_sink **self,
+    struct nn_usock *usock, int errnum);
+static void nn_udp_active_timeout (const struct nn_cp_sink **self,
+    struct nn_timer *timer);
+static const struct nn_cp_sink nn_udp_state_active = {
+    nn_udp_active_received,
+    NULL,
+    NULL,
+    NULL,
+    nn_udp_active_err,
+    NULL,
+    nn_udp_active_timeout,
+    NULL
+};
+
+/*  FAILED state. The initialisation have failed and the socket is being
+    closed. It's not registered with the completion port yet, so it's closed
+    synchronously. */
+static void nn_udp_failed_closed (const struct nn_cp_sink **self,
+    struct nn_usock *usock);
+static const struct nn_cp_sink nn_udp_state_failed = {
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    nn_udp_failed_closed,
+    NULL,
+    NULL
+};
+
+/*  TERMINATING state. */
+static void nn_udp_terminating_closed (const struct nn_cp_sink **self,
+    struct nn_usock *usock);
+static const struct nn_cp_sink nn_udp_state_terminating = {
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    nn_udp_terminating_closed,
+    NULL,
+    NULL
+};
+
+static void nn_udp_init (void)
+{
+}
+
+static void nn_udp_term (void)
+{
+}
+
+static int nn_udp_bind (const char *addr, void *hint,
+    struct nn_epbase **epbase)
+{
+    return nn_udp_create (addr, hint, epbase, 0);
+}
+
+static int nn_udp_connect (const char *addr, void *hint,
+    struct nn_epbase **epbase)
+{
+    return nn_udp_create (addr, hint, epbase, 1);
+}
+
+static int nn_udp_create (const char *addr, void *hint,
+    struct nn_epbase **epbase, int connected)
+{
+    int rc;
+    struct nn_udp *udp;
+
+    udp = nn_alloc (sizeof (struct nn_udp), "udp");
+    alloc_assert (udp);
+    rc = nn_udp_ep_init (udp, addr, hint, connected);
+    if (nn_slow (rc != 0)) {
+        nn_free (udp);
+        return rc;
+    }
+    *epbase = &udp->epbase;
+
+    return 0;
+}
+
+static int nn_udp_ep_init (struct nn_udp *self, const char *addr,
+    void *hint, int connected)
+{
+    int rc;
+    int i;
+    int protocol;
+    int sndbuf;
+    int rcvbuf;
+    size_t sz;
+    struct sockaddr_storage local;
+    nn_socklen locallen;
+    struct sockaddr_storage remote;
+    nn_socklen remotelen;
+
+    rc = nn_udp_resolve (addr, connected, &local, &locallen,
+        &remote, &remotelen);
+    if (nn_slow (rc < 0))
+        return rc;
+
+    nn_epbase_init (&self->epbase, &nn_udp_epbase_vfptr, addr, hint);
+    self->connected = connected;
+
+    /*  The delivery is not reliable, thus only the protocols that can
+        live with lost messages can use the transport. */
+    sz = sizeof (protocol);
+    nn_epbase_getopt (&self->epbase, NN_SOL_SOCKET, NN_PROTOCOL,
+        &protocol, &sz);
+    nn_assert (sz == sizeof (protocol));
+    if (protocol / 16 != NN_PROTO_PUBSUB && protocol / 16 != NN_PROTO_BUS &&
+          protocol / 16 != NN_PROTO_SURVEY) {
+        nn_epbase_term (&self->epbase);
+        return -EPROTONOSUPPORT;
+    }
+    self->nosend = protocol == NN_SUB;
+    self->norecv = protocol == NN_PUB;
+
+    /*  Open the socket. */
+    sz = sizeof (sndbuf);
+    nn_epbase_getopt (&self->epbase, NN_SOL_SOCKET, NN_SNDBUF, &sndbuf, &sz);
+    nn_assert (sz == sizeof (sndbuf));
+    sz = sizeof (rcvbuf);
+    nn_epbase_getopt (&self->epbase, NN_SOL_SOCKET, NN_RCVBUF, &rcvbuf, &sz);
+    nn_assert (sz == sizeof (rcvbuf));
+    rc = nn_usock_init (&self->usock, &self->sink, AF_INET, SOCK_DGRAM,
+        IPPROTO_UDP, sndbuf, rcvbuf, nn_epbase_getcp (&self->epbase));
+    if (nn_slow (rc < 0)) {
+        nn_epbase_term (&self->epbase);
+        return rc;
+    }
+
+    /*  Bind the socket and connect it to the peer, if any. */
+    rc = nn_udp_setup (self, &local, locallen, &remote, remotelen);
+    if (nn_slow (rc < 0)) {
+        self->sink = &nn_udp_state_failed;
+        nn_usock_close (&self->usock);
+        nn_epbase_term (&self->epbase);
+        return rc;
+    }
+
+    /*  Prepare the protocol header and the keep-alive. */
+    memcpy (self->protohdr, "\0\0SP\0\0\0\0", 8);
+    nn_puts (self->protohdr + 4, (uint16_t) protocol);
+    memcpy (self->keepalive, self->protohdr, 8);
+    self->keepalive [7] |= NN_UDP_HDR_KEEPALIVE;
+
+    self->sink = &nn_udp_state_active;
+    self->npeers = 0;
+    self->instate = NN_UDP_INSTATE_IDLE;
+    self->inbuf = nn_alloc (NN_UDP_RECV_BATCH * NN_UDP_MAX_DGRAM,
+        "udp datagrams");
+    alloc_assert (self->inbuf);
+    for (i = 0; i != NN_UDP_RECV_BATCH; ++i) {
+        self->dgrams [i].buf = self->inbuf + i * NN_UDP_MAX_DGRAM;
+        self->dgrams [i].size = NN_UDP_MAX_DGRAM;
+    }
+    self->dgramcount = 0;
+    self->dgrampos = 0;
+    nn_msg_init (&self->inmsg, 0);
+
+    /*  Start the keep-alive timer. The connected endpoint announces itself
+        to the peer straight away. */
+    sz = sizeof (self->ivl);
+    nn_epbase_getopt (&self->epbase, NN_UDP, NN_UDP_KEEPALIVE,
+        &self->ivl, &sz);
+    nn_assert (sz == sizeof (self->ivl));
+    nn_timer_init (&self->timer, &self->sink,
+        nn_epbase_getcp (&self->epbase));
+    nn_timer_start (&self->timer, self->ivl);
+    if (connected)
+        nn_udp_sendkeepalive (self);
+
+    /*  Create the pipe. */
+    rc = nn_pipebase_init (&self->pipebase, &nn_udp_pipebase_vfptr,
+        &self->epbase);
+    nn_assert (rc == 0);
+    nn_pipebase_activate (&self->pipebase);
+
+    /*  Start receiving the datagrams. */
+    nn_udp_next (self);
+
+    return 0;
+}
+
+static int nn_udp_resolve (const char *addr, int connected,
+    struct sockaddr_storage *local, nn_socklen *locallen,
+    struct sockaddr_storage *remote, nn_socklen *remotelen)
+{
+    int rc;
+    const char *end;
+    const char *semicolon;
+    const char *colon;
+    const char *host;
+    int port;
+
+    /*  The bound address is in the form of interface:port, the connected
+        one in the form of [interface;]host:port. */
+    end = addr + strlen (addr);
+    semicolon = connected ? strchr (addr, ';') : NULL;
+    host = semicolon ? semicolon + 1 : addr;
+    colon = strrchr (host, ':');
+    if (nn_slow (!colon))
+        return -EINVAL;
+
+    /*  Parse the port. */
+    port = nn_addr_parse_port (colon + 1, end - colon - 1);
+    if (nn_slow (port < 0))
+        return port;
+
+    /*  The bound endpoint listens on the specified interface. */
+    memset (local, 0, sizeof (struct sockaddr_storage));
+    if (!connected) {
+        rc = nn_addr_parse_local (addr, colon - addr, NN_ADDR_IPV4ONLY,
+            local, locallen);
+        if (nn_slow (rc < 0))
+            return rc;
+        ((struct sockaddr_in*) local)->sin_port = htons ((uint16_t) port);
+        return 0;
+    }
+
+    /*  The connected endpoint sends the datagrams via the specified
+        interface, if any, using an ephemeral port. */
+    if (semicolon) {
+        rc = nn_addr_parse_local (addr, semicolon - addr, NN_ADDR_IPV4ONLY,
+            local, locallen);
+        if (nn_slow (rc < 0))
+            return rc;
+    }
+    else
+        *locallen = 0;
+
+    /*  The hostname, if any, is looked up synchronously. */
+    memset (remote, 0, sizeof (struct sockaddr_storage));
+    rc = nn_addr_parse_remote (host, colon - host, NN_ADDR_IPV4ONLY,
+        remote, remotelen);
+    if (nn_slow (rc < 0))
+        return rc;
+    if (nn_slow (remote->ss_family != AF_INET))
+        return -EINVAL;
+    ((struct sockaddr_in*) remote)->sin_port = htons ((uint16_t) port);
+
+    return 0;
+}
+
+static int nn_udp_setup (struct nn_udp *self,
+    struct sockaddr_storage *local, nn_socklen locallen,
+    struct sockaddr_storage *remote, nn_socklen remotelen)
+{
+    int rc;
+
+    if (!self->connected || locallen) {
+        rc = nn_usock_bind (&self->usock, (struct sockaddr*) local,
+            locallen);
+        if (nn_slow (rc < 0))
+            return rc;
+    }
+    if (!self->connected)
+        return 0;
+
+    /*  Connecting the socket makes the kernel filter out the datagrams
+        from anyone but the peer. */
+    self->sink = &nn_udp_state_connecting;
+    self->errnum = 0;
+    nn_usock_connect (&self->usock, (struct sockaddr*) remote, remotelen);
+    return -self->errnum;
+}
+
+static void nn_udp_connecting_connected (const struct nn_cp_sink **self,
+    struct nn_usock *usock)
+{
+}
+
+static void nn_udp_connecting_err (const struct nn_cp_sink **self,
+    struct nn_usock *usock, int errnum)
+{
+    struct nn_udp *udp;
+
+    udp = nn_cont (self, struct nn_udp, sink);
+    udp->errnum = errnum;
+}
+
+static void nn_udp_failed_closed (const struct nn_cp_sink **self,
+    struct nn_usock *usock)
+{
+}
+
+static void nn_udp_next (struct nn_udp *self)
+{
+    /*  Process the datagrams received so far until there's a message for
+        the user. Once they are exhausted, receive a new batch. If there are
+        no datagrams available at the moment, the batch will be passed to
+        nn_udp_active_received once they arrive. */
+    while (1) {
+        while (self->dgrampos != self->dgramcount) {
+            if (nn_udp_parse (self, &self->dgrams [self->dgrampos++])) {
+                self->instate = NN_UDP_INSTATE_READY;
+                nn_pipebase_received (&self->pipebase);
+                return;
+            }
+        }
+        self->instate = NN_UDP_INSTATE_RECEIVING;
+        nn_usock_recvdgrams (&self->usock, self->dgrams, NN_UDP_RECV_BATCH);
+        if (self->instate == NN_UDP_INSTATE_RECEIVING) {
+            self->instate = NN_UDP_INSTATE_IDLE;
+            return;
+        }
+        nn_assert (self->instate == NN_UDP_INSTATE_RECEIVED);
+    }
+}
+
+static int nn_udp_parse (struct nn_udp *self, struct nn_usock_dgram *dgram)
+{
+    uint8_t *data;
+
+    /*  Datagrams not sent by a peer socket are ignored. */
+    data = dgram->buf;
+    if (nn_slow (dgram->len < 8 || dgram->len > dgram->size ||
+          memcmp (data, "\0\0SP", 4) != 0 || data [6] != 0 ||
+          (data [7] & ~NN_UDP_HDR_KEEPALIVE) != 0 ||
+          !nn_pipebase_ispeer (&self->pipebase, nn_gets (data + 4))))
+        return 0;
+
+    /*  The bound endpoint learns about its peers from the datagrams they
+        send. */
+    if (!self->connected)
+        nn_udp_addpeer (self, &dgram->addr, dgram->addrlen);
+
+    if (data [7] & NN_UDP_HDR_KEEPALIVE || self->norecv)
+        return 0;
+
+    nn_msg_term (&self->inmsg);
+    nn_msg_init (&self->inmsg, dgram->len - 8);
+    memcpy (nn_chunkref_data (&self->inmsg.body), data + 8, dgram->len - 8);
+    return 1;
+}
+
+static void nn_udp_addpeer (struct nn_udp *self,
+    struct sockaddr_storage *addr, nn_socklen addrlen)
+{
+    int i;
+
+    for (i = 0; i != self->npeers; ++i) {
+        if (self->peerlens [i] == addrlen &&
+              memcmp (&self->peers [i], addr, addrlen) == 0) {
+            self->idle [i] = 0;
+            return;
+        }
+    }
+
+    /*  If there are too many peers already, the new one is not sent any
+        messages. Those it sends are received though. */
+    if (nn_slow (self->npeers == NN_UDP_MAX_PEERS))
+        return;
+    memcpy (&self->peers [self->npeers], addr, addrlen);
+    self->peerlens [self->npeers] = addrlen;
+    self->idle [self->npeers] = 0;
+    ++self->npeers;
+}
+
+static void nn_udp_sendkeepalive (struct nn_udp *self)
+{
+    struct nn_iobuf iov;
+
+    iov.iov_base = self->keepalive;
+    iov.iov_len = sizeof (self->keepalive);
+    nn_usock_sendto (&self->usock, &iov, 1, NULL, NULL, 1);
+}
+
+static void nn_udp_active_received (const struct nn_cp_sink **self,
+    struct nn_usock *usock)
+{
+    struct nn_udp *udp;
+
+    udp = nn_cont (self, struct nn_udp, sink);
+    udp->dgramcount = nn_usock_dgramcount (usock);
+    udp->dgrampos = 0;
+
+    /*  The datagrams were received from within nn_udp_next. */
+    if (udp->instate == NN_UDP_INSTATE_RECEIVING) {
+        udp->instate = NN_UDP_INSTATE_RECEIVED;
+        return;
+    }
+
+    nn_assert (udp->instate == NN_UDP_INSTATE_IDLE);
+    nn_udp_next (udp);
+}
+
+static void nn_udp_active_err (const struct nn_cp_sink **self,
+    struct nn_usock *usock, int errnum)
+{
+    /*  The errors are reported for individual datagrams that were already
+        dropped. There's no connection to be broken, so they are ignored. */
+}
+
+static void nn_udp_active_timeout (const struct nn_cp_sink **self,
+    struct nn_timer *timer)
+{
+    struct nn_udp *udp;
+    int i;
+
+    udp = nn_cont (self, struct nn_udp, sink);
+
+    /*  The connected endpoint reminds the peer of its existence. */
+    if (udp->connected)
+        nn_udp_sendkeepalive (udp);
+
+    /*  The bound endpoint forgets the peers that went silent. */
+    i = 0;
+    while (i != udp->npeers) {
+        if (++udp->idle [i] <= NN_UDP_PEER_IVLS) {
+            ++i;
+            continue;
+        }
+        --udp->npeers;
+        memcpy (&udp->peers [i], &udp->peers [udp->npeers],
+            udp->peerlens [udp->npeers]);
+        udp->peerlens [i] = udp->peerlens [udp->npeers];
+        udp->idle [i] = udp->idle [udp->npeers];
+    }
+
+    nn_timer_start (&udp->timer, udp->ivl);
+}
+
+static int nn_udp_send (struct nn_pipebase *self, struct nn_msg *msg)
+{
+    struct nn_udp *udp;
+    struct nn_iobuf iov [3 + NN_MSG_MAXFRAGS];
+    int iovcnt;
+    int i;
+
+    udp = nn_cont (self, struct nn_udp, pipebase);
+
+    /*  Messages that don't fit into a datagram are dropped, same as those
+        that have nobody to be sent to. */
+    if (udp->nosend || (!udp->connected && !udp->npeers) ||
+          nn_chunkref_size (&msg->hdr) + nn_msg_bodysize (msg) >
+          NN_UDP_MAX_DGRAM - 8) {
+        nn_msg_term (msg);
+        nn_pipebase_sent (&udp->pipebase);
+        return 0;
+    }
+
+    /*  The message is sent as a single datagram to each peer. The send
+        is done synchronously, so the pipe is writable straight away. */
+    iov [0].iov_base = udp->protohdr;
+    iov [0].iov_len = sizeof (udp->protohdr);
+    iov [1].iov_base = nn_chunkref_data (&msg->hdr);
+    iov [1].iov_len = nn_chunkref_size (&msg->hdr);
+    iov [2].iov_base = nn_chunkref_data (&msg->body);
+    iov [2].iov_len = nn_chunkref_size (&msg->body);
+    iovcnt = 3;
+    if (msg->frags) {
+        for (i = 0; i != msg->frags->count; ++i) {
+            iov [iovcnt].iov_base = nn_chunkref_data (&msg->frags->frag [i]);
+            iov [iovcnt].iov_len = nn_chunkref_size (&msg->frags->frag [i]);
+            ++iovcnt;
+        }
+    }
+    if (udp->connected)
+        nn_usock_sendto (&udp->usock, iov, iovcnt, NULL, NULL, 1);
+    else
+        nn_usock_sendto (&udp->usock, iov, iovcnt, udp->peers,
+            udp->peerlens, udp->npeers);
+    nn_msg_term (msg);
+    nn_pipebase_sent (&udp->pipebase);
+
+    return 0;
+}
+
+static int nn_udp_recv (struct nn_pipebase *self, struct nn_msg *msg)
+{
+    struct nn_udp *udp;
+
+    udp = nn_cont (self, struct nn_udp, pipebase);
+    nn_assert (udp->instate == NN_UDP_INSTATE_READY);
+
+    /*  Move message content to the user-supplied structure and start
+        processing the next datagram. */
+    nn_msg_mv (msg, &udp->inmsg);
+    nn_msg_init (&udp->inmsg, 0);
+    nn_udp_next (udp);
+
+    return 0;
+}
+
+static int nn_udp_close (struct nn_epbase *self)
+{
+    struct nn_udp *udp;
+
+    udp = nn_cont (self, struct nn_udp, epbase);
+
+    nn_pipebase_term (&udp->pipebase);
+    nn_msg_term (&udp->inmsg);
+    nn_timer_term (&udp->timer);
+
+    udp->sink = &nn_udp_state_terminating;
+    nn_usock_close (&udp->usock);
+
+    return -EINPROGRESS;
+}
+
+static void nn_udp_terminating_closed (const struct nn_cp_sink **self,
+    struct nn_usock *usock)
+{
+    struct nn_udp *udp;
+
+    udp = nn_cont (self, struct nn_udp, sink);
+
+    nn_free (udp->inbuf);
+    nn_epbase_term (&udp->epbase);
+    nn_free (udp);
+}
+
+static struct nn_optset *nn_udp_optset ()
+{
+    struct nn_udp_optset *optset;
+
+    optset = nn_alloc (sizeof (struct nn_udp_optset), "optset (udp)");
+    alloc_assert (optset);
+    optset->base.vfptr = &nn_udp_optset_vfptr;
+
+    /*  Default values for UDP socket options. */
+    optset->keepalive = 1000;
+
+    return &optset->base;
+}
+
+static void nn_udp_optset_destroy (struct nn_optset *self)
+{
+    struct nn_udp_optset *optset;
+
+    optset = nn_cont (self, struct nn_udp_optset, base);
+    nn_free (optset);
+}
+
+static int nn_udp_optset_setopt (struct nn_optset *self, int option,
+    const void *optval, size_t optvallen)
+{
+    struct nn_udp_optset *optset;
+    int val;
+
+    optset = nn_cont (self, struct nn_udp_optset, base);
+
+    /*  All the options are of type int. */
+    if (optvallen != sizeof (int))
+        return -EINVAL;
+    val = *(int*) optval;
+
+    switch (option) {
+    case NN_UDP_KEEPALIVE:
+        if (nn_slow (val <= 0))
+            return -EINVAL;
+        optset->keepalive = val;
+        return 0;
+    default:
+        return -ENOPROTOOPT;
+    }
+}
+
+static int nn_udp_optset_getopt (struct nn_optset *self, int option,
+    void *optval, size_t *optvallen)
+{
+    struct nn_udp_optset *optset;
+    int intval;
+
+    optset = nn_cont (self, struct nn_udp_optset, base);
+
+    switch (option) {
+    case NN_UDP_KEEPALIVE:
+        intval = optset->keepalive;
+        break;
+    default:
+        return -ENOPROTOOPT;
+    }
+    memcpy (optval, &intval,
+        *optvallen < sizeof (int) ? *optvallen : sizeof (int));
+    *optvallen = sizeof (int);
+    return 0;
+}
+
+#endif
+
@@ -0,0 +1,719 @@
+/*
+    Copyright (c) 2013 250bpm s.r.o.
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"),
+    to deal in the Software without restriction, including without limitation
+    the rights to use, copy, modify, merge, publish, distribute, sublicense,
+    and/or sell copies of the Software, and to permit persons to whom
+    the Software is furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included
+    in all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+    THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+    FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+    IN THE SOFTWARE.
+*/
+
+#if !defined NN_HAVE_WINDOWS
+
+#include "udpm.h"
+
+#include "../../udpm.h"
+#include "../../pubsub.h"
+
+#include "../../utils/err.h"
+#include "../../utils/cont.h"
+#include "../../utils/alloc.h"
+#include "../../utils/fast.h"
+#include "../../utils/wire.h"
+#include "../../utils/addr.h"
+
+#include <string.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+/*  Maximum size of a UDP datagram over IPv4. Each message is sent as a single
+    datagram, prefixed by the protocol header. Messages that don't fit into
+    a datagram are dropped. */
+#define NN_UDPM_MAX_DGRAM 65507
+
+/*  States of the inbound state machine. While in RECEIVING state, the
+    endpoint is waiting for nn_usock_recvdgram to complete synchronously.
+    If it does, the state changes to RECEIVED. IDLE means that the datagram
+    is going to be received asynchronously. In READY state there's a message
+    waiting to be received by the user. */
+#define NN_UDPM_INSTATE_IDLE 1
+#define NN_UDPM_INSTATE_RECEIVING 2
+#define NN_UDPM_INSTATE_RECEIVED 3
+#define NN_UDPM_INSTATE_READY 4
+
+/*  Multicast endpoint. As there are no connections, each endpoint has exactly
+    one pipe. On the publisher's side, the messages sent to the pipe are sent
+    to the multicast group. On the subscriber's side, the datagrams sent to
+    the group are received from the pipe. Bound and connected endpoints
+    behave the same. */
+struct nn_udpm {
+
+    /*  Event sink. */
+    const struct nn_cp_sink *sink;
+
+    /*  This object is an endpoint. */
+    struct nn_epbase epbase;
+
+    /*  Pipe to exchange messages with the user of the library. */
+    struct nn_pipebase pipebase;
+
+    /*  The underlying UDP socket. */
+    struct nn_usock usock;
+
+    /*  1 on the publisher's side, 0 on the subscriber's side. */
+    int sender;
+
+    /*  Protocol header prefixed to each datagram. */
+    uint8_t protohdr [8];
+
+    /*  State of the inbound state machine, the buffer to receive datagrams
+        into and the message received. */
+    int instate;
+    uint8_t *inbuf;
+    struct nn_msg inmsg;
+
+    /*  Message being sent at the moment. It's valid only if 'sending'
+        is set. */
+    int sending;
+    struct nn_msg outmsg;
+
+    /*  Error encountered while connecting the socket during the
+        initialisation. */
+    int errnum;
+};
+
+struct nn_udpm_optset {
+    struct nn_optset base;
+    int ttl;
+    int loop;
+};
+
+static void nn_udpm_optset_destroy (struct nn_optset *self);
+static int nn_udpm_optset_setopt (struct nn_optset *self, int option,
+    const void *optval, size_t optvallen);
+static int nn_udpm_optset_getopt (struct nn_optset *self, int option,
+    void *optval, size_t *optvallen);
+static const struct nn_optset_vfptr nn_udpm_optset_vfptr = {
+    nn_udpm_optset_destroy,
+    nn_udpm_optset_setopt,
+    nn_udpm_optset_getopt
+};
+
+/*  nn_transport interface. */
+static void nn_udpm_init (void);
+static void nn_udpm_term (void);
+static int nn_udpm_bind (const char *addr, void *hint,
+    struct nn_epbase **epbase);
+static int nn_udpm_connect (const char *addr, void *hint,
+    struct nn_epbase **epbase);
+static struct nn_optset *nn_udpm_optset ();
+
+static struct nn_transport nn_udpm_vfptr = {
+    "udpm",
+    NN_UDPM,
+    0,
+    nn_udpm_init,
+    nn_udpm_term,
+    nn_udpm_bind,
+    nn_udpm_connect,
+    nn_udpm_optset
+};
+
+struct nn_transport *nn_udpm = &nn_udpm_vfptr;
+
+/*  Private functions. */
+static int nn_udpm_create (const char *addr, void *hint,
+    struct nn_epbase **epbase);
+static int nn_udpm_ep_init (struct nn_udpm *self, const char *addr,
+    void *hint);
+static int nn_udpm_resolve (const char *addr, struct sockaddr_in *group,
+    struct in_addr *iface);
+static int nn_udpm_setup (struct nn_udpm *self, struct sockaddr_in *group,
+    struct in_addr *iface);
+static void nn_udpm_next (struct nn_udpm *self);
+static int nn_udpm_parse (struct nn_udpm *self);
+
+/*  Implementation of nn_epbase interface. */
+static int nn_udpm_close (struct nn_epbase *self);
+static const struct nn_epbase_vfptr nn_udpm_epbase_vfptr =
+    {nn_udpm_close};
+
+/*  Implementation of nn_pipebase interface. */
+static int nn_udpm_send (struct nn_pipebase *self, struct nn_msg *msg);
+static int nn_udpm_recv (struct nn_pipebase *self, struct nn_msg *msg);
+static const struct nn_pipebase_vfptr nn_udpm_pipebase_vfptr = {
+    nn_udpm_send,
+    nn_udpm_recv
+};
+
+/*  CONNECTING state. The socket of the publisher is being connected to
+    the multicast group. For UDP, this is done synchronously. */
+static void nn_udpm_connecting_connected (const struct nn_cp_sink **self,
+    struct nn_usock *usock);
+static void nn_udpm_connecting_err (const struct nn_cp_sink **self,
+    struct nn_usock *usock, int errnum);
+static const struct nn_cp_sink nn_udpm_state_connecting = {
+    NULL,
+    NULL,
+    nn_udpm_connecting_connected,
+    NULL,
+    nn_udpm_connecting_err,
+    NULL,
+    NULL,
+    NULL
+};
+
+/*  ACTIVE state. */
+static void nn_udpm_active_received (const struct nn_cp_sink **self,
+    struct nn_usock *usock);
+static void nn_udpm_active_sent (const struct nn_cp_sink **self,
+    struct nn_usock *usock);
+static void nn_udpm_active_err (const struct nn_cp_sink **self,
+    struct nn_usock *usock, int errnum);
+static const struct nn_cp_sink nn_udpm_state_active = {
+    nn_udpm_active_received,
+    nn_udpm_active_sent,
+    NULL,
+    NULL,
+    nn_udpm_active_err,
+    NULL,
+    NULL,
+    NULL
+};
+
+/*  FAILED state. The initialisation have failed and the socket is being
+    closed. It's not registered with the completion port yet, so it's closed
+    synchronously. */
+static void nn_udpm_failed_closed (const struct nn_cp_sink **self,
+    struct nn_usock *usock);
+static const struct nn_cp_sink nn_udpm_state_failed = {
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    nn_udpm_failed_closed,
+    NULL,
+    NULL
+};
+
+/*  TERMINATING state. */
+static void nn_udpm_terminating_closed (const struct nn_cp_sink **self,
+    struct nn_usock *usock);
+static const struct nn_cp_sink nn_udpm_state_terminating = {
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    nn_udpm_terminating_closed,
+    NULL,
+    NULL
+};
+
+static void nn_udpm_init (void)
+{
+}
+
+static void nn_udpm_term (void)
+{
+}
+
+static int nn_udpm_bind (const char *addr, void *hint,
+    struct nn_epbase **epbase)
+{
+    return nn_udpm_create (addr, hint, epbase);
+}
+
+static int nn_udpm_connect (const char *addr, void *hint,
+    struct nn_epbase **epbase)
+{
+    return nn_udpm_create (addr, hint, epbase);
+}
+
+static int nn_udpm_create (const char *addr, void *hint,
+    struct nn_epbase **epbase)
+{
+    int rc;
+    struct nn_udpm *udpm;
+
+    udpm = nn_alloc (sizeof (struct nn_udpm), "udpm");
+    alloc_assert (udpm);
+    rc = nn_udpm_ep_init (udpm, addr, hint);
+    if (nn_slow (rc != 0)) {
+        nn_free (udpm);
+        return rc;
+    }
+    *epbase = &udpm->epbase;
+
+    return 0;
+}
+
+static int nn_udpm_ep_init (struct nn_udpm *self, const char *addr,
+    void *hint)
+{
+    int rc;
+    int protocol;
+    int sndbuf;
+    int rcvbuf;
+    size_t sz;
+    struct sockaddr_in group;
+    struct in_addr iface;
+
+    rc = nn_udpm_resolve (addr, &group, &iface);
+    if (nn_slow (rc < 0))
+        return rc;
+
+    nn_epbase_init (&self->epbase, &nn_udpm_epbase_vfptr, addr, hint);
+
+    /*  Multicast is one-way. Publishers send to the group, subscribers
+        receive from it. Other socket types can't use it. */
+    if (nn_epbase_ispeer (&self->epbase, NN_SUB))
+        self->sender = 1;
+    else if (nn_epbase_ispeer (&self->epbase, NN_PUB))
+        self->sender = 0;
+    else {
+        nn_epbase_term (&self->epbase);
+        return -EPROTONOSUPPORT;
+    }
+
+    /*  Open the socket. */
+    sz = sizeof (sndbuf);
+    nn_epbase_getopt (&self->epbase, NN_SOL_SOCKET, NN_SNDBUF, &sndbuf, &sz);
+    nn_assert (sz == sizeof (sndbuf));
+    sz = sizeof (rcvbuf);
+    nn_epbase_getopt (&self->epbase, NN_SOL_SOCKET, NN_RCVBUF, &rcvbuf, &sz);
+    nn_assert (sz == sizeof (rcvbuf));
+    rc = nn_usock_init (&self->usock, &self->sink, AF_INET, SOCK_DGRAM,
+        IPPROTO_UDP, sndbuf, rcvbuf, nn_epbase_getcp (&self->epbase));
+    if (nn_slow (rc < 0)) {
+        nn_epbase_term (&self->epbase);
+        return rc;
+    }
+
+    /*  Join the group or start sending to it. */
+    rc = nn_udpm_setup (self, &group, &iface);
+    if (nn_slow (rc < 0)) {
+        self->sink = &nn_udpm_state_failed;
+        nn_usock_close (&self->usock);
+        nn_epbase_term (&self->epbase);
+        return rc;
+    }
+
+    /*  Prepare the protocol header. */
+    sz = sizeof (protocol);
+    nn_epbase_getopt (&self->epbase, NN_SOL_SOCKET, NN_PROTOCOL,
+        &protocol, &sz);
+    nn_assert (sz == sizeof (protocol));
+    memcpy (self->protohdr, "\0\0SP\0\0\0\0", 8);
+    nn_puts (self->protohdr + 4, (uint16_t) protocol);
+
+    self->sink = &nn_udpm_state_active;
+    self->instate = NN_UDPM_INSTATE_IDLE;
+    self->inbuf = NULL;
+    nn_msg_init (&self->inmsg, 0);
+    self->sending = 0;
+
+    /*  Create the pipe. */
+    rc = nn_pipebase_init (&self->pipebase, &nn_udpm_pipebase_vfptr,
+        &self->epbase);
+    nn_assert (rc == 0);
+    nn_pipebase_activate (&self->pipebase);
+
+    /*  Start receiving the datagrams. */
+    if (!self->sender) {
+        self->inbuf = nn_alloc (NN_UDPM_MAX_DGRAM, "udpm datagram");
+        alloc_assert (self->inbuf);
+        nn_udpm_next (self);
+    }
+
+    return 0;
+}
+
+static int nn_udpm_resolve (const char *addr, struct sockaddr_in *group,
+    struct in_addr *iface)
+{
+    int rc;
+    const char *end;
+    const char *semicolon;
+    const char *colon;
+    const char *host;
+    int port;
+    struct sockaddr_storage ss;
+    nn_socklen sslen;
+
+    /*  The address is in the form of [interface;]group:port. */
+    end = addr + strlen (addr);
+    semicolon = strchr (addr, ';');
+    host = semicolon ? semicolon + 1 : addr;
+    colon = strrchr (host, ':');
+    if (nn_slow (!colon))
+        return -EINVAL;
+
+    /*  Parse the port. */
+    port = nn_addr_parse_port (colon + 1, end - colon - 1);
+    if (nn_slow (port < 0))
+        return port;
+
+    /*  Parse the group. It has to be an IPv4 multicast address. */
+    rc = nn_addr_parse_remote (host, colon - host, NN_ADDR_IPV4ONLY,
+        &ss, &sslen);
+    if (nn_slow (rc < 0))
+        return rc;
+    if (nn_slow (ss.ss_family != AF_INET))
+        return -EINVAL;
+    memcpy (group, &ss, sizeof (struct sockaddr_in));
+    if (nn_slow (!IN_MULTICAST (ntohl (group->sin_addr.s_addr))))
+        return -EINVAL;
+    group->sin_port = htons ((uint16_t) port);
+
+    /*  Parse the interface. If it's not specified, the system chooses one. */
+    if (!semicolon) {
+        iface->s_addr = htonl (INADDR_ANY);
+        return 0;
+    }
+    rc = nn_addr_parse_local (addr, semicolon - addr, NN_ADDR_IPV4ONLY,
+        &ss, &sslen);
+    if (nn_slow (rc < 0))
+        return rc;
+    *iface = ((struct sockaddr_in*) &ss)->sin_addr;
+
+    return 0;
+}
+
+static int nn_udpm_setup (struct nn_udpm *self, struct sockaddr_in *group,
+    struct in_addr *iface)
+{
+    int rc;
+    int val;
+    size_t sz;
+    unsigned char opt;
+    struct ip_mreq mreq;
+
+    /*  Subscriber joins the group. The socket is bound to the address of
+        the group so that it doesn't get datagrams sent to other groups
+        using the same port. */
+    if (!self->sender) {
+        rc = nn_usock_bind (&self->usock, (struct sockaddr*) group,
+            sizeof (struct sockaddr_in));
+        if (nn_slow (rc < 0))
+            return rc;
+        mreq.imr_multiaddr = group->sin_addr;
+        mreq.imr_interface = *iface;
+        return nn_usock_setsockopt (&self->usock, IPPROTO_IP,
+            IP_ADD_MEMBERSHIP, &mreq, sizeof (mreq));
+    }
+
+    /*  Publisher sends the datagrams to the group via the specified
+        interface. */
+    rc = nn_usock_setsockopt (&self->usock, IPPROTO_IP, IP_MULTICAST_IF,
+        iface, sizeof (struct in_addr));
+    if (nn_slow (rc < 0))
+        return rc;
+    sz = sizeof (val);
+    nn_epbase_getopt (&self->epbase, NN_UDPM, NN_UDPM_TTL, &val, &sz);
+    nn_assert (sz == sizeof (val));
+    opt = (unsigned char) val;
+    rc = nn_usock_setsockopt (&self->usock, IPPROTO_IP, IP_MULTICAST_TTL,
+        &opt, sizeof (opt));
+    if (nn_slow (rc < 0))
+        return rc;
+    sz = sizeof (val);
+    nn_epbase_getopt (&self->epbase, NN_UDPM, NN_UDPM_LOOP, &val, &sz);
+    nn_assert (sz == sizeof (val));
+    opt = (unsigned char) val;
+    rc = nn_usock_setsockopt (&self->usock, IPPROTO_IP, IP_MULTICAST_LOOP,
+        &opt, sizeof (opt));
+    if (nn_slow (rc < 0))
+        return rc;
+
+    self->sink = &nn_udpm_state_connecting;
+    self->errnum = 0;
+    nn_usock_connect (&self->usock, (struct sockaddr*) group,
+        sizeof (struct sockaddr_in));
+    return -self->errnum;
+}
+
+static void nn_udpm_connecting_connected (const struct nn_cp_sink **self,
+    struct nn_usock *usock)
+{
+}
+
+static void nn_udpm_connecting_err (const struct nn_cp_sink **self,
+    struct nn_usock *usock, int errnum)
+{
+    struct nn_udpm *udpm;
+
+    udpm = nn_cont (self, struct nn_udpm, sink);
+    udpm->errnum = errnum;
+}
+
+static void nn_udpm_failed_closed (const struct nn_cp_sink **self,
+    struct nn_usock *usock)
+{
+}
+
+static void nn_udpm_next (struct nn_udpm *self)
+{
+    /*  Receive datagrams until there's a valid one or until there's none
+        available at the moment. In the latter case, the datagram will be
+        passed to nn_udpm_active_received once it arrives. */
+    while (1) {
+        self->instate = NN_UDPM_INSTATE_RECEIVING;
+        nn_usock_recvdgram (&self->usock, self->inbuf, NN_UDPM_MAX_DGRAM);
+        if (self->instate == NN_UDPM_INSTATE_RECEIVING) {
+            self->instate = NN_UDPM_INSTATE_IDLE;
+            return;
+        }
+        nn_assert (self->instate == NN_UDPM_INSTATE_RECEIVED);
+        if (nn_udpm_parse (self)) {
+            self->instate = NN_UDPM_INSTATE_READY;
+            nn_pipebase_received (&self->pipebase);
+            return;
+        }
+    }
+}
+
+static int nn_udpm_parse (struct nn_udpm *self)
+{
+    size_t len;
+
+    /*  Datagrams not sent by a peer socket are ignored. */
+    len = nn_usock_dgramlen (&self->usock);
+    if (nn_slow (len < 8 || memcmp (self->inbuf, "\0\0SP", 4) != 0 ||
+          nn_gets (self->inbuf + 6) != 0 ||
+          !nn_pipebase_ispeer (&self->pipebase, nn_gets (self->inbuf + 4))))
+        return 0;
+
+    nn_msg_term (&self->inmsg);
+    nn_msg_init (&self->inmsg, len - 8);
+    memcpy (nn_chunkref_data (&self->inmsg.body), self->inbuf + 8, len - 8);
+    return 1;
+}
+
+static void nn_udpm_active_received (const struct nn_cp_sink **self,
+    struct nn_usock *usock)
+{
+    struct nn_udpm *udpm;
+
+    udpm = nn_cont (self, struct nn_udpm, sink);
+
+    /*  The datagram was received from within nn_udpm_next. */
+    if (udpm->instate == NN_UDPM_INSTATE_RECEIVING) {
+        udpm->instate = NN_UDPM_INSTATE_RECEIVED;
+        return;
+    }
+
+    nn_assert (udpm->instate == NN_UDPM_INSTATE_IDLE);
+    if (nn_udpm_parse (udpm)) {
+        udpm->instate = NN_UDPM_INSTATE_READY;
+        nn_pipebase_received (&udpm->pipebase);
+        return;
+    }
+    nn_udpm_next (udpm);
+}
+
+static void nn_udpm_active_sent (const struct nn_cp_sink **self,
+    struct nn_usock *usock)
+{
+    struct nn_udpm *udpm;
+
+    udpm = nn_cont (self, struct nn_udpm, sink);
+
+    nn_assert (udpm->sending);
+    udpm->sending = 0;
+    nn_msg_term (&udpm->outmsg);
+    nn_pipebase_sent (&udpm->pipebase);
+}
+
+static void nn_udpm_active_err (const struct nn_cp_sink **self,
+    struct nn_usock *usock, int errnum)
+{
+    /*  The errors are reported for individual datagrams that were already
+        dropped. There's no connection to be broken, so they are ignored. */
+}
+
+static int nn_udpm_send (struct nn_pipebase *self, struct nn_msg *msg)
+{
+    struct nn_udpm *udpm;
+    struct nn_iobuf iov [3 + NN_MSG_MAXFRAGS];
+    int iovcnt;
+    int i;
+
+    udpm = nn_cont (self, struct nn_udpm, pipebase);
+    nn_assert (!udpm->sending);
+
+    /*  Subscribers don't send anything. The subscriptions are not forwarded,
+        the subscriber filters the messages itself. Messages that don't fit
+        into a datagram are dropped. */
+    if (!udpm->sender || nn_chunkref_size (&msg->hdr) +
+          nn_msg_bodysize (msg) > NN_UDPM_MAX_DGRAM - 8) {
+        nn_msg_term (msg);
+        nn_pipebase_sent (&udpm->pipebase);
+        return 0;
+    }
+
+    /*  The message is sent as a single datagram. */
+    udpm->sending = 1;
+    nn_msg_mv (&udpm->outmsg, msg);
+    iov [0].iov_base = udpm->protohdr;
+    iov [0].iov_len = sizeof (udpm->protohdr);
+    iov [1].iov_base = nn_chunkref_data (&udpm->outmsg.hdr);
+    iov [1].iov_len = nn_chunkref_size (&udpm->outmsg.hdr);
+    iov [2].iov_base = nn_chunkref_data (&udpm->outmsg.body);
+    iov [2].iov_len = nn_chunkref_size (&udpm->outmsg.body);
+    iovcnt = 3;
+    if (udpm->outmsg.frags) {
+        for (i = 0; i != udpm->outmsg.frags->count; ++i) {
+            iov [iovcnt].iov_base =
+                nn_chunkref_data (&udpm->outmsg.frags->frag [i]);
+            iov [iovcnt].iov_len =
+                nn_chunkref_size (&udpm->outmsg.frags->frag [i]);
+            ++iovcnt;
+        }
+    }
+    nn_usock_send (&udpm->usock, iov, iovcnt);
+
+    return 0;
+}
+
+static int nn_udpm_recv (struct nn_pipebase *self, struct nn_msg *msg)
+{
+    struct nn_udpm *udpm;
+
+    udpm = nn_cont (self, struct nn_udpm, pipebase);
+    nn_assert (udpm->instate == NN_UDPM_INSTATE_READY);
+
+    /*  Move message content to the user-supplied structure and start
+        receiving the next one. */
+    nn_msg_mv (msg, &udpm->inmsg);
+    nn_msg_init (&udpm->inmsg, 0);
+    nn_udpm_next (udpm);
+
+    return 0;
+}
+
+static int nn_udpm_close (struct nn_epbase *self)
+{
+    struct nn_udpm *udpm;
+
+    udpm = nn_cont (self, struct nn_udpm, epbase);
+
+    nn_pipebase_term (&udpm->pipebase);
+    nn_msg_term (&udpm->inmsg);
+    if (udpm->sending) {
+        udpm->sending = 0;
+        nn_msg_term (&udpm->outmsg);
+    }
+
+    udpm->sink = &nn_udpm_state_terminating;
+    nn_usock_close (&udpm->usock);
+
+    return -EINPROGRESS;
+}
+
+static void nn_udpm_terminating_closed (const struct nn_cp_sink **self,
+    struct nn_usock *usock)
+{
+    struct nn_udpm *udpm;
+
+    udpm = nn_cont (self, struct nn_udpm, sink);
+
+    if (udpm->inbuf)
+        nn_free (udpm->inbuf);
+    nn_epbase_term (&udpm->epbase);
+    nn_free (udpm);
+}
+
+static struct nn_optset *nn_udpm_optset ()
+{
+    struct nn_udpm_optset *optset;
+
+    optset = nn_alloc (sizeof (struct nn_udpm_optset), "optset (udpm)");
+    alloc_assert (optset);
+    optset->base.vfptr = &nn_udpm_optset_vfptr;
+
+    /*  Default values for multicast socket options. The datagrams don't
+        leave the local network and they are delivered to the subscribers on
+        the local host as well. */
+    optset->ttl = 1;
+    optset->loop = 1;
+
+    return &optset->base;
+}
+
+static void nn_udpm_optset_destroy (struct nn_optset *self)
+{
+    struct nn_udpm_optset *optset;
+
+    optset = nn_cont (self, struct nn_udpm_optset, base);
+    nn_free (optset);
+}
+
+static int nn_udpm_optset_setopt (struct nn_optset *self, int option,
+    const void *optval, size_t optvallen)
+{
+    struct nn_udpm_optset *optset;
+    int val;
+
+    optset = nn_cont (self, struct nn_udpm_optset, base);
+
+    /*  All the options are of type int. */
+    if (optvallen != sizeof (int))
+        return -EINVAL;
+    val = *(int*) optval;
+
+    switch (option) {
+    case NN_UDPM_TTL:
+        if (nn_slow (val < 0 || val > 255))
+            return -EINVAL;
+        optset->ttl = val;
+        return 0;
+    case NN_UDPM_LOOP:
+        if (nn_slow (val != 0 && val != 1))
+            return -EINVAL;
+        optset->loop = val;
+        return 0;
+    default:
+        return -ENOPROTOOPT;
+    }
+}
+
+static int nn_udpm_optset_getopt (struct nn_optset *self, int option,
+    void *optval, size_t *optvallen)
+{
+    struct nn_udpm_optset *optset;
+    int intval;
+
+    optset = nn_cont (self, struct nn_udpm_optset, base);
+
+    switch (option) {
+    case NN_UDPM_TTL:
+        intval = optset->ttl;
+        break;
+    case NN_UDPM_LOOP:
+        intval = optset->loop;
+        break;
+    default:
+        return -ENOPROTOOPT;
+    }
+    memcpy (optval, &intval,
+        *optvallen < sizeof (int) ? *optvallen : sizeof (int));
+    *optvallen = sizeof (int);
+    return 0;
+}
+
+#endif
+
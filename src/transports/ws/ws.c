@@ -0,0 +1,230 @@
+/*
+    Copyright (c) 2013 250bpm s.r.o.
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"),
+    to deal in the Software without restriction, including without limitation
+    the rights to use, copy, modify, merge, publish, distribute, sublicense,
+    and/or sell copies of the Software, and to permit persons to whom
+    the Software is furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included
+    in all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+    THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+    FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+    IN THE SOFTWARE.
+*/
+
+#include "ws.h"
+
+#include "../tcp/tcp.h"
+
+#include "../../ws.h"
+
+#include "../../utils/err.h"
+#include "../../utils/addr.h"
+#include "../../utils/alloc.h"
+#include "../../utils/fast.h"
+#include "../../utils/bstream.h"
+#include "../../utils/cstream.h"
+#include "../../utils/list.h"
+
+#include <string.h>
+
+#define NN_WS_BACKLOG 100
+
+/*  The address is in "[local;]host:port[/path]" format. The part before
+    the path is handled the same way as with TCP, the path is checked during
+    the opening handshake. TCP socket options (NN_TCP_NODELAY et c.) apply
+    to WebSocket connections as well. */
+
+/*  Private functions. */
+static int nn_ws_strip (const char *addr, char *buf);
+static int nn_ws_binit (const char *addr, struct nn_usock *usock,
+    struct nn_epbase *epbase, int backlog, int s);
+static int nn_ws_csockinit (struct nn_usock *usock, int sndbuf, int rcvbuf,
+    struct nn_epbase *epbase);
+static int nn_ws_cresolve (const char *addr, struct nn_resolve *resolve,
+    struct sockaddr_storage *local, socklen_t *locallen,
+    struct sockaddr_storage *remote, socklen_t *remotelen, int *nremote);
+
+/*  nn_transport interface. */
+static void nn_ws_init (void);
+static void nn_ws_term (void);
+static int nn_ws_bind (const char *addr, void *hint,
+    struct nn_epbase **epbase);
+static int nn_ws_connect (const char *addr, void *hint,
+    struct nn_epbase **epbase);
+static int nn_ws_adopt (const char *addr, void *hint, const int *fds,
+    int nfds, struct nn_epbase **epbase);
+
+static struct nn_transport nn_ws_vfptr = {
+    "ws",
+    NN_WS,
+    0,
+    nn_ws_init,
+    nn_ws_term,
+    nn_ws_bind,
+    nn_ws_connect,
+    NULL,
+    nn_ws_adopt
+};
+
+struct nn_transport *nn_ws = &nn_ws_vfptr;
+
+static void nn_ws_init (void)
+{
+}
+
+static void nn_ws_term (void)
+{
+}
+
+static int nn_ws_bind (const char *addr, void *hint,
+    struct nn_epbase **epbase)
+{
+    int rc;
+    struct nn_bstream *bstream;
+
+    bstream = nn_alloc (sizeof (struct nn_bstream), "bstream (ws)");
+    alloc_assert (bstream);
+    rc = nn_bstream_init (bstream, addr, hint, nn_ws_binit, nn_tcp_bcount,
+        nn_tcp_baccept, NN_WS_BACKLOG);
+    if (nn_slow (rc != 0)) {
+        nn_free (bstream);
+        return rc;
+    }
+    *epbase = &bstream->epbase;
+
+    return 0;
+}
+
+static int nn_ws_adopt (const char *addr, void *hint, const int *fds,
+    int nfds, struct nn_epbase **epbase)
+{
+    int rc;
+    struct nn_bstream *bstream;
+
+    bstream = nn_alloc (sizeof (struct nn_bstream), "bstream (ws)");
+    alloc_assert (bstream);
+    rc = nn_bstream_adopt (bstream, addr, hint, nn_ws_binit, nn_tcp_baccept,
+        NN_WS_BACKLOG, fds, nfds);
+    if (nn_slow (rc != 0)) {
+        nn_free (bstream);
+        return rc;
+    }
+    *epbase = &bstream->epbase;
+
+    return 0;
+}
+
+static int nn_ws_connect (const char *addr, void *hint,
+    struct nn_epbase **epbase)
+{
+    int rc;
+    const char *pos;
+    char buf [NN_SOCKADDR_MAX + 1];
+    struct nn_cstream *cstream;
+
+    /*  Check the syntax of the address here. First, check whether port number
+        is OK.  */
+    rc = nn_ws_strip (addr, buf);
+    if (rc < 0)
+        return rc;
+    pos = strrchr (buf, ':');
+    if (!pos)
+        return -EINVAL;
+    ++pos;
+    rc = nn_addr_parse_port (pos, strlen (pos));
+    if (rc < 0)
+        return rc;
+
+    /*  Now check whether local address, in any, is valid. */
+    pos = strchr (buf, ';');
+    if (pos) {
+        rc = nn_addr_parse_local (buf, pos - buf, NN_ADDR_IPV4ONLY,
+            NULL, NULL);
+        if (rc < 0)
+            return rc;
+    }
+
+    /*  Create the async object to handle the connection. */
+    cstream = nn_alloc (sizeof (struct nn_cstream), "cstream (ws)");
+    alloc_assert (cstream);
+    rc = nn_cstream_init (cstream, addr, hint, nn_ws_csockinit,
+        nn_ws_cresolve);
+    if (nn_slow (rc != 0)) {
+        nn_free (cstream);
+        return rc;
+    }
+    *epbase = &cstream->epbase;
+
+    return 0;
+}
+
+/*  Copies the address without the path to 'buf', which must be at least
+    NN_SOCKADDR_MAX + 1 bytes long. */
+static int nn_ws_strip (const char *addr, char *buf)
+{
+    const char *pos;
+    size_t len;
+
+    pos = strchr (addr, '/');
+    len = pos ? (size_t) (pos - addr) : strlen (addr);
+    if (nn_slow (len > NN_SOCKADDR_MAX))
+        return -EINVAL;
+    memcpy (buf, addr, len);
+    buf [len] = 0;
+    return 0;
+}
+
+static int nn_ws_binit (const char *addr, struct nn_usock *usock,
+    struct nn_epbase *epbase, int backlog, int s)
+{
+    int rc;
+    char buf [NN_SOCKADDR_MAX + 1];
+
+    rc = nn_ws_strip (addr, buf);
+    if (rc < 0)
+        return rc;
+    rc = nn_tcp_binit (buf, usock, epbase, backlog, s);
+    if (rc < 0)
+        return rc;
+
+    /*  Accepted sockets inherit the WebSocket mode and act as servers. */
+    nn_usock_setws (usock, 1);
+
+    return 0;
+}
+
+static int nn_ws_csockinit (struct nn_usock *usock, int sndbuf, int rcvbuf,
+    struct nn_epbase *epbase)
+{
+    int rc;
+
+    rc = nn_tcp_csockinit (usock, sndbuf, rcvbuf, epbase);
+    if (nn_slow (rc < 0))
+        return rc;
+    nn_usock_setws (usock, 0);
+
+    return 0;
+}
+
+static int nn_ws_cresolve (const char *addr, struct nn_resolve *resolve,
+    struct sockaddr_storage *local, socklen_t *locallen,
+    struct sockaddr_storage *remote, socklen_t *remotelen, int *nremote)
+{
+    int rc;
+    char buf [NN_SOCKADDR_MAX + 1];
+
+    rc = nn_ws_strip (addr, buf);
+    errnum_assert (rc == 0, -rc);
+    return nn_tcp_cresolve (buf, resolve, local, locallen, remote, remotelen,
+        nremote);
+}
+
@@ -35,8 +35,6 @@
 #endif
 
 /*  Private functions. */
-int nn_addr_parse_literal (const char *addr, size_t addrlen, int flags,
-    struct sockaddr_storage *result, nn_socklen *resultlen);
 void nn_addr_any (int flags, struct sockaddr_storage *result,
     nn_socklen *resultlen);
 
@@ -232,15 +230,28 @@ int nn_addr_parse_remote (const char *addr, size_t addrlen, int flags,
     struct sockaddr_storage *result, nn_socklen *resultlen)
 {
     int rc;
+
+    rc = nn_addr_parse_remotes (addr, addrlen, flags, result, resultlen, 1);
+    return rc < 0 ? rc : 0;
+}
+
+int nn_addr_parse_remotes (const char *addr, size_t addrlen, int flags,
+    struct sockaddr_storage *result, nn_socklen *resultlen, int count)
+{
+    int rc;
+    int i;
     struct addrinfo query;
     struct addrinfo *reply;
+    struct addrinfo *it;
     char hostname [NN_SOCKADDR_MAX];
 
+    nn_assert (count > 0);
+
     /*  Try to resolve the supplied string as a literal address. Note that
         in this case, there's no DNS lookup involved. */
     rc = nn_addr_parse_literal (addr, addrlen, flags, result, resultlen);
     if (rc == 0)
-        return 0;
+        return 1;
     errnum_assert (rc == -EINVAL, -rc);
 
     /*  The name is not a literal.*/
@@ -263,17 +274,20 @@ int nn_addr_parse_remote (const char *addr, size_t addrlen, int flags,
     if (rc)
         return -EFAULT;
 
-    /*  Check that exactly one address is returned and return it to
-        the caller. */
-    nn_assert (reply && !reply->ai_next);
-    if (result)
-        memcpy (result, reply->ai_addr, reply->ai_addrlen);
-    if (resultlen)
-        *resultlen = reply->ai_addrlen;
+    /*  The addresses are already sorted by preference (RFC 6724). Keep
+        the order. */
+    nn_assert (reply);
+    i = 0;
+    for (it = reply; it && i != count; it = it->ai_next, ++i) {
+        if (result)
+            memcpy (&result [i], it->ai_addr, it->ai_addrlen);
+        if (resultlen)
+            resultlen [i] = it->ai_addrlen;
+    }
 
     freeaddrinfo (reply);
-    
-    return 0;
+
+    return i;
 }
 
 int nn_addr_parse_literal (const char *addr, size_t addrlen, int flags,
@@ -46,10 +46,21 @@ int nn_addr_parse_port (const char *port, size_t portlen);
 int nn_addr_parse_local (const char *addr, size_t addrlen, int flags,
     struct sockaddr_storage *result, nn_socklen *resultlen);
 
-/*  Resolves name of a local address into the address itself.
-    TODO:  This should be an asynchronous operation. This way a DNS failure
-    can block the whole system. */
+/*  Resolves name of a remote host into the address itself. This may involve
+    a blocking DNS lookup. Use nn_resolve_start (see resolver.h) to resolve
+    the address from a completion port. */
 int nn_addr_parse_remote (const char *addr, size_t addrlen, int flags,
     struct sockaddr_storage *result, nn_socklen *resultlen);
 
+/*  Same as above, except that if the name resolves to several addresses, up
+    to 'count' of them are stored to 'result' and 'resultlen' arrays in
+    the order they should be tried in. Returns the number of addresses. */
+int nn_addr_parse_remotes (const char *addr, size_t addrlen, int flags,
+    struct sockaddr_storage *result, nn_socklen *resultlen, int count);
+
+/*  Parses an IP address literal. Returns -EINVAL if the string is not
+    a literal. Never does any DNS lookup. */
+int nn_addr_parse_literal (const char *addr, size_t addrlen, int flags,
+    struct sockaddr_storage *result, nn_socklen *resultlen);
+
 #endif
@@ -21,30 +21,187 @@
 */
 
 #include "alloc.h"
+#include "err.h"
+#include "fast.h"
+
+#include <stdlib.h>
+
+/*  The system allocator. It can be replaced only before the first allocation
+    is done, so that no block is ever freed by a different allocator than
+    the one it was allocated by. */
+static void *(*nn_alloc_sysalloc) (size_t size) = malloc;
+static void *(*nn_alloc_sysrealloc) (void *ptr, size_t size) = realloc;
+static void (*nn_alloc_sysfree) (void *ptr) = free;
+static volatile int nn_alloc_used = 0;
+
+int nn_alloc_setfns (void *(*allocfn) (size_t size),
+    void *(*reallocfn) (void *ptr, size_t size), void (*freefn) (void *ptr))
+{
+    if (nn_slow (!allocfn || !reallocfn || !freefn))
+        return -EINVAL;
+    if (nn_slow (nn_alloc_used))
+        return -EBUSY;
+    nn_alloc_sysalloc = allocfn;
+    nn_alloc_sysrealloc = reallocfn;
+    nn_alloc_sysfree = freefn;
+    return 0;
+}
+
+/*  Remember that the allocator is in use. The flag is written only once
+    so that the threads don't keep fighting over its cache line. */
+#define nn_alloc_use() \
+    do {\
+        if (nn_slow (!nn_alloc_used))\
+            nn_alloc_used = 1;\
+    } while (0)
 
 #if defined NN_ALLOC_MONITOR
 
+#include "../nn.h"
+
 #include "mutex.h"
 
-#include <stdlib.h>
 #include <stddef.h>
 #include <stdint.h>
-#include <stdio.h>
+#include <string.h>
+
+/*  The memory is accounted for per allocation name ("tag"). Names beyond
+    NN_ALLOC_MAXTAGS are accounted for together under tag 0. */
+#define NN_ALLOC_MAXTAGS 128
+#define NN_ALLOC_OTHER 0
+
+/*  Size of the hash table mapping name pointers to tags. The same name may
+    be stored at different addresses in different compilation units, so
+    several pointers can map to a single tag. */
+#define NN_ALLOC_SLOTS 512
 
 struct nn_alloc_hdr {
     size_t size;
-    const char *name;
+    size_t tag;
+};
+
+struct nn_alloc_counters {
+    int64_t bytes [NN_ALLOC_MAXTAGS];
+    int64_t blocks [NN_ALLOC_MAXTAGS];
+    uint64_t allocs [NN_ALLOC_MAXTAGS];
 };
 
+struct nn_alloc_slot {
+    const char *volatile name;
+    size_t tag;
+};
+
+/*  Guards the tags, the list of threads and the retired counters. */
 static struct nn_mutex nn_alloc_sync;
-static size_t nn_alloc_bytes;
-static size_t nn_alloc_blocks;
+
+/*  The tags. The slots are read without locking, they are only ever added
+    to under the mutex. */
+static struct nn_alloc_slot nn_alloc_slots [NN_ALLOC_SLOTS];
+static int nn_alloc_nslots;
+static const char *nn_alloc_names [NN_ALLOC_MAXTAGS] = {"other"};
+static int nn_alloc_ntags = 1;
+
+/*  Counters of the threads that have already exited. Without per-thread
+    counters (on Windows) all the allocations are accounted for here. */
+static struct nn_alloc_counters nn_alloc_retired;
+
+static size_t nn_alloc_tag (const char *name);
+static void nn_alloc_account (size_t tag, int64_t bytes, int64_t blocks,
+    uint64_t allocs);
+static void nn_alloc_sum (struct nn_alloc_counters *dst,
+    const struct nn_alloc_counters *src);
+
+#if !defined NN_HAVE_WINDOWS
+
+#include <pthread.h>
+
+/*  Counters of a single thread. Only the owning thread ever modifies them,
+    so the allocation path needs no synchronisation at all. The statistics
+    read them on the fly, which may make the totals slightly out of date. */
+struct nn_alloc_thread {
+    struct nn_alloc_thread *prev;
+    struct nn_alloc_thread *next;
+    struct nn_alloc_counters counters;
+};
+
+static pthread_once_t nn_alloc_once = PTHREAD_ONCE_INIT;
+static pthread_key_t nn_alloc_key;
+static struct nn_alloc_thread *nn_alloc_threads;
+
+static void nn_alloc_setup (void);
+static void nn_alloc_thread_term (void *arg);
+static struct nn_alloc_thread *nn_alloc_thread (void);
+
+void nn_alloc_init (void)
+{
+}
+
+void nn_alloc_term (void)
+{
+}
+
+static void nn_alloc_setup (void)
+{
+    int rc;
+
+    nn_mutex_init (&nn_alloc_sync);
+    rc = pthread_key_create (&nn_alloc_key, nn_alloc_thread_term);
+    errnum_assert (rc == 0, rc);
+}
+
+static void nn_alloc_thread_term (void *arg)
+{
+    struct nn_alloc_thread *thread;
+
+    /*  The thread is exiting. Keep its counters in the retired ones. */
+    thread = (struct nn_alloc_thread*) arg;
+    nn_mutex_lock (&nn_alloc_sync);
+    nn_alloc_sum (&nn_alloc_retired, &thread->counters);
+    if (thread->prev)
+        thread->prev->next = thread->next;
+    else
+        nn_alloc_threads = thread->next;
+    if (thread->next)
+        thread->next->prev = thread->prev;
+    nn_mutex_unlock (&nn_alloc_sync);
+    free (thread);
+}
+
+static struct nn_alloc_thread *nn_alloc_thread (void)
+{
+    int rc;
+    struct nn_alloc_thread *thread;
+
+    rc = pthread_once (&nn_alloc_once, nn_alloc_setup);
+    errnum_assert (rc == 0, rc);
+
+    thread = pthread_getspecific (nn_alloc_key);
+    if (nn_fast (thread != NULL))
+        return thread;
+
+    /*  First allocation in this thread. The counters can't be allocated
+        using nn_alloc, obviously. If there's no memory for them, the thread's
+        allocations are accounted for in the retired counters. */
+    thread = calloc (1, sizeof (struct nn_alloc_thread));
+    if (nn_slow (!thread))
+        return NULL;
+    nn_mutex_lock (&nn_alloc_sync);
+    thread->prev = NULL;
+    thread->next = nn_alloc_threads;
+    if (nn_alloc_threads)
+        nn_alloc_threads->prev = thread;
+    nn_alloc_threads = thread;
+    nn_mutex_unlock (&nn_alloc_sync);
+    rc = pthread_setspecific (nn_alloc_key, thread);
+    errnum_assert (rc == 0, rc);
+    return thread;
+}
+
+#else
 
 void nn_alloc_init (void)
 {
     nn_mutex_init (&nn_alloc_sync);
-    nn_alloc_bytes = 0;
-    nn_alloc_blocks = 0;
 }
 
 void nn_alloc_term (void)
@@ -52,25 +209,21 @@ void nn_alloc_term (void)
     nn_mutex_term (&nn_alloc_sync);
 }
 
+#endif
+
 void *nn_alloc_ (size_t size, const char *name)
 {
-    uint8_t *chunk;
+    struct nn_alloc_hdr *chunk;
 
-    chunk = malloc (sizeof (struct nn_alloc_hdr) + size);
+    nn_alloc_use ();
+    chunk = nn_alloc_sysalloc (sizeof (struct nn_alloc_hdr) + size);
     if (!chunk)
         return NULL;
+    chunk->size = size;
+    chunk->tag = nn_alloc_tag (name);
+    nn_alloc_account (chunk->tag, size, 1, 1);
 
-    nn_mutex_lock (&nn_alloc_sync);
-    ((struct nn_alloc_hdr*) chunk)->size = size;
-    ((struct nn_alloc_hdr*) chunk)->name = name;
-    nn_alloc_bytes += size;
-    ++nn_alloc_blocks;
-    printf ("Allocating %s (%zu bytes)\n", name, size);
-    printf ("Current memory usage: %zu bytes in %zu blocks\n",
-        nn_alloc_bytes, nn_alloc_blocks);
-    nn_mutex_unlock (&nn_alloc_sync);
-
-    return chunk + sizeof (struct nn_alloc_hdr);
+    return chunk + 1;
 }
 
 void *nn_realloc (void *ptr, size_t size)
@@ -79,23 +232,19 @@ void *nn_realloc (void *ptr, size_t size)
     struct nn_alloc_hdr *newchunk;
     size_t oldsize;
 
+    if (!ptr)
+        return nn_alloc_ (size, "realloc");
+
     oldchunk = ((struct nn_alloc_hdr*) ptr) - 1;
     oldsize = oldchunk->size;
-    newchunk = realloc (oldchunk, sizeof (struct nn_alloc_hdr) + size);
+    newchunk = nn_alloc_sysrealloc (oldchunk,
+        sizeof (struct nn_alloc_hdr) + size);
     if (!newchunk)
         return NULL;
     newchunk->size = size;
+    nn_alloc_account (newchunk->tag, (int64_t) size - (int64_t) oldsize, 0, 0);
 
-    nn_mutex_lock (&nn_alloc_sync);
-    nn_alloc_bytes -= oldsize;
-    nn_alloc_bytes += size;
-    printf ("Reallocating %s (%zu bytes to %zu bytes)\n",
-        newchunk->name, oldsize, size);
-    printf ("Current memory usage: %zu bytes in %zu blocks\n",
-        nn_alloc_bytes, nn_alloc_blocks);
-    nn_mutex_unlock (&nn_alloc_sync);
-
-    return newchunk + sizeof (size_t);
+    return newchunk + 1;
 }
 
 void nn_free (void *ptr)
@@ -105,21 +254,142 @@ void nn_free (void *ptr)
     if (!ptr)
         return;
     chunk = ((struct nn_alloc_hdr*) ptr) - 1;
+    nn_alloc_account (chunk->tag, - (int64_t) chunk->size, -1, 0);
+    nn_alloc_sysfree (chunk);
+}
+
+int nn_alloc_stats (struct nn_alloc_stat *stats, int count)
+{
+    int i;
+    int ntags;
+    struct nn_alloc_counters *total;
+#if !defined NN_HAVE_WINDOWS
+    struct nn_alloc_thread *thread;
+
+    /*  Make sure the mutex exists even if nothing was allocated yet. */
+    nn_alloc_thread ();
+#endif
+
+    total = malloc (sizeof (struct nn_alloc_counters));
+    if (!total)
+        return -ENOMEM;
 
     nn_mutex_lock (&nn_alloc_sync);
-    nn_alloc_bytes -= chunk->size;
-    --nn_alloc_blocks;
-    printf ("Deallocating %s (%zu bytes)\n", chunk->name, chunk->size);
-    printf ("Current memory usage: %zu bytes in %zu blocks\n",
-        nn_alloc_bytes, nn_alloc_blocks);
+    memcpy (total, &nn_alloc_retired, sizeof (struct nn_alloc_counters));
+#if !defined NN_HAVE_WINDOWS
+    for (thread = nn_alloc_threads; thread; thread = thread->next)
+        nn_alloc_sum (total, &thread->counters);
+#endif
+    ntags = nn_alloc_ntags;
+    for (i = 0; i != ntags && i != count; ++i) {
+        stats [i].name = nn_alloc_names [i];
+        stats [i].bytes = total->bytes [i];
+        stats [i].blocks = total->blocks [i];
+        stats [i].allocs = total->allocs [i];
+    }
     nn_mutex_unlock (&nn_alloc_sync);
 
-    free (chunk);
+    free (total);
+    return ntags;
 }
 
-#else
+static size_t nn_alloc_tag (const char *name)
+{
+    size_t pos;
+    size_t tag;
+    int i;
+    const char *slotname;
 
-#include <stdlib.h>
+    /*  Fast path. The name was already seen. */
+    pos = (size_t) (((uintptr_t) name >> 2) % NN_ALLOC_SLOTS);
+    while (1) {
+        slotname = nn_alloc_slots [pos].name;
+        if (nn_fast (slotname == name))
+            return nn_alloc_slots [pos].tag;
+        if (!slotname)
+            break;
+        pos = (pos + 1) % NN_ALLOC_SLOTS;
+    }
+
+    /*  New name pointer. Map it to the tag with the same name or create
+        a new tag. The table is never filled up more than half so that the
+        lookups stay short and always terminate. */
+#if !defined NN_HAVE_WINDOWS
+    nn_alloc_thread ();
+#endif
+    nn_mutex_lock (&nn_alloc_sync);
+    while (nn_alloc_slots [pos].name) {
+        if (nn_alloc_slots [pos].name == name) {
+            tag = nn_alloc_slots [pos].tag;
+            nn_mutex_unlock (&nn_alloc_sync);
+            return tag;
+        }
+        pos = (pos + 1) % NN_ALLOC_SLOTS;
+    }
+    tag = NN_ALLOC_OTHER;
+    for (i = 1; i != nn_alloc_ntags; ++i)
+        if (strcmp (nn_alloc_names [i], name) == 0)
+            break;
+    if (i != nn_alloc_ntags)
+        tag = i;
+    else if (nn_alloc_ntags != NN_ALLOC_MAXTAGS) {
+        tag = nn_alloc_ntags;
+        nn_alloc_names [nn_alloc_ntags++] = name;
+    }
+    if (nn_alloc_nslots < NN_ALLOC_SLOTS / 2) {
+
+        /*  The tag is stored before the name is published. A reader
+            that sees the name but not the tag yet ends up accounting
+            the allocation to tag 0, which is harmless. */
+        nn_alloc_slots [pos].tag = tag;
+#if defined NN_HAVE_GCC_ATOMIC_BUILTINS
+        __sync_synchronize ();
+#endif
+        nn_alloc_slots [pos].name = name;
+        ++nn_alloc_nslots;
+    }
+    nn_mutex_unlock (&nn_alloc_sync);
+    return tag;
+}
+
+static void nn_alloc_account (size_t tag, int64_t bytes, int64_t blocks,
+    uint64_t allocs)
+{
+    struct nn_alloc_counters *counters;
+#if !defined NN_HAVE_WINDOWS
+    struct nn_alloc_thread *thread;
+
+    thread = nn_alloc_thread ();
+    if (nn_fast (thread != NULL)) {
+        counters = &thread->counters;
+        counters->bytes [tag] += bytes;
+        counters->blocks [tag] += blocks;
+        counters->allocs [tag] += allocs;
+        return;
+    }
+#endif
+
+    nn_mutex_lock (&nn_alloc_sync);
+    counters = &nn_alloc_retired;
+    counters->bytes [tag] += bytes;
+    counters->blocks [tag] += blocks;
+    counters->allocs [tag] += allocs;
+    nn_mutex_unlock (&nn_alloc_sync);
+}
+
+static void nn_alloc_sum (struct nn_alloc_counters *dst,
+    const struct nn_alloc_counters *src)
+{
+    int i;
+
+    for (i = 0; i != NN_ALLOC_MAXTAGS; ++i) {
+        dst->bytes [i] += src->bytes [i];
+        dst->blocks [i] += src->blocks [i];
+        dst->allocs [i] += src->allocs [i];
+    }
+}
+
+#else
 
 void nn_alloc_init (void)
 {
@@ -131,18 +401,25 @@ void nn_alloc_term (void)
 
 void *nn_alloc_ (size_t size)
 {
-    return malloc (size);
+    nn_alloc_use ();
+    return nn_alloc_sysalloc (size);
 }
 
 void *nn_realloc (void *ptr, size_t size)
 {
-    return realloc (ptr, size);
+    nn_alloc_use ();
+    return nn_alloc_sysrealloc (ptr, size);
 }
 
 void nn_free (void *ptr)
 {
-    free (ptr);
+    if (ptr)
+        nn_alloc_sysfree (ptr);
 }
 
-#endif
+int nn_alloc_stats (struct nn_alloc_stat *stats, int count)
+{
+    return -ENOTSUP;
+}
 
+#endif
@@ -30,6 +30,11 @@
 
 void nn_alloc_init (void);
 void nn_alloc_term (void);
+
+/*  Replaces the system allocator used by all the functions below. Fails with
+    -EBUSY once anything was allocated. */
+int nn_alloc_setfns (void *(*allocfn) (size_t size),
+    void *(*reallocfn) (void *ptr, size_t size), void (*freefn) (void *ptr));
 void *nn_realloc (void *ptr, size_t size);
 void nn_free (void *ptr);
 
@@ -41,4 +46,12 @@ void *nn_alloc_ (size_t size, const char *name);
 void *nn_alloc_ (size_t size);
 #endif
 
+/*  With NN_ALLOC_MONITOR, the memory allocated by the library is accounted
+    for per allocation name. Fills in up to 'count' elements of 'stats', one
+    per name, and returns the number of the names seen so far, which may be
+    greater than 'count'. Returns -ENOTSUP if the monitoring is not compiled
+    in. */
+struct nn_alloc_stat;
+int nn_alloc_stats (struct nn_alloc_stat *stats, int count);
+
 #endif
@@ -48,7 +48,8 @@ static const struct nn_cp_sink nn_astream_state_connected = {
 };
 
 void nn_astream_init (struct nn_astream *self, struct nn_epbase *epbase,
-    int s, struct nn_usock *usock, struct nn_bstream *bstream)
+    int s, struct nn_usock *usock, struct nn_bstream *bstream,
+    const uint8_t *hdr)
 {
     int sndbuf;
     int rcvbuf;
@@ -74,6 +75,8 @@ void nn_astream_init (struct nn_astream *self, struct nn_epbase *epbase,
     /*  Start the stream state machine. */
     nn_usock_init_child (&self->usock, usock, s, &self->sink, sndbuf, rcvbuf,
         usock->cp);
+    if (bstream->acceptfn)
+        bstream->acceptfn (&self->usock, epbase);
     
     /*  Note: must add myself to the astreams list *before* initializing my
         stream, which may fail and terminate me. */
@@ -82,7 +85,10 @@ void nn_astream_init (struct nn_astream *self, struct nn_epbase *epbase,
 
     /*  Note: may fail and terminate me - do not reference self after
         this point! */
-    nn_stream_init (&self->stream, epbase, &self->usock);
+    if (hdr)
+        nn_stream_adopt (&self->stream, epbase, &self->usock, hdr);
+    else
+        nn_stream_init (&self->stream, epbase, &self->usock);
 }
 
 static void nn_astream_connected_err (const struct nn_cp_sink **self,
@@ -48,8 +48,12 @@ struct nn_astream {
     struct nn_list_item item;
 };
 
+/*  If 'hdr' is not NULL, 's' is an established connection handed off by
+    another process (see nn_handoff) and 'hdr' is the protocol header
+    the peer sent. */
 void nn_astream_init (struct nn_astream *self, struct nn_epbase *epbase,
-    int s, struct nn_usock *usock, struct nn_bstream *bstream);
+    int s, struct nn_usock *usock, struct nn_bstream *bstream,
+    const uint8_t *hdr);
 void nn_astream_close (struct nn_astream *self);
 
 #endif
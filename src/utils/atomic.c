@@ -42,6 +42,8 @@ uint32_t nn_atomic_inc (struct nn_atomic *self, uint32_t n)
 {
 #if defined NN_ATOMIC_WINAPI
     return (uint32_t) InterlockedExchangeAdd ((LONG*) &self->n, n);
+#elif defined NN_ATOMIC_GCC_MEMORY_MODEL
+    return __atomic_fetch_add (&self->n, n, __ATOMIC_SEQ_CST);
 #elif defined NN_ATOMIC_GCC_BUILTINS
     return (uint32_t) __sync_fetch_and_add (&self->n, n);
 #elif defined NN_ATOMIC_MUTEX
@@ -60,6 +62,8 @@ uint32_t nn_atomic_dec (struct nn_atomic *self, uint32_t n)
 {
 #if defined NN_ATOMIC_WINAPI
     return (uint32_t) InterlockedExchangeAdd ((LONG*) &self->n, -((LONG) n));
+#elif defined NN_ATOMIC_GCC_MEMORY_MODEL
+    return __atomic_fetch_sub (&self->n, n, __ATOMIC_SEQ_CST);
 #elif defined NN_ATOMIC_GCC_BUILTINS
     return (uint32_t) __sync_fetch_and_sub (&self->n, n);
 #elif defined NN_ATOMIC_MUTEX
@@ -74,3 +78,213 @@ uint32_t nn_atomic_dec (struct nn_atomic *self, uint32_t n)
 #endif
 }
 
+uint32_t nn_atomic_get (struct nn_atomic *self)
+{
+#if defined NN_ATOMIC_WINAPI
+    return (uint32_t) InterlockedExchangeAdd ((LONG*) &self->n, 0);
+#elif defined NN_ATOMIC_GCC_MEMORY_MODEL
+    return __atomic_load_n (&self->n, __ATOMIC_SEQ_CST);
+#elif defined NN_ATOMIC_GCC_BUILTINS
+    return (uint32_t) __sync_fetch_and_add (&self->n, 0);
+#elif defined NN_ATOMIC_MUTEX
+    uint32_t res;
+    nn_mutex_lock (&self->sync);
+    res = self->n;
+    nn_mutex_unlock (&self->sync);
+    return res;
+#else
+#error
+#endif
+}
+
+uint32_t nn_atomic_load (struct nn_atomic *self)
+{
+#if defined NN_ATOMIC_WINAPI
+    return (uint32_t) InterlockedExchangeAdd ((LONG*) &self->n, 0);
+#elif defined NN_ATOMIC_GCC_MEMORY_MODEL
+    return __atomic_load_n (&self->n, __ATOMIC_ACQUIRE);
+#elif defined NN_ATOMIC_GCC_BUILTINS && defined __ATOMIC_ACQUIRE
+    return (uint32_t) __atomic_load_n (&self->n, __ATOMIC_ACQUIRE);
+#elif defined NN_ATOMIC_GCC_BUILTINS
+    return (uint32_t) __sync_fetch_and_add (&self->n, 0);
+#elif defined NN_ATOMIC_MUTEX
+    return nn_atomic_get (self);
+#else
+#error
+#endif
+}
+
+void nn_atomic_store (struct nn_atomic *self, uint32_t n)
+{
+#if defined NN_ATOMIC_WINAPI
+    InterlockedExchange ((LONG*) &self->n, (LONG) n);
+#elif defined NN_ATOMIC_GCC_MEMORY_MODEL
+    __atomic_store_n (&self->n, n, __ATOMIC_RELEASE);
+#elif defined NN_ATOMIC_GCC_BUILTINS && defined __ATOMIC_RELEASE
+    __atomic_store_n (&self->n, n, __ATOMIC_RELEASE);
+#elif defined NN_ATOMIC_GCC_BUILTINS
+    __sync_synchronize ();
+    self->n = n;
+#elif defined NN_ATOMIC_MUTEX
+    nn_mutex_lock (&self->sync);
+    self->n = n;
+    nn_mutex_unlock (&self->sync);
+#else
+#error
+#endif
+}
+
+int nn_atomic_cas (struct nn_atomic *self, uint32_t oldval, uint32_t newval)
+{
+#if defined NN_ATOMIC_WINAPI
+    return InterlockedCompareExchange ((LONG*) &self->n, (LONG) newval,
+        (LONG) oldval) == (LONG) oldval ? 1 : 0;
+#elif defined NN_ATOMIC_GCC_MEMORY_MODEL
+    return __atomic_compare_exchange_n (&self->n, &oldval, newval, 0,
+        __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST) ? 1 : 0;
+#elif defined NN_ATOMIC_GCC_BUILTINS
+    return __sync_bool_compare_and_swap (&self->n, oldval, newval) ? 1 : 0;
+#elif defined NN_ATOMIC_MUTEX
+    int res;
+    nn_mutex_lock (&self->sync);
+    res = self->n == oldval ? 1 : 0;
+    if (res)
+        self->n = newval;
+    nn_mutex_unlock (&self->sync);
+    return res;
+#else
+#error
+#endif
+}
+
+void nn_atomic_addref (struct nn_atomic *self, uint32_t n)
+{
+#if defined NN_ATOMIC_GCC_MEMORY_MODEL
+    __atomic_fetch_add (&self->n, n, __ATOMIC_RELAXED);
+#else
+    nn_atomic_inc (self, n);
+#endif
+}
+
+uint32_t nn_atomic_decref (struct nn_atomic *self, uint32_t n)
+{
+#if defined NN_ATOMIC_GCC_MEMORY_MODEL
+    uint32_t res;
+
+    res = __atomic_fetch_sub (&self->n, n, __ATOMIC_RELEASE);
+    if (res <= n)
+        __atomic_thread_fence (__ATOMIC_ACQUIRE);
+    return res;
+#else
+    return nn_atomic_dec (self, n);
+#endif
+}
+
+void nn_atomic64_init (struct nn_atomic64 *self, uint64_t n)
+{
+    self->n = n;
+#if defined NN_ATOMIC64_MUTEX
+    nn_mutex_init (&self->sync);
+#endif
+}
+
+void nn_atomic64_term (struct nn_atomic64 *self)
+{
+#if defined NN_ATOMIC64_MUTEX
+    nn_mutex_term (&self->sync);
+#endif
+}
+
+uint64_t nn_atomic64_inc (struct nn_atomic64 *self, uint64_t n)
+{
+#if defined NN_ATOMIC_WINAPI
+    return (uint64_t) InterlockedExchangeAdd64 ((LONGLONG*) &self->n,
+        (LONGLONG) n);
+#elif defined NN_ATOMIC_GCC_MEMORY_MODEL
+    return __atomic_fetch_add (&self->n, n, __ATOMIC_SEQ_CST);
+#elif defined NN_ATOMIC64_MUTEX
+    uint64_t res;
+    nn_mutex_lock (&self->sync);
+    res = self->n;
+    self->n += n;
+    nn_mutex_unlock (&self->sync);
+    return res;
+#else
+#error
+#endif
+}
+
+uint64_t nn_atomic64_dec (struct nn_atomic64 *self, uint64_t n)
+{
+#if defined NN_ATOMIC_WINAPI
+    return (uint64_t) InterlockedExchangeAdd64 ((LONGLONG*) &self->n,
+        -((LONGLONG) n));
+#elif defined NN_ATOMIC_GCC_MEMORY_MODEL
+    return __atomic_fetch_sub (&self->n, n, __ATOMIC_SEQ_CST);
+#elif defined NN_ATOMIC64_MUTEX
+    uint64_t res;
+    nn_mutex_lock (&self->sync);
+    res = self->n;
+    self->n -= n;
+    nn_mutex_unlock (&self->sync);
+    return res;
+#else
+#error
+#endif
+}
+
+uint64_t nn_atomic64_load (struct nn_atomic64 *self)
+{
+#if defined NN_ATOMIC_WINAPI
+    return (uint64_t) InterlockedCompareExchange64 ((LONGLONG*) &self->n,
+        0, 0);
+#elif defined NN_ATOMIC_GCC_MEMORY_MODEL
+    return __atomic_load_n (&self->n, __ATOMIC_ACQUIRE);
+#elif defined NN_ATOMIC64_MUTEX
+    uint64_t res;
+    nn_mutex_lock (&self->sync);
+    res = self->n;
+    nn_mutex_unlock (&self->sync);
+    return res;
+#else
+#error
+#endif
+}
+
+void nn_atomic64_store (struct nn_atomic64 *self, uint64_t n)
+{
+#if defined NN_ATOMIC_WINAPI
+    InterlockedExchange64 ((LONGLONG*) &self->n, (LONGLONG) n);
+#elif defined NN_ATOMIC_GCC_MEMORY_MODEL
+    __atomic_store_n (&self->n, n, __ATOMIC_RELEASE);
+#elif defined NN_ATOMIC64_MUTEX
+    nn_mutex_lock (&self->sync);
+    self->n = n;
+    nn_mutex_unlock (&self->sync);
+#else
+#error
+#endif
+}
+
+int nn_atomic64_cas (struct nn_atomic64 *self, uint64_t oldval,
+    uint64_t newval)
+{
+#if defined NN_ATOMIC_WINAPI
+    return InterlockedCompareExchange64 ((LONGLONG*) &self->n,
+        (LONGLONG) newval, (LONGLONG) oldval) == (LONGLONG) oldval ? 1 : 0;
+#elif defined NN_ATOMIC_GCC_MEMORY_MODEL
+    return __atomic_compare_exchange_n (&self->n, &oldval, newval, 0,
+        __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST) ? 1 : 0;
+#elif defined NN_ATOMIC64_MUTEX
+    int res;
+    nn_mutex_lock (&self->sync);
+    res = self->n == oldval ? 1 : 0;
+    if (res)
+        self->n = newval;
+    nn_mutex_unlock (&self->sync);
+    return res;
+#else
+#error
+#endif
+}
+
@@ -44,6 +44,8 @@ AS_IF([test "x$gcc_style_sync_atomic" = "xyes"], [
 #if defined NN_HAVE_WINDOWS
 #include "win.h"
 #define NN_ATOMIC_WINAPI
+#elif defined NN_HAVE_GCC_ATOMIC_MEMORY_MODEL
+#define NN_ATOMIC_GCC_MEMORY_MODEL
 #elif defined NN_HAVE_GCC_ATOMIC_BUILTINS
 #define NN_ATOMIC_GCC_BUILTINS
 #else
@@ -51,6 +53,15 @@ AS_IF([test "x$gcc_style_sync_atomic" = "xyes"], [
 #define NN_ATOMIC_MUTEX
 #endif
 
+/*  Lock-free 64-bit operations are not available with the older __sync
+    builtins on all platforms. Use a mutex instead. */
+#if defined NN_ATOMIC_GCC_BUILTINS
+#include "mutex.h"
+#define NN_ATOMIC64_MUTEX
+#elif defined NN_ATOMIC_MUTEX
+#define NN_ATOMIC64_MUTEX
+#endif
+
 #include <stdint.h>
 
 struct nn_atomic {
@@ -66,11 +77,56 @@ void nn_atomic_init (struct nn_atomic *self, uint32_t n);
 /*  Destroy the object. */
 void nn_atomic_term (struct nn_atomic *self);
 
-/*  Atomically add n to the object, return old value of the object. */
+/*  Atomically add n to the object, return old value of the object. Acts as
+    a full memory barrier. */
 uint32_t nn_atomic_inc (struct nn_atomic *self, uint32_t n);
 
-/*  Atomically subtract n from the object, return old value of the object. */
+/*  Atomically subtract n from the object, return old value of the object.
+    Acts as a full memory barrier. */
 uint32_t nn_atomic_dec (struct nn_atomic *self, uint32_t n);
 
+/*  Return current value of the object. Acts as a full memory barrier. */
+uint32_t nn_atomic_get (struct nn_atomic *self);
+
+/*  Return current value of the object. Unlike nn_atomic_get() it's only
+    guaranteed that subsequent memory accesses are not moved before it
+    (acquire semantics), which makes it much cheaper on most platforms. */
+uint32_t nn_atomic_load (struct nn_atomic *self);
+
+/*  Set the object to value 'n'. It's only guaranteed that preceding memory
+    accesses are not moved after it (release semantics). */
+void nn_atomic_store (struct nn_atomic *self, uint32_t n);
+
+/*  If the value of the object is 'oldval', atomically replace it by
+    'newval' and return 1. Otherwise, return 0. */
+int nn_atomic_cas (struct nn_atomic *self, uint32_t oldval, uint32_t newval);
+
+/*  Reference counting. nn_atomic_addref adds n references. The caller
+    already holds one, so no ordering is needed (relaxed semantics).
+    nn_atomic_decref drops n references and returns the old value. Accesses
+    to the object preceding the call are not moved after it (release
+    semantics) and, if the last reference was dropped, subsequent accesses,
+    i.e. the deallocation, are not moved before it (acquire semantics). */
+void nn_atomic_addref (struct nn_atomic *self, uint32_t n);
+uint32_t nn_atomic_decref (struct nn_atomic *self, uint32_t n);
+
+/*  64-bit counterpart of nn_atomic. The functions have the same semantics as
+    their 32-bit equivalents. */
+struct nn_atomic64 {
+#if defined NN_ATOMIC64_MUTEX
+    struct nn_mutex sync;
+#endif
+    volatile uint64_t n;
+};
+
+void nn_atomic64_init (struct nn_atomic64 *self, uint64_t n);
+void nn_atomic64_term (struct nn_atomic64 *self);
+uint64_t nn_atomic64_inc (struct nn_atomic64 *self, uint64_t n);
+uint64_t nn_atomic64_dec (struct nn_atomic64 *self, uint64_t n);
+uint64_t nn_atomic64_load (struct nn_atomic64 *self);
+void nn_atomic64_store (struct nn_atomic64 *self, uint64_t n);
+int nn_atomic64_cas (struct nn_atomic64 *self, uint64_t oldval,
+    uint64_t newval);
+
 #endif
 
@@ -27,10 +27,17 @@
 #include "addr.h"
 #include "alloc.h"
 #include "fast.h"
+#include "handoff.h"
 
 #include <string.h>
 
 /*  Private functions. */
+static int nn_bstream_init_aux (struct nn_bstream *self, const char *addr,
+    void *hint, int (*initfn) (const char *addr, struct nn_usock *usock,
+    struct nn_epbase *epbase, int backlog, int s),
+    int (*countfn) (struct nn_epbase *epbase),
+    void (*acceptfn) (struct nn_usock *usock, struct nn_epbase *epbase),
+    int backlog, const int *fds, int nfds);
 static void nn_bstream_term (struct nn_bstream *self);
 
 /*  States. */
@@ -40,8 +47,11 @@ static const struct nn_cp_sink nn_bstream_state_terminating2;
 
 /*  Implementation of nn_epbase interface. */
 static int nn_bstream_close (struct nn_epbase *self);
+static int nn_bstream_handoff (struct nn_epbase *self, int fd);
+static int nn_bstream_adoptpipe (struct nn_epbase *self, int s,
+    const void *state, size_t len);
 static const struct nn_epbase_vfptr nn_bstream_epbase_vfptr =
-    {nn_bstream_close};
+    {nn_bstream_close, nn_bstream_handoff, nn_bstream_adoptpipe};
 
 /******************************************************************************/
 /*  State: LISTENING                                                          */
@@ -59,27 +69,83 @@ static const struct nn_cp_sink nn_bstream_state_listening = {
 };
 
 int nn_bstream_init (struct nn_bstream *self, const char *addr, void *hint,
-    int (*initfn) (const char *addr, struct nn_usock *usock, struct nn_cp *cp,
-    int backlog), int backlog)
+    int (*initfn) (const char *addr, struct nn_usock *usock,
+    struct nn_epbase *epbase, int backlog, int s),
+    int (*countfn) (struct nn_epbase *epbase),
+    void (*acceptfn) (struct nn_usock *usock, struct nn_epbase *epbase),
+    int backlog)
+{
+    return nn_bstream_init_aux (self, addr, hint, initfn, countfn, acceptfn,
+        backlog, NULL, 0);
+}
+
+int nn_bstream_adopt (struct nn_bstream *self, const char *addr, void *hint,
+    int (*initfn) (const char *addr, struct nn_usock *usock,
+    struct nn_epbase *epbase, int backlog, int s),
+    void (*acceptfn) (struct nn_usock *usock, struct nn_epbase *epbase),
+    int backlog, const int *fds, int nfds)
+{
+    if (nn_slow (nfds < 1)) {
+        nn_handoff_closefds (fds, nfds);
+        return -EPROTO;
+    }
+    return nn_bstream_init_aux (self, addr, hint, initfn, NULL, acceptfn,
+        backlog, fds, nfds);
+}
+
+static int nn_bstream_init_aux (struct nn_bstream *self, const char *addr,
+    void *hint, int (*initfn) (const char *addr, struct nn_usock *usock,
+    struct nn_epbase *epbase, int backlog, int s),
+    int (*countfn) (struct nn_epbase *epbase),
+    void (*acceptfn) (struct nn_usock *usock, struct nn_epbase *epbase),
+    int backlog, const int *fds, int nfds)
 {
     int rc;
+    int i;
 
     /*  Start in LISTENING state. */
     self->sink = &nn_bstream_state_listening;
     nn_list_init (&self->astreams);
+    self->acceptfn = acceptfn;
     nn_epbase_init (&self->epbase, &nn_bstream_epbase_vfptr, addr, hint);
 
-    /*  Open the listening socket. */
-    rc = initfn (addr, &self->usock, nn_epbase_getcp (&self->epbase), backlog);
-    nn_usock_setsink (&self->usock, &self->sink);
+    /*  Allocate the listening sockets. The endpoint taken over from another
+        process keeps the sockets it had there. */
+    if (fds)
+        self->nusocks = nfds;
+    else
+        self->nusocks = countfn ? countfn (&self->epbase) : 1;
+    nn_assert (self->nusocks >= 1);
+    self->usocks = nn_alloc (sizeof (struct nn_usock) * self->nusocks,
+        "listening sockets");
+    alloc_assert (self->usocks);
+    self->nopen = self->nusocks;
+
+    /*  Open the first listening socket. If the address is invalid, this is
+        where it fails. */
+    rc = initfn (addr, &self->usocks [0], &self->epbase, backlog,
+        fds ? fds [0] : -1);
+    nn_usock_setsink (&self->usocks [0], &self->sink);
     if (nn_slow (rc < 0)) {
+        if (fds)
+            nn_handoff_closefds (fds, nfds);
+        nn_free (self->usocks);
         nn_epbase_term (&self->epbase);
         nn_list_term (&self->astreams);
         return rc;
     }
 
-    /*  Start waiting for incoming connection. */
-    nn_usock_accept (&self->usock);
+    /*  Open the remaining listening sockets. */
+    for (i = 1; i != self->nusocks; ++i) {
+        rc = initfn (addr, &self->usocks [i], &self->epbase, backlog,
+            fds ? fds [i] : -1);
+        errnum_assert (rc == 0, -rc);
+        nn_usock_setsink (&self->usocks [i], &self->sink);
+    }
+
+    /*  Start waiting for incoming connections. */
+    for (i = 0; i != self->nusocks; ++i)
+        nn_usock_accept (&self->usocks [i]);
 
     return 0;
 }
@@ -97,7 +163,81 @@ static void nn_bstream_listening_accepted (const struct nn_cp_sink **self,
     
     /*  Note: astream may be terminated after this call -
         do not reference it. */
-    nn_astream_init (astream, &bstream->epbase, s, usock, bstream);
+    nn_astream_init (astream, &bstream->epbase, s, usock, bstream, NULL);
+
+    /*  Start waiting for the next incoming connection. */
+    nn_usock_accept (usock);
+}
+
+static int nn_bstream_handoff (struct nn_epbase *self, int fd)
+{
+    int rc;
+    int i;
+    int fds [NN_HANDOFF_MAXFDS];
+    uint8_t hdr [8];
+    struct nn_bstream *bstream;
+    struct nn_list_item *it;
+    struct nn_astream *astream;
+
+    bstream = nn_cont (self, struct nn_bstream, epbase);
+
+    /*  The endpoint is being closed already. */
+    if (bstream->sink != &nn_bstream_state_listening)
+        return 0;
+
+    /*  Pass the listening sockets over. */
+    nn_assert (bstream->nusocks <= NN_HANDOFF_MAXFDS);
+    for (i = 0; i != bstream->nusocks; ++i)
+        fds [i] = nn_usock_getfd (&bstream->usocks [i]);
+    rc = nn_epbase_handoff (self, fd, fds, bstream->nusocks);
+    if (nn_slow (rc < 0))
+        return rc;
+
+    /*  Pass over the connections that are at a message boundary and close
+        them here. The remaining ones are closed along with the endpoint
+        and their peers reconnect. Closing the connection may deallocate
+        the astream, so take care to get the next one before the call. */
+    it = nn_list_begin (&bstream->astreams);
+    while (it != nn_list_end (&bstream->astreams)) {
+        astream = nn_cont (it, struct nn_astream, item);
+        it = nn_list_next (&bstream->astreams, it);
+        if (nn_stream_handoff (&astream->stream, hdr) < 0)
+            continue;
+        rc = nn_epbase_handoffpipe (self, fd,
+            nn_usock_getfd (&astream->usock), hdr, sizeof (hdr));
+        if (nn_slow (rc < 0))
+            return rc;
+        nn_astream_close (astream);
+    }
+
+    return 1;
+}
+
+static int nn_bstream_adoptpipe (struct nn_epbase *self, int s,
+    const void *state, size_t len)
+{
+    int server;
+    struct nn_bstream *bstream;
+    struct nn_astream *astream;
+
+    bstream = nn_cont (self, struct nn_bstream, epbase);
+
+    /*  The state of the connection is the protocol header sent by the peer.
+        TLS and WebSocket connections are never handed off. */
+    if (nn_slow (len != 8 ||
+          nn_usock_gettls (&bstream->usocks [0], &server) ||
+          nn_usock_getws (&bstream->usocks [0], &server)))
+        return -EPROTO;
+
+    astream = nn_alloc (sizeof (struct nn_astream), "astream");
+    alloc_assert (astream);
+
+    /*  Note: astream may be terminated after this call -
+        do not reference it. */
+    nn_astream_init (astream, &bstream->epbase, s, &bstream->usocks [0],
+        bstream, (const uint8_t*) state);
+
+    return 0;
 }
 
 /******************************************************************************/
@@ -119,13 +259,24 @@ static const struct nn_cp_sink nn_bstream_state_terminating1 = {
 
 static int nn_bstream_close (struct nn_epbase *self)
 {
+    int i;
+    int nusocks;
     struct nn_bstream *bstream;
 
     bstream = nn_cont (self, struct nn_bstream, epbase);
 
-    /*  Close the listening socket itself. */
+    /*  The endpoint is being closed already, e.g. after it was handed off
+        and the socket is being closed now. */
+    if (bstream->sink != &nn_bstream_state_listening)
+        return -EINPROGRESS;
+
+    /*  Close the listening sockets themselves. Once the last one is closed
+        the object may be deallocated straight away, so it must not be
+        accessed afterwards. */
     bstream->sink = &nn_bstream_state_terminating1;
-    nn_usock_close (&bstream->usock);
+    nusocks = bstream->nusocks;
+    for (i = 0; i != nusocks; ++i)
+        nn_usock_close (&bstream->usocks [i]);
 
     return -EINPROGRESS;
 }
@@ -139,18 +290,23 @@ static void nn_bstream_terminating1_closed (const struct nn_cp_sink **self,
 
     bstream = nn_cont (self, struct nn_bstream, sink);
 
-    /*  Listening socket is closed. Switch from TERMINATING1 to TERMINATING2
-        state and start closing individual sessions. */
-    nn_assert (bstream->sink == &nn_bstream_state_terminating1);
-    bstream->sink = &nn_bstream_state_terminating2;
+    /*  Wait till all the listening sockets are closed. */
+    --bstream->nopen;
+    if (bstream->nopen)
+        return;
 
-    /*  Ask all the associated sessions to close. */
+    /*  Listening sockets are closed. Ask all the associated sessions to
+        close. The sessions may close synchronously, so the object is
+        switched from TERMINATING1 to TERMINATING2 state only afterwards,
+        otherwise it would be deallocated by the last of them. */
+    nn_assert (bstream->sink == &nn_bstream_state_terminating1);
     it = nn_list_begin (&bstream->astreams);
     while (it != nn_list_end (&bstream->astreams)) {
         astream = nn_cont (it, struct nn_astream, item);
         it = nn_list_next (&bstream->astreams, it);
         nn_astream_close (astream);
     }
+    bstream->sink = &nn_bstream_state_terminating2;
 
     /*  If there are no sessions left, we can terminate straight away. */
     if (nn_list_empty (&bstream->astreams)) {
@@ -193,6 +349,7 @@ void nn_bstream_astream_closed (struct nn_bstream *self,
 
 static void nn_bstream_term (struct nn_bstream *self)
 {
+    nn_free (self->usocks);
     nn_epbase_term (&self->epbase);
 }
 
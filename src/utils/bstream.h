@@ -39,16 +39,44 @@ struct nn_bstream {
     /*  This object is an endpoint. */
     struct nn_epbase epbase;
 
-    /*  The listening socket. */
-    struct nn_usock usock;
+    /*  The listening sockets. Usually there's only one, however, multiple
+        sockets bound to the same address can be used to spread the incoming
+        connections among several accept queues. */
+    struct nn_usock *usocks;
+    int nusocks;
+
+    /*  Number of listening sockets that are still open while the endpoint
+        is being closed. */
+    int nopen;
+
+    /*  Called for each accepted connection, NULL if not needed. */
+    void (*acceptfn) (struct nn_usock *usock, struct nn_epbase *epbase);
 
     /*  List of all sockets accepted via this endpoint. */
     struct nn_list astreams;
 };
 
+/*  'initfn' opens a listening socket or, if 's' is not -1, sets up
+    the listening socket 's' passed over from another process. 'countfn'
+    returns the number of the listening sockets to open. If it is NULL,
+    a single socket is used. 'acceptfn', if not NULL, tunes each accepted
+    socket before the stream is started on it. */
 int nn_bstream_init (struct nn_bstream *self, const char *addr, void *hint,
-    int (*initfn) (const char *addr, struct nn_usock *usock, struct nn_cp *cp,
-    int backlog), int backlog);
+    int (*initfn) (const char *addr, struct nn_usock *usock,
+    struct nn_epbase *epbase, int backlog, int s),
+    int (*countfn) (struct nn_epbase *epbase),
+    void (*acceptfn) (struct nn_usock *usock, struct nn_epbase *epbase),
+    int backlog);
+
+/*  Same as nn_bstream_init, except that the endpoint takes over
+    the listening sockets 'fds' of an endpoint handed off by another process
+    (see nn_handoff) instead of opening its own. The sockets are closed
+    in case of failure. */
+int nn_bstream_adopt (struct nn_bstream *self, const char *addr, void *hint,
+    int (*initfn) (const char *addr, struct nn_usock *usock,
+    struct nn_epbase *epbase, int backlog, int s),
+    void (*acceptfn) (struct nn_usock *usock, struct nn_epbase *epbase),
+    int backlog, const int *fds, int nfds);
 
 void nn_bstream_astream_closed (struct nn_bstream *self,
     struct nn_astream *astream);
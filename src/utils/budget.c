@@ -0,0 +1,166 @@
+/*
+    Copyright (c) 2012-2013 250bpm s.r.o.
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"),
+    to deal in the Software without restriction, including without limitation
+    the rights to use, copy, modify, merge, publish, distribute, sublicense,
+    and/or sell copies of the Software, and to permit persons to whom
+    the Software is furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included
+    in all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+    THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+    FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+    IN THE SOFTWARE.
+*/
+
+#include "budget.h"
+#include "err.h"
+#include "fast.h"
+#include "cont.h"
+
+/*  Private functions. */
+static void nn_budget_notify (struct nn_budget *self);
+
+void nn_budget_init (struct nn_budget *self, uint64_t max)
+{
+    nn_mutex_init (&self->sync);
+    nn_atomic64_init (&self->max, max);
+    nn_atomic64_init (&self->used, 0);
+    nn_atomic64_init (&self->waits, 0);
+    nn_list_init (&self->waiters);
+}
+
+void nn_budget_term (struct nn_budget *self)
+{
+    nn_assert (nn_list_empty (&self->waiters));
+
+    nn_list_term (&self->waiters);
+    nn_atomic64_term (&self->waits);
+    nn_atomic64_term (&self->used);
+    nn_atomic64_term (&self->max);
+    nn_mutex_term (&self->sync);
+}
+
+void nn_budget_setmax (struct nn_budget *self, uint64_t max)
+{
+    nn_mutex_lock (&self->sync);
+    nn_atomic64_store (&self->max, max);
+    if (!nn_budget_isfull (self))
+        nn_budget_notify (self);
+    nn_mutex_unlock (&self->sync);
+}
+
+uint64_t nn_budget_used (struct nn_budget *self)
+{
+    return nn_atomic64_load (&self->used);
+}
+
+uint64_t nn_budget_waits (struct nn_budget *self)
+{
+    return nn_atomic64_load (&self->waits);
+}
+
+void nn_budget_take (struct nn_budget *self, size_t size)
+{
+    nn_atomic64_inc (&self->used, size);
+}
+
+void nn_budget_give (struct nn_budget *self, size_t size)
+{
+    uint64_t max;
+    uint64_t used;
+
+    if (!size)
+        return;
+
+    /*  Only the release that takes the usage below the limit has to wake
+        the waiters up. Those that started waiting earlier are already in
+        the list by the time the lock is acquired, the later ones see that
+        the limit is not reached any more. */
+    used = nn_atomic64_dec (&self->used, size);
+    max = nn_atomic64_load (&self->max);
+    if (nn_fast (!max || used < max || used - size >= max))
+        return;
+    nn_mutex_lock (&self->sync);
+    nn_budget_notify (self);
+    nn_mutex_unlock (&self->sync);
+}
+
+int nn_budget_isfull (struct nn_budget *self)
+{
+    uint64_t max;
+
+    max = nn_atomic64_load (&self->max);
+    return max && nn_atomic64_load (&self->used) >= max;
+}
+
+int nn_budget_wait (struct nn_budget *self, struct nn_budget_waiter *waiter)
+{
+    if (nn_fast (!nn_budget_isfull (self)))
+        return 0;
+
+    nn_mutex_lock (&self->sync);
+    if (nn_list_item_isinlist (&waiter->item) || waiter->notified) {
+        nn_mutex_unlock (&self->sync);
+        return 1;
+    }
+    if (!nn_budget_isfull (self)) {
+        nn_mutex_unlock (&self->sync);
+        return 0;
+    }
+    nn_list_insert (&self->waiters, &waiter->item,
+        nn_list_end (&self->waiters));
+    nn_atomic64_inc (&self->waits, 1);
+    nn_mutex_unlock (&self->sync);
+    return 1;
+}
+
+void nn_budget_notified (struct nn_budget *self,
+    struct nn_budget_waiter *waiter)
+{
+    nn_mutex_lock (&self->sync);
+    waiter->notified = 0;
+    nn_mutex_unlock (&self->sync);
+}
+
+void nn_budget_cancel (struct nn_budget *self,
+    struct nn_budget_waiter *waiter)
+{
+    nn_mutex_lock (&self->sync);
+    if (nn_list_item_isinlist (&waiter->item))
+        nn_list_erase (&self->waiters, &waiter->item);
+    waiter->notified = 0;
+    nn_mutex_unlock (&self->sync);
+}
+
+void nn_budget_waiter_init (struct nn_budget_waiter *self, nn_budget_fn *fn)
+{
+    self->fn = fn;
+    nn_list_item_init (&self->item);
+    self->notified = 0;
+}
+
+void nn_budget_waiter_term (struct nn_budget_waiter *self)
+{
+    nn_list_item_term (&self->item);
+}
+
+static void nn_budget_notify (struct nn_budget *self)
+{
+    struct nn_budget_waiter *waiter;
+
+    while (!nn_list_empty (&self->waiters)) {
+        waiter = nn_cont (nn_list_begin (&self->waiters),
+            struct nn_budget_waiter, item);
+        nn_list_erase (&self->waiters, &waiter->item);
+        waiter->notified = 1;
+        waiter->fn (waiter);
+    }
+}
@@ -0,0 +1,99 @@
+/*
+    Copyright (c) 2012-2013 250bpm s.r.o.
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"),
+    to deal in the Software without restriction, including without limitation
+    the rights to use, copy, modify, merge, publish, distribute, sublicense,
+    and/or sell copies of the Software, and to permit persons to whom
+    the Software is furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included
+    in all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+    THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+    FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+    IN THE SOFTWARE.
+*/
+
+#ifndef NN_BUDGET_INCLUDED
+#define NN_BUDGET_INCLUDED
+
+#include "atomic.h"
+#include "mutex.h"
+#include "list.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*  Memory budget shared by a number of pipes. The pipes draw from it as they
+    hold messages and give the memory back once the messages are passed on.
+    A single message may take the usage over the limit. Once it is reached,
+    the pipes stop accepting messages and wait for the usage to drop below
+    the limit again. The object is thread-safe. */
+
+struct nn_budget_waiter;
+
+/*  Invoked when the usage dropped below the limit. It's called from the
+    thread that released the memory, with the budget locked, so it should
+    do no more than schedule the waiter to proceed. */
+typedef void nn_budget_fn (struct nn_budget_waiter *self);
+
+/*  'notified' is set from the moment the waiter is notified until it
+    acknowledges the notification, so that it is not notified twice. */
+struct nn_budget_waiter {
+    nn_budget_fn *fn;
+    struct nn_list_item item;
+    int notified;
+};
+
+struct nn_budget {
+    struct nn_mutex sync;
+    struct nn_atomic64 max;
+    struct nn_atomic64 used;
+    struct nn_atomic64 waits;
+    struct nn_list waiters;
+};
+
+/*  Initialise the budget. Zero limit means no limit. */
+void nn_budget_init (struct nn_budget *self, uint64_t max);
+void nn_budget_term (struct nn_budget *self);
+
+/*  Change the limit. The waiters are notified if the usage is below the new
+    limit. */
+void nn_budget_setmax (struct nn_budget *self, uint64_t max);
+
+/*  Returns the memory in use at the moment and the number of times
+    the waiters had to wait. */
+uint64_t nn_budget_used (struct nn_budget *self);
+uint64_t nn_budget_waits (struct nn_budget *self);
+
+/*  Draw 'size' bytes from the budget, respectively give them back. */
+void nn_budget_take (struct nn_budget *self, size_t size);
+void nn_budget_give (struct nn_budget *self, size_t size);
+
+/*  Returns 1 if the limit was reached, 0 otherwise. */
+int nn_budget_isfull (struct nn_budget *self);
+
+/*  If the limit was reached, arranges for the waiter to be notified once
+    the usage drops below it and returns 1. Otherwise returns 0. A waiter
+    that is already waiting, or was notified but didn't acknowledge it yet,
+    is not registered again. */
+int nn_budget_wait (struct nn_budget *self, struct nn_budget_waiter *waiter);
+
+/*  Acknowledge the notification. The waiter may wait again afterwards. */
+void nn_budget_notified (struct nn_budget *self,
+    struct nn_budget_waiter *waiter);
+
+/*  Stop waiting. Once it returns, the waiter won't be notified any more. */
+void nn_budget_cancel (struct nn_budget *self,
+    struct nn_budget_waiter *waiter);
+
+void nn_budget_waiter_init (struct nn_budget_waiter *self, nn_budget_fn *fn);
+void nn_budget_waiter_term (struct nn_budget_waiter *self);
+
+#endif
@@ -0,0 +1,37 @@
+/*
+    Copyright (c) 2013 250bpm s.r.o.
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"),
+    to deal in the Software without restriction, including without limitation
+    the rights to use, copy, modify, merge, publish, distribute, sublicense,
+    and/or sell copies of the Software, and to permit persons to whom
+    the Software is furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included
+    in all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+    THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+    FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+    IN THE SOFTWARE.
+*/
+
+#ifndef NN_CACHELINE_INCLUDED
+#define NN_CACHELINE_INCLUDED
+
+/*  Size of the cache line on the most common platforms. */
+#define NN_CACHELINE_SIZE 64
+
+/*  Padding to put between the fields of a structure that are written by
+    different threads, so that they never share a cache line and the threads
+    don't invalidate each other's caches (false sharing). It's the padding
+    rather than the alignment of the structure that matters, so it works
+    irrespective of how the structure was allocated. */
+#define NN_CACHELINE_PAD(name) char name [NN_CACHELINE_SIZE]
+
+#endif
+
@@ -0,0 +1,101 @@
+/*
+    Copyright (c) 2012 250bpm s.r.o.
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"),
+    to deal in the Software without restriction, including without limitation
+    the rights to use, copy, modify, merge, publish, distribute, sublicense,
+    and/or sell copies of the Software, and to permit persons to whom
+    the Software is furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included
+    in all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+    THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+    FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+    IN THE SOFTWARE.
+*/
+
+#include "capture.h"
+#include "alloc.h"
+#include "clock.h"
+#include "err.h"
+#include "fast.h"
+#include "wire.h"
+
+#include <stdio.h>
+#include <string.h>
+
+/*  Size of the stdio buffer. Records are written to the file once it's
+    full, so that capturing costs a copy of 16 bytes per message. */
+#define NN_CAPTURE_BUFSIZE (64 * 1024)
+
+struct nn_capture {
+    FILE *file;
+    uint64_t start;
+    char *buf;
+    char *path;
+};
+
+int nn_capture_open (struct nn_capture **result, const char *path,
+    size_t len, int protocol)
+{
+    int rc;
+    struct nn_capture *self;
+    uint8_t hdr [NN_CAPTURE_HDRSIZE];
+
+    self = nn_alloc (sizeof (struct nn_capture) + len + 1, "capture");
+    alloc_assert (self);
+    self->path = (char*) (self + 1);
+    memcpy (self->path, path, len);
+    self->path [len] = 0;
+
+    self->file = fopen (self->path, "wb");
+    if (nn_slow (!self->file)) {
+        rc = -errno;
+        nn_free (self);
+        return rc;
+    }
+    self->buf = nn_alloc (NN_CAPTURE_BUFSIZE, "capture buffer");
+    alloc_assert (self->buf);
+    rc = setvbuf (self->file, self->buf, _IOFBF, NN_CAPTURE_BUFSIZE);
+    nn_assert (rc == 0);
+
+    memcpy (hdr, NN_CAPTURE_MAGIC, 4);
+    nn_puts (hdr + 4, NN_CAPTURE_VERSION);
+    nn_puts (hdr + 6, (uint16_t) protocol);
+    nn_putll (hdr + 8, nn_clock_realtime ());
+    fwrite (hdr, 1, sizeof (hdr), self->file);
+    self->start = nn_clock_monotonic ();
+
+    *result = self;
+    return 0;
+}
+
+void nn_capture_close (struct nn_capture *self)
+{
+    fclose (self->file);
+    nn_free (self->buf);
+    nn_free (self);
+}
+
+const char *nn_capture_path (struct nn_capture *self)
+{
+    return self->path;
+}
+
+void nn_capture_record (struct nn_capture *self, int recv, uint32_t pipe,
+    size_t size)
+{
+    uint8_t rec [NN_CAPTURE_RECSIZE];
+
+    nn_putll (rec, nn_clock_monotonic () - self->start);
+    nn_putl (rec + 8, size > 0xffffffff ? 0xffffffff : (uint32_t) size);
+    nn_putl (rec + 12, (pipe & ~NN_CAPTURE_RECV) |
+        (recv ? NN_CAPTURE_RECV : 0));
+    fwrite (rec, 1, sizeof (rec), self->file);
+}
@@ -0,0 +1,73 @@
+/*
+    Copyright (c) 2012 250bpm s.r.o.
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"),
+    to deal in the Software without restriction, including without limitation
+    the rights to use, copy, modify, merge, publish, distribute, sublicense,
+    and/or sell copies of the Software, and to permit persons to whom
+    the Software is furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included
+    in all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+    THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+    FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+    IN THE SOFTWARE.
+*/
+
+#ifndef NN_CAPTURE_INCLUDED
+#define NN_CAPTURE_INCLUDED
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*  Records the metadata of the messages passed through a socket into
+    a binary file, so that the traffic can be replayed later on. The file
+    consists of a 16-byte header followed by 16-byte records, one per
+    message. All the numbers are in network byte order.
+
+    Header:
+        magic ("NNCP", 4 bytes)
+        version (NN_CAPTURE_VERSION, 2 bytes)
+        socket type, e.g. NN_PUSH (2 bytes)
+        wall-clock time of the start of the capture, in nanoseconds since
+            the epoch (8 bytes)
+
+    Record:
+        time since the start of the capture, in nanoseconds (8 bytes)
+        size of the message body, in bytes, saturated at 2^32-1 (4 bytes)
+        direction (NN_CAPTURE_RECV in the top bit, 0 for the messages sent)
+            and the pipe ID, unique within the socket (4 bytes)
+
+    The records are buffered and written in the order they are made. */
+
+#define NN_CAPTURE_MAGIC "NNCP"
+#define NN_CAPTURE_VERSION 1
+#define NN_CAPTURE_HDRSIZE 16
+#define NN_CAPTURE_RECSIZE 16
+#define NN_CAPTURE_RECV 0x80000000u
+
+struct nn_capture;
+
+/*  Creates the file 'path', 'len' bytes long, and writes the header into it.
+    Returns -errno if the file can't be created. */
+int nn_capture_open (struct nn_capture **result, const char *path,
+    size_t len, int protocol);
+
+/*  Flushes the records and closes the file. */
+void nn_capture_close (struct nn_capture *self);
+
+/*  Returns the path the capture was opened with, NUL-terminated. */
+const char *nn_capture_path (struct nn_capture *self);
+
+/*  Adds a record. 'recv' is 1 for a received message, 0 for a sent one.
+    The caller has to serialise the calls. */
+void nn_capture_record (struct nn_capture *self, int recv, uint32_t pipe,
+    size_t size);
+
+#endif
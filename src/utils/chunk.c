@@ -20,53 +20,351 @@
     IN THE SOFTWARE.
 */
 
+#if defined NN_USE_MEMFD
+/*  Must be defined before any system header is included to make memfd_create
+    and file sealing available. */
+#define _GNU_SOURCE
+#endif
+
 #include "chunk.h"
+#include "chunkpool.h"
 #include "alloc.h"
 #include "fast.h"
 #include "err.h"
 
 #include <string.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#if !defined NN_HAVE_WINDOWS
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
 
 #define NN_CHUNK_TAG 0xdeadcafe
 
+static struct nn_chunk *nn_chunk_place (uint8_t *base, uint8_t *data);
+static struct nn_chunk *nn_chunk_move (struct nn_chunk *self, uint8_t *data);
+
 static void nn_chunk_default_free (void *p);
 static const struct nn_chunk_vfptr nn_chunk_default_vfptr = {
     nn_chunk_default_free
 };
 
-struct nn_chunk *nn_chunk_alloc (size_t size, int type)
+static const struct nn_chunk_vfptr nn_chunk_pool_vfptr = {
+    nn_chunkpool_free
+};
+
+/*  User-defined allocation mechanisms. */
+static void *(*nn_chunk_user_alloc [NN_CHUNK_MAX - NN_CHUNK_USER])
+    (size_t size);
+static struct nn_chunk_vfptr nn_chunk_user_vfptr [NN_CHUNK_MAX -
+    NN_CHUNK_USER];
+
+/*  The reserved space must keep the data aligned. */
+CT_ASSERT (NN_CHUNK_RESERVE % 8 == 0);
+
+/*  Alignment of the chunk header. Trimming and extending the data move
+    the header by whole multiples of it, so that the data may start at any
+    address. */
+struct nn_chunk_align {
+    char c;
+    struct nn_chunk chunk;
+};
+#define NN_CHUNK_ALIGN offsetof (struct nn_chunk_align, chunk)
+
+/*  Returns the place of the header of the chunk whose data start at 'data'. */
+#define NN_CHUNK_HDR(data) ((struct nn_chunk*) (((uintptr_t) (data) - \
+    sizeof (struct nn_chunk)) & ~((uintptr_t) NN_CHUNK_ALIGN - 1)))
+
+/*  Header of an external chunk. It's immediately followed by the chunk
+    header, however, the data live in the user's buffer. */
+struct nn_chunk_ext {
+    void *buf;
+    void (*ffn) (void *buf, void *arg);
+    void *arg;
+
+    /*  The data currently referred to by the chunk. They may start later than
+        'buf' if the chunk was trimmed. */
+    void *data;
+};
+
+static void nn_chunk_ext_free (void *p);
+static const struct nn_chunk_vfptr nn_chunk_ext_vfptr = {
+    nn_chunk_ext_free
+};
+
+#if !defined NN_HAVE_WINDOWS
+
+/*  Argument of the deallocation function of a chunk created by nn_chunk_file.
+    The data start at 'offset' in the file and 'skip' bytes into the mapping,
+    which begins at the page boundary. */
+struct nn_chunk_file {
+    int fd;
+    uint64_t offset;
+    void *map;
+    size_t mapsize;
+};
+
+static void nn_chunk_file_free (void *buf, void *arg);
+
+#endif
+
+#if defined NN_USE_MEMFD
+
+/*  Header stored at the beginning of a memory file mapping. The chunk's data
+    start NN_CHUNK_FD_HEADROOM bytes into the file, leaving space for the
+    headers of the chunk, including the one created by the receiver. */
+struct nn_chunk_fd {
+    int fd;
+    size_t mapsize;
+};
+
+#define NN_CHUNK_FD_HEADROOM 4096
+
+static struct nn_chunk *nn_chunk_fd_alloc (size_t size);
+static void nn_chunk_fd_free (void *p);
+static const struct nn_chunk_vfptr nn_chunk_fd_vfptr = {
+    nn_chunk_fd_free
+};
+
+#endif
+
+int nn_chunk_alloc (size_t size, int type, struct nn_chunk **result)
 {
     size_t sz;
     struct nn_chunk *self;
+    const struct nn_chunk_vfptr *vfptr;
 
     /*  Allocate the actual memory depending on the type. */
-    sz = size + sizeof (struct nn_chunk);
+#if defined NN_USE_MEMFD
+    /*  Large shared chunks are allocated in memory files if possible. In
+        the case of failure, fall back to the standard allocation mechanism.
+        Creating the file costs several system calls and a file descriptor
+        for the lifetime of the chunk, so it's done only when asked for. */
+    if (nn_slow (type == NN_CHUNK_SHARED &&
+          size >= NN_CHUNK_FD_THRESHOLD)) {
+        self = nn_chunk_fd_alloc (size);
+        if (self) {
+            *result = self;
+            return 0;
+        }
+    }
+#endif
+
+    sz = NN_CHUNK_RESERVE + size + sizeof (struct nn_chunk);
+    if (nn_slow (sz < size))
+        return -ENOMEM;
     switch (type) {
-    case 0:
+    case NN_CHUNK_DEFAULT:
+    case NN_CHUNK_SHARED:
         self = nn_alloc (sz, "message chunk");
+        alloc_assert (self);
+        vfptr = &nn_chunk_default_vfptr;
+        break;
+    case NN_CHUNK_POOL:
+        self = nn_chunkpool_alloc (sz);
+        alloc_assert (self);
+        vfptr = &nn_chunk_pool_vfptr;
         break;
     default:
-        return NULL;
+        if (nn_slow (type < NN_CHUNK_USER || type >= NN_CHUNK_MAX ||
+              !nn_chunk_user_alloc [type - NN_CHUNK_USER]))
+            return -EINVAL;
+
+        /*  User-defined allocators, such as fixed-size arenas, may run out
+            of memory. Let the user know instead of failing. */
+        self = nn_chunk_user_alloc [type - NN_CHUNK_USER] (sz);
+        if (nn_slow (!self))
+            return -ENOMEM;
+        vfptr = &nn_chunk_user_vfptr [type - NN_CHUNK_USER];
+        break;
     }
-    alloc_assert (self);
 
-    /*  Fill in the chunk header. */
+    /*  Fill in the chunk header. It follows the reserved space. */
+    self = nn_chunk_place ((uint8_t*) self,
+        ((uint8_t*) self) + NN_CHUNK_RESERVE + sizeof (struct nn_chunk));
+    self->tag = NN_CHUNK_TAG;
+    nn_atomic_init (&self->refcount, 1);
+    self->vfptr = vfptr;
+    self->size = size;
+
+    *result = self;
+    return 0;
+}
+
+int nn_chunk_setallocator (int type, void *(*alloc) (size_t size),
+    void (*free) (void *p))
+{
+    if (nn_slow (type < NN_CHUNK_USER || type >= NN_CHUNK_MAX))
+        return -EINVAL;
+    if (nn_slow (alloc && !free))
+        return -EINVAL;
+
+    nn_chunk_user_alloc [type - NN_CHUNK_USER] = alloc;
+    nn_chunk_user_vfptr [type - NN_CHUNK_USER].free = free;
+    return 0;
+}
+
+struct nn_chunk *nn_chunk_ext (void *buf, size_t size,
+    void (*ffn) (void *buf, void *arg), void *arg)
+{
+    struct nn_chunk_ext *ext;
+    struct nn_chunk *self;
+
+    ext = nn_alloc (sizeof (struct nn_chunk_ext) + sizeof (struct nn_chunk),
+        "external chunk");
+    if (nn_slow (!ext))
+        return NULL;
+    ext->buf = buf;
+    ext->ffn = ffn;
+    ext->arg = arg;
+    ext->data = buf;
+
+    self = (struct nn_chunk*) (ext + 1);
     self->tag = NN_CHUNK_TAG;
-    self->offset = 0;
+    self->offset = sizeof (struct nn_chunk_ext);
+    self->pad = 0;
     nn_atomic_init (&self->refcount, 1);
-    self->vfptr = &nn_chunk_default_vfptr;
+    self->vfptr = &nn_chunk_ext_vfptr;
     self->size = size;
 
     return self;
 }
 
+#if !defined NN_HAVE_WINDOWS
+
+int nn_chunk_file (int fd, uint64_t offset, size_t size,
+    struct nn_chunk **result)
+{
+    int rc;
+    struct stat st;
+    long pagesize;
+    size_t skip;
+    struct nn_chunk_file *file;
+    struct nn_chunk *self;
+
+    file = nn_alloc (sizeof (struct nn_chunk_file), "file chunk");
+    alloc_assert (file);
+    file->fd = fcntl (fd, F_DUPFD_CLOEXEC, 0);
+    if (nn_slow (file->fd < 0)) {
+        nn_free (file);
+        return -EBADF;
+    }
+
+    /*  Reading past the end of the file would crash the process, so the
+        range has to be there. Of course, the file must not be truncated
+        while the chunk is in use. */
+    rc = fstat (file->fd, &st);
+    errno_assert (rc == 0);
+    if (nn_slow (!S_ISREG (st.st_mode) || offset + size < offset ||
+          offset + size > (uint64_t) st.st_size)) {
+        rc = -EINVAL;
+        goto fail;
+    }
+
+    /*  The mapping is private so that the library, which may store headers
+        in front of the message data, never modifies the file. */
+    pagesize = sysconf (_SC_PAGESIZE);
+    skip = (size_t) (offset % (uint64_t) pagesize);
+    file->offset = offset;
+    file->mapsize = skip + size;
+    file->map = NULL;
+    if (size) {
+        if (nn_slow (file->mapsize < size ||
+              (uint64_t) (off_t) (offset - skip) != offset - skip)) {
+            rc = -ENOMEM;
+            goto fail;
+        }
+        file->map = mmap (NULL, file->mapsize, PROT_READ | PROT_WRITE,
+            MAP_PRIVATE, file->fd, (off_t) (offset - skip));
+        if (nn_slow (file->map == MAP_FAILED)) {
+            rc = -ENOMEM;
+            goto fail;
+        }
+    }
+
+    self = nn_chunk_ext (file->map ? ((uint8_t*) file->map) + skip : NULL,
+        size, nn_chunk_file_free, file);
+    if (nn_slow (!self)) {
+        if (file->map)
+            munmap (file->map, file->mapsize);
+        rc = -ENOMEM;
+        goto fail;
+    }
+    *result = self;
+    return 0;
+
+fail:
+    close (file->fd);
+    nn_free (file);
+    return rc;
+}
+
+int nn_chunk_getfile (struct nn_chunk *self, uint64_t *offset)
+{
+#if defined NN_USE_SENDFILE
+    struct nn_chunk_ext *ext;
+    struct nn_chunk_file *file;
+
+    if (self->vfptr != &nn_chunk_ext_vfptr)
+        return -1;
+    ext = (struct nn_chunk_ext*) (((uint8_t*) self) - self->offset);
+    if (ext->ffn != nn_chunk_file_free)
+        return -1;
+    file = (struct nn_chunk_file*) ext->arg;
+    *offset = file->offset + (((uint8_t*) ext->data) - ((uint8_t*) ext->buf));
+    return file->fd;
+#else
+    return -1;
+#endif
+}
+
+static void nn_chunk_file_free (void *buf, void *arg)
+{
+    int rc;
+    struct nn_chunk_file *file;
+
+    file = (struct nn_chunk_file*) arg;
+    if (file->map) {
+        rc = munmap (file->map, file->mapsize);
+        errno_assert (rc == 0);
+    }
+    rc = close (file->fd);
+    errno_assert (rc == 0);
+    nn_free (file);
+}
+
+#else
+
+int nn_chunk_file (int fd, uint64_t offset, size_t size,
+    struct nn_chunk **result)
+{
+    return -ENOTSUP;
+}
+
+int nn_chunk_getfile (struct nn_chunk *self, uint64_t *offset)
+{
+    return -1;
+}
+
+#endif
+
+int nn_chunk_isext (struct nn_chunk *self)
+{
+    return self->vfptr == &nn_chunk_ext_vfptr ? 1 : 0;
+}
+
 void nn_chunk_free (struct nn_chunk *self)
 {
     nn_assert (self->tag == NN_CHUNK_TAG);
 
     /*  Decrement the reference count. Actual deallocation happens only if
         it drops to zero. */
-    if (nn_atomic_dec (&self->refcount, 1) <= 1) {
+    if (nn_atomic_decref (&self->refcount, 1) <= 1) {
         
         /*  Mark chunk as deallocated. */
         self->tag = 0;
@@ -82,7 +380,7 @@ void nn_chunk_free (struct nn_chunk *self)
 void nn_chunk_addref (struct nn_chunk *self, uint32_t n)
 {
     nn_assert (self->tag == NN_CHUNK_TAG);
-    nn_atomic_inc (&self->refcount, n);
+    nn_atomic_addref (&self->refcount, n);
 }
 
 static void nn_chunk_default_free (void *p)
@@ -90,21 +388,35 @@ static void nn_chunk_default_free (void *p)
     nn_free (p);
 }
 
+static void nn_chunk_ext_free (void *p)
+{
+    struct nn_chunk_ext *ext;
+
+    ext = (struct nn_chunk_ext*) p;
+    if (ext->ffn)
+        ext->ffn (ext->buf, ext->arg);
+    nn_free (ext);
+}
+
 struct nn_chunk *nn_chunk_from_data (void *data)
 {
     struct nn_chunk *chunk;
 
     if (nn_slow (!data))
         return NULL;
-    chunk = ((struct nn_chunk*) data) - 1;
-    if (nn_slow (chunk->tag != NN_CHUNK_TAG))
+    chunk = NN_CHUNK_HDR (data);
+    if (nn_slow (chunk->tag != NN_CHUNK_TAG ||
+          ((uint8_t*) (chunk + 1)) + chunk->pad != (uint8_t*) data))
         return NULL;
     return chunk;
 }
 
 void *nn_chunk_data (struct nn_chunk *self)
 {
-    return (void*) (self + 1);
+    if (nn_slow (self->vfptr == &nn_chunk_ext_vfptr))
+        return ((struct nn_chunk_ext*) (((uint8_t*) self) -
+            self->offset))->data;
+    return (void*) (((uint8_t*) (self + 1)) + self->pad);
 }
 
 size_t nn_chunk_size (struct nn_chunk *self)
@@ -114,19 +426,236 @@ size_t nn_chunk_size (struct nn_chunk *self)
 
 struct nn_chunk *nn_chunk_trim (struct nn_chunk *self, size_t n)
 {
+    int rc;
     struct nn_chunk *newself;
+    struct nn_chunk_ext *ext;
 
     /*  Sanity check. We cannot trim more bytes than there are in the chunk. */
     nn_assert (self->size >= n);
 
-    /*  Move the chunk header to the new place. */
-    newself = (struct nn_chunk*) (((uint8_t*) self) + n);
-    memmove (newself, self, sizeof (struct nn_chunk));
+    /*  The other references expect the data to stay where they are. */
+    if (nn_slow (nn_atomic_load (&self->refcount) > 1)) {
+        rc = nn_chunk_alloc (self->size - n, NN_CHUNK_DEFAULT, &newself);
+        errnum_assert (rc == 0, -rc);
+        memcpy (nn_chunk_data (newself),
+            ((uint8_t*) nn_chunk_data (self)) + n, self->size - n);
+        nn_chunk_free (self);
+        return newself;
+    }
+
+    /*  The header of an external chunk is not followed by the data. */
+    if (nn_slow (self->vfptr == &nn_chunk_ext_vfptr)) {
+        ext = (struct nn_chunk_ext*) (((uint8_t*) self) - self->offset);
+        ext->data = ((uint8_t*) ext->data) + n;
+        self->size -= n;
+        return self;
+    }
 
-    /*  Adjust the header. */
-    newself->offset += n;
+    /*  Move the chunk header to the new place. */
+    newself = nn_chunk_move (self, ((uint8_t*) nn_chunk_data (self)) + n);
     newself->size -= n;
 
     return newself;
 }
 
+size_t nn_chunk_headroom (struct nn_chunk *self)
+{
+    if (nn_atomic_load (&self->refcount) > 1)
+        return 0;
+
+    /*  The space in front of the data of the other chunks holds their own
+        bookkeeping. External chunks have none, memory file chunks may be
+        mapped by the local peers. */
+    if (self->vfptr == &nn_chunk_ext_vfptr)
+        return 0;
+#if defined NN_USE_MEMFD
+    if (self->vfptr == &nn_chunk_fd_vfptr)
+        return 0;
+#endif
+
+    /*  The allocated block is aligned, so the header still fits in front
+        of the data once they've been extended to the very beginning. */
+    return self->offset + self->pad;
+}
+
+struct nn_chunk *nn_chunk_push (struct nn_chunk *self, size_t n)
+{
+    struct nn_chunk *newself;
+
+    nn_assert (nn_chunk_headroom (self) >= n);
+
+    /*  Move the chunk header to the new place. */
+    newself = nn_chunk_move (self, ((uint8_t*) nn_chunk_data (self)) - n);
+    newself->size += n;
+
+    return newself;
+}
+
+static struct nn_chunk *nn_chunk_place (uint8_t *base, uint8_t *data)
+{
+    struct nn_chunk *self;
+
+    self = NN_CHUNK_HDR (data);
+    nn_assert ((uint8_t*) self >= base);
+    self->offset = (uint32_t) (((uint8_t*) self) - base);
+    self->pad = (uint32_t) (data - ((uint8_t*) (self + 1)));
+    return self;
+}
+
+static struct nn_chunk *nn_chunk_move (struct nn_chunk *self, uint8_t *data)
+{
+    uint8_t *base;
+    struct nn_chunk *newself;
+
+    base = ((uint8_t*) self) - self->offset;
+    newself = NN_CHUNK_HDR (data);
+    if (newself != self)
+        memmove (newself, self, sizeof (struct nn_chunk));
+    return nn_chunk_place (base, data);
+}
+
+#if defined NN_USE_MEMFD
+
+static struct nn_chunk *nn_chunk_fd_alloc (size_t size)
+{
+    int rc;
+    int fd;
+    size_t mapsize;
+    uint8_t *base;
+    struct nn_chunk_fd *hdr;
+    struct nn_chunk *self;
+
+    mapsize = NN_CHUNK_FD_HEADROOM + size;
+    if (nn_slow (mapsize < size))
+        return NULL;
+
+    /*  Create the file and make sure the receiver can rely on its size. */
+    fd = memfd_create ("nanomsg", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+    if (nn_slow (fd < 0))
+        return NULL;
+    rc = ftruncate (fd, mapsize);
+    if (nn_slow (rc != 0))
+        goto fail;
+    rc = fcntl (fd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_SEAL);
+    if (nn_slow (rc != 0))
+        goto fail;
+    base = mmap (NULL, mapsize, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (nn_slow (base == MAP_FAILED))
+        goto fail;
+
+    hdr = (struct nn_chunk_fd*) base;
+    hdr->fd = fd;
+    hdr->mapsize = mapsize;
+
+    /*  The chunk header is placed immediately before the data. */
+    self = nn_chunk_place (base, base + NN_CHUNK_FD_HEADROOM);
+    self->tag = NN_CHUNK_TAG;
+    nn_atomic_init (&self->refcount, 1);
+    self->vfptr = &nn_chunk_fd_vfptr;
+    self->size = size;
+    return self;
+
+fail:
+    rc = close (fd);
+    errno_assert (rc == 0);
+    return NULL;
+}
+
+static void nn_chunk_fd_free (void *p)
+{
+    int rc;
+    int fd;
+    struct nn_chunk_fd *hdr;
+
+    hdr = (struct nn_chunk_fd*) p;
+    fd = hdr->fd;
+    rc = munmap (p, hdr->mapsize);
+    errno_assert (rc == 0);
+    if (fd >= 0) {
+        rc = close (fd);
+        errno_assert (rc == 0);
+    }
+}
+
+int nn_chunk_getfd (struct nn_chunk *self, size_t *offset)
+{
+    uint8_t *base;
+    struct nn_chunk_fd *hdr;
+
+    if (self->vfptr != &nn_chunk_fd_vfptr)
+        return -1;
+    base = ((uint8_t*) self) - self->offset;
+    hdr = (struct nn_chunk_fd*) base;
+    if (hdr->fd < 0)
+        return -1;
+    *offset = ((uint8_t*) nn_chunk_data (self)) - base;
+    return hdr->fd;
+}
+
+int nn_chunk_mapfd (int fd, size_t offset, size_t size, size_t headroom,
+    struct nn_chunk **result)
+{
+    int rc;
+    int seals;
+    struct stat st;
+    size_t mapsize;
+    uint8_t *base;
+    struct nn_chunk_fd *hdr;
+    struct nn_chunk *self;
+
+    /*  The headers have to fit in front of the data and the file must not be
+        shrunk by the peer while it's mapped, otherwise accessing the data
+        could crash the process. */
+    mapsize = offset + size;
+    if (nn_slow (mapsize < size || offset < sizeof (struct nn_chunk_fd) +
+          sizeof (struct nn_chunk) + headroom || offset > UINT32_MAX))
+        goto inval;
+    seals = fcntl (fd, F_GET_SEALS);
+    if (nn_slow (seals < 0 || !(seals & F_SEAL_SHRINK)))
+        goto inval;
+    rc = fstat (fd, &st);
+    errno_assert (rc == 0);
+    if (nn_slow (st.st_size < 0 || (uint64_t) st.st_size < mapsize))
+        goto inval;
+
+    /*  The mapping is private so that the headers can be written into it
+        without affecting the peer. Only the touched pages get copied. */
+    base = mmap (NULL, mapsize, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    if (nn_slow (base == MAP_FAILED))
+        goto inval;
+    rc = close (fd);
+    errno_assert (rc == 0);
+
+    hdr = (struct nn_chunk_fd*) base;
+    hdr->fd = -1;
+    hdr->mapsize = mapsize;
+
+    self = nn_chunk_place (base, base + offset - headroom);
+    self->tag = NN_CHUNK_TAG;
+    nn_atomic_init (&self->refcount, 1);
+    self->vfptr = &nn_chunk_fd_vfptr;
+    self->size = headroom + size;
+
+    *result = self;
+    return 0;
+
+inval:
+    rc = close (fd);
+    errno_assert (rc == 0);
+    return -EINVAL;
+}
+
+#else
+
+int nn_chunk_getfd (struct nn_chunk *self, size_t *offset)
+{
+    return -1;
+}
+
+int nn_chunk_mapfd (int fd, size_t offset, size_t size, size_t headroom,
+    struct nn_chunk **result)
+{
+    return -EINVAL;
+}
+
+#endif
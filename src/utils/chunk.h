@@ -28,6 +28,29 @@
 #include <stdint.h>
 #include <stddef.h>
 
+/*  Allocation mechanisms. The values match the 'type' argument of
+    nn_allocmsg. */
+#define NN_CHUNK_DEFAULT 0
+#define NN_CHUNK_POOL 1
+#define NN_CHUNK_SHARED 2
+#define NN_CHUNK_USER 16
+#define NN_CHUNK_MAX 32
+
+/*  Space reserved in front of the data of newly allocated chunks, so that
+    headers can be prepended to the data without copying them. The value can
+    be set at build time using CHUNK_RESERVE CMake option. */
+#ifndef NN_CHUNK_RESERVE
+#define NN_CHUNK_RESERVE 32
+#endif
+
+/*  NN_CHUNK_SHARED chunks of at least this size are allocated in anonymous
+    memory files, if the platform supports it, so that they can be passed to
+    local peers by file descriptor rather than by copying the data. Smaller
+    ones, as well as all the other types, are allocated as usual. */
+#ifndef NN_CHUNK_FD_THRESHOLD
+#define NN_CHUNK_FD_THRESHOLD (1024 * 1024)
+#endif
+
 struct nn_chunk;
 
 struct nn_chunk_vfptr {
@@ -43,6 +66,11 @@ struct nn_chunk {
         nn_chunk structure. */
     uint32_t offset;
 
+    /*  Distance between the end of nn_chunk structure and the data. The data
+        may start anywhere, while the structure is kept aligned in front of
+        them. */
+    uint32_t pad;
+
     /*  Number of places the chunk is referenced from. */
     struct nn_atomic refcount;
 
@@ -52,11 +80,49 @@ struct nn_chunk {
     /*  Virtual functions. */
     const struct nn_chunk_vfptr *vfptr;
 
-    /*  Actual message buffer follows the nn_chunk structure in the memory. */
+    /*  Actual message buffer follows the nn_chunk structure in the memory,
+        'pad' bytes after it. */
 };
 
-/*  Allocates the chunk using the allocation mechanism specified by 'type'. */
-struct nn_chunk *nn_chunk_alloc (size_t size, int type);
+/*  Allocates the chunk using the allocation mechanism specified by 'type'.
+    Returns -EINVAL if the type is invalid, -ENOMEM if a user-defined
+    allocator has run out of memory. */
+int nn_chunk_alloc (size_t size, int type, struct nn_chunk **result);
+
+/*  Defines a custom allocation mechanism with type ID 'type'. If 'alloc' is
+    NULL the type is undefined. The function is not thread-safe. It should
+    be called before the type is used for the first time and it must not be
+    changed while there are chunks of the type still allocated. Returns
+    -EINVAL if the type ID is out of the range for user-defined types. */
+int nn_chunk_setallocator (int type, void *(*alloc) (size_t size),
+    void (*free) (void *p));
+
+/*  Creates a chunk referring to an existing buffer without using any of its
+    space. The chunk header is allocated separately. When the chunk is
+    deallocated, 'ffn' is invoked with 'buf' and 'arg' as arguments. Returns
+    NULL if out of memory. Note that the data of such an external chunk don't
+    follow the chunk header, so the pointer to the end of the header can only
+    be used as a handle, not to access the data. */
+struct nn_chunk *nn_chunk_ext (void *buf, size_t size,
+    void (*ffn) (void *buf, void *arg), void *arg);
+
+/*  Creates an external chunk referring to 'size' bytes of file 'fd' starting
+    at 'offset'. The data are accessed through a private mapping of the file.
+    The descriptor is duplicated, so the caller keeps ownership of 'fd'.
+    Returns -EBADF if the descriptor is not valid, -EINVAL if it's not
+    a regular file or the range is beyond its end, -ENOMEM if the range
+    can't be mapped and -ENOTSUP on Windows. */
+int nn_chunk_file (int fd, uint64_t offset, size_t size,
+    struct nn_chunk **result);
+
+/*  If the chunk was created by nn_chunk_file and the platform can send files
+    without copying them through user space, returns the file descriptor and
+    sets '*offset' to the position of the chunk's data within the file.
+    The descriptor remains owned by the chunk. Returns -1 otherwise. */
+int nn_chunk_getfile (struct nn_chunk *self, uint64_t *offset);
+
+/*  Returns 1 if the chunk was created by nn_chunk_ext, 0 otherwise. */
+int nn_chunk_isext (struct nn_chunk *self);
 
 /*  Deallocates the chunk. */
 void nn_chunk_free (struct nn_chunk *self);
@@ -75,8 +141,32 @@ void *nn_chunk_data (struct nn_chunk *self);
 size_t nn_chunk_size (struct nn_chunk *self);
 
 /*  Trims n bytes from the beginning of the chunk. Returns pointer to the new
-    chunk. */
+    chunk. If the chunk is shared, the remaining data are copied into a new
+    chunk and the reference to the original one is dropped. */
 struct nn_chunk *nn_chunk_trim (struct nn_chunk *self, size_t n);
 
+/*  Returns the number of bytes that can be prepended to the data in place,
+    i.e. the unused space in front of the data of an unshared chunk. */
+size_t nn_chunk_headroom (struct nn_chunk *self);
+
+/*  Extends the data of the chunk by n uninitialised bytes at the beginning,
+    the opposite of nn_chunk_trim. There must be enough headroom. Returns
+    pointer to the new chunk. */
+struct nn_chunk *nn_chunk_push (struct nn_chunk *self, size_t n);
+
+/*  If the chunk is stored in a memory file, returns its file descriptor and
+    sets '*offset' to the position of the chunk's data within the file.
+    The descriptor remains owned by the chunk. Returns -1 otherwise. */
+int nn_chunk_getfd (struct nn_chunk *self, size_t *offset);
+
+/*  Creates a chunk by mapping the memory file 'fd' received from a local
+    peer. The chunk's data consist of 'headroom' uninitialised bytes followed
+    by 'size' bytes of the file starting at 'offset'. The mapping is private,
+    thus the peer's copy of the data is never modified. The function takes
+    ownership of 'fd'. Returns -EINVAL if the file doesn't have the expected
+    size or can be resized by the peer. */
+int nn_chunk_mapfd (int fd, size_t offset, size_t size, size_t headroom,
+    struct nn_chunk **result);
+
 #endif
 
@@ -0,0 +1,234 @@
+/*
+    Copyright (c) 2013 250bpm s.r.o.
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"),
+    to deal in the Software without restriction, including without limitation
+    the rights to use, copy, modify, merge, publish, distribute, sublicense,
+    and/or sell copies of the Software, and to permit persons to whom
+    the Software is furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included
+    in all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+    THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+    FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+    IN THE SOFTWARE.
+*/
+
+#include "chunkpool.h"
+#include "alloc.h"
+#include "fast.h"
+#include "err.h"
+#include "thread.h"
+
+#if !defined NN_HAVE_WINDOWS
+#include <pthread.h>
+#endif
+
+/*  Block header. The allocated memory follows it. */
+struct nn_chunkpool_hdr {
+
+    /*  Next block in the thread's cache. Valid only while the block is
+        cached. */
+    struct nn_chunkpool_hdr *next;
+
+    /*  Size class of the block. NN_CHUNKPOOL_CLASSES means that the block
+        was allocated directly from the system allocator. */
+    int cls;
+
+    /*  NUMA node of the thread that allocated the block. */
+    int node;
+};
+
+#if !defined NN_HAVE_WINDOWS
+
+/*  Per-thread cache of free blocks. Only the blocks allocated on the NUMA
+    node the thread was running on when the cache was created are cached, so
+    that the library's threads, which are bound to nodes, reuse local memory
+    only. */
+struct nn_chunkpool_cache {
+    struct nn_chunkpool_hdr *blocks [NN_CHUNKPOOL_CLASSES];
+    int count [NN_CHUNKPOOL_CLASSES];
+    int node;
+};
+
+static pthread_once_t nn_chunkpool_once = PTHREAD_ONCE_INIT;
+static pthread_key_t nn_chunkpool_key;
+static int nn_chunkpool_haskey;
+
+static void nn_chunkpool_init (void);
+static void nn_chunkpool_term (void *arg);
+static struct nn_chunkpool_cache *nn_chunkpool_cache (void);
+
+/*  The key is created once per process. Once the library is unloaded,
+    the threads still running must not call its destructor on exit, so
+    the key is deleted at that point. */
+#if defined __GNUC__
+static void nn_chunkpool_unload (void) __attribute__ ((destructor));
+#endif
+
+#endif
+
+static int nn_chunkpool_class (size_t size);
+
+void *nn_chunkpool_alloc (size_t size)
+{
+    int cls;
+    int node;
+    struct nn_chunkpool_hdr *hdr;
+#if !defined NN_HAVE_WINDOWS
+    struct nn_chunkpool_cache *cache;
+#endif
+
+    cls = nn_chunkpool_class (size);
+    node = 0;
+
+#if !defined NN_HAVE_WINDOWS
+    /*  If there's a cached block of appropriate size, use it. */
+    if (nn_fast (cls < NN_CHUNKPOOL_CLASSES)) {
+        cache = nn_chunkpool_cache ();
+        if (nn_fast (cache != NULL))
+            node = cache->node;
+        if (nn_fast (cache && cache->blocks [cls])) {
+            hdr = cache->blocks [cls];
+            cache->blocks [cls] = hdr->next;
+            --cache->count [cls];
+            return (void*) (hdr + 1);
+        }
+    }
+#endif
+
+    /*  Allocate a new block. The size is rounded up to the size class so that
+        the block can be reused for any allocation of the same class. */
+    if (nn_fast (cls < NN_CHUNKPOOL_CLASSES))
+        size = ((size_t) 1) << (cls + NN_CHUNKPOOL_MIN_SHIFT);
+    hdr = nn_alloc (sizeof (struct nn_chunkpool_hdr) + size, "pooled chunk");
+    if (nn_slow (!hdr))
+        return NULL;
+    hdr->cls = cls;
+    hdr->node = node;
+    return (void*) (hdr + 1);
+}
+
+void nn_chunkpool_free (void *p)
+{
+    struct nn_chunkpool_hdr *hdr;
+#if !defined NN_HAVE_WINDOWS
+    struct nn_chunkpool_cache *cache;
+#endif
+
+    hdr = ((struct nn_chunkpool_hdr*) p) - 1;
+
+#if !defined NN_HAVE_WINDOWS
+    /*  Store the block in the cache, unless the cache is already full or
+        the block lives on another node. */
+    if (nn_fast (hdr->cls < NN_CHUNKPOOL_CLASSES)) {
+        cache = nn_chunkpool_cache ();
+        if (nn_fast (cache && cache->count [hdr->cls] < NN_CHUNKPOOL_CACHE &&
+              cache->node == hdr->node)) {
+            hdr->next = cache->blocks [hdr->cls];
+            cache->blocks [hdr->cls] = hdr;
+            ++cache->count [hdr->cls];
+            return;
+        }
+    }
+#endif
+
+    nn_free (hdr);
+}
+
+static int nn_chunkpool_class (size_t size)
+{
+    int cls;
+
+    cls = 0;
+    while (cls < NN_CHUNKPOOL_CLASSES &&
+          size > (((size_t) 1) << (cls + NN_CHUNKPOOL_MIN_SHIFT)))
+        ++cls;
+    return cls;
+}
+
+#if !defined NN_HAVE_WINDOWS
+
+static void nn_chunkpool_init (void)
+{
+    int rc;
+
+    rc = pthread_key_create (&nn_chunkpool_key, nn_chunkpool_term);
+    errnum_assert (rc == 0, rc);
+    nn_chunkpool_haskey = 1;
+}
+
+#if defined __GNUC__
+static void nn_chunkpool_unload (void)
+{
+    int rc;
+
+    /*  The caches of the threads still running are not deallocated, as
+        the threads may be using them at the moment, e.g. if the process is
+        exiting without closing the sockets. */
+    if (!nn_chunkpool_haskey)
+        return;
+    rc = pthread_key_delete (nn_chunkpool_key);
+    errnum_assert (rc == 0, rc);
+}
+#endif
+
+static void nn_chunkpool_term (void *arg)
+{
+    struct nn_chunkpool_cache *cache;
+    struct nn_chunkpool_hdr *hdr;
+    int cls;
+
+    /*  The thread is exiting. Return all the cached blocks to the system. */
+    cache = (struct nn_chunkpool_cache*) arg;
+    for (cls = 0; cls != NN_CHUNKPOOL_CLASSES; ++cls) {
+        while (cache->blocks [cls]) {
+            hdr = cache->blocks [cls];
+            cache->blocks [cls] = hdr->next;
+            nn_free (hdr);
+        }
+    }
+    nn_free (cache);
+}
+
+static struct nn_chunkpool_cache *nn_chunkpool_cache (void)
+{
+    int rc;
+    int cls;
+    struct nn_chunkpool_cache *cache;
+
+    rc = pthread_once (&nn_chunkpool_once, nn_chunkpool_init);
+    errnum_assert (rc == 0, rc);
+
+    cache = pthread_getspecific (nn_chunkpool_key);
+    if (nn_fast (cache != NULL))
+        return cache;
+
+    /*  First use of the pool in this thread. Create the cache. If there's
+        not enough memory for it, the pool works without caching. */
+    cache = nn_alloc (sizeof (struct nn_chunkpool_cache), "chunk cache");
+    if (nn_slow (!cache))
+        return NULL;
+    for (cls = 0; cls != NN_CHUNKPOOL_CLASSES; ++cls) {
+        cache->blocks [cls] = NULL;
+        cache->count [cls] = 0;
+    }
+    cache->node = nn_thread_node ();
+
+    /*  Fails once the key is deleted while the library is being unloaded.
+        The pool then works without caching. */
+    rc = pthread_setspecific (nn_chunkpool_key, cache);
+    if (nn_slow (rc != 0)) {
+        nn_free (cache);
+        return NULL;
+    }
+    return cache;
+}
+
+#endif
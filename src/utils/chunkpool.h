@@ -0,0 +1,57 @@
+/*
+    Copyright (c) 2013 250bpm s.r.o.
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"),
+    to deal in the Software without restriction, including without limitation
+    the rights to use, copy, modify, merge, publish, distribute, sublicense,
+    and/or sell copies of the Software, and to permit persons to whom
+    the Software is furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included
+    in all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+    THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+    FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+    IN THE SOFTWARE.
+*/
+
+#ifndef NN_CHUNKPOOL_INCLUDED
+#define NN_CHUNKPOOL_INCLUDED
+
+#include <stddef.h>
+
+/*  Size-classed memory pool for message chunks. Each thread caches a limited
+    number of freed blocks of each size class and reuses them for subsequent
+    allocations, so that the hot path doesn't touch the system allocator.
+    Blocks can be deallocated from any thread. They go to the cache of
+    the thread that frees them. */
+
+/*  Size of the smallest size class is 2^NN_CHUNKPOOL_MIN_SHIFT bytes. */
+#ifndef NN_CHUNKPOOL_MIN_SHIFT
+#define NN_CHUNKPOOL_MIN_SHIFT 6
+#endif
+
+/*  Number of size classes. Each class is twice the size of the previous one.
+    Larger blocks are allocated directly from the system allocator. */
+#ifndef NN_CHUNKPOOL_CLASSES
+#define NN_CHUNKPOOL_CLASSES 11
+#endif
+
+/*  Maximum number of blocks of each size class cached by a single thread. */
+#ifndef NN_CHUNKPOOL_CACHE
+#define NN_CHUNKPOOL_CACHE 64
+#endif
+
+/*  Allocates a block of at least 'size' bytes. Returns NULL if there's
+    not enough memory. */
+void *nn_chunkpool_alloc (size_t size);
+
+/*  Returns the block to the pool. */
+void nn_chunkpool_free (void *p);
+
+#endif
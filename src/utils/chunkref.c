@@ -22,36 +22,51 @@
 
 #include "chunkref.h"
 #include "err.h"
+#include "fast.h"
 
 #include <string.h>
 
 /*  nn_chunkref should be reinterpreted as this structure in case the first
-    byte ('tag') is 0xff. */
+    byte ('tag') is 0xff. The chunkref refers to the data of the chunk
+    starting 'offset' bytes from its beginning. Thus, trimming the data
+    doesn't touch the chunk itself, which may be shared with other
+    chunkrefs. */
 struct nn_chunkref_chunk {
     uint8_t tag;
+    uint32_t offset;
     struct nn_chunk *chunk;
 };
 
+/*  Otherwise, the first byte is the size of the data and the second one is
+    the offset of the data from the beginning of the space that follows. */
+#define NN_CHUNKREF_SIZE(self) ((self)->ref [0])
+#define NN_CHUNKREF_OFFSET(self) ((self)->ref [1])
+#define NN_CHUNKREF_DATA(self) (&(self)->ref [2 + NN_CHUNKREF_OFFSET (self)])
+
 /*  Check whether VSM are small enough for size to fit into the first byte
     of the structure. */
 CT_ASSERT (NN_CHUNKREF_MAX < 255);
 
 /*  Check whether nn_chunkref_chunk fits into nn_chunkref. */
+CT_ASSERT (NN_CHUNKREF_MAX >= 2);
 CT_ASSERT (sizeof (struct nn_chunkref) >= sizeof (struct nn_chunkref_chunk));
 
 void nn_chunkref_init (struct nn_chunkref *self, size_t size)
 {
+    int rc;
     struct nn_chunkref_chunk *ch;
 
-    if (size < NN_CHUNKREF_MAX) {
-        self->ref [0] = (uint8_t) size;
+    if (size <= NN_CHUNKREF_MAX - 2) {
+        NN_CHUNKREF_SIZE (self) = (uint8_t) size;
+        NN_CHUNKREF_OFFSET (self) = 0;
         return;
     }
 
     ch = (struct nn_chunkref_chunk*) self;
     ch->tag = 0xff;
-    ch->chunk = nn_chunk_alloc (size, 0);
-    alloc_assert (ch->chunk);
+    ch->offset = 0;
+    rc = nn_chunk_alloc (size, 0, &ch->chunk);
+    errnum_assert (rc == 0, -rc);
 }
 
 void nn_chunkref_init_chunk (struct nn_chunkref *self, struct nn_chunk *chunk)
@@ -60,6 +75,7 @@ void nn_chunkref_init_chunk (struct nn_chunkref *self, struct nn_chunk *chunk)
 
     ch = (struct nn_chunkref_chunk*) self;
     ch->tag = 0xff;
+    ch->offset = 0;
     ch->chunk = chunk;
 }
 
@@ -73,28 +89,79 @@ void nn_chunkref_term (struct nn_chunkref *self)
     }
 }
 
+void nn_chunkref_release (struct nn_chunkref *self)
+{
+    if (self->ref [0] == 0xff) {
+        NN_CHUNKREF_SIZE (self) = 0;
+        NN_CHUNKREF_OFFSET (self) = 0;
+    }
+}
+
+/*  Applies the offset of the chunkref to the chunk itself so that the data
+    of the chunk are exactly the data the chunkref refers to. This is needed
+    only when the chunk is passed out of the chunkref. */
+static struct nn_chunk *nn_chunkref_settle (struct nn_chunkref_chunk *ch)
+{
+    if (nn_slow (ch->offset)) {
+        ch->chunk = nn_chunk_trim (ch->chunk, ch->offset);
+        ch->offset = 0;
+    }
+    return ch->chunk;
+}
+
 struct nn_chunk *nn_chunkref_getchunk (struct nn_chunkref *self)
 {
+    int rc;
     struct nn_chunkref_chunk *ch;
     struct nn_chunk *chunk;
 
     if (self->ref [0] == 0xff) {
         ch = (struct nn_chunkref_chunk*) self;
-        self->ref [0] = 0;
+        nn_chunkref_settle (ch);
+        NN_CHUNKREF_SIZE (self) = 0;
+        NN_CHUNKREF_OFFSET (self) = 0;
+
+        /*  The data of an external chunk can't be accessed via the pointer
+            to the end of its header. Copy them into an ordinary chunk. */
+        if (nn_slow (nn_chunk_isext (ch->chunk))) {
+            rc = nn_chunk_alloc (nn_chunk_size (ch->chunk), 0, &chunk);
+            errnum_assert (rc == 0, -rc);
+            memcpy (nn_chunk_data (chunk), nn_chunk_data (ch->chunk),
+                nn_chunk_size (ch->chunk));
+            nn_chunk_free (ch->chunk);
+            return chunk;
+        }
         return ch->chunk;
     }
 
-    chunk = nn_chunk_alloc (self->ref [0], 0);
-    alloc_assert (chunk);
-    memcpy (nn_chunk_data (chunk), &self->ref [1], self->ref [0]);
-    self->ref [0] = 0;
+    rc = nn_chunk_alloc (NN_CHUNKREF_SIZE (self), 0, &chunk);
+    errnum_assert (rc == 0, -rc);
+    memcpy (nn_chunk_data (chunk), NN_CHUNKREF_DATA (self),
+        NN_CHUNKREF_SIZE (self));
+    NN_CHUNKREF_SIZE (self) = 0;
+    NN_CHUNKREF_OFFSET (self) = 0;
     return chunk;
 }
 
+struct nn_chunk *nn_chunkref_peekchunk (struct nn_chunkref *self)
+{
+    if (self->ref [0] != 0xff)
+        return NULL;
+    return nn_chunkref_settle ((struct nn_chunkref_chunk*) self);
+}
+
 void nn_chunkref_mv (struct nn_chunkref *dst, struct nn_chunkref *src)
 {
-    memcpy (dst, src, src->ref [0] == 0xff ?
-        sizeof (struct nn_chunkref_chunk) : src->ref [0] + 1);
+    if (src->ref [0] == 0xff) {
+        memcpy (dst, src, sizeof (struct nn_chunkref_chunk));
+        return;
+    }
+
+    /*  Space freed by trimming is not copied. */
+    NN_CHUNKREF_SIZE (dst) = NN_CHUNKREF_SIZE (src);
+    NN_CHUNKREF_OFFSET (dst) = 0;
+    memcpy (NN_CHUNKREF_DATA (dst), NN_CHUNKREF_DATA (src),
+        NN_CHUNKREF_SIZE (src));
 }
 
 void nn_chunkref_cp (struct nn_chunkref *dst, struct nn_chunkref *src)
@@ -105,21 +172,29 @@ void nn_chunkref_cp (struct nn_chunkref *dst, struct nn_chunkref *src)
         ch = (struct nn_chunkref_chunk*) src;
         nn_chunk_addref (ch->chunk, 1);
     }
-    memcpy (dst, src, sizeof (struct nn_chunkref));
+    nn_chunkref_mv (dst, src);
 }
 
 void *nn_chunkref_data (struct nn_chunkref *self)
 {
-    return self->ref [0] == 0xff ?
-        nn_chunk_data (((struct nn_chunkref_chunk*) self)->chunk) :
-        &self->ref [1];
+    struct nn_chunkref_chunk *ch;
+
+    if (self->ref [0] == 0xff) {
+        ch = (struct nn_chunkref_chunk*) self;
+        return ((uint8_t*) nn_chunk_data (ch->chunk)) + ch->offset;
+    }
+    return NN_CHUNKREF_DATA (self);
 }
 
 size_t nn_chunkref_size (struct nn_chunkref *self)
 {
-    return self->ref [0] == 0xff ?
-        nn_chunk_size (((struct nn_chunkref_chunk*) self)->chunk) :
-        self->ref [0];
+    struct nn_chunkref_chunk *ch;
+
+    if (self->ref [0] == 0xff) {
+        ch = (struct nn_chunkref_chunk*) self;
+        return nn_chunk_size (ch->chunk) - ch->offset;
+    }
+    return NN_CHUNKREF_SIZE (self);
 }
 
 void nn_chunkref_trim (struct nn_chunkref *self, size_t n)
@@ -128,13 +203,89 @@ void nn_chunkref_trim (struct nn_chunkref *self, size_t n)
 
     if (self->ref [0] == 0xff) {
         ch = (struct nn_chunkref_chunk*) self;
-        ch->chunk = nn_chunk_trim (ch->chunk, n);
+        nn_assert (nn_chunk_size (ch->chunk) - ch->offset >= n);
+
+        /*  Offsets beyond 4GB are not representable. Trim the chunk itself. */
+        if (nn_slow (n > UINT32_MAX - ch->offset)) {
+            nn_chunkref_settle (ch);
+            ch->chunk = nn_chunk_trim (ch->chunk, n);
+            return;
+        }
+        ch->offset += (uint32_t) n;
         return;
     }
 
-    nn_assert (self->ref [0] >= n);
-    memmove (&self->ref [1], &self->ref [1 + n], self->ref [0] - n);
-    self->ref [0] -= n;
+    nn_assert (NN_CHUNKREF_SIZE (self) >= n);
+    NN_CHUNKREF_SIZE (self) -= (uint8_t) n;
+    NN_CHUNKREF_OFFSET (self) += (uint8_t) n;
+}
+
+void nn_chunkref_push (struct nn_chunkref *self, const void *data, size_t n)
+{
+    size_t sz;
+    struct nn_chunkref ref;
+    struct nn_chunkref_chunk *ch;
+
+    if (self->ref [0] != 0xff) {
+
+        /*  If there's enough space left by trimming, just reuse it. */
+        if (NN_CHUNKREF_OFFSET (self) >= n) {
+            NN_CHUNKREF_OFFSET (self) -= (uint8_t) n;
+            NN_CHUNKREF_SIZE (self) += (uint8_t) n;
+            memcpy (NN_CHUNKREF_DATA (self), data, n);
+            return;
+        }
+        if (NN_CHUNKREF_SIZE (self) + n <= NN_CHUNKREF_MAX - 2) {
+            memmove (&self->ref [2 + n], NN_CHUNKREF_DATA (self),
+                NN_CHUNKREF_SIZE (self));
+            memcpy (&self->ref [2], data, n);
+            NN_CHUNKREF_SIZE (self) += (uint8_t) n;
+            NN_CHUNKREF_OFFSET (self) = 0;
+            return;
+        }
+    }
+    else {
+
+        /*  The same applies to a chunk unless it's shared with someone else
+            who expects the trimmed bytes to stay intact. Beyond the trimmed
+            bytes, the chunk itself may have space in front of the data. */
+        ch = (struct nn_chunkref_chunk*) self;
+        if (nn_atomic_load (&ch->chunk->refcount) == 1) {
+            if (ch->offset < n && n - ch->offset <=
+                  nn_chunk_headroom (ch->chunk)) {
+                ch->chunk = nn_chunk_push (ch->chunk, n - ch->offset);
+                ch->offset = (uint32_t) n;
+            }
+            if (ch->offset >= n) {
+                ch->offset -= (uint32_t) n;
+                memcpy (((uint8_t*) nn_chunk_data (ch->chunk)) + ch->offset,
+                    data, n);
+                return;
+            }
+        }
+    }
+
+    sz = nn_chunkref_size (self);
+    nn_chunkref_init (&ref, sz + n);
+    memcpy (nn_chunkref_data (&ref), data, n);
+    memcpy (((uint8_t*) nn_chunkref_data (&ref)) + n,
+        nn_chunkref_data (self), sz);
+    nn_chunkref_term (self);
+    nn_chunkref_mv (self, &ref);
+}
+
+size_t nn_chunkref_headroom (struct nn_chunkref *self)
+{
+    struct nn_chunkref_chunk *ch;
+
+    /*  The data stored in the chunkref can be moved to make space. */
+    if (self->ref [0] != 0xff)
+        return NN_CHUNKREF_MAX - 2 - NN_CHUNKREF_SIZE (self);
+
+    ch = (struct nn_chunkref_chunk*) self;
+    if (nn_atomic_load (&ch->chunk->refcount) > 1)
+        return 0;
+    return ch->offset + nn_chunk_headroom (ch->chunk);
 }
 
 void nn_chunkref_bulkcopy_start (struct nn_chunkref *self, uint32_t copies)
@@ -149,6 +300,10 @@ void nn_chunkref_bulkcopy_start (struct nn_chunkref *self, uint32_t copies)
 
 void nn_chunkref_bulkcopy_cp (struct nn_chunkref *dst, struct nn_chunkref *src)
 {
-    memcpy (dst, src, sizeof (struct nn_chunkref));
+    /*  Only the part of the chunkref that is actually in use is copied. When
+        fanning out to many pipes, the empty header and the chunk reference
+        of the body amount to a few bytes per copy instead of the full size
+        of both chunkrefs. */
+    nn_chunkref_mv (dst, src);
 }
 
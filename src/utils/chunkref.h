@@ -23,7 +23,12 @@
 #ifndef NN_CHUNKREF_INCLUDED
 #define NN_CHUNKREF_INCLUDED
 
+/*  Size of the chunkref. Data of up to NN_CHUNKREF_MAX - 2 bytes are stored
+    in the chunkref itself. The value can be set at build time using
+    CHUNKREF_MAX CMake option. */
+#if !defined NN_CHUNKREF_MAX
 #define NN_CHUNKREF_MAX 32
+#endif
 
 #include "chunk.h"
 
@@ -50,10 +55,19 @@ void nn_chunkref_init_chunk (struct nn_chunkref *self, struct nn_chunk *chunk);
 /*  Deallocate the chunk. */
 void nn_chunkref_term (struct nn_chunkref *self);
 
-/*  Get the underlying chunk. If it doesn't exist (small messages) it allocates
-    one. Chunkref points to empty chunk after the call. */
+/*  Deallocate the chunkref, but leave the chunk it refers to, if any, to the
+    caller. Used to give the chunk back to the user when a send fails. */
+void nn_chunkref_release (struct nn_chunkref *self);
+
+/*  Get the underlying chunk. If it doesn't exist (small messages) or if it's
+    an external chunk, it allocates one. Chunkref points to empty chunk after
+    the call. */
 struct nn_chunk *nn_chunkref_getchunk (struct nn_chunkref *self);
 
+/*  Returns the underlying chunk without taking it from the chunkref or NULL
+    if the data are stored in the chunkref itself. */
+struct nn_chunk *nn_chunkref_peekchunk (struct nn_chunkref *self);
+
 /*  Moves chunk content from src to dst. dst should not be initialised before
     calling this function. After the call, dst becomes initialised and src
     becomes uninitialised. */
@@ -69,9 +83,19 @@ void *nn_chunkref_data (struct nn_chunkref *self);
 /*  Returns the size of the binary data stored in the chunk. */
 size_t nn_chunkref_size (struct nn_chunkref *self);
 
-/*  Trims n bytes from the beginning of the chunk. */
+/*  Trims n bytes from the beginning of the chunk. Only the chunkref is
+    adjusted, the data stay where they are. */
 void nn_chunkref_trim (struct nn_chunkref *self, size_t n);
 
+/*  Prepends n bytes from 'data' to the beginning of the chunk. As long as
+    the result is small enough to be stored in the chunkref itself, or the
+    bytes fit into the headroom of an unshared chunk, this is done in place,
+    without allocating memory. */
+void nn_chunkref_push (struct nn_chunkref *self, const void *data, size_t n);
+
+/*  Returns the number of bytes nn_chunkref_push can prepend in place. */
+size_t nn_chunkref_headroom (struct nn_chunkref *self);
+
 /*  Bulk copying is done by first invoking nn_chunkref_bulkcopy_start on the
     source chunk and specifying how many copies of the chunk will be made.
     Then, nn_chunkref_bulkcopy_cp should be used 'copies' of times to make
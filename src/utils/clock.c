@@ -27,7 +27,8 @@
 #include <mach/mach_time.h>
 #elif defined NN_HAVE_CLOCK_MONOTONIC || defined NN_HAVE_GETHRTIME
 #include <time.h>
-#else
+#endif
+#if !defined NN_HAVE_WINDOWS && !defined NN_HAVE_CLOCK_MONOTONIC
 #include <sys/time.h>
 #endif
 
@@ -39,10 +40,21 @@
    it works pretty well for CPU frequencies above 500MHz. */
 #define NN_CLOCK_PRECISION 1000000
 
+/*  Coarse clock is used only if its resolution is at least this good,
+    expressed in nanoseconds. */
+#define NN_CLOCK_COARSE_RESOLUTION 1000000
+
 #if defined NN_HAVE_OSX
 static mach_timebase_info_data_t nn_clock_timebase_info = {0};
 #endif
 
+#if defined NN_HAVE_CLOCK_MONOTONIC
+/*  The clock to use with clock_gettime. Zero means that it haven't been
+    chosen yet. The value is the clock ID plus one. */
+static int nn_clock_id = 0;
+static clockid_t nn_clock_choose_id ();
+#endif
+
 static uint64_t nn_clock_rdtsc ()
 {
 #if (defined _MSC_VER && (defined _M_IX86 || defined _M_X64))
@@ -97,7 +109,12 @@ static uint64_t nn_clock_time ()
     int rc;
     struct timespec tv;
 
-    rc = clock_gettime (CLOCK_MONOTONIC, &tv);
+    /*  Coarse monotonic clock avoids reading the hardware clock source
+        and is thus much faster than the precise one. */
+    if (nn_slow (!nn_clock_id))
+        nn_clock_id = (int) nn_clock_choose_id () + 1;
+
+    rc = clock_gettime ((clockid_t) (nn_clock_id - 1), &tv);
     errno_assert (rc == 0);
     return tv.tv_sec * (uint64_t) 1000 + tv.tv_nsec / 1000000;
 
@@ -149,8 +166,87 @@ uint64_t nn_clock_now (struct nn_clock *self)
     return self->last_time;
 }
 
+uint64_t nn_clock_realtime (void)
+{
+#if defined NN_HAVE_WINDOWS
+    FILETIME ft;
+    ULARGE_INTEGER t;
+
+    /*  FILETIME counts 100-nanosecond intervals since 1601. */
+    GetSystemTimeAsFileTime (&ft);
+    t.LowPart = ft.dwLowDateTime;
+    t.HighPart = ft.dwHighDateTime;
+    return (t.QuadPart - 116444736000000000ULL) * 100;
+#elif defined NN_HAVE_CLOCK_MONOTONIC
+    int rc;
+    struct timespec tv;
+
+    rc = clock_gettime (CLOCK_REALTIME, &tv);
+    errno_assert (rc == 0);
+    return tv.tv_sec * (uint64_t) 1000000000 + tv.tv_nsec;
+#else
+    int rc;
+    struct timeval tv;
+
+    rc = gettimeofday (&tv, NULL);
+    errno_assert (rc == 0);
+    return tv.tv_sec * (uint64_t) 1000000000 + tv.tv_usec * (uint64_t) 1000;
+#endif
+}
+
+uint64_t nn_clock_monotonic (void)
+{
+#if defined NN_HAVE_WINDOWS
+    LARGE_INTEGER tps;
+    LARGE_INTEGER time;
+
+    QueryPerformanceFrequency (&tps);
+    QueryPerformanceCounter (&time);
+    return (uint64_t) (time.QuadPart / tps.QuadPart * 1000000000 +
+        time.QuadPart % tps.QuadPart * 1000000000 / tps.QuadPart);
+#elif defined NN_HAVE_OSX
+    if (nn_slow (!nn_clock_timebase_info.denom))
+        mach_timebase_info (&nn_clock_timebase_info);
+    return mach_absolute_time () * nn_clock_timebase_info.numer /
+        nn_clock_timebase_info.denom;
+#elif defined NN_HAVE_CLOCK_MONOTONIC
+    int rc;
+    struct timespec tv;
+
+    rc = clock_gettime (CLOCK_MONOTONIC, &tv);
+    errno_assert (rc == 0);
+    return tv.tv_sec * (uint64_t) 1000000000 + tv.tv_nsec;
+#elif defined NN_HAVE_GETHRTIME
+    return gethrtime ();
+#else
+    int rc;
+    struct timeval tv;
+
+    rc = gettimeofday (&tv, NULL);
+    errno_assert (rc == 0);
+    return tv.tv_sec * (uint64_t) 1000000000 + tv.tv_usec * (uint64_t) 1000;
+#endif
+}
+
 uint64_t nn_clock_timestamp ()
 {
     return nn_clock_rdtsc ();
 }
 
+#if defined NN_HAVE_CLOCK_MONOTONIC
+static clockid_t nn_clock_choose_id ()
+{
+#if defined CLOCK_MONOTONIC_COARSE
+    int rc;
+    struct timespec res;
+
+    /*  The resolution of the coarse clock depends on the kernel tick rate.
+        If it's too low to measure milliseconds, use the precise clock. */
+    rc = clock_getres (CLOCK_MONOTONIC_COARSE, &res);
+    if (rc == 0 && res.tv_sec == 0 &&
+          res.tv_nsec <= NN_CLOCK_COARSE_RESOLUTION)
+        return CLOCK_MONOTONIC_COARSE;
+#endif
+    return CLOCK_MONOTONIC;
+}
+#endif
@@ -43,6 +43,14 @@ void nn_clock_term (struct nn_clock *self);
 /*  Returns current time in milliseconds. */
 uint64_t nn_clock_now (struct nn_clock *self);
 
+/*  Returns the wall-clock time in nanoseconds since the epoch, the same
+    time base as that of the kernel timestamps of the received data. */
+uint64_t nn_clock_realtime (void);
+
+/*  Returns the precise monotonic time in nanoseconds. Meant for measuring
+    short intervals, it's more expensive than nn_clock_now. */
+uint64_t nn_clock_monotonic (void);
+
 /*  Returns an unique timestamp. If the system doesn't support producing
     timestamps the return value is zero. */
 uint64_t nn_clock_timestamp ();
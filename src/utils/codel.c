@@ -0,0 +1,110 @@
+/*
+    Copyright (c) 2013 250bpm s.r.o.
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"),
+    to deal in the Software without restriction, including without limitation
+    the rights to use, copy, modify, merge, publish, distribute, sublicense,
+    and/or sell copies of the Software, and to permit persons to whom
+    the Software is furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included
+    in all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+    THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+    FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+    IN THE SOFTWARE.
+*/
+
+#include "codel.h"
+#include "fast.h"
+
+/*  Private functions. */
+static uint64_t nn_codel_next (struct nn_codel *self, uint64_t t);
+
+void nn_codel_init (struct nn_codel *self, int target, int interval)
+{
+    self->target = target;
+    self->interval = interval > 0 ? interval : 1;
+    self->above = 0;
+    self->dropping = 0;
+    self->next = 0;
+    self->count = 0;
+    self->lastcount = 0;
+}
+
+int nn_codel_active (struct nn_codel *self)
+{
+    return self->target >= 0;
+}
+
+int nn_codel_drop (struct nn_codel *self, uint64_t now, uint64_t stamp,
+    int last)
+{
+    int ok;
+    uint32_t delta;
+
+    if (nn_fast (self->target < 0) || !stamp)
+        return 0;
+
+    /*  Find out whether the messages have been above the target for long
+        enough. The time is measured from the first message above it. */
+    ok = 0;
+    if (now < stamp + self->target || last)
+        self->above = 0;
+    else if (!self->above)
+        self->above = now + self->interval;
+    else if (now >= self->above)
+        ok = 1;
+
+    /*  In the dropping state, drop the messages according to the control
+        law until they fall below the target. */
+    if (self->dropping) {
+        if (!ok) {
+            self->dropping = 0;
+            return 0;
+        }
+        if (now < self->next)
+            return 0;
+        ++self->count;
+        self->next = nn_codel_next (self, self->next);
+        return 1;
+    }
+
+    if (!ok)
+        return 0;
+
+    /*  Enter the dropping state. If it was left only recently, start with
+        the drop rate that was in effect back then rather than from
+        the scratch. */
+    self->dropping = 1;
+    delta = self->count - self->lastcount;
+    self->count = delta > 1 && now - self->next < 16 * (uint64_t)
+        self->interval ? delta : 1;
+    self->lastcount = self->count;
+    self->next = nn_codel_next (self, now);
+    return 1;
+}
+
+/*  The control law: interval / sqrt(count) after 't'. */
+static uint64_t nn_codel_next (struct nn_codel *self, uint64_t t)
+{
+    uint64_t n;
+    uint64_t x;
+    uint64_t y;
+
+    /*  Integer square root of count * 2^20 by Newton's method, i.e. sqrt
+        of the count in 1/1024 units. */
+    n = (uint64_t) self->count << 20;
+    x = n;
+    y = (x + 1) / 2;
+    while (y < x) {
+        x = y;
+        y = (x + n / x) / 2;
+    }
+    return t + (uint64_t) self->interval * 1024 / x;
+}
@@ -0,0 +1,71 @@
+/*
+    Copyright (c) 2013 250bpm s.r.o.
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"),
+    to deal in the Software without restriction, including without limitation
+    the rights to use, copy, modify, merge, publish, distribute, sublicense,
+    and/or sell copies of the Software, and to permit persons to whom
+    the Software is furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included
+    in all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+    THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+    FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+    IN THE SOFTWARE.
+*/
+
+#ifndef NN_CODEL_INCLUDED
+#define NN_CODEL_INCLUDED
+
+#include <stdint.h>
+
+/*  Active queue management in the manner of CoDel (RFC 8289). The queue
+    stamps each message with the time it was enqueued and asks the object at
+    dequeue whether the message should be dropped. Once the time the messages
+    spend in the queue stays above 'target' for a whole 'interval', one
+    message is dropped and then more and more often (interval / sqrt(n)
+    after the n-th drop) until the time drops below the target again.
+    The last message in the queue is never dropped. All the times are in
+    milliseconds. The object is used by the reader of the queue only. */
+
+struct nn_codel {
+
+    /*  Target and interval, in milliseconds. Negative target means that no
+        messages are ever dropped. */
+    int target;
+    int interval;
+
+    /*  Time at which the messages will have been above the target for
+        the whole interval, zero if the last one was below it. */
+    uint64_t above;
+
+    /*  Set while dropping, along with the time of the next drop. */
+    int dropping;
+    uint64_t next;
+
+    /*  Number of drops in the current dropping state and its value at
+        the time the state was entered. */
+    uint32_t count;
+    uint32_t lastcount;
+};
+
+void nn_codel_init (struct nn_codel *self, int target, int interval);
+
+/*  Returns 1 if the policy is in effect, so that the messages have to be
+    stamped. */
+int nn_codel_active (struct nn_codel *self);
+
+/*  Returns 1 if the message enqueued at 'stamp' and dequeued at 'now'
+    should be dropped, 0 otherwise. 'last' is set if it's the last message
+    in the queue. Zero stamp means that the time the message was enqueued is
+    not known; such a message is never dropped. */
+int nn_codel_drop (struct nn_codel *self, uint64_t now, uint64_t stamp,
+    int last);
+
+#endif
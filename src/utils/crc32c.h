@@ -0,0 +1,42 @@
+/*
+    Copyright (c) 2013 250bpm s.r.o.
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"),
+    to deal in the Software without restriction, including without limitation
+    the rights to use, copy, modify, merge, publish, distribute, sublicense,
+    and/or sell copies of the Software, and to permit persons to whom
+    the Software is furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included
+    in all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+    THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+    FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+    IN THE SOFTWARE.
+*/
+
+#ifndef NN_CRC32C_INCLUDED
+#define NN_CRC32C_INCLUDED
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*  CRC32C (Castagnoli) checksums. The CRC instructions of SSE4.2 or ARMv8
+    are used if the CPU has them, a lookup table otherwise. */
+
+/*  Updates checksum 'crc' with 'len' bytes at 'data' and returns the new
+    checksum. The checksum of no data is 0. */
+uint32_t nn_crc32c (uint32_t crc, const void *data, size_t len);
+
+/*  Copies 'len' bytes from 'src' to 'dst' and updates checksum 'crc' with
+    them, in a single pass over the data. */
+uint32_t nn_crc32c_copy (uint32_t crc, void *dst, const void *src,
+    size_t len);
+
+#endif
+
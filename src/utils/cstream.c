@@ -26,22 +26,48 @@
 #include "addr.h"
 #include "alloc.h"
 #include "random.h"
+#include "atomic.h"
 
+#include <stdlib.h>
 #include <string.h>
 
+/*  Process-wide limit of connection attempts per second. Zero means that
+    the attempts are not limited. */
+static int nn_cstream_rate = 0;
+
+/*  The time, in microseconds, when the next connection attempt may be made
+    without exceeding the limit. */
+static struct nn_atomic64 nn_cstream_next;
+static int nn_cstream_nextinit = 0;
+
+/*  States of the underlying sockets. */
+#define NN_CSTREAM_SLOT_IDLE 0
+#define NN_CSTREAM_SLOT_CONNECTING 1
+#define NN_CSTREAM_SLOT_CONNECTED 2
+#define NN_CSTREAM_SLOT_CLOSING 3
+
 /*  States. */
 static const struct nn_cp_sink nn_cstream_state_waiting;
+static const struct nn_cp_sink nn_cstream_state_resolving;
 static const struct nn_cp_sink nn_cstream_state_connecting;
 static const struct nn_cp_sink nn_cstream_state_connected;
 static const struct nn_cp_sink nn_cstream_state_closing;
 
 /*  Private functions. */
+static void nn_cstream_resolve (struct nn_cstream *self);
+static void nn_cstream_attempt (struct nn_cstream *self);
+static int nn_cstream_slot (struct nn_cstream *self, struct nn_usock *usock);
+static int nn_cstream_released (struct nn_cstream *self,
+    struct nn_usock *usock);
+static int nn_cstream_admit (struct nn_cstream *self);
 static int nn_cstream_compute_retry_ivl (struct nn_cstream *self)
 {
     int reconnect_ivl;
     int reconnect_ivl_max;
+    int jitter;
     size_t sz;
     int result;
+    int cap;
     unsigned int random;
 
     /*  Get relevant options' values. */
@@ -53,12 +79,33 @@ static int nn_cstream_compute_retry_ivl (struct nn_cstream *self)
     nn_epbase_getopt (&self->epbase, NN_SOL_SOCKET, NN_RECONNECT_IVL_MAX,
         &reconnect_ivl_max, &sz);
     nn_assert (sz == sizeof (reconnect_ivl_max));
+    sz = sizeof (jitter);
+    nn_epbase_getopt (&self->epbase, NN_SOL_SOCKET, NN_RECONNECT_JITTER,
+        &jitter, &sz);
+    nn_assert (sz == sizeof (jitter));
+    cap = reconnect_ivl_max > reconnect_ivl ? reconnect_ivl_max :
+        reconnect_ivl;
 
     /*  Negative number means that reconnect sequence is starting.
         The reconnect interval in this case is NN_RECONNECT_IVL. */
     if (self->retry_ivl < 0)
         self->retry_ivl = reconnect_ivl;
 
+    nn_random_generate (&random, sizeof (random));
+
+    /*  With decorrelated jitter, the interval is chosen at random between
+        NN_RECONNECT_IVL and three times the previous interval. The clients
+        that were disconnected at the same time thus drift apart with each
+        attempt rather than retrying in waves. */
+    if (jitter == NN_JITTER_DECORRELATED) {
+        result = self->retry_ivl > cap / 3 ? cap : self->retry_ivl * 3;
+        if (result > reconnect_ivl)
+            result = reconnect_ivl +
+                (int) (random % (unsigned int) (result - reconnect_ivl + 1));
+        self->retry_ivl = result;
+        return result;
+    }
+
     /*  Current retry_ivl will be returned to the caller. */
     result = self->retry_ivl;
 
@@ -70,13 +117,59 @@ static int nn_cstream_compute_retry_ivl (struct nn_cstream *self)
     }
 
     /*  Randomise the result to prevent re-connection storms when network
-        and/or server goes down and then up again. This may rise
-        the reconnection interval at most twice and at most by one second. */
-    nn_random_generate (&random, sizeof (random));
-    result += (random % result % 1000);
+        and/or server goes down and then up again. Partial jitter may rise
+        the reconnection interval at most twice and at most by one second.
+        Full jitter picks any interval up to the current one. */
+    switch (jitter) {
+    case NN_JITTER_NONE:
+        break;
+    case NN_JITTER_FULL:
+        result = (int) (random % ((unsigned int) result + 1));
+        break;
+    default:
+        if (result > 0)
+            result += (random % result % 1000);
+        break;
+    }
     return result;
 }
 
+void nn_cstream_setup (void)
+{
+    const char *env;
+
+    env = getenv ("NN_CONNECT_RATE");
+    nn_cstream_rate = env && atoi (env) > 0 ? atoi (env) : 0;
+    if (nn_cstream_rate > 1000000)
+        nn_cstream_rate = 1000000;
+    if (!nn_cstream_nextinit) {
+        nn_atomic64_init (&nn_cstream_next, 0);
+        nn_cstream_nextinit = 1;
+    }
+}
+
+/*  Reserves a slot for a connection attempt. Returns the time, in
+    milliseconds, to wait for the slot. The slots are spaced evenly so that
+    the attempts made by all the endpoints in the process don't exceed
+    the NN_CONNECT_RATE limit. */
+static int nn_cstream_admit (struct nn_cstream *self)
+{
+    uint64_t now;
+    uint64_t next;
+    uint64_t slot;
+
+    if (nn_fast (!nn_cstream_rate))
+        return 0;
+
+    now = nn_clock_now (&self->clock) * 1000;
+    do {
+        next = nn_atomic64_load (&nn_cstream_next);
+        slot = next > now ? next : now;
+    } while (!nn_atomic64_cas (&nn_cstream_next, next,
+        slot + 1000000 / nn_cstream_rate));
+    return (int) ((slot - now + 999) / 1000);
+}
+
 /*  Implementation of nn_epbase interface. */
 static int nn_cstream_close (struct nn_epbase *self);
 static const struct nn_epbase_vfptr nn_cstream_epbase_vfptr =
@@ -101,14 +194,12 @@ static const struct nn_cp_sink nn_cstream_state_waiting = {
 
 int nn_cstream_init (struct nn_cstream *self, const char *addr, void *hint,
     int (*initsockfn) (struct nn_usock *sock, int sndbuf, int rcvbuf,
-    struct nn_cp *cp), int (*resolvefn) (const char *addr,
-    struct sockaddr_storage *local, socklen_t *locallen,
-    struct sockaddr_storage *remote, socklen_t *remotelen))
+    struct nn_epbase *epbase), int (*resolvefn) (const char *addr,
+    struct nn_resolve *resolve, struct sockaddr_storage *local,
+    socklen_t *locallen, struct sockaddr_storage *remote,
+    socklen_t *remotelen, int *nremote))
 {
-    int rc;
-    int sndbuf;
-    int rcvbuf;
-    size_t sz;
+    int i;
 
     self->initsockfn = initsockfn;
     self->resolvefn = resolvefn;
@@ -120,24 +211,23 @@ int nn_cstream_init (struct nn_cstream *self, const char *addr, void *hint,
     /*  Initialise the base class. */
     nn_epbase_init (&self->epbase, &nn_cstream_epbase_vfptr, addr, hint);
 
-    /*  Get the current values of NN_SNDBUF and NN_RCVBUF options. */    
-    sz = sizeof (sndbuf);
-    nn_epbase_getopt (&self->epbase, NN_SOL_SOCKET, NN_SNDBUF, &sndbuf, &sz);
-    nn_assert (sz == sizeof (sndbuf));
-    sz = sizeof (rcvbuf);
-    nn_epbase_getopt (&self->epbase, NN_SOL_SOCKET, NN_RCVBUF, &rcvbuf, &sz);
-    nn_assert (sz == sizeof (rcvbuf));
-
-    /*  Open a socket. */
-    rc = self->initsockfn (&self->usock, sndbuf, rcvbuf,
-        nn_epbase_getcp (&self->epbase));
-    errnum_assert (rc == 0, -rc);
-    nn_usock_setsink (&self->usock, &self->sink);
+    /*  The sockets are opened once the address is resolved. */
+    for (i = 0; i != NN_CSTREAM_ATTEMPTS; ++i)
+        self->slots [i] = NN_CSTREAM_SLOT_IDLE;
+    self->usock = NULL;
+    self->nremote = 0;
+    self->next = 0;
 
-    /*  Initialise the retry timer. */
+    /*  Initialise the timers. */
     self->retry_ivl = -1;
+    self->admitted = 0;
+    nn_clock_init (&self->clock);
     nn_timer_init (&self->retry_timer, &self->sink,
         nn_epbase_getcp (&self->epbase));
+    nn_timer_init (&self->attempt_timer, &self->sink,
+        nn_epbase_getcp (&self->epbase));
+    nn_resolve_init (&self->resolve, &self->sink,
+        nn_epbase_getcp (&self->epbase));
 
     /*  Pretend we were waiting for the re-connect timer and that the timer
         have expired. */
@@ -150,32 +240,156 @@ int nn_cstream_init (struct nn_cstream *self, const char *addr, void *hint,
 static void nn_cstream_waiting_timeout (const struct nn_cp_sink **self,
     struct nn_timer *timer)
 {
-    int rc;
+    int delay;
     struct nn_cstream *cstream;
-    struct sockaddr_storage local;
-    socklen_t locallen;
-    struct sockaddr_storage remote;
-    socklen_t remotelen;
 
     cstream = nn_cont (self, struct nn_cstream, sink);
 
+    /*  If the number of connection attempts is limited, wait for
+        the attempt's turn first. */
+    if (!cstream->admitted) {
+        delay = nn_cstream_admit (cstream);
+        if (delay > 0) {
+            cstream->admitted = 1;
+            nn_timer_start (&cstream->retry_timer, delay);
+            return;
+        }
+    }
+    cstream->admitted = 0;
+
     /*  Retry timer expired. Now we'll try to resolve the address. */
-    rc = cstream->resolvefn (nn_epbase_getaddr (&cstream->epbase),
-        &local, &locallen, &remote, &remotelen);
+    nn_cstream_resolve (cstream);
+}
+
+static void nn_cstream_resolve (struct nn_cstream *self)
+{
+    int rc;
+
+    self->nremote = NN_RESOLVE_MAXADDRS;
+    rc = self->resolvefn (nn_epbase_getaddr (&self->epbase),
+        &self->resolve, &self->local, &self->locallen, self->remote,
+        self->remotelen, &self->nremote);
+
+    /*  The name is being looked up. Wait till it's done. */
+    if (rc == -EINPROGRESS) {
+        self->sink = &nn_cstream_state_resolving;
+        return;
+    }
 
     /*  If the address resolution have failed, wait and re-try. */
     if (rc < 0) {
-        cstream->sink = &nn_cstream_state_waiting;
-        nn_timer_start (&cstream->retry_timer,
-            nn_cstream_compute_retry_ivl (cstream));
+        self->sink = &nn_cstream_state_waiting;
+        nn_timer_start (&self->retry_timer,
+            nn_cstream_compute_retry_ivl (self));
         return;
     }
 
-    /*  Open the socket and start connecting. */
-    cstream->sink = &nn_cstream_state_connecting;
-    if (rc & NN_CSTREAM_DOBIND)
-        nn_usock_bind (&cstream->usock, (struct sockaddr*) &local, locallen);
-    nn_usock_connect (&cstream->usock, (struct sockaddr*) &remote, remotelen);
+    /*  Start connecting to the first address. */
+    nn_assert (self->nremote > 0);
+    self->dobind = rc & NN_CSTREAM_DOBIND;
+    self->next = 0;
+    self->sink = &nn_cstream_state_connecting;
+    nn_cstream_attempt (self);
+}
+
+/*  Opens a socket and starts connecting to the next remote address. */
+static void nn_cstream_attempt (struct nn_cstream *self)
+{
+    int rc;
+    int i;
+    int sndbuf;
+    int rcvbuf;
+    size_t sz;
+    struct nn_usock *usock;
+
+    nn_assert (self->next < self->nremote);
+
+    /*  Find a socket that is not in use. */
+    for (i = 0; i != NN_CSTREAM_ATTEMPTS; ++i)
+        if (self->slots [i] == NN_CSTREAM_SLOT_IDLE)
+            break;
+    nn_assert (i < NN_CSTREAM_ATTEMPTS);
+    usock = &self->usocks [i];
+
+    /*  Get the current values of NN_SNDBUF and NN_RCVBUF options. */
+    sz = sizeof (sndbuf);
+    nn_epbase_getopt (&self->epbase, NN_SOL_SOCKET, NN_SNDBUF, &sndbuf, &sz);
+    nn_assert (sz == sizeof (sndbuf));
+    sz = sizeof (rcvbuf);
+    nn_epbase_getopt (&self->epbase, NN_SOL_SOCKET, NN_RCVBUF, &rcvbuf, &sz);
+    nn_assert (sz == sizeof (rcvbuf));
+
+    /*  Open the socket. */
+    rc = self->initsockfn (usock, sndbuf, rcvbuf, &self->epbase);
+    errnum_assert (rc == 0, -rc);
+    nn_usock_setsink (usock, &self->sink);
+    self->slots [i] = NN_CSTREAM_SLOT_CONNECTING;
+
+    /*  If there are more addresses to try, the next one is tried in
+        parallel unless this attempt finishes soon. */
+    ++self->next;
+    if (self->next < self->nremote)
+        nn_timer_start (&self->attempt_timer, NN_CSTREAM_ATTEMPT_DELAY);
+    else
+        nn_timer_stop (&self->attempt_timer);
+
+    /*  Start connecting. Note that the result may be reported to the sink
+        before the function returns. */
+    if (self->dobind)
+        nn_usock_bind (usock, (struct sockaddr*) &self->local,
+            self->locallen);
+    nn_usock_connect (usock, (struct sockaddr*) &self->remote [self->next - 1],
+        self->remotelen [self->next - 1]);
+}
+
+/*  Returns index of the socket in 'usocks' array. */
+static int nn_cstream_slot (struct nn_cstream *self, struct nn_usock *usock)
+{
+    nn_assert (usock >= self->usocks &&
+        usock < self->usocks + NN_CSTREAM_ATTEMPTS);
+    return (int) (usock - self->usocks);
+}
+
+/*  Marks the socket as closed. Returns 1 if none of the sockets is in use
+    any more. */
+static int nn_cstream_released (struct nn_cstream *self,
+    struct nn_usock *usock)
+{
+    int i;
+
+    self->slots [nn_cstream_slot (self, usock)] = NN_CSTREAM_SLOT_IDLE;
+    for (i = 0; i != NN_CSTREAM_ATTEMPTS; ++i)
+        if (self->slots [i] != NN_CSTREAM_SLOT_IDLE)
+            return 0;
+    return 1;
+}
+
+/******************************************************************************/
+/*  State: RESOLVING                                                          */
+/******************************************************************************/
+
+static void nn_cstream_resolving_event (const struct nn_cp_sink **self,
+    struct nn_event *event);
+static const struct nn_cp_sink nn_cstream_state_resolving = {
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    nn_cstream_resolving_event
+};
+
+static void nn_cstream_resolving_event (const struct nn_cp_sink **self,
+    struct nn_event *event)
+{
+    struct nn_cstream *cstream;
+
+    cstream = nn_cont (self, struct nn_cstream, sink);
+
+    /*  The lookup is done. Pick up the result. */
+    nn_cstream_resolve (cstream);
 }
 
 /******************************************************************************/
@@ -186,30 +400,49 @@ static void nn_cstream_connecting_connected (const struct nn_cp_sink **self,
     struct nn_usock *usock);
 static void nn_cstream_connecting_err (const struct nn_cp_sink **self,
     struct nn_usock *usock, int errnum);
+static void nn_cstream_connecting_closed (const struct nn_cp_sink **self,
+    struct nn_usock *usock);
+static void nn_cstream_connecting_timeout (const struct nn_cp_sink **self,
+    struct nn_timer *timer);
 static const struct nn_cp_sink nn_cstream_state_connecting = {
     NULL,
     NULL,
     nn_cstream_connecting_connected,
     NULL,
     nn_cstream_connecting_err,
-    NULL,
-    NULL,
+    nn_cstream_connecting_closed,
+    nn_cstream_connecting_timeout,
     NULL
 };
 
 static void nn_cstream_connecting_connected (const struct nn_cp_sink **self,
     struct nn_usock *usock)
 {
+    int i;
     struct nn_cstream *cstream;
 
     cstream = nn_cont (self, struct nn_cstream, sink);
 
-    /*  TODO: Set current reconnect interval to the value of
-        NN_RECONNECT_IVL. */
+    /*  Once the connection breaks, the reconnect sequence starts anew
+        from NN_RECONNECT_IVL. */
+    cstream->retry_ivl = -1;
 
-    /*  Connect succeeded. Switch to the session state machine. */
+    /*  The first connection established is used. Cancel the other
+        attempts. */
+    nn_timer_stop (&cstream->attempt_timer);
+    cstream->slots [nn_cstream_slot (cstream, usock)] =
+        NN_CSTREAM_SLOT_CONNECTED;
+    cstream->usock = usock;
     cstream->sink = &nn_cstream_state_connected;
-    nn_stream_init (&cstream->stream, &cstream->epbase, &cstream->usock);
+    for (i = 0; i != NN_CSTREAM_ATTEMPTS; ++i) {
+        if (cstream->slots [i] == NN_CSTREAM_SLOT_CONNECTING) {
+            cstream->slots [i] = NN_CSTREAM_SLOT_CLOSING;
+            nn_usock_close (&cstream->usocks [i]);
+        }
+    }
+
+    /*  Switch to the session state machine. */
+    nn_stream_init (&cstream->stream, &cstream->epbase, usock);
 }
 
 static void nn_cstream_connecting_err (const struct nn_cp_sink **self,
@@ -220,8 +453,55 @@ static void nn_cstream_connecting_err (const struct nn_cp_sink **self,
     cstream = nn_cont (self, struct nn_cstream, sink);
 
     /*  Connect failed. Close the underlying socket. */
-    cstream->sink = &nn_cstream_state_closing;
-    nn_usock_close (&cstream->usock);
+    cstream->slots [nn_cstream_slot (cstream, usock)] =
+        NN_CSTREAM_SLOT_CLOSING;
+    nn_usock_close (usock);
+}
+
+static void nn_cstream_connecting_closed (const struct nn_cp_sink **self,
+    struct nn_usock *usock)
+{
+    int idle;
+    struct nn_cstream *cstream;
+
+    cstream = nn_cont (self, struct nn_cstream, sink);
+
+    idle = nn_cstream_released (cstream, usock);
+
+    /*  There's no point in waiting for the attempt timer. Try the next
+        address straight away. */
+    if (cstream->next < cstream->nremote) {
+        nn_cstream_attempt (cstream);
+        return;
+    }
+
+    /*  If all the attempts have failed, wait and re-try. */
+    if (idle) {
+        nn_timer_stop (&cstream->attempt_timer);
+        cstream->sink = &nn_cstream_state_waiting;
+        nn_timer_start (&cstream->retry_timer,
+            nn_cstream_compute_retry_ivl (cstream));
+    }
+}
+
+static void nn_cstream_connecting_timeout (const struct nn_cp_sink **self,
+    struct nn_timer *timer)
+{
+    int i;
+    struct nn_cstream *cstream;
+
+    cstream = nn_cont (self, struct nn_cstream, sink);
+    nn_assert (timer == &cstream->attempt_timer);
+
+    /*  The attempts in progress take too long. Try the next address in
+        parallel. If all the sockets are in use, the next address is tried
+        once one of the attempts fails. */
+    for (i = 0; i != NN_CSTREAM_ATTEMPTS; ++i) {
+        if (cstream->slots [i] == NN_CSTREAM_SLOT_IDLE) {
+            nn_cstream_attempt (cstream);
+            return;
+        }
+    }
 }
 
 /******************************************************************************/
@@ -232,13 +512,15 @@ static void nn_cstream_connecting_err (const struct nn_cp_sink **self,
 
 static void nn_cstream_connected_err (const struct nn_cp_sink **self,
     struct nn_usock *usock, int errnum);
+static void nn_cstream_connected_closed (const struct nn_cp_sink **self,
+    struct nn_usock *usock);
 static const struct nn_cp_sink nn_cstream_state_connected = {
     NULL,
     NULL,
     NULL,
     NULL,
     nn_cstream_connected_err,
-    NULL,
+    nn_cstream_connected_closed,
     NULL,
     NULL
 };
@@ -249,10 +531,25 @@ static void nn_cstream_connected_err (const struct nn_cp_sink **self,
     struct nn_cstream *cstream;
 
     cstream = nn_cont (self, struct nn_cstream, sink);
+    nn_assert (usock == cstream->usock);
 
-    /*  The connection is broken. Reconnect. */
-    cstream->sink = &nn_cstream_state_waiting;
-    nn_cstream_waiting_timeout (&cstream->sink, &cstream->retry_timer);
+    /*  The connection is broken. Close the underlying socket and reconnect
+        once it is closed. */
+    cstream->slots [nn_cstream_slot (cstream, usock)] =
+        NN_CSTREAM_SLOT_CLOSING;
+    cstream->sink = &nn_cstream_state_closing;
+    nn_usock_close (usock);
+}
+
+static void nn_cstream_connected_closed (const struct nn_cp_sink **self,
+    struct nn_usock *usock)
+{
+    struct nn_cstream *cstream;
+
+    cstream = nn_cont (self, struct nn_cstream, sink);
+
+    /*  One of the cancelled connection attempts is closed. */
+    nn_cstream_released (cstream, usock);
 }
 
 /******************************************************************************/
@@ -275,29 +572,16 @@ static const struct nn_cp_sink nn_cstream_state_closing = {
 static void nn_cstream_closing_closed (const struct nn_cp_sink **self,
     struct nn_usock *usock)
 {
-    int rc;
     struct nn_cstream *cstream;
-    int sndbuf;
-    int rcvbuf;
-    size_t sz;
 
     cstream = nn_cont (self, struct nn_cstream, sink);
 
-    /*  Get the current values of NN_SNDBUF and NN_RCVBUF options. */    
-    sz = sizeof (sndbuf);
-    nn_epbase_getopt (&cstream->epbase, NN_SOL_SOCKET, NN_SNDBUF, &sndbuf, &sz);
-    nn_assert (sz == sizeof (sndbuf));
-    sz = sizeof (rcvbuf);
-    nn_epbase_getopt (&cstream->epbase, NN_SOL_SOCKET, NN_RCVBUF, &rcvbuf, &sz);
-    nn_assert (sz == sizeof (rcvbuf));
-
-    /*  Create new socket. */
-    rc = cstream->initsockfn (&cstream->usock, sndbuf, rcvbuf,
-        nn_epbase_getcp (&cstream->epbase));
-    errnum_assert (rc == 0, -rc);
-    nn_usock_setsink (&cstream->usock, &cstream->sink);
+    /*  Wait till the cancelled connection attempts are closed as well. */
+    if (!nn_cstream_released (cstream, usock))
+        return;
 
     /*  Wait for the specified period. */
+    cstream->usock = NULL;
     cstream->sink = &nn_cstream_state_waiting;
     nn_timer_start (&cstream->retry_timer,
         nn_cstream_compute_retry_ivl (cstream));
@@ -322,6 +606,9 @@ static const struct nn_cp_sink nn_cstream_state_terminating = {
 
 static int nn_cstream_close (struct nn_epbase *self)
 {
+    int i;
+    int pending;
+    int closing;
     struct nn_cstream *cstream;
 
     cstream = nn_cont (self, struct nn_cstream, epbase);
@@ -334,12 +621,42 @@ static int nn_cstream_close (struct nn_epbase *self)
     if (cstream->sink == &nn_cstream_state_connected)
         nn_stream_term (&cstream->stream);
 
-    /*  Deallocate resources. */
+    /*  Deallocate resources. The lookup in progress, if any, is cancelled. */
+    nn_clock_term (&cstream->clock);
     nn_timer_term (&cstream->retry_timer);
-
-    /*  Close the socket, if needed. */
+    nn_timer_term (&cstream->attempt_timer);
+    nn_resolve_term (&cstream->resolve);
     cstream->sink = &nn_cstream_state_terminating;
-    nn_usock_close (&cstream->usock);
+
+    /*  Count the sockets that have to be closed and those being closed
+        already. */
+    pending = 0;
+    closing = 0;
+    for (i = 0; i != NN_CSTREAM_ATTEMPTS; ++i) {
+        if (cstream->slots [i] == NN_CSTREAM_SLOT_CLOSING)
+            ++closing;
+        else if (cstream->slots [i] != NN_CSTREAM_SLOT_IDLE)
+            ++pending;
+    }
+
+    /*  If there are no sockets open, the endpoint can be deallocated
+        straight away. */
+    if (!pending && !closing) {
+        nn_epbase_term (&cstream->epbase);
+        nn_free (cstream);
+        return 0;
+    }
+
+    /*  Close the sockets. The endpoint is deallocated once the last one is
+        closed, which may happen synchronously. Don't touch it afterwards. */
+    for (i = 0; pending; ++i) {
+        if (cstream->slots [i] == NN_CSTREAM_SLOT_CONNECTING ||
+              cstream->slots [i] == NN_CSTREAM_SLOT_CONNECTED) {
+            cstream->slots [i] = NN_CSTREAM_SLOT_CLOSING;
+            --pending;
+            nn_usock_close (&cstream->usocks [i]);
+        }
+    }
 
     return -EINPROGRESS;
 }
@@ -351,7 +668,10 @@ static void nn_cstream_terminating_closed (const struct nn_cp_sink **self,
 
     cstream = nn_cont (self, struct nn_cstream, sink);
 
+    /*  Wait till all the sockets are closed. */
+    if (!nn_cstream_released (cstream, usock))
+        return;
+
     nn_epbase_term (&cstream->epbase);
     nn_free (cstream);
 }
-
@@ -27,11 +27,26 @@
 
 #include "aio.h"
 #include "stream.h"
+#include "resolver.h"
+#include "clock.h"
 
 /*  Returned by the resolve function to indicate that the 'local' address
-    should be used. */
+    should be used. The function may also return -EINPROGRESS, meaning that
+    it has started resolving the address using 'resolve' object and it should
+    be invoked anew once it's done. On input, 'nremote' is the number of
+    elements of 'remote' and 'remotelen' arrays. On success, it's set to
+    the number of remote addresses to try. */
 #define NN_CSTREAM_DOBIND 1
 
+/*  If the remote name resolves to several addresses, they are tried one
+    after another, the next one being tried once the previous attempt fails
+    or when it doesn't succeed within NN_CSTREAM_ATTEMPT_DELAY milliseconds,
+    whichever comes first (RFC 8305). At most NN_CSTREAM_ATTEMPTS attempts
+    are in progress at the same time. The first connection established is
+    used, the others are closed. */
+#define NN_CSTREAM_ATTEMPTS 4
+#define NN_CSTREAM_ATTEMPT_DELAY 250
+
 struct nn_cstream {
 
     /*  Event sink. */
@@ -40,8 +55,12 @@ struct nn_cstream {
     /*  This object is an endpoint. */
     struct nn_epbase epbase;
 
-    /*  The underlying socket. */
-    struct nn_usock usock;
+    /*  The underlying sockets, one per connection attempt. 'slots' hold
+        their states. Once connected, 'usock' points to the socket used by
+        the session. */
+    struct nn_usock usocks [NN_CSTREAM_ATTEMPTS];
+    int slots [NN_CSTREAM_ATTEMPTS];
+    struct nn_usock *usock;
 
     /*  There's at most one session per connecting endpoint, thus we can
         embed the session object directly into the connecter class. */
@@ -54,19 +73,47 @@ struct nn_cstream {
     /*  Timer to wait before retrying to connect. */
     struct nn_timer retry_timer;
 
+    /*  1 if the retry timer is running because of the process-wide limit
+        of connection attempts, meaning that the attempt was already
+        accounted for. */
+    int admitted;
+    struct nn_clock clock;
+
+    /*  Used to resolve the address without blocking the completion port. */
+    struct nn_resolve resolve;
+
+    /*  The addresses to connect to and the index of the next remote address
+        to try. */
+    int dobind;
+    struct sockaddr_storage local;
+    socklen_t locallen;
+    struct sockaddr_storage remote [NN_RESOLVE_MAXADDRS];
+    socklen_t remotelen [NN_RESOLVE_MAXADDRS];
+    int nremote;
+    int next;
+
+    /*  Timer to start the next connection attempt if the ones in progress
+        take too long. */
+    struct nn_timer attempt_timer;
+
     /*  Virtual functions supplied by the specific transport type. */
     int (*initsockfn) (struct nn_usock *sock, int sndbuf, int rcvbuf,
-        struct nn_cp *cp);
-    int (*resolvefn) (const char *addr, struct sockaddr_storage *local,
-        socklen_t *locallen, struct sockaddr_storage *remote,
-        socklen_t *remotelen);
+        struct nn_epbase *epbase);
+    int (*resolvefn) (const char *addr, struct nn_resolve *resolve,
+        struct sockaddr_storage *local, socklen_t *locallen,
+        struct sockaddr_storage *remote, socklen_t *remotelen, int *nremote);
 };
 
+/*  Reads the process-wide limit of connection attempts per second from
+    NN_CONNECT_RATE environment variable. */
+void nn_cstream_setup (void);
+
 int nn_cstream_init (struct nn_cstream *self, const char *addr, void *hint,
     int (*initsockfn) (struct nn_usock *sock, int sndbuf, int rcvbuf,
-    struct nn_cp *cp), int (*resolvefn) (const char *addr,
-    struct sockaddr_storage *local, socklen_t *locallen,
-    struct sockaddr_storage *remote, socklen_t *remotelen));
+    struct nn_epbase *epbase), int (*resolvefn) (const char *addr,
+    struct nn_resolve *resolve, struct sockaddr_storage *local,
+    socklen_t *locallen, struct sockaddr_storage *remote,
+    socklen_t *remotelen, int *nremote));
 
 #endif
 
@@ -31,11 +31,15 @@ void nn_dist_init (struct nn_dist *self)
 {
     self->count = 0;
     nn_list_init (&self->pipes);
+    self->nselected = 0;
+    nn_list_init (&self->selected);
 }
 
 void nn_dist_term (struct nn_dist *self)
 {
     nn_assert (self->count == 0);
+    nn_assert (self->nselected == 0);
+    nn_list_term (&self->selected);
     nn_list_term (&self->pipes);
 }
 
@@ -44,6 +48,7 @@ void nn_dist_add (struct nn_dist *self, struct nn_pipe *pipe,
 {
     data->pipe = pipe;
     nn_list_item_init (&data->item);
+    nn_list_item_init (&data->selitem);
 }
 
 void nn_dist_rm (struct nn_dist *self, struct nn_pipe *pipe,
@@ -53,6 +58,8 @@ void nn_dist_rm (struct nn_dist *self, struct nn_pipe *pipe,
         --self->count;
         nn_list_erase (&self->pipes, &data->item);
     }
+    nn_assert (!nn_list_item_isinlist (&data->selitem));
+    nn_list_item_term (&data->selitem);
     nn_list_item_term (&data->item);
 }
 
@@ -71,9 +78,6 @@ int nn_dist_send (struct nn_dist *self, struct nn_msg *msg,
     struct nn_dist_data *data;
     struct nn_msg copy;
 
-    /*  TODO: We can optimise for the case when there's only one outbound
-        pipe here. No message copying is needed in such case. */
-
     /*  In the specific case when there are no outbound pipes. There's nowhere
         to send the message to. Deallocate it. */
     if (nn_slow (self->count) == 0) {
@@ -81,6 +85,23 @@ int nn_dist_send (struct nn_dist *self, struct nn_msg *msg,
         return 0;
     }
 
+    /*  If there's only one outbound pipe, no message copying is needed. */
+    if (self->count == 1) {
+        it = nn_list_begin (&self->pipes);
+        data = nn_cont (it, struct nn_dist_data, item);
+        if (data->pipe == exclude) {
+            nn_msg_term (msg);
+            return 0;
+        }
+        rc = nn_pipe_send (data->pipe, msg);
+        errnum_assert (rc >= 0, -rc);
+        if (rc & NN_PIPE_RELEASE) {
+            --self->count;
+            nn_list_erase (&self->pipes, it);
+        }
+        return 0;
+    }
+
     /*  Send the message to all the subscribers. */
     nn_msg_bulkcopy_start (msg, self->count);
     it = nn_list_begin (&self->pipes);
@@ -106,3 +127,57 @@ int nn_dist_send (struct nn_dist *self, struct nn_msg *msg,
     return 0;
 }
 
+int nn_dist_select (struct nn_dist *self, struct nn_dist_data *data)
+{
+    if (!nn_list_item_isinlist (&data->item))
+        return 0;
+    if (nn_list_item_isinlist (&data->selitem))
+        return 1;
+    ++self->nselected;
+    nn_list_insert (&self->selected, &data->selitem,
+        nn_list_end (&self->selected));
+    return 1;
+}
+
+int nn_dist_send_selected (struct nn_dist *self, struct nn_msg *msg)
+{
+    int rc;
+    size_t count;
+    struct nn_list_item *it;
+    struct nn_dist_data *data;
+    struct nn_msg copy;
+
+    /*  Nobody is interested in the message. Deallocate it. */
+    count = self->nselected;
+    if (count == 0) {
+        nn_msg_term (msg);
+        return 0;
+    }
+
+    /*  If there's a single destination, the message itself is passed to it
+        and no copying is needed. */
+    if (count > 1)
+        nn_msg_bulkcopy_start (msg, count);
+    while (1) {
+        it = nn_list_begin (&self->selected);
+        if (it == nn_list_end (&self->selected))
+            break;
+        nn_list_erase (&self->selected, it);
+        data = nn_cont (it, struct nn_dist_data, selitem);
+        if (count > 1)
+            nn_msg_bulkcopy_cp (&copy, msg);
+        else
+            nn_msg_mv (&copy, msg);
+        rc = nn_pipe_send (data->pipe, &copy);
+        errnum_assert (rc >= 0, -rc);
+        if (rc & NN_PIPE_RELEASE) {
+            --self->count;
+            nn_list_erase (&self->pipes, &data->item);
+        }
+    }
+    self->nselected = 0;
+    if (count > 1)
+        nn_msg_term (msg);
+
+    return 0;
+}
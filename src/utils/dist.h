@@ -32,11 +32,18 @@
 struct nn_dist_data {
     struct nn_list_item item;
     struct nn_pipe *pipe;
+
+    /*  Item in the list of pipes selected by nn_dist_select. */
+    struct nn_list_item selitem;
 };
 
 struct nn_dist {
     size_t count;
     struct nn_list pipes;
+
+    /*  Pipes to send the next message to, see nn_dist_select. */
+    size_t nselected;
+    struct nn_list selected;
 };
 
 void nn_dist_init (struct nn_dist *self);
@@ -54,4 +61,13 @@ void nn_dist_out (struct nn_dist *self, struct nn_pipe *pipe,
 int nn_dist_send (struct nn_dist *self, struct nn_msg *msg,
     struct nn_pipe *exclude);
 
+/*  Selective sending. nn_dist_select marks the pipe as a destination of
+    the next message. Pipes that are not ready for sending and pipes that are
+    already selected are ignored. nn_dist_select returns 0 if the pipe is not
+    ready for sending, 1 otherwise. nn_dist_send_selected sends the message to
+    the selected pipes only and clears the selection. The cost doesn't depend
+    on the number of pipes that were not selected. */
+int nn_dist_select (struct nn_dist *self, struct nn_dist_data *data);
+int nn_dist_send_selected (struct nn_dist *self, struct nn_msg *msg);
+
 #endif
@@ -381,13 +381,21 @@ void nn_efd_unsignal (struct nn_efd *self)
 #elif defined NN_USE_EVENTFD
 
 #include "err.h"
+#include "fast.h"
 
 #include <stdint.h>
 #include <sys/eventfd.h>
 #include <unistd.h>
 #include <fcntl.h>
 
-int nn_efd_init (struct nn_efd *self)
+#if defined NN_EFD_LAZY
+#include <limits.h>
+#include <time.h>
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#endif
+
+static int nn_efd_mkfd (struct nn_efd *self)
 {
     int rc;
     int flags;
@@ -406,16 +414,56 @@ int nn_efd_init (struct nn_efd *self)
     return 0;
 }
 
+int nn_efd_init (struct nn_efd *self)
+{
+#if defined NN_EFD_LAZY
+    self->lazy = 0;
+#endif
+    return nn_efd_mkfd (self);
+}
+
+#if defined NN_EFD_LAZY
+
+int nn_efd_init_lazy (struct nn_efd *self)
+{
+    self->efd = -1;
+    self->lazy = 1;
+    self->signalled = 0;
+    self->waiters = 0;
+    return 0;
+}
+
+#endif
+
 void nn_efd_term (struct nn_efd *self)
 {
     int rc;
 
+    if (self->efd == -1)
+        return;
     rc = close (self->efd);
     errno_assert (rc == 0);
 }
 
 nn_fd nn_efd_getfd (struct nn_efd *self)
 {
+#if defined NN_EFD_LAZY
+    const uint64_t one = 1;
+    ssize_t nbytes;
+#endif
+
+    if (nn_slow (self->efd == -1)) {
+        if (nn_efd_mkfd (self) < 0)
+            return -1;
+
+#if defined NN_EFD_LAZY
+        /*  Bring the descriptor to the current state of the object. */
+        if (self->signalled) {
+            nbytes = write (self->efd, &one, sizeof (one));
+            errno_assert (nbytes == sizeof (one));
+        }
+#endif
+    }
     return self->efd;
 }
 
@@ -424,6 +472,20 @@ void nn_efd_signal (struct nn_efd *self)
     const uint64_t one = 1;
     ssize_t nbytes;
 
+#if defined NN_EFD_LAZY
+    if (self->lazy) {
+
+        /*  Paired with the increment of 'waiters' in nn_efd_wait. Either
+            the waiter sees the object signalled or we see the waiter. */
+        __atomic_store_n (&self->signalled, 1, __ATOMIC_SEQ_CST);
+        if (__atomic_load_n (&self->waiters, __ATOMIC_SEQ_CST))
+            syscall (SYS_futex, &self->signalled, FUTEX_WAKE_PRIVATE,
+                INT_MAX, NULL, NULL, 0);
+        if (nn_fast (self->efd == -1))
+            return;
+    }
+#endif
+
     nbytes = write (self->efd, &one, sizeof (one));
     errno_assert (nbytes == sizeof (one));
 }
@@ -431,13 +493,77 @@ void nn_efd_signal (struct nn_efd *self)
 void nn_efd_unsignal (struct nn_efd *self)
 {
     uint64_t count;
+    ssize_t sz;
+
+#if defined NN_EFD_LAZY
+    if (self->lazy) {
+        __atomic_store_n (&self->signalled, 0, __ATOMIC_RELAXED);
+        if (nn_fast (self->efd == -1))
+            return;
+    }
+#endif
 
     /*  Extract all the signals from the eventfd. */
-    ssize_t sz = read (self->efd, &count, sizeof (count));
+    sz = read (self->efd, &count, sizeof (count));
     errno_assert (sz >= 0);
     nn_assert (sz == sizeof (count));
 }
 
+#if defined NN_EFD_LAZY
+
+/*  Waits for a lazily initialised efd using the futex. The deadline is
+    absolute so that the spurious wake-ups don't extend the timeout. */
+static int nn_efd_wait_futex (struct nn_efd *self, int timeout)
+{
+    int rc;
+    int res;
+    struct timespec deadline;
+
+    if (timeout > 0) {
+        rc = clock_gettime (CLOCK_MONOTONIC, &deadline);
+        errno_assert (rc == 0);
+        deadline.tv_sec += timeout / 1000;
+        deadline.tv_nsec += (long) (timeout % 1000) * 1000000;
+        if (deadline.tv_nsec >= 1000000000) {
+            ++deadline.tv_sec;
+            deadline.tv_nsec -= 1000000000;
+        }
+    }
+
+    __atomic_fetch_add (&self->waiters, 1, __ATOMIC_SEQ_CST);
+    res = 0;
+    while (!__atomic_load_n (&self->signalled, __ATOMIC_SEQ_CST)) {
+        if (timeout == 0) {
+            res = -ETIMEDOUT;
+            break;
+        }
+        rc = syscall (SYS_futex, &self->signalled, FUTEX_WAIT_BITSET_PRIVATE,
+            0, timeout > 0 ? &deadline : NULL, NULL, FUTEX_BITSET_MATCH_ANY);
+        if (rc < 0 && errno == ETIMEDOUT) {
+            res = -ETIMEDOUT;
+            break;
+        }
+        if (rc < 0 && errno == EINTR) {
+            res = -EINTR;
+            break;
+        }
+        errno_assert (rc == 0 || errno == EAGAIN);
+    }
+    __atomic_fetch_sub (&self->waiters, 1, __ATOMIC_RELAXED);
+    return res;
+}
+
+#endif
+
+#endif
+
+#if !defined NN_EFD_LAZY
+
+int nn_efd_init_lazy (struct nn_efd *self)
+{
+    return nn_efd_init (self);
+}
+
 #endif
 
 #if defined NN_HAVE_POLL
@@ -449,6 +575,11 @@ int nn_efd_wait (struct nn_efd *self, int timeout)
     int rc;
     struct pollfd pfd;
 
+#if defined NN_EFD_LAZY
+    if (self->lazy)
+        return nn_efd_wait_futex (self, timeout);
+#endif
+
     pfd.fd = nn_efd_getfd (self);
     pfd.events = POLLIN;
     rc = poll (&pfd, 1, timeout);
@@ -40,11 +40,20 @@ struct nn_efd;
 /*  Initialise the efd object. */
 int nn_efd_init (struct nn_efd *self);
 
+/*  Initialise the efd object without creating the OS file descriptor until
+    nn_efd_getfd() is called. Threads waiting in nn_efd_wait() are woken up
+    without the help of the OS descriptor, if the platform allows, which
+    saves the system calls when no one else is interested in the events. */
+int nn_efd_init_lazy (struct nn_efd *self);
+
 /*  Uninitialise the efd object. */
 void nn_efd_term (struct nn_efd *self);
 
 /*  Get the OS file descriptor that is readable when the efd object
-    is signaled. */
+    is signaled. Returns (nn_fd) -1 if the descriptor of an object initialised
+    by nn_efd_init_lazy() can't be created for the lack of file descriptors.
+    Calls to the function must not be concurrent with signalling or
+    unsignalling the object. */
 nn_fd nn_efd_getfd (struct nn_efd *self);
 
 /*  Switch the object into signaled state. */
@@ -84,8 +93,25 @@ struct nn_efd {
 
 #elif defined NN_USE_EVENTFD
 
+/*  Lazily initialised efds use a futex to wake up the waiters. */
+#if defined NN_HAVE_FUTEX && defined NN_HAVE_GCC_ATOMIC_MEMORY_MODEL
+#define NN_EFD_LAZY
+#include <stdint.h>
+#endif
+
 struct nn_efd {
+
+    /*  The eventfd or -1 if it wasn't created yet. */
     int efd;
+
+#if defined NN_EFD_LAZY
+    /*  1 if the object was initialised by nn_efd_init_lazy. 'signalled'
+        then mirrors the state of the object and 'waiters' is the number of
+        threads waiting for it to become signalled. */
+    int lazy;
+    uint32_t signalled;
+    uint32_t waiters;
+#endif
 };
 
 #endif
@@ -23,12 +23,16 @@
 #include "fq.h"
 #include "err.h"
 #include "cont.h"
+#include "fast.h"
 
 #include <stddef.h>
 
 void nn_fq_init (struct nn_fq *self)
 {
     nn_priolist_init (&self->priolist);
+    self->last = NULL;
+    self->taken = 0;
+    self->clock = NULL;
 }
 
 void nn_fq_term (struct nn_fq *self)
@@ -37,21 +41,32 @@ void nn_fq_term (struct nn_fq *self)
 }
 
 void nn_fq_add (struct nn_fq *self, struct nn_pipe *pipe,
-    struct nn_fq_data *data, int priority)
+    struct nn_fq_data *data, int priority, int quantum)
 {
-    nn_priolist_add (&self->priolist, pipe, &data->priolist, priority);
+    nn_priolist_add (&self->priolist, pipe, &data->priolist, priority, 1);
+    data->quantum = quantum;
+    data->since = 0;
 }
 
 void nn_fq_rm (struct nn_fq *self, struct nn_pipe *pipe,
     struct nn_fq_data *data)
 {
     nn_priolist_rm (&self->priolist, pipe, &data->priolist);
+    if (self->last == data)
+        self->last = NULL;
 }
 
 void nn_fq_in (struct nn_fq *self, struct nn_pipe *pipe,
     struct nn_fq_data *data)
 {
     nn_priolist_activate (&self->priolist, pipe, &data->priolist);
+    if (nn_slow (self->clock != NULL))
+        data->since = nn_clock_now (self->clock);
+}
+
+void nn_fq_setclock (struct nn_fq *self, struct nn_clock *clock)
+{
+    self->clock = clock;
 }
 
 int nn_fq_can_recv (struct nn_fq *self)
@@ -63,23 +78,42 @@ int nn_fq_recv (struct nn_fq *self, struct nn_msg *msg, struct nn_pipe **pipe)
 {
     int rc;
     struct nn_pipe *p;
-
-    /*  Pipe is NULL only when there are no avialable pipes. */
-    p = nn_priolist_getpipe (&self->priolist);
-    if (nn_slow (!p))
-        return -EAGAIN;
-
-    /*  Receive the messsage. */
-    rc = nn_pipe_recv (p, msg);
-    errnum_assert (rc >= 0, -rc);
+    struct nn_fq_data *data;
+
+    /*  Messages that have outlived their time-to-live are dropped here, before
+        the protocol gets to process them. */
+    while (1) {
+
+        /*  Pipe is NULL only when there are no avialable pipes. */
+        p = nn_priolist_getpipe (&self->priolist);
+        if (nn_slow (!p))
+            return -EAGAIN;
+        data = nn_cont (nn_priolist_getdata (&self->priolist),
+            struct nn_fq_data, priolist);
+        if (data != self->last) {
+            self->last = data;
+            self->taken = 0;
+        }
+
+        /*  Receive the messsage. */
+        rc = nn_pipe_recv (p, msg);
+        errnum_assert (rc >= 0, -rc);
+
+        /*  Move to the next pipe once the pipe is exhausted or its quantum is
+            used up. */
+        if ((rc & NN_PIPE_RELEASE) || ++self->taken >= data->quantum) {
+            nn_priolist_advance (&self->priolist, rc & NN_PIPE_RELEASE);
+            self->last = NULL;
+        }
+
+        if (nn_fast (!msg->deadline || !nn_pipe_expired (p, msg)))
+            break;
+        nn_msg_term (msg);
+    }
 
     /*  Return the pipe data to the user, if required. */
     if (pipe)
         *pipe = p;
 
-    /*  Move to the next pipe. */
-    nn_priolist_advance (&self->priolist, rc & NN_PIPE_RELEASE);
-
     return rc & ~NN_PIPE_RELEASE;
 }
-
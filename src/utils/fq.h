@@ -26,26 +26,46 @@
 #include "../protocol.h"
 
 #include "priolist.h"
+#include "clock.h"
+
+#include <stdint.h>
 
 /*  Fair-queuer. Retrieves messages from a set of pipes in round-robin
-    manner. */
+    manner. Up to 'quantum' messages are retrieved from a pipe in a row
+    before moving to the next one. */
 
 struct nn_fq_data {
     struct nn_priolist_data priolist;
+    int quantum;
+
+    /*  Time the pipe last became readable. Messages received from the pipe
+        have been waiting for at most this long. Tracked only if the clock
+        is set by nn_fq_setclock, zero otherwise. */
+    uint64_t since;
 };
 
 struct nn_fq {
     struct nn_priolist priolist;
+
+    /*  The pipe messages were last retrieved from and the number of messages
+        retrieved from it in a row. */
+    struct nn_fq_data *last;
+    int taken;
+
+    /*  Clock to timestamp the pipes with when they become readable. NULL if
+        they are not timestamped. */
+    struct nn_clock *clock;
 };
 
 void nn_fq_init (struct nn_fq *self);
 void nn_fq_term (struct nn_fq *self);
 void nn_fq_add (struct nn_fq *self, struct nn_pipe *pipe,
-    struct nn_fq_data *data, int priority);
+    struct nn_fq_data *data, int priority, int quantum);
 void nn_fq_rm (struct nn_fq *self, struct nn_pipe *pipe,
     struct nn_fq_data *data);
 void nn_fq_in (struct nn_fq *self, struct nn_pipe *pipe,
     struct nn_fq_data *data);
+void nn_fq_setclock (struct nn_fq *self, struct nn_clock *clock);
 int nn_fq_can_recv (struct nn_fq *self);
 int nn_fq_recv (struct nn_fq *self, struct nn_msg *msg, struct nn_pipe **pipe);
 
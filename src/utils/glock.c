@@ -56,6 +56,34 @@ void nn_glock_unlock (void)
 
 static pthread_mutex_t nn_glock_mutex = PTHREAD_MUTEX_INITIALIZER;
 
+#if defined NN_LOCK_MONITOR
+
+#include "mutex.h"
+
+/*  The global lock is accounted for along with the mutexes. */
+static volatile int nn_glock_site = -1;
+
+void nn_glock_lock (void)
+{
+    int rc;
+    uint64_t start;
+
+    if (nn_glock_site < 0)
+        nn_glock_site = nn_mutex_site ("glock");
+    rc = pthread_mutex_trylock (&nn_glock_mutex);
+    if (rc == 0) {
+        nn_mutex_account (nn_glock_site, 0, 0);
+        return;
+    }
+    errnum_assert (rc == EBUSY, rc);
+    start = nn_mutex_now ();
+    rc = pthread_mutex_lock (&nn_glock_mutex);
+    errnum_assert (rc == 0, rc);
+    nn_mutex_account (nn_glock_site, 1, nn_mutex_now () - start);
+}
+
+#else
+
 void nn_glock_lock (void)
 {
     int rc;
@@ -64,6 +92,8 @@ void nn_glock_lock (void)
     errnum_assert (rc == 0, rc);
 }
 
+#endif
+
 void nn_glock_unlock (void)
 {
     int rc;
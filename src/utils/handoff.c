@@ -0,0 +1,218 @@
+/*
+    Copyright (c) 2013 250bpm s.r.o.
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"),
+    to deal in the Software without restriction, including without limitation
+    the rights to use, copy, modify, merge, publish, distribute, sublicense,
+    and/or sell copies of the Software, and to permit persons to whom
+    the Software is furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included
+    in all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+    THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+    FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+    IN THE SOFTWARE.
+*/
+
+#include "handoff.h"
+#include "err.h"
+#include "fast.h"
+#include "wire.h"
+
+#if !defined NN_HAVE_WINDOWS
+
+#include <string.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+
+/*  Size of the record header. */
+#define NN_HANDOFF_HDR 4
+
+#if !defined MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0
+#endif
+
+int nn_handoff_send (int fd, int type, const void *data, size_t len,
+    const int *fds, int nfds)
+{
+    ssize_t nbytes;
+    size_t pos;
+    uint8_t hdr [NN_HANDOFF_HDR];
+    struct iovec iov [2];
+    struct msghdr msg;
+    struct cmsghdr *cmsg;
+    union {
+        struct cmsghdr align;
+        uint8_t buf [CMSG_SPACE (sizeof (int) * NN_HANDOFF_MAXFDS)];
+    } ctl;
+
+    nn_assert (len <= NN_HANDOFF_MAXDATA);
+    nn_assert (nfds >= 0 && nfds <= NN_HANDOFF_MAXFDS);
+
+    hdr [0] = (uint8_t) type;
+    hdr [1] = (uint8_t) nfds;
+    nn_puts (hdr + 2, (uint16_t) len);
+    iov [0].iov_base = hdr;
+    iov [0].iov_len = NN_HANDOFF_HDR;
+    iov [1].iov_base = (void*) data;
+    iov [1].iov_len = len;
+    memset (&msg, 0, sizeof (msg));
+    msg.msg_iov = iov;
+    msg.msg_iovlen = len ? 2 : 1;
+
+    /*  The file descriptors travel with the header. */
+    if (nfds) {
+        msg.msg_control = ctl.buf;
+        msg.msg_controllen = CMSG_SPACE (sizeof (int) * nfds);
+        cmsg = CMSG_FIRSTHDR (&msg);
+        cmsg->cmsg_level = SOL_SOCKET;
+        cmsg->cmsg_type = SCM_RIGHTS;
+        cmsg->cmsg_len = CMSG_LEN (sizeof (int) * nfds);
+        memcpy (CMSG_DATA (cmsg), fds, sizeof (int) * nfds);
+    }
+    while (1) {
+        nbytes = sendmsg (fd, &msg, MSG_NOSIGNAL);
+        if (nbytes >= 0)
+            break;
+        if (errno != EINTR)
+            return -errno;
+    }
+
+    /*  Send whatever didn't fit into the socket buffer. */
+    pos = (size_t) nbytes;
+    while (pos < NN_HANDOFF_HDR + len) {
+        if (pos < NN_HANDOFF_HDR)
+            nbytes = send (fd, hdr + pos, NN_HANDOFF_HDR - pos, MSG_NOSIGNAL);
+        else
+            nbytes = send (fd, ((const uint8_t*) data) + pos - NN_HANDOFF_HDR,
+                NN_HANDOFF_HDR + len - pos, MSG_NOSIGNAL);
+        if (nbytes < 0) {
+            if (errno == EINTR)
+                continue;
+            return -errno;
+        }
+        pos += (size_t) nbytes;
+    }
+
+    return 0;
+}
+
+/*  Reads exactly 'len' bytes. */
+static int nn_handoff_read (int fd, void *buf, size_t len)
+{
+    ssize_t nbytes;
+    size_t pos;
+
+    pos = 0;
+    while (pos < len) {
+        nbytes = recv (fd, ((uint8_t*) buf) + pos, len - pos, 0);
+        if (nbytes == 0)
+            return -ECONNRESET;
+        if (nbytes < 0) {
+            if (errno == EINTR)
+                continue;
+            return -errno;
+        }
+        pos += (size_t) nbytes;
+    }
+    return 0;
+}
+
+int nn_handoff_recv (int fd, void *data, size_t *len, int *fds, int *nfds)
+{
+    int rc;
+    int count;
+    ssize_t nbytes;
+    uint8_t hdr [NN_HANDOFF_HDR];
+    struct iovec iov;
+    struct msghdr msg;
+    struct cmsghdr *cmsg;
+    union {
+        struct cmsghdr align;
+        uint8_t buf [CMSG_SPACE (sizeof (int) * NN_HANDOFF_MAXFDS)];
+    } ctl;
+
+    /*  Receive the header, or its beginning, along with the descriptors. */
+    iov.iov_base = hdr;
+    iov.iov_len = NN_HANDOFF_HDR;
+    memset (&msg, 0, sizeof (msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = ctl.buf;
+    msg.msg_controllen = sizeof (ctl.buf);
+    while (1) {
+#if defined MSG_CMSG_CLOEXEC
+        nbytes = recvmsg (fd, &msg, MSG_CMSG_CLOEXEC);
+#else
+        nbytes = recvmsg (fd, &msg, 0);
+#endif
+        if (nbytes >= 0)
+            break;
+        if (errno != EINTR)
+            return -errno;
+    }
+    if (nbytes == 0)
+        return -ECONNRESET;
+
+    *nfds = 0;
+    for (cmsg = CMSG_FIRSTHDR (&msg); cmsg; cmsg = CMSG_NXTHDR (&msg, cmsg)) {
+        if (cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS)
+            continue;
+        count = (int) ((cmsg->cmsg_len - CMSG_LEN (0)) / sizeof (int));
+        memcpy (fds + *nfds, CMSG_DATA (cmsg), sizeof (int) * count);
+        *nfds += count;
+    }
+
+    /*  Receive the rest of the record and check it's consistent. */
+    rc = nn_handoff_read (fd, hdr + nbytes, NN_HANDOFF_HDR - nbytes);
+    if (rc == 0) {
+        *len = nn_gets (hdr + 2);
+        if ((msg.msg_flags & MSG_CTRUNC) || hdr [1] != *nfds ||
+              *len > NN_HANDOFF_MAXDATA)
+            rc = -EPROTO;
+    }
+    if (rc == 0)
+        rc = nn_handoff_read (fd, data, *len);
+    if (nn_slow (rc < 0)) {
+        nn_handoff_closefds (fds, *nfds);
+        *nfds = 0;
+        return rc;
+    }
+
+    return hdr [0];
+}
+
+void nn_handoff_closefds (const int *fds, int nfds)
+{
+    int i;
+
+    for (i = 0; i != nfds; ++i)
+        close (fds [i]);
+}
+
+#else
+
+int nn_handoff_send (int fd, int type, const void *data, size_t len,
+    const int *fds, int nfds)
+{
+    return -ENOTSUP;
+}
+
+int nn_handoff_recv (int fd, void *data, size_t *len, int *fds, int *nfds)
+{
+    return -ENOTSUP;
+}
+
+void nn_handoff_closefds (const int *fds, int nfds)
+{
+    nn_assert (nfds == 0);
+}
+
+#endif
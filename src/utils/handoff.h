@@ -0,0 +1,63 @@
+/*
+    Copyright (c) 2013 250bpm s.r.o.
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"),
+    to deal in the Software without restriction, including without limitation
+    the rights to use, copy, modify, merge, publish, distribute, sublicense,
+    and/or sell copies of the Software, and to permit persons to whom
+    the Software is furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included
+    in all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+    THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+    FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+    IN THE SOFTWARE.
+*/
+
+#ifndef NN_HANDOFF_INCLUDED
+#define NN_HANDOFF_INCLUDED
+
+#include <stddef.h>
+
+/*  Hot restart (see nn_handoff). The endpoints of a socket are passed to
+    the successor process over a UNIX domain socket as a sequence of records.
+    Each record consists of a 1-byte type, 1-byte number of file descriptors
+    passed along with it, 2-byte size of the data and the data themselves.
+    An NN_HANDOFF_EP record carries the transport ID and the address of
+    a bound endpoint along with its listening sockets. It's followed by
+    an NN_HANDOFF_PIPE record for each connection handed off, carrying
+    the state of the connection along with its socket. NN_HANDOFF_END record
+    terminates the sequence. */
+
+#define NN_HANDOFF_EP 1
+#define NN_HANDOFF_PIPE 2
+#define NN_HANDOFF_END 3
+
+/*  Maximum size of the data and maximum number of file descriptors in
+    a single record. */
+#define NN_HANDOFF_MAXDATA 1024
+#define NN_HANDOFF_MAXFDS 64
+
+/*  Sends a record via blocking socket 'fd'. The descriptors in 'fds' are
+    duplicated for the peer, the caller keeps owning them. Returns 0 in case
+    of success, negative error code otherwise. */
+int nn_handoff_send (int fd, int type, const void *data, size_t len,
+    const int *fds, int nfds);
+
+/*  Receives a record via blocking socket 'fd'. 'data' must be able to hold
+    NN_HANDOFF_MAXDATA bytes, 'fds' NN_HANDOFF_MAXFDS descriptors; '*len' and
+    '*nfds' are set to their actual numbers. The caller becomes the owner of
+    the descriptors received. Returns the type of the record or negative
+    error code, -EPROTO if the peer sent something else than a record. */
+int nn_handoff_recv (int fd, void *data, size_t *len, int *fds, int *nfds);
+
+/*  Closes the descriptors received, e.g. when they can't be used. */
+void nn_handoff_closefds (const int *fds, int nfds);
+
+#endif
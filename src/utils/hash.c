@@ -19,122 +19,108 @@
     FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
     IN THE SOFTWARE.
 */
-
 #include "hash.h"
 #include "fast.h"
 #include "alloc.h"
-#include "cont.h"
 #include "err.h"
 
+#include <string.h>
+
 #define NN_HASH_INITIAL_SLOTS 32
 
+/*  Number of steps of moving the items from the old array to the new one
+    done on each insertion or removal. A step either moves a single item or
+    skips a single empty slot. The old array has at most half as many slots
+    as the new one and is at most half full, so four steps per operation are
+    enough to empty it before the new array has to grow again. */
+#define NN_HASH_MIGRATE_STEPS 4
+
+/*  Private functions. */
 static uint32_t nn_hash_key (uint32_t key);
+static void nn_hash_array_init (struct nn_hash_array *self, uint32_t slots);
+static uint32_t nn_hash_array_find (struct nn_hash_array *self, uint32_t key);
+static void nn_hash_array_remove (struct nn_hash_array *self, uint32_t i);
+static void nn_hash_grow (struct nn_hash *self);
+static void nn_hash_migrate (struct nn_hash *self, uint32_t steps);
 
 void nn_hash_init (struct nn_hash *self)
 {
-    uint32_t i;
-
-    self->slots = NN_HASH_INITIAL_SLOTS;
-    self->items = 0;
-    self->array = nn_alloc (sizeof (struct nn_list) * NN_HASH_INITIAL_SLOTS,
-        "hash map");
-    alloc_assert (self->array);
-    for (i = 0; i != NN_HASH_INITIAL_SLOTS; ++i)
-        nn_list_init (&self->array [i]);
+    nn_hash_array_init (&self->current, NN_HASH_INITIAL_SLOTS);
+    self->old.slots = 0;
+    self->old.items = 0;
+    self->old.array = NULL;
+    self->pos = 0;
 }
 
 void nn_hash_term (struct nn_hash *self)
 {
-    uint32_t i;
-
-    for (i = 0; i != self->slots; ++i)
-        nn_list_term (&self->array [i]);
-    nn_free (self->array);
+    nn_assert (self->current.items == 0 && self->old.items == 0);
+    nn_free (self->current.array);
+    if (self->old.array)
+        nn_free (self->old.array);
 }
 
 void nn_hash_insert (struct nn_hash *self, uint32_t key,
     struct nn_hash_item *item)
 {
-    struct nn_list_item *it;
     uint32_t i;
-    uint32_t oldslots;
-    struct nn_list *oldarray;
-    struct nn_hash_item *hitm;
-    uint32_t newslot;
 
-    i = nn_hash_key (key) % self->slots;
+    nn_assert (!nn_hash_get (self, key));
 
-    for (it = nn_list_begin (&self->array [i]);
-          it != nn_list_end (&self->array [i]);
-          it = nn_list_next (&self->array [i], it))
-        nn_assert (nn_cont (it, struct nn_hash_item, list)->key != key);
+    /*  If the hash is getting full, double the amount of slots. */
+    if (nn_slow ((self->current.items + 1) * 2 > self->current.slots &&
+          self->current.slots < 0x80000000))
+        nn_hash_grow (self);
 
     item->key = key;
-    nn_list_insert (&self->array [i], &item->list,
-        nn_list_end (&self->array [i]));
-    ++self->items;
-
-    /*  If the hash is getting full, double the amount of slots and
-        re-hash all the items. */
-    if (nn_slow (self->items * 2 > self->slots && self->slots < 0x80000000)) {
-
-        /*  Allocate new double-sized array of slots. */
-        oldslots = self->slots;
-        oldarray = self->array;
-        self->slots *= 2;
-        self->array = nn_alloc (sizeof (struct nn_list) * self->slots,
-            "hash map");
-        alloc_assert (self->array);
-        for (i = 0; i != self->slots; ++i)
-            nn_list_init (&self->array [i]);
-
-        /*  Move the items from old slot array to new slot array. */
-        for (i = 0; i != oldslots; ++i) {
-            while (!nn_list_empty (&oldarray [i])) {
-                hitm = nn_cont (nn_list_begin (&oldarray [i]),
-                     struct nn_hash_item, list);
-                nn_list_erase (&oldarray [i], &hitm->list);
-                newslot = nn_hash_key (hitm->key) % self->slots;
-                nn_list_insert (&self->array [newslot], &hitm->list,
-                    nn_list_end (&self->array [newslot]));
-            }
-
-            nn_list_term (&oldarray [i]);
-        }
+    i = nn_hash_array_find (&self->current, key);
+    self->current.array [i].key = key;
+    self->current.array [i].item = item;
+    ++self->current.items;
 
-        /*  Deallocate the old array of slots. */
-        nn_free (oldarray);
-    }
+    if (nn_slow (self->old.array != NULL))
+        nn_hash_migrate (self, NN_HASH_MIGRATE_STEPS);
 }
 
 void nn_hash_erase (struct nn_hash *self, struct nn_hash_item *item)
 {
-    uint32_t slot;
+    uint32_t i;
 
-    slot = nn_hash_key (item->key) % self->slots;
-    nn_list_erase (&self->array [slot], &item->list);
+    i = nn_hash_array_find (&self->current, item->key);
+    if (nn_fast (self->current.array [i].item == item))
+        nn_hash_array_remove (&self->current, i);
+    else {
+        nn_assert (self->old.array);
+        i = nn_hash_array_find (&self->old, item->key);
+        nn_assert (self->old.array [i].item == item);
+        nn_hash_array_remove (&self->old, i);
+    }
+
+    if (nn_slow (self->old.array != NULL))
+        nn_hash_migrate (self, NN_HASH_MIGRATE_STEPS);
 }
 
 struct nn_hash_item *nn_hash_get (struct nn_hash *self, uint32_t key)
 {
-    uint32_t slot;
-    struct nn_list_item *it;
     struct nn_hash_item *item;
 
-    slot = nn_hash_key (key) % self->slots;
+    item = self->current.array [nn_hash_array_find (&self->current,
+        key)].item;
+    if (nn_fast (item || !self->old.array))
+        return item;
+    return self->old.array [nn_hash_array_find (&self->old, key)].item;
+}
 
-    for (it = nn_list_begin (&self->array [slot]);
-          it != nn_list_end (&self->array [slot]);
-          it = nn_list_next (&self->array [slot], it)) {
-        item = nn_cont (it, struct nn_hash_item, list);
-        if (item->key == key)
-            return item;
-    }
+void nn_hash_item_init (struct nn_hash_item *self)
+{
+    self->key = 0xffff;
+}
 
-    return NULL;
+void nn_hash_item_term (struct nn_hash_item *self)
+{
 }
 
-uint32_t nn_hash_key (uint32_t key)
+static uint32_t nn_hash_key (uint32_t key)
 {
     /*  TODO: This is a randomly chosen hashing function. Give some thought
         to picking a more fitting one. */
@@ -147,13 +133,103 @@ uint32_t nn_hash_key (uint32_t key)
     return key;
 }
 
-void nn_hash_item_init (struct nn_hash_item *self)
+static void nn_hash_array_init (struct nn_hash_array *self, uint32_t slots)
 {
-    nn_list_item_init (&self->list);
+    self->slots = slots;
+    self->items = 0;
+    self->array = nn_alloc (sizeof (struct nn_hash_slot) * slots, "hash map");
+    alloc_assert (self->array);
+    memset (self->array, 0, sizeof (struct nn_hash_slot) * slots);
 }
 
-void nn_hash_item_term (struct nn_hash_item *self)
+static uint32_t nn_hash_array_find (struct nn_hash_array *self, uint32_t key)
+{
+    /*  Returns the slot holding the key or, if the key is not in the array,
+        the empty slot where it should be inserted. */
+
+    uint32_t mask;
+    uint32_t i;
+
+    mask = self->slots - 1;
+    i = nn_hash_key (key) & mask;
+    while (self->array [i].item && self->array [i].key != key)
+        i = (i + 1) & mask;
+    return i;
+}
+
+static void nn_hash_array_remove (struct nn_hash_array *self, uint32_t i)
+{
+    uint32_t mask;
+    uint32_t j;
+    uint32_t k;
+
+    self->array [i].item = NULL;
+    --self->items;
+
+    /*  Move the following items of the probe sequence back to fill the gap.
+        An item can be moved to the gap only if its home slot is not
+        cyclically between the gap and the item itself. */
+    mask = self->slots - 1;
+    j = i;
+    while (1) {
+        j = (j + 1) & mask;
+        if (!self->array [j].item)
+            break;
+        k = nn_hash_key (self->array [j].key) & mask;
+        if (i <= j ? (i < k && k <= j) : (i < k || k <= j))
+            continue;
+        self->array [i] = self->array [j];
+        self->array [j].item = NULL;
+        i = j;
+    }
+}
+
+static void nn_hash_grow (struct nn_hash *self)
 {
-    nn_list_item_term (&self->list);
+    /*  If the previous growth is still in progress, finish it first. */
+    if (nn_slow (self->old.array != NULL))
+        nn_hash_migrate (self, 0xffffffff);
+
+    self->old = self->current;
+    nn_hash_array_init (&self->current, self->old.slots * 2);
+
+    /*  Start moving the items just after an empty slot. No item is inserted
+        into the old array any more, so the slot stays empty and no probe
+        sequence can span over it. Thus, when an item is moved out, the items
+        following it can always be shifted back into the already processed
+        part of the array. The array is at most half full so there is an
+        empty slot. */
+    self->pos = 0;
+    while (self->old.array [self->pos].item)
+        ++self->pos;
+    self->pos = (self->pos + 1) & (self->old.slots - 1);
 }
 
+static void nn_hash_migrate (struct nn_hash *self, uint32_t steps)
+{
+    struct nn_hash_slot *slot;
+    uint32_t i;
+
+    while (steps-- && self->old.items) {
+        slot = &self->old.array [self->pos];
+
+        /*  Skip an empty slot. */
+        if (!slot->item) {
+            self->pos = (self->pos + 1) & (self->old.slots - 1);
+            continue;
+        }
+
+        /*  Move the item to the new array. Removing it from the old array
+            may shift another item into the same slot so don't advance. */
+        i = nn_hash_array_find (&self->current, slot->key);
+        self->current.array [i] = *slot;
+        ++self->current.items;
+        nn_hash_array_remove (&self->old, self->pos);
+    }
+
+    if (!self->old.items) {
+        nn_free (self->old.array);
+        self->old.slots = 0;
+        self->old.array = NULL;
+    }
+}
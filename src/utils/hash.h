@@ -26,20 +26,46 @@
 #include <stdint.h>
 #include <stddef.h>
 
-#include "list.h"
+/*  Open-addressing hash table with linear probing. The keys are stored in
+    the slots along with the pointers to the items so that a lookup doesn't
+    have to touch the items it passes by. When the table grows, the items
+    are moved to the new array of slots gradually, a few of them on each
+    insertion and removal, rather than all at once. */
 
 /*  Use for initialising a hash item statically. */
-#define NN_HASH_ITEM_INITIALIZER {0xffff, NN_LIST_ITEM_INITILIZER}
+#define NN_HASH_ITEM_INITIALIZER {0xffff}
 
 struct nn_hash_item {
     uint32_t key;
-    struct nn_list_item list;
 };
 
-struct nn_hash {
+struct nn_hash_slot {
+    uint32_t key;
+    struct nn_hash_item *item;
+};
+
+struct nn_hash_array {
+
+    /*  Number of slots. It's either zero or a power of two. */
     uint32_t slots;
+
+    /*  Number of items stored in the slots. */
     uint32_t items;
-    struct nn_list *array;
+
+    /*  Unused slots have NULL item. */
+    struct nn_hash_slot *array;
+};
+
+struct nn_hash {
+
+    /*  The array new items are inserted into. */
+    struct nn_hash_array current;
+
+    /*  While growing, the array the items are being moved from. Items are
+        moved in slot order starting with 'pos'. All the slots preceding
+        'pos' are already empty. */
+    struct nn_hash_array old;
+    uint32_t pos;
 };
 
 /*  Initialise the hash table. */
@@ -68,3 +94,4 @@ void nn_hash_item_init (struct nn_hash_item *self);
 void nn_hash_item_term (struct nn_hash_item *self);
 
 #endif
+
@@ -0,0 +1,148 @@
+/*
+    Copyright (c) 2012-2013 250bpm s.r.o.
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"),
+    to deal in the Software without restriction, including without limitation
+    the rights to use, copy, modify, merge, publish, distribute, sublicense,
+    and/or sell copies of the Software, and to permit persons to whom
+    the Software is furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included
+    in all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+    THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+    FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+    IN THE SOFTWARE.
+*/
+
+
+#include "hist.h"
+#include "alloc.h"
+#include "fast.h"
+#include "err.h"
+
+#include "../nn.h"
+
+#include <string.h>
+
+/*  Values below NN_HIST_SUB are counted exactly. Each following power-of-two
+    range is split into NN_HIST_SUB buckets of equal width. Values too large
+    for the last range are counted in its last bucket. */
+#define NN_HIST_SUB 16
+#define NN_HIST_RANGES 32
+#define NN_HIST_BUCKETS ((NN_HIST_RANGES + 1) * NN_HIST_SUB)
+
+/*  Private functions. */
+static int nn_hist_index (uint64_t value);
+static uint64_t nn_hist_value (int index);
+
+void nn_hist_init (struct nn_hist *self)
+{
+    self->count = 0;
+    self->sum = 0;
+    self->min = 0;
+    self->max = 0;
+    self->buckets = NULL;
+}
+
+void nn_hist_term (struct nn_hist *self)
+{
+    if (self->buckets)
+        nn_free (self->buckets);
+}
+
+void nn_hist_reset (struct nn_hist *self)
+{
+    nn_hist_term (self);
+    nn_hist_init (self);
+}
+
+void nn_hist_record (struct nn_hist *self, uint64_t value)
+{
+    if (nn_slow (!self->buckets)) {
+        self->buckets = nn_alloc (NN_HIST_BUCKETS * sizeof (uint64_t),
+            "histogram");
+        alloc_assert (self->buckets);
+        memset (self->buckets, 0, NN_HIST_BUCKETS * sizeof (uint64_t));
+    }
+
+    ++self->buckets [nn_hist_index (value)];
+    if (!self->count || value < self->min)
+        self->min = value;
+    if (value > self->max)
+        self->max = value;
+    ++self->count;
+    self->sum += value;
+}
+
+uint64_t nn_hist_quantile (struct nn_hist *self, int permille)
+{
+    uint64_t rank;
+    uint64_t seen;
+    int i;
+
+    if (!self->count)
+        return 0;
+
+    /*  Find the bucket the value of the requested rank falls into. The upper
+        bound of the bucket is reported, but never more than the largest value
+        actually recorded. */
+    rank = (self->count * permille + 999) / 1000;
+    if (!rank)
+        rank = 1;
+    seen = 0;
+    for (i = 0; i != NN_HIST_BUCKETS; ++i) {
+        seen += self->buckets [i];
+        if (seen >= rank)
+            break;
+    }
+    nn_assert (i != NN_HIST_BUCKETS);
+    return nn_hist_value (i) < self->max ? nn_hist_value (i) : self->max;
+}
+
+void nn_hist_stats (struct nn_hist *self, struct nn_latency_stats *stats)
+{
+    stats->count = self->count;
+    stats->min = self->min;
+    stats->mean = self->count ? self->sum / self->count : 0;
+    stats->max = self->max;
+    stats->p50 = nn_hist_quantile (self, 500);
+    stats->p90 = nn_hist_quantile (self, 900);
+    stats->p99 = nn_hist_quantile (self, 990);
+    stats->p999 = nn_hist_quantile (self, 999);
+}
+
+static int nn_hist_index (uint64_t value)
+{
+    int shift;
+
+    if (value < NN_HIST_SUB)
+        return (int) value;
+
+    /*  Find the power-of-two range the value falls into and its bucket
+        within the range. */
+    shift = 0;
+    while (shift != NN_HIST_RANGES - 1 &&
+          (value >> shift) >= 2 * NN_HIST_SUB)
+        ++shift;
+    if (nn_slow ((value >> shift) >= 2 * NN_HIST_SUB))
+        return NN_HIST_BUCKETS - 1;
+    return (shift + 1) * NN_HIST_SUB + (int) ((value >> shift) - NN_HIST_SUB);
+}
+
+static uint64_t nn_hist_value (int index)
+{
+    int shift;
+
+    if (index < NN_HIST_SUB)
+        return index;
+
+    /*  The largest value counted in the bucket. */
+    shift = index / NN_HIST_SUB - 1;
+    return (((uint64_t) (index % NN_HIST_SUB + NN_HIST_SUB + 1)) << shift) - 1;
+}
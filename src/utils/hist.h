@@ -0,0 +1,65 @@
+/*
+    Copyright (c) 2012-2013 250bpm s.r.o.
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"),
+    to deal in the Software without restriction, including without limitation
+    the rights to use, copy, modify, merge, publish, distribute, sublicense,
+    and/or sell copies of the Software, and to permit persons to whom
+    the Software is furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included
+    in all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+    THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+    FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+    IN THE SOFTWARE.
+*/
+
+
+#ifndef NN_HIST_INCLUDED
+#define NN_HIST_INCLUDED
+
+#include <stdint.h>
+
+/*  Histogram of latencies in the spirit of HdrHistogram. Small values are
+    counted exactly, larger ones in buckets whose width grows with the value
+    so that the relative error stays below 1/16. Memory for the buckets is
+    allocated when the first value is recorded. The object is not
+    thread-safe. */
+
+struct nn_latency_stats;
+
+struct nn_hist {
+    uint64_t count;
+    uint64_t sum;
+    uint64_t min;
+    uint64_t max;
+    uint64_t *buckets;
+};
+
+/*  Initialise an empty histogram. */
+void nn_hist_init (struct nn_hist *self);
+
+/*  Terminate the histogram. */
+void nn_hist_term (struct nn_hist *self);
+
+/*  Drop all the recorded values. */
+void nn_hist_reset (struct nn_hist *self);
+
+/*  Record one value. */
+void nn_hist_record (struct nn_hist *self, uint64_t value);
+
+/*  Returns the value below which the specified part of the recorded values
+    lies, in thousandths, e.g. 990 for the 99th percentile. Returns zero if no
+    values were recorded. */
+uint64_t nn_hist_quantile (struct nn_hist *self, int permille);
+
+/*  Fill in the statistics returned by the latency socket options. */
+void nn_hist_stats (struct nn_hist *self, struct nn_latency_stats *stats);
+
+#endif
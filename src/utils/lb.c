@@ -23,12 +23,22 @@
 #include "lb.h"
 #include "err.h"
 #include "cont.h"
+#include "random.h"
 
 #include <stddef.h>
+#include <limits.h>
+
+/*  Private functions. */
+static struct nn_lb_data *nn_lb_leastbusy (struct nn_lb *self);
+static struct nn_lb_data *nn_lb_affinity (struct nn_lb *self,
+    struct nn_msg *msg);
+static uint32_t nn_lb_mix (uint32_t h);
 
 void nn_lb_init (struct nn_lb *self)
 {
     nn_priolist_init (&self->priolist);
+    self->leastbusy = 0;
+    self->affinity = 0;
 }
 
 void nn_lb_term (struct nn_lb *self)
@@ -37,9 +47,13 @@ void nn_lb_term (struct nn_lb *self)
 }
 
 void nn_lb_add (struct nn_lb *self, struct nn_pipe *pipe,
-    struct nn_lb_data *data, int priority)
+    struct nn_lb_data *data, int priority, int weight)
 {
-    nn_priolist_add (&self->priolist, pipe, &data->priolist, priority);
+    nn_priolist_add (&self->priolist, pipe, &data->priolist, priority, weight);
+    data->outstanding = 0;
+    data->credit = -1;
+    data->writable = 0;
+    nn_random_generate (&data->id, sizeof (data->id));
 }
 
 void nn_lb_rm (struct nn_lb *self, struct nn_pipe *pipe,
@@ -51,7 +65,9 @@ void nn_lb_rm (struct nn_lb *self, struct nn_pipe *pipe,
 void nn_lb_out (struct nn_lb *self, struct nn_pipe *pipe,
     struct nn_lb_data *data)
 {
-    nn_priolist_activate (&self->priolist, pipe, &data->priolist);
+    data->writable = 1;
+    if (data->credit)
+        nn_priolist_activate (&self->priolist, pipe, &data->priolist);
 }
 
 int nn_lb_can_send (struct nn_lb *self)
@@ -63,19 +79,161 @@ int nn_lb_send (struct nn_lb *self, struct nn_msg *msg)
 {
     int rc;
     struct nn_pipe *pipe;
+    struct nn_lb_data *data;
 
     /*  Pipe is NULL only when there are no avialable pipes. */
     pipe = nn_priolist_getpipe (&self->priolist);
     if (nn_slow (!pipe))
         return -EAGAIN;
+    data = nn_cont (nn_priolist_getdata (&self->priolist),
+        struct nn_lb_data, priolist);
+
+    /*  In the affinity and least busy modes, the current pipe may be not
+        the right one. */
+    if (self->affinity) {
+        data = nn_lb_affinity (self, msg);
+        pipe = data->priolist.pipe;
+    }
+    else if (self->leastbusy) {
+        data = nn_lb_leastbusy (self);
+        pipe = data->priolist.pipe;
+        ++data->outstanding;
+    }
 
     /*  Send the messsage. */
     rc = nn_pipe_send (pipe, msg);
     errnum_assert (rc >= 0, -rc);
 
-    /*  Move to the next pipe. */
-    nn_priolist_advance (&self->priolist, rc & NN_PIPE_RELEASE);
+    /*  Move to the next pipe. The pipe is put aside when it's full or when it
+        has run out of credit. */
+    if (rc & NN_PIPE_RELEASE)
+        data->writable = 0;
+    if (data->credit > 0)
+        --data->credit;
+    nn_priolist_advance (&self->priolist, !data->writable || !data->credit);
 
     return rc & ~NN_PIPE_RELEASE;
 }
 
+void nn_lb_setleastbusy (struct nn_lb *self, int leastbusy)
+{
+    self->leastbusy = leastbusy;
+}
+
+void nn_lb_setaffinity (struct nn_lb *self, int keylen)
+{
+    self->affinity = keylen;
+}
+
+void nn_lb_done (struct nn_lb *self, struct nn_lb_data *data)
+{
+    /*  The message may have been sent before the least busy mode was
+        switched on. */
+    if (data->outstanding)
+        --data->outstanding;
+}
+
+void nn_lb_credit (struct nn_lb *self, struct nn_lb_data *data, int credit)
+{
+    int active;
+
+    /*  The pipe becomes available if it's writable and it had no credit
+        left so far. */
+    active = data->writable && data->credit;
+    if (credit < 0)
+        data->credit = -1;
+    else if (data->credit < 0)
+        data->credit = credit;
+    else
+        data->credit = credit > INT_MAX - data->credit ?
+            INT_MAX : data->credit + credit;
+    if (!active && data->writable && data->credit)
+        nn_priolist_activate (&self->priolist, data->priolist.pipe,
+            &data->priolist);
+}
+
+static struct nn_lb_data *nn_lb_leastbusy (struct nn_lb *self)
+{
+    struct nn_priolist_slot *slot;
+    int i;
+    struct nn_lb_data *data;
+    struct nn_lb_data *best;
+
+    /*  Only the pipes with the current priority are taken into account.
+        Scanning starts with the current pipe, so that equally busy pipes are
+        still round-robined. */
+    slot = &self->priolist.slots [self->priolist.current - 1];
+    best = nn_cont (slot->pipes [slot->current], struct nn_lb_data, priolist);
+    i = slot->current;
+    while (best->outstanding) {
+        if (++i == slot->count)
+            i = 0;
+        if (i == slot->current)
+            break;
+        data = nn_cont (slot->pipes [i], struct nn_lb_data, priolist);
+        if (data->outstanding < best->outstanding)
+            best = data;
+    }
+
+    nn_priolist_select (&self->priolist, &best->priolist);
+    return best;
+}
+
+static struct nn_lb_data *nn_lb_affinity (struct nn_lb *self,
+    struct nn_msg *msg)
+{
+    struct nn_priolist_slot *slot;
+    int i;
+    struct nn_lb_data *data;
+    struct nn_lb_data *best;
+    const uint8_t *key;
+    size_t keylen;
+    size_t pos;
+    uint32_t hash;
+    uint32_t score;
+    uint32_t bestscore;
+
+    /*  Hash the key (FNV-1a). Messages shorter than the key size are keyed
+        by the whole body. The key may span several fragments. */
+    if (nn_slow (msg->frags &&
+          nn_chunkref_size (&msg->body) < (size_t) self->affinity))
+        nn_msg_flatten (msg);
+    key = nn_chunkref_data (&msg->body);
+    keylen = nn_chunkref_size (&msg->body);
+    if (keylen > (size_t) self->affinity)
+        keylen = self->affinity;
+    hash = 2166136261u;
+    for (pos = 0; pos != keylen; ++pos)
+        hash = (hash ^ key [pos]) * 16777619u;
+
+    /*  Only the available pipes with the current priority take part. Should
+        the pipe of a key be full, the key goes to its second best pipe till
+        the first one is available again. */
+    slot = &self->priolist.slots [self->priolist.current - 1];
+    best = NULL;
+    bestscore = 0;
+    for (i = 0; i != slot->count; ++i) {
+        data = nn_cont (slot->pipes [i], struct nn_lb_data, priolist);
+        score = nn_lb_mix (hash ^ data->id);
+        if (!best || score > bestscore ||
+              (score == bestscore && data->id > best->id)) {
+            best = data;
+            bestscore = score;
+        }
+    }
+
+    nn_priolist_select (&self->priolist, &best->priolist);
+    return best;
+}
+
+static uint32_t nn_lb_mix (uint32_t h)
+{
+    /*  Finalizer of MurmurHash3. Spreads the bits of the input evenly so that
+        the scores of different pipes for the same key are independent. */
+    h ^= h >> 16;
+    h *= 0x85ebca6b;
+    h ^= h >> 13;
+    h *= 0xc2b2ae35;
+    h ^= h >> 16;
+    return h;
+}
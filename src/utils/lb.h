@@ -27,25 +27,68 @@
 
 #include "priolist.h"
 
-/*  A load balancer. Round-robins messages to a set of pipes. */
+/*  A load balancer. Round-robins messages to a set of pipes. Optionally,
+    each message can be sent to the pipe with the fewest messages outstanding
+    instead. A message is outstanding from the moment it's sent until the user
+    marks it as done, e.g. when a reply to a request arrives.
+
+    In the affinity mode, the pipe is chosen by the key at the beginning of
+    the message instead, so that messages with the same key go to the same
+    pipe. The pipe for a key is found by rendezvous hashing: the pipe with
+    the highest score for the key wins. That way, when a pipe is added or
+    removed, only the keys that go to that pipe move.
+
+    A pipe can also be limited to the number of messages the peer is ready to
+    accept. Once the user grants the pipe some credit, a message is sent to it
+    only while it has credit left, even if it's writable. */
 
 struct nn_lb_data {
     struct nn_priolist_data priolist;
+
+    /*  Number of messages sent to the pipe not yet marked as done. */
+    uint32_t outstanding;
+
+    /*  Number of messages that can be sent to the pipe, or -1 if the pipe
+        is not limited. */
+    int credit;
+
+    /*  Set if the pipe is ready for sending, irrespective of its credit. */
+    int writable;
+
+    /*  Random identifier of the pipe used to compute its score for a key. */
+    uint32_t id;
 };
 
 struct nn_lb {
     struct nn_priolist priolist;
+
+    /*  If set, messages are sent to the least busy pipe of the highest
+        priority available rather than round-robined. */
+    int leastbusy;
+
+    /*  Size of the key in the affinity mode, zero if the mode is off. */
+    int affinity;
 };
 
 void nn_lb_init (struct nn_lb *self);
 void nn_lb_term (struct nn_lb *self);
 void nn_lb_add (struct nn_lb *self, struct nn_pipe *pipe,
-    struct nn_lb_data *data, int priority);
+    struct nn_lb_data *data, int priority, int weight);
 void nn_lb_rm (struct nn_lb *self, struct nn_pipe *pipe,
     struct nn_lb_data *data);
 void nn_lb_out (struct nn_lb *self, struct nn_pipe *pipe,
     struct nn_lb_data *data);
 int nn_lb_can_send (struct nn_lb *self);
 int nn_lb_send (struct nn_lb *self, struct nn_msg *msg);
+void nn_lb_setleastbusy (struct nn_lb *self, int leastbusy);
+void nn_lb_done (struct nn_lb *self, struct nn_lb_data *data);
+
+/*  Switches the affinity mode on, with the first 'keylen' bytes of each
+    message being the key. Zero switches it off. */
+void nn_lb_setaffinity (struct nn_lb *self, int keylen);
+
+/*  Allows to send 'credit' more messages to the pipe. Negative value removes
+    the limit altogether. */
+void nn_lb_credit (struct nn_lb *self, struct nn_lb_data *data, int credit);
 
 #endif
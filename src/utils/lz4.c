@@ -0,0 +1,231 @@
+/*
+    Copyright (c) 2013 250bpm s.r.o.
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"),
+    to deal in the Software without restriction, including without limitation
+    the rights to use, copy, modify, merge, publish, distribute, sublicense,
+    and/or sell copies of the Software, and to permit persons to whom
+    the Software is furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included
+    in all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+    THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+    FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+    IN THE SOFTWARE.
+*/
+
+#include "lz4.h"
+#include "err.h"
+#include "fast.h"
+
+#include <string.h>
+#include <stdint.h>
+
+/*  Parameters of the format. Matches are at least NN_LZ4_MINMATCH bytes long
+    and at most 64kB back. The last match starts at least NN_LZ4_MFLIMIT
+    bytes before the end of the block and the last NN_LZ4_LASTLITERALS bytes
+    are always literals. */
+#define NN_LZ4_MINMATCH 4
+#define NN_LZ4_MFLIMIT 12
+#define NN_LZ4_LASTLITERALS 5
+#define NN_LZ4_MAXOFFSET 65535
+
+/*  Size of the table of recently seen 4-byte sequences. */
+#define NN_LZ4_HASHLOG 12
+
+/*  Private functions. */
+static uint32_t nn_lz4_read32 (const uint8_t *p);
+static uint32_t nn_lz4_hash (uint32_t seq);
+static uint8_t *nn_lz4_putlen (uint8_t *op, size_t len);
+
+size_t nn_lz4_compress (const void *src, size_t srclen, void *dst,
+    size_t dstlen)
+{
+    uint32_t table [1 << NN_LZ4_HASHLOG];
+    const uint8_t *in;
+    const uint8_t *ip;
+    const uint8_t *anchor;
+    const uint8_t *end;
+    const uint8_t *ref;
+    uint8_t *op;
+    uint8_t *oend;
+    uint8_t *token;
+    size_t litlen;
+    size_t matchlen;
+    uint32_t seq;
+    uint32_t h;
+
+    in = (const uint8_t*) src;
+    ip = in;
+    anchor = in;
+    end = in + srclen;
+    op = (uint8_t*) dst;
+    oend = op + dstlen;
+
+    /*  Look for matches. Unused table entries point to the beginning of
+        the block, which is never a valid match for the current position
+        before it is checked. */
+    if (srclen > NN_LZ4_MFLIMIT) {
+        memset (table, 0, sizeof (table));
+        while (ip < end - NN_LZ4_MFLIMIT) {
+            seq = nn_lz4_read32 (ip);
+            h = nn_lz4_hash (seq);
+            ref = in + table [h];
+            table [h] = (uint32_t) (ip - in);
+            if (ref >= ip || ip - ref > NN_LZ4_MAXOFFSET ||
+                  nn_lz4_read32 (ref) != seq) {
+
+                /*  Skip faster over the data that don't compress. */
+                ip += 1 + ((ip - anchor) >> 6);
+                continue;
+            }
+
+            /*  Extend the match. */
+            matchlen = NN_LZ4_MINMATCH;
+            while (ip + matchlen < end - NN_LZ4_LASTLITERALS &&
+                  ip [matchlen] == ref [matchlen])
+                ++matchlen;
+
+            /*  Emit the sequence: token, literals and the match. */
+            litlen = ip - anchor;
+            if (nn_slow ((size_t) (oend - op) < 1 + litlen / 255 + 1 +
+                  litlen + 2 + (matchlen - NN_LZ4_MINMATCH) / 255 + 1))
+                return 0;
+            token = op++;
+            *token = (uint8_t) ((litlen < 15 ? litlen : 15) << 4);
+            if (litlen >= 15)
+                op = nn_lz4_putlen (op, litlen - 15);
+            memcpy (op, anchor, litlen);
+            op += litlen;
+            *op++ = (uint8_t) (ip - ref);
+            *op++ = (uint8_t) ((ip - ref) >> 8);
+            matchlen -= NN_LZ4_MINMATCH;
+            *token |= (uint8_t) (matchlen < 15 ? matchlen : 15);
+            if (matchlen >= 15)
+                op = nn_lz4_putlen (op, matchlen - 15);
+            ip += matchlen + NN_LZ4_MINMATCH;
+            anchor = ip;
+        }
+    }
+
+    /*  The rest of the block is stored as literals. */
+    litlen = end - anchor;
+    if (nn_slow ((size_t) (oend - op) < 1 + litlen / 255 + 1 + litlen))
+        return 0;
+    *op++ = (uint8_t) ((litlen < 15 ? litlen : 15) << 4);
+    if (litlen >= 15)
+        op = nn_lz4_putlen (op, litlen - 15);
+    memcpy (op, anchor, litlen);
+    op += litlen;
+
+    return op - (uint8_t*) dst;
+}
+
+int nn_lz4_decompress (const void *src, size_t srclen, void *dst,
+    size_t dstlen)
+{
+    const uint8_t *ip;
+    const uint8_t *iend;
+    uint8_t *out;
+    uint8_t *op;
+    uint8_t *oend;
+    const uint8_t *ref;
+    size_t len;
+    size_t offset;
+    uint8_t token;
+    uint8_t b;
+
+    ip = (const uint8_t*) src;
+    iend = ip + srclen;
+    out = (uint8_t*) dst;
+    op = out;
+    oend = op + dstlen;
+
+    while (1) {
+
+        /*  Literals. */
+        if (nn_slow (ip == iend))
+            return -EPROTO;
+        token = *ip++;
+        len = token >> 4;
+        if (len == 15) {
+            do {
+                if (nn_slow (ip == iend))
+                    return -EPROTO;
+                b = *ip++;
+                len += b;
+            } while (b == 255);
+        }
+        if (nn_slow (len > (size_t) (iend - ip) ||
+              len > (size_t) (oend - op)))
+            return -EPROTO;
+        memcpy (op, ip, len);
+        ip += len;
+        op += len;
+
+        /*  The last sequence has no match. */
+        if (ip == iend)
+            break;
+
+        /*  The match. It may overlap with the data being produced. */
+        if (nn_slow (iend - ip < 2))
+            return -EPROTO;
+        offset = ip [0] | (ip [1] << 8);
+        ip += 2;
+        if (nn_slow (offset == 0 || offset > (size_t) (op - out)))
+            return -EPROTO;
+        len = token & 15;
+        if (len == 15) {
+            do {
+                if (nn_slow (ip == iend))
+                    return -EPROTO;
+                b = *ip++;
+                len += b;
+            } while (b == 255);
+        }
+        len += NN_LZ4_MINMATCH;
+        if (nn_slow (len > (size_t) (oend - op)))
+            return -EPROTO;
+        ref = op - offset;
+        if (offset >= len) {
+            memcpy (op, ref, len);
+            op += len;
+        }
+        else {
+            while (len--)
+                *op++ = *ref++;
+        }
+    }
+
+    return op == oend ? 0 : -EPROTO;
+}
+
+static uint32_t nn_lz4_read32 (const uint8_t *p)
+{
+    uint32_t val;
+
+    memcpy (&val, p, sizeof (val));
+    return val;
+}
+
+static uint32_t nn_lz4_hash (uint32_t seq)
+{
+    return (seq * 2654435761U) >> (32 - NN_LZ4_HASHLOG);
+}
+
+static uint8_t *nn_lz4_putlen (uint8_t *op, size_t len)
+{
+    while (len >= 255) {
+        *op++ = 255;
+        len -= 255;
+    }
+    *op++ = (uint8_t) len;
+    return op;
+}
+
@@ -0,0 +1,48 @@
+/*
+    Copyright (c) 2013 250bpm s.r.o.
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"),
+    to deal in the Software without restriction, including without limitation
+    the rights to use, copy, modify, merge, publish, distribute, sublicense,
+    and/or sell copies of the Software, and to permit persons to whom
+    the Software is furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included
+    in all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+    THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+    FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+    IN THE SOFTWARE.
+*/
+
+#ifndef NN_LZ4_INCLUDED
+#define NN_LZ4_INCLUDED
+
+#include <stddef.h>
+
+/*  Compression and decompression of data blocks in LZ4 block format. The
+    compressor is a simple greedy one, trading compression ratio for speed.
+    The decompressor checks the input and never reads or writes out of
+    the buffers supplied. */
+
+/*  Maximal ratio between the size of decompressed and compressed data. */
+#define NN_LZ4_MAXRATIO 255
+
+/*  Compresses 'srclen' bytes from 'src' into 'dst'. Returns the size of
+    the compressed data or 0 if it doesn't fit into 'dstlen' bytes. */
+size_t nn_lz4_compress (const void *src, size_t srclen, void *dst,
+    size_t dstlen);
+
+/*  Decompresses 'srclen' bytes from 'src' into 'dst'. Returns 0 if
+    the decompressed data are exactly 'dstlen' bytes long, -EPROTO if they
+    are not or if the input is malformed. */
+int nn_lz4_decompress (const void *src, size_t srclen, void *dst,
+    size_t dstlen);
+
+#endif
+
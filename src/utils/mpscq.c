@@ -0,0 +1,114 @@
+/*
+    Copyright (c) 2013 250bpm s.r.o.
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"),
+    to deal in the Software without restriction, including without limitation
+    the rights to use, copy, modify, merge, publish, distribute, sublicense,
+    and/or sell copies of the Software, and to permit persons to whom
+    the Software is furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included
+    in all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+    THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+    FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+    IN THE SOFTWARE.
+*/
+
+#include "mpscq.h"
+#include "err.h"
+
+#include <stddef.h>
+
+void nn_mpscq_init (struct nn_mpscq *self)
+{
+#if !defined NN_HAVE_GCC_ATOMIC_MEMORY_MODEL
+    nn_mutex_init (&self->sync);
+#endif
+    self->head = NULL;
+}
+
+void nn_mpscq_term (struct nn_mpscq *self)
+{
+#if !defined NN_HAVE_GCC_ATOMIC_MEMORY_MODEL
+    nn_mutex_term (&self->sync);
+#endif
+}
+
+int nn_mpscq_push (struct nn_mpscq *self, struct nn_queue_item *item)
+{
+    struct nn_queue_item *head;
+
+    nn_assert (item->next == NN_QUEUE_NOTINQUEUE);
+
+#if defined NN_HAVE_GCC_ATOMIC_MEMORY_MODEL
+    /*  The items are never popped individually, only the whole stack is
+        taken, so there's no ABA problem. */
+    head = __atomic_load_n (&self->head, __ATOMIC_RELAXED);
+    do {
+        item->next = head;
+    } while (!__atomic_compare_exchange_n (&self->head, &head, item, 1,
+        __ATOMIC_SEQ_CST, __ATOMIC_RELAXED));
+#else
+    nn_mutex_lock (&self->sync);
+    head = self->head;
+    item->next = head;
+    self->head = item;
+    nn_mutex_unlock (&self->sync);
+#endif
+
+    return head ? 0 : 1;
+}
+
+int nn_mpscq_empty (struct nn_mpscq *self)
+{
+#if defined NN_HAVE_GCC_ATOMIC_MEMORY_MODEL
+    return __atomic_load_n (&self->head, __ATOMIC_SEQ_CST) ? 0 : 1;
+#else
+    int empty;
+
+    nn_mutex_lock (&self->sync);
+    empty = self->head ? 0 : 1;
+    nn_mutex_unlock (&self->sync);
+    return empty;
+#endif
+}
+
+void nn_mpscq_drain (struct nn_mpscq *self, struct nn_queue *dst)
+{
+    struct nn_queue_item *it;
+    struct nn_queue_item *next;
+    struct nn_queue_item *prev;
+
+#if defined NN_HAVE_GCC_ATOMIC_MEMORY_MODEL
+    if (!__atomic_load_n (&self->head, __ATOMIC_RELAXED))
+        return;
+    it = __atomic_exchange_n (&self->head, NULL, __ATOMIC_ACQUIRE);
+#else
+    nn_mutex_lock (&self->sync);
+    it = self->head;
+    self->head = NULL;
+    nn_mutex_unlock (&self->sync);
+#endif
+
+    /*  Reverse the stack to get the items in the order they were pushed. */
+    prev = NULL;
+    while (it) {
+        next = it->next;
+        it->next = prev;
+        prev = it;
+        it = next;
+    }
+
+    for (it = prev; it; it = next) {
+        next = it->next;
+        it->next = NN_QUEUE_NOTINQUEUE;
+        nn_queue_push (dst, it);
+    }
+}
+
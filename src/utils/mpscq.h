@@ -0,0 +1,69 @@
+/*
+    Copyright (c) 2013 250bpm s.r.o.
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"),
+    to deal in the Software without restriction, including without limitation
+    the rights to use, copy, modify, merge, publish, distribute, sublicense,
+    and/or sell copies of the Software, and to permit persons to whom
+    the Software is furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included
+    in all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+    THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+    FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+    IN THE SOFTWARE.
+*/
+
+#ifndef NN_MPSCQ_INCLUDED
+#define NN_MPSCQ_INCLUDED
+
+#include "queue.h"
+
+#if !defined NN_HAVE_GCC_ATOMIC_MEMORY_MODEL
+#include "mutex.h"
+#endif
+
+/*  Intrusive multi-producer single-consumer queue. Any thread can push items
+    into it without locking. The consumer takes all the items at once and
+    moves them into an ordinary nn_queue owned by it. The items are plain
+    nn_queue_items, thus an item can be removed from the queue by draining
+    it first and removing the item from the consumer's queue. */
+
+struct nn_mpscq {
+#if !defined NN_HAVE_GCC_ATOMIC_MEMORY_MODEL
+    struct nn_mutex sync;
+#endif
+
+    /*  The items pushed so far, most recent first. */
+    struct nn_queue_item *head;
+};
+
+/*  Initialise the queue. */
+void nn_mpscq_init (struct nn_mpscq *self);
+
+/*  Terminate the queue. Note that queue must be manually emptied before the
+    termination. */
+void nn_mpscq_term (struct nn_mpscq *self);
+
+/*  Inserts one item into the queue. Returns 1 if the queue was empty, i.e.
+    if the consumer has to be notified about the new item, 0 otherwise. */
+int nn_mpscq_push (struct nn_mpscq *self, struct nn_queue_item *item);
+
+/*  Returns 1 if there are no items in the queue, 0 otherwise. Both this
+    function and nn_mpscq_push are sequentially consistent, so that a thread
+    that pushes an item and then checks a lock can't miss the thread that
+    releases the lock and then checks the queue, and vice versa. */
+int nn_mpscq_empty (struct nn_mpscq *self);
+
+/*  Moves all the items from the queue to the end of 'dst', in the order they
+    were pushed. Only one thread at a time may call this function. */
+void nn_mpscq_drain (struct nn_mpscq *self, struct nn_queue *dst);
+
+#endif
+
@@ -21,48 +21,198 @@
 */
 
 #include "msg.h"
+#include "alloc.h"
+#include "fast.h"
+#include "err.h"
 
 #include <string.h>
 
+/*  Private functions. */
+static void nn_msg_frags_term (struct nn_msg *self);
+static struct nn_msg_frags *nn_msg_frags_alloc (void);
+
 void nn_msg_init (struct nn_msg *self, size_t size)
 {
     nn_chunkref_init (&self->hdr, 0);
     nn_chunkref_init (&self->body, size);
+    self->frags = NULL;
+    self->tstamp = 0;
+    self->deadline = 0;
+    nn_chunkref_init (&self->trace, 0);
+    self->urgent = 0;
+    self->chunkoff = 0;
+    self->chunktotal = 0;
 }
 
 void nn_msg_init_chunk (struct nn_msg *self, struct nn_chunk *chunk)
 {
     nn_chunkref_init (&self->hdr, 0);
     nn_chunkref_init_chunk (&self->body, chunk);
+    self->frags = NULL;
+    self->tstamp = 0;
+    self->deadline = 0;
+    nn_chunkref_init (&self->trace, 0);
+    self->urgent = 0;
+    self->chunkoff = 0;
+    self->chunktotal = 0;
 }
 
 void nn_msg_term (struct nn_msg *self)
 {
     nn_chunkref_term (&self->hdr);
     nn_chunkref_term (&self->body);
+    nn_chunkref_term (&self->trace);
+    if (nn_slow (self->frags != NULL))
+        nn_msg_frags_term (self);
+}
+
+void nn_msg_release (struct nn_msg *self)
+{
+    int i;
+
+    nn_chunkref_release (&self->hdr);
+    nn_chunkref_release (&self->body);
+    nn_chunkref_term (&self->trace);
+    if (nn_slow (self->frags != NULL)) {
+        for (i = 0; i != self->frags->count; ++i)
+            nn_chunkref_release (&self->frags->frag [i]);
+        nn_msg_frags_term (self);
+    }
 }
 
 void nn_msg_mv (struct nn_msg *dst, struct nn_msg *src)
 {
     nn_chunkref_mv (&dst->hdr, &src->hdr);
     nn_chunkref_mv (&dst->body, &src->body);
+    dst->frags = src->frags;
+    src->frags = NULL;
+    dst->tstamp = src->tstamp;
+    dst->deadline = src->deadline;
+    nn_chunkref_mv (&dst->trace, &src->trace);
+    dst->urgent = src->urgent;
+    dst->chunkoff = src->chunkoff;
+    dst->chunktotal = src->chunktotal;
 }
 
 void nn_msg_cp (struct nn_msg *dst, struct nn_msg *src)
 {
+    int i;
+
     nn_chunkref_cp (&dst->hdr, &src->hdr);
     nn_chunkref_cp (&dst->body, &src->body);
+    dst->frags = NULL;
+    dst->tstamp = src->tstamp;
+    dst->deadline = src->deadline;
+    nn_chunkref_cp (&dst->trace, &src->trace);
+    dst->urgent = src->urgent;
+    dst->chunkoff = src->chunkoff;
+    dst->chunktotal = src->chunktotal;
+    if (nn_slow (src->frags != NULL)) {
+        dst->frags = nn_msg_frags_alloc ();
+        dst->frags->count = src->frags->count;
+        for (i = 0; i != src->frags->count; ++i)
+            nn_chunkref_cp (&dst->frags->frag [i], &src->frags->frag [i]);
+    }
 }
 
 void nn_msg_bulkcopy_start (struct nn_msg *self, uint32_t copies)
 {
+    int i;
+
     nn_chunkref_bulkcopy_start (&self->hdr, copies);
     nn_chunkref_bulkcopy_start (&self->body, copies);
+    nn_chunkref_bulkcopy_start (&self->trace, copies);
+    if (nn_slow (self->frags != NULL))
+        for (i = 0; i != self->frags->count; ++i)
+            nn_chunkref_bulkcopy_start (&self->frags->frag [i], copies);
 }
 
 void nn_msg_bulkcopy_cp (struct nn_msg *dst, struct nn_msg *src)
 {
+    int i;
+
     nn_chunkref_bulkcopy_cp (&dst->hdr, &src->hdr);
     nn_chunkref_bulkcopy_cp (&dst->body, &src->body);
+    dst->frags = NULL;
+    dst->tstamp = src->tstamp;
+    dst->deadline = src->deadline;
+    nn_chunkref_bulkcopy_cp (&dst->trace, &src->trace);
+    dst->urgent = src->urgent;
+    dst->chunkoff = src->chunkoff;
+    dst->chunktotal = src->chunktotal;
+    if (nn_slow (src->frags != NULL)) {
+        dst->frags = nn_msg_frags_alloc ();
+        dst->frags->count = src->frags->count;
+        for (i = 0; i != src->frags->count; ++i)
+            nn_chunkref_bulkcopy_cp (&dst->frags->frag [i],
+                &src->frags->frag [i]);
+    }
+}
+
+void nn_msg_addfrag (struct nn_msg *self, struct nn_chunkref *frag)
+{
+    if (!self->frags)
+        self->frags = nn_msg_frags_alloc ();
+    nn_assert (self->frags->count < NN_MSG_MAXFRAGS);
+    nn_chunkref_mv (&self->frags->frag [self->frags->count], frag);
+    ++self->frags->count;
+}
+
+size_t nn_msg_bodysize (struct nn_msg *self)
+{
+    size_t sz;
+    int i;
+
+    sz = nn_chunkref_size (&self->body);
+    if (nn_slow (self->frags != NULL))
+        for (i = 0; i != self->frags->count; ++i)
+            sz += nn_chunkref_size (&self->frags->frag [i]);
+    return sz;
+}
+
+void nn_msg_flatten (struct nn_msg *self)
+{
+    struct nn_chunkref body;
+    uint8_t *pos;
+    int i;
+
+    if (nn_fast (self->frags == NULL))
+        return;
+
+    /*  Copy all the pieces of the payload into a newly allocated body. */
+    nn_chunkref_init (&body, nn_msg_bodysize (self));
+    pos = (uint8_t*) nn_chunkref_data (&body);
+    memcpy (pos, nn_chunkref_data (&self->body),
+        nn_chunkref_size (&self->body));
+    pos += nn_chunkref_size (&self->body);
+    for (i = 0; i != self->frags->count; ++i) {
+        memcpy (pos, nn_chunkref_data (&self->frags->frag [i]),
+            nn_chunkref_size (&self->frags->frag [i]));
+        pos += nn_chunkref_size (&self->frags->frag [i]);
+    }
+
+    nn_chunkref_term (&self->body);
+    nn_chunkref_mv (&self->body, &body);
+    nn_msg_frags_term (self);
+}
+
+static void nn_msg_frags_term (struct nn_msg *self)
+{
+    int i;
+
+    for (i = 0; i != self->frags->count; ++i)
+        nn_chunkref_term (&self->frags->frag [i]);
+    nn_free (self->frags);
+    self->frags = NULL;
+}
+
+static struct nn_msg_frags *nn_msg_frags_alloc (void)
+{
+    struct nn_msg_frags *frags;
+
+    frags = nn_alloc (sizeof (struct nn_msg_frags), "message fragments");
+    alloc_assert (frags);
+    frags->count = 0;
+    return frags;
 }
 
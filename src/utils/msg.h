@@ -27,6 +27,16 @@
 
 #include <stddef.h>
 
+/*  Maximum number of additional body fragments a message can consist of. */
+#define NN_MSG_MAXFRAGS 8
+
+struct nn_msg_frags {
+
+    /*  Goes first to keep the chunkrefs aligned. */
+    struct nn_chunkref frag [NN_MSG_MAXFRAGS];
+    int count;
+};
+
 struct nn_msg {
 
     /*  Contains SP protocol message header. */
@@ -34,6 +44,33 @@ struct nn_msg {
 
     /*  Contains application level message payload. */
     struct nn_chunkref body;
+
+    /*  Additional pieces of the payload that logically follow the body.
+        This allows to send a message composed of several chunks without
+        copying them into a single buffer. NULL if there are none. */
+    struct nn_msg_frags *frags;
+
+    /*  Time the first bytes of the message were received by the kernel,
+        in nanoseconds since the epoch. Zero if not known. */
+    uint64_t tstamp;
+
+    /*  Time after which the message is of no use to the receiver, in
+        milliseconds as returned by nn_clock_now. Zero if it never expires. */
+    uint64_t deadline;
+
+    /*  Trace context of the message, NN_TRACE_SIZE bytes long, or empty if
+        the message is not traced. It's never inspected by the library, only
+        passed along with the message. */
+    struct nn_chunkref trace;
+
+    /*  1 if the message was sent with NN_URGENT flag, 0 otherwise. */
+    int urgent;
+
+    /*  If the message is a chunk of a larger message received with
+        NN_RCVCHUNKS socket option, the offset of the chunk and the size of
+        the whole message. Zero otherwise. */
+    uint64_t chunkoff;
+    uint64_t chunktotal;
 };
 
 /*  Initialises a message with body 'size' bytes long and empty header. */
@@ -45,6 +82,10 @@ void nn_msg_init_chunk (struct nn_msg *self, struct nn_chunk *chunk);
 /*  Frees resources allocate with the message. */
 void nn_msg_term (struct nn_msg *self);
 
+/*  Frees the message, but leaves the chunks passed by reference (the body,
+    the header and the fragments) to the caller. */
+void nn_msg_release (struct nn_msg *self);
+
 /*  Moves the content of the message from src to dst. dst should not be
     initialised prior to the operation. dst will be uninitialised after the
     operation. */
@@ -62,5 +103,18 @@ void nn_msg_cp (struct nn_msg *dst, struct nn_msg *src);
 void nn_msg_bulkcopy_start (struct nn_msg *self, uint32_t copies);
 void nn_msg_bulkcopy_cp (struct nn_msg *dst, struct nn_msg *src);
 
+/*  Appends a fragment to the message payload. The content of 'frag' is moved
+    to the message. 'frag' will be uninitialised after the operation. There
+    must be less than NN_MSG_MAXFRAGS fragments in the message. */
+void nn_msg_addfrag (struct nn_msg *self, struct nn_chunkref *frag);
+
+/*  Returns the size of the payload, including all the fragments. */
+size_t nn_msg_bodysize (struct nn_msg *self);
+
+/*  Merges all the fragments into the body, so that the whole payload is
+    stored in a single chunk. Code that inspects the payload should do this
+    first. If there are no fragments, the function does nothing. */
+void nn_msg_flatten (struct nn_msg *self);
+
 #endif
 
@@ -23,9 +23,17 @@
 #include "mutex.h"
 #include "err.h"
 
+#if defined NN_USE_FUTEX && !defined NN_HAVE_WINDOWS
+#include "fast.h"
+
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
 #ifdef NN_HAVE_WINDOWS
 
-void nn_mutex_init (struct nn_mutex *self)
+static void nn_mutex_setup (struct nn_mutex *self)
 {
     InitializeCriticalSection (&self->mutex);
 }
@@ -35,7 +43,7 @@ void nn_mutex_term (struct nn_mutex *self)
     DeleteCriticalSection (&self->mutex);
 }
 
-void nn_mutex_lock (struct nn_mutex *self)
+static void nn_mutex_acquire (struct nn_mutex *self)
 {
     EnterCriticalSection (&self->mutex);
 }
@@ -45,9 +53,111 @@ void nn_mutex_unlock (struct nn_mutex *self)
     LeaveCriticalSection (&self->mutex);
 }
 
+static int nn_mutex_tryacquire (struct nn_mutex *self)
+{
+    return TryEnterCriticalSection (&self->mutex) ? 1 : 0;
+}
+
+#elif defined NN_USE_FUTEX
+
+/*  Upper limit on the number of spins before the thread goes to sleep.
+    With a short critical section, such as that of a socket, the owner is
+    likely to release the mutex in the meantime, saving two system calls
+    and a context switch. */
+#define NN_MUTEX_MAX_SPINS 200
+
+#if defined __i386__ || defined __x86_64__
+#define nn_mutex_relax() __builtin_ia32_pause ()
+#else
+#define nn_mutex_relax() __atomic_signal_fence (__ATOMIC_SEQ_CST)
+#endif
+
+/*  Spinning is pointless if there's no other CPU for the owner of the mutex
+    to run on. 0 means not yet known. */
+static int nn_mutex_ncpus;
+
+static void nn_mutex_setup (struct nn_mutex *self)
+{
+    if (nn_slow (!nn_mutex_ncpus))
+        nn_mutex_ncpus = (int) sysconf (_SC_NPROCESSORS_ONLN);
+    self->state = 0;
+    self->spins = 0;
+}
+
+void nn_mutex_term (struct nn_mutex *self)
+{
+    nn_assert (self->state == 0);
+}
+
+/*  Moves the average number of spins towards 'n'. */
+static void nn_mutex_adapt (struct nn_mutex *self, uint32_t spins, uint32_t n)
+{
+    __atomic_store_n (&self->spins, (uint32_t) ((int32_t) spins +
+        ((int32_t) n - (int32_t) spins) / 8), __ATOMIC_RELAXED);
+}
+
+static int nn_mutex_cas (struct nn_mutex *self, uint32_t oldval,
+    uint32_t newval)
+{
+    return __atomic_compare_exchange_n (&self->state, &oldval, newval, 0,
+        __ATOMIC_ACQUIRE, __ATOMIC_RELAXED);
+}
+
+static void nn_mutex_acquire (struct nn_mutex *self)
+{
+    uint32_t i;
+    uint32_t maxspins;
+    uint32_t spins;
+    uint32_t state;
+
+    if (nn_fast (nn_mutex_cas (self, 0, 1)))
+        return;
+
+    /*  Spin for up to twice the number of spins it usually takes to get
+        the mutex. The statistics are updated without synchronisation, as
+        they are only a hint. */
+    spins = __atomic_load_n (&self->spins, __ATOMIC_RELAXED);
+    maxspins = spins * 2 + 10;
+    if (maxspins > NN_MUTEX_MAX_SPINS)
+        maxspins = NN_MUTEX_MAX_SPINS;
+    if (nn_mutex_ncpus <= 1)
+        maxspins = 0;
+    for (i = 0; i != maxspins; ++i) {
+        nn_mutex_relax ();
+        if (__atomic_load_n (&self->state, __ATOMIC_RELAXED) == 0 &&
+              nn_mutex_cas (self, 0, 1)) {
+            nn_mutex_adapt (self, spins, i);
+            return;
+        }
+    }
+    nn_mutex_adapt (self, spins, maxspins);
+
+    /*  Mark the mutex as contended and go to sleep until it's unlocked. */
+    state = __atomic_exchange_n (&self->state, 2, __ATOMIC_ACQUIRE);
+    while (state != 0) {
+        syscall (SYS_futex, &self->state, FUTEX_WAIT_PRIVATE, 2,
+            NULL, NULL, 0);
+        state = __atomic_exchange_n (&self->state, 2, __ATOMIC_ACQUIRE);
+    }
+}
+
+void nn_mutex_unlock (struct nn_mutex *self)
+{
+    /*  If there may be sleeping threads, wake one of them up. */
+    if (nn_slow (__atomic_exchange_n (&self->state, 0, __ATOMIC_RELEASE) ==
+          2))
+        syscall (SYS_futex, &self->state, FUTEX_WAKE_PRIVATE, 1,
+            NULL, NULL, 0);
+}
+
+static int nn_mutex_tryacquire (struct nn_mutex *self)
+{
+    return nn_mutex_cas (self, 0, 1) ? 1 : 0;
+}
+
 #else
 
-void nn_mutex_init (struct nn_mutex *self)
+static void nn_mutex_setup (struct nn_mutex *self)
 {
     int rc;
 
@@ -63,7 +173,7 @@ void nn_mutex_term (struct nn_mutex *self)
     errnum_assert (rc == 0, rc);
 }
 
-void nn_mutex_lock (struct nn_mutex *self)
+static void nn_mutex_acquire (struct nn_mutex *self)
 {
     int rc;
 
@@ -79,5 +189,226 @@ void nn_mutex_unlock (struct nn_mutex *self)
     errnum_assert (rc == 0, rc);
 }
 
+static int nn_mutex_tryacquire (struct nn_mutex *self)
+{
+    int rc;
+
+    rc = pthread_mutex_trylock (&self->mutex);
+    if (rc == EBUSY)
+        return 0;
+    errnum_assert (rc == 0, rc);
+    return 1;
+}
+
+#endif
+
+#if defined NN_LOCK_MONITOR
+
+#if !defined NN_HAVE_GCC_ATOMIC_BUILTINS
+#error "NN_LOCK_MONITOR requires atomic builtins"
+#endif
+
+#include "../nn.h"
+#include "fast.h"
+
+#include <stdio.h>
+#include <string.h>
+#if !defined NN_HAVE_WINDOWS
+#include <time.h>
+#endif
+
+/*  The acquisitions are accounted for per place the mutex was initialised at
+    ("site"). Sites beyond NN_MUTEX_MAXSITES are accounted for together under
+    site 0. The counters are shared by all the threads, so they are updated
+    atomically; the monitor is meant for finding the contended locks rather
+    than for production builds. */
+#define NN_MUTEX_MAXSITES 128
+#define NN_MUTEX_OTHER 0
+
+/*  Length of the names, including the line number. */
+#define NN_MUTEX_NAMELEN 64
+
+struct nn_mutex_site {
+    char name [NN_MUTEX_NAMELEN];
+    uint64_t locks;
+    uint64_t contended;
+    uint64_t waitns;
+    uint64_t maxwaitns;
+    uint64_t waits [NN_LOCK_BUCKETS];
+};
+
+/*  The sites are only ever added. 'nn_mutex_nsites' is incremented once
+    the name of the new site is filled in, the lookups don't need locking.
+    Adding a site is guarded by a spinlock, as it can't be done using
+    a mutex. */
+static struct nn_mutex_site nn_mutex_sites [NN_MUTEX_MAXSITES] = {{"other"}};
+static volatile int nn_mutex_nsites = 1;
+static volatile int nn_mutex_sitelock = 0;
+
+static int nn_mutex_find (const char *name);
+
+void nn_mutex_init_ (struct nn_mutex *self, const char *file, int line)
+{
+    const char *pos;
+    char name [NN_MUTEX_NAMELEN];
+
+    /*  The name of the site is the path of the file relative to the source
+        directory, followed by the line number. */
+    pos = strstr (file, "src/");
+    while (pos && strstr (pos + 1, "src/"))
+        pos = strstr (pos + 1, "src/");
+    if (pos)
+        file = pos + 4;
+    snprintf (name, sizeof (name), "%s:%d", file, line);
+
+    nn_mutex_setup (self);
+    self->site = nn_mutex_site (name);
+}
+
+void nn_mutex_lock (struct nn_mutex *self)
+{
+    uint64_t start;
+
+    if (nn_fast (nn_mutex_tryacquire (self))) {
+        nn_mutex_account (self->site, 0, 0);
+        return;
+    }
+    start = nn_mutex_now ();
+    nn_mutex_acquire (self);
+    nn_mutex_account (self->site, 1, nn_mutex_now () - start);
+}
+
+int nn_mutex_trylock (struct nn_mutex *self)
+{
+    if (!nn_mutex_tryacquire (self))
+        return 0;
+    nn_mutex_account (self->site, 0, 0);
+    return 1;
+}
+
+int nn_mutex_site (const char *name)
+{
+    int site;
+
+    site = nn_mutex_find (name);
+    if (nn_fast (site >= 0))
+        return site;
+
+    while (__sync_lock_test_and_set (&nn_mutex_sitelock, 1))
+        ;
+    site = nn_mutex_find (name);
+    if (site < 0) {
+        site = NN_MUTEX_OTHER;
+        if (nn_mutex_nsites != NN_MUTEX_MAXSITES) {
+            site = nn_mutex_nsites;
+            strncpy (nn_mutex_sites [site].name, name, NN_MUTEX_NAMELEN - 1);
+            __sync_synchronize ();
+            ++nn_mutex_nsites;
+        }
+    }
+    __sync_lock_release (&nn_mutex_sitelock);
+    return site;
+}
+
+static int nn_mutex_find (const char *name)
+{
+    int i;
+    int nsites;
+
+    nsites = nn_mutex_nsites;
+    __sync_synchronize ();
+    for (i = 1; i != nsites; ++i)
+        if (strncmp (nn_mutex_sites [i].name, name, NN_MUTEX_NAMELEN - 1) == 0)
+            return i;
+    return -1;
+}
+
+void nn_mutex_account (int site, int contended, uint64_t wait)
+{
+    int bucket;
+    uint64_t n;
+    uint64_t max;
+    struct nn_mutex_site *s;
+
+    s = &nn_mutex_sites [site];
+    __sync_fetch_and_add (&s->locks, 1);
+    if (nn_fast (!contended))
+        return;
+
+    /*  Bucket i counts the waits of 2^i to 2^(i+1)-1 nanoseconds. */
+    __sync_fetch_and_add (&s->contended, 1);
+    __sync_fetch_and_add (&s->waitns, wait);
+    n = wait;
+    for (bucket = 0; bucket != NN_LOCK_BUCKETS - 1 && (n >> 1); ++bucket)
+        n >>= 1;
+    __sync_fetch_and_add (&s->waits [bucket], 1);
+    max = s->maxwaitns;
+    while (wait > max && !__sync_bool_compare_and_swap (&s->maxwaitns, max,
+          wait))
+        max = s->maxwaitns;
+}
+
+uint64_t nn_mutex_now (void)
+{
+#if defined NN_HAVE_WINDOWS
+    LARGE_INTEGER tps;
+    LARGE_INTEGER time;
+
+    QueryPerformanceFrequency (&tps);
+    QueryPerformanceCounter (&time);
+    return (uint64_t) (time.QuadPart * 1000000000.0 / tps.QuadPart);
+#else
+    int rc;
+    struct timespec tv;
+
+    rc = clock_gettime (CLOCK_MONOTONIC, &tv);
+    errno_assert (rc == 0);
+    return (uint64_t) tv.tv_sec * 1000000000 + tv.tv_nsec;
 #endif
+}
+
+int nn_mutex_stats (struct nn_lock_stat *stats, int count)
+{
+    int i;
+    int j;
+    int nsites;
+    struct nn_mutex_site *s;
+
+    nsites = nn_mutex_nsites;
+    __sync_synchronize ();
+    for (i = 0; i != nsites && i != count; ++i) {
+        s = &nn_mutex_sites [i];
+        stats [i].name = s->name;
+        stats [i].locks = s->locks;
+        stats [i].contended = s->contended;
+        stats [i].waitns = s->waitns;
+        stats [i].maxwaitns = s->maxwaitns;
+        for (j = 0; j != NN_LOCK_BUCKETS; ++j)
+            stats [i].waits [j] = s->waits [j];
+    }
+    return nsites;
+}
+
+#else
 
+void nn_mutex_init_ (struct nn_mutex *self)
+{
+    nn_mutex_setup (self);
+}
+
+void nn_mutex_lock (struct nn_mutex *self)
+{
+    nn_mutex_acquire (self);
+}
+
+int nn_mutex_trylock (struct nn_mutex *self)
+{
+    return nn_mutex_tryacquire (self);
+}
+
+int nn_mutex_stats (struct nn_lock_stat *stats, int count)
+{
+    return -ENOTSUP;
+}
+
+#endif
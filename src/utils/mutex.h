@@ -23,22 +23,42 @@
 #ifndef NN_MUTEX_INCLUDED
 #define NN_MUTEX_INCLUDED
 
+#include <stdint.h>
+
 #ifdef NN_HAVE_WINDOWS
 #include "win.h"
-#else
+#elif !defined NN_USE_FUTEX
 #include <pthread.h>
 #endif
 
 struct nn_mutex {
 #ifdef NN_HAVE_WINDOWS
     CRITICAL_SECTION mutex;
+#elif defined NN_USE_FUTEX
+    /*  0 if unlocked, 1 if locked, 2 if locked and there may be threads
+        sleeping on the futex. */
+    uint32_t state;
+
+    /*  Moving average of the number of spins it took to acquire the mutex.
+        Determines how long to spin before going to sleep. */
+    uint32_t spins;
 #else
     pthread_mutex_t mutex;
 #endif
+#if defined NN_LOCK_MONITOR
+    /*  The place the mutex was initialised at, see nn_mutex_stats. */
+    int site;
+#endif
 };
 
 /*  Initialise the mutex. */
-void nn_mutex_init (struct nn_mutex *self);
+#if defined NN_LOCK_MONITOR
+#define nn_mutex_init(self) nn_mutex_init_ (self, __FILE__, __LINE__)
+void nn_mutex_init_ (struct nn_mutex *self, const char *file, int line);
+#else
+#define nn_mutex_init(self) nn_mutex_init_ (self)
+void nn_mutex_init_ (struct nn_mutex *self);
+#endif
 
 /*  Terminate the mutex. */
 void nn_mutex_term (struct nn_mutex *self);
@@ -50,5 +70,29 @@ void nn_mutex_lock (struct nn_mutex *self);
 /*  Unlock the mutex. Behaviour of unlocking an unlocked mutex is undefined */
 void nn_mutex_unlock (struct nn_mutex *self);
 
+/*  Lock the mutex if it's not locked at the moment. Returns 1 if the mutex
+    was locked, 0 otherwise. Never blocks. Behaviour of locking the mutex
+    already locked by the same thread is undefined. */
+int nn_mutex_trylock (struct nn_mutex *self);
+
+/*  With NN_LOCK_MONITOR, acquisitions of the mutexes are accounted for per
+    the place the mutex was initialised at ("aio/aio_posix.inc:556"). Fills
+    in up to 'count' elements of 'stats', one per place, and returns
+    the number of the places seen so far, which may be greater than 'count'.
+    Returns -ENOTSUP if the monitoring is not compiled in. */
+struct nn_lock_stat;
+int nn_mutex_stats (struct nn_lock_stat *stats, int count);
+
+#if defined NN_LOCK_MONITOR
+
+/*  Locks other than nn_mutex account for their acquisitions themselves.
+    nn_mutex_site returns the place to account them to, 'wait' is the time
+    the thread was blocked for, in nanoseconds. */
+int nn_mutex_site (const char *name);
+void nn_mutex_account (int site, int contended, uint64_t wait);
+uint64_t nn_mutex_now (void);
+
+#endif
+
 #endif
 
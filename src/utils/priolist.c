@@ -21,20 +21,39 @@
 */
 
 #include "priolist.h"
-#include "cont.h"
+#include "alloc.h"
 #include "fast.h"
 #include "err.h"
 
 #include <stddef.h>
+#include <string.h>
+
+#if defined _MSC_VER
+#include <intrin.h>
+#endif
+
+/*  Initial size of the array of active pipes in a slot. */
+#define NN_PRIOLIST_CAPACITY 4
+
+/*  Private functions. */
+static void nn_priolist_erase (struct nn_priolist *self,
+    struct nn_priolist_slot *slot, struct nn_priolist_data *data);
+static void nn_priolist_update (struct nn_priolist *self);
+static void nn_priolist_weigh (struct nn_priolist_slot *self,
+    struct nn_priolist_data *used);
 
 void nn_priolist_init (struct nn_priolist *self)
 {
     int i;
 
     for (i = 0; i != NN_PRIOLIST_SLOTS; ++i) {
-        nn_list_init (&self->slots [i].pipes);
-        self->slots [i].current = NULL;
+        self->slots [i].pipes = NULL;
+        self->slots [i].capacity = 0;
+        self->slots [i].current = 0;
+        self->slots [i].count = 0;
+        self->slots [i].weight = 0;
     }
+    self->active = 0;
     self->current = -1;
 }
 
@@ -43,56 +62,66 @@ void nn_priolist_term (struct nn_priolist *self)
     int i;
 
     for (i = 0; i != NN_PRIOLIST_SLOTS; ++i)
-        nn_list_term (&self->slots [i].pipes);
+        nn_free (self->slots [i].pipes);
 }
 
 void nn_priolist_add (struct nn_priolist *self, struct nn_pipe *pipe,
-    struct nn_priolist_data *data, int priority)
+    struct nn_priolist_data *data, int priority, int weight)
 {
     data->pipe = pipe;
     data->priority = priority;
-    nn_list_item_init (&data->item);
+    data->weight = weight;
+    data->current = 0;
+    data->index = -1;
 }
 
 void nn_priolist_rm (struct nn_priolist *self, struct nn_pipe *pipe,
     struct nn_priolist_data *data)
 {
-    if (nn_list_item_isinlist (&data->item))
-        nn_list_erase (&self->slots [data->priority - 1].pipes, &data->item);
-    nn_list_item_term (&data->item);
+    struct nn_priolist_slot *slot;
+
+    /*  Non-active pipes don't need any special processing. */
+    if (data->index < 0)
+        return;
+
+    slot = &self->slots [data->priority - 1];
+    nn_priolist_erase (self, slot, data);
 }
 
 void nn_priolist_activate (struct nn_priolist *self, struct nn_pipe *pipe,
     struct nn_priolist_data *data)
 {
     struct nn_priolist_slot *slot;
+    struct nn_priolist_data **pipes;
+    int capacity;
 
     slot = &self->slots [data->priority - 1];
 
-    /*  If there are already some elements in this slot, current pipe is not
-        going to change. */
-    if (!nn_list_empty (&slot->pipes)) {
-        nn_list_insert (&slot->pipes, &data->item, nn_list_end (&slot->pipes));
-        return;
+    /*  Make space for the pipe. The array never shrinks, so once the number
+        of pipes settles down, activation doesn't allocate. */
+    if (nn_slow (slot->count == slot->capacity)) {
+        capacity = slot->capacity ? slot->capacity * 2 : NN_PRIOLIST_CAPACITY;
+        pipes = slot->pipes ?
+            nn_realloc (slot->pipes, capacity * sizeof (*pipes)) :
+            nn_alloc (capacity * sizeof (*pipes), "priolist slot");
+        alloc_assert (pipes);
+        slot->pipes = pipes;
+        slot->capacity = capacity;
     }
 
-    /*  Add first pipe into the slot. If there are no pipes in priolist at all
-        this slot becomes current. */
-    nn_list_insert (&slot->pipes, &data->item, nn_list_end (&slot->pipes));
-    slot->current = data;
-    if (self->current == -1) {
-        self->current = data->priority;
-        return;
-    }
+    data->index = slot->count;
+    data->current = 0;
+    slot->pipes [slot->count] = data;
+    ++slot->count;
+    slot->weight += data->weight;
 
-    /*  If the current priority is lower than the one of the newly activated
-        pipe, this slot becomes current. */
-    if (self->current > data->priority) {
-        self->current = data->priority;
+    /*  If there are already some pipes in this slot, current pipe is not
+        going to change. Otherwise the slot may become the current one. */
+    if (slot->count > 1)
         return;
-    }
-
-    /*  Current doesn't change otherwise. */
+    slot->current = 0;
+    self->active |= 1u << (data->priority - 1);
+    nn_priolist_update (self);
 }
 
 int nn_priolist_is_active (struct nn_priolist *self)
@@ -102,37 +131,122 @@ int nn_priolist_is_active (struct nn_priolist *self)
 
 struct nn_pipe *nn_priolist_getpipe (struct nn_priolist *self)
 {
+    struct nn_priolist_slot *slot;
+
+    if (nn_slow (self->current == -1))
+        return NULL;
+    slot = &self->slots [self->current - 1];
+    return slot->pipes [slot->current]->pipe;
+}
+
+struct nn_priolist_data *nn_priolist_getdata (struct nn_priolist *self)
+{
+    struct nn_priolist_slot *slot;
+
     if (nn_slow (self->current == -1))
         return NULL;
-    return self->slots [self->current - 1].current->pipe;
+    slot = &self->slots [self->current - 1];
+    return slot->pipes [slot->current];
 }
 
 void nn_priolist_advance (struct nn_priolist *self, int release)
 {
     struct nn_priolist_slot *slot;
-    struct nn_list_item *it;
+    struct nn_priolist_data *used;
 
     nn_assert (self->current > 0);
     slot = &self->slots [self->current - 1];
+    used = slot->pipes [slot->current];
+
+    /*  Move slot's current index to the next pipe. Once the released pipe
+        is erased, the next pipe already is at the current index. */
+    if (release) {
+        nn_priolist_erase (self, slot, used);
+        if (nn_slow (slot->count && slot->weight != slot->count))
+            nn_priolist_weigh (slot, NULL);
+        return;
+    }
+    if (++slot->current == slot->count)
+        slot->current = 0;
+    if (nn_slow (slot->weight != slot->count))
+        nn_priolist_weigh (slot, used);
+}
+
+void nn_priolist_select (struct nn_priolist *self,
+    struct nn_priolist_data *data)
+{
+    nn_assert (self->current == data->priority);
+    nn_assert (data->index >= 0);
+    self->slots [self->current - 1].current = data->index;
+}
+
+static void nn_priolist_erase (struct nn_priolist *self,
+    struct nn_priolist_slot *slot, struct nn_priolist_data *data)
+{
+    int i;
 
-    /*  Move slot's current pointer to the next pipe. */
-    if (release)
-        it = nn_list_erase (&slot->pipes, &slot->current->item);
-    else
-        it = nn_list_next (&slot->pipes, &slot->current->item);
-    if (!it)
-        it = nn_list_begin (&slot->pipes);
-    slot->current = nn_cont (it, struct nn_priolist_data, item);
-
-    /* If there are no more pipes in this slot, find a non-empty slot with
-       lower priority. */
-    while (nn_list_empty (&slot->pipes)) {
-        ++self->current;
-        if (self->current > NN_PRIOLIST_SLOTS) {
-            self->current = -1;
-            return;
-        }
-        slot = &self->slots [self->current - 1];
+    /*  Close the gap, so that the round-robin order is not disturbed. */
+    --slot->count;
+    slot->weight -= data->weight;
+    for (i = data->index; i != slot->count; ++i) {
+        slot->pipes [i] = slot->pipes [i + 1];
+        slot->pipes [i]->index = i;
+    }
+
+    /*  If the erased pipe was current, the pipe following it becomes current
+        (with wrap-over). */
+    if (slot->current > data->index)
+        --slot->current;
+    if (slot->current >= slot->count)
+        slot->current = 0;
+    data->index = -1;
+
+    /*  If the slot has become empty, switch to the slots with lower
+        priority. */
+    if (slot->count == 0) {
+        self->active &= ~(1u << (data->priority - 1));
+        nn_priolist_update (self);
     }
 }
 
+static void nn_priolist_update (struct nn_priolist *self)
+{
+    unsigned long index;
+
+    /*  The current priority is the lowest bit set in the bitmap. */
+    if (!self->active) {
+        self->current = -1;
+        return;
+    }
+#if defined _MSC_VER
+    _BitScanForward (&index, self->active);
+#else
+    index = __builtin_ctz (self->active);
+#endif
+    self->current = (int) index + 1;
+}
+
+static void nn_priolist_weigh (struct nn_priolist_slot *self,
+    struct nn_priolist_data *used)
+{
+    int i;
+    int best;
+    struct nn_priolist_data *data;
+
+    /*  The pipe just used pays for its turn. */
+    if (used)
+        used->current -= self->weight;
+
+    /*  Pick the pipe with the highest current weight. On a tie, the one
+        following the pipe just used goes first. */
+    best = -1;
+    for (i = 0; i != self->count; ++i) {
+        data = self->pipes [i];
+        data->current += data->weight;
+        if (best < 0 || data->current > self->pipes [best]->current ||
+              (data->current == self->pipes [best]->current &&
+              i == self->current))
+            best = i;
+    }
+    self->current = best;
+}
@@ -25,38 +25,82 @@
 
 #include "../protocol.h"
 
-#include "list.h"
+#include <stdint.h>
 
-/*  Prioritised list of pipes. */
+/*  Prioritised list of pipes. Pipes of the same priority are used in turns,
+    each of them in proportion to its weight. The turns are interleaved as
+    evenly as possible (smooth weighted round-robin).
+
+    The active pipes of each priority are kept in an array used as a ring,
+    and a bitmap tells which priorities have any active pipes, so that
+    finding the next pipe to use doesn't walk any lists. The pipes keep
+    the order in which they were activated. */
 
 #define NN_PRIOLIST_SLOTS 16
 
+/*  Maximum weight of a pipe. */
+#define NN_PRIOLIST_MAX_WEIGHT 1000
+
 struct nn_priolist_data {
     struct nn_pipe *pipe;
     int priority;
-    struct nn_list_item item;
+    int weight;
+
+    /*  The pipe with the highest current weight is used next. Each turn,
+        the current weights of all the active pipes grow by their weights and
+        the one of the pipe used decreases by the total weight. */
+    int current;
+
+    /*  Position of the pipe in the array of its slot, -1 if the pipe is not
+        active. */
+    int index;
 };
 
 struct nn_priolist_slot {
-    struct nn_list pipes;
-    struct nn_priolist_data *current;
+
+    /*  The active pipes and the allocated size of the array. */
+    struct nn_priolist_data **pipes;
+    int capacity;
+
+    /*  Index of the pipe to be used next. */
+    int current;
+
+    /*  Number of active pipes in the slot and their total weight. If
+        the two are equal, all the weights are 1 and the pipes are simply
+        round-robined. */
+    int count;
+    int weight;
 };
 
 struct nn_priolist {
     struct nn_priolist_slot slots [NN_PRIOLIST_SLOTS];
+
+    /*  Bit N is set if the slot of priority N + 1 has any active pipes. */
+    uint32_t active;
+
+    /*  Priority of the pipes being used, -1 if there are no active pipes. */
     int current;
 };
 
 void nn_priolist_init (struct nn_priolist *self);
 void nn_priolist_term (struct nn_priolist *self);
 void nn_priolist_add (struct nn_priolist *self, struct nn_pipe *pipe,
-    struct nn_priolist_data *data, int priority);
+    struct nn_priolist_data *data, int priority, int weight);
 void nn_priolist_rm (struct nn_priolist *self, struct nn_pipe *pipe,
     struct nn_priolist_data *data);
 void nn_priolist_activate (struct nn_priolist *self, struct nn_pipe *pipe,
     struct nn_priolist_data *data);
 int nn_priolist_is_active (struct nn_priolist *self);
 struct nn_pipe *nn_priolist_getpipe (struct nn_priolist *self);
+
+/*  Returns the data of the pipe to be used next, NULL if there's none. */
+struct nn_priolist_data *nn_priolist_getdata (struct nn_priolist *self);
+
 void nn_priolist_advance (struct nn_priolist *self, int release);
 
+/*  Makes the pipe the current one. The pipe must be active and have the
+    priority of the current pipe. */
+void nn_priolist_select (struct nn_priolist *self,
+    struct nn_priolist_data *data);
+
 #endif
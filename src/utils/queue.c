@@ -37,6 +37,11 @@ void nn_queue_term (struct nn_queue *self)
     self->tail = NULL;
 }
 
+int nn_queue_empty (struct nn_queue *self)
+{
+    return self->head ? 0 : 1;
+}
+
 void nn_queue_push (struct nn_queue *self, struct nn_queue_item *item)
 {
     nn_assert (item->next == NN_QUEUE_NOTINQUEUE);
@@ -63,6 +68,30 @@ struct nn_queue_item *nn_queue_pop (struct nn_queue *self)
     return result;
 }
 
+void nn_queue_remove (struct nn_queue *self, struct nn_queue_item *item)
+{
+    struct nn_queue_item *it;
+    struct nn_queue_item *prev;
+
+    if (item->next == NN_QUEUE_NOTINQUEUE)
+        return;
+
+    prev = NULL;
+    for (it = self->head; it; it = it->next) {
+        if (it == item) {
+            if (prev)
+                prev->next = it->next;
+            else
+                self->head = it->next;
+            if (self->tail == it)
+                self->tail = prev;
+            item->next = NN_QUEUE_NOTINQUEUE;
+            return;
+        }
+        prev = it;
+    }
+}
+
 void nn_queue_item_init (struct nn_queue_item *self)
 {
     self->next = NN_QUEUE_NOTINQUEUE;
@@ -46,6 +46,9 @@ void nn_queue_init (struct nn_queue *self);
     termination. */
 void nn_queue_term (struct nn_queue *self);
 
+/*  Returns 1 if there are no elements in the queue, 0 otherwise. */
+int nn_queue_empty (struct nn_queue *self);
+
 /*  Inserts one element into the queue. */
 void nn_queue_push (struct nn_queue *self, struct nn_queue_item *item);
 
@@ -53,6 +56,10 @@ void nn_queue_push (struct nn_queue *self, struct nn_queue_item *item);
     from the queue. Returns NULL if the queue is empty. */
 struct nn_queue_item *nn_queue_pop (struct nn_queue *self);
 
+/*  Removes the element from the queue. Does nothing if the element is not
+    a part of the queue. */
+void nn_queue_remove (struct nn_queue *self, struct nn_queue_item *item);
+
 /*  Initialise a queue item. At this point it is not a part of any queue. */
 void nn_queue_item_init (struct nn_queue_item *self);
 
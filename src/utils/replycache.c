@@ -0,0 +1,183 @@
+/*
+    Copyright (c) 2013 250bpm s.r.o.
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"),
+    to deal in the Software without restriction, including without limitation
+    the rights to use, copy, modify, merge, publish, distribute, sublicense,
+    and/or sell copies of the Software, and to permit persons to whom
+    the Software is furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included
+    in all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+    THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+    FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+    IN THE SOFTWARE.
+*/
+
+#include "replycache.h"
+#include "alloc.h"
+#include "crc32c.h"
+#include "err.h"
+#include "fast.h"
+
+#include <string.h>
+
+/*  Private functions. */
+static int nn_replycache_find (struct nn_replycache *self, struct nn_chunkref *key,
+    uint32_t hash);
+static void nn_replycache_evict (struct nn_replycache *self, int index);
+
+void nn_replycache_init (struct nn_replycache *self)
+{
+    self->capacity = 0;
+    self->entries = NULL;
+    self->pos = 0;
+    self->buckets = NULL;
+    self->mask = 0;
+}
+
+void nn_replycache_term (struct nn_replycache *self)
+{
+    nn_replycache_resize (self, 0);
+}
+
+void nn_replycache_resize (struct nn_replycache *self, int capacity)
+{
+    int i;
+    uint32_t nbuckets;
+
+    if (self->entries) {
+        for (i = 0; i != self->capacity; ++i)
+            nn_replycache_evict (self, i);
+        nn_free (self->entries);
+        nn_free (self->buckets);
+        self->entries = NULL;
+        self->buckets = NULL;
+    }
+    self->capacity = capacity;
+    self->pos = 0;
+    self->mask = 0;
+    if (!capacity)
+        return;
+
+    /*  Keep the buckets at most half full. */
+    nbuckets = 1;
+    while (nbuckets < 2 * (uint32_t) capacity)
+        nbuckets <<= 1;
+    self->mask = nbuckets - 1;
+    self->entries = nn_alloc (capacity * sizeof (struct nn_replycache_entry),
+        "reply cache");
+    alloc_assert (self->entries);
+    self->buckets = nn_alloc (nbuckets * sizeof (int), "reply cache buckets");
+    alloc_assert (self->buckets);
+    for (i = 0; i != capacity; ++i)
+        self->entries [i].state = NN_REPLYCACHE_NEW;
+    for (i = 0; i != (int) nbuckets; ++i)
+        self->buckets [i] = -1;
+}
+
+int nn_replycache_active (struct nn_replycache *self)
+{
+    return self->capacity != 0;
+}
+
+int nn_replycache_check (struct nn_replycache *self, struct nn_chunkref *key,
+    struct nn_msg *reply)
+{
+    uint32_t hash;
+    int index;
+    struct nn_replycache_entry *entry;
+
+    hash = nn_crc32c (0, nn_chunkref_data (key), nn_chunkref_size (key));
+    index = nn_replycache_find (self, key, hash);
+    if (index >= 0) {
+        entry = &self->entries [index];
+        if (entry->state == NN_REPLYCACHE_DONE)
+            nn_msg_cp (reply, &entry->reply);
+        return entry->state;
+    }
+
+    /*  Record the new request in place of the oldest one. */
+    index = self->pos;
+    self->pos = (self->pos + 1) % self->capacity;
+    nn_replycache_evict (self, index);
+    entry = &self->entries [index];
+    entry->state = NN_REPLYCACHE_INPROGRESS;
+    entry->hash = hash;
+    nn_chunkref_cp (&entry->key, key);
+    entry->next = self->buckets [hash & self->mask];
+    self->buckets [hash & self->mask] = index;
+
+    return NN_REPLYCACHE_NEW;
+}
+
+void nn_replycache_done (struct nn_replycache *self, struct nn_chunkref *key,
+    struct nn_msg *reply)
+{
+    int index;
+    struct nn_replycache_entry *entry;
+
+    /*  The request may have been evicted in the meantime. */
+    index = nn_replycache_find (self, key,
+        nn_crc32c (0, nn_chunkref_data (key), nn_chunkref_size (key)));
+    if (nn_slow (index < 0))
+        return;
+    entry = &self->entries [index];
+    if (entry->state == NN_REPLYCACHE_DONE)
+        nn_msg_term (&entry->reply);
+    nn_msg_cp (&entry->reply, reply);
+    entry->state = NN_REPLYCACHE_DONE;
+}
+
+void nn_replycache_cancel (struct nn_replycache *self, struct nn_chunkref *key)
+{
+    int index;
+
+    index = nn_replycache_find (self, key,
+        nn_crc32c (0, nn_chunkref_data (key), nn_chunkref_size (key)));
+    if (index >= 0 && self->entries [index].state == NN_REPLYCACHE_INPROGRESS)
+        nn_replycache_evict (self, index);
+}
+
+static int nn_replycache_find (struct nn_replycache *self, struct nn_chunkref *key,
+    uint32_t hash)
+{
+    int index;
+    struct nn_replycache_entry *entry;
+
+    for (index = self->buckets [hash & self->mask]; index >= 0;
+          index = entry->next) {
+        entry = &self->entries [index];
+        if (entry->hash == hash &&
+              nn_chunkref_size (&entry->key) == nn_chunkref_size (key) &&
+              memcmp (nn_chunkref_data (&entry->key), nn_chunkref_data (key),
+              nn_chunkref_size (key)) == 0)
+            return index;
+    }
+    return -1;
+}
+
+/*  Removes the entry from its bucket and deallocates its content. */
+static void nn_replycache_evict (struct nn_replycache *self, int index)
+{
+    int *it;
+    struct nn_replycache_entry *entry;
+
+    entry = &self->entries [index];
+    if (entry->state == NN_REPLYCACHE_NEW)
+        return;
+    for (it = &self->buckets [entry->hash & self->mask]; *it != index;
+          it = &self->entries [*it].next)
+        nn_assert (*it >= 0);
+    *it = entry->next;
+    nn_chunkref_term (&entry->key);
+    if (entry->state == NN_REPLYCACHE_DONE)
+        nn_msg_term (&entry->reply);
+    entry->state = NN_REPLYCACHE_NEW;
+}
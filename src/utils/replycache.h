@@ -0,0 +1,94 @@
+/*
+    Copyright (c) 2013 250bpm s.r.o.
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"),
+    to deal in the Software without restriction, including without limitation
+    the rights to use, copy, modify, merge, publish, distribute, sublicense,
+    and/or sell copies of the Software, and to permit persons to whom
+    the Software is furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included
+    in all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+    THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+    FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+    IN THE SOFTWARE.
+*/
+
+#ifndef NN_REPLYCACHE_INCLUDED
+#define NN_REPLYCACHE_INCLUDED
+
+#include "chunkref.h"
+#include "msg.h"
+
+#include <stdint.h>
+
+/*  Bounded cache of the requests received lately, used by REP and
+    RESPONDENT sockets to recognise the requests the peer has resent, e.g.
+    after NN_REQ_RESEND_IVL expired. The requests are keyed by their
+    backtraces, which end with the request or survey ID generated by
+    the peer. Each request is either still being processed or was answered,
+    in which case a copy of the reply is kept to be sent again. Once
+    the cache is full, the oldest request is evicted. */
+
+#define NN_REPLYCACHE_NEW 0
+#define NN_REPLYCACHE_INPROGRESS 1
+#define NN_REPLYCACHE_DONE 2
+
+struct nn_replycache_entry {
+    int state;
+    uint32_t hash;
+
+    /*  Next entry in the same bucket, -1 if none. */
+    int next;
+    struct nn_chunkref key;
+
+    /*  The reply, valid in NN_REPLYCACHE_DONE state only. */
+    struct nn_msg reply;
+};
+
+struct nn_replycache {
+
+    /*  Maximum number of requests kept, zero if the cache is disabled. */
+    int capacity;
+
+    /*  The entries are reused in a round-robin fashion; 'pos' is the one to
+        be used next. Each bucket holds the index of its first entry, -1 if
+        it's empty. */
+    struct nn_replycache_entry *entries;
+    int pos;
+    int *buckets;
+    uint32_t mask;
+};
+
+void nn_replycache_init (struct nn_replycache *self);
+void nn_replycache_term (struct nn_replycache *self);
+
+/*  Drops all the requests and sets the maximum number of requests kept.
+    Zero disables the cache. */
+void nn_replycache_resize (struct nn_replycache *self, int capacity);
+
+int nn_replycache_active (struct nn_replycache *self);
+
+/*  Looks the request up. If it wasn't seen yet, it's recorded as being in
+    progress and NN_REPLYCACHE_NEW is returned. If it's in progress,
+    NN_REPLYCACHE_INPROGRESS is returned. If it was answered, NN_REPLYCACHE_DONE is
+    returned and 'reply' is initialised with a copy of the reply. */
+int nn_replycache_check (struct nn_replycache *self, struct nn_chunkref *key,
+    struct nn_msg *reply);
+
+/*  Records a copy of the reply to the request, replacing the one recorded
+    before, if any. */
+void nn_replycache_done (struct nn_replycache *self, struct nn_chunkref *key,
+    struct nn_msg *reply);
+
+/*  Forgets the request in progress, so that it's processed again if
+    the peer resends it. */
+void nn_replycache_cancel (struct nn_replycache *self, struct nn_chunkref *key);
+
+#endif
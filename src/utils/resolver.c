@@ -0,0 +1,386 @@
+/*
+    Copyright (c) 2013 250bpm s.r.o.
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"),
+    to deal in the Software without restriction, including without limitation
+    the rights to use, copy, modify, merge, publish, distribute, sublicense,
+    and/or sell copies of the Software, and to permit persons to whom
+    the Software is furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included
+    in all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+    THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+    FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+    IN THE SOFTWARE.
+*/
+
+#include "resolver.h"
+
+#include "../nn.h"
+
+#include "alloc.h"
+#include "clock.h"
+#include "cont.h"
+#include "err.h"
+#include "fast.h"
+#include "mutex.h"
+#include "queue.h"
+#include "sem.h"
+#include "thread.h"
+
+#include <string.h>
+
+/*  Number of threads doing the DNS lookups. */
+#define NN_RESOLVER_THREADS 4
+
+/*  Number of names cached and for how long, in milliseconds. Failures are
+    cached for a shorter time so that the name is available soon after
+    the DNS is fixed, yet a reconnection loop doesn't query it on every
+    attempt. */
+#define NN_RESOLVER_CACHE_SIZE 64
+#define NN_RESOLVER_TTL 30000
+#define NN_RESOLVER_NEGATIVE_TTL 1000
+
+/*  States of a lookup. */
+#define NN_RESOLVER_REQ_QUEUED 1
+#define NN_RESOLVER_REQ_RUNNING 2
+#define NN_RESOLVER_REQ_DONE 3
+
+struct nn_resolver_req {
+
+    /*  The handle the lookup is done for or NULL if it was cancelled while
+        running. In the latter case the resolver thread deallocates
+        the request once the lookup is finished. */
+    struct nn_resolve *owner;
+
+    /*  Item in the queue of the lookups to do. */
+    struct nn_queue_item item;
+
+    int state;
+    char name [NN_SOCKADDR_MAX];
+    int flags;
+
+    /*  The result, i.e. either the number of addresses or an error. While
+        the lookup is running, it is accessed by the resolver thread only. */
+    int rc;
+    struct sockaddr_storage addrs [NN_RESOLVE_MAXADDRS];
+    nn_socklen addrlens [NN_RESOLVE_MAXADDRS];
+};
+
+struct nn_resolver_entry {
+
+    /*  Empty name means that the entry is not used. */
+    char name [NN_SOCKADDR_MAX];
+    int flags;
+    int rc;
+    struct sockaddr_storage addrs [NN_RESOLVE_MAXADDRS];
+    nn_socklen addrlens [NN_RESOLVE_MAXADDRS];
+    uint64_t expiry;
+};
+
+struct nn_resolver {
+
+    /*  Guards all of the state below. */
+    struct nn_mutex sync;
+
+    /*  Posted when there are lookups to do or the threads should exit.
+        'posted' avoids posting the semaphore twice. */
+    struct nn_sem ready;
+    int posted;
+    int stop;
+
+    /*  The threads are started once the first lookup is needed. */
+    int started;
+    struct nn_thread threads [NN_RESOLVER_THREADS];
+
+    /*  Lookups waiting for a thread. */
+    struct nn_queue reqs;
+
+    struct nn_clock clock;
+    struct nn_resolver_entry cache [NN_RESOLVER_CACHE_SIZE];
+};
+
+static struct nn_resolver resolver;
+
+/*  Private functions. */
+static void nn_resolver_routine (void *arg);
+static void nn_resolver_wake (void);
+static void nn_resolver_store (struct nn_resolver_req *req);
+static void nn_resolve_cancel (struct nn_resolve *self);
+static int nn_resolve_copy (int rc, const struct sockaddr_storage *addrs,
+    const nn_socklen *addrlens, struct sockaddr_storage *result,
+    nn_socklen *resultlen, int count);
+
+void nn_resolver_init (void)
+{
+    int i;
+
+    nn_mutex_init (&resolver.sync);
+    nn_sem_init (&resolver.ready);
+    resolver.posted = 0;
+    resolver.stop = 0;
+    resolver.started = 0;
+    nn_queue_init (&resolver.reqs);
+    nn_clock_init (&resolver.clock);
+    for (i = 0; i != NN_RESOLVER_CACHE_SIZE; ++i) {
+        resolver.cache [i].name [0] = 0;
+        resolver.cache [i].expiry = 0;
+    }
+}
+
+void nn_resolver_term (void)
+{
+    int i;
+
+    /*  Ask the threads to exit and wait till they do. A lookup that is
+        still in progress has to finish first. */
+    if (resolver.started) {
+        nn_mutex_lock (&resolver.sync);
+        resolver.stop = 1;
+        nn_resolver_wake ();
+        nn_mutex_unlock (&resolver.sync);
+        for (i = 0; i != NN_RESOLVER_THREADS; ++i)
+            nn_thread_term (&resolver.threads [i]);
+    }
+
+    /*  All the endpoints are closed by now, so all the lookups they asked
+        for were either cancelled or finished. */
+    nn_assert (nn_queue_empty (&resolver.reqs));
+
+    nn_clock_term (&resolver.clock);
+    nn_queue_term (&resolver.reqs);
+    nn_sem_term (&resolver.ready);
+    nn_mutex_term (&resolver.sync);
+}
+
+void nn_resolve_init (struct nn_resolve *self, const struct nn_cp_sink **sink,
+    struct nn_cp *cp)
+{
+    nn_event_init (&self->done, sink, cp);
+    self->req = NULL;
+}
+
+void nn_resolve_term (struct nn_resolve *self)
+{
+    nn_mutex_lock (&resolver.sync);
+    nn_resolve_cancel (self);
+    nn_mutex_unlock (&resolver.sync);
+    nn_event_term (&self->done);
+}
+
+int nn_resolve_start (struct nn_resolve *self, const char *addr,
+    size_t addrlen, int flags, struct sockaddr_storage *result,
+    nn_socklen *resultlen, int count)
+{
+    int rc;
+    int i;
+    char name [NN_SOCKADDR_MAX];
+    struct nn_resolver_req *req;
+    struct nn_resolver_entry *entry;
+
+    nn_assert (count > 0);
+
+    /*  Literal addresses need no DNS lookup. */
+    rc = nn_addr_parse_literal (addr, addrlen, flags, result, resultlen);
+    if (rc == 0)
+        return 1;
+    errnum_assert (rc == -EINVAL, -rc);
+    if (nn_slow (addrlen >= sizeof (name)))
+        return -EINVAL;
+    memcpy (name, addr, addrlen);
+    name [addrlen] = 0;
+
+    nn_mutex_lock (&resolver.sync);
+
+    /*  If the lookup for this name was already started, either wait for it
+        to finish or pick up the result. A lookup for a different name is not
+        needed any more. */
+    req = self->req;
+    if (req) {
+        if (strcmp (req->name, name) == 0 && req->flags == flags) {
+            if (req->state != NN_RESOLVER_REQ_DONE) {
+                nn_mutex_unlock (&resolver.sync);
+                return -EINPROGRESS;
+            }
+            rc = nn_resolve_copy (req->rc, req->addrs, req->addrlens,
+                result, resultlen, count);
+            nn_resolve_cancel (self);
+            nn_mutex_unlock (&resolver.sync);
+            return rc;
+        }
+        nn_resolve_cancel (self);
+    }
+
+    /*  Try the cache. */
+    for (i = 0; i != NN_RESOLVER_CACHE_SIZE; ++i) {
+        entry = &resolver.cache [i];
+        if (strcmp (entry->name, name) != 0 || entry->flags != flags)
+            continue;
+        if (entry->expiry <= nn_clock_now (&resolver.clock))
+            break;
+        rc = nn_resolve_copy (entry->rc, entry->addrs, entry->addrlens,
+            result, resultlen, count);
+        nn_mutex_unlock (&resolver.sync);
+        return rc;
+    }
+
+    /*  Hand the lookup over to the resolver threads. */
+    if (nn_slow (!resolver.started)) {
+        for (i = 0; i != NN_RESOLVER_THREADS; ++i)
+            nn_thread_init_named (&resolver.threads [i], "nn_resolver",
+                nn_resolver_routine, NULL);
+        resolver.started = 1;
+    }
+    req = nn_alloc (sizeof (struct nn_resolver_req), "resolver request");
+    alloc_assert (req);
+    req->owner = self;
+    nn_queue_item_init (&req->item);
+    req->state = NN_RESOLVER_REQ_QUEUED;
+    memcpy (req->name, name, addrlen + 1);
+    req->flags = flags;
+    nn_queue_push (&resolver.reqs, &req->item);
+    nn_resolver_wake ();
+    self->req = req;
+
+    nn_mutex_unlock (&resolver.sync);
+    return -EINPROGRESS;
+}
+
+static void nn_resolve_cancel (struct nn_resolve *self)
+{
+    struct nn_resolver_req *req;
+
+    req = self->req;
+    if (!req)
+        return;
+    self->req = NULL;
+
+    /*  A running lookup can't be interrupted. It's left to the resolver
+        thread to deallocate the request once it's done. */
+    if (req->state == NN_RESOLVER_REQ_RUNNING) {
+        req->owner = NULL;
+        return;
+    }
+    if (req->state == NN_RESOLVER_REQ_QUEUED)
+        nn_queue_remove (&resolver.reqs, &req->item);
+    nn_queue_item_term (&req->item);
+    nn_free (req);
+}
+
+static int nn_resolve_copy (int rc, const struct sockaddr_storage *addrs,
+    const nn_socklen *addrlens, struct sockaddr_storage *result,
+    nn_socklen *resultlen, int count)
+{
+    int i;
+
+    if (rc < 0)
+        return rc;
+    if (rc > count)
+        rc = count;
+    for (i = 0; i != rc; ++i) {
+        memcpy (&result [i], &addrs [i], addrlens [i]);
+        resultlen [i] = addrlens [i];
+    }
+    return rc;
+}
+
+static void nn_resolver_wake (void)
+{
+    if (!resolver.posted) {
+        resolver.posted = 1;
+        nn_sem_post (&resolver.ready);
+    }
+}
+
+static void nn_resolver_store (struct nn_resolver_req *req)
+{
+    int i;
+    uint64_t now;
+    struct nn_resolver_entry *entry;
+
+    /*  Replace the entry for the same name, if any. Otherwise, replace
+        the one that expires first. Unused entries have expired long ago. */
+    entry = &resolver.cache [0];
+    for (i = 0; i != NN_RESOLVER_CACHE_SIZE; ++i) {
+        if (strcmp (resolver.cache [i].name, req->name) == 0 &&
+              resolver.cache [i].flags == req->flags) {
+            entry = &resolver.cache [i];
+            break;
+        }
+        if (resolver.cache [i].expiry < entry->expiry)
+            entry = &resolver.cache [i];
+    }
+
+    now = nn_clock_now (&resolver.clock);
+    memcpy (entry->name, req->name, sizeof (entry->name));
+    entry->flags = req->flags;
+    entry->rc = req->rc;
+    for (i = 0; i < req->rc; ++i) {
+        memcpy (&entry->addrs [i], &req->addrs [i], req->addrlens [i]);
+        entry->addrlens [i] = req->addrlens [i];
+    }
+    entry->expiry = now + (req->rc > 0 ? NN_RESOLVER_TTL :
+        NN_RESOLVER_NEGATIVE_TTL);
+}
+
+static void nn_resolver_routine (void *arg)
+{
+    int rc;
+    struct nn_queue_item *it;
+    struct nn_resolver_req *req;
+
+    while (1) {
+        rc = nn_sem_wait (&resolver.ready);
+        if (nn_slow (rc == -EINTR))
+            continue;
+        errnum_assert (rc == 0, -rc);
+
+        nn_mutex_lock (&resolver.sync);
+        resolver.posted = 0;
+        while (1) {
+
+            /*  Pass the request to exit on to the other threads. */
+            if (nn_slow (resolver.stop)) {
+                nn_resolver_wake ();
+                nn_mutex_unlock (&resolver.sync);
+                return;
+            }
+
+            it = nn_queue_pop (&resolver.reqs);
+            if (!it)
+                break;
+
+            /*  If there are more lookups waiting, let another thread take
+                care of them in the meantime. */
+            if (!nn_queue_empty (&resolver.reqs))
+                nn_resolver_wake ();
+
+            /*  Do the lookup without holding the lock. */
+            req = nn_cont (it, struct nn_resolver_req, item);
+            req->state = NN_RESOLVER_REQ_RUNNING;
+            nn_mutex_unlock (&resolver.sync);
+            req->rc = nn_addr_parse_remotes (req->name, strlen (req->name),
+                req->flags, req->addrs, req->addrlens, NN_RESOLVE_MAXADDRS);
+            nn_mutex_lock (&resolver.sync);
+
+            /*  Cache the result and let the endpoint know. If it is not
+                interested any more, drop the request. */
+            nn_resolver_store (req);
+            if (req->owner) {
+                req->state = NN_RESOLVER_REQ_DONE;
+                nn_event_signal (&req->owner->done);
+            }
+            else {
+                nn_queue_item_term (&req->item);
+                nn_free (req);
+            }
+        }
+        nn_mutex_unlock (&resolver.sync);
+    }
+}
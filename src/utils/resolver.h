@@ -0,0 +1,76 @@
+/*
+    Copyright (c) 2013 250bpm s.r.o.
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"),
+    to deal in the Software without restriction, including without limitation
+    the rights to use, copy, modify, merge, publish, distribute, sublicense,
+    and/or sell copies of the Software, and to permit persons to whom
+    the Software is furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included
+    in all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+    THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+    FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+    IN THE SOFTWARE.
+*/
+
+#ifndef NN_RESOLVER_INCLUDED
+#define NN_RESOLVER_INCLUDED
+
+#include "../aio/aio.h"
+
+#include "addr.h"
+
+#include <stddef.h>
+
+/*  Asynchronous resolution of remote addresses. DNS lookups are done by
+    a small pool of threads started on first use, so that a slow or
+    unresponsive DNS server never blocks a completion port. The results,
+    both positive and negative, are cached for a while so that reconnection
+    loops don't keep querying the DNS server. */
+
+/*  Initialise and terminate the global state of the resolver. Terminating
+    it waits for the lookups that are still in progress. */
+void nn_resolver_init (void);
+void nn_resolver_term (void);
+
+/*  Maximal number of addresses per name that are kept. */
+#define NN_RESOLVE_MAXADDRS 8
+
+struct nn_resolver_req;
+
+/*  Handle to resolve the addresses on behalf of a single endpoint. At most
+    one lookup per handle is in progress at any given time. */
+struct nn_resolve {
+
+    /*  Signalled in the context of the completion port once an asynchronous
+        lookup is finished. */
+    struct nn_event done;
+
+    /*  The lookup in progress or the finished one that was not picked up
+        yet, if any. */
+    struct nn_resolver_req *req;
+};
+
+void nn_resolve_init (struct nn_resolve *self, const struct nn_cp_sink **sink,
+    struct nn_cp *cp);
+
+/*  Cancels the lookup in progress, if any. */
+void nn_resolve_term (struct nn_resolve *self);
+
+/*  Resolves the address, same way as nn_addr_parse_remotes does. If the
+    address is a literal or the result is cached, it is returned straight
+    away. Otherwise -EINPROGRESS is returned and the 'done' event is
+    signalled once the lookup is finished. Calling the function again with
+    the same address then returns the result. */
+int nn_resolve_start (struct nn_resolve *self, const char *addr,
+    size_t addrlen, int flags, struct sockaddr_storage *result,
+    nn_socklen *resultlen, int count);
+
+#endif
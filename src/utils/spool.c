@@ -0,0 +1,395 @@
+/*
+    Copyright (c) 2012-2013 250bpm s.r.o.
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"),
+    to deal in the Software without restriction, including without limitation
+    the rights to use, copy, modify, merge, publish, distribute, sublicense,
+    and/or sell copies of the Software, and to permit persons to whom
+    the Software is furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included
+    in all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+    THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+    FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+    IN THE SOFTWARE.
+*/
+
+#if !defined NN_HAVE_WINDOWS
+
+#include "spool.h"
+#include "err.h"
+#include "fast.h"
+#include "alloc.h"
+#include "wire.h"
+
+#include <string.h>
+#include <stdio.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+/*  Special values of the first word of a record. */
+#define NN_SPOOL_END 0
+#define NN_SPOOL_NEXT 0xffffffffffffffffULL
+#define NN_SPOOL_READ 0x8000000000000000ULL
+
+/*  Size of the two words preceding the data of a record. */
+#define NN_SPOOL_RECHDR 16
+
+/*  Length of a segment file name, "%016llx.spool". */
+#define NN_SPOOL_NAMELEN 22
+
+/*  Private functions. */
+static void nn_spool_path (struct nn_spool *self, uint64_t id, char *path);
+static void nn_spool_unlink (struct nn_spool *self, uint64_t id);
+static int nn_spool_open (struct nn_spool *self, struct nn_spool_seg *seg,
+    uint64_t id, size_t size);
+static void nn_spool_close (struct nn_spool_seg *seg);
+static size_t nn_spool_reclen (const uint8_t *rec);
+static int nn_spool_recover (struct nn_spool *self, uint64_t first,
+    uint64_t last);
+static int nn_spool_roll (struct nn_spool *self, size_t reclen);
+static void nn_spool_seek (struct nn_spool *self);
+
+int nn_spool_init (struct nn_spool *self, const char *dir, size_t dirlen)
+{
+    int rc;
+    DIR *d;
+    struct dirent *ent;
+    unsigned long long id;
+    uint64_t first;
+    uint64_t last;
+    int found;
+
+    self->dir = nn_alloc (dirlen + 1, "spool directory");
+    alloc_assert (self->dir);
+    memcpy (self->dir, dir, dirlen);
+    self->dir [dirlen] = 0;
+    self->wseg.map = NULL;
+    self->rseg.map = NULL;
+
+    rc = mkdir (self->dir, 0700);
+    if (rc < 0 && errno != EEXIST) {
+        rc = -errno;
+        nn_free (self->dir);
+        return rc;
+    }
+
+    /*  Find the segments left over by the previous run. */
+    d = opendir (self->dir);
+    if (!d) {
+        rc = -errno;
+        nn_free (self->dir);
+        return rc;
+    }
+    found = 0;
+    first = 0;
+    last = 0;
+    while ((ent = readdir (d)) != NULL) {
+        if (strlen (ent->d_name) != NN_SPOOL_NAMELEN ||
+              strcmp (ent->d_name + 16, ".spool") != 0 ||
+              sscanf (ent->d_name, "%16llx", &id) != 1)
+            continue;
+        if (!found || id < first)
+            first = id;
+        if (!found || id > last)
+            last = id;
+        found = 1;
+    }
+    closedir (d);
+
+    if (found)
+        rc = nn_spool_recover (self, first, last);
+    else {
+        rc = nn_spool_open (self, &self->wseg, 0, NN_SPOOL_SEGMENT);
+        self->wpos = 0;
+        self->rid = 0;
+        self->rpos = 0;
+    }
+    if (nn_slow (rc < 0)) {
+        nn_spool_close (&self->rseg);
+        nn_spool_close (&self->wseg);
+        nn_free (self->dir);
+        return rc;
+    }
+
+    return 0;
+}
+
+void nn_spool_term (struct nn_spool *self)
+{
+    /*  Don't leave an empty segment behind. */
+    if (nn_spool_empty (self))
+        nn_spool_unlink (self, self->wseg.id);
+
+    nn_spool_close (&self->rseg);
+    nn_spool_close (&self->wseg);
+    nn_free (self->dir);
+}
+
+int nn_spool_empty (struct nn_spool *self)
+{
+    return !self->rseg.map && self->rpos == self->wpos;
+}
+
+int nn_spool_put (struct nn_spool *self, struct nn_msg *msg)
+{
+    int rc;
+    size_t hdrsz;
+    size_t bodysz;
+    size_t reclen;
+    uint8_t *rec;
+
+    nn_msg_flatten (msg);
+    hdrsz = nn_chunkref_size (&msg->hdr);
+    bodysz = nn_chunkref_size (&msg->body);
+    reclen = NN_SPOOL_RECHDR + ((hdrsz + bodysz + 7) & ~((size_t) 7));
+
+    if (nn_slow (self->wpos + reclen > self->wseg.size)) {
+        rc = nn_spool_roll (self, reclen);
+        if (nn_slow (rc < 0))
+            return rc;
+    }
+
+    rec = self->wseg.map + self->wpos;
+    nn_putll (rec + 8, bodysz);
+    memcpy (rec + NN_SPOOL_RECHDR, nn_chunkref_data (&msg->hdr), hdrsz);
+    memcpy (rec + NN_SPOOL_RECHDR + hdrsz, nn_chunkref_data (&msg->body),
+        bodysz);
+    nn_putll (rec, hdrsz + 1);
+    self->wpos += reclen;
+
+    nn_msg_term (msg);
+    return 0;
+}
+
+int nn_spool_get (struct nn_spool *self, struct nn_msg *msg)
+{
+    uint8_t *rec;
+    size_t hdrsz;
+    size_t bodysz;
+
+    if (nn_spool_empty (self))
+        return -EAGAIN;
+
+    rec = (self->rseg.map ? self->rseg.map : self->wseg.map) + self->rpos;
+    hdrsz = (size_t) nn_getll (rec) - 1;
+    bodysz = (size_t) nn_getll (rec + 8);
+    nn_msg_init (msg, bodysz);
+    memcpy (nn_chunkref_data (&msg->body), rec + NN_SPOOL_RECHDR + hdrsz,
+        bodysz);
+    if (hdrsz) {
+        nn_chunkref_term (&msg->hdr);
+        nn_chunkref_init (&msg->hdr, hdrsz);
+        memcpy (nn_chunkref_data (&msg->hdr), rec + NN_SPOOL_RECHDR, hdrsz);
+    }
+
+    /*  Mark the record as read so that it's not replayed after restart. */
+    nn_putll (rec, (hdrsz + 1) | NN_SPOOL_READ);
+    self->rpos += nn_spool_reclen (rec);
+    nn_spool_seek (self);
+
+    return 0;
+}
+
+static void nn_spool_path (struct nn_spool *self, uint64_t id, char *path)
+{
+    sprintf (path, "%s/%016llx.spool", self->dir, (unsigned long long) id);
+}
+
+static void nn_spool_unlink (struct nn_spool *self, uint64_t id)
+{
+    char *path;
+
+    path = nn_alloc (strlen (self->dir) + NN_SPOOL_NAMELEN + 2, "spool path");
+    alloc_assert (path);
+    nn_spool_path (self, id, path);
+    unlink (path);
+    nn_free (path);
+}
+
+static int nn_spool_open (struct nn_spool *self, struct nn_spool_seg *seg,
+    uint64_t id, size_t size)
+{
+    int rc;
+    char *path;
+    struct stat st;
+
+    path = nn_alloc (strlen (self->dir) + NN_SPOOL_NAMELEN + 2, "spool path");
+    alloc_assert (path);
+    nn_spool_path (self, id, path);
+
+    /*  Size of zero means opening an existing segment. New segments have
+        their space allocated upfront, so that running out of disk space is
+        reported here rather than by SIGBUS when writing to the mapping. */
+    seg->fd = open (path, size ? O_RDWR | O_CREAT | O_TRUNC : O_RDWR, 0600);
+    if (seg->fd < 0) {
+        rc = -errno;
+        nn_free (path);
+        return rc;
+    }
+    if (size) {
+        rc = posix_fallocate (seg->fd, 0, size);
+        if (nn_slow (rc != 0)) {
+            close (seg->fd);
+            unlink (path);
+            nn_free (path);
+            return -rc;
+        }
+    }
+    else {
+        rc = fstat (seg->fd, &st);
+        errno_assert (rc == 0);
+        size = (size_t) st.st_size & ~((size_t) 7);
+    }
+    nn_free (path);
+
+    seg->map = size ? mmap (NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED,
+        seg->fd, 0) : MAP_FAILED;
+    if (seg->map == MAP_FAILED) {
+        rc = size ? -errno : -EINVAL;
+        close (seg->fd);
+        seg->map = NULL;
+        return rc;
+    }
+    madvise (seg->map, size, MADV_SEQUENTIAL);
+    seg->size = size;
+    seg->id = id;
+
+    return 0;
+}
+
+static void nn_spool_close (struct nn_spool_seg *seg)
+{
+    int rc;
+
+    if (!seg->map)
+        return;
+    rc = munmap (seg->map, seg->size);
+    errno_assert (rc == 0);
+    rc = close (seg->fd);
+    errno_assert (rc == 0);
+    seg->map = NULL;
+}
+
+static size_t nn_spool_reclen (const uint8_t *rec)
+{
+    return NN_SPOOL_RECHDR + (((nn_getll (rec) & ~NN_SPOOL_READ) - 1 +
+        nn_getll (rec + 8) + 7) & ~((uint64_t) 7));
+}
+
+static int nn_spool_recover (struct nn_spool *self, uint64_t first,
+    uint64_t last)
+{
+    int rc;
+    uint64_t word;
+    size_t reclen;
+
+    /*  Find the end of the data in the last segment. A record that doesn't
+        fit into the segment can only be the result of a damaged file and is
+        treated as the end of the data. */
+    rc = nn_spool_open (self, &self->wseg, last, 0);
+    if (nn_slow (rc < 0))
+        return rc;
+    self->wpos = 0;
+    while (self->wpos + NN_SPOOL_RECHDR <= self->wseg.size) {
+        word = nn_getll (self->wseg.map + self->wpos);
+        if (word == NN_SPOOL_END || word == NN_SPOOL_NEXT)
+            break;
+        reclen = nn_spool_reclen (self->wseg.map + self->wpos);
+        if (reclen > self->wseg.size - self->wpos)
+            break;
+        self->wpos += reclen;
+    }
+
+    /*  Start reading from the first segment, skipping the records that were
+        already read. */
+    self->rid = first;
+    self->rpos = 0;
+    if (first != last) {
+        rc = nn_spool_open (self, &self->rseg, first, 0);
+        if (nn_slow (rc < 0))
+            return rc;
+    }
+    nn_spool_seek (self);
+
+    /*  New records are appended at the end of the data, overwriting the
+        remains of a record that was being written when the process died,
+        if any. */
+    return 0;
+}
+
+static int nn_spool_roll (struct nn_spool *self, size_t reclen)
+{
+    int rc;
+    struct nn_spool_seg seg;
+
+    rc = nn_spool_open (self, &seg, self->wseg.id + 1,
+        reclen + 8 > NN_SPOOL_SEGMENT ? reclen + 8 : NN_SPOOL_SEGMENT);
+    if (nn_slow (rc < 0))
+        return rc;
+
+    /*  Tell the reader to continue with the next segment. If the current
+        segment is still being read from, hand it over to the reader. */
+    if (self->wpos + 8 <= self->wseg.size)
+        nn_putll (self->wseg.map + self->wpos, NN_SPOOL_NEXT);
+    if (!self->rseg.map)
+        self->rseg = self->wseg;
+    else
+        nn_spool_close (&self->wseg);
+    self->wseg = seg;
+    self->wpos = 0;
+    nn_spool_seek (self);
+
+    return 0;
+}
+
+static void nn_spool_seek (struct nn_spool *self)
+{
+    uint64_t word;
+    size_t reclen;
+
+    while (1) {
+
+        /*  Reading from the segment being written to. */
+        if (!self->rseg.map) {
+            while (self->rpos != self->wpos &&
+                  nn_getll (self->wseg.map + self->rpos) & NN_SPOOL_READ)
+                self->rpos += nn_spool_reclen (self->wseg.map + self->rpos);
+            return;
+        }
+
+        /*  Skip the records already read. */
+        if (self->rpos + NN_SPOOL_RECHDR <= self->rseg.size) {
+            word = nn_getll (self->rseg.map + self->rpos);
+            if (word != NN_SPOOL_END && word != NN_SPOOL_NEXT) {
+                reclen = nn_spool_reclen (self->rseg.map + self->rpos);
+                if (reclen <= self->rseg.size - self->rpos) {
+                    if (!(word & NN_SPOOL_READ))
+                        return;
+                    self->rpos += reclen;
+                    continue;
+                }
+            }
+        }
+
+        /*  The segment is done with. Delete it and move to the next one.
+            Segments that have disappeared in the meantime are skipped. */
+        nn_spool_unlink (self, self->rid);
+        nn_spool_close (&self->rseg);
+        self->rpos = 0;
+        while (++self->rid != self->wseg.id)
+            if (nn_spool_open (self, &self->rseg, self->rid, 0) == 0)
+                break;
+    }
+}
+
+#endif
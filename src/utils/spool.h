@@ -0,0 +1,95 @@
+/*
+    Copyright (c) 2012-2013 250bpm s.r.o.
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"),
+    to deal in the Software without restriction, including without limitation
+    the rights to use, copy, modify, merge, publish, distribute, sublicense,
+    and/or sell copies of the Software, and to permit persons to whom
+    the Software is furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included
+    in all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+    THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+    FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+    IN THE SOFTWARE.
+*/
+
+#ifndef NN_SPOOL_INCLUDED
+#define NN_SPOOL_INCLUDED
+
+#if !defined NN_HAVE_WINDOWS
+
+#include "msg.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*  Append-only queue of messages stored on disk. The messages are written to
+    a series of memory-mapped segment files named by their sequence number
+    in hexadecimal ("0000000000000000.spool" and so on) in the spool
+    directory. Each record consists of two 64-bit words, the size of the
+    header plus one and the size of the body, followed by the header and the
+    body, padded to a multiple of 8 bytes. The first word is written last,
+    so that zero marks the end of the data, and a record that has been read
+    has its top bit set. Once all the records in a segment are read, the
+    segment file is deleted. The messages that haven't been read survive
+    the process; re-opening the directory continues where the last reader
+    stopped. The object is not thread-safe. */
+
+/*  Default size of a segment file. Messages larger than that get a segment
+    of their own. */
+#ifndef NN_SPOOL_SEGMENT
+#define NN_SPOOL_SEGMENT (64 * 1024 * 1024)
+#endif
+
+struct nn_spool_seg {
+    int fd;
+    uint8_t *map;
+    size_t size;
+    uint64_t id;
+};
+
+struct nn_spool {
+
+    /*  Directory the segment files are stored in. */
+    char *dir;
+
+    /*  The segment being written to and the offset of its end. */
+    struct nn_spool_seg wseg;
+    size_t wpos;
+
+    /*  The segment being read from, if it's not the one being written to.
+        Its map is NULL otherwise. */
+    struct nn_spool_seg rseg;
+    uint64_t rid;
+    size_t rpos;
+};
+
+/*  Opens the spool in the specified directory, creating the directory if
+    needed. If there are messages left in the directory from the previous
+    run, they are read first. */
+int nn_spool_init (struct nn_spool *self, const char *dir, size_t dirlen);
+
+/*  Closes the spool. The messages that haven't been read are left on
+    disk. */
+void nn_spool_term (struct nn_spool *self);
+
+/*  Returns 1 if there are no messages in the spool, 0 otherwise. */
+int nn_spool_empty (struct nn_spool *self);
+
+/*  Appends the message to the spool. On success the message is consumed. */
+int nn_spool_put (struct nn_spool *self, struct nn_msg *msg);
+
+/*  Removes the oldest message from the spool. Returns -EAGAIN if the spool
+    is empty. */
+int nn_spool_get (struct nn_spool *self, struct nn_msg *msg);
+
+#endif
+
+#endif
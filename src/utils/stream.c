@@ -26,11 +26,52 @@
 #include "cont.h"
 #include "wire.h"
 #include "fast.h"
+#include "trace.h"
+#include "lz4.h"
+#include "crc32c.h"
+#include "ws.h"
+#include "alloc.h"
+#include "clock.h"
+#include "random.h"
 
 #include <string.h>
 #include <stdint.h>
 
+/*  Flag in the protocol header announcing that the peer is able to receive
+    messages passed by file descriptor. */
+#define NN_STREAM_HDR_FDS 1
+
+/*  Flag in the protocol header announcing that the peer is able to receive
+    compressed messages. */
+#define NN_STREAM_HDR_LZ4 2
+
+/*  Flag in the protocol header announcing that the peer is able to receive
+    messages sent in chunks. */
+#define NN_STREAM_HDR_CHUNKS 4
+
+/*  Flag in the protocol header announcing that the peer is able to receive
+    messages with compact headers. */
+#define NN_STREAM_HDR_COMPACT 8
+
+/*  Flag in the protocol header announcing that the peer is able to send and
+    receive heartbeats. */
+#define NN_STREAM_HDR_HEARTBEAT 16
+
+/*  Flag in the protocol header announcing that the peer is able to receive
+    the time-to-live frames. */
+#define NN_STREAM_HDR_TTL 32
+
+/*  Flag in the protocol header announcing that the peer is able to receive
+    the trace context frames. */
+#define NN_STREAM_HDR_TRACE 64
+
+/*  Flag in the protocol header announcing that the peer is able to receive
+    the checksum frames. */
+#define NN_STREAM_HDR_CRC 128
+
 /*   Private functions. */
+static void nn_stream_init_aux (struct nn_stream *self,
+    struct nn_epbase *epbase, struct nn_usock *usock, const uint8_t *hdr);
 static void nn_stream_hdr_received (const struct nn_cp_sink **self,
     struct nn_usock *usock);
 static void nn_stream_hdr_sent (const struct nn_cp_sink **self,
@@ -43,6 +84,114 @@ static void nn_stream_sent (const struct nn_cp_sink **self,
     struct nn_usock *usock);
 static void nn_stream_err (const struct nn_cp_sink **self,
     struct nn_usock *usock, int errnum);
+static void nn_stream_batch_init (struct nn_stream_batch *self);
+static void nn_stream_batch_term (struct nn_stream_batch *self);
+static void nn_stream_batch_add (struct nn_stream_batch *self,
+    struct nn_msg *msg, int fdpassing, int compressed, int chunks,
+    int compact, int64_t ttl, int traced, int crc);
+static void nn_stream_batch_inline (struct nn_stream_batch *self, int i);
+static size_t nn_stream_hdrlen (uint8_t byte);
+static uint64_t nn_stream_getsize (const uint8_t *hdr);
+static void nn_stream_framehdr (struct nn_stream *self, uint64_t size);
+static void nn_stream_settrace (struct nn_stream *self, struct nn_msg *msg);
+static void nn_stream_setdeadline (struct nn_stream *self, uint64_t ttl,
+    uint64_t tstamp);
+static int nn_stream_batch_isfull (struct nn_stream_batch *self,
+    int maxmsgs, size_t maxbytes);
+static size_t nn_stream_msgsize (struct nn_msg *msg);
+static void nn_stream_pump (struct nn_stream *self);
+static int nn_stream_flush (struct nn_stream *self);
+static int nn_stream_chunk (struct nn_stream *self, struct nn_msg *msg,
+    struct nn_iobuf *iov);
+static int nn_stream_getfile (struct nn_msg *msg, uint64_t *offset);
+static int nn_stream_isfull (struct nn_stream *self);
+static void nn_stream_unblock (struct nn_stream *self);
+static void nn_stream_parse (struct nn_stream *self);
+static void nn_stream_initmsg (struct nn_stream *self, struct nn_msg *msg,
+    size_t size);
+static int nn_stream_checkcrc (struct nn_stream *self);
+static uint32_t nn_stream_crc (struct nn_msg *msg);
+static int nn_stream_mapfd (struct nn_stream *self);
+static int nn_stream_compress (struct nn_stream *self, struct nn_msg *msg);
+static int nn_stream_decompress (struct nn_stream *self);
+static void nn_stream_tls_received (const struct nn_cp_sink **self,
+    struct nn_usock *usock);
+static void nn_stream_tls_sent (const struct nn_cp_sink **self,
+    struct nn_usock *usock);
+static void nn_stream_tls_step (struct nn_stream *self, const void *data,
+    size_t len);
+static void nn_stream_tls_next (struct nn_stream *self);
+static void nn_stream_start (struct nn_stream *self);
+static void nn_stream_recvnext (struct nn_stream *self);
+static void nn_stream_recvhdr (struct nn_stream *self);
+static void nn_stream_recvchunk (struct nn_stream *self);
+static void nn_stream_recvrecs (struct nn_stream *self);
+static int nn_stream_parserecs (struct nn_stream *self);
+static int nn_stream_bulkrecs (struct nn_stream *self);
+static void nn_stream_sendrecs (struct nn_stream *self,
+    struct nn_stream_batch *batch, int first);
+static int nn_stream_records (struct nn_stream *self, struct nn_msg *msg,
+    struct nn_iobuf *iov, int *reciovs, int *iovcnt);
+static int nn_stream_slice (struct nn_msg *msg, size_t pos, size_t len,
+    struct nn_iobuf *iov);
+static void nn_stream_queue (struct nn_stream *self,
+    struct nn_stream_batch *batch, struct nn_msg *msg, int compressed);
+static void nn_stream_ws_sent (const struct nn_cp_sink **self,
+    struct nn_usock *usock);
+static void nn_stream_ws_received (const struct nn_cp_sink **self,
+    struct nn_usock *usock);
+static void nn_stream_ws_done (struct nn_stream *self);
+static void nn_stream_ws_frame (struct nn_stream *self);
+static void nn_stream_ws_body (struct nn_stream *self);
+static void nn_stream_ws_control (struct nn_stream *self);
+static void nn_stream_ws_sendctl (struct nn_stream *self, int opcode,
+    const void *data, size_t len);
+static void nn_stream_batch_addhb (struct nn_stream_batch *self);
+static void nn_stream_tick (struct nn_tick *tick);
+static void nn_stream_outflush (struct nn_flush *flush);
+static void nn_stream_batch_addws (struct nn_stream_batch *self,
+    struct nn_msg *msg, int opcode, int masked);
+static void nn_stream_take (struct nn_stream *self, size_t size);
+static void nn_stream_give (struct nn_stream *self, size_t size);
+static void nn_stream_budget_ready (struct nn_budget_waiter *waiter);
+static void nn_stream_budget_event (const struct nn_cp_sink **self,
+    struct nn_event *event);
+
+/*  TLS state. The TLS handshake is in progress. */
+static const struct nn_cp_sink nn_stream_state_tls = {
+    nn_stream_tls_received,
+    nn_stream_tls_sent,
+    NULL,
+    NULL,
+    nn_stream_err,
+    NULL,
+    nn_stream_hdr_timeout,
+    NULL
+};
+
+/*  WebSocket handshake states. The HTTP request or response is being sent
+    or received. */
+static const struct nn_cp_sink nn_stream_state_wssend = {
+    NULL,
+    nn_stream_ws_sent,
+    NULL,
+    NULL,
+    nn_stream_err,
+    NULL,
+    nn_stream_hdr_timeout,
+    NULL
+};
+
+static const struct nn_cp_sink nn_stream_state_wsrecv = {
+    nn_stream_ws_received,
+    NULL,
+    NULL,
+    NULL,
+    nn_stream_err,
+    NULL,
+    nn_stream_hdr_timeout,
+    NULL
+};
 
 /*  START state. */
 static const struct nn_cp_sink nn_stream_state_start = {
@@ -56,16 +205,17 @@ static const struct nn_cp_sink nn_stream_state_start = {
     NULL
 };
 
-/*  SENT state. */
+/*  SENT state. Messages can already be sent to the peer while its protocol
+    header is still awaited. */
 static const struct nn_cp_sink nn_stream_state_sent = {
     nn_stream_hdr_received,
-    NULL,
+    nn_stream_sent,
     NULL,
     NULL,
     nn_stream_err,
     NULL,
     nn_stream_hdr_timeout,
-    NULL
+      nn_stream_budget_event
 };
 
 /*  ACTIVE state. */
@@ -77,24 +227,41 @@ static const struct nn_cp_sink nn_stream_state_active = {
     nn_stream_err,
     NULL,
     NULL,
-    NULL
+      nn_stream_budget_event
 };
 
 /*  Pipe interface. */
 static int nn_stream_send (struct nn_pipebase *self, struct nn_msg *msg);
 static int nn_stream_recv (struct nn_pipebase *self, struct nn_msg *msg);
+static void nn_stream_close (struct nn_pipebase *self);
 const struct nn_pipebase_vfptr nn_stream_pipebase_vfptr = {
     nn_stream_send,
-    nn_stream_recv
+    nn_stream_recv,
+    nn_stream_close
 };
 
 void nn_stream_init (struct nn_stream *self, struct nn_epbase *epbase,
     struct nn_usock *usock)
+{
+    nn_stream_init_aux (self, epbase, usock, NULL);
+}
+
+void nn_stream_adopt (struct nn_stream *self, struct nn_epbase *epbase,
+    struct nn_usock *usock, const uint8_t *hdr)
+{
+    nn_stream_init_aux (self, epbase, usock, hdr);
+}
+
+static void nn_stream_init_aux (struct nn_stream *self,
+    struct nn_epbase *epbase, struct nn_usock *usock, const uint8_t *hdr)
 {
     int rc;
     int protocol;
+    int timeout;
+    int server;
+    int val;
     size_t sz;
-    struct nn_iobuf iobuf;
+    struct nn_tls *tls;
 
     /*  Redirect the underlying socket's events to this state machine. */
     self->usock = usock;
@@ -106,30 +273,232 @@ void nn_stream_init (struct nn_stream *self, struct nn_epbase *epbase,
     nn_assert (rc == 0);
 
     nn_msg_init (&self->inmsg, 0);
-    nn_msg_init (&self->outmsg, 0);
+    self->intstamp = 0;
+    self->indeadline = 0;
+    self->intraced = 0;
+    self->incrc = 0;
+    self->incrcset = 0;
+    self->inbulksize = 0;
+    self->fdpassing = 0;
+    self->chunks = 0;
+    self->compact = 0;
+    self->ttl = 0;
+    self->trace = 0;
+    self->crc = 0;
+    self->compress = 0;
+    nn_tls_session_init (&self->tls);
+    self->tlsdone = 0;
+    self->ws = nn_usock_getws (usock, &self->wsserver);
+    self->seqpacket = nn_usock_isseqpacket (usock);
+    self->inrecs = NULL;
+    self->indgrams = NULL;
+    self->wsbuf = NULL;
+    self->wsfrag = 0;
+    self->incount = 0;
+    self->inpos = 0;
+    self->outstate = NN_STREAM_OUTSTATE_IDLE;
+    nn_stream_batch_init (&self->outbatches [0]);
+    nn_stream_batch_init (&self->outbatches [1]);
+    self->outbatch = 0;
+    self->outmsg = 0;
+    self->outpos = 0;
+    self->outfd = 0;
+    self->outfile = -1;
+    self->outurgent = NULL;
+    self->outurgentbatch = 0;
+    self->outstatus = NULL;
+    self->outblocked = 0;
+
+    /*  Limit the number of messages held by the library. The message
+        being sent or received at the moment counts towards the limit. */
+    sz = sizeof (val);
+    nn_epbase_getopt (epbase, NN_SOL_SOCKET, NN_RCVBUFMSGS, &val, &sz);
+    nn_assert (sz == sizeof (val));
+    self->inmaxmsgs = val > 0 && val <= NN_STREAM_BATCH_MSGS ?
+        val - 1 : NN_STREAM_BATCH_MSGS;
+    sz = sizeof (val);
+    nn_epbase_getopt (epbase, NN_SOL_SOCKET, NN_SNDBUFMSGS, &val, &sz);
+    nn_assert (sz == sizeof (val));
+    self->outmaxmsgs = val > 0 && val < NN_STREAM_BATCH_MSGS ?
+        val : NN_STREAM_BATCH_MSGS;
+    sz = sizeof (val);
+    nn_epbase_getopt (epbase, NN_SOL_SOCKET, NN_SNDBUF, &val, &sz);
+    nn_assert (sz == sizeof (val));
+    self->outmaxbytes = (size_t) val < NN_STREAM_BATCH_BYTES ?
+        (size_t) val : NN_STREAM_BATCH_BYTES;
+    sz = sizeof (val);
+    nn_epbase_getopt (epbase, NN_SOL_SOCKET, NN_SNDLOWAT, &val, &sz);
+    nn_assert (sz == sizeof (val));
+    self->outlowat = val < 0 ? (size_t) -1 : (size_t) val;
+    sz = sizeof (val);
+    nn_epbase_getopt (epbase, NN_SOL_SOCKET, NN_SNDLOWATMSGS, &val, &sz);
+    nn_assert (sz == sizeof (val));
+    self->outlowatmsgs = val < 0 ? (size_t) -1 : (size_t) val;
+    self->outfull = 0;
+    sz = sizeof (val);
+    nn_epbase_getopt (epbase, NN_SOL_SOCKET, NN_SNDBATCH, &val, &sz);
+    nn_assert (sz == sizeof (val));
+    self->outdelay = val;
+    sz = sizeof (val);
+    nn_epbase_getopt (epbase, NN_SOL_SOCKET, NN_SNDBATCHBYTES, &val, &sz);
+    nn_assert (sz == sizeof (val));
+    self->outdelaybytes = val > 0 && (size_t) val < self->outmaxbytes ?
+        (size_t) val : self->outmaxbytes;
+    nn_flush_init (&self->outflush, nn_stream_outflush, usock->cp);
+
+    /*  Ask the kernel to timestamp the incoming data, if requested. Where
+        that's not possible the messages simply carry no timestamp. */
+    sz = sizeof (val);
+    nn_epbase_getopt (epbase, NN_SOL_SOCKET, NN_RCVTIMESTAMP, &val, &sz);
+    nn_assert (sz == sizeof (val));
+    self->tstamping = 0;
+    if (val) {
+        nn_usock_settstamp (usock, 1);
+        self->tstamping = 1;
+    }
+
+    /*  Check whether the user wants to receive large messages chunk by
+        chunk. */
+    sz = sizeof (val);
+    nn_epbase_getopt (epbase, NN_SOL_SOCKET, NN_RCVCHUNKS, &val, &sz);
+    nn_assert (sz == sizeof (val));
+    self->rcvchunks = self->seqpacket ? 0 : val;
+
+    /*  Check where the user wants the incoming messages to be stored. */
+    sz = sizeof (val);
+    nn_epbase_getopt (epbase, NN_SOL_SOCKET, NN_RCVALLOC, &val, &sz);
+    nn_assert (sz == sizeof (val));
+    self->rcvalloc = val;
+
+    /*  Heartbeats are set up once the peer's protocol header arrives. */
+    sz = sizeof (val);
+    nn_epbase_getopt (epbase, NN_SOL_SOCKET, NN_HEARTBEAT_IVL, &val, &sz);
+    nn_assert (sz == sizeof (val));
+    self->hbivl = val;
+    sz = sizeof (val);
+    nn_epbase_getopt (epbase, NN_SOL_SOCKET, NN_HEARTBEAT_MISSES, &val, &sz);
+    nn_assert (sz == sizeof (val));
+    self->hbmisses = val;
+    self->hbsend = 0;
+    self->hbtimeout = 0;
+    self->hbsent = 0;
+    self->hbrecvd = 0;
+    nn_tick_init (&self->hbtick, nn_stream_tick, usock->cp);
+
+    /*  Messages held by the pipe draw from the socket's memory budget. */
+    self->budget = nn_epbase_getbudget (epbase);
+    self->inbudget = 0;
+    self->inblocked = 0;
+    nn_budget_waiter_init (&self->budgetwaiter, nn_stream_budget_ready);
+    nn_event_init (&self->budgetevent, &self->sink, usock->cp);
 
-    /*  Start the header timeout timer. */
+    /*  Start the header timeout timer. It covers the TLS handshake, if any,
+        as well. */
+    sz = sizeof (timeout);
+    nn_epbase_getopt (epbase, NN_SOL_SOCKET, NN_HANDSHAKE_TIMEOUT,
+        &timeout, &sz);
+    nn_assert (sz == sizeof (timeout));
     nn_timer_init (&self->hdr_timeout, &self->sink, usock->cp);
-    nn_timer_start (&self->hdr_timeout, 1000);
+    if (timeout >= 0 && !hdr)
+        nn_timer_start (&self->hdr_timeout, timeout);
 
-    /*  Send the protocol header. */
+    /*  Prepare the protocol header. */
     sz = sizeof (protocol);
     nn_epbase_getopt (epbase, NN_SOL_SOCKET, NN_PROTOCOL, &protocol, &sz);
     errnum_assert (rc == 0, -rc);
     nn_assert (sz == sizeof (protocol));
     memcpy (self->protohdr, "\0\0SP\0\0\0\0", 8);
     nn_puts (self->protohdr + 4, (uint16_t) protocol);
-    iobuf.iov_base = self->protohdr;
-    iobuf.iov_len = 8;
-    nn_usock_send (usock, &iobuf, 1);
+#if defined NN_USE_MEMFD
+    if (nn_usock_getfdpassing (usock) && !self->seqpacket)
+        self->protohdr [7] |= NN_STREAM_HDR_FDS;
+#endif
+    if (!self->seqpacket)
+        self->protohdr [7] |= NN_STREAM_HDR_LZ4 | NN_STREAM_HDR_CHUNKS |
+            NN_STREAM_HDR_COMPACT | NN_STREAM_HDR_HEARTBEAT |
+            NN_STREAM_HDR_TTL | NN_STREAM_HDR_TRACE | NN_STREAM_HDR_CRC;
+
+    /*  Ask the peer for heartbeats at least as often as the local ones. */
+    if (self->hbivl > 0 && !self->seqpacket)
+        self->protohdr [6] = self->hbivl >= 255 * NN_STREAM_HEARTBEAT_UNIT ?
+            255 : self->hbivl < NN_STREAM_HEARTBEAT_UNIT ?
+            1 : (uint8_t) (self->hbivl / NN_STREAM_HEARTBEAT_UNIT);
+
+    /*  The connection taken over from another process is past the protocol
+        header exchange. Carry on as if the peer's header has just arrived. */
+    if (hdr) {
+        memcpy (self->protohdr, hdr, 8);
+        nn_pipebase_activate (&self->pipebase);
+        nn_stream_hdr_received (&self->sink, usock);
+        return;
+    }
+
+    /*  WebSocket server announces its own protocol, the client asks for
+        the protocol of its peer. */
+    if (self->ws) {
+        self->wsaddr = nn_epbase_getaddr (epbase);
+        self->wsproto = self->wsserver ? nn_ws_protoname (protocol) :
+            nn_ws_peername (protocol);
+        if (nn_slow (!self->wsproto)) {
+            nn_stream_err (&self->sink, usock, EPROTONOSUPPORT);
+            return;
+        }
+    }
+
+    /*  If the connection is to be secured, start with the TLS handshake.
+        The records are read one by one, without read-ahead, so that no
+        data encrypted by the peer are read before the keys are passed to
+        the kernel. */
+    tls = nn_usock_gettls (usock, &server);
+    if (tls) {
+        rc = nn_tls_session_start (&self->tls, tls, server);
+        errnum_assert (rc == 0, -rc);
+        nn_usock_setreadahead (usock, 0);
+        self->sink = &nn_stream_state_tls;
+        nn_stream_tls_step (self, NULL, 0);
+        return;
+    }
+
+    nn_stream_start (self);
 }
 
 void nn_stream_term (struct nn_stream *self)
 {
     /*  Close the messages in progress. */
     nn_msg_term (&self->inmsg);
-    nn_msg_term (&self->outmsg);
+    if (self->inbulksize && !self->rcvchunks)
+        nn_msg_term (&self->inbulk);
+    while (self->inpos != self->incount)
+        nn_msg_term (&self->inqueue [self->inpos++]);
+    nn_stream_give (self, self->inbudget + self->outbatches [0].budget +
+        self->outbatches [1].budget);
+    nn_stream_batch_term (&self->outbatches [0]);
+    nn_stream_batch_term (&self->outbatches [1]);
+    if (self->outurgent) {
+        nn_stream_give (self, self->outurgent [0].budget +
+            self->outurgent [1].budget);
+        nn_stream_batch_term (&self->outurgent [0]);
+        nn_stream_batch_term (&self->outurgent [1]);
+        nn_free (self->outurgent);
+        self->outurgent = NULL;
+    }
+    nn_tls_session_term (&self->tls);
+    if (self->wsbuf) {
+        nn_free (self->wsbuf);
+        self->wsbuf = NULL;
+    }
+    if (self->inrecs) {
+        nn_free (self->inrecs);
+        nn_free (self->indgrams);
+        self->inrecs = NULL;
+    }
 
+    nn_tick_term (&self->hbtick);
+    nn_flush_term (&self->outflush);
+    if (self->budget)
+        nn_budget_cancel (self->budget, &self->budgetwaiter);
+    nn_budget_waiter_term (&self->budgetwaiter);
+    nn_event_term (&self->budgetevent);
     nn_timer_term (&self->hdr_timeout);
     nn_pipebase_term (&self->pipebase);
 
@@ -137,159 +506,2136 @@ void nn_stream_term (struct nn_stream *self)
     nn_usock_setsink (self->usock, self->original_sink);
 }
 
-static void nn_stream_hdr_sent (const struct nn_cp_sink **self,
+int nn_stream_handoff (struct nn_stream *self, uint8_t *hdr)
+{
+    int server;
+
+    /*  The headers must have been exchanged. The state of TLS, WebSocket and
+        record-based connections is not passed over. */
+    if (self->sink != &nn_stream_state_active || self->ws ||
+          self->seqpacket || nn_usock_gettls (self->usock, &server))
+        return -EAGAIN;
+
+    /*  The connection must be at a message boundary in both directions,
+        with no messages held by the pipe. */
+    if (self->instate != NN_STREAM_INSTATE_HDR || self->inblocked ||
+          self->inpos != self->incount || self->indeadline ||
+          self->intraced || self->incrcset || self->inbulksize ||
+          !nn_pipebase_isreceiving (&self->pipebase))
+        return -EAGAIN;
+    if (self->outstate != NN_STREAM_OUTSTATE_IDLE ||
+          self->outbatches [0].count || self->outbatches [1].count)
+        return -EAGAIN;
+    if (self->outurgent &&
+          (self->outurgent [0].count || self->outurgent [1].count))
+        return -EAGAIN;
+    if (!nn_usock_isidle (self->usock, self->inhdr))
+        return -EAGAIN;
+
+    /*  The negotiated features follow from the peer's protocol header. */
+    memcpy (hdr, self->protohdr, 8);
+    return 0;
+}
+
+static void nn_stream_tls_received (const struct nn_cp_sink **self,
     struct nn_usock *usock)
 {
     struct nn_stream *stream;
+    size_t len;
 
     stream = nn_cont (self, struct nn_stream, sink);
+    switch (stream->instate) {
+    case NN_STREAM_INSTATE_HDR:
 
-    stream->sink = &nn_stream_state_sent;
+        /*  Record header was received. Check the length of the record and
+            read the record itself. */
+        len = nn_gets (stream->tls.in + 3);
+        if (nn_slow (len == 0 || len > NN_TLS_MAX_RECORD)) {
+            nn_stream_err (self, usock, EPROTO);
+            return;
+        }
+        stream->instate = NN_STREAM_INSTATE_BODY;
+        nn_usock_recv (usock, stream->tls.in + NN_TLS_RECORD_HDR, len);
+        return;
+    case NN_STREAM_INSTATE_BODY:
 
-    /*  Receive the protocol header from the peer. */
-    nn_usock_recv (usock, stream->protohdr, 8);
+        /*  Whole record was received. Pass it to the TLS engine. */
+        len = nn_gets (stream->tls.in + 3);
+        nn_stream_tls_step (stream, stream->tls.in, NN_TLS_RECORD_HDR + len);
+        return;
+    default:
+        nn_assert (0);
+    }
 }
 
-static void nn_stream_hdr_received (const struct nn_cp_sink **self,
+static void nn_stream_tls_sent (const struct nn_cp_sink **self,
     struct nn_usock *usock)
 {
     struct nn_stream *stream;
-    int protocol;
 
     stream = nn_cont (self, struct nn_stream, sink);
+    nn_stream_tls_next (stream);
+}
 
-    stream->sink = &nn_stream_state_active;
-    nn_timer_stop (&stream->hdr_timeout);
+static void nn_stream_tls_step (struct nn_stream *self, const void *data,
+    size_t len)
+{
+    int rc;
+    struct nn_iobuf iobuf;
 
-    /*  TODO: If it does not conform, drop the connection. */
-    protocol = nn_gets (stream->protohdr + 4);
-    if (!nn_pipebase_ispeer (&stream->pipebase, protocol))
-        nn_assert (0);
+    rc = nn_tls_session_handshake (&self->tls, data, len);
+    if (nn_slow (rc < 0)) {
+        nn_stream_err (&self->sink, self->usock, -rc);
+        return;
+    }
+    self->tlsdone = rc;
 
-    /*  Connection is ready for sending. Make outpipe available
-        to the SP socket. */
-    nn_pipebase_activate (&stream->pipebase);
+    /*  Send the handshake data to the peer, if any. */
+    if (self->tls.outlen) {
+        iobuf.iov_base = self->tls.out;
+        iobuf.iov_len = self->tls.outlen;
+        nn_usock_send (self->usock, &iobuf, 1);
+        return;
+    }
+    nn_stream_tls_next (self);
+}
+
+static void nn_stream_tls_next (struct nn_stream *self)
+{
+    int rc;
+
+    /*  If the handshake is not yet done, read next record header. */
+    if (!self->tlsdone) {
+        self->instate = NN_STREAM_INSTATE_HDR;
+        nn_usock_recv (self->usock, self->tls.in, NN_TLS_RECORD_HDR);
+        return;
+    }
 
-    /*  Start waiting for incoming messages. First, read the 8-byte size. */
-    stream->instate = NN_STREAM_INSTATE_HDR;
-    nn_usock_recv (stream->usock, stream->inhdr, 8);
+    /*  Hand the connection over to kernel TLS. */
+    rc = nn_tls_session_offload (&self->tls, self->usock);
+    if (nn_slow (rc < 0)) {
+        nn_stream_err (&self->sink, self->usock, -rc);
+        return;
+    }
+    nn_tls_session_term (&self->tls);
+    nn_usock_setreadahead (self->usock, 1);
+
+    /*  Proceed with the protocol header exchange. */
+    self->sink = &nn_stream_state_start;
+    nn_stream_start (self);
 }
 
-static void nn_stream_hdr_timeout (const struct nn_cp_sink **self,
-    struct nn_timer *timer)
+static void nn_stream_start (struct nn_stream *self)
 {
-    struct nn_stream *stream;
-    const struct nn_cp_sink **original_sink;
+    int rc;
+    const char *host;
+    const char *path;
+    size_t hostlen;
+    struct nn_iobuf iobuf;
 
-    /*  The initial protocol header exchange have timed out. */
-    stream = nn_cont (self, struct nn_stream, sink);
-    original_sink = stream->original_sink;
+    /*  Send the protocol header. */
+    if (!self->ws) {
+        iobuf.iov_base = self->protohdr;
+        iobuf.iov_len = 8;
+        nn_usock_send (self->usock, &iobuf, 1);
+        return;
+    }
 
-    /*  Terminate the session object. */
-    nn_stream_term (stream);
+    self->wsbuf = nn_alloc (NN_WS_MAXHANDSHAKE, "websocket handshake");
+    alloc_assert (self->wsbuf);
+    self->wslen = 0;
 
-    /*  Notify the parent state machine about the failure. */
-    nn_assert ((*original_sink)->err);
-    (*original_sink)->err (original_sink, stream->usock, ETIMEDOUT);
+    /*  The server waits for the request of the client. */
+    if (self->wsserver) {
+        self->sink = &nn_stream_state_wsrecv;
+        nn_usock_recv (self->usock, self->wsbuf, 1);
+        return;
+    }
+
+    /*  The address is in "[local;]host:port[/path]" format. */
+    host = strchr (self->wsaddr, ';');
+    host = host ? host + 1 : self->wsaddr;
+    path = strchr (host, '/');
+    hostlen = path ? (size_t) (path - host) : strlen (host);
+    rc = nn_ws_request (self->wsbuf, NN_WS_MAXHANDSHAKE, host, hostlen,
+        path ? path : "/", self->wsproto, self->wskey);
+    if (nn_slow (rc < 0)) {
+        nn_stream_err (&self->sink, self->usock, -rc);
+        return;
+    }
+    self->sink = &nn_stream_state_wssend;
+    iobuf.iov_base = self->wsbuf;
+    iobuf.iov_len = (size_t) rc;
+    nn_usock_send (self->usock, &iobuf, 1);
 }
 
-static void nn_stream_received (const struct nn_cp_sink **self,
+static void nn_stream_ws_sent (const struct nn_cp_sink **self,
     struct nn_usock *usock)
 {
     struct nn_stream *stream;
-    uint64_t size;
 
     stream = nn_cont (self, struct nn_stream, sink);
-    switch (stream->instate) {
-    case NN_STREAM_INSTATE_HDR:
-        size = nn_getll (stream->inhdr);
-        nn_msg_term (&stream->inmsg);
-        nn_msg_init (&stream->inmsg, (size_t) size);
-        if (!size) {
-            nn_pipebase_received (&stream->pipebase);
-            break;
-        }
-        stream->instate = NN_STREAM_INSTATE_BODY;
-        nn_usock_recv (stream->usock, nn_chunkref_data (&stream->inmsg.body),
-            (size_t) size);
-        break;
-    case NN_STREAM_INSTATE_BODY:
-        nn_pipebase_received (&stream->pipebase);
-        break;
-    default:
-        nn_assert (0);
+
+    /*  The server has accepted the connection. */
+    if (stream->wsserver) {
+        nn_stream_ws_done (stream);
+        return;
     }
+
+    /*  The client waits for the response. */
+    stream->sink = &nn_stream_state_wsrecv;
+    stream->wslen = 0;
+    nn_usock_recv (usock, stream->wsbuf, 1);
 }
 
-static void nn_stream_sent (const struct nn_cp_sink **self,
+static void nn_stream_ws_received (const struct nn_cp_sink **self,
     struct nn_usock *usock)
 {
+    int rc;
     struct nn_stream *stream;
+    const uint8_t *data;
+    const char *path;
+    struct nn_iobuf iobuf;
 
     stream = nn_cont (self, struct nn_stream, sink);
-    nn_pipebase_sent (&stream->pipebase);
-    nn_msg_term (&stream->outmsg);
-    nn_msg_init (&stream->outmsg, 0);
+    ++stream->wslen;
+
+    /*  Take the data that were already read from the socket, but not past
+        the end of the handshake. The peer may have sent frames after it. */
+    while (!nn_ws_iscomplete (stream->wsbuf, stream->wslen)) {
+        if (nn_slow (stream->wslen == NN_WS_MAXHANDSHAKE)) {
+            nn_stream_err (self, usock, EPROTO);
+            return;
+        }
+        if (!nn_usock_peek (usock, (const void**) &data)) {
+            nn_usock_recv (usock, stream->wsbuf + stream->wslen, 1);
+            return;
+        }
+        stream->wsbuf [stream->wslen++] = (char) *data;
+        nn_usock_consume (usock, 1);
+    }
+
+    if (!stream->wsserver) {
+        rc = nn_ws_checkresponse (stream->wsbuf, stream->wslen,
+            stream->wskey, stream->wsproto);
+        if (nn_slow (rc < 0)) {
+            nn_stream_err (self, usock, -rc);
+            return;
+        }
+        nn_stream_ws_done (stream);
+        return;
+    }
+
+    /*  Check the request and send the response. */
+    path = strchr (stream->wsaddr, '/');
+    rc = nn_ws_response (stream->wsbuf, stream->wslen, NN_WS_MAXHANDSHAKE,
+        path ? path : "/", stream->wsproto);
+    if (nn_slow (rc < 0)) {
+        nn_stream_err (self, usock, -rc);
+        return;
+    }
+    stream->sink = &nn_stream_state_wssend;
+    iobuf.iov_base = stream->wsbuf;
+    iobuf.iov_len = (size_t) rc;
+    nn_usock_send (usock, &iobuf, 1);
 }
 
-static void nn_stream_err (const struct nn_cp_sink **self,
-    struct nn_usock *usock, int errnum)
+static void nn_stream_ws_done (struct nn_stream *self)
+{
+    nn_free (self->wsbuf);
+    self->wsbuf = NULL;
+    nn_timer_stop (&self->hdr_timeout);
+
+    /*  The connection is established. Start exchanging the messages. */
+    self->sink = &nn_stream_state_active;
+    nn_pipebase_activate (&self->pipebase);
+    nn_stream_recvnext (self);
+}
+
+static void nn_stream_hdr_sent (const struct nn_cp_sink **self,
+    struct nn_usock *usock)
 {
     struct nn_stream *stream;
-    const struct nn_cp_sink **original_sink;
 
     stream = nn_cont (self, struct nn_stream, sink);
-    original_sink = stream->original_sink;
 
-    /*  Terminate the session object. */
-    nn_stream_term (stream);
+    stream->sink = &nn_stream_state_sent;
 
-    /*  Notify the parent state machine about the failure. */
-    nn_assert ((*original_sink)->err);
-    (*original_sink)->err (original_sink, usock, errnum);
+    /*  Don't wait for the peer's protocol header to start sending messages.
+        In the rare case of a protocol mismatch the connection is closed
+        once the header arrives and the messages are lost as if the
+        connection failed. */
+    nn_pipebase_activate (&stream->pipebase);
+
+    /*  Receive the protocol header from the peer. */
+    nn_usock_recv (usock, stream->protohdr, 8);
 }
 
-static int nn_stream_send (struct nn_pipebase *self, struct nn_msg *msg)
+static void nn_stream_hdr_received (const struct nn_cp_sink **self,
+    struct nn_usock *usock)
 {
     struct nn_stream *stream;
-    struct nn_iobuf iov [3];
+    int protocol;
+    int ivl;
 
-    stream = nn_cont (self, struct nn_stream, pipebase);
+    stream = nn_cont (self, struct nn_stream, sink);
+
+    stream->sink = &nn_stream_state_active;
+    nn_timer_stop (&stream->hdr_timeout);
+
+    /*  If the header does not conform, drop the connection. */
+    protocol = nn_gets (stream->protohdr + 4);
+    if (nn_slow (memcmp (stream->protohdr, "\0\0SP", 4) != 0 ||
+          !nn_pipebase_ispeer (&stream->pipebase, protocol))) {
+        nn_stream_err (self, usock, EPROTO);
+        return;
+    }
 
-    /*  Mave the message to the local storage. */
-    nn_msg_term (&stream->outmsg);
-    nn_msg_mv (&stream->outmsg, msg);
+    /*  Messages are passed by file descriptor only if both peers are able
+        to do so. */
+#if defined NN_USE_MEMFD
+    stream->fdpassing = nn_usock_getfdpassing (usock) &&
+        (stream->protohdr [7] & NN_STREAM_HDR_FDS);
+#else
+    stream->fdpassing = 0;
+#endif
 
-    /*  Serialise the message header. */
-    nn_putll (stream->outhdr, nn_chunkref_size (&stream->outmsg.hdr) +
-        nn_chunkref_size (&stream->outmsg.body));
+    /*  Decompression is always available, thus the messages are compressed
+        if requested by the local socket and the peer announced it. */
+    stream->compress = (stream->protohdr [7] & NN_STREAM_HDR_LZ4) ?
+        nn_usock_getcompress (usock) : 0;
 
-    /*  Start async sending. */
-    iov [0].iov_base = stream->outhdr;
-    iov [0].iov_len = sizeof (stream->outhdr);
-    iov [1].iov_base = nn_chunkref_data (&stream->outmsg.hdr);
-    iov [1].iov_len = nn_chunkref_size (&stream->outmsg.hdr);
-    iov [2].iov_base = nn_chunkref_data (&stream->outmsg.body);
-    iov [2].iov_len = nn_chunkref_size (&stream->outmsg.body);;
-    nn_usock_send (stream->usock, iov, 3);
+    /*  Large messages are sent in chunks if the peer can receive them. */
+    stream->chunks = (stream->protohdr [7] & NN_STREAM_HDR_CHUNKS) ? 1 : 0;
 
-    return 0;
+    /*  Compact headers are used in both directions if the peer supports
+        them. The messages already queued have 8-byte sizes, which the peer
+        can tell from the compact headers. */
+    stream->compact = (stream->protohdr [7] & NN_STREAM_HDR_COMPACT) ? 1 : 0;
+
+    /*  Deadlines of the messages are passed on if the peer understands
+        them. */
+    stream->ttl = (stream->protohdr [7] & NN_STREAM_HDR_TTL) ? 1 : 0;
+    stream->trace = (stream->protohdr [7] & NN_STREAM_HDR_TRACE) ? 1 : 0;
+
+    /*  Checksums are always verified, thus they are sent if requested by
+        the local socket and the peer announced it. */
+    stream->crc = (stream->protohdr [7] & NN_STREAM_HDR_CRC) ?
+        nn_usock_getcrc (usock) : 0;
+
+    /*  Heartbeats are sent as often as either peer asks for and only the peer
+        that asked for them checks whether they arrive. The intervals are
+        converted to ticks, rounding down for sending and up for checking. */
+    if (stream->protohdr [7] & NN_STREAM_HDR_HEARTBEAT) {
+        ivl = stream->protohdr [6] * NN_STREAM_HEARTBEAT_UNIT;
+        if (stream->hbivl > 0 && (!ivl || stream->hbivl < ivl))
+            ivl = stream->hbivl;
+        if (ivl) {
+            stream->hbsend = ivl / NN_TICKER_IVL ? ivl / NN_TICKER_IVL : 1;
+            if (stream->hbivl > 0)
+                stream->hbtimeout = (int) (((int64_t) stream->hbivl *
+                    stream->hbmisses + NN_TICKER_IVL - 1) / NN_TICKER_IVL);
+            nn_tick_start (&stream->hbtick);
+        }
+    }
+
+    /*  Start waiting for incoming messages. */
+    nn_stream_recvnext (stream);
 }
 
-static int nn_stream_recv (struct nn_pipebase *self, struct nn_msg *msg)
+/*  Starts receiving the next message unless the memory budget is exhausted.
+    In that case, the message is received once the budget is available. */
+static void nn_stream_recvnext (struct nn_stream *self)
 {
-    struct nn_stream *stream;
+    if (nn_slow (self->budget &&
+          nn_budget_wait (self->budget, &self->budgetwaiter))) {
+        self->inblocked = 1;
+        return;
+    }
+    nn_stream_recvhdr (self);
+}
 
-    stream = nn_cont (self, struct nn_stream, pipebase);
+/*  Starts receiving the next message. First, read the 8-byte size, the first
+    byte of the header if compact headers are used or, with WebSocket,
+    the first two bytes of the frame header. */
+static void nn_stream_recvhdr (struct nn_stream *self)
+{
+    if (self->seqpacket) {
+        nn_stream_recvrecs (self);
+        return;
+    }
+    if (self->ws) {
+        self->instate = NN_STREAM_INSTATE_WSHDR;
+        nn_usock_recv (self->usock, self->wshdr, 2);
+        return;
+    }
+    self->instate = NN_STREAM_INSTATE_HDR;
+    nn_usock_recv (self->usock, self->inhdr, self->compact ? 1 : 8);
+}
 
-    /*  Move message content to the user-supplied structure. */
-    nn_msg_mv (msg, &stream->inmsg);
-    nn_msg_init (&stream->inmsg, 0);
+/*  Returns the length of the message header starting with the byte. */
+static size_t nn_stream_hdrlen (uint8_t byte)
+{
+    if (!(byte & 0x1f))
+        return 8;
+    if (byte == NN_STREAM_COMPACT16)
+        return 3;
+    if (byte == NN_STREAM_COMPACT32)
+        return 5;
+    return 1;
+}
 
-    /* Start receiving new message. */ 
-    stream->instate = NN_STREAM_INSTATE_HDR;
-    nn_usock_recv (stream->usock, stream->inhdr, 8);
+/*  Returns the size, including the flags, stored in the message header. */
+static uint64_t nn_stream_getsize (const uint8_t *hdr)
+{
+    if (!(hdr [0] & 0x1f))
+        return nn_getll (hdr);
+    if (hdr [0] == NN_STREAM_COMPACT16)
+        return nn_gets (hdr + 1);
+    if (hdr [0] == NN_STREAM_COMPACT32)
+        return nn_getl (hdr + 1);
+    return hdr [0] - 1;
+}
+
+/*  Processes the size from the header of the message frame that was
+    received. */
+static void nn_stream_framehdr (struct nn_stream *self, uint64_t size)
+{
+    /*  Time-to-live of the message that follows. */
+    if (nn_slow ((size & NN_STREAM_TTL_FLAG) == NN_STREAM_TTL_FLAG)) {
+        nn_stream_setdeadline (self, size & ~NN_STREAM_TTL_FLAG,
+            self->intstamp);
+        nn_stream_recvhdr (self);
+        return;
+    }
+
+    /*  Trace context of the message that follows. */
+    if (nn_slow ((size & NN_STREAM_TRACE_MASK) == NN_STREAM_TRACE_FLAG)) {
+        if (nn_slow ((size & ~NN_STREAM_TRACE_FLAG) != NN_TRACE_SIZE)) {
+            nn_stream_err (&self->sink, self->usock, EPROTO);
+            return;
+        }
+        self->instate = NN_STREAM_INSTATE_TRACE;
+        nn_usock_recv (self->usock, self->intrace, NN_TRACE_SIZE);
+        return;
+    }
 
+    /*  Checksum of the message that follows. */
+    if (nn_slow ((size & NN_STREAM_TRACE_MASK) == NN_STREAM_CRC_FLAG)) {
+        if (nn_slow ((size & ~NN_STREAM_CRC_FLAG) > 0xffffffff)) {
+            nn_stream_err (&self->sink, self->usock, EPROTO);
+            return;
+        }
+        self->incrc = (uint32_t) size;
+        self->incrcset = 1;
+        nn_stream_recvhdr (self);
+        return;
+    }
+
+    /*  The message is passed by file descriptor. Receive the description
+        of the data first. */
+    if (nn_slow (size & NN_STREAM_FD_FLAG)) {
+        size &= ~NN_STREAM_FD_FLAG;
+        if (nn_slow (!self->fdpassing || self->incrcset || size < 16 ||
+              size > sizeof (self->infd))) {
+            nn_stream_err (&self->sink, self->usock, EPROTO);
+            return;
+        }
+        self->infdsize = (size_t) size;
+        self->instate = NN_STREAM_INSTATE_FD;
+        nn_usock_recv (self->usock, self->infd, (size_t) size);
+        return;
+    }
+
+    /*  The message is compressed. Receive it as a whole and decompress
+        it afterwards. */
+    if (nn_slow (size & NN_STREAM_LZ4_FLAG)) {
+        size &= ~NN_STREAM_LZ4_FLAG;
+        if (nn_slow (size < 16 || size > SIZE_MAX)) {
+            nn_stream_err (&self->sink, self->usock, EPROTO);
+            return;
+        }
+        nn_msg_term (&self->inmsg);
+        nn_msg_init (&self->inmsg, (size_t) size);
+        self->instate = NN_STREAM_INSTATE_LZ4;
+        nn_usock_recv (self->usock, nn_chunkref_data (&self->inmsg.body),
+            (size_t) size);
+        return;
+    }
+
+    /*  A heartbeat. The fact that it arrived is all that matters. */
+    if (nn_slow (size == NN_STREAM_HEARTBEAT)) {
+        nn_stream_recvhdr (self);
+        return;
+    }
+
+    /*  A chunk of a large message. The first one starts with the size
+        of the whole message. Other messages may arrive in between the
+        chunks. */
+    if (nn_slow (size & NN_STREAM_CHUNK_FLAG)) {
+        size &= ~NN_STREAM_CHUNK_FLAG;
+        if (nn_slow (self->incrcset)) {
+            nn_stream_err (&self->sink, self->usock, EPROTO);
+            return;
+        }
+        if (!self->inbulksize) {
+            if (nn_slow (!self->chunks || size <= 8)) {
+                nn_stream_err (&self->sink, self->usock, EPROTO);
+                return;
+            }
+            self->inchunk = (size_t) size - 8;
+            self->instate = NN_STREAM_INSTATE_CHUNKHDR;
+            nn_usock_recv (self->usock, self->inhdr, 8);
+            return;
+        }
+        if (nn_slow (size == 0 ||
+              size > self->inbulksize - self->inbulkpos)) {
+            nn_stream_err (&self->sink, self->usock, EPROTO);
+            return;
+        }
+        self->inchunk = (size_t) size;
+        nn_stream_recvchunk (self);
+        return;
+    }
+
+    nn_msg_term (&self->inmsg);
+    nn_stream_initmsg (self, &self->inmsg, (size_t) size);
+    if (!size) {
+        if (nn_slow (nn_stream_checkcrc (self) < 0)) {
+            nn_stream_err (&self->sink, self->usock, EPROTO);
+            return;
+        }
+        nn_stream_parse (self);
+        nn_pipebase_received (&self->pipebase);
+        return;
+    }
+    self->instate = NN_STREAM_INSTATE_BODY;
+    nn_usock_recv (self->usock, nn_chunkref_data (&self->inmsg.body),
+        (size_t) size);
+}
+
+/*  Initialises a message for 'size' bytes of incoming data. If the user has
+    asked for the messages to be stored in memory of their own (NN_RCVALLOC),
+    the body is allocated from there, so that the data are received right
+    into it. Should the allocator run out of memory, the library's own memory
+    is used rather than dropping the connection. */
+static void nn_stream_initmsg (struct nn_stream *self, struct nn_msg *msg,
+    size_t size)
+{
+    int rc;
+    struct nn_chunk *chunk;
+
+    if (nn_slow (self->rcvalloc != NN_CHUNK_DEFAULT && size != 0)) {
+        rc = nn_chunk_alloc (size, self->rcvalloc, &chunk);
+        if (nn_fast (rc == 0)) {
+            nn_msg_init_chunk (msg, chunk);
+            return;
+        }
+    }
+    nn_msg_init (msg, size);
+}
+
+/*  Checks the message just received against the checksum that preceded it,
+    if any. */
+static int nn_stream_checkcrc (struct nn_stream *self)
+{
+    if (nn_fast (!self->incrcset))
+        return 0;
+    self->incrcset = 0;
+    if (nn_slow (nn_crc32c (0, nn_chunkref_data (&self->inmsg.body),
+          nn_chunkref_size (&self->inmsg.body)) != self->incrc))
+        return -EPROTO;
     return 0;
 }
 
+/*  Sets the deadline of the next message to be received from its
+    time-to-live. The time the frame spent in the kernel since it arrived
+    counts, if it's known. It's known once the kernel timestamps the incoming
+    data, which it's asked to do the first time a deadline is received. */
+static void nn_stream_setdeadline (struct nn_stream *self, uint64_t ttl,
+    uint64_t tstamp)
+{
+    uint64_t now;
+    uint64_t age;
+
+    age = 0;
+    if (tstamp) {
+        now = nn_clock_realtime ();
+        if (now > tstamp)
+            age = (now - tstamp) / 1000000;
+    }
+    else if (nn_slow (!self->tstamping)) {
+        nn_usock_settstamp (self->usock, 1);
+        self->tstamping = 1;
+    }
+
+    /*  A message that has already expired gets a deadline in the past. */
+    now = nn_pipebase_now (&self->pipebase);
+    self->indeadline = now + ttl > age ? now + ttl - age : 1;
+}
+
+/*  Attaches the trace context received in front of a message to it. */
+static void nn_stream_settrace (struct nn_stream *self, struct nn_msg *msg)
+{
+    nn_chunkref_term (&msg->trace);
+    nn_chunkref_init (&msg->trace, NN_TRACE_SIZE);
+    memcpy (nn_chunkref_data (&msg->trace), self->intrace, NN_TRACE_SIZE);
+    self->intraced = 0;
+}
+
+static void nn_stream_hdr_timeout (const struct nn_cp_sink **self,
+    struct nn_timer *timer)
+{
+    struct nn_stream *stream;
+    const struct nn_cp_sink **original_sink;
+
+    /*  The initial protocol header exchange have timed out. */
+    stream = nn_cont (self, struct nn_stream, sink);
+    original_sink = stream->original_sink;
+
+    /*  Terminate the session object. */
+    nn_stream_term (stream);
+
+    /*  Notify the parent state machine about the failure. */
+    nn_assert ((*original_sink)->err);
+    (*original_sink)->err (original_sink, stream->usock, ETIMEDOUT);
+}
+
+static void nn_stream_received (const struct nn_cp_sink **self,
+    struct nn_usock *usock)
+{
+    int rc;
+    struct nn_stream *stream;
+    uint64_t size;
+
+    stream = nn_cont (self, struct nn_stream, sink);
+    stream->hbrecvd = 0;
+    switch (stream->instate) {
+    case NN_STREAM_INSTATE_HDR:
+        stream->intstamp = nn_usock_gettstamp (usock);
+        if (!stream->compact) {
+            nn_stream_framehdr (stream, nn_getll (stream->inhdr));
+            break;
+        }
+
+        /*  Only the first byte of the header was received. Receive the rest
+            of it, if any. */
+        size = nn_stream_hdrlen (stream->inhdr [0]);
+        if (size > 1) {
+            stream->instate = NN_STREAM_INSTATE_HDREXT;
+            nn_usock_recv (stream->usock, stream->inhdr + 1,
+                (size_t) size - 1);
+            break;
+        }
+        nn_stream_framehdr (stream, nn_stream_getsize (stream->inhdr));
+        break;
+    case NN_STREAM_INSTATE_HDREXT:
+        nn_stream_framehdr (stream, nn_stream_getsize (stream->inhdr));
+        break;
+    case NN_STREAM_INSTATE_TRACE:
+        stream->intraced = 1;
+        nn_stream_recvhdr (stream);
+        break;
+    case NN_STREAM_INSTATE_BODY:
+        rc = nn_stream_checkcrc (stream);
+        if (nn_slow (rc < 0)) {
+            nn_stream_err (self, usock, -rc);
+            return;
+        }
+        nn_stream_parse (stream);
+        nn_pipebase_received (&stream->pipebase);
+        break;
+    case NN_STREAM_INSTATE_FD:
+        rc = nn_stream_mapfd (stream);
+        if (nn_slow (rc < 0)) {
+            nn_stream_err (self, usock, -rc);
+            return;
+        }
+        nn_stream_parse (stream);
+        nn_pipebase_received (&stream->pipebase);
+        break;
+    case NN_STREAM_INSTATE_LZ4:
+        rc = nn_stream_checkcrc (stream);
+        if (nn_fast (rc == 0))
+            rc = nn_stream_decompress (stream);
+        if (nn_slow (rc < 0)) {
+            nn_stream_err (self, usock, -rc);
+            return;
+        }
+        nn_stream_parse (stream);
+        nn_pipebase_received (&stream->pipebase);
+        break;
+    case NN_STREAM_INSTATE_CHUNKHDR:
+        size = nn_getll (stream->inhdr);
+        if (nn_slow (size < stream->inchunk || size > SIZE_MAX)) {
+            nn_stream_err (self, usock, EPROTO);
+            return;
+        }
+        if (!stream->rcvchunks)
+            nn_stream_initmsg (stream, &stream->inbulk, (size_t) size);
+        stream->inbulksize = (size_t) size;
+        stream->inbulkpos = 0;
+        stream->inbulktstamp = stream->intstamp;
+        nn_stream_recvchunk (stream);
+        break;
+    case NN_STREAM_INSTATE_CHUNK:
+
+        /*  Pass the chunk to the user straight away, if requested. */
+        if (stream->rcvchunks) {
+            stream->inmsg.chunkoff = stream->inbulkpos;
+            stream->inmsg.chunktotal = stream->inbulksize;
+            stream->inbulkpos += stream->inchunk;
+            if (stream->inbulkpos == stream->inbulksize)
+                stream->inbulksize = 0;
+            nn_stream_parse (stream);
+            nn_pipebase_received (&stream->pipebase);
+            break;
+        }
+
+        stream->inbulkpos += stream->inchunk;
+        if (stream->inbulkpos != stream->inbulksize) {
+            nn_stream_recvhdr (stream);
+            break;
+        }
+        nn_msg_term (&stream->inmsg);
+        nn_msg_mv (&stream->inmsg, &stream->inbulk);
+        stream->inbulksize = 0;
+        stream->intstamp = stream->inbulktstamp;
+        nn_stream_parse (stream);
+        nn_pipebase_received (&stream->pipebase);
+        break;
+    case NN_STREAM_INSTATE_WSHDR:
+        if (!stream->wsfrag)
+            stream->intstamp = nn_usock_gettstamp (usock);
+
+        /*  Receive the rest of the frame header, if any. */
+        size = nn_ws_hdrsize (stream->wshdr);
+        if (size) {
+            stream->instate = NN_STREAM_INSTATE_WSEXT;
+            nn_usock_recv (stream->usock, stream->wshdr + 2, (size_t) size);
+            break;
+        }
+        nn_stream_ws_frame (stream);
+        break;
+    case NN_STREAM_INSTATE_WSEXT:
+        nn_stream_ws_frame (stream);
+        break;
+    case NN_STREAM_INSTATE_WSBODY:
+        nn_stream_ws_body (stream);
+        break;
+    case NN_STREAM_INSTATE_WSCTL:
+        nn_stream_ws_control (stream);
+        break;
+    case NN_STREAM_INSTATE_RECS:
+    case NN_STREAM_INSTATE_RECBULK:
+        rc = stream->instate == NN_STREAM_INSTATE_RECS ?
+            nn_stream_parserecs (stream) : nn_stream_bulkrecs (stream);
+        if (nn_slow (rc < 0)) {
+            nn_stream_err (self, usock, -rc);
+            return;
+        }
+
+        /*  Keep reading till there's a complete message. */
+        if (!rc) {
+            nn_stream_recvrecs (stream);
+            break;
+        }
+        nn_pipebase_received (&stream->pipebase);
+        break;
+    default:
+        nn_assert (0);
+    }
+}
+
+/*  Starts receiving the next batch of records. If a message is being received
+    in several records, its data are received straight into the message. */
+static void nn_stream_recvrecs (struct nn_stream *self)
+{
+    int i;
+    int count;
+    size_t pos;
+
+    if (!self->inrecs) {
+        self->inrecs = nn_alloc (NN_STREAM_BATCH_MSGS * NN_STREAM_RECORD,
+            "stream records");
+        alloc_assert (self->inrecs);
+        self->indgrams = nn_alloc (NN_STREAM_BATCH_MSGS *
+            sizeof (struct nn_usock_dgram), "stream records");
+        alloc_assert (self->indgrams);
+    }
+
+    if (self->inbulksize) {
+        self->instate = NN_STREAM_INSTATE_RECBULK;
+        pos = self->inbulkpos;
+        for (i = 0; i != NN_STREAM_BATCH_MSGS && pos != self->inbulksize;
+              ++i) {
+            self->indgrams [i].buf =
+                ((uint8_t*) nn_chunkref_data (&self->inbulk.body)) + pos;
+            self->indgrams [i].size = self->inbulksize - pos;
+            if (self->indgrams [i].size > NN_STREAM_RECORD)
+                self->indgrams [i].size = NN_STREAM_RECORD;
+            pos += self->indgrams [i].size;
+        }
+        nn_usock_recvdgrams (self->usock, self->indgrams, i);
+        return;
+    }
+
+    /*  Each record may be a message of its own, so read no more of them than
+        there is space for in the queue of incoming messages. */
+    self->instate = NN_STREAM_INSTATE_RECS;
+    count = self->inmaxmsgs + 1 < NN_STREAM_BATCH_MSGS ?
+        self->inmaxmsgs + 1 : NN_STREAM_BATCH_MSGS;
+    for (i = 0; i != count; ++i) {
+        self->indgrams [i].buf = self->inrecs + i * NN_STREAM_RECORD;
+        self->indgrams [i].size = NN_STREAM_RECORD;
+    }
+    nn_usock_recvdgrams (self->usock, self->indgrams, count);
+}
+
+/*  Extracts the messages from the batch of records that was received. The
+    first one goes to 'inmsg', the others to 'inqueue'. Returns the number of
+    the complete messages or a negative error code. */
+static int nn_stream_parserecs (struct nn_stream *self)
+{
+    int i;
+    int count;
+    int done;
+    size_t len;
+    size_t left;
+    uint64_t size;
+    uint64_t tstamp;
+    const uint8_t *data;
+    struct nn_msg *msg;
+
+    /*  The kernel timestamps are not read along with the records, thus
+        the time of the read is the best estimate available. */
+    tstamp = self->tstamping ? nn_clock_realtime () : 0;
+    count = nn_usock_dgramcount (self->usock);
+    done = 0;
+    self->incount = 0;
+    self->inpos = 0;
+    for (i = 0; i != count; ++i) {
+        data = self->indgrams [i].buf;
+        len = self->indgrams [i].len;
+        if (nn_slow (len > self->indgrams [i].size || len == 0))
+            return -EPROTO;
+
+        /*  The next part of the message being received in several
+            records. */
+        if (self->inbulksize) {
+            left = self->inbulksize - self->inbulkpos;
+            if (nn_slow (len != (left < NN_STREAM_RECORD ?
+                  left : NN_STREAM_RECORD)))
+                return -EPROTO;
+            memcpy (((uint8_t*) nn_chunkref_data (&self->inbulk.body)) +
+                self->inbulkpos, data, len);
+            self->inbulkpos += len;
+            if (self->inbulkpos != self->inbulksize)
+                continue;
+            msg = done ? &self->inqueue [self->incount++] : &self->inmsg;
+            if (!done)
+                nn_msg_term (&self->inmsg);
+            nn_msg_mv (msg, &self->inbulk);
+            msg->tstamp = self->inbulktstamp;
+            self->inbulksize = 0;
+        }
+
+        /*  The first record of a message that doesn't fit into a single
+            one. */
+        else if (data [0] == NN_STREAM_RECORD_MORE) {
+            if (nn_slow (len != NN_STREAM_RECORD))
+                return -EPROTO;
+            size = nn_getll (data + 1);
+            if (nn_slow (size < NN_STREAM_RECORD || size > SIZE_MAX))
+                return -EPROTO;
+            nn_stream_initmsg (self, &self->inbulk, (size_t) size);
+            memcpy (nn_chunkref_data (&self->inbulk.body), data + 9, len - 9);
+            self->inbulksize = (size_t) size;
+            self->inbulkpos = len - 9;
+            self->inbulktstamp = tstamp;
+            continue;
+        }
+
+        /*  A message of its own. */
+        else {
+            if (nn_slow (data [0] != 0))
+                return -EPROTO;
+            msg = done ? &self->inqueue [self->incount++] : &self->inmsg;
+            if (!done)
+                nn_msg_term (&self->inmsg);
+            nn_stream_initmsg (self, msg, len - 1);
+            memcpy (nn_chunkref_data (&msg->body), data + 1, len - 1);
+            msg->tstamp = tstamp;
+        }
+
+        nn_trace2 (stream_received, self, nn_msg_bodysize (msg));
+        nn_stream_take (self, nn_msg_bodysize (msg));
+        ++done;
+    }
+    if (done)
+        self->intstamp = self->inmsg.tstamp;
+    return done;
+}
+
+/*  Accounts for the records of a message that were received straight into it.
+    Returns 1 if the message is complete, 0 if it isn't or a negative error
+    code. */
+static int nn_stream_bulkrecs (struct nn_stream *self)
+{
+    int i;
+    int count;
+
+    count = nn_usock_dgramcount (self->usock);
+    for (i = 0; i != count; ++i) {
+        if (nn_slow (self->indgrams [i].len != self->indgrams [i].size))
+            return -EPROTO;
+        self->inbulkpos += self->indgrams [i].len;
+    }
+    if (self->inbulkpos != self->inbulksize)
+        return 0;
+    nn_msg_term (&self->inmsg);
+    nn_msg_mv (&self->inmsg, &self->inbulk);
+    self->inbulksize = 0;
+    self->intstamp = self->inbulktstamp;
+    self->incount = 0;
+    self->inpos = 0;
+    nn_trace2 (stream_received, self, nn_msg_bodysize (&self->inmsg));
+    nn_stream_take (self, nn_msg_bodysize (&self->inmsg));
+    return 1;
+}
+
+static void nn_stream_recvchunk (struct nn_stream *self)
+{
+    self->instate = NN_STREAM_INSTATE_CHUNK;
+    if (self->rcvchunks) {
+        nn_msg_term (&self->inmsg);
+        nn_stream_initmsg (self, &self->inmsg, self->inchunk);
+        nn_usock_recv (self->usock, nn_chunkref_data (&self->inmsg.body),
+            self->inchunk);
+        return;
+    }
+    nn_usock_recv (self->usock, ((uint8_t*) nn_chunkref_data (
+        &self->inbulk.body)) + self->inbulkpos, self->inchunk);
+}
+
+static void nn_stream_ws_frame (struct nn_stream *self)
+{
+    int rc;
+    struct nn_ws_frame *frame;
+    struct nn_msg msg;
+    size_t size;
+
+    /*  The frames sent by the client must be masked, the frames sent by
+        the server must not. */
+    frame = &self->wsframe;
+    rc = nn_ws_parsehdr (self->wshdr, frame);
+    if (nn_slow (rc < 0 || frame->masked != self->wsserver)) {
+        nn_stream_err (&self->sink, self->usock, EPROTO);
+        return;
+    }
+
+    /*  Control frames may be interleaved with the frames of a message. */
+    if (frame->opcode & 0x08) {
+        self->instate = NN_STREAM_INSTATE_WSCTL;
+        if (!frame->len) {
+            nn_stream_ws_control (self);
+            return;
+        }
+        nn_usock_recv (self->usock, self->wsctl, (size_t) frame->len);
+        return;
+    }
+
+    /*  A data frame either starts a new message or continues the one
+        in progress. */
+    size = self->wsfrag ? nn_chunkref_size (&self->inmsg.body) : 0;
+    if (nn_slow ((frame->opcode == NN_WS_OP_CONT) != self->wsfrag ||
+          frame->len > SIZE_MAX - size)) {
+        nn_stream_err (&self->sink, self->usock, EPROTO);
+        return;
+    }
+    nn_stream_initmsg (self, &msg, size + (size_t) frame->len);
+    if (size)
+        memcpy (nn_chunkref_data (&msg.body),
+            nn_chunkref_data (&self->inmsg.body), size);
+    nn_msg_term (&self->inmsg);
+    nn_msg_mv (&self->inmsg, &msg);
+    self->wspos = size;
+    self->wsfrag = !frame->fin;
+
+    /*  The data are received directly into the message. */
+    self->instate = NN_STREAM_INSTATE_WSBODY;
+    if (!frame->len) {
+        nn_stream_ws_body (self);
+        return;
+    }
+    nn_usock_recv (self->usock,
+        (uint8_t*) nn_chunkref_data (&self->inmsg.body) + self->wspos,
+        (size_t) frame->len);
+}
+
+static void nn_stream_ws_body (struct nn_stream *self)
+{
+    uint8_t *data;
+
+    if (self->wsframe.masked) {
+        data = (uint8_t*) nn_chunkref_data (&self->inmsg.body) + self->wspos;
+        nn_ws_mask (data, data, (size_t) self->wsframe.len,
+            self->wsframe.mask, 0);
+    }
+
+    /*  Wait for the next frame of the message. */
+    if (self->wsfrag) {
+        nn_stream_recvhdr (self);
+        return;
+    }
+
+    nn_trace2 (stream_received, self, nn_chunkref_size (&self->inmsg.body));
+    nn_stream_take (self, nn_msg_bodysize (&self->inmsg));
+    nn_pipebase_received (&self->pipebase);
+}
+
+static void nn_stream_ws_control (struct nn_stream *self)
+{
+    if (self->wsframe.masked)
+        nn_ws_mask (self->wsctl, self->wsctl, (size_t) self->wsframe.len,
+            self->wsframe.mask, 0);
+
+    switch (self->wsframe.opcode) {
+    case NN_WS_OP_PING:
+        nn_stream_ws_sendctl (self, NN_WS_OP_PONG, self->wsctl,
+            (size_t) self->wsframe.len);
+        break;
+    case NN_WS_OP_PONG:
+        break;
+    case NN_WS_OP_CLOSE:
+
+        /*  The peer is closing the connection. No need to confirm that,
+            the connection is closed straight away. */
+        nn_stream_err (&self->sink, self->usock, ECONNRESET);
+        return;
+    default:
+        nn_assert (0);
+    }
+
+    nn_stream_recvhdr (self);
+}
+
+static void nn_stream_ws_sendctl (struct nn_stream *self, int opcode,
+    const void *data, size_t len)
+{
+    struct nn_msg msg;
+    struct nn_stream_batch *batch;
+
+    nn_msg_init (&msg, len);
+    memcpy (nn_chunkref_data (&msg.body), data, len);
+
+    /*  If the batch waiting to be sent is full, the frame is dropped. It's
+        fine for the peer not to get a response to each one of its pings. */
+    batch = &self->outbatches [!self->outbatch];
+    if (nn_stream_batch_isfull (batch, NN_STREAM_BATCH_MSGS, SIZE_MAX)) {
+        nn_msg_term (&msg);
+        return;
+    }
+    nn_stream_batch_addws (batch, &msg, opcode, !self->wsserver);
+    nn_stream_pump (self);
+}
+
+static void nn_stream_sent (const struct nn_cp_sink **self,
+    struct nn_usock *usock)
+{
+    struct nn_stream *stream;
+
+    stream = nn_cont (self, struct nn_stream, sink);
+
+    /*  Account for the data that were sent. The urgent messages are
+        deallocated straight away, the others once the whole batch is sent. */
+    if (stream->outstate == NN_STREAM_OUTSTATE_URGENT) {
+        nn_stream_give (stream,
+            stream->outurgent [stream->outurgentbatch].budget);
+        nn_stream_batch_term (&stream->outurgent [stream->outurgentbatch]);
+        nn_stream_batch_init (&stream->outurgent [stream->outurgentbatch]);
+    }
+    else if (stream->outchunk) {
+        stream->outpos += stream->outchunk;
+        if (stream->outpos == nn_stream_msgsize (&stream->outbatches [
+              stream->outbatch].msgs [stream->outmsg])) {
+            ++stream->outmsg;
+            stream->outpos = 0;
+        }
+    }
+    else
+        stream->outmsg = stream->outend;
+    stream->outstate = NN_STREAM_OUTSTATE_IDLE;
+
+    /*  Send whatever is to be sent next. If the send was started by
+        nn_stream_pump and completed straight away, it takes care of that. */
+    if (stream->outstatus)
+        *stream->outstatus = 1;
+    else
+        nn_stream_pump (stream);
+}
+
+static void nn_stream_err (const struct nn_cp_sink **self,
+    struct nn_usock *usock, int errnum)
+{
+    struct nn_stream *stream;
+    const struct nn_cp_sink **original_sink;
+
+    stream = nn_cont (self, struct nn_stream, sink);
+    original_sink = stream->original_sink;
+
+    /*  If a send started by nn_stream_pump failed, it must not touch the
+        stream any more, the parent state machine may deallocate it. */
+    if (stream->outstatus)
+        *stream->outstatus = -1;
+
+    /*  Terminate the session object. */
+    nn_stream_term (stream);
+
+    /*  Notify the parent state machine about the failure. */
+    nn_assert ((*original_sink)->err);
+    (*original_sink)->err (original_sink, usock, errnum);
+}
+
+static int nn_stream_send (struct nn_pipebase *self, struct nn_msg *msg)
+{
+    struct nn_stream *stream;
+    struct nn_stream_batch *batch;
+    int compressed;
+    size_t size;
+
+    stream = nn_cont (self, struct nn_stream, pipebase);
+
+    /*  Messages that have outlived their time-to-live are not worth sending.
+        The pipe stays writeable, nothing was queued. */
+    if (nn_slow (msg->deadline &&
+          nn_pipebase_expired (&stream->pipebase, msg))) {
+        nn_msg_term (msg);
+        nn_pipebase_sent (&stream->pipebase);
+        return 0;
+    }
+
+    /*  Large messages are compressed before being queued. */
+    compressed = stream->compress && nn_stream_compress (stream, msg);
+    size = nn_chunkref_size (&msg->hdr) + nn_msg_bodysize (msg);
+
+    /*  Add the message to the batch waiting to be sent. Urgent messages have
+        a batch of their own. */
+    if (nn_slow (msg->urgent && !stream->seqpacket)) {
+        if (!stream->outurgent) {
+            stream->outurgent = nn_alloc (2 * sizeof (struct nn_stream_batch),
+                "urgent batches");
+            alloc_assert (stream->outurgent);
+            nn_stream_batch_init (&stream->outurgent [0]);
+            nn_stream_batch_init (&stream->outurgent [1]);
+        }
+        batch = &stream->outurgent [!stream->outurgentbatch];
+    }
+    else
+        batch = &stream->outbatches [!stream->outbatch];
+    nn_stream_queue (stream, batch, msg, compressed);
+    if (stream->budget) {
+        nn_budget_take (stream->budget, size);
+        batch->budget += size;
+    }
+
+    /*  The message is accepted. If there's still space in the batches and
+        in the budget, more messages can be sent immediately. If not, stop
+        the message flow until the batch is being sent or the budget is
+        available again. */
+    stream->outblocked = 1;
+    nn_stream_unblock (stream);
+
+    /*  If there's no send in progress, send the message straight away,
+        unless it's to be batched with the subsequent ones. The batch is
+        not held back once no more messages can be added to it. */
+    if (stream->outstate == NN_STREAM_OUTSTATE_IDLE) {
+        if (stream->outdelay && !stream->outblocked &&
+              batch == &stream->outbatches [!stream->outbatch] &&
+              batch->bytes < stream->outdelaybytes)
+            nn_flush_start (&stream->outflush, stream->outdelay);
+        else
+            nn_stream_pump (stream);
+    }
+
+    return 0;
+}
+
+static int nn_stream_recv (struct nn_pipebase *self, struct nn_msg *msg)
+{
+    struct nn_stream *stream;
+    size_t size;
+
+    stream = nn_cont (self, struct nn_stream, pipebase);
+
+    /*  Move message content to the user-supplied structure. */
+    nn_msg_mv (msg, &stream->inmsg);
+    msg->tstamp = stream->intstamp;
+    if (stream->budget) {
+        size = nn_msg_bodysize (msg);
+        nn_assert (stream->inbudget >= size);
+        stream->inbudget -= size;
+        nn_budget_give (stream->budget, size);
+    }
+
+    /*  If there are more complete messages already parsed, make the next one
+        available straight away. */
+    if (stream->inpos != stream->incount) {
+        nn_msg_mv (&stream->inmsg, &stream->inqueue [stream->inpos]);
+        stream->intstamp = stream->inmsg.tstamp;
+        ++stream->inpos;
+        nn_pipebase_received (&stream->pipebase);
+        return 0;
+    }
+    nn_msg_init (&stream->inmsg, 0);
+
+    /* Start receiving new message. */ 
+    nn_stream_recvnext (stream);
+
+    return 0;
+}
+
+static void nn_stream_close (struct nn_pipebase *self)
+{
+    struct nn_stream *stream;
+
+    stream = nn_cont (self, struct nn_stream, pipebase);
+
+    /*  The parent state machine handles it as any other broken connection.
+        The pending sends are abandoned, the peer sees the connection reset. */
+    nn_stream_err (&stream->sink, stream->usock, ECONNRESET);
+}
+
+static void nn_stream_queue (struct nn_stream *self,
+    struct nn_stream_batch *batch, struct nn_msg *msg, int compressed)
+{
+    int64_t ttl;
+    uint64_t now;
+    int traced;
+
+    if (self->ws) {
+        nn_stream_batch_addws (batch, msg, NN_WS_OP_BINARY, !self->wsserver);
+        return;
+    }
+
+    /*  The flags byte of a message sent as a single record. Messages sent
+        in several records are marked by zero length. */
+    if (self->seqpacket) {
+        nn_stream_batch_add (batch, msg, 0, 0, 0, 0, -1, 0, 0);
+        msg = &batch->msgs [batch->count - 1];
+        batch->hdrs [batch->count - 1] [0] = 0;
+        batch->hdrlens [batch->count - 1] =
+            1 + nn_stream_msgsize (msg) <= NN_STREAM_RECORD ? 1 : 0;
+        return;
+    }
+
+    /*  The time the message has left to live. It's not expired yet. */
+    ttl = -1;
+    if (nn_slow (self->ttl && msg->deadline)) {
+        now = nn_pipebase_now (&self->pipebase);
+        ttl = msg->deadline > now ? (int64_t) (msg->deadline - now) : 0;
+        if (ttl > (int64_t) NN_STREAM_TTL_MAX)
+            ttl = (int64_t) NN_STREAM_TTL_MAX;
+    }
+    traced = self->trace && nn_chunkref_size (&msg->trace) == NN_TRACE_SIZE;
+    nn_stream_batch_add (batch, msg, self->fdpassing && !self->crc, compressed,
+        self->chunks && !msg->urgent && ttl < 0 && !traced && !self->crc,
+        self->compact, ttl, traced, self->crc);
+    nn_stream_batch_inline (batch, batch->count - 1);
+}
+
+static void nn_stream_batch_init (struct nn_stream_batch *self)
+{
+    self->count = 0;
+    self->bytes = 0;
+    self->iovcnt = 0;
+    self->nfds = 0;
+    self->budget = 0;
+}
+
+static void nn_stream_batch_term (struct nn_stream_batch *self)
+{
+    int i;
+
+    for (i = 0; i != self->count; ++i)
+        nn_msg_term (&self->msgs [i]);
+}
+
+static void nn_stream_batch_add (struct nn_stream_batch *self,
+    struct nn_msg *msg, int fdpassing, int compressed, int chunks,
+    int compact, int64_t ttl, int traced, int crc)
+{
+    struct nn_chunk *chunk;
+    int fd;
+    size_t offset;
+    size_t size;
+    size_t prelen;
+    uint8_t *hdr;
+
+    nn_assert (self->count < NN_STREAM_BATCH_MSGS);
+
+    /*  Move the message to the batch. */
+    nn_msg_mv (&self->msgs [self->count], msg);
+    msg = &self->msgs [self->count];
+
+    /*  The time-to-live and the trace context frames go first, if any. */
+    prelen = 0;
+    if (nn_slow (ttl >= 0)) {
+        nn_putll (self->hdrs [self->count],
+            (uint64_t) ttl | NN_STREAM_TTL_FLAG);
+        prelen = 8;
+    }
+    if (nn_slow (traced)) {
+        nn_putll (self->hdrs [self->count] + prelen,
+            NN_TRACE_SIZE | NN_STREAM_TRACE_FLAG);
+        memcpy (self->hdrs [self->count] + prelen + 8,
+            nn_chunkref_data (&msg->trace), NN_TRACE_SIZE);
+        prelen += 8 + NN_TRACE_SIZE;
+    }
+    hdr = self->hdrs [self->count] + prelen;
+    self->fdmsgs [self->count] = 0;
+    self->inlined [self->count] = 0;
+
+    /*  If the body is stored in a memory file, pass the file descriptor
+        instead of the data. */
+    fd = -1;
+    if (fdpassing && !msg->frags && self->nfds < NN_USOCK_MAX_FDS &&
+          nn_chunkref_size (&msg->hdr) <= NN_STREAM_FD_MAXHDR) {
+        chunk = nn_chunkref_peekchunk (&msg->body);
+        if (chunk)
+            fd = nn_chunk_getfd (chunk, &offset);
+    }
+    if (fd >= 0) {
+        nn_putll (hdr, (16 + nn_chunkref_size (&msg->hdr)) | NN_STREAM_FD_FLAG);
+        nn_putll (hdr + 8, offset);
+        nn_putll (hdr + 16, nn_chunkref_size (&msg->body));
+        self->hdrlens [self->count] = prelen + 24;
+        self->fdmsgs [self->count] = 1;
+        self->fds [self->nfds++] = fd;
+        ++self->count;
+        self->bytes += prelen + 24 + nn_chunkref_size (&msg->hdr);
+        self->iovcnt += 3;
+        return;
+    }
+
+    /*  The checksum frame goes right before the message frame. */
+    if (nn_slow (crc)) {
+        nn_putll (hdr, nn_stream_crc (msg) | NN_STREAM_CRC_FLAG);
+        hdr += 8;
+        prelen += 8;
+    }
+
+    /*  Serialise the message header. Headers of the messages sent in chunks
+        are serialised for each chunk separately, they are marked by zero
+        length here. */
+    size = nn_stream_msgsize (msg);
+    if (chunks && !compressed && size > NN_STREAM_CHUNK)
+        self->hdrlens [self->count] = 0;
+    else if (compact && !compressed && size < NN_STREAM_COMPACT16 - 1) {
+        hdr [0] = (uint8_t) (size + 1);
+        self->hdrlens [self->count] = prelen + 1;
+    }
+    else if (compact && !compressed && size <= 0xffff) {
+        hdr [0] = NN_STREAM_COMPACT16;
+        nn_puts (hdr + 1, (uint16_t) size);
+        self->hdrlens [self->count] = prelen + 3;
+    }
+    else if (compact && !compressed && size <= 0xffffffff) {
+        hdr [0] = NN_STREAM_COMPACT32;
+        nn_putl (hdr + 1, (uint32_t) size);
+        self->hdrlens [self->count] = prelen + 5;
+    }
+    else {
+        nn_putll (hdr, size | (compressed ? NN_STREAM_LZ4_FLAG : 0));
+        self->hdrlens [self->count] = prelen + 8;
+    }
+
+    ++self->count;
+    self->bytes += nn_chunkref_size (&msg->hdr) + nn_msg_bodysize (msg);
+    self->iovcnt += 3 + (msg->frags ? msg->frags->count : 0);
+}
+
+static void nn_stream_batch_inline (struct nn_stream_batch *self, int i)
+{
+    struct nn_msg *msg;
+    size_t hdrsz;
+
+    /*  Messages sent in chunks, passed by file descriptor or composed of
+        several fragments are left alone, as are the bodies shared with other
+        pipes or allocated without space in front of the data. */
+    msg = &self->msgs [i];
+    if (self->hdrlens [i] == 0 || self->fdmsgs [i] || msg->frags)
+        return;
+    hdrsz = nn_chunkref_size (&msg->hdr);
+    if (nn_chunkref_headroom (&msg->body) < self->hdrlens [i] + hdrsz)
+        return;
+
+    /*  The protocol header goes right before the body, the frame header
+        before that. */
+    nn_chunkref_push (&msg->body, nn_chunkref_data (&msg->hdr), hdrsz);
+    nn_chunkref_push (&msg->body, self->hdrs [i], self->hdrlens [i]);
+    nn_chunkref_term (&msg->hdr);
+    nn_chunkref_init (&msg->hdr, 0);
+    self->inlined [i] = 1;
+}
+
+static void nn_stream_batch_addhb (struct nn_stream_batch *self)
+{
+    nn_assert (self->count < NN_STREAM_BATCH_MSGS);
+
+    nn_msg_init (&self->msgs [self->count], 0);
+    nn_putll (self->hdrs [self->count], NN_STREAM_HEARTBEAT);
+    self->hdrlens [self->count] = 8;
+    self->fdmsgs [self->count] = 0;
+    self->inlined [self->count] = 0;
+    ++self->count;
+    self->iovcnt += 3;
+}
+
+static void nn_stream_tick (struct nn_tick *tick)
+{
+    struct nn_stream *stream;
+    struct nn_stream_batch *batch;
+
+    stream = nn_cont (tick, struct nn_stream, hbtick);
+
+    /*  If nothing arrived from the peer for too long, it's gone. Time spent
+        waiting for the user to take the message received last, or for
+        the memory budget, doesn't count, the peer's heartbeats are not
+        being read meanwhile. */
+    if (stream->hbtimeout) {
+        if (!nn_pipebase_isreceiving (&stream->pipebase) ||
+              stream->inblocked)
+            stream->hbrecvd = 0;
+        else if (++stream->hbrecvd > stream->hbtimeout) {
+            nn_stream_err (&stream->sink, stream->usock, ETIMEDOUT);
+            return;
+        }
+    }
+
+    /*  If nothing was sent for the interval, send a heartbeat. There's no
+        point in queueing it behind a send that is still in progress. If
+        the batch waiting to be sent is full, the heartbeat is skipped. */
+    if (stream->hbsend && ++stream->hbsent >= stream->hbsend &&
+          stream->outstate == NN_STREAM_OUTSTATE_IDLE) {
+        batch = &stream->outbatches [!stream->outbatch];
+        if (nn_stream_batch_isfull (batch, NN_STREAM_BATCH_MSGS, SIZE_MAX))
+            return;
+        nn_stream_batch_addhb (batch);
+        nn_stream_pump (stream);
+    }
+}
+
+static void nn_stream_outflush (struct nn_flush *flush)
+{
+    nn_stream_pump (nn_cont (flush, struct nn_stream, outflush));
+}
+
+static void nn_stream_batch_addws (struct nn_stream_batch *self,
+    struct nn_msg *msg, int opcode, int masked)
+{
+    int i;
+    size_t size;
+    size_t pos;
+    uint8_t *data;
+    uint8_t mask [4];
+    struct nn_chunkref *chunk;
+    struct nn_chunkref payload;
+
+    nn_assert (self->count < NN_STREAM_BATCH_MSGS);
+
+    /*  Move the message to the batch. */
+    nn_msg_mv (&self->msgs [self->count], msg);
+    msg = &self->msgs [self->count];
+    size = nn_chunkref_size (&msg->hdr) + nn_msg_bodysize (msg);
+
+    /*  The client has to mask the payload. The data may be shared with
+        other pipes, thus they are masked while being copied into a new
+        buffer that replaces the header, the body and the fragments. */
+    if (masked) {
+        nn_random_generate (mask, sizeof (mask));
+        nn_chunkref_init (&payload, size);
+        data = nn_chunkref_data (&payload);
+        pos = 0;
+        for (i = -2; i != (msg->frags ? msg->frags->count : 0); ++i) {
+            chunk = i == -2 ? &msg->hdr : i == -1 ? &msg->body :
+                &msg->frags->frag [i];
+            nn_ws_mask (data + pos, nn_chunkref_data (chunk),
+                nn_chunkref_size (chunk), mask, pos);
+            pos += nn_chunkref_size (chunk);
+        }
+        nn_msg_term (msg);
+        nn_msg_init (msg, 0);
+        nn_chunkref_term (&msg->body);
+        nn_chunkref_mv (&msg->body, &payload);
+    }
+
+    /*  Serialise the frame header. */
+    self->hdrlens [self->count] = nn_ws_puthdr (self->hdrs [self->count],
+        opcode, size, masked ? mask : NULL);
+    self->fdmsgs [self->count] = 0;
+    self->inlined [self->count] = 0;
+
+    ++self->count;
+    self->bytes += size;
+    self->iovcnt += 3 + (msg->frags ? msg->frags->count : 0);
+}
+
+static int nn_stream_batch_isfull (struct nn_stream_batch *self,
+    int maxmsgs, size_t maxbytes)
+{
+    return self->count >= maxmsgs || self->bytes >= maxbytes ||
+        self->nfds >= NN_USOCK_MAX_FDS ||
+        self->iovcnt + 3 + NN_MSG_MAXFRAGS > NN_AIO_MAX_IOVCNT;
+}
+
+static size_t nn_stream_msgsize (struct nn_msg *msg)
+{
+    return nn_chunkref_size (&msg->hdr) + nn_msg_bodysize (msg);
+}
+
+static void nn_stream_pump (struct nn_stream *self)
+{
+    int status;
+
+    /*  If called from within the loop below, let the loop do the job. */
+    if (self->outstatus || self->outstate != NN_STREAM_OUTSTATE_IDLE)
+        return;
+
+    /*  Whatever is held back for batching is sent now. */
+    nn_flush_stop (&self->outflush);
+
+    /*  Keep sending while the sends complete straight away. If a send fails,
+        the stream is gone. */
+    while (1) {
+        status = 0;
+        self->outstatus = &status;
+        if (!nn_stream_flush (self))
+            break;
+        if (nn_slow (status < 0))
+            return;
+        if (!status)
+            break;
+    }
+    self->outstatus = NULL;
+
+    /*  Once everything is sent, the data held for the connection are below
+        any low-water mark. */
+    if (nn_slow (self->outfull))
+        nn_stream_unblock (self);
+}
+
+static int nn_stream_flush (struct nn_stream *self)
+{
+    struct nn_stream_batch *batch;
+    struct nn_msg *msg;
+    struct nn_iobuf iov [NN_AIO_MAX_IOVCNT];
+    int iovcnt;
+    int first;
+    int *fds;
+    int nfds;
+    int i;
+    int j;
+    int file;
+    uint64_t offset;
+
+    /*  Urgent messages go first. Otherwise, continue with the batch being
+        sent or, once it's done, with the batch collected in the meantime. */
+    if (nn_slow (self->outurgent &&
+          self->outurgent [!self->outurgentbatch].count)) {
+        self->outurgentbatch = !self->outurgentbatch;
+        batch = &self->outurgent [self->outurgentbatch];
+        self->outstate = NN_STREAM_OUTSTATE_URGENT;
+        first = 0;
+        fds = batch->fds;
+    }
+    else {
+        batch = &self->outbatches [self->outbatch];
+        if (self->outmsg == batch->count) {
+            nn_stream_give (self, batch->budget);
+            nn_stream_batch_term (batch);
+            nn_stream_batch_init (batch);
+            self->outbatch = !self->outbatch;
+            self->outmsg = 0;
+            self->outpos = 0;
+            self->outfd = 0;
+            batch = &self->outbatches [self->outbatch];
+            if (!batch->count)
+                return 0;
+        }
+        self->outstate = NN_STREAM_OUTSTATE_SENDING;
+        first = self->outmsg;
+        fds = batch->fds + self->outfd;
+    }
+
+    /*  If the message flow was stopped because the batch was full, restart
+        it. */
+    nn_stream_unblock (self);
+    self->hbsent = 0;
+
+    /*  Start async sending of the messages. Fragments of the messages are
+        passed to the kernel as they are, without copying them into a single
+        buffer. A message to be sent in chunks is sent on its own, one chunk
+        at a time. */
+    nn_assert (batch->iovcnt <= NN_AIO_MAX_IOVCNT);
+    iovcnt = 0;
+    nfds = 0;
+    self->outchunk = 0;
+    self->outfile = -1;
+    if (self->seqpacket) {
+        nn_stream_sendrecs (self, batch, first);
+        return 1;
+    }
+    for (i = first; i != batch->count; ++i) {
+        msg = &batch->msgs [i];
+        if (nn_slow (batch->hdrlens [i] == 0)) {
+            if (i == first)
+                iovcnt = nn_stream_chunk (self, msg, iov);
+            break;
+        }
+
+        /*  A body stored in a file is sent by the kernel straight from
+            the file after everything else, thus it ends the step. Urgent
+            messages are all sent in a single step, so they don't qualify.
+            Neither does a step passing file descriptors. */
+        file = -1;
+        if (self->outstate == NN_STREAM_OUTSTATE_SENDING) {
+            file = nn_stream_getfile (msg, &offset);
+            if (nn_slow (file >= 0 && nfds))
+                break;
+        }
+
+        if (batch->inlined [i]) {
+            iov [iovcnt].iov_base = nn_chunkref_data (&msg->body);
+            iov [iovcnt].iov_len = nn_chunkref_size (&msg->body);
+            ++iovcnt;
+            continue;
+        }
+
+        iov [iovcnt].iov_base = batch->hdrs [i];
+        iov [iovcnt].iov_len = batch->hdrlens [i];
+        iov [iovcnt + 1].iov_base = nn_chunkref_data (&msg->hdr);
+        iov [iovcnt + 1].iov_len = nn_chunkref_size (&msg->hdr);
+        iovcnt += 2;
+
+        /*  Only the header of a message passed by file descriptor is sent. */
+        if (batch->fdmsgs [i]) {
+            ++nfds;
+            continue;
+        }
+        if (nn_slow (file >= 0)) {
+            self->outfile = file;
+            self->outfileoff = offset;
+            self->outfilelen = nn_chunkref_size (&msg->body);
+            ++i;
+            break;
+        }
+        iov [iovcnt].iov_base = nn_chunkref_data (&msg->body);
+        iov [iovcnt].iov_len = nn_chunkref_size (&msg->body);
+        ++iovcnt;
+        if (msg->frags) {
+            for (j = 0; j != msg->frags->count; ++j) {
+                iov [iovcnt].iov_base =
+                    nn_chunkref_data (&msg->frags->frag [j]);
+                iov [iovcnt].iov_len =
+                    nn_chunkref_size (&msg->frags->frag [j]);
+                ++iovcnt;
+            }
+        }
+    }
+    self->outend = i;
+    if (self->outstate == NN_STREAM_OUTSTATE_SENDING)
+        self->outfd += nfds;
+    nn_trace2 (stream_flush, self, batch->bytes);
+    if (nn_slow (self->outfile >= 0))
+        nn_usock_sendfile (self->usock, iov, iovcnt, self->outfile,
+            self->outfileoff, self->outfilelen);
+    else
+        nn_usock_sendfds (self->usock, iov, iovcnt, fds, nfds);
+    return 1;
+}
+
+static int nn_stream_chunk (struct nn_stream *self, struct nn_msg *msg,
+    struct nn_iobuf *iov)
+{
+    int i;
+    int iovcnt;
+    size_t size;
+    size_t pos;
+    size_t start;
+    size_t end;
+    struct nn_chunkref *part;
+    int file;
+    uint64_t offset;
+
+    /*  Serialise the frame header. */
+    size = nn_stream_msgsize (msg) - self->outpos;
+    if (size > NN_STREAM_CHUNK)
+        size = NN_STREAM_CHUNK;
+    iov [0].iov_base = self->outchunkhdr;
+    if (!self->outpos) {
+        nn_putll (self->outchunkhdr, (8 + size) | NN_STREAM_CHUNK_FLAG);
+        nn_putll (self->outchunkhdr + 8, nn_stream_msgsize (msg));
+        iov [0].iov_len = 16;
+    }
+    else {
+        nn_putll (self->outchunkhdr, size | NN_STREAM_CHUNK_FLAG);
+        iov [0].iov_len = 8;
+    }
+    iovcnt = 1;
+
+    /*  Pick the data of the chunk from the header, the body and the
+        fragments of the message. A body stored in a file has no fragments
+        following it, its part of the chunk is sent from the file. */
+    file = nn_stream_getfile (msg, &offset);
+    pos = 0;
+    for (i = -2; i != (msg->frags ? msg->frags->count : 0); ++i) {
+        part = i == -2 ? &msg->hdr : i == -1 ? &msg->body :
+            &msg->frags->frag [i];
+        start = self->outpos > pos ? self->outpos - pos : 0;
+        end = self->outpos + size - pos;
+        if (end > nn_chunkref_size (part))
+            end = nn_chunkref_size (part);
+        if (start < end && i == -1 && file >= 0) {
+            self->outfile = file;
+            self->outfileoff = offset + start;
+            self->outfilelen = end - start;
+        }
+        else if (start < end) {
+            iov [iovcnt].iov_base = ((uint8_t*) nn_chunkref_data (part)) +
+                start;
+            iov [iovcnt].iov_len = end - start;
+            ++iovcnt;
+        }
+        pos += nn_chunkref_size (part);
+        if (pos >= self->outpos + size)
+            break;
+    }
+
+    self->outchunk = size;
+    return iovcnt;
+}
+
+/*  Sends the messages of the batch starting with 'first' as records. A message
+    that doesn't fit into a single record is sent on its own, as many records
+    of it at a time as the iovecs allow for. */
+static void nn_stream_sendrecs (struct nn_stream *self,
+    struct nn_stream_batch *batch, int first)
+{
+    struct nn_msg *msg;
+    struct nn_iobuf iov [NN_AIO_MAX_IOVCNT];
+    int reciovs [NN_AIO_MAX_IOVCNT];
+    int iovcnt;
+    int nrecs;
+    int i;
+
+    iovcnt = 0;
+    nrecs = 0;
+    for (i = first; i != batch->count; ++i) {
+        msg = &batch->msgs [i];
+        if (nn_slow (batch->hdrlens [i] == 0)) {
+            if (i == first)
+                nrecs = nn_stream_records (self, msg, iov, reciovs, &iovcnt);
+            break;
+        }
+        iov [iovcnt].iov_base = batch->hdrs [i];
+        iov [iovcnt].iov_len = 1;
+        reciovs [nrecs] = 1 + nn_stream_slice (msg, 0,
+            nn_stream_msgsize (msg), iov + iovcnt + 1);
+        iovcnt += reciovs [nrecs];
+        ++nrecs;
+    }
+    self->outend = i;
+    nn_trace2 (stream_flush, self, batch->bytes);
+    nn_usock_sendrecs (self->usock, iov, iovcnt, reciovs, nrecs);
+}
+
+/*  Fills in the records of the next step of sending a message that doesn't
+    fit into a single record. Returns the number of the records. */
+static int nn_stream_records (struct nn_stream *self, struct nn_msg *msg,
+    struct nn_iobuf *iov, int *reciovs, int *iovcnt)
+{
+    int nrecs;
+    int n;
+    size_t size;
+    size_t pos;
+    size_t len;
+    struct nn_iobuf parts [3 + NN_MSG_MAXFRAGS];
+
+    /*  The first record starts with the flags and the size of the message. */
+    size = nn_stream_msgsize (msg);
+    pos = self->outpos;
+    len = NN_STREAM_RECORD;
+    *iovcnt = 0;
+    if (!pos) {
+        self->outchunkhdr [0] = NN_STREAM_RECORD_MORE;
+        nn_putll (self->outchunkhdr + 1, size);
+        iov [0].iov_base = self->outchunkhdr;
+        iov [0].iov_len = 9;
+        *iovcnt = 1;
+        len -= 9;
+    }
+
+    /*  Add the records while there's space for their iovecs. */
+    nrecs = 0;
+    while (pos != size) {
+        if (len > size - pos)
+            len = size - pos;
+        n = nn_stream_slice (msg, pos, len, parts);
+        if (*iovcnt + n > NN_AIO_MAX_IOVCNT) {
+            nn_assert (nrecs);
+            break;
+        }
+        memcpy (iov + *iovcnt, parts, n * sizeof (struct nn_iobuf));
+        reciovs [nrecs++] = n + (pos ? 0 : 1);
+        *iovcnt += n;
+        pos += len;
+        len = NN_STREAM_RECORD;
+    }
+    self->outchunk = pos - self->outpos;
+    return nrecs;
+}
+
+/*  Fills in the iovecs for 'len' bytes of the message, starting at 'pos'.
+    Returns the number of the iovecs. */
+static int nn_stream_slice (struct nn_msg *msg, size_t pos, size_t len,
+    struct nn_iobuf *iov)
+{
+    int i;
+    int iovcnt;
+    size_t off;
+    size_t start;
+    size_t end;
+    struct nn_chunkref *part;
+
+    iovcnt = 0;
+    off = 0;
+    for (i = -2; i != (msg->frags ? msg->frags->count : 0); ++i) {
+        part = i == -2 ? &msg->hdr : i == -1 ? &msg->body :
+            &msg->frags->frag [i];
+        start = pos > off ? pos - off : 0;
+        end = pos + len - off;
+        if (end > nn_chunkref_size (part))
+            end = nn_chunkref_size (part);
+        if (start < end) {
+            iov [iovcnt].iov_base = ((uint8_t*) nn_chunkref_data (part)) +
+                start;
+            iov [iovcnt].iov_len = end - start;
+            ++iovcnt;
+        }
+        off += nn_chunkref_size (part);
+        if (off >= pos + len)
+            break;
+    }
+    return iovcnt;
+}
+
+/*  Returns the checksum of the data of the message frame, i.e. of
+    the header, the body and the fragments of the message. */
+static uint32_t nn_stream_crc (struct nn_msg *msg)
+{
+    int i;
+    uint32_t crc;
+    struct nn_chunkref *part;
+
+    crc = 0;
+    for (i = -2; i != (msg->frags ? msg->frags->count : 0); ++i) {
+        part = i == -2 ? &msg->hdr : i == -1 ? &msg->body :
+            &msg->frags->frag [i];
+        crc = nn_crc32c (crc, nn_chunkref_data (part),
+            nn_chunkref_size (part));
+    }
+    return crc;
+}
+
+static int nn_stream_getfile (struct nn_msg *msg, uint64_t *offset)
+{
+    struct nn_chunk *chunk;
+
+    if (msg->frags)
+        return -1;
+    chunk = nn_chunkref_peekchunk (&msg->body);
+    if (!chunk)
+        return -1;
+    return nn_chunk_getfile (chunk, offset);
+}
+
+static int nn_stream_isfull (struct nn_stream *self)
+{
+    struct nn_stream_batch *sending;
+    struct nn_stream_batch *waiting;
+
+    sending = &self->outbatches [self->outbatch];
+    waiting = &self->outbatches [!self->outbatch];
+    if (nn_stream_batch_isfull (waiting, self->outmaxmsgs,
+          self->outmaxbytes)) {
+        self->outfull = 1;
+        return 1;
+    }
+    if (self->outurgent && nn_stream_batch_isfull (
+          &self->outurgent [!self->outurgentbatch], self->outmaxmsgs,
+          self->outmaxbytes))
+        return 1;
+
+    /*  After the batch got full, wait for the data held for the connection,
+        i.e. the batch being sent and the one collected in the meantime, to
+        drain to the low-water marks. */
+    if (nn_slow (self->outfull)) {
+        if (sending->bytes + waiting->bytes > self->outlowat ||
+              (size_t) (sending->count - self->outmsg + waiting->count) >
+              self->outlowatmsgs)
+            return 1;
+        self->outfull = 0;
+    }
+    return 0;
+}
+
+static void nn_stream_unblock (struct nn_stream *self)
+{
+    /*  If the batches are full, this is called again once one of them is
+        being sent. If the budget is exhausted, once it's available. */
+    if (!self->outblocked || nn_stream_isfull (self))
+        return;
+    if (self->budget && nn_budget_wait (self->budget, &self->budgetwaiter))
+        return;
+    self->outblocked = 0;
+    nn_pipebase_sent (&self->pipebase);
+}
+
+static void nn_stream_take (struct nn_stream *self, size_t size)
+{
+    if (self->budget) {
+        nn_budget_take (self->budget, size);
+        self->inbudget += size;
+    }
+}
+
+static void nn_stream_give (struct nn_stream *self, size_t size)
+{
+    if (self->budget)
+        nn_budget_give (self->budget, size);
+}
+
+static void nn_stream_budget_ready (struct nn_budget_waiter *waiter)
+{
+    struct nn_stream *stream;
+
+    stream = nn_cont (waiter, struct nn_stream, budgetwaiter);
+    nn_event_signal (&stream->budgetevent);
+}
+
+static void nn_stream_budget_event (const struct nn_cp_sink **self,
+    struct nn_event *event)
+{
+    struct nn_stream *stream;
+
+    stream = nn_cont (self, struct nn_stream, sink);
+
+    /*  The budget is available again. Resume the message flows stopped
+        because of it. If it's exhausted by the time one of them resumes,
+        wait again. */
+    nn_budget_notified (stream->budget, &stream->budgetwaiter);
+    nn_stream_unblock (stream);
+    if (stream->inblocked &&
+          !nn_budget_wait (stream->budget, &stream->budgetwaiter)) {
+        stream->inblocked = 0;
+        nn_stream_recvhdr (stream);
+    }
+}
+
+static void nn_stream_parse (struct nn_stream *self)
+{
+    uint64_t size;
+    size_t avail;
+    size_t hdrlen;
+    const uint8_t *data;
+    struct nn_msg *msg;
+
+    /*  Extract all the complete messages that are already sitting in the
+        socket's batch buffer, so that they can be handed to the user without
+        going through the state machine for each one of them. An incomplete
+        message is left in the buffer to be received in the standard way. */
+    nn_trace2 (stream_received, self, nn_msg_bodysize (&self->inmsg));
+    nn_stream_take (self, nn_msg_bodysize (&self->inmsg));
+    self->inmsg.deadline = self->indeadline;
+    self->indeadline = 0;
+    if (nn_slow (self->intraced))
+        nn_stream_settrace (self, &self->inmsg);
+    self->incount = 0;
+    self->inpos = 0;
+    while (self->incount != self->inmaxmsgs) {
+        if (self->budget && nn_budget_isfull (self->budget))
+            break;
+        avail = nn_usock_peek (self->usock, (const void**) &data);
+        if (avail < 1)
+            break;
+        hdrlen = self->compact ? nn_stream_hdrlen (data [0]) : 8;
+        if (avail < hdrlen)
+            break;
+        size = self->compact ? nn_stream_getsize (data) : nn_getll (data);
+        if (nn_slow ((size & NN_STREAM_TTL_FLAG) == NN_STREAM_TTL_FLAG)) {
+            nn_stream_setdeadline (self, size & ~NN_STREAM_TTL_FLAG,
+                nn_usock_gettstamp (self->usock));
+            nn_usock_consume (self->usock, hdrlen);
+            continue;
+        }
+        if (nn_slow ((size & NN_STREAM_TRACE_MASK) == NN_STREAM_TRACE_FLAG)) {
+            if (size != (NN_TRACE_SIZE | NN_STREAM_TRACE_FLAG) ||
+                  avail < hdrlen + NN_TRACE_SIZE)
+                break;
+            memcpy (self->intrace, data + hdrlen, NN_TRACE_SIZE);
+            self->intraced = 1;
+            nn_usock_consume (self->usock, hdrlen + NN_TRACE_SIZE);
+            continue;
+        }
+        if (nn_slow ((size & NN_STREAM_TRACE_MASK) == NN_STREAM_CRC_FLAG)) {
+            if ((size & ~NN_STREAM_CRC_FLAG) > 0xffffffff)
+                break;
+            self->incrc = (uint32_t) size;
+            self->incrcset = 1;
+            nn_usock_consume (self->usock, hdrlen);
+            continue;
+        }
+        if (size > avail - hdrlen)
+            break;
+        msg = &self->inqueue [self->incount];
+        nn_stream_initmsg (self, msg, (size_t) size);
+        msg->tstamp = nn_usock_gettstamp (self->usock);
+        msg->deadline = self->indeadline;
+        self->indeadline = 0;
+        if (nn_slow (self->intraced))
+            nn_stream_settrace (self, msg);
+
+        /*  The checksum is computed while the data are being copied. If it
+            doesn't match, the message is left in the buffer for the state
+            machine to fail the connection. */
+        if (nn_slow (self->incrcset)) {
+            if (nn_crc32c_copy (0, nn_chunkref_data (&msg->body),
+                  data + hdrlen, (size_t) size) != self->incrc) {
+                nn_msg_term (msg);
+                break;
+            }
+            self->incrcset = 0;
+        }
+        else
+            memcpy (nn_chunkref_data (&msg->body), data + hdrlen,
+                (size_t) size);
+        nn_usock_consume (self->usock, hdrlen + (size_t) size);
+        nn_trace2 (stream_received, self, size);
+        nn_stream_take (self, (size_t) size);
+        ++self->incount;
+    }
+}
+
+static int nn_stream_mapfd (struct nn_stream *self)
+{
+    int rc;
+    int fd;
+    uint64_t offset;
+    uint64_t size;
+    size_t hdrsize;
+    struct nn_chunk *chunk;
+
+    /*  The file descriptor was received along with the data preceding
+        the description of the message. */
+    fd = nn_usock_recvfd (self->usock);
+    if (nn_slow (fd < 0))
+        return -EPROTO;
+
+    /*  Map the data into memory and fill in the message header in front
+        of them, so that the message looks the same as if it was copied. */
+    offset = nn_getll (self->infd);
+    size = nn_getll (self->infd + 8);
+    hdrsize = self->infdsize - 16;
+    rc = nn_chunk_mapfd (fd, offset > SIZE_MAX ? SIZE_MAX : (size_t) offset,
+        size > SIZE_MAX ? SIZE_MAX : (size_t) size, hdrsize, &chunk);
+    if (nn_slow (rc < 0))
+        return -EPROTO;
+    memcpy (nn_chunk_data (chunk), self->infd + 16, hdrsize);
+    nn_msg_term (&self->inmsg);
+    nn_msg_init_chunk (&self->inmsg, chunk);
+
+    return 0;
+}
+
+static int nn_stream_compress (struct nn_stream *self, struct nn_msg *msg)
+{
+    size_t size;
+    size_t clen;
+    size_t offset;
+    uint64_t fileoff;
+    uint8_t *data;
+    struct nn_chunk *chunk;
+    struct nn_chunkref body;
+
+    /*  Fragmented messages and messages to be passed by file descriptor
+        are sent as they are. */
+    size = nn_chunkref_size (&msg->body);
+    if (msg->frags || size < self->compress || size <= 16)
+        return 0;
+    if (self->fdpassing) {
+        chunk = nn_chunkref_peekchunk (&msg->body);
+        if (chunk && nn_chunk_getfd (chunk, &offset) >= 0)
+            return 0;
+    }
+
+    /*  So are the bodies stored in files. */
+    if (nn_stream_getfile (msg, &fileoff) >= 0)
+        return 0;
+
+    /*  Use the compressed body only if it, including the trailer, is smaller
+        than the original one. */
+    nn_chunkref_init (&body, size);
+    data = nn_chunkref_data (&body);
+    clen = nn_lz4_compress (nn_chunkref_data (&msg->body), size,
+        data, size - 16);
+    if (!clen) {
+        nn_chunkref_term (&body);
+        return 0;
+    }
+
+    /*  Move the compressed data to the end of the buffer, so that the unused
+        space can be trimmed away, and append the trailer. */
+    memmove (data + size - 16 - clen, data, clen);
+    nn_putll (data + size - 16, nn_chunkref_size (&msg->hdr));
+    nn_putll (data + size - 8, size);
+    nn_chunkref_trim (&body, size - 16 - clen);
+    nn_chunkref_term (&msg->body);
+    nn_chunkref_mv (&msg->body, &body);
+
+    return 1;
+}
+
+static int nn_stream_decompress (struct nn_stream *self)
+{
+    int rc;
+    uint8_t *data;
+    size_t size;
+    uint64_t hdrsize;
+    uint64_t bodysize;
+    struct nn_msg msg;
+
+    /*  Check the trailer before allocating the buffer for the message, so
+        that the peer can't make us allocate arbitrary amounts of memory. */
+    data = nn_chunkref_data (&self->inmsg.body);
+    size = nn_chunkref_size (&self->inmsg.body) - 16;
+    hdrsize = nn_getll (data + size);
+    bodysize = nn_getll (data + size + 8);
+    if (nn_slow (hdrsize > size ||
+          bodysize > (size - hdrsize) * (uint64_t) NN_LZ4_MAXRATIO))
+        return -EPROTO;
+
+    /*  The message header is stored uncompressed in front of the body. */
+    nn_stream_initmsg (self, &msg, (size_t) (hdrsize + bodysize));
+    memcpy (nn_chunkref_data (&msg.body), data, (size_t) hdrsize);
+    rc = nn_lz4_decompress (data + hdrsize, size - (size_t) hdrsize,
+        (uint8_t*) nn_chunkref_data (&msg.body) + hdrsize, (size_t) bodysize);
+    if (nn_slow (rc < 0)) {
+        nn_msg_term (&msg);
+        return rc;
+    }
+    nn_msg_term (&self->inmsg);
+    nn_msg_mv (&self->inmsg, &msg);
+
+    return 0;
+}
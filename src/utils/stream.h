@@ -24,9 +24,14 @@
 #define NN_STREAM_INCLUDED
 
 #include "../transport.h"
+#include "../aio/ticker.h"
+#include "../aio/flusher.h"
 
 #include "aio.h"
+#include "budget.h"
 #include "msg.h"
+#include "tls.h"
+#include "ws.h"
 
 #include <stdint.h>
 
@@ -34,6 +39,154 @@
 
 #define NN_STREAM_INSTATE_HDR 1
 #define NN_STREAM_INSTATE_BODY 2
+#define NN_STREAM_INSTATE_FD 3
+#define NN_STREAM_INSTATE_LZ4 4
+#define NN_STREAM_INSTATE_WSHDR 5
+#define NN_STREAM_INSTATE_WSEXT 6
+#define NN_STREAM_INSTATE_WSBODY 7
+#define NN_STREAM_INSTATE_WSCTL 8
+#define NN_STREAM_INSTATE_CHUNKHDR 9
+#define NN_STREAM_INSTATE_CHUNK 10
+#define NN_STREAM_INSTATE_HDREXT 11
+#define NN_STREAM_INSTATE_TRACE 12
+#define NN_STREAM_INSTATE_RECS 13
+#define NN_STREAM_INSTATE_RECBULK 14
+
+#define NN_STREAM_OUTSTATE_IDLE 1
+#define NN_STREAM_OUTSTATE_SENDING 2
+#define NN_STREAM_OUTSTATE_URGENT 3
+
+/*  While a batch of messages is being sent, subsequent messages are collected
+    into another batch that is sent using a single system call once the
+    previous one is done. These are the limits for the size of the batch. */
+#ifndef NN_STREAM_BATCH_MSGS
+#define NN_STREAM_BATCH_MSGS 16
+#endif
+#ifndef NN_STREAM_BATCH_BYTES
+#define NN_STREAM_BATCH_BYTES 65536
+#endif
+
+/*  If both peers support it, messages stored in memory files are passed
+    by file descriptor. Instead of the data, the message frame, marked by
+    the topmost bit of the size, contains the 8-byte offset and 8-byte size
+    of the data in the file, followed by the message header, which may be
+    at most NN_STREAM_FD_MAXHDR bytes long. */
+#define NN_STREAM_FD_FLAG (((uint64_t) 1) << 63)
+#ifndef NN_STREAM_FD_MAXHDR
+#define NN_STREAM_FD_MAXHDR 64
+#endif
+
+/*  If both peers support it, large message bodies may be compressed using
+    LZ4. The message frame, marked by the second topmost bit of the size,
+    contains the message header, the compressed body and the 8-byte size of
+    the header and 8-byte size of the original body. */
+#define NN_STREAM_LZ4_FLAG (((uint64_t) 1) << 62)
+
+/*  If both peers support it, messages longer than NN_STREAM_CHUNK bytes are
+    sent in chunks, so that urgent messages can be sent in between them.
+    Each chunk is a frame marked by the third topmost bit of the size. The
+    first chunk of a message starts with the 8-byte size of the message. */
+#define NN_STREAM_CHUNK_FLAG (((uint64_t) 1) << 61)
+#ifndef NN_STREAM_CHUNK
+#define NN_STREAM_CHUNK 65536
+#endif
+
+/*  If both peers support it, the frames of plain messages shorter than 4GB
+    start with a compact header rather than the 8-byte size. The first byte
+    of the header is the size plus one for messages of up to 28 bytes, or
+    NN_STREAM_COMPACT16 or NN_STREAM_COMPACT32, followed by 2-byte or 4-byte
+    size, for longer ones. The five lowest bits of the first byte of an 8-byte
+    size are always clear, while those of a compact header never are, so
+    the peer can still send frames of either kind. */
+#define NN_STREAM_COMPACT16 30
+#define NN_STREAM_COMPACT32 31
+
+/*  If both peers support it, either peer may ask the other one to send
+    heartbeats. The interval it asks for, in units of 100 milliseconds, is
+    stored in the seventh byte of its protocol header. Heartbeat is a chunk
+    frame of zero size. It's sent whenever nothing else was sent for
+    the interval. A peer that asked for heartbeats and received nothing for
+    a number of intervals considers the connection dead. */
+#define NN_STREAM_HEARTBEAT NN_STREAM_CHUNK_FLAG
+#define NN_STREAM_HEARTBEAT_UNIT 100
+
+/*  If both peers support it, a message with NN_SNDTTL deadline is preceded
+    by a frame marked by both the topmost and the second topmost bit of
+    the size. Instead of the size, it holds the number of milliseconds
+    the message has left to live, which is at most NN_STREAM_TTL_MAX so that
+    the frame can't be mistaken for a compact header. Messages with
+    a deadline are never sent in chunks. The receiver subtracts the time
+    the frame waited in its kernel buffers, once it has the timestamps of
+    the incoming data. */
+#define NN_STREAM_TTL_FLAG (NN_STREAM_FD_FLAG | NN_STREAM_LZ4_FLAG)
+#define NN_STREAM_TTL_MAX ((((uint64_t) 1) << 56) - 1)
+
+/*  If both peers support it, the trace context of a message is sent in
+    a frame preceding it, marked by the topmost and the third topmost bit of
+    the size, and containing the NN_TRACE_SIZE bytes of the context. Traced
+    messages are never sent in chunks. */
+#define NN_STREAM_TRACE_FLAG (NN_STREAM_FD_FLAG | NN_STREAM_CHUNK_FLAG)
+#define NN_STREAM_TRACE_MASK \
+    (NN_STREAM_FD_FLAG | NN_STREAM_LZ4_FLAG | NN_STREAM_CHUNK_FLAG)
+
+/*  If both peers support it, a message may be preceded by a frame marked by
+    the second and the third topmost bit of the size. Instead of the size,
+    its lowest 32 bits hold the CRC32C checksum of the data of the message
+    frame that follows, as sent, i.e. after compression. Checksummed messages
+    are never sent in chunks or passed by file descriptor. */
+#define NN_STREAM_CRC_FLAG (NN_STREAM_LZ4_FLAG | NN_STREAM_CHUNK_FLAG)
+
+/*  If the underlying socket preserves the boundaries of the records, i.e.
+    it's a SOCK_SEQPACKET one, the protocol headers are exchanged as records
+    of their own, announcing none of the features above. Each message is
+    then sent as a single record, starting with a byte of flags instead of
+    the size. A message that doesn't fit into a record of NN_STREAM_RECORD
+    bytes is marked by NN_STREAM_RECORD_MORE flag, followed by the 8-byte
+    size of the message, and the rest of it is sent in records of
+    NN_STREAM_RECORD bytes, the last one possibly shorter, which carry
+    nothing but the data. There are no empty records, the peer would take
+    one for the end of the connection. */
+#ifndef NN_STREAM_RECORD
+#define NN_STREAM_RECORD 4096
+#endif
+#define NN_STREAM_RECORD_MORE 1
+
+struct nn_stream_batch {
+
+    /*  Number of messages in the batch. */
+    int count;
+
+    /*  Total size of the messages in the batch, in bytes. */
+    size_t bytes;
+
+    /*  Number of iovecs needed to send the batch. */
+    int iovcnt;
+
+    /*  Buffers used to store the headers of the messages and their sizes.
+        The header of a message passed by file descriptor also contains
+        the position of the data within the file. The header of a message
+        with a deadline is preceded by the time-to-live frame, the header of
+        a traced message by the trace context frame. */
+    uint8_t hdrs [NN_STREAM_BATCH_MSGS][64];
+    size_t hdrlens [NN_STREAM_BATCH_MSGS];
+
+    /*  1 for the messages passed by file descriptor, 0 for the others. */
+    uint8_t fdmsgs [NN_STREAM_BATCH_MSGS];
+
+    /*  1 for the messages whose headers were written in front of the body,
+        so that the whole message is sent from a single buffer. */
+    uint8_t inlined [NN_STREAM_BATCH_MSGS];
+
+    /*  File descriptors to be passed along with the batch. */
+    int fds [NN_USOCK_MAX_FDS];
+    int nfds;
+
+    /*  Memory the messages in the batch drew from the budget. */
+    size_t budget;
+
+    /*  The messages themselves. */
+    struct nn_msg msgs [NN_STREAM_BATCH_MSGS];
+};
 
 struct nn_stream {
 
@@ -49,6 +202,78 @@ struct nn_stream {
     /*  Protocol header. */
     uint8_t protohdr [8];
 
+    /*  1 if messages can be passed to the peer by file descriptor, 0
+        otherwise. */
+    int fdpassing;
+
+    /*  1 if large messages can be sent to the peer in chunks, 0 otherwise. */
+    int chunks;
+
+    /*  1 if both peers use the compact message headers, 0 otherwise. */
+    int compact;
+
+    /*  1 if the deadlines of the messages are passed to the peer, 0
+        otherwise. */
+    int ttl;
+
+    /*  1 if the trace contexts of the messages are passed to the peer, 0
+        otherwise. */
+    int trace;
+
+    /*  1 if the messages are sent along with their checksums, 0 otherwise. */
+    int crc;
+
+    /*  Messages with body at least this long are compressed. 0 if the
+        messages are not to be compressed or the peer can't decompress them. */
+    size_t compress;
+
+    /*  Heartbeat interval and number of missed intervals after which
+        the peer is considered dead, as set by the user. Once the protocol
+        headers are exchanged, a heartbeat is sent if nothing was sent for
+        'hbsend' ticks and the connection is closed if nothing was received
+        for more than 'hbtimeout' ticks while the data were being read. Zero
+        means never. 'hbsent' and 'hbrecvd' count the ticks since the last
+        send and receive. */
+    int hbivl;
+    int hbmisses;
+    int hbsend;
+    int hbtimeout;
+    int hbsent;
+    int hbrecvd;
+    struct nn_tick hbtick;
+
+    /*  Memory budget shared with the other pipes of the socket, NULL if
+        there's none. Messages waiting to be sent and messages received but
+        not yet passed to the user draw from it, 'inbudget' being the memory
+        held by the latter. Once the budget is exhausted, no more messages
+        are accepted from the user and, with 'inblocked' set, no more are
+        read from the peer, until 'budgetevent' is signalled. */
+    struct nn_budget *budget;
+    size_t inbudget;
+    int inblocked;
+    struct nn_budget_waiter budgetwaiter;
+    struct nn_event budgetevent;
+
+    /*  If TLS is used, the TLS handshake precedes the protocol header
+        exchange. 'tlsdone' is set to 1 once the local side of the handshake
+        is complete. */
+    struct nn_tls_session tls;
+    int tlsdone;
+
+    /*  If set, the protocol header exchange is replaced by the WebSocket
+        opening handshake and the messages are sent as WebSocket frames.
+        'wsserver' is set on the accepting side. 'wsaddr' is the address of
+        the endpoint and 'wsproto' the name of the protocol of the server.
+        The HTTP request or response is stored in 'wsbuf' while the
+        handshake is in progress. */
+    int ws;
+    int wsserver;
+    const char *wsaddr;
+    const char *wsproto;
+    char wskey [NN_WS_KEYLEN];
+    char *wsbuf;
+    size_t wslen;
+
     /*  If header is not received in certain amount of time, connection is
         closed. This solves a rare race condition in TCP. It also minimises
         the usage of resources in case of erroneous connections. Also, it
@@ -61,17 +286,145 @@ struct nn_stream {
     /*  Buffer used to store the header of incoming message. */
     uint8_t inhdr [8];
 
-    /*  Message being received at the moment. */
+    /*  Buffer used to store the description of incoming message passed
+        by file descriptor and its size. */
+    uint8_t infd [16 + NN_STREAM_FD_MAXHDR];
+    size_t infdsize;
+
+    /*  Message being received at the moment and the time its first bytes
+        were received, if NN_RCVTIMESTAMP is set. */
     struct nn_msg inmsg;
+    uint64_t intstamp;
+
+    /*  1 once the kernel was asked to timestamp the incoming data, 0
+        otherwise. */
+    int tstamping;
+
+    /*  Deadline of the next message to be received, as carried by the
+        time-to-live frame preceding it. Zero if there's none. */
+    uint64_t indeadline;
+
+    /*  Trace context of the next message to be received, as carried by
+        the trace context frame preceding it, if 'intraced' is set. */
+    uint8_t intrace [NN_TRACE_SIZE];
+    int intraced;
+
+    /*  Checksum of the next message to be received, as carried by
+        the checksum frame preceding it, if 'incrcset' is set. */
+    uint32_t incrc;
+    int incrcset;
+
+    /*  Allocation mechanism the bodies of the incoming messages are
+        allocated with, as set by NN_RCVALLOC. */
+    int rcvalloc;
+
+    /*  Message being received in chunks, if 'inbulksize' is not zero, the
+        number of its bytes received so far and the time its first bytes
+        were received. 'inchunk' is the size of the chunk being received.
+        If 'rcvchunks' is set, the chunks are passed to the user one by one
+        as they arrive and 'inbulk' is not used. */
+    int rcvchunks;
+    struct nn_msg inbulk;
+    size_t inbulksize;
+    size_t inbulkpos;
+    uint64_t inbulktstamp;
+    size_t inchunk;
+
+    /*  Header of the incoming WebSocket frame. If 'wsfrag' is set, a message
+        split into several frames is being received and 'wspos' is where the
+        data of the current frame go. Payload of control frames is stored in
+        'wsctl'. */
+    uint8_t wshdr [NN_WS_MAXHDR];
+    struct nn_ws_frame wsframe;
+    int wsfrag;
+    size_t wspos;
+    uint8_t wsctl [NN_WS_MAXCTL];
+
+    /*  Complete messages that were found in the data already read from the
+        socket, waiting to be passed to the user after 'inmsg'. The queued
+        messages are inqueue [inpos] to inqueue [incount - 1]. */
+    struct nn_msg inqueue [NN_STREAM_BATCH_MSGS];
+    int incount;
+    int inpos;
+
+    /*  Maximum number of messages to store in 'inqueue', derived from
+        NN_RCVBUFMSGS. */
+    int inmaxmsgs;
 
     /*  State of the outbound state machine. */
     int outstate;
 
-    /*  Buffer used to store the header of outgoing message. */
-    uint8_t outhdr [8];
+    /*  Batch of messages being sent at the moment and the batch of messages
+        waiting to be sent. 'outbatch' is the index of the former one. */
+    struct nn_stream_batch outbatches [2];
+    int outbatch;
+
+    /*  The batch being sent may be sent in several steps if there are
+        messages to be sent in chunks. 'outmsg' is the first message that
+        was not completely sent yet, 'outpos' the number of its bytes sent
+        so far and 'outfd' the number of file descriptors sent. The step in
+        progress sends the messages up to 'outend' or, if 'outchunk' is not
+        zero, a chunk of 'outmsg' that many bytes long, with the frame header
+        stored in 'outchunkhdr'. */
+    int outmsg;
+    size_t outpos;
+    int outfd;
+    int outend;
+    size_t outchunk;
+    uint8_t outchunkhdr [16];
+
+    /*  If the body of the last message of the step is stored in a file, it's
+        sent by the kernel straight from 'outfile', 'outfilelen' bytes
+        starting at 'outfileoff', once the rest of the step is sent. -1 if
+        there's no such body. */
+    int outfile;
+    uint64_t outfileoff;
+    size_t outfilelen;
 
-    /*  Message being sent at the moment. */
-    struct nn_msg outmsg;
+    /*  Batch of urgent messages being sent at the moment and the batch of
+        urgent messages waiting to be sent, which goes before any further
+        step of the batch above. Allocated once the first urgent message is
+        sent. 'outurgentbatch' is the index of the former one. */
+    struct nn_stream_batch *outurgent;
+    int outurgentbatch;
+
+    /*  While nn_stream_pump is sending messages, points to the variable
+        the outcome of the send in progress is stored to, so that sends that
+        complete straight away don't nest. NULL otherwise. */
+    int *outstatus;
+
+    /*  If 1, the pipe was not released after the last message was queued
+        because the batch is full. */
+    int outblocked;
+
+    /*  Limits for the batch waiting to be sent, derived from NN_SNDBUFMSGS
+        and NN_SNDBUF. */
+    int outmaxmsgs;
+    size_t outmaxbytes;
+
+    /*  Low-water marks, derived from NN_SNDLOWAT and NN_SNDLOWATMSGS. Once
+        the batch waiting to be sent gets full, 'outfull' is set and the pipe
+        is not released until the data held for the connection drop to
+        the marks. */
+    size_t outlowat;
+    size_t outlowatmsgs;
+    int outfull;
+
+    /*  Send batching, derived from NN_SNDBATCH and NN_SNDBATCHBYTES. While
+        no send is in progress, the messages are held for up to 'outdelay'
+        microseconds, or until the batch waiting to be sent holds
+        'outdelaybytes' bytes, and then sent all at once. Zero 'outdelay'
+        means the messages are sent straight away. */
+    int outdelay;
+    size_t outdelaybytes;
+    struct nn_flush outflush;
+
+    /*  1 if the messages are sent as records (see NN_STREAM_RECORD), 0
+        otherwise. The incoming records are read in batches into 'inrecs',
+        which is allocated once needed, as described by 'indgrams'. */
+    int seqpacket;
+    uint8_t *inrecs;
+    struct nn_usock_dgram *indgrams;
 
     /*  Stores the sink of the parent state machine while this state machine
         does its job. */
@@ -82,4 +435,14 @@ void nn_stream_init (struct nn_stream *self, struct nn_epbase *epbase,
     struct nn_usock *usock);
 void nn_stream_term ();
 
+/*  Hot restart (see nn_handoff). If the connection can be passed over to
+    another process, nn_stream_handoff stores the peer's protocol header
+    into 'hdr' and returns 0. Otherwise, e.g. if a message is being sent or
+    received at the moment, it returns -EAGAIN. nn_stream_adopt is the same
+    as nn_stream_init except that the connection is taken as established,
+    'hdr' being the header the peer sent. */
+int nn_stream_handoff (struct nn_stream *self, uint8_t *hdr);
+void nn_stream_adopt (struct nn_stream *self, struct nn_epbase *epbase,
+    struct nn_usock *usock, const uint8_t *hdr);
+
 #endif
@@ -23,6 +23,173 @@
 #include "thread.h"
 #include "err.h"
 
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*  Max number of CPUs the library's threads can be pinned to. */
+#define NN_THREAD_MAX_CPUS 1024
+
+/*  Max number of NUMA nodes the library's threads can be spread over. */
+#define NN_THREAD_MAX_NODES 64
+
+/*  Attributes of the library's own threads, as set by nn_thread_setup. */
+struct nn_thread_attrs {
+
+    /*  Bitmap of CPUs the threads should run on. If 'ncpus' is zero,
+        the threads are not pinned. */
+    unsigned char cpus [NN_THREAD_MAX_CPUS / 8];
+    int ncpus;
+
+    /*  If non-zero, the threads are scheduled as realtime with this
+        priority. */
+    int priority;
+
+    /*  If 'hasnice' is set, the threads get 'nice' niceness. Ignored
+        for realtime threads. */
+    int hasnice;
+    int nice;
+
+    /*  Number of NUMA nodes and the bitmaps of their CPUs. If 'nnodes' is 1,
+        NUMA is not in use. */
+    int nnodes;
+    unsigned char nodecpus [NN_THREAD_MAX_NODES][NN_THREAD_MAX_CPUS / 8];
+};
+
+static struct nn_thread_attrs nn_thread_attrs;
+
+/*  Private functions. */
+static int nn_thread_parse_cpus (const char *str, unsigned char *cpus);
+static void nn_thread_setup_numa (void);
+static void nn_thread_apply (struct nn_thread *self);
+
+void nn_thread_setup (void)
+{
+    const char *env;
+
+    memset (&nn_thread_attrs, 0, sizeof (nn_thread_attrs));
+
+    env = getenv ("NN_THREAD_CPUS");
+    if (env)
+        nn_thread_attrs.ncpus = nn_thread_parse_cpus (env,
+            nn_thread_attrs.cpus);
+
+    env = getenv ("NN_THREAD_PRIORITY");
+    if (env && atoi (env) > 0)
+        nn_thread_attrs.priority = atoi (env);
+
+    env = getenv ("NN_THREAD_NICE");
+    if (env) {
+        nn_thread_attrs.hasnice = 1;
+        nn_thread_attrs.nice = atoi (env);
+    }
+
+    nn_thread_attrs.nnodes = 1;
+    env = getenv ("NN_THREAD_NUMA");
+    if (!env || atoi (env) > 0)
+        nn_thread_setup_numa ();
+}
+
+int nn_thread_nodes (void)
+{
+    return nn_thread_attrs.nnodes;
+}
+
+/*  Parses list of CPUs such as "0-3,8" into a bitmap and returns the number
+    of CPUs in it. If the list is malformed, the bitmap is left empty rather
+    than filled with some unexpected subset. */
+static int nn_thread_parse_cpus (const char *str, unsigned char *cpus)
+{
+    char *end;
+    long first;
+    long last;
+    int ncpus;
+
+    ncpus = 0;
+    while (*str && *str != '\n') {
+        first = strtol (str, &end, 10);
+        if (end == str || first < 0)
+            goto invalid;
+        str = end;
+        last = first;
+        if (*str == '-') {
+            ++str;
+            last = strtol (str, &end, 10);
+            if (end == str || last < first)
+                goto invalid;
+            str = end;
+        }
+        if (*str == ',')
+            ++str;
+        else if (*str && *str != '\n')
+            goto invalid;
+        for (; first <= last && first < NN_THREAD_MAX_CPUS; ++first) {
+            if (!(cpus [first / 8] & (1 << (first % 8)))) {
+                cpus [first / 8] |= 1 << (first % 8);
+                ++ncpus;
+            }
+        }
+    }
+    return ncpus;
+
+invalid:
+    memset (cpus, 0, NN_THREAD_MAX_CPUS / 8);
+    return 0;
+}
+
+/*  Reads the NUMA topology from sysfs. If anything is amiss, NUMA is simply
+    not used. */
+static void nn_thread_setup_numa (void)
+{
+#if defined NN_HAVE_LINUX
+    FILE *f;
+    char buf [4096];
+    unsigned char nodes [NN_THREAD_MAX_CPUS / 8];
+    int nnodes;
+    int i;
+
+    f = fopen ("/sys/devices/system/node/online", "r");
+    if (!f)
+        return;
+    memset (nodes, 0, sizeof (nodes));
+    if (!fgets (buf, sizeof (buf), f) ||
+          nn_thread_parse_cpus (buf, nodes) < 2) {
+        fclose (f);
+        return;
+    }
+    fclose (f);
+
+    /*  The nodes are numbered from zero. Nodes without CPUs, such as those
+        of memory expanders, have empty bitmaps. */
+    for (nnodes = NN_THREAD_MAX_NODES; nnodes > 0; --nnodes)
+        if (nodes [(nnodes - 1) / 8] & (1 << ((nnodes - 1) % 8)))
+            break;
+    for (i = 0; i != nnodes; ++i) {
+        snprintf (buf, sizeof (buf), "/sys/devices/system/node/node%d/cpulist",
+            i);
+        f = fopen (buf, "r");
+        if (!f)
+            continue;
+        if (fgets (buf, sizeof (buf), f))
+            nn_thread_parse_cpus (buf, nn_thread_attrs.nodecpus [i]);
+        fclose (f);
+    }
+    nn_thread_attrs.nnodes = nnodes;
+#endif
+}
+
+void nn_thread_init_named (struct nn_thread *self, const char *name,
+    nn_thread_routine *routine, void *arg)
+{
+    nn_thread_init_node (self, name, -1, routine, arg);
+}
+
+void nn_thread_init (struct nn_thread *self,
+    nn_thread_routine *routine, void *arg)
+{
+    nn_thread_init_named (self, NULL, routine, arg);
+}
+
 #ifdef NN_HAVE_WINDOWS
 
 static unsigned int __stdcall nn_thread_main_routine (void *arg)
@@ -30,15 +197,43 @@ static unsigned int __stdcall nn_thread_main_routine (void *arg)
     struct nn_thread *self;
 
     self = (struct nn_thread*) arg;
+    if (self->name)
+        nn_thread_apply (self);
     self->routine (self->arg);
     return 0;
 }
 
-void nn_thread_init (struct nn_thread *self,
-    nn_thread_routine *routine, void *arg)
+/*  The attributes are applied on a best-effort basis. The thread is not
+    named as there's no API for that on older versions of Windows. */
+static void nn_thread_apply (struct nn_thread *self)
+{
+    int i;
+    DWORD_PTR mask;
+
+    if (nn_thread_attrs.ncpus) {
+        mask = 0;
+        for (i = 0; i != sizeof (mask) * 8; ++i)
+            if (nn_thread_attrs.cpus [i / 8] & (1 << (i % 8)))
+                mask |= ((DWORD_PTR) 1) << i;
+        if (mask)
+            SetThreadAffinityMask (GetCurrentThread (), mask);
+    }
+
+    if (nn_thread_attrs.priority)
+        SetThreadPriority (GetCurrentThread (), THREAD_PRIORITY_TIME_CRITICAL);
+    else if (nn_thread_attrs.hasnice && nn_thread_attrs.nice > 0)
+        SetThreadPriority (GetCurrentThread (), THREAD_PRIORITY_BELOW_NORMAL);
+    else if (nn_thread_attrs.hasnice && nn_thread_attrs.nice < 0)
+        SetThreadPriority (GetCurrentThread (), THREAD_PRIORITY_ABOVE_NORMAL);
+}
+
+void nn_thread_init_node (struct nn_thread *self, const char *name,
+    int node, nn_thread_routine *routine, void *arg)
 {
     self->routine = routine;
     self->arg = arg;
+    self->name = name;
+    self->node = node;
     self->handle = (HANDLE) _beginthreadex (NULL, 0,
         nn_thread_main_routine, (void*) self, 0 , &self->tid);
     win_assert (self->handle != NULL);
@@ -60,9 +255,27 @@ int nn_thread_current (struct nn_thread *self)
     return ((unsigned int) GetCurrentThreadId ()) == self->tid ? 1 : 0;
 }
 
+int nn_thread_node (void)
+{
+    return 0;
+}
+
+void nn_thread_setcpu (int cpu)
+{
+}
+
 #else
 
 #include <signal.h>
+#include <sched.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+
+#if defined NN_HAVE_LINUX
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <sys/prctl.h>
+#endif
 
 static void *nn_thread_main_routine (void *arg)
 {
@@ -80,18 +293,76 @@ static void *nn_thread_main_routine (void *arg)
     rc = pthread_sigmask (SIG_BLOCK, &sigset, NULL);
     errnum_assert (rc == 0, rc);
 
+    /*  Set up the library's own threads as requested by the user. */
+    if (self->name)
+        nn_thread_apply (self);
+
     /*  Run the thread routine. */
     self->routine (self->arg);
     return NULL;
 }
 
-void nn_thread_init (struct nn_thread *self,
-    nn_thread_routine *routine, void *arg)
+/*  The attributes are applied on a best-effort basis. For example, realtime
+    priority requires privileges the process may not have, in which case
+    the thread simply keeps the default scheduling. The raw syscalls are used
+    on Linux so that no GNU extensions are needed. */
+static void nn_thread_apply (struct nn_thread *self)
+{
+    int max;
+    struct sched_param param;
+#if defined NN_HAVE_LINUX
+    int i;
+    const unsigned char *cpus;
+    unsigned long mask [NN_THREAD_MAX_CPUS / (sizeof (unsigned long) * 8)];
+#endif
+
+#if defined NN_HAVE_LINUX
+    prctl (PR_SET_NAME, self->name, 0, 0, 0);
+#elif defined NN_HAVE_OSX
+    pthread_setname_np (self->name);
+#endif
+
+#if defined NN_HAVE_LINUX
+    /*  CPUs set by the user take precedence over the NUMA node. */
+    cpus = NULL;
+    if (nn_thread_attrs.ncpus)
+        cpus = nn_thread_attrs.cpus;
+    else if (self->node >= 0 && self->node < nn_thread_attrs.nnodes &&
+          nn_thread_attrs.nnodes > 1)
+        cpus = nn_thread_attrs.nodecpus [self->node];
+    if (cpus) {
+        memset (mask, 0, sizeof (mask));
+        for (i = 0; i != NN_THREAD_MAX_CPUS; ++i)
+            if (cpus [i / 8] & (1 << (i % 8)))
+                mask [i / (sizeof (unsigned long) * 8)] |=
+                    1ul << (i % (sizeof (unsigned long) * 8));
+        syscall (__NR_sched_setaffinity, 0, sizeof (mask), mask);
+    }
+#endif
+
+    if (nn_thread_attrs.priority) {
+        max = sched_get_priority_max (SCHED_FIFO);
+        param.sched_priority = nn_thread_attrs.priority > max ?
+            max : nn_thread_attrs.priority;
+        pthread_setschedparam (pthread_self (), SCHED_FIFO, &param);
+    }
+#if defined NN_HAVE_LINUX
+    /*  On Linux, niceness is a per-thread attribute. */
+    else if (nn_thread_attrs.hasnice)
+        setpriority (PRIO_PROCESS, (id_t) syscall (__NR_gettid),
+            nn_thread_attrs.nice);
+#endif
+}
+
+void nn_thread_init_node (struct nn_thread *self, const char *name,
+    int node, nn_thread_routine *routine, void *arg)
 {
     int rc;
 
     self->routine = routine;
     self->arg = arg;
+    self->name = name;
+    self->node = node;
     rc = pthread_create (&self->handle, NULL, nn_thread_main_routine,
         (void*) self);
     errnum_assert (rc == 0, rc);
@@ -110,5 +381,40 @@ int nn_thread_current (struct nn_thread *self)
     return pthread_equal (pthread_self (), self->handle) ? 1 : 0;
 }
 
+int nn_thread_node (void)
+{
+#if defined NN_HAVE_LINUX && defined __NR_getcpu
+    unsigned cpu;
+    unsigned node;
+
+    if (nn_thread_attrs.nnodes <= 1)
+        return 0;
+    if (syscall (__NR_getcpu, &cpu, &node, NULL) != 0 ||
+          node >= (unsigned) nn_thread_attrs.nnodes)
+        return 0;
+    return (int) node;
+#else
+    return 0;
+#endif
+}
+
+void nn_thread_setcpu (int cpu)
+{
+#if defined NN_HAVE_LINUX
+    unsigned long mask [NN_THREAD_MAX_CPUS / (sizeof (unsigned long) * 8)];
+
+    /*  The CPUs set by the user are not to be left. */
+    if (cpu < 0 || cpu >= NN_THREAD_MAX_CPUS)
+        return;
+    if (nn_thread_attrs.ncpus &&
+          !(nn_thread_attrs.cpus [cpu / 8] & (1 << (cpu % 8))))
+        return;
+    memset (mask, 0, sizeof (mask));
+    mask [cpu / (sizeof (unsigned long) * 8)] =
+        1ul << (cpu % (sizeof (unsigned long) * 8));
+    syscall (__NR_sched_setaffinity, 0, sizeof (mask), mask);
+#endif
+}
+
 #endif
 
@@ -37,6 +37,8 @@ struct nn_thread
 {
     nn_thread_routine *routine;
     void *arg;
+    const char *name;
+    int node;
 #ifdef NN_HAVE_WINDOWS
     HANDLE handle;
     unsigned int tid;
@@ -47,11 +49,40 @@ struct nn_thread
 
 void nn_thread_init (struct nn_thread *self,
     nn_thread_routine *routine, void *arg);
+
+/*  Launches one of the library's own threads. The thread is named 'name'
+    (as shown by top, perf and debuggers) and gets the CPU affinity and
+    scheduling priority configured by nn_thread_setup. */
+void nn_thread_init_named (struct nn_thread *self, const char *name,
+    nn_thread_routine *routine, void *arg);
+
+/*  Same as nn_thread_init_named, except that the thread runs on the CPUs of
+    NUMA node 'node', unless the CPUs are set by NN_THREAD_CPUS. Negative
+    'node' means any node. */
+void nn_thread_init_node (struct nn_thread *self, const char *name,
+    int node, nn_thread_routine *routine, void *arg);
 void nn_thread_term (struct nn_thread *self);
 
 /*  Returns 1 if the current thread is the one managed by the nn_thread object,
     0 otherwise. */
 int nn_thread_current (struct nn_thread *self);
 
+/*  Reads the attributes of the library's own threads from NN_THREAD_CPUS,
+    NN_THREAD_PRIORITY and NN_THREAD_NICE environment variables and the NUMA
+    topology of the machine, unless NN_THREAD_NUMA environment variable is
+    set to 0. Must not be called while any named threads are running. */
+void nn_thread_setup (void);
+
+/*  Returns the number of NUMA nodes, 1 if NUMA is not in use. */
+int nn_thread_nodes (void);
+
+/*  Returns the NUMA node the calling thread runs on at the moment, 0 if NUMA
+    is not in use. */
+int nn_thread_node (void);
+
+/*  Pins the calling thread to the CPU, unless the CPU is not among those
+    set by NN_THREAD_CPUS. Linux only; elsewhere it does nothing. */
+void nn_thread_setcpu (int cpu);
+
 #endif
 
@@ -0,0 +1,459 @@
+/*
+    Copyright (c) 2013 250bpm s.r.o.
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"),
+    to deal in the Software without restriction, including without limitation
+    the rights to use, copy, modify, merge, publish, distribute, sublicense,
+    and/or sell copies of the Software, and to permit persons to whom
+    the Software is furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included
+    in all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+    THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+    FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+    IN THE SOFTWARE.
+*/
+
+#include "tls.h"
+#include "err.h"
+#include "alloc.h"
+#include "fast.h"
+
+#include "../aio/aio.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#if defined NN_USE_TLS
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <unistd.h>
+#include <linux/tls.h>
+
+#include <openssl/ssl.h>
+#include <openssl/err.h>
+#include <openssl/evp.h>
+#include <openssl/kdf.h>
+
+#ifndef SOL_TLS
+#define SOL_TLS 282
+#endif
+#ifndef TCP_ULP
+#define TCP_ULP 31
+#endif
+
+/*  The ciphers that kernel TLS is able to use. */
+#define NN_TLS_CIPHERSUITES "TLS_AES_128_GCM_SHA256:TLS_AES_256_GCM_SHA384"
+
+/*  Private functions. */
+static int nn_tls_available (void);
+static void nn_tls_keylog (const SSL *ssl, const char *line);
+static int nn_tls_expand (const EVP_MD *md, const uint8_t *secret,
+    size_t secretlen, const char *label, uint8_t *out, size_t outlen);
+
+int nn_tls_create (const char *cert, const char *key, const char *ca,
+    struct nn_tls **result)
+{
+    int rc;
+    SSL_CTX *ctx;
+
+    if (nn_slow (!nn_tls_available ()))
+        return -ENOTSUP;
+
+    ctx = SSL_CTX_new (TLS_method ());
+    alloc_assert (ctx);
+
+    /*  Restrict the handshake to what the kernel can deal with afterwards.
+        Session tickets are disabled because they would be sent encrypted
+        after the handshake, before the keys are passed to the kernel. */
+    rc = SSL_CTX_set_min_proto_version (ctx, TLS1_3_VERSION);
+    nn_assert (rc == 1);
+    rc = SSL_CTX_set_max_proto_version (ctx, TLS1_3_VERSION);
+    nn_assert (rc == 1);
+    rc = SSL_CTX_set_ciphersuites (ctx, NN_TLS_CIPHERSUITES);
+    nn_assert (rc == 1);
+    rc = SSL_CTX_set_num_tickets (ctx, 0);
+    nn_assert (rc == 1);
+    SSL_CTX_set_options (ctx, SSL_OP_NO_TICKET);
+    SSL_CTX_set_session_cache_mode (ctx, SSL_SESS_CACHE_OFF);
+    SSL_CTX_set_keylog_callback (ctx, nn_tls_keylog);
+
+    /*  Load the local identity and the trusted certificates. */
+    if (cert) {
+        rc = SSL_CTX_use_certificate_chain_file (ctx, cert);
+        if (nn_slow (rc != 1))
+            goto inval;
+    }
+    if (key) {
+        rc = SSL_CTX_use_PrivateKey_file (ctx, key, SSL_FILETYPE_PEM);
+        if (nn_slow (rc != 1))
+            goto inval;
+    }
+    if (cert && key) {
+        rc = SSL_CTX_check_private_key (ctx);
+        if (nn_slow (rc != 1))
+            goto inval;
+    }
+    if (ca) {
+        rc = SSL_CTX_load_verify_locations (ctx, ca, NULL);
+        if (nn_slow (rc != 1))
+            goto inval;
+        SSL_CTX_set_verify (ctx,
+            SSL_VERIFY_PEER | SSL_VERIFY_FAIL_IF_NO_PEER_CERT, NULL);
+    }
+
+    *result = (struct nn_tls*) ctx;
+    return 0;
+
+inval:
+    ERR_clear_error ();
+    SSL_CTX_free (ctx);
+    return -EINVAL;
+}
+
+void nn_tls_addref (struct nn_tls *self)
+{
+    int rc;
+
+    rc = SSL_CTX_up_ref ((SSL_CTX*) self);
+    nn_assert (rc == 1);
+}
+
+void nn_tls_release (struct nn_tls *self)
+{
+    SSL_CTX_free ((SSL_CTX*) self);
+}
+
+void nn_tls_session_init (struct nn_tls_session *self)
+{
+    self->ssl = NULL;
+    self->in = NULL;
+    self->out = NULL;
+    self->outlen = 0;
+    self->outsize = 0;
+}
+
+void nn_tls_session_term (struct nn_tls_session *self)
+{
+    if (self->ssl) {
+        SSL_free ((SSL*) self->ssl);
+        self->ssl = NULL;
+    }
+    if (self->in) {
+        nn_free (self->in);
+        self->in = NULL;
+    }
+    if (self->out) {
+        nn_free (self->out);
+        self->out = NULL;
+    }
+    OPENSSL_cleanse (self->secrets, sizeof (self->secrets));
+}
+
+int nn_tls_session_start (struct nn_tls_session *self, struct nn_tls *tls,
+    int server)
+{
+    SSL *ssl;
+    BIO *rbio;
+    BIO *wbio;
+
+    /*  The handshake messages are exchanged via memory buffers. The records
+        are read from the socket one by one so that no encrypted data are
+        read before the keys are passed to the kernel. */
+    ssl = SSL_new ((SSL_CTX*) tls);
+    alloc_assert (ssl);
+    rbio = BIO_new (BIO_s_mem ());
+    alloc_assert (rbio);
+    wbio = BIO_new (BIO_s_mem ());
+    alloc_assert (wbio);
+    SSL_set_bio (ssl, rbio, wbio);
+    SSL_set_app_data (ssl, self);
+    if (server)
+        SSL_set_accept_state (ssl);
+    else
+        SSL_set_connect_state (ssl);
+
+    self->ssl = ssl;
+    self->server = server;
+    self->in = nn_alloc (NN_TLS_RECORD_HDR + NN_TLS_MAX_RECORD,
+        "TLS record");
+    alloc_assert (self->in);
+    self->secretlens [0] = 0;
+    self->secretlens [1] = 0;
+
+    return 0;
+}
+
+int nn_tls_session_handshake (struct nn_tls_session *self, const void *data,
+    size_t len)
+{
+    int rc;
+    int done;
+    size_t pending;
+    SSL *ssl;
+
+    ssl = (SSL*) self->ssl;
+    nn_assert (ssl);
+
+    /*  Pass the received data to OpenSSL and move the handshake forward. */
+    if (len) {
+        rc = BIO_write (SSL_get_rbio (ssl), data, (int) len);
+        nn_assert (rc == (int) len);
+    }
+    rc = SSL_do_handshake (ssl);
+    done = rc == 1;
+    if (!done && SSL_get_error (ssl, rc) != SSL_ERROR_WANT_READ) {
+        ERR_clear_error ();
+        return -EPROTO;
+    }
+
+    /*  Any data following the handshake would be missed by the kernel. */
+    if (nn_slow (done && BIO_ctrl_pending (SSL_get_rbio (ssl))))
+        return -EPROTO;
+
+    /*  Collect the data to be sent to the peer. */
+    self->outlen = 0;
+    pending = BIO_ctrl_pending (SSL_get_wbio (ssl));
+    if (pending) {
+        if (pending > self->outsize) {
+            self->out = nn_realloc (self->out, pending);
+            alloc_assert (self->out);
+            self->outsize = pending;
+        }
+        rc = BIO_read (SSL_get_wbio (ssl), self->out, (int) pending);
+        nn_assert (rc == (int) pending);
+        self->outlen = pending;
+    }
+
+    return done;
+}
+
+int nn_tls_session_offload (struct nn_tls_session *self,
+    struct nn_usock *usock)
+{
+    int rc;
+    int i;
+    int dir;
+    const EVP_MD *md;
+    size_t keylen;
+    uint16_t cipher;
+    uint8_t key [32];
+    uint8_t iv [12];
+    union {
+        struct tls12_crypto_info_aes_gcm_128 gcm128;
+        struct tls12_crypto_info_aes_gcm_256 gcm256;
+    } info;
+    size_t infolen;
+
+    /*  Find out the parameters of the negotiated cipher. */
+    cipher = (uint16_t) SSL_CIPHER_get_protocol_id (
+        SSL_get_current_cipher ((SSL*) self->ssl));
+    switch (cipher) {
+    case 0x1301:
+        md = EVP_sha256 ();
+        keylen = 16;
+        break;
+    case 0x1302:
+        md = EVP_sha384 ();
+        keylen = 32;
+        break;
+    default:
+        return -ENOTSUP;
+    }
+    if (nn_slow (!self->secretlens [0] || !self->secretlens [1]))
+        return -EPROTO;
+
+    /*  Switch the socket to kernel TLS. */
+    rc = nn_usock_setsockopt (usock, IPPROTO_TCP, TCP_ULP, "tls",
+        sizeof ("tls"));
+    if (nn_slow (rc < 0))
+        return -ENOTSUP;
+
+    /*  Derive the keys for both directions from the traffic secrets and pass
+        them to the kernel. The record sequence numbers start at zero as
+        no records were sent using the keys yet. */
+    for (i = 0; i != 2; ++i) {
+        dir = i == 0 ? self->server : !self->server;
+        rc = nn_tls_expand (md, self->secrets [dir], self->secretlens [dir],
+            "key", key, keylen);
+        if (nn_slow (rc < 0))
+            return rc;
+        rc = nn_tls_expand (md, self->secrets [dir], self->secretlens [dir],
+            "iv", iv, sizeof (iv));
+        if (nn_slow (rc < 0))
+            return rc;
+        memset (&info, 0, sizeof (info));
+        if (keylen == 16) {
+            info.gcm128.info.version = TLS_1_3_VERSION;
+            info.gcm128.info.cipher_type = TLS_CIPHER_AES_GCM_128;
+            memcpy (info.gcm128.salt, iv, 4);
+            memcpy (info.gcm128.iv, iv + 4, 8);
+            memcpy (info.gcm128.key, key, 16);
+            infolen = sizeof (info.gcm128);
+        }
+        else {
+            info.gcm256.info.version = TLS_1_3_VERSION;
+            info.gcm256.info.cipher_type = TLS_CIPHER_AES_GCM_256;
+            memcpy (info.gcm256.salt, iv, 4);
+            memcpy (info.gcm256.iv, iv + 4, 8);
+            memcpy (info.gcm256.key, key, 32);
+            infolen = sizeof (info.gcm256);
+        }
+        rc = nn_usock_setsockopt (usock, SOL_TLS, i == 0 ? TLS_TX : TLS_RX,
+            &info, infolen);
+        OPENSSL_cleanse (&info, sizeof (info));
+        OPENSSL_cleanse (key, sizeof (key));
+        if (nn_slow (rc < 0))
+            return -ENOTSUP;
+    }
+
+    return 0;
+}
+
+static int nn_tls_available (void)
+{
+    int rc;
+    int s;
+    int available;
+
+    /*  Attaching the TLS upper layer protocol to an unconnected socket fails
+        with ENOTCONN if kernel TLS is supported and with ENOENT if it's not.
+        The kernel module is loaded on demand. */
+    s = socket (AF_INET, SOCK_STREAM, 0);
+    if (nn_slow (s < 0))
+        return 0;
+    rc = setsockopt (s, IPPROTO_TCP, TCP_ULP, "tls", sizeof ("tls"));
+    available = rc == 0 || errno != ENOENT;
+    rc = close (s);
+    errno_assert (rc == 0);
+    return available;
+}
+
+static void nn_tls_keylog (const SSL *ssl, const char *line)
+{
+    struct nn_tls_session *self;
+    int dir;
+    size_t len;
+    unsigned int byte;
+
+    /*  OpenSSL reports the secrets in the NSS key log format. The only way
+        to get the traffic secrets needed by the kernel is to catch them
+        here. */
+    self = (struct nn_tls_session*) SSL_get_app_data (ssl);
+    if (strncmp (line, "CLIENT_TRAFFIC_SECRET_0 ", 24) == 0)
+        dir = 0;
+    else if (strncmp (line, "SERVER_TRAFFIC_SECRET_0 ", 24) == 0)
+        dir = 1;
+    else
+        return;
+
+    /*  Skip the client random and parse the hex-encoded secret. */
+    line = strchr (line + 24, ' ');
+    if (nn_slow (!line))
+        return;
+    ++line;
+    len = 0;
+    while (line [0] && line [1] && len != sizeof (self->secrets [dir])) {
+        if (sscanf (line, "%2x", &byte) != 1)
+            break;
+        self->secrets [dir][len++] = (uint8_t) byte;
+        line += 2;
+    }
+    self->secretlens [dir] = len;
+}
+
+static int nn_tls_expand (const EVP_MD *md, const uint8_t *secret,
+    size_t secretlen, const char *label, uint8_t *out, size_t outlen)
+{
+    int rc;
+    EVP_PKEY_CTX *pctx;
+    uint8_t info [2 + 1 + 255 + 1];
+    size_t infolen;
+    size_t labellen;
+    size_t len;
+
+    /*  HKDF-Expand-Label as defined in RFC 8446, with empty context. */
+    labellen = strlen (label);
+    info [0] = (uint8_t) (outlen >> 8);
+    info [1] = (uint8_t) outlen;
+    info [2] = (uint8_t) (6 + labellen);
+    memcpy (info + 3, "tls13 ", 6);
+    memcpy (info + 9, label, labellen);
+    info [9 + labellen] = 0;
+    infolen = 10 + labellen;
+
+    pctx = EVP_PKEY_CTX_new_id (EVP_PKEY_HKDF, NULL);
+    alloc_assert (pctx);
+    len = outlen;
+    rc = EVP_PKEY_derive_init (pctx) == 1 &&
+        EVP_PKEY_CTX_hkdf_mode (pctx, EVP_PKEY_HKDEF_MODE_EXPAND_ONLY) == 1 &&
+        EVP_PKEY_CTX_set_hkdf_md (pctx, md) == 1 &&
+        EVP_PKEY_CTX_set1_hkdf_key (pctx, secret, (int) secretlen) == 1 &&
+        EVP_PKEY_CTX_add1_hkdf_info (pctx, info, (int) infolen) == 1 &&
+        EVP_PKEY_derive (pctx, out, &len) == 1 && len == outlen;
+    EVP_PKEY_CTX_free (pctx);
+    if (nn_slow (!rc)) {
+        ERR_clear_error ();
+        return -EPROTO;
+    }
+    return 0;
+}
+
+#else
+
+int nn_tls_create (const char *cert, const char *key, const char *ca,
+    struct nn_tls **result)
+{
+    return -ENOTSUP;
+}
+
+void nn_tls_addref (struct nn_tls *self)
+{
+    nn_assert (0);
+}
+
+void nn_tls_release (struct nn_tls *self)
+{
+    nn_assert (0);
+}
+
+void nn_tls_session_init (struct nn_tls_session *self)
+{
+    self->ssl = NULL;
+}
+
+void nn_tls_session_term (struct nn_tls_session *self)
+{
+}
+
+int nn_tls_session_start (struct nn_tls_session *self, struct nn_tls *tls,
+    int server)
+{
+    nn_assert (0);
+    return -ENOTSUP;
+}
+
+int nn_tls_session_handshake (struct nn_tls_session *self, const void *data,
+    size_t len)
+{
+    nn_assert (0);
+    return -ENOTSUP;
+}
+
+int nn_tls_session_offload (struct nn_tls_session *self,
+    struct nn_usock *usock)
+{
+    nn_assert (0);
+    return -ENOTSUP;
+}
+
+#endif
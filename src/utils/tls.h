@@ -0,0 +1,100 @@
+/*
+    Copyright (c) 2013 250bpm s.r.o.
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"),
+    to deal in the Software without restriction, including without limitation
+    the rights to use, copy, modify, merge, publish, distribute, sublicense,
+    and/or sell copies of the Software, and to permit persons to whom
+    the Software is furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included
+    in all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+    THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+    FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+    IN THE SOFTWARE.
+*/
+
+#ifndef NN_TLS_INCLUDED
+#define NN_TLS_INCLUDED
+
+#include <stdint.h>
+#include <stddef.h>
+
+/*  TLS support for stream-oriented transports. The handshake is done in user
+    space using OpenSSL, then the negotiated keys are passed to the kernel
+    (Linux kernel TLS) and the data are sent and received using ordinary
+    socket calls. Only TLS 1.3 with AES-GCM cipher suites is used. */
+
+struct nn_usock;
+
+/*  Maximum size of the TLS record payload in TLS 1.3. */
+#define NN_TLS_MAX_RECORD (16384 + 256)
+
+/*  Size of the TLS record header. */
+#define NN_TLS_RECORD_HDR 5
+
+/*  Shared TLS configuration. It's reference-counted and can be used by
+    multiple connections at the same time. */
+struct nn_tls;
+
+/*  Creates the TLS configuration. 'cert' and 'key' are paths to the PEM
+    files containing the certificate chain and the private key of the local
+    peer. 'ca' is the path to the PEM file with the certificates the peer is
+    verified against. Any of them can be NULL. Returns -ENOTSUP if TLS or
+    kernel TLS is not available and -EINVAL if the files can't be used. */
+int nn_tls_create (const char *cert, const char *key, const char *ca,
+    struct nn_tls **result);
+void nn_tls_addref (struct nn_tls *self);
+void nn_tls_release (struct nn_tls *self);
+
+/*  State of the handshake of a single connection. */
+struct nn_tls_session {
+
+    /*  OpenSSL connection object or NULL if the session is not active. */
+    void *ssl;
+
+    /*  1 if this is the accepting side of the connection. */
+    int server;
+
+    /*  Buffer to receive the TLS records into. */
+    uint8_t *in;
+
+    /*  Data to be sent to the peer. */
+    uint8_t *out;
+    size_t outlen;
+    size_t outsize;
+
+    /*  Traffic secrets of the client and the server. */
+    uint8_t secrets [2][64];
+    size_t secretlens [2];
+};
+
+/*  Initialises the session object. It's not active at this point. */
+void nn_tls_session_init (struct nn_tls_session *self);
+void nn_tls_session_term (struct nn_tls_session *self);
+
+/*  Starts the handshake. */
+int nn_tls_session_start (struct nn_tls_session *self, struct nn_tls *tls,
+    int server);
+
+/*  Processes 'len' bytes of 'data' received from the peer and advances the
+    handshake. The data to be sent to the peer are stored in 'out' afterwards.
+    Returns 1 if the handshake is complete, 0 if more data are needed and
+    -EPROTO if the handshake failed. */
+int nn_tls_session_handshake (struct nn_tls_session *self, const void *data,
+    size_t len);
+
+/*  Once the handshake is complete and all the data are sent, passes the keys
+    to the kernel. From now on, all the data sent and received using the
+    socket are encrypted. Returns -ENOTSUP if the kernel doesn't support
+    the negotiated cipher. */
+int nn_tls_session_offload (struct nn_tls_session *self,
+    struct nn_usock *usock);
+
+#endif
@@ -0,0 +1,66 @@
+/*
+    Copyright (c) 2012 250bpm s.r.o.
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"),
+    to deal in the Software without restriction, including without limitation
+    the rights to use, copy, modify, merge, publish, distribute, sublicense,
+    and/or sell copies of the Software, and to permit persons to whom
+    the Software is furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included
+    in all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+    THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+    FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+    IN THE SOFTWARE.
+*/
+
+#ifndef NN_TRACE_INCLUDED
+#define NN_TRACE_INCLUDED
+
+/*  Static tracepoints (USDT probes) in the hot paths of the library. Each
+    compiles into a single nop instruction that tracing tools such as
+    SystemTap, bpftrace or perf can attach to at runtime, e.g.
+
+        bpftrace -e 'usdt:./libnanomsg.so:nanomsg:sock_send_start {...}'
+
+    The probes follow a message through the library:
+
+    sock_send_start (sock, count)  nn_send et al. entered
+    sock_send_locked (sock)        socket lock acquired
+    pipe_send (pipe, size)         protocol passed the message to a pipe
+    pipe_sent (pipe, rc)           transport accepted the message
+    stream_flush (stream, bytes)   batch of messages handed to the usock
+    usock_send (fd, bytes)         data written to the kernel
+    usock_sent (fd)                asynchronous send completed
+    sock_send_done (sock, rc)      nn_send et al. succeeded
+
+    usock_recv (fd, bytes)         data read from the kernel
+    stream_received (stream, size) whole message read from the connection
+    pipe_received (pipe)           message available to the socket
+    pipe_recv (pipe, size)         protocol took the message from a pipe
+    sock_recv_start (sock, count)  nn_recv et al. entered
+    sock_recv_locked (sock)        socket lock acquired
+    sock_recv_done (sock, rc)      nn_recv et al. succeeded
+
+    cp_signal (cp, event)          event queued for the completion port
+    cp_dispatch (cp, event)        queued event being processed
+
+    Without sys/sdt.h, or with TRACE CMake option switched off, the probes
+    compile into nothing. */
+
+#if defined NN_USE_SDT
+#include <sys/sdt.h>
+#define nn_trace1(name, a) DTRACE_PROBE1 (nanomsg, name, a)
+#define nn_trace2(name, a, b) DTRACE_PROBE2 (nanomsg, name, a, b)
+#else
+#define nn_trace1(name, a) ((void) 0)
+#define nn_trace2(name, a, b) ((void) 0)
+#endif
+
+#endif
@@ -0,0 +1,596 @@
+/*
+    Copyright (c) 2013 250bpm s.r.o.
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"),
+    to deal in the Software without restriction, including without limitation
+    the rights to use, copy, modify, merge, publish, distribute, sublicense,
+    and/or sell copies of the Software, and to permit persons to whom
+    the Software is furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included
+    in all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+    THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+    FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+    IN THE SOFTWARE.
+*/
+
+#include "ws.h"
+#include "err.h"
+#include "wire.h"
+#include "random.h"
+#include "fast.h"
+
+#include "../pair.h"
+#include "../pubsub.h"
+#include "../reqrep.h"
+#include "../fanin.h"
+#include "../fanout.h"
+#include "../survey.h"
+#include "../bus.h"
+
+#include <string.h>
+
+#if defined __SSE2__ || defined _M_X64 || \
+    (defined _M_IX86_FP && _M_IX86_FP >= 2)
+#define NN_WS_SSE2
+#include <emmintrin.h>
+#elif defined __ARM_NEON && defined __GNUC__
+#define NN_WS_NEON
+#include <arm_neon.h>
+#endif
+
+/*  Suffix of the subprotocol names and the GUID used to compute the value
+    of Sec-WebSocket-Accept header. */
+#define NN_WS_PROTO_SUFFIX ".sp.nanomsg.org"
+#define NN_WS_GUID "258EAFA5-E914-47DA-95CA-C5AB0DC85B11"
+
+/*  Size of Sec-WebSocket-Accept value, including the terminating zero. */
+#define NN_WS_ACCEPTLEN 29
+
+/*  Names of the protocols and the protocols of their peers. The client asks
+    for the protocol of the server, the server checks that it's its own. */
+static const struct {
+    int protocol;
+    const char *name;
+    int peer;
+} nn_ws_protocols [] = {
+    {NN_PAIR, "pair", NN_PAIR},
+    {NN_PUB, "pub", NN_SUB},
+    {NN_SUB, "sub", NN_PUB},
+    {NN_REQ, "req", NN_REP},
+    {NN_REP, "rep", NN_REQ},
+    {NN_SOURCE, "source", NN_SINK},
+    {NN_SINK, "sink", NN_SOURCE},
+    {NN_PUSH, "push", NN_PULL},
+    {NN_PULL, "pull", NN_PUSH},
+    {NN_SURVEYOR, "surveyor", NN_RESPONDENT},
+    {NN_RESPONDENT, "respondent", NN_SURVEYOR},
+    {NN_BUS, "bus", NN_BUS}
+};
+
+/*  Private functions. */
+static void nn_ws_sha1 (const uint8_t *data, size_t len, uint8_t *digest);
+static void nn_ws_base64 (const uint8_t *src, size_t len, char *dst);
+static void nn_ws_accept (const char *key, size_t keylen, char *accept);
+static int nn_ws_append (char *buf, size_t bufsz, size_t *pos,
+    const char *str, size_t len);
+static int nn_ws_field (const char *buf, size_t len, const char *name,
+    const char **value, size_t *valuelen);
+static int nn_ws_hastoken (const char *value, size_t valuelen,
+    const char *token, size_t tokenlen);
+static int nn_ws_strieq (const char *a, const char *b, size_t len);
+
+size_t nn_ws_hdrsize (const uint8_t *hdr)
+{
+    size_t size;
+
+    size = (hdr [1] & 0x80) ? 4 : 0;
+    if ((hdr [1] & 0x7f) == 126)
+        size += 2;
+    else if ((hdr [1] & 0x7f) == 127)
+        size += 8;
+    return size;
+}
+
+int nn_ws_parsehdr (const uint8_t *hdr, struct nn_ws_frame *frame)
+{
+    size_t pos;
+
+    /*  No extensions are negotiated, thus the reserved bits must be zero. */
+    if (nn_slow (hdr [0] & 0x70))
+        return -EPROTO;
+    frame->fin = (hdr [0] & 0x80) ? 1 : 0;
+    frame->opcode = hdr [0] & 0x0f;
+    switch (frame->opcode) {
+    case NN_WS_OP_CONT:
+    case NN_WS_OP_TEXT:
+    case NN_WS_OP_BINARY:
+    case NN_WS_OP_CLOSE:
+    case NN_WS_OP_PING:
+    case NN_WS_OP_PONG:
+        break;
+    default:
+        return -EPROTO;
+    }
+
+    frame->len = hdr [1] & 0x7f;
+    pos = 2;
+    if (frame->len == 126) {
+        frame->len = nn_gets (hdr + 2);
+        pos = 4;
+    }
+    else if (frame->len == 127) {
+        frame->len = nn_getll (hdr + 2);
+        if (nn_slow (frame->len >> 63))
+            return -EPROTO;
+        pos = 10;
+    }
+
+    /*  Control frames can't be fragmented and their payload is short. */
+    if (nn_slow ((frame->opcode & 0x08) &&
+          (!frame->fin || frame->len > NN_WS_MAXCTL)))
+        return -EPROTO;
+
+    frame->masked = (hdr [1] & 0x80) ? 1 : 0;
+    if (frame->masked)
+        memcpy (frame->mask, hdr + pos, 4);
+    return 0;
+}
+
+size_t nn_ws_puthdr (uint8_t *hdr, int opcode, uint64_t len,
+    const uint8_t *mask)
+{
+    size_t pos;
+
+    hdr [0] = (uint8_t) (0x80 | opcode);
+    if (len < 126) {
+        hdr [1] = (uint8_t) len;
+        pos = 2;
+    }
+    else if (len <= 0xffff) {
+        hdr [1] = 126;
+        nn_puts (hdr + 2, (uint16_t) len);
+        pos = 4;
+    }
+    else {
+        hdr [1] = 127;
+        nn_putll (hdr + 2, len);
+        pos = 10;
+    }
+    if (mask) {
+        hdr [1] |= 0x80;
+        memcpy (hdr + pos, mask, 4);
+        pos += 4;
+    }
+    return pos;
+}
+
+void nn_ws_mask (void *dst, const void *src, size_t len, const uint8_t *mask,
+    size_t pos)
+{
+    size_t i;
+    uint8_t key [16];
+    uint8_t *d;
+    const uint8_t *s;
+#if defined NN_WS_SSE2
+    __m128i k;
+#elif defined NN_WS_NEON
+    uint8x16_t k;
+#else
+    uint64_t k;
+    uint64_t w;
+#endif
+
+    /*  The key is rotated so that it starts at the first byte to be masked
+        and repeated to fill a whole vector. */
+    for (i = 0; i != sizeof (key); ++i)
+        key [i] = mask [(pos + i) % 4];
+    d = (uint8_t*) dst;
+    s = (const uint8_t*) src;
+    i = 0;
+
+#if defined NN_WS_SSE2
+    k = _mm_loadu_si128 ((const __m128i*) key);
+    for (; i + 16 <= len; i += 16)
+        _mm_storeu_si128 ((__m128i*) (d + i),
+            _mm_xor_si128 (_mm_loadu_si128 ((const __m128i*) (s + i)), k));
+#elif defined NN_WS_NEON
+    k = vld1q_u8 (key);
+    for (; i + 16 <= len; i += 16)
+        vst1q_u8 (d + i, veorq_u8 (vld1q_u8 (s + i), k));
+#else
+    memcpy (&k, key, sizeof (k));
+    for (; i + 8 <= len; i += 8) {
+        memcpy (&w, s + i, sizeof (w));
+        w ^= k;
+        memcpy (d + i, &w, sizeof (w));
+    }
+#endif
+
+    /*  The tail. 'i' is a multiple of the key size at this point. */
+    for (; i != len; ++i)
+        d [i] = s [i] ^ key [i % 4];
+}
+
+const char *nn_ws_protoname (int protocol)
+{
+    size_t i;
+
+    for (i = 0; i != sizeof (nn_ws_protocols) / sizeof (nn_ws_protocols [0]);
+          ++i)
+        if (nn_ws_protocols [i].protocol == protocol)
+            return nn_ws_protocols [i].name;
+    return NULL;
+}
+
+const char *nn_ws_peername (int protocol)
+{
+    size_t i;
+
+    for (i = 0; i != sizeof (nn_ws_protocols) / sizeof (nn_ws_protocols [0]);
+          ++i)
+        if (nn_ws_protocols [i].protocol == protocol)
+            return nn_ws_protoname (nn_ws_protocols [i].peer);
+    return NULL;
+}
+
+int nn_ws_iscomplete (const char *buf, size_t len)
+{
+    return len >= 4 && memcmp (buf + len - 4, "\r\n\r\n", 4) == 0;
+}
+
+int nn_ws_request (char *buf, size_t bufsz, const char *host, size_t hostlen,
+    const char *path, const char *proto, char *key)
+{
+    int rc;
+    size_t pos;
+    uint8_t nonce [16];
+
+    nn_random_generate (nonce, sizeof (nonce));
+    nn_ws_base64 (nonce, sizeof (nonce), key);
+
+    pos = 0;
+    rc = nn_ws_append (buf, bufsz, &pos, "GET ", 4);
+    rc |= nn_ws_append (buf, bufsz, &pos, path, strlen (path));
+    rc |= nn_ws_append (buf, bufsz, &pos, " HTTP/1.1\r\nHost: ", 17);
+    rc |= nn_ws_append (buf, bufsz, &pos, host, hostlen);
+    rc |= nn_ws_append (buf, bufsz, &pos, "\r\nUpgrade: websocket\r\n"
+        "Connection: Upgrade\r\nSec-WebSocket-Key: ", 62);
+    rc |= nn_ws_append (buf, bufsz, &pos, key, NN_WS_KEYLEN - 1);
+    rc |= nn_ws_append (buf, bufsz, &pos, "\r\nSec-WebSocket-Version: 13\r\n"
+        "Sec-WebSocket-Protocol: ", 53);
+    rc |= nn_ws_append (buf, bufsz, &pos, proto, strlen (proto));
+    rc |= nn_ws_append (buf, bufsz, &pos, NN_WS_PROTO_SUFFIX "\r\n\r\n",
+        sizeof (NN_WS_PROTO_SUFFIX) + 3);
+    if (nn_slow (rc))
+        return -EINVAL;
+    return (int) pos;
+}
+
+int nn_ws_checkresponse (const char *buf, size_t len, const char *key,
+    const char *proto)
+{
+    const char *value;
+    size_t valuelen;
+    size_t protolen;
+    char accept [NN_WS_ACCEPTLEN];
+
+    if (nn_slow (len < 13 || memcmp (buf, "HTTP/1.1 101 ", 13) != 0))
+        return -EPROTO;
+    if (nn_slow (!nn_ws_field (buf, len, "upgrade", &value, &valuelen) ||
+          !nn_ws_hastoken (value, valuelen, "websocket", 9)))
+        return -EPROTO;
+    if (nn_slow (!nn_ws_field (buf, len, "connection", &value, &valuelen) ||
+          !nn_ws_hastoken (value, valuelen, "upgrade", 7)))
+        return -EPROTO;
+
+    nn_ws_accept (key, NN_WS_KEYLEN - 1, accept);
+    if (nn_slow (!nn_ws_field (buf, len, "sec-websocket-accept",
+          &value, &valuelen) || valuelen != NN_WS_ACCEPTLEN - 1 ||
+          memcmp (value, accept, valuelen) != 0))
+        return -EPROTO;
+
+    /*  The server must have agreed to the subprotocol that was asked for. */
+    protolen = strlen (proto);
+    if (nn_slow (!nn_ws_field (buf, len, "sec-websocket-protocol",
+          &value, &valuelen) ||
+          valuelen != protolen + sizeof (NN_WS_PROTO_SUFFIX) - 1 ||
+          !nn_ws_strieq (value, proto, protolen) ||
+          !nn_ws_strieq (value + protolen, NN_WS_PROTO_SUFFIX,
+          sizeof (NN_WS_PROTO_SUFFIX) - 1)))
+        return -EPROTO;
+
+    return 0;
+}
+
+int nn_ws_response (char *buf, size_t len, size_t bufsz, const char *path,
+    const char *proto)
+{
+    int rc;
+    const char *value;
+    size_t valuelen;
+    const char *target;
+    size_t targetlen;
+    size_t pos;
+    char name [32];
+    char accept [NN_WS_ACCEPTLEN];
+
+    /*  Check the request line. The query part of the target is ignored. */
+    if (nn_slow (len < 4 || memcmp (buf, "GET ", 4) != 0))
+        return -EPROTO;
+    target = buf + 4;
+    targetlen = 0;
+    while (4 + targetlen < len && target [targetlen] != ' ' &&
+          target [targetlen] != '?' && target [targetlen] != '\r')
+        ++targetlen;
+    if (nn_slow (targetlen != strlen (path) ||
+          memcmp (target, path, targetlen) != 0))
+        return -EPROTO;
+
+    /*  Check that it's a WebSocket upgrade request. */
+    if (nn_slow (!nn_ws_field (buf, len, "upgrade", &value, &valuelen) ||
+          !nn_ws_hastoken (value, valuelen, "websocket", 9)))
+        return -EPROTO;
+    if (nn_slow (!nn_ws_field (buf, len, "connection", &value, &valuelen) ||
+          !nn_ws_hastoken (value, valuelen, "upgrade", 7)))
+        return -EPROTO;
+    if (nn_slow (!nn_ws_field (buf, len, "sec-websocket-version",
+          &value, &valuelen) || valuelen != 2 || memcmp (value, "13", 2) != 0))
+        return -EPROTO;
+
+    /*  The client has to ask for the protocol of this socket. */
+    nn_assert (strlen (proto) + sizeof (NN_WS_PROTO_SUFFIX) <= sizeof (name));
+    strcpy (name, proto);
+    strcat (name, NN_WS_PROTO_SUFFIX);
+    if (nn_slow (!nn_ws_field (buf, len, "sec-websocket-protocol",
+          &value, &valuelen) ||
+          !nn_ws_hastoken (value, valuelen, name, strlen (name))))
+        return -EPROTO;
+
+    /*  The key has to be computed before the request is overwritten. */
+    if (nn_slow (!nn_ws_field (buf, len, "sec-websocket-key",
+          &value, &valuelen) || valuelen != NN_WS_KEYLEN - 1))
+        return -EPROTO;
+    nn_ws_accept (value, valuelen, accept);
+
+    pos = 0;
+    rc = nn_ws_append (buf, bufsz, &pos, "HTTP/1.1 101 Switching Protocols\r\n"
+        "Upgrade: websocket\r\nConnection: Upgrade\r\n"
+        "Sec-WebSocket-Accept: ", 97);
+    rc |= nn_ws_append (buf, bufsz, &pos, accept, NN_WS_ACCEPTLEN - 1);
+    rc |= nn_ws_append (buf, bufsz, &pos, "\r\nSec-WebSocket-Protocol: ", 26);
+    rc |= nn_ws_append (buf, bufsz, &pos, name, strlen (name));
+    rc |= nn_ws_append (buf, bufsz, &pos, "\r\n\r\n", 4);
+    if (nn_slow (rc))
+        return -EPROTO;
+    return (int) pos;
+}
+
+static void nn_ws_accept (const char *key, size_t keylen, char *accept)
+{
+    uint8_t data [NN_WS_KEYLEN - 1 + sizeof (NN_WS_GUID) - 1];
+    uint8_t digest [20];
+
+    nn_assert (keylen == NN_WS_KEYLEN - 1);
+    memcpy (data, key, keylen);
+    memcpy (data + keylen, NN_WS_GUID, sizeof (NN_WS_GUID) - 1);
+    nn_ws_sha1 (data, sizeof (data), digest);
+    nn_ws_base64 (digest, sizeof (digest), accept);
+}
+
+static int nn_ws_append (char *buf, size_t bufsz, size_t *pos,
+    const char *str, size_t len)
+{
+    if (nn_slow (*pos + len > bufsz))
+        return 1;
+    memcpy (buf + *pos, str, len);
+    *pos += len;
+    return 0;
+}
+
+/*  Finds the header field with the specified lowercase name. The value is
+    stripped of the surrounding whitespace. Returns 0 if there's no such
+    field. */
+static int nn_ws_field (const char *buf, size_t len, const char *name,
+    const char **value, size_t *valuelen)
+{
+    const char *pos;
+    const char *end;
+    const char *eol;
+    size_t namelen;
+
+    namelen = strlen (name);
+    end = buf + len;
+
+    /*  Skip the request or status line. */
+    pos = buf;
+    while (pos + 1 < end && !(pos [0] == '\r' && pos [1] == '\n'))
+        ++pos;
+    pos += 2;
+
+    while (pos < end) {
+        eol = pos;
+        while (eol + 1 < end && !(eol [0] == '\r' && eol [1] == '\n'))
+            ++eol;
+        if (eol + 1 >= end)
+            return 0;
+        if ((size_t) (eol - pos) > namelen && pos [namelen] == ':' &&
+              nn_ws_strieq (pos, name, namelen)) {
+            pos += namelen + 1;
+            while (pos < eol && (*pos == ' ' || *pos == '\t'))
+                ++pos;
+            while (eol > pos && (eol [-1] == ' ' || eol [-1] == '\t'))
+                --eol;
+            *value = pos;
+            *valuelen = eol - pos;
+            return 1;
+        }
+        pos = eol + 2;
+    }
+    return 0;
+}
+
+/*  Returns 1 if the comma-separated list contains the token, compared
+    case-insensitively. */
+static int nn_ws_hastoken (const char *value, size_t valuelen,
+    const char *token, size_t tokenlen)
+{
+    const char *pos;
+    const char *end;
+    const char *next;
+    const char *last;
+
+    pos = value;
+    end = value + valuelen;
+    while (pos < end) {
+        next = memchr (pos, ',', end - pos);
+        if (!next)
+            next = end;
+        while (pos < next && (*pos == ' ' || *pos == '\t'))
+            ++pos;
+        last = next;
+        while (last > pos && (last [-1] == ' ' || last [-1] == '\t'))
+            --last;
+        if ((size_t) (last - pos) == tokenlen &&
+              nn_ws_strieq (pos, token, tokenlen))
+            return 1;
+        pos = next + 1;
+    }
+    return 0;
+}
+
+static int nn_ws_strieq (const char *a, const char *b, size_t len)
+{
+    size_t i;
+    char ca;
+    char cb;
+
+    for (i = 0; i != len; ++i) {
+        ca = a [i] >= 'A' && a [i] <= 'Z' ? a [i] - 'A' + 'a' : a [i];
+        cb = b [i] >= 'A' && b [i] <= 'Z' ? b [i] - 'A' + 'a' : b [i];
+        if (ca != cb)
+            return 0;
+    }
+    return 1;
+}
+
+static void nn_ws_base64 (const uint8_t *src, size_t len, char *dst)
+{
+    static const char alphabet [] =
+        "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+    size_t i;
+    uint32_t v;
+
+    for (i = 0; i + 3 <= len; i += 3) {
+        v = ((uint32_t) src [i] << 16) | ((uint32_t) src [i + 1] << 8) |
+            src [i + 2];
+        *dst++ = alphabet [(v >> 18) & 0x3f];
+        *dst++ = alphabet [(v >> 12) & 0x3f];
+        *dst++ = alphabet [(v >> 6) & 0x3f];
+        *dst++ = alphabet [v & 0x3f];
+    }
+    if (len - i == 1) {
+        v = (uint32_t) src [i] << 16;
+        *dst++ = alphabet [(v >> 18) & 0x3f];
+        *dst++ = alphabet [(v >> 12) & 0x3f];
+        *dst++ = '=';
+        *dst++ = '=';
+    }
+    else if (len - i == 2) {
+        v = ((uint32_t) src [i] << 16) | ((uint32_t) src [i + 1] << 8);
+        *dst++ = alphabet [(v >> 18) & 0x3f];
+        *dst++ = alphabet [(v >> 12) & 0x3f];
+        *dst++ = alphabet [(v >> 6) & 0x3f];
+        *dst++ = '=';
+    }
+    *dst = 0;
+}
+
+#define NN_WS_ROL(x,n) (((x) << (n)) | ((x) >> (32 - (n))))
+
+static void nn_ws_sha1_block (uint32_t *h, const uint8_t *block)
+{
+    int i;
+    uint32_t w [80];
+    uint32_t a, b, c, d, e, f, k, t;
+
+    for (i = 0; i != 16; ++i)
+        w [i] = nn_getl (block + i * 4);
+    for (i = 16; i != 80; ++i)
+        w [i] = NN_WS_ROL (w [i - 3] ^ w [i - 8] ^ w [i - 14] ^ w [i - 16], 1);
+
+    a = h [0];
+    b = h [1];
+    c = h [2];
+    d = h [3];
+    e = h [4];
+    for (i = 0; i != 80; ++i) {
+        if (i < 20) {
+            f = (b & c) | (~b & d);
+            k = 0x5a827999;
+        }
+        else if (i < 40) {
+            f = b ^ c ^ d;
+            k = 0x6ed9eba1;
+        }
+        else if (i < 60) {
+            f = (b & c) | (b & d) | (c & d);
+            k = 0x8f1bbcdc;
+        }
+        else {
+            f = b ^ c ^ d;
+            k = 0xca62c1d6;
+        }
+        t = NN_WS_ROL (a, 5) + f + e + k + w [i];
+        e = d;
+        d = c;
+        c = NN_WS_ROL (b, 30);
+        b = a;
+        a = t;
+    }
+    h [0] += a;
+    h [1] += b;
+    h [2] += c;
+    h [3] += d;
+    h [4] += e;
+}
+
+/*  SHA-1 is only used to compute Sec-WebSocket-Accept, as mandated by
+    RFC 6455. It has no security relevance there. */
+static void nn_ws_sha1 (const uint8_t *data, size_t len, uint8_t *digest)
+{
+    int i;
+    size_t pos;
+    uint32_t h [5];
+    uint8_t block [64];
+
+    h [0] = 0x67452301;
+    h [1] = 0xefcdab89;
+    h [2] = 0x98badcfe;
+    h [3] = 0x10325476;
+    h [4] = 0xc3d2e1f0;
+
+    for (pos = 0; pos + 64 <= len; pos += 64)
+        nn_ws_sha1_block (h, data + pos);
+
+    /*  Pad the last block with 0x80, zeros and the length in bits. */
+    memset (block, 0, sizeof (block));
+    memcpy (block, data + pos, len - pos);
+    block [len - pos] = 0x80;
+    if (len - pos >= 56) {
+        nn_ws_sha1_block (h, block);
+        memset (block, 0, sizeof (block));
+    }
+    nn_putll (block + 56, (uint64_t) len * 8);
+    nn_ws_sha1_block (h, block);
+
+    for (i = 0; i != 5; ++i)
+        nn_putl (digest + i * 4, h [i]);
+}
+
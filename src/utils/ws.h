@@ -0,0 +1,109 @@
+/*
+    Copyright (c) 2013 250bpm s.r.o.
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"),
+    to deal in the Software without restriction, including without limitation
+    the rights to use, copy, modify, merge, publish, distribute, sublicense,
+    and/or sell copies of the Software, and to permit persons to whom
+    the Software is furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included
+    in all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+    THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+    FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+    IN THE SOFTWARE.
+*/
+
+#ifndef NN_WS_INCLUDED
+#define NN_WS_INCLUDED
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*  WebSocket (RFC 6455) framing and opening handshake. Each SP message is
+    sent as a single binary WebSocket message. The subprotocol name is
+    the name of the SP protocol of the server followed by ".sp.nanomsg.org",
+    e.g. "rep.sp.nanomsg.org" for a REQ socket connecting to a REP socket. */
+
+#define NN_WS_OP_CONT 0x0
+#define NN_WS_OP_TEXT 0x1
+#define NN_WS_OP_BINARY 0x2
+#define NN_WS_OP_CLOSE 0x8
+#define NN_WS_OP_PING 0x9
+#define NN_WS_OP_PONG 0xa
+
+/*  Maximum size of a frame header and maximum size of the payload of
+    a control frame. */
+#define NN_WS_MAXHDR 14
+#define NN_WS_MAXCTL 125
+
+/*  Maximum size of the HTTP request or response of the opening handshake. */
+#ifndef NN_WS_MAXHANDSHAKE
+#define NN_WS_MAXHANDSHAKE 4096
+#endif
+
+/*  Size of the key sent by the client, including the terminating zero. */
+#define NN_WS_KEYLEN 25
+
+struct nn_ws_frame {
+    int fin;
+    int opcode;
+    uint64_t len;
+    int masked;
+    uint8_t mask [4];
+};
+
+/*  Given the first two bytes of a frame header, returns the number of
+    the header bytes that follow them. */
+size_t nn_ws_hdrsize (const uint8_t *hdr);
+
+/*  Parses a complete frame header. Returns -EPROTO if it's malformed. */
+int nn_ws_parsehdr (const uint8_t *hdr, struct nn_ws_frame *frame);
+
+/*  Writes the header of an unfragmented frame to 'hdr', which must be at
+    least NN_WS_MAXHDR bytes long. If 'mask' is not NULL, the masking key is
+    included in the header. Returns the size of the header. */
+size_t nn_ws_puthdr (uint8_t *hdr, int opcode, uint64_t len,
+    const uint8_t *mask);
+
+/*  Copies 'len' bytes from 'src' to 'dst', masking them with 'mask'. 'pos' is
+    the position of the data within the payload of the frame. 'src' and 'dst'
+    may be the same buffer. Masking and unmasking are the same operation. */
+void nn_ws_mask (void *dst, const void *src, size_t len, const uint8_t *mask,
+    size_t pos);
+
+/*  Returns the name of the specified SP protocol, NULL if it's unknown. */
+const char *nn_ws_protoname (int protocol);
+
+/*  Returns the name of the protocol of the peer of the specified SP protocol,
+    NULL if it's unknown. */
+const char *nn_ws_peername (int protocol);
+
+/*  Returns 1 if the HTTP request or response in 'buf' is complete, i.e. it's
+    terminated by an empty line, 0 otherwise. */
+int nn_ws_iscomplete (const char *buf, size_t len);
+
+/*  Client side of the handshake. nn_ws_request writes the HTTP request to
+    'buf' and the key it has generated to 'key', which must be NN_WS_KEYLEN
+    bytes long. It returns the size of the request or -EINVAL if it doesn't
+    fit into the buffer. nn_ws_checkresponse checks the server's response
+    and returns -EPROTO if the connection wasn't accepted. */
+int nn_ws_request (char *buf, size_t bufsz, const char *host, size_t hostlen,
+    const char *path, const char *proto, char *key);
+int nn_ws_checkresponse (const char *buf, size_t len, const char *key,
+    const char *proto);
+
+/*  Server side of the handshake. Checks the request of length 'len' in 'buf'
+    and overwrites it with the response. Returns the size of the response or
+    -EPROTO if the request is to be rejected. */
+int nn_ws_response (char *buf, size_t len, size_t bufsz, const char *path,
+    const char *proto);
+
+#endif
+
@@ -0,0 +1,135 @@
+/*
+    Copyright (c) 2013 250bpm s.r.o.
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"),
+    to deal in the Software without restriction, including without limitation
+    the rights to use, copy, modify, merge, publish, distribute, sublicense,
+    and/or sell copies of the Software, and to permit persons to whom
+    the Software is furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included
+    in all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+    THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+    FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+    IN THE SOFTWARE.
+*/
+
+#include "../src/nn.h"
+#include "../src/pair.h"
+
+#include "../src/utils/err.c"
+#include "../src/utils/sleep.c"
+#include "../src/utils/mutex.c"
+#include "../src/utils/atomic.c"
+
+#include <string.h>
+
+/*  Tests nn_send_async and nn_recv_async. */
+
+#define SOCKET_ADDRESS "inproc://a"
+
+/*  Each operation stores its result into its own slot. Storing the result
+    publishes the received data to the main thread. */
+#define PENDING 12345
+static struct nn_atomic results [4];
+static char buf [16];
+static void *msgbuf;
+
+static void callback (int s, int rc, void *arg)
+{
+    nn_atomic_store (&results [(int) (size_t) arg], (uint32_t) rc);
+}
+
+static int result (int index)
+{
+    return (int) nn_atomic_load (&results [index]);
+}
+
+static void wait_for (int index)
+{
+    int i;
+
+    for (i = 0; i != 1000; ++i) {
+        if (result (index) != PENDING)
+            return;
+        nn_sleep (1);
+    }
+    nn_assert (0);
+}
+
+int main ()
+{
+    int rc;
+    int sb;
+    int sc;
+    int i;
+
+#if defined NN_HAVE_WINDOWS
+    /*  The operations are completed by the worker threads, which are not
+        available on Windows. */
+    return 0;
+#endif
+
+    for (i = 0; i != 4; ++i)
+        nn_atomic_init (&results [i], PENDING);
+
+    sb = nn_socket (AF_SP, NN_PAIR);
+    errno_assert (sb != -1);
+    rc = nn_bind (sb, SOCKET_ADDRESS);
+    errno_assert (rc >= 0);
+    sc = nn_socket (AF_SP, NN_PAIR);
+    errno_assert (sc != -1);
+    rc = nn_connect (sc, SOCKET_ADDRESS);
+    errno_assert (rc >= 0);
+
+    /*  Receive operation queued before the message is sent. */
+    rc = nn_recv_async (sb, buf, sizeof (buf), 0, callback, (void*) 0);
+    errno_assert (rc == 0);
+    nn_sleep (10);
+    nn_assert (result (0) == PENDING);
+    rc = nn_send_async (sc, "ABC", 3, 0, callback, (void*) 1);
+    errno_assert (rc == 0);
+    wait_for (0);
+    wait_for (1);
+    nn_assert (result (0) == 3);
+    nn_assert (result (1) == 3);
+    nn_assert (memcmp (buf, "ABC", 3) == 0);
+
+    /*  Message already available; zero-copy receive. */
+    rc = nn_send (sc, "DEFG", 4, 0);
+    errno_assert (rc == 4);
+    rc = nn_recv_async (sb, &msgbuf, NN_MSG, 0, callback, (void*) 2);
+    errno_assert (rc == 0);
+    wait_for (2);
+    nn_assert (result (2) == 4);
+    nn_assert (memcmp (msgbuf, "DEFG", 4) == 0);
+    rc = nn_freemsg (msgbuf);
+    errno_assert (rc == 0);
+
+    /*  Invalid arguments. */
+    rc = nn_send_async (sc, "ABC", 3, NN_DONTWAIT, callback, NULL);
+    nn_assert (rc == -1 && nn_errno () == EINVAL);
+    rc = nn_recv_async (sc, buf, sizeof (buf), 0, NULL, NULL);
+    nn_assert (rc == -1 && nn_errno () == EINVAL);
+
+    /*  Pending operation is cancelled when the socket is closed. */
+    rc = nn_recv_async (sb, buf, sizeof (buf), 0, callback, (void*) 3);
+    errno_assert (rc == 0);
+    rc = nn_close (sc);
+    errno_assert (rc == 0);
+    rc = nn_close (sb);
+    errno_assert (rc == 0);
+    wait_for (3);
+    nn_assert (result (3) == -ETERM);
+
+    for (i = 0; i != 4; ++i)
+        nn_atomic_term (&results [i]);
+
+    return 0;
+}
@@ -54,11 +54,23 @@ void worker (void *arg)
     nn_assert (rc == 3);
 }
 
+void receiver (void *arg)
+{
+    int rc;
+    char buf [3];
+
+    rc = nn_recv (sb, buf, sizeof (buf), 0);
+    errno_assert (rc >= 0);
+    nn_assert (rc == 3);
+}
+
 int main ()
 {
     int rc;
     char buf [3];
+    int i;
     struct nn_thread thread;
+    struct nn_thread receivers [8];
 
     sb = nn_socket (AF_SP, NN_PAIR);
     errno_assert (sb != -1);
@@ -80,6 +92,19 @@ int main ()
 
     nn_thread_term (&thread);
 
+    /*  Several threads blocked in recv on the same socket. They are woken
+        up one by one and each of them gets a message. */
+    for (i = 0; i != 8; ++i)
+        nn_thread_init (&receivers [i], receiver, NULL);
+    nn_sleep (100);
+    for (i = 0; i != 8; ++i) {
+        rc = nn_send (sc, "ABC", 3, 0);
+        errno_assert (rc >= 0);
+        nn_assert (rc == 3);
+    }
+    for (i = 0; i != 8; ++i)
+        nn_thread_term (&receivers [i]);
+
     rc = nn_close (sc);
     errno_assert (rc == 0);
     rc = nn_close (sb);
@@ -24,9 +24,29 @@
 #include "../src/bus.h"
 #include "../src/utils/err.c"
 #include "../src/utils/sleep.c"
+#include "../src/utils/thread.c"
+
+#include <string.h>
 
 #define SOCKET_ADDRESS_A "inproc://a"
 #define SOCKET_ADDRESS_B "inproc://b"
+#define SOCKET_ADDRESS_C "inproc://c"
+
+#define FANOUT_PEERS 16
+
+/*  Blocks in nn_recv till the message arrives and sends it back. */
+static void fanout_peer (void *arg)
+{
+    int rc;
+    int s;
+    char buf [3];
+
+    s = *(int*) arg;
+    rc = nn_recv (s, buf, sizeof (buf), 0);
+    errno_assert (rc == 3);
+    rc = nn_send (s, buf, 3, 0);
+    errno_assert (rc == 3);
+}
 
 int main ()
 {
@@ -35,6 +55,11 @@ int main ()
     int bus2;
     int bus3;
     char buf [3];
+    int val;
+    size_t sz;
+    int i;
+    int peers [FANOUT_PEERS];
+    struct nn_thread threads [FANOUT_PEERS];
 
     /*  Create a simple bus topology consisting of 3 nodes. */
     bus1 = nn_socket (AF_SP, NN_BUS);
@@ -85,6 +110,57 @@ int main ()
     errno_assert (rc >= 0);
     nn_assert (rc == 1 || rc == 2);
 
+    /*  Check that the same message received from two nodes is passed to
+        the user only once when deduplication is on. */
+    val = 16;
+    rc = nn_setsockopt (bus3, NN_BUS, NN_BUS_DEDUP, &val, sizeof (val));
+    errno_assert (rc == 0);
+    sz = sizeof (val);
+    rc = nn_getsockopt (bus3, NN_BUS, NN_BUS_DEDUP, &val, &sz);
+    errno_assert (rc == 0);
+    nn_assert (sz == sizeof (val) && val == 16);
+    rc = nn_send (bus1, "XY", 2, 0);
+    errno_assert (rc >= 0);
+    rc = nn_send (bus2, "XY", 2, 0);
+    errno_assert (rc >= 0);
+    rc = nn_send (bus2, "Z", 1, 0);
+    errno_assert (rc >= 0);
+    rc = nn_send (bus1, "Z", 1, 0);
+    errno_assert (rc >= 0);
+    rc = nn_recv (bus3, buf, 3, 0);
+    errno_assert (rc >= 0);
+    nn_assert (rc == 1 || rc == 2);
+    rc = nn_recv (bus3, buf, 3, 0);
+    errno_assert (rc >= 0);
+    nn_assert (rc == 1 || rc == 2);
+    val = 100;
+    rc = nn_setsockopt (bus3, NN_SOL_SOCKET, NN_RCVTIMEO, &val, sizeof (val));
+    errno_assert (rc == 0);
+    rc = nn_recv (bus3, buf, 3, 0);
+    nn_assert (rc < 0 && nn_errno () == EAGAIN);
+    rc = nn_recv (bus1, buf, 3, 0);
+    errno_assert (rc >= 0);
+    rc = nn_recv (bus1, buf, 3, 0);
+    errno_assert (rc >= 0);
+    rc = nn_recv (bus2, buf, 3, 0);
+    errno_assert (rc >= 0);
+    rc = nn_recv (bus2, buf, 3, 0);
+    errno_assert (rc >= 0);
+
+    /*  Messages sent by the socket itself are remembered as well. */
+    rc = nn_send (bus3, "XYZ", 3, 0);
+    errno_assert (rc >= 0);
+    rc = nn_recv (bus1, buf, 3, 0);
+    errno_assert (rc == 3);
+    rc = nn_send (bus1, "XYZ", 3, 0);
+    errno_assert (rc >= 0);
+    rc = nn_recv (bus3, buf, 3, 0);
+    nn_assert (rc < 0 && nn_errno () == EAGAIN);
+    rc = nn_recv (bus2, buf, 3, 0);
+    errno_assert (rc == 3);
+    rc = nn_recv (bus2, buf, 3, 0);
+    errno_assert (rc == 3);
+
     /*  Wait till both connections are established. */
     nn_sleep (10);
 
@@ -95,6 +171,38 @@ int main ()
     rc = nn_close (bus1);
     errno_assert (rc == 0);
 
+    /*  A message sent to many inproc peers wakes up all of them, including
+        the ones that share the I/O thread. */
+    bus1 = nn_socket (AF_SP, NN_BUS);
+    errno_assert (bus1 >= 0);
+    rc = nn_bind (bus1, SOCKET_ADDRESS_C);
+    errno_assert (rc >= 0);
+    val = 1000;
+    rc = nn_setsockopt (bus1, NN_SOL_SOCKET, NN_RCVTIMEO, &val, sizeof (val));
+    errno_assert (rc == 0);
+    for (i = 0; i != FANOUT_PEERS; ++i) {
+        peers [i] = nn_socket (AF_SP, NN_BUS);
+        errno_assert (peers [i] >= 0);
+        rc = nn_connect (peers [i], SOCKET_ADDRESS_C);
+        errno_assert (rc >= 0);
+        nn_thread_init (&threads [i], fanout_peer, &peers [i]);
+    }
+    nn_sleep (10);
+    rc = nn_send (bus1, "ABC", 3, 0);
+    errno_assert (rc == 3);
+    for (i = 0; i != FANOUT_PEERS; ++i) {
+        rc = nn_recv (bus1, buf, 3, 0);
+        errno_assert (rc == 3);
+        nn_assert (memcmp (buf, "ABC", 3) == 0);
+    }
+    for (i = 0; i != FANOUT_PEERS; ++i) {
+        nn_thread_term (&threads [i]);
+        rc = nn_close (peers [i]);
+        errno_assert (rc == 0);
+    }
+    rc = nn_close (bus1);
+    errno_assert (rc == 0);
+
     return 0;
 }
 
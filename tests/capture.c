@@ -0,0 +1,122 @@
+/*
+    Copyright (c) 2013 250bpm s.r.o.
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"),
+    to deal in the Software without restriction, including without limitation
+    the rights to use, copy, modify, merge, publish, distribute, sublicense,
+    and/or sell copies of the Software, and to permit persons to whom
+    the Software is furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included
+    in all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+    THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+    FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+    IN THE SOFTWARE.
+*/
+
+#include "../src/nn.h"
+#include "../src/pair.h"
+
+#include "../src/utils/err.c"
+#include "../src/utils/wire.c"
+#include "../src/utils/capture.h"
+
+#include <stdio.h>
+#include <string.h>
+
+/*  Test that NN_CAPTURE records the messages passed by the socket. */
+
+#define SOCKET_ADDRESS "inproc://capture"
+#define CAPTURE_FILE "test-capture.nncp"
+
+int main ()
+{
+    int rc;
+    int sb;
+    int sc;
+    int i;
+    size_t sz;
+    char buf [32];
+    FILE *file;
+    uint8_t hdr [NN_CAPTURE_HDRSIZE];
+    uint8_t rec [NN_CAPTURE_RECSIZE];
+    uint64_t time;
+
+    sb = nn_socket (AF_SP, NN_PAIR);
+    errno_assert (sb != -1);
+    rc = nn_bind (sb, SOCKET_ADDRESS);
+    errno_assert (rc >= 0);
+    sc = nn_socket (AF_SP, NN_PAIR);
+    errno_assert (sc != -1);
+    rc = nn_connect (sc, SOCKET_ADDRESS);
+    errno_assert (rc >= 0);
+
+    /*  No capture by default. */
+    sz = sizeof (buf);
+    rc = nn_getsockopt (sc, NN_SOL_SOCKET, NN_CAPTURE, buf, &sz);
+    errno_assert (rc == 0);
+    nn_assert (sz == 0);
+
+    rc = nn_setsockopt (sc, NN_SOL_SOCKET, NN_CAPTURE, CAPTURE_FILE,
+        strlen (CAPTURE_FILE));
+    errno_assert (rc == 0);
+    sz = sizeof (buf);
+    rc = nn_getsockopt (sc, NN_SOL_SOCKET, NN_CAPTURE, buf, &sz);
+    errno_assert (rc == 0);
+    nn_assert (sz == strlen (CAPTURE_FILE));
+    nn_assert (memcmp (buf, CAPTURE_FILE, sz) == 0);
+
+    rc = nn_send (sc, "ABC", 3, 0);
+    errno_assert (rc == 3);
+    rc = nn_recv (sb, buf, sizeof (buf), 0);
+    errno_assert (rc == 3);
+    rc = nn_send (sb, "DEFGH", 5, 0);
+    errno_assert (rc == 5);
+    rc = nn_recv (sc, buf, sizeof (buf), 0);
+    errno_assert (rc == 5);
+
+    /*  Empty path finishes the capture. */
+    rc = nn_setsockopt (sc, NN_SOL_SOCKET, NN_CAPTURE, "", 0);
+    errno_assert (rc == 0);
+    rc = nn_send (sc, "IJ", 2, 0);
+    errno_assert (rc == 2);
+    rc = nn_recv (sb, buf, sizeof (buf), 0);
+    errno_assert (rc == 2);
+
+    /*  Check the file. */
+    file = fopen (CAPTURE_FILE, "rb");
+    nn_assert (file);
+    nn_assert (fread (hdr, 1, sizeof (hdr), file) == sizeof (hdr));
+    nn_assert (memcmp (hdr, NN_CAPTURE_MAGIC, 4) == 0);
+    nn_assert (nn_gets (hdr + 4) == NN_CAPTURE_VERSION);
+    nn_assert (nn_gets (hdr + 6) == NN_PAIR);
+    nn_assert (nn_getll (hdr + 8) != 0);
+    time = 0;
+    for (i = 0; i != 2; ++i) {
+        nn_assert (fread (rec, 1, sizeof (rec), file) == sizeof (rec));
+        nn_assert (nn_getll (rec) >= time);
+        time = nn_getll (rec);
+        nn_assert (nn_getl (rec + 8) == (i == 0 ? 3 : 5));
+        nn_assert (nn_getl (rec + 12) == (i == 0 ? 1 : (1 | NN_CAPTURE_RECV)));
+    }
+    nn_assert (fread (rec, 1, sizeof (rec), file) == 0);
+    fclose (file);
+    remove (CAPTURE_FILE);
+
+    /*  Path that can't be opened. */
+    rc = nn_setsockopt (sc, NN_SOL_SOCKET, NN_CAPTURE, "/nonexistent/x", 14);
+    nn_assert (rc == -1);
+
+    rc = nn_close (sc);
+    errno_assert (rc == 0);
+    rc = nn_close (sb);
+    errno_assert (rc == 0);
+
+    return 0;
+}
@@ -0,0 +1,117 @@
+/*
+    Copyright (c) 2013 250bpm s.r.o.
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"),
+    to deal in the Software without restriction, including without limitation
+    the rights to use, copy, modify, merge, publish, distribute, sublicense,
+    and/or sell copies of the Software, and to permit persons to whom
+    the Software is furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included
+    in all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+    THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+    FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+    IN THE SOFTWARE.
+*/
+
+/*  Goes first, it may need to define _GNU_SOURCE. */
+#include "../src/utils/chunk.c"
+
+#include "../src/utils/err.c"
+#include "../src/utils/alloc.c"
+#include "../src/utils/mutex.c"
+#include "../src/utils/atomic.c"
+#include "../src/utils/thread.c"
+#include "../src/utils/chunkpool.c"
+#include "../src/utils/chunkref.c"
+
+/*  Test prepending headers to the chunks in place. */
+
+int main ()
+{
+    struct nn_chunkref ref;
+    struct nn_chunkref copy;
+    uint8_t *data;
+    size_t room;
+    struct nn_chunk *chunk;
+    size_t i;
+
+    /*  Data stored in the chunkref itself are moved to make space. */
+    nn_chunkref_init (&ref, 10);
+    memset (nn_chunkref_data (&ref), 'b', 10);
+    nn_assert (nn_chunkref_headroom (&ref) == NN_CHUNKREF_MAX - 12);
+    nn_chunkref_push (&ref, "aa", 2);
+    nn_assert (nn_chunkref_size (&ref) == 12);
+    nn_assert (nn_chunkref_peekchunk (&ref) == NULL);
+    nn_assert (memcmp (nn_chunkref_data (&ref), "aabbbbbbbbbb", 12) == 0);
+    nn_chunkref_term (&ref);
+
+    /*  A newly allocated chunk has NN_CHUNK_RESERVE bytes of space in front
+        of the data. Without it, the data are copied into a new chunk. */
+    nn_chunkref_init (&ref, 100);
+    memset (nn_chunkref_data (&ref), 'b', 100);
+    data = nn_chunkref_data (&ref);
+    nn_assert (nn_chunkref_headroom (&ref) == NN_CHUNK_RESERVE);
+    nn_chunkref_push (&ref, "aaaa", 4);
+#if NN_CHUNK_RESERVE >= 4
+    nn_assert (nn_chunkref_data (&ref) == data - 4);
+    nn_assert (nn_chunkref_headroom (&ref) == NN_CHUNK_RESERVE - 4);
+#else
+    data = ((uint8_t*) nn_chunkref_data (&ref)) + 4;
+    nn_assert (nn_chunkref_headroom (&ref) == NN_CHUNK_RESERVE);
+#endif
+    nn_assert (nn_chunkref_size (&ref) == 104);
+    nn_assert (memcmp (data - 4, "aaaab", 5) == 0);
+
+    /*  Trimmed space is reused first. */
+    room = nn_chunkref_headroom (&ref);
+    nn_chunkref_trim (&ref, 6);
+    nn_assert (nn_chunkref_headroom (&ref) == room + 6);
+    nn_chunkref_push (&ref, "cccccccc", 8);
+    if (room + 6 >= 8)
+        nn_assert (nn_chunkref_data (&ref) == data - 6);
+    nn_assert (nn_chunkref_size (&ref) == 106);
+    nn_assert (memcmp (nn_chunkref_data (&ref), "ccccccccbb", 10) == 0);
+
+    /*  Shared chunks are left intact. */
+    data = nn_chunkref_data (&ref);
+    nn_chunkref_cp (&copy, &ref);
+    nn_assert (nn_chunkref_headroom (&ref) == 0);
+    nn_chunkref_push (&ref, "d", 1);
+    nn_assert (nn_chunkref_data (&copy) == data);
+    nn_assert (nn_chunkref_data (&ref) != data - 1);
+    nn_assert (memcmp (nn_chunkref_data (&ref), "dcccccccc", 9) == 0);
+    nn_assert (memcmp (nn_chunkref_data (&copy), "ccccccccbb", 10) == 0);
+    nn_chunkref_term (&copy);
+    nn_chunkref_term (&ref);
+
+    /*  Header stays aligned whatever the amount of data trimmed or pushed. */
+    nn_assert (nn_chunk_alloc (100, 0, &chunk) == 0);
+    memset (nn_chunk_data (chunk), 'e', 100);
+    for (i = 1; i <= NN_CHUNK_RESERVE + 1; i += 3) {
+        chunk = nn_chunk_trim (chunk, i);
+        nn_assert (((uintptr_t) chunk) % NN_CHUNK_ALIGN == 0);
+        nn_assert (nn_chunk_from_data (nn_chunk_data (chunk)) == chunk);
+        chunk = nn_chunk_push (chunk, i - 1);
+        nn_assert (((uintptr_t) chunk) % NN_CHUNK_ALIGN == 0);
+        nn_assert (nn_chunk_from_data (nn_chunk_data (chunk)) == chunk);
+        nn_assert (nn_chunk_size (chunk) == 99);
+        nn_assert (nn_atomic_get (&chunk->refcount) == 1);
+        memset (nn_chunk_data (chunk), 'e', 99);
+        chunk = nn_chunk_push (chunk, 1);
+    }
+    nn_assert (nn_chunk_headroom (chunk) == NN_CHUNK_RESERVE);
+    chunk = nn_chunk_push (chunk, NN_CHUNK_RESERVE);
+    nn_assert (((uintptr_t) chunk) % NN_CHUNK_ALIGN == 0);
+    nn_assert (nn_chunk_headroom (chunk) == 0);
+    nn_assert (nn_chunk_size (chunk) == 100 + NN_CHUNK_RESERVE);
+    nn_chunk_free (chunk);
+
+    return 0;
+}
@@ -35,6 +35,8 @@
 #define SOCKET_ADDRESS_C "inproc://c"
 #define SOCKET_ADDRESS_D "inproc://d"
 #define SOCKET_ADDRESS_E "inproc://e"
+#define SOCKET_ADDRESS_F "inproc://f"
+#define SOCKET_ADDRESS_G "inproc://g"
 
 void device1 (void *arg)
 {
@@ -110,6 +112,34 @@ void device3 (void *arg)
     errno_assert (rc == 0);
 }
 
+void device4 (void *arg)
+{
+    int rc;
+    int devf;
+    int devg;
+
+    /*  Intialise the device sockets. */
+    devf = nn_socket (AF_SP_RAW, NN_PAIR);
+    errno_assert (devf >= 0);
+    rc = nn_bind (devf, SOCKET_ADDRESS_F);
+    errno_assert (rc >= 0);
+    devg = nn_socket (AF_SP_RAW, NN_PAIR);
+    errno_assert (devg >= 0);
+    rc = nn_bind (devg, SOCKET_ADDRESS_G);
+    errno_assert (rc >= 0);
+
+    /*  Run the device using a receiving and a sending thread for each
+        direction. */
+    rc = nn_device_threads (devf, devg, 4);
+    nn_assert (rc < 0 && nn_errno () == ETERM);
+
+    /*  Clean up. */
+    rc = nn_close (devg);
+    errno_assert (rc == 0);
+    rc = nn_close (devf);
+    errno_assert (rc == 0);
+}
+
 int main ()
 {
     int rc;
@@ -122,8 +152,15 @@ int main ()
     struct nn_thread thread1;
     struct nn_thread thread2;
     struct nn_thread thread3;
+    struct nn_thread thread4;
     char buf [3];
     int timeo;
+    int endf;
+    int endg;
+    int i;
+    int val;
+    int credit;
+    int sent;
 
     /*  Test the bi-directional device. */
 
@@ -172,6 +209,10 @@ int main ()
     errno_assert (rc >= 0);
     endd = nn_socket (AF_SP, NN_PULL);
     errno_assert (endd >= 0);
+    credit = 2;
+    rc = nn_setsockopt (endd, NN_PULL, NN_PULL_CREDIT, &credit,
+        sizeof (credit));
+    errno_assert (rc == 0);
     rc = nn_connect (endd, SOCKET_ADDRESS_D);
     errno_assert (rc >= 0);
 
@@ -183,6 +224,21 @@ int main ()
     errno_assert (rc >= 0);
     nn_assert (rc == 3);
 
+    /*  Once the puller stops receiving, the backpressure reaches the pusher
+        on the other side of the device before many messages pile up. */
+    for (sent = 0; sent != 100000; ++sent) {
+        rc = nn_send (endc, "XYZ", 3, NN_DONTWAIT);
+        if (rc < 0)
+            break;
+    }
+    errno_assert (rc < 0 && nn_errno () == EAGAIN);
+    nn_assert (sent < 1000);
+    for (i = 0; i != sent; ++i) {
+        rc = nn_recv (endd, buf, sizeof (buf), 0);
+        errno_assert (rc >= 0);
+        nn_assert (rc == 3);
+    }
+
     /*  Clean up. */
     rc = nn_close (endd);
     errno_assert (rc == 0);
@@ -230,11 +286,50 @@ int main ()
     rc = nn_close (ende1);
     errno_assert (rc == 0);
 
+    /*  Test the multi-threaded device. */
+
+    /*  Start the device. */
+    nn_thread_init (&thread4, device4, NULL);
+
+    /*  Create two sockets to connect to the device. */
+    endf = nn_socket (AF_SP, NN_PAIR);
+    errno_assert (endf >= 0);
+    rc = nn_connect (endf, SOCKET_ADDRESS_F);
+    errno_assert (rc >= 0);
+    endg = nn_socket (AF_SP, NN_PAIR);
+    errno_assert (endg >= 0);
+    rc = nn_connect (endg, SOCKET_ADDRESS_G);
+    errno_assert (rc >= 0);
+
+    /*  Pass a stream of messages in both directions and check that they
+        arrive in order. */
+    for (i = 0; i != 1000; ++i) {
+        rc = nn_send (endf, &i, sizeof (i), 0);
+        errno_assert (rc == sizeof (i));
+        rc = nn_send (endg, &i, sizeof (i), 0);
+        errno_assert (rc == sizeof (i));
+    }
+    for (i = 0; i != 1000; ++i) {
+        rc = nn_recv (endg, &val, sizeof (val), 0);
+        errno_assert (rc == sizeof (val));
+        nn_assert (val == i);
+        rc = nn_recv (endf, &val, sizeof (val), 0);
+        errno_assert (rc == sizeof (val));
+        nn_assert (val == i);
+    }
+
+    /*  Clean up. */
+    rc = nn_close (endg);
+    errno_assert (rc == 0);
+    rc = nn_close (endf);
+    errno_assert (rc == 0);
+
     /*  Shut down the devices. */
     nn_term ();
     nn_thread_term (&thread1);
     nn_thread_term (&thread2);
     nn_thread_term (&thread3);
+    nn_thread_term (&thread4);
 
     return 0;
 }
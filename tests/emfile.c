@@ -25,9 +25,15 @@
 #include "../src/tcp.h"
 #include "../src/utils/err.c"
 
+#include <stdlib.h>
+
 #define SOCKET_ADDRESS "tcp://127.0.0.1:5555"
 #define MAX_SOCKETS 1000
 
+/*  Limit on number of sockets that spans more than one page of the socket
+    table. */
+#define LIMIT 300
+
 int main ()
 {
     int rc;
@@ -50,6 +56,34 @@ int main ()
         errno_assert (rc == 0);
     }
 
+    /*  Now set the limit explicitly. It is applied when the library is
+        re-initialised with the next socket. */
+    rc = putenv ((char*) "NN_MAX_SOCKETS=300");
+    errno_assert (rc == 0);
+    for (i = 0; i != LIMIT; ++i) {
+        socks [i] = nn_socket (AF_SP, NN_PAIR);
+        errno_assert (socks [i] >= 0);
+    }
+    rc = nn_socket (AF_SP, NN_PAIR);
+    errno_assert (rc == -1 && nn_errno () == EMFILE);
+
+    /*  Descriptor of a closed socket gets reused. */
+    rc = nn_close (socks [LIMIT - 10]);
+    errno_assert (rc == 0);
+    rc = nn_socket (AF_SP, NN_PAIR);
+    errno_assert (rc == socks [LIMIT - 10]);
+
+    /*  Descriptors outside of the socket table are rejected. */
+    rc = nn_close (-1);
+    errno_assert (rc == -1 && nn_errno () == EBADF);
+    rc = nn_close (1000000);
+    errno_assert (rc == -1 && nn_errno () == EBADF);
+
+    for (i = 0; i != LIMIT; ++i) {
+        rc = nn_close (socks [i]);
+        errno_assert (rc == 0);
+    }
+
     return 0;
 }
 
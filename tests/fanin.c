@@ -23,8 +23,37 @@
 #include "../src/nn.h"
 #include "../src/fanin.h"
 #include "../src/utils/err.c"
+#include "../src/utils/sleep.c"
 
 #define SOCKET_ADDRESS "inproc://a"
+#define SOCKET_ADDRESS_QUANTUM "inproc://b"
+#define SOCKET_ADDRESS_REORDER "inproc://c"
+#define SOCKET_ADDRESS_REORDER_TCP "tcp://127.0.0.1:5563"
+
+/*  Sends a message stamped with stream ID 1 and the sequence number by hand,
+    the way the sink sees it when it arrives via a stream transport. */
+static void send_seq (int s, unsigned char seq)
+{
+    int rc;
+    unsigned char msg [9] = {0, 0, 0, 1, 0, 0, 0, 0, 0};
+
+    msg [7] = seq;
+    msg [8] = seq;
+    rc = nn_send (s, msg, sizeof (msg), 0);
+    errno_assert (rc == sizeof (msg));
+}
+
+/*  Receives a message and checks that it's the one with the sequence
+    number 'seq'. */
+static void recv_seq (int s, unsigned char seq)
+{
+    int rc;
+    unsigned char buf [2];
+
+    rc = nn_recv (s, buf, sizeof (buf), NN_DONTWAIT);
+    errno_assert (rc == 1);
+    nn_assert (buf [0] == seq);
+}
 
 int main ()
 {
@@ -33,6 +62,10 @@ int main ()
     int source1;
     int source2;
     char buf [3];
+    int quantum;
+    char got [8];
+    int i;
+    int val;
 
     sink = nn_socket (AF_SP, NN_SINK);
     errno_assert (sink != -1);
@@ -68,6 +101,132 @@ int main ()
     rc = nn_close (source2);
     errno_assert (rc == 0);
 
+    /*  Test the receive quantum. Messages are taken from each source in runs
+        of the specified length. */
+    sink = nn_socket (AF_SP, NN_SINK);
+    errno_assert (sink != -1);
+    quantum = 2;
+    rc = nn_setsockopt (sink, NN_SOL_SOCKET, NN_RCVQUANTUM, &quantum,
+        sizeof (quantum));
+    errno_assert (rc == 0);
+    rc = nn_bind (sink, SOCKET_ADDRESS_QUANTUM);
+    errno_assert (rc >= 0);
+    source1 = nn_socket (AF_SP, NN_SOURCE);
+    errno_assert (source1 != -1);
+    rc = nn_connect (source1, SOCKET_ADDRESS_QUANTUM);
+    errno_assert (rc >= 0);
+    source2 = nn_socket (AF_SP, NN_SOURCE);
+    errno_assert (source2 != -1);
+    rc = nn_connect (source2, SOCKET_ADDRESS_QUANTUM);
+    errno_assert (rc >= 0);
+    nn_sleep (10);
+
+    for (i = 0; i != 4; ++i) {
+        rc = nn_send (source1, "A", 1, 0);
+        errno_assert (rc == 1);
+        rc = nn_send (source2, "B", 1, 0);
+        errno_assert (rc == 1);
+    }
+    nn_sleep (10);
+    for (i = 0; i != 8; ++i) {
+        rc = nn_recv (sink, got + i, 1, 0);
+        errno_assert (rc == 1);
+    }
+    for (i = 0; i != 8; i += 2) {
+        nn_assert (got [i] == got [i + 1]);
+        if (i)
+            nn_assert (got [i] != got [i - 1]);
+    }
+
+    rc = nn_close (sink);
+    errno_assert (rc == 0);
+    rc = nn_close (source1);
+    errno_assert (rc == 0);
+    rc = nn_close (source2);
+    errno_assert (rc == 0);
+
+    /*  Two replicated sources sharing a stream ID. Each message is received
+        once, in order. */
+    sink = nn_socket (AF_SP, NN_SINK);
+    errno_assert (sink != -1);
+    val = 4;
+    rc = nn_setsockopt (sink, NN_SINK, NN_SINK_REORDER, &val, sizeof (val));
+    errno_assert (rc == 0);
+    rc = nn_bind (sink, SOCKET_ADDRESS_REORDER);
+    errno_assert (rc >= 0);
+    source1 = nn_socket (AF_SP, NN_SOURCE);
+    errno_assert (source1 != -1);
+    source2 = nn_socket (AF_SP, NN_SOURCE);
+    errno_assert (source2 != -1);
+    val = 7;
+    rc = nn_setsockopt (source1, NN_SOURCE, NN_SOURCE_STREAM, &val,
+        sizeof (val));
+    errno_assert (rc == 0);
+    rc = nn_setsockopt (source2, NN_SOURCE, NN_SOURCE_STREAM, &val,
+        sizeof (val));
+    errno_assert (rc == 0);
+    rc = nn_connect (source1, SOCKET_ADDRESS_REORDER);
+    errno_assert (rc >= 0);
+    rc = nn_connect (source2, SOCKET_ADDRESS_REORDER);
+    errno_assert (rc >= 0);
+    nn_sleep (10);
+
+    for (i = 0; i != 3; ++i) {
+        rc = nn_send (source1, "012" + i, 1, 0);
+        errno_assert (rc == 1);
+        rc = nn_send (source2, "012" + i, 1, 0);
+        errno_assert (rc == 1);
+    }
+    nn_sleep (10);
+    for (i = 0; i != 3; ++i) {
+        rc = nn_recv (sink, buf, sizeof (buf), NN_DONTWAIT);
+        errno_assert (rc == 1);
+        nn_assert (buf [0] == '0' + i);
+    }
+    rc = nn_recv (sink, buf, sizeof (buf), NN_DONTWAIT);
+    nn_assert (rc < 0 && nn_errno () == EAGAIN);
+
+    rc = nn_close (source2);
+    errno_assert (rc == 0);
+    rc = nn_close (source1);
+    errno_assert (rc == 0);
+
+    /*  Out-of-order messages are held back until the missing ones arrive.
+        If a message doesn't fit into the window, the missing messages are
+        given up on. */
+    rc = nn_bind (sink, SOCKET_ADDRESS_REORDER_TCP);
+    errno_assert (rc >= 0);
+    source1 = nn_socket (AF_SP_RAW, NN_SOURCE);
+    errno_assert (source1 != -1);
+    rc = nn_connect (source1, SOCKET_ADDRESS_REORDER_TCP);
+    errno_assert (rc >= 0);
+    nn_sleep (100);
+
+    send_seq (source1, 0);
+    send_seq (source1, 2);
+    send_seq (source1, 1);
+    send_seq (source1, 1);
+    send_seq (source1, 4);
+    send_seq (source1, 3);
+    send_seq (source1, 10);
+    send_seq (source1, 9);
+    send_seq (source1, 7);
+    nn_sleep (100);
+    for (i = 0; i != 5; ++i)
+        recv_seq (sink, (unsigned char) i);
+    recv_seq (sink, 7);
+    rc = nn_recv (sink, buf, sizeof (buf), NN_DONTWAIT);
+    nn_assert (rc < 0 && nn_errno () == EAGAIN);
+    send_seq (source1, 8);
+    nn_sleep (100);
+    for (i = 8; i != 11; ++i)
+        recv_seq (sink, (unsigned char) i);
+
+    rc = nn_close (source1);
+    errno_assert (rc == 0);
+    rc = nn_close (sink);
+    errno_assert (rc == 0);
+
     return 0;
 }
 
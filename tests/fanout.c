@@ -25,7 +25,19 @@
 #include "../src/utils/err.c"
 #include "../src/utils/sleep.c"
 
+#include <string.h>
+#include <stdio.h>
+
+#if !defined NN_HAVE_WINDOWS
+#include <unistd.h>
+#endif
+
 #define SOCKET_ADDRESS "inproc://a"
+#define SOCKET_ADDRESS_CREDIT "inproc://b"
+#define SOCKET_ADDRESS_AFFINITY "inproc://c"
+#define SOCKET_ADDRESS_SPOOL "inproc://d"
+#define SPOOL_DIR "fanout.spool"
+#define SPOOL_MESSAGES 500
 
 int main ()
 {
@@ -34,6 +46,18 @@ int main ()
     int pull1;
     int pull2;
     char buf [3];
+    int credit;
+    int affinity;
+    int pulls [3];
+    int eids [3];
+    char addr [16];
+    int owners [8];
+    int i;
+    int j;
+    int k;
+    char msg [16];
+    char dir [32];
+    size_t sz;
 
     push = nn_socket (AF_SP, NN_PUSH);
     errno_assert (push != -1);
@@ -73,6 +97,185 @@ int main ()
     rc = nn_close (pull2);
     errno_assert (rc == 0);
 
+    /*  Test the credit mode. Messages are sent only to the pullers that are
+        ready to accept them. */
+    push = nn_socket (AF_SP, NN_PUSH);
+    errno_assert (push != -1);
+    rc = nn_bind (push, SOCKET_ADDRESS_CREDIT);
+    errno_assert (rc >= 0);
+    credit = 1;
+    pull1 = nn_socket (AF_SP, NN_PULL);
+    errno_assert (pull1 != -1);
+    rc = nn_setsockopt (pull1, NN_PULL, NN_PULL_CREDIT, &credit,
+        sizeof (credit));
+    errno_assert (rc == 0);
+    rc = nn_connect (pull1, SOCKET_ADDRESS_CREDIT);
+    errno_assert (rc >= 0);
+    pull2 = nn_socket (AF_SP, NN_PULL);
+    errno_assert (pull2 != -1);
+    rc = nn_setsockopt (pull2, NN_PULL, NN_PULL_CREDIT, &credit,
+        sizeof (credit));
+    errno_assert (rc == 0);
+    rc = nn_connect (pull2, SOCKET_ADDRESS_CREDIT);
+    errno_assert (rc >= 0);
+    nn_sleep (10);
+
+    rc = nn_send (push, "ABC", 3, NN_DONTWAIT);
+    errno_assert (rc == 3);
+    rc = nn_send (push, "DEF", 3, NN_DONTWAIT);
+    errno_assert (rc == 3);
+    rc = nn_send (push, "GHI", 3, NN_DONTWAIT);
+    nn_assert (rc == -1 && nn_errno () == EAGAIN);
+
+    /*  The puller that is done with its message gets the next one. */
+    rc = nn_recv (pull1, buf, sizeof (buf), 0);
+    errno_assert (rc == 3);
+    nn_sleep (10);
+    rc = nn_send (push, "GHI", 3, NN_DONTWAIT);
+    errno_assert (rc == 3);
+    rc = nn_send (push, "JKL", 3, NN_DONTWAIT);
+    nn_assert (rc == -1 && nn_errno () == EAGAIN);
+    rc = nn_recv (pull1, buf, sizeof (buf), 0);
+    errno_assert (rc == 3);
+    nn_assert (memcmp (buf, "GHI", 3) == 0);
+    rc = nn_recv (pull1, buf, sizeof (buf), NN_DONTWAIT);
+    nn_assert (rc == -1 && nn_errno () == EAGAIN);
+
+    /*  Switching the credit mode off lets the pusher send at will. */
+    credit = 0;
+    rc = nn_setsockopt (pull2, NN_PULL, NN_PULL_CREDIT, &credit,
+        sizeof (credit));
+    errno_assert (rc == 0);
+    nn_sleep (10);
+    rc = nn_send (push, "JKL", 3, NN_DONTWAIT);
+    errno_assert (rc == 3);
+    rc = nn_send (push, "MNO", 3, NN_DONTWAIT);
+    errno_assert (rc == 3);
+    rc = nn_send (push, "PQR", 3, NN_DONTWAIT);
+    errno_assert (rc == 3);
+    rc = nn_recv (pull1, buf, sizeof (buf), 0);
+    errno_assert (rc == 3);
+    rc = nn_recv (pull2, buf, sizeof (buf), 0);
+    errno_assert (rc == 3);
+    rc = nn_recv (pull2, buf, sizeof (buf), 0);
+    errno_assert (rc == 3);
+    rc = nn_recv (pull2, buf, sizeof (buf), 0);
+    errno_assert (rc == 3);
+
+    rc = nn_close (push);
+    errno_assert (rc == 0);
+    rc = nn_close (pull1);
+    errno_assert (rc == 0);
+    rc = nn_close (pull2);
+    errno_assert (rc == 0);
+
+    /*  Test the affinity mode. Messages with the same key go to the same
+        puller. When a puller leaves, the other keys stay where they were. */
+    push = nn_socket (AF_SP, NN_PUSH);
+    errno_assert (push != -1);
+    affinity = 1;
+    rc = nn_setsockopt (push, NN_PUSH, NN_PUSH_AFFINITY, &affinity,
+        sizeof (affinity));
+    errno_assert (rc == 0);
+    for (i = 0; i != 3; ++i) {
+        memcpy (addr, SOCKET_ADDRESS_AFFINITY, sizeof (SOCKET_ADDRESS_AFFINITY));
+        addr [sizeof (SOCKET_ADDRESS_AFFINITY) - 1] = '0' + i;
+        addr [sizeof (SOCKET_ADDRESS_AFFINITY)] = 0;
+        pulls [i] = nn_socket (AF_SP, NN_PULL);
+        errno_assert (pulls [i] != -1);
+        rc = nn_bind (pulls [i], addr);
+        errno_assert (rc >= 0);
+        eids [i] = nn_connect (push, addr);
+        errno_assert (eids [i] >= 0);
+    }
+    nn_sleep (10);
+
+    for (k = 0; k != 2; ++k) {
+        for (i = 0; i != 8; ++i) {
+            buf [0] = 'A' + i;
+            for (j = 0; j != 3; ++j) {
+                buf [1] = '0' + j;
+                rc = nn_send (push, buf, 2, 0);
+                errno_assert (rc == 2);
+            }
+        }
+        nn_sleep (10);
+        for (i = 0; i != 3 - k; ++i) {
+            while (1) {
+                rc = nn_recv (pulls [i], buf, sizeof (buf), NN_DONTWAIT);
+                if (rc < 0 && nn_errno () == EAGAIN)
+                    break;
+                errno_assert (rc == 2);
+                if (k == 0 && buf [1] == '0')
+                    owners [buf [0] - 'A'] = i;
+                else if (k == 0 || owners [buf [0] - 'A'] != 2)
+                    nn_assert (owners [buf [0] - 'A'] == i);
+            }
+        }
+        if (k == 0) {
+            rc = nn_shutdown (push, eids [2]);
+            errno_assert (rc == 0);
+            nn_sleep (10);
+        }
+    }
+
+    rc = nn_close (push);
+    errno_assert (rc == 0);
+    rc = nn_close (pulls [0]);
+    errno_assert (rc == 0);
+    rc = nn_close (pulls [1]);
+    errno_assert (rc == 0);
+    rc = nn_close (pulls [2]);
+    errno_assert (rc == 0);
+
+#if !defined NN_HAVE_WINDOWS
+    /*  Test the spool. The messages sent while there's no puller are stored
+        on disk, survive closing the socket and are delivered in order once
+        a puller connects. */
+    for (k = 0; k != 2; ++k) {
+        push = nn_socket (AF_SP, NN_PUSH);
+        errno_assert (push != -1);
+        rc = nn_setsockopt (push, NN_PUSH, NN_PUSH_SPOOL, SPOOL_DIR,
+            strlen (SPOOL_DIR));
+        errno_assert (rc == 0);
+        sz = sizeof (dir);
+        rc = nn_getsockopt (push, NN_PUSH, NN_PUSH_SPOOL, dir, &sz);
+        errno_assert (rc == 0);
+        nn_assert (sz == strlen (SPOOL_DIR) && memcmp (dir, SPOOL_DIR, sz) == 0);
+        rc = nn_bind (push, SOCKET_ADDRESS_SPOOL);
+        errno_assert (rc >= 0);
+        for (i = k * SPOOL_MESSAGES; i != (k + 1) * SPOOL_MESSAGES; ++i) {
+            sprintf (msg, "%d", i);
+            rc = nn_send (push, msg, strlen (msg), NN_DONTWAIT);
+            errno_assert (rc == (int) strlen (msg));
+        }
+        if (k == 0) {
+            rc = nn_close (push);
+            errno_assert (rc == 0);
+        }
+    }
+    rc = nn_setsockopt (push, NN_PUSH, NN_PUSH_SPOOL, "", 0);
+    nn_assert (rc < 0 && nn_errno () == EBUSY);
+    pull1 = nn_socket (AF_SP, NN_PULL);
+    errno_assert (pull1 != -1);
+    rc = nn_connect (pull1, SOCKET_ADDRESS_SPOOL);
+    errno_assert (rc >= 0);
+    for (i = 0; i != 2 * SPOOL_MESSAGES; ++i) {
+        rc = nn_recv (pull1, msg, sizeof (msg), 0);
+        errno_assert (rc >= 0);
+        sprintf (dir, "%d", i);
+        nn_assert (rc == (int) strlen (dir) && memcmp (msg, dir, rc) == 0);
+    }
+    rc = nn_setsockopt (push, NN_PUSH, NN_PUSH_SPOOL, "", 0);
+    errno_assert (rc == 0);
+    rc = nn_close (push);
+    errno_assert (rc == 0);
+    rc = nn_close (pull1);
+    errno_assert (rc == 0);
+    rc = rmdir (SPOOL_DIR);
+    errno_assert (rc == 0);
+#endif
+
     return 0;
 }
 
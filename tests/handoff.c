@@ -0,0 +1,189 @@
+/*
+    Copyright (c) 2013 250bpm s.r.o.
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"),
+    to deal in the Software without restriction, including without limitation
+    the rights to use, copy, modify, merge, publish, distribute, sublicense,
+    and/or sell copies of the Software, and to permit persons to whom
+    the Software is furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included
+    in all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+    THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+    FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+    IN THE SOFTWARE.
+*/
+
+#include "../src/nn.h"
+#include "../src/pair.h"
+
+#include "../src/utils/err.c"
+#include "../src/utils/sleep.c"
+
+#include <string.h>
+
+#if !defined NN_HAVE_WINDOWS
+#include <sys/socket.h>
+#include <unistd.h>
+#endif
+
+/*  Test hot restart: the endpoints and the connections are passed over to
+    another socket and the peer keeps its connection. */
+
+#define SOCKET_ADDRESS_TCP "tcp://127.0.0.1:5592"
+#define SOCKET_ADDRESS_IPC "ipc://test-handoff.ipc"
+
+#if !defined NN_HAVE_WINDOWS
+
+/*  Waits till socket 's' has seen the given numbers of connections
+    established and broken. */
+static void wait_stats (int s, unsigned long long connects,
+    unsigned long long disconnects)
+{
+    int rc;
+    int i;
+    size_t sz;
+    struct nn_sock_stats stats;
+
+    for (i = 0; i != 100; ++i) {
+        sz = sizeof (stats);
+        rc = nn_getsockopt (s, NN_SOL_SOCKET, NN_STATS, &stats, &sz);
+        errno_assert (rc == 0);
+        if (stats.connects == connects && stats.disconnects == disconnects)
+            return;
+        nn_sleep (10);
+    }
+    nn_assert (0);
+}
+
+static void handoff (const char *addr)
+{
+    int rc;
+    int sa;
+    int sb;
+    int sc;
+    int timeo;
+    int sv [2];
+    size_t sz;
+    char buf [3];
+    struct nn_sock_stats stats;
+
+    sa = nn_socket (AF_SP, NN_PAIR);
+    errno_assert (sa != -1);
+    rc = nn_bind (sa, addr);
+    errno_assert (rc >= 0);
+    sc = nn_socket (AF_SP, NN_PAIR);
+    errno_assert (sc != -1);
+    timeo = 1000;
+    rc = nn_setsockopt (sc, NN_SOL_SOCKET, NN_RCVTIMEO, &timeo, sizeof (timeo));
+    errno_assert (rc == 0);
+    rc = nn_connect (sc, addr);
+    errno_assert (rc >= 0);
+
+    rc = nn_send (sc, "ABC", 3, 0);
+    errno_assert (rc == 3);
+    rc = nn_recv (sa, buf, sizeof (buf), 0);
+    errno_assert (rc == 3);
+    rc = nn_send (sa, "DEF", 3, 0);
+    errno_assert (rc == 3);
+    rc = nn_recv (sc, buf, sizeof (buf), 0);
+    errno_assert (rc == 3);
+    nn_sleep (10);
+
+    /*  Pass the endpoint along with the connection over to another socket.
+        The records fit into the socket buffer, so a single thread does. */
+    rc = socketpair (AF_UNIX, SOCK_STREAM, 0, sv);
+    errno_assert (rc == 0);
+    rc = nn_handoff (sa, sv [0]);
+    errno_assert (rc == 1);
+    rc = nn_close (sa);
+    errno_assert (rc == 0);
+    sb = nn_socket (AF_SP, NN_PAIR);
+    errno_assert (sb != -1);
+    rc = nn_setsockopt (sb, NN_SOL_SOCKET, NN_RCVTIMEO, &timeo, sizeof (timeo));
+    errno_assert (rc == 0);
+    rc = nn_adopt (sb, sv [1]);
+    errno_assert (rc == 1);
+    close (sv [0]);
+    close (sv [1]);
+
+    /*  The messages flow over the original connection. */
+    rc = nn_send (sc, "GHI", 3, 0);
+    errno_assert (rc == 3);
+    rc = nn_recv (sb, buf, sizeof (buf), 0);
+    errno_assert (rc == 3);
+    nn_assert (memcmp (buf, "GHI", 3) == 0);
+    rc = nn_send (sb, "JKL", 3, 0);
+    errno_assert (rc == 3);
+    rc = nn_recv (sc, buf, sizeof (buf), 0);
+    errno_assert (rc == 3);
+    nn_assert (memcmp (buf, "JKL", 3) == 0);
+    sz = sizeof (stats);
+    rc = nn_getsockopt (sc, NN_SOL_SOCKET, NN_STATS, &stats, &sz);
+    errno_assert (rc == 0);
+    nn_assert (stats.connects == 1 && stats.disconnects == 0);
+
+    /*  The listening socket was passed over as well. PAIR accepts a single
+        connection, so wait till the old one is gone before reconnecting,
+        and for the new one before sending. */
+    rc = nn_close (sc);
+    errno_assert (rc == 0);
+    wait_stats (sb, 1, 1);
+    sc = nn_socket (AF_SP, NN_PAIR);
+    errno_assert (sc != -1);
+    rc = nn_setsockopt (sc, NN_SOL_SOCKET, NN_RCVTIMEO, &timeo, sizeof (timeo));
+    errno_assert (rc == 0);
+    rc = nn_connect (sc, addr);
+    errno_assert (rc >= 0);
+    wait_stats (sb, 2, 1);
+    rc = nn_send (sb, "MNO", 3, 0);
+    errno_assert (rc == 3);
+    rc = nn_recv (sc, buf, sizeof (buf), 0);
+    errno_assert (rc == 3);
+    nn_assert (memcmp (buf, "MNO", 3) == 0);
+
+    rc = nn_close (sc);
+    errno_assert (rc == 0);
+    rc = nn_close (sb);
+    errno_assert (rc == 0);
+}
+
+#endif
+
+int main ()
+{
+#if !defined NN_HAVE_WINDOWS
+    int rc;
+    int sa;
+    int sv [2];
+
+    handoff (SOCKET_ADDRESS_TCP);
+    handoff (SOCKET_ADDRESS_IPC);
+
+    /*  Nothing to pass over. */
+    sa = nn_socket (AF_SP, NN_PAIR);
+    errno_assert (sa != -1);
+    rc = socketpair (AF_UNIX, SOCK_STREAM, 0, sv);
+    errno_assert (rc == 0);
+    rc = nn_handoff (sa, sv [0]);
+    errno_assert (rc == 0);
+    rc = nn_adopt (sa, sv [1]);
+    errno_assert (rc == 0);
+
+    /*  The predecessor went away before finishing. */
+    close (sv [0]);
+    rc = nn_adopt (sa, sv [1]);
+    nn_assert (rc < 0 && nn_errno () == ECONNRESET);
+    close (sv [1]);
+    rc = nn_close (sa);
+    errno_assert (rc == 0);
+#endif
+
+    return 0;
+}
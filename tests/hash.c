@@ -21,9 +21,9 @@
 */
 
 #include "../src/utils/err.c"
-#include "../src/utils/list.c"
 #include "../src/utils/hash.c"
 #include "../src/utils/alloc.c"
+#include "../src/utils/mutex.c"
 
 int main ()
 {
@@ -55,6 +55,33 @@ int main ()
     }
     nn_hash_term (&hash);
 
+    /*  Interleave insertions and removals so that items are removed both
+        from the new array and from the one being moved out of. */
+    nn_hash_init (&hash);
+    for (k = 0; k != 21000; ++k) {
+        item = nn_alloc (sizeof (struct nn_hash_item), "item");
+        nn_assert (item);
+        nn_hash_item_init (item);
+        nn_hash_insert (&hash, k, item);
+        if (k % 3 == 2) {
+            item = nn_hash_get (&hash, k - 1);
+            nn_assert (item && item->key == k - 1);
+            nn_hash_erase (&hash, item);
+            nn_free (item);
+        }
+    }
+    for (k = 0; k != 21000; ++k) {
+        item = nn_hash_get (&hash, k);
+        if (k % 3 == 1) {
+            nn_assert (!item);
+            continue;
+        }
+        nn_assert (item && item->key == k);
+        nn_hash_erase (&hash, item);
+        nn_free (item);
+    }
+    nn_hash_term (&hash);
+
     return 0;
 }
 
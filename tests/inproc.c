@@ -36,8 +36,10 @@ int main ()
     int sb;
     int sc;
     int i;
+    int j;
     char buf [256];
     int val;
+    size_t sz;
 
     /*  Create a simple topology. */
     sc = nn_socket (AF_SP, NN_PAIR);
@@ -149,6 +151,160 @@ int main ()
     rc = nn_close (sb);
     errno_assert (rc == 0);
 
+    /*  Test the low-water mark. Once the queue is full, the sender should
+        be blocked until it drains to 100 bytes. */
+    sb = nn_socket (AF_SP, NN_PAIR);
+    errno_assert (sb != -1);
+    val = 100;
+    rc = nn_setsockopt (sb, NN_SOL_SOCKET, NN_RCVBUF, &val, sizeof (val));
+    errno_assert (rc == 0);
+    rc = nn_bind (sb, SOCKET_ADDRESS);
+    errno_assert (rc >= 0);
+    sc = nn_socket (AF_SP, NN_PAIR);
+    errno_assert (sc != -1);
+    val = 100;
+    rc = nn_setsockopt (sc, NN_SOL_SOCKET, NN_SNDBUF, &val, sizeof (val));
+    errno_assert (rc == 0);
+    rc = nn_setsockopt (sc, NN_SOL_SOCKET, NN_SNDLOWAT, &val, sizeof (val));
+    errno_assert (rc == 0);
+    rc = nn_connect (sc, SOCKET_ADDRESS);
+    errno_assert (rc >= 0);
+
+    for (i = 0; i != 20; ++i) {
+        rc = nn_send (sc, "0123456789", 10, 0);
+        errno_assert (rc >= 0);
+        nn_assert (rc == 10);
+    }
+    rc = nn_send (sc, "0123456789", 10, NN_DONTWAIT);
+    nn_assert (rc < 0 && nn_errno () == EAGAIN);
+    for (i = 0; i != 9; ++i) {
+        rc = nn_recv (sb, buf, sizeof (buf), 0);
+        errno_assert (rc >= 0);
+        nn_assert (rc == 10);
+    }
+    rc = nn_send (sc, "0123456789", 10, NN_DONTWAIT);
+    nn_assert (rc < 0 && nn_errno () == EAGAIN);
+    rc = nn_recv (sb, buf, sizeof (buf), 0);
+    errno_assert (rc >= 0);
+    nn_assert (rc == 10);
+    val = 200;
+    rc = nn_setsockopt (sc, NN_SOL_SOCKET, NN_SNDTIMEO, &val, sizeof (val));
+    errno_assert (rc == 0);
+    rc = nn_send (sc, "0123456789", 10, 0);
+    errno_assert (rc >= 0);
+    nn_assert (rc == 10);
+    for (i = 0; i != 11; ++i) {
+        rc = nn_recv (sb, buf, sizeof (buf), 0);
+        errno_assert (rc >= 0);
+        nn_assert (rc == 10);
+    }
+
+    rc = nn_close (sc);
+    errno_assert (rc == 0);
+    rc = nn_close (sb);
+    errno_assert (rc == 0);
+
+    /*  Test the queue limits and the low-water mark in messages. */
+    sb = nn_socket (AF_SP, NN_PAIR);
+    errno_assert (sb != -1);
+    val = 2;
+    rc = nn_setsockopt (sb, NN_SOL_SOCKET, NN_RCVBUFMSGS, &val, sizeof (val));
+    errno_assert (rc == 0);
+    rc = nn_bind (sb, SOCKET_ADDRESS);
+    errno_assert (rc >= 0);
+    sc = nn_socket (AF_SP, NN_PAIR);
+    errno_assert (sc != -1);
+    val = 3;
+    rc = nn_setsockopt (sc, NN_SOL_SOCKET, NN_SNDBUFMSGS, &val, sizeof (val));
+    errno_assert (rc == 0);
+    val = 2;
+    rc = nn_setsockopt (sc, NN_SOL_SOCKET, NN_SNDLOWATMSGS, &val,
+        sizeof (val));
+    errno_assert (rc == 0);
+    rc = nn_connect (sc, SOCKET_ADDRESS);
+    errno_assert (rc >= 0);
+
+    for (i = 0; i != 5; ++i) {
+        rc = nn_send (sc, "ABC", 3, 0);
+        errno_assert (rc >= 0);
+        nn_assert (rc == 3);
+    }
+    rc = nn_send (sc, "ABC", 3, NN_DONTWAIT);
+    nn_assert (rc < 0 && nn_errno () == EAGAIN);
+    for (i = 0; i != 2; ++i) {
+        rc = nn_recv (sb, buf, sizeof (buf), 0);
+        errno_assert (rc >= 0);
+        nn_assert (rc == 3);
+    }
+    rc = nn_send (sc, "ABC", 3, NN_DONTWAIT);
+    nn_assert (rc < 0 && nn_errno () == EAGAIN);
+    rc = nn_recv (sb, buf, sizeof (buf), 0);
+    errno_assert (rc >= 0);
+    nn_assert (rc == 3);
+    val = 200;
+    rc = nn_setsockopt (sc, NN_SOL_SOCKET, NN_SNDTIMEO, &val, sizeof (val));
+    errno_assert (rc == 0);
+    rc = nn_send (sc, "ABC", 3, 0);
+    errno_assert (rc >= 0);
+    nn_assert (rc == 3);
+    for (i = 0; i != 3; ++i) {
+        rc = nn_recv (sb, buf, sizeof (buf), 0);
+        errno_assert (rc >= 0);
+        nn_assert (rc == 3);
+    }
+
+    rc = nn_close (sc);
+    errno_assert (rc == 0);
+    rc = nn_close (sb);
+    errno_assert (rc == 0);
+
+    /*  Test the chunk cache and prefaulting. Bursts of messages spanning
+        several queue chunks are passed through the prefaulted ones, then
+        through ones allocated on demand. */
+    sb = nn_socket (AF_SP, NN_PAIR);
+    errno_assert (sb != -1);
+    rc = nn_bind (sb, SOCKET_ADDRESS);
+    errno_assert (rc >= 0);
+    sc = nn_socket (AF_SP, NN_PAIR);
+    errno_assert (sc != -1);
+    sz = sizeof (val);
+    rc = nn_getsockopt (sc, NN_INPROC, NN_INPROC_CHUNKS, &val, &sz);
+    errno_assert (rc == 0);
+    nn_assert (sz == sizeof (val) && val == 1);
+    val = -1;
+    rc = nn_setsockopt (sc, NN_INPROC, NN_INPROC_PREFAULT, &val, sizeof (val));
+    nn_assert (rc < 0 && nn_errno () == EINVAL);
+    val = NN_ALLOC_MAX;
+    rc = nn_setsockopt (sc, NN_INPROC, NN_INPROC_ALLOCTYPE, &val,
+        sizeof (val));
+    nn_assert (rc < 0 && nn_errno () == EINVAL);
+    val = 2;
+    rc = nn_setsockopt (sc, NN_INPROC, NN_INPROC_CHUNKS, &val, sizeof (val));
+    errno_assert (rc == 0);
+    val = 3;
+    rc = nn_setsockopt (sc, NN_INPROC, NN_INPROC_PREFAULT, &val, sizeof (val));
+    errno_assert (rc == 0);
+    rc = nn_connect (sc, SOCKET_ADDRESS);
+    errno_assert (rc >= 0);
+
+    for (j = 0; j != 4; ++j) {
+        for (i = 0; i != 100 + j * 300; ++i) {
+            rc = nn_send (sc, "ABC", 3, 0);
+            errno_assert (rc >= 0);
+            nn_assert (rc == 3);
+        }
+        for (i = 0; i != 100 + j * 300; ++i) {
+            rc = nn_recv (sb, buf, sizeof (buf), 0);
+            errno_assert (rc >= 0);
+            nn_assert (rc == 3);
+        }
+    }
+
+    rc = nn_close (sc);
+    errno_assert (rc == 0);
+    rc = nn_close (sb);
+    errno_assert (rc == 0);
+
     return 0;
 }
 
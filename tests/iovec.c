@@ -28,6 +28,42 @@
 #include <string.h>
 
 #define SOCKET_ADDRESS "inproc://a"
+#define SOCKET_ADDRESS_TCP "tcp://127.0.0.1:5557"
+
+/*  Sends a message composed of ordinary buffers and a buffer allocated by
+    nn_allocmsg and checks that it arrives in one piece. */
+static void test_fragments (int sb, int sc)
+{
+    int rc;
+    struct nn_iovec iov [4];
+    struct nn_msghdr hdr;
+    char *chunk;
+    char buf [10];
+
+    chunk = nn_allocmsg (4, 0);
+    alloc_assert (chunk);
+    memcpy (chunk, "CDEF", 4);
+
+    iov [0].iov_base = "A";
+    iov [0].iov_len = 1;
+    iov [1].iov_base = "B";
+    iov [1].iov_len = 1;
+    iov [2].iov_base = &chunk;
+    iov [2].iov_len = NN_MSG;
+    iov [3].iov_base = "GHIJ";
+    iov [3].iov_len = 4;
+    memset (&hdr, 0, sizeof (hdr));
+    hdr.msg_iov = iov;
+    hdr.msg_iovlen = 4;
+    rc = nn_sendmsg (sc, &hdr, 0);
+    errno_assert (rc >= 0);
+    nn_assert (rc == 10);
+
+    rc = nn_recv (sb, buf, sizeof (buf), 0);
+    errno_assert (rc >= 0);
+    nn_assert (rc == 10);
+    nn_assert (memcmp (buf, "ABCDEFGHIJ", 10) == 0);
+}
 
 int main ()
 {
@@ -70,6 +106,25 @@ int main ()
     nn_assert (rc == 6);
     nn_assert (memcmp (buf, "ABCDEF", 6) == 0);
 
+    test_fragments (sb, sc);
+
+    rc = nn_close (sc);
+    errno_assert (rc == 0);
+    rc = nn_close (sb);
+    errno_assert (rc == 0);
+
+    /*  Fragmented message over a stream transport. */
+    sb = nn_socket (AF_SP, NN_PAIR);
+    errno_assert (sb != -1);
+    rc = nn_bind (sb, SOCKET_ADDRESS_TCP);
+    errno_assert (rc >= 0);
+    sc = nn_socket (AF_SP, NN_PAIR);
+    errno_assert (sc != -1);
+    rc = nn_connect (sc, SOCKET_ADDRESS_TCP);
+    errno_assert (rc >= 0);
+
+    test_fragments (sb, sc);
+
     rc = nn_close (sc);
     errno_assert (rc == 0);
     rc = nn_close (sb);
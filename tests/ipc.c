@@ -28,9 +28,16 @@
 #include "../src/utils/err.c"
 #include "../src/utils/sleep.c"
 
+#include <string.h>
+
 /*  Tests IPC transport. */
 
 #define SOCKET_ADDRESS "ipc://test.ipc"
+#define LARGE_MSG_SIZE (4 * 1024 * 1024)
+#define SEQPACKET_ADDRESS "ipc://test_seq.ipc"
+
+static const size_t seqpacket_sizes [] =
+    {0, 1, 100, 4095, 4096, 4097, 100000, 2 * 1024 * 1024};
 
 int main ()
 {
@@ -39,7 +46,12 @@ int main ()
     int sb;
     int sc;
     int i;
+    size_t j;
+    size_t len;
+    size_t sz;
+    int val;
     char buf [3];
+    char *msg;
 
     /*  Try closing a IPC socket while it not connected. */
     sc = nn_socket (AF_SP, NN_PAIR);
@@ -95,6 +107,94 @@ int main ()
         nn_assert (rc == 3);
     }
 
+    /*  Large messages in memory files, which may be passed by file
+        descriptor. */
+    for (i = 0; i != 20; ++i) {
+        msg = nn_allocmsg (LARGE_MSG_SIZE, NN_ALLOC_SHARED);
+        alloc_assert (msg);
+        for (j = 0; j != LARGE_MSG_SIZE; j += 4096)
+            msg [j] = (char) (i + j / 4096);
+        rc = nn_send (sc, &msg, NN_MSG, 0);
+        errno_assert (rc >= 0);
+        nn_assert (rc == LARGE_MSG_SIZE);
+    }
+    for (i = 0; i != 20; ++i) {
+        rc = nn_recv (sb, &msg, NN_MSG, 0);
+        errno_assert (rc >= 0);
+        nn_assert (rc == LARGE_MSG_SIZE);
+        for (j = 0; j != LARGE_MSG_SIZE; j += 4096)
+            nn_assert (msg [j] == (char) (i + j / 4096));
+        rc = nn_freemsg (msg);
+        errno_assert (rc == 0);
+    }
+
+    rc = nn_close (sc);
+    errno_assert (rc == 0);
+    rc = nn_close (sb);
+    errno_assert (rc == 0);
+
+    /*  Test the connection preserving message boundaries. */
+    sb = nn_socket (AF_SP, NN_PAIR);
+    errno_assert (sb != -1);
+    val = 1;
+    rc = nn_setsockopt (sb, NN_IPC, NN_IPC_SEQPACKET, &val, sizeof (val));
+    errno_assert (rc == 0);
+    val = 0;
+    sz = sizeof (val);
+    rc = nn_getsockopt (sb, NN_IPC, NN_IPC_SEQPACKET, &val, &sz);
+    errno_assert (rc == 0);
+    nn_assert (sz == sizeof (val) && val == 1);
+    rc = nn_bind (sb, SEQPACKET_ADDRESS);
+    errno_assert (rc >= 0);
+    sc = nn_socket (AF_SP, NN_PAIR);
+    errno_assert (sc != -1);
+    val = 1;
+    rc = nn_setsockopt (sc, NN_IPC, NN_IPC_SEQPACKET, &val, sizeof (val));
+    errno_assert (rc == 0);
+    rc = nn_connect (sc, SEQPACKET_ADDRESS);
+    errno_assert (rc >= 0);
+
+    /*  Messages of all sizes, including empty ones and those that don't
+        fit into a single record, arrive intact. */
+    for (i = 0; i != 16; ++i) {
+        len = seqpacket_sizes [i % 8];
+        msg = nn_allocmsg (len, 0);
+        alloc_assert (msg);
+        for (j = 0; j != len; ++j)
+            msg [j] = (char) (i + j);
+        rc = nn_send (sc, &msg, NN_MSG, 0);
+        errno_assert (rc >= 0);
+        nn_assert (rc == (int) len);
+        rc = nn_recv (sb, &msg, NN_MSG, 0);
+        errno_assert (rc >= 0);
+        nn_assert (rc == (int) len);
+        for (j = 0; j != len; ++j)
+            nn_assert (msg [j] == (char) (i + j));
+        rc = nn_freemsg (msg);
+        errno_assert (rc == 0);
+    }
+
+    /*  Small messages are read in batches and arrive in order. */
+    for (i = 0; i != 100; ++i) {
+        buf [0] = (char) i;
+        rc = nn_send (sc, buf, 1 + i % 3, 0);
+        errno_assert (rc >= 0);
+        nn_assert (rc == 1 + i % 3);
+    }
+    for (i = 0; i != 100; ++i) {
+        rc = nn_recv (sb, buf, sizeof (buf), 0);
+        errno_assert (rc >= 0);
+        nn_assert (rc == 1 + i % 3 && buf [0] == (char) i);
+    }
+
+    /*  The other way round. */
+    rc = nn_send (sb, "ABC", 3, 0);
+    errno_assert (rc >= 0);
+    nn_assert (rc == 3);
+    rc = nn_recv (sc, buf, sizeof (buf), 0);
+    errno_assert (rc >= 0);
+    nn_assert (rc == 3 && memcmp (buf, "ABC", 3) == 0);
+
     rc = nn_close (sc);
     errno_assert (rc == 0);
     rc = nn_close (sb);
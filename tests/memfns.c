@@ -0,0 +1,101 @@
+/*
+    Copyright (c) 2013 250bpm s.r.o.
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"),
+    to deal in the Software without restriction, including without limitation
+    the rights to use, copy, modify, merge, publish, distribute, sublicense,
+    and/or sell copies of the Software, and to permit persons to whom
+    the Software is furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included
+    in all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+    THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+    FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+    IN THE SOFTWARE.
+*/
+
+#include "../src/nn.h"
+#include "../src/pair.h"
+
+#include "../src/utils/err.c"
+
+#include <stdlib.h>
+
+#define SOCKET_ADDRESS "inproc://a"
+
+static int allocs = 0;
+static int reallocs = 0;
+static int frees = 0;
+
+static void *test_alloc (size_t size)
+{
+    ++allocs;
+    return malloc (size);
+}
+
+static void *test_realloc (void *ptr, size_t size)
+{
+    ++reallocs;
+    return realloc (ptr, size);
+}
+
+static void test_free (void *ptr)
+{
+    ++frees;
+    free (ptr);
+}
+
+int main ()
+{
+    int rc;
+    int sb;
+    int sc;
+    char buf [3];
+    struct nn_memfns fns;
+
+    /*  Incomplete set of functions is rejected. */
+    fns.alloc = test_alloc;
+    fns.realloc = NULL;
+    fns.free = test_free;
+    rc = nn_setmemfns (&fns);
+    nn_assert (rc == -1 && nn_errno () == EINVAL);
+
+    fns.realloc = test_realloc;
+    rc = nn_setmemfns (&fns);
+    errno_assert (rc == 0);
+
+    /*  All the memory is allocated using the supplied functions. */
+    sb = nn_socket (AF_SP, NN_PAIR);
+    errno_assert (sb != -1);
+    rc = nn_bind (sb, SOCKET_ADDRESS);
+    errno_assert (rc >= 0);
+    sc = nn_socket (AF_SP, NN_PAIR);
+    errno_assert (sc != -1);
+    rc = nn_connect (sc, SOCKET_ADDRESS);
+    errno_assert (rc >= 0);
+    rc = nn_send (sc, "ABC", 3, 0);
+    errno_assert (rc == 3);
+    rc = nn_recv (sb, buf, sizeof (buf), 0);
+    errno_assert (rc == 3);
+    nn_assert (allocs > 0);
+
+    /*  Once the library has allocated memory, the functions can't be
+        replaced. */
+    rc = nn_setmemfns (&fns);
+    nn_assert (rc == -1 && nn_errno () == EBUSY);
+
+    rc = nn_close (sc);
+    errno_assert (rc == 0);
+    rc = nn_close (sb);
+    errno_assert (rc == 0);
+    nn_assert (frees > 0);
+
+    return 0;
+}
+
@@ -0,0 +1,123 @@
+/*
+    Copyright (c) 2013 250bpm s.r.o.
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"),
+    to deal in the Software without restriction, including without limitation
+    the rights to use, copy, modify, merge, publish, distribute, sublicense,
+    and/or sell copies of the Software, and to permit persons to whom
+    the Software is furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included
+    in all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+    THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+    FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+    IN THE SOFTWARE.
+*/
+
+#include "../src/nn.h"
+#include "../src/pair.h"
+
+#include "../src/utils/err.c"
+
+#include <string.h>
+
+#define SOCKET_ADDRESS "inproc://a"
+
+int main ()
+{
+    int rc;
+    int i;
+    int sb;
+    int sc;
+    int received;
+    struct nn_iovec iov [4];
+    struct nn_mmsghdr hdrs [4];
+    char *chunk;
+    char buf [4][4];
+
+    sb = nn_socket (AF_SP, NN_PAIR);
+    errno_assert (sb != -1);
+    rc = nn_bind (sb, SOCKET_ADDRESS);
+    errno_assert (rc >= 0);
+    sc = nn_socket (AF_SP, NN_PAIR);
+    errno_assert (sc != -1);
+    rc = nn_connect (sc, SOCKET_ADDRESS);
+    errno_assert (rc >= 0);
+
+    /*  Empty vector is a no-op. */
+    rc = nn_sendmmsg (sc, hdrs, 0, 0);
+    errno_assert (rc == 0);
+
+    /*  Send a batch of three messages, one of them allocated by nn_allocmsg. */
+    chunk = nn_allocmsg (3, 0);
+    alloc_assert (chunk);
+    memcpy (chunk, "DEF", 3);
+    iov [0].iov_base = "ABC";
+    iov [0].iov_len = 3;
+    iov [1].iov_base = &chunk;
+    iov [1].iov_len = NN_MSG;
+    iov [2].iov_base = "GHIJ";
+    iov [2].iov_len = 4;
+    memset (hdrs, 0, sizeof (hdrs));
+    for (i = 0; i != 3; ++i) {
+        hdrs [i].msg_hdr.msg_iov = &iov [i];
+        hdrs [i].msg_hdr.msg_iovlen = 1;
+    }
+    rc = nn_sendmmsg (sc, hdrs, 3, 0);
+    errno_assert (rc >= 0);
+    nn_assert (rc == 3);
+    nn_assert (hdrs [0].msg_len == 3);
+    nn_assert (hdrs [1].msg_len == 3);
+    nn_assert (hdrs [2].msg_len == 4);
+
+    /*  Receive them. The first call blocks until at least one message is
+        available; the rest may come in subsequent calls. */
+    received = 0;
+    while (received != 3) {
+        memset (hdrs, 0, sizeof (hdrs));
+        for (i = 0; i != 4; ++i) {
+            iov [i].iov_base = buf [received + i < 4 ? received + i : 3];
+            iov [i].iov_len = sizeof (buf [0]);
+            hdrs [i].msg_hdr.msg_iov = &iov [i];
+            hdrs [i].msg_hdr.msg_iovlen = 1;
+        }
+        rc = nn_recvmmsg (sb, hdrs, 4 - received, 0);
+        errno_assert (rc > 0);
+        nn_assert (received + rc <= 3);
+        for (i = 0; i != rc; ++i)
+            nn_assert (hdrs [i].msg_len == (received + i == 2 ? 4 : 3));
+        received += rc;
+    }
+    nn_assert (memcmp (buf [0], "ABC", 3) == 0);
+    nn_assert (memcmp (buf [1], "DEF", 3) == 0);
+    nn_assert (memcmp (buf [2], "GHIJ", 4) == 0);
+
+    /*  Nothing more to receive. */
+    rc = nn_recvmmsg (sb, hdrs, 4, NN_DONTWAIT);
+    errno_assert (rc == -1 && nn_errno () == EAGAIN);
+
+    /*  Malformed header is reported before any message is received. */
+    iov [0].iov_base = &chunk;
+    iov [0].iov_len = NN_MSG;
+    iov [1].iov_base = buf [0];
+    iov [1].iov_len = sizeof (buf [0]);
+    memset (hdrs, 0, sizeof (hdrs));
+    hdrs [0].msg_hdr.msg_iov = iov;
+    hdrs [0].msg_hdr.msg_iovlen = 2;
+    rc = nn_recvmmsg (sb, hdrs, 1, NN_DONTWAIT);
+    errno_assert (rc == -1 && nn_errno () == EINVAL);
+
+    rc = nn_close (sc);
+    errno_assert (rc == 0);
+    rc = nn_close (sb);
+    errno_assert (rc == 0);
+
+    return 0;
+}
+
@@ -25,10 +25,32 @@
 
 #include "../src/utils/err.c"
 
+#include <stdlib.h>
 #include <string.h>
 
 #define SOCKET_ADDRESS "inproc://a"
 
+static int allocated = 0;
+
+static void *test_alloc (size_t size)
+{
+    ++allocated;
+    return malloc (size);
+}
+
+static void test_free (void *ptr)
+{
+    --allocated;
+    free (ptr);
+}
+
+static void test_freefn (void *buf, void *arg)
+{
+    nn_assert (arg == &allocated);
+    --allocated;
+    free (buf);
+}
+
 int main ()
 {
     int rc;
@@ -38,6 +60,11 @@ int main ()
     int i;
     struct nn_iovec iov;
     struct nn_msghdr hdr;
+    struct nn_allocator allocator;
+    unsigned char *ext;
+    struct nn_alloc_stat stats [64];
+    struct nn_lock_stat lockstats [64];
+    int nstats;
 
     sb = nn_socket (AF_SP, NN_PAIR);
     errno_assert (sb != -1);
@@ -94,6 +121,106 @@ int main ()
     rc = nn_freemsg (buf2);
     errno_assert (rc == 0);
 
+    /*  Pooled messages of different sizes. Freed blocks are reused. */
+    for (i = 0; i != 100; ++i) {
+        buf1 = nn_allocmsg (i * 100 + 1, NN_ALLOC_POOL);
+        alloc_assert (buf1);
+        memset (buf1, 0xaa, i * 100 + 1);
+        rc = nn_send (sc, &buf1, NN_MSG, 0);
+        errno_assert (rc >= 0);
+        nn_assert (rc == i * 100 + 1);
+        buf2 = NULL;
+        rc = nn_recv (sb, &buf2, NN_MSG, 0);
+        errno_assert (rc >= 0);
+        nn_assert (rc == i * 100 + 1);
+        nn_assert (buf2 [i * 100] == 0xaa);
+        rc = nn_freemsg (buf2);
+        errno_assert (rc == 0);
+    }
+
+    /*  Invalid allocation type. */
+    buf1 = nn_allocmsg (256, 1000);
+    nn_assert (!buf1 && nn_errno () == EINVAL);
+    buf1 = nn_allocmsg (256, NN_ALLOC_USER);
+    nn_assert (!buf1 && nn_errno () == EINVAL);
+
+    /*  User-defined allocator. */
+    allocator.alloc = test_alloc;
+    allocator.free = test_free;
+    rc = nn_setallocator (NN_ALLOC_POOL, &allocator);
+    nn_assert (rc == -1 && nn_errno () == EINVAL);
+    rc = nn_setallocator (NN_ALLOC_USER, &allocator);
+    errno_assert (rc == 0);
+    buf1 = nn_allocmsg (256, NN_ALLOC_USER);
+    alloc_assert (buf1);
+    nn_assert (allocated == 1);
+    rc = nn_send (sc, &buf1, NN_MSG, 0);
+    errno_assert (rc == 256);
+    buf2 = NULL;
+    rc = nn_recv (sb, &buf2, NN_MSG, 0);
+    errno_assert (rc == 256);
+    rc = nn_freemsg (buf2);
+    errno_assert (rc == 0);
+    nn_assert (allocated == 0);
+    rc = nn_setallocator (NN_ALLOC_USER, NULL);
+    errno_assert (rc == 0);
+
+    /*  Using an existing buffer. The library doesn't write to it. */
+    ext = malloc (256);
+    alloc_assert (ext);
+    ++allocated;
+    for (i = 0; i != 256; ++i)
+        ext [i] = (unsigned char) i;
+    buf1 = nn_extmsg (ext, 256, test_freefn, &allocated);
+    alloc_assert (buf1);
+    rc = nn_send (sc, &buf1, NN_MSG, 0);
+    errno_assert (rc == 256);
+    buf2 = NULL;
+    rc = nn_recv (sb, &buf2, NN_MSG, 0);
+    errno_assert (rc == 256);
+    for (i = 0; i != 256; ++i)
+        nn_assert (buf2 [i] == (unsigned char) i);
+    rc = nn_freemsg (buf2);
+    errno_assert (rc == 0);
+    nn_assert (allocated == 0);
+    buf1 = nn_extmsg (NULL, 1, NULL, NULL);
+    nn_assert (!buf1 && nn_errno () == EFAULT);
+
+    /*  Memory held by the library is reported per subsystem, provided that
+        the allocation monitor is compiled in. */
+    buf1 = nn_allocmsg (100000, 0);
+    alloc_assert (buf1);
+    nstats = nn_allocstats (stats, 64);
+    if (nstats < 0)
+        nn_assert (nn_errno () == ENOTSUP);
+    else {
+        for (i = 0; i != nstats && i != 64; ++i)
+            if (strcmp (stats [i].name, "message chunk") == 0)
+                break;
+        nn_assert (i != nstats && i != 64);
+        nn_assert (stats [i].bytes >= 100000 && stats [i].blocks >= 1);
+    }
+    rc = nn_freemsg (buf1);
+    errno_assert (rc == 0);
+    rc = nn_allocstats (stats, -1);
+    nn_assert (rc == -1 && nn_errno () == EINVAL);
+
+    /*  So are the acquisitions of the locks, provided that the lock monitor
+        is compiled in. The sockets have been locked many times by now. */
+    nstats = nn_lockstats (lockstats, 64);
+    if (nstats < 0)
+        nn_assert (nn_errno () == ENOTSUP);
+    else {
+        nn_assert (nstats >= 1 && strcmp (lockstats [0].name, "other") == 0);
+        for (i = 0; i != nstats && i != 64; ++i)
+            if (lockstats [i].locks > 0)
+                break;
+        nn_assert (i != nstats && i != 64);
+        nn_assert (lockstats [i].contended <= lockstats [i].locks);
+    }
+    rc = nn_lockstats (lockstats, -1);
+    nn_assert (rc == -1 && nn_errno () == EINVAL);
+
     rc = nn_close (sc);
     errno_assert (rc == 0);
     rc = nn_close (sb);
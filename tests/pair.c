@@ -26,6 +26,7 @@
 #include "../src/utils/err.c"
 
 #define SOCKET_ADDRESS "inproc://a"
+#define SOCKET_ADDRESS_TCP "tcp://127.0.0.1:5574"
 
 int main ()
 {
@@ -33,6 +34,9 @@ int main ()
     int sb;
     int sc;
     char buf [3];
+    int val;
+    size_t sz;
+    int i;
 
     sb = nn_socket (AF_SP, NN_PAIR);
     errno_assert (sb != -1);
@@ -64,6 +68,51 @@ int main ()
     rc = nn_close (sb);
     errno_assert (rc == 0);
 
+    /*  Test busy-polling of the sockets used by a single thread. */
+    sb = nn_socket (AF_SP, NN_PAIR);
+    errno_assert (sb != -1);
+    val = 1;
+    rc = nn_setsockopt (sb, NN_SOL_SOCKET, NN_SINGLE_THREADED, &val,
+        sizeof (val));
+    errno_assert (rc == 0);
+    sz = sizeof (val);
+    rc = nn_getsockopt (sb, NN_SOL_SOCKET, NN_SINGLE_THREADED, &val, &sz);
+    errno_assert (rc == 0);
+    nn_assert (sz == sizeof (val) && val == 1);
+    rc = nn_bind (sb, SOCKET_ADDRESS_TCP);
+    errno_assert (rc >= 0);
+    sc = nn_socket (AF_SP, NN_PAIR);
+    errno_assert (sc != -1);
+    rc = nn_setsockopt (sc, NN_SOL_SOCKET, NN_SINGLE_THREADED, &val,
+        sizeof (val));
+    errno_assert (rc == 0);
+    rc = nn_send (sc, "ABC", 3, NN_DONTWAIT);
+    errno_assert (rc == -1 && nn_errno () == EAGAIN);
+    rc = nn_connect (sc, SOCKET_ADDRESS_TCP);
+    errno_assert (rc >= 0);
+
+    for (i = 0; i != 100; ++i) {
+        while (1) {
+            rc = nn_send (sc, "ABC", 3, NN_DONTWAIT);
+            if (rc == 3)
+                break;
+            errno_assert (rc == -1 && nn_errno () == EAGAIN);
+        }
+        while (1) {
+            rc = nn_recv (sb, buf, sizeof (buf), NN_DONTWAIT);
+            if (rc == 3)
+                break;
+            errno_assert (rc == -1 && nn_errno () == EAGAIN);
+        }
+    }
+    rc = nn_recv (sb, buf, sizeof (buf), NN_DONTWAIT);
+    errno_assert (rc == -1 && nn_errno () == EAGAIN);
+
+    rc = nn_close (sc);
+    errno_assert (rc == 0);
+    rc = nn_close (sb);
+    errno_assert (rc == 0);
+
     return 0;
 }
 
@@ -0,0 +1,137 @@
+/*
+    Copyright (c) 2012-2013 250bpm s.r.o.
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"),
+    to deal in the Software without restriction, including without limitation
+    the rights to use, copy, modify, merge, publish, distribute, sublicense,
+    and/or sell copies of the Software, and to permit persons to whom
+    the Software is furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included
+    in all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+    THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+    FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+    IN THE SOFTWARE.
+*/
+
+
+#include "../src/protocols/pubsub/patterns.c"
+#include "../src/protocols/pubsub/topics.c"
+#include "../src/utils/alloc.c"
+#include "../src/utils/mutex.c"
+#include "../src/utils/err.c"
+
+#include <stdio.h>
+#include <string.h>
+
+static int match (struct nn_patterns_dfa *dfa, const char *topic)
+{
+    size_t len;
+
+    return nn_patterns_match (dfa, (const uint8_t*) topic, strlen (topic),
+        &len);
+}
+
+int main ()
+{
+    int rc;
+    struct nn_patterns patterns;
+    struct nn_patterns_dfa *dfa;
+    size_t len;
+    int i;
+    char pattern [64];
+
+    /*  An empty set compiles to nothing. */
+    nn_patterns_init (&patterns, '.');
+    rc = nn_patterns_compile (&patterns, &dfa);
+    nn_assert (rc == 0 && dfa == NULL);
+    rc = nn_patterns_unsubscribe (&patterns, (const uint8_t*) "A", 1);
+    nn_assert (rc == -EINVAL);
+
+    /*  A wildcard matches a single segment. */
+    rc = nn_patterns_subscribe (&patterns, (const uint8_t*) "md.*.nq.", 8);
+    nn_assert (rc == 1);
+    rc = nn_patterns_compile (&patterns, &dfa);
+    nn_assert (rc == 0 && dfa != NULL);
+    nn_assert (match (dfa, "md.eq.nq.AAPL") == 1);
+    nn_assert (match (dfa, "md.fx.nq.") == 1);
+    nn_assert (match (dfa, "md..nq.") == 1);
+    nn_assert (match (dfa, "md.eq.ny.IBM") == 0);
+    nn_assert (match (dfa, "md.eq.x.nq.") == 0);
+    nn_assert (match (dfa, "md.eq.nq") == 0);
+    nn_assert (match (dfa, "xd.eq.nq.") == 0);
+    nn_assert (match (dfa, "") == 0);
+    rc = nn_patterns_match (dfa, (const uint8_t*) "md.eq.nq.AAPL", 13, &len);
+    nn_assert (rc == 1 && len == 9);
+    nn_patterns_free (dfa);
+
+    /*  Several patterns, overlapping each other. */
+    rc = nn_patterns_subscribe (&patterns, (const uint8_t*) "md.eq.*.X", 9);
+    nn_assert (rc == 1);
+    rc = nn_patterns_subscribe (&patterns, (const uint8_t*) "*.*.ny.", 7);
+    nn_assert (rc == 1);
+    rc = nn_patterns_subscribe (&patterns, (const uint8_t*) "ref", 3);
+    nn_assert (rc == 1);
+    rc = nn_patterns_subscribe (&patterns, (const uint8_t*) "ref", 3);
+    nn_assert (rc == 0);
+    rc = nn_patterns_compile (&patterns, &dfa);
+    nn_assert (rc == 0);
+    nn_assert (match (dfa, "md.eq.nq.AAPL") == 1);
+    nn_assert (match (dfa, "md.eq.ny.IBM") == 1);
+    nn_assert (match (dfa, "md.eq.ld.X") == 1);
+    nn_assert (match (dfa, "md.eq.ld.Y") == 0);
+    nn_assert (match (dfa, "ev.fx.ny.") == 1);
+    nn_assert (match (dfa, "ev.fx.ld.") == 0);
+    nn_assert (match (dfa, "reference") == 1);
+    nn_assert (match (dfa, "re") == 0);
+    nn_patterns_free (dfa);
+
+    /*  Removing the patterns. */
+    rc = nn_patterns_unsubscribe (&patterns, (const uint8_t*) "ref", 3);
+    nn_assert (rc == 0);
+    rc = nn_patterns_unsubscribe (&patterns, (const uint8_t*) "ref", 3);
+    nn_assert (rc == 1);
+    rc = nn_patterns_unsubscribe (&patterns, (const uint8_t*) "*.*.ny.", 7);
+    nn_assert (rc == 1);
+    rc = nn_patterns_compile (&patterns, &dfa);
+    nn_assert (rc == 0);
+    nn_assert (match (dfa, "reference") == 0);
+    nn_assert (match (dfa, "md.eq.ny.IBM") == 0);
+    nn_assert (match (dfa, "md.eq.ld.X") == 1);
+    nn_patterns_free (dfa);
+
+    /*  A different separator. */
+    nn_patterns_term (&patterns);
+    nn_patterns_init (&patterns, '/');
+    rc = nn_patterns_subscribe (&patterns, (const uint8_t*) "a/*/c", 5);
+    nn_assert (rc == 1);
+    rc = nn_patterns_compile (&patterns, &dfa);
+    nn_assert (rc == 0);
+    nn_assert (match (dfa, "a/b.x/c") == 1);
+    nn_assert (match (dfa, "a/b/x/c") == 0);
+    nn_patterns_free (dfa);
+
+    /*  Many patterns still take a single pass. */
+    for (i = 0; i != 1000; ++i) {
+        sprintf (pattern, "md/*/%d/", i);
+        rc = nn_patterns_subscribe (&patterns, (const uint8_t*) pattern,
+            strlen (pattern));
+        nn_assert (rc == 1);
+    }
+    rc = nn_patterns_compile (&patterns, &dfa);
+    nn_assert (rc == 0);
+    nn_assert (dfa->states < NN_PATTERNS_MAX_STATES);
+    nn_assert (match (dfa, "md/eq/999/") == 1);
+    nn_assert (match (dfa, "md/eq/1000/") == 0);
+    nn_assert (match (dfa, "md/eq/x/1/") == 0);
+    nn_patterns_free (dfa);
+    nn_patterns_term (&patterns);
+
+    return 0;
+}
@@ -32,6 +32,7 @@
 #include "../src/utils/win.h"
 #else
 #include <sys/select.h>
+#include <unistd.h>
 #endif
 
 /*  Test of polling via NN_SNDFD/NN_RCVFD mechanism. */
@@ -123,12 +124,29 @@ int getevents (int s, int events, int timeout)
     return revents;
 }
 
+int pollevents (int s, int events, int timeout)
+{
+    int rc;
+    struct nn_pollfd pfd;
+
+    pfd.fd = s;
+    pfd.events = (short) events;
+    rc = nn_poll (&pfd, 1, timeout);
+    errno_assert (rc >= 0);
+    nn_assert (rc == (pfd.revents ? 1 : 0));
+    return pfd.revents;
+}
+
 int main ()
 {
     int rc;
     int sb;
     char buf [3];
     struct nn_thread thread;
+    struct nn_pollfd pfd [2];
+#if !defined NN_HAVE_WINDOWS
+    int p [2];
+#endif
 
     /*  Create a simple topology. */
     sb = nn_socket (AF_SP, NN_PAIR);
@@ -140,6 +158,18 @@ int main ()
     rc = nn_connect (sc, SOCKET_ADDRESS);
     errno_assert (rc >= 0);
 
+    /*  Message that arrived before NN_RCVFD was retrieved is signaled
+        straight away. */
+    rc = nn_send (sc, "ABC", 3, 0);
+    errno_assert (rc >= 0);
+    nn_assert (rc == 3);
+    nn_sleep (100);
+    rc = getevents (sb, NN_IN, 0);
+    nn_assert (rc == NN_IN);
+    rc = nn_recv (sb, buf, sizeof (buf), 0);
+    errno_assert (rc >= 0);
+    nn_assert (rc == 3);
+
     /*  Check the initial state of the socket. */
     rc = getevents (sb, NN_IN | NN_OUT, 1000);
     nn_assert (rc == NN_OUT);
@@ -173,6 +203,84 @@ int main ()
     nn_assert (rc == 3);
     nn_thread_term (&thread);
 
+    /*  Do the same checks using nn_poll. */
+    rc = pollevents (sb, NN_POLLIN | NN_POLLOUT, 1000);
+    nn_assert (rc == NN_POLLOUT);
+    rc = pollevents (sb, NN_POLLIN, 10);
+    nn_assert (rc == 0);
+    rc = nn_send (sc, "ABC", 3, 0);
+    errno_assert (rc >= 0);
+    nn_assert (rc == 3);
+    rc = pollevents (sb, NN_POLLIN, 1000);
+    nn_assert (rc == NN_POLLIN);
+    rc = nn_recv (sb, buf, sizeof (buf), 0);
+    errno_assert (rc >= 0);
+    nn_assert (rc == 3);
+    rc = pollevents (sb, NN_POLLIN, 0);
+    nn_assert (rc == 0);
+    nn_thread_init (&thread, routine1, NULL);
+    rc = pollevents (sb, NN_POLLIN, 1000);
+    nn_assert (rc == NN_POLLIN);
+    rc = nn_recv (sb, buf, sizeof (buf), 0);
+    errno_assert (rc >= 0);
+    nn_assert (rc == 3);
+    nn_thread_term (&thread);
+
+    /*  Poll on both sockets at once. */
+    pfd [0].fd = sb;
+    pfd [0].events = NN_POLLIN;
+    pfd [1].fd = sc;
+    pfd [1].events = NN_POLLIN | NN_POLLOUT;
+    rc = nn_poll (pfd, 2, 1000);
+    errno_assert (rc >= 0);
+    nn_assert (rc == 1);
+    nn_assert (pfd [0].revents == 0 && pfd [1].revents == NN_POLLOUT);
+    pfd [1].events = NN_POLLIN;
+    rc = nn_poll (pfd, 2, 10);
+    errno_assert (rc >= 0);
+    nn_assert (rc == 0);
+
+#if !defined NN_HAVE_WINDOWS
+
+    /*  Poll on a socket and an OS-level file descriptor at once. */
+    rc = pipe (p);
+    errno_assert (rc == 0);
+    pfd [0].fd = sb;
+    pfd [0].events = NN_POLLIN;
+    pfd [1].fd = p [0];
+    pfd [1].events = NN_POLLIN | NN_POLLSYSFD;
+    rc = nn_poll (pfd, 2, 10);
+    errno_assert (rc >= 0);
+    nn_assert (rc == 0);
+    rc = write (p [1], "A", 1);
+    errno_assert (rc == 1);
+    rc = nn_poll (pfd, 2, 1000);
+    errno_assert (rc >= 0);
+    nn_assert (rc == 1);
+    nn_assert (pfd [0].revents == 0 && pfd [1].revents == NN_POLLIN);
+    rc = read (p [0], buf, 1);
+    errno_assert (rc == 1);
+    nn_thread_init (&thread, routine1, NULL);
+    rc = nn_poll (pfd, 2, 1000);
+    errno_assert (rc >= 0);
+    nn_assert (rc == 1);
+    nn_assert (pfd [0].revents == NN_POLLIN && pfd [1].revents == 0);
+    rc = nn_recv (sb, buf, sizeof (buf), 0);
+    errno_assert (rc >= 0);
+    nn_assert (rc == 3);
+    nn_thread_term (&thread);
+    close (p [0]);
+    close (p [1]);
+
+#endif
+
+    /*  Invalid arguments. */
+    pfd [0].fd = -1;
+    rc = nn_poll (pfd, 1, 0);
+    nn_assert (rc < 0 && nn_errno () == EBADF);
+    rc = nn_poll (pfd, -1, 0);
+    nn_assert (rc < 0 && nn_errno () == EINVAL);
+
     /*  Check terminating the library from a different thread. */
     nn_thread_init (&thread, routine2, NULL);
     rc = getevents (sb, NN_IN, 1000);
@@ -181,6 +289,19 @@ int main ()
     nn_assert (rc < 0 && nn_errno () == ETERM);
     nn_thread_term (&thread);
 
+    /*  Once the library is terminating, nn_poll reports the sockets
+        straight away. */
+    pfd [0].fd = sb;
+    pfd [0].events = NN_POLLIN;
+    pfd [1].fd = sc;
+    pfd [1].events = NN_POLLIN;
+    rc = nn_poll (pfd, 2, -1);
+    errno_assert (rc >= 0);
+    nn_assert (rc == 2);
+    nn_assert (pfd [0].revents == NN_POLLIN && pfd [1].revents == NN_POLLIN);
+    rc = nn_recv (sc, buf, sizeof (buf), 0);
+    nn_assert (rc < 0 && nn_errno () == ETERM);
+
     /*  Clean up. */
     rc = nn_close (sc);
     errno_assert (rc == 0);
@@ -0,0 +1,140 @@
+/*
+    Copyright (c) 2013 250bpm s.r.o.
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"),
+    to deal in the Software without restriction, including without limitation
+    the rights to use, copy, modify, merge, publish, distribute, sublicense,
+    and/or sell copies of the Software, and to permit persons to whom
+    the Software is furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included
+    in all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+    THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+    FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+    IN THE SOFTWARE.
+*/
+
+/*  The poll() backend is tested whichever backend the library is built with,
+    as it's the fallback on the systems having no better one. */
+#undef NN_USE_EPOLL
+#undef NN_USE_EPOLLET
+#undef NN_USE_URING
+#undef NN_USE_KQUEUE
+#undef NN_USE_PORT
+#undef NN_USE_POLL
+#define NN_USE_POLL
+
+#include "../src/utils/err.c"
+#include "../src/utils/alloc.c"
+#include "../src/utils/mutex.c"
+
+#if !defined NN_HAVE_WINDOWS
+#include "../src/aio/poller.c"
+
+#include <unistd.h>
+#endif
+
+#define TEST_FDS 8
+
+#if !defined NN_HAVE_WINDOWS
+
+static struct nn_poller poller;
+static struct nn_poller_hndl hndls [TEST_FDS];
+static int fds [TEST_FDS][2];
+
+/*  Checks that exactly the handles in 'live' report their fds readable. */
+static void check (const int *live)
+{
+    int rc;
+    int i;
+    int event;
+    int seen [TEST_FDS];
+    struct nn_poller_hndl *hndl;
+
+    for (i = 0; i != TEST_FDS; ++i)
+        seen [i] = 0;
+    rc = nn_poller_wait (&poller, 1000);
+    errnum_assert (rc == 0, -rc);
+    while (1) {
+        rc = nn_poller_event (&poller, &event, &hndl);
+        if (rc == -EAGAIN)
+            break;
+        errnum_assert (rc == 0, -rc);
+        nn_assert (event == NN_POLLER_IN);
+        i = (int) (hndl - hndls);
+        nn_assert (i >= 0 && i < TEST_FDS && live [i] && !seen [i]);
+        seen [i] = 1;
+    }
+    for (i = 0; i != TEST_FDS; ++i)
+        nn_assert (seen [i] == live [i]);
+}
+
+#endif
+
+int main ()
+{
+#if !defined NN_HAVE_WINDOWS
+    int rc;
+    int i;
+    int live [TEST_FDS];
+
+    nn_alloc_init ();
+    rc = nn_poller_init (&poller);
+    errnum_assert (rc == 0, -rc);
+    for (i = 0; i != TEST_FDS; ++i) {
+        rc = pipe (fds [i]);
+        errno_assert (rc == 0);
+        rc = (int) write (fds [i][1], "A", 1);
+        errno_assert (rc == 1);
+        nn_poller_add (&poller, fds [i][0], &hndls [i]);
+        nn_poller_set_in (&poller, &hndls [i]);
+        live [i] = 1;
+    }
+    check (live);
+
+    /*  The last element of the pollset is removed before the one preceding
+        it. The former ends up moved in place of the latter while it's still
+        on the list of removed elements. */
+    nn_poller_rm (&poller, &hndls [7]);
+    nn_poller_rm (&poller, &hndls [6]);
+    live [7] = live [6] = 0;
+    check (live);
+
+    /*  Removing elements from the middle of the pollset moves the last ones
+        in their place, whether they were removed as well or not. */
+    nn_poller_rm (&poller, &hndls [1]);
+    nn_poller_rm (&poller, &hndls [5]);
+    nn_poller_rm (&poller, &hndls [3]);
+    live [1] = live [5] = live [3] = 0;
+    check (live);
+
+    /*  Removed elements are reused. */
+    nn_poller_add (&poller, fds [6][0], &hndls [6]);
+    nn_poller_set_in (&poller, &hndls [6]);
+    live [6] = 1;
+    check (live);
+    nn_poller_rm (&poller, &hndls [0]);
+    nn_poller_rm (&poller, &hndls [2]);
+    nn_poller_rm (&poller, &hndls [4]);
+    nn_poller_rm (&poller, &hndls [6]);
+    live [0] = live [2] = live [4] = live [6] = 0;
+    rc = nn_poller_wait (&poller, 0);
+    errnum_assert (rc == 0, -rc);
+    nn_assert (poller.size == 0);
+
+    nn_poller_term (&poller);
+    for (i = 0; i != TEST_FDS; ++i) {
+        close (fds [i][0]);
+        close (fds [i][1]);
+    }
+    nn_alloc_term ();
+#endif
+
+    return 0;
+}
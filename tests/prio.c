@@ -22,11 +22,17 @@
 
 #include "../src/nn.h"
 #include "../src/fanout.h"
+#include "../src/fanin.h"
 
 #include "../src/utils/err.c"
+#include "../src/utils/sleep.c"
 
 #define SOCKET_ADDRESS_A "inproc://a"
 #define SOCKET_ADDRESS_B "inproc://b"
+#define SOCKET_ADDRESS_C "inproc://c"
+#define SOCKET_ADDRESS_D "inproc://d"
+#define SOCKET_ADDRESS_TCP_A "tcp://127.0.0.1:5564"
+#define SOCKET_ADDRESS_TCP_B "tcp://127.0.0.1:5565"
 
 int main ()
 {
@@ -35,6 +41,12 @@ int main ()
     int pull1;
     int pull2;
     int sndprio;
+    int sndweight;
+    int rcvprio;
+    int sink;
+    int source1;
+    int source2;
+    int i;
     char buf [3];
 
     pull1 = nn_socket (AF_SP, NN_PULL);
@@ -69,13 +81,154 @@ int main ()
     rc = nn_recv (pull1, buf, sizeof (buf), 0);
     errno_assert (rc == 3);
 
+    rc = nn_close (push);
+    errno_assert (rc == 0);
+    rc = nn_close (pull1);
+    errno_assert (rc == 0);
+    rc = nn_close (pull2);
+    errno_assert (rc == 0);
+
+    /*  Once the peer with higher priority goes away, the messages go to
+        the one with lower priority. */
+    pull1 = nn_socket (AF_SP, NN_PULL);
+    errno_assert (pull1 != -1);
+    rc = nn_bind (pull1, SOCKET_ADDRESS_TCP_A);
+    errno_assert (rc >= 0);
+    pull2 = nn_socket (AF_SP, NN_PULL);
+    errno_assert (pull2 != -1);
+    rc = nn_bind (pull2, SOCKET_ADDRESS_TCP_B);
+    errno_assert (rc >= 0);
+    push = nn_socket (AF_SP, NN_PUSH);
+    errno_assert (push != -1);
+    sndprio = 1;
+    rc = nn_setsockopt (push, NN_SOL_SOCKET, NN_SNDPRIO,
+        &sndprio, sizeof (sndprio));
+    errno_assert (rc == 0);
+    rc = nn_connect (push, SOCKET_ADDRESS_TCP_A);
+    errno_assert (rc >= 0);
+    sndprio = 2;
+    rc = nn_setsockopt (push, NN_SOL_SOCKET, NN_SNDPRIO,
+        &sndprio, sizeof (sndprio));
+    errno_assert (rc == 0);
+    rc = nn_connect (push, SOCKET_ADDRESS_TCP_B);
+    errno_assert (rc >= 0);
+    nn_sleep (100);
+
+    rc = nn_send (push, "ABC", 3, 0);
+    errno_assert (rc == 3);
+    rc = nn_recv (pull1, buf, sizeof (buf), 0);
+    errno_assert (rc == 3);
     rc = nn_close (pull1);
     errno_assert (rc == 0);
+    nn_sleep (100);
+    for (i = 0; i != 3; ++i) {
+        rc = nn_send (push, "DEF", 3, 0);
+        errno_assert (rc == 3);
+        rc = nn_recv (pull2, buf, sizeof (buf), 0);
+        errno_assert (rc == 3);
+    }
+
     rc = nn_close (push);
     errno_assert (rc == 0);
     rc = nn_close (pull2);
     errno_assert (rc == 0);
 
+    /*  Test weighted distribution among peers of the same priority. */
+    pull1 = nn_socket (AF_SP, NN_PULL);
+    errno_assert (pull1 != -1);
+    rc = nn_bind (pull1, SOCKET_ADDRESS_C);
+    errno_assert (rc >= 0);
+    pull2 = nn_socket (AF_SP, NN_PULL);
+    errno_assert (pull2 != -1);
+    rc = nn_bind (pull2, SOCKET_ADDRESS_D);
+    errno_assert (rc >= 0);
+    push = nn_socket (AF_SP, NN_PUSH);
+    errno_assert (push != -1);
+    sndweight = 0;
+    rc = nn_setsockopt (push, NN_SOL_SOCKET, NN_SNDWEIGHT,
+        &sndweight, sizeof (sndweight));
+    nn_assert (rc == -1 && nn_errno () == EINVAL);
+    rc = nn_connect (push, SOCKET_ADDRESS_C);
+    errno_assert (rc >= 0);
+    sndweight = 3;
+    rc = nn_setsockopt (push, NN_SOL_SOCKET, NN_SNDWEIGHT,
+        &sndweight, sizeof (sndweight));
+    errno_assert (rc == 0);
+    rc = nn_connect (push, SOCKET_ADDRESS_D);
+    errno_assert (rc >= 0);
+    nn_sleep (10);
+
+    for (i = 0; i != 8; ++i) {
+        rc = nn_send (push, "ABC", 3, 0);
+        errno_assert (rc == 3);
+    }
+    nn_sleep (10);
+    for (i = 0; i != 2; ++i) {
+        rc = nn_recv (pull1, buf, sizeof (buf), NN_DONTWAIT);
+        errno_assert (rc == 3);
+    }
+    rc = nn_recv (pull1, buf, sizeof (buf), NN_DONTWAIT);
+    nn_assert (rc == -1 && nn_errno () == EAGAIN);
+    for (i = 0; i != 6; ++i) {
+        rc = nn_recv (pull2, buf, sizeof (buf), NN_DONTWAIT);
+        errno_assert (rc == 3);
+    }
+    rc = nn_recv (pull2, buf, sizeof (buf), NN_DONTWAIT);
+    nn_assert (rc == -1 && nn_errno () == EAGAIN);
+
+    rc = nn_close (push);
+    errno_assert (rc == 0);
+    rc = nn_close (pull1);
+    errno_assert (rc == 0);
+    rc = nn_close (pull2);
+    errno_assert (rc == 0);
+
+    /*  Test receive priorities. Messages from the endpoint with higher
+        priority are received first. */
+    sink = nn_socket (AF_SP, NN_SINK);
+    errno_assert (sink != -1);
+    rcvprio = 2;
+    rc = nn_setsockopt (sink, NN_SOL_SOCKET, NN_RCVPRIO,
+        &rcvprio, sizeof (rcvprio));
+    errno_assert (rc == 0);
+    rc = nn_bind (sink, SOCKET_ADDRESS_A);
+    errno_assert (rc >= 0);
+    rcvprio = 1;
+    rc = nn_setsockopt (sink, NN_SOL_SOCKET, NN_RCVPRIO,
+        &rcvprio, sizeof (rcvprio));
+    errno_assert (rc == 0);
+    rc = nn_bind (sink, SOCKET_ADDRESS_B);
+    errno_assert (rc >= 0);
+    source1 = nn_socket (AF_SP, NN_SOURCE);
+    errno_assert (source1 != -1);
+    rc = nn_connect (source1, SOCKET_ADDRESS_A);
+    errno_assert (rc >= 0);
+    source2 = nn_socket (AF_SP, NN_SOURCE);
+    errno_assert (source2 != -1);
+    rc = nn_connect (source2, SOCKET_ADDRESS_B);
+    errno_assert (rc >= 0);
+    nn_sleep (10);
+
+    for (i = 0; i != 2; ++i) {
+        rc = nn_send (source1, "A", 1, 0);
+        errno_assert (rc == 1);
+        rc = nn_send (source2, "B", 1, 0);
+        errno_assert (rc == 1);
+    }
+    nn_sleep (10);
+    for (i = 0; i != 4; ++i) {
+        rc = nn_recv (sink, buf, sizeof (buf), NN_DONTWAIT);
+        errno_assert (rc == 1);
+        nn_assert (buf [0] == (i < 2 ? 'B' : 'A'));
+    }
+
+    rc = nn_close (source2);
+    errno_assert (rc == 0);
+    rc = nn_close (source1);
+    errno_assert (rc == 0);
+    rc = nn_close (sink);
+    errno_assert (rc == 0);
+
     return 0;
 }
 
@@ -0,0 +1,140 @@
+/*
+    Copyright (c) 2013 250bpm s.r.o.
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"),
+    to deal in the Software without restriction, including without limitation
+    the rights to use, copy, modify, merge, publish, distribute, sublicense,
+    and/or sell copies of the Software, and to permit persons to whom
+    the Software is furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included
+    in all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+    THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+    FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+    IN THE SOFTWARE.
+*/
+
+#include "../src/nn.h"
+#include "../src/pair.h"
+#include "../src/tcp.h"
+#include "../src/utils/err.c"
+
+#include <stdlib.h>
+
+#if !defined NN_HAVE_WINDOWS
+#include <poll.h>
+#endif
+
+/*  Test of driving the I/O from the user's thread via nn_process. */
+
+#define SOCKET_ADDRESS "tcp://127.0.0.1:5561"
+
+/*  Waits for the I/O events and processes them. */
+void process (int fd, int timeout)
+{
+    int rc;
+#if !defined NN_HAVE_WINDOWS
+    struct pollfd pfd;
+
+    if (fd >= 0) {
+        pfd.fd = fd;
+        pfd.events = POLLIN;
+        rc = poll (&pfd, 1, timeout);
+        errno_assert (rc >= 0);
+        timeout = 0;
+    }
+#endif
+    rc = nn_process (timeout);
+    errno_assert (rc >= 0);
+}
+
+int main ()
+{
+    int rc;
+    int fd;
+    int sb;
+    int sc;
+    int timeo;
+    int i;
+    char buf [3];
+
+    putenv ("NN_CP_EXTERNAL=1");
+
+    /*  The library is not initialised yet. */
+    rc = nn_process (0);
+    nn_assert (rc < 0 && nn_errno () == ENOTSUP);
+
+    sb = nn_socket (AF_SP, NN_PAIR);
+    errno_assert (sb != -1);
+    rc = nn_bind (sb, SOCKET_ADDRESS);
+    errno_assert (rc >= 0);
+    sc = nn_socket (AF_SP, NN_PAIR);
+    errno_assert (sc != -1);
+    rc = nn_connect (sc, SOCKET_ADDRESS);
+    errno_assert (rc >= 0);
+
+    /*  Some platforms have no single descriptor to poll on. nn_process
+        has to be called with a timeout there. */
+    fd = nn_processfd ();
+    if (fd < 0) {
+        nn_assert (nn_errno () == ENOTSUP);
+#if defined NN_HAVE_WINDOWS
+        /*  The library falls back to its own I/O threads. */
+        return 0;
+#endif
+    }
+
+    /*  Nothing happens unless the I/O is processed by this thread. */
+    while (1) {
+        rc = nn_send (sc, "ABC", 3, NN_DONTWAIT);
+        if (rc >= 0)
+            break;
+        errno_assert (nn_errno () == EAGAIN);
+        process (fd, 100);
+    }
+    nn_assert (rc == 3);
+    while (1) {
+        rc = nn_recv (sb, buf, sizeof (buf), NN_DONTWAIT);
+        if (rc >= 0)
+            break;
+        errno_assert (nn_errno () == EAGAIN);
+        process (fd, 100);
+    }
+    nn_assert (rc == 3);
+
+    /*  Blocking calls process the I/O themselves. */
+    for (i = 0; i != 100; ++i) {
+        rc = nn_send (sb, "DEF", 3, 0);
+        errno_assert (rc >= 0);
+        nn_assert (rc == 3);
+        rc = nn_recv (sc, buf, sizeof (buf), 0);
+        errno_assert (rc >= 0);
+        nn_assert (rc == 3);
+    }
+
+    /*  Timeouts work as well. */
+    timeo = 50;
+    rc = nn_setsockopt (sb, NN_SOL_SOCKET, NN_RCVTIMEO, &timeo, sizeof (timeo));
+    errno_assert (rc == 0);
+    rc = nn_recv (sb, buf, sizeof (buf), 0);
+    nn_assert (rc < 0 && nn_errno () == EAGAIN);
+
+    /*  Closing the sockets doesn't need anyone else to process the I/O. */
+    rc = nn_close (sc);
+    errno_assert (rc == 0);
+    rc = nn_close (sb);
+    errno_assert (rc == 0);
+
+    /*  The library is terminated now. */
+    rc = nn_process (0);
+    nn_assert (rc < 0 && nn_errno () == ENOTSUP);
+
+    return 0;
+}
+
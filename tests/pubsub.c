@@ -25,16 +25,83 @@
 
 #include "../src/utils/err.c"
 #include "../src/utils/sleep.c"
+#include "../src/utils/thread.c"
+
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#if !defined NN_HAVE_WINDOWS
+#include <unistd.h>
+#endif
 
 #define SOCKET_ADDRESS "inproc://a"
+#define SOCKET_ADDRESS_TCP "tcp://127.0.0.1:5562"
+#define SOCKET_ADDRESS_JOURNAL "inproc://j"
+#define SOCKET_ADDRESS_BULK "inproc://k"
+#define SOCKET_ADDRESS_CHURN "inproc://l"
+#define SOCKET_ADDRESS_PATTERN "inproc://m"
+#define SOCKET_ADDRESS_SHARDS "inproc://n"
+#define JOURNAL_FILE "pubsub.journal"
+
+static int churn_sub;
+
+static void churn (void *arg)
+{
+    int rc;
+    int i;
+
+    /*  Keep changing the subscriptions while the other thread receives. */
+    for (i = 0; i != 1000; ++i) {
+        rc = nn_setsockopt (churn_sub, NN_SUB, NN_SUB_SUBSCRIBE, "XY", 2);
+        errno_assert (rc == 0);
+        rc = nn_setsockopt (churn_sub, NN_SUB, NN_SUB_UNSUBSCRIBE, "XY", 2);
+        errno_assert (rc == 0);
+    }
+}
+
+static int shard_sub;
+static int shard_ctx;
+
+static void shard_recv (void *arg)
+{
+    int rc;
+    char buf [8];
+
+    /*  Blocks until a message for the shard arrives. */
+    rc = nn_ctx_recv (shard_sub, shard_ctx, buf, sizeof (buf), 0);
+    errno_assert (rc == 4);
+    nn_assert (memcmp (buf, arg, 2) == 0);
+}
 
 int main ()
 {
     int rc;
     int pub;
     int sub1;
+    struct nn_thread thread;
     int sub2;
+    int i;
     char buf [3];
+    int delimiter;
+    int val;
+    char last;
+    int eid;
+    size_t sz;
+    struct nn_pub_pipe_stats stats [2];
+    int k;
+    uint64_t seq;
+    char msg [16];
+    int ctxs [4];
+    int owner [10];
+    int latest [10];
+    int shard;
+    int received;
+    char expected [16];
+    char *big;
+    struct nn_sock_stats sockstats;
+    uint8_t bulk [32];
+    struct nn_sub_trie_stats triestats;
 
     pub = nn_socket (AF_SP, NN_PUB);
     errno_assert (pub != -1);
@@ -74,6 +141,696 @@ int main ()
     rc = nn_close (sub2);
     errno_assert (rc == 0);
 
+    delimiter = '|';
+
+    /*  Subscriptions are forwarded to the publisher, including the ones
+        made after the connection was established. */
+    pub = nn_socket (AF_SP, NN_PUB);
+    errno_assert (pub != -1);
+    rc = nn_bind (pub, SOCKET_ADDRESS_TCP);
+    errno_assert (rc >= 0);
+    sub1 = nn_socket (AF_SP, NN_SUB);
+    errno_assert (sub1 != -1);
+    rc = nn_setsockopt (sub1, NN_SUB, NN_SUB_SUBSCRIBE, "A", 1);
+    errno_assert (rc == 0);
+    rc = nn_connect (sub1, SOCKET_ADDRESS_TCP);
+    errno_assert (rc >= 0);
+    sub2 = nn_socket (AF_SP, NN_SUB);
+    errno_assert (sub2 != -1);
+    rc = nn_connect (sub2, SOCKET_ADDRESS_TCP);
+    errno_assert (rc >= 0);
+    nn_sleep (10);
+    rc = nn_setsockopt (sub2, NN_SUB, NN_SUB_SUBSCRIBE, "B", 1);
+    errno_assert (rc == 0);
+    rc = nn_setsockopt (sub2, NN_SUB, NN_SUB_SUBSCRIBE, "C", 1);
+    errno_assert (rc == 0);
+    rc = nn_setsockopt (sub2, NN_SUB, NN_SUB_UNSUBSCRIBE, "C", 1);
+    errno_assert (rc == 0);
+    nn_sleep (10);
+
+    for (i = 0; i != 100; ++i) {
+        rc = nn_send (pub, "CCC", 3, 0);
+        errno_assert (rc >= 0);
+        rc = nn_send (pub, "AAA", 3, 0);
+        errno_assert (rc >= 0);
+        rc = nn_send (pub, "BBB", 3, 0);
+        errno_assert (rc >= 0);
+    }
+    for (i = 0; i != 100; ++i) {
+        rc = nn_recv (sub1, buf, sizeof (buf), 0);
+        errno_assert (rc >= 0);
+        nn_assert (rc == 3 && buf [0] == 'A');
+        rc = nn_recv (sub2, buf, sizeof (buf), 0);
+        errno_assert (rc >= 0);
+        nn_assert (rc == 3 && buf [0] == 'B');
+    }
+
+    /*  Exact subscriptions match the topic preceding the delimiter, but
+        not the topics that merely start with the subscribed string. */
+    rc = nn_setsockopt (sub1, NN_SUB, NN_SUB_TOPIC_DELIMITER, &delimiter,
+        sizeof (delimiter));
+    errno_assert (rc == 0);
+    rc = nn_setsockopt (sub1, NN_SUB, NN_SUB_EXACT_SUBSCRIBE, "B", 1);
+    errno_assert (rc == 0);
+    nn_sleep (10);
+    rc = nn_send (pub, "BB|", 3, 0);
+    errno_assert (rc >= 0);
+    rc = nn_send (pub, "B|B", 3, 0);
+    errno_assert (rc >= 0);
+    rc = nn_recv (sub1, buf, sizeof (buf), 0);
+    errno_assert (rc >= 0);
+    nn_assert (rc == 3 && buf [0] == 'B' && buf [1] == '|');
+    rc = nn_recv (sub2, buf, sizeof (buf), 0);
+    errno_assert (rc >= 0);
+    nn_assert (rc == 3 && buf [1] == 'B');
+    rc = nn_recv (sub2, buf, sizeof (buf), 0);
+    errno_assert (rc >= 0);
+    nn_assert (rc == 3 && buf [1] == '|');
+
+    rc = nn_close (pub);
+    errno_assert (rc == 0);
+    rc = nn_close (sub1);
+    errno_assert (rc == 0);
+    rc = nn_close (sub2);
+    errno_assert (rc == 0);
+
+    /*  Conflating subscriber gets only the latest message for each topic
+        among the messages waiting to be received. */
+    pub = nn_socket (AF_SP, NN_PUB);
+    errno_assert (pub != -1);
+    rc = nn_bind (pub, SOCKET_ADDRESS);
+    errno_assert (rc >= 0);
+    sub1 = nn_socket (AF_SP, NN_SUB);
+    errno_assert (sub1 != -1);
+    rc = nn_setsockopt (sub1, NN_SUB, NN_SUB_SUBSCRIBE, "", 0);
+    errno_assert (rc == 0);
+    rc = nn_setsockopt (sub1, NN_SUB, NN_SUB_TOPIC_DELIMITER, &delimiter,
+        sizeof (delimiter));
+    errno_assert (rc == 0);
+    val = 1;
+    rc = nn_setsockopt (sub1, NN_SUB, NN_SUB_CONFLATE, &val, sizeof (val));
+    errno_assert (rc == 0);
+    rc = nn_connect (sub1, SOCKET_ADDRESS);
+    errno_assert (rc >= 0);
+    nn_sleep (10);
+    rc = nn_send (pub, "A|1", 3, 0);
+    errno_assert (rc >= 0);
+    rc = nn_send (pub, "B|1", 3, 0);
+    errno_assert (rc >= 0);
+    rc = nn_send (pub, "A|2", 3, 0);
+    errno_assert (rc >= 0);
+    nn_sleep (10);
+    rc = nn_recv (sub1, buf, sizeof (buf), 0);
+    errno_assert (rc >= 0);
+    nn_assert (rc == 3 && memcmp (buf, "A|2", 3) == 0);
+    rc = nn_recv (sub1, buf, sizeof (buf), 0);
+    errno_assert (rc >= 0);
+    nn_assert (rc == 3 && memcmp (buf, "B|1", 3) == 0);
+    rc = nn_recv (sub1, buf, sizeof (buf), NN_DONTWAIT);
+    nn_assert (rc < 0 && nn_errno () == EAGAIN);
+    rc = nn_close (pub);
+    errno_assert (rc == 0);
+    rc = nn_close (sub1);
+    errno_assert (rc == 0);
+
+    /*  Conflating publisher keeps the latest message for each topic while
+        the subscriber is not ready to receive and sends them afterwards. */
+    pub = nn_socket (AF_SP, NN_PUB);
+    errno_assert (pub != -1);
+    val = 1;
+    rc = nn_setsockopt (pub, NN_PUB, NN_PUB_CONFLATE, &val, sizeof (val));
+    errno_assert (rc == 0);
+    rc = nn_setsockopt (pub, NN_PUB, NN_PUB_TOPIC_DELIMITER, &delimiter,
+        sizeof (delimiter));
+    errno_assert (rc == 0);
+    rc = nn_setsockopt (pub, NN_SOL_SOCKET, NN_SNDBUF, &val, sizeof (val));
+    errno_assert (rc == 0);
+    rc = nn_bind (pub, SOCKET_ADDRESS);
+    errno_assert (rc >= 0);
+    sub1 = nn_socket (AF_SP, NN_SUB);
+    errno_assert (sub1 != -1);
+    rc = nn_setsockopt (sub1, NN_SUB, NN_SUB_SUBSCRIBE, "", 0);
+    errno_assert (rc == 0);
+    rc = nn_setsockopt (sub1, NN_SOL_SOCKET, NN_RCVBUF, &val, sizeof (val));
+    errno_assert (rc == 0);
+    rc = nn_connect (sub1, SOCKET_ADDRESS);
+    errno_assert (rc >= 0);
+    nn_sleep (10);
+    for (i = 0; i != 10; ++i) {
+        memcpy (buf, "A|0", 3);
+        buf [2] += i;
+        rc = nn_send (pub, buf, 3, 0);
+        errno_assert (rc >= 0);
+    }
+    rc = nn_send (pub, "B|1", 3, 0);
+    errno_assert (rc >= 0);
+    nn_sleep (10);
+    last = '0' - 1;
+    for (i = 0; i != 11; ++i) {
+        rc = nn_recv (sub1, buf, sizeof (buf), NN_DONTWAIT);
+        if (rc < 0) {
+            errno_assert (nn_errno () == EAGAIN);
+            break;
+        }
+        nn_assert (rc == 3);
+        if (buf [0] == 'B') {
+            nn_assert (memcmp (buf, "B|1", 3) == 0);
+            continue;
+        }
+        nn_assert (buf [0] == 'A' && buf [2] > last);
+        last = buf [2];
+    }
+    nn_assert (i < 11 && last == '9');
+
+    rc = nn_close (pub);
+    errno_assert (rc == 0);
+    rc = nn_close (sub1);
+    errno_assert (rc == 0);
+
+    /*  Subscriber that joins late gets the latest message for each topic it
+        subscribes to from the publisher's cache. */
+    pub = nn_socket (AF_SP, NN_PUB);
+    errno_assert (pub != -1);
+    val = 1;
+    rc = nn_setsockopt (pub, NN_PUB, NN_PUB_LAST_VALUE_CACHE, &val,
+        sizeof (val));
+    errno_assert (rc == 0);
+    rc = nn_setsockopt (pub, NN_PUB, NN_PUB_TOPIC_DELIMITER, &delimiter,
+        sizeof (delimiter));
+    errno_assert (rc == 0);
+    rc = nn_bind (pub, SOCKET_ADDRESS);
+    errno_assert (rc >= 0);
+    rc = nn_send (pub, "A|1", 3, 0);
+    errno_assert (rc >= 0);
+    rc = nn_send (pub, "B|1", 3, 0);
+    errno_assert (rc >= 0);
+    rc = nn_send (pub, "A|2", 3, 0);
+    errno_assert (rc >= 0);
+    rc = nn_send (pub, "C|1", 3, 0);
+    errno_assert (rc >= 0);
+    sub1 = nn_socket (AF_SP, NN_SUB);
+    errno_assert (sub1 != -1);
+    rc = nn_setsockopt (sub1, NN_SUB, NN_SUB_SUBSCRIBE, "A", 1);
+    errno_assert (rc == 0);
+    rc = nn_setsockopt (sub1, NN_SUB, NN_SUB_SUBSCRIBE, "B", 1);
+    errno_assert (rc == 0);
+    rc = nn_connect (sub1, SOCKET_ADDRESS);
+    errno_assert (rc >= 0);
+    rc = nn_recv (sub1, buf, sizeof (buf), 0);
+    errno_assert (rc >= 0);
+    nn_assert (rc == 3 && memcmp (buf, "A|2", 3) == 0);
+    rc = nn_recv (sub1, buf, sizeof (buf), 0);
+    errno_assert (rc >= 0);
+    nn_assert (rc == 3 && memcmp (buf, "B|1", 3) == 0);
+    rc = nn_setsockopt (sub1, NN_SUB, NN_SUB_SUBSCRIBE, "C", 1);
+    errno_assert (rc == 0);
+    rc = nn_recv (sub1, buf, sizeof (buf), 0);
+    errno_assert (rc >= 0);
+    nn_assert (rc == 3 && memcmp (buf, "C|1", 3) == 0);
+
+    /*  Messages the subscriber has already got are not replayed again. */
+    rc = nn_setsockopt (sub1, NN_SUB, NN_SUB_SUBSCRIBE, "A|", 2);
+    errno_assert (rc == 0);
+    nn_sleep (10);
+    rc = nn_recv (sub1, buf, sizeof (buf), NN_DONTWAIT);
+    nn_assert (rc < 0 && nn_errno () == EAGAIN);
+    rc = nn_send (pub, "A|3", 3, 0);
+    errno_assert (rc >= 0);
+    rc = nn_recv (sub1, buf, sizeof (buf), 0);
+    errno_assert (rc >= 0);
+    nn_assert (rc == 3 && memcmp (buf, "A|3", 3) == 0);
+
+    rc = nn_close (pub);
+    errno_assert (rc == 0);
+    rc = nn_close (sub1);
+    errno_assert (rc == 0);
+
+    /*  Test per-subscriber statistics. The subscriber doesn't receive, so
+        most of the messages are dropped. */
+    pub = nn_socket (AF_SP, NN_PUB);
+    errno_assert (pub != -1);
+    val = 1;
+    rc = nn_setsockopt (pub, NN_SOL_SOCKET, NN_SNDBUF, &val, sizeof (val));
+    errno_assert (rc == 0);
+    eid = nn_bind (pub, SOCKET_ADDRESS);
+    errno_assert (eid >= 0);
+    sub1 = nn_socket (AF_SP, NN_SUB);
+    errno_assert (sub1 != -1);
+    rc = nn_setsockopt (sub1, NN_SOL_SOCKET, NN_RCVBUF, &val, sizeof (val));
+    errno_assert (rc == 0);
+    rc = nn_setsockopt (sub1, NN_SUB, NN_SUB_SUBSCRIBE, "", 0);
+    errno_assert (rc == 0);
+    rc = nn_connect (sub1, SOCKET_ADDRESS);
+    errno_assert (rc >= 0);
+    nn_sleep (10);
+
+    for (i = 0; i != 100; ++i) {
+        rc = nn_send (pub, "ABC", 3, 0);
+        errno_assert (rc >= 0);
+    }
+    sz = 0;
+    rc = nn_getsockopt (pub, NN_PUB, NN_PUB_PIPE_STATS, stats, &sz);
+    errno_assert (rc == 0);
+    nn_assert (sz == sizeof (stats [0]));
+    sz = sizeof (stats);
+    rc = nn_getsockopt (pub, NN_PUB, NN_PUB_PIPE_STATS, stats, &sz);
+    errno_assert (rc == 0);
+    nn_assert (sz == sizeof (stats [0]));
+    nn_assert (stats [0].eid == eid);
+    nn_assert (stats [0].sent + stats [0].dropped == 100);
+    nn_assert (stats [0].sent > 0 && stats [0].dropped > 0);
+    nn_assert (stats [0].sentbytes == stats [0].sent * 3);
+    nn_assert (stats [0].droppedbytes == stats [0].dropped * 3);
+    nn_assert (stats [0].queued == 0 && stats [0].queuedbytes == 0);
+
+    /*  In the conflating mode, the message replaced by a newer one is
+        dropped. The newer one is queued. */
+    val = 1;
+    rc = nn_setsockopt (pub, NN_PUB, NN_PUB_CONFLATE, &val, sizeof (val));
+    errno_assert (rc == 0);
+    rc = nn_setsockopt (pub, NN_PUB, NN_PUB_TOPIC_DELIMITER, &delimiter,
+        sizeof (delimiter));
+    errno_assert (rc == 0);
+    rc = nn_send (pub, "A|1", 3, 0);
+    errno_assert (rc >= 0);
+    rc = nn_send (pub, "A|22", 4, 0);
+    errno_assert (rc >= 0);
+    rc = nn_send (pub, "A|333", 5, 0);
+    errno_assert (rc >= 0);
+    sz = sizeof (stats);
+    rc = nn_getsockopt (pub, NN_PUB, NN_PUB_PIPE_STATS, stats, &sz);
+    errno_assert (rc == 0);
+    nn_assert (stats [0].sent + stats [0].dropped == 102);
+    nn_assert (stats [0].queued == 1 && stats [0].queuedbytes == 5);
+
+    rc = nn_close (pub);
+    errno_assert (rc == 0);
+    rc = nn_close (sub1);
+    errno_assert (rc == 0);
+
+    /*  A subscriber that stops accepting messages for too long is evicted.
+        Inproc connections can't be broken, so the pipe stays but gets no
+        more messages. */
+    pub = nn_socket (AF_SP, NN_PUB);
+    errno_assert (pub != -1);
+    val = 1;
+    rc = nn_setsockopt (pub, NN_SOL_SOCKET, NN_SNDBUF, &val, sizeof (val));
+    errno_assert (rc == 0);
+    val = 50;
+    rc = nn_setsockopt (pub, NN_PUB, NN_PUB_EVICT_TIMEOUT, &val, sizeof (val));
+    errno_assert (rc == 0);
+    rc = nn_bind (pub, SOCKET_ADDRESS);
+    errno_assert (rc >= 0);
+    sub1 = nn_socket (AF_SP, NN_SUB);
+    errno_assert (sub1 != -1);
+    val = 1;
+    rc = nn_setsockopt (sub1, NN_SOL_SOCKET, NN_RCVBUF, &val, sizeof (val));
+    errno_assert (rc == 0);
+    rc = nn_setsockopt (sub1, NN_SUB, NN_SUB_SUBSCRIBE, "", 0);
+    errno_assert (rc == 0);
+    rc = nn_connect (sub1, SOCKET_ADDRESS);
+    errno_assert (rc >= 0);
+    nn_sleep (10);
+
+    for (i = 0; i != 10; ++i) {
+        rc = nn_send (pub, "ABC", 3, 0);
+        errno_assert (rc >= 0);
+    }
+    sz = sizeof (sockstats);
+    rc = nn_getsockopt (pub, NN_SOL_SOCKET, NN_STATS, &sockstats, &sz);
+    errno_assert (rc == 0);
+    nn_assert (sockstats.evicted == 0);
+    nn_sleep (100);
+    rc = nn_send (pub, "ABC", 3, 0);
+    errno_assert (rc >= 0);
+    sz = sizeof (sockstats);
+    rc = nn_getsockopt (pub, NN_SOL_SOCKET, NN_STATS, &sockstats, &sz);
+    errno_assert (rc == 0);
+    nn_assert (sockstats.evicted == 1);
+    for (i = 0; i != 10; ++i) {
+        rc = nn_send (pub, "ABC", 3, 0);
+        errno_assert (rc >= 0);
+    }
+    sz = sizeof (stats);
+    rc = nn_getsockopt (pub, NN_PUB, NN_PUB_PIPE_STATS, stats, &sz);
+    errno_assert (rc == 0);
+    nn_assert (sz == sizeof (stats [0]));
+    nn_assert (stats [0].sent + stats [0].dropped == 11);
+
+    rc = nn_close (pub);
+    errno_assert (rc == 0);
+    rc = nn_close (sub1);
+    errno_assert (rc == 0);
+
+    /*  A subscriber that drops too many messages is disconnected. */
+    pub = nn_socket (AF_SP, NN_PUB);
+    errno_assert (pub != -1);
+    val = 50;
+    rc = nn_setsockopt (pub, NN_PUB, NN_PUB_EVICT_DROPS, &val, sizeof (val));
+    errno_assert (rc == 0);
+    val = 101;
+    rc = nn_setsockopt (pub, NN_PUB, NN_PUB_EVICT_DROPS, &val, sizeof (val));
+    nn_assert (rc < 0 && nn_errno () == EINVAL);
+    rc = nn_bind (pub, SOCKET_ADDRESS_TCP);
+    errno_assert (rc >= 0);
+    sub1 = nn_socket (AF_SP, NN_SUB);
+    errno_assert (sub1 != -1);
+    rc = nn_setsockopt (sub1, NN_SUB, NN_SUB_SUBSCRIBE, "", 0);
+    errno_assert (rc == 0);
+    rc = nn_connect (sub1, SOCKET_ADDRESS_TCP);
+    errno_assert (rc >= 0);
+    nn_sleep (10);
+
+    big = malloc (65536);
+    alloc_assert (big);
+    memset (big, 'A', 65536);
+    for (i = 0; i != 1000; ++i) {
+        rc = nn_send (pub, big, 65536, 0);
+        errno_assert (rc >= 0);
+    }
+    free (big);
+    sz = sizeof (sockstats);
+    rc = nn_getsockopt (pub, NN_SOL_SOCKET, NN_STATS, &sockstats, &sz);
+    errno_assert (rc == 0);
+    nn_assert (sockstats.evicted >= 1);
+    nn_assert (sockstats.disconnects >= 1);
+
+    rc = nn_close (pub);
+    errno_assert (rc == 0);
+    rc = nn_close (sub1);
+    errno_assert (rc == 0);
+
+#if !defined NN_HAVE_WINDOWS
+    /*  Test the journal. The subscriber that reconnects gets the messages it
+        has missed, even if the publisher was restarted in the meantime. */
+    unlink (JOURNAL_FILE);
+    seq = 0;
+    for (k = 0; k != 3; ++k) {
+        pub = nn_socket (AF_SP, NN_PUB);
+        errno_assert (pub != -1);
+        val = 64 * 1024;
+        rc = nn_setsockopt (pub, NN_PUB, NN_PUB_JOURNAL_SIZE, &val,
+            sizeof (val));
+        errno_assert (rc == 0);
+        rc = nn_setsockopt (pub, NN_PUB, NN_PUB_JOURNAL, JOURNAL_FILE,
+            strlen (JOURNAL_FILE));
+        errno_assert (rc == 0);
+        sz = sizeof (msg);
+        rc = nn_getsockopt (pub, NN_PUB, NN_PUB_JOURNAL, msg, &sz);
+        errno_assert (rc == 0);
+        nn_assert (sz == strlen (JOURNAL_FILE) &&
+            memcmp (msg, JOURNAL_FILE, sz) == 0);
+        rc = nn_bind (pub, SOCKET_ADDRESS_JOURNAL);
+        errno_assert (rc >= 0);
+
+        /*  Only the first half of the messages is received each time, the rest
+            is replayed to the next subscriber. */
+        sub1 = nn_socket (AF_SP, NN_SUB);
+        errno_assert (sub1 != -1);
+        rc = nn_setsockopt (sub1, NN_SUB, NN_SUB_SUBSCRIBE, "", 0);
+        errno_assert (rc == 0);
+        val = 1;
+        rc = nn_setsockopt (sub1, NN_SUB, NN_SUB_REPLAY, &val, sizeof (val));
+        errno_assert (rc == 0);
+        rc = nn_setsockopt (sub1, NN_SUB, NN_SUB_SEQ, &seq, sizeof (seq));
+        errno_assert (rc == 0);
+        rc = nn_connect (sub1, SOCKET_ADDRESS_JOURNAL);
+        errno_assert (rc >= 0);
+        nn_sleep (10);
+        rc = nn_setsockopt (sub1, NN_SUB, NN_SUB_REPLAY, &val, sizeof (val));
+        nn_assert (rc < 0 && nn_errno () == EISCONN);
+        for (i = k * 10; i != (k + 1) * 10; ++i) {
+            sprintf (msg, "%d", i);
+            rc = nn_send (pub, msg, strlen (msg), 0);
+            errno_assert (rc == (int) strlen (msg));
+        }
+        for (i = k ? k * 10 - 5 : 0; i != k * 10 + 5; ++i) {
+            rc = nn_recv (sub1, msg, sizeof (msg), 0);
+            errno_assert (rc >= 0);
+            sprintf (expected, "%d", i);
+            nn_assert (rc == (int) strlen (expected) &&
+                memcmp (msg, expected, rc) == 0);
+        }
+        sz = sizeof (seq);
+        rc = nn_getsockopt (sub1, NN_SUB, NN_SUB_SEQ, &seq, &sz);
+        errno_assert (rc == 0);
+        nn_assert (sz == sizeof (seq) && seq == (uint64_t) k * 10 + 5);
+
+        rc = nn_setsockopt (pub, NN_PUB, NN_PUB_JOURNAL, "", 0);
+        nn_assert (rc < 0 && nn_errno () == EBUSY);
+        rc = nn_close (sub1);
+        errno_assert (rc == 0);
+        rc = nn_close (pub);
+        errno_assert (rc == 0);
+    }
+    rc = unlink (JOURNAL_FILE);
+    errno_assert (rc == 0);
+#endif
+
+    /*  The inproc subscribers of a publisher share a ring. A subscriber that
+        falls behind by too much is overrun; it loses the older messages but
+        gets the newest one. The others are not affected. */
+    pub = nn_socket (AF_SP, NN_PUB);
+    errno_assert (pub != -1);
+    rc = nn_bind (pub, SOCKET_ADDRESS);
+    errno_assert (rc >= 0);
+    sub1 = nn_socket (AF_SP, NN_SUB);
+    errno_assert (sub1 != -1);
+    rc = nn_setsockopt (sub1, NN_SUB, NN_SUB_SUBSCRIBE, "", 0);
+    errno_assert (rc == 0);
+    rc = nn_connect (sub1, SOCKET_ADDRESS);
+    errno_assert (rc >= 0);
+    sub2 = nn_socket (AF_SP, NN_SUB);
+    errno_assert (sub2 != -1);
+    rc = nn_setsockopt (sub2, NN_SUB, NN_SUB_SUBSCRIBE, "", 0);
+    errno_assert (rc == 0);
+    rc = nn_connect (sub2, SOCKET_ADDRESS);
+    errno_assert (rc >= 0);
+    nn_sleep (10);
+    for (i = 0; i != 5000; ++i) {
+        sprintf (msg, "%d", i);
+        rc = nn_send (pub, msg, strlen (msg), 0);
+        errno_assert (rc == (int) strlen (msg));
+        rc = nn_recv (sub1, expected, sizeof (expected), 0);
+        nn_assert (rc == (int) strlen (msg) && memcmp (msg, expected, rc) == 0);
+    }
+    k = -1;
+    for (i = 0; i != 5000; ++i) {
+        rc = nn_recv (sub2, msg, sizeof (msg) - 1, NN_DONTWAIT);
+        if (rc < 0) {
+            errno_assert (nn_errno () == EAGAIN);
+            break;
+        }
+        msg [rc] = 0;
+        nn_assert (atoi (msg) > k);
+        k = atoi (msg);
+    }
+    nn_assert (i < 5000 && k == 4999);
+    rc = nn_close (sub2);
+    errno_assert (rc == 0);
+    rc = nn_close (sub1);
+    errno_assert (rc == 0);
+    rc = nn_close (pub);
+    errno_assert (rc == 0);
+
+    /*  Subscribe to many topics at once, a sorted list on one socket and
+        an unsorted one on the other. */
+    pub = nn_socket (AF_SP, NN_PUB);
+    errno_assert (pub != -1);
+    rc = nn_bind (pub, SOCKET_ADDRESS_BULK);
+    errno_assert (rc >= 0);
+    memcpy (bulk, "\0\0\0\2AB\0\0\0\3ABC\0\0\0\2CD", 19);
+    sub1 = nn_socket (AF_SP, NN_SUB);
+    errno_assert (sub1 != -1);
+    rc = nn_setsockopt (sub1, NN_SUB, NN_SUB_SUBSCRIBE_BULK, bulk, 19);
+    errno_assert (rc == 0);
+    sz = sizeof (triestats);
+    rc = nn_getsockopt (sub1, NN_SUB, NN_SUB_TRIE_STATS, &triestats, &sz);
+    errno_assert (rc == 0);
+    nn_assert (sz == sizeof (triestats));
+    nn_assert (triestats.nodes == 4 && triestats.bytes > 0);
+    rc = nn_setsockopt (sub1, NN_SUB, NN_SUB_SUBSCRIBE_BULK, bulk, 18);
+    nn_assert (rc < 0 && nn_errno () == EINVAL);
+    memcpy (bulk, "\0\0\0\2CD\0\0\0\2AB", 12);
+    sub2 = nn_socket (AF_SP, NN_SUB);
+    errno_assert (sub2 != -1);
+    rc = nn_setsockopt (sub2, NN_SUB, NN_SUB_SUBSCRIBE_BULK, bulk, 12);
+    errno_assert (rc == 0);
+    rc = nn_connect (sub1, SOCKET_ADDRESS_BULK);
+    errno_assert (rc >= 0);
+    rc = nn_connect (sub2, SOCKET_ADDRESS_BULK);
+    errno_assert (rc >= 0);
+    nn_sleep (10);
+    rc = nn_send (pub, "XYZ", 3, 0);
+    errno_assert (rc == 3);
+    rc = nn_send (pub, "ABX", 3, 0);
+    errno_assert (rc == 3);
+    rc = nn_send (pub, "CDX", 3, 0);
+    errno_assert (rc == 3);
+    rc = nn_recv (sub1, buf, sizeof (buf), 0);
+    nn_assert (rc == 3 && memcmp (buf, "ABX", 3) == 0);
+    rc = nn_recv (sub1, buf, sizeof (buf), 0);
+    nn_assert (rc == 3 && memcmp (buf, "CDX", 3) == 0);
+    rc = nn_recv (sub2, buf, sizeof (buf), 0);
+    nn_assert (rc == 3 && memcmp (buf, "ABX", 3) == 0);
+    rc = nn_recv (sub2, buf, sizeof (buf), 0);
+    nn_assert (rc == 3 && memcmp (buf, "CDX", 3) == 0);
+    rc = nn_close (sub2);
+    errno_assert (rc == 0);
+    rc = nn_close (sub1);
+    errno_assert (rc == 0);
+    rc = nn_close (pub);
+    errno_assert (rc == 0);
+
+    /*  Messages keep being matched while the subscriptions change. */
+    pub = nn_socket (AF_SP, NN_PUB);
+    errno_assert (pub != -1);
+    rc = nn_bind (pub, SOCKET_ADDRESS_CHURN);
+    errno_assert (rc >= 0);
+    churn_sub = nn_socket (AF_SP, NN_SUB);
+    errno_assert (churn_sub != -1);
+    rc = nn_setsockopt (churn_sub, NN_SUB, NN_SUB_SUBSCRIBE, "AB", 2);
+    errno_assert (rc == 0);
+    rc = nn_connect (churn_sub, SOCKET_ADDRESS_CHURN);
+    errno_assert (rc >= 0);
+    nn_sleep (10);
+    nn_thread_init (&thread, churn, NULL);
+    for (i = 0; i != 100; ++i) {
+        rc = nn_send (pub, "ABC", 3, 0);
+        errno_assert (rc == 3);
+        rc = nn_recv (churn_sub, buf, sizeof (buf), 0);
+        nn_assert (rc == 3 && memcmp (buf, "ABC", 3) == 0);
+    }
+    nn_thread_term (&thread);
+    sz = sizeof (triestats);
+    rc = nn_getsockopt (churn_sub, NN_SUB, NN_SUB_TRIE_STATS, &triestats,
+        &sz);
+    errno_assert (rc == 0);
+    nn_assert (triestats.nodes == 1);
+    rc = nn_close (churn_sub);
+    errno_assert (rc == 0);
+    rc = nn_close (pub);
+    errno_assert (rc == 0);
+
+    /*  Wildcard subscriptions. */
+    pub = nn_socket (AF_SP, NN_PUB);
+    errno_assert (pub != -1);
+    rc = nn_bind (pub, SOCKET_ADDRESS_PATTERN);
+    errno_assert (rc >= 0);
+    sub1 = nn_socket (AF_SP, NN_SUB);
+    errno_assert (sub1 != -1);
+    rc = nn_setsockopt (sub1, NN_SUB, NN_SUB_PATTERN_SUBSCRIBE, "md.*.nq.", 8);
+    errno_assert (rc == 0);
+    rc = nn_setsockopt (sub1, NN_SUB, NN_SUB_PATTERN_SUBSCRIBE, "*.ny", 4);
+    errno_assert (rc == 0);
+    rc = nn_setsockopt (sub1, NN_SUB, NN_SUB_PATTERN_UNSUBSCRIBE, "*.ny", 4);
+    errno_assert (rc == 0);
+    rc = nn_setsockopt (sub1, NN_SUB, NN_SUB_PATTERN_UNSUBSCRIBE, "*.ny", 4);
+    nn_assert (rc < 0 && nn_errno () == EINVAL);
+    val = '/';
+    rc = nn_setsockopt (sub1, NN_SUB, NN_SUB_PATTERN_SEPARATOR, &val,
+        sizeof (val));
+    errno_assert (rc == 0);
+    sz = sizeof (val);
+    rc = nn_getsockopt (sub1, NN_SUB, NN_SUB_PATTERN_SEPARATOR, &val, &sz);
+    errno_assert (rc == 0);
+    nn_assert (sz == sizeof (val) && val == '/');
+    val = '.';
+    rc = nn_setsockopt (sub1, NN_SUB, NN_SUB_PATTERN_SEPARATOR, &val,
+        sizeof (val));
+    errno_assert (rc == 0);
+    rc = nn_connect (sub1, SOCKET_ADDRESS_PATTERN);
+    errno_assert (rc >= 0);
+    nn_sleep (10);
+    rc = nn_send (pub, "md.eq.ny.IBM", 12, 0);
+    errno_assert (rc == 12);
+    rc = nn_send (pub, "md.x.y.nq.A", 11, 0);
+    errno_assert (rc == 11);
+    rc = nn_send (pub, "md.eq.nq.AAPL", 13, 0);
+    errno_assert (rc == 13);
+    rc = nn_recv (sub1, msg, sizeof (msg), 0);
+    nn_assert (rc == 13 && memcmp (msg, "md.eq.nq.AAPL", 13) == 0);
+    rc = nn_close (sub1);
+    errno_assert (rc == 0);
+    rc = nn_close (pub);
+    errno_assert (rc == 0);
+
+    /*  Sharding by topic. The socket itself is shard 0, each context is
+        another one. Each topic is received from a single shard, in order. */
+    pub = nn_socket (AF_SP, NN_PUB);
+    errno_assert (pub != -1);
+    rc = nn_bind (pub, SOCKET_ADDRESS_SHARDS);
+    errno_assert (rc >= 0);
+    shard_sub = nn_socket (AF_SP, NN_SUB);
+    errno_assert (shard_sub != -1);
+    rc = nn_setsockopt (shard_sub, NN_SUB, NN_SUB_SUBSCRIBE, "t", 1);
+    errno_assert (rc == 0);
+    delimiter = '|';
+    rc = nn_setsockopt (shard_sub, NN_SUB, NN_SUB_TOPIC_DELIMITER, &delimiter,
+        sizeof (delimiter));
+    errno_assert (rc == 0);
+    ctxs [0] = -1;
+    for (i = 1; i != 4; ++i) {
+        ctxs [i] = nn_ctx_open (shard_sub);
+        errno_assert (ctxs [i] >= 0);
+    }
+    val = 1;
+    rc = nn_setsockopt (shard_sub, NN_SUB, NN_SUB_CONFLATE, &val,
+        sizeof (val));
+    nn_assert (rc < 0 && nn_errno () == EINVAL);
+    rc = nn_connect (shard_sub, SOCKET_ADDRESS_SHARDS);
+    errno_assert (rc >= 0);
+    nn_sleep (10);
+    for (i = 0; i != 100; ++i) {
+        sprintf (msg, "t%d|%c", i % 10, 'A' + i / 10);
+        rc = nn_send (pub, msg, 4, 0);
+        errno_assert (rc == 4);
+    }
+    nn_sleep (10);
+    for (k = 0; k != 10; ++k) {
+        owner [k] = -1;
+        latest [k] = 'A' - 1;
+    }
+    received = 0;
+    for (shard = 0; shard != 4; ++shard) {
+        while (1) {
+            if (shard == 0)
+                rc = nn_recv (shard_sub, msg, sizeof (msg), NN_DONTWAIT);
+            else
+                rc = nn_ctx_recv (shard_sub, ctxs [shard], msg, sizeof (msg),
+                    NN_DONTWAIT);
+            if (rc < 0) {
+                nn_assert (nn_errno () == EAGAIN);
+                break;
+            }
+            nn_assert (rc == 4);
+            k = msg [1] - '0';
+            nn_assert (owner [k] == -1 || owner [k] == shard);
+            owner [k] = shard;
+            nn_assert (msg [3] == latest [k] + 1);
+            latest [k] = msg [3];
+            ++received;
+        }
+    }
+    nn_assert (received == 100);
+
+    /*  A thread blocked on a context is woken up by a message for it. */
+    for (k = 0; owner [k] == 0; ++k)
+        nn_assert (k < 9);
+    shard_ctx = ctxs [owner [k]];
+    sprintf (msg, "t%d|Z", k);
+    nn_thread_init (&thread, shard_recv, msg);
+    nn_sleep (10);
+    rc = nn_send (pub, msg, 4, 0);
+    errno_assert (rc == 4);
+    nn_thread_term (&thread);
+    rc = nn_ctx_close (shard_sub, ctxs [1]);
+    errno_assert (rc == 0);
+    rc = nn_close (shard_sub);
+    errno_assert (rc == 0);
+    rc = nn_close (pub);
+    errno_assert (rc == 0);
+
     return 0;
 }
 
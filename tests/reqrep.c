@@ -26,7 +26,19 @@
 #include "../src/utils/err.c"
 #include "../src/utils/sleep.c"
 
+#include <string.h>
+
 #define SOCKET_ADDRESS "inproc://a"
+#define SOCKET_ADDRESS_PIPELINE "inproc://b"
+#define SOCKET_ADDRESS_CTX "inproc://c"
+#define SOCKET_ADDRESS_LB1 "inproc://d"
+#define SOCKET_ADDRESS_LB2 "inproc://e"
+#define SOCKET_ADDRESS_HEDGE1 "inproc://f"
+#define SOCKET_ADDRESS_HEDGE2 "inproc://g"
+#define SOCKET_ADDRESS_LATENCY "inproc://h"
+#define SOCKET_ADDRESS_SHED "inproc://i"
+#define SOCKET_ADDRESS_TRACE "tcp://127.0.0.1:5595"
+#define SOCKET_ADDRESS_DEDUP "inproc://j"
 
 int main ()
 {
@@ -38,6 +50,28 @@ int main ()
     int resend_ivl;
     char buf [7];
     int timeo;
+    int pipeline;
+    int i;
+    int ctx1;
+    int ctx2;
+    int leastbusy;
+    int fast;
+    int slow;
+    int hedge_ivl;
+    int adaptive;
+    struct nn_latency_stats stats;
+    struct nn_sock_stats sockstats;
+    int maxwait;
+    int dedup;
+    size_t sz;
+    void *hdrs [3];
+    char tag [8];
+    struct nn_iovec iov;
+    struct nn_msghdr hdr;
+    int tracectx;
+    char trace [NN_TRACE_SIZE];
+    char ctrl [256];
+    struct nn_cmsghdr *cmsg;
 
     /*  Test req/rep with full socket types. */
     rep1 = nn_socket (AF_SP, NN_REP);
@@ -198,6 +232,579 @@ int main ()
     rc = nn_close (rep1);
     errno_assert (rc == 0);
 
+    /*  Test the cache of the requests received lately. A resent request is
+        not passed to the user; while it's being processed, it's ignored,
+        once it's answered, the reply is sent again. */
+    rep1 = nn_socket (AF_SP, NN_REP);
+    errno_assert (rep1 != -1);
+    sz = sizeof (dedup);
+    rc = nn_getsockopt (rep1, NN_REP, NN_REP_DEDUP, &dedup, &sz);
+    errno_assert (rc == 0);
+    nn_assert (sz == sizeof (dedup) && dedup == 0);
+    dedup = -1;
+    rc = nn_setsockopt (rep1, NN_REP, NN_REP_DEDUP, &dedup, sizeof (dedup));
+    nn_assert (rc == -1 && nn_errno () == EINVAL);
+    dedup = 16;
+    rc = nn_setsockopt (rep1, NN_REP, NN_REP_DEDUP, &dedup, sizeof (dedup));
+    errno_assert (rc == 0);
+    sz = sizeof (dedup);
+    rc = nn_getsockopt (rep1, NN_REP, NN_REP_DEDUP, &dedup, &sz);
+    errno_assert (rc == 0);
+    nn_assert (sz == sizeof (dedup) && dedup == 16);
+    timeo = 100;
+    rc = nn_setsockopt (rep1, NN_SOL_SOCKET, NN_RCVTIMEO, &timeo,
+        sizeof (timeo));
+    errno_assert (rc == 0);
+    rc = nn_bind (rep1, SOCKET_ADDRESS_DEDUP);
+    errno_assert (rc >= 0);
+    req1 = nn_socket (AF_SP_RAW, NN_REQ);
+    errno_assert (req1 != -1);
+    rc = nn_connect (req1, SOCKET_ADDRESS_DEDUP);
+    errno_assert (rc >= 0);
+    ctx1 = nn_ctx_open (rep1);
+    errno_assert (ctx1 >= 0);
+    ctx2 = nn_ctx_open (rep1);
+    errno_assert (ctx2 >= 0);
+
+    memcpy (tag, "\x80\0\0\x01", 4);
+    for (i = 0; i != 3; ++i) {
+        iov.iov_base = "ABC";
+        iov.iov_len = 3;
+        hdr.msg_iov = &iov;
+        hdr.msg_iovlen = 1;
+        hdr.msg_control = tag;
+        hdr.msg_controllen = 4;
+        rc = nn_sendmsg (req1, &hdr, 0);
+        errno_assert (rc == 3);
+        if (i == 0) {
+            rc = nn_ctx_recv (rep1, ctx1, buf, sizeof (buf), 0);
+            errno_assert (rc == 3);
+        }
+        rc = nn_ctx_recv (rep1, ctx2, buf, sizeof (buf), 0);
+        nn_assert (rc == -1 &&
+            (nn_errno () == EAGAIN || nn_errno () == ETIMEDOUT));
+        if (i == 1) {
+            rc = nn_ctx_send (rep1, ctx1, "XYZ", 3, 0);
+            errno_assert (rc == 3);
+        }
+        if (i != 0) {
+            iov.iov_base = buf;
+            iov.iov_len = sizeof (buf);
+            hdr.msg_controllen = sizeof (tag);
+            rc = nn_recvmsg (req1, &hdr, 0);
+            errno_assert (rc == 3);
+            nn_assert (memcmp (buf, "XYZ", 3) == 0);
+            nn_assert (hdr.msg_controllen == 4 &&
+                memcmp (tag, "\x80\0\0\x01", 4) == 0);
+        }
+    }
+
+    rc = nn_ctx_close (rep1, ctx2);
+    errno_assert (rc == 0);
+    rc = nn_ctx_close (rep1, ctx1);
+    errno_assert (rc == 0);
+    rc = nn_close (req1);
+    errno_assert (rc == 0);
+    rc = nn_close (rep1);
+    errno_assert (rc == 0);
+
+    /*  Test pipelined REQ socket. The replies are received in the order of
+        arrival, each with the header supplied along with the request. */
+    rep1 = nn_socket (AF_SP_RAW, NN_REP);
+    errno_assert (rep1 != -1);
+    rc = nn_bind (rep1, SOCKET_ADDRESS_PIPELINE);
+    errno_assert (rc >= 0);
+    req1 = nn_socket (AF_SP, NN_REQ);
+    errno_assert (req1 != -1);
+    pipeline = 3;
+    rc = nn_setsockopt (req1, NN_REQ, NN_REQ_PIPELINE, &pipeline,
+        sizeof (pipeline));
+    errno_assert (rc == 0);
+    rc = nn_connect (req1, SOCKET_ADDRESS_PIPELINE);
+    errno_assert (rc >= 0);
+
+    for (i = 0; i != 3; ++i) {
+        buf [0] = 'A' + i;
+        tag [0] = 'a' + i;
+        iov.iov_base = buf;
+        iov.iov_len = 1;
+        hdr.msg_iov = &iov;
+        hdr.msg_iovlen = 1;
+        hdr.msg_control = tag;
+        hdr.msg_controllen = 1;
+        rc = nn_sendmsg (req1, &hdr, 0);
+        errno_assert (rc == 1);
+    }
+
+    /*  No more requests can be sent until a reply arrives. */
+    rc = nn_send (req1, "D", 1, NN_DONTWAIT);
+    nn_assert (rc == -1 && nn_errno () == EAGAIN);
+
+    /*  Reply in the reverse order. */
+    for (i = 0; i != 3; ++i) {
+        iov.iov_base = buf;
+        iov.iov_len = sizeof (buf);
+        hdr.msg_iov = &iov;
+        hdr.msg_iovlen = 1;
+        hdr.msg_control = &hdrs [i];
+        hdr.msg_controllen = NN_MSG;
+        rc = nn_recvmsg (rep1, &hdr, 0);
+        errno_assert (rc == 1);
+        nn_assert (buf [0] == 'A' + i);
+    }
+    for (i = 2; i >= 0; --i) {
+        buf [0] = 'X' + i;
+        iov.iov_base = buf;
+        iov.iov_len = 1;
+        hdr.msg_iov = &iov;
+        hdr.msg_iovlen = 1;
+        hdr.msg_control = &hdrs [i];
+        hdr.msg_controllen = NN_MSG;
+        rc = nn_sendmsg (rep1, &hdr, 0);
+        errno_assert (rc == 1);
+    }
+    for (i = 2; i >= 0; --i) {
+        iov.iov_base = buf;
+        iov.iov_len = sizeof (buf);
+        hdr.msg_iov = &iov;
+        hdr.msg_iovlen = 1;
+        hdr.msg_control = tag;
+        hdr.msg_controllen = sizeof (tag);
+        rc = nn_recvmsg (req1, &hdr, 0);
+        errno_assert (rc == 1);
+        nn_assert (buf [0] == 'X' + i);
+        nn_assert (hdr.msg_controllen == 1 && tag [0] == 'a' + i);
+    }
+
+    /*  No request in flight. */
+    rc = nn_recv (req1, buf, sizeof (buf), NN_DONTWAIT);
+    nn_assert (rc == -1 && nn_errno () == EFSM);
+
+    /*  Lost requests are re-sent. */
+    resend_ivl = 10;
+    rc = nn_setsockopt (req1, NN_REQ, NN_REQ_RESEND_IVL, &resend_ivl,
+        sizeof (resend_ivl));
+    errno_assert (rc == 0);
+    rc = nn_send (req1, "E", 1, 0);
+    errno_assert (rc == 1);
+    rc = nn_recv (rep1, buf, sizeof (buf), 0);
+    errno_assert (rc == 1);
+    rc = nn_recv (rep1, buf, sizeof (buf), 0);
+    errno_assert (rc == 1);
+    nn_assert (buf [0] == 'E');
+
+    rc = nn_close (req1);
+    errno_assert (rc == 0);
+    rc = nn_close (rep1);
+    errno_assert (rc == 0);
+
+    /*  Test contexts. Two requests are received via two contexts of the same
+        REP socket and replied to in reverse order. */
+    rep1 = nn_socket (AF_SP, NN_REP);
+    errno_assert (rep1 != -1);
+    rc = nn_bind (rep1, SOCKET_ADDRESS_CTX);
+    errno_assert (rc >= 0);
+    req1 = nn_socket (AF_SP, NN_REQ);
+    errno_assert (req1 != -1);
+    rc = nn_connect (req1, SOCKET_ADDRESS_CTX);
+    errno_assert (rc >= 0);
+    req2 = nn_socket (AF_SP, NN_REQ);
+    errno_assert (req2 != -1);
+    rc = nn_connect (req2, SOCKET_ADDRESS_CTX);
+    errno_assert (rc >= 0);
+
+    ctx1 = nn_ctx_open (rep1);
+    errno_assert (ctx1 >= 0);
+    ctx2 = nn_ctx_open (rep1);
+    errno_assert (ctx2 >= 0 && ctx2 != ctx1);
+
+    rc = nn_ctx_send (rep1, ctx1, "X", 1, 0);
+    nn_assert (rc == -1 && nn_errno () == EFSM);
+
+    rc = nn_send (req1, "A", 1, 0);
+    errno_assert (rc == 1);
+    rc = nn_ctx_recv (rep1, ctx1, buf, sizeof (buf), 0);
+    errno_assert (rc == 1);
+    nn_assert (buf [0] == 'A');
+    rc = nn_send (req2, "B", 1, 0);
+    errno_assert (rc == 1);
+    rc = nn_ctx_recv (rep1, ctx2, buf, sizeof (buf), 0);
+    errno_assert (rc == 1);
+    nn_assert (buf [0] == 'B');
+
+    rc = nn_ctx_send (rep1, ctx2, "b", 1, 0);
+    errno_assert (rc == 1);
+    rc = nn_ctx_send (rep1, ctx1, "a", 1, 0);
+    errno_assert (rc == 1);
+    rc = nn_recv (req2, buf, sizeof (buf), 0);
+    errno_assert (rc == 1);
+    nn_assert (buf [0] == 'b');
+    rc = nn_recv (req1, buf, sizeof (buf), 0);
+    errno_assert (rc == 1);
+    nn_assert (buf [0] == 'a');
+
+    /*  A context with a request in progress can be closed. */
+    rc = nn_send (req1, "C", 1, 0);
+    errno_assert (rc == 1);
+    rc = nn_ctx_recv (rep1, ctx1, buf, sizeof (buf), 0);
+    errno_assert (rc == 1);
+    rc = nn_ctx_close (rep1, ctx1);
+    errno_assert (rc == 0);
+    rc = nn_ctx_close (rep1, ctx1);
+    nn_assert (rc == -1 && nn_errno () == EINVAL);
+    rc = nn_ctx_recv (rep1, ctx1, buf, sizeof (buf), NN_DONTWAIT);
+    nn_assert (rc == -1 && nn_errno () == EINVAL);
+
+    /*  Sockets not supporting contexts. */
+    rc = nn_ctx_open (req1);
+    nn_assert (rc == -1 && nn_errno () == ENOTSUP);
+
+    rc = nn_close (req2);
+    errno_assert (rc == 0);
+    rc = nn_close (req1);
+    errno_assert (rc == 0);
+    rc = nn_close (rep1);
+    errno_assert (rc == 0);
+
+    /*  Test least busy load balancing. The peer that replies gets the new
+        requests while the other one still has requests outstanding. */
+    rep1 = nn_socket (AF_SP, NN_REP);
+    errno_assert (rep1 != -1);
+    rc = nn_bind (rep1, SOCKET_ADDRESS_LB1);
+    errno_assert (rc >= 0);
+    rep2 = nn_socket (AF_SP, NN_REP);
+    errno_assert (rep2 != -1);
+    rc = nn_bind (rep2, SOCKET_ADDRESS_LB2);
+    errno_assert (rc >= 0);
+    req1 = nn_socket (AF_SP, NN_REQ);
+    errno_assert (req1 != -1);
+    leastbusy = 1;
+    rc = nn_setsockopt (req1, NN_REQ, NN_REQ_LEAST_BUSY, &leastbusy,
+        sizeof (leastbusy));
+    errno_assert (rc == 0);
+    pipeline = 8;
+    rc = nn_setsockopt (req1, NN_REQ, NN_REQ_PIPELINE, &pipeline,
+        sizeof (pipeline));
+    errno_assert (rc == 0);
+    rc = nn_connect (req1, SOCKET_ADDRESS_LB1);
+    errno_assert (rc >= 0);
+    rc = nn_connect (req1, SOCKET_ADDRESS_LB2);
+    errno_assert (rc >= 0);
+    nn_sleep (10);
+
+    rc = nn_send (req1, "A", 1, 0);
+    errno_assert (rc == 1);
+    rc = nn_send (req1, "B", 1, 0);
+    errno_assert (rc == 1);
+    rc = nn_send (req1, "C", 1, 0);
+    errno_assert (rc == 1);
+
+    /*  One peer gets A and C, the other one gets B. */
+    rc = nn_recv (rep1, buf, sizeof (buf), 0);
+    errno_assert (rc == 1);
+    fast = buf [0] == 'B' ? rep1 : rep2;
+    slow = buf [0] == 'B' ? rep2 : rep1;
+    rc = nn_recv (rep2, buf, sizeof (buf), 0);
+    errno_assert (rc == 1);
+    rc = nn_recv (slow, buf, sizeof (buf), 0);
+    errno_assert (rc == 1);
+    nn_assert (buf [0] == 'C');
+
+    rc = nn_send (fast, "b", 1, 0);
+    errno_assert (rc == 1);
+    rc = nn_recv (req1, buf, sizeof (buf), 0);
+    errno_assert (rc == 1);
+    nn_assert (buf [0] == 'b');
+
+    rc = nn_send (req1, "D", 1, 0);
+    errno_assert (rc == 1);
+    rc = nn_send (req1, "E", 1, 0);
+    errno_assert (rc == 1);
+    rc = nn_recv (fast, buf, sizeof (buf), 0);
+    errno_assert (rc == 1);
+    nn_assert (buf [0] == 'D');
+    rc = nn_recv (fast, buf, sizeof (buf), 0);
+    errno_assert (rc == 1);
+    nn_assert (buf [0] == 'E');
+    rc = nn_recv (slow, buf, sizeof (buf), NN_DONTWAIT);
+    nn_assert (rc == -1 && nn_errno () == EAGAIN);
+
+    rc = nn_close (req1);
+    errno_assert (rc == 0);
+    rc = nn_close (rep2);
+    errno_assert (rc == 0);
+    rc = nn_close (rep1);
+    errno_assert (rc == 0);
+
+    /*  Test hedged requests. The duplicate of the request goes to the other
+        peer and its reply is taken. */
+    rep1 = nn_socket (AF_SP, NN_REP);
+    errno_assert (rep1 != -1);
+    rc = nn_bind (rep1, SOCKET_ADDRESS_HEDGE1);
+    errno_assert (rc >= 0);
+    rep2 = nn_socket (AF_SP, NN_REP);
+    errno_assert (rep2 != -1);
+    rc = nn_bind (rep2, SOCKET_ADDRESS_HEDGE2);
+    errno_assert (rc >= 0);
+    req1 = nn_socket (AF_SP, NN_REQ);
+    errno_assert (req1 != -1);
+    hedge_ivl = 10;
+    rc = nn_setsockopt (req1, NN_REQ, NN_REQ_HEDGE_IVL, &hedge_ivl,
+        sizeof (hedge_ivl));
+    errno_assert (rc == 0);
+    rc = nn_connect (req1, SOCKET_ADDRESS_HEDGE1);
+    errno_assert (rc >= 0);
+    rc = nn_connect (req1, SOCKET_ADDRESS_HEDGE2);
+    errno_assert (rc >= 0);
+    nn_sleep (10);
+
+    rc = nn_send (req1, "A", 1, 0);
+    errno_assert (rc == 1);
+    rc = nn_recv (rep1, buf, sizeof (buf), 0);
+    errno_assert (rc == 1);
+    rc = nn_recv (rep2, buf, sizeof (buf), 0);
+    errno_assert (rc == 1);
+    nn_assert (buf [0] == 'A');
+    rc = nn_send (rep2, "a", 1, 0);
+    errno_assert (rc == 1);
+    rc = nn_recv (req1, buf, sizeof (buf), 0);
+    errno_assert (rc == 1);
+    nn_assert (buf [0] == 'a');
+
+    /*  The late reply is dropped. */
+    rc = nn_send (rep1, "x", 1, 0);
+    errno_assert (rc == 1);
+    nn_sleep (10);
+    rc = nn_recv (req1, buf, sizeof (buf), NN_DONTWAIT);
+    nn_assert (rc == -1 && nn_errno () == EFSM);
+
+    rc = nn_close (req1);
+    errno_assert (rc == 0);
+    rc = nn_close (rep2);
+    errno_assert (rc == 0);
+
+    /*  Test adaptive re-send interval. After a few quick replies, a lost
+        request is re-sent way before the re-send interval expires. */
+    req1 = nn_socket (AF_SP, NN_REQ);
+    errno_assert (req1 != -1);
+    adaptive = 1;
+    rc = nn_setsockopt (req1, NN_REQ, NN_REQ_ADAPTIVE_RESEND, &adaptive,
+        sizeof (adaptive));
+    errno_assert (rc == 0);
+    rc = nn_connect (req1, SOCKET_ADDRESS_HEDGE1);
+    errno_assert (rc >= 0);
+    nn_sleep (10);
+
+    for (i = 0; i != 4; ++i) {
+        rc = nn_send (req1, "B", 1, 0);
+        errno_assert (rc == 1);
+        rc = nn_recv (rep1, buf, sizeof (buf), 0);
+        errno_assert (rc == 1);
+        rc = nn_send (rep1, "b", 1, 0);
+        errno_assert (rc == 1);
+        rc = nn_recv (req1, buf, sizeof (buf), 0);
+        errno_assert (rc == 1);
+    }
+    timeo = 1000;
+    rc = nn_setsockopt (rep1, NN_SOL_SOCKET, NN_RCVTIMEO, &timeo,
+        sizeof (timeo));
+    errno_assert (rc == 0);
+    rc = nn_send (req1, "C", 1, 0);
+    errno_assert (rc == 1);
+    rc = nn_recv (rep1, buf, sizeof (buf), 0);
+    errno_assert (rc == 1);
+    rc = nn_recv (rep1, buf, sizeof (buf), 0);
+    errno_assert (rc == 1);
+    nn_assert (buf [0] == 'C');
+
+    rc = nn_close (req1);
+    errno_assert (rc == 0);
+    rc = nn_close (rep1);
+    errno_assert (rc == 0);
+
+    /*  Test the reply latency statistics. */
+    rep1 = nn_socket (AF_SP, NN_REP);
+    errno_assert (rep1 != -1);
+    rc = nn_bind (rep1, SOCKET_ADDRESS_LATENCY);
+    errno_assert (rc >= 0);
+    req1 = nn_socket (AF_SP, NN_REQ);
+    errno_assert (req1 != -1);
+    rc = nn_connect (req1, SOCKET_ADDRESS_LATENCY);
+    errno_assert (rc >= 0);
+
+    sz = sizeof (stats);
+    rc = nn_getsockopt (req1, NN_REQ, NN_REQ_LATENCY, &stats, &sz);
+    errno_assert (rc == 0);
+    nn_assert (sz == sizeof (stats));
+    nn_assert (stats.count == 0 && stats.max == 0 && stats.p999 == 0);
+
+    for (i = 0; i != 10; ++i) {
+        rc = nn_send (req1, "ABC", 3, 0);
+        errno_assert (rc == 3);
+        rc = nn_recv (rep1, buf, sizeof (buf), 0);
+        errno_assert (rc == 3);
+        if (i == 9)
+            nn_sleep (50);
+        rc = nn_send (rep1, "DEF", 3, 0);
+        errno_assert (rc == 3);
+        rc = nn_recv (req1, buf, sizeof (buf), 0);
+        errno_assert (rc == 3);
+    }
+
+    sz = sizeof (stats);
+    rc = nn_getsockopt (req1, NN_REQ, NN_REQ_LATENCY, &stats, &sz);
+    errno_assert (rc == 0);
+    nn_assert (stats.count == 10);
+    nn_assert (stats.min <= stats.p50 && stats.p50 <= stats.p90);
+    nn_assert (stats.p90 <= stats.p99 && stats.p99 <= stats.p999);
+    nn_assert (stats.p999 == stats.max);
+    nn_assert (stats.max >= 40000 && stats.p50 < 40000);
+
+    rc = nn_setsockopt (req1, NN_REQ, NN_REQ_LATENCY, NULL, 0);
+    errno_assert (rc == 0);
+    sz = sizeof (stats);
+    rc = nn_getsockopt (req1, NN_REQ, NN_REQ_LATENCY, &stats, &sz);
+    errno_assert (rc == 0);
+    nn_assert (stats.count == 0);
+
+    rc = nn_close (req1);
+    errno_assert (rc == 0);
+    rc = nn_close (rep1);
+    errno_assert (rc == 0);
+
+    /*  Test shedding of the requests that have been queued for too long. */
+    rep1 = nn_socket (AF_SP, NN_REP);
+    errno_assert (rep1 != -1);
+    maxwait = 20;
+    rc = nn_setsockopt (rep1, NN_REP, NN_REP_MAXWAIT, &maxwait,
+        sizeof (maxwait));
+    errno_assert (rc == 0);
+    sz = sizeof (maxwait);
+    rc = nn_getsockopt (rep1, NN_REP, NN_REP_MAXWAIT, &maxwait, &sz);
+    errno_assert (rc == 0);
+    nn_assert (sz == sizeof (maxwait) && maxwait == 20);
+    timeo = 10;
+    rc = nn_setsockopt (rep1, NN_SOL_SOCKET, NN_RCVTIMEO, &timeo,
+        sizeof (timeo));
+    errno_assert (rc == 0);
+    rc = nn_bind (rep1, SOCKET_ADDRESS_SHED);
+    errno_assert (rc >= 0);
+    req1 = nn_socket (AF_SP, NN_REQ);
+    errno_assert (req1 != -1);
+    rc = nn_connect (req1, SOCKET_ADDRESS_SHED);
+    errno_assert (rc >= 0);
+    req2 = nn_socket (AF_SP, NN_REQ);
+    errno_assert (req2 != -1);
+    rc = nn_connect (req2, SOCKET_ADDRESS_SHED);
+    errno_assert (rc >= 0);
+    nn_sleep (10);
+
+    rc = nn_send (req1, "ABC", 3, 0);
+    errno_assert (rc == 3);
+    rc = nn_send (req2, "ABC", 3, 0);
+    errno_assert (rc == 3);
+    nn_sleep (50);
+    rc = nn_recv (rep1, buf, sizeof (buf), 0);
+    nn_assert (rc == -1 && nn_errno () == EAGAIN);
+    rc = nn_send (req1, "DE", 2, 0);
+    errno_assert (rc == 2);
+    rc = nn_recv (rep1, buf, sizeof (buf), 0);
+    errno_assert (rc == 2);
+    nn_assert (buf [0] == 'D' && buf [1] == 'E');
+
+    sz = sizeof (sockstats);
+    rc = nn_getsockopt (rep1, NN_SOL_SOCKET, NN_STATS, &sockstats, &sz);
+    errno_assert (rc == 0);
+    nn_assert (sockstats.shed == 2 && sockstats.shedbytes == 6);
+    nn_assert (sockstats.received == 1);
+
+    rc = nn_close (req2);
+    errno_assert (rc == 0);
+    rc = nn_close (req1);
+    errno_assert (rc == 0);
+    rc = nn_close (rep1);
+    errno_assert (rc == 0);
+
+    /*  Test propagation of the trace context over TCP. REP attaches the
+        context of the request to the reply. */
+    rep1 = nn_socket (AF_SP, NN_REP);
+    errno_assert (rep1 != -1);
+    tracectx = 1;
+    rc = nn_setsockopt (rep1, NN_SOL_SOCKET, NN_TRACECTX, &tracectx,
+        sizeof (tracectx));
+    errno_assert (rc == 0);
+    rc = nn_bind (rep1, SOCKET_ADDRESS_TRACE);
+    errno_assert (rc >= 0);
+    req1 = nn_socket (AF_SP, NN_REQ);
+    errno_assert (req1 != -1);
+    rc = nn_setsockopt (req1, NN_SOL_SOCKET, NN_TRACECTX, &tracectx,
+        sizeof (tracectx));
+    errno_assert (rc == 0);
+    sz = sizeof (tracectx);
+    rc = nn_getsockopt (req1, NN_SOL_SOCKET, NN_TRACECTX, &tracectx, &sz);
+    errno_assert (rc == 0);
+    nn_assert (sz == sizeof (tracectx) && tracectx == 1);
+    rc = nn_connect (req1, SOCKET_ADDRESS_TRACE);
+    errno_assert (rc >= 0);
+
+    /*  The trace contexts are passed only once the peers have agreed on
+        it, so wait for the connection to be established. */
+    nn_sleep (100);
+
+    for (i = 0; i != NN_TRACE_SIZE; ++i)
+        trace [i] = (char) i;
+    memset (ctrl, 0, sizeof (ctrl));
+    cmsg = (struct nn_cmsghdr*) ctrl;
+    cmsg->cmsg_len = NN_CMSG_LEN (NN_TRACE_SIZE);
+    cmsg->cmsg_level = PROTO_SP;
+    cmsg->cmsg_type = SP_TRACE;
+    memcpy (NN_CMSG_DATA (cmsg), trace, NN_TRACE_SIZE);
+    iov.iov_base = "ABC";
+    iov.iov_len = 3;
+    memset (&hdr, 0, sizeof (hdr));
+    hdr.msg_iov = &iov;
+    hdr.msg_iovlen = 1;
+    hdr.msg_control = ctrl;
+    hdr.msg_controllen = NN_CMSG_SPACE (NN_TRACE_SIZE);
+    rc = nn_sendmsg (req1, &hdr, 0);
+    errno_assert (rc == 3);
+
+    /*  A trace context of the wrong size is rejected. */
+    cmsg->cmsg_len = NN_CMSG_LEN (NN_TRACE_SIZE - 1);
+    rc = nn_sendmsg (req1, &hdr, 0);
+    nn_assert (rc < 0 && nn_errno () == EINVAL);
+
+    iov.iov_base = buf;
+    iov.iov_len = sizeof (buf);
+    hdr.msg_controllen = sizeof (ctrl);
+    rc = nn_recvmsg (rep1, &hdr, 0);
+    errno_assert (rc == 3);
+    cmsg = NN_CMSG_FIRSTHDR (&hdr);
+    nn_assert (cmsg && cmsg->cmsg_type == SP_HDR);
+    cmsg = NN_CMSG_NXTHDR (&hdr, cmsg);
+    nn_assert (cmsg);
+    nn_assert (cmsg->cmsg_level == PROTO_SP && cmsg->cmsg_type == SP_TRACE);
+    nn_assert (cmsg->cmsg_len == NN_CMSG_LEN (NN_TRACE_SIZE));
+    nn_assert (memcmp (NN_CMSG_DATA (cmsg), trace, NN_TRACE_SIZE) == 0);
+
+    rc = nn_send (rep1, "DEF", 3, 0);
+    errno_assert (rc == 3);
+    memset (ctrl, 0, sizeof (ctrl));
+    hdr.msg_controllen = sizeof (ctrl);
+    rc = nn_recvmsg (req1, &hdr, 0);
+    errno_assert (rc == 3);
+    nn_assert (buf [0] == 'D' && buf [1] == 'E' && buf [2] == 'F');
+    cmsg = NN_CMSG_FIRSTHDR (&hdr);
+    nn_assert (cmsg && cmsg->cmsg_type == SP_HDR);
+    cmsg = NN_CMSG_NXTHDR (&hdr, cmsg);
+    nn_assert (cmsg && cmsg->cmsg_type == SP_TRACE);
+    nn_assert (memcmp (NN_CMSG_DATA (cmsg), trace, NN_TRACE_SIZE) == 0);
+
+    rc = nn_close (req1);
+    errno_assert (rc == 0);
+    rc = nn_close (rep1);
+    errno_assert (rc == 0);
+
     return 0;
 }
 
@@ -0,0 +1,134 @@
+/*
+    Copyright (c) 2013 250bpm s.r.o.
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"),
+    to deal in the Software without restriction, including without limitation
+    the rights to use, copy, modify, merge, publish, distribute, sublicense,
+    and/or sell copies of the Software, and to permit persons to whom
+    the Software is furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included
+    in all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+    THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+    FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+    IN THE SOFTWARE.
+*/
+
+#include "../src/nn.h"
+#include "../src/pair.h"
+#include "../src/reqrep.h"
+
+#include "../src/utils/err.c"
+#include "../src/utils/sleep.c"
+#include "../src/utils/thread.c"
+
+#include <string.h>
+
+/*  Test the request-serving engine. */
+
+#define SOCKET_ADDRESS "inproc://serve"
+#define HANDLERS 4
+#define CLIENTS 8
+
+static int serve_rc;
+static int serve_errno;
+
+/*  Replies with the request itself, the first byte incremented. */
+static void *handler (void *req, size_t len, void *arg)
+{
+    nn_assert (len == 3);
+    nn_assert (arg == &serve_rc);
+    ++((char*) req) [0];
+    return req;
+}
+
+static void routine (void *arg)
+{
+    serve_rc = nn_serve (*(int*) arg, HANDLERS, handler, &serve_rc);
+    serve_errno = nn_errno ();
+}
+
+int main ()
+{
+    int rc;
+    int rep;
+    int req [CLIENTS];
+    int i;
+    int timeo;
+    size_t sz;
+    char buf [3];
+    struct nn_thread thread;
+    struct nn_sock_stats stats;
+
+    /*  Only sockets supporting contexts can be served. */
+    rep = nn_socket (AF_SP, NN_PAIR);
+    errno_assert (rep != -1);
+    rc = nn_serve (rep, HANDLERS, handler, &serve_rc);
+    nn_assert (rc == -1 && nn_errno () == ENOTSUP);
+    rc = nn_close (rep);
+    errno_assert (rc == 0);
+
+    rep = nn_socket (AF_SP, NN_REP);
+    errno_assert (rep != -1);
+    rc = nn_serve (rep, 0, handler, &serve_rc);
+    nn_assert (rc == -1 && nn_errno () == EINVAL);
+    rc = nn_bind (rep, SOCKET_ADDRESS);
+    errno_assert (rc >= 0);
+    nn_thread_init (&thread, routine, &rep);
+
+    timeo = 1000;
+    for (i = 0; i != CLIENTS; ++i) {
+        req [i] = nn_socket (AF_SP, NN_REQ);
+        errno_assert (req [i] != -1);
+        rc = nn_setsockopt (req [i], NN_SOL_SOCKET, NN_RCVTIMEO, &timeo,
+            sizeof (timeo));
+        errno_assert (rc == 0);
+        rc = nn_connect (req [i], SOCKET_ADDRESS);
+        errno_assert (rc >= 0);
+    }
+
+    /*  The requests are handled in parallel. */
+    for (i = 0; i != CLIENTS; ++i) {
+        rc = nn_send (req [i], "ABC", 3, 0);
+        errno_assert (rc == 3);
+    }
+    for (i = 0; i != CLIENTS; ++i) {
+        rc = nn_recv (req [i], buf, sizeof (buf), 0);
+        errno_assert (rc == 3);
+        nn_assert (memcmp (buf, "BBC", 3) == 0);
+    }
+
+    /*  The handlers are registered before nn_serve starts the threads. They
+        count a request as handled only after the reply was sent, though. */
+    for (i = 0; i != 100; ++i) {
+        sz = sizeof (stats);
+        rc = nn_getsockopt (rep, NN_SOL_SOCKET, NN_STATS, &stats, &sz);
+        errno_assert (rc == 0);
+        if (stats.handled == CLIENTS)
+            break;
+        nn_sleep (10);
+    }
+    nn_assert (stats.handlers == HANDLERS);
+    nn_assert (stats.handling == 0);
+    nn_assert (stats.handled == CLIENTS);
+
+    for (i = 0; i != CLIENTS; ++i) {
+        rc = nn_close (req [i]);
+        errno_assert (rc == 0);
+    }
+
+    /*  Closing the socket stops the engine. nn_close wakes the handlers up
+        and waits for them to leave the socket. */
+    rc = nn_close (rep);
+    errno_assert (rc == 0);
+    nn_thread_term (&thread);
+    nn_assert (serve_rc == -1 && serve_errno == ETERM);
+
+    return 0;
+}
@@ -0,0 +1,245 @@
+/*
+    Copyright (c) 2013 250bpm s.r.o.
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"),
+    to deal in the Software without restriction, including without limitation
+    the rights to use, copy, modify, merge, publish, distribute, sublicense,
+    and/or sell copies of the Software, and to permit persons to whom
+    the Software is furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included
+    in all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+    THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+    FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+    IN THE SOFTWARE.
+*/
+
+#include "../src/nn.h"
+#include "../src/pair.h"
+#include "../src/pubsub.h"
+#include "../src/shm.h"
+
+#include "../src/utils/err.c"
+#include "../src/utils/sleep.c"
+
+#include <stdlib.h>
+#include <string.h>
+
+/*  Tests shared memory transport. */
+
+#define SOCKET_ADDRESS "shm://test.shm"
+
+/*  Bigger than the ring so that the message has to be passed in pieces. */
+#define BIG_SIZE (1024 * 1024)
+
+#define SOCKET_ADDRESS_PUB "shm://test_pub.shm"
+#define SUBSCRIBERS 3
+
+/*  Too big for the feed of the PUB socket. */
+#define FEED_BIG_SIZE (128 * 1024)
+
+/*  Messages sent to a subscriber that doesn't read them. Their total size
+    exceeds the size of the feed. */
+#define OVERRUN_SIZE (16 * 1024)
+#define OVERRUN_COUNT 200
+
+int main ()
+{
+#if defined NN_USE_SHM
+    int rc;
+    int sb;
+    int sc;
+    int i;
+    int j;
+    int timeo;
+    int last;
+    int count;
+    int subs [SUBSCRIBERS];
+    char buf [3];
+    char *big;
+    void *msg;
+    struct nn_sock_stats stats;
+    size_t sz;
+
+    /*  Try closing a shm socket while it not connected. */
+    sc = nn_socket (AF_SP, NN_PAIR);
+    errno_assert (sc != -1);
+    rc = nn_connect (sc, SOCKET_ADDRESS);
+    errno_assert (rc >= 0);
+    rc = nn_close (sc);
+    errno_assert (rc == 0);
+
+    /*  Open the socket anew. */
+    sc = nn_socket (AF_SP, NN_PAIR);
+    errno_assert (sc != -1);
+    rc = nn_connect (sc, SOCKET_ADDRESS);
+    errno_assert (rc >= 0);
+
+    /*  Leave enough time for at least on re-connect attempt. */
+    nn_sleep (200);
+
+    sb = nn_socket (AF_SP, NN_PAIR);
+    errno_assert (sb != -1);
+    rc = nn_bind (sb, SOCKET_ADDRESS);
+    errno_assert (rc >= 0);
+
+    /*  Ping-pong test. */
+    for (i = 0; i != 100; ++i) {
+
+        rc = nn_send (sc, "0123456789012345678901234567890123456789", 40, 0);
+        errno_assert (rc >= 0);
+        nn_assert (rc == 40);
+
+        rc = nn_recv (sb, buf, sizeof (buf), 0);
+        errno_assert (rc >= 0);
+        nn_assert (rc == 40);
+
+        rc = nn_send (sb, "0123456789012345678901234567890123456789", 40, 0);
+        errno_assert (rc >= 0);
+        nn_assert (rc == 40);
+
+        rc = nn_recv (sc, buf, sizeof (buf), 0);
+        errno_assert (rc >= 0);
+        nn_assert (rc == 40);
+    }
+
+    /*  Batch transfer test. */
+    for (i = 0; i != 100; ++i) {
+        rc = nn_send (sc, "XYZ", 3, 0);
+        errno_assert (rc >= 0);
+        nn_assert (rc == 3);
+    }
+    for (i = 0; i != 100; ++i) {
+        rc = nn_recv (sb, buf, sizeof (buf), 0);
+        errno_assert (rc >= 0);
+        nn_assert (rc == 3);
+        nn_assert (memcmp (buf, "XYZ", 3) == 0);
+    }
+
+    /*  Transfer messages that don't fit into the ring. */
+    big = malloc (BIG_SIZE);
+    alloc_assert (big);
+    for (i = 0; i != BIG_SIZE; ++i)
+        big [i] = (char) i;
+    for (i = 0; i != 4; ++i) {
+        rc = nn_send (sc, big, BIG_SIZE, 0);
+        errno_assert (rc >= 0);
+        nn_assert (rc == BIG_SIZE);
+        rc = nn_recv (sb, &msg, NN_MSG, 0);
+        errno_assert (rc >= 0);
+        nn_assert (rc == BIG_SIZE);
+        nn_assert (memcmp (msg, big, BIG_SIZE) == 0);
+        rc = nn_freemsg (msg);
+        errno_assert (rc == 0);
+    }
+
+    rc = nn_close (sc);
+    errno_assert (rc == 0);
+    rc = nn_close (sb);
+    errno_assert (rc == 0);
+
+    /*  Publish the messages to several subscribers via the feed. */
+    sb = nn_socket (AF_SP, NN_PUB);
+    errno_assert (sb != -1);
+    rc = nn_bind (sb, SOCKET_ADDRESS_PUB);
+    errno_assert (rc >= 0);
+    timeo = 1000;
+    for (j = 0; j != SUBSCRIBERS; ++j) {
+        subs [j] = nn_socket (AF_SP, NN_SUB);
+        errno_assert (subs [j] != -1);
+        rc = nn_setsockopt (subs [j], NN_SUB, NN_SUB_SUBSCRIBE, "", 0);
+        errno_assert (rc == 0);
+        rc = nn_setsockopt (subs [j], NN_SOL_SOCKET, NN_RCVTIMEO, &timeo,
+            sizeof (timeo));
+        errno_assert (rc == 0);
+        rc = nn_connect (subs [j], SOCKET_ADDRESS_PUB);
+        errno_assert (rc >= 0);
+    }
+    nn_sleep (200);
+
+    for (i = 0; i != 100; ++i) {
+        rc = nn_send (sb, "XYZ", 3, 0);
+        errno_assert (rc >= 0);
+        nn_assert (rc == 3);
+    }
+    for (j = 0; j != SUBSCRIBERS; ++j) {
+        for (i = 0; i != 100; ++i) {
+            rc = nn_recv (subs [j], buf, sizeof (buf), 0);
+            errno_assert (rc >= 0);
+            nn_assert (rc == 3);
+            nn_assert (memcmp (buf, "XYZ", 3) == 0);
+        }
+    }
+
+    /*  Messages too big for the feed keep their order with the others. */
+    rc = nn_send (sb, "ABC", 3, 0);
+    errno_assert (rc == 3);
+    rc = nn_send (sb, big, FEED_BIG_SIZE, 0);
+    errno_assert (rc == FEED_BIG_SIZE);
+    rc = nn_send (sb, "DEF", 3, 0);
+    errno_assert (rc == 3);
+    for (j = 0; j != SUBSCRIBERS; ++j) {
+        rc = nn_recv (subs [j], buf, sizeof (buf), 0);
+        errno_assert (rc == 3);
+        nn_assert (memcmp (buf, "ABC", 3) == 0);
+        rc = nn_recv (subs [j], &msg, NN_MSG, 0);
+        errno_assert (rc == FEED_BIG_SIZE);
+        nn_assert (memcmp (msg, big, FEED_BIG_SIZE) == 0);
+        rc = nn_freemsg (msg);
+        errno_assert (rc == 0);
+        rc = nn_recv (subs [j], buf, sizeof (buf), 0);
+        errno_assert (rc == 3);
+        nn_assert (memcmp (buf, "DEF", 3) == 0);
+    }
+
+    /*  The publisher doesn't wait for a subscriber that doesn't keep up.
+        The oldest messages are lost and accounted for, the rest arrive in
+        order. */
+    for (i = 0; i != OVERRUN_COUNT; ++i) {
+        memcpy (big, &i, sizeof (i));
+        rc = nn_send (sb, big, OVERRUN_SIZE, 0);
+        errno_assert (rc == OVERRUN_SIZE);
+    }
+    last = -1;
+    count = 0;
+    while (1) {
+        rc = nn_recv (subs [0], &msg, NN_MSG, 0);
+        if (rc < 0) {
+            errno_assert (nn_errno () == EAGAIN);
+            break;
+        }
+        nn_assert (rc == OVERRUN_SIZE);
+        memcpy (&i, msg, sizeof (i));
+        nn_assert (i > last && i < OVERRUN_COUNT);
+        last = i;
+        ++count;
+        rc = nn_freemsg (msg);
+        errno_assert (rc == 0);
+    }
+    nn_assert (last == OVERRUN_COUNT - 1);
+    nn_assert (count < OVERRUN_COUNT);
+    sz = sizeof (stats);
+    rc = nn_getsockopt (subs [0], NN_SOL_SOCKET, NN_STATS, &stats, &sz);
+    errno_assert (rc == 0);
+    nn_assert (stats.shed == (unsigned long long) (OVERRUN_COUNT - count));
+    nn_assert (stats.shedbytes == stats.shed * OVERRUN_SIZE);
+
+    for (j = 0; j != SUBSCRIBERS; ++j) {
+        rc = nn_close (subs [j]);
+        errno_assert (rc == 0);
+    }
+    rc = nn_close (sb);
+    errno_assert (rc == 0);
+    free (big);
+
+#endif
+
+    return 0;
+}
+
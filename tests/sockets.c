@@ -0,0 +1,109 @@
+/*
+    Copyright (c) 2013 250bpm s.r.o.
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"),
+    to deal in the Software without restriction, including without limitation
+    the rights to use, copy, modify, merge, publish, distribute, sublicense,
+    and/or sell copies of the Software, and to permit persons to whom
+    the Software is furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included
+    in all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+    THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+    FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+    IN THE SOFTWARE.
+*/
+
+#include "../src/nn.h"
+#include "../src/pair.h"
+
+#include "../src/utils/err.c"
+#include "../src/utils/thread.c"
+
+/*  Creates and closes sockets from several threads in parallel. */
+
+#define SOCKET_ADDRESS "tcp://127.0.0.1:5594"
+
+#define THREAD_COUNT 8
+#define ITERATIONS 200
+#define BGCLOSE_ITERATIONS 20
+#define SOCKETS 8
+
+static void worker (void *arg)
+{
+    int rc;
+    int i;
+    int j;
+    int s [SOCKETS];
+    int bgclose;
+
+    /*  With NN_BGCLOSE, the sockets get an endpoint that takes a while to
+        terminate. Fewer iterations are done so as not to run out of file
+        descriptors while the sockets are being closed. */
+    bgclose = arg ? 1 : 0;
+    for (i = 0; i != (bgclose ? BGCLOSE_ITERATIONS : ITERATIONS); ++i) {
+        for (j = 0; j != SOCKETS; ++j) {
+            s [j] = nn_socket (AF_SP, NN_PAIR);
+            errno_assert (s [j] >= 0);
+            if (bgclose) {
+                rc = nn_setsockopt (s [j], NN_SOL_SOCKET, NN_BGCLOSE,
+                    &bgclose, sizeof (bgclose));
+                errno_assert (rc == 0);
+                rc = nn_connect (s [j], SOCKET_ADDRESS);
+                errno_assert (rc >= 0);
+            }
+        }
+        for (j = 0; j != SOCKETS; ++j) {
+            rc = nn_close (s [j]);
+            errno_assert (rc == 0);
+        }
+    }
+}
+
+static void run (void *arg)
+{
+    int i;
+    struct nn_thread threads [THREAD_COUNT];
+
+    for (i = 0; i != THREAD_COUNT; ++i)
+        nn_thread_init (&threads [i], worker, arg);
+    for (i = 0; i != THREAD_COUNT; ++i)
+        nn_thread_term (&threads [i]);
+}
+
+int main ()
+{
+    int rc;
+    int s;
+
+    /*  The library may be initialised and terminated repeatedly in between
+        as the number of sockets drops to zero. */
+    run (NULL);
+
+    /*  Same while the library stays initialised. */
+    s = nn_socket (AF_SP, NN_PAIR);
+    errno_assert (s >= 0);
+    run (NULL);
+
+    /*  Same with the sockets closed in the background. */
+    run ((void*) 1);
+    rc = nn_close (s);
+    errno_assert (rc == 0);
+
+    /*  The last socket closed in the background leaves the library
+        initialised. It's restarted by the next nn_socket. */
+    run ((void*) 1);
+    s = nn_socket (AF_SP, NN_PAIR);
+    errno_assert (s >= 0);
+    rc = nn_close (s);
+    errno_assert (rc == 0);
+
+    return 0;
+}
+
@@ -0,0 +1,79 @@
+/*
+    Copyright (c) 2013 250bpm s.r.o.
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"),
+    to deal in the Software without restriction, including without limitation
+    the rights to use, copy, modify, merge, publish, distribute, sublicense,
+    and/or sell copies of the Software, and to permit persons to whom
+    the Software is furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included
+    in all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+    THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+    FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+    IN THE SOFTWARE.
+*/
+
+#include "../src/nn.h"
+#include "../src/pair.h"
+
+#include "../src/utils/err.c"
+#include "../src/utils/sleep.c"
+
+#include <stdlib.h>
+
+/*  Test of the I/O threads spinning instead of blocking when idle. */
+
+#define SOCKET_ADDRESS "tcp://127.0.0.1:5572"
+
+int main ()
+{
+    int rc;
+    int sb;
+    int sc;
+    int i;
+    char buf [3];
+
+    putenv ("NN_CP_SPIN=2000");
+
+    /*  Connect before the peer is bound so that the connection is only
+        established by a reconnect timer firing in the spinning I/O thread. */
+    sc = nn_socket (AF_SP, NN_PAIR);
+    errno_assert (sc != -1);
+    rc = nn_connect (sc, SOCKET_ADDRESS);
+    errno_assert (rc >= 0);
+    nn_sleep (10);
+    sb = nn_socket (AF_SP, NN_PAIR);
+    errno_assert (sb != -1);
+    rc = nn_bind (sb, SOCKET_ADDRESS);
+    errno_assert (rc >= 0);
+
+    for (i = 0; i != 100; ++i) {
+        rc = nn_send (sc, "ABC", 3, 0);
+        errno_assert (rc == 3);
+        rc = nn_recv (sb, buf, sizeof (buf), 0);
+        errno_assert (rc == 3);
+        rc = nn_send (sb, "DEF", 3, 0);
+        errno_assert (rc == 3);
+        rc = nn_recv (sc, buf, sizeof (buf), 0);
+        errno_assert (rc == 3);
+
+        /*  Let the I/O threads give up spinning now and then. */
+        if (i % 10 == 0)
+            nn_sleep (5);
+    }
+
+    rc = nn_close (sc);
+    errno_assert (rc == 0);
+    rc = nn_close (sb);
+    errno_assert (rc == 0);
+
+    return 0;
+}
+
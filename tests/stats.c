@@ -0,0 +1,352 @@
+/*
+    Copyright (c) 2013 250bpm s.r.o.
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"),
+    to deal in the Software without restriction, including without limitation
+    the rights to use, copy, modify, merge, publish, distribute, sublicense,
+    and/or sell copies of the Software, and to permit persons to whom
+    the Software is furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included
+    in all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+    THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+    FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+    IN THE SOFTWARE.
+*/
+
+#include "../src/nn.h"
+#include "../src/pair.h"
+#include "../src/pubsub.h"
+#include "../src/fanout.h"
+#include "../src/fanin.h"
+
+#include "../src/utils/err.c"
+#include "../src/utils/sleep.c"
+
+#include <string.h>
+
+#define SOCKET_ADDRESS "inproc://a"
+#define SOCKET_ADDRESS_TCP "tcp://127.0.0.1:5566"
+
+int main ()
+{
+    int rc;
+    int sb;
+    int sc;
+    int timeo;
+    int i;
+    size_t sz;
+    char buf [3];
+    char body [1000];
+    struct nn_sock_stats stats;
+    struct nn_worker_stat wstats [64];
+
+    sb = nn_socket (AF_SP, NN_PAIR);
+    errno_assert (sb != -1);
+    rc = nn_bind (sb, SOCKET_ADDRESS_TCP);
+    errno_assert (rc >= 0);
+    sc = nn_socket (AF_SP, NN_PAIR);
+    errno_assert (sc != -1);
+    rc = nn_connect (sc, SOCKET_ADDRESS_TCP);
+    errno_assert (rc >= 0);
+    nn_sleep (10);
+
+    /*  All the counters start at zero. */
+    sz = sizeof (stats);
+    rc = nn_getsockopt (sc, NN_SOL_SOCKET, NN_STATS, &stats, &sz);
+    errno_assert (rc == 0);
+    nn_assert (sz == sizeof (stats));
+    nn_assert (stats.sent == 0 && stats.received == 0);
+    nn_assert (stats.sndblocked == 0 && stats.rcvblocked == 0);
+    nn_assert (stats.connects == 1 && stats.disconnects == 0);
+
+    /*  The statistics can't be set. */
+    timeo = 0;
+    rc = nn_setsockopt (sc, NN_SOL_SOCKET, NN_STATS, &timeo, sizeof (timeo));
+    nn_assert (rc < 0 && nn_errno () == ENOPROTOOPT);
+
+    rc = nn_send (sc, "ABC", 3, 0);
+    errno_assert (rc == 3);
+    rc = nn_send (sc, "DE", 2, 0);
+    errno_assert (rc == 2);
+    rc = nn_recv (sb, buf, sizeof (buf), 0);
+    errno_assert (rc == 3);
+    rc = nn_recv (sb, buf, sizeof (buf), 0);
+    errno_assert (rc == 2);
+
+    sz = sizeof (stats);
+    rc = nn_getsockopt (sc, NN_SOL_SOCKET, NN_STATS, &stats, &sz);
+    errno_assert (rc == 0);
+    nn_assert (stats.sent == 2 && stats.sentbytes == 5);
+    nn_assert (stats.received == 0 && stats.receivedbytes == 0);
+    sz = sizeof (stats);
+    rc = nn_getsockopt (sb, NN_SOL_SOCKET, NN_STATS, &stats, &sz);
+    errno_assert (rc == 0);
+    nn_assert (stats.sent == 0 && stats.sentbytes == 0);
+    nn_assert (stats.received == 2 && stats.receivedbytes == 5);
+    nn_assert (stats.connects == 1 && stats.disconnects == 0);
+
+    /*  The I/O thread has been waiting for the messages and then reading
+        them. */
+    nn_assert (stats.iowait > 0 && stats.io > 0);
+
+    /*  There's at least one thread in the worker pool. */
+    rc = nn_workerstats (wstats, 64);
+    errno_assert (rc >= 1);
+    rc = nn_workerstats (NULL, 1);
+    nn_assert (rc < 0 && nn_errno () == EINVAL);
+
+    /*  Time spent waiting for a message is accounted for. */
+    timeo = 50;
+    rc = nn_setsockopt (sb, NN_SOL_SOCKET, NN_RCVTIMEO, &timeo, sizeof (timeo));
+    errno_assert (rc == 0);
+    rc = nn_recv (sb, buf, sizeof (buf), 0);
+    nn_assert (rc < 0 && nn_errno () == EAGAIN);
+    sz = sizeof (stats);
+    rc = nn_getsockopt (sb, NN_SOL_SOCKET, NN_STATS, &stats, &sz);
+    errno_assert (rc == 0);
+    nn_assert (stats.rcvblocked >= 40000);
+
+    /*  Broken connections are counted. */
+    rc = nn_close (sc);
+    errno_assert (rc == 0);
+    nn_sleep (100);
+    sz = sizeof (stats);
+    rc = nn_getsockopt (sb, NN_SOL_SOCKET, NN_STATS, &stats, &sz);
+    errno_assert (rc == 0);
+    nn_assert (stats.connects == 1 && stats.disconnects == 1);
+
+    rc = nn_close (sb);
+    errno_assert (rc == 0);
+
+    /*  Messages dropped by a slow subscriber are counted. */
+    sb = nn_socket (AF_SP, NN_PUB);
+    errno_assert (sb != -1);
+    rc = nn_bind (sb, SOCKET_ADDRESS);
+    errno_assert (rc >= 0);
+    sc = nn_socket (AF_SP, NN_SUB);
+    errno_assert (sc != -1);
+    rc = nn_setsockopt (sc, NN_SUB, NN_SUB_SUBSCRIBE, "", 0);
+    errno_assert (rc == 0);
+    timeo = 1;
+    rc = nn_setsockopt (sc, NN_SOL_SOCKET, NN_RCVBUFMSGS, &timeo,
+        sizeof (timeo));
+    errno_assert (rc == 0);
+    rc = nn_connect (sc, SOCKET_ADDRESS);
+    errno_assert (rc >= 0);
+    nn_sleep (10);
+    rc = nn_send (sb, "ABC", 3, 0);
+    errno_assert (rc == 3);
+    rc = nn_send (sb, "ABC", 3, 0);
+    errno_assert (rc == 3);
+    rc = nn_send (sb, "ABC", 3, 0);
+    errno_assert (rc == 3);
+    sz = sizeof (stats);
+    rc = nn_getsockopt (sb, NN_SOL_SOCKET, NN_STATS, &stats, &sz);
+    errno_assert (rc == 0);
+    nn_assert (stats.sent == 3 && stats.sentbytes == 9);
+    nn_assert (stats.dropped > 0 && stats.droppedbytes == 3 * stats.dropped);
+
+    rc = nn_close (sc);
+    errno_assert (rc == 0);
+    rc = nn_close (sb);
+    errno_assert (rc == 0);
+
+    /*  Messages held by the pipes draw from the memory budget. Once it's
+        exhausted, the pipes stop accepting messages from the user until
+        the peer catches up. */
+    sc = nn_socket (AF_SP, NN_PUSH);
+    errno_assert (sc != -1);
+    timeo = -1;
+    rc = nn_setsockopt (sc, NN_SOL_SOCKET, NN_MEMBUDGET, &timeo,
+        sizeof (timeo));
+    nn_assert (rc < 0 && nn_errno () == EINVAL);
+    timeo = 2000;
+    rc = nn_setsockopt (sc, NN_SOL_SOCKET, NN_MEMBUDGET, &timeo,
+        sizeof (timeo));
+    errno_assert (rc == 0);
+    sz = sizeof (timeo);
+    rc = nn_getsockopt (sc, NN_SOL_SOCKET, NN_MEMBUDGET, &timeo, &sz);
+    errno_assert (rc == 0);
+    nn_assert (sz == sizeof (timeo) && timeo == 2000);
+    rc = nn_bind (sc, SOCKET_ADDRESS_TCP);
+    errno_assert (rc >= 0);
+    sb = nn_socket (AF_SP, NN_PULL);
+    errno_assert (sb != -1);
+    rc = nn_connect (sb, SOCKET_ADDRESS_TCP);
+    errno_assert (rc >= 0);
+    nn_sleep (10);
+    memset (body, 'A', sizeof (body));
+    for (i = 0; ; ++i) {
+        rc = nn_send (sc, body, sizeof (body), NN_DONTWAIT);
+        if (rc < 0) {
+            nn_assert (nn_errno () == EAGAIN);
+            break;
+        }
+        errno_assert (rc == sizeof (body));
+    }
+    sz = sizeof (stats);
+    rc = nn_getsockopt (sc, NN_SOL_SOCKET, NN_STATS, &stats, &sz);
+    errno_assert (rc == 0);
+    nn_assert (stats.memused <= 2000 + sizeof (body));
+    nn_assert (stats.memwaits > 0);
+    for (; i != 0; --i) {
+        rc = nn_recv (sb, body, sizeof (body), 0);
+        errno_assert (rc == sizeof (body));
+    }
+    rc = nn_send (sc, body, sizeof (body), 0);
+    errno_assert (rc == sizeof (body));
+    rc = nn_recv (sb, body, sizeof (body), 0);
+    errno_assert (rc == sizeof (body));
+    sz = sizeof (stats);
+    rc = nn_getsockopt (sc, NN_SOL_SOCKET, NN_STATS, &stats, &sz);
+    errno_assert (rc == 0);
+    nn_assert (stats.memused == 0);
+
+    rc = nn_close (sc);
+    errno_assert (rc == 0);
+    rc = nn_close (sb);
+    errno_assert (rc == 0);
+
+    /*  Messages that outlive their time-to-live are dropped before being
+        passed to the user, both within the process and over the network.
+        The time the messages wait in the kernel buffers is accounted for
+        once the incoming data are timestamped. */
+    for (i = 0; i != 2; ++i) {
+        sc = nn_socket (AF_SP, NN_SOURCE);
+        errno_assert (sc != -1);
+        rc = nn_bind (sc, i ? SOCKET_ADDRESS_TCP : SOCKET_ADDRESS);
+        errno_assert (rc >= 0);
+        sb = nn_socket (AF_SP, NN_SINK);
+        errno_assert (sb != -1);
+        timeo = 1;
+        rc = nn_setsockopt (sb, NN_SOL_SOCKET, NN_RCVTIMESTAMP, &timeo,
+            sizeof (timeo));
+        errno_assert (rc == 0);
+        rc = nn_connect (sb, i ? SOCKET_ADDRESS_TCP : SOCKET_ADDRESS);
+        errno_assert (rc >= 0);
+
+        /*  Make sure the peers are connected before the clock starts. */
+        rc = nn_send (sc, "F", 1, 0);
+        errno_assert (rc == 1);
+        rc = nn_recv (sb, buf, sizeof (buf), 0);
+        errno_assert (rc == 1);
+
+        timeo = 10;
+        rc = nn_setsockopt (sc, NN_SOL_SOCKET, NN_SNDTTL, &timeo,
+            sizeof (timeo));
+        errno_assert (rc == 0);
+        sz = sizeof (timeo);
+        rc = nn_getsockopt (sc, NN_SOL_SOCKET, NN_SNDTTL, &timeo, &sz);
+        errno_assert (rc == 0);
+        nn_assert (sz == sizeof (timeo) && timeo == 10);
+        rc = nn_send (sc, "ABC", 3, 0);
+        errno_assert (rc == 3);
+        nn_sleep (100);
+        timeo = -1;
+        rc = nn_setsockopt (sc, NN_SOL_SOCKET, NN_SNDTTL, &timeo,
+            sizeof (timeo));
+        errno_assert (rc == 0);
+        rc = nn_send (sc, "DE", 2, 0);
+        errno_assert (rc == 2);
+        rc = nn_recv (sb, buf, sizeof (buf), 0);
+        errno_assert (rc == 2);
+        sz = sizeof (stats);
+        rc = nn_getsockopt (sb, NN_SOL_SOCKET, NN_STATS, &stats, &sz);
+        errno_assert (rc == 0);
+        nn_assert (stats.received == 2 && stats.receivedbytes == 3);
+        nn_assert (stats.expired == 1 && stats.expiredbytes == 3);
+        rc = nn_close (sc);
+        errno_assert (rc == 0);
+        rc = nn_close (sb);
+        errno_assert (rc == 0);
+    }
+
+    /*  The queue management policy can be used only with the socket types
+        that tolerate their messages being dropped. */
+    sb = nn_socket (AF_SP, NN_PULL);
+    errno_assert (sb != -1);
+    sz = sizeof (timeo);
+    rc = nn_getsockopt (sb, NN_SOL_SOCKET, NN_CODEL_TARGET, &timeo, &sz);
+    errno_assert (rc == 0);
+    nn_assert (timeo == -1);
+    sz = sizeof (timeo);
+    rc = nn_getsockopt (sb, NN_SOL_SOCKET, NN_CODEL_INTERVAL, &timeo, &sz);
+    errno_assert (rc == 0);
+    nn_assert (timeo == 100);
+    timeo = 5;
+    rc = nn_setsockopt (sb, NN_SOL_SOCKET, NN_CODEL_TARGET, &timeo,
+        sizeof (timeo));
+    nn_assert (rc == -1 && nn_errno () == ENOTSUP);
+    timeo = 0;
+    rc = nn_setsockopt (sb, NN_SOL_SOCKET, NN_CODEL_INTERVAL, &timeo,
+        sizeof (timeo));
+    nn_assert (rc == -1 && nn_errno () == EINVAL);
+    rc = nn_close (sb);
+    errno_assert (rc == 0);
+
+    /*  Once the messages have been queued for longer than the target for
+        a whole interval, the receiving side starts dropping them, both
+        in the queue of a single pipe and in the ring shared by the inproc
+        subscribers. The last message in the queue is never dropped. */
+    for (i = 0; i != 2; ++i) {
+        sc = nn_socket (AF_SP, i ? NN_PUB : NN_PUSH);
+        errno_assert (sc != -1);
+        timeo = -2;
+        rc = nn_setsockopt (sc, NN_SOL_SOCKET, NN_CODEL_TARGET, &timeo,
+            sizeof (timeo));
+        nn_assert (rc == -1 && nn_errno () == EINVAL);
+        timeo = 0;
+        rc = nn_setsockopt (sc, NN_SOL_SOCKET, NN_CODEL_TARGET, &timeo,
+            sizeof (timeo));
+        errno_assert (rc == 0);
+        timeo = 10;
+        rc = nn_setsockopt (sc, NN_SOL_SOCKET, NN_CODEL_INTERVAL, &timeo,
+            sizeof (timeo));
+        errno_assert (rc == 0);
+        rc = nn_bind (sc, SOCKET_ADDRESS);
+        errno_assert (rc >= 0);
+        sb = nn_socket (AF_SP, i ? NN_SUB : NN_PULL);
+        errno_assert (sb != -1);
+        if (i) {
+            rc = nn_setsockopt (sb, NN_SUB, NN_SUB_SUBSCRIBE, "", 0);
+            errno_assert (rc == 0);
+        }
+        rc = nn_connect (sb, SOCKET_ADDRESS);
+        errno_assert (rc >= 0);
+        nn_sleep (10);
+        for (timeo = 0; timeo != 10; ++timeo) {
+            rc = nn_send (sc, "ABC", 3, 0);
+            errno_assert (rc == 3);
+        }
+        nn_sleep (50);
+        rc = nn_recv (sb, buf, sizeof (buf), 0);
+        errno_assert (rc == 3);
+        nn_sleep (20);
+        for (timeo = 1; ; ++timeo) {
+            rc = nn_recv (sb, buf, sizeof (buf), NN_DONTWAIT);
+            if (rc < 0)
+                break;
+            errno_assert (rc == 3);
+        }
+        nn_assert (nn_errno () == EAGAIN);
+        sz = sizeof (stats);
+        rc = nn_getsockopt (sb, NN_SOL_SOCKET, NN_STATS, &stats, &sz);
+        errno_assert (rc == 0);
+        nn_assert (stats.shed >= 1 && stats.shedbytes == stats.shed * 3);
+        nn_assert (stats.received == (unsigned long long) timeo);
+        nn_assert (stats.received + stats.shed == 10);
+        rc = nn_close (sc);
+        errno_assert (rc == 0);
+        rc = nn_close (sb);
+        errno_assert (rc == 0);
+    }
+
+    return 0;
+}
@@ -24,8 +24,14 @@
 #include "../src/survey.h"
 
 #include "../src/utils/err.c"
+#include "../src/utils/sleep.c"
+#include "../src/utils/wire.c"
+
+#include <string.h>
 
 #define SOCKET_ADDRESS "inproc://a"
+#define SOCKET_ADDRESS_B "inproc://b"
+#define SOCKET_ADDRESS_C "inproc://c"
 
 int main ()
 {
@@ -35,7 +41,24 @@ int main ()
     int respondent2;
     int respondent3;
     int deadline;
+    int batch;
+    int quorum;
+    int concurrent;
+    struct nn_latency_stats stats;
+    size_t sz;
+    int counts [2];
+    char tag [4];
+    struct nn_msghdr hdr;
+    int i;
     char buf [7];
+    char bufs [4][7];
+    struct nn_iovec iov [4];
+    struct nn_mmsghdr hdrs [4];
+    int xrespondent;
+    int xsurveyor;
+    int reduce;
+    uint8_t val [8];
+    char id [4];
 
     /*  Test a simple survey with three respondents. */
     surveyor = nn_socket (AF_SP, NN_SURVEYOR);
@@ -118,6 +141,447 @@ int main ()
     rc = nn_close (respondent3);
     errno_assert (rc == 0);
 
+    /*  Test the batch mode. The responses are received at once after
+        the requested number of them is collected. */
+    surveyor = nn_socket (AF_SP, NN_SURVEYOR);
+    errno_assert (surveyor != -1);
+    deadline = 500;
+    rc = nn_setsockopt (surveyor, NN_SURVEYOR, NN_SURVEYOR_DEADLINE,
+        &deadline, sizeof (deadline));
+    errno_assert (rc == 0);
+    batch = 2;
+    rc = nn_setsockopt (surveyor, NN_SURVEYOR, NN_SURVEYOR_BATCH,
+        &batch, sizeof (batch));
+    errno_assert (rc == 0);
+    rc = nn_bind (surveyor, SOCKET_ADDRESS);
+    errno_assert (rc >= 0);
+    respondent1 = nn_socket (AF_SP, NN_RESPONDENT);
+    errno_assert (respondent1 != -1);
+    rc = nn_connect (respondent1, SOCKET_ADDRESS);
+    errno_assert (rc >= 0);
+    respondent2 = nn_socket (AF_SP, NN_RESPONDENT);
+    errno_assert (respondent2 != -1);
+    rc = nn_connect (respondent2, SOCKET_ADDRESS);
+    errno_assert (rc >= 0);
+    respondent3 = nn_socket (AF_SP, NN_RESPONDENT);
+    errno_assert (respondent3 != -1);
+    rc = nn_connect (respondent3, SOCKET_ADDRESS);
+    errno_assert (rc >= 0);
+
+    rc = nn_send (surveyor, "ABC", 3, 0);
+    errno_assert (rc == 3);
+    rc = nn_recv (respondent1, buf, sizeof (buf), 0);
+    errno_assert (rc == 3);
+    rc = nn_send (respondent1, "DEF", 3, 0);
+    errno_assert (rc == 3);
+    rc = nn_recv (respondent2, buf, sizeof (buf), 0);
+    errno_assert (rc == 3);
+
+    /*  A single response is held back. */
+    rc = nn_recv (surveyor, buf, sizeof (buf), NN_DONTWAIT);
+    errno_assert (rc == -1 && nn_errno () == EAGAIN);
+
+    rc = nn_send (respondent2, "DEF", 3, 0);
+    errno_assert (rc == 3);
+    memset (hdrs, 0, sizeof (hdrs));
+    for (i = 0; i != 4; ++i) {
+        iov [i].iov_base = bufs [i];
+        iov [i].iov_len = sizeof (bufs [i]);
+        hdrs [i].msg_hdr.msg_iov = &iov [i];
+        hdrs [i].msg_hdr.msg_iovlen = 1;
+    }
+    rc = nn_recvmmsg (surveyor, hdrs, 4, 0);
+    errno_assert (rc == 2);
+    nn_assert (hdrs [0].msg_len == 3 && hdrs [1].msg_len == 3);
+
+    /*  Once released, further responses are received straight away. */
+    rc = nn_recv (respondent3, buf, sizeof (buf), 0);
+    errno_assert (rc == 3);
+    rc = nn_send (respondent3, "GHI", 3, 0);
+    errno_assert (rc == 3);
+    rc = nn_recv (surveyor, buf, sizeof (buf), 0);
+    errno_assert (rc == 3);
+    nn_assert (memcmp (buf, "GHI", 3) == 0);
+    rc = nn_recv (surveyor, buf, sizeof (buf), 0);
+    errno_assert (rc == -1 && nn_errno () == EFSM);
+
+    /*  If there are not enough responses, they are released at
+        the deadline. */
+    batch = 10;
+    rc = nn_setsockopt (surveyor, NN_SURVEYOR, NN_SURVEYOR_BATCH,
+        &batch, sizeof (batch));
+    errno_assert (rc == 0);
+    rc = nn_send (surveyor, "ABC", 3, 0);
+    errno_assert (rc == 3);
+    rc = nn_recv (respondent1, buf, sizeof (buf), 0);
+    errno_assert (rc == 3);
+    rc = nn_send (respondent1, "DEF", 3, 0);
+    errno_assert (rc == 3);
+    rc = nn_recv (respondent2, buf, sizeof (buf), 0);
+    errno_assert (rc == 3);
+    rc = nn_send (respondent2, "DEF", 3, 0);
+    errno_assert (rc == 3);
+    rc = nn_recvmmsg (surveyor, hdrs, 4, 0);
+    errno_assert (rc == 2);
+    rc = nn_recv (surveyor, buf, sizeof (buf), 0);
+    errno_assert (rc == -1 && nn_errno () == EFSM);
+
+    rc = nn_close (surveyor);
+    errno_assert (rc == 0);
+    rc = nn_close (respondent1);
+    errno_assert (rc == 0);
+    rc = nn_close (respondent2);
+    errno_assert (rc == 0);
+    rc = nn_close (respondent3);
+    errno_assert (rc == 0);
+
+    /*  Test quorum. The survey is over as soon as enough responses arrive,
+        way before the deadline. */
+    surveyor = nn_socket (AF_SP, NN_SURVEYOR);
+    errno_assert (surveyor != -1);
+    deadline = 60000;
+    rc = nn_setsockopt (surveyor, NN_SURVEYOR, NN_SURVEYOR_DEADLINE,
+        &deadline, sizeof (deadline));
+    errno_assert (rc == 0);
+    quorum = 2;
+    rc = nn_setsockopt (surveyor, NN_SURVEYOR, NN_SURVEYOR_QUORUM,
+        &quorum, sizeof (quorum));
+    errno_assert (rc == 0);
+    rc = nn_bind (surveyor, SOCKET_ADDRESS);
+    errno_assert (rc >= 0);
+    respondent1 = nn_socket (AF_SP, NN_RESPONDENT);
+    errno_assert (respondent1 != -1);
+    rc = nn_connect (respondent1, SOCKET_ADDRESS);
+    errno_assert (rc >= 0);
+    respondent2 = nn_socket (AF_SP, NN_RESPONDENT);
+    errno_assert (respondent2 != -1);
+    rc = nn_connect (respondent2, SOCKET_ADDRESS);
+    errno_assert (rc >= 0);
+    respondent3 = nn_socket (AF_SP, NN_RESPONDENT);
+    errno_assert (respondent3 != -1);
+    rc = nn_connect (respondent3, SOCKET_ADDRESS);
+    errno_assert (rc >= 0);
+
+    for (i = 0; i != 2; ++i) {
+        rc = nn_send (surveyor, "ABC", 3, 0);
+        errno_assert (rc == 3);
+        rc = nn_recv (respondent1, buf, sizeof (buf), 0);
+        errno_assert (rc == 3);
+        rc = nn_send (respondent1, "DEF", 3, 0);
+        errno_assert (rc == 3);
+        rc = nn_recv (respondent2, buf, sizeof (buf), 0);
+        errno_assert (rc == 3);
+        rc = nn_send (respondent2, "DEF", 3, 0);
+        errno_assert (rc == 3);
+        rc = nn_recv (respondent3, buf, sizeof (buf), 0);
+        errno_assert (rc == 3);
+        rc = nn_recv (surveyor, buf, sizeof (buf), 0);
+        errno_assert (rc == 3);
+        nn_assert (memcmp (buf, "DEF", 3) == 0);
+        rc = nn_recv (surveyor, buf, sizeof (buf), 0);
+        errno_assert (rc == 3);
+        nn_assert (memcmp (buf, "DEF", 3) == 0);
+        rc = nn_recv (surveyor, buf, sizeof (buf), 0);
+        errno_assert (rc == -1 && nn_errno () == EFSM);
+
+        /*  The late response is not delivered as a response to the next
+            survey. */
+        rc = nn_send (respondent3, "GHI", 3, 0);
+        errno_assert (rc == 3);
+    }
+
+    rc = nn_close (surveyor);
+    errno_assert (rc == 0);
+    rc = nn_close (respondent1);
+    errno_assert (rc == 0);
+    rc = nn_close (respondent2);
+    errno_assert (rc == 0);
+    rc = nn_close (respondent3);
+    errno_assert (rc == 0);
+
+    /*  Test concurrent surveys. Each response carries the header of
+        the survey it belongs to. */
+    surveyor = nn_socket (AF_SP, NN_SURVEYOR);
+    errno_assert (surveyor != -1);
+    deadline = 200;
+    rc = nn_setsockopt (surveyor, NN_SURVEYOR, NN_SURVEYOR_DEADLINE,
+        &deadline, sizeof (deadline));
+    errno_assert (rc == 0);
+    concurrent = 2;
+    rc = nn_setsockopt (surveyor, NN_SURVEYOR, NN_SURVEYOR_CONCURRENT,
+        &concurrent, sizeof (concurrent));
+    errno_assert (rc == 0);
+    rc = nn_bind (surveyor, SOCKET_ADDRESS);
+    errno_assert (rc >= 0);
+    respondent1 = nn_socket (AF_SP, NN_RESPONDENT);
+    errno_assert (respondent1 != -1);
+    rc = nn_connect (respondent1, SOCKET_ADDRESS);
+    errno_assert (rc >= 0);
+    respondent2 = nn_socket (AF_SP, NN_RESPONDENT);
+    errno_assert (respondent2 != -1);
+    rc = nn_connect (respondent2, SOCKET_ADDRESS);
+    errno_assert (rc >= 0);
+
+    for (i = 0; i != 2; ++i) {
+        tag [0] = 'a' + i;
+        iov [0].iov_base = "ABC";
+        iov [0].iov_len = 3;
+        memset (&hdr, 0, sizeof (hdr));
+        hdr.msg_iov = iov;
+        hdr.msg_iovlen = 1;
+        hdr.msg_control = tag;
+        hdr.msg_controllen = 1;
+        rc = nn_sendmsg (surveyor, &hdr, 0);
+        errno_assert (rc == 3);
+    }
+    rc = nn_send (surveyor, "ABC", 3, NN_DONTWAIT);
+    errno_assert (rc == -1 && nn_errno () == EAGAIN);
+
+    for (i = 0; i != 2; ++i) {
+        rc = nn_recv (respondent1, buf, sizeof (buf), 0);
+        errno_assert (rc == 3);
+        rc = nn_send (respondent1, "DEF", 3, 0);
+        errno_assert (rc == 3);
+        rc = nn_recv (respondent2, buf, sizeof (buf), 0);
+        errno_assert (rc == 3);
+        rc = nn_send (respondent2, "DEF", 3, 0);
+        errno_assert (rc == 3);
+    }
+
+    counts [0] = 0;
+    counts [1] = 0;
+    for (i = 0; i != 4; ++i) {
+        iov [0].iov_base = buf;
+        iov [0].iov_len = sizeof (buf);
+        memset (&hdr, 0, sizeof (hdr));
+        hdr.msg_iov = iov;
+        hdr.msg_iovlen = 1;
+        hdr.msg_control = tag;
+        hdr.msg_controllen = sizeof (tag);
+        rc = nn_recvmsg (surveyor, &hdr, 0);
+        errno_assert (rc == 3);
+        nn_assert (hdr.msg_controllen == 1);
+        nn_assert (tag [0] == 'a' || tag [0] == 'b');
+        ++counts [tag [0] - 'a'];
+    }
+    nn_assert (counts [0] == 2 && counts [1] == 2);
+
+    /*  Both surveys end at their deadlines. */
+    rc = nn_recv (surveyor, buf, sizeof (buf), 0);
+    errno_assert (rc == -1 && nn_errno () == EFSM);
+
+    rc = nn_close (surveyor);
+    errno_assert (rc == 0);
+    rc = nn_close (respondent1);
+    errno_assert (rc == 0);
+    rc = nn_close (respondent2);
+    errno_assert (rc == 0);
+
+    /*  Test the aggregation of the responses in a device. The responses are
+        forwarded by hand here, the way nn_device would do it. */
+    surveyor = nn_socket (AF_SP, NN_SURVEYOR);
+    errno_assert (surveyor != -1);
+    rc = nn_bind (surveyor, SOCKET_ADDRESS);
+    errno_assert (rc >= 0);
+    xrespondent = nn_socket (AF_SP_RAW, NN_RESPONDENT);
+    errno_assert (xrespondent != -1);
+    rc = nn_connect (xrespondent, SOCKET_ADDRESS);
+    errno_assert (rc >= 0);
+    xsurveyor = nn_socket (AF_SP_RAW, NN_SURVEYOR);
+    errno_assert (xsurveyor != -1);
+    reduce = 42;
+    rc = nn_setsockopt (xsurveyor, NN_SURVEYOR, NN_SURVEYOR_REDUCE,
+        &reduce, sizeof (reduce));
+    errno_assert (rc == -1 && nn_errno () == EINVAL);
+    reduce = NN_SURVEYOR_REDUCE_SUM;
+    rc = nn_setsockopt (xsurveyor, NN_SURVEYOR, NN_SURVEYOR_REDUCE,
+        &reduce, sizeof (reduce));
+    errno_assert (rc == 0);
+    deadline = 200;
+    rc = nn_setsockopt (xsurveyor, NN_SURVEYOR, NN_SURVEYOR_DEADLINE,
+        &deadline, sizeof (deadline));
+    errno_assert (rc == 0);
+    rc = nn_bind (xsurveyor, SOCKET_ADDRESS_B);
+    errno_assert (rc >= 0);
+    respondent1 = nn_socket (AF_SP, NN_RESPONDENT);
+    errno_assert (respondent1 != -1);
+    rc = nn_connect (respondent1, SOCKET_ADDRESS_B);
+    errno_assert (rc >= 0);
+    respondent2 = nn_socket (AF_SP, NN_RESPONDENT);
+    errno_assert (respondent2 != -1);
+    rc = nn_connect (respondent2, SOCKET_ADDRESS_B);
+    errno_assert (rc >= 0);
+    respondent3 = nn_socket (AF_SP, NN_RESPONDENT);
+    errno_assert (respondent3 != -1);
+    rc = nn_connect (respondent3, SOCKET_ADDRESS_B);
+    errno_assert (rc >= 0);
+    nn_sleep (10);
+
+    for (i = 0; i != 2; ++i) {
+        rc = nn_send (surveyor, "ABC", 3, 0);
+        errno_assert (rc == 3);
+        iov [0].iov_base = buf;
+        iov [0].iov_len = sizeof (buf);
+        memset (&hdr, 0, sizeof (hdr));
+        hdr.msg_iov = iov;
+        hdr.msg_iovlen = 1;
+        hdr.msg_control = id;
+        hdr.msg_controllen = sizeof (id);
+        rc = nn_recvmsg (xrespondent, &hdr, 0);
+        errno_assert (rc == 3);
+        nn_assert (hdr.msg_controllen == sizeof (id));
+        iov [0].iov_len = 3;
+        rc = nn_sendmsg (xsurveyor, &hdr, 0);
+        errno_assert (rc == 3);
+
+        /*  In the first round all the respondents answer and the sum goes
+            upwards straight away. In the second one, the third respondent
+            keeps silent and the sum goes upwards at the deadline. */
+        rc = nn_recv (respondent1, buf, sizeof (buf), 0);
+        errno_assert (rc == 3);
+        nn_putll (val, 1);
+        rc = nn_send (respondent1, val, sizeof (val), 0);
+        errno_assert (rc == sizeof (val));
+        rc = nn_recv (respondent2, buf, sizeof (buf), 0);
+        errno_assert (rc == 3);
+        nn_putll (val, 20);
+        rc = nn_send (respondent2, val, sizeof (val), 0);
+        errno_assert (rc == sizeof (val));
+        rc = nn_recv (respondent3, buf, sizeof (buf), 0);
+        errno_assert (rc == 3);
+        if (i == 0) {
+            nn_putll (val, 300);
+            rc = nn_send (respondent3, val, sizeof (val), 0);
+            errno_assert (rc == sizeof (val));
+        }
+
+        iov [0].iov_base = val;
+        iov [0].iov_len = sizeof (val);
+        hdr.msg_controllen = sizeof (id);
+        rc = nn_recvmsg (xsurveyor, &hdr, 0);
+        errno_assert (rc == sizeof (val));
+        nn_assert (nn_getll (val) == (i == 0 ? 321 : 21));
+        rc = nn_sendmsg (xrespondent, &hdr, 0);
+        errno_assert (rc == sizeof (val));
+        rc = nn_recv (surveyor, val, sizeof (val), 0);
+        errno_assert (rc == sizeof (val));
+        nn_assert (nn_getll (val) == (i == 0 ? 321 : 21));
+    }
+
+    /*  The late response to the second survey is dropped. */
+    nn_putll (val, 300);
+    rc = nn_send (respondent3, val, sizeof (val), 0);
+    errno_assert (rc == sizeof (val));
+    rc = nn_recv (xsurveyor, val, sizeof (val), NN_DONTWAIT);
+    errno_assert (rc == -1 && nn_errno () == EAGAIN);
+
+    rc = nn_close (surveyor);
+    errno_assert (rc == 0);
+    rc = nn_close (xrespondent);
+    errno_assert (rc == 0);
+    rc = nn_close (xsurveyor);
+    errno_assert (rc == 0);
+    rc = nn_close (respondent1);
+    errno_assert (rc == 0);
+    rc = nn_close (respondent2);
+    errno_assert (rc == 0);
+    rc = nn_close (respondent3);
+    errno_assert (rc == 0);
+
+    /*  Test the response latency statistics. */
+    surveyor = nn_socket (AF_SP, NN_SURVEYOR);
+    errno_assert (surveyor != -1);
+    rc = nn_bind (surveyor, SOCKET_ADDRESS);
+    errno_assert (rc >= 0);
+    respondent1 = nn_socket (AF_SP, NN_RESPONDENT);
+    errno_assert (respondent1 != -1);
+    rc = nn_connect (respondent1, SOCKET_ADDRESS);
+    errno_assert (rc >= 0);
+    nn_sleep (10);
+
+    rc = nn_send (surveyor, "ABC", 3, 0);
+    errno_assert (rc == 3);
+    rc = nn_recv (respondent1, buf, sizeof (buf), 0);
+    errno_assert (rc == 3);
+    nn_sleep (50);
+    rc = nn_send (respondent1, "DEF", 3, 0);
+    errno_assert (rc == 3);
+    rc = nn_recv (surveyor, buf, sizeof (buf), 0);
+    errno_assert (rc == 3);
+
+    sz = sizeof (stats);
+    rc = nn_getsockopt (surveyor, NN_SURVEYOR, NN_SURVEYOR_LATENCY, &stats,
+        &sz);
+    errno_assert (rc == 0);
+    nn_assert (sz == sizeof (stats));
+    nn_assert (stats.count == 1);
+    nn_assert (stats.min == stats.max && stats.p50 == stats.max);
+    nn_assert (stats.max >= 40000);
+
+    rc = nn_close (surveyor);
+    errno_assert (rc == 0);
+    rc = nn_close (respondent1);
+    errno_assert (rc == 0);
+
+    /*  Test the cache of the surveys received lately. A resent survey is
+        answered with the cached response, without being passed to
+        the user. */
+    xsurveyor = nn_socket (AF_SP_RAW, NN_SURVEYOR);
+    errno_assert (xsurveyor != -1);
+    rc = nn_bind (xsurveyor, SOCKET_ADDRESS_C);
+    errno_assert (rc >= 0);
+    respondent1 = nn_socket (AF_SP, NN_RESPONDENT);
+    errno_assert (respondent1 != -1);
+    i = 4;
+    rc = nn_setsockopt (respondent1, NN_RESPONDENT, NN_RESPONDENT_DEDUP, &i,
+        sizeof (i));
+    errno_assert (rc == 0);
+    sz = sizeof (i);
+    rc = nn_getsockopt (respondent1, NN_RESPONDENT, NN_RESPONDENT_DEDUP, &i,
+        &sz);
+    errno_assert (rc == 0);
+    nn_assert (sz == sizeof (i) && i == 4);
+    deadline = 100;
+    rc = nn_setsockopt (respondent1, NN_SOL_SOCKET, NN_RCVTIMEO, &deadline,
+        sizeof (deadline));
+    errno_assert (rc == 0);
+    rc = nn_connect (respondent1, SOCKET_ADDRESS_C);
+    errno_assert (rc >= 0);
+    nn_sleep (10);
+
+    memcpy (id, "\0\0\0\x07", 4);
+    for (i = 0; i != 2; ++i) {
+        iov [0].iov_base = "ABC";
+        iov [0].iov_len = 3;
+        memset (&hdr, 0, sizeof (hdr));
+        hdr.msg_iov = iov;
+        hdr.msg_iovlen = 1;
+        hdr.msg_control = id;
+        hdr.msg_controllen = sizeof (id);
+        rc = nn_sendmsg (xsurveyor, &hdr, 0);
+        errno_assert (rc == 3);
+        rc = nn_recv (respondent1, buf, sizeof (buf), 0);
+        if (i == 0) {
+            errno_assert (rc == 3);
+            rc = nn_send (respondent1, "XYZ", 3, 0);
+            errno_assert (rc == 3);
+        }
+        else
+            nn_assert (rc == -1 &&
+                (nn_errno () == EAGAIN || nn_errno () == ETIMEDOUT));
+        iov [0].iov_base = buf;
+        iov [0].iov_len = sizeof (buf);
+        rc = nn_recvmsg (xsurveyor, &hdr, 0);
+        errno_assert (rc == 3);
+        nn_assert (memcmp (buf, "XYZ", 3) == 0);
+        nn_assert (memcmp (id, "\0\0\0\x07", 4) == 0);
+    }
+
+    rc = nn_close (xsurveyor);
+    errno_assert (rc == 0);
+    rc = nn_close (respondent1);
+    errno_assert (rc == 0);
+
     return 0;
 }
 
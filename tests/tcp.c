@@ -23,34 +23,479 @@
 #include "../src/nn.h"
 #include "../src/pair.h"
 #include "../src/pubsub.h"
+#include "../src/fanin.h"
+#include "../src/fanout.h"
+#include "../src/reqrep.h"
 #include "../src/tcp.h"
 
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+
 #include "../src/utils/err.c"
 #include "../src/utils/sleep.c"
 
+#if !defined NN_HAVE_WINDOWS
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+#endif
+
 /*  Tests TCP transport. */
 
 #define SOCKET_ADDRESS "tcp://127.0.0.1:5555"
 
+/*  Receive buffers of the application, handed out by the allocator used with
+    NN_RCVALLOC. */
+#define TEST_RCVBUFS 2
+static char test_rcvbufs [TEST_RCVBUFS][8192];
+static int test_rcvused [TEST_RCVBUFS];
+
+static void *test_rcvalloc (size_t size)
+{
+    int i;
+
+    for (i = 0; i != TEST_RCVBUFS; ++i) {
+        if (!test_rcvused [i] && size <= sizeof (test_rcvbufs [i])) {
+            test_rcvused [i] = 1;
+            return test_rcvbufs [i];
+        }
+    }
+    return NULL;
+}
+
+static void test_rcvfree (void *ptr)
+{
+    int i;
+
+    for (i = 0; i != TEST_RCVBUFS; ++i)
+        if (ptr == test_rcvbufs [i])
+            test_rcvused [i] = 0;
+}
+
+static int test_isrcvbuf (void *ptr)
+{
+    return (char*) ptr >= (char*) test_rcvbufs &&
+        (char*) ptr < (char*) test_rcvbufs + sizeof (test_rcvbufs);
+}
+
+#if !defined NN_HAVE_WINDOWS
+
+/*  Talks to a PAIR socket over a plain TCP connection, announcing support
+    for compact message headers or not, and checks the framing of the
+    messages in both directions. */
+static void test_framing (int compact)
+{
+    int rc;
+    int sb;
+    int s;
+    size_t len;
+    struct sockaddr_in addr;
+    uint8_t hdr [8];
+    char buf [16];
+
+    sb = nn_socket (AF_SP, NN_PAIR);
+    errno_assert (sb >= 0);
+    rc = nn_bind (sb, SOCKET_ADDRESS);
+    errno_assert (rc >= 0);
+    s = socket (AF_INET, SOCK_STREAM, 0);
+    errno_assert (s >= 0);
+    memset (&addr, 0, sizeof (addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons (5555);
+    addr.sin_addr.s_addr = inet_addr ("127.0.0.1");
+    rc = connect (s, (struct sockaddr*) &addr, sizeof (addr));
+    errno_assert (rc == 0);
+
+    /*  Exchange the protocol headers. The socket announces compact headers
+        in the flags in the last byte. */
+    memcpy (hdr, "\0\0SP\0\x10\0\0", 8);
+    hdr [7] = compact ? 8 : 0;
+    rc = send (s, hdr, 8, 0);
+    errno_assert (rc == 8);
+    len = 0;
+    while (len != 8) {
+        rc = recv (s, hdr + len, 8 - len, 0);
+        errno_assert (rc > 0);
+        len += rc;
+    }
+    nn_assert (memcmp (hdr, "\0\0SP\0\x10\0", 7) == 0);
+    nn_assert (hdr [7] & 8);
+    nn_sleep (100);
+
+    /*  A short message gets a single-byte header if the peer supports it. */
+    rc = nn_send (sb, "ABC", 3, 0);
+    errno_assert (rc == 3);
+    len = 0;
+    while (len != (compact ? 4 : 11)) {
+        rc = recv (s, buf + len, (compact ? 4 : 11) - len, 0);
+        errno_assert (rc > 0);
+        len += rc;
+    }
+    if (compact)
+        nn_assert (memcmp (buf, "\x04" "ABC", 4) == 0);
+    else
+        nn_assert (memcmp (buf, "\0\0\0\0\0\0\0\x03" "ABC", 11) == 0);
+
+    /*  Once the compact headers are negotiated, either kind of header can
+        be received. */
+    if (compact) {
+        rc = send (s, "\x03" "DE" "\x1e\0\x01" "F", 7, 0);
+        errno_assert (rc == 7);
+        rc = nn_recv (sb, buf, sizeof (buf), 0);
+        errno_assert (rc == 2);
+        nn_assert (memcmp (buf, "DE", 2) == 0);
+        rc = nn_recv (sb, buf, sizeof (buf), 0);
+        errno_assert (rc == 1);
+        nn_assert (buf [0] == 'F');
+    }
+    rc = send (s, "\0\0\0\0\0\0\0\x01" "G", 9, 0);
+    errno_assert (rc == 9);
+    rc = nn_recv (sb, buf, sizeof (buf), 0);
+    errno_assert (rc == 1);
+    nn_assert (buf [0] == 'G');
+
+    rc = close (s);
+    errno_assert (rc == 0);
+    rc = nn_close (sb);
+    errno_assert (rc == 0);
+}
+
+/*  Checks that an idle connection is kept alive by heartbeats and that
+    a peer that goes silent is disconnected. */
+static void test_heartbeat (void)
+{
+    int rc;
+    int sb;
+    int sc;
+    int s;
+    int opt;
+    size_t sz;
+    size_t len;
+    struct sockaddr_in addr;
+    struct timeval tv;
+    struct nn_sock_stats stats;
+    uint8_t hdr [8];
+
+    sb = nn_socket (AF_SP, NN_PAIR);
+    errno_assert (sb >= 0);
+    opt = 100;
+    rc = nn_setsockopt (sb, NN_SOL_SOCKET, NN_HEARTBEAT_IVL, &opt,
+        sizeof (opt));
+    errno_assert (rc == 0);
+    opt = 2;
+    rc = nn_setsockopt (sb, NN_SOL_SOCKET, NN_HEARTBEAT_MISSES, &opt,
+        sizeof (opt));
+    errno_assert (rc == 0);
+    opt = 0;
+    rc = nn_setsockopt (sb, NN_SOL_SOCKET, NN_HEARTBEAT_MISSES, &opt,
+        sizeof (opt));
+    nn_assert (rc < 0 && nn_errno () == EINVAL);
+    sz = sizeof (opt);
+    rc = nn_getsockopt (sb, NN_SOL_SOCKET, NN_HEARTBEAT_IVL, &opt, &sz);
+    errno_assert (rc == 0);
+    nn_assert (sz == sizeof (opt) && opt == 100);
+    rc = nn_bind (sb, SOCKET_ADDRESS);
+    errno_assert (rc >= 0);
+
+    /*  The peer doesn't ask for heartbeats, yet it sends them when asked
+        to, so the connection survives while it's idle. */
+    sc = nn_socket (AF_SP, NN_PAIR);
+    errno_assert (sc >= 0);
+    rc = nn_connect (sc, SOCKET_ADDRESS);
+    errno_assert (rc >= 0);
+    rc = nn_send (sc, "ABC", 3, 0);
+    errno_assert (rc == 3);
+    rc = nn_recv (sb, hdr, sizeof (hdr), 0);
+    errno_assert (rc == 3);
+    nn_sleep (1000);
+    sz = sizeof (stats);
+    rc = nn_getsockopt (sb, NN_SOL_SOCKET, NN_STATS, &stats, &sz);
+    errno_assert (rc == 0);
+    nn_assert (stats.connects == 1 && stats.disconnects == 0);
+    rc = nn_close (sc);
+    errno_assert (rc == 0);
+
+    /*  A plain TCP peer asks for heartbeats every 100ms, but never sends
+        any. */
+    s = socket (AF_INET, SOCK_STREAM, 0);
+    errno_assert (s >= 0);
+    tv.tv_sec = 5;
+    tv.tv_usec = 0;
+    rc = setsockopt (s, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof (tv));
+    errno_assert (rc == 0);
+    memset (&addr, 0, sizeof (addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons (5555);
+    addr.sin_addr.s_addr = inet_addr ("127.0.0.1");
+    rc = connect (s, (struct sockaddr*) &addr, sizeof (addr));
+    errno_assert (rc == 0);
+    rc = send (s, "\0\0SP\0\x10\x01\x10", 8, 0);
+    errno_assert (rc == 8);
+    len = 0;
+    while (len != 8) {
+        rc = recv (s, hdr + len, 8 - len, 0);
+        errno_assert (rc > 0);
+        len += rc;
+    }
+    nn_assert (hdr [6] == 1 && (hdr [7] & 0x10));
+
+    /*  Heartbeats arrive until the socket gives up on the peer. */
+    len = 0;
+    while (1) {
+        rc = recv (s, hdr, 8, 0);
+        if (rc == 0 || (rc < 0 && errno == ECONNRESET))
+            break;
+        errno_assert (rc > 0);
+        nn_assert (hdr [0] == 0x20);
+        len += rc;
+    }
+    nn_assert (len >= 8);
+
+    rc = close (s);
+    errno_assert (rc == 0);
+    rc = nn_close (sb);
+    errno_assert (rc == 0);
+}
+
+/*  Sends messages along with their checksums, both between two SP sockets
+    and to and from a plain TCP connection, and checks that a message that
+    doesn't match its checksum breaks the connection. */
+static void test_crc (void)
+{
+    int rc;
+    int sb;
+    int sc;
+    int s;
+    int opt;
+    size_t i;
+    size_t sz;
+    size_t len;
+    struct sockaddr_in addr;
+    struct timeval tv;
+    uint8_t hdr [8];
+    char frame [19];
+    char *data;
+    void *buf;
+    static const size_t sizes [] = {0, 3, 4096, 200000};
+
+    data = malloc (200000);
+    alloc_assert (data);
+    for (i = 0; i != 200000; ++i)
+        data [i] = (char) (i % 251);
+
+    sb = nn_socket (AF_SP, NN_PAIR);
+    errno_assert (sb >= 0);
+    opt = 2;
+    rc = nn_setsockopt (sb, NN_TCP, NN_TCP_CRC, &opt, sizeof (opt));
+    nn_assert (rc < 0 && nn_errno () == EINVAL);
+    opt = 1;
+    rc = nn_setsockopt (sb, NN_TCP, NN_TCP_CRC, &opt, sizeof (opt));
+    errno_assert (rc == 0);
+    sz = sizeof (opt);
+    rc = nn_getsockopt (sb, NN_TCP, NN_TCP_CRC, &opt, &sz);
+    errno_assert (rc == 0);
+    nn_assert (sz == sizeof (opt) && opt == 1);
+    rc = nn_bind (sb, SOCKET_ADDRESS);
+    errno_assert (rc >= 0);
+
+    /*  Plain, compressed and large messages, which would be sent in chunks
+        otherwise, arrive intact. */
+    sc = nn_socket (AF_SP, NN_PAIR);
+    errno_assert (sc >= 0);
+    rc = nn_setsockopt (sc, NN_TCP, NN_TCP_CRC, &opt, sizeof (opt));
+    errno_assert (rc == 0);
+    opt = 1000;
+    rc = nn_setsockopt (sc, NN_TCP, NN_TCP_COMPRESS, &opt, sizeof (opt));
+    errno_assert (rc == 0);
+    rc = nn_connect (sc, SOCKET_ADDRESS);
+    errno_assert (rc >= 0);
+    for (i = 0; i != sizeof (sizes) / sizeof (sizes [0]); ++i) {
+        rc = nn_send (sc, data, sizes [i], 0);
+        errno_assert (rc >= 0 && (size_t) rc == sizes [i]);
+    }
+    for (i = 0; i != sizeof (sizes) / sizeof (sizes [0]); ++i) {
+        rc = nn_recv (sb, &buf, NN_MSG, 0);
+        errno_assert (rc >= 0 && (size_t) rc == sizes [i]);
+        nn_assert (memcmp (buf, data, sizes [i]) == 0);
+        nn_freemsg (buf);
+    }
+    rc = nn_close (sc);
+    errno_assert (rc == 0);
+
+    /*  A plain TCP peer announces that it can receive the checksums. */
+    s = socket (AF_INET, SOCK_STREAM, 0);
+    errno_assert (s >= 0);
+    tv.tv_sec = 5;
+    tv.tv_usec = 0;
+    rc = setsockopt (s, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof (tv));
+    errno_assert (rc == 0);
+    memset (&addr, 0, sizeof (addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons (5555);
+    addr.sin_addr.s_addr = inet_addr ("127.0.0.1");
+    rc = connect (s, (struct sockaddr*) &addr, sizeof (addr));
+    errno_assert (rc == 0);
+    rc = send (s, "\0\0SP\0\x10\0\x80", 8, 0);
+    errno_assert (rc == 8);
+    len = 0;
+    while (len != 8) {
+        rc = recv (s, hdr + len, 8 - len, 0);
+        errno_assert (rc > 0);
+        len += rc;
+    }
+    nn_assert (hdr [7] & 0x80);
+    nn_sleep (100);
+
+    /*  The message is preceded by the CRC32C of "ABC". */
+    rc = nn_send (sb, "ABC", 3, 0);
+    errno_assert (rc == 3);
+    len = 0;
+    while (len != 19) {
+        rc = recv (s, frame + len, 19 - len, 0);
+        errno_assert (rc > 0);
+        len += rc;
+    }
+    nn_assert (memcmp (frame, "\x60\0\0\0\x88\x39\xa9\x7f"
+        "\0\0\0\0\0\0\0\x03" "ABC", 19) == 0);
+
+    /*  A message matching its checksum is accepted, one that doesn't match
+        it breaks the connection. */
+    rc = send (s, frame, 19, 0);
+    errno_assert (rc == 19);
+    rc = nn_recv (sb, &buf, NN_MSG, 0);
+    errno_assert (rc == 3);
+    nn_assert (memcmp (buf, "ABC", 3) == 0);
+    nn_freemsg (buf);
+    frame [18] = 'D';
+    rc = send (s, frame, 19, 0);
+    errno_assert (rc == 19);
+    rc = recv (s, frame, sizeof (frame), 0);
+    nn_assert (rc == 0 || (rc < 0 && errno == ECONNRESET));
+
+    rc = close (s);
+    errno_assert (rc == 0);
+    rc = nn_close (sb);
+    errno_assert (rc == 0);
+    free (data);
+}
+
+/*  Sends regions of a file, both shorter and longer than a chunk, and
+    checks that they arrive intact. */
+static void test_filemsg (void)
+{
+    int rc;
+    int sb;
+    int sc;
+    int fd;
+    FILE *f;
+    size_t i;
+    unsigned char *data;
+    void *msg;
+    void *buf;
+
+    data = malloc (300000);
+    alloc_assert (data);
+    for (i = 0; i != 300000; ++i)
+        data [i] = (unsigned char) (i * 7 + i / 251);
+    f = tmpfile ();
+    errno_assert (f);
+    rc = (int) fwrite (data, 1, 300000, f);
+    nn_assert (rc == 300000);
+    rc = fflush (f);
+    errno_assert (rc == 0);
+    fd = fileno (f);
+
+    /*  Invalid file descriptors and regions are refused. */
+    msg = nn_filemsg (-1, 0, 10);
+    nn_assert (!msg && nn_errno () == EBADF);
+    msg = nn_filemsg (fd, 299990, 11);
+    nn_assert (!msg && nn_errno () == EINVAL);
+
+    sb = nn_socket (AF_SP, NN_PAIR);
+    errno_assert (sb >= 0);
+    rc = nn_bind (sb, SOCKET_ADDRESS);
+    errno_assert (rc >= 0);
+    sc = nn_socket (AF_SP, NN_PAIR);
+    errno_assert (sc >= 0);
+    rc = nn_connect (sc, SOCKET_ADDRESS);
+    errno_assert (rc >= 0);
+
+    msg = nn_filemsg (fd, 1000, 100);
+    alloc_assert (msg);
+    rc = nn_send (sc, &msg, NN_MSG, 0);
+    errno_assert (rc == 100);
+    msg = nn_filemsg (fd, 5, 250000);
+    alloc_assert (msg);
+    rc = nn_send (sc, &msg, NN_MSG, 0);
+    errno_assert (rc == 250000);
+
+    /*  The message holds its own reference to the file. */
+    rc = fclose (f);
+    errno_assert (rc == 0);
+    rc = nn_send (sc, "ABC", 3, 0);
+    errno_assert (rc == 3);
+
+    rc = nn_recv (sb, &buf, NN_MSG, 0);
+    errno_assert (rc == 100);
+    nn_assert (memcmp (buf, data + 1000, 100) == 0);
+    nn_freemsg (buf);
+    rc = nn_recv (sb, &buf, NN_MSG, 0);
+    errno_assert (rc == 250000);
+    nn_assert (memcmp (buf, data + 5, 250000) == 0);
+    nn_freemsg (buf);
+    rc = nn_recv (sb, &buf, NN_MSG, 0);
+    errno_assert (rc == 3);
+    nn_assert (memcmp (buf, "ABC", 3) == 0);
+    nn_freemsg (buf);
+
+    rc = nn_close (sc);
+    errno_assert (rc == 0);
+    rc = nn_close (sb);
+    errno_assert (rc == 0);
+    free (data);
+}
+
+#endif
+
 int main ()
 {
     int rc;
     int sb;
     int sc;
     int i;
+    int j;
+    int count;
+    int eid;
     char buf [3];
     int opt;
     size_t sz;
+    int s [8];
+    char path [16];
+    char data [4096];
+    char rdata [4096];
+    char *zcdata;
+    char *zcbuf;
+    struct nn_msghdr hdr;
+    struct nn_iovec iov;
+    struct nn_cmsghdr *cmsg;
+    uint64_t ctrl [16];
+    uint64_t tstamp;
+    void *big;
+    void *part;
+    struct nn_allocator allocator;
+    struct nn_sock_stats stats;
 
     /*  Try closing bound but unconnected socket. */
-#if 0
     sb = nn_socket (AF_SP, NN_PAIR);
     errno_assert (sb >= 0);
     rc = nn_bind (sb, SOCKET_ADDRESS);
     errno_assert (rc > 0);
     rc = nn_close (sb);
     errno_assert (rc == 0);
-#endif
 
     /*  Try closing a TCP socket while it not connected. At the same time
         test specifying the local address for connection. */
@@ -65,6 +510,16 @@ int main ()
     sc = nn_socket (AF_SP, NN_PAIR);
     errno_assert (sc != -1);
 
+    /*  Keep the I/O of the socket on the NUMA node it was created on. It
+        works on any machine, NUMA or not. */
+    opt = 1;
+    rc = nn_setsockopt (sc, NN_SOL_SOCKET, NN_NUMA, &opt, sizeof (opt));
+    errno_assert (rc == 0);
+    sz = sizeof (opt);
+    rc = nn_getsockopt (sc, NN_SOL_SOCKET, NN_NUMA, &opt, &sz);
+    errno_assert (rc == 0);
+    nn_assert (sz == sizeof (opt) && opt == 1);
+
     /*  Check NODELAY socket option. */
     sz = sizeof (opt);
     rc = nn_getsockopt (sc, NN_TCP, NN_TCP_NODELAY, &opt, &sz);
@@ -83,6 +538,69 @@ int main ()
     nn_assert (sz == sizeof (opt));
     nn_assert (opt == 1);
 
+    /*  Check CORK socket option. */
+    sz = sizeof (opt);
+    rc = nn_getsockopt (sc, NN_TCP, NN_TCP_CORK, &opt, &sz);
+    errno_assert (rc == 0);
+    nn_assert (sz == sizeof (opt));
+    nn_assert (opt == 0);
+    opt = 2;
+    rc = nn_setsockopt (sc, NN_TCP, NN_TCP_CORK, &opt, sizeof (opt));
+    nn_assert (rc < 0 && nn_errno () == EINVAL);
+    opt = 1;
+    rc = nn_setsockopt (sc, NN_TCP, NN_TCP_CORK, &opt, sizeof (opt));
+    errno_assert (rc == 0);
+
+    /*  Check BUSY_POLL socket option. It's not available on all platforms. */
+    sz = sizeof (opt);
+    rc = nn_getsockopt (sc, NN_TCP, NN_TCP_BUSY_POLL, &opt, &sz);
+    errno_assert (rc == 0);
+    nn_assert (sz == sizeof (opt));
+    nn_assert (opt == 0);
+    opt = 50;
+    rc = nn_setsockopt (sc, NN_TCP, NN_TCP_BUSY_POLL, &opt, sizeof (opt));
+    errno_assert (rc == 0 || nn_errno () == ENOPROTOOPT);
+
+    /*  Check HANDSHAKE_TIMEOUT socket option. */
+    sz = sizeof (opt);
+    rc = nn_getsockopt (sc, NN_SOL_SOCKET, NN_HANDSHAKE_TIMEOUT, &opt, &sz);
+    errno_assert (rc == 0);
+    nn_assert (sz == sizeof (opt));
+    nn_assert (opt == 1000);
+    opt = 0;
+    rc = nn_setsockopt (sc, NN_SOL_SOCKET, NN_HANDSHAKE_TIMEOUT,
+        &opt, sizeof (opt));
+    nn_assert (rc < 0 && nn_errno () == EINVAL);
+    opt = 500;
+    rc = nn_setsockopt (sc, NN_SOL_SOCKET, NN_HANDSHAKE_TIMEOUT,
+        &opt, sizeof (opt));
+    errno_assert (rc == 0);
+
+    /*  Check TLS socket options. Kernel TLS may not be available. */
+    s [0] = nn_socket (AF_SP, NN_PAIR);
+    errno_assert (s [0] != -1);
+    sz = sizeof (opt);
+    rc = nn_getsockopt (s [0], NN_TCP, NN_TCP_TLS, &opt, &sz);
+    errno_assert (rc == 0);
+    nn_assert (sz == sizeof (opt));
+    nn_assert (opt == 0);
+    rc = nn_setsockopt (s [0], NN_TCP, NN_TCP_TLS_CERT, "/nonexistent", 12);
+    errno_assert (rc == 0);
+    sz = sizeof (path);
+    rc = nn_getsockopt (s [0], NN_TCP, NN_TCP_TLS_CERT, path, &sz);
+    errno_assert (rc == 0);
+    nn_assert (sz == 12 && memcmp (path, "/nonexistent", 12) == 0);
+    opt = 1;
+    rc = nn_setsockopt (s [0], NN_TCP, NN_TCP_TLS, &opt, sizeof (opt));
+    nn_assert (rc < 0 &&
+        (nn_errno () == EINVAL || nn_errno () == ENOTSUP));
+    rc = nn_setsockopt (s [0], NN_TCP, NN_TCP_TLS_CERT, "", 0);
+    errno_assert (rc == 0);
+    rc = nn_setsockopt (s [0], NN_TCP, NN_TCP_TLS, &opt, sizeof (opt));
+    errno_assert (rc == 0 || nn_errno () == ENOTSUP);
+    rc = nn_close (s [0]);
+    errno_assert (rc == 0);
+
     /*  Try using invalid address strings. */
     rc = nn_connect (sc, "tcp://*:");
     nn_assert (rc < 0);
@@ -105,6 +623,25 @@ int main ()
     nn_assert (rc < 0);
     errno_assert (nn_errno () == ENODEV);
 
+    /*  Check RECONNECT_JITTER socket option. */
+    sz = sizeof (opt);
+    rc = nn_getsockopt (sc, NN_SOL_SOCKET, NN_RECONNECT_JITTER, &opt, &sz);
+    errno_assert (rc == 0);
+    nn_assert (sz == sizeof (opt));
+    nn_assert (opt == NN_JITTER_PARTIAL);
+    opt = NN_JITTER_DECORRELATED + 1;
+    rc = nn_setsockopt (sc, NN_SOL_SOCKET, NN_RECONNECT_JITTER, &opt,
+        sizeof (opt));
+    nn_assert (rc < 0 && nn_errno () == EINVAL);
+    opt = NN_JITTER_DECORRELATED;
+    rc = nn_setsockopt (sc, NN_SOL_SOCKET, NN_RECONNECT_JITTER, &opt,
+        sizeof (opt));
+    errno_assert (rc == 0);
+    opt = 400;
+    rc = nn_setsockopt (sc, NN_SOL_SOCKET, NN_RECONNECT_IVL_MAX, &opt,
+        sizeof (opt));
+    errno_assert (rc == 0);
+
     /*  Connect correctly. Do so before binding the peer socket. */
     rc = nn_connect (sc, SOCKET_ADDRESS);
     errno_assert (rc >= 0);
@@ -114,6 +651,11 @@ int main ()
 
     sb = nn_socket (AF_SP, NN_PAIR);
     errno_assert (sb != -1);
+    opt = 1;
+    rc = nn_setsockopt (sb, NN_TCP, NN_TCP_NODELAY, &opt, sizeof (opt));
+    errno_assert (rc == 0);
+    rc = nn_setsockopt (sb, NN_TCP, NN_TCP_CORK, &opt, sizeof (opt));
+    errno_assert (rc == 0);
     rc = nn_bind (sb, SOCKET_ADDRESS);
     errno_assert (rc >= 0);
 
@@ -154,6 +696,683 @@ int main ()
     rc = nn_close (sb);
     errno_assert (rc == 0);
 
+    /*  Connect using a hostname. The name is resolved asynchronously.
+        Closing the socket while an unresolvable name is being looked up
+        cancels the lookup. */
+    sb = nn_socket (AF_SP, NN_PAIR);
+    errno_assert (sb != -1);
+    rc = nn_bind (sb, SOCKET_ADDRESS);
+    errno_assert (rc >= 0);
+    sc = nn_socket (AF_SP, NN_PAIR);
+    errno_assert (sc != -1);
+    rc = nn_connect (sc, "tcp://nonexistent.invalid:5555");
+    errno_assert (rc >= 0);
+    rc = nn_connect (sc, "tcp://localhost:5555");
+    errno_assert (rc >= 0);
+    rc = nn_send (sc, "ABC", 3, 0);
+    errno_assert (rc >= 0);
+    nn_assert (rc == 3);
+    rc = nn_recv (sb, buf, sizeof (buf), 0);
+    errno_assert (rc >= 0);
+    nn_assert (rc == 3);
+    rc = nn_close (sc);
+    errno_assert (rc == 0);
+    rc = nn_close (sb);
+    errno_assert (rc == 0);
+
+    /*  Test message compression. Only the large messages are compressed and
+        the message header is passed along with them. */
+    sb = nn_socket (AF_SP, NN_REP);
+    errno_assert (sb != -1);
+    opt = -1;
+    rc = nn_setsockopt (sb, NN_TCP, NN_TCP_COMPRESS, &opt, sizeof (opt));
+    nn_assert (rc < 0 && nn_errno () == EINVAL);
+    opt = 1024;
+    rc = nn_setsockopt (sb, NN_TCP, NN_TCP_COMPRESS, &opt, sizeof (opt));
+    errno_assert (rc == 0);
+    sz = sizeof (opt);
+    rc = nn_getsockopt (sb, NN_TCP, NN_TCP_COMPRESS, &opt, &sz);
+    errno_assert (rc == 0);
+    nn_assert (sz == sizeof (opt) && opt == 1024);
+    rc = nn_bind (sb, SOCKET_ADDRESS);
+    errno_assert (rc >= 0);
+    sc = nn_socket (AF_SP, NN_REQ);
+    errno_assert (sc != -1);
+    rc = nn_setsockopt (sc, NN_TCP, NN_TCP_COMPRESS, &opt, sizeof (opt));
+    errno_assert (rc == 0);
+    rc = nn_connect (sc, SOCKET_ADDRESS);
+    errno_assert (rc >= 0);
+    for (i = 0; i != sizeof (data); ++i)
+        data [i] = "compressible" [i % 12] + (i / 1000);
+    for (i = 0; i != 4; ++i) {
+        rc = nn_send (sc, data, i % 2 ? 3 : sizeof (data), 0);
+        errno_assert (rc >= 0);
+        memset (rdata, 0, sizeof (rdata));
+        rc = nn_recv (sb, rdata, sizeof (rdata), 0);
+        errno_assert (rc >= 0);
+        nn_assert (rc == (i % 2 ? 3 : sizeof (data)));
+        nn_assert (memcmp (data, rdata, rc) == 0);
+        rc = nn_send (sb, rdata, rc, 0);
+        errno_assert (rc >= 0);
+        memset (rdata, 0, sizeof (rdata));
+        rc = nn_recv (sc, rdata, sizeof (rdata), 0);
+        errno_assert (rc >= 0);
+        nn_assert (rc == (i % 2 ? 3 : sizeof (data)));
+        nn_assert (memcmp (data, rdata, rc) == 0);
+    }
+    rc = nn_close (sc);
+    errno_assert (rc == 0);
+    rc = nn_close (sb);
+    errno_assert (rc == 0);
+
+    /*  Test sending without copying. The kernel may not support it, in which
+        case the data are copied, but they must arrive intact either way. */
+    sb = nn_socket (AF_SP, NN_PAIR);
+    errno_assert (sb != -1);
+    opt = 65536;
+    rc = nn_setsockopt (sb, NN_TCP, NN_TCP_ZEROCOPY, &opt, sizeof (opt));
+    if (rc == 0) {
+        sz = sizeof (opt);
+        rc = nn_getsockopt (sb, NN_TCP, NN_TCP_ZEROCOPY, &opt, &sz);
+        errno_assert (rc == 0);
+        nn_assert (sz == sizeof (opt) && opt == 65536);
+        rc = nn_bind (sb, SOCKET_ADDRESS);
+        errno_assert (rc >= 0);
+        sc = nn_socket (AF_SP, NN_PAIR);
+        errno_assert (sc != -1);
+        rc = nn_setsockopt (sc, NN_TCP, NN_TCP_ZEROCOPY, &opt, sizeof (opt));
+        errno_assert (rc == 0);
+        rc = nn_connect (sc, SOCKET_ADDRESS);
+        errno_assert (rc >= 0);
+        zcdata = malloc (262144);
+        alloc_assert (zcdata);
+        for (i = 0; i != 8; ++i) {
+            memset (zcdata, 'A' + i, 262144);
+            rc = nn_send (sc, zcdata, 262144, 0);
+            errno_assert (rc == 262144);
+            rc = nn_recv (sb, &zcbuf, NN_MSG, 0);
+            errno_assert (rc == 262144);
+            nn_assert (zcbuf [0] == 'A' + i && zcbuf [262143] == 'A' + i);
+            rc = nn_send (sb, &zcbuf, NN_MSG, 0);
+            errno_assert (rc == 262144);
+            rc = nn_recv (sc, zcdata, 262144, 0);
+            errno_assert (rc == 262144);
+            nn_assert (zcdata [0] == 'A' + i && zcdata [262143] == 'A' + i);
+        }
+        free (zcdata);
+        rc = nn_close (sc);
+        errno_assert (rc == 0);
+    }
+    else
+        nn_assert (nn_errno () == ENOPROTOOPT);
+    rc = nn_close (sb);
+    errno_assert (rc == 0);
+
+    /*  Test keeping the unsent data out of the kernel. The messages have to
+        be passed on intact and in order once the peer starts receiving. */
+    sb = nn_socket (AF_SP, NN_PAIR);
+    errno_assert (sb != -1);
+    sz = sizeof (opt);
+    rc = nn_getsockopt (sb, NN_TCP, NN_TCP_NOTSENT_LOWAT, &opt, &sz);
+    errno_assert (rc == 0);
+    nn_assert (sz == sizeof (opt) && opt == 0);
+    opt = -1;
+    rc = nn_setsockopt (sb, NN_TCP, NN_TCP_NOTSENT_LOWAT, &opt, sizeof (opt));
+    nn_assert (rc < 0);
+    errno_assert (nn_errno () == EINVAL || nn_errno () == ENOPROTOOPT);
+    opt = 4096;
+    rc = nn_setsockopt (sb, NN_TCP, NN_TCP_NOTSENT_LOWAT, &opt, sizeof (opt));
+    if (rc == 0) {
+        sz = sizeof (opt);
+        rc = nn_getsockopt (sb, NN_TCP, NN_TCP_NOTSENT_LOWAT, &opt, &sz);
+        errno_assert (rc == 0);
+        nn_assert (sz == sizeof (opt) && opt == 4096);
+        opt = 1024 * 1024;
+        rc = nn_setsockopt (sb, NN_SOL_SOCKET, NN_SNDBUF, &opt, sizeof (opt));
+        errno_assert (rc == 0);
+        rc = nn_bind (sb, SOCKET_ADDRESS);
+        errno_assert (rc >= 0);
+        sc = nn_socket (AF_SP, NN_PAIR);
+        errno_assert (sc != -1);
+        rc = nn_connect (sc, SOCKET_ADDRESS);
+        errno_assert (rc >= 0);
+        zcdata = malloc (65536);
+        alloc_assert (zcdata);
+        rc = nn_send (sc, "ABC", 3, 0);
+        errno_assert (rc == 3);
+        rc = nn_recv (sb, buf, sizeof (buf), 0);
+        errno_assert (rc == 3);
+        for (i = 0; i != 64; ++i) {
+            memset (zcdata, i, 65536);
+            rc = nn_send (sb, zcdata, 65536, NN_DONTWAIT);
+            if (rc < 0) {
+                errno_assert (nn_errno () == EAGAIN);
+                break;
+            }
+            nn_assert (rc == 65536);
+        }
+        nn_assert (i > 0);
+        count = i;
+        for (i = 0; i != count; ++i) {
+            rc = nn_recv (sc, zcdata, 65536, 0);
+            errno_assert (rc == 65536);
+            nn_assert (zcdata [0] == i && zcdata [65535] == i);
+        }
+        free (zcdata);
+        rc = nn_close (sc);
+        errno_assert (rc == 0);
+    }
+    else
+        nn_assert (nn_errno () == ENOPROTOOPT);
+    rc = nn_close (sb);
+    errno_assert (rc == 0);
+
+    /*  Test TCP Fast Open. The second connection may carry the protocol
+        header in the SYN, using the cookie obtained by the first one. */
+    sb = nn_socket (AF_SP, NN_PAIR);
+    errno_assert (sb != -1);
+    sz = sizeof (opt);
+    rc = nn_getsockopt (sb, NN_TCP, NN_TCP_FASTOPEN, &opt, &sz);
+    errno_assert (rc == 0);
+    nn_assert (sz == sizeof (opt) && opt == 0);
+    opt = 2;
+    rc = nn_setsockopt (sb, NN_TCP, NN_TCP_FASTOPEN, &opt, sizeof (opt));
+    nn_assert (rc < 0);
+    errno_assert (nn_errno () == EINVAL || nn_errno () == ENOPROTOOPT);
+    opt = 1;
+    rc = nn_setsockopt (sb, NN_TCP, NN_TCP_FASTOPEN, &opt, sizeof (opt));
+    if (rc == 0) {
+        rc = nn_bind (sb, SOCKET_ADDRESS);
+        errno_assert (rc >= 0);
+        for (i = 0; i != 2; ++i) {
+            sc = nn_socket (AF_SP, NN_PAIR);
+            errno_assert (sc != -1);
+            rc = nn_setsockopt (sc, NN_TCP, NN_TCP_FASTOPEN, &opt,
+                sizeof (opt));
+            errno_assert (rc == 0);
+            rc = nn_connect (sc, SOCKET_ADDRESS);
+            errno_assert (rc >= 0);
+            rc = nn_send (sc, "ABC", 3, 0);
+            errno_assert (rc == 3);
+            rc = nn_recv (sb, buf, sizeof (buf), 0);
+            errno_assert (rc == 3);
+            rc = nn_send (sb, "DEF", 3, 0);
+            errno_assert (rc == 3);
+            rc = nn_recv (sc, buf, sizeof (buf), 0);
+            errno_assert (rc == 3);
+            rc = nn_close (sc);
+            errno_assert (rc == 0);
+
+            /*  PAIR accepts a single connection. Wait till the old one
+                is gone before reconnecting. */
+            for (j = 0; j != 100; ++j) {
+                sz = sizeof (stats);
+                rc = nn_getsockopt (sb, NN_SOL_SOCKET, NN_STATS, &stats, &sz);
+                errno_assert (rc == 0);
+                if (stats.disconnects == (unsigned long long) i + 1)
+                    break;
+                nn_sleep (10);
+            }
+            nn_assert (stats.disconnects == (unsigned long long) i + 1);
+        }
+    }
+    else
+        nn_assert (nn_errno () == ENOPROTOOPT);
+    rc = nn_close (sb);
+    errno_assert (rc == 0);
+
+    /*  Test send batching. The messages are held back until the batch gets
+        big enough or the delay expires. */
+    sb = nn_socket (AF_SP, NN_PULL);
+    errno_assert (sb != -1);
+    rc = nn_bind (sb, SOCKET_ADDRESS);
+    errno_assert (rc >= 0);
+    sc = nn_socket (AF_SP, NN_PUSH);
+    errno_assert (sc != -1);
+    sz = sizeof (opt);
+    rc = nn_getsockopt (sc, NN_SOL_SOCKET, NN_SNDBATCH, &opt, &sz);
+    errno_assert (rc == 0);
+    nn_assert (sz == sizeof (opt) && opt == 0);
+    opt = -1;
+    rc = nn_setsockopt (sc, NN_SOL_SOCKET, NN_SNDBATCH, &opt, sizeof (opt));
+    nn_assert (rc < 0 && nn_errno () == EINVAL);
+    rc = nn_setsockopt (sc, NN_SOL_SOCKET, NN_SNDBATCHBYTES, &opt,
+        sizeof (opt));
+    nn_assert (rc < 0 && nn_errno () == EINVAL);
+    opt = 10000000;
+    rc = nn_setsockopt (sc, NN_SOL_SOCKET, NN_SNDBATCH, &opt, sizeof (opt));
+    errno_assert (rc == 0);
+    opt = 5;
+    rc = nn_setsockopt (sc, NN_SOL_SOCKET, NN_SNDBATCHBYTES, &opt,
+        sizeof (opt));
+    errno_assert (rc == 0);
+    sz = sizeof (opt);
+    rc = nn_getsockopt (sc, NN_SOL_SOCKET, NN_SNDBATCHBYTES, &opt, &sz);
+    errno_assert (rc == 0);
+    nn_assert (sz == sizeof (opt) && opt == 5);
+    rc = nn_connect (sc, SOCKET_ADDRESS);
+    errno_assert (rc >= 0);
+    nn_sleep (100);
+    rc = nn_send (sc, "ABC", 3, 0);
+    errno_assert (rc == 3);
+    nn_sleep (100);
+    rc = nn_recv (sb, buf, sizeof (buf), NN_DONTWAIT);
+    nn_assert (rc < 0 && nn_errno () == EAGAIN);
+    rc = nn_send (sc, "DEF", 3, 0);
+    errno_assert (rc == 3);
+    for (i = 0; i != 2; ++i) {
+        rc = nn_recv (sb, buf, sizeof (buf), 0);
+        errno_assert (rc == 3);
+    }
+    rc = nn_close (sc);
+    errno_assert (rc == 0);
+    sc = nn_socket (AF_SP, NN_PUSH);
+    errno_assert (sc != -1);
+    opt = 500;
+    rc = nn_setsockopt (sc, NN_SOL_SOCKET, NN_SNDBATCH, &opt, sizeof (opt));
+    errno_assert (rc == 0);
+    rc = nn_connect (sc, SOCKET_ADDRESS);
+    errno_assert (rc >= 0);
+    for (i = 0; i != 100; ++i) {
+        rc = nn_send (sc, "ABC", 3, 0);
+        errno_assert (rc == 3);
+    }
+    for (i = 0; i != 100; ++i) {
+        rc = nn_recv (sb, buf, sizeof (buf), 0);
+        errno_assert (rc == 3);
+    }
+    rc = nn_close (sc);
+    errno_assert (rc == 0);
+    rc = nn_close (sb);
+    errno_assert (rc == 0);
+
+    /*  Test receive timestamps. With NN_RCVTIMESTAMP set, the control
+        information consists of the protocol header and the timestamp. */
+    sb = nn_socket (AF_SP_RAW, NN_REP);
+    errno_assert (sb != -1);
+    opt = 1;
+    rc = nn_setsockopt (sb, NN_SOL_SOCKET, NN_RCVTIMESTAMP, &opt, sizeof (opt));
+    errno_assert (rc == 0);
+    rc = nn_bind (sb, SOCKET_ADDRESS);
+    errno_assert (rc >= 0);
+    sc = nn_socket (AF_SP, NN_REQ);
+    errno_assert (sc != -1);
+    rc = nn_connect (sc, SOCKET_ADDRESS);
+    errno_assert (rc >= 0);
+    rc = nn_send (sc, "ABC", 3, 0);
+    errno_assert (rc == 3);
+    memset (&hdr, 0, sizeof (hdr));
+    iov.iov_base = buf;
+    iov.iov_len = sizeof (buf);
+    hdr.msg_iov = &iov;
+    hdr.msg_iovlen = 1;
+    hdr.msg_control = ctrl;
+    hdr.msg_controllen = sizeof (ctrl);
+    rc = nn_recvmsg (sb, &hdr, 0);
+    errno_assert (rc == 3);
+    cmsg = NN_CMSG_FIRSTHDR (&hdr);
+    nn_assert (cmsg);
+    nn_assert (cmsg->cmsg_level == PROTO_SP && cmsg->cmsg_type == SP_HDR);
+    nn_assert (cmsg->cmsg_len > NN_CMSG_LEN (0));
+    sz = cmsg->cmsg_len - NN_CMSG_LEN (0);
+    cmsg = NN_CMSG_NXTHDR (&hdr, cmsg);
+#if defined __linux__
+    nn_assert (cmsg);
+    nn_assert (cmsg->cmsg_level == NN_SOL_SOCKET &&
+        cmsg->cmsg_type == NN_RCVTIMESTAMP);
+    nn_assert (cmsg->cmsg_len == NN_CMSG_LEN (sizeof (tstamp)));
+    memcpy (&tstamp, NN_CMSG_DATA (cmsg), sizeof (tstamp));
+    nn_assert (tstamp / 1000000000 + 60 > (uint64_t) time (NULL) &&
+        tstamp / 1000000000 < (uint64_t) time (NULL) + 60);
+    nn_assert (!NN_CMSG_NXTHDR (&hdr, cmsg));
+    nn_assert (hdr.msg_controllen ==
+        NN_CMSG_SPACE (sz) + NN_CMSG_SPACE (sizeof (tstamp)));
+#endif
+
+    /*  The control buffer can be passed back to nn_sendmsg as it is. */
+    iov.iov_len = 3;
+    rc = nn_sendmsg (sb, &hdr, 0);
+    errno_assert (rc == 3);
+    rc = nn_recv (sc, buf, sizeof (buf), 0);
+    errno_assert (rc == 3);
+    hdr.msg_controllen = NN_CMSG_LEN (0) - 1;
+    rc = nn_sendmsg (sb, &hdr, 0);
+    nn_assert (rc < 0);
+    errno_assert (nn_errno () == EINVAL);
+    rc = nn_close (sc);
+    errno_assert (rc == 0);
+    rc = nn_close (sb);
+    errno_assert (rc == 0);
+
+    /*  Test urgent messages. Once the peer stops reading, a large message
+        gets stuck in the kernel buffers and an urgent message sent after
+        it overtakes it. */
+    sb = nn_socket (AF_SP, NN_PULL);
+    errno_assert (sb != -1);
+    rc = nn_bind (sb, SOCKET_ADDRESS);
+    errno_assert (rc >= 0);
+    sc = nn_socket (AF_SP, NN_PUSH);
+    errno_assert (sc != -1);
+    rc = nn_connect (sc, SOCKET_ADDRESS);
+    errno_assert (rc >= 0);
+    nn_sleep (100);
+    rc = nn_send (sc, "A", 1, 0);
+    errno_assert (rc == 1);
+    big = nn_allocmsg (64 << 20, 0);
+    alloc_assert (big);
+    memset (big, 'B', 64 << 20);
+    rc = nn_send (sc, &big, NN_MSG, 0);
+    errno_assert (rc == 64 << 20);
+    nn_sleep (100);
+    rc = nn_send (sc, "U", 1, NN_URGENT);
+    errno_assert (rc == 1);
+    rc = nn_recv (sb, buf, sizeof (buf), 0);
+    errno_assert (rc == 1);
+    nn_assert (buf [0] == 'A');
+    rc = nn_recv (sb, buf, sizeof (buf), 0);
+    errno_assert (rc == 1);
+    nn_assert (buf [0] == 'U');
+    rc = nn_recv (sb, &big, NN_MSG, 0);
+    errno_assert (rc == 64 << 20);
+    nn_assert (((char*) big) [0] == 'B' && ((char*) big) [rc - 1] == 'B');
+    rc = nn_freemsg (big);
+    errno_assert (rc == 0);
+    rc = nn_close (sc);
+    errno_assert (rc == 0);
+    rc = nn_close (sb);
+    errno_assert (rc == 0);
+
+    /*  Test receiving a large message chunk by chunk. */
+    sb = nn_socket (AF_SP, NN_PULL);
+    errno_assert (sb != -1);
+    opt = 1;
+    rc = nn_setsockopt (sb, NN_SOL_SOCKET, NN_RCVCHUNKS, &opt, sizeof (opt));
+    errno_assert (rc == 0);
+    rc = nn_bind (sb, SOCKET_ADDRESS);
+    errno_assert (rc >= 0);
+    sc = nn_socket (AF_SP, NN_PUSH);
+    errno_assert (sc != -1);
+    rc = nn_setsockopt (sc, NN_SOL_SOCKET, NN_RCVCHUNKS, &opt, sizeof (opt));
+    nn_assert (rc < 0);
+    errno_assert (nn_errno () == ENOTSUP);
+    rc = nn_connect (sc, SOCKET_ADDRESS);
+    errno_assert (rc >= 0);
+    big = nn_allocmsg (1 << 20, 0);
+    alloc_assert (big);
+    for (i = 0; i != 1 << 20; ++i)
+        ((char*) big) [i] = (char) i;
+    rc = nn_send (sc, &big, NN_MSG, 0);
+    errno_assert (rc == 1 << 20);
+    sz = 0;
+    while (sz != 1 << 20) {
+        memset (&hdr, 0, sizeof (hdr));
+        iov.iov_base = &part;
+        iov.iov_len = NN_MSG;
+        hdr.msg_iov = &iov;
+        hdr.msg_iovlen = 1;
+        hdr.msg_control = ctrl;
+        hdr.msg_controllen = sizeof (ctrl);
+        rc = nn_recvmsg (sb, &hdr, 0);
+        errno_assert (rc > 0 && rc <= 65536);
+        cmsg = NN_CMSG_NXTHDR (&hdr, NN_CMSG_FIRSTHDR (&hdr));
+        nn_assert (cmsg);
+        nn_assert (cmsg->cmsg_level == NN_SOL_SOCKET &&
+            cmsg->cmsg_type == NN_RCVCHUNKS);
+        memcpy (&tstamp, NN_CMSG_DATA (cmsg), sizeof (tstamp));
+        nn_assert (tstamp == sz);
+        memcpy (&tstamp, ((uint8_t*) NN_CMSG_DATA (cmsg)) + 8,
+            sizeof (tstamp));
+        nn_assert (tstamp == 1 << 20);
+        for (i = 0; i != rc; ++i)
+            nn_assert (((char*) part) [i] == (char) (sz + i));
+        sz += rc;
+        rc = nn_freemsg (part);
+        errno_assert (rc == 0);
+    }
+    rc = nn_close (sc);
+    errno_assert (rc == 0);
+    rc = nn_close (sb);
+    errno_assert (rc == 0);
+
+    /*  Test connecting to a list of addresses. The messages are spread
+        among the peers and, once one of them goes away, they go to the other
+        one. All of the connections are shut down at once. */
+    s [0] = nn_socket (AF_SP, NN_PULL);
+    errno_assert (s [0] != -1);
+    rc = nn_bind (s [0], SOCKET_ADDRESS);
+    errno_assert (rc >= 0);
+    s [1] = nn_socket (AF_SP, NN_PULL);
+    errno_assert (s [1] != -1);
+    rc = nn_bind (s [1], "tcp://127.0.0.1:5567");
+    errno_assert (rc >= 0);
+    sc = nn_socket (AF_SP, NN_PUSH);
+    errno_assert (sc != -1);
+    rc = nn_connect (sc, "tcp://127.0.0.1:5568,");
+    nn_assert (rc < 0);
+    errno_assert (nn_errno () == EINVAL);
+    rc = nn_connect (sc, "tcp://127.0.0.1:5568,*:");
+    nn_assert (rc < 0);
+    errno_assert (nn_errno () == EINVAL);
+    eid = nn_connect (sc, "tcp://127.0.0.1:5555,127.0.0.1:5567");
+    errno_assert (eid >= 0);
+    nn_sleep (100);
+    for (i = 0; i != 4; ++i) {
+        rc = nn_send (sc, "ABC", 3, 0);
+        errno_assert (rc == 3);
+    }
+    nn_sleep (10);
+    for (i = 0; i != 2; ++i) {
+        rc = nn_recv (s [0], buf, sizeof (buf), NN_DONTWAIT);
+        errno_assert (rc == 3);
+        rc = nn_recv (s [1], buf, sizeof (buf), NN_DONTWAIT);
+        errno_assert (rc == 3);
+    }
+    rc = nn_close (s [0]);
+    errno_assert (rc == 0);
+    nn_sleep (100);
+    for (i = 0; i != 3; ++i) {
+        rc = nn_send (sc, "DEF", 3, 0);
+        errno_assert (rc == 3);
+        rc = nn_recv (s [1], buf, sizeof (buf), 0);
+        errno_assert (rc == 3);
+    }
+    rc = nn_shutdown (sc, eid);
+    errno_assert (rc == 0);
+    rc = nn_close (sc);
+    errno_assert (rc == 0);
+    rc = nn_close (s [1]);
+    errno_assert (rc == 0);
+
+    /*  Test multiple listening sockets per endpoint. */
+    sb = nn_socket (AF_SP, NN_SINK);
+    errno_assert (sb != -1);
+    opt = 0;
+    rc = nn_setsockopt (sb, NN_TCP, NN_TCP_LISTENERS, &opt, sizeof (opt));
+    nn_assert (rc < 0 && nn_errno () == EINVAL);
+    opt = 4;
+    rc = nn_setsockopt (sb, NN_TCP, NN_TCP_LISTENERS, &opt, sizeof (opt));
+    errno_assert (rc == 0 || nn_errno () == ENOPROTOOPT);
+    rc = nn_bind (sb, SOCKET_ADDRESS);
+    errno_assert (rc >= 0);
+    for (i = 0; i != 8; ++i) {
+        s [i] = nn_socket (AF_SP, NN_SOURCE);
+        errno_assert (s [i] != -1);
+        rc = nn_connect (s [i], SOCKET_ADDRESS);
+        errno_assert (rc >= 0);
+    }
+    for (i = 0; i != 8; ++i) {
+        rc = nn_send (s [i], "ABC", 3, 0);
+        errno_assert (rc >= 0);
+        nn_assert (rc == 3);
+    }
+    for (i = 0; i != 8; ++i) {
+        rc = nn_recv (sb, buf, sizeof (buf), 0);
+        errno_assert (rc >= 0);
+        nn_assert (rc == 3);
+    }
+    for (i = 0; i != 8; ++i) {
+        rc = nn_close (s [i]);
+        errno_assert (rc == 0);
+    }
+    rc = nn_close (sb);
+    errno_assert (rc == 0);
+
+    /*  Test the sockets sharing the address with NN_TCP_RSS. Each connection
+        is accepted by one of them. */
+    sb = nn_socket (AF_SP, NN_SINK);
+    errno_assert (sb != -1);
+    opt = 2;
+    rc = nn_setsockopt (sb, NN_TCP, NN_TCP_RSS, &opt, sizeof (opt));
+    nn_assert (rc < 0 &&
+        (nn_errno () == EINVAL || nn_errno () == ENOPROTOOPT));
+    opt = 1;
+    rc = nn_setsockopt (sb, NN_TCP, NN_TCP_RSS, &opt, sizeof (opt));
+    if (rc == 0) {
+        sz = sizeof (opt);
+        rc = nn_getsockopt (sb, NN_TCP, NN_TCP_RSS, &opt, &sz);
+        errno_assert (rc == 0);
+        nn_assert (sz == sizeof (opt) && opt == 1);
+        rc = nn_bind (sb, SOCKET_ADDRESS);
+        errno_assert (rc >= 0);
+        s [0] = nn_socket (AF_SP, NN_SINK);
+        errno_assert (s [0] != -1);
+        rc = nn_setsockopt (s [0], NN_TCP, NN_TCP_RSS, &opt, sizeof (opt));
+        errno_assert (rc == 0);
+        rc = nn_bind (s [0], SOCKET_ADDRESS);
+        errno_assert (rc >= 0);
+        for (i = 1; i != 8; ++i) {
+            s [i] = nn_socket (AF_SP, NN_SOURCE);
+            errno_assert (s [i] != -1);
+            rc = nn_connect (s [i], SOCKET_ADDRESS);
+            errno_assert (rc >= 0);
+            rc = nn_send (s [i], "ABC", 3, 0);
+            errno_assert (rc == 3);
+        }
+        opt = 0;
+        for (i = 0; opt != 7; ++i) {
+            nn_assert (i < 1000);
+            rc = nn_recv (i % 2 ? s [0] : sb, buf, sizeof (buf),
+                NN_DONTWAIT);
+            if (rc < 0) {
+                errno_assert (nn_errno () == EAGAIN);
+                nn_sleep (10);
+                continue;
+            }
+            nn_assert (rc == 3);
+            ++opt;
+        }
+        for (i = 0; i != 8; ++i) {
+            rc = nn_close (s [i]);
+            errno_assert (rc == 0);
+        }
+    }
+    rc = nn_close (sb);
+    errno_assert (rc == 0);
+
+    /*  Test receiving into the application's own buffers. The messages that
+        arrive while all of them are in use go to the library's memory. */
+    allocator.alloc = test_rcvalloc;
+    allocator.free = test_rcvfree;
+    rc = nn_setallocator (NN_ALLOC_USER, &allocator);
+    errno_assert (rc == 0);
+    sb = nn_socket (AF_SP, NN_PAIR);
+    errno_assert (sb != -1);
+    opt = NN_ALLOC_USER - 1;
+    rc = nn_setsockopt (sb, NN_SOL_SOCKET, NN_RCVALLOC, &opt, sizeof (opt));
+    nn_assert (rc < 0 && nn_errno () == EINVAL);
+    opt = NN_ALLOC_USER;
+    rc = nn_setsockopt (sb, NN_SOL_SOCKET, NN_RCVALLOC, &opt, sizeof (opt));
+    errno_assert (rc == 0);
+    sz = sizeof (opt);
+    rc = nn_getsockopt (sb, NN_SOL_SOCKET, NN_RCVALLOC, &opt, &sz);
+    errno_assert (rc == 0);
+    nn_assert (sz == sizeof (opt) && opt == NN_ALLOC_USER);
+    rc = nn_bind (sb, SOCKET_ADDRESS);
+    errno_assert (rc >= 0);
+    sc = nn_socket (AF_SP, NN_PAIR);
+    errno_assert (sc != -1);
+    rc = nn_connect (sc, SOCKET_ADDRESS);
+    errno_assert (rc >= 0);
+    memset (data, 0x5a, sizeof (data));
+    for (i = 0; i != 3; ++i) {
+        rc = nn_send (sc, data, sizeof (data), 0);
+        errno_assert (rc == sizeof (data));
+    }
+    rc = nn_recv (sb, &big, NN_MSG, 0);
+    errno_assert (rc == sizeof (data));
+    nn_assert (test_isrcvbuf (big));
+    nn_assert (memcmp (big, data, sizeof (data)) == 0);
+    rc = nn_recv (sb, &part, NN_MSG, 0);
+    errno_assert (rc == sizeof (data));
+    nn_assert (test_isrcvbuf (part));
+    rc = nn_recv (sb, &zcbuf, NN_MSG, 0);
+    errno_assert (rc == sizeof (data));
+    nn_assert (!test_isrcvbuf (zcbuf));
+    nn_assert (memcmp (zcbuf, data, sizeof (data)) == 0);
+    rc = nn_freemsg (big);
+    errno_assert (rc == 0);
+    rc = nn_freemsg (part);
+    errno_assert (rc == 0);
+    rc = nn_freemsg (zcbuf);
+    errno_assert (rc == 0);
+    nn_assert (!test_rcvused [0] && !test_rcvused [1]);
+    rc = nn_close (sc);
+    errno_assert (rc == 0);
+    rc = nn_close (sb);
+    errno_assert (rc == 0);
+    rc = nn_setallocator (NN_ALLOC_USER, NULL);
+    errno_assert (rc == 0);
+
+    /*  Test the low-water mark. Once the sender's batch is full, it waits
+        for everything queued to be written before accepting more messages,
+        and no message gets stuck on the way. */
+    sb = nn_socket (AF_SP, NN_PAIR);
+    errno_assert (sb != -1);
+    rc = nn_bind (sb, SOCKET_ADDRESS);
+    errno_assert (rc >= 0);
+    sc = nn_socket (AF_SP, NN_PAIR);
+    errno_assert (sc != -1);
+    opt = 2;
+    rc = nn_setsockopt (sc, NN_SOL_SOCKET, NN_SNDBUFMSGS, &opt, sizeof (opt));
+    errno_assert (rc == 0);
+    opt = 0;
+    rc = nn_setsockopt (sc, NN_SOL_SOCKET, NN_SNDLOWATMSGS, &opt,
+        sizeof (opt));
+    errno_assert (rc == 0);
+    rc = nn_setsockopt (sc, NN_SOL_SOCKET, NN_SNDLOWAT, &opt, sizeof (opt));
+    errno_assert (rc == 0);
+    rc = nn_connect (sc, SOCKET_ADDRESS);
+    errno_assert (rc >= 0);
+    for (i = 0; i != 1000; ++i) {
+        rc = nn_send (sc, "ABC", 3, 0);
+        errno_assert (rc >= 0);
+        nn_assert (rc == 3);
+    }
+    for (i = 0; i != 1000; ++i) {
+        rc = nn_recv (sb, buf, sizeof (buf), 0);
+        errno_assert (rc >= 0);
+        nn_assert (rc == 3);
+    }
+    rc = nn_close (sc);
+    errno_assert (rc == 0);
+    rc = nn_close (sb);
+    errno_assert (rc == 0);
+
+#if !defined NN_HAVE_WINDOWS
+    /*  Check the message framing with and without compact headers. */
+    test_framing (0);
+    test_framing (1);
+
+    /*  Send regions of a file. */
+    test_filemsg ();
+
+    /*  Detect dead peers using heartbeats. */
+    test_heartbeat ();
+
+    /*  Check the messages against their checksums. */
+    test_crc ();
+#endif
+
     return 0;
 }
 
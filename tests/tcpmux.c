@@ -0,0 +1,212 @@
+/*
+    Copyright (c) 2013 250bpm s.r.o.
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"),
+    to deal in the Software without restriction, including without limitation
+    the rights to use, copy, modify, merge, publish, distribute, sublicense,
+    and/or sell copies of the Software, and to permit persons to whom
+    the Software is furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included
+    in all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+    THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+    FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+    IN THE SOFTWARE.
+*/
+
+#include "../src/nn.h"
+#include "../src/pair.h"
+#include "../src/reqrep.h"
+#include "../src/tcpmux.h"
+
+#include "../src/utils/err.c"
+#include "../src/utils/sleep.c"
+
+#include <string.h>
+#include <stdio.h>
+
+/*  Tests tcpmux transport. */
+
+#define SOCKET_ADDRESS "tcpmux://127.0.0.1:5596/a"
+
+#define NSOCKS 8
+
+int main ()
+{
+    int rc;
+    int sb;
+    int sc;
+    int i;
+    int j;
+    int sbs [NSOCKS];
+    int scs [NSOCKS];
+    char addr [64];
+    char buf [256];
+    char *data;
+
+    /*  Test the address parsing. */
+    sc = nn_socket (AF_SP, NN_PAIR);
+    errno_assert (sc != -1);
+    rc = nn_connect (sc, "tcpmux://127.0.0.1/a");
+    nn_assert (rc < 0 && nn_errno () == EINVAL);
+    rc = nn_connect (sc, "tcpmux://127.0.0.1:/a");
+    nn_assert (rc < 0 && nn_errno () == EINVAL);
+    rc = nn_connect (sc, "tcpmux://127.0.0.1;127.0.0.1:5596/a");
+    nn_assert (rc < 0 && nn_errno () == EINVAL);
+    rc = nn_bind (sc, "tcpmux://eth10000:5596/a");
+    nn_assert (rc < 0 && nn_errno () == ENODEV);
+    rc = nn_close (sc);
+    errno_assert (rc == 0);
+
+    /*  Ping-pong test. */
+    sb = nn_socket (AF_SP, NN_PAIR);
+    errno_assert (sb != -1);
+    rc = nn_bind (sb, SOCKET_ADDRESS);
+    errno_assert (rc >= 0);
+    sc = nn_socket (AF_SP, NN_PAIR);
+    errno_assert (sc != -1);
+    rc = nn_connect (sc, SOCKET_ADDRESS);
+    errno_assert (rc >= 0);
+
+    for (i = 0; i != 100; ++i) {
+        rc = nn_send (sc, "0123456789ABCDEFGHIJ", 20, 0);
+        errno_assert (rc == 20);
+        rc = nn_recv (sb, buf, sizeof (buf), 0);
+        errno_assert (rc == 20);
+        nn_assert (memcmp (buf, "0123456789ABCDEFGHIJ", 20) == 0);
+        rc = nn_send (sb, buf, 200, 0);
+        errno_assert (rc == 200);
+        rc = nn_recv (sc, buf, sizeof (buf), 0);
+        errno_assert (rc == 200);
+    }
+
+    data = nn_allocmsg (1000000, 0);
+    alloc_assert (data);
+    for (i = 0; i != 1000000; ++i)
+        data [i] = (char) i;
+    rc = nn_send (sc, &data, NN_MSG, 0);
+    errno_assert (rc == 1000000);
+    rc = nn_recv (sb, &data, NN_MSG, 0);
+    errno_assert (rc == 1000000);
+    for (i = 0; i != 1000000; ++i)
+        nn_assert (data [i] == (char) i);
+    rc = nn_freemsg (data);
+    errno_assert (rc == 0);
+
+    /*  Batch of messages bigger than the receive buffer. Reading from
+        the connection stops till the socket catches up. */
+    for (i = 0; i != 1000; ++i) {
+        rc = nn_send (sc, buf, sizeof (buf), 0);
+        errno_assert (rc == sizeof (buf));
+    }
+    nn_sleep (100);
+    for (i = 0; i != 1000; ++i) {
+        rc = nn_recv (sb, buf, sizeof (buf), 0);
+        errno_assert (rc == sizeof (buf));
+    }
+
+    /*  The name can be bound to only once. */
+    sbs [0] = nn_socket (AF_SP, NN_PAIR);
+    errno_assert (sbs [0] != -1);
+    rc = nn_bind (sbs [0], SOCKET_ADDRESS);
+    nn_assert (rc < 0 && nn_errno () == EADDRINUSE);
+    rc = nn_close (sbs [0]);
+    errno_assert (rc == 0);
+
+    rc = nn_close (sc);
+    errno_assert (rc == 0);
+
+    /*  The channel is refused if there's no socket bound to the name. */
+    sc = nn_socket (AF_SP, NN_PAIR);
+    errno_assert (sc != -1);
+    rc = nn_connect (sc, "tcpmux://127.0.0.1:5596/other");
+    errno_assert (rc >= 0);
+    nn_sleep (100);
+    rc = nn_send (sc, "ABC", 3, NN_DONTWAIT);
+    nn_assert (rc < 0 && nn_errno () == EAGAIN);
+    rc = nn_close (sc);
+    errno_assert (rc == 0);
+    rc = nn_close (sb);
+    errno_assert (rc == 0);
+
+    /*  Many pairs of sockets talking over the same connection. */
+    for (i = 0; i != NSOCKS; ++i) {
+        sprintf (addr, "tcpmux://127.0.0.1:5596/%d", i);
+        sbs [i] = nn_socket (AF_SP, NN_PAIR);
+        errno_assert (sbs [i] != -1);
+        rc = nn_bind (sbs [i], addr);
+        errno_assert (rc >= 0);
+        scs [i] = nn_socket (AF_SP, NN_PAIR);
+        errno_assert (scs [i] != -1);
+        rc = nn_connect (scs [i], addr);
+        errno_assert (rc >= 0);
+    }
+    for (j = 0; j != 10; ++j) {
+        for (i = 0; i != NSOCKS; ++i) {
+            rc = nn_send (scs [i], &i, sizeof (i), 0);
+            errno_assert (rc == sizeof (i));
+        }
+        for (i = 0; i != NSOCKS; ++i) {
+            rc = nn_recv (sbs [i], buf, sizeof (buf), 0);
+            errno_assert (rc == sizeof (i));
+            nn_assert (memcmp (buf, &i, sizeof (i)) == 0);
+            rc = nn_send (sbs [i], buf, rc, 0);
+            errno_assert (rc == sizeof (i));
+        }
+        for (i = 0; i != NSOCKS; ++i) {
+            rc = nn_recv (scs [i], buf, sizeof (buf), 0);
+            errno_assert (rc == sizeof (i));
+            nn_assert (memcmp (buf, &i, sizeof (i)) == 0);
+        }
+    }
+    for (i = 0; i != NSOCKS; ++i) {
+        rc = nn_close (scs [i]);
+        errno_assert (rc == 0);
+        rc = nn_close (sbs [i]);
+        errno_assert (rc == 0);
+    }
+
+    /*  Request/reply. The header of the request is carried in the frame
+        along with the body. */
+    sb = nn_socket (AF_SP, NN_REP);
+    errno_assert (sb != -1);
+    rc = nn_bind (sb, SOCKET_ADDRESS);
+    errno_assert (rc >= 0);
+    sc = nn_socket (AF_SP, NN_REQ);
+    errno_assert (sc != -1);
+    rc = nn_connect (sc, SOCKET_ADDRESS);
+    errno_assert (rc >= 0);
+    rc = nn_send (sc, "ABC", 3, 0);
+    errno_assert (rc == 3);
+    rc = nn_recv (sb, buf, sizeof (buf), 0);
+    errno_assert (rc == 3);
+    rc = nn_send (sb, "DEFG", 4, 0);
+    errno_assert (rc == 4);
+    rc = nn_recv (sc, buf, sizeof (buf), 0);
+    errno_assert (rc == 4);
+    nn_assert (memcmp (buf, "DEFG", 4) == 0);
+    rc = nn_close (sc);
+    errno_assert (rc == 0);
+
+    /*  The channel is refused if the protocols don't match. */
+    sc = nn_socket (AF_SP, NN_PAIR);
+    errno_assert (sc != -1);
+    rc = nn_connect (sc, SOCKET_ADDRESS);
+    errno_assert (rc >= 0);
+    nn_sleep (100);
+    rc = nn_send (sc, "ABC", 3, NN_DONTWAIT);
+    nn_assert (rc < 0 && nn_errno () == EAGAIN);
+    rc = nn_close (sc);
+    errno_assert (rc == 0);
+    rc = nn_close (sb);
+    errno_assert (rc == 0);
+
+    return 0;
+}
+
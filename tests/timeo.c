@@ -56,6 +56,26 @@ int main ()
     errno_assert (rc < 0 && nn_errno () == EAGAIN);
     time_assert (elapsed, 100000);
 
+    /*  Spinning before going to sleep doesn't affect the timeouts. */
+    timeo = -1;
+    rc = nn_setsockopt (s, NN_SOL_SOCKET, NN_RCVSPIN, &timeo, sizeof (timeo));
+    nn_assert (rc < 0 && nn_errno () == EINVAL);
+    timeo = 10000;
+    rc = nn_setsockopt (s, NN_SOL_SOCKET, NN_RCVSPIN, &timeo, sizeof (timeo));
+    errno_assert (rc == 0);
+    rc = nn_setsockopt (s, NN_SOL_SOCKET, NN_SNDSPIN, &timeo, sizeof (timeo));
+    errno_assert (rc == 0);
+    nn_stopwatch_init (&stopwatch);
+    rc = nn_recv (s, buf, sizeof (buf), 0);
+    elapsed = nn_stopwatch_term (&stopwatch);
+    errno_assert (rc < 0 && nn_errno () == EAGAIN);
+    time_assert (elapsed, 100000);
+    nn_stopwatch_init (&stopwatch);
+    rc = nn_send (s, "ABC", 3, 0);
+    elapsed = nn_stopwatch_term (&stopwatch);
+    errno_assert (rc < 0 && nn_errno () == EAGAIN);
+    time_assert (elapsed, 100000);
+
     rc = nn_close (s);
     errno_assert (rc == 0);
 
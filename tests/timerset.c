@@ -0,0 +1,146 @@
+/*
+    Copyright (c) 2013 250bpm s.r.o.
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"),
+    to deal in the Software without restriction, including without limitation
+    the rights to use, copy, modify, merge, publish, distribute, sublicense,
+    and/or sell copies of the Software, and to permit persons to whom
+    the Software is furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included
+    in all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+    THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+    FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+    IN THE SOFTWARE.
+*/
+
+#include "../src/utils/err.c"
+#include "../src/utils/list.c"
+#include "../src/utils/clock.c"
+#include "../src/utils/sleep.c"
+#include "../src/aio/timerset.c"
+
+#define TEST_TIMERS 1000
+
+int main ()
+{
+    struct nn_timerset timerset;
+    struct nn_timerset_hndl hndls [TEST_TIMERS];
+    struct nn_timerset_hndl *hndl;
+    struct nn_clock clock;
+    uint64_t start;
+    uint64_t elapsed;
+    int timeout;
+    int rc;
+    int i;
+    int fired;
+
+    nn_clock_init (&clock);
+    nn_timerset_init (&timerset);
+
+    /*  Empty timerset. */
+    nn_assert (nn_timerset_timeout (&timerset) == -1);
+    rc = nn_timerset_event (&timerset, &hndl);
+    nn_assert (rc == -EAGAIN);
+
+    /*  Adding a timeout earlier than any other one has to be reported. */
+    nn_timerset_hndl_init (&hndls [0]);
+    rc = nn_timerset_add (&timerset, 100, &hndls [0]);
+    nn_assert (rc == 1);
+    nn_assert (nn_timerset_hndl_isactive (&hndls [0]));
+    timeout = nn_timerset_timeout (&timerset);
+    nn_assert (timeout > 50 && timeout <= 100 + NN_TIMERSET_TICK);
+    nn_timerset_hndl_init (&hndls [1]);
+    rc = nn_timerset_add (&timerset, 200, &hndls [1]);
+    nn_assert (rc == 0);
+    nn_timerset_hndl_init (&hndls [2]);
+    rc = nn_timerset_add (&timerset, 10, &hndls [2]);
+    nn_assert (rc == 1);
+
+    /*  Removed timeout must not fire. */
+    nn_timerset_rm (&timerset, &hndls [2]);
+    nn_assert (!nn_timerset_hndl_isactive (&hndls [2]));
+    nn_timerset_hndl_term (&hndls [2]);
+
+    /*  Timeouts fire in order and not prematurely. */
+    start = nn_clock_now (&clock);
+    for (i = 0; i != 2; ++i) {
+        while (1) {
+            timeout = nn_timerset_timeout (&timerset);
+            nn_assert (timeout >= 0);
+            nn_sleep (timeout);
+            nn_timerset_refresh (&timerset);
+            rc = nn_timerset_event (&timerset, &hndl);
+            if (rc == 0)
+                break;
+            errnum_assert (rc == -EAGAIN, -rc);
+        }
+        elapsed = nn_clock_now (&clock) - start;
+        nn_assert (hndl == &hndls [i]);
+        nn_assert (elapsed >= (i + 1) * 100 - 1);
+        nn_assert (!nn_timerset_hndl_isactive (hndl));
+        nn_timerset_hndl_term (hndl);
+    }
+    nn_assert (nn_timerset_timeout (&timerset) == -1);
+
+    /*  Timeouts longer than a single rotation of the wheel mixed with
+        short ones. */
+    nn_timerset_hndl_init (&hndls [0]);
+    nn_timerset_add (&timerset, NN_TIMERSET_SLOTS * NN_TIMERSET_TICK + 20,
+        &hndls [0]);
+    nn_timerset_hndl_init (&hndls [1]);
+    nn_timerset_add (&timerset, 20, &hndls [1]);
+    start = nn_clock_now (&clock);
+    while (1) {
+        timeout = nn_timerset_timeout (&timerset);
+        nn_assert (timeout >= 0);
+        nn_sleep (timeout);
+        nn_timerset_refresh (&timerset);
+        rc = nn_timerset_event (&timerset, &hndl);
+        if (rc == 0)
+            break;
+    }
+    nn_assert (hndl == &hndls [1]);
+    nn_timerset_hndl_term (&hndls [1]);
+    timeout = nn_timerset_timeout (&timerset);
+    nn_assert (timeout > 0);
+    nn_timerset_rm (&timerset, &hndls [0]);
+    nn_timerset_hndl_term (&hndls [0]);
+    nn_assert (nn_timerset_timeout (&timerset) == -1);
+
+    /*  Lots of short timeouts. */
+    for (i = 0; i != TEST_TIMERS; ++i) {
+        nn_timerset_hndl_init (&hndls [i]);
+        nn_timerset_add (&timerset, i % 50, &hndls [i]);
+    }
+    for (i = 0; i < TEST_TIMERS; i += 2)
+        nn_timerset_rm (&timerset, &hndls [i]);
+    fired = 0;
+    while (fired != TEST_TIMERS / 2) {
+        timeout = nn_timerset_timeout (&timerset);
+        nn_assert (timeout >= 0);
+        nn_sleep (timeout);
+        nn_timerset_refresh (&timerset);
+        while (1) {
+            rc = nn_timerset_event (&timerset, &hndl);
+            if (rc == -EAGAIN)
+                break;
+            nn_assert ((hndl - hndls) % 2 == 1);
+            ++fired;
+        }
+    }
+    nn_assert (nn_timerset_timeout (&timerset) == -1);
+    for (i = 0; i != TEST_TIMERS; ++i)
+        nn_timerset_hndl_term (&hndls [i]);
+
+    nn_timerset_term (&timerset);
+    nn_clock_term (&clock);
+
+    return 0;
+}
@@ -0,0 +1,100 @@
+/*
+    Copyright (c) 2012-2013 250bpm s.r.o.
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"),
+    to deal in the Software without restriction, including without limitation
+    the rights to use, copy, modify, merge, publish, distribute, sublicense,
+    and/or sell copies of the Software, and to permit persons to whom
+    the Software is furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included
+    in all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+    THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+    FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+    IN THE SOFTWARE.
+*/
+
+#include "../src/protocols/pubsub/topics.c"
+#include "../src/utils/alloc.c"
+#include "../src/utils/mutex.c"
+#include "../src/utils/err.c"
+
+/*  Counts the strings in the set. */
+void walk_fn (const uint8_t *data, size_t size, void *arg)
+{
+    ++*((int*) arg);
+}
+
+int main ()
+{
+    int rc;
+    struct nn_topics topics;
+    int count;
+    int i;
+    uint8_t key [2];
+
+    /*  Try matching with an empty set. */
+    nn_topics_init (&topics);
+    rc = nn_topics_match (&topics, (const uint8_t*) "", 0);
+    nn_assert (rc == 0);
+    rc = nn_topics_unsubscribe (&topics, (const uint8_t*) "A", 1);
+    nn_assert (rc == -EINVAL);
+
+    /*  Exact matching, no prefixes. */
+    rc = nn_topics_subscribe (&topics, (const uint8_t*) "ABC", 3);
+    nn_assert (rc == 1);
+    rc = nn_topics_subscribe (&topics, (const uint8_t*) "ABC", 3);
+    nn_assert (rc == 0);
+    rc = nn_topics_subscribe (&topics, (const uint8_t*) "", 0);
+    nn_assert (rc == 1);
+    rc = nn_topics_match (&topics, (const uint8_t*) "ABC", 3);
+    nn_assert (rc == 1);
+    rc = nn_topics_match (&topics, (const uint8_t*) "AB", 2);
+    nn_assert (rc == 0);
+    rc = nn_topics_match (&topics, (const uint8_t*) "ABCD", 4);
+    nn_assert (rc == 0);
+    rc = nn_topics_match (&topics, (const uint8_t*) "", 0);
+    nn_assert (rc == 1);
+    rc = nn_topics_unsubscribe (&topics, (const uint8_t*) "ABC", 3);
+    nn_assert (rc == 0);
+    rc = nn_topics_unsubscribe (&topics, (const uint8_t*) "ABC", 3);
+    nn_assert (rc == 1);
+    rc = nn_topics_match (&topics, (const uint8_t*) "ABC", 3);
+    nn_assert (rc == 0);
+    rc = nn_topics_unsubscribe (&topics, (const uint8_t*) "", 0);
+    nn_assert (rc == 1);
+
+    /*  Grow the table and remove every other string so that the entries
+        have to be moved back in the probe sequences. */
+    for (i = 0; i != 1000; ++i) {
+        key [0] = (uint8_t) (i / 256);
+        key [1] = (uint8_t) (i % 256);
+        rc = nn_topics_subscribe (&topics, key, 2);
+        nn_assert (rc == 1);
+    }
+    for (i = 0; i < 1000; i += 2) {
+        key [0] = (uint8_t) (i / 256);
+        key [1] = (uint8_t) (i % 256);
+        rc = nn_topics_unsubscribe (&topics, key, 2);
+        nn_assert (rc == 1);
+    }
+    for (i = 0; i != 1000; ++i) {
+        key [0] = (uint8_t) (i / 256);
+        key [1] = (uint8_t) (i % 256);
+        rc = nn_topics_match (&topics, key, 2);
+        nn_assert (rc == i % 2);
+    }
+    count = 0;
+    nn_topics_walk (&topics, walk_fn, &count);
+    nn_assert (count == 500);
+    nn_topics_term (&topics);
+
+    return 0;
+}
+
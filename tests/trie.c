@@ -22,12 +22,50 @@
 
 #include "../src/protocols/pubsub/trie.c"
 #include "../src/utils/alloc.c"
+#include "../src/utils/mutex.c"
 #include "../src/utils/err.c"
 
+/*  Counts the strings in the trie and their total length. */
+struct walk_stats {
+    int count;
+    size_t size;
+};
+
+void walk_fn (const uint8_t *data, size_t size, void *arg)
+{
+    ((struct walk_stats*) arg)->count++;
+    ((struct walk_stats*) arg)->size += size;
+}
+
+/*  Sums the user data of the matching subscriptions. */
+void match_fn (void *data, void *arg)
+{
+    *((int*) arg) += *((int*) data);
+}
+
 int main ()
 {
     int rc;
     struct nn_trie trie;
+    struct walk_stats stats;
+    int v1;
+    int v2;
+    int v3;
+    int sum;
+    void **slot;
+    char c;
+    char buf [2];
+    int i;
+    uint8_t key [3];
+    uint8_t longkey [600];
+    struct nn_trie built;
+    uint8_t topics [1000][16];
+    const uint8_t *strs [1004];
+    size_t sizes [1004];
+    size_t nodes;
+    size_t bytes;
+    size_t nodes2;
+    size_t bytes2;
 
     /*  Try matching with an empty trie. */
     nn_trie_init (&trie);
@@ -203,6 +241,268 @@ int main ()
     nn_assert (rc == 1);
     nn_trie_term (&trie);
 
+    /*  Unsubscribing from an empty trie fails. */
+    nn_trie_init (&trie);
+    rc = nn_trie_unsubscribe (&trie, (const uint8_t*) "A", 1);
+    nn_assert (rc == -EINVAL);
+    nn_trie_term (&trie);
+
+    /*  Data shorter than the subscriptions don't match. */
+    nn_trie_init (&trie);
+    rc = nn_trie_subscribe (&trie, (const uint8_t*) "AB", 2);
+    nn_assert (rc == 1);
+    rc = nn_trie_subscribe (&trie, (const uint8_t*) "AC", 2);
+    nn_assert (rc == 1);
+    rc = nn_trie_match (&trie, (const uint8_t*) "A", 1);
+    nn_assert (rc == 0);
+    nn_trie_term (&trie);
+
+    /*  Walk the trie. Each subscription is visited once. */
+    nn_trie_init (&trie);
+    rc = nn_trie_subscribe (&trie, (const uint8_t*) "", 0);
+    nn_assert (rc == 1);
+    rc = nn_trie_subscribe (&trie, (const uint8_t*) "ABCDEFGHIJKLMNOP", 16);
+    nn_assert (rc == 1);
+    rc = nn_trie_subscribe (&trie, (const uint8_t*) "ABC", 3);
+    nn_assert (rc == 1);
+    rc = nn_trie_subscribe (&trie, (const uint8_t*) "ABC", 3);
+    nn_assert (rc == 0);
+    rc = nn_trie_subscribe (&trie, (const uint8_t*) "ABD", 3);
+    nn_assert (rc == 1);
+    stats.count = 0;
+    stats.size = 0;
+    nn_trie_walk (&trie, walk_fn, &stats);
+    nn_assert (stats.count == 4);
+    nn_assert (stats.size == 22);
+    nn_trie_term (&trie);
+
+    /*  Associate user data with the subscriptions and find all the matching
+        subscriptions in a single pass. */
+    nn_trie_init (&trie);
+    v1 = 1;
+    v2 = 10;
+    v3 = 100;
+    rc = nn_trie_subscribe (&trie, (const uint8_t*) "A", 1);
+    nn_assert (rc == 1);
+    rc = nn_trie_subscribe (&trie, (const uint8_t*) "ABC", 3);
+    nn_assert (rc == 1);
+    rc = nn_trie_subscribe (&trie, (const uint8_t*) "ABD", 3);
+    nn_assert (rc == 1);
+    slot = nn_trie_data (&trie, (const uint8_t*) "AB", 2);
+    nn_assert (slot == NULL);
+    slot = nn_trie_data (&trie, (const uint8_t*) "A", 1);
+    nn_assert (slot && *slot == NULL);
+    *slot = &v1;
+    slot = nn_trie_data (&trie, (const uint8_t*) "ABC", 3);
+    nn_assert (slot && *slot == NULL);
+    *slot = &v2;
+    slot = nn_trie_data (&trie, (const uint8_t*) "ABD", 3);
+    nn_assert (slot && *slot == NULL);
+    *slot = &v3;
+    sum = 0;
+    nn_trie_match_all (&trie, (const uint8_t*) "ABCD", 4, match_fn, &sum);
+    nn_assert (sum == 11);
+    sum = 0;
+    nn_trie_match_all (&trie, (const uint8_t*) "AB", 2, match_fn, &sum);
+    nn_assert (sum == 1);
+    sum = 0;
+    nn_trie_match_all (&trie, (const uint8_t*) "B", 1, match_fn, &sum);
+    nn_assert (sum == 0);
+
+    /*  The subscription and its data survive conversion of the node to
+        a dense array and back. */
+    for (c = 'E'; c != 'N'; ++c) {
+        rc = nn_trie_subscribe (&trie, (const uint8_t*) "ABD", 3);
+        nn_assert (rc == 0);
+        rc = nn_trie_subscribe (&trie, (const uint8_t*) "A", 1);
+        nn_assert (rc == 0);
+        rc = nn_trie_unsubscribe (&trie, (const uint8_t*) "A", 1);
+        nn_assert (rc == 0);
+        rc = nn_trie_unsubscribe (&trie, (const uint8_t*) "ABD", 3);
+        nn_assert (rc == 0);
+        buf [0] = 'A';
+        buf [1] = c;
+        rc = nn_trie_subscribe (&trie, (const uint8_t*) buf, 2);
+        nn_assert (rc == 1);
+    }
+    for (c = 'E'; c != 'N'; ++c) {
+        buf [0] = 'A';
+        buf [1] = c;
+        rc = nn_trie_unsubscribe (&trie, (const uint8_t*) buf, 2);
+        nn_assert (rc == 1);
+    }
+    sum = 0;
+    nn_trie_match_all (&trie, (const uint8_t*) "ABD", 3, match_fn, &sum);
+    nn_assert (sum == 101);
+    *nn_trie_data (&trie, (const uint8_t*) "A", 1) = NULL;
+    rc = nn_trie_unsubscribe (&trie, (const uint8_t*) "A", 1);
+    nn_assert (rc == 1);
+    nn_trie_term (&trie);
+
+    /*  Grow nodes through all the size classes and back, twice, so that
+        the deallocated nodes get reused. */
+    nn_trie_init (&trie);
+    key [0] = 'X';
+    for (c = 0; c != 2; ++c) {
+        for (i = 0; i != 256; ++i) {
+            key [1] = (uint8_t) i;
+            key [2] = (uint8_t) (255 - i);
+            rc = nn_trie_subscribe (&trie, key, 3);
+            nn_assert (rc == 1);
+        }
+        for (i = 0; i != 256; ++i) {
+            key [1] = (uint8_t) i;
+            key [2] = (uint8_t) (255 - i);
+            nn_assert (nn_trie_match (&trie, key, 3) == 1);
+            key [2] = (uint8_t) i;
+            nn_assert (nn_trie_match (&trie, key, 3) == (i * 2 == 255));
+        }
+        for (i = 0; i != 256; ++i) {
+            key [1] = (uint8_t) i;
+            key [2] = (uint8_t) (255 - i);
+            rc = nn_trie_unsubscribe (&trie, key, 3);
+            nn_assert (rc == 1);
+        }
+        key [1] = 0;
+        key [2] = 255;
+        nn_assert (nn_trie_match (&trie, key, 3) == 0);
+    }
+    nn_trie_term (&trie);
+
+    /*  Fill in the gaps of a dense array and convert it back to sparse. */
+    nn_trie_init (&trie);
+    key [0] = 'Z';
+    for (i = 0; i != 20; ++i) {
+        key [1] = (uint8_t) ('a' + (i % 10) * 2 + i / 10);
+        rc = nn_trie_subscribe (&trie, key, 2);
+        nn_assert (rc == 1);
+    }
+    for (i = 0; i != 20; ++i) {
+        key [1] = (uint8_t) ('a' + (i % 10) * 2 + i / 10);
+        rc = nn_trie_unsubscribe (&trie, key, 2);
+        nn_assert (rc == 1);
+    }
+    nn_assert (trie.root == NULL);
+    nn_trie_term (&trie);
+
+    /*  Long prefixes are stored out of line. Check splitting and merging of
+        such prefixes, including the ones longer than NN_TRIE_PREFIX_MAX. */
+    nn_trie_init (&trie);
+    rc = nn_trie_subscribe (&trie,
+        (const uint8_t*) "md.equities.nasdaq.level2.AAPL", 30);
+    nn_assert (rc == 1);
+    rc = nn_trie_subscribe (&trie,
+        (const uint8_t*) "md.equities.nasdaq.level2.MSFT", 30);
+    nn_assert (rc == 1);
+    rc = nn_trie_subscribe (&trie, (const uint8_t*) "md.equities.n", 13);
+    nn_assert (rc == 1);
+    rc = nn_trie_match (&trie,
+        (const uint8_t*) "md.equities.nasdaq.level2.MSFT.bid", 34);
+    nn_assert (rc == 1);
+    rc = nn_trie_match (&trie, (const uint8_t*) "md.equities.", 12);
+    nn_assert (rc == 0);
+    slot = nn_trie_data (&trie,
+        (const uint8_t*) "md.equities.nasdaq.level2.AAPL", 30);
+    nn_assert (slot && *slot == NULL);
+    rc = nn_trie_unsubscribe (&trie, (const uint8_t*) "md.equities.n", 13);
+    nn_assert (rc == 1);
+    rc = nn_trie_unsubscribe (&trie,
+        (const uint8_t*) "md.equities.nasdaq.level2.AAPL", 30);
+    nn_assert (rc == 1);
+    rc = nn_trie_match (&trie,
+        (const uint8_t*) "md.equities.nasdaq.level2.AAPL", 30);
+    nn_assert (rc == 0);
+    rc = nn_trie_match (&trie,
+        (const uint8_t*) "md.equities.nasdaq.level2.MSFT", 30);
+    nn_assert (rc == 1);
+    memset (longkey, 'x', sizeof (longkey));
+    rc = nn_trie_subscribe (&trie, longkey, sizeof (longkey));
+    nn_assert (rc == 1);
+    rc = nn_trie_subscribe (&trie, longkey, 300);
+    nn_assert (rc == 1);
+    rc = nn_trie_match (&trie, longkey, 599);
+    nn_assert (rc == 1);
+    rc = nn_trie_unsubscribe (&trie, longkey, 300);
+    nn_assert (rc == 1);
+    rc = nn_trie_match (&trie, longkey, 599);
+    nn_assert (rc == 0);
+    rc = nn_trie_match (&trie, longkey, sizeof (longkey));
+    nn_assert (rc == 1);
+    stats.count = 0;
+    stats.size = 0;
+    nn_trie_walk (&trie, walk_fn, &stats);
+    nn_assert (stats.count == 2 && stats.size == 630);
+    nn_trie_term (&trie);
+
+    /*  Build a trie from a sorted list in one go. It's the same as the trie
+        the strings are subscribed to one by one. */
+    strs [0] = (const uint8_t*) "";
+    sizes [0] = 0;
+    strs [1] = (const uint8_t*) "topic.";
+    sizes [1] = 6;
+    for (i = 0; i != 1000; ++i) {
+        sprintf ((char*) topics [i], "topic.%03d", i);
+        strs [i + 2] = topics [i];
+        sizes [i + 2] = 9;
+    }
+    strs [1002] = topics [999];
+    sizes [1002] = 9;
+    strs [1003] = longkey;
+    sizes [1003] = sizeof (longkey);
+    nn_trie_init (&trie);
+    for (i = 0; i != 1004; ++i)
+        nn_trie_subscribe (&trie, strs [i], sizes [i]);
+    nn_trie_init (&built);
+    rc = nn_trie_build (&built, strs, sizes, 1004);
+    nn_assert (rc == 0);
+    nn_trie_stats (&trie, &nodes, &bytes);
+    nn_trie_stats (&built, &nodes2, &bytes2);
+    nn_assert (nodes == nodes2 && bytes2 <= bytes);
+    stats.count = 0;
+    stats.size = 0;
+    nn_trie_walk (&built, walk_fn, &stats);
+    nn_assert (stats.count == 1003 && stats.size == 6 + 9000 + 600);
+    rc = nn_trie_match (&built, (const uint8_t*) "topic.5", 7);
+    nn_assert (rc == 1);
+    rc = nn_trie_unsubscribe (&built, (const uint8_t*) "", 0);
+    nn_assert (rc == 1);
+    rc = nn_trie_unsubscribe (&built, (const uint8_t*) "topic.", 6);
+    nn_assert (rc == 1);
+    rc = nn_trie_match (&built, (const uint8_t*) "topic.5", 7);
+    nn_assert (rc == 0);
+    rc = nn_trie_match (&built, (const uint8_t*) "topic.512x", 10);
+    nn_assert (rc == 1);
+    rc = nn_trie_unsubscribe (&built, topics [999], 9);
+    nn_assert (rc == 0);
+    rc = nn_trie_unsubscribe (&built, topics [999], 9);
+    nn_assert (rc == 1);
+    rc = nn_trie_match (&built, topics [999], 9);
+    nn_assert (rc == 0);
+    rc = nn_trie_subscribe (&built, (const uint8_t*) "topic.1000", 10);
+    nn_assert (rc == 1);
+    rc = nn_trie_match (&built, (const uint8_t*) "topic.1000", 10);
+    nn_assert (rc == 1);
+    rc = nn_trie_match (&built, longkey, sizeof (longkey));
+    nn_assert (rc == 1);
+
+    /*  The strings must be sorted and the trie empty. */
+    rc = nn_trie_build (&built, strs, sizes, 1);
+    nn_assert (rc == -EINVAL);
+    nn_trie_term (&built);
+    nn_trie_init (&built);
+    rc = nn_trie_build (&built, strs + 1, sizes + 1, 1003);
+    nn_assert (rc == 0);
+    nn_trie_term (&built);
+    nn_trie_init (&built);
+    strs [1] = (const uint8_t*) "zzz";
+    sizes [1] = 3;
+    rc = nn_trie_build (&built, strs, sizes, 1004);
+    nn_assert (rc == -EINVAL);
+    nn_trie_stats (&built, &nodes, &bytes);
+    nn_assert (nodes == 0 && bytes == 0);
+    nn_trie_term (&built);
+    nn_trie_term (&trie);
+
     return 0;
 }
 
@@ -0,0 +1,210 @@
+/*
+    Copyright (c) 2013 250bpm s.r.o.
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"),
+    to deal in the Software without restriction, including without limitation
+    the rights to use, copy, modify, merge, publish, distribute, sublicense,
+    and/or sell copies of the Software, and to permit persons to whom
+    the Software is furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included
+    in all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+    THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+    FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+    IN THE SOFTWARE.
+*/
+
+#include "../src/nn.h"
+#include "../src/pubsub.h"
+#include "../src/survey.h"
+#include "../src/pair.h"
+#include "../src/udp.h"
+
+#include "../src/utils/err.c"
+#include "../src/utils/sleep.c"
+
+#include <string.h>
+
+/*  Tests UDP transport. */
+
+#define SOCKET_ADDRESS_A "udp://127.0.0.1:5570"
+#define SOCKET_ADDRESS_B "udp://127.0.0.1:5571"
+
+int main ()
+{
+#if !defined NN_HAVE_WINDOWS
+    int rc;
+    int pub;
+    int sub1;
+    int sub2;
+    int surveyor;
+    int respondent1;
+    int respondent2;
+    int pair;
+    int i;
+    int val;
+    size_t sz;
+    char buf [16];
+    char *data;
+
+    /*  Only the protocols tolerating message loss can use the transport. */
+    pair = nn_socket (AF_SP, NN_PAIR);
+    errno_assert (pair != -1);
+    rc = nn_connect (pair, SOCKET_ADDRESS_A);
+    nn_assert (rc < 0 && nn_errno () == EPROTONOSUPPORT);
+    rc = nn_close (pair);
+    errno_assert (rc == 0);
+
+    /*  Check the address parsing and the transport options. */
+    pub = nn_socket (AF_SP, NN_PUB);
+    errno_assert (pub != -1);
+    rc = nn_bind (pub, "udp://127.0.0.1");
+    nn_assert (rc < 0 && nn_errno () == EINVAL);
+    rc = nn_connect (pub, "udp://127.0.0.1:");
+    nn_assert (rc < 0 && nn_errno () == EINVAL);
+    sz = sizeof (val);
+    rc = nn_getsockopt (pub, NN_UDP, NN_UDP_KEEPALIVE, &val, &sz);
+    errno_assert (rc == 0);
+    nn_assert (sz == sizeof (val) && val == 1000);
+    val = 0;
+    rc = nn_setsockopt (pub, NN_UDP, NN_UDP_KEEPALIVE, &val, sizeof (val));
+    nn_assert (rc < 0 && nn_errno () == EINVAL);
+    val = 50;
+    rc = nn_setsockopt (pub, NN_UDP, NN_UDP_KEEPALIVE, &val, sizeof (val));
+    errno_assert (rc == 0);
+
+    /*  The bound publisher sends the messages to all the subscribers that
+        connected to it. Each subscriber filters the messages itself. */
+    rc = nn_bind (pub, SOCKET_ADDRESS_A);
+    errno_assert (rc >= 0);
+    sub1 = nn_socket (AF_SP, NN_SUB);
+    errno_assert (sub1 != -1);
+    rc = nn_setsockopt (sub1, NN_SUB, NN_SUB_SUBSCRIBE, "", 0);
+    errno_assert (rc == 0);
+    val = 1000;
+    rc = nn_setsockopt (sub1, NN_SOL_SOCKET, NN_RCVTIMEO, &val, sizeof (val));
+    errno_assert (rc == 0);
+    rc = nn_connect (sub1, SOCKET_ADDRESS_A);
+    errno_assert (rc >= 0);
+    sub2 = nn_socket (AF_SP, NN_SUB);
+    errno_assert (sub2 != -1);
+    rc = nn_setsockopt (sub2, NN_SUB, NN_SUB_SUBSCRIBE, "A", 1);
+    errno_assert (rc == 0);
+    rc = nn_setsockopt (sub2, NN_SOL_SOCKET, NN_RCVTIMEO, &val, sizeof (val));
+    errno_assert (rc == 0);
+    rc = nn_connect (sub2, SOCKET_ADDRESS_A);
+    errno_assert (rc >= 0);
+    nn_sleep (100);
+
+    for (i = 0; i != 10; ++i) {
+        rc = nn_send (pub, i % 2 ? "AXY" : "BXY", 3, 0);
+        errno_assert (rc >= 0);
+        nn_assert (rc == 3);
+    }
+    for (i = 0; i != 10; ++i) {
+        rc = nn_recv (sub1, buf, sizeof (buf), 0);
+        errno_assert (rc >= 0);
+        nn_assert (rc == 3);
+        nn_assert (memcmp (buf, i % 2 ? "AXY" : "BXY", 3) == 0);
+    }
+    for (i = 0; i != 5; ++i) {
+        rc = nn_recv (sub2, buf, sizeof (buf), 0);
+        errno_assert (rc >= 0);
+        nn_assert (rc == 3 && memcmp (buf, "AXY", 3) == 0);
+    }
+
+    /*  Large messages are sent as a single datagram as well. */
+    data = nn_allocmsg (60000, 0);
+    alloc_assert (data);
+    memset (data, 'A', 60000);
+    rc = nn_send (pub, &data, NN_MSG, 0);
+    errno_assert (rc == 60000);
+    rc = nn_recv (sub1, &data, NN_MSG, 0);
+    errno_assert (rc == 60000);
+    nn_assert (data [0] == 'A' && data [59999] == 'A');
+    rc = nn_freemsg (data);
+    errno_assert (rc == 0);
+    rc = nn_recv (sub2, &data, NN_MSG, 0);
+    errno_assert (rc == 60000);
+    rc = nn_freemsg (data);
+    errno_assert (rc == 0);
+
+    rc = nn_close (sub2);
+    errno_assert (rc == 0);
+    rc = nn_close (sub1);
+    errno_assert (rc == 0);
+    rc = nn_close (pub);
+    errno_assert (rc == 0);
+
+    /*  The connected publisher sends the messages to the bound subscriber. */
+    sub1 = nn_socket (AF_SP, NN_SUB);
+    errno_assert (sub1 != -1);
+    rc = nn_setsockopt (sub1, NN_SUB, NN_SUB_SUBSCRIBE, "", 0);
+    errno_assert (rc == 0);
+    rc = nn_setsockopt (sub1, NN_SOL_SOCKET, NN_RCVTIMEO, &val, sizeof (val));
+    errno_assert (rc == 0);
+    rc = nn_bind (sub1, SOCKET_ADDRESS_A);
+    errno_assert (rc >= 0);
+    pub = nn_socket (AF_SP, NN_PUB);
+    errno_assert (pub != -1);
+    rc = nn_connect (pub, SOCKET_ADDRESS_A);
+    errno_assert (rc >= 0);
+    rc = nn_send (pub, "ABC", 3, 0);
+    errno_assert (rc == 3);
+    rc = nn_recv (sub1, buf, sizeof (buf), 0);
+    errno_assert (rc == 3);
+    nn_assert (memcmp (buf, "ABC", 3) == 0);
+    rc = nn_close (pub);
+    errno_assert (rc == 0);
+    rc = nn_close (sub1);
+    errno_assert (rc == 0);
+
+    /*  The survey is sent to all the respondents and their responses are
+        routed back to the surveyor. */
+    surveyor = nn_socket (AF_SP, NN_SURVEYOR);
+    errno_assert (surveyor != -1);
+    rc = nn_bind (surveyor, SOCKET_ADDRESS_B);
+    errno_assert (rc >= 0);
+    respondent1 = nn_socket (AF_SP, NN_RESPONDENT);
+    errno_assert (respondent1 != -1);
+    rc = nn_connect (respondent1, SOCKET_ADDRESS_B);
+    errno_assert (rc >= 0);
+    respondent2 = nn_socket (AF_SP, NN_RESPONDENT);
+    errno_assert (respondent2 != -1);
+    rc = nn_connect (respondent2, SOCKET_ADDRESS_B);
+    errno_assert (rc >= 0);
+    nn_sleep (100);
+
+    rc = nn_send (surveyor, "ABC", 3, 0);
+    errno_assert (rc == 3);
+    rc = nn_recv (respondent1, buf, sizeof (buf), 0);
+    errno_assert (rc == 3);
+    rc = nn_send (respondent1, "DEF", 3, 0);
+    errno_assert (rc == 3);
+    rc = nn_recv (respondent2, buf, sizeof (buf), 0);
+    errno_assert (rc == 3);
+    rc = nn_send (respondent2, "DEF", 3, 0);
+    errno_assert (rc == 3);
+    for (i = 0; i != 2; ++i) {
+        rc = nn_recv (surveyor, buf, sizeof (buf), 0);
+        errno_assert (rc == 3);
+        nn_assert (memcmp (buf, "DEF", 3) == 0);
+    }
+
+    rc = nn_close (respondent2);
+    errno_assert (rc == 0);
+    rc = nn_close (respondent1);
+    errno_assert (rc == 0);
+    rc = nn_close (surveyor);
+    errno_assert (rc == 0);
+#endif
+
+    return 0;
+}
+
@@ -0,0 +1,145 @@
+/*
+    Copyright (c) 2013 250bpm s.r.o.
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"),
+    to deal in the Software without restriction, including without limitation
+    the rights to use, copy, modify, merge, publish, distribute, sublicense,
+    and/or sell copies of the Software, and to permit persons to whom
+    the Software is furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included
+    in all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+    THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+    FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+    IN THE SOFTWARE.
+*/
+
+#include "../src/nn.h"
+#include "../src/pubsub.h"
+#include "../src/pair.h"
+#include "../src/udpm.h"
+
+#include "../src/utils/err.c"
+#include "../src/utils/sleep.c"
+
+#include <string.h>
+
+/*  Tests UDP multicast transport. */
+
+#define SOCKET_ADDRESS "udpm://127.0.0.1;239.255.97.1:5560"
+
+int main ()
+{
+#if !defined NN_HAVE_WINDOWS
+    int rc;
+    int pub;
+    int sub1;
+    int sub2;
+    int pair;
+    int i;
+    int val;
+    size_t sz;
+    char buf [3];
+
+    /*  Only multicast group addresses are accepted. */
+    pub = nn_socket (AF_SP, NN_PUB);
+    errno_assert (pub != -1);
+    rc = nn_connect (pub, "udpm://127.0.0.1:5560");
+    nn_assert (rc < 0 && nn_errno () == EINVAL);
+    rc = nn_connect (pub, "udpm://239.255.97.1");
+    nn_assert (rc < 0 && nn_errno () == EINVAL);
+
+    /*  Only PUB and SUB sockets can use the transport. */
+    pair = nn_socket (AF_SP, NN_PAIR);
+    errno_assert (pair != -1);
+    rc = nn_connect (pair, SOCKET_ADDRESS);
+    nn_assert (rc < 0 && nn_errno () == EPROTONOSUPPORT);
+    rc = nn_close (pair);
+    errno_assert (rc == 0);
+
+    /*  Check the transport options. */
+    sz = sizeof (val);
+    rc = nn_getsockopt (pub, NN_UDPM, NN_UDPM_TTL, &val, &sz);
+    errno_assert (rc == 0);
+    nn_assert (sz == sizeof (val) && val == 1);
+    val = 256;
+    rc = nn_setsockopt (pub, NN_UDPM, NN_UDPM_TTL, &val, sizeof (val));
+    nn_assert (rc < 0 && nn_errno () == EINVAL);
+    val = 1;
+    rc = nn_setsockopt (pub, NN_UDPM, NN_UDPM_LOOP, &val, sizeof (val));
+    errno_assert (rc == 0);
+
+    /*  Two subscribers get the messages sent to the group. */
+    sub1 = nn_socket (AF_SP, NN_SUB);
+    errno_assert (sub1 != -1);
+    rc = nn_setsockopt (sub1, NN_SUB, NN_SUB_SUBSCRIBE, "", 0);
+    errno_assert (rc == 0);
+    val = 1000;
+    rc = nn_setsockopt (sub1, NN_SOL_SOCKET, NN_RCVTIMEO, &val, sizeof (val));
+    errno_assert (rc == 0);
+    rc = nn_bind (sub1, SOCKET_ADDRESS);
+    errno_assert (rc >= 0);
+    sub2 = nn_socket (AF_SP, NN_SUB);
+    errno_assert (sub2 != -1);
+    rc = nn_setsockopt (sub2, NN_SUB, NN_SUB_SUBSCRIBE, "A", 1);
+    errno_assert (rc == 0);
+    rc = nn_setsockopt (sub2, NN_SOL_SOCKET, NN_RCVTIMEO, &val, sizeof (val));
+    errno_assert (rc == 0);
+    rc = nn_connect (sub2, SOCKET_ADDRESS);
+    errno_assert (rc >= 0);
+    rc = nn_connect (pub, SOCKET_ADDRESS);
+    errno_assert (rc >= 0);
+
+    rc = nn_send (pub, "ABC", 3, 0);
+    errno_assert (rc >= 0);
+    nn_assert (rc == 3);
+
+    /*  Multicast may not be routed via the loopback interface in
+        the test environment. If the message doesn't arrive, skip the rest
+        of the test. */
+    rc = nn_recv (sub1, buf, sizeof (buf), 0);
+    if (rc >= 0) {
+        nn_assert (rc == 3 && memcmp (buf, "ABC", 3) == 0);
+        rc = nn_recv (sub2, buf, sizeof (buf), 0);
+        errno_assert (rc >= 0);
+        nn_assert (rc == 3 && memcmp (buf, "ABC", 3) == 0);
+
+        /*  The subscriber filters the messages itself. */
+        for (i = 0; i != 10; ++i) {
+            rc = nn_send (pub, i % 2 ? "AXY" : "BXY", 3, 0);
+            errno_assert (rc >= 0);
+            nn_assert (rc == 3);
+            nn_sleep (1);
+        }
+        for (i = 0; i != 10; ++i) {
+            rc = nn_recv (sub1, buf, sizeof (buf), 0);
+            errno_assert (rc >= 0);
+            nn_assert (rc == 3);
+            nn_assert (memcmp (buf, i % 2 ? "AXY" : "BXY", 3) == 0);
+        }
+        for (i = 0; i != 5; ++i) {
+            rc = nn_recv (sub2, buf, sizeof (buf), 0);
+            errno_assert (rc >= 0);
+            nn_assert (rc == 3 && memcmp (buf, "AXY", 3) == 0);
+        }
+    }
+    else
+        nn_assert (nn_errno () == EAGAIN);
+
+    rc = nn_close (pub);
+    errno_assert (rc == 0);
+    rc = nn_close (sub2);
+    errno_assert (rc == 0);
+    rc = nn_close (sub1);
+    errno_assert (rc == 0);
+#endif
+
+    return 0;
+}
+
@@ -0,0 +1,235 @@
+/*
+    Copyright (c) 2013 250bpm s.r.o.
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"),
+    to deal in the Software without restriction, including without limitation
+    the rights to use, copy, modify, merge, publish, distribute, sublicense,
+    and/or sell copies of the Software, and to permit persons to whom
+    the Software is furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included
+    in all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+    THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+    FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+    IN THE SOFTWARE.
+*/
+
+#include "../src/nn.h"
+#include "../src/pair.h"
+#include "../src/reqrep.h"
+#include "../src/ws.h"
+
+#include "../src/utils/err.c"
+#include "../src/utils/sleep.c"
+
+#include <string.h>
+
+#if !defined NN_HAVE_WINDOWS
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+#endif
+
+/*  Tests WebSocket transport. */
+
+#define SOCKET_ADDRESS "ws://127.0.0.1:5573/path"
+
+#define REQUEST "GET /path HTTP/1.1\r\n" \
+    "Host: 127.0.0.1:5573\r\n" \
+    "Upgrade: websocket\r\n" \
+    "Connection: Upgrade\r\n" \
+    "Sec-WebSocket-Key: dGhlIHNhbXBsZSBub25jZQ==\r\n" \
+    "Sec-WebSocket-Version: 13\r\n" \
+    "Sec-WebSocket-Protocol: pair.sp.nanomsg.org\r\n\r\n"
+
+int main ()
+{
+    int rc;
+    int sb;
+    int sc;
+    int i;
+    char buf [256];
+    char *data;
+#if !defined NN_HAVE_WINDOWS
+    int s;
+    size_t len;
+    struct sockaddr_in addr;
+    unsigned char frame [16];
+#endif
+
+    /*  Test the address parsing. */
+    sc = nn_socket (AF_SP, NN_PAIR);
+    errno_assert (sc != -1);
+    rc = nn_connect (sc, "ws://127.0.0.1/path");
+    nn_assert (rc < 0 && nn_errno () == EINVAL);
+    rc = nn_connect (sc, "ws://127.0.0.1:/path");
+    nn_assert (rc < 0 && nn_errno () == EINVAL);
+    rc = nn_connect (sc, "ws://eth10000;127.0.0.1:5555/path");
+    nn_assert (rc < 0 && nn_errno () == ENODEV);
+    rc = nn_close (sc);
+    errno_assert (rc == 0);
+
+    /*  Ping-pong test. Messages larger than 64kB use the 8-byte length. */
+    sb = nn_socket (AF_SP, NN_PAIR);
+    errno_assert (sb != -1);
+    rc = nn_bind (sb, SOCKET_ADDRESS);
+    errno_assert (rc >= 0);
+    sc = nn_socket (AF_SP, NN_PAIR);
+    errno_assert (sc != -1);
+    rc = nn_connect (sc, SOCKET_ADDRESS);
+    errno_assert (rc >= 0);
+
+    for (i = 0; i != 100; ++i) {
+        rc = nn_send (sc, "0123456789ABCDEFGHIJ", 20, 0);
+        errno_assert (rc == 20);
+        rc = nn_recv (sb, buf, sizeof (buf), 0);
+        errno_assert (rc == 20);
+        nn_assert (memcmp (buf, "0123456789ABCDEFGHIJ", 20) == 0);
+        rc = nn_send (sb, buf, 200, 0);
+        errno_assert (rc == 200);
+        rc = nn_recv (sc, buf, sizeof (buf), 0);
+        errno_assert (rc == 200);
+    }
+
+    data = nn_allocmsg (100000, 0);
+    alloc_assert (data);
+    for (i = 0; i != 100000; ++i)
+        data [i] = (char) i;
+    rc = nn_send (sc, &data, NN_MSG, 0);
+    errno_assert (rc == 100000);
+    rc = nn_recv (sb, &data, NN_MSG, 0);
+    errno_assert (rc == 100000);
+    for (i = 0; i != 100000; ++i)
+        nn_assert (data [i] == (char) i);
+    rc = nn_send (sb, &data, NN_MSG, 0);
+    errno_assert (rc == 100000);
+    rc = nn_recv (sc, &data, NN_MSG, 0);
+    errno_assert (rc == 100000);
+    for (i = 0; i != 100000; ++i)
+        nn_assert (data [i] == (char) i);
+    rc = nn_freemsg (data);
+    errno_assert (rc == 0);
+
+    rc = nn_close (sc);
+    errno_assert (rc == 0);
+
+    /*  The connection is refused if the path doesn't match. */
+    sc = nn_socket (AF_SP, NN_PAIR);
+    errno_assert (sc != -1);
+    rc = nn_connect (sc, "ws://127.0.0.1:5573/other");
+    errno_assert (rc >= 0);
+    nn_sleep (100);
+    rc = nn_send (sc, "ABC", 3, NN_DONTWAIT);
+    nn_assert (rc < 0 && nn_errno () == EAGAIN);
+    rc = nn_close (sc);
+    errno_assert (rc == 0);
+    rc = nn_close (sb);
+    errno_assert (rc == 0);
+
+    /*  Request/reply. The header of the request is carried in the frame
+        along with the body. */
+    sb = nn_socket (AF_SP, NN_REP);
+    errno_assert (sb != -1);
+    rc = nn_bind (sb, SOCKET_ADDRESS);
+    errno_assert (rc >= 0);
+    sc = nn_socket (AF_SP, NN_REQ);
+    errno_assert (sc != -1);
+    rc = nn_connect (sc, SOCKET_ADDRESS);
+    errno_assert (rc >= 0);
+    rc = nn_send (sc, "ABC", 3, 0);
+    errno_assert (rc == 3);
+    rc = nn_recv (sb, buf, sizeof (buf), 0);
+    errno_assert (rc == 3);
+    rc = nn_send (sb, "DEFG", 4, 0);
+    errno_assert (rc == 4);
+    rc = nn_recv (sc, buf, sizeof (buf), 0);
+    errno_assert (rc == 4);
+    nn_assert (memcmp (buf, "DEFG", 4) == 0);
+    rc = nn_close (sc);
+    errno_assert (rc == 0);
+
+    /*  The connection is refused if the protocols don't match. */
+    sc = nn_socket (AF_SP, NN_PAIR);
+    errno_assert (sc != -1);
+    rc = nn_connect (sc, SOCKET_ADDRESS);
+    errno_assert (rc >= 0);
+    nn_sleep (100);
+    rc = nn_send (sc, "ABC", 3, NN_DONTWAIT);
+    nn_assert (rc < 0 && nn_errno () == EAGAIN);
+    rc = nn_close (sc);
+    errno_assert (rc == 0);
+    rc = nn_close (sb);
+    errno_assert (rc == 0);
+
+#if !defined NN_HAVE_WINDOWS
+    /*  Talk to the socket the way a browser would, using the example
+        handshake from RFC 6455. */
+    sb = nn_socket (AF_SP, NN_PAIR);
+    errno_assert (sb != -1);
+    rc = nn_bind (sb, SOCKET_ADDRESS);
+    errno_assert (rc >= 0);
+    s = socket (AF_INET, SOCK_STREAM, 0);
+    errno_assert (s >= 0);
+    memset (&addr, 0, sizeof (addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons (5573);
+    addr.sin_addr.s_addr = inet_addr ("127.0.0.1");
+    rc = connect (s, (struct sockaddr*) &addr, sizeof (addr));
+    errno_assert (rc == 0);
+    rc = send (s, REQUEST, sizeof (REQUEST) - 1, 0);
+    errno_assert (rc == sizeof (REQUEST) - 1);
+    len = 0;
+    while (len < 4 || memcmp (buf + len - 4, "\r\n\r\n", 4) != 0) {
+        rc = recv (s, buf + len, 1, 0);
+        errno_assert (rc == 1);
+        ++len;
+        nn_assert (len < sizeof (buf));
+    }
+    buf [len] = 0;
+    nn_assert (strncmp (buf, "HTTP/1.1 101 ", 13) == 0);
+    nn_assert (strstr (buf,
+        "Sec-WebSocket-Accept: s3pPLMBiTxaQ9kYGzzhZRbK+xOo=\r\n"));
+    nn_assert (strstr (buf,
+        "Sec-WebSocket-Protocol: pair.sp.nanomsg.org\r\n"));
+
+    /*  A message split into two masked frames with a ping in between. */
+    memcpy (frame, "\x02\x82\x01\x02\x03\x04\x40\x40", 8);
+    rc = send (s, frame, 8, 0);
+    errno_assert (rc == 8);
+    memcpy (frame, "\x89\x81\x00\x00\x00\x00P", 7);
+    rc = send (s, frame, 7, 0);
+    errno_assert (rc == 7);
+    memcpy (frame, "\x80\x81\x01\x02\x03\x04\x42", 7);
+    rc = send (s, frame, 7, 0);
+    errno_assert (rc == 7);
+    rc = nn_recv (sb, buf, sizeof (buf), 0);
+    errno_assert (rc == 3);
+    nn_assert (memcmp (buf, "ABC", 3) == 0);
+
+    /*  The pong and the reply are sent unmasked. */
+    rc = nn_send (sb, "DE", 2, 0);
+    errno_assert (rc == 2);
+    len = 0;
+    while (len != 7) {
+        rc = recv (s, frame + len, 7 - len, 0);
+        errno_assert (rc > 0);
+        len += rc;
+    }
+    nn_assert (memcmp (frame, "\x8a\x01P\x82\x02" "DE", 7) == 0);
+
+    rc = close (s);
+    errno_assert (rc == 0);
+    rc = nn_close (sb);
+    errno_assert (rc == 0);
+#endif
+
+    return 0;
+}
+
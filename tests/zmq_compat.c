@@ -29,6 +29,14 @@
 
 #define SOCKET_ADDRESS "inproc://a"
 
+static int freed = 0;
+
+static void test_free (void *data, void *hint)
+{
+    nn_assert (data == hint);
+    ++freed;
+}
+
 int main ()
 {
     int rc;
@@ -39,6 +47,9 @@ int main ()
     int nn_sndbuf;
     zmq_msg_t msg1;
     zmq_msg_t msg2;
+    zmq_msg_t msg3;
+    char buf [3];
+    zmq_pollitem_t items [2];
 
     ctx = zmq_init (1);
     errno_assert (ctx);
@@ -76,6 +87,18 @@ int main ()
     rc = zmq_msg_close (&msg1);
     errno_assert (rc == 0);
 
+    /*  Poll for the message along with an OS-level file descriptor that
+        never becomes ready. */
+    items [0].socket = s1;
+    items [0].events = ZMQ_POLLIN;
+    items [1].socket = NULL;
+    items [1].fd = 0;
+    items [1].events = 0;
+    rc = zmq_poll (items, 2, 1000000);
+    errno_assert (rc >= 0);
+    nn_assert (rc == 1);
+    nn_assert (items [0].revents == ZMQ_POLLIN && items [1].revents == 0);
+
     /*  Receive a message. */
     rc = zmq_msg_init (&msg2);
     errno_assert (rc == 0);
@@ -84,6 +107,38 @@ int main ()
     nn_assert (zmq_msg_size (&msg2) == 3);
     rc = zmq_msg_close (&msg2);
     errno_assert (rc == 0);
+    rc = zmq_poll (items, 2, 1000);
+    errno_assert (rc >= 0);
+    nn_assert (rc == 0);
+
+    /*  Send a user-supplied buffer, along with a copy of it, without copying
+        the data. The buffer is released once both messages are gone. */
+    memcpy (buf, "DEF", 3);
+    rc = zmq_msg_init_data (&msg1, buf, 3, test_free, buf);
+    errno_assert (rc == 0);
+    nn_assert (zmq_msg_data (&msg1) == buf);
+    rc = zmq_msg_init (&msg3);
+    errno_assert (rc == 0);
+    rc = zmq_msg_copy (&msg3, &msg1);
+    errno_assert (rc == 0);
+    nn_assert (zmq_msg_data (&msg3) == buf);
+    nn_assert (zmq_msg_size (&msg3) == 3);
+    rc = zmq_send (s2, &msg1, 0);
+    errno_assert (rc == 0);
+    rc = zmq_msg_close (&msg1);
+    errno_assert (rc == 0);
+    rc = zmq_msg_init (&msg2);
+    errno_assert (rc == 0);
+    rc = zmq_recv (s1, &msg2, 0);
+    errno_assert (rc == 0);
+    nn_assert (zmq_msg_size (&msg2) == 3);
+    nn_assert (memcmp (zmq_msg_data (&msg2), "DEF", 3) == 0);
+    rc = zmq_msg_close (&msg2);
+    errno_assert (rc == 0);
+    nn_assert (freed == 0);
+    rc = zmq_msg_close (&msg3);
+    errno_assert (rc == 0);
+    nn_assert (freed == 1);
 
     /*  Clean up. */
     rc = zmq_close (s2);